@@ -0,0 +1,1255 @@
+/*
+ * ngxload - an HTTP/1.1 load generator for the nginx suites.
+ *
+ * Every thread runs its own epoll loop over its share of the connections.
+ * A connection keeps up to -P requests in flight (pipelining); by default
+ * it sends the next one as soon as a response is read (closed loop). With
+ * -r the requests arrive at a fixed total rate instead, spaced by an
+ * exponential distribution from the seed -S (open loop), and wait for a
+ * free connection if all are busy; their latency is counted from the
+ * arrival, so a stalled server is not hidden by the generator slowing
+ * down with it.
+ *
+ * Latencies go to a log-linear histogram of microseconds, one per thread,
+ * merged at the end. The requests of the first -w seconds are not
+ * counted. The last line of the output has the results as key=value pairs
+ * for popcorn-bench.sh.
+ *
+ * https:// URLs need a build with OpenSSL (make SSL=1, the default when
+ * its headers are found).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#ifdef NGXLOAD_SSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+#define MAX_URLS		64
+#define MAX_PIPELINE	64
+#define MAX_HEADERS		16
+#define RBUF_SIZE		(64 * 1024)
+
+/* Histogram: exact below 2 * HIST_SUB us, then HIST_SUB buckets per power
+ * of two (under 1% error); the last level ends above 2^40 us. */
+#define HIST_SUB_BITS	7
+#define HIST_SUB		(1 << HIST_SUB_BITS)
+#define HIST_LEVELS		34
+#define HIST_SIZE		(2 * HIST_SUB + HIST_LEVELS * HIST_SUB)
+
+#define NSEC			1000000000ULL
+
+/* Connection states */
+#define CONN_IDLE		0	/* Not connected */
+#define CONN_CONNECTING	1
+#define CONN_HANDSHAKE	2	/* TLS */
+#define CONN_ACTIVE		3
+
+/* Response parser states */
+#define P_STATUS		0
+#define P_HEADER		1
+#define P_BODY			2	/* Content-Length */
+#define P_BODY_EOF		3	/* Until the server closes */
+#define P_CHUNK_SIZE	4
+#define P_CHUNK_DATA	5
+#define P_CHUNK_CRLF	6
+#define P_TRAILER		7
+
+typedef struct {
+	char *path;
+	char *request;			/* The whole request */
+	size_t len;
+} url_t;
+
+typedef struct {
+	uint64_t counts[HIST_SIZE];
+	uint64_t total;
+	uint64_t max;
+	double sum, sum2;
+} hist_t;
+
+typedef struct {
+	uint64_t requests;		/* Responses counted */
+	uint64_t status[6];		/* By class, 1xx..5xx; [0] is other */
+	uint64_t bytes;			/* Response bytes, headers included */
+	uint64_t connects;
+	uint64_t err_connect, err_read, err_write, err_timeout, err_parse;
+	uint64_t dropped;		/* Open loop arrivals that did not fit */
+} stats_t;
+
+struct thread_s;
+
+typedef struct {
+	int fd;
+	int state;
+	struct thread_s *t;
+#ifdef NGXLOAD_SSL
+	SSL *ssl;
+#endif
+	unsigned url;			/* Next URL, round robin */
+
+	/* Requests sent or being sent, oldest first */
+	uint64_t start[MAX_PIPELINE];
+	unsigned head, count;
+
+	/* Output: the requests not written yet */
+	char *out;
+	size_t out_len, out_sent, out_size;
+	int want_write;
+
+	/* Input */
+	char rbuf[RBUF_SIZE];
+	size_t rpos, rlen;
+	int pstate;
+	int status;
+	int64_t remain;
+	int chunked, has_length, close_after;
+	size_t resp_bytes;
+
+	uint64_t active;		/* Last progress, for the timeout */
+	uint64_t retry_at;		/* Reconnect after an error */
+	unsigned served;		/* Responses on this connection */
+} conn_t;
+
+typedef struct thread_s {
+	pthread_t tid;
+	int id;
+	int epfd;
+	conn_t *conns;
+	int nconns;
+
+	/* Open loop */
+	double rate;			/* Arrivals per ns */
+	uint64_t next_arrival;
+	uint64_t *backlog;		/* Arrival times waiting for a connection */
+	size_t bl_head, bl_count, bl_size;
+	unsigned short xsubi[3];
+
+	hist_t hist;
+	stats_t stats;
+} thread_t;
+
+/* Options */
+static int nthreads = 2;
+static int nconns = 10;
+static double duration = 10;
+static double warmup = 0;
+static uint64_t max_requests;
+static double rate;
+static int pipeline = 1;
+static int keepalive = 1;
+static double timeout = 10;
+static long seed = 1;
+static int pin;
+static int tls;
+static int nodelay = 1;
+static const char *hist_out;
+static char *headers[MAX_HEADERS];
+static int nheaders;
+
+static url_t urls[MAX_URLS];
+static int nurls;
+static char *host, *port;
+static struct addrinfo *addr;
+
+#ifdef NGXLOAD_SSL
+static SSL_CTX *ssl_ctx;
+#endif
+
+static uint64_t t_start, t_measure, t_end;
+static volatile int stopping;
+static uint64_t issued;		/* Counted requests issued, for -n */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+/*********************************************************************
+ * Histogram
+ *********************************************************************/
+
+static unsigned hist_index(uint64_t v)
+{
+	unsigned msb, shift, idx;
+
+	if (v < 2 * HIST_SUB)
+		return v;
+	msb = 63 - __builtin_clzll(v);
+	shift = msb - HIST_SUB_BITS;
+	idx = 2 * HIST_SUB + (shift - 1) * HIST_SUB + (v >> shift) - HIST_SUB;
+	return idx < HIST_SIZE ? idx : HIST_SIZE - 1;
+}
+
+/* Middle of the range of values of bucket idx. */
+static double hist_value(unsigned idx)
+{
+	unsigned shift;
+	uint64_t low;
+
+	if (idx < 2 * HIST_SUB)
+		return idx;
+	shift = (idx - 2 * HIST_SUB) / HIST_SUB + 1;
+	low = (uint64_t)((idx - 2 * HIST_SUB) % HIST_SUB + HIST_SUB) << shift;
+	return low + ((1ULL << shift) - 1) / 2.0;
+}
+
+static void hist_record(hist_t *h, uint64_t us)
+{
+	h->counts[hist_index(us)]++;
+	h->total++;
+	if (us > h->max)
+		h->max = us;
+	h->sum += us;
+	h->sum2 += (double)us * us;
+}
+
+static void hist_merge(hist_t *to, const hist_t *from)
+{
+	int i;
+
+	for (i = 0; i < HIST_SIZE; i++)
+		to->counts[i] += from->counts[i];
+	to->total += from->total;
+	if (from->max > to->max)
+		to->max = from->max;
+	to->sum += from->sum;
+	to->sum2 += from->sum2;
+}
+
+/* Percentile p (0-100) in us. */
+static double hist_percentile(const hist_t *h, double p)
+{
+	uint64_t want, seen = 0;
+	int i;
+
+	if (h->total == 0)
+		return 0;
+	want = (uint64_t)ceil(h->total * p / 100.0);
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < HIST_SIZE; i++) {
+		seen += h->counts[i];
+		if (seen >= want) {
+			double v = hist_value(i);
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+/*********************************************************************
+ * Connections
+ *********************************************************************/
+
+static void conn_close(conn_t *c);
+static int conn_send(conn_t *c);
+
+static void conn_events(conn_t *c, int op)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | (c->want_write ? EPOLLOUT : 0);
+	ev.data.ptr = c;
+	if (epoll_ctl(c->t->epfd, op, c->fd, &ev) == -1 && op != EPOLL_CTL_DEL)
+		perror("ngxload: epoll_ctl");
+}
+
+static void conn_want_write(conn_t *c, int on)
+{
+	if (c->want_write == on)
+		return;
+	c->want_write = on;
+	conn_events(c, EPOLL_CTL_MOD);
+}
+
+static void conn_connect(conn_t *c, uint64_t now)
+{
+	int fd, one = 1;
+
+	fd = socket(addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    0);
+	if (fd == -1) {
+		c->t->stats.err_connect++;
+		c->retry_at = now + NSEC / 100;
+		return;
+	}
+	if (nodelay)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	c->fd = fd;
+	c->state = CONN_CONNECTING;
+	c->head = c->count = 0;
+	c->out_len = c->out_sent = 0;
+	c->rpos = c->rlen = 0;
+	c->pstate = P_STATUS;
+	c->served = 0;
+	c->active = now;
+	c->want_write = 1;
+	c->t->stats.connects++;
+
+	if (connect(fd, addr->ai_addr, addr->ai_addrlen) == -1
+	    && errno != EINPROGRESS) {
+		close(fd);
+		c->fd = -1;
+		c->state = CONN_IDLE;
+		c->t->stats.err_connect++;
+		c->retry_at = now + NSEC / 100;
+		return;
+	}
+	conn_events(c, EPOLL_CTL_ADD);
+}
+
+/* The requests in flight on a closed connection are given back to the
+ * backlog in open loop; in closed loop they are simply issued again. */
+static void conn_requeue(conn_t *c)
+{
+	thread_t *t = c->t;
+
+	if (rate == 0 && max_requests && c->count)
+		__atomic_sub_fetch(&issued, c->count, __ATOMIC_RELAXED);
+	if (rate > 0) {
+		while (c->count) {
+			unsigned last = (c->head + c->count - 1) % MAX_PIPELINE;
+			if (t->bl_count == t->bl_size) {
+				t->stats.dropped++;
+			} else {
+				t->bl_head = (t->bl_head + t->bl_size - 1) % t->bl_size;
+				t->backlog[t->bl_head] = c->start[last];
+				t->bl_count++;
+			}
+			c->count--;
+		}
+	}
+	c->head = c->count = 0;
+}
+
+static void conn_close(conn_t *c)
+{
+	if (c->fd == -1)
+		return;
+#ifdef NGXLOAD_SSL
+	if (c->ssl) {
+		SSL_free(c->ssl);
+		c->ssl = NULL;
+	}
+#endif
+	conn_events(c, EPOLL_CTL_DEL);
+	close(c->fd);
+	c->fd = -1;
+	c->state = CONN_IDLE;
+	c->want_write = 0;
+	c->out_len = c->out_sent = 0;
+}
+
+/* The server closed the connection after a response (Connection: close,
+ * keepalive_requests): open the next one at once. */
+static void conn_reopen(conn_t *c, uint64_t now)
+{
+	conn_requeue(c);
+	conn_close(c);
+	if (!stopping)
+		conn_connect(c, now);
+}
+
+/* An error on the connection: the request in progress is lost, the rest
+ * are requeued. */
+static void conn_error(conn_t *c, uint64_t *counter, uint64_t now)
+{
+	(*counter)++;
+	if (c->count) {
+		c->head = (c->head + 1) % MAX_PIPELINE;
+		c->count--;
+	}
+	conn_requeue(c);
+	conn_close(c);
+	c->retry_at = now + NSEC / 100;
+}
+
+static int conn_io_read(conn_t *c, char *buf, size_t size)
+{
+#ifdef NGXLOAD_SSL
+	if (c->ssl) {
+		int n = SSL_read(c->ssl, buf, size);
+		if (n > 0)
+			return n;
+		switch (SSL_get_error(c->ssl, n)) {
+		case SSL_ERROR_WANT_READ:
+			errno = EAGAIN;
+			return -1;
+		case SSL_ERROR_WANT_WRITE:
+			conn_want_write(c, 1);
+			errno = EAGAIN;
+			return -1;
+		case SSL_ERROR_ZERO_RETURN:
+			return 0;
+		case SSL_ERROR_SYSCALL:
+			if (ERR_peek_error() == 0 && n == 0)
+				return 0;	/* Closed without close_notify */
+			errno = EIO;
+			return -1;
+		default:
+			errno = EIO;
+			return -1;
+		}
+	}
+#endif
+	return recv(c->fd, buf, size, 0);
+}
+
+static int conn_io_write(conn_t *c, const char *buf, size_t size)
+{
+#ifdef NGXLOAD_SSL
+	if (c->ssl) {
+		int n = SSL_write(c->ssl, buf, size);
+		if (n > 0)
+			return n;
+		switch (SSL_get_error(c->ssl, n)) {
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			errno = EAGAIN;
+			return -1;
+		default:
+			errno = EIO;
+			return -1;
+		}
+	}
+#endif
+	return send(c->fd, buf, size, MSG_NOSIGNAL);
+}
+
+/* Append the next request, started at start, to the output. */
+static int conn_queue(conn_t *c, uint64_t start)
+{
+	url_t *u = &urls[c->url++ % nurls];
+
+	if (c->out_len + u->len > c->out_size) {
+		size_t size = c->out_size ? c->out_size : 4096;
+		char *out;
+
+		while (size < c->out_len + u->len)
+			size *= 2;
+		out = realloc(c->out, size);
+		if (out == NULL)
+			return -1;
+		c->out = out;
+		c->out_size = size;
+	}
+	memcpy(c->out + c->out_len, u->request, u->len);
+	c->out_len += u->len;
+	c->start[(c->head + c->count) % MAX_PIPELINE] = start;
+	c->count++;
+	return 0;
+}
+
+/* Whether one more request may be issued in closed loop. */
+static int may_issue(void)
+{
+	if (stopping)
+		return 0;
+	if (max_requests == 0)
+		return 1;
+	if (__atomic_add_fetch(&issued, 1, __ATOMIC_RELAXED) <= max_requests)
+		return 1;
+	__atomic_sub_fetch(&issued, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Fill the pipeline of an active connection. */
+static void conn_fill(conn_t *c, uint64_t now)
+{
+	thread_t *t = c->t;
+	int limit = keepalive ? pipeline : 1;
+	int queued = 0;
+
+	if (c->state != CONN_ACTIVE || (!keepalive && c->served))
+		return;
+
+	while ((int)c->count < limit) {
+		if (rate > 0) {
+			if (t->bl_count == 0)
+				break;
+			if (conn_queue(c, t->backlog[t->bl_head]) == -1)
+				break;
+			t->bl_head = (t->bl_head + 1) % t->bl_size;
+			t->bl_count--;
+		} else {
+			if (!may_issue())
+				break;
+			if (conn_queue(c, now) == -1)
+				break;
+		}
+		queued = 1;
+	}
+	if (queued)
+		conn_send(c);
+}
+
+static int conn_send(conn_t *c)
+{
+	uint64_t now;
+	int n;
+
+	while (c->out_sent < c->out_len) {
+		n = conn_io_write(c, c->out + c->out_sent, c->out_len - c->out_sent);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EINTR) {
+				conn_want_write(c, 1);
+				return 0;
+			}
+			now = now_ns();
+			conn_error(c, &c->t->stats.err_write, now);
+			return -1;
+		}
+		c->out_sent += n;
+	}
+	c->out_len = c->out_sent = 0;
+	conn_want_write(c, 0);
+	return 0;
+}
+
+/* A response is complete. */
+static void conn_done(conn_t *c, uint64_t now)
+{
+	thread_t *t = c->t;
+	uint64_t start = c->start[c->head];
+
+	c->head = (c->head + 1) % MAX_PIPELINE;
+	c->count--;
+	c->served++;
+	c->active = now;
+
+	if (start >= t_measure && now <= t_end) {
+		int cls = c->status / 100;
+		t->stats.requests++;
+		t->stats.status[cls >= 1 && cls <= 5 ? cls : 0]++;
+		t->stats.bytes += c->resp_bytes;
+		hist_record(&t->hist, (now - start) / 1000);
+	}
+	c->pstate = P_STATUS;
+	c->resp_bytes = 0;
+}
+
+/* Parse the input; returns -1 on a parse error, 1 when the connection
+ * is to be closed after the response. */
+static int conn_parse(conn_t *c, uint64_t now)
+{
+	char *p, *end, *eol;
+	size_t n;
+
+	for (;;) {
+		p = c->rbuf + c->rpos;
+		end = c->rbuf + c->rlen;
+
+		switch (c->pstate) {
+		case P_STATUS:
+		case P_HEADER:
+		case P_CHUNK_SIZE:
+		case P_CHUNK_CRLF:
+		case P_TRAILER:
+			if (p == end)
+				return 0;
+			eol = memchr(p, '\n', end - p);
+			if (eol == NULL) {
+				if (c->rpos == 0 && c->rlen == RBUF_SIZE)
+					return -1;	/* Line too long */
+				return 0;
+			}
+			n = eol + 1 - p;
+			c->rpos += n;
+			c->resp_bytes += n;
+			if (eol > p && eol[-1] == '\r')
+				eol--;
+			*eol = '\0';
+			break;
+		default:
+			break;
+		}
+
+		switch (c->pstate) {
+		case P_STATUS:
+			if (c->count == 0)
+				return -1;	/* Nothing was asked */
+			if (strncmp(p, "HTTP/1.", 7) != 0 || strlen(p) < 12)
+				return -1;
+			c->status = atoi(p + 9);
+			c->chunked = c->has_length = 0;
+			c->close_after = (p[7] == '0' || !keepalive);
+			c->remain = 0;
+			c->pstate = P_HEADER;
+			break;
+
+		case P_HEADER:
+			if (*p == '\0') {
+				if (c->status / 100 == 1) {
+					c->pstate = P_STATUS;	/* 100 Continue */
+				} else if (c->status == 204 || c->status == 304) {
+					conn_done(c, now);
+					if (c->close_after)
+						return 1;
+				} else if (c->chunked) {
+					c->pstate = P_CHUNK_SIZE;
+				} else if (c->has_length) {
+					c->pstate = P_BODY;
+				} else {
+					c->pstate = P_BODY_EOF;
+					c->close_after = 1;
+				}
+				break;
+			}
+			if (strncasecmp(p, "Content-Length:", 15) == 0) {
+				c->remain = strtoll(p + 15, NULL, 10);
+				c->has_length = 1;
+			} else if (strncasecmp(p, "Transfer-Encoding:", 18) == 0) {
+				c->chunked = strcasestr(p + 18, "chunked") != NULL;
+			} else if (strncasecmp(p, "Connection:", 11) == 0) {
+				if (strcasestr(p + 11, "close"))
+					c->close_after = 1;
+				else if (keepalive && strcasestr(p + 11, "keep-alive"))
+					c->close_after = 0;
+			}
+			break;
+
+		case P_BODY:
+		case P_CHUNK_DATA:
+			n = end - p;
+			if ((int64_t)n > c->remain)
+				n = c->remain;
+			c->rpos += n;
+			c->resp_bytes += n;
+			c->remain -= n;
+			if (c->remain > 0)
+				return 0;
+			if (c->pstate == P_CHUNK_DATA) {
+				c->pstate = P_CHUNK_CRLF;
+				break;
+			}
+			conn_done(c, now);
+			if (c->close_after)
+				return 1;
+			break;
+
+		case P_BODY_EOF:
+			c->resp_bytes += end - p;
+			c->rpos = c->rlen;
+			return 0;
+
+		case P_CHUNK_SIZE:
+			c->remain = strtoll(p, NULL, 16);
+			if (c->remain < 0)
+				return -1;
+			c->pstate = c->remain ? P_CHUNK_DATA : P_TRAILER;
+			break;
+
+		case P_CHUNK_CRLF:
+			if (*p != '\0')
+				return -1;
+			c->pstate = P_CHUNK_SIZE;
+			break;
+
+		case P_TRAILER:
+			if (*p != '\0')
+				break;
+			conn_done(c, now);
+			if (c->close_after)
+				return 1;
+			break;
+		}
+	}
+}
+
+static void conn_read(conn_t *c, uint64_t now)
+{
+	int n, rc;
+
+	for (;;) {
+		if (c->rpos == c->rlen) {
+			c->rpos = c->rlen = 0;
+		} else if (c->rlen == RBUF_SIZE && c->rpos > 0) {
+			memmove(c->rbuf, c->rbuf + c->rpos, c->rlen - c->rpos);
+			c->rlen -= c->rpos;
+			c->rpos = 0;
+		}
+
+		n = conn_io_read(c, c->rbuf + c->rlen, RBUF_SIZE - c->rlen);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			conn_error(c, &c->t->stats.err_read, now);
+			return;
+		}
+		if (n == 0) {
+			if (c->pstate == P_BODY_EOF) {
+				conn_done(c, now);
+				conn_reopen(c, now);
+			} else if (c->pstate == P_STATUS && c->rpos == c->rlen) {
+				/* Closed between the responses */
+				conn_reopen(c, now);
+			} else {
+				conn_error(c, &c->t->stats.err_read, now);
+			}
+			return;
+		}
+		c->rlen += n;
+		c->active = now;
+
+		rc = conn_parse(c, now);
+		if (rc == -1) {
+			conn_error(c, &c->t->stats.err_parse, now);
+			return;
+		}
+		if (rc == 1) {
+			conn_reopen(c, now);
+			return;
+		}
+	}
+	conn_fill(c, now);
+}
+
+static void conn_connected(conn_t *c, uint64_t now)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err) {
+		conn_close(c);
+		c->t->stats.err_connect++;
+		c->retry_at = now + NSEC / 100;
+		return;
+	}
+
+#ifdef NGXLOAD_SSL
+	if (tls) {
+		c->ssl = SSL_new(ssl_ctx);
+		if (c->ssl == NULL || SSL_set_fd(c->ssl, c->fd) != 1) {
+			conn_close(c);
+			c->t->stats.err_connect++;
+			c->retry_at = now + NSEC / 100;
+			return;
+		}
+		SSL_set_tlsext_host_name(c->ssl, host);
+		SSL_set_connect_state(c->ssl);
+		c->state = CONN_HANDSHAKE;
+		return;
+	}
+#endif
+	c->state = CONN_ACTIVE;
+	conn_want_write(c, 0);
+	conn_fill(c, now);
+}
+
+#ifdef NGXLOAD_SSL
+static void conn_handshake(conn_t *c, uint64_t now)
+{
+	int n = SSL_do_handshake(c->ssl);
+
+	if (n == 1) {
+		c->state = CONN_ACTIVE;
+		c->active = now;
+		conn_want_write(c, 0);
+		conn_fill(c, now);
+		return;
+	}
+	switch (SSL_get_error(c->ssl, n)) {
+	case SSL_ERROR_WANT_READ:
+		conn_want_write(c, 0);
+		break;
+	case SSL_ERROR_WANT_WRITE:
+		conn_want_write(c, 1);
+		break;
+	default:
+		conn_close(c);
+		c->t->stats.err_connect++;
+		c->retry_at = now + NSEC / 100;
+	}
+}
+#endif
+
+static void conn_event(conn_t *c, uint32_t events, uint64_t now)
+{
+	switch (c->state) {
+	case CONN_CONNECTING:
+		conn_connected(c, now);
+		return;
+#ifdef NGXLOAD_SSL
+	case CONN_HANDSHAKE:
+		conn_handshake(c, now);
+		return;
+#endif
+	case CONN_ACTIVE:
+		if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+			conn_read(c, now);
+			if (c->state != CONN_ACTIVE)
+				return;
+		}
+		if (events & EPOLLOUT)
+			conn_send(c);
+		return;
+	}
+}
+
+/*********************************************************************
+ * Threads
+ *********************************************************************/
+
+/* Exponential inter-arrival time in ns. */
+static uint64_t next_gap(thread_t *t)
+{
+	double u = erand48(t->xsubi);
+
+	return (uint64_t)(-log(1.0 - u) / t->rate);
+}
+
+static void thread_arrivals(thread_t *t, uint64_t now)
+{
+	while (t->next_arrival <= now && t->next_arrival < t_end) {
+		if (max_requests
+		    && __atomic_add_fetch(&issued, 1, __ATOMIC_RELAXED) > max_requests) {
+			t->next_arrival = UINT64_MAX;
+			break;
+		}
+		if (t->bl_count == t->bl_size) {
+			t->stats.dropped++;
+		} else {
+			t->backlog[(t->bl_head + t->bl_count) % t->bl_size] =
+				t->next_arrival;
+			t->bl_count++;
+		}
+		t->next_arrival += next_gap(t);
+	}
+}
+
+/* With -n, whether every request of the thread has been answered. */
+static int thread_done(thread_t *t)
+{
+	int i;
+
+	if (max_requests == 0 || __atomic_load_n(&issued, __ATOMIC_RELAXED)
+	    < max_requests || t->bl_count)
+		return 0;
+	for (i = 0; i < t->nconns; i++)
+		if (t->conns[i].count)
+			return 0;
+	return 1;
+}
+
+static void thread_timers(thread_t *t, uint64_t now)
+{
+	uint64_t limit = (uint64_t)(timeout * NSEC);
+	int i;
+
+	for (i = 0; i < t->nconns; i++) {
+		conn_t *c = &t->conns[i];
+
+		if (c->state == CONN_IDLE) {
+			if (!stopping && now >= c->retry_at)
+				conn_connect(c, now);
+			continue;
+		}
+		if ((c->count || c->state != CONN_ACTIVE)
+		    && now - c->active > limit) {
+			conn_error(c, &t->stats.err_timeout, now);
+		} else if (c->state == CONN_ACTIVE && c->count == 0) {
+			conn_fill(c, now);
+		}
+	}
+}
+
+static void *thread_main(void *arg)
+{
+	thread_t *t = arg;
+	struct epoll_event events[256];
+	uint64_t now, last_timers = 0;
+	int i, n, wait_ms;
+
+	if (pin) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(t->id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+		sched_setaffinity(0, sizeof(set), &set);
+	}
+
+	now = now_ns();
+	for (i = 0; i < t->nconns; i++)
+		conn_connect(&t->conns[i], now);
+
+	for (;;) {
+		now = now_ns();
+		if (now >= t_end)
+			stopping = 1;
+		if (stopping || thread_done(t))
+			break;
+
+		if (rate > 0)
+			thread_arrivals(t, now);
+
+		if (now - last_timers >= NSEC / 100) {
+			thread_timers(t, now);
+			last_timers = now;
+		} else if (rate > 0 && t->bl_count) {
+			for (i = 0; i < t->nconns && t->bl_count; i++)
+				conn_fill(&t->conns[i], now);
+		}
+
+		wait_ms = 10;
+		if (rate > 0 && t->next_arrival > now
+		    && t->next_arrival - now < 10 * NSEC / 1000)
+			wait_ms = (t->next_arrival - now) / 1000000;
+
+		n = epoll_wait(t->epfd, events, 256, wait_ms);
+		now = now_ns();
+		for (i = 0; i < n; i++)
+			conn_event(events[i].data.ptr, events[i].events, now);
+	}
+
+	for (i = 0; i < t->nconns; i++)
+		conn_close(&t->conns[i]);
+	return NULL;
+}
+
+/*********************************************************************
+ * Setup and report
+ *********************************************************************/
+
+/* Split http[s]://host[:port]/path; every URL must have the same host. */
+static int parse_url(const char *s, url_t *u)
+{
+	const char *p, *slash;
+	char *h, *pt;
+	int https = 0, i;
+	size_t len;
+
+	if (strncmp(s, "http://", 7) == 0) {
+		p = s + 7;
+	} else if (strncmp(s, "https://", 8) == 0) {
+		p = s + 8;
+		https = 1;
+	} else {
+		return -1;
+	}
+	slash = strchr(p, '/');
+	if (slash == NULL)
+		slash = p + strlen(p);
+	h = strndup(p, slash - p);
+	pt = strrchr(h, ':');
+	if (pt && strchr(pt, ']') == NULL) {
+		*pt++ = '\0';
+		pt = strdup(pt);
+	} else {
+		pt = strdup(https ? "443" : "80");
+	}
+	if (h[0] == '[') {
+		memmove(h, h + 1, strlen(h));
+		h[strlen(h) - 1] = '\0';
+	}
+
+	if (host == NULL) {
+		host = h;
+		port = pt;
+		tls = https;
+	} else if (strcmp(host, h) != 0 || strcmp(port, pt) != 0
+		   || tls != https) {
+		fprintf(stderr, "ngxload: all URLs must be on %s://%s:%s\n",
+			tls ? "https" : "http", host, port);
+		return -1;
+	}
+
+	u->path = strdup(*slash ? slash : "/");
+
+	len = strlen(u->path) + strlen(host) + strlen(port) + 128;
+	for (i = 0; i < nheaders; i++)
+		len += strlen(headers[i]) + 2;
+	u->request = malloc(len);
+	u->len = snprintf(u->request, len,
+			  "GET %s HTTP/1.1\r\nHost: %s%s%s\r\n"
+			  "User-Agent: ngxload\r\n%s",
+			  u->path, host,
+			  strcmp(port, https ? "443" : "80") ? ":" : "",
+			  strcmp(port, https ? "443" : "80") ? port : "",
+			  keepalive ? "" : "Connection: close\r\n");
+	for (i = 0; i < nheaders; i++)
+		u->len += snprintf(u->request + u->len, len - u->len, "%s\r\n",
+				   headers[i]);
+	u->len += snprintf(u->request + u->len, len - u->len, "\r\n");
+	return 0;
+}
+
+static double parse_time(const char *s)
+{
+	char *end;
+	double v = strtod(s, &end);
+
+	if (*end == 'm' && end[1] == 's')
+		return v / 1000;
+	if (*end == 'm')
+		return v * 60;
+	return v;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"Usage: ngxload [options] <url> [<url> ...]\n"
+"  -t <n>     threads, default %d\n"
+"  -c <n>     connections, default %d\n"
+"  -d <time>  duration after the warmup, default %gs (ms, s, m)\n"
+"  -w <time>  warmup, not counted, default %gs\n"
+"  -n <n>     stop after n requests, the warmup included\n"
+"  -r <rps>   open loop: total arrival rate, default closed loop\n"
+"  -S <seed>  seed of the open loop arrivals, default %ld\n"
+"  -P <n>     requests in flight per connection (pipelining), default %d\n"
+"  -C         a new connection per request (Connection: close)\n"
+"  -H <line>  extra request header\n"
+"  -T <time>  request timeout, default %gs\n"
+"  -a         pin thread i to CPU i\n"
+"  -N         do not set TCP_NODELAY\n"
+"  -L <file>  write the latency histogram to file\n"
+"The URLs, all on the same host, are requested in turn on each connection.\n",
+		nthreads, nconns, duration, warmup, seed, pipeline, timeout);
+	exit(1);
+}
+
+static void write_histogram(const hist_t *h, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	uint64_t seen = 0;
+	int i;
+
+	if (f == NULL) {
+		perror(path);
+		return;
+	}
+	fprintf(f, "# latency_us\tcount\tpercentile\n");
+	for (i = 0; i < HIST_SIZE; i++) {
+		if (h->counts[i] == 0)
+			continue;
+		seen += h->counts[i];
+		fprintf(f, "%.1f\t%llu\t%.6f\n", hist_value(i),
+			(unsigned long long)h->counts[i],
+			100.0 * seen / h->total);
+	}
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	thread_t *threads;
+	hist_t *hist;
+	stats_t total;
+	double secs, mean, sd, p50, p90, p99, p999, p9999;
+	struct addrinfo hints;
+	uint64_t errors;
+	int opt, i, j, k, rc;
+
+	while ((opt = getopt(argc, argv, "t:c:d:w:n:r:S:P:CH:T:aNL:h")) != -1) {
+		switch (opt) {
+		case 't': nthreads = atoi(optarg); break;
+		case 'c': nconns = atoi(optarg); break;
+		case 'd': duration = parse_time(optarg); break;
+		case 'w': warmup = parse_time(optarg); break;
+		case 'n': max_requests = strtoull(optarg, NULL, 10); break;
+		case 'r': rate = atof(optarg); break;
+		case 'S': seed = atol(optarg); break;
+		case 'P': pipeline = atoi(optarg); break;
+		case 'C': keepalive = 0; break;
+		case 'H':
+			if (nheaders == MAX_HEADERS)
+				usage();
+			headers[nheaders++] = optarg;
+			break;
+		case 'T': timeout = parse_time(optarg); break;
+		case 'a': pin = 1; break;
+		case 'N': nodelay = 0; break;
+		case 'L': hist_out = optarg; break;
+		default: usage();
+		}
+	}
+	if (optind == argc || argc - optind > MAX_URLS || nthreads < 1
+	    || nconns < 1 || pipeline < 1 || pipeline > MAX_PIPELINE
+	    || duration <= 0 || rate < 0)
+		usage();
+	if (nthreads > nconns)
+		nthreads = nconns;
+
+	for (i = optind; i < argc; i++) {
+		if (parse_url(argv[i], &urls[nurls++]) == -1) {
+			fprintf(stderr, "ngxload: invalid URL %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+#ifdef NGXLOAD_SSL
+	if (tls) {
+		SSL_library_init();
+		SSL_load_error_strings();
+		ssl_ctx = SSL_CTX_new(SSLv23_client_method());
+		if (ssl_ctx == NULL) {
+			ERR_print_errors_fp(stderr);
+			return 1;
+		}
+		SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+		SSL_CTX_set_options(ssl_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+	}
+#else
+	if (tls) {
+		fprintf(stderr, "ngxload: built without OpenSSL, no https\n");
+		return 1;
+	}
+#endif
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	rc = getaddrinfo(host, port, &hints, &addr);
+	if (rc) {
+		fprintf(stderr, "ngxload: %s: %s\n", host, gai_strerror(rc));
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	threads = calloc(nthreads, sizeof(thread_t));
+	hist = calloc(1, sizeof(hist_t));
+	if (threads == NULL || hist == NULL) {
+		perror("ngxload");
+		return 1;
+	}
+
+	t_start = now_ns();
+	t_measure = t_start + (uint64_t)(warmup * NSEC);
+	t_end = t_measure + (uint64_t)(duration * NSEC);
+
+	for (i = 0, k = 0; i < nthreads; i++) {
+		thread_t *t = &threads[i];
+
+		t->id = i;
+		t->nconns = nconns / nthreads + (i < nconns % nthreads);
+		t->conns = calloc(t->nconns, sizeof(conn_t));
+		t->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (t->conns == NULL || t->epfd == -1) {
+			perror("ngxload");
+			return 1;
+		}
+		for (j = 0; j < t->nconns; j++, k++) {
+			t->conns[j].fd = -1;
+			t->conns[j].t = t;
+			t->conns[j].url = k;	/* Spread the URLs */
+		}
+		if (rate > 0) {
+			t->rate = rate / nthreads / NSEC;
+			t->xsubi[0] = 0x330e;
+			t->xsubi[1] = (unsigned short)(seed + i);
+			t->xsubi[2] = (unsigned short)((seed + i) >> 16);
+			t->bl_size = (size_t)(rate / nthreads * timeout) + 1024;
+			t->backlog = malloc(t->bl_size * sizeof(uint64_t));
+			if (t->backlog == NULL) {
+				perror("ngxload");
+				return 1;
+			}
+			t->next_arrival = t_start + next_gap(t);
+		}
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&threads[i].tid, NULL, thread_main, &threads[i]);
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nthreads; i++) {
+		stats_t *s = &threads[i].stats;
+
+		pthread_join(threads[i].tid, NULL);
+		hist_merge(hist, &threads[i].hist);
+		total.requests += s->requests;
+		for (j = 0; j < 6; j++)
+			total.status[j] += s->status[j];
+		total.bytes += s->bytes;
+		total.connects += s->connects;
+		total.err_connect += s->err_connect;
+		total.err_read += s->err_read;
+		total.err_write += s->err_write;
+		total.err_timeout += s->err_timeout;
+		total.err_parse += s->err_parse;
+		total.dropped += s->dropped;
+	}
+
+	secs = (double)(now_ns() < t_end ? now_ns() - t_measure
+		: t_end - t_measure) / NSEC;
+	mean = hist->total ? hist->sum / hist->total : 0;
+	sd = hist->total ? sqrt(hist->sum2 / hist->total - mean * mean) : 0;
+	p50 = hist_percentile(hist, 50) / 1000;
+	p90 = hist_percentile(hist, 90) / 1000;
+	p99 = hist_percentile(hist, 99) / 1000;
+	p999 = hist_percentile(hist, 99.9) / 1000;
+	p9999 = hist_percentile(hist, 99.99) / 1000;
+	errors = total.err_connect + total.err_read + total.err_write
+		+ total.err_timeout + total.err_parse;
+
+	printf("ngxload: %s://%s:%s, %d url(s), %d thread(s), %d connection(s),"
+	       " %s, pipeline %d, ",
+	       tls ? "https" : "http", host, port, nurls, nthreads, nconns,
+	       keepalive ? "keepalive" : "close", keepalive ? pipeline : 1);
+	if (rate > 0)
+		printf("open loop %.0f req/s seed %ld\n", rate, seed);
+	else
+		printf("closed loop\n");
+	printf("  %.2fs after %.2fs warmup, %llu requests, %llu connections\n",
+	       secs, warmup, (unsigned long long)total.requests,
+	       (unsigned long long)total.connects);
+	printf("  status 2xx %llu 3xx %llu 4xx %llu 5xx %llu other %llu\n",
+	       (unsigned long long)total.status[2],
+	       (unsigned long long)total.status[3],
+	       (unsigned long long)total.status[4],
+	       (unsigned long long)total.status[5],
+	       (unsigned long long)(total.status[0] + total.status[1]));
+	printf("  errors connect %llu read %llu write %llu timeout %llu"
+	       " parse %llu, dropped %llu\n",
+	       (unsigned long long)total.err_connect,
+	       (unsigned long long)total.err_read,
+	       (unsigned long long)total.err_write,
+	       (unsigned long long)total.err_timeout,
+	       (unsigned long long)total.err_parse,
+	       (unsigned long long)total.dropped);
+	printf("  throughput %.2f req/s, %.2f MB/s\n",
+	       total.requests / secs, total.bytes / secs / 1e6);
+	printf("  latency ms  mean %.3f  sd %.3f  p50 %.3f  p90 %.3f  p99 %.3f"
+	       "  p99.9 %.3f  p99.99 %.3f  max %.3f\n",
+	       mean / 1000, sd / 1000, p50, p90, p99, p999, p9999,
+	       hist->max / 1000.0);
+	printf("result requests=%llu seconds=%.3f rps=%.2f mbps=%.2f"
+	       " p50_ms=%.3f p90_ms=%.3f p99_ms=%.3f p999_ms=%.3f max_ms=%.3f"
+	       " errors=%llu non2xx=%llu\n",
+	       (unsigned long long)total.requests, secs, total.requests / secs,
+	       total.bytes / secs / 1e6, p50, p90, p99, p999, hist->max / 1000.0,
+	       (unsigned long long)errors,
+	       (unsigned long long)(total.requests - total.status[2]));
+
+	if (hist_out)
+		write_histogram(hist, hist_out);
+
+	return errors && total.requests == 0 ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+#!/bin/bash
+#
+# popcorn-advise.sh - place the migration points from the region profiles.
+#
+# The migration points of the suites were placed by hand: every NPB kernel
+# call, the whole kmeans thread loop, the redis time events and the nginx
+# event loop are offloaded whenever a node is available. This reads the
+# popcorn_profile.h tables that popcorn-bench.sh -p leaves in
+# <results>/log/<tag>.profile and decides, for each region of each
+# benchmark, whether offloading it pays:
+#
+#   home     time of the region on the home node, in the local run (the
+#            migration points are still crossed there, see
+#            POPCORN_PROFILE_ENTER() in popcorn_profile.h; for redis and
+#            nginx, whose local variant turns the policy off, the "home"
+#            variant has the policy on and POPCORN_MIGRATE=off)
+#   remote   time of the region on the other nodes in the migrate run, plus
+#            its migrations there and back
+#   pages    faults taken by the region on the other nodes, the pages it
+#            pulled over
+#   drag     the growth of the time outside of any region (region 0)
+#            between the local and the migrate run, the pages the home node
+#            pulls back, charged to the offloaded regions by their pages;
+#            with a cost model (-k, or <results>/popcorn.cost when
+#            popcorn-bench.sh ran the micro suite), the pages of the region
+#            times the measured cost of taking back a page the other node
+#            wrote (fault_back in popcorn_cost.h), the working set closest
+#            to the region's
+#
+# A region is offloaded when home - remote - drag is more than the margin
+# (-m, 5% of home by default), to the node it spent most of its time on,
+# and kept home otherwise. Each benchmark gets <advice>/<group>.sched, a
+# popcorn_schedule.h file with one "<region> * <node>" line per region,
+# which popcorn_nodes.h applies at the hand-placed points; popcorn-bench.sh
+# -a <advice> runs it as the "advised" variant. -c then compares the three
+# placements from results.csv.
+#
+#   ./bench/popcorn-bench.sh -b -p -o results/profile
+#   ./bench/popcorn-advise.sh results/profile
+#   ./bench/popcorn-bench.sh -a results/profile/advice -o results/profile
+#   ./bench/popcorn-advise.sh -c results/profile
+
+MARGIN=5
+ADVICE=
+COMPARE=0
+COST=
+PAGE_SIZE=4096
+
+usage() {
+	cat <<EOF
+Usage: $0 [-m <margin>] [-o <advice dir>] [-k <cost model>] <results dir>
+       $0 -c <results dir>
+  -m  minimum gain to offload a region, percent of its home time, default $MARGIN
+  -o  where to write the schedules, default <results dir>/advice
+  -k  popcornmicro cost model, default <results dir>/popcorn.cost if any
+  -c  compare the local, migrate and advised variants of results.csv
+EOF
+	exit 1
+}
+
+while getopts "m:o:k:ch" opt; do
+	case $opt in
+	m) MARGIN=$OPTARG ;;
+	o) ADVICE=$OPTARG ;;
+	k) COST=$OPTARG ;;
+	c) COMPARE=1 ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 1 ] && [ -d "$1" ] || usage
+OUT=$1
+
+# Mean of each variant per benchmark and input, and the advised placement
+# against the hand-placed one. Throughputs in req/s are better higher, the
+# rest compares seconds.
+compare() {
+	[ -f "$OUT/results.csv" ] || {
+		echo "$0: no $OUT/results.csv" >&2
+		exit 1
+	}
+	awk -F, 'NR == 1 || $6 != "ok" { next }
+	{
+		key = $1 "," $2 "," $3;
+		v = $9 == "req/s" ? $8 : $7;
+		if (v == "") next;
+		if (!(key in unit)) order[n++] = key;
+		unit[key] = $9 == "req/s" ? "req/s" : "s";
+		sum[key, $4] += v;
+		cnt[key, $4]++;
+	}
+	function mean(k, var) {
+		return cnt[k, var] ? sum[k, var] / cnt[k, var] : "";
+	}
+	function speedup(k, a, b,    x, y) {
+		x = mean(k, a); y = mean(k, b);
+		if (x == "" || y == "" || x == 0 || y == 0) return "-";
+		return sprintf("%.2fx", unit[k] == "s" ? y / x : x / y);
+	}
+	END {
+		printf "%-40s %10s %10s %10s %6s %9s %9s\n", "benchmark", "local",
+			"migrate", "advised", "unit", "vs hand", "vs local";
+		for (i = 0; i < n; i++) {
+			k = order[i];
+			if (!cnt[k, "advised"]) continue;
+			split(k, f, ",");
+			printf "%-40s %10s %10s %10s %6s %9s %9s\n",
+				substr(f[1] "/" f[2] "/" f[3], 1, 40),
+				mean(k, "local"), mean(k, "migrate"), mean(k, "advised"),
+				unit[k], speedup(k, "advised", "migrate"),
+				speedup(k, "advised", "local");
+		}
+	}' "$OUT/results.csv"
+}
+
+if [ $COMPARE -eq 1 ]; then
+	compare
+	exit
+fi
+
+[ -n "$ADVICE" ] || ADVICE=$OUT/advice
+if [ -z "$COST" ] && [ -f "$OUT/popcorn.cost" ]; then
+	COST=$OUT/popcorn.cost
+fi
+if [ -n "$COST" ] && [ ! -f "$COST" ]; then
+	echo "$0: no cost model $COST" >&2
+	exit 1
+fi
+mkdir -p "$ADVICE" || exit 1
+set -- "$OUT"/log/*.profile
+[ -f "$1" ] || {
+	echo "$0: no profiles in $OUT/log, run popcorn-bench.sh with -p" >&2
+	exit 1
+}
+
+# Tags are <suite>-...-<variant>-...-<run>: the group is the tag without
+# the variant and the run, the one schedule serves all the runs.
+awk -F'\t' -v margin="$MARGIN" -v advice="$ADVICE" -v cost="$COST" \
+	-v page="$PAGE_SIZE" '
+BEGIN {
+	# fault_back lines of the cost model: bytes, mean_ns.
+	while (cost != "" && (getline line < cost) > 0) {
+		split(line, cl, "\t");
+		if (cl[1] != "fault_back") continue;
+		nback++;
+		back_bytes[nback] = cl[3];
+		back_ns[nback] = cl[6];
+	}
+}
+FNR == 1 {
+	tag = FILENAME;
+	sub(/.*\//, "", tag);
+	sub(/\.profile$/, "", tag);
+	nf = split(tag, f, "-");
+	group = ""; var = "";
+	for (i = 1; i < nf; i++) {
+		if (var == "" && f[i] ~ /^(migrate|local|home|remote|advised)$/) {
+			var = f[i];
+			continue;
+		}
+		group = group (group == "" ? "" : "-") f[i];
+	}
+	if (var == "home" || var == "local" || var == "migrate" || var == "remote") {
+		if (!(group in seen)) groups[ng++] = group;
+		seen[group] = 1;
+		runs[group, var]++;
+	}
+}
+/^#/ || $1 == "region" || var == "" || var == "advised" { next }
+{
+	r = $1; nid = $2;
+	region[group, r] = 1;
+	if (nid == 0) {
+		home[group, var, r] += $7;
+	} else {
+		remote[group, var, r] += $7;
+		pages[group, var, r] += $8;
+		on[group, var, r, nid] += $7;
+		if (nid > maxnid) maxnid = nid;
+	}
+	migr[group, var, r] += $5;
+}
+function ms(ns) { return sprintf("%.1f", ns / 1e6); }
+# Cost of taking back a page, in the working set closest to <pages> pages.
+function page_ns(pages,    i, d, best, bd) {
+	for (i = 1; i <= nback; i++) {
+		d = back_bytes[i] - pages * page;
+		if (d < 0) d = -d;
+		if (!best || d < bd) { best = i; bd = d; }
+	}
+	return back_ns[best];
+}
+END {
+	printf "%-28s %6s %10s %10s %8s %10s %10s  %s\n", "benchmark", "region",
+		"home_ms", "remote_ms", "pages", "drag_ms", "gain_ms", "placement";
+	for (g = 0; g < ng; g++) {
+		group = groups[g];
+		hv = runs[group, "home"] ? "home" : "local";
+		mv = runs[group, "migrate"] ? "migrate" : "remote";
+		if (!runs[group, hv] || !runs[group, mv]) {
+			printf "%-28s %6s %10s %10s %8s %10s %10s  %s\n", group, "-",
+				"-", "-", "-", "-", "-", "missing the local or migrate profile";
+			continue;
+		}
+		hn = runs[group, hv]; mn = runs[group, mv];
+
+		# The home node pulling back what the regions changed.
+		drag = home[group, mv, 0] / mn - home[group, hv, 0] / hn;
+		if (drag < 0) drag = 0;
+		total = 0;
+		for (k in region) {
+			split(k, kk, SUBSEP);
+			if (kk[1] == group && kk[2] > 0) total += pages[group, mv, kk[2]] / mn;
+		}
+
+		file = advice "/" group ".sched";
+		model = nback ? ", cost model " cost : "";
+		printf "# %s: popcorn-advise.sh, margin %s%%%s\n", group, margin,
+			model > file;
+		for (r = 1; r < 64; r++) {
+			if (!((group, r) in region)) continue;
+			h = home[group, hv, r] / hn;
+			t = remote[group, mv, r] / mn;
+			p = pages[group, mv, r] / mn;
+			c = (t + migr[group, mv, r] / mn);
+			if (nback) d = p * page_ns(p);
+			else d = total > 0 ? drag * p / total : 0;
+			best = 0;
+			for (nid = 1; nid <= maxnid; nid++)
+				if (on[group, mv, r, nid] > on[group, mv, r, best]) best = nid;
+
+			if (h == 0 || t == 0) {
+				node = "hand";
+				why = h == 0 ? "not run at home" : "not offloaded";
+			} else if (h - c - d > h * margin / 100) {
+				node = best;
+				why = "offload to node " best;
+			} else {
+				node = 0;
+				why = "keep home";
+			}
+			printf "%-28s %6d %10s %10s %8d %10s %10s  %s\n", group, r,
+				ms(h), t ? ms(c) : "-", p, ms(d),
+				h && t ? ms(h - c - d) : "-", why;
+			if (node != "hand") printf "%d * %d\n", r, node > file;
+		}
+		close(file);
+	}
+}' "$@"
+
+echo "schedules in $ADVICE"
@@ -0,0 +1,705 @@
+#!/bin/bash
+#
+# popcorn-bench.sh - build, run and collect every benchmark suite.
+#
+# Runs each suite twice per input, once migrating ("migrate") and once kept
+# on the home node ("local"), and appends one line per measurement to
+# <outdir>/results.csv; <outdir>/results.json has the same rows. The raw
+# output of every run is kept under <outdir>/log.
+#
+#   micro   bench/popcornmicro, the cost of migrate(), of the page
+#           transfers and of barriers spanning nodes, in a single "migrate"
+#           variant. The model of the last run is kept as
+#           <outdir>/popcorn.cost: the later runs get it in $POPCORN_COST,
+#           and popcorn-advise.sh prices the pages of the regions with it.
+#   npb     NPB3.3 bt cg ep ft is lu mg sp ua, classes S A B by default;
+#           -c also takes C, D and custom (sized by the NPB_* variables,
+#           see setclass.sh). The local variant runs with
+#           POPCORN_MIGRATE=off (see popcorn_nodes.h).
+#   kmeans  three fixed problem sizes, the two larger ones also with the
+#           partial sums means update (-u partial), the large one with the
+#           pruned assignment step (-a prune), a mini-batch pass over
+#           100M streamed points (-b), a wider problem in each point
+#           layout (-l aos|soa|tiled), and the large one seeded with
+#           k-means++ and k-means|| (-S pp|par) or with work stealing
+#           between the nodes (-w steal). The local variant uses a
+#           schedule that keeps every thread on node 0, the extra remote
+#           variant one that keeps every thread on node 1.
+#   redis   redis-benchmark SET, GET, LPUSH, LPOP and INCR against
+#           popcorn-migrate-policy always and never.
+#   nginx   ngxload (bench/ngxload) against popcorn_migrate_policy batch
+#           and off, one run per scenario: static files small and large,
+#           pipelined, one connection per request, open loop, proxied to a
+#           second server block, and TLS when the binary has the ssl module.
+#   nginx-homo
+#           the same scenarios, load and seed against the homogeneous
+#           nginx-1.3.9, built natively, in a single "homo" variant.
+#
+# The heterogeneous binaries are run as <name>_x86-64 copied to <name> on
+# this node; the Popcorn kernel expects <name>_aarch64 under the same path on
+# the ARM node, which -i copies there over ssh. NPB3.3 is the homogeneous
+# suite: -i copies the same binary to the other node.
+#
+# Migration counts come from INFO popcorn (redis), from the popcorn lines of
+# stub_status (nginx) and, for NPB and kmeans, from the popcorn_profile.h
+# table, so build those with -p to get them.
+#
+# With -p every run also leaves its profile in <outdir>/log/<tag>.profile,
+# and redis and nginx get a "home" variant, their migration policy on and
+# POPCORN_MIGRATE=off, which profiles their regions on the home node.
+# popcorn-advise.sh turns the profiles into a schedule per benchmark; -a
+# <advice dir> adds an "advised" variant that migrates with those schedules.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+HET=$ROOT/heterogeneous_test_suits
+NPB=$ROOT/homogeneous_test_suits/NPB3.3
+NGINX_HOMO=$ROOT/homogeneous_test_suits/nginx-1.3.9
+
+SUITES="micro npb kmeans redis nginx nginx-homo"
+NPB_BENCHS=${NPB_BENCHS:-bt cg ep ft is lu mg sp ua}
+NPB_CLASSES="S A B"
+VARIANTS="migrate local"
+KMEANS_VARIANTS="$VARIANTS remote"
+RUNS=3
+OUT=
+BUILD=0
+INSTALL=0
+PROFILE=0
+ADVICE=
+REMOTE_HOST=${REMOTE_HOST:-} # user@host of the other node, for -i.
+TIMEOUT=${TIMEOUT:-1800}    # Seconds before a run is killed.
+
+# name|arguments
+KMEANS_SIZES=${KMEANS_SIZES:-"small|-d 3 -c 100 -p 100000 -s 1000 -n 2 -t 4
+medium|-d 3 -c 500 -p 1000000 -s 1000 -n 2 -t 4
+large|-d 3 -c 1000 -p 4000000 -s 1000 -n 2 -t 4
+medium-partial|-d 3 -c 500 -p 1000000 -s 1000 -n 2 -t 4 -u partial
+large-partial|-d 3 -c 1000 -p 4000000 -s 1000 -n 2 -t 4 -u partial
+large-prune|-d 3 -c 1000 -p 4000000 -s 1000 -n 2 -t 4 -u partial -a prune
+stream|-d 3 -c 1000 -p 100000000 -s 1000 -n 2 -t 4 -b 100000
+layout-aos|-d 32 -c 500 -p 200000 -s 1000 -n 2 -t 4 -u partial -l aos
+layout-soa|-d 32 -c 500 -p 200000 -s 1000 -n 2 -t 4 -u partial -l soa
+layout-tiled|-d 32 -c 500 -p 200000 -s 1000 -n 2 -t 4 -u partial -l tiled
+large-seed-pp|-d 3 -c 1000 -p 4000000 -s 1000 -n 2 -t 4 -u partial -S pp
+large-seed-par|-d 3 -c 1000 -p 4000000 -s 1000 -n 2 -t 4 -u partial -S par
+large-steal|-d 3 -c 1000 -p 4000000 -s 1000 -n 2 -t 4 -u partial -w steal"}
+
+MICRO_ARGS=${MICRO_ARGS:-}      # popcornmicro options, see popcornmicro.c
+
+REDIS_PORT=${REDIS_PORT:-6390}
+REDIS_TESTS=${REDIS_TESTS:-set,get,lpush,lpop,incr}
+REDIS_REQUESTS=${REDIS_REQUESTS:-1000000}
+REDIS_CLIENTS=${REDIS_CLIENTS:-50}
+REDIS_PIPELINE=${REDIS_PIPELINE:-1}
+REDIS_BENCHMARK=${REDIS_BENCHMARK:-$HET/redis/src/redis-benchmark}
+REDIS_CLI=${REDIS_CLI:-$HET/redis/src/redis-cli}
+
+NGINX_PORT=${NGINX_PORT:-8090}
+NGINX_BACKEND_PORT=${NGINX_BACKEND_PORT:-8091}
+NGINX_TLS_PORT=${NGINX_TLS_PORT:-8443}
+NGINX_WORKERS=${NGINX_WORKERS:-2}
+NGINX_LARGE_KB=${NGINX_LARGE_KB:-1024}
+NGINX_HOMO_CONFIGURE=${NGINX_HOMO_CONFIGURE:---without-http_rewrite_module --without-pcre --without-http_gzip_module --with-http_stub_status_module --with-http_ssl_module}
+NGXLOAD=${NGXLOAD:-$ROOT/bench/ngxload/ngxload}
+NGXLOAD_ARGS=${NGXLOAD_ARGS:--t 4 -c 64 -d 30s -w 5s}
+NGXLOAD_SEED=${NGXLOAD_SEED:-1}
+
+# name|scheme|path|ngxload arguments, added to $NGXLOAD_ARGS
+NGINX_SCENARIOS=${NGINX_SCENARIOS:-"static|http|/index.html|
+large|http|/large.bin|
+pipeline|http|/index.html|-P 8
+close|http|/index.html|-C
+open|http|/index.html|-r 20000
+proxy|http|/proxy/index.html|
+tls|https|/index.html|"}
+
+usage() {
+	cat <<EOF
+Usage: $0 [-b] [-p] [-i] [-s <suites>] [-c <classes>] [-r <runs>] [-o <outdir>]
+          [-a <advice dir>]
+  -b  build the binaries (x86-64/aarch64 pairs but for NPB and nginx-homo)
+  -p  build with POPCORN_PROFILE=1 (migration counts of NPB and kmeans)
+  -a  also run the schedules of popcorn-advise.sh, as the advised variant
+  -i  install the binaries on \$REMOTE_HOST
+  -s  suites to run, default "$SUITES"
+  -c  NPB classes, default "$NPB_CLASSES"
+  -r  runs per benchmark, input and variant, default $RUNS
+  -o  output directory, default results/<date>
+EOF
+	exit 1
+}
+
+while getopts "bpis:c:r:o:a:h" opt; do
+	case $opt in
+	b) BUILD=1 ;;
+	p) PROFILE=1 ;;
+	i) INSTALL=1 ;;
+	s) SUITES=$OPTARG ;;
+	c) NPB_CLASSES=$OPTARG ;;
+	r) RUNS=$OPTARG ;;
+	o) OUT=$OPTARG ;;
+	a) ADVICE=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+if [ -z "$OUT" ]; then
+	OUT=$ROOT/results/$(date +%Y%m%d-%H%M%S)
+fi
+mkdir -p "$OUT/log" "$OUT/bin" || exit 1
+OUT=$(cd "$OUT" && pwd)
+SERVER_VARIANTS=$VARIANTS
+if [ $PROFILE -eq 1 ]; then
+	SERVER_VARIANTS="$SERVER_VARIANTS home"
+fi
+if [ -n "$ADVICE" ]; then
+	ADVICE=$(cd "$ADVICE" && pwd) || exit 1
+	VARIANTS="$VARIANTS advised"
+	KMEANS_VARIANTS="$KMEANS_VARIANTS advised"
+	SERVER_VARIANTS="$SERVER_VARIANTS advised"
+fi
+CSV=$OUT/results.csv
+MAKE_FLAGS=
+if [ $PROFILE -eq 1 ]; then
+	MAKE_FLAGS=POPCORN_PROFILE=1
+fi
+
+log() {
+	echo "[$(date +%H:%M:%S)] $*"
+}
+
+# record <suite> <benchmark> <input> <variant> <run> <status> <seconds>
+#        <throughput> <unit> <p50_ms> <p99_ms> <p999_ms> <migrations>
+record() {
+	local IFS=,
+	echo "$*" >> "$CSV"
+}
+
+if [ ! -f "$CSV" ]; then
+	echo "suite,benchmark,input,variant,run,status,seconds,throughput,unit,p50_ms,p99_ms,p999_ms,migrations" > "$CSV"
+fi
+
+# install_pair <dir> <name>: <dir>/<name>_x86-64 becomes <dir>/<name> here,
+# <dir>/<name>_aarch64 becomes <dir>/<name> on the ARM node.
+install_pair() {
+	cp "$1/$2_x86-64" "$1/$2" || return 1
+	if [ $INSTALL -eq 1 ] && [ -n "$REMOTE_HOST" ]; then
+		ssh "$REMOTE_HOST" mkdir -p "$1" &&
+		scp -q "$1/$2_aarch64" "$REMOTE_HOST:$1/$2_aarch64" &&
+		ssh "$REMOTE_HOST" cp "$1/$2_aarch64" "$1/$2"
+	fi
+}
+
+# install_same <dir> <name>: <dir>/<name> under the same path on the other
+# node, for the homogeneous suite.
+install_same() {
+	if [ $INSTALL -eq 1 ] && [ -n "$REMOTE_HOST" ]; then
+		ssh "$REMOTE_HOST" mkdir -p "$1" &&
+		scp -q "$1/$2" "$REMOTE_HOST:$1/$2"
+	fi
+}
+
+# Sum of the migrations column of a popcorn_profile.h table, or nothing.
+profile_migrations() {
+	[ -s "$1" ] || return
+	awk -F'\t' '!/^#/ && $1 != "region" { n += $3 } END { print n + 0 }' "$1"
+}
+
+# Environment of a run of variant <variant> of the benchmark <group>, the
+# tag of the run without the variant and the run number.
+variant_env() {
+	if [ -f "$OUT/popcorn.cost" ]; then
+		echo POPCORN_COST="$OUT/popcorn.cost"
+	fi
+	case $1 in
+	local|home) echo POPCORN_MIGRATE=off ;;
+	advised) echo POPCORN_MIGRATE=on POPCORN_SCHEDULE="$ADVICE/$2.sched" ;;
+	*) echo POPCORN_MIGRATE=on ;;
+	esac
+}
+
+# Is there a schedule for the advised variant of <group>?
+advised() {
+	[ -f "$ADVICE/$1.sched" ] || {
+		log "no $ADVICE/$1.sched, skipping the advised variant of $1"
+		return 1
+	}
+}
+
+############
+# micro    #
+############
+
+micro_build() {
+	(cd "$ROOT/bench/popcornmicro" && make $MAKE_FLAGS \
+		> "$OUT/log/micro-build.log" 2>&1) || {
+		log "micro: build failed, see micro-build.log"
+		return 1
+	}
+	mkdir -p "$OUT/bin/micro"
+	cp "$ROOT/bench/popcornmicro/popcornmicro_x86-64" \
+		"$ROOT/bench/popcornmicro/popcornmicro_aarch64" "$OUT/bin/micro/" &&
+	install_pair "$OUT/bin/micro" popcornmicro
+}
+
+# One row per line of the model: the input is n<nid>-<bytes>-t<threads>,
+# the mean in the throughput column, in ns.
+micro_run() {
+	local bin=$OUT/bin/micro/popcornmicro r tag status
+
+	if [ $BUILD -eq 1 ]; then
+		micro_build || return
+	fi
+	if [ ! -x "$bin" ]; then
+		log "micro: no $bin, skipping (build with -b)"
+		return
+	fi
+	for r in $(seq 1 "$RUNS"); do
+		tag=micro-$r
+		log "$tag"
+		rm -f "$OUT/log/$tag.profile"
+		POPCORN_PROFILE_OUT="$OUT/log/$tag.profile" \
+			timeout "$TIMEOUT" "$bin" $MICRO_ARGS -o "$OUT/log/$tag.cost" \
+			> "$OUT/log/$tag.log" 2>&1
+		status=$?
+		if [ $status -ne 0 ] || [ ! -s "$OUT/log/$tag.cost" ]; then
+			record micro popcornmicro "" migrate "$r" fail "" "" "" \
+				"" "" "" ""
+			continue
+		fi
+		awk -F'\t' '!/^#/ && $1 != "primitive" {
+			printf "%s,n%s-%s-t%s,%s,%.6f,%.6f\n", $1, $2, $3, $4, $6,
+				$7 / 1e6, $8 / 1e6
+		}' "$OUT/log/$tag.cost" |
+		while IFS=, read -r prim input mean p50 p99; do
+			record micro "$prim" "$input" migrate "$r" ok "" "$mean" ns \
+				"$p50" "$p99" "" ""
+		done
+		cp "$OUT/log/$tag.cost" "$OUT/popcorn.cost"
+	done
+}
+
+############
+# NPB3.3   #
+############
+
+npb_build() {
+	local class=$1 b
+	(cd "$NPB" && make "$class" > "$OUT/log/npb-build-$class.log" 2>&1 &&
+	 make all $MAKE_FLAGS >> "$OUT/log/npb-build-$class.log" 2>&1) || {
+		log "npb: build of class $class failed, see npb-build-$class.log"
+		return 1
+	}
+	mkdir -p "$OUT/bin/npb"
+	for b in $NPB_BENCHS; do
+		cp "$NPB/$b/$b" "$OUT/bin/npb/$b.$class" &&
+		install_same "$OUT/bin/npb" "$b.$class"
+	done
+}
+
+npb_run() {
+	local class b v r tag bin status secs mops mig
+	for class in $NPB_CLASSES; do
+		if [ $BUILD -eq 1 ]; then
+			npb_build "$class" || continue
+		fi
+		for b in $NPB_BENCHS; do
+			bin=$OUT/bin/npb/$b.$class
+			if [ ! -x "$bin" ]; then
+				log "npb: no $bin, skipping (build with -b)"
+				continue
+			fi
+			for v in $VARIANTS; do
+				[ "$v" = advised ] && ! advised "npb-$b.$class" && continue
+				for r in $(seq 1 "$RUNS"); do
+					tag=npb-$b.$class-$v-$r
+					log "$tag"
+					rm -f "$OUT/log/$tag.profile"
+					env $(variant_env "$v" "npb-$b.$class") \
+						POPCORN_PROFILE_OUT="$OUT/log/$tag.profile" \
+						timeout "$TIMEOUT" "$bin" > "$OUT/log/$tag.log" 2>&1
+					status=fail
+					grep -q "Verification *= *SUCCESSFUL" "$OUT/log/$tag.log" &&
+						status=ok
+					secs=$(awk -F= '/Time in seconds/ { print $2 + 0 }' \
+						"$OUT/log/$tag.log")
+					mops=$(awk -F= '/Mop\/s total/ { print $2 + 0 }' \
+						"$OUT/log/$tag.log")
+					mig=$(profile_migrations "$OUT/log/$tag.profile")
+					record npb "$b" "$class" "$v" "$r" "$status" "$secs" \
+						"$mops" Mop/s "" "" "" "$mig"
+				done
+			done
+		done
+	done
+}
+
+############
+# kmeans   #
+############
+
+kmeans_build() {
+	(cd "$HET/kmeans" && make $MAKE_FLAGS > "$OUT/log/kmeans-build.log" 2>&1) || {
+		log "kmeans: build failed, see kmeans-build.log"
+		return 1
+	}
+	mkdir -p "$OUT/bin/kmeans"
+	cp "$HET/kmeans/kmeans_x86-64" "$HET/kmeans/kmeans_aarch64" \
+		"$OUT/bin/kmeans/" && install_pair "$OUT/bin/kmeans" kmeans
+}
+
+kmeans_run() {
+	local bin=$OUT/bin/kmeans/kmeans local_sched=$OUT/log/kmeans-local.sched
+	local remote_sched=$OUT/log/kmeans-remote.sched
+	local line name args v r tag sched status secs mig
+
+	if [ $BUILD -eq 1 ]; then
+		kmeans_build || return
+	fi
+	if [ ! -x "$bin" ]; then
+		log "kmeans: no $bin, skipping (build with -b)"
+		return
+	fi
+	echo "* * 0" > "$local_sched"
+	echo "* * 1" > "$remote_sched"
+
+	echo "$KMEANS_SIZES" | while IFS='|' read -r name args; do
+		for v in $KMEANS_VARIANTS; do
+			[ "$v" = advised ] && ! advised "kmeans-$name" && continue
+			sched=
+			[ "$v" = local ] && sched="-f $local_sched"
+			[ "$v" = remote ] && sched="-f $remote_sched"
+			for r in $(seq 1 "$RUNS"); do
+				tag=kmeans-$name-$v-$r
+				log "$tag"
+				rm -f "$OUT/log/$tag.profile"
+				env $(variant_env "$v" "kmeans-$name") \
+					POPCORN_PROFILE_OUT="$OUT/log/$tag.profile" \
+					timeout "$TIMEOUT" "$bin" $args $sched \
+					> "$OUT/log/$tag.log" 2>&1 < /dev/null
+				status=fail
+				secs=$(awk '/kmeans: Completed/ { print $3 }' \
+					"$OUT/log/$tag.log")
+				rounds=$(awk '/kmeans: Rounds/ { print $3 }' \
+					"$OUT/log/$tag.log")
+				[ -n "$secs" ] && status=ok
+				mig=$(profile_migrations "$OUT/log/$tag.profile")
+				record kmeans kmeans "$name" "$v" "$r" "$status" "$secs" \
+					"$rounds" "${rounds:+rounds}" "" "" "" "$mig"
+			done
+		done
+	done
+}
+
+############
+# redis    #
+############
+
+redis_build() {
+	(cd "$HET/redis/src" && make post_process $MAKE_FLAGS \
+		> "$OUT/log/redis-build.log" 2>&1) || {
+		log "redis: build failed, see redis-build.log"
+		return 1
+	}
+	mkdir -p "$OUT/bin/redis"
+	cp "$HET/redis/src/redis-server_x86-64" \
+		"$HET/redis/src/redis-server_aarch64" "$OUT/bin/redis/" &&
+	install_pair "$OUT/bin/redis" redis-server
+}
+
+# Percentile <p> in ms of the redis-benchmark distribution on stdin.
+redis_percentile() {
+	awk -v p="$1" '/% <= / { sub("%", "", $1);
+		if ($1 + 0 >= p) { print $3; exit } }'
+}
+
+redis_run() {
+	local bin=$OUT/bin/redis/redis-server v r t tag pid policy mig rps cli
+	local status
+
+	if [ $BUILD -eq 1 ]; then
+		redis_build || return
+	fi
+	if [ ! -x "$bin" ] || [ ! -x "$REDIS_BENCHMARK" ]; then
+		log "redis: no $bin or $REDIS_BENCHMARK, skipping"
+		return
+	fi
+	cli="$REDIS_CLI -p $REDIS_PORT"
+
+	for v in $SERVER_VARIANTS; do
+		[ "$v" = advised ] && ! advised redis && continue
+		policy=always
+		[ "$v" = local ] && policy=never
+		for r in $(seq 1 "$RUNS"); do
+			tag=redis-$v-$r
+			log "$tag"
+			rm -f "$OUT/log/$tag.profile"
+			(cd "$OUT/log" && exec env $(variant_env "$v" redis) \
+				POPCORN_PROFILE_OUT="$OUT/log/$tag.profile" "$bin" \
+				--port "$REDIS_PORT" --save "" --appendonly no \
+				--popcorn-migrate-policy "$policy") \
+				> "$OUT/log/$tag-server.log" 2>&1 &
+			pid=$!
+			for t in $(seq 1 50); do
+				$cli ping > /dev/null 2>&1 && break
+				sleep 0.1
+			done
+			for t in ${REDIS_TESTS//,/ }; do
+				$cli popcorn reset > /dev/null 2>&1
+				timeout "$TIMEOUT" "$REDIS_BENCHMARK" -p "$REDIS_PORT" \
+					-t "$t" -n "$REDIS_REQUESTS" -c "$REDIS_CLIENTS" \
+					-P "$REDIS_PIPELINE" > "$OUT/log/$tag-$t.log" 2>&1
+				mig=$($cli info popcorn 2>/dev/null |
+					awk -F: '/^popcorn_migrations:/ { print $2 + 0 }')
+				rps=$(awk '/requests per second/ { print $1 }' \
+					"$OUT/log/$tag-$t.log" | tail -1)
+				status=fail
+				[ -n "$rps" ] && status=ok
+				record redis "$t" "n$REDIS_REQUESTS-c$REDIS_CLIENTS-P$REDIS_PIPELINE" \
+					"$v" "$r" "$status" "" "$rps" req/s \
+					"$(redis_percentile 50 < "$OUT/log/$tag-$t.log")" \
+					"$(redis_percentile 99 < "$OUT/log/$tag-$t.log")" \
+					"$(redis_percentile 99.9 < "$OUT/log/$tag-$t.log")" \
+					"$mig"
+			done
+			$cli shutdown nosave > /dev/null 2>&1
+			wait $pid
+		done
+	done
+}
+
+############
+# nginx    #
+############
+
+nginx_build() {
+	(cd "$HET/nginx" && ./myconfig.sh && make -f master_Makefile) \
+		> "$OUT/log/nginx-build.log" 2>&1 || {
+		log "nginx: build failed, see nginx-build.log"
+		return 1
+	}
+	mkdir -p "$OUT/bin/nginx"
+	cp "$HET/nginx/objs/x86_objs/nginx_x86-64" \
+		"$HET/nginx/objs/arm_objs/nginx_aarch64" "$OUT/bin/nginx/" &&
+	install_pair "$OUT/bin/nginx" nginx
+}
+
+nginx_homo_build() {
+	(cd "$NGINX_HOMO" && ./configure $NGINX_HOMO_CONFIGURE && make) \
+		> "$OUT/log/nginx-homo-build.log" 2>&1 || {
+		log "nginx-homo: build failed, see nginx-homo-build.log"
+		return 1
+	}
+	mkdir -p "$OUT/bin/nginx-homo"
+	cp "$NGINX_HOMO/objs/nginx" "$OUT/bin/nginx-homo/" &&
+	install_same "$OUT/bin/nginx-homo" nginx
+}
+
+ngxload_build() {
+	make -C "$ROOT/bench/ngxload" > "$OUT/log/ngxload-build.log" 2>&1 || {
+		log "ngxload: build failed, see ngxload-build.log"
+		return 1
+	}
+}
+
+# nginx_conf <prefix> <policy> <tls>: the same server for every build; the
+# popcorn directives only with a policy, the TLS server only with tls 1.
+nginx_conf() {
+	local events=
+	mkdir -p "$1/conf" "$1/logs" "$1/html" || return 1
+	cp "$HET/nginx/html/index.html" "$HET/nginx/html/50x.html" "$1/html/" &&
+	dd if=/dev/zero of="$1/html/large.bin" bs=1024 count="$NGINX_LARGE_KB" \
+		2> /dev/null || return 1
+	if [ -n "$2" ]; then
+		events="popcorn_migrate_policy $2;
+    popcorn_migrate_node auto;"
+	fi
+	cat > "$1/conf/nginx.conf" <<EOF
+worker_processes $NGINX_WORKERS;
+daemon off;
+error_log logs/error.log;
+pid logs/nginx.pid;
+
+events {
+    worker_connections 4096;
+    $events
+}
+
+http {
+    access_log off;
+    sendfile on;
+    server {
+        listen $NGINX_PORT;
+        location / { root $1/html; }
+        location /proxy/ { proxy_pass http://127.0.0.1:$NGINX_BACKEND_PORT/; }
+        location = /popcorn_status { stub_status on; }
+    }
+    server {
+        listen 127.0.0.1:$NGINX_BACKEND_PORT;
+        location / { root $1/html; }
+    }
+EOF
+	if [ "$3" = 1 ]; then
+		openssl req -x509 -newkey rsa:2048 -nodes -days 30 -subj /CN=localhost \
+			-keyout "$1/conf/cert.key" -out "$1/conf/cert.pem" \
+			> /dev/null 2>&1 || return 1
+		cat >> "$1/conf/nginx.conf" <<EOF
+    server {
+        listen $NGINX_TLS_PORT ssl;
+        ssl_certificate cert.pem;
+        ssl_certificate_key cert.key;
+        ssl_session_cache shared:SSL:1m;
+        location / { root $1/html; }
+    }
+EOF
+	fi
+	echo "}" >> "$1/conf/nginx.conf"
+}
+
+# Total migrations of the workers, from the popcorn lines of stub_status.
+nginx_migrations() {
+	curl -s "http://127.0.0.1:$NGINX_PORT/popcorn_status" |
+	awk '/^popcorn worker/ { on = 1; next } on && NF >= 4 { n += $4; seen = 1 }
+		END { if (seen) print n }'
+}
+
+# Value of <key> in the result line of ngxload.
+ngxload_field() {
+	awk -v k="$1" '/^result / { for (i = 2; i <= NF; i++) {
+		split($i, kv, "="); if (kv[1] == k) print kv[2] } }'
+}
+
+# nginx_bench <suite> <bin> <variant> <policy>: every scenario against one
+# build and variant.
+nginx_bench() {
+	local suite=$1 bin=$2 v=$3 prefix=$OUT/log/$1-$3 tls=0
+	local name scheme path args port r t tag pid before after mig rps status
+
+	"$bin" -V 2>&1 | grep -q http_ssl_module && tls=1
+	nginx_conf "$prefix" "$4" "$tls" || {
+		log "$suite: cannot set up $prefix"
+		return 1
+	}
+	while IFS='|' read -r name scheme path args <&3; do
+		[ -n "$name" ] || continue
+		port=$NGINX_PORT
+		if [ "$scheme" = https ]; then
+			if [ $tls -eq 0 ]; then
+				log "$suite: no ssl module in $bin, skipping $name"
+				continue
+			fi
+			port=$NGINX_TLS_PORT
+		fi
+		[ "$v" = advised ] && ! advised "$suite-$name" && continue
+		for r in $(seq 1 "$RUNS"); do
+			tag=$suite-$v-$name-$r
+			log "$tag"
+			rm -f "$OUT/log/$tag.profile"
+			env $(variant_env "$v" "$suite-$name") \
+				POPCORN_PROFILE_OUT="$OUT/log/$tag.profile" \
+				"$bin" -p "$prefix/" -c conf/nginx.conf \
+				> "$OUT/log/$tag-server.log" 2>&1 &
+			pid=$!
+			for t in $(seq 1 50); do
+				curl -s -o /dev/null "http://127.0.0.1:$NGINX_PORT/" && break
+				sleep 0.1
+			done
+			before=$(nginx_migrations)
+			timeout "$TIMEOUT" "$NGXLOAD" $NGXLOAD_ARGS -S "$NGXLOAD_SEED" \
+				$args -L "$OUT/log/$tag.hist" \
+				"$scheme://127.0.0.1:$port$path" > "$OUT/log/$tag.log" 2>&1
+			after=$(nginx_migrations)
+			mig=
+			[ -n "$before" ] && [ -n "$after" ] && mig=$((after - before))
+			rps=$(ngxload_field rps < "$OUT/log/$tag.log")
+			status=fail
+			[ -n "$rps" ] &&
+			[ "$(ngxload_field requests < "$OUT/log/$tag.log")" != 0 ] &&
+				status=ok
+			record "$suite" "$name" "$NGXLOAD_ARGS${args:+ $args}" "$v" "$r" "$status" \
+				"$(ngxload_field seconds < "$OUT/log/$tag.log")" "$rps" req/s \
+				"$(ngxload_field p50_ms < "$OUT/log/$tag.log")" \
+				"$(ngxload_field p99_ms < "$OUT/log/$tag.log")" \
+				"$(ngxload_field p999_ms < "$OUT/log/$tag.log")" "$mig"
+			kill -QUIT $pid 2>/dev/null
+			wait $pid
+		done
+	done 3<<EOF
+$NGINX_SCENARIOS
+EOF
+}
+
+# The load generator, built with -b or when it is missing.
+nginx_load() {
+	if [ $BUILD -eq 1 ] || [ ! -x "$NGXLOAD" ]; then
+		ngxload_build || return
+	fi
+	[ -x "$NGXLOAD" ] || {
+		log "nginx: no $NGXLOAD, skipping"
+		return 1
+	}
+}
+
+nginx_run() {
+	local bin=$OUT/bin/nginx/nginx v policy
+
+	if [ $BUILD -eq 1 ]; then
+		nginx_build || return
+	fi
+	nginx_load || return
+	if [ ! -x "$bin" ]; then
+		log "nginx: no $bin, skipping (build with -b)"
+		return
+	fi
+
+	for v in $SERVER_VARIANTS; do
+		policy=batch
+		[ "$v" = local ] && policy=off
+		nginx_bench nginx "$bin" "$v" "$policy"
+	done
+}
+
+nginx-homo_run() {
+	local bin=$OUT/bin/nginx-homo/nginx
+
+	if [ $BUILD -eq 1 ]; then
+		nginx_homo_build || return
+	fi
+	nginx_load || return
+	if [ ! -x "$bin" ]; then
+		log "nginx-homo: no $bin, skipping (build with -b)"
+		return
+	fi
+
+	nginx_bench nginx-homo "$bin" homo ""
+}
+
+############
+# Results  #
+############
+
+# results.csv as a JSON array of objects, numbers unquoted.
+csv_to_json() {
+	awk -F, 'NR == 1 { for (i = 1; i <= NF; i++) key[i] = $i; next }
+	{
+		printf "%s\n  {", (NR == 2 ? "[" : ",");
+		for (i = 1; i <= NF; i++) {
+			v = $i;
+			if (v == "") v = "null";
+			else if (v !~ /^-?[0-9.]+$/) v = "\"" v "\"";
+			printf "%s\"%s\": %s", (i > 1 ? ", " : ""), key[i], v;
+		}
+		printf "}";
+	}
+	END { print (NR > 1 ? "\n]" : "[]") }' "$1"
+}
+
+for s in $SUITES; do
+	case $s in
+	micro|npb|kmeans|redis|nginx|nginx-homo) ${s}_run ;;
+	*) log "unknown suite $s"; usage ;;
+	esac
+done
+
+csv_to_json "$CSV" > "$OUT/results.json"
+log "results in $CSV and $OUT/results.json"
@@ -0,0 +1,600 @@
+/*
+ * popcornmicro - cost of the Popcorn primitives the suites depend on.
+ *
+ * For every online node other than the home one (or the -n nodes):
+ *
+ *   migrate      -r round trips home -> node -> home, timed at home
+ *   fault        for every -s working set, the first touch of each of its
+ *                pages on the node after it was written at home, read
+ *                (fault_read) and written (fault_write), and the write at
+ *                home of the pages the node wrote (fault_back), one sample
+ *                per page, timed where the page is touched
+ *   pingpong     -r round trips of a word written in turn by a thread at
+ *                home and one on the node
+ *   share        writes of a thread at home to its own word while a thread
+ *                on the node writes another word 8 bytes away, on the same
+ *                page, and PAGE_SIZE away, on the next one (false_share)
+ *   barrier      -r waits of a pthread barrier (barrier) and of a
+ *                popcorn_barrier.h one (barrier_node) by each of the -t
+ *                thread counts, half of the threads on the node
+ *
+ * The results are a popcorn_cost.h model, written to -o or to stdout: the
+ * adaptive migration policies read it from $POPCORN_COST, and
+ * popcorn-advise.sh -k prices the pages a region pulls over with it.
+ * Progress goes to stderr.
+ *
+ * Timings never span nodes: each one is taken with the clock of the node
+ * that starts and stops it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "migrate.h"
+
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_profile.h"
+#include "popcorn_nodes.h"
+#include "popcorn_arena.h"
+#include "popcorn_barrier.h"
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE	4096UL
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+/* Region IDs for popcorn_profile.h */
+#define MICRO_REGION_MIGRATE	1
+#define MICRO_REGION_FAULT	2
+#define MICRO_REGION_THREAD	3
+
+#define MAX_LIST	16
+
+/* Writes timed together in the false sharing test, one sample. */
+#define SHARE_BATCH	64
+
+#define TEST_MIGRATE	0x01
+#define TEST_FAULT	0x02
+#define TEST_PINGPONG	0x04
+#define TEST_SHARE	0x08
+#define TEST_BARRIER	0x10
+#define TEST_ALL	0x1f
+
+static const struct {
+	const char *name;
+	int flag;
+} test_names[] = {
+	{ "migrate", TEST_MIGRATE },
+	{ "fault", TEST_FAULT },
+	{ "pingpong", TEST_PINGPONG },
+	{ "share", TEST_SHARE },
+	{ "barrier", TEST_BARRIER },
+};
+
+static int reps = 1000;
+static int tests = TEST_ALL;
+static size_t sizes[MAX_LIST] = { 4096, 65536, 1 << 20, 16 << 20 };
+static int nsizes = 4;
+static int threads[MAX_LIST] = { 2, 4, 8 };
+static int nthreads = 3;
+static int nodes[MAX_POPCORN_NODES];
+static int nnodes;
+static int home;
+static FILE *out;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *map_pages(size_t size)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED) {
+		perror("popcornmicro: mmap");
+		exit(1);
+	}
+	return p;
+}
+
+static void go(int region, int nid)
+{
+	int rc;
+
+	if (nid == popcorn_nodes_current())
+		return;
+	rc = popcorn_nodes_migrate(region, nid);
+	if (rc != 0 && rc != EBUSY) {
+		fprintf(stderr, "popcornmicro: migrate to node %d failed: %s\n",
+			nid, strerror(rc));
+		exit(1);
+	}
+}
+
+/*
+ * Samples
+ */
+
+typedef struct {
+	uint64_t *ns;
+	size_t n, cap;
+} samples_t;
+
+static void sample(samples_t *s, uint64_t ns)
+{
+	if (s->n == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 1024;
+		s->ns = realloc(s->ns, s->cap * sizeof(*s->ns));
+		if (s->ns == NULL) {
+			perror("popcornmicro: realloc");
+			exit(1);
+		}
+	}
+	s->ns[s->n++] = ns;
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* One line of the model, and the samples are reset. */
+static void report(samples_t *s, const char *primitive, int nid,
+		   size_t bytes, int nthr)
+{
+	double sum = 0;
+	size_t i;
+
+	if (s->n == 0)
+		return;
+	qsort(s->ns, s->n, sizeof(*s->ns), cmp_ns);
+	for (i = 0; i < s->n; i++)
+		sum += s->ns[i];
+	fprintf(out, "%s\t%d\t%zu\t%d\t%zu\t%.0f\t%llu\t%llu\n", primitive,
+		nid, bytes, nthr, s->n, sum / s->n,
+		(unsigned long long)s->ns[s->n / 2],
+		(unsigned long long)s->ns[s->n * 99 / 100]);
+	fflush(out);
+	fprintf(stderr, "popcornmicro: %s node %d, %zu bytes, %d threads: "
+		"%.0f ns\n", primitive, nid, bytes, nthr, sum / s->n);
+	s->n = 0;
+}
+
+/*
+ * migrate() round trips
+ */
+
+static void bench_migrate(int nid, samples_t *s)
+{
+	uint64_t t;
+	int i;
+
+	for (i = 0; i < reps; i++) {
+		t = now_ns();
+		go(MICRO_REGION_MIGRATE, nid);
+		go(MICRO_REGION_MIGRATE, home);
+		sample(s, now_ns() - t);
+	}
+	report(s, "migrate", nid, 0, 1);
+}
+
+/*
+ * Page transfers
+ */
+
+static void touch_pages(volatile char *buf, size_t size, int write,
+			samples_t *s)
+{
+	uint64_t t;
+	size_t off;
+	char c = 0;
+
+	for (off = 0; off < size; off += PAGE_SIZE) {
+		t = s ? now_ns() : 0;
+		if (write)
+			buf[off] = (char)off;
+		else
+			c += buf[off];
+		if (s)
+			sample(s, now_ns() - t);
+	}
+	(void)c;
+}
+
+static void bench_fault(int nid, size_t size, samples_t *s)
+{
+	volatile char *buf = map_pages(size);
+
+	touch_pages(buf, size, 1, NULL);
+
+	go(MICRO_REGION_FAULT, nid);
+	touch_pages(buf, size, 0, s);
+	go(MICRO_REGION_FAULT, home);
+	report(s, "fault_read", nid, size, 1);
+
+	/* Take the pages back, the node's copies are invalidated. */
+	touch_pages(buf, size, 1, NULL);
+
+	go(MICRO_REGION_FAULT, nid);
+	touch_pages(buf, size, 1, s);
+	go(MICRO_REGION_FAULT, home);
+	report(s, "fault_write", nid, size, 1);
+
+	touch_pages(buf, size, 1, s);
+	report(s, "fault_back", nid, size, 1);
+
+	munmap((void *)buf, size);
+}
+
+/*
+ * Two threads, one on the node
+ */
+
+typedef struct {
+	int nid;
+	volatile long *word;	/* The word the peer writes. */
+	volatile long *flag;	/* Set by the home thread to stop. */
+	volatile long *ready;	/* Set by the peer once on the node. */
+} peer_t;
+
+static void *pingpong_peer(void *arg)
+{
+	peer_t *p = arg;
+	long i;
+
+	go(MICRO_REGION_THREAD, p->nid);
+	*p->word = 1;
+	for (i = 1; i <= reps; i++) {
+		while (*p->word != 2 * i)
+			;
+		*p->word = 2 * i + 1;
+	}
+	go(MICRO_REGION_THREAD, home);
+	return NULL;
+}
+
+static void bench_pingpong(int nid, samples_t *s)
+{
+	volatile long *page = map_pages(PAGE_SIZE);
+	pthread_t tid;
+	peer_t peer;
+	uint64_t t;
+	long i;
+
+	peer.nid = nid;
+	peer.word = page;
+	pthread_create(&tid, NULL, pingpong_peer, &peer);
+
+	while (*page != 1)
+		;
+	for (i = 1; i <= reps; i++) {
+		t = now_ns();
+		*page = 2 * i;
+		while (*page != 2 * i + 1)
+			;
+		sample(s, now_ns() - t);
+	}
+	pthread_join(tid, NULL);
+	report(s, "pingpong", nid, 0, 2);
+	munmap((void *)page, PAGE_SIZE);
+}
+
+static void *share_peer(void *arg)
+{
+	peer_t *p = arg;
+
+	go(MICRO_REGION_THREAD, p->nid);
+	*p->ready = 1;
+	while (!*p->flag)
+		(*p->word)++;
+	go(MICRO_REGION_THREAD, home);
+	return NULL;
+}
+
+static void bench_share(int nid, size_t dist, samples_t *s)
+{
+	char *pages = map_pages(3 * PAGE_SIZE);
+	volatile long *mine = (volatile long *)pages;
+	pthread_t tid;
+	peer_t peer;
+	uint64_t t;
+	int i, j;
+
+	/* The flags on a page of their own, out of the way. */
+	peer.nid = nid;
+	peer.word = (volatile long *)(pages + dist);
+	peer.flag = (volatile long *)(pages + 2 * PAGE_SIZE);
+	peer.ready = peer.flag + 1;
+	pthread_create(&tid, NULL, share_peer, &peer);
+
+	while (!*peer.ready)
+		;
+	for (i = 0; i < reps; i++) {
+		t = now_ns();
+		for (j = 0; j < SHARE_BATCH; j++)
+			(*mine)++;
+		sample(s, (now_ns() - t) / SHARE_BATCH);
+	}
+	*peer.flag = 1;
+	pthread_join(tid, NULL);
+	report(s, "false_share", nid, dist, 2);
+	munmap(pages, 3 * PAGE_SIZE);
+}
+
+/*
+ * Barriers spanning the nodes
+ */
+
+typedef struct {
+	int nid;
+	int serial;		/* The thread whose waits are timed. */
+	pthread_barrier_t *barrier;
+	struct popcorn_barrier *node_barrier;
+	samples_t *s;
+} waiter_t;
+
+static void *waiter(void *arg)
+{
+	waiter_t *w = arg;
+	uint64_t t;
+	int i;
+
+	go(MICRO_REGION_THREAD, w->nid);
+
+	/* Every thread is on its node before the first timed wait. */
+	if (w->barrier)
+		pthread_barrier_wait(w->barrier);
+	else
+		popcorn_barrier_wait(w->node_barrier, w->nid);
+
+	for (i = 0; i < reps; i++) {
+		t = now_ns();
+		if (w->barrier)
+			pthread_barrier_wait(w->barrier);
+		else
+			popcorn_barrier_wait(w->node_barrier, w->nid);
+		if (w->serial)
+			sample(w->s, now_ns() - t);
+	}
+	go(MICRO_REGION_THREAD, home);
+	return NULL;
+}
+
+static void bench_barrier(int nid, int nthr, int per_node, samples_t *s)
+{
+	int counts[MAX_POPCORN_NODES] = { 0 };
+	struct popcorn_barrier node_barrier;
+	pthread_barrier_t barrier;
+	pthread_t tid[nthr];
+	waiter_t w[nthr];
+	int i, rc;
+
+	/* The second half of the threads on the node. */
+	for (i = 0; i < nthr; i++)
+		counts[i < nthr / 2 ? home : nid]++;
+	if (per_node)
+		rc = popcorn_barrier_init(&node_barrier, counts);
+	else
+		rc = pthread_barrier_init(&barrier, NULL, nthr);
+	if (rc) {
+		fprintf(stderr, "popcornmicro: barrier of %d threads: %s\n",
+			nthr, strerror(rc));
+		exit(1);
+	}
+
+	for (i = 0; i < nthr; i++) {
+		w[i].nid = i < nthr / 2 ? home : nid;
+		w[i].serial = i == 0;
+		w[i].barrier = per_node ? NULL : &barrier;
+		w[i].node_barrier = per_node ? &node_barrier : NULL;
+		w[i].s = s;
+		pthread_create(&tid[i], NULL, waiter, &w[i]);
+	}
+	for (i = 0; i < nthr; i++)
+		pthread_join(tid[i], NULL);
+
+	if (per_node)
+		popcorn_barrier_destroy(&node_barrier);
+	else
+		pthread_barrier_destroy(&barrier);
+	report(s, per_node ? "barrier_node" : "barrier", nid, 0, nthr);
+}
+
+/*
+ * Options
+ */
+
+static size_t parse_size(const char *s)
+{
+	char *end;
+	size_t v = strtoull(s, &end, 10);
+
+	switch (*end) {
+	case 'G': case 'g':
+		v <<= 10;
+		/* fall through */
+	case 'M': case 'm':
+		v <<= 10;
+		/* fall through */
+	case 'K': case 'k':
+		v <<= 10;
+		end++;
+		break;
+	}
+	if (*end != '\0' || v == 0) {
+		fprintf(stderr, "popcornmicro: bad size %s\n", s);
+		exit(1);
+	}
+	return (v + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+/* Hands each value of a comma separated list to 'parse', returns how many
+ * there were. */
+static int parse_list(char *list, void (*parse)(const char *, int),
+		      int max)
+{
+	char *tok, *save;
+	int n = 0;
+
+	for (tok = strtok_r(list, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		if (n == max) {
+			fprintf(stderr, "popcornmicro: at most %d values\n",
+				max);
+			exit(1);
+		}
+		parse(tok, n++);
+	}
+	return n;
+}
+
+static void set_size(const char *s, int i)
+{
+	sizes[i] = parse_size(s);
+}
+
+static void set_threads(const char *s, int i)
+{
+	threads[i] = atoi(s);
+	if (threads[i] < 2) {
+		fprintf(stderr, "popcornmicro: a barrier needs 2 threads\n");
+		exit(1);
+	}
+}
+
+static void set_node(const char *s, int i)
+{
+	nodes[i] = atoi(s);
+}
+
+static void set_test(const char *s, int i)
+{
+	size_t j;
+
+	(void)i;
+	for (j = 0; j < sizeof(test_names) / sizeof(test_names[0]); j++) {
+		if (strcmp(s, test_names[j].name) == 0) {
+			tests |= test_names[j].flag;
+			return;
+		}
+	}
+	fprintf(stderr, "popcornmicro: unknown test %s\n", s);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"Usage: popcornmicro [options]\n"
+"  -n <nid,...>   nodes to measure, default every online one but home\n"
+"  -b <test,...>  migrate, fault, pingpong, share, barrier; default all\n"
+"  -r <n>         round trips, waits and samples per test, default %d\n"
+"  -s <size,...>  working sets of the fault test (K, M, G), default\n"
+"                 4K,64K,1M,16M\n"
+"  -t <n,...>     threads of the barrier test, default 2,4,8\n"
+"  -o <file>      write the cost model to file, default stdout\n",
+		reps);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = NULL;
+	samples_t s = { NULL, 0, 0 };
+	int c, i, j, nid;
+
+	while ((c = getopt(argc, argv, "n:b:r:s:t:o:h")) != -1) {
+		switch (c) {
+		case 'n':
+			nnodes = parse_list(optarg, set_node, MAX_POPCORN_NODES);
+			break;
+		case 'b':
+			tests = 0;
+			parse_list(optarg, set_test, MAX_LIST);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		case 's':
+			nsizes = parse_list(optarg, set_size, MAX_LIST);
+			break;
+		case 't':
+			nthreads = parse_list(optarg, set_threads, MAX_LIST);
+			break;
+		case 'o':
+			path = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (reps <= 0)
+		usage();
+
+	home = popcorn_nodes_home();
+	if (nnodes == 0) {
+		for (i = 0; i < MAX_POPCORN_NODES; i++)
+			if (i != home && popcorn_nodes_online(i))
+				nodes[nnodes++] = i;
+	}
+	if (nnodes == 0) {
+		fprintf(stderr, "popcornmicro: no node to measure\n");
+		return 1;
+	}
+
+	out = stdout;
+	if (path && (out = fopen(path, "w")) == NULL) {
+		perror(path);
+		return 1;
+	}
+	fprintf(out, "# popcornmicro home=%d nodes=", home);
+	for (i = 0; i < nnodes; i++)
+		fprintf(out, "%s%d", i ? "," : "", nodes[i]);
+	fprintf(out, "\nprimitive\tnid\tbytes\tthreads\tn\tmean_ns\tp50_ns"
+		"\tp99_ns\n");
+
+	for (i = 0; i < nnodes; i++) {
+		nid = nodes[i];
+		if (tests & TEST_MIGRATE)
+			bench_migrate(nid, &s);
+		if (tests & TEST_FAULT)
+			for (j = 0; j < nsizes; j++)
+				bench_fault(nid, sizes[j], &s);
+		if (tests & TEST_PINGPONG)
+			bench_pingpong(nid, &s);
+		if (tests & TEST_SHARE) {
+			bench_share(nid, sizeof(long), &s);
+			bench_share(nid, PAGE_SIZE, &s);
+		}
+		if (tests & TEST_BARRIER) {
+			for (j = 0; j < nthreads; j++) {
+				bench_barrier(nid, threads[j], 0, &s);
+				bench_barrier(nid, threads[j], 1, &s);
+			}
+		}
+	}
+
+	if (out != stdout)
+		fclose(out);
+	free(s.ns);
+	return 0;
+}
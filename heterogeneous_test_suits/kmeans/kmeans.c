@@ -8,11 +8,32 @@
 #include <pthread.h>
 #include <getopt.h>
 #include <errno.h>
+#include <signal.h>
 #include <sys/time.h>
+#include <limits.h>
+#include <float.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #include "migrate.h"
 #include "utils.h"
 
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_profile.h"
+#include "popcorn_arena.h"
+#include "popcorn_schedule.h"
+#include "popcorn_barrier.h"
+
+/* Region IDs for popcorn_profile.h */
+#define KMEANS_REGION_THREAD_LOOP 1
+
 #define _POPCORN_ALIGN_VARIABLES
 #define _POPCORN_ALIGN_HEAP
 #undef _POPCORN_PROFILE_REGION
@@ -29,6 +50,64 @@
 #endif
 
 
+/* Type of the coordinates, chosen at build time (make COORD=int16). The
+ * integer types keep the original grid of integer points and truncated
+ * means; float and double give real means. */
+#if defined(KMEANS_COORD_int16)
+typedef int16_t coord_t;
+typedef unsigned int dist_t;	/* Squared distances */
+typedef long long sum_t;		/* Sums of coordinates */
+#define COORD_NAME		"int16"
+#define COORD_TYPE		2
+#define COORD_MAX		INT16_MAX
+#define COORD_FMT		"%5d "
+#elif defined(KMEANS_COORD_float)
+typedef float coord_t;
+typedef float dist_t;
+typedef double sum_t;
+#define COORD_NAME		"float"
+#define COORD_TYPE		3
+#define COORD_FMT		"%9.3f "
+#elif defined(KMEANS_COORD_double)
+typedef double coord_t;
+typedef double dist_t;
+typedef double sum_t;
+#define COORD_NAME		"double"
+#define COORD_TYPE		4
+#define COORD_FMT		"%9.3f "
+#else
+typedef int coord_t;
+typedef unsigned int dist_t;
+typedef long long sum_t;
+#define COORD_NAME		"int32"
+#define COORD_TYPE		1
+#define COORD_MAX		INT_MAX
+#define COORD_FMT		"%5d "
+#endif
+
+/* COORD_MAX is only defined for the integer types */
+#ifdef COORD_MAX
+#define DIST_MAX		UINT_MAX
+#define COORD_RANDOM(r)	((coord_t)((r) % grid_size))
+#define COORD_ROUND(x)	((coord_t)lround(x))
+/* Slack on the pruning bounds, well below the smallest gap between two
+ * distinct distances of integer points */
+#define BOUND_EPS		1e-6
+#else
+#define DIST_MAX		INFINITY
+#define COORD_RANDOM(r)	((coord_t)(((r) >> 11) * 0x1.0p-53 * grid_size))
+#define COORD_ROUND(x)	((coord_t)(x))
+/* Slack on the pruning bounds, above the rounding error of a distance */
+#define BOUND_EPS		(grid_size * (sizeof(coord_t) == 4 ? 1e-4 : 1e-10))
+#endif
+
+/* The SIMD kernels work on 32 bit lanes: integers, widened if needed, or
+ * floats */
+#if (defined(COORD_MAX) || defined(KMEANS_COORD_float)) && \
+	(defined(__x86_64__) || defined(__aarch64__))
+#define KMEANS_SIMD
+#endif
+
 int num_points = 5000000;	/* number of vectors */
 int num_means = 100;		/* number of clusters */
 int dim = 3;				/* Dimension of each vector */
@@ -36,14 +115,193 @@ int grid_size = 1000;		/* size of each dimension of vector space */
 
 int num_nodes = 1;			/* Number of nodes to use */
 int threads_per_node = 8;	/* Threads per node */
+char *schedule_file = NULL;	/* Thread schedule, see popcorn_schedule.h */
+unsigned long long seed = 1;	/* Of the generated points and means */
+char *dataset_in = NULL;	/* Points to map instead of generating them */
+char *dataset_out = NULL;	/* File to save the generated points to */
+
+/* Dataset file: this header, then num_points * dim ints in host byte order
+ * (x86-64 and aarch64 are both little endian) */
+#define DATASET_MAGIC	"KMEANS01"
+struct dataset_header {
+	char magic[8];
+	int num_points;
+	int dim;
+	int grid_size;
+	int coord_type;		/* COORD_TYPE, 0 for int32 too */
+};
+void *dataset;				/* Mapping of dataset_in */
+size_t dataset_size;
+
+/* Mini-batch mode: every round assigns the next batch_size points of the
+ * dataset, streamed through small per thread buffers, and moves each mean
+ * towards the running average of the points it got. 0 for the full set. */
+int batch_size = 0;
+long long *batch_counts;	/* Points each mean got in all batches */
+double *batch_means;		/* The means before rounding to means */
+
+/* Points generated or copied at a time when they are streamed */
+#define POINTS_CHUNK	4096
+
+/* Other stopping criteria than no point changing cluster: the largest move
+ * of a mean in a round at most tolerance (if >= 0), and max_rounds rounds
+ * (if > 0, one pass over the points in mini-batch mode by default) */
+double tolerance = -1;
+int max_rounds = 0;
+
+/* How the means are updated after each assignment step */
+#define UPDATE_SCAN		0	/* Each thread rescans all points for its means */
+#define UPDATE_PARTIAL	1	/* Per thread partial sums, then a reduction */
+int update_mode = UPDATE_SCAN;
+
+/* Distance kernel of the assignment step */
+#define KERNEL_SCALAR	0
+#define KERNEL_SIMD		1	/* AVX2 on x86-64, NEON on aarch64, if available */
+#define KERNEL_GEMM		2	/* ||x||^2 + ||m||^2 - 2 x.m, the cross terms of a
+							 * tile of points and a block of means as a matrix
+							 * product, with SIMD if available */
+int dist_kernel = KERNEL_SIMD;
+
+/* KERNEL_GEMM: the micro-kernel computes the dot products of GEMM_MR points
+ * with GEMM_NR means, held in registers over all the coordinates */
+#define GEMM_MR			4
+#define GEMM_NR			16
+
+/* KERNEL_GEMM: bytes of means multiplied with a tile at a time */
+#define GEMM_BLOCK_BYTES	(128 * 1024)
+int gemm_block;
+
+/* Layout the assignment step reads the points in */
+#define LAYOUT_AOS		0	/* points[i * dim + j], as generated */
+#define LAYOUT_SOA		1	/* points_t[j * num_points + i], 8 points at once */
+#define LAYOUT_TILED	2	/* Tiles of points against blocks of means */
+int layout = LAYOUT_AOS;
+
+/* Points handled together by find_clusters(), a multiple of 8 */
+#define POINTS_TILE		64
+
+/* LAYOUT_TILED: bytes of means compared with a tile at a time */
+#define MEANS_TILE_BYTES	(16 * 1024)
+int means_tile;
+
+/* How the assignment step finds the closest mean */
+#define ASSIGN_FULL		0	/* Distance to every mean */
+#define ASSIGN_PRUNE	1	/* Skip the means ruled out by the triangle inequality */
+int assign_mode = ASSIGN_FULL;
+
+/* How the points are split between the threads for the assignment step */
+#define WORK_STATIC		0	/* A fixed slice per thread */
+#define WORK_STEAL		1	/* Chunks from a queue per node, then from the others */
+int work_mode = WORK_STATIC;
+
+/* WORK_STEAL: points per chunk, a multiple of POINTS_TILE */
+#define STEAL_CHUNK		(32 * POINTS_TILE)
+
+/* WORK_STEAL: the points of each node still to assign in the round, the
+ * first in the low half of 'range' and the end in the high half. The
+ * threads of the node take chunks from the front, those of other nodes
+ * from the back, both with a compare and swap. Each queue is in the arena
+ * of its node, on a page of its own. */
+typedef struct {
+	uint64_t range;
+} work_queue;
+
+work_queue *queues[MAX_POPCORN_NODES];
+int queue_first[MAX_POPCORN_NODES], queue_end[MAX_POPCORN_NODES];
+
+/* How the initial means are picked */
+#define SEED_RANDOM		0	/* Random points of the grid */
+#define SEED_PP			1	/* k-means++, one pick per round */
+#define SEED_PARALLEL	2	/* k-means||, then k-means++ on the candidates */
+int seed_mode = SEED_RANDOM;
+
+/* SEED_PARALLEL: sampling rounds, and points expected per round per mean */
+#define SEED_ROUNDS			5
+#define SEED_OVERSAMPLING	2
+
+/* Seeding: coordinates of the candidates so far, and the points sampled in
+ * the current round, in no particular order until main sorts them */
+coord_t *seed_cands;
+int seed_count, seed_cap;
+int *seed_new;
+int seed_new_count, seed_new_cap;
+int seed_rounds;
+
+/* Whether the node running the thread can use the SIMD kernel, -1 if not
+ * checked yet. Reset by every migration, as the other node may be of
+ * another ISA. */
+static __thread int simd_ok = -1;
 
-int modified = true;
-pthread_barrier_t barr;		/* Synchronization with main thread */
+int converged = false;		/* Set by main when a round changed nothing */
+struct popcorn_barrier barr;	/* Synchronization with main thread */
 
-int *points;
-int *means;
+coord_t *points;
+coord_t *means;
 int *clusters;
 
+/* UPDATE_PARTIAL: for every thread, the sum of the coordinates and the
+ * number of its points in each cluster, (dim + 1) values per cluster */
+sum_t **partials;
+
+/* Means of the SIMD kernel, transposed: coordinate j of mean i is at
+ * means_t[j * means_stride + i]. Rebuilt from means before each round. */
+coord_t *means_t;
+int means_stride;
+
+/* LAYOUT_SOA: the points, transposed */
+coord_t *points_t;
+
+/* KERNEL_GEMM: the means packed in panels of GEMM_NR, a panel being
+ * means_p[i * dim + j * GEMM_NR + c] for the means i + c, so that the
+ * micro-kernel reads it in order. Rebuilt with means_t. */
+coord_t *means_p;
+
+/* KERNEL_GEMM: the squared norm of each point, computed once with the
+ * points, and of each mean, rebuilt with means_t */
+dist_t *points_norm;
+dist_t *means_norm;
+
+/* ASSIGN_PRUNE, per point: upper bound on the distance to its mean and
+ * lower bound on the distance to any other mean (Hamerly's variant of
+ * Elkan's algorithm) */
+double *upper;
+double *lower;
+
+/* ASSIGN_PRUNE and the tolerance, per mean: how far it moved in the last
+ * update, written by the thread updating it */
+coord_t *means_old;
+double *drift;
+
+/* What each thread reports of a round, and its own pruning state. Every
+ * thread allocates its own on its node, so that the counters written in
+ * every round do not share a page with those of other threads. */
+typedef struct {
+	long long changes;	/* Points that changed cluster */
+	long long evals;	/* Distances computed */
+	double moved;		/* Largest move of its means in the last update */
+
+	/* ASSIGN_PRUNE: the two largest moves of the means, for the lower
+	 * bounds, and half the distance from each mean to the closest other */
+	double drift_max, drift_max2;
+	int drift_argmax;
+	double *half_gap;
+
+	/* Seeding: for each point of the thread the squared distance to the
+	 * closest candidate and that candidate, their sum, and the number of
+	 * points closest to each candidate */
+	dist_t *seed_d2;
+	int *seed_near;
+	double psi;
+	long long *seed_weights;
+
+	/* Time in the assignment step and waiting for the other threads after
+	 * it, and the chunks taken from other nodes */
+	double busy, idle;
+	long long stolen;
+} thread_state;
+
+thread_state **states;
+
 typedef struct {
 	/* Work splitting for calculating cluster */
 	int cluster_start_idx;
@@ -53,32 +311,168 @@ typedef struct {
 	int means_start_idx;
 	int means_num_pts;
 
-	/* Node id to run on */
+	/* Thread index in the schedule and node id to start on */
+	int tid;
 	int nid;
 #ifdef _ALIGN_VARIABLES
 	char _padding[PAGE_SIZE
-		- sizeof(int) * 5
+		- sizeof(int) * 6
 	];
 #endif
 }  thread_arg;
 
 
 /**
- * dump_points()
- *  Helper function to print out the points
+ * dump_means()
+ *  Helper function to print out the means
  */
-void dump_points(int *vals, int rows)
+void dump_means(void)
 {
 	int i, j;
 
-	for (i = 0; i < rows; i++) {
+	for (i = 0; i < num_means; i++) {
 		for (j = 0; j < dim; j++) {
-			PRINTF("%5d ",vals[i * dim + j]);
+			PRINTF(COORD_FMT, means[i * dim + j]);
 		}
 		PRINTF("\n");
 	}
 }
 
+/* Random streams of generate_points() */
+#define POINTS_STREAM	0
+#define MEANS_STREAM	1
+#define SEED_STREAM		2	/* Seeding draws */
+#define SAMPLE_STREAM	3	/* SEED_PARALLEL sampling, per point and round */
+
+/**
+ * random_at()
+ *  Value 'n' of the random stream 'stream' (splitmix64 of the counter), the
+ *  same whichever thread, node or libc computes it
+ */
+static inline uint64_t random_at(uint64_t stream, uint64_t n)
+{
+	uint64_t z = (seed ^ (stream << 56)) + (n + 1) * 0x9e3779b97f4a7c15ULL;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/**
+ * random_uniform()
+ *  random_at() as a double in [0, 1)
+ */
+static inline double random_uniform(uint64_t stream, uint64_t n)
+{
+	return (random_at(stream, n) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * generate_points()
+ *  Generate in 'pts' the points start to end - 1 of the random stream
+ *  'stream'
+ */
+void generate_points(coord_t *pts, int start, int end, int stream) 
+{   
+	int i, j;
+
+	for (i = start; i < end; i++) 
+	{
+		for (j = 0; j < dim; j++) 
+		{
+			pts[(i - start) * dim + j] = COORD_RANDOM(random_at(stream,
+					(uint64_t)i * dim + j));
+		}
+	}
+}
+
+/**
+ * map_dataset()
+ *  Map the points of a dataset file written with -o
+ */
+void map_dataset(const char *path)
+{
+	struct dataset_header *h;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+		perror(path);
+		exit(1);
+	}
+	dataset_size = st.st_size;
+	dataset = mmap(NULL, dataset_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (dataset_size < sizeof(*h) || dataset == MAP_FAILED) {
+		fprintf(stderr, "%s: not a dataset\n", path);
+		exit(1);
+	}
+
+	h = (struct dataset_header *)dataset;
+	if (memcmp(h->magic, DATASET_MAGIC, sizeof(h->magic)) ||
+			h->num_points <= 0 || h->dim <= 0 || h->grid_size <= 0 ||
+			dataset_size != sizeof(*h) +
+				sizeof(coord_t) * (size_t)h->num_points * h->dim) {
+		fprintf(stderr, "%s: not a dataset\n", path);
+		exit(1);
+	}
+	if (h->coord_type != COORD_TYPE && (h->coord_type || COORD_TYPE != 1)) {
+		fprintf(stderr, "%s: not a dataset of " COORD_NAME " points\n", path);
+		exit(1);
+	}
+	num_points = h->num_points;
+	dim = h->dim;
+	grid_size = h->grid_size;
+	points = (coord_t *)(h + 1);
+}
+
+/**
+ * save_dataset()
+ *  Write the points to a dataset file
+ */
+void save_dataset(const char *path)
+{
+	struct dataset_header h;
+	coord_t *buf;
+	int i, n;
+	FILE *fp;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, DATASET_MAGIC, sizeof(h.magic));
+	h.num_points = num_points;
+	h.dim = dim;
+	h.grid_size = grid_size;
+	h.coord_type = COORD_TYPE;
+
+	if ((fp = fopen(path, "wb")) == NULL ||
+			fwrite(&h, sizeof(h), 1, fp) != 1)
+		goto fail;
+
+	/* In mini-batch mode the points are not in memory: generate them a
+	 * chunk at a time */
+	if (points) {
+		if (fwrite(points, sizeof(coord_t) * dim, num_points, fp) !=
+				(size_t)num_points)
+			goto fail;
+	} else {
+		buf = (coord_t *)malloc(sizeof(coord_t) * dim * POINTS_CHUNK);
+		for (i = 0; i < num_points; i += n) {
+			n = num_points - i < POINTS_CHUNK ? num_points - i : POINTS_CHUNK;
+			generate_points(buf, i, i + n, POINTS_STREAM);
+			if (fwrite(buf, sizeof(coord_t) * dim, n, fp) != (size_t)n)
+				goto fail;
+		}
+		free(buf);
+	}
+	if (fclose(fp) != 0)
+		goto fail;
+	return;
+
+fail:
+	perror(path);
+	exit(1);
+}
+
 /**
  * parse_args()
  *  Parse the user arguments
@@ -89,7 +483,7 @@ void parse_args(int argc, char **argv)
 	extern char *optarg;
 	extern int optind;
 
-	while ((c = getopt(argc, argv, "d:c:p:s:n:t:h?")) != EOF) 
+	while ((c = getopt(argc, argv, "d:c:p:s:n:t:f:u:k:l:a:r:i:o:b:e:m:S:w:h?")) != EOF) 
 	{
 		switch (c) {
 			case 'd':
@@ -110,15 +504,118 @@ void parse_args(int argc, char **argv)
 			case 't':
 				threads_per_node = atoi(optarg);
 				break;
+			case 'f':
+				schedule_file = optarg;
+				break;
+			case 'u':
+				if (!strcmp(optarg, "scan"))
+					update_mode = UPDATE_SCAN;
+				else if (!strcmp(optarg, "partial"))
+					update_mode = UPDATE_PARTIAL;
+				else {
+					fprintf(stderr, "Illegal update mode '%s'. "
+							"Must be scan or partial\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'k':
+				if (!strcmp(optarg, "scalar"))
+					dist_kernel = KERNEL_SCALAR;
+				else if (!strcmp(optarg, "simd"))
+					dist_kernel = KERNEL_SIMD;
+				else if (!strcmp(optarg, "gemm"))
+					dist_kernel = KERNEL_GEMM;
+				else {
+					fprintf(stderr, "Illegal distance kernel '%s'. "
+							"Must be scalar, simd or gemm\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'l':
+				if (!strcmp(optarg, "aos"))
+					layout = LAYOUT_AOS;
+				else if (!strcmp(optarg, "soa"))
+					layout = LAYOUT_SOA;
+				else if (!strcmp(optarg, "tiled"))
+					layout = LAYOUT_TILED;
+				else {
+					fprintf(stderr, "Illegal layout '%s'. "
+							"Must be aos, soa or tiled\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'a':
+				if (!strcmp(optarg, "full"))
+					assign_mode = ASSIGN_FULL;
+				else if (!strcmp(optarg, "prune"))
+					assign_mode = ASSIGN_PRUNE;
+				else {
+					fprintf(stderr, "Illegal assignment '%s'. "
+							"Must be full or prune\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'r':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'i':
+				dataset_in = optarg;
+				break;
+			case 'o':
+				dataset_out = optarg;
+				break;
+			case 'b':
+				batch_size = atoi(optarg);
+				break;
+			case 'e':
+				tolerance = atof(optarg);
+				break;
+			case 'm':
+				max_rounds = atoi(optarg);
+				break;
+			case 'w':
+				if (!strcmp(optarg, "static"))
+					work_mode = WORK_STATIC;
+				else if (!strcmp(optarg, "steal"))
+					work_mode = WORK_STEAL;
+				else {
+					fprintf(stderr, "Illegal work distribution '%s'. "
+							"Must be static or steal\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'S':
+				if (!strcmp(optarg, "random"))
+					seed_mode = SEED_RANDOM;
+				else if (!strcmp(optarg, "pp"))
+					seed_mode = SEED_PP;
+				else if (!strcmp(optarg, "par"))
+					seed_mode = SEED_PARALLEL;
+				else {
+					fprintf(stderr, "Illegal seeding '%s'. "
+							"Must be random, pp or par\n", optarg);
+					exit(1);
+				}
+				break;
 			case 'h':
 			case '?':
 				printf("Usage: %s -d <vector dimension> -c <num clusters> "
 						"-p <num points> -s <grid size> -n <num nodes> "
-						"-t <threads per node>\n", argv[0]);
+						"-t <threads per node> -f <schedule file> "
+						"-u <scan | partial> -k <scalar | simd | gemm> "
+						"-l <aos | soa | tiled> -a <full | prune> "
+						"-r <seed> -i <dataset file> -o <dataset file> "
+						"-b <batch size> -e <tolerance> -m <max rounds> "
+						"-S <random | pp | par> -w <static | steal>\n",
+						argv[0]);
 				exit(1);
 		}
 	}
 
+	/* The dataset has its own size, dimension and grid */
+	if (dataset_in)
+		map_dataset(dataset_in);
+
 	if (dim <= 0 || num_means <= 0 || num_points <= 0 || grid_size <= 0) {
 		fprintf(stderr, "Illegal argument value. "
 				"All values must be numeric and greater than 0\n");
@@ -129,270 +626,1883 @@ void parse_args(int argc, char **argv)
 				"All values must be numeric and greater than 0\n");
 		exit(1);
 	}
+#ifdef COORD_MAX
+	if (grid_size - 1 > COORD_MAX) {
+		fprintf(stderr, "Illegal grid size. Must be at most %lld for "
+				COORD_NAME " coordinates\n", (long long)COORD_MAX + 1);
+		exit(1);
+	}
+	/* The squared distances, up to dim * (grid_size - 1)^2, are 32 bit */
+	if ((double)dim * (grid_size - 1) * (grid_size - 1) > DIST_MAX) {
+		fprintf(stderr, "Illegal grid size. Must be at most %lld for %d "
+				"dimensions of " COORD_NAME " coordinates\n",
+				(long long)sqrt((double)DIST_MAX / dim) + 1, dim);
+		exit(1);
+	}
+#endif
+	if (batch_size < 0 || max_rounds < 0) {
+		fprintf(stderr, "Illegal argument value. "
+				"Batch size and rounds cannot be negative\n");
+		exit(1);
+	}
+
+	/* Batches are assigned from the stream, with partial sums; the other
+	 * variants need all the points in memory */
+	if (batch_size && seed_mode != SEED_RANDOM) {
+		fprintf(stderr, "Illegal seeding. Mini-batch mode only "
+				"supports random\n");
+		exit(1);
+	}
+	if (batch_size && work_mode != WORK_STATIC) {
+		fprintf(stderr, "Illegal work distribution. Mini-batch mode only "
+				"supports static\n");
+		exit(1);
+	}
+	if (batch_size) {
+		if (batch_size > num_points)
+			batch_size = num_points;
+		if (max_rounds == 0)
+			max_rounds = (num_points + batch_size - 1) / batch_size;
+		update_mode = UPDATE_PARTIAL;
+		layout = LAYOUT_AOS;
+		assign_mode = ASSIGN_FULL;
+	}
 
 	printf("Dimension = %d\n", dim);
+	printf("Coordinates = " COORD_NAME "\n");
 	printf("Number of clusters = %d\n", num_means);
 	printf("Number of points = %d\n", num_points);
 	printf("Size of each dimension = %d\n", grid_size);
 	printf("Number of nodes = %d\n", num_nodes);
 	printf("Threads per node = %d\n", threads_per_node);
+	if (schedule_file)
+		printf("Schedule = %s\n", schedule_file);
+	if (dataset_in)
+		printf("Dataset = %s\n", dataset_in);
+	else
+		printf("Seed = %llu\n", seed);
+	printf("Means update = %s\n",
+			update_mode == UPDATE_PARTIAL ? "partial" : "scan");
+	printf("Layout = %s\n", layout == LAYOUT_SOA ? "soa" :
+			layout == LAYOUT_TILED ? "tiled" : "aos");
+	printf("Assignment = %s\n",
+			assign_mode == ASSIGN_PRUNE ? "prune" : "full");
+	printf("Work distribution = %s\n",
+			work_mode == WORK_STEAL ? "steal" : "static");
+	printf("Seeding = %s\n", seed_mode == SEED_PP ? "pp" :
+			seed_mode == SEED_PARALLEL ? "par" : "random");
+	if (batch_size)
+		printf("Mini-batch = %d points\n", batch_size);
+	if (tolerance >= 0)
+		printf("Tolerance = %g\n", tolerance);
+	if (max_rounds)
+		printf("Max rounds = %d\n", max_rounds);
 }
 
 /**
- * generate_points()
- *  Generate the points
+ * get_sq_norm()
+ *  Get the squared norm of a point. With integer coordinates it wraps like
+ *  get_sq_dist(), so that ||x||^2 + ||m||^2 - 2 x.m is the same distance.
  */
-void generate_points(int *pts, int size) 
-{   
-	int i, j;
+static inline dist_t get_sq_norm(coord_t *v)
+{
+	int i;
 
-	for (i=0; i<size; i++) 
+	dist_t x, sum = 0;
+	for (i = 0; i < dim; i++)
 	{
-		for (j=0; j<dim; j++) 
-		{
-			pts[i * dim + j] = rand() % grid_size;
-		}
+		x = v[i];
+		sum += x * x;
 	}
+	return sum;
+}
+
+/**
+ * prepare_points()
+ *  Generate (unless they come from a dataset file) and lay out the points
+ *  start to end - 1 of the calling thread, so that they are first touched
+ *  on its node
+ */
+void prepare_points(int start_idx, int end_idx)
+{
+	int i, j;
+
+	if (!dataset)
+		generate_points(&points[start_idx * dim], start_idx, end_idx,
+				POINTS_STREAM);
+	if (points_t)
+		for (i = start_idx; i < end_idx; i++)
+			for (j = 0; j < dim; j++)
+				points_t[j * num_points + i] = points[i * dim + j];
+	if (points_norm)
+		for (i = start_idx; i < end_idx; i++)
+			points_norm[i] = get_sq_norm(&points[i * dim]);
+	for (i = start_idx; i < end_idx; i++)
+		clusters[i] = -1;
 }
 
 /**
  * get_sq_dist()
  *  Get the squared distance between 2 points
  */
-static inline unsigned int get_sq_dist(int *v1, int *v2)
+static inline dist_t get_sq_dist(coord_t *v1, coord_t *v2)
 {
 	int i;
 
-	unsigned int sum = 0;
+	dist_t diff, sum = 0;
 	for (i = 0; i < dim; i++) 
 	{
-		sum += ((v1[i] - v2[i]) * (v1[i] - v2[i])); 
+		diff = v1[i] - v2[i];
+		sum += diff * diff; 
 	}
 	return sum;
 }
 
 /**
- * add_to_sum()
- *	Helper function to update the total distance sum
+ * simd_supported()
+ *  Whether the node running the calling thread has the SIMD kernel
+ */
+static int simd_supported(void)
+{
+#if !defined(KMEANS_SIMD)
+	return 0;
+#elif defined(__x86_64__)
+	/* Every AVX2 CPU has FMA, which the float GEMM micro-kernel uses */
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(__aarch64__)
+	return 1;	/* NEON is part of the base ISA */
+#else
+	return 0;
+#endif
+}
+
+static inline int use_simd(void)
+{
+	if (dist_kernel == KERNEL_SCALAR)
+		return 0;
+	if (simd_ok < 0)
+		simd_ok = simd_supported();
+	return simd_ok;
+}
+
+/**
+ * transpose_means()
+ *  Rebuild means_t, and means_p and means_norm for KERNEL_GEMM, from the
+ *  given means
+ */
+void transpose_means(int start_idx, int end_idx)
+{
+	int i, j, c;
+
+	for (i = start_idx; i < end_idx; i++)
+		for (j = 0; j < dim; j++)
+			means_t[j * means_stride + i] = means[i * dim + j];
+	if (means_p)
+		for (i = start_idx; i < end_idx; i++)
+		{
+			c = i % GEMM_NR;
+			for (j = 0; j < dim; j++)
+				means_p[(i - c) * dim + j * GEMM_NR + c] = means[i * dim + j];
+			means_norm[i] = get_sq_norm(&means[i * dim]);
+		}
+}
+
+/**
+ * measure_drift()
+ *  How far the given means moved in the last update. Returns the largest
+ *  move.
  */
-void add_to_sum(int *sum, int *point)
+double measure_drift(int start_idx, int end_idx)
 {
+	double max = 0;
 	int i;
 
-	for (i = 0; i < dim; i++)
+	for (i = start_idx; i < end_idx; i++)
 	{
-		sum[i] += point[i];   
-	}   
+		drift[i] = sqrt(get_sq_dist(&means[i * dim], &means_old[i * dim]));
+		if (drift[i] > max)
+			max = drift[i];
+	}
+	memcpy(&means_old[start_idx * dim], &means[start_idx * dim],
+			sizeof(coord_t) * (end_idx - start_idx) * dim);
+	return max;
 }
 
 /**
- * find_clusters()
- *  Find the cluster that is most suitable for a given set of points
+ * prepare_pruning()
+ *  ASSIGN_PRUNE: the largest moves of the means and how far apart they are,
+ *  for the bounds of the next round. Every thread computes its own copy,
+ *  which spares a barrier per round.
  */
-void find_clusters(int start_idx, int end_idx) 
+void prepare_pruning(thread_state *st)
 {
+	dist_t d, min_d;
 	int i, j;
-	unsigned int min_dist, cur_dist;
-	int min_idx;
-#ifdef _ALIGN_VARIABLES
-	int local_modified = false;
-#endif
 
-	for (i = start_idx; i < end_idx; i++) 
+	st->drift_max = st->drift_max2 = 0;
+	st->drift_argmax = -1;
+	for (i = 0; i < num_means; i++)
 	{
-		min_dist = get_sq_dist(&points[i * dim], &means[0]);
-		min_idx = 0; 
-		for (j = 1; j < num_means; j++)
-		{
-			cur_dist = get_sq_dist(&points[i * dim], &means[j * dim]);
-			if (cur_dist < min_dist) 
-			{
-				min_dist = cur_dist;
-				min_idx = j;   
-			}
+		if (drift[i] > st->drift_max) {
+			st->drift_max2 = st->drift_max;
+			st->drift_max = drift[i];
+			st->drift_argmax = i;
+		} else if (drift[i] > st->drift_max2) {
+			st->drift_max2 = drift[i];
 		}
+	}
 
-		if (clusters[i] != min_idx) 
+	for (i = 0; i < num_means; i++)
+	{
+		min_d = DIST_MAX;
+		for (j = 0; j < num_means; j++)
 		{
-			clusters[i] = min_idx;
-#ifndef _ALIGN_VARIABLES
-			modified = true;
-#else
-			local_modified = true;
-#endif
+			if (j == i)
+				continue;
+			d = get_sq_dist(&means[i * dim], &means[j * dim]);
+			if (d < min_d)
+				min_d = d;
 		}
+		st->half_gap[i] = sqrt(min_d) / 2;
 	}
-#ifdef _ALIGN_VARIABLES
-	modified |= local_modified;
-#endif
 }
 
 /**
- * calc_means()
- *  Compute the means for the various clusters
+ * nearest_mean_scalar()
+ *  Compare a point with means lo to hi - 1 and keep in '*min_dist' and
+ *  '*min_idx' the closest one so far. Ties go to the lowest index.
  */
-void calc_means(int start_idx, int end_idx, int *sum)
+static void nearest_mean_scalar(coord_t *point, int lo, int hi,
+		dist_t *min_dist, int *min_idx)
 {
-	int i, j, grp_size;
+	dist_t cur_dist;
+	int j;
 
-	for (i = start_idx; i < end_idx; i++) 
+	for (j = lo; j < hi; j++)
 	{
-		memset(sum, 0, dim * sizeof(int));
-		grp_size = 0;
-
-		for (j = 0; j < num_points; j++)
+		cur_dist = get_sq_dist(point, &means[j * dim]);
+		if (cur_dist < *min_dist)
 		{
-			if (clusters[j] == i) 
-			{
-				add_to_sum(sum, &points[j * dim]);
-				grp_size++;
-			}   
+			*min_dist = cur_dist;
+			*min_idx = j;
 		}
+	}
+}
 
-		for (j = 0; j < dim; j++)
+/**
+ * nearest8_soa_scalar()
+ *  Closest mean of the 8 points from 'first', read from points_t
+ */
+static void nearest8_soa_scalar(int first, int *idx)
+{
+	dist_t cur_dist, min_dist, diff;
+	int i, j, k;
+
+	for (k = 0; k < 8; k++)
+	{
+		min_dist = DIST_MAX;
+		idx[k] = 0;
+		for (i = 0; i < num_means; i++)
 		{
-			//dprintf("div sum = %d, grp size = %d\n", sum[j], grp_size);
-			if (grp_size != 0)
-			{ 
-				means[i * dim + j] = sum[j] / grp_size;
+			cur_dist = 0;
+			for (j = 0; j < dim; j++)
+			{
+				diff = points_t[j * num_points + first + k] - means[i * dim + j];
+				cur_dist += diff * diff;
+			}
+			if (cur_dist < min_dist)
+			{
+				min_dist = cur_dist;
+				idx[k] = i;
 			}
 		}
 	}
 }
 
-static void *thread_loop(void *args)
+/**
+ * dots_panel_scalar()
+ *  KERNEL_GEMM micro-kernel: dot products of the GEMM_MR points 'row' with
+ *  the GEMM_NR means of the panel from 'i' in means_p. Integer products
+ *  wrap like get_sq_dist().
+ */
+static void dots_panel_scalar(coord_t **row, int i, dist_t (*dots)[GEMM_NR])
 {
-	thread_arg *targ = (thread_arg *)args;
-	int cluster_end = targ->cluster_start_idx + targ->cluster_num_pts;
-	int means_end = targ->means_start_idx + targ->means_num_pts;
-	int *sum;
-
-#ifdef _ALIGN_VARIABLES
-	sum = popcorn_malloc(sizeof(int) * dim);
-#else
-	sum = (int *)malloc(sizeof(int) * dim);
-#endif
-	migrate(targ->nid, NULL, NULL);
+	coord_t *panel = &means_p[i * dim];
+	int j, r, c;
 
-	/* Iterative loop */
-	while(modified)
+	for (r = 0; r < GEMM_MR; r++)
+		for (c = 0; c < GEMM_NR; c++)
+			dots[r][c] = 0;
+	for (j = 0; j < dim; j++)
 	{
-		/* Make sure everybody enters loop with previous modified value */
-		pthread_barrier_wait(&barr);
+		coord_t *m = &panel[j * GEMM_NR];
 
-		/* Wait for main thread to reset modified */
-		pthread_barrier_wait(&barr);
-		find_clusters(targ->cluster_start_idx, cluster_end);
+		for (r = 0; r < GEMM_MR; r++)
+		{
+			dist_t p = row[r][j];
 
-		/* Wait for all cluster updates */
-		pthread_barrier_wait(&barr);
-		calc_means(targ->means_start_idx, means_end, sum);
+			for (c = 0; c < GEMM_NR; c++)
+				dots[r][c] += p * (dist_t)m[c];
+		}
 	}
-
-	free(sum);
-	migrate(0, NULL, NULL);
-
-	return NULL;
 }
 
-int main(int argc, char **argv)
-{
-	struct timeval beginT, startT, endT;
-	int num_procs, curr_cluster, curr_mean, cluster_per_thread,
-		mean_per_thread, i, excess_cluster, excess_mean;
-	int iter = 0;
-	pthread_t *pid;
-	pthread_attr_t attr;
-	thread_arg *arg;
-
-	parse_args(argc, argv);
-
-	points = (int *)malloc(sizeof(int) * num_points * dim);
-	PRINTF("Generating points\n");
-	generate_points(points, num_points);
-
-	means = (int *)malloc(sizeof(int) * num_means * dim);
-	PRINTF("Generating means\n");
-	generate_points(means, num_means);
-
-	clusters = (int *)malloc(sizeof(int) * num_points);
-	memset(clusters, -1, sizeof(int) * num_points);
-
-	pthread_attr_init(&attr);
-	pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+#if defined(KMEANS_SIMD) && defined(COORD_MAX) && defined(__x86_64__)
+/* 8 coordinates from p, widened to 32 bits */
+#if defined(KMEANS_COORD_int16)
+#define LOAD8(p)	_mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *)(p)))
+#else
+#define LOAD8(p)	_mm256_loadu_si256((__m256i *)(p))
+#endif
 
-	num_procs = num_nodes * threads_per_node;
+/**
+ * nearest_mean_simd()
+ *  nearest_mean_scalar() comparing the point with 8 means at a time. 'lo'
+ *  is a multiple of 8.
+ */
+__attribute__((target("avx2")))
+static void nearest_mean_simd(coord_t *point, int lo, int hi,
+		dist_t *min_dist, int *min_idx)
+{
+	unsigned int d[8];
+	int i, j, k, n;
 
-	pid = (pthread_t *)malloc(sizeof(pthread_t) * num_procs);
-	pthread_barrier_init(&barr, NULL, num_procs + 1);
-	arg = (thread_arg *)popcorn_malloc(sizeof(thread_arg) * num_procs,1);
+	for (i = lo; i < hi; i += 8)
+	{
+		__m256i acc = _mm256_setzero_si256();
 
-	modified = true;
+		for (j = 0; j < dim; j++)
+		{
+			__m256i m = LOAD8(&means_t[j * means_stride + i]);
+			__m256i diff = _mm256_sub_epi32(m, _mm256_set1_epi32(point[j]));
 
-	/* Calculate clustering/mean update parameters & start threads. */
-	cluster_per_thread = num_points / num_procs;
-	excess_cluster = num_points % num_procs;
-	curr_cluster = 0;
-	mean_per_thread = num_means / num_procs;
-	excess_mean = num_means % num_procs;
-	curr_mean = 0;
-	for(i = 0; i < num_procs; i++)
-	{
-		arg[i].cluster_start_idx = curr_cluster;
-		arg[i].cluster_num_pts = cluster_per_thread;
-		if (excess_cluster > 0) {
-			arg[i].cluster_num_pts++;
-			excess_cluster--;
+			acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(diff, diff));
 		}
-		curr_cluster += arg[i].cluster_num_pts;
+		_mm256_storeu_si256((__m256i *)d, acc);
 
-		arg[i].means_start_idx = curr_mean;
-		arg[i].means_num_pts = mean_per_thread;
-		if (excess_mean > 0) {
-			arg[i].means_num_pts++;
-			excess_mean--;
+		n = hi - i < 8 ? hi - i : 8;
+		for (k = 0; k < n; k++)
+		{
+			if (d[k] < *min_dist)
+			{
+				*min_dist = d[k];
+				*min_idx = i + k;
+			}
 		}
-		curr_mean += arg[i].means_num_pts;
-
-		arg[i].nid = i / threads_per_node;
-		pthread_create(&pid[i], &attr, thread_loop, &arg[i]);
 	}
+}
 
-	printf("Starting iterative algorithm\n");
+/**
+ * nearest8_soa_simd()
+ *  nearest8_soa_scalar() with one point per lane
+ */
+__attribute__((target("avx2")))
+static void nearest8_soa_simd(int first, int *idx)
+{
+	__m256i min_dist = _mm256_set1_epi32(-1), best = _mm256_setzero_si256();
+	int i, j;
+
+	for (i = 0; i < num_means; i++)
+	{
+		__m256i acc = _mm256_setzero_si256(), lt;
+
+		for (j = 0; j < dim; j++)
+		{
+			__m256i p = LOAD8(&points_t[j * num_points + first]);
+			__m256i diff = _mm256_sub_epi32(p,
+					_mm256_set1_epi32(means[i * dim + j]));
+
+			acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(diff, diff));
+		}
+		/* Unsigned acc < min_dist */
+		lt = _mm256_andnot_si256(_mm256_cmpeq_epi32(acc, min_dist),
+				_mm256_cmpeq_epi32(_mm256_min_epu32(acc, min_dist), acc));
+		min_dist = _mm256_min_epu32(acc, min_dist);
+		best = _mm256_blendv_epi8(best, _mm256_set1_epi32(i), lt);
+	}
+	_mm256_storeu_si256((__m256i *)idx, best);
+}
+
+/**
+ * dots_panel_simd()
+ *  dots_panel_scalar() with the GEMM_NR means in two vectors and the
+ *  coordinate of each point broadcast
+ */
+__attribute__((target("avx2")))
+static void dots_panel_simd(coord_t **row, int i, dist_t (*dots)[GEMM_NR])
+{
+	__m256i acc[GEMM_MR][2];
+	coord_t *panel = &means_p[i * dim];
+	int j, r;
+
+	for (r = 0; r < GEMM_MR; r++)
+		acc[r][0] = acc[r][1] = _mm256_setzero_si256();
+	for (j = 0; j < dim; j++)
+	{
+		__m256i m0 = LOAD8(&panel[j * GEMM_NR]);
+		__m256i m1 = LOAD8(&panel[j * GEMM_NR + 8]);
+
+		for (r = 0; r < GEMM_MR; r++)
+		{
+			__m256i p = _mm256_set1_epi32(row[r][j]);
+
+			acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_mullo_epi32(p, m0));
+			acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_mullo_epi32(p, m1));
+		}
+	}
+	for (r = 0; r < GEMM_MR; r++)
+	{
+		_mm256_storeu_si256((__m256i *)dots[r], acc[r][0]);
+		_mm256_storeu_si256((__m256i *)(dots[r] + 8), acc[r][1]);
+	}
+}
+#elif defined(KMEANS_SIMD) && defined(COORD_MAX) && defined(__aarch64__)
+/* 4 coordinates from p, widened to 32 bits */
+#if defined(KMEANS_COORD_int16)
+#define LOAD4(p)	vmovl_s16(vld1_s16(p))
+#else
+#define LOAD4(p)	vld1q_s32(p)
+#endif
+
+/**
+ * nearest_mean_simd()
+ *  nearest_mean_scalar() comparing the point with 8 means at a time. 'lo'
+ *  is a multiple of 8.
+ */
+static void nearest_mean_simd(coord_t *point, int lo, int hi,
+		dist_t *min_dist, int *min_idx)
+{
+	unsigned int d[8];
+	int i, j, k, n;
+
+	for (i = lo; i < hi; i += 8)
+	{
+		int32x4_t dlo = vdupq_n_s32(0), dhi = vdupq_n_s32(0);
+
+		for (j = 0; j < dim; j++)
+		{
+			coord_t *m = &means_t[j * means_stride + i];
+			int32x4_t p = vdupq_n_s32(point[j]);
+			int32x4_t difflo = vsubq_s32(LOAD4(m), p);
+			int32x4_t diffhi = vsubq_s32(LOAD4(m + 4), p);
+
+			dlo = vmlaq_s32(dlo, difflo, difflo);
+			dhi = vmlaq_s32(dhi, diffhi, diffhi);
+		}
+		vst1q_u32(d, vreinterpretq_u32_s32(dlo));
+		vst1q_u32(d + 4, vreinterpretq_u32_s32(dhi));
+
+		n = hi - i < 8 ? hi - i : 8;
+		for (k = 0; k < n; k++)
+		{
+			if (d[k] < *min_dist)
+			{
+				*min_dist = d[k];
+				*min_idx = i + k;
+			}
+		}
+	}
+}
+
+/**
+ * nearest8_soa_simd()
+ *  nearest8_soa_scalar() with one point per lane
+ */
+static void nearest8_soa_simd(int first, int *idx)
+{
+	uint32x4_t min_lo = vdupq_n_u32(UINT_MAX), min_hi = vdupq_n_u32(UINT_MAX);
+	uint32x4_t best_lo = vdupq_n_u32(0), best_hi = vdupq_n_u32(0);
+	uint32x4_t lt, cur;
+	int i, j;
+
+	for (i = 0; i < num_means; i++)
+	{
+		int32x4_t dlo = vdupq_n_s32(0), dhi = vdupq_n_s32(0);
+
+		for (j = 0; j < dim; j++)
+		{
+			coord_t *p = &points_t[j * num_points + first];
+			int32x4_t m = vdupq_n_s32(means[i * dim + j]);
+			int32x4_t difflo = vsubq_s32(LOAD4(p), m);
+			int32x4_t diffhi = vsubq_s32(LOAD4(p + 4), m);
+
+			dlo = vmlaq_s32(dlo, difflo, difflo);
+			dhi = vmlaq_s32(dhi, diffhi, diffhi);
+		}
+		cur = vreinterpretq_u32_s32(dlo);
+		lt = vcltq_u32(cur, min_lo);
+		min_lo = vminq_u32(cur, min_lo);
+		best_lo = vbslq_u32(lt, vdupq_n_u32(i), best_lo);
+
+		cur = vreinterpretq_u32_s32(dhi);
+		lt = vcltq_u32(cur, min_hi);
+		min_hi = vminq_u32(cur, min_hi);
+		best_hi = vbslq_u32(lt, vdupq_n_u32(i), best_hi);
+	}
+	vst1q_u32((uint32_t *)idx, best_lo);
+	vst1q_u32((uint32_t *)idx + 4, best_hi);
+}
+
+/**
+ * dots_panel_simd()
+ *  dots_panel_scalar() with the GEMM_NR means in four vectors
+ */
+static void dots_panel_simd(coord_t **row, int i, dist_t (*dots)[GEMM_NR])
+{
+	int32x4_t acc[GEMM_MR][4];
+	coord_t *panel = &means_p[i * dim];
+	int j, r, q;
+
+	for (r = 0; r < GEMM_MR; r++)
+		for (q = 0; q < 4; q++)
+			acc[r][q] = vdupq_n_s32(0);
+	for (j = 0; j < dim; j++)
+	{
+		coord_t *m = &panel[j * GEMM_NR];
+		int32x4_t m0 = LOAD4(m), m1 = LOAD4(m + 4);
+		int32x4_t m2 = LOAD4(m + 8), m3 = LOAD4(m + 12);
+
+		for (r = 0; r < GEMM_MR; r++)
+		{
+			acc[r][0] = vmlaq_n_s32(acc[r][0], m0, row[r][j]);
+			acc[r][1] = vmlaq_n_s32(acc[r][1], m1, row[r][j]);
+			acc[r][2] = vmlaq_n_s32(acc[r][2], m2, row[r][j]);
+			acc[r][3] = vmlaq_n_s32(acc[r][3], m3, row[r][j]);
+		}
+	}
+	for (r = 0; r < GEMM_MR; r++)
+		for (q = 0; q < 4; q++)
+			vst1q_u32((uint32_t *)dots[r] + 4 * q,
+					vreinterpretq_u32_s32(acc[r][q]));
+}
+#elif defined(KMEANS_SIMD) && defined(__x86_64__)
+/**
+ * nearest_mean_simd()
+ *  nearest_mean_scalar() comparing the point with 8 means at a time. 'lo'
+ *  is a multiple of 8.
+ */
+__attribute__((target("avx2")))
+static void nearest_mean_simd(coord_t *point, int lo, int hi,
+		dist_t *min_dist, int *min_idx)
+{
+	float d[8];
+	int i, j, k, n;
+
+	for (i = lo; i < hi; i += 8)
+	{
+		__m256 acc = _mm256_setzero_ps();
+
+		for (j = 0; j < dim; j++)
+		{
+			__m256 m = _mm256_loadu_ps(&means_t[j * means_stride + i]);
+			__m256 diff = _mm256_sub_ps(m, _mm256_set1_ps(point[j]));
+
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(diff, diff));
+		}
+		_mm256_storeu_ps(d, acc);
+
+		n = hi - i < 8 ? hi - i : 8;
+		for (k = 0; k < n; k++)
+		{
+			if (d[k] < *min_dist)
+			{
+				*min_dist = d[k];
+				*min_idx = i + k;
+			}
+		}
+	}
+}
+
+/**
+ * nearest8_soa_simd()
+ *  nearest8_soa_scalar() with one point per lane
+ */
+__attribute__((target("avx2")))
+static void nearest8_soa_simd(int first, int *idx)
+{
+	__m256 min_dist = _mm256_set1_ps(INFINITY);
+	__m256i best = _mm256_setzero_si256();
+	int i, j;
+
+	for (i = 0; i < num_means; i++)
+	{
+		__m256 acc = _mm256_setzero_ps(), lt;
+
+		for (j = 0; j < dim; j++)
+		{
+			__m256 p = _mm256_loadu_ps(&points_t[j * num_points + first]);
+			__m256 diff = _mm256_sub_ps(p, _mm256_set1_ps(means[i * dim + j]));
+
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(diff, diff));
+		}
+		lt = _mm256_cmp_ps(acc, min_dist, _CMP_LT_OQ);
+		min_dist = _mm256_blendv_ps(min_dist, acc, lt);
+		best = _mm256_blendv_epi8(best, _mm256_set1_epi32(i),
+				_mm256_castps_si256(lt));
+	}
+	_mm256_storeu_si256((__m256i *)idx, best);
+}
+
+/**
+ * dots_panel_simd()
+ *  dots_panel_scalar() with the GEMM_NR means in two vectors and the
+ *  coordinate of each point broadcast
+ */
+__attribute__((target("avx2,fma")))
+static void dots_panel_simd(coord_t **row, int i, dist_t (*dots)[GEMM_NR])
+{
+	__m256 acc[GEMM_MR][2];
+	coord_t *panel = &means_p[i * dim];
+	int j, r;
+
+	for (r = 0; r < GEMM_MR; r++)
+		acc[r][0] = acc[r][1] = _mm256_setzero_ps();
+	for (j = 0; j < dim; j++)
+	{
+		__m256 m0 = _mm256_loadu_ps(&panel[j * GEMM_NR]);
+		__m256 m1 = _mm256_loadu_ps(&panel[j * GEMM_NR + 8]);
+
+		for (r = 0; r < GEMM_MR; r++)
+		{
+			__m256 p = _mm256_set1_ps(row[r][j]);
+
+			acc[r][0] = _mm256_fmadd_ps(p, m0, acc[r][0]);
+			acc[r][1] = _mm256_fmadd_ps(p, m1, acc[r][1]);
+		}
+	}
+	for (r = 0; r < GEMM_MR; r++)
+	{
+		_mm256_storeu_ps(dots[r], acc[r][0]);
+		_mm256_storeu_ps(dots[r] + 8, acc[r][1]);
+	}
+}
+#elif defined(KMEANS_SIMD) && defined(__aarch64__)
+/**
+ * nearest_mean_simd()
+ *  nearest_mean_scalar() comparing the point with 8 means at a time. 'lo'
+ *  is a multiple of 8.
+ */
+static void nearest_mean_simd(coord_t *point, int lo, int hi,
+		dist_t *min_dist, int *min_idx)
+{
+	float d[8];
+	int i, j, k, n;
+
+	for (i = lo; i < hi; i += 8)
+	{
+		float32x4_t dlo = vdupq_n_f32(0), dhi = vdupq_n_f32(0);
+
+		for (j = 0; j < dim; j++)
+		{
+			coord_t *m = &means_t[j * means_stride + i];
+			float32x4_t p = vdupq_n_f32(point[j]);
+			float32x4_t difflo = vsubq_f32(vld1q_f32(m), p);
+			float32x4_t diffhi = vsubq_f32(vld1q_f32(m + 4), p);
+
+			dlo = vaddq_f32(dlo, vmulq_f32(difflo, difflo));
+			dhi = vaddq_f32(dhi, vmulq_f32(diffhi, diffhi));
+		}
+		vst1q_f32(d, dlo);
+		vst1q_f32(d + 4, dhi);
+
+		n = hi - i < 8 ? hi - i : 8;
+		for (k = 0; k < n; k++)
+		{
+			if (d[k] < *min_dist)
+			{
+				*min_dist = d[k];
+				*min_idx = i + k;
+			}
+		}
+	}
+}
+
+/**
+ * nearest8_soa_simd()
+ *  nearest8_soa_scalar() with one point per lane
+ */
+static void nearest8_soa_simd(int first, int *idx)
+{
+	float32x4_t min_lo = vdupq_n_f32(INFINITY), min_hi = vdupq_n_f32(INFINITY);
+	uint32x4_t best_lo = vdupq_n_u32(0), best_hi = vdupq_n_u32(0);
+	uint32x4_t lt;
+	int i, j;
+
+	for (i = 0; i < num_means; i++)
+	{
+		float32x4_t dlo = vdupq_n_f32(0), dhi = vdupq_n_f32(0);
+
+		for (j = 0; j < dim; j++)
+		{
+			coord_t *p = &points_t[j * num_points + first];
+			float32x4_t m = vdupq_n_f32(means[i * dim + j]);
+			float32x4_t difflo = vsubq_f32(vld1q_f32(p), m);
+			float32x4_t diffhi = vsubq_f32(vld1q_f32(p + 4), m);
+
+			dlo = vaddq_f32(dlo, vmulq_f32(difflo, difflo));
+			dhi = vaddq_f32(dhi, vmulq_f32(diffhi, diffhi));
+		}
+		lt = vcltq_f32(dlo, min_lo);
+		min_lo = vbslq_f32(lt, dlo, min_lo);
+		best_lo = vbslq_u32(lt, vdupq_n_u32(i), best_lo);
+
+		lt = vcltq_f32(dhi, min_hi);
+		min_hi = vbslq_f32(lt, dhi, min_hi);
+		best_hi = vbslq_u32(lt, vdupq_n_u32(i), best_hi);
+	}
+	vst1q_u32((uint32_t *)idx, best_lo);
+	vst1q_u32((uint32_t *)idx + 4, best_hi);
+}
+
+/**
+ * dots_panel_simd()
+ *  dots_panel_scalar() with the GEMM_NR means in four vectors
+ */
+static void dots_panel_simd(coord_t **row, int i, dist_t (*dots)[GEMM_NR])
+{
+	float32x4_t acc[GEMM_MR][4];
+	coord_t *panel = &means_p[i * dim];
+	int j, r, q;
+
+	for (r = 0; r < GEMM_MR; r++)
+		for (q = 0; q < 4; q++)
+			acc[r][q] = vdupq_n_f32(0);
+	for (j = 0; j < dim; j++)
+	{
+		coord_t *m = &panel[j * GEMM_NR];
+		float32x4_t m0 = vld1q_f32(m), m1 = vld1q_f32(m + 4);
+		float32x4_t m2 = vld1q_f32(m + 8), m3 = vld1q_f32(m + 12);
+
+		for (r = 0; r < GEMM_MR; r++)
+		{
+			acc[r][0] = vfmaq_n_f32(acc[r][0], m0, row[r][j]);
+			acc[r][1] = vfmaq_n_f32(acc[r][1], m1, row[r][j]);
+			acc[r][2] = vfmaq_n_f32(acc[r][2], m2, row[r][j]);
+			acc[r][3] = vfmaq_n_f32(acc[r][3], m3, row[r][j]);
+		}
+	}
+	for (r = 0; r < GEMM_MR; r++)
+		for (q = 0; q < 4; q++)
+			vst1q_f32(dots[r] + 4 * q, acc[r][q]);
+}
+#endif
+
+static inline void nearest_mean_range(coord_t *point, int lo, int hi,
+		dist_t *min_dist, int *min_idx)
+{
+#ifdef KMEANS_SIMD
+	if (use_simd()) {
+		nearest_mean_simd(point, lo, hi, min_dist, min_idx);
+		return;
+	}
+#endif
+	nearest_mean_scalar(point, lo, hi, min_dist, min_idx);
+}
+
+static inline int nearest_mean(coord_t *point)
+{
+	dist_t min_dist = DIST_MAX;
+	int min_idx = 0;
+
+	nearest_mean_range(point, 0, num_means, &min_dist, &min_idx);
+	return min_idx;
+}
+
+static inline void nearest8_soa(int first, int *idx)
+{
+#ifdef KMEANS_SIMD
+	if (use_simd()) {
+		nearest8_soa_simd(first, idx);
+		return;
+	}
+#endif
+	nearest8_soa_scalar(first, idx);
+}
+
+static inline void dots_panel(coord_t **row, int i, dist_t (*dots)[GEMM_NR])
+{
+#ifdef KMEANS_SIMD
+	if (use_simd()) {
+		dots_panel_simd(row, i, dots);
+		return;
+	}
+#endif
+	dots_panel_scalar(row, i, dots);
+}
+
+/**
+ * nearest_means_gemm()
+ *  KERNEL_GEMM: closest mean of the 'n' (at most POINTS_TILE) points 'pts',
+ *  of squared norms 'pnorm', with the distances expanded as
+ *  ||x||^2 + ||m||^2 - 2 x.m. The cross terms are computed a block of
+ *  gemm_block means at a time, which stays in cache for the whole tile,
+ *  GEMM_MR points by GEMM_NR means per micro-kernel call. Ties go to the
+ *  lowest index, as with the other kernels.
+ */
+static void nearest_means_gemm(coord_t *pts, dist_t *pnorm, int n, int *idx)
+{
+	dist_t min_dist[POINTS_TILE], dots[GEMM_MR][GEMM_NR], d;
+	coord_t *row[GEMM_MR];
+	int k, r, c, i, lo, hi;
+
+	for (k = 0; k < n; k++)
+	{
+		min_dist[k] = DIST_MAX;
+		idx[k] = 0;
+	}
+	for (lo = 0; lo < num_means; lo += gemm_block)
+	{
+		hi = lo + gemm_block < num_means ? lo + gemm_block : num_means;
+		for (k = 0; k < n; k += GEMM_MR)
+		{
+			/* A short last group computes its first point again */
+			for (r = 0; r < GEMM_MR; r++)
+				row[r] = &pts[(k + r < n ? k + r : k) * dim];
+
+			/* means_p is padded to a whole last panel */
+			for (i = lo; i < hi; i += GEMM_NR)
+			{
+				dots_panel(row, i, dots);
+				for (r = 0; r < GEMM_MR && k + r < n; r++)
+				{
+					for (c = 0; c < GEMM_NR && i + c < hi; c++)
+					{
+						d = pnorm[k + r] + means_norm[i + c] -
+								2 * dots[r][c];
+						if (d < min_dist[k + r])
+						{
+							min_dist[k + r] = d;
+							idx[k + r] = i + c;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+/**
+ * nearest_means()
+ *  Closest mean of the 'n' (at most POINTS_TILE) points from 'first', in
+ *  the layout selected with -l
+ */
+static void nearest_means(int first, int n, int *idx)
+{
+	dist_t min_dist[POINTS_TILE];
+	int k, lo, hi;
+
+	/* KERNEL_GEMM reads the points in place, whatever the layout */
+	if (dist_kernel == KERNEL_GEMM) {
+		nearest_means_gemm(&points[first * dim], &points_norm[first], n, idx);
+		return;
+	}
+
+	switch (layout) {
+	case LAYOUT_TILED:
+		/* All the points of the tile against one block of means at a
+		 * time, so that the block stays in cache */
+		for (k = 0; k < n; k++)
+		{
+			min_dist[k] = DIST_MAX;
+			idx[k] = 0;
+		}
+		for (lo = 0; lo < num_means; lo += means_tile)
+		{
+			hi = lo + means_tile < num_means ? lo + means_tile : num_means;
+			for (k = 0; k < n; k++)
+				nearest_mean_range(&points[(first + k) * dim], lo, hi,
+						&min_dist[k], &idx[k]);
+		}
+		break;
+	case LAYOUT_SOA:
+		for (k = 0; k + 8 <= n; k += 8)
+			nearest8_soa(first + k, &idx[k]);
+		for (; k < n; k++)
+			idx[k] = nearest_mean(&points[(first + k) * dim]);
+		break;
+	default:
+		for (k = 0; k < n; k++)
+			idx[k] = nearest_mean(&points[(first + k) * dim]);
+		break;
+	}
+}
+
+/**
+ * nearest_mean_pruned()
+ *  ASSIGN_PRUNE: closest mean of point 'i'. The point keeps its mean
+ *  without computing any distance when its upper bound is below half the
+ *  gap to the closest other mean or below its lower bound, and with one
+ *  distance when the tightened upper bound is. Only the other points are
+ *  compared with all the means. Adds the distances computed to '*evals'.
+ */
+static int nearest_mean_pruned(int i, const thread_state *st,
+		long long *evals)
+{
+	coord_t *point = &points[i * dim];
+	int a = clusters[i], j, min_idx = 0;
+	dist_t cur_dist, min_dist, min_dist2;
+	double bound;
+
+	if (a >= 0) {
+		upper[i] += drift[a];
+		lower[i] -= a == st->drift_argmax ? st->drift_max2 : st->drift_max;
+		bound = lower[i] > st->half_gap[a] ? lower[i] : st->half_gap[a];
+		if (upper[i] + BOUND_EPS < bound)
+			return a;
+
+		upper[i] = sqrt(get_sq_dist(point, &means[a * dim]));
+		(*evals)++;
+		if (upper[i] + BOUND_EPS < bound)
+			return a;
+	}
+
+	/* The closest and second closest means. Ties go to the lowest index,
+	 * as in nearest_mean(), and leave lower == upper. */
+	min_dist = min_dist2 = DIST_MAX;
+	for (j = 0; j < num_means; j++)
+	{
+		cur_dist = get_sq_dist(point, &means[j * dim]);
+		if (cur_dist < min_dist) {
+			min_dist2 = min_dist;
+			min_dist = cur_dist;
+			min_idx = j;
+		} else if (cur_dist < min_dist2) {
+			min_dist2 = cur_dist;
+		}
+	}
+	*evals += num_means;
+	upper[i] = sqrt(min_dist);
+	lower[i] = sqrt(min_dist2);
+	return min_idx;
+}
+
+/**
+ * add_to_sum()
+ *	Helper function to update the total distance sum
+ */
+void add_to_sum(sum_t *sum, coord_t *point)
+{
+	int i;
+
+	for (i = 0; i < dim; i++)
+	{
+		sum[i] += point[i];   
+	}   
+}
+
+/**
+ * assign_range()
+ *  Find the cluster that is most suitable for a given set of points. With
+ *  'psum' also add every point to the partial sum of its cluster. Adds to
+ *  'st' the points that changed cluster and the distances computed.
+ */
+static void assign_range(int start_idx, int end_idx, sum_t *psum,
+		thread_state *st)
+{
+	int i, j, t, n;
+	int min_idx, idx[POINTS_TILE];
+	long long evals = 0, changes = 0;
+
+	for (t = start_idx; t < end_idx; t += POINTS_TILE)
+	{
+		n = end_idx - t < POINTS_TILE ? end_idx - t : POINTS_TILE;
+		if (assign_mode == ASSIGN_PRUNE) {
+			for (i = 0; i < n; i++)
+				idx[i] = nearest_mean_pruned(t + i, st, &evals);
+		} else {
+			nearest_means(t, n, idx);
+			evals += (long long)n * num_means;
+		}
+
+		for (i = t; i < t + n; i++) 
+		{
+			min_idx = idx[i - t];
+
+			if (clusters[i] != min_idx) 
+			{
+				clusters[i] = min_idx;
+				changes++;
+			}
+
+			if (psum)
+			{
+				sum_t *s = &psum[min_idx * (dim + 1)];
+
+				for (j = 0; j < dim; j++)
+					s[j] += points[i * dim + j];
+				s[dim]++;
+			}
+		}
+	}
+	st->changes += changes;
+	st->evals += evals;
+}
 
+/**
+ * find_clusters()
+ *  assign_range() of the points start to end - 1, with fresh partial sums
+ *  and counters
+ */
+void find_clusters(int start_idx, int end_idx, sum_t *psum,
+		thread_state *st)
+{
+	if (psum)
+		memset(psum, 0, sizeof(sum_t) * num_means * (dim + 1));
+	st->changes = st->evals = 0;
+	assign_range(start_idx, end_idx, psum, st);
+}
+
+/**
+ * reset_queues()
+ *  Fill the queue of each node with its points, for the next round
+ */
+void reset_queues(void)
+{
+	int n;
+
+	for (n = 0; n < MAX_POPCORN_NODES; n++)
+		if (queues[n])
+			__atomic_store_n(&queues[n]->range,
+					(uint64_t)queue_end[n] << 32 | queue_first[n],
+					__ATOMIC_RELAXED);
+}
+
+/**
+ * take_chunk()
+ *  Take a chunk of points from the front (the node's own threads) or the
+ *  back (thieves) of a queue. Returns 0 once it is empty.
+ */
+static int take_chunk(work_queue *q, int front, int *start, int *end)
+{
+	uint64_t old = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE), range;
+	uint32_t first, last;
+
+	do {
+		first = (uint32_t)old;
+		last = old >> 32;
+		if (first >= last)
+			return 0;
+		if (front) {
+			*start = first;
+			*end = last - first > STEAL_CHUNK ? first + STEAL_CHUNK : last;
+			range = (uint64_t)last << 32 | (uint32_t)*end;
+		} else {
+			*start = last - first > STEAL_CHUNK ? last - STEAL_CHUNK : first;
+			*end = last;
+			range = (uint64_t)(uint32_t)*start << 32 | first;
+		}
+	} while (!__atomic_compare_exchange_n(&q->range, &old, range, 1,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	return 1;
+}
+
+/**
+ * steal_clusters()
+ *  find_clusters() for WORK_STEAL: the chunks of the thread's node, then
+ *  those left on the other nodes
+ */
+void steal_clusters(int nid, sum_t *psum, thread_state *st)
+{
+	int n, start, end;
+
+	if (psum)
+		memset(psum, 0, sizeof(sum_t) * num_means * (dim + 1));
+	st->changes = st->evals = 0;
+
+	while (take_chunk(queues[nid], 1, &start, &end))
+		assign_range(start, end, psum, st);
+	for (n = (nid + 1) % MAX_POPCORN_NODES; n != nid;
+			n = (n + 1) % MAX_POPCORN_NODES) {
+		if (!queues[n])
+			continue;
+		while (take_chunk(queues[n], 0, &start, &end)) {
+			assign_range(start, end, psum, st);
+			st->stolen++;
+		}
+	}
+}
+
+/**
+ * assign_batch()
+ *  Mini-batch mode: bring the 'n' points from 'first' (wrapping around the
+ *  dataset) into 'buf', a chunk at a time, and add each one to the partial
+ *  sum of its closest mean. Pages of a mapped dataset are dropped once
+ *  read, so that only the buffers stay in memory.
+ */
+void assign_batch(coord_t *buf, long long first, int n, sum_t *psum,
+		thread_state *st)
+{
+	int i, j, k, p, c, min_idx, idx[POINTS_TILE];
+	dist_t norm[POINTS_TILE];
+	uintptr_t lo, hi;
+
+	memset(psum, 0, sizeof(sum_t) * num_means * (dim + 1));
+
+	for (i = 0; i < n; i += c)
+	{
+		/* Up to the end of the buffer or of the dataset */
+		p = (first + i) % num_points;
+		c = n - i < num_points - p ? n - i : num_points - p;
+
+		if (dataset) {
+			memcpy(&buf[i * dim], &points[p * dim], sizeof(coord_t) * c * dim);
+			lo = ((uintptr_t)&points[p * dim] + PAGE_SIZE - 1) & PAGE_MASK;
+			hi = (uintptr_t)&points[(p + c) * dim] & PAGE_MASK;
+			if (hi > lo)
+				madvise((void *)lo, hi - lo, MADV_DONTNEED);
+		} else {
+			generate_points(&buf[i * dim], p, p + c, POINTS_STREAM);
+		}
+	}
+
+	for (i = 0; i < n; i += POINTS_TILE)
+	{
+		c = n - i < POINTS_TILE ? n - i : POINTS_TILE;
+		if (dist_kernel == KERNEL_GEMM) {
+			/* The buffer changes every round, so do its norms */
+			for (k = 0; k < c; k++)
+				norm[k] = get_sq_norm(&buf[(i + k) * dim]);
+			nearest_means_gemm(&buf[i * dim], norm, c, idx);
+		} else {
+			for (k = 0; k < c; k++)
+				idx[k] = nearest_mean(&buf[(i + k) * dim]);
+		}
+
+		for (k = 0; k < c; k++)
+		{
+			sum_t *s;
+
+			min_idx = idx[k];
+			s = &psum[min_idx * (dim + 1)];
+			for (j = 0; j < dim; j++)
+				s[j] += buf[(i + k) * dim + j];
+			s[dim]++;
+		}
+	}
+
+	st->changes = 0;
+	st->evals = (long long)n * num_means;
+}
+
+/**
+ * calc_means()
+ *  Compute the means for the various clusters
+ */
+void calc_means(int start_idx, int end_idx, sum_t *sum)
+{
+	int i, j, grp_size;
+
+	for (i = start_idx; i < end_idx; i++) 
+	{
+		memset(sum, 0, dim * sizeof(sum_t));
+		grp_size = 0;
+
+		for (j = 0; j < num_points; j++)
+		{
+			if (clusters[j] == i) 
+			{
+				add_to_sum(sum, &points[j * dim]);
+				grp_size++;
+			}   
+		}
+
+		for (j = 0; j < dim; j++)
+		{
+			//dprintf("div sum = %d, grp size = %d\n", sum[j], grp_size);
+			if (grp_size != 0)
+			{ 
+				means[i * dim + j] = sum[j] / grp_size;
+			}
+		}
+	}
+}
+
+/**
+ * reduce_means()
+ *  Compute the means for the various clusters from the partial sums of all
+ *  the threads
+ */
+void reduce_means(int start_idx, int end_idx, int num_procs)
+{
+	int i, j, t;
+	long long grp_size;
+	sum_t sum;
+
+	for (i = start_idx; i < end_idx; i++)
+	{
+		grp_size = 0;
+		for (t = 0; t < num_procs; t++)
+			grp_size += partials[t][i * (dim + 1) + dim];
+		if (grp_size == 0)
+			continue;
+
+		for (j = 0; j < dim; j++)
+		{
+			sum = 0;
+			for (t = 0; t < num_procs; t++)
+				sum += partials[t][i * (dim + 1) + j];
+			means[i * dim + j] = sum / grp_size;
+		}
+	}
+}
+
+/**
+ * update_batch_means()
+ *  Mini-batch mode: move each mean to the average of all the points it got
+ *  so far, from the partial sums of the last batch of all the threads
+ */
+void update_batch_means(int start_idx, int end_idx, int num_procs)
+{
+	int i, j, t;
+	long long grp_size;
+	sum_t sum;
+	double *m;
+
+	for (i = start_idx; i < end_idx; i++)
+	{
+		grp_size = 0;
+		for (t = 0; t < num_procs; t++)
+			grp_size += partials[t][i * (dim + 1) + dim];
+		if (grp_size == 0)
+			continue;
+		batch_counts[i] += grp_size;
+
+		m = &batch_means[i * dim];
+		for (j = 0; j < dim; j++)
+		{
+			sum = 0;
+			for (t = 0; t < num_procs; t++)
+				sum += partials[t][i * (dim + 1) + j];
+			m[j] += (sum - grp_size * m[j]) / batch_counts[i];
+			means[i * dim + j] = COORD_ROUND(m[j]);
+		}
+	}
+}
+
+/**
+ * seed_pick()
+ *  Append point i to the candidates sampled in this round
+ */
+static inline void seed_pick(int i)
+{
+	int c = __atomic_fetch_add(&seed_new_count, 1, __ATOMIC_RELAXED);
+
+	if (c < seed_new_cap)
+		seed_new[c] = i;
+}
+
+/**
+ * seed_thread()
+ *  The work of a thread for the seeding rounds. Each round the thread
+ *  updates the distances of its points to the candidates added by the last
+ *  round and, once all the sums are in, samples its points. Main then adds
+ *  the samples to the candidates. Three barriers per round, two more at
+ *  the end for the weights and the final means.
+ */
+static void seed_thread(int start_idx, int end_idx, thread_arg *targ,
+		thread_state *st)
+{
+	int num_procs = num_nodes * threads_per_node;
+	int n_pts = end_idx - start_idx;
+	int i, c, t, from = 0, to, last, round;
+	double total, prefix, target, acc, ell = (double)SEED_OVERSAMPLING *
+		num_means;
+	dist_t d, *d2;
+
+	st->seed_d2 = (dist_t *)popcorn_node_malloc(sizeof(dist_t) *
+			(n_pts ? n_pts : 1), targ->nid);
+	st->seed_near = (int *)popcorn_node_malloc(sizeof(int) *
+			(n_pts ? n_pts : 1), targ->nid);
+	for (i = 0; i < n_pts; i++)
+		st->seed_d2[i] = DIST_MAX;
+
+	for (round = 0; ; round++) {
+		to = seed_count;
+		st->psi = 0;
+		for (i = start_idx; i < end_idx; i++) {
+			d2 = &st->seed_d2[i - start_idx];
+			for (c = from; c < to; c++) {
+				d = get_sq_dist(&points[i * dim], &seed_cands[c * dim]);
+				if (d < *d2) {
+					*d2 = d;
+					st->seed_near[i - start_idx] = c;
+				}
+			}
+			st->psi += *d2;
+		}
+		from = to;
+		if (round == seed_rounds)
+			break;
+
+		/* Wait for all the sums, every thread adds them up in the same
+		 * order so that they all see the same total */
+		popcorn_barrier_wait(&barr, targ->nid);
+		for (t = 0, total = prefix = 0, last = 0; t < num_procs; t++) {
+			if (t == targ->tid)
+				prefix = total;
+			if (states[t]->psi > 0)
+				last = t;
+			total += states[t]->psi;
+		}
+
+		if (total > 0 && seed_mode == SEED_PP) {
+			/* One point for all the threads, the thread whose share of
+			 * the total has the target picks it */
+			target = random_uniform(SEED_STREAM, 1 + round) * total - prefix;
+			if (target >= 0 && st->psi > 0 &&
+					(target < st->psi || targ->tid == last)) {
+				for (i = 0, c = -1, acc = 0; i < n_pts; i++) {
+					if (st->seed_d2[i] == 0)
+						continue;
+					c = i;
+					acc += st->seed_d2[i];
+					if (acc > target)
+						break;
+				}
+				seed_pick(start_idx + c);
+			}
+		} else if (total > 0) {
+			/* Each point with probability ell * D^2 / total */
+			for (i = 0; i < n_pts; i++)
+				if (random_uniform(SAMPLE_STREAM, (uint64_t)round *
+						num_points + start_idx + i) * total <
+						ell * st->seed_d2[i])
+					seed_pick(start_idx + i);
+		}
+
+		/* Wait for all the samples, then for main to add them */
+		popcorn_barrier_wait(&barr, targ->nid);
+		popcorn_barrier_wait(&barr, targ->nid);
+	}
+
+	/* k-means|| reclusters the candidates weighted by their points */
+	if (seed_mode == SEED_PARALLEL) {
+		st->seed_weights = (long long *)popcorn_node_calloc(seed_count,
+				sizeof(long long), targ->nid);
+		for (i = 0; i < n_pts; i++)
+			st->seed_weights[st->seed_near[i]]++;
+	}
+
+	/* Wait for the weights, then for main to pick the means */
+	popcorn_barrier_wait(&barr, targ->nid);
+	popcorn_barrier_wait(&barr, targ->nid);
+
+	popcorn_node_free(st->seed_d2);
+	popcorn_node_free(st->seed_near);
+	popcorn_node_free(st->seed_weights);
+}
+
+/**
+ * seed_point()
+ *  Copy point i into 'dst', from the points or their random stream
+ */
+static void seed_point(coord_t *dst, int i)
+{
+	if (dataset)
+		memcpy(dst, &points[i * dim], sizeof(coord_t) * dim);
+	else
+		generate_points(dst, i, i + 1, POINTS_STREAM);
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * seed_recluster()
+ *  k-means++ on the candidates, each weighted by the number of points
+ *  closest to it. The means it cannot fill keep their random values.
+ */
+static void seed_recluster(int num_procs)
+{
+	double *w = (double *)malloc(sizeof(double) * seed_count);
+	double *d2 = (double *)malloc(sizeof(double) * seed_count);
+	double total, target, acc;
+	int c, m, t, pick;
+
+	for (c = 0; c < seed_count; c++) {
+		for (t = 0, w[c] = 0; t < num_procs; t++)
+			w[c] += states[t]->seed_weights[c];
+		d2[c] = 1;
+	}
+
+	for (m = 0; m < num_means; m++) {
+		for (c = 0, total = 0; c < seed_count; c++)
+			total += w[c] * d2[c];
+		if (total <= 0)
+			break;
+
+		target = random_uniform(SEED_STREAM, 1 + m) * total;
+		for (c = 0, pick = -1, acc = 0; c < seed_count; c++) {
+			if (w[c] * d2[c] == 0)
+				continue;
+			pick = c;
+			acc += w[c] * d2[c];
+			if (acc > target)
+				break;
+		}
+
+		memcpy(&means[m * dim], &seed_cands[pick * dim],
+				sizeof(coord_t) * dim);
+		for (c = 0; c < seed_count; c++) {
+			acc = get_sq_dist(&seed_cands[c * dim], &means[m * dim]);
+			if (m == 0 || acc < d2[c])
+				d2[c] = acc;
+		}
+	}
+
+	free(w);
+	free(d2);
+}
+
+/**
+ * seed_means()
+ *  Main's side of seed_thread(): add the samples of each round to the
+ *  candidates, in order of their index so that the run does not depend on
+ *  the threads, then pick the means from the candidates
+ */
+static void seed_means(int num_procs)
+{
+	int round, i, n;
+
+	for (round = 0; round < seed_rounds; round++) {
+		/* Sums, then samples */
+		popcorn_barrier_wait(&barr, 0);
+		popcorn_barrier_wait(&barr, 0);
+
+		n = seed_new_count < seed_new_cap ? seed_new_count : seed_new_cap;
+		qsort(seed_new, n, sizeof(int), cmp_int);
+		if (n > seed_cap - seed_count)
+			n = seed_cap - seed_count;
+		for (i = 0; i < n; i++)
+			seed_point(&seed_cands[(seed_count + i) * dim], seed_new[i]);
+		seed_count += n;
+		seed_new_count = 0;
+		popcorn_barrier_wait(&barr, 0);
+	}
+
+	/* Weights */
+	popcorn_barrier_wait(&barr, 0);
+	if (seed_mode == SEED_PARALLEL)
+		seed_recluster(num_procs);
+	else
+		memcpy(means, seed_cands, sizeof(coord_t) * dim *
+				(seed_count < num_means ? seed_count : num_means));
+	transpose_means(0, num_means);
+	if (means_old)
+		memcpy(means_old, means, sizeof(coord_t) * num_means * dim);
+	popcorn_barrier_wait(&barr, 0);
+}
+
+static void *thread_loop(void *args)
+{
+	thread_arg *targ = (thread_arg *)args;
+	int cluster_end = targ->cluster_start_idx + targ->cluster_num_pts;
+	int means_end = targ->means_start_idx + targ->means_num_pts;
+	int num_procs = num_nodes * threads_per_node;
+	int nid, cur_nid = targ->nid, round = 0;
+	int batch_first = 0, batch_n = 0;
+	coord_t *buf = NULL;
+	sum_t *sum = NULL, *psum = NULL;
+	double moved = DBL_MAX;
+	thread_state *st;
+	struct timeval startT, doneT, endT;
+
+	/* A thread placed on the home node runs the region there: profile it
+	 * all the same, the placement advisor compares both */
+	POPCORN_PROFILE_MIGRATE(KMEANS_REGION_THREAD_LOOP, targ->nid);
+	POPCORN_PROFILE_ENTER(KMEANS_REGION_THREAD_LOOP);
+	simd_ok = -1;
+
+	/* Allocated after the migration so that they are first touched on the
+	 * node that uses them */
+	if (update_mode == UPDATE_PARTIAL) {
+		psum = (sum_t *)popcorn_node_calloc(num_means * (dim + 1),
+				sizeof(sum_t), targ->nid);
+		partials[targ->tid] = psum;
+	} else {
+		sum = (sum_t *)popcorn_node_malloc(sizeof(sum_t) * dim, targ->nid);
+	}
+	st = (thread_state *)popcorn_node_calloc(1, sizeof(thread_state),
+			targ->nid);
+	if (assign_mode == ASSIGN_PRUNE)
+		st->half_gap = (double *)popcorn_node_malloc(
+				sizeof(double) * num_means, targ->nid);
+	states[targ->tid] = st;
+
+	/* In mini-batch mode the thread gets its share of each batch instead
+	 * of a fixed slice of the points */
+	if (batch_size) {
+		batch_first = (long long)targ->tid * batch_size / num_procs;
+		batch_n = (long long)(targ->tid + 1) * batch_size / num_procs
+			- batch_first;
+		buf = (coord_t *)popcorn_node_malloc(sizeof(coord_t) * dim *
+				(batch_n ? batch_n : 1), targ->nid);
+	} else {
+		prepare_points(targ->cluster_start_idx, cluster_end);
+	}
+	popcorn_barrier_wait(&barr, targ->nid);
+	if (seed_mode != SEED_RANDOM)
+		seed_thread(targ->cluster_start_idx, cluster_end, targ, st);
+
+	/* Iterative loop, two barriers per round: after the assignment and
+	 * after the means update. Transposing the means and measuring how far
+	 * they moved is done by each thread for its own means, and the
+	 * convergence test by main between the two barriers. The moves are
+	 * published with the counters of the next round. */
+	while (!converged)
+	{
+		/* Follow the schedule if it was reloaded since the last round */
+		nid = popcorn_schedule_node(KMEANS_REGION_THREAD_LOOP, targ->tid,
+				cur_nid);
+		if (nid != cur_nid) {
+			int rc = POPCORN_PROFILE_MIGRATE(KMEANS_REGION_THREAD_LOOP, nid);
+			if (rc == 0 || rc == EBUSY)
+				cur_nid = nid;
+			POPCORN_PROFILE_ENTER(KMEANS_REGION_THREAD_LOOP);
+			simd_ok = -1;
+		}
+
+		st->moved = moved;
+		gettimeofday(&startT, NULL);
+		if (batch_size) {
+			assign_batch(buf, (long long)round * batch_size + batch_first,
+					batch_n, psum, st);
+		} else {
+			if (assign_mode == ASSIGN_PRUNE)
+				prepare_pruning(st);
+			if (work_mode == WORK_STEAL)
+				steal_clusters(targ->nid, psum, st);
+			else
+				find_clusters(targ->cluster_start_idx, cluster_end, psum,
+						st);
+		}
+		gettimeofday(&doneT, NULL);
+
+		/* Wait for all cluster updates */
+		popcorn_barrier_wait(&barr, targ->nid);
+		gettimeofday(&endT, NULL);
+		st->busy += stopwatch_elapsed(&startT, &doneT);
+		st->idle += stopwatch_elapsed(&doneT, &endT);
+		if (batch_size)
+			update_batch_means(targ->means_start_idx, means_end, num_procs);
+		else if (psum)
+			reduce_means(targ->means_start_idx, means_end, num_procs);
+		else
+			calc_means(targ->means_start_idx, means_end, sum);
+		transpose_means(targ->means_start_idx, means_end);
+		if (means_old)
+			moved = measure_drift(targ->means_start_idx, means_end);
+		round++;
+
+		/* Wait for all means updates, and for main to check convergence */
+		popcorn_barrier_wait(&barr, targ->nid);
+	}
+
+	popcorn_node_free(sum);
+	popcorn_node_free(psum);
+	popcorn_node_free(buf);
+	POPCORN_PROFILE_MIGRATE(KMEANS_REGION_THREAD_LOOP, 0);
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct timeval beginT, startT, endT;
+	int num_procs, curr_cluster, curr_mean, cluster_per_thread,
+		mean_per_thread, i, n, k, nodes_used, excess_cluster, excess_mean;
+	int node_threads[MAX_POPCORN_NODES] = { 0 };
+	size_t node_cluster_start, node_cluster_pts, node_mean_start,
+		node_mean_pts;
+	int iter = 0;
+	long long changes, evals;
+	double moved, seedT;
+	pthread_t *pid;
+	pthread_attr_t attr;
+	thread_arg *arg;
+
+	parse_args(argc, argv);
+
+	/* An explicit -f must load, $POPCORN_SCHEDULE is optional */
+	if (popcorn_schedule_load(schedule_file, &n) == -1 && schedule_file) {
+		if (n)
+			fprintf(stderr, "%s:%d: invalid schedule line\n", schedule_file, n);
+		else
+			perror(schedule_file);
+		exit(1);
+	}
+	popcorn_schedule_signal(SIGHUP);
+
+	/* Generated by the threads, each on the node it starts on. Mini-batch
+	 * mode only keeps the batches in memory. */
+	if (!dataset && !batch_size)
+		points = (coord_t *)popcorn_node_malloc(
+				sizeof(coord_t) * num_points * dim, 0);
+
+	means = (coord_t *)popcorn_node_malloc(sizeof(coord_t) * num_means * dim, 0);
+	PRINTF("Generating means\n");
+	generate_points(means, 0, num_means, MEANS_STREAM);
+
+	if (batch_size) {
+		batch_counts = (long long *)popcorn_node_calloc(num_means,
+				sizeof(long long), 0);
+		batch_means = (double *)popcorn_node_malloc(
+				sizeof(double) * num_means * dim, 0);
+		for (i = 0; i < num_means * dim; i++)
+			batch_means[i] = means[i];
+	} else {
+		clusters = (int *)popcorn_node_malloc(sizeof(int) * num_points, 0);
+	}
+
+	/* Padded to whole SIMD vectors and GEMM panels, the padding is never a
+	 * candidate */
+	means_stride = (num_means + GEMM_NR - 1) & ~(GEMM_NR - 1);
+	means_t = (coord_t *)popcorn_node_calloc(means_stride * dim,
+			sizeof(coord_t), 0);
+	if (dist_kernel == KERNEL_GEMM) {
+		means_p = (coord_t *)popcorn_node_calloc(means_stride * dim,
+				sizeof(coord_t), 0);
+		means_norm = (dist_t *)popcorn_node_calloc(means_stride,
+				sizeof(dist_t), 0);
+	}
+	transpose_means(0, num_means);
+
+	if (layout == LAYOUT_SOA)
+		points_t = (coord_t *)popcorn_node_malloc(
+				sizeof(coord_t) * num_points * dim, 0);
+	if (dist_kernel == KERNEL_GEMM && !batch_size)
+		points_norm = (dist_t *)popcorn_node_malloc(
+				sizeof(dist_t) * num_points, 0);
+	if (assign_mode == ASSIGN_PRUNE) {
+		upper = (double *)popcorn_node_malloc(sizeof(double) * num_points, 0);
+		lower = (double *)popcorn_node_malloc(sizeof(double) * num_points, 0);
+	}
+	if (assign_mode == ASSIGN_PRUNE || tolerance >= 0) {
+		means_old = (coord_t *)popcorn_node_malloc(
+				sizeof(coord_t) * num_means * dim, 0);
+		memcpy(means_old, means, sizeof(coord_t) * num_means * dim);
+		drift = (double *)popcorn_node_calloc(num_means, sizeof(double), 0);
+	}
+	/* The first candidate is a random point. k-means++ adds one candidate
+	 * per round, k-means|| about ell per round. */
+	if (seed_mode != SEED_RANDOM) {
+		if (seed_mode == SEED_PP) {
+			seed_rounds = num_means - 1;
+			seed_new_cap = 1;
+			seed_cap = num_means;
+		} else {
+			seed_rounds = SEED_ROUNDS;
+			seed_new_cap = 4 * SEED_OVERSAMPLING * num_means + 64;
+			seed_cap = 1 + seed_rounds * seed_new_cap;
+		}
+		seed_cands = (coord_t *)popcorn_node_malloc(
+				sizeof(coord_t) * seed_cap * dim, 0);
+		seed_new = (int *)popcorn_node_malloc(sizeof(int) * seed_new_cap, 0);
+		seed_point(seed_cands, random_at(SEED_STREAM, 0) % num_points);
+		seed_count = 1;
+	}
+
+	/* Whole SIMD vectors of means, at least one */
+	means_tile = (MEANS_TILE_BYTES / (sizeof(coord_t) * dim)) & ~7;
+	if (means_tile < 8)
+		means_tile = 8;
+
+	/* Whole GEMM panels of means, at least one */
+	gemm_block = (GEMM_BLOCK_BYTES / (sizeof(coord_t) * dim)) & ~(GEMM_NR - 1);
+	if (gemm_block < GEMM_NR)
+		gemm_block = GEMM_NR;
+
+	printf("Distance kernel = %s%s\n",
+			dist_kernel == KERNEL_GEMM ? "gemm " : "", use_simd() ?
+#if defined(__x86_64__)
+			"avx2"
+#else
+			"neon"
+#endif
+			: "scalar");
+
+	pthread_attr_init(&attr);
+	pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+
+	num_procs = num_nodes * threads_per_node;
+
+	pid = (pthread_t *)malloc(sizeof(pthread_t) * num_procs);
+	arg = (thread_arg *)popcorn_node_malloc(sizeof(thread_arg) * num_procs, 0);
+	partials = (sum_t **)popcorn_node_calloc(num_procs, sizeof(sum_t *), 0);
+	states = (thread_state **)popcorn_node_calloc(num_procs,
+			sizeof(thread_state *), 0);
+
+	converged = false;
+
+	/* Place the threads. The schedule overrides the default of
+	 * threads_per_node consecutive threads on each node. */
+	for (i = 0; i < num_procs; i++)
+	{
+		arg[i].tid = i;
+		arg[i].nid = popcorn_schedule_node(KMEANS_REGION_THREAD_LOOP, i,
+				i / threads_per_node);
+		node_threads[arg[i].nid]++;
+	}
+	for (n = 0, nodes_used = 0; n < MAX_POPCORN_NODES; n++)
+		if (node_threads[n])
+			nodes_used++;
+
+	/* Threads sync on their node first, main with those of node 0 */
+	node_threads[0]++;
+	if ((n = popcorn_barrier_init(&barr, node_threads)) != 0) {
+		fprintf(stderr, "popcorn_barrier_init: %s\n", strerror(n));
+		exit(1);
+	}
+	node_threads[0]--;
+
+	/* Calculate clustering/mean update parameters & start threads. Each
+	 * node gets page aligned slices of clusters and means, so that threads
+	 * on different nodes never write to the same page. */
+	for (n = 0, k = 0; n < MAX_POPCORN_NODES; n++)
+	{
+		if (!node_threads[n])
+			continue;
+
+		popcorn_partition(num_points, sizeof(int), nodes_used, k,
+				&node_cluster_start, &node_cluster_pts);
+		popcorn_partition(num_means, sizeof(coord_t) * dim, nodes_used, k,
+				&node_mean_start, &node_mean_pts);
+		k++;
+
+		if (work_mode == WORK_STEAL) {
+			queues[n] = (work_queue *)popcorn_node_malloc(
+					sizeof(work_queue), n);
+			queue_first[n] = node_cluster_start;
+			queue_end[n] = node_cluster_start + node_cluster_pts;
+			reset_queues();
+		}
+
+		cluster_per_thread = node_cluster_pts / node_threads[n];
+		excess_cluster = node_cluster_pts % node_threads[n];
+		curr_cluster = node_cluster_start;
+		mean_per_thread = node_mean_pts / node_threads[n];
+		excess_mean = node_mean_pts % node_threads[n];
+		curr_mean = node_mean_start;
+		for (i = 0; i < num_procs; i++)
+		{
+			if (arg[i].nid != n)
+				continue;
+
+			arg[i].cluster_start_idx = curr_cluster;
+			arg[i].cluster_num_pts = cluster_per_thread;
+			if (excess_cluster > 0) {
+				arg[i].cluster_num_pts++;
+				excess_cluster--;
+			}
+			curr_cluster += arg[i].cluster_num_pts;
+
+			arg[i].means_start_idx = curr_mean;
+			arg[i].means_num_pts = mean_per_thread;
+			if (excess_mean > 0) {
+				arg[i].means_num_pts++;
+				excess_mean--;
+			}
+			curr_mean += arg[i].means_num_pts;
+
+			pthread_create(&pid[i], &attr, thread_loop, &arg[i]);
+		}
+	}
+
+	PRINTF("%s points\n", dataset ? "Preparing" : "Generating");
+	popcorn_barrier_wait(&barr, 0);
+	if (dataset_out)
+		save_dataset(dataset_out);
+
+	/* Seeding counts in the time to converge */
 	gettimeofday(&beginT, NULL);
-	/* Create the threads to process the distances between the various
-	   points and repeat until modified is no longer valid */
-	while (modified) 
+	if (seed_mode != SEED_RANDOM) {
+		printf("Seeding means\n");
+		seed_means(num_procs);
+	}
+	gettimeofday(&endT, NULL);
+	seedT = stopwatch_elapsed(&beginT, &endT);
+
+	printf("Starting iterative algorithm\n");
+	/* Let the threads process the distances between the various points
+	   and repeat until no point changes cluster, or another criterion
+	   is met */
+	while (!converged) 
 	{
-		/* Make sure all threads (including this one) see updates to modified
-		 * before continuing */
 		gettimeofday(&startT, NULL);
-		pthread_barrier_wait(&barr);
-		modified = false;
-		pthread_barrier_wait(&barr);
 		/* Find cluster */
-		pthread_barrier_wait(&barr);
+		popcorn_barrier_wait(&barr, 0);
+		for (i = 0, changes = 0, evals = 0, moved = 0; i < num_procs; i++) {
+			changes += states[i]->changes;
+			evals += states[i]->evals;
+			if (states[i]->moved > moved)
+				moved = states[i]->moved;
+		}
+		converged = (!batch_size && changes == 0) ||
+			(tolerance >= 0 && moved <= tolerance) ||
+			(max_rounds && iter + 1 >= max_rounds);
+		/* No thread takes chunks before the next round */
+		if (work_mode == WORK_STEAL)
+			reset_queues();
 		/* Calculate means */
+		popcorn_barrier_wait(&barr, 0);
 		gettimeofday(&endT, NULL);
-		PRINTF("%d  %.6lf  %.6lf\n", iter++,
+		/* The last column is the share of distances pruned */
+		PRINTF("%d  %.6lf  %.6lf  %.4lf\n", iter,
 				stopwatch_elapsed(&startT, &endT),
-				stopwatch_elapsed(&beginT, &endT));
+				stopwatch_elapsed(&beginT, &endT),
+				1 - (double)evals / ((double)(batch_size ? batch_size :
+						num_points) * num_means));
+		iter++;
 	}
 
 	for (i = 0; i < num_procs; i++) {
 		pthread_join(pid[i], NULL);   
+		printf("kmeans: Thread %d node %d busy %.6lf idle %.6lf "
+				"stolen %lld\n", i, arg[i].nid, states[i]->busy,
+				states[i]->idle, states[i]->stolen);
+		popcorn_node_free(states[i]->half_gap);
+		popcorn_node_free(states[i]);
 	}
+	for (n = 0; n < MAX_POPCORN_NODES; n++)
+		popcorn_node_free(queues[n]);
+	popcorn_barrier_destroy(&barr);
 
 	PRINTF("\n\nFinal means:\n");
-	dump_points(means, num_means);
+	dump_means();
+	printf("kmeans: Seeding %.6lf\n", seedT);
+	printf("kmeans: Rounds %d\n", iter);
 	printf("kmeans: Completed %.6lf\n\n", stopwatch_elapsed(&beginT, &endT));
 
+#ifdef _VERBOSE
+	popcorn_arena_dump(stdout);
+#endif
+
 	free(pid);
-	free(arg);
-	free(points);
-	free(means);
-	free(clusters);
+	popcorn_node_free(arg);
+	popcorn_node_free(partials);
+	if (dataset)
+		munmap(dataset, dataset_size);
+	else
+		popcorn_node_free(points);
+	popcorn_node_free(means);
+	popcorn_node_free(means_t);
+	popcorn_node_free(points_t);
+	popcorn_node_free(points_norm);
+	popcorn_node_free(means_p);
+	popcorn_node_free(means_norm);
+	popcorn_node_free(upper);
+	popcorn_node_free(lower);
+	popcorn_node_free(means_old);
+	popcorn_node_free(drift);
+	popcorn_node_free(states);
+	popcorn_node_free(clusters);
+	popcorn_node_free(batch_counts);
+	popcorn_node_free(batch_means);
+	popcorn_node_free(seed_cands);
+	popcorn_node_free(seed_new);
 
 	return 0;
 }
@@ -0,0 +1,170 @@
+#!/usr/bin/perl -w
+
+# this script provided "as is", without any warranties. use it at your own risk.
+#
+# this script builds a precompiled map file for the "precompiled" parameter
+# of the ngx_http_map_module from the lines in the map block format
+#
+#   /old/page.html  /new/page.html;
+#
+# keys are exact and case-insensitive, values are static strings.
+#
+#   map2db.pl [-s seed] < redirects.conf > redirects.map.new
+#   mv redirects.map.new redirects.map
+#
+# the file is replaced by rename() so that running workers keep the old
+# mapping until the reload.
+
+
+use warnings;
+use strict;
+
+my $seed = 0;
+
+while (@ARGV) {
+	my $arg = shift @ARGV;
+
+	if ($arg eq '-s' && @ARGV) {
+		$seed = shift(@ARGV) & 0xffffffff;
+		next;
+	}
+
+	die "usage: map2db.pl [-s seed] < map.conf > map.db\n";
+}
+
+binmode STDIN;
+binmode STDOUT;
+
+my (@keys, @values, %seen);
+
+while (<STDIN>) {
+	s/#.*//;
+	s/^\s+//;
+	s/[\s;]+$//;
+
+	next if $_ eq '';
+
+	my ($key, $value) = split /\s+/, $_, 2;
+
+	die "line $.: no value\n" unless defined $value;
+	die "line $.: variables are not supported\n" if $value =~ /^\$/;
+
+	$key =~ s/^\\//;
+	$key =~ tr/A-Z/a-z/;
+
+	die "line $.: conflicting parameter \"$key\"\n" if $seen{$key}++;
+	die "line $.: key or value is too long\n"
+		if length($key) > 65535 || length($value) > 65535;
+
+	push @keys, $key;
+	push @values, $value;
+}
+
+my $n = @keys;
+
+die "no keys\n" unless $n;
+
+# about 4 keys per bucket, about 10% of free slots keep the last buckets
+# cheap to place; a prime number of slots makes every step h2 full cycle
+
+my $nbuckets = int(($n + 3) / 4);
+my $nslots = next_prime(int($n * 1.1) + 2);
+
+my (@h1, @h2, @buckets);
+
+for my $i (0 .. $n - 1) {
+	my ($ha, $hb) = hash($keys[$i]);
+
+	push @{$buckets[mix($ha) % $nbuckets]}, $i;
+	$h1[$i] = mix($hb) % $nslots;
+	$h2[$i] = mix($ha ^ $hb ^ 0x9e3779b9) % ($nslots - 1) + 1;
+}
+
+my @disp = (0) x $nbuckets;
+my @slots = (-1) x $nslots;
+
+my @order = sort { @{$buckets[$b] || []} <=> @{$buckets[$a] || []} }
+	0 .. $nbuckets - 1;
+
+for my $bucket (@order) {
+	my $keys = $buckets[$bucket] or last;
+
+	DISP: for (my $d = 0; ; $d++) {
+		die "cannot place keys, try another seed\n" if $d > 1 << 24;
+
+		my %taken;
+
+		for my $i (@$keys) {
+			my $slot = ($h1[$i] + $d * $h2[$i]) % $nslots;
+			next DISP if $slots[$slot] >= 0 || $taken{$slot}++;
+		}
+
+		for my $i (@$keys) {
+			$slots[($h1[$i] + $d * $h2[$i]) % $nslots] = $i;
+		}
+
+		$disp[$bucket] = $d;
+		last;
+	}
+}
+
+my $off = 32 + 4 * ($nbuckets + $nslots);
+my @offsets;
+
+for my $i (0 .. $n - 1) {
+	$offsets[$i] = $off;
+	$off += 4 + length($keys[$i]) + length($values[$i]);
+}
+
+die "map is too large\n" if $off > 0xffffffff;
+
+print "NGXMAP01", pack("V6", 0x01020304, $n, $nbuckets, $nslots, $seed, 0);
+print pack("V*", @disp);
+print pack("V*", map { $_ >= 0 ? $offsets[$_] : 0 } @slots);
+
+for my $i (0 .. $n - 1) {
+	print pack("vv", length($keys[$i]), length($values[$i])),
+		$keys[$i], $values[$i];
+}
+
+
+# the hash must match ngx_http_map_db_find()
+
+sub hash {
+	my ($key) = @_;
+	my $len = length $key;
+	my $x = 0x811c9dc5 ^ $seed;
+	my $y = $seed ^ $len;
+
+	for my $w (unpack("V*", $key . "\0" x ((4 - $len % 4) % 4))) {
+		$x = (($x ^ $w) * 0x01000193) & 0xffffffff;
+		$y = (($y ^ $w) * 0x5bd1e995) & 0xffffffff;
+		$y ^= $y >> 15;
+	}
+
+	return ($x, $y);
+}
+
+sub mix {
+	my ($h) = @_;
+
+	$h ^= $h >> 16;
+	$h = ($h * 0x85ebca6b) & 0xffffffff;
+	$h ^= $h >> 13;
+	$h = ($h * 0xc2b2ae35) & 0xffffffff;
+	$h ^= $h >> 16;
+
+	return $h;
+}
+
+sub next_prime {
+	my ($p) = @_;
+
+	P: for (;; $p++) {
+		for (my $d = 2; $d * $d <= $p; $d++) {
+			next P unless $p % $d;
+		}
+
+		return $p;
+	}
+}
@@ -1,2 +1,2 @@
 #CC=/usr/local/popcorn/bin/clang ./configure --with-pcre=/home/sengming/PopcornVM/webserver/pcre/pcre-8.42/ --without-http_gzip_module
-CC=/share/ashwin/secure-popcorn/bin/clang ./configure --without-http_rewrite_module --without-pcre --without-http_gzip_module
+CC=/share/ashwin/secure-popcorn/bin/clang ./configure --without-http_rewrite_module --without-pcre --without-http_gzip_module --with-http_stub_status_module --with-cc-opt="-I../../popcorn"
@@ -25,6 +25,26 @@
 #endif
 
 
+#ifndef NGX_HAVE_IOURING
+#define NGX_HAVE_IOURING  1
+#endif
+
+
+#ifndef NGX_HAVE_PTHREAD
+#define NGX_HAVE_PTHREAD  1
+#endif
+
+
+#ifndef NGX_HAVE_INOTIFY
+#define NGX_HAVE_INOTIFY  1
+#endif
+
+
+#ifndef NGX_HAVE_SPLICE
+#define NGX_HAVE_SPLICE  1
+#endif
+
+
 #ifndef NGX_HAVE_CLEAR_EVENT
 #define NGX_HAVE_CLEAR_EVENT  1
 #endif
@@ -50,6 +70,16 @@
 #endif
 
 
+#ifndef NGX_HAVE_CLOCK_COARSE
+#define NGX_HAVE_CLOCK_COARSE  1
+#endif
+
+
+#ifndef NGX_HAVE_FUTEX
+#define NGX_HAVE_FUTEX  1
+#endif
+
+
 #ifndef NGX_HAVE_GNU_CRYPT_R
 #define NGX_HAVE_GNU_CRYPT_R  1
 #endif
@@ -98,6 +128,11 @@
 #endif
 
 
+#ifndef NGX_HAVE_REUSEPORT
+#define NGX_HAVE_REUSEPORT  1
+#endif
+
+
 #ifndef NGX_HAVE_DEFERRED_ACCEPT
 #define NGX_HAVE_DEFERRED_ACCEPT  1
 #endif
@@ -253,6 +288,11 @@
 #endif
 
 
+#ifndef NGX_HTTP_V2
+#define NGX_HTTP_V2  1
+#endif
+
+
 #ifndef NGX_HTTP_SSI
 #define NGX_HTTP_SSI  1
 #endif
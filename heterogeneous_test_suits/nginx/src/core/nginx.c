@@ -22,6 +22,7 @@ static char *ngx_set_env(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_set_priority(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static uint64_t ngx_get_cpu_affinity_auto(uint64_t mask, ngx_uint_t n);
 static char *ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
@@ -133,6 +134,13 @@ static ngx_command_t  ngx_core_commands[] = {
       offsetof(ngx_core_conf_t, working_directory),
       NULL },
 
+    { ngx_string("worker_pool_cache"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_core_conf_t, pool_cache),
+      NULL },
+
     { ngx_string("env"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_set_env,
@@ -947,6 +955,8 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
      *     ccf->pid = NULL;
      *     ccf->oldpid = NULL;
      *     ccf->priority = 0;
+     *     ccf->worker_processes_auto = 0;
+     *     ccf->cpu_affinity_auto = 0;
      *     ccf->cpu_affinity_n = 0;
      *     ccf->cpu_affinity = NULL;
      */
@@ -965,6 +975,8 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
     ccf->user = (ngx_uid_t) NGX_CONF_UNSET_UINT;
     ccf->group = (ngx_gid_t) NGX_CONF_UNSET_UINT;
 
+    ccf->pool_cache = NGX_CONF_UNSET_SIZE;
+
 #if (NGX_THREADS)
     ccf->worker_threads = NGX_CONF_UNSET;
     ccf->thread_stack_size = NGX_CONF_UNSET_SIZE;
@@ -992,6 +1004,8 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ccf->worker_processes, 1);
     ngx_conf_init_value(ccf->debug_points, 0);
 
+    ngx_conf_init_size_value(ccf->pool_cache, 512 * 1024);
+
 #if (NGX_HAVE_CPU_AFFINITY)
 
     if (ccf->cpu_affinity_n
@@ -1273,7 +1287,30 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     value = cf->args->elts;
 
-    for (n = 1; n < cf->args->nelts; n++) {
+    if (ngx_strcmp(value[1].data, "auto") == 0) {
+
+        if (cf->args->nelts > 3) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid number of arguments in "
+                               "\"worker_cpu_affinity\" directive");
+            return NGX_CONF_ERROR;
+        }
+
+        ccf->cpu_affinity_auto = 1;
+
+        /* the CPUs of the optional mask, all of them by default */
+
+        mask[0] = (uint64_t) -1;
+        ccf->cpu_affinity_n = 1;
+
+        if (cf->args->nelts == 2) {
+            return NGX_CONF_OK;
+        }
+
+        value++;
+    }
+
+    for (n = 1; n < cf->args->nelts - ccf->cpu_affinity_auto; n++) {
 
         if (value[n].len > 64) {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
@@ -1332,6 +1369,10 @@ ngx_get_cpu_affinity(ngx_uint_t n)
         return 0;
     }
 
+    if (ccf->cpu_affinity_auto) {
+        return ngx_get_cpu_affinity_auto(ccf->cpu_affinity[0], n);
+    }
+
     if (ccf->cpu_affinity_n > n) {
         return ccf->cpu_affinity[n];
     }
@@ -1340,6 +1381,42 @@ ngx_get_cpu_affinity(ngx_uint_t n)
 }
 
 
+/*
+ * "worker_cpu_affinity auto" binds the n-th worker to the n-th online CPU
+ * of the mask, and wraps around if there are more workers than CPUs
+ */
+
+static uint64_t
+ngx_get_cpu_affinity_auto(uint64_t mask, ngx_uint_t n)
+{
+    ngx_uint_t  i, cpus;
+
+    if (ngx_ncpu > 0 && ngx_ncpu < 64) {
+        mask &= ((uint64_t) 1 << ngx_ncpu) - 1;
+    }
+
+    cpus = 0;
+
+    for (i = 0; i < 64; i++) {
+        if (mask & ((uint64_t) 1 << i)) {
+            cpus++;
+        }
+    }
+
+    if (cpus == 0) {
+        return 0;
+    }
+
+    n %= cpus;
+
+    for (i = 0; /* void */ ; i++) {
+        if ((mask & ((uint64_t) 1 << i)) && n-- == 0) {
+            return (uint64_t) 1 << i;
+        }
+    }
+}
+
+
 static char *
 ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1356,6 +1433,7 @@ ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     if (ngx_strcmp(value[1].data, "auto") == 0) {
         ccf->worker_processes = ngx_ncpu;
+        ccf->worker_processes_auto = 1;
         return NGX_CONF_OK;
     }
 
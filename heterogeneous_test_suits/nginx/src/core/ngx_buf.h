@@ -77,6 +77,11 @@ typedef void (*ngx_output_chain_aio_pt)(ngx_output_chain_ctx_t *ctx,
     ngx_file_t *file);
 #endif
 
+#if (NGX_HAVE_PTHREAD)
+typedef ngx_int_t (*ngx_output_chain_thread_pt)(ngx_thread_task_t *task,
+    ngx_file_t *file);
+#endif
+
 struct ngx_output_chain_ctx_s {
     ngx_buf_t                   *buf;
     ngx_chain_t                 *in;
@@ -90,12 +95,18 @@ struct ngx_output_chain_ctx_s {
 #endif
     unsigned                     need_in_memory:1;
     unsigned                     need_in_temp:1;
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_HAVE_PTHREAD)
     unsigned                     aio:1;
+#endif
 
+#if (NGX_HAVE_FILE_AIO)
     ngx_output_chain_aio_pt      aio_handler;
 #endif
 
+#if (NGX_HAVE_PTHREAD)
+    ngx_output_chain_thread_pt   thread_handler;
+#endif
+
     off_t                        alignment;
 
     ngx_pool_t                  *pool;
@@ -946,6 +946,8 @@ ngx_conf_open_file(ngx_cycle_t *cycle, ngx_str_t *name)
     }
 
     file->buffer = NULL;
+    file->flush = NULL;
+    file->data = NULL;
 
     return file;
 }
@@ -975,6 +977,11 @@ ngx_conf_flush_files(ngx_cycle_t *cycle)
             i = 0;
         }
 
+        if (file[i].flush) {
+            file[i].flush(&file[i], cycle->log);
+            continue;
+        }
+
         len = file[i].pos - file[i].buffer;
 
         if (file[i].buffer == NULL || len == 0) {
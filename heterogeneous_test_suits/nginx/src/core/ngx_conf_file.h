@@ -95,12 +95,15 @@ struct ngx_open_file_s {
     u_char               *pos;
     u_char               *last;
 
+    /* set by a module that owns the buffer, e.g. to flush it elsewhere */
+    void                (*flush)(ngx_open_file_t *file, ngx_log_t *log);
+    void                 *data;
+
 #if 0
     /* e.g. append mode, error_log */
     ngx_uint_t            flags;
     /* e.g. reopen db file */
     ngx_uint_t          (*handler)(void *data, ngx_open_file_t *file);
-    void                 *data;
 #endif
 };
 
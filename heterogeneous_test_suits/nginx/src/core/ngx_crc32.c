@@ -9,6 +9,74 @@
 #include <ngx_core.h>
 
 
+/*
+ * ngx_crc32_long() and ngx_crc32_update() go through a handler selected for
+ * the CPU: the 256 element table below, the folding with carry-less
+ * multiplications of Intel's "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction" on x86-64, or the CRC32 instructions of ARMv8.
+ * The SSE4.2 crc32 instruction computes CRC-32C, another polynomial, and
+ * can not be used.  All the handlers return the same values.
+ *
+ * On Popcorn the worker migrates between the two ISAs with the handler of
+ * the node it comes from, so every handler is compiled for both, the one
+ * for the other ISA falling back to the table, and ngx_crc32_select() picks
+ * again the handler of the current ISA on arrival.
+ */
+
+#if (__x86_64__ && __PCLMUL__ && __SSE4_1__)
+
+#define NGX_CRC32_PCLMUL  1
+#define NGX_CRC32_PCLMUL_TARGET
+
+#elif (__x86_64__ && (__clang_major__ >= 4 || (__GNUC__ >= 5 && !__clang__)))
+
+#define NGX_CRC32_PCLMUL  1
+#define NGX_CRC32_PCLMUL_TARGET  __attribute__((target("pclmul,sse4.1")))
+
+#elif (__aarch64__ && __ARM_FEATURE_CRC32)
+
+#define NGX_CRC32_ARMV8  1
+#define NGX_CRC32_ARMV8_TARGET
+
+#elif (__aarch64__ && __clang_major__ >= 16)
+
+#define NGX_CRC32_ARMV8  1
+#define NGX_CRC32_ARMV8_TARGET  __attribute__((target("crc")))
+
+#elif (__aarch64__ && __GNUC__ >= 10 && !__clang__)
+
+#define NGX_CRC32_ARMV8  1
+#define NGX_CRC32_ARMV8_TARGET  __attribute__((target("+crc")))
+
+#endif
+
+#if (NGX_CRC32_PCLMUL)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if (NGX_CRC32_ARMV8)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32  (1 << 7)
+#endif
+#endif
+
+#if (__aarch64__)
+#define NGX_CRC32_ISA  1
+#else
+#define NGX_CRC32_ISA  0
+#endif
+
+
+static uint32_t ngx_crc32_update_table(uint32_t crc, u_char *p, size_t len);
+static uint32_t ngx_crc32_update_pclmul(uint32_t crc, u_char *p, size_t len);
+static uint32_t ngx_crc32_update_armv8(uint32_t crc, u_char *p, size_t len);
+static ngx_uint_t ngx_crc32_have_pclmul(void);
+static ngx_uint_t ngx_crc32_have_armv8(void);
+
+
 /*
  * The code and lookup tables are based on the algorithm
  * described at http://www.w3.org/TR/PNG/
@@ -101,12 +169,257 @@ uint32_t  ngx_crc32_table256[] = {
 
 uint32_t *ngx_crc32_table_short = ngx_crc32_table16;
 
+ngx_crc32_update_pt  ngx_crc32_update_handler = ngx_crc32_update_table;
+
+/* the handler selected on each ISA */
+static ngx_crc32_update_pt  ngx_crc32_handlers[2];
+
+
+static uint32_t
+ngx_crc32_update_table(uint32_t crc, u_char *p, size_t len)
+{
+    while (len--) {
+        crc = ngx_crc32_table256[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+
+#if (NGX_CRC32_PCLMUL)
+
+/*
+ * The constants are x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32)
+ * and x^64 mod P(x), bit-reflected, then P(x) and the Barrett constant
+ * floor(x^64 / P(x)).
+ */
+
+static const uint64_t  ngx_crc32_k1k2[2] __attribute__((aligned(16))) =
+    { 0x0154442bd4, 0x01c6e41596 };
+static const uint64_t  ngx_crc32_k3k4[2] __attribute__((aligned(16))) =
+    { 0x01751997d0, 0x00ccaa009e };
+static const uint64_t  ngx_crc32_k5k0[2] __attribute__((aligned(16))) =
+    { 0x0163cd6124, 0x0000000000 };
+static const uint64_t  ngx_crc32_poly[2] __attribute__((aligned(16))) =
+    { 0x01db710641, 0x01f7011641 };
+
+
+static NGX_CRC32_PCLMUL_TARGET uint32_t
+ngx_crc32_update_pclmul(uint32_t crc, u_char *p, size_t len)
+{
+    size_t   n;
+    u_char  *last;
+    __m128i  k, x1, x2, x3, x4, x5, x6, x7, x8, mask;
+
+    if (len < 64) {
+        return ngx_crc32_update_table(crc, p, len);
+    }
+
+    n = len & ~(size_t) 15;
+    last = p + n;
+
+    /* fold four 128-bit lanes over 64 byte blocks */
+
+    x1 = _mm_loadu_si128((__m128i *) p);
+    x2 = _mm_loadu_si128((__m128i *) (p + 16));
+    x3 = _mm_loadu_si128((__m128i *) (p + 32));
+    x4 = _mm_loadu_si128((__m128i *) (p + 48));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+
+    k = _mm_load_si128((__m128i *) ngx_crc32_k1k2);
+
+    for (p += 64; last - p >= 64; p += 64) {
+        x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((__m128i *) p));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                           _mm_loadu_si128((__m128i *) (p + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                           _mm_loadu_si128((__m128i *) (p + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                           _mm_loadu_si128((__m128i *) (p + 48)));
+    }
+
+    /* fold the lanes into one, then the 16 byte blocks left */
+
+    k = _mm_load_si128((__m128i *) ngx_crc32_k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    for ( /* void */ ; p < last; p += 16) {
+        x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((__m128i *) p)),
+                           x5);
+    }
+
+    /* fold 128 bits to 64, then Barrett reduce to 32 */
+
+    mask = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    k = _mm_loadl_epi64((__m128i *) ngx_crc32_k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    k = _mm_load_si128((__m128i *) ngx_crc32_poly);
+
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    crc = (uint32_t) _mm_extract_epi32(x1, 1);
+
+    return ngx_crc32_update_table(crc, p, len - n);
+}
+
+
+static ngx_uint_t
+ngx_crc32_have_pclmul(void)
+{
+    unsigned int  eax, ebx, ecx, edx;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+        return 0;
+    }
+
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+
+#else
+
+static uint32_t
+ngx_crc32_update_pclmul(uint32_t crc, u_char *p, size_t len)
+{
+    return ngx_crc32_update_table(crc, p, len);
+}
+
+
+static ngx_uint_t
+ngx_crc32_have_pclmul(void)
+{
+    return 0;
+}
+
+#endif
+
+
+#if (NGX_CRC32_ARMV8)
+
+static NGX_CRC32_ARMV8_TARGET uint32_t
+ngx_crc32_update_armv8(uint32_t crc, u_char *p, size_t len)
+{
+    while (len && ((uintptr_t) p & 7)) {
+        crc = __crc32b(crc, *p++);
+        len--;
+    }
+
+    while (len >= 8) {
+        crc = __crc32d(crc, *(uint64_t *) p);
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = __crc32b(crc, *p++);
+    }
+
+    return crc;
+}
+
+
+static ngx_uint_t
+ngx_crc32_have_armv8(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#else
+
+static uint32_t
+ngx_crc32_update_armv8(uint32_t crc, u_char *p, size_t len)
+{
+    return ngx_crc32_update_table(crc, p, len);
+}
+
+
+static ngx_uint_t
+ngx_crc32_have_armv8(void)
+{
+    return 0;
+}
+
+#endif
+
+
+void
+ngx_crc32_select(void)
+{
+    u_char               *p;
+    size_t                len;
+    ngx_crc32_update_pt   handler;
+
+    handler = ngx_crc32_handlers[NGX_CRC32_ISA];
+
+    if (handler == NULL) {
+        handler = ngx_crc32_update_table;
+
+        if (ngx_crc32_have_pclmul()) {
+            handler = ngx_crc32_update_pclmul;
+
+        } else if (ngx_crc32_have_armv8()) {
+            handler = ngx_crc32_update_armv8;
+        }
+
+        /* keep the table if the hardware does not give the same values */
+
+        p = (u_char *) ngx_crc32_table256 + 3;
+        len = 256 * sizeof(uint32_t) - 3;
+
+        if (handler(0xffffffff, p, len)
+            != ngx_crc32_update_table(0xffffffff, p, len))
+        {
+            handler = ngx_crc32_update_table;
+        }
+
+        ngx_crc32_handlers[NGX_CRC32_ISA] = handler;
+    }
+
+    ngx_crc32_update_handler = handler;
+}
+
 
 ngx_int_t
 ngx_crc32_table_init(void)
 {
     void  *p;
 
+    ngx_crc32_select();
+
     if (((uintptr_t) ngx_crc32_table_short
           & ~((uintptr_t) ngx_cacheline_size - 1))
         == (uintptr_t) ngx_crc32_table_short)
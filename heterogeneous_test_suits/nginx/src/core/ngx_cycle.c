@@ -500,12 +500,23 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                     continue;
                 }
 
+                if (ls[i].remain) {
+                    /* taken by a previous reuseport socket of the address */
+                    continue;
+                }
+
                 if (ngx_cmp_sockaddr(nls[n].sockaddr, ls[i].sockaddr) == NGX_OK)
                 {
                     nls[n].fd = ls[i].fd;
                     nls[n].previous = &ls[i];
                     ls[i].remain = 1;
 
+#if (NGX_HAVE_REUSEPORT)
+                    if (nls[n].reuseport && !ls[i].reuseport) {
+                        nls[n].add_reuseport = 1;
+                    }
+#endif
+
                     if (ls[n].backlog != nls[i].backlog) {
                         nls[n].listen = 1;
                     }
@@ -1141,7 +1152,10 @@ ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user)
 
         len = file[i].pos - file[i].buffer;
 
-        if (file[i].buffer && len != 0) {
+        if (file[i].flush) {
+            file[i].flush(&file[i], cycle->log);
+
+        } else if (file[i].buffer && len != 0) {
 
             n = ngx_write_fd(file[i].fd, file[i].buffer, len);
 
@@ -77,6 +77,7 @@ typedef struct {
      ngx_msec_t               timer_resolution;
 
      ngx_int_t                worker_processes;
+     ngx_flag_t               worker_processes_auto;
      ngx_int_t                debug_points;
 
      ngx_int_t                rlimit_nofile;
@@ -85,6 +86,7 @@ typedef struct {
 
      int                      priority;
 
+     ngx_uint_t               cpu_affinity_auto;
      ngx_uint_t               cpu_affinity_n;
      uint64_t                *cpu_affinity;
 
@@ -101,6 +103,8 @@ typedef struct {
      ngx_array_t              env;
      char                   **environment;
 
+     size_t                   pool_cache;
+
 #if (NGX_THREADS)
      ngx_int_t                worker_threads;
      size_t                   thread_stack_size;
@@ -9,6 +9,35 @@
 #include <ngx_core.h>
 
 
+/*
+ * The search for the number of buckets of a hash tests every key for every
+ * size tried, so with thousands of keys it takes most of the time of
+ * a reload.  The sizes found are remembered, in memory that outlives the
+ * cycles, by the fingerprint of the keys, and a hash whose keys did not
+ * change since the last configuration gets its size without the search.
+ * The remembered size is tested as any other, so a false match may only
+ * cost a few more buckets than the minimum.
+ */
+
+#define NGX_HASH_MEMO_SIZE  4096
+
+
+typedef struct {
+    uint32_t     fingerprint;
+    ngx_uint_t   nelts;
+    ngx_uint_t   size;
+} ngx_hash_memo_t;
+
+
+static ngx_int_t ngx_hash_test(ngx_hash_key_t *names, ngx_uint_t nelts,
+    u_short *test, ngx_uint_t size, ngx_uint_t bucket_size);
+static uint32_t ngx_hash_fingerprint(ngx_hash_init_t *hinit,
+    ngx_hash_key_t *names, ngx_uint_t nelts);
+
+
+static ngx_hash_memo_t  *ngx_hash_memo;
+
+
 void *
 ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
 {
@@ -251,11 +280,13 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
 ngx_int_t
 ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
 {
-    u_char          *elts;
-    size_t           len;
-    u_short         *test;
-    ngx_uint_t       i, n, key, size, start, bucket_size;
-    ngx_hash_elt_t  *elt, **buckets;
+    u_char           *elts;
+    size_t            len;
+    u_short          *test;
+    uint32_t          fingerprint;
+    ngx_uint_t        i, n, key, size, start, bucket_size;
+    ngx_hash_elt_t   *elt, **buckets;
+    ngx_hash_memo_t  *memo;
 
     for (n = 0; n < nelts; n++) {
         if (hinit->bucket_size < NGX_HASH_ELT_SIZE(&names[n]) + sizeof(void *))
@@ -282,34 +313,34 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         start = hinit->max_size - 1000;
     }
 
-    for (size = start; size < hinit->max_size; size++) {
+    if (ngx_hash_memo == NULL) {
+        ngx_hash_memo = ngx_calloc(NGX_HASH_MEMO_SIZE * sizeof(ngx_hash_memo_t),
+                                   hinit->pool->log);
+    }
 
-        ngx_memzero(test, size * sizeof(u_short));
+    memo = NULL;
+    fingerprint = 0;
 
-        for (n = 0; n < nelts; n++) {
-            if (names[n].key.data == NULL) {
-                continue;
-            }
-
-            key = names[n].key_hash % size;
-            test[key] = (u_short) (test[key] + NGX_HASH_ELT_SIZE(&names[n]));
+    if (ngx_hash_memo) {
+        fingerprint = ngx_hash_fingerprint(hinit, names, nelts);
+        memo = &ngx_hash_memo[fingerprint % NGX_HASH_MEMO_SIZE];
 
-#if 0
-            ngx_log_error(NGX_LOG_ALERT, hinit->pool->log, 0,
-                          "%ui: %ui %ui \"%V\"",
-                          size, key, test[key], &names[n].key);
-#endif
-
-            if (test[key] > (u_short) bucket_size) {
-                goto next;
-            }
+        if (memo->fingerprint == fingerprint
+            && memo->nelts == nelts
+            && memo->size >= start
+            && memo->size < hinit->max_size
+            && ngx_hash_test(names, nelts, test, memo->size, bucket_size)
+               == NGX_OK)
+        {
+            size = memo->size;
+            goto found;
         }
+    }
 
-        goto found;
-
-    next:
-
-        continue;
+    for (size = start; size < hinit->max_size; size++) {
+        if (ngx_hash_test(names, nelts, test, size, bucket_size) == NGX_OK) {
+            goto found;
+        }
     }
 
     ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
@@ -324,6 +355,12 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
 
 found:
 
+    if (memo) {
+        memo->fingerprint = fingerprint;
+        memo->nelts = nelts;
+        memo->size = size;
+    }
+
     for (i = 0; i < size; i++) {
         test[i] = sizeof(void *);
     }
@@ -455,6 +492,69 @@ found:
 }
 
 
+static ngx_int_t
+ngx_hash_test(ngx_hash_key_t *names, ngx_uint_t nelts, u_short *test,
+    ngx_uint_t size, ngx_uint_t bucket_size)
+{
+    ngx_uint_t  n, key;
+
+    ngx_memzero(test, size * sizeof(u_short));
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        key = names[n].key_hash % size;
+        test[key] = (u_short) (test[key] + NGX_HASH_ELT_SIZE(&names[n]));
+
+#if 0
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "%ui: %ui %ui \"%V\"",
+                      size, key, test[key], &names[n].key);
+#endif
+
+        if (test[key] > (u_short) bucket_size) {
+            return NGX_DECLINED;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static uint32_t
+ngx_hash_fingerprint(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
+    ngx_uint_t nelts)
+{
+    u_char      *p;
+    uint32_t     h;
+    ngx_uint_t   n;
+
+    /* FNV-1a over the hash name, its limits and the keys */
+
+    h = 2166136261U;
+
+    for (p = (u_char *) hinit->name; *p; p++) {
+        h = (h ^ *p) * 16777619U;
+    }
+
+    h = (h ^ (uint32_t) hinit->max_size) * 16777619U;
+    h = (h ^ (uint32_t) hinit->bucket_size) * 16777619U;
+
+    for (n = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        h = (h ^ (uint32_t) names[n].key_hash) * 16777619U;
+        h = (h ^ (uint32_t) names[n].key.len) * 16777619U;
+    }
+
+    return h;
+}
+
+
 ngx_int_t
 ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts)
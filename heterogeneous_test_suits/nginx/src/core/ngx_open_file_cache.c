@@ -41,17 +41,44 @@ static void ngx_close_cached_file(ngx_open_file_cache_t *cache,
 static void ngx_open_file_del_event(ngx_cached_open_file_t *file);
 static void ngx_expire_old_cached_files(ngx_open_file_cache_t *cache,
     ngx_uint_t n, ngx_log_t *log);
-static void ngx_open_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static void ngx_open_file_cache_insert(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file);
+static void ngx_open_file_cache_delete(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file);
 static ngx_cached_open_file_t *
     ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
     uint32_t hash);
 static void ngx_open_file_cache_remove(ngx_event_t *ev);
+#if (NGX_HAVE_INOTIFY)
+static ngx_int_t ngx_open_file_inotify_init(ngx_log_t *log);
+static void ngx_open_file_inotify_add(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file, ngx_open_file_info_t *of, ngx_log_t *log);
+static void ngx_open_file_inotify_del(ngx_open_file_cache_event_t *fev);
+static ngx_open_file_cache_event_t *ngx_open_file_inotify_find(
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel, int wd,
+    struct inotify_event *ie);
+static void ngx_open_file_inotify_handler(ngx_event_t *ev);
+static void ngx_open_file_inotify_overflow(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
+
+
+/*
+ * a worker has one inotify descriptor for all caches, a watch is kept
+ * for every cached file while it is open and for the parent directory
+ * of every cached "not found" error
+ */
+
+static ngx_connection_t   *ngx_open_file_inotify;
+static ngx_uint_t          ngx_open_file_inotify_failed;
+static ngx_rbtree_t        ngx_open_file_watches;
+static ngx_rbtree_node_t   ngx_open_file_watches_sentinel;
+#endif
 
 
 ngx_open_file_cache_t *
 ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
 {
+    ngx_uint_t              n;
     ngx_pool_cleanup_t     *cln;
     ngx_open_file_cache_t  *cache;
 
@@ -60,8 +87,19 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
         return NULL;
     }
 
-    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
-                    ngx_open_file_cache_rbtree_insert_value);
+    /*
+     * the index is a power of two of buckets not less than "max", so
+     * a lookup is a single bucket walk instead of a tree descent
+     */
+
+    for (n = 1; n < max; n <<= 1) { /* void */ }
+
+    cache->hash = ngx_pcalloc(pool, n * sizeof(ngx_cached_open_file_t *));
+    if (cache->hash == NULL) {
+        return NULL;
+    }
+
+    cache->hash_mask = n - 1;
 
     ngx_queue_init(&cache->expire_queue);
 
@@ -104,7 +142,7 @@ ngx_open_file_cache_cleanup(void *data)
 
         ngx_queue_remove(q);
 
-        ngx_rbtree_delete(&cache->rbtree, &file->node);
+        ngx_open_file_cache_delete(cache, file);
 
         cache->current--;
 
@@ -117,6 +155,7 @@ ngx_open_file_cache_cleanup(void *data)
             ngx_close_cached_file(cache, file, 0, ngx_cycle->log);
 
         } else {
+            ngx_open_file_del_event(file);
             ngx_free(file->name);
             ngx_free(file);
         }
@@ -127,12 +166,6 @@ ngx_open_file_cache_cleanup(void *data)
                       "%d items still leave in open file cache",
                       cache->current);
     }
-
-    if (cache->rbtree.root != cache->rbtree.sentinel) {
-        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                      "rbtree still is not empty in open file cache");
-
-    }
 }
 
 
@@ -291,6 +324,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         if (of->is_dir) {
 
             if (file->is_dir || file->err) {
+                ngx_open_file_del_event(file);
                 goto update;
             }
 
@@ -299,6 +333,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         } else if (of->err == 0) {  /* file */
 
             if (file->is_dir || file->err) {
+                ngx_open_file_del_event(file);
                 goto add_event;
             }
 
@@ -318,6 +353,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         } else { /* error to cache */
 
             if (file->err || file->is_dir) {
+
+                if (file->event && file->err == of->err) {
+                    file->use_event = 1;
+                }
+
                 goto update;
             }
 
@@ -336,7 +376,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
             goto add_event;
         }
 
-        ngx_rbtree_delete(&cache->rbtree, &file->node);
+        ngx_open_file_cache_delete(cache, file);
 
         cache->current--;
 
@@ -375,9 +415,9 @@ create:
 
     ngx_cpystrn(file->name, name->data, name->len + 1);
 
-    file->node.key = hash;
+    file->hash = hash;
 
-    ngx_rbtree_insert(&cache->rbtree, &file->node);
+    ngx_open_file_cache_insert(cache, file);
 
     cache->current++;
 
@@ -449,12 +489,14 @@ found:
 failed:
 
     if (file) {
-        ngx_rbtree_delete(&cache->rbtree, &file->node);
+        ngx_open_file_cache_delete(cache, file);
 
         cache->current--;
 
         if (file->count == 0) {
 
+            ngx_open_file_del_event(file);
+
             if (file->fd != NGX_INVALID_FILE) {
                 if (ngx_close_file(file->fd) == NGX_FILE_ERROR) {
                     ngx_log_error(NGX_LOG_ALERT, pool->log, ngx_errno,
@@ -891,6 +933,13 @@ ngx_open_file_add_event(ngx_open_file_cache_t *cache,
 {
     ngx_open_file_cache_event_t  *fev;
 
+#if (NGX_HAVE_INOTIFY)
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+        ngx_open_file_inotify_add(cache, file, of, log);
+        return;
+    }
+#endif
+
     if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)
         || !of->events
         || file->event
@@ -1016,8 +1065,16 @@ ngx_open_file_del_event(ngx_cached_open_file_t *file)
         return;
     }
 
-    (void) ngx_del_event(file->event, NGX_VNODE_EVENT,
-                         file->count ? NGX_FLUSH_EVENT : NGX_CLOSE_EVENT);
+#if (NGX_HAVE_INOTIFY)
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+        ngx_open_file_inotify_del(file->event->data);
+
+    } else
+#endif
+    {
+        (void) ngx_del_event(file->event, NGX_VNODE_EVENT,
+                             file->count ? NGX_FLUSH_EVENT : NGX_CLOSE_EVENT);
+    }
 
     ngx_free(file->event->data);
     ngx_free(file->event);
@@ -1058,7 +1115,7 @@ ngx_expire_old_cached_files(ngx_open_file_cache_t *cache, ngx_uint_t n,
 
         ngx_queue_remove(q);
 
-        ngx_rbtree_delete(&cache->rbtree, &file->node);
+        ngx_open_file_cache_delete(cache, file);
 
         cache->current--;
 
@@ -1070,6 +1127,7 @@ ngx_expire_old_cached_files(ngx_open_file_cache_t *cache, ngx_uint_t n,
             ngx_close_cached_file(cache, file, 0, log);
 
         } else {
+            ngx_open_file_del_event(file);
             ngx_free(file->name);
             ngx_free(file);
         }
@@ -1078,80 +1136,301 @@ ngx_expire_old_cached_files(ngx_open_file_cache_t *cache, ngx_uint_t n,
 
 
 static void
-ngx_open_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+ngx_open_file_cache_insert(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file)
 {
-    ngx_rbtree_node_t       **p;
-    ngx_cached_open_file_t    *file, *file_temp;
+    ngx_cached_open_file_t  **bucket;
 
-    for ( ;; ) {
+    bucket = &cache->hash[file->hash & cache->hash_mask];
 
-        if (node->key < temp->key) {
+    file->next = *bucket;
+    *bucket = file;
+}
 
-            p = &temp->left;
 
-        } else if (node->key > temp->key) {
+static void
+ngx_open_file_cache_delete(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file)
+{
+    ngx_cached_open_file_t  **p;
 
-            p = &temp->right;
+    for (p = &cache->hash[file->hash & cache->hash_mask];
+         *p;
+         p = &(*p)->next)
+    {
+        if (*p == file) {
+            *p = file->next;
+            return;
+        }
+    }
+}
 
-        } else { /* node->key == temp->key */
 
-            file = (ngx_cached_open_file_t *) node;
-            file_temp = (ngx_cached_open_file_t *) temp;
+static ngx_cached_open_file_t *
+ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash)
+{
+    ngx_cached_open_file_t  *file;
 
-            p = (ngx_strcmp(file->name, file_temp->name) < 0)
-                    ? &temp->left : &temp->right;
+    for (file = cache->hash[hash & cache->hash_mask];
+         file;
+         file = file->next)
+    {
+        if (file->hash == hash && ngx_strcmp(name->data, file->name) == 0) {
+            return file;
         }
+    }
 
-        if (*p == sentinel) {
-            break;
+    return NULL;
+}
+
+
+static void
+ngx_open_file_cache_remove(ngx_event_t *ev)
+{
+    ngx_cached_open_file_t       *file;
+    ngx_open_file_cache_event_t  *fev;
+
+    fev = ev->data;
+    file = fev->file;
+
+    ngx_queue_remove(&file->queue);
+
+#if (NGX_HAVE_INOTIFY)
+    if (!(ngx_event_flags & NGX_USE_VNODE_EVENT)) {
+        ngx_open_file_inotify_del(fev);
+    }
+#endif
+
+    ngx_open_file_cache_delete(fev->cache, file);
+
+    fev->cache->current--;
+
+    /* NGX_ONESHOT_EVENT was already deleted */
+    file->event = NULL;
+    file->use_event = 0;
+
+    file->close = 1;
+
+    ngx_close_cached_file(fev->cache, file, 0, ev->log);
+
+    /* free memory only when fev->cache and fev->file are already not needed */
+
+    ngx_free(ev->data);
+    ngx_free(ev);
+}
+
+
+#if (NGX_HAVE_INOTIFY)
+
+static ngx_int_t
+ngx_open_file_inotify_init(ngx_log_t *log)
+{
+    int                fd;
+    ngx_connection_t  *c;
+
+    if (ngx_open_file_inotify) {
+        return NGX_OK;
+    }
+
+    if (ngx_open_file_inotify_failed
+        || (ngx_process != NGX_PROCESS_WORKER
+            && ngx_process != NGX_PROCESS_SINGLE))
+    {
+        return NGX_DECLINED;
+    }
+
+    /* an error is not retried, the cache falls back to periodic retests */
+
+    ngx_open_file_inotify_failed = 1;
+
+    fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+    if (fd == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "inotify_init1() failed");
+        return NGX_ERROR;
+    }
+
+    c = ngx_get_connection(fd, log);
+
+    if (c == NULL) {
+        (void) close(fd);
+        return NGX_ERROR;
+    }
+
+    c->read->handler = ngx_open_file_inotify_handler;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+
+    if (ngx_add_event(c->read, NGX_READ_EVENT, 0) == NGX_ERROR) {
+        ngx_free_connection(c);
+        (void) close(fd);
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&ngx_open_file_watches, &ngx_open_file_watches_sentinel,
+                    ngx_rbtree_insert_value);
+
+    ngx_open_file_inotify = c;
+    ngx_open_file_inotify_failed = 0;
+
+    return NGX_OK;
+}
+
+
+/*
+ * an open file is watched for changes, a "not found" error is watched
+ * through its directory for the name to appear; as with kqueue,
+ * the events are trusted only after one more revalidation
+ */
+
+static void
+ngx_open_file_inotify_add(ngx_open_file_cache_t *cache,
+    ngx_cached_open_file_t *file, ngx_open_file_info_t *of, ngx_log_t *log)
+{
+    int                           wd;
+    u_char                       *p;
+    uint32_t                      mask;
+    ngx_open_file_cache_event_t  *fev;
+
+    if (!of->events || file->event || file->uses < of->min_uses) {
+        return;
+    }
+
+    if (of->fd == NGX_INVALID_FILE && of->err != NGX_ENOENT) {
+        return;
+    }
+
+    if (ngx_open_file_inotify_init(log) != NGX_OK) {
+        return;
+    }
+
+    file->event = ngx_calloc(sizeof(ngx_event_t), log);
+    if (file->event == NULL) {
+        return;
+    }
+
+    fev = ngx_alloc(sizeof(ngx_open_file_cache_event_t), log);
+    if (fev == NULL) {
+        ngx_free(file->event);
+        file->event = NULL;
+        return;
+    }
+
+    if (of->fd != NGX_INVALID_FILE) {
+        mask = IN_MODIFY|IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF;
+
+        wd = inotify_add_watch(ngx_open_file_inotify->fd,
+                               (char *) file->name, mask|IN_MASK_ADD);
+
+    } else {
+        mask = IN_CREATE|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF;
+
+        p = (u_char *) strrchr((char *) file->name, '/');
+
+        if (p == NULL) {
+            wd = -1;
+
+        } else if (p == file->name) {
+            wd = inotify_add_watch(ngx_open_file_inotify->fd, "/",
+                                   mask|IN_ONLYDIR|IN_MASK_ADD);
+
+        } else {
+            *p = '\0';
+            wd = inotify_add_watch(ngx_open_file_inotify->fd,
+                                   (char *) file->name,
+                                   mask|IN_ONLYDIR|IN_MASK_ADD);
+            *p = '/';
         }
+    }
+
+    if (wd == -1) {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, ngx_errno,
+                       "inotify_add_watch(\"%s\") failed", file->name);
 
-        temp = *p;
+        ngx_free(fev);
+        ngx_free(file->event);
+        file->event = NULL;
+        return;
     }
 
-    *p = node;
-    node->parent = temp;
-    node->left = sentinel;
-    node->right = sentinel;
-    ngx_rbt_red(node);
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "inotify watch %d: \"%s\"", wd, file->name);
+
+    fev->fd = wd;
+    fev->file = file;
+    fev->cache = cache;
+
+    fev->node.key = wd;
+    ngx_rbtree_insert(&ngx_open_file_watches, &fev->node);
+
+    file->use_event = 0;
+
+    file->event->handler = ngx_open_file_cache_remove;
+    file->event->data = fev;
+    file->event->log = ngx_cycle->log;
 }
 
 
-static ngx_cached_open_file_t *
-ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
-    uint32_t hash)
+static void
+ngx_open_file_inotify_del(ngx_open_file_cache_event_t *fev)
 {
-    ngx_int_t                rc;
-    ngx_rbtree_node_t       *node, *sentinel;
-    ngx_cached_open_file_t  *file;
+    ngx_rbtree_delete(&ngx_open_file_watches, &fev->node);
+
+    /* several names of one inode or one directory share a watch */
+
+    if (ngx_open_file_inotify_find(ngx_open_file_watches.root,
+                                   ngx_open_file_watches.sentinel,
+                                   fev->fd, NULL)
+        == NULL)
+    {
+        (void) inotify_rm_watch(ngx_open_file_inotify->fd, fev->fd);
+    }
+}
 
-    node = cache->rbtree.root;
-    sentinel = cache->rbtree.sentinel;
+
+static ngx_open_file_cache_event_t *
+ngx_open_file_inotify_find(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel, int wd, struct inotify_event *ie)
+{
+    u_char                       *p;
+    ngx_open_file_cache_event_t  *fev;
 
     while (node != sentinel) {
 
-        if (hash < node->key) {
+        if ((ngx_rbtree_key_t) wd < node->key) {
             node = node->left;
             continue;
         }
 
-        if (hash > node->key) {
+        if ((ngx_rbtree_key_t) wd > node->key) {
             node = node->right;
             continue;
         }
 
-        /* hash == node->key */
+        /* equal keys may be on both sides after rotations */
 
-        file = (ngx_cached_open_file_t *) node;
+        fev = (ngx_open_file_cache_event_t *)
+                  ((u_char *) node - offsetof(ngx_open_file_cache_event_t,
+                                              node));
 
-        rc = ngx_strcmp(name->data, file->name);
+        if (ie == NULL || ie->len == 0) {
+            return fev;
+        }
 
-        if (rc == 0) {
-            return file;
+        p = (u_char *) strrchr((char *) fev->file->name, '/');
+
+        if (p && ngx_strcmp(p + 1, ie->name) == 0) {
+            return fev;
         }
 
-        node = (rc < 0) ? node->left : node->right;
+        fev = ngx_open_file_inotify_find(node->left, sentinel, wd, ie);
+
+        if (fev) {
+            return fev;
+        }
+
+        node = node->right;
     }
 
     return NULL;
@@ -1159,30 +1438,92 @@ ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
 
 static void
-ngx_open_file_cache_remove(ngx_event_t *ev)
+ngx_open_file_inotify_handler(ngx_event_t *ev)
 {
-    ngx_cached_open_file_t       *file;
+    u_char                       *p;
+    ssize_t                       n;
+    ngx_err_t                     err;
+    ngx_uint_t                    buf[4096 / sizeof(ngx_uint_t)];
+    ngx_connection_t             *c;
+    struct inotify_event         *ie;
     ngx_open_file_cache_event_t  *fev;
 
-    fev = ev->data;
-    file = fev->file;
+    c = ev->data;
 
-    ngx_queue_remove(&file->queue);
+    for ( ;; ) {
 
-    ngx_rbtree_delete(&fev->cache->rbtree, &file->node);
+        n = read(c->fd, buf, sizeof(buf));
 
-    fev->cache->current--;
+        if (n == -1) {
+            err = ngx_errno;
 
-    /* NGX_ONESHOT_EVENT was already deleted */
-    file->event = NULL;
-    file->use_event = 0;
+            if (err != NGX_EAGAIN && err != NGX_EINTR) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                              "read() from inotify failed");
+            }
 
-    file->close = 1;
+            return;
+        }
 
-    ngx_close_cached_file(fev->cache, file, 0, ev->log);
+        if (n == 0) {
+            return;
+        }
 
-    /* free memory only when fev->cache and fev->file are already not needed */
+        for (p = (u_char *) buf;
+             p < (u_char *) buf + n;
+             p += sizeof(struct inotify_event) + ie->len)
+        {
+            ie = (struct inotify_event *) p;
 
-    ngx_free(ev->data);
-    ngx_free(ev);
+            ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "inotify event %d: %08XD \"%s\"",
+                           ie->wd, ie->mask, ie->len ? ie->name : "");
+
+            if (ie->mask & IN_Q_OVERFLOW) {
+                ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                              "inotify queue overflowed, "
+                              "open file cache events are reset");
+
+                ngx_open_file_inotify_overflow(ngx_open_file_watches.root,
+                                               ngx_open_file_watches.sentinel);
+                continue;
+            }
+
+            for ( ;; ) {
+                fev = ngx_open_file_inotify_find(ngx_open_file_watches.root,
+                                                 ngx_open_file_watches.sentinel,
+                                                 ie->wd, ie);
+                if (fev == NULL) {
+                    break;
+                }
+
+                ngx_open_file_cache_remove(fev->file->event);
+            }
+        }
+    }
 }
+
+
+/* the events are lost, so all files are retested as without events */
+
+static void
+ngx_open_file_inotify_overflow(ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel)
+{
+    ngx_open_file_cache_event_t  *fev;
+
+    while (node != sentinel) {
+
+        fev = (ngx_open_file_cache_event_t *)
+                  ((u_char *) node - offsetof(ngx_open_file_cache_event_t,
+                                              node));
+
+        fev->file->use_event = 0;
+
+        ngx_open_file_inotify_overflow(node->left, sentinel);
+
+        node = node->right;
+    }
+}
+
+#endif
@@ -54,7 +54,8 @@ typedef struct {
 typedef struct ngx_cached_open_file_s  ngx_cached_open_file_t;
 
 struct ngx_cached_open_file_s {
-    ngx_rbtree_node_t        node;
+    ngx_cached_open_file_t  *next;
+    uint32_t                 hash;
     ngx_queue_t              queue;
 
     u_char                  *name;
@@ -89,8 +90,8 @@ struct ngx_cached_open_file_s {
 
 
 typedef struct {
-    ngx_rbtree_t             rbtree;
-    ngx_rbtree_node_t        sentinel;
+    ngx_cached_open_file_t **hash;
+    ngx_uint_t               hash_mask;
     ngx_queue_t              expire_queue;
 
     ngx_uint_t               current;
@@ -117,6 +118,11 @@ typedef struct {
 
     ngx_cached_open_file_t  *file;
     ngx_open_file_cache_t   *cache;
+
+#if (NGX_HAVE_INOTIFY)
+    /* keyed by the watch descriptor kept in fd */
+    ngx_rbtree_node_t        node;
+#endif
 } ngx_open_file_cache_event_t;
 
 
@@ -9,8 +9,50 @@
 #include <ngx_core.h>
 
 
+/*
+ * A worker keeps the pool blocks and the large allocations it frees
+ * in a few exact size lists, so that the steady state request cycle
+ * (connection pool, request pool, request structure, header and output
+ * buffers) runs without malloc() and free().  The lists are bound to
+ * the thread that enabled them, other threads fall through to malloc().
+ *
+ * The lists belong to a zone.  A Popcorn worker has a zone per node it
+ * runs on, each with a region of that node's memory: new blocks are cut
+ * from the region of the current zone, freed ones go to its lists, so
+ * the blocks a worker reuses on a node were last written there.  Blocks
+ * of a region cannot be freed, they stay on the lists whatever the size
+ * of the cache.
+ */
+
+#define NGX_POOL_CACHE_MAX_BLOCK   (64 * 1024)
+
+
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static void *ngx_pool_cache_alloc(size_t size, ngx_log_t *log);
+static void ngx_pool_cache_free(void *p, size_t size);
+static ngx_pool_cache_slot_t *ngx_pool_cache_slot(ngx_pool_zone_t *zone,
+    size_t size);
+
+
+static ngx_pool_zone_t   ngx_pool_zone0;
+static ngx_pool_zone_t  *ngx_pool_zone = &ngx_pool_zone0;
+static ngx_pool_zone_t  *ngx_pool_zones;
+static size_t            ngx_pool_cache_max;
+
+#if (NGX_HAVE_PTHREAD)
+
+static pthread_t         ngx_pool_cache_owner;
+
+#define ngx_pool_cache_owned()                                                \
+    (ngx_pool_cache_max                                                       \
+     && pthread_equal(pthread_self(), ngx_pool_cache_owner))
+
+#else
+
+#define ngx_pool_cache_owned()  (ngx_pool_cache_max != 0)
+
+#endif
 
 
 ngx_pool_t *
@@ -18,7 +60,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_pool_cache_alloc(size, log);
     if (p == NULL) {
         return NULL;
     }
@@ -61,7 +103,7 @@ ngx_destroy_pool(ngx_pool_t *pool)
         ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0, "free: %p", l->alloc);
 
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
         }
     }
 
@@ -84,7 +126,7 @@ ngx_destroy_pool(ngx_pool_t *pool)
 #endif
 
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_cache_free(p, (size_t) (p->d.end - (u_char *) p));
 
         if (n == NULL) {
             break;
@@ -101,7 +143,7 @@ ngx_reset_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
         }
     }
 
@@ -182,7 +224,7 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_cache_alloc(psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
@@ -220,7 +262,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     ngx_uint_t         n;
     ngx_pool_large_t  *large;
 
-    p = ngx_alloc(size, pool->log);
+    p = ngx_pool_cache_alloc(size, pool->log);
     if (p == NULL) {
         return NULL;
     }
@@ -230,6 +272,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size = size;
             return p;
         }
 
@@ -240,11 +283,12 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 
     large = ngx_palloc(pool, sizeof(ngx_pool_large_t));
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_cache_free(p, size);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = size;
     large->next = pool->large;
     pool->large = large;
 
@@ -270,6 +314,7 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
     }
 
     large->alloc = p;
+    large->size = 0;
     large->next = pool->large;
     pool->large = large;
 
@@ -286,7 +331,7 @@ ngx_pfree(ngx_pool_t *pool, void *p)
         if (p == l->alloc) {
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
             l->alloc = NULL;
 
             return NGX_OK;
@@ -404,30 +449,198 @@ ngx_pool_delete_file(void *data)
 }
 
 
-#if 0
+
+void
+ngx_pool_cache_init(size_t size)
+{
+    ngx_pool_cache_max = size;
+
+#if (NGX_HAVE_PTHREAD)
+    ngx_pool_cache_owner = pthread_self();
+#endif
+}
+
+
+void
+ngx_pool_zone_init(ngx_pool_zone_t *zone, void *start, size_t size)
+{
+    ngx_memzero(zone, sizeof(ngx_pool_zone_t));
+
+    zone->start = start;
+    zone->last = start;
+    zone->end = (u_char *) start + size;
+
+    zone->next = ngx_pool_zones;
+    ngx_pool_zones = zone;
+}
+
+
+void
+ngx_pool_zone_set(ngx_pool_zone_t *zone)
+{
+    ngx_pool_zone = zone ? zone : &ngx_pool_zone0;
+}
+
+
+/*
+ * Passes the blocks freed to the zone since the last call, the ones
+ * a worker leaving the node will not touch before it comes back.
+ */
+
+void
+ngx_pool_zone_release(ngx_pool_zone_t *zone, ngx_pool_release_pt release)
+{
+    ngx_uint_t              i, n;
+    ngx_pool_cached_t      *b;
+    ngx_pool_cache_slot_t  *slot;
+
+    for (i = 0; i < NGX_POOL_CACHE_SLOTS; i++) {
+        slot = &zone->cache[i];
+
+        for (b = slot->block, n = slot->dirty; b && n; b = b->next, n--) {
+            release(b, slot->size);
+        }
+
+        slot->dirty = 0;
+    }
+}
+
 
 static void *
-ngx_get_cached_block(size_t size)
+ngx_pool_cache_alloc(size_t size, ngx_log_t *log)
 {
-    void                     *p;
-    ngx_cached_block_slot_t  *slot;
+    u_char                 *m;
+    ngx_uint_t              i;
+    ngx_pool_zone_t        *zone;
+    ngx_pool_cached_t      *b;
+    ngx_pool_cache_slot_t  *slot;
 
-    if (ngx_cycle->cache == NULL) {
-        return NULL;
+    if (ngx_pool_cache_owned()) {
+
+        zone = ngx_pool_zone;
+
+        for (i = 0; i < NGX_POOL_CACHE_SLOTS; i++) {
+            slot = &zone->cache[i];
+
+            if (slot->size != size) {
+                continue;
+            }
+
+            b = slot->block;
+
+            if (b) {
+                slot->block = b->next;
+                zone->used -= size;
+
+                if (slot->dirty) {
+                    slot->dirty--;
+                }
+
+                return b;
+            }
+
+            break;
+        }
+
+        if (zone->start && size <= NGX_POOL_CACHE_MAX_BLOCK) {
+            m = ngx_align_ptr(zone->last, NGX_POOL_ALIGNMENT);
+
+            if (m < zone->end && (size_t) (zone->end - m) >= size) {
+                zone->last = m + size;
+
+                return m;
+            }
+        }
     }
 
-    slot = &ngx_cycle->cache[(size + ngx_pagesize - 1) / ngx_pagesize];
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+}
+
+
+static void
+ngx_pool_cache_free(void *p, size_t size)
+{
+    ngx_uint_t              region;
+    ngx_pool_zone_t        *zone;
+    ngx_pool_cached_t      *b;
+    ngx_pool_cache_slot_t  *slot;
 
-    slot->tries++;
+    region = 0;
 
-    if (slot->number) {
-        p = slot->block;
-        slot->block = slot->block->next;
-        slot->number--;
-        return p;
+    for (zone = ngx_pool_zones; zone; zone = zone->next) {
+        if ((u_char *) p >= zone->start && (u_char *) p < zone->end) {
+            region = 1;
+            break;
+        }
     }
 
-    return NULL;
+    zone = ngx_pool_zone;
+
+    if (region) {
+
+        /*
+         * a block of a region freed by another thread or with all
+         * the lists bound to other sizes is lost
+         */
+
+        if (!ngx_pool_cache_owned()) {
+            return;
+        }
+
+    } else if (size < sizeof(ngx_pool_cached_t)
+               || size > NGX_POOL_CACHE_MAX_BLOCK
+               || zone->used + size > ngx_pool_cache_max
+               || !ngx_pool_cache_owned())
+    {
+        ngx_free(p);
+        return;
+    }
+
+    slot = ngx_pool_cache_slot(zone, size);
+
+    if (slot == NULL) {
+        if (!region) {
+            ngx_free(p);
+        }
+
+        return;
+    }
+
+    b = p;
+    b->next = slot->block;
+    slot->block = b;
+    slot->dirty++;
+
+    zone->used += size;
 }
 
-#endif
+
+static ngx_pool_cache_slot_t *
+ngx_pool_cache_slot(ngx_pool_zone_t *zone, size_t size)
+{
+    ngx_uint_t              i;
+    ngx_pool_cache_slot_t  *slot, *empty;
+
+    empty = NULL;
+
+    for (i = 0; i < NGX_POOL_CACHE_SLOTS; i++) {
+        slot = &zone->cache[i];
+
+        if (slot->size == size) {
+            return slot;
+        }
+
+        if (empty == NULL && slot->block == NULL) {
+            empty = slot;
+        }
+    }
+
+    /* rebind an empty list to the new size */
+
+    if (empty) {
+        empty->size = size;
+        empty->dirty = 0;
+    }
+
+    return empty;
+}
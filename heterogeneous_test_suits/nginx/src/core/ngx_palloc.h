@@ -43,6 +43,7 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;
     void                 *alloc;
+    size_t                size;
 };
 
 
@@ -72,12 +73,47 @@ typedef struct {
 } ngx_pool_cleanup_file_t;
 
 
+#define NGX_POOL_CACHE_SLOTS     16
+
+typedef struct ngx_pool_cached_s  ngx_pool_cached_t;
+
+struct ngx_pool_cached_s {
+    ngx_pool_cached_t    *next;
+};
+
+
+typedef struct {
+    size_t                size;
+    ngx_uint_t            dirty;
+    ngx_pool_cached_t    *block;
+} ngx_pool_cache_slot_t;
+
+
+typedef struct ngx_pool_zone_s  ngx_pool_zone_t;
+
+struct ngx_pool_zone_s {
+    ngx_pool_cache_slot_t  cache[NGX_POOL_CACHE_SLOTS];
+    size_t                 used;
+    u_char                *start;
+    u_char                *last;
+    u_char                *end;
+    ngx_pool_zone_t       *next;
+};
+
+
+typedef void (*ngx_pool_release_pt)(void *p, size_t size);
+
+
 void *ngx_alloc(size_t size, ngx_log_t *log);
 void *ngx_calloc(size_t size, ngx_log_t *log);
 
 ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log);
 void ngx_destroy_pool(ngx_pool_t *pool);
 void ngx_reset_pool(ngx_pool_t *pool);
+void ngx_pool_cache_init(size_t size);
+void ngx_pool_zone_init(ngx_pool_zone_t *zone, void *start, size_t size);
+void ngx_pool_zone_set(ngx_pool_zone_t *zone);
+void ngx_pool_zone_release(ngx_pool_zone_t *zone, ngx_pool_release_pt release);
 
 void *ngx_palloc(ngx_pool_t *pool, size_t size);
 void *ngx_pnalloc(ngx_pool_t *pool, size_t size);
@@ -10,6 +10,8 @@
 
 
 static void *ngx_radix_alloc(ngx_radix_tree_t *tree);
+static ngx_int_t ngx_radix32tree_fill(ngx_pool_t *pool, uintptr_t *table,
+    ngx_uint_t n, ngx_radix_node_t *node, ngx_uint_t depth, uintptr_t value);
 
 
 ngx_radix_tree_t *
@@ -263,6 +265,90 @@ ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
 }
 
 
+/*
+ * the tree is expanded to the 16, 24, and 32 bit levels, and only
+ * the entries having longer prefixes below them get a next level table,
+ * so a lookup takes at most three memory accesses instead of up to 32
+ */
+
+uintptr_t *
+ngx_radix32tree_compile(ngx_radix_tree_t *tree, ngx_pool_t *pool)
+{
+    uintptr_t  *table;
+
+    table = ngx_palloc(pool, 0x10000 * sizeof(uintptr_t));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    if (ngx_radix32tree_fill(pool, table, 0x10000, tree->root, 0,
+                             NGX_RADIX_NO_VALUE)
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return table;
+}
+
+
+static ngx_int_t
+ngx_radix32tree_fill(ngx_pool_t *pool, uintptr_t *table, ngx_uint_t n,
+    ngx_radix_node_t *node, ngx_uint_t depth, uintptr_t value)
+{
+    ngx_uint_t   i;
+    uintptr_t   *next;
+
+    if (node == NULL) {
+        for (i = 0; i < n; i++) {
+            table[i] = value;
+        }
+
+        return NGX_OK;
+    }
+
+    if (node->value != NGX_RADIX_NO_VALUE) {
+        value = node->value;
+    }
+
+    if (n > 1) {
+        n /= 2;
+
+        if (ngx_radix32tree_fill(pool, table, n, node->left, depth + 1, value)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        return ngx_radix32tree_fill(pool, table + n, n, node->right,
+                                    depth + 1, value);
+    }
+
+    /* the entry of the 16, 24, or 32 bit prefix */
+
+    if (depth == 32 || (node->left == NULL && node->right == NULL)) {
+        *table = value;
+        return NGX_OK;
+    }
+
+    next = ngx_palloc(pool, 256 * sizeof(uintptr_t));
+    if (next == NULL) {
+        return NGX_ERROR;
+    }
+
+    *table = (uintptr_t) next | 1;
+
+    if (ngx_radix32tree_fill(pool, next, 128, node->left, depth + 1, value)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_radix32tree_fill(pool, next + 128, 128, node->right,
+                                depth + 1, value);
+}
+
+
 static void *
 ngx_radix_alloc(ngx_radix_tree_t *tree)
 {
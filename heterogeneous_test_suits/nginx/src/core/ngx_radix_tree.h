@@ -41,6 +41,36 @@ ngx_int_t ngx_radix32tree_insert(ngx_radix_tree_t *tree,
 ngx_int_t ngx_radix32tree_delete(ngx_radix_tree_t *tree,
     uint32_t key, uint32_t mask);
 uintptr_t ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key);
+uintptr_t *ngx_radix32tree_compile(ngx_radix_tree_t *tree, ngx_pool_t *pool);
+
+
+/*
+ * a table compiled by ngx_radix32tree_compile() is a 16-8-8 multibit trie:
+ * an entry is either a value, or a pointer to the next level table
+ * of 256 entries tagged with the low bit, so the values must be even
+ */
+
+#define ngx_radix32table_next(e)                                             \
+    (((e) & 1) && (e) != NGX_RADIX_NO_VALUE)
+
+
+static ngx_inline uintptr_t
+ngx_radix32table_find(uintptr_t *table, uint32_t key)
+{
+    uintptr_t  e;
+
+    e = table[key >> 16];
+
+    if (ngx_radix32table_next(e)) {
+        e = ((uintptr_t *) (e & ~(uintptr_t) 1))[(key >> 8) & 0xff];
+
+        if (ngx_radix32table_next(e)) {
+            e = ((uintptr_t *) (e & ~(uintptr_t) 1))[key & 0xff];
+        }
+    }
+
+    return e;
+}
 
 
 #endif /* _NGX_RADIX_TREE_H_INCLUDED_ */
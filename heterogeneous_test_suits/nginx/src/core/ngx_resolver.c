@@ -8,10 +8,13 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_event.h>
+#include <ngx_event_connect.h>
 
 
 #define NGX_RESOLVER_UDP_SIZE   4096
 
+#define NGX_RESOLVER_TRUNCATED  0x0200
+
 
 typedef struct {
     u_char  ident_hi;
@@ -48,6 +51,46 @@ typedef struct {
 } ngx_resolver_an_t;
 
 
+typedef struct {
+    ngx_rbtree_t            rbtree;
+    ngx_rbtree_node_t       sentinel;
+    ngx_queue_t             queue;
+} ngx_resolver_shared_t;
+
+
+typedef struct {
+    ngx_rbtree_node_t       node;
+    ngx_queue_t             queue;
+
+    time_t                  valid;
+
+    u_short                 nlen;
+    u_short                 naddrs;
+    u_short                 cnlen;
+    u_short                 code;
+
+    /* the addresses, then the name, then the cname */
+    in_addr_t               addrs[1];
+} ngx_resolver_shared_node_t;
+
+
+typedef struct {
+    ngx_resolver_t         *resolver;
+    ngx_queue_t             queue;
+    ngx_peer_connection_t   peer;
+
+    /* the query prefixed with its length */
+    u_char                 *query;
+    size_t                  qlen;
+    size_t                  sent;
+
+    u_char                  len[2];
+    u_char                 *buf;
+    size_t                  size;
+    size_t                  received;
+} ngx_resolver_tcp_t;
+
+
 ngx_int_t ngx_udp_connect(ngx_udp_connection_t *uc);
 
 
@@ -68,7 +111,7 @@ static time_t ngx_resolver_resend(ngx_resolver_t *r, ngx_rbtree_t *tree,
     ngx_queue_t *queue);
 static void ngx_resolver_read_response(ngx_event_t *rev);
 static void ngx_resolver_process_response(ngx_resolver_t *r, u_char *buf,
-    size_t n);
+    size_t n, ngx_uint_t tcp);
 static void ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
     ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan, ngx_uint_t ans);
 static void ngx_resolver_process_ptr(ngx_resolver_t *r, u_char *buf, size_t n,
@@ -92,10 +135,39 @@ static in_addr_t *ngx_resolver_rotate(ngx_resolver_t *r, in_addr_t *src,
     ngx_uint_t n);
 static u_char *ngx_resolver_log_error(ngx_log_t *log, u_char *buf, size_t len);
 
+static void ngx_resolver_prefetch(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_resolver_ctx_t *ctx);
+static void ngx_resolver_free_answer(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+
+static ngx_int_t ngx_resolver_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_resolver_shared_get(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_shared_set(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static ngx_resolver_shared_node_t *ngx_resolver_shared_lookup(
+    ngx_resolver_shared_t *sh, u_char *name, size_t len, uint32_t hash);
+static void ngx_resolver_shared_delete(ngx_slab_pool_t *shpool,
+    ngx_resolver_shared_t *sh, ngx_resolver_shared_node_t *sn);
+static void ngx_resolver_shared_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+
+static void ngx_resolver_tcp_query(ngx_resolver_t *r, u_char *buf, size_t n,
+    ngx_uint_t ident);
+static void ngx_resolver_tcp_write_handler(ngx_event_t *wev);
+static void ngx_resolver_tcp_read_handler(ngx_event_t *rev);
+static void ngx_resolver_tcp_close(ngx_resolver_tcp_t *t);
+
+
+/* the tag of the shared zones of all resolvers */
+static ngx_uint_t  ngx_resolver_zone_tag;
+
 
 ngx_resolver_t *
 ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 {
+    u_char                *p;
+    ssize_t                size;
     ngx_str_t              s;
     ngx_url_t              u;
     ngx_uint_t             i, j;
@@ -134,6 +206,8 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
     ngx_queue_init(&r->name_expire_queue);
     ngx_queue_init(&r->addr_expire_queue);
 
+    ngx_queue_init(&r->tcp_queue);
+
     r->event->handler = ngx_resolver_resend_handler;
     r->event->data = r;
     r->event->log = &cf->cycle->new_log;
@@ -142,6 +216,8 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
     r->resend_timeout = 5;
     r->expire = 30;
     r->valid = 0;
+    r->negative = 5;
+    r->prefetch = 5;
 
     r->log = &cf->cycle->new_log;
     r->log_level = NGX_LOG_ERR;
@@ -171,6 +247,71 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
             continue;
         }
 
+        if (ngx_strncmp(names[i].data, "negative=", 9) == 0) {
+            s.len = names[i].len - 9;
+            s.data = names[i].data + 9;
+
+            r->negative = ngx_parse_time(&s, 1);
+
+            if (r->negative == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "prefetch=", 9) == 0) {
+            s.len = names[i].len - 9;
+            s.data = names[i].data + 9;
+
+            r->prefetch = ngx_parse_time(&s, 1);
+
+            if (r->prefetch == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "zone=", 5) == 0) {
+            p = (u_char *) ngx_strchr(names[i].data + 5, ':');
+
+            if (p == NULL || p == names[i].data + 5) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            s.data = p + 1;
+            s.len = names[i].data + names[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            s.data = names[i].data + 5;
+            s.len = p - s.data;
+
+            r->shm_zone = ngx_shared_memory_add(cf, &s, size,
+                                                &ngx_resolver_zone_tag);
+            if (r->shm_zone == NULL) {
+                return NULL;
+            }
+
+            r->shm_zone->init = ngx_resolver_init_zone;
+            r->shm_zone->data = r;
+
+            continue;
+        }
+
         ngx_memzero(&u, sizeof(ngx_url_t));
 
         u.url = names[i];
@@ -210,12 +351,19 @@ ngx_resolver_cleanup(void *data)
     ngx_resolver_t  *r = data;
 
     ngx_uint_t             i;
+    ngx_queue_t           *q;
     ngx_udp_connection_t  *uc;
 
     if (r) {
         ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
                        "cleanup resolver");
 
+        while (!ngx_queue_empty(&r->tcp_queue)) {
+            q = ngx_queue_head(&r->tcp_queue);
+            ngx_resolver_tcp_close(ngx_queue_data(q, ngx_resolver_tcp_t,
+                                                  queue));
+        }
+
         ngx_resolver_cleanup_tree(r, &r->name_rbtree);
 
         ngx_resolver_cleanup_tree(r, &r->addr_rbtree);
@@ -439,6 +587,34 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx)
 
             ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+            if (rn->code) {
+
+                ctx->next = rn->waiting;
+                rn->waiting = NULL;
+
+                /* unlock name mutex */
+
+                do {
+                    ctx->state = rn->code;
+                    next = ctx->next;
+
+                    ctx->handler(ctx);
+
+                    ctx = next;
+                } while (ctx);
+
+                return NGX_OK;
+            }
+
+            /*
+             * a hot name is queried again before it expires, so the requests
+             * keep getting the cached answer and never wait for the resolver
+             */
+
+            if (rn->query == NULL && rn->valid - ngx_time() < r->prefetch) {
+                ngx_resolver_prefetch(r, rn, ctx);
+            }
+
             naddrs = rn->naddrs;
 
             if (naddrs) {
@@ -556,6 +732,26 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx)
         ngx_rbtree_insert(&r->name_rbtree, &rn->node);
     }
 
+    rn->cnlen = 0;
+    rn->naddrs = 0;
+    rn->code = 0;
+    rn->valid = 0;
+    rn->waiting = NULL;
+
+    /* another worker or the previous configuration may have the answer */
+
+    if (ngx_resolver_shared_get(r, rn) == NGX_OK) {
+
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0,
+                       "resolve shared cached");
+
+        rn->expire = ngx_time() + r->expire;
+
+        ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+
+        return ngx_resolve_name_locked(r, ctx);
+    }
+
     rc = ngx_resolver_create_name_query(rn, ctx);
 
     if (rc == NGX_ERROR) {
@@ -1012,14 +1208,15 @@ ngx_resolver_read_response(ngx_event_t *rev)
             return;
         }
 
-        ngx_resolver_process_response(c->data, buf, n);
+        ngx_resolver_process_response(c->data, buf, n, 0);
 
     } while (rev->ready);
 }
 
 
 static void
-ngx_resolver_process_response(ngx_resolver_t *r, u_char *buf, size_t n)
+ngx_resolver_process_response(ngx_resolver_t *r, u_char *buf, size_t n,
+    ngx_uint_t tcp)
 {
     char                  *err;
     size_t                 len;
@@ -1107,9 +1304,7 @@ found:
         goto done;
     }
 
-    if (i + sizeof(ngx_resolver_qs_t) + nan * (2 + sizeof(ngx_resolver_an_t))
-        > (ngx_uint_t) n)
-    {
+    if (i + sizeof(ngx_resolver_qs_t) > (ngx_uint_t) n) {
         goto short_response;
     }
 
@@ -1127,6 +1322,19 @@ found:
         return;
     }
 
+    /* the answers did not fit in a datagram, the query is repeated over TCP */
+
+    if ((flags & NGX_RESOLVER_TRUNCATED) && !tcp && qtype == NGX_RESOLVE_A) {
+        ngx_resolver_tcp_query(r, buf, n, ident);
+        return;
+    }
+
+    if (i + sizeof(ngx_resolver_qs_t) + nan * (2 + sizeof(ngx_resolver_an_t))
+        > (ngx_uint_t) n)
+    {
+        goto short_response;
+    }
+
     switch (qtype) {
 
     case NGX_RESOLVE_A:
@@ -1218,6 +1426,49 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
         code = 3; /* NXDOMAIN */
     }
 
+    if (code == NGX_RESOLVE_NXDOMAIN && r->negative) {
+        next = rn->waiting;
+        rn->waiting = NULL;
+
+        ngx_queue_remove(&rn->queue);
+
+        ngx_resolver_free_answer(r, rn);
+
+        rn->code = (u_short) code;
+
+        rn->valid = ngx_time() + r->negative;
+        rn->expire = ngx_time() + r->expire;
+
+        ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+
+        ngx_resolver_free(r, rn->query);
+        rn->query = NULL;
+
+        ngx_resolver_shared_set(r, rn);
+
+        /* unlock name mutex */
+
+        while (next) {
+             ctx = next;
+             ctx->state = code;
+             next = ctx->next;
+
+             ctx->handler(ctx);
+        }
+
+        return;
+    }
+
+    if (code && rn->waiting == NULL && rn->valid >= ngx_time()) {
+
+        /* a failed prefetch, the cached answer is still good */
+
+        ngx_resolver_free(r, rn->query);
+        rn->query = NULL;
+
+        return;
+    }
+
     if (code) {
         next = rn->waiting;
         rn->waiting = NULL;
@@ -1328,6 +1579,10 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
 
     if (naddrs) {
 
+        /* a prefetched name still has the previous answer */
+
+        ngx_resolver_free_answer(r, rn);
+
         if (naddrs == 1) {
             rn->u.addr = addr;
 
@@ -1398,6 +1653,8 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        ngx_resolver_shared_set(r, rn);
+
         next = rn->waiting;
         rn->waiting = NULL;
 
@@ -1436,6 +1693,8 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
 
         ngx_queue_remove(&rn->queue);
 
+        ngx_resolver_free_answer(r, rn);
+
         rn->cnlen = (u_short) name.len;
         rn->u.cname = name.data;
 
@@ -1444,6 +1703,8 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        ngx_resolver_shared_set(r, rn);
+
         ctx = rn->waiting;
         rn->waiting = NULL;
 
@@ -2071,6 +2332,23 @@ ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
 }
 
 
+static void
+ngx_resolver_free_answer(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    if (rn->cnlen) {
+        ngx_resolver_free(r, rn->u.cname);
+    }
+
+    if (rn->naddrs > 1) {
+        ngx_resolver_free(r, rn->u.addrs);
+    }
+
+    rn->cnlen = 0;
+    rn->naddrs = 0;
+    rn->code = 0;
+}
+
+
 static void *
 ngx_resolver_alloc(ngx_resolver_t *r, size_t size)
 {
@@ -2208,6 +2486,546 @@ ngx_resolver_log_error(ngx_log_t *log, u_char *buf, size_t len)
 }
 
 
+/*
+ * the query is sent without a waiting context and outside of the resend
+ * queue: if the answer is lost, the name is queried as usual on expiry
+ */
+
+static void
+ngx_resolver_prefetch(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_resolver_ctx_t *ctx)
+{
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver prefetch \"%*s\"", (size_t) rn->nlen, rn->name);
+
+    if (ngx_resolver_create_name_query(rn, ctx) == NGX_OK
+        && ngx_resolver_send_query(r, rn) == NGX_OK)
+    {
+        return;
+    }
+
+    if (rn->query) {
+        ngx_resolver_free(r, rn->query);
+        rn->query = NULL;
+    }
+}
+
+
+static ngx_int_t
+ngx_resolver_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_resolver_t  *or = data;
+
+    ngx_slab_pool_t        *shpool;
+    ngx_resolver_shared_t  *sh;
+
+    if (or) {
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_resolver_shared_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = sh;
+
+    ngx_rbtree_init(&sh->rbtree, &sh->sentinel,
+                    ngx_resolver_shared_insert_value);
+
+    ngx_queue_init(&sh->queue);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_resolver_shared_get(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                      *name;
+    ngx_int_t                    rc;
+    ngx_slab_pool_t             *shpool;
+    ngx_resolver_shared_t       *sh;
+    ngx_resolver_shared_node_t  *sn;
+
+    if (r->shm_zone == NULL) {
+        return NGX_DECLINED;
+    }
+
+    shpool = (ngx_slab_pool_t *) r->shm_zone->shm.addr;
+    sh = shpool->data;
+
+    rc = NGX_DECLINED;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = ngx_resolver_shared_lookup(sh, rn->name, rn->nlen, rn->node.key);
+
+    if (sn == NULL || sn->valid < ngx_time()) {
+        goto done;
+    }
+
+    ngx_queue_remove(&sn->queue);
+    ngx_queue_insert_head(&sh->queue, &sn->queue);
+
+    if (sn->naddrs == 1) {
+        rn->u.addr = sn->addrs[0];
+
+    } else if (sn->naddrs) {
+        rn->u.addrs = ngx_resolver_dup(r, sn->addrs,
+                                       sn->naddrs * sizeof(in_addr_t));
+        if (rn->u.addrs == NULL) {
+            goto done;
+        }
+
+    } else if (sn->cnlen) {
+        name = (u_char *) &sn->addrs[sn->naddrs] + sn->nlen;
+
+        rn->u.cname = ngx_resolver_dup(r, name, sn->cnlen);
+        if (rn->u.cname == NULL) {
+            goto done;
+        }
+    }
+
+    rn->naddrs = sn->naddrs;
+    rn->cnlen = sn->cnlen;
+    rn->code = sn->code;
+    rn->valid = sn->valid;
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return rc;
+}
+
+
+static void
+ngx_resolver_shared_set(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                      *p;
+    size_t                       size;
+    time_t                       now;
+    ngx_uint_t                   i;
+    ngx_queue_t                 *q;
+    ngx_slab_pool_t             *shpool;
+    ngx_resolver_shared_t       *sh;
+    ngx_resolver_shared_node_t  *sn;
+
+    if (r->shm_zone == NULL) {
+        return;
+    }
+
+    shpool = (ngx_slab_pool_t *) r->shm_zone->shm.addr;
+    sh = shpool->data;
+
+    size = offsetof(ngx_resolver_shared_node_t, addrs)
+           + rn->naddrs * sizeof(in_addr_t) + rn->nlen + rn->cnlen;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = ngx_resolver_shared_lookup(sh, rn->name, rn->nlen, rn->node.key);
+
+    if (sn) {
+        ngx_resolver_shared_delete(shpool, sh, sn);
+    }
+
+    /* one or two expired names are freed on every update */
+
+    for (i = 0; i < 2 && !ngx_queue_empty(&sh->queue); i++) {
+
+        q = ngx_queue_last(&sh->queue);
+        sn = ngx_queue_data(q, ngx_resolver_shared_node_t, queue);
+
+        if (sn->valid >= now) {
+            break;
+        }
+
+        ngx_resolver_shared_delete(shpool, sh, sn);
+    }
+
+    for ( ;; ) {
+        sn = ngx_slab_alloc_locked(shpool, size);
+
+        if (sn) {
+            break;
+        }
+
+        if (ngx_queue_empty(&sh->queue)) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return;
+        }
+
+        /* the least recently used names are evicted */
+
+        q = ngx_queue_last(&sh->queue);
+
+        ngx_resolver_shared_delete(shpool, sh,
+                         ngx_queue_data(q, ngx_resolver_shared_node_t, queue));
+    }
+
+    sn->node.key = rn->node.key;
+    sn->valid = rn->valid;
+    sn->nlen = rn->nlen;
+    sn->naddrs = rn->naddrs;
+    sn->cnlen = rn->cnlen;
+    sn->code = rn->code;
+
+    if (rn->naddrs == 1) {
+        sn->addrs[0] = rn->u.addr;
+
+    } else if (rn->naddrs) {
+        ngx_memcpy(sn->addrs, rn->u.addrs, rn->naddrs * sizeof(in_addr_t));
+    }
+
+    p = ngx_cpymem(&sn->addrs[rn->naddrs], rn->name, rn->nlen);
+
+    if (rn->cnlen) {
+        ngx_memcpy(p, rn->u.cname, rn->cnlen);
+    }
+
+    ngx_rbtree_insert(&sh->rbtree, &sn->node);
+    ngx_queue_insert_head(&sh->queue, &sn->queue);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static ngx_resolver_shared_node_t *
+ngx_resolver_shared_lookup(ngx_resolver_shared_t *sh, u_char *name,
+    size_t len, uint32_t hash)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_resolver_shared_node_t  *sn;
+
+    node = sh->rbtree.root;
+    sentinel = sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        sn = (ngx_resolver_shared_node_t *) node;
+
+        rc = ngx_memn2cmp(name, (u_char *) &sn->addrs[sn->naddrs],
+                          len, sn->nlen);
+
+        if (rc == 0) {
+            return sn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_resolver_shared_delete(ngx_slab_pool_t *shpool, ngx_resolver_shared_t *sh,
+    ngx_resolver_shared_node_t *sn)
+{
+    ngx_queue_remove(&sn->queue);
+    ngx_rbtree_delete(&sh->rbtree, &sn->node);
+    ngx_slab_free_locked(shpool, sn);
+}
+
+
+static void
+ngx_resolver_shared_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t           **p;
+    ngx_resolver_shared_node_t   *sn, *sn_temp;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            sn = (ngx_resolver_shared_node_t *) node;
+            sn_temp = (ngx_resolver_shared_node_t *) temp;
+
+            p = (ngx_memn2cmp((u_char *) &sn->addrs[sn->naddrs],
+                              (u_char *) &sn_temp->addrs[sn_temp->naddrs],
+                              sn->nlen, sn_temp->nlen)
+                 < 0) ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+/*
+ * a truncated response is ignored and the query is repeated over TCP;
+ * the name stays in the resend queue, so a failed TCP query is retried
+ * over UDP as usual
+ */
+
+static void
+ngx_resolver_tcp_query(ngx_resolver_t *r, u_char *buf, size_t n,
+    ngx_uint_t ident)
+{
+    uint32_t               hash;
+    ngx_int_t              rc;
+    ngx_str_t              name;
+    ngx_uint_t             qident;
+    ngx_connection_t      *c;
+    ngx_resolver_tcp_t    *t;
+    ngx_resolver_node_t   *rn;
+    ngx_udp_connection_t  *uc;
+
+    if (ngx_resolver_copy(r, &name, buf, &buf[12], &buf[n]) != NGX_OK) {
+        return;
+    }
+
+    hash = ngx_crc32_short(name.data, name.len);
+
+    rn = ngx_resolver_lookup_name(r, &name, hash);
+
+    ngx_resolver_free(r, name.data);
+
+    if (rn == NULL || rn->query == NULL) {
+        return;
+    }
+
+    qident = (rn->query[0] << 8) + rn->query[1];
+
+    if (ident != qident) {
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver truncated response for \"%*s\", using TCP",
+                   (size_t) rn->nlen, rn->name);
+
+    uc = r->udp_connections.elts;
+
+    uc = &uc[r->last_connection++];
+    if (r->last_connection == r->udp_connections.nelts) {
+        r->last_connection = 0;
+    }
+
+    t = ngx_resolver_calloc(r, sizeof(ngx_resolver_tcp_t));
+    if (t == NULL) {
+        return;
+    }
+
+    t->qlen = 2 + rn->qlen;
+
+    t->query = ngx_resolver_alloc(r, t->qlen);
+    if (t->query == NULL) {
+        ngx_resolver_free(r, t);
+        return;
+    }
+
+    t->query[0] = (u_char) (rn->qlen >> 8);
+    t->query[1] = (u_char) rn->qlen;
+    ngx_memcpy(&t->query[2], rn->query, rn->qlen);
+
+    t->resolver = r;
+
+    t->peer.sockaddr = uc->sockaddr;
+    t->peer.socklen = uc->socklen;
+    t->peer.name = &uc->server;
+    t->peer.get = ngx_event_get_peer;
+    t->peer.log = r->log;
+    t->peer.log_error = NGX_ERROR_ERR;
+    t->peer.tries = 1;
+
+    rc = ngx_event_connect_peer(&t->peer);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_resolver_free(r, t->query);
+        ngx_resolver_free(r, t);
+        return;
+    }
+
+    c = t->peer.connection;
+
+    c->data = t;
+    c->read->handler = ngx_resolver_tcp_read_handler;
+    c->write->handler = ngx_resolver_tcp_write_handler;
+
+    ngx_queue_insert_head(&r->tcp_queue, &t->queue);
+
+    ngx_add_timer(c->read, (ngx_msec_t) (r->resend_timeout * 1000));
+
+    if (rc == NGX_OK) {
+        ngx_resolver_tcp_write_handler(c->write);
+    }
+}
+
+
+static void
+ngx_resolver_tcp_write_handler(ngx_event_t *wev)
+{
+    ssize_t              n;
+    ngx_connection_t    *c;
+    ngx_resolver_tcp_t  *t;
+
+    c = wev->data;
+    t = c->data;
+
+    while (t->sent < t->qlen) {
+
+        n = c->send(c, t->query + t->sent, t->qlen - t->sent);
+
+        if (n == NGX_ERROR) {
+            ngx_resolver_tcp_close(t);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_resolver_tcp_close(t);
+            }
+
+            return;
+        }
+
+        t->sent += n;
+    }
+
+    if (c->read->ready) {
+        ngx_resolver_tcp_read_handler(c->read);
+    }
+}
+
+
+static void
+ngx_resolver_tcp_read_handler(ngx_event_t *rev)
+{
+    ssize_t              n;
+    ngx_connection_t    *c;
+    ngx_resolver_tcp_t  *t;
+
+    c = rev->data;
+    t = c->data;
+
+    if (rev->timedout) {
+        ngx_log_error(t->resolver->log_level, c->log, NGX_ETIMEDOUT,
+                      "resolver TCP query to %V timed out", t->peer.name);
+        ngx_resolver_tcp_close(t);
+        return;
+    }
+
+    if (t->sent < t->qlen) {
+        return;
+    }
+
+    for ( ;; ) {
+
+        if (t->buf == NULL) {
+            n = c->recv(c, t->len + t->received, 2 - t->received);
+
+        } else {
+            n = c->recv(c, t->buf + t->received, t->size - t->received);
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_resolver_tcp_close(t);
+            }
+
+            return;
+        }
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_resolver_tcp_close(t);
+            return;
+        }
+
+        t->received += n;
+
+        if (t->buf == NULL) {
+
+            if (t->received < 2) {
+                continue;
+            }
+
+            t->size = (t->len[0] << 8) + t->len[1];
+
+            if (t->size == 0) {
+                ngx_resolver_tcp_close(t);
+                return;
+            }
+
+            t->buf = ngx_resolver_alloc(t->resolver, t->size);
+            if (t->buf == NULL) {
+                ngx_resolver_tcp_close(t);
+                return;
+            }
+
+            t->received = 0;
+
+            continue;
+        }
+
+        if (t->received == t->size) {
+            ngx_resolver_process_response(t->resolver, t->buf, t->size, 1);
+            ngx_resolver_tcp_close(t);
+            return;
+        }
+    }
+}
+
+
+static void
+ngx_resolver_tcp_close(ngx_resolver_tcp_t *t)
+{
+    ngx_queue_remove(&t->queue);
+
+    ngx_close_connection(t->peer.connection);
+
+    if (t->buf) {
+        ngx_resolver_free(t->resolver, t->buf);
+    }
+
+    ngx_resolver_free(t->resolver, t->query);
+    ngx_resolver_free(t->resolver, t);
+}
+
+
 ngx_int_t
 ngx_udp_connect(ngx_udp_connection_t *uc)
 {
@@ -68,6 +68,9 @@ typedef struct {
     u_short                   naddrs;
     u_short                   cnlen;
 
+    /* NXDOMAIN for a negatively cached name */
+    u_short                   code;
+
     time_t                    expire;
     time_t                    valid;
 
@@ -100,9 +103,17 @@ typedef struct {
     ngx_queue_t               name_expire_queue;
     ngx_queue_t               addr_expire_queue;
 
+    /* queries retried over TCP after truncated UDP responses */
+    ngx_queue_t               tcp_queue;
+
+    /* the names cache shared by the workers, it survives reloads */
+    ngx_shm_zone_t           *shm_zone;
+
     time_t                    resend_timeout;
     time_t                    expire;
     time_t                    valid;
+    time_t                    negative;
+    time_t                    prefetch;
 
     ngx_uint_t                log_level;
 } ngx_resolver_t;
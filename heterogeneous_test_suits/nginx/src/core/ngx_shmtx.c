@@ -15,9 +15,31 @@
 static void ngx_shmtx_wakeup(ngx_shmtx_t *mtx);
 
 
+#if (NGX_HAVE_FUTEX)
+
+/*
+ * the processes sleep on the word of the lock that holds the owner pid,
+ * so a waiter does not sleep if the lock has been released or passed
+ * to another process meanwhile
+ */
+
+#if (NGX_HAVE_LITTLE_ENDIAN)
+#define ngx_shmtx_futex_word(mtx)  ((uint32_t *) (mtx)->lock)
+#else
+#define ngx_shmtx_futex_word(mtx)                                             \
+    ((uint32_t *) (mtx)->lock + sizeof(ngx_atomic_t) / sizeof(uint32_t) - 1)
+#endif
+
+#define ngx_shmtx_futex(mtx, op, val)                                         \
+    syscall(SYS_futex, ngx_shmtx_futex_word(mtx), op, val, NULL, NULL, 0)
+
+#endif
+
+
 ngx_int_t
 ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 {
+    mtx->sh = addr;
     mtx->lock = &addr->lock;
 
     if (mtx->spin == (ngx_uint_t) -1) {
@@ -26,7 +48,18 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 
     mtx->spin = 2048;
 
-#if (NGX_HAVE_POSIX_SEM)
+    /* a lock that survived reconfiguration keeps its calibration */
+
+    if (addr->spin == 0) {
+        addr->spin = mtx->spin / 8;
+    }
+
+#if (NGX_HAVE_FUTEX)
+
+    mtx->wait = &addr->wait;
+    mtx->futex = 1;
+
+#elif (NGX_HAVE_POSIX_SEM)
 
     mtx->wait = &addr->wait;
 
@@ -46,7 +79,7 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 void
 ngx_shmtx_destroy(ngx_shmtx_t *mtx)
 {
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_POSIX_SEM && !NGX_HAVE_FUTEX)
 
     if (mtx->semaphore) {
         if (sem_destroy(&mtx->sem) == -1) {
@@ -62,51 +95,133 @@ ngx_shmtx_destroy(ngx_shmtx_t *mtx)
 ngx_uint_t
 ngx_shmtx_trylock(ngx_shmtx_t *mtx)
 {
-    return (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid));
+    if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+        mtx->sh->acquired++;
+        return 1;
+    }
+
+    (void) ngx_atomic_fetch_add(&mtx->sh->contended, 1);
+
+    return 0;
 }
 
 
+/*
+ * The spin is calibrated per lock: a process that got the lock while
+ * spinning moves the average by 1/8 towards the iterations it took, and
+ * it may spin up to twice the average.  A process that had to sleep
+ * decays the average by 1/8, so a lock held for long stops burning CPU
+ * on spinning, while a lock released soon after it is found busy lets
+ * the average grow back.  The average and the counters are updated with
+ * the lock held, but for the contended count, which failed trylocks add to.
+ */
+
 void
 ngx_shmtx_lock(ngx_shmtx_t *mtx)
 {
-    ngx_uint_t         i, n;
+    ngx_int_t        spun, usec;
+    ngx_uint_t       n, limit, sleeps;
+    struct timeval   start, tv;
+    ngx_shmtx_sh_t  *sh;
+#if (NGX_HAVE_FUTEX)
+    ngx_err_t        err;
+    ngx_atomic_t     lock;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx lock");
 
-    for ( ;; ) {
+    sh = mtx->sh;
 
-        if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
-            return;
-        }
+    if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+        sh->acquired++;
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&sh->contended, 1);
+
+    ngx_gettimeofday(&start);
+
+    spun = -1;
+    sleeps = 0;
+
+    for ( ;; ) {
 
         if (ngx_ncpu > 1) {
 
-            for (n = 1; n < mtx->spin; n <<= 1) {
+            if (mtx->spin == (ngx_uint_t) -1) {
+                limit = 2048;
 
-                for (i = 0; i < n; i++) {
-                    ngx_cpu_pause();
-                }
+            } else {
+                limit = ngx_min(mtx->spin, 2 * sh->spin + 16);
+            }
+
+            for (n = 1; n < limit; n++) {
+
+                ngx_cpu_pause();
 
                 if (*mtx->lock == 0
                     && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid))
                 {
-                    return;
+                    spun = n;
+                    goto acquired;
                 }
             }
         }
 
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX)
+
+        if (mtx->futex) {
+            (void) ngx_atomic_fetch_add(mtx->wait, 1);
+
+            lock = *mtx->lock;
+
+            if (lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+                (void) ngx_atomic_fetch_add(mtx->wait, -1);
+                goto acquired;
+            }
+
+            if (lock) {
+                ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                               "shmtx wait %uA", *mtx->wait);
+
+                sleeps++;
+
+                if (ngx_shmtx_futex(mtx, FUTEX_WAIT, (uint32_t) lock) == -1) {
+                    err = ngx_errno;
+
+                    if (err != NGX_EAGAIN && err != NGX_EINTR) {
+                        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                                      "futex() failed while waiting on shmtx");
+                    }
+                }
+
+                ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                               "shmtx awoke");
+            }
+
+            (void) ngx_atomic_fetch_add(mtx->wait, -1);
+
+            if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+                goto acquired;
+            }
+
+            continue;
+        }
+
+#elif (NGX_HAVE_POSIX_SEM)
 
         if (mtx->semaphore) {
             (void) ngx_atomic_fetch_add(mtx->wait, 1);
 
             if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
-                return;
+                goto acquired;
             }
 
             ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
                            "shmtx wait %uA", *mtx->wait);
 
+            sleeps++;
+
             while (sem_wait(&mtx->sem) == -1) {
                 ngx_err_t  err;
 
@@ -122,12 +237,44 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
             ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
                            "shmtx awoke");
 
+            if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+                goto acquired;
+            }
+
             continue;
         }
 
 #endif
 
         ngx_sched_yield();
+
+        if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+            goto acquired;
+        }
+    }
+
+acquired:
+
+    ngx_gettimeofday(&tv);
+
+    usec = (tv.tv_sec - start.tv_sec) * 1000000
+           + (tv.tv_usec - start.tv_usec);
+
+    sh->acquired++;
+    sh->sleeps += sleeps;
+
+    if (usec > 0) {
+        sh->wait_usec += usec;
+    }
+
+    if (mtx->spin != (ngx_uint_t) -1 && ngx_ncpu > 1) {
+
+        if (spun != -1) {
+            sh->spin += (spun - (ngx_int_t) sh->spin) / 8;
+
+        } else if (sleeps) {
+            sh->spin -= sh->spin / 8;
+        }
     }
 }
 
@@ -163,7 +310,23 @@ ngx_shmtx_force_unlock(ngx_shmtx_t *mtx, ngx_pid_t pid)
 static void
 ngx_shmtx_wakeup(ngx_shmtx_t *mtx)
 {
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX)
+
+    /* the waiters remove themselves from the count when they awake */
+
+    if (!mtx->futex || *mtx->wait == 0) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shmtx wake %uA", *mtx->wait);
+
+    if (ngx_shmtx_futex(mtx, FUTEX_WAKE, 1) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "futex() failed while wake shmtx");
+    }
+
+#elif (NGX_HAVE_POSIX_SEM)
     ngx_atomic_uint_t  wait;
 
     if (!mtx->semaphore) {
@@ -13,27 +13,42 @@
 #include <ngx_core.h>
 
 
+/*
+ * the statistics are kept next to the lock, so all the processes sharing it
+ * see the same numbers; the accept mutex slot limits the structure to 128
+ * bytes
+ */
+
 typedef struct {
     ngx_atomic_t   lock;
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX || NGX_HAVE_POSIX_SEM)
     ngx_atomic_t   wait;
 #endif
+    ngx_atomic_t   spin;         /* the calibrated spin, see ngx_shmtx_lock() */
+    ngx_atomic_t   acquired;
+    ngx_atomic_t   contended;
+    ngx_atomic_t   sleeps;
+    ngx_atomic_t   wait_usec;
 } ngx_shmtx_sh_t;
 
 
 typedef struct {
 #if (NGX_HAVE_ATOMIC_OPS)
-    ngx_atomic_t  *lock;
-#if (NGX_HAVE_POSIX_SEM)
-    ngx_atomic_t  *wait;
-    ngx_uint_t     semaphore;
-    sem_t          sem;
+    ngx_shmtx_sh_t  *sh;
+    ngx_atomic_t    *lock;
+#if (NGX_HAVE_FUTEX)
+    ngx_atomic_t    *wait;
+    ngx_uint_t       futex;
+#elif (NGX_HAVE_POSIX_SEM)
+    ngx_atomic_t    *wait;
+    ngx_uint_t       semaphore;
+    sem_t            sem;
 #endif
 #else
-    ngx_fd_t       fd;
-    u_char        *name;
+    ngx_fd_t         fd;
+    u_char          *name;
 #endif
-    ngx_uint_t     spin;
+    ngx_uint_t       spin;
 } ngx_shmtx_t;
 
 
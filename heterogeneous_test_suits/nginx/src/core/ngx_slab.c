@@ -614,6 +614,85 @@ fail:
 }
 
 
+#if (NGX_HAVE_ATOMIC_OPS)
+
+/*
+ * splits the free pages of a zone between n pools with their own locks,
+ * the pools are linked to the zone pool to be unlocked if a worker exits
+ * abnormally
+ */
+
+ngx_slab_pool_t **
+ngx_slab_stripe(ngx_slab_pool_t *pool, ngx_uint_t n)
+{
+    size_t             size;
+    ngx_uint_t         i, pages;
+    ngx_slab_page_t   *page;
+    ngx_slab_pool_t   *sp, **stripes;
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    stripes = ngx_slab_alloc_locked(pool, n * sizeof(ngx_slab_pool_t *));
+    if (stripes == NULL) {
+        goto failed;
+    }
+
+    pages = 0;
+
+    for (page = pool->free.next; page != &pool->free; page = page->next) {
+        pages += page->slab;
+    }
+
+    /* a stripe spends about a page on its header and page array */
+
+    pages /= n;
+
+    if (pages < 4) {
+        ngx_slab_error(pool, NGX_LOG_EMERG,
+                       "ngx_slab_stripe() failed: zone is too small");
+        goto failed;
+    }
+
+    size = pages << ngx_pagesize_shift;
+
+    for (i = 0; i < n; i++) {
+        sp = ngx_slab_alloc_locked(pool, size);
+        if (sp == NULL) {
+            goto failed;
+        }
+
+        ngx_memzero(sp, sizeof(ngx_slab_pool_t));
+
+        sp->end = (u_char *) sp + size;
+        sp->min_shift = pool->min_shift;
+        sp->addr = sp;
+
+        if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+            goto failed;
+        }
+
+        ngx_slab_init(sp);
+
+        sp->next = pool->next;
+        pool->next = sp;
+
+        stripes[i] = sp;
+    }
+
+    ngx_shmtx_unlock(&pool->mutex);
+
+    return stripes;
+
+failed:
+
+    ngx_shmtx_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+#endif
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
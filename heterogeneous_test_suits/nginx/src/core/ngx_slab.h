@@ -41,6 +41,9 @@ typedef struct {
 
     void             *data;
     void             *addr;
+
+    /* the pools striped off this one, see ngx_slab_stripe() */
+    void             *next;
 } ngx_slab_pool_t;
 
 
@@ -49,6 +52,9 @@ void *ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+#if (NGX_HAVE_ATOMIC_OPS)
+ngx_slab_pool_t **ngx_slab_stripe(ngx_slab_pool_t *pool, ngx_uint_t n);
+#endif
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
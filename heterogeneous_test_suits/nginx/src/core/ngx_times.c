@@ -16,12 +16,23 @@
  * values and strings from the current slot.  Thus thread may get the corrupted
  * values only if it is preempted while copying and then it is not scheduled
  * to run more than NGX_TIME_SLOTS seconds.
+ *
+ * The strings of a new second are formatted by the first ngx_time_strings()
+ * call that needs them, and not by ngx_time_update(): the update follows
+ * every return from the event method, while most seconds of an idle worker
+ * log nothing.  The formatting takes no libc calls, so it is safe to do from
+ * a signal handler too.
  */
 
 #define NGX_TIME_SLOTS   64
 
 static ngx_uint_t        slot;
 static ngx_atomic_t      ngx_time_lock;
+static volatile ngx_uint_t  ngx_time_stale;
+
+#if (NGX_HAVE_CLOCK_COARSE)
+static ngx_uint_t        ngx_time_coarse;
+#endif
 
 volatile ngx_msec_t      ngx_current_msec;
 volatile ngx_time_t     *ngx_cached_time;
@@ -59,6 +70,10 @@ static char  *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
 void
 ngx_time_init(void)
 {
+#if (NGX_HAVE_CLOCK_COARSE)
+    struct timespec  ts;
+#endif
+
     ngx_cached_err_log_time.len = sizeof("1970/09/28 12:00:00") - 1;
     ngx_cached_http_time.len = sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1;
     ngx_cached_http_log_time.len = sizeof("28/Sep/1970:12:00:00 +0600") - 1;
@@ -66,28 +81,82 @@ ngx_time_init(void)
 
     ngx_cached_time = &cached_time[0];
 
+#if (NGX_HAVE_CLOCK_COARSE)
+
+    /*
+     * the coarse clock is read from the vDSO without touching the clock
+     * hardware, it is used if it still ticks every millisecond
+     */
+
+    if (clock_getres(CLOCK_REALTIME_COARSE, &ts) == 0
+        && ts.tv_sec == 0 && ts.tv_nsec <= 1000000)
+    {
+        ngx_time_coarse = 1;
+    }
+
+#endif
+
     ngx_time_update();
+    ngx_time_strings();
+}
+
+
+void
+ngx_time_now(time_t *sec, ngx_uint_t *msec)
+{
+    struct timeval   tv;
+#if (NGX_HAVE_CLOCK_COARSE)
+    struct timespec  ts;
+
+    if (ngx_time_coarse) {
+        (void) clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+
+        *sec = ts.tv_sec;
+        *msec = ts.tv_nsec / 1000000;
+        return;
+    }
+
+#endif
+
+    ngx_gettimeofday(&tv);
+
+    *sec = tv.tv_sec;
+    *msec = tv.tv_usec / 1000;
+}
+
+
+/*
+ * the microseconds of the wall clock and not of a monotonic one: a worker
+ * migrated to another node goes on with the clock of that node, and only
+ * the wall clocks of the nodes are kept in step
+ */
+
+ngx_usec_t
+ngx_time_usec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (ngx_usec_t) tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
 
 void
 ngx_time_update(void)
 {
-    u_char          *p0, *p1, *p2, *p3;
-    ngx_tm_t         tm, gmt;
     time_t           sec;
     ngx_uint_t       msec;
     ngx_time_t      *tp;
-    struct timeval   tv;
+#if !(NGX_HAVE_GETTIMEZONE)
+    ngx_tm_t         tm;
+#endif
 
     if (!ngx_trylock(&ngx_time_lock)) {
         return;
     }
 
-    ngx_gettimeofday(&tv);
-
-    sec = tv.tv_sec;
-    msec = tv.tv_usec / 1000;
+    ngx_time_now(&sec, &msec);
 
     ngx_current_msec = (ngx_msec_t) sec * 1000 + msec;
 
@@ -110,20 +179,9 @@ ngx_time_update(void)
     tp->sec = sec;
     tp->msec = msec;
 
-    ngx_gmtime(sec, &gmt);
-
-
-    p0 = &cached_http_time[slot][0];
-
-    (void) ngx_sprintf(p0, "%s, %02d %s %4d %02d:%02d:%02d GMT",
-                       week[gmt.ngx_tm_wday], gmt.ngx_tm_mday,
-                       months[gmt.ngx_tm_mon - 1], gmt.ngx_tm_year,
-                       gmt.ngx_tm_hour, gmt.ngx_tm_min, gmt.ngx_tm_sec);
-
 #if (NGX_HAVE_GETTIMEZONE)
 
     tp->gmtoff = ngx_gettimezone();
-    ngx_gmtime(sec + tp->gmtoff * 60, &tm);
 
 #elif (NGX_HAVE_GMTOFF)
 
@@ -139,6 +197,50 @@ ngx_time_update(void)
 
 #endif
 
+    ngx_memory_barrier();
+
+    ngx_cached_time = tp;
+    ngx_time_stale = 1;
+
+    ngx_unlock(&ngx_time_lock);
+}
+
+
+void
+ngx_time_strings(void)
+{
+    u_char      *p0, *p1, *p2, *p3;
+    ngx_tm_t     tm, gmt;
+    ngx_time_t  *tp;
+
+    if (!ngx_time_stale) {
+        return;
+    }
+
+    if (!ngx_trylock(&ngx_time_lock)) {
+
+        /* the strings of the previous second are used meanwhile */
+
+        return;
+    }
+
+    if (!ngx_time_stale) {
+        ngx_unlock(&ngx_time_lock);
+        return;
+    }
+
+    tp = &cached_time[slot];
+
+    ngx_gmtime(tp->sec, &gmt);
+
+    p0 = &cached_http_time[slot][0];
+
+    (void) ngx_sprintf(p0, "%s, %02d %s %4d %02d:%02d:%02d GMT",
+                       week[gmt.ngx_tm_wday], gmt.ngx_tm_mday,
+                       months[gmt.ngx_tm_mon - 1], gmt.ngx_tm_year,
+                       gmt.ngx_tm_hour, gmt.ngx_tm_min, gmt.ngx_tm_sec);
+
+    ngx_gmtime(tp->sec + tp->gmtoff * 60, &tm);
 
     p1 = &cached_err_log_time[slot][0];
 
@@ -169,12 +271,13 @@ ngx_time_update(void)
 
     ngx_memory_barrier();
 
-    ngx_cached_time = tp;
     ngx_cached_http_time.data = p0;
     ngx_cached_err_log_time.data = p1;
     ngx_cached_http_log_time.data = p2;
     ngx_cached_http_log_iso8601.data = p3;
 
+    ngx_time_stale = 0;
+
     ngx_unlock(&ngx_time_lock);
 }
 
@@ -187,16 +290,14 @@ ngx_time_sigsafe_update(void)
     u_char          *p;
     ngx_tm_t         tm;
     time_t           sec;
+    ngx_uint_t       msec;
     ngx_time_t      *tp;
-    struct timeval   tv;
 
     if (!ngx_trylock(&ngx_time_lock)) {
         return;
     }
 
-    ngx_gettimeofday(&tv);
-
-    sec = tv.tv_sec;
+    ngx_time_now(&sec, &msec);
 
     tp = &cached_time[slot];
 
@@ -228,6 +329,10 @@ ngx_time_sigsafe_update(void)
 
     ngx_cached_err_log_time.data = p;
 
+    /* the slot has no time to format the other strings from */
+
+    ngx_time_stale = 0;
+
     ngx_unlock(&ngx_time_lock);
 }
 
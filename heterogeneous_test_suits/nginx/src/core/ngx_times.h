@@ -21,7 +21,10 @@ typedef struct {
 
 
 void ngx_time_init(void);
+void ngx_time_now(time_t *sec, ngx_uint_t *msec);
+ngx_usec_t ngx_time_usec(void);
 void ngx_time_update(void);
+void ngx_time_strings(void);
 void ngx_time_sigsafe_update(void);
 u_char *ngx_http_time(u_char *buf, time_t t);
 u_char *ngx_http_cookie_time(u_char *buf, time_t t);
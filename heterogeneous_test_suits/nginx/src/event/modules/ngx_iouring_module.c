@@ -0,0 +1,813 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The readiness of the sockets is waited for with one-shot IORING_OP_POLL_ADD
+ * requests: a poll that completed is queued again in the next call of
+ * ngx_iouring_process_events() if its events are still active, so the method
+ * is level-triggered like poll().  The polls queued, the timeout and the file
+ * reads are all handed to the kernel by the single io_uring_enter() that
+ * waits for the completions.
+ *
+ * The user data of a request holds its kind in the low two bits.  A poll
+ * keeps the index of its connection and a generation there, a file read
+ * keeps its event.
+ */
+
+#define NGX_IOURING_POLL     0
+#define NGX_IOURING_READ     1
+#define NGX_IOURING_TIMEOUT  2
+#define NGX_IOURING_REMOVE   3
+
+#define ngx_iouring_poll_data(i, gen)                                         \
+    (((uint64_t) (gen) << 32) | ((uint64_t) (i) << 2) | NGX_IOURING_POLL)
+#define ngx_iouring_kind(data)   ((data) & 3)
+#define ngx_iouring_index(data)  ((ngx_uint_t) (((data) & 0xffffffff) >> 2))
+#define ngx_iouring_gen(data)    ((uint32_t) ((data) >> 32))
+
+
+typedef struct {
+    ngx_uint_t  entries;
+} ngx_iouring_conf_t;
+
+
+/* struct __kernel_timespec, which older headers do not have */
+
+typedef struct {
+    int64_t     tv_sec;
+    long long   tv_nsec;
+} ngx_iouring_timespec_t;
+
+
+static ngx_int_t ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_iouring_setup(ngx_cycle_t *cycle, ngx_uint_t entries);
+static void ngx_iouring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+static ngx_int_t ngx_iouring_arm(ngx_connection_t *c);
+static int ngx_iouring_enter(ngx_uint_t wait);
+static struct io_uring_sqe *ngx_iouring_get_sqe(void);
+
+static void *ngx_iouring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+static int                      ring = -1;
+static ngx_uint_t               nentries;
+
+static unsigned                *sq_head, *sq_tail, *sq_mask, *sq_array;
+static unsigned                *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_sqe     *sqes;
+static struct io_uring_cqe     *cqes;
+static void                    *sq_ptr, *cq_ptr;
+static size_t                   sq_len, cq_len, sqes_len;
+static unsigned                 sq_tail_local;
+
+/* the events of the poll pending on each connection and its generation */
+static u_char                  *armed;
+static uint32_t                *generation;
+static ngx_uint_t               nconnections;
+
+/* the connections whose poll completed, to poll them again */
+static ngx_uint_t              *rearm;
+static ngx_uint_t               nrearm;
+
+static ngx_iouring_timespec_t   timeout;
+
+#if (NGX_HAVE_FILE_AIO)
+ngx_uint_t                      ngx_iouring_files;
+#endif
+
+#if (NGX_HAVE_EPOLL)
+extern ngx_event_module_t       ngx_epoll_module_ctx;
+#endif
+
+
+static ngx_str_t      iouring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_iouring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_iouring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+ngx_event_module_t  ngx_iouring_module_ctx = {
+    &iouring_name,
+    ngx_iouring_create_conf,             /* create configuration */
+    ngx_iouring_init_conf,               /* init configuration */
+
+    {
+        ngx_iouring_add_event,           /* add an event */
+        ngx_iouring_del_event,           /* delete an event */
+        ngx_iouring_add_event,           /* enable an event */
+        ngx_iouring_del_event,           /* disable an event */
+        NULL,                            /* add an connection */
+        NULL,                            /* delete an connection */
+        NULL,                            /* process the changes */
+        ngx_iouring_process_events,      /* process the events */
+        ngx_iouring_init,                /* init the events */
+        ngx_iouring_done,                /* done the events */
+    }
+};
+
+ngx_module_t  ngx_iouring_module = {
+    NGX_MODULE_V1,
+    &ngx_iouring_module_ctx,             /* module context */
+    ngx_iouring_commands,                /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_uint_t           i;
+    ngx_iouring_conf_t  *iucf;
+
+    iucf = ngx_event_get_conf(cycle->conf_ctx, ngx_iouring_module);
+
+    if (ring == -1) {
+        if (ngx_iouring_setup(cycle, iucf->entries) != NGX_OK) {
+
+#if (NGX_HAVE_EPOLL)
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "io_uring is not available, using epoll");
+
+            return ngx_epoll_module_ctx.actions.init(cycle, timer);
+#else
+            return NGX_ERROR;
+#endif
+        }
+    }
+
+    if (nconnections < cycle->connection_n) {
+        if (armed) {
+            ngx_free(armed);
+            ngx_free(generation);
+            ngx_free(rearm);
+        }
+
+        armed = ngx_alloc(cycle->connection_n, cycle->log);
+        generation = ngx_alloc(sizeof(uint32_t) * cycle->connection_n,
+                               cycle->log);
+        rearm = ngx_alloc(sizeof(ngx_uint_t) * cycle->connection_n,
+                          cycle->log);
+
+        if (armed == NULL || generation == NULL || rearm == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < cycle->connection_n; i++) {
+            armed[i] = 0;
+            generation[i] = 0;
+        }
+
+        nconnections = cycle->connection_n;
+        nrearm = 0;
+    }
+
+#if (NGX_HAVE_FILE_AIO)
+    ngx_iouring_files = 1;
+#endif
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_iouring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_LEVEL_EVENT;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_setup(ngx_cycle_t *cycle, ngx_uint_t entries)
+{
+    struct io_uring_params  p;
+
+    ngx_memzero(&p, sizeof(struct io_uring_params));
+
+    ring = syscall(__NR_io_uring_setup, entries, &p);
+
+    if (ring == -1) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_errno,
+                      "io_uring_setup() failed");
+        return NGX_ERROR;
+    }
+
+    /* without IORING_FEAT_NODROP the overflowing completions are lost */
+
+    if (!(p.features & IORING_FEAT_NODROP)) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "io_uring does not support IORING_FEAT_NODROP");
+        goto failed;
+    }
+
+    nentries = p.sq_entries;
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_len > sq_len) {
+            sq_len = cq_len;
+        }
+
+        cq_len = sq_len;
+    }
+
+    sq_ptr = mmap(NULL, sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                  ring, IORING_OFF_SQ_RING);
+
+    if (sq_ptr == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        goto failed;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr = sq_ptr;
+
+    } else {
+        cq_ptr = mmap(NULL, cq_len, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+
+        if (cq_ptr == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            goto failed_sq;
+        }
+    }
+
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    sqes = mmap(NULL, sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                ring, IORING_OFF_SQES);
+
+    if (sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        goto failed_cq;
+    }
+
+    sq_head = (unsigned *) ((u_char *) sq_ptr + p.sq_off.head);
+    sq_tail = (unsigned *) ((u_char *) sq_ptr + p.sq_off.tail);
+    sq_mask = (unsigned *) ((u_char *) sq_ptr + p.sq_off.ring_mask);
+    sq_array = (unsigned *) ((u_char *) sq_ptr + p.sq_off.array);
+    cq_head = (unsigned *) ((u_char *) cq_ptr + p.cq_off.head);
+    cq_tail = (unsigned *) ((u_char *) cq_ptr + p.cq_off.tail);
+    cq_mask = (unsigned *) ((u_char *) cq_ptr + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) ((u_char *) cq_ptr + p.cq_off.cqes);
+
+    sq_tail_local = *sq_tail;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d entries:%ui", ring, nentries);
+
+    return NGX_OK;
+
+failed_cq:
+
+    if (cq_ptr != sq_ptr) {
+        munmap(cq_ptr, cq_len);
+    }
+
+failed_sq:
+
+    munmap(sq_ptr, sq_len);
+
+failed:
+
+    if (close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_iouring_done(ngx_cycle_t *cycle)
+{
+    munmap(sqes, sqes_len);
+
+    if (cq_ptr != sq_ptr) {
+        munmap(cq_ptr, cq_len);
+    }
+
+    munmap(sq_ptr, sq_len);
+
+    if (close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+#if (NGX_HAVE_FILE_AIO)
+    ngx_iouring_files = 0;
+#endif
+
+    ngx_free(armed);
+    ngx_free(generation);
+    ngx_free(rearm);
+
+    armed = NULL;
+    generation = NULL;
+    rearm = NULL;
+    nconnections = 0;
+    nrearm = 0;
+}
+
+
+static ngx_int_t
+ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    ev->active = 1;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d ev:%i", c->fd, event);
+
+    return ngx_iouring_arm(c);
+}
+
+
+static ngx_int_t
+ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_uint_t         i, was;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    ev->active = 0;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d ev:%i", c->fd, event);
+
+    i = c - ngx_cycle->connections;
+    was = armed[i];
+
+    if (ngx_iouring_arm(c) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * a pending poll holds a reference to the file, so unlike epoll
+     * the poll is removed before the descriptor is closed, otherwise
+     * the peer would not see the socket closed
+     */
+
+    if ((flags & NGX_CLOSE_EVENT) && was && armed[i] == 0) {
+        if (ngx_iouring_enter(0) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+                          "io_uring_enter() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * make the poll pending on the connection the one of its active events:
+ * remove the old poll if any and queue the new one
+ */
+
+static ngx_int_t
+ngx_iouring_arm(ngx_connection_t *c)
+{
+    ngx_uint_t            i, events;
+    struct io_uring_sqe  *sqe;
+
+    i = c - ngx_cycle->connections;
+
+    events = 0;
+
+    if (c->fd != -1) {
+        if (c->read->active) {
+            events |= POLLIN;
+        }
+
+        if (c->write->active) {
+            events |= POLLOUT;
+        }
+    }
+
+    if (armed[i] == events) {
+        return NGX_OK;
+    }
+
+    if (armed[i]) {
+        sqe = ngx_iouring_get_sqe();
+        if (sqe == NULL) {
+            goto full;
+        }
+
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = ngx_iouring_poll_data(i, generation[i]);
+        sqe->user_data = NGX_IOURING_REMOVE;
+
+        armed[i] = 0;
+    }
+
+    generation[i]++;
+
+    if (events) {
+        sqe = ngx_iouring_get_sqe();
+        if (sqe == NULL) {
+            goto full;
+        }
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = c->fd;
+        sqe->poll_events = (uint16_t) events;
+        sqe->user_data = ngx_iouring_poll_data(i, generation[i]);
+
+        armed[i] = (u_char) events;
+    }
+
+    return NGX_OK;
+
+full:
+
+    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                  "io_uring submission queue is full, "
+                  "increase io_uring_entries");
+
+    return NGX_ERROR;
+}
+
+
+static int
+ngx_iouring_enter(ngx_uint_t wait)
+{
+    unsigned  n;
+
+    ngx_memory_barrier();
+
+    *sq_tail = sq_tail_local;
+
+    ngx_memory_barrier();
+
+    n = sq_tail_local - *sq_head;
+
+    return syscall(__NR_io_uring_enter, ring, n, wait,
+                   wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+
+/* a free submission entry, NULL if the queue stays full after a submission */
+
+static struct io_uring_sqe *
+ngx_iouring_get_sqe(void)
+{
+    unsigned              i;
+    struct io_uring_sqe  *sqe;
+
+    if (sq_tail_local - *sq_head >= nentries) {
+        (void) ngx_iouring_enter(0);
+
+        if (sq_tail_local - *sq_head >= nentries) {
+            return NULL;
+        }
+    }
+
+    i = sq_tail_local & *sq_mask;
+
+    sqe = &sqes[i];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    sq_array[i] = i;
+    sq_tail_local++;
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_iouring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                   n, res;
+    uint64_t              data;
+    unsigned              head, tail;
+    ngx_err_t             err;
+    ngx_uint_t            i, level, wait, revents, instance;
+    ngx_event_t          *rev, *wev, **queue;
+    ngx_connection_t     *c;
+    struct io_uring_sqe  *sqe;
+    struct io_uring_cqe  *cqe;
+#if (NGX_HAVE_FILE_AIO)
+    ngx_event_t          *e;
+    ngx_event_aio_t      *aio;
+#endif
+
+    /* poll again the connections whose poll completed in the last call */
+
+    for (i = 0; i < nrearm; i++) {
+        c = &cycle->connections[rearm[i]];
+
+        if (ngx_iouring_arm(c) != NGX_OK) {
+            break;
+        }
+    }
+
+    nrearm -= i;
+
+    if (nrearm) {
+        ngx_memmove(rearm, &rearm[i], nrearm * sizeof(ngx_uint_t));
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M", timer);
+
+    wait = 1;
+
+    if (timer == 0) {
+        wait = 0;
+
+    } else if (timer != NGX_TIMER_INFINITE) {
+
+        /* completes after the timer expires or with the first completion */
+
+        sqe = ngx_iouring_get_sqe();
+
+        if (sqe == NULL) {
+            wait = 0;
+
+        } else {
+            timeout.tv_sec = timer / 1000;
+            timeout.tv_nsec = (timer % 1000) * 1000000;
+
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t) (uintptr_t) &timeout;
+            sqe->len = 1;
+            sqe->off = 1;
+            sqe->user_data = NGX_IOURING_TIMEOUT;
+        }
+    }
+
+    n = ngx_iouring_enter(wait);
+
+    err = (n == -1) ? ngx_errno : 0;
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_mutex_lock(ngx_posted_events_mutex);
+
+    head = *cq_head;
+
+    ngx_memory_barrier();
+
+    tail = *cq_tail;
+
+    for ( /* void */ ; head != tail; head++) {
+        cqe = &cqes[head & *cq_mask];
+
+        data = cqe->user_data;
+        res = cqe->res;
+
+#if (NGX_HAVE_FILE_AIO)
+
+        if (ngx_iouring_kind(data) == NGX_IOURING_READ) {
+            e = (ngx_event_t *) (uintptr_t) (data & ~(uint64_t) 3);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring read: %p %d", e, res);
+
+            e->complete = 1;
+            e->active = 0;
+            e->ready = 1;
+
+            aio = e->data;
+            aio->res = res;
+
+            ngx_locked_post_event(e, &ngx_posted_events);
+            continue;
+        }
+
+#endif
+
+        /* the removes, the timeouts and the polls replaced since queued */
+
+        if (ngx_iouring_kind(data) != NGX_IOURING_POLL) {
+            continue;
+        }
+
+        i = ngx_iouring_index(data);
+
+        if (i >= nconnections || ngx_iouring_gen(data) != generation[i]) {
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %uXL", data);
+            continue;
+        }
+
+        c = &cycle->connections[i];
+
+        /* a failed poll reports the events it waited for to the handlers */
+
+        revents = (res < 0) ? (ngx_uint_t) (armed[i] | POLLERR)
+                            : (ngx_uint_t) res;
+
+        armed[i] = 0;
+        rearm[nrearm++] = i;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d ev:%04Xi d:%uXL", c->fd, revents, data);
+
+        if (c->fd == -1) {
+            continue;
+        }
+
+        if ((revents & (POLLERR|POLLHUP|POLLNVAL))
+             && (revents & (POLLIN|POLLOUT)) == 0)
+        {
+            /*
+             * if the error events were returned without POLLIN or POLLOUT,
+             * then add these flags to handle the events at least in one
+             * active handler
+             */
+
+            revents |= POLLIN|POLLOUT;
+        }
+
+        rev = c->read;
+        instance = rev->instance;
+
+        if ((revents & POLLIN) && rev->active) {
+
+            if ((flags & NGX_POST_THREAD_EVENTS) && !rev->accept) {
+                rev->posted_ready = 1;
+
+            } else {
+                rev->ready = 1;
+            }
+
+            if (flags & NGX_POST_EVENTS) {
+                queue = (ngx_event_t **) (rev->accept ?
+                               &ngx_posted_accept_events : &ngx_posted_events);
+
+                ngx_locked_post_event(rev, queue);
+
+            } else {
+                rev->handler(rev);
+            }
+        }
+
+        wev = c->write;
+
+        if ((revents & POLLOUT) && wev->active) {
+
+            if (c->fd == -1 || wev->instance != instance) {
+
+                /*
+                 * the stale event from a file descriptor
+                 * that was just closed in this iteration
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                               "io_uring: stale event %p", c);
+                continue;
+            }
+
+            if (flags & NGX_POST_THREAD_EVENTS) {
+                wev->posted_ready = 1;
+
+            } else {
+                wev->ready = 1;
+            }
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_locked_post_event(wev, &ngx_posted_events);
+
+            } else {
+                wev->handler(wev);
+            }
+        }
+    }
+
+    ngx_memory_barrier();
+
+    *cq_head = head;
+
+    ngx_mutex_unlock(ngx_posted_events_mutex);
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+/*
+ * queues a read of the file on the ring: the completion posts the event
+ * as the eventfd handler of the epoll module does
+ */
+
+ngx_int_t
+ngx_iouring_file_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf, size_t size,
+    off_t offset)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe();
+    if (sqe == NULL) {
+        return NGX_DECLINED;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = (uint32_t) size;
+    sqe->off = (uint64_t) offset;
+    sqe->user_data = (uint64_t) (uintptr_t) ev | NGX_IOURING_READ;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static void *
+ngx_iouring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_iouring_conf_t  *iucf;
+
+    iucf = ngx_palloc(cycle->pool, sizeof(ngx_iouring_conf_t));
+    if (iucf == NULL) {
+        return NULL;
+    }
+
+    iucf->entries = NGX_CONF_UNSET;
+
+    return iucf;
+}
+
+
+static char *
+ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_iouring_conf_t *iucf = conf;
+
+    ngx_conf_init_uint_value(iucf->entries, 512);
+
+    return NGX_CONF_OK;
+}
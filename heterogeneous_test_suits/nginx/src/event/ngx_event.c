@@ -9,9 +9,21 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 
+#define POPCORN_RT_IMPLEMENTATION
+#include <popcorn_profile.h>
+#include <popcorn_nodes.h>
+#include <popcorn_arena.h>
+#include <popcorn_ranges.h>
+
 
 #define DEFAULT_CONNECTIONS  512
 
+/* how often a worker publishes its migration statistics, in msec */
+#define NGX_POPCORN_STAT_FLUSH  1000
+
+/* the node memory a worker cuts its pool blocks from, per node */
+#define NGX_POPCORN_ZONE_SIZE   (16 * 1024 * 1024)
+
 
 extern ngx_module_t ngx_kqueue_module;
 extern ngx_module_t ngx_eventport_module;
@@ -31,10 +43,27 @@ static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_event_use(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_event_popcorn_node(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 static void *ngx_event_core_create_conf(ngx_cycle_t *cycle);
 static char *ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf);
 
+static void ngx_event_update_lag(void);
+
+static ngx_uint_t ngx_popcorn_nodes(ngx_int_t *nodes);
+static void ngx_popcorn_spread(ngx_cycle_t *cycle);
+static ngx_atomic_uint_t ngx_popcorn_cpu(uint64_t cpu_affinity);
+static void ngx_popcorn_migrate(ngx_int_t node);
+static void ngx_popcorn_arrived(void *data);
+static void ngx_popcorn_enter(void);
+static void ngx_popcorn_leave(ngx_uint_t drained);
+static void ngx_popcorn_account(void);
+static void ngx_popcorn_flush(void);
+static void *ngx_popcorn_alloc(size_t size, ngx_log_t *log);
+static ngx_pool_zone_t *ngx_popcorn_zone(ngx_uint_t node);
+static void ngx_popcorn_release(void *p, size_t size);
+
 
 static ngx_uint_t     ngx_timer_resolution;
 sig_atomic_t          ngx_event_timer_alarm;
@@ -44,6 +73,13 @@ static ngx_uint_t     ngx_event_max_module;
 ngx_uint_t            ngx_event_flags;
 ngx_event_actions_t   ngx_event_actions;
 
+/*
+ * the time the worker spends on handling the events of a cycle,
+ * averaged over the last cycles: a newly ready event waits about as long
+ */
+
+ngx_msec_t            ngx_event_loop_lag;
+
 
 static ngx_atomic_t   connection_counter = 1;
 ngx_atomic_t         *ngx_connection_counter = &connection_counter;
@@ -61,22 +97,40 @@ ngx_file_t            ngx_accept_mutex_lock_file;
 
 #if (NGX_STAT_STUB)
 
-ngx_atomic_t   ngx_stat_accepted0;
-ngx_atomic_t  *ngx_stat_accepted = &ngx_stat_accepted0;
-ngx_atomic_t   ngx_stat_handled0;
-ngx_atomic_t  *ngx_stat_handled = &ngx_stat_handled0;
-ngx_atomic_t   ngx_stat_requests0;
-ngx_atomic_t  *ngx_stat_requests = &ngx_stat_requests0;
-ngx_atomic_t   ngx_stat_active0;
-ngx_atomic_t  *ngx_stat_active = &ngx_stat_active0;
-ngx_atomic_t   ngx_stat_reading0;
-ngx_atomic_t  *ngx_stat_reading = &ngx_stat_reading0;
-ngx_atomic_t   ngx_stat_writing0;
-ngx_atomic_t  *ngx_stat_writing = &ngx_stat_writing0;
+static ngx_stat_slot_t   ngx_stat_slot0;
+u_char                  *ngx_stat_slots = (u_char *) &ngx_stat_slot0;
+ngx_uint_t               ngx_stat_slots_n = 1;
+size_t                   ngx_stat_slot_size = sizeof(ngx_stat_slot_t);
+ngx_stat_slot_t         *ngx_stat = &ngx_stat_slot0;
+
+ngx_atomic_t  *ngx_stat_accepted = &ngx_stat_slot0.accepted;
+ngx_atomic_t  *ngx_stat_handled = &ngx_stat_slot0.handled;
+ngx_atomic_t  *ngx_stat_requests = &ngx_stat_slot0.requests;
+ngx_atomic_t  *ngx_stat_active = &ngx_stat_slot0.active;
+ngx_atomic_t  *ngx_stat_reading = &ngx_stat_slot0.reading;
+ngx_atomic_t  *ngx_stat_writing = &ngx_stat_slot0.writing;
 
 #endif
 
 
+static ngx_popcorn_stat_t   ngx_popcorn_stat0;
+ngx_popcorn_stat_t         *ngx_popcorn_stats = &ngx_popcorn_stat0;
+ngx_uint_t                  ngx_popcorn_stats_n = 1;
+
+static ngx_event_conf_t    *ngx_popcorn_conf;
+static ngx_popcorn_stat_t  *ngx_popcorn_stat;
+ngx_popcorn_stat_t          ngx_popcorn_local;
+ngx_usec_t                  ngx_popcorn_migrate_usec;
+static ngx_uint_t           ngx_popcorn_node = NGX_POPCORN_HOME_NODE;
+static ngx_uint_t           ngx_popcorn_cycles;
+static ngx_msec_t           ngx_popcorn_start;
+static ngx_msec_t           ngx_popcorn_since;
+static ngx_msec_t           ngx_popcorn_flushed;
+static ngx_pool_zone_t     *ngx_popcorn_zones[MAX_POPCORN_NODES];
+static uintptr_t            ngx_popcorn_released_start;
+static uintptr_t            ngx_popcorn_released_end;
+
+
 
 static ngx_command_t  ngx_events_commands[] = {
 
@@ -117,6 +171,16 @@ ngx_module_t  ngx_events_module = {
 static ngx_str_t  event_core_name = ngx_string("event_core");
 
 
+static ngx_conf_enum_t  ngx_popcorn_migrate_policies[] = {
+    { ngx_string("off"), NGX_POPCORN_MIGRATE_OFF },
+    { ngx_string("always"), NGX_POPCORN_MIGRATE_ALWAYS },
+    { ngx_string("batch"), NGX_POPCORN_MIGRATE_BATCH },
+    { ngx_string("pin"), NGX_POPCORN_MIGRATE_PIN },
+    { ngx_string("spread"), NGX_POPCORN_MIGRATE_SPREAD },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_command_t  ngx_event_core_commands[] = {
 
     { ngx_string("worker_connections"),
@@ -147,6 +211,13 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, multi_accept),
       NULL },
 
+    { ngx_string("multi_accept_batch"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_event_conf_t, multi_accept_batch),
+      NULL },
+
     { ngx_string("accept_mutex"),
       NGX_EVENT_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -168,6 +239,41 @@ static ngx_command_t  ngx_event_core_commands[] = {
       0,
       NULL },
 
+    { ngx_string("popcorn_migrate_policy"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      0,
+      offsetof(ngx_event_conf_t, popcorn_migrate_policy),
+      &ngx_popcorn_migrate_policies },
+
+    { ngx_string("popcorn_migrate_node"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_event_popcorn_node,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("popcorn_migrate_batch"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_event_conf_t, popcorn_migrate_batch),
+      NULL },
+
+    { ngx_string("popcorn_migrate_batch_time"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_event_conf_t, popcorn_migrate_batch_time),
+      NULL },
+
+    { ngx_string("popcorn_migrate_drain"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, popcorn_migrate_drain),
+      NULL },
+
       ngx_null_command
 };
 
@@ -200,10 +306,11 @@ ngx_module_t  ngx_event_core_module = {
 void
 ngx_process_events_and_timers(ngx_cycle_t *cycle)
 {
-    ngx_uint_t  flags;
+    ngx_uint_t  flags, drained;
     ngx_msec_t  timer, delta;
 
-    migrate(1, NULL, NULL);
+    ngx_popcorn_enter();
+
     if (ngx_timer_resolution) {
         timer = NGX_TIMER_INFINITE;
         flags = 0;
@@ -227,7 +334,7 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
 
         } else {
             if (ngx_trylock_accept_mutex(cycle) == NGX_ERROR) {
-		migrate(0, NULL, NULL);
+                ngx_popcorn_leave(1);
                 return;
             }
 
@@ -253,6 +360,8 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
                    "timer delta: %M", delta);
 
+    drained = (ngx_posted_accept_events == NULL && ngx_posted_events == NULL);
+
     if (ngx_posted_accept_events) {
         ngx_event_process_posted(cycle, &ngx_posted_accept_events);
     }
@@ -276,7 +385,414 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
             ngx_event_process_posted(cycle, &ngx_posted_events);
         }
     }
-    migrate(0, NULL, NULL);
+
+    ngx_event_update_lag();
+
+    ngx_popcorn_leave(drained);
+}
+
+
+static void
+ngx_event_update_lag(void)
+{
+    time_t          sec;
+    ngx_uint_t      msec;
+    ngx_msec_int_t  busy;
+
+    /* the cached time is that of the return from ngx_process_events() */
+
+    ngx_time_now(&sec, &msec);
+
+    busy = (ngx_msec_int_t) ((ngx_msec_t) sec * 1000 + msec
+                             - ngx_current_msec);
+
+    if (busy < 0) {
+        busy = 0;
+    }
+
+    ngx_event_loop_lag = (ngx_event_loop_lag * 7 + busy) / 8;
+}
+
+
+/*
+ * The worker loop runs on a remote Popcorn node according to
+ * the "popcorn_migrate_policy" directive:
+ *
+ *   off     the worker never leaves the home node;
+ *   always  the worker migrates to the remote node at the start of
+ *           every cycle and back home at its end;
+ *   batch   the worker stays on the remote node for up to
+ *           "popcorn_migrate_batch" cycles or "popcorn_migrate_batch_time"
+ *           milliseconds, whichever comes first, and with
+ *           "popcorn_migrate_drain" returns home as soon as a cycle
+ *           leaves no posted events;
+ *   pin     the worker migrates once at startup and stays there;
+ *   spread  the workers are dealt out at startup over the home node and
+ *           every online remote node in turn, and stay there.
+ *
+ * The remote node is "popcorn_migrate_node", or with "auto" the one
+ * popcorn_nodes.h picks: an online node of another architecture, the
+ * least loaded by this worker and then the closest.  Every worker picks
+ * on its own.  On arrival the worker updates its cached time before
+ * handling any event, so that the timers and the log are not off by the
+ * migration latency.
+ */
+
+/*
+ * the online nodes, the home node first; a node that is offline
+ * when a worker starts gets no workers until the next reload
+ */
+
+static ngx_uint_t
+ngx_popcorn_nodes(ngx_int_t *nodes)
+{
+    ngx_uint_t  i, n;
+
+    nodes[0] = NGX_POPCORN_HOME_NODE;
+    n = 1;
+
+    for (i = 0; i < MAX_POPCORN_NODES; i++) {
+        if (i != NGX_POPCORN_HOME_NODE && popcorn_nodes_online((int) i)) {
+            nodes[n++] = i;
+        }
+    }
+
+    return n;
+}
+
+
+/*
+ * "popcorn_migrate_policy spread" sends the n-th worker to the node
+ * n % nodes, where it is the (n / nodes)-th worker, and with
+ * "worker_cpu_affinity auto" binds it to that CPU of the node: the
+ * binding done by ngx_worker_process_init() counted the workers of all
+ * the nodes and is redone once the worker has arrived
+ */
+
+static void
+ngx_popcorn_spread(ngx_cycle_t *cycle)
+{
+    uint64_t          cpu_affinity;
+    ngx_int_t         nodes[MAX_POPCORN_NODES];
+    ngx_uint_t        n, slot;
+    ngx_core_conf_t  *ccf;
+
+    n = ngx_popcorn_nodes(nodes);
+
+    ngx_popcorn_migrate(nodes[ngx_worker % n]);
+
+    if (ngx_popcorn_node == (ngx_uint_t) nodes[ngx_worker % n]) {
+        slot = ngx_worker / n;
+
+    } else {
+        /* the migration failed, the worker stays home */
+        slot = ngx_worker;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (!ccf->cpu_affinity_auto) {
+        return;
+    }
+
+    cpu_affinity = ngx_get_cpu_affinity(slot);
+
+    if (cpu_affinity) {
+        ngx_setaffinity(cpu_affinity, cycle->log);
+    }
+
+    ngx_popcorn_local.cpu = ngx_popcorn_cpu(cpu_affinity);
+}
+
+
+static ngx_atomic_uint_t
+ngx_popcorn_cpu(uint64_t cpu_affinity)
+{
+    ngx_atomic_uint_t  cpu;
+
+    if (cpu_affinity == 0 || (cpu_affinity & (cpu_affinity - 1))) {
+        return NGX_POPCORN_CPU_ANY;
+    }
+
+    for (cpu = 0; !(cpu_affinity & 1); cpu++) {
+        cpu_affinity >>= 1;
+    }
+
+    return cpu;
+}
+
+
+static void
+ngx_popcorn_migrate(ngx_int_t node)
+{
+    int         rc;
+    ngx_usec_t  start, now;
+
+    if (node == NGX_POPCORN_NODE_AUTO) {
+        if (ngx_popcorn_node != NGX_POPCORN_HOME_NODE) {
+            return;
+        }
+
+        node = POPCORN_NODE_BEST;
+
+    } else if ((ngx_uint_t) node == ngx_popcorn_node) {
+        return;
+    }
+
+    /* the blocks freed here will not be reused before coming back */
+
+    if (ngx_popcorn_zones[ngx_popcorn_node]) {
+        ngx_pool_zone_release(ngx_popcorn_zones[ngx_popcorn_node],
+                              ngx_popcorn_release);
+        ngx_popcorn_release(NULL, 0);
+    }
+
+    start = ngx_time_usec();
+
+    rc = popcorn_nodes_migrate_cb(NGX_POPCORN_REGION_EVENTS, (int) node,
+                                  ngx_popcorn_arrived, NULL);
+
+    now = ngx_time_usec();
+
+    if (now > start) {
+        ngx_popcorn_migrate_usec += now - start;
+    }
+
+    if (rc != 0 && rc != EBUSY) {
+        ngx_popcorn_local.failed++;
+        return;
+    }
+
+    ngx_popcorn_account();
+
+    ngx_popcorn_node = popcorn_nodes_current();
+    ngx_popcorn_local.node = ngx_popcorn_node;
+
+    if (ngx_popcorn_conf->popcorn_migrate_policy != NGX_POPCORN_MIGRATE_OFF) {
+        ngx_pool_zone_set(ngx_popcorn_zone(ngx_popcorn_node));
+    }
+
+    if (rc == 0) {
+        ngx_popcorn_local.migrations++;
+    }
+}
+
+
+static void
+ngx_popcorn_arrived(void *data)
+{
+    ngx_time_update();
+    ngx_crc32_select();
+}
+
+
+static void
+ngx_popcorn_enter(void)
+{
+    ngx_event_conf_t  *ecf;
+
+    ecf = ngx_popcorn_conf;
+
+    switch (ecf->popcorn_migrate_policy) {
+
+    case NGX_POPCORN_MIGRATE_ALWAYS:
+        ngx_popcorn_migrate(ecf->popcorn_migrate_node);
+        break;
+
+    case NGX_POPCORN_MIGRATE_BATCH:
+        if (ngx_popcorn_node == NGX_POPCORN_HOME_NODE) {
+            ngx_popcorn_migrate(ecf->popcorn_migrate_node);
+            ngx_popcorn_cycles = 0;
+            ngx_popcorn_start = ngx_current_msec;
+        }
+        break;
+
+    default: /* NGX_POPCORN_MIGRATE_OFF, NGX_POPCORN_MIGRATE_PIN,
+                NGX_POPCORN_MIGRATE_SPREAD */
+        break;
+    }
+}
+
+
+static void
+ngx_popcorn_leave(ngx_uint_t drained)
+{
+    ngx_event_conf_t  *ecf;
+
+    ecf = ngx_popcorn_conf;
+
+    switch (ecf->popcorn_migrate_policy) {
+
+    case NGX_POPCORN_MIGRATE_ALWAYS:
+        ngx_popcorn_migrate(NGX_POPCORN_HOME_NODE);
+        break;
+
+    case NGX_POPCORN_MIGRATE_BATCH:
+        if (ngx_popcorn_node == NGX_POPCORN_HOME_NODE) {
+            break;
+        }
+
+        ngx_popcorn_cycles++;
+
+        if ((ecf->popcorn_migrate_batch
+             && ngx_popcorn_cycles >= (ngx_uint_t) ecf->popcorn_migrate_batch)
+            || (ecf->popcorn_migrate_batch_time
+                && ngx_current_msec - ngx_popcorn_start
+                   >= ecf->popcorn_migrate_batch_time)
+            || (ecf->popcorn_migrate_drain && drained))
+        {
+            ngx_popcorn_migrate(NGX_POPCORN_HOME_NODE);
+        }
+
+        break;
+
+    default: /* NGX_POPCORN_MIGRATE_OFF, NGX_POPCORN_MIGRATE_PIN,
+                NGX_POPCORN_MIGRATE_SPREAD */
+        break;
+    }
+
+    if (ngx_current_msec - ngx_popcorn_flushed >= NGX_POPCORN_STAT_FLUSH) {
+        ngx_popcorn_flush();
+    }
+}
+
+
+static void
+ngx_popcorn_account(void)
+{
+    ngx_msec_t  now;
+
+    now = ngx_current_msec;
+
+    if (ngx_popcorn_node == NGX_POPCORN_HOME_NODE) {
+        ngx_popcorn_local.home_msec += now - ngx_popcorn_since;
+
+    } else {
+        ngx_popcorn_local.remote_msec += now - ngx_popcorn_since;
+    }
+
+    ngx_popcorn_since = now;
+}
+
+
+/*
+ * the statistics live in the shared zone, which may cost a remote
+ * page fault to write, so they are published periodically and not
+ * on every cycle
+ */
+
+static void
+ngx_popcorn_flush(void)
+{
+    ngx_popcorn_account();
+
+    ngx_popcorn_flushed = ngx_current_msec;
+
+    if (ngx_popcorn_stat) {
+        *ngx_popcorn_stat = ngx_popcorn_local;
+    }
+}
+
+
+/*
+ * With a migration policy the connections and the events are allocated
+ * from the arena of the node the worker runs on once "pin" or "spread"
+ * have placed it, on pages of their own, and first written there.
+ */
+
+static void *
+ngx_popcorn_alloc(size_t size, ngx_log_t *log)
+{
+    void  *p;
+
+    if (ngx_popcorn_conf->popcorn_migrate_policy == NGX_POPCORN_MIGRATE_OFF) {
+        return ngx_alloc(size, log);
+    }
+
+    p = popcorn_node_malloc(size, (int) ngx_popcorn_node);
+    if (p == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "popcorn_node_malloc(%uz, %ui) failed",
+                      size, ngx_popcorn_node);
+    }
+
+    return p;
+}
+
+
+/*
+ * The pool blocks are cut from a zone of the node the worker runs on,
+ * see ngx_palloc.c; a zone that cannot be set up leaves the worker
+ * with plain malloc() there.
+ */
+
+static ngx_pool_zone_t *
+ngx_popcorn_zone(ngx_uint_t node)
+{
+    void             *start;
+    ngx_pool_zone_t  *zone;
+
+    if (node >= MAX_POPCORN_NODES) {
+        return NULL;
+    }
+
+    if (ngx_popcorn_zones[node]) {
+        return ngx_popcorn_zones[node];
+    }
+
+    zone = popcorn_node_calloc(1, sizeof(ngx_pool_zone_t), (int) node);
+    start = popcorn_node_malloc(NGX_POPCORN_ZONE_SIZE, (int) node);
+
+    if (zone == NULL || start == NULL) {
+        return NULL;
+    }
+
+    ngx_pool_zone_init(zone, start, NGX_POPCORN_ZONE_SIZE);
+    ngx_popcorn_zones[node] = zone;
+
+    return zone;
+}
+
+
+/*
+ * Gives up the pages of the blocks freed on the node being left,
+ * merging the neighbouring ones; a NULL block releases what is left
+ */
+
+static void
+ngx_popcorn_release(void *p, size_t size)
+{
+    uintptr_t             start, end;
+    struct popcorn_range  range;
+
+    start = (uintptr_t) p & PAGE_MASK;
+    end = ((uintptr_t) p + size + PAGE_SIZE - 1) & PAGE_MASK;
+
+    if (p && start <= ngx_popcorn_released_end
+        && end >= ngx_popcorn_released_start)
+    {
+        ngx_popcorn_released_start = ngx_min(start,
+                                             ngx_popcorn_released_start);
+        ngx_popcorn_released_end = ngx_max(end, ngx_popcorn_released_end);
+        return;
+    }
+
+    if (ngx_popcorn_released_end) {
+        range.addr = (void *) ngx_popcorn_released_start;
+        range.len = ngx_popcorn_released_end - ngx_popcorn_released_start;
+        range.write = 0;
+
+        popcorn_release_ranges(&range, 1);
+    }
+
+    if (p == NULL) {
+        ngx_popcorn_released_start = 0;
+        ngx_popcorn_released_end = 0;
+        return;
+    }
+
+    ngx_popcorn_released_start = start;
+    ngx_popcorn_released_end = end;
 }
 
 
@@ -446,6 +962,9 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     void              ***cf;
     u_char              *shared;
     size_t               size, cl;
+#if (NGX_STAT_STUB)
+    size_t               stats, stat_size;
+#endif
     ngx_shm_t            shm;
     ngx_time_t          *tp;
     ngx_core_conf_t     *ccf;
@@ -463,6 +982,19 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
     ngx_timer_resolution = ccf->timer_resolution;
 
+    if (ecf->popcorn_migrate_policy == NGX_POPCORN_MIGRATE_SPREAD
+        && ccf->worker_processes_auto)
+    {
+        ngx_int_t  nodes[MAX_POPCORN_NODES];
+
+        /*
+         * the kernel does not report the CPUs of the remote nodes,
+         * they are taken to have as many as the home node
+         */
+
+        ccf->worker_processes = ngx_ncpu * ngx_popcorn_nodes(nodes);
+    }
+
 #if !(NGX_WIN32)
     {
     ngx_int_t      limit;
@@ -507,14 +1039,19 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_connection_counter */
            + cl;         /* ngx_temp_number */
 
+    size += ccf->worker_processes * sizeof(ngx_popcorn_stat_t);
+
 #if (NGX_STAT_STUB)
 
-    size += cl           /* ngx_stat_accepted */
-           + cl          /* ngx_stat_handled */
-           + cl          /* ngx_stat_requests */
-           + cl          /* ngx_stat_active */
-           + cl          /* ngx_stat_reading */
-           + cl;         /* ngx_stat_writing */
+    /*
+     * the stat slots are padded to a page, the unit in which the pages
+     * of a worker that migrated to another node are kept coherent
+     */
+
+    stats = ngx_align(size, ngx_pagesize);
+    stat_size = ngx_align(sizeof(ngx_stat_slot_t), ngx_pagesize);
+
+    size = stats + ccf->worker_processes * stat_size;
 
 #endif
 
@@ -553,14 +1090,14 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
     ngx_random_number = (tp->msec << 16) + ngx_pid;
 
+    ngx_popcorn_stats = (ngx_popcorn_stat_t *) (shared + 3 * cl);
+    ngx_popcorn_stats_n = ccf->worker_processes;
+
 #if (NGX_STAT_STUB)
 
-    ngx_stat_accepted = (ngx_atomic_t *) (shared + 3 * cl);
-    ngx_stat_handled = (ngx_atomic_t *) (shared + 4 * cl);
-    ngx_stat_requests = (ngx_atomic_t *) (shared + 5 * cl);
-    ngx_stat_active = (ngx_atomic_t *) (shared + 6 * cl);
-    ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
-    ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
+    ngx_stat_slots = shared + stats;
+    ngx_stat_slots_n = ccf->worker_processes;
+    ngx_stat_slot_size = stat_size;
 
 #endif
 
@@ -606,6 +1143,29 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         ngx_use_accept_mutex = 0;
     }
 
+#if (NGX_HAVE_REUSEPORT)
+
+    if (ngx_use_accept_mutex) {
+
+        /*
+         * the mutex and its shared page are left out of the accept path
+         * if every socket has a copy per worker
+         */
+
+        ls = cycle->listening.elts;
+        for (i = 0; i < cycle->listening.nelts; i++) {
+            if (!ls[i].reuseport) {
+                break;
+            }
+        }
+
+        if (i == cycle->listening.nelts) {
+            ngx_use_accept_mutex = 0;
+        }
+    }
+
+#endif
+
 #if (NGX_THREADS)
     ngx_posted_events_mutex = ngx_mutex_init(cycle->log, 0);
     if (ngx_posted_events_mutex == NULL) {
@@ -617,6 +1177,60 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         return NGX_ERROR;
     }
 
+    ngx_popcorn_conf = ecf;
+    ngx_popcorn_since = ngx_current_msec;
+    ngx_popcorn_flushed = ngx_current_msec;
+
+    ngx_popcorn_local.pid = ngx_pid;
+    ngx_popcorn_local.node = ngx_popcorn_node;
+    ngx_popcorn_local.cpu = ngx_popcorn_cpu(ngx_get_cpu_affinity(ngx_worker));
+
+    if (ngx_worker < ngx_popcorn_stats_n) {
+        ngx_popcorn_stat = &ngx_popcorn_stats[ngx_worker];
+        ngx_popcorn_flush();
+    }
+
+#if (NGX_STAT_STUB)
+
+    /*
+     * the workers started by a reconfiguration that raised worker_processes
+     * share the last slot, so the counters are still updated atomically
+     */
+
+    ngx_stat = ngx_stat_slot(ngx_min(ngx_worker, ngx_stat_slots_n - 1));
+
+    ngx_stat_accepted = &ngx_stat->accepted;
+    ngx_stat_handled = &ngx_stat->handled;
+    ngx_stat_requests = &ngx_stat->requests;
+    ngx_stat_active = &ngx_stat->active;
+    ngx_stat_reading = &ngx_stat->reading;
+    ngx_stat_writing = &ngx_stat->writing;
+
+#endif
+
+    switch (ecf->popcorn_migrate_policy) {
+
+    case NGX_POPCORN_MIGRATE_PIN:
+        ngx_popcorn_migrate(ecf->popcorn_migrate_node);
+        break;
+
+    case NGX_POPCORN_MIGRATE_SPREAD:
+        ngx_popcorn_spread(cycle);
+        break;
+
+    default: /* NGX_POPCORN_MIGRATE_OFF, NGX_POPCORN_MIGRATE_ALWAYS,
+                NGX_POPCORN_MIGRATE_BATCH */
+        break;
+    }
+
+    if (ecf->popcorn_migrate_policy != NGX_POPCORN_MIGRATE_OFF) {
+        ngx_pool_zone_set(ngx_popcorn_zone(ngx_popcorn_node));
+    }
+
+    if (ngx_popcorn_stat) {
+        ngx_popcorn_flush();
+    }
+
     for (m = 0; ngx_modules[m]; m++) {
         if (ngx_modules[m]->type != NGX_EVENT_MODULE) {
             continue;
@@ -684,15 +1298,17 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 #endif
 
     cycle->connections =
-        ngx_alloc(sizeof(ngx_connection_t) * cycle->connection_n, cycle->log);
+        ngx_popcorn_alloc(sizeof(ngx_connection_t) * cycle->connection_n,
+                          cycle->log);
     if (cycle->connections == NULL) {
         return NGX_ERROR;
     }
 
     c = cycle->connections;
 
-    cycle->read_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                   cycle->log);
+    cycle->read_events =
+        ngx_popcorn_alloc(sizeof(ngx_event_t) * cycle->connection_n,
+                          cycle->log);
     if (cycle->read_events == NULL) {
         return NGX_ERROR;
     }
@@ -707,8 +1323,9 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 #endif
     }
 
-    cycle->write_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                    cycle->log);
+    cycle->write_events =
+        ngx_popcorn_alloc(sizeof(ngx_event_t) * cycle->connection_n,
+                          cycle->log);
     if (cycle->write_events == NULL) {
         return NGX_ERROR;
     }
@@ -748,6 +1365,14 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ls = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
 
+#if (NGX_HAVE_REUSEPORT)
+        if (ls[i].reuseport && ls[i].worker != ngx_worker
+            && ngx_process == NGX_PROCESS_WORKER)
+        {
+            continue;
+        }
+#endif
+
         c = ngx_get_connection(ls[i].fd, cycle->log);
 
         if (c == NULL) {
@@ -828,6 +1453,16 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
         rev->handler = ngx_event_accept;
 
+#if (NGX_HAVE_REUSEPORT)
+        if (ls[i].reuseport) {
+            if (ngx_add_event(rev, NGX_READ_EVENT, 0) == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            continue;
+        }
+#endif
+
         if (ngx_use_accept_mutex) {
             continue;
         }
@@ -1163,6 +1798,36 @@ ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_event_popcorn_node(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_event_conf_t  *ecf = conf;
+
+    ngx_str_t  *value;
+
+    if (ecf->popcorn_migrate_node != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "auto") == 0) {
+        ecf->popcorn_migrate_node = NGX_POPCORN_NODE_AUTO;
+        return NGX_CONF_OK;
+    }
+
+    ecf->popcorn_migrate_node = ngx_atoi(value[1].data, value[1].len);
+    if (ecf->popcorn_migrate_node == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid node \"%V\"", &value[1]);
+
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static void *
 ngx_event_core_create_conf(ngx_cycle_t *cycle)
 {
@@ -1176,8 +1841,14 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->connections = NGX_CONF_UNSET_UINT;
     ecf->use = NGX_CONF_UNSET_UINT;
     ecf->multi_accept = NGX_CONF_UNSET;
+    ecf->multi_accept_batch = NGX_CONF_UNSET;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->popcorn_migrate_policy = NGX_CONF_UNSET_UINT;
+    ecf->popcorn_migrate_node = NGX_CONF_UNSET;
+    ecf->popcorn_migrate_batch = NGX_CONF_UNSET;
+    ecf->popcorn_migrate_batch_time = NGX_CONF_UNSET_MSEC;
+    ecf->popcorn_migrate_drain = NGX_CONF_UNSET;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1291,9 +1962,22 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_ptr_value(ecf->name, event_module->name->data);
 
     ngx_conf_init_value(ecf->multi_accept, 0);
+    ngx_conf_init_value(ecf->multi_accept_batch, 0);
     ngx_conf_init_value(ecf->accept_mutex, 1);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
 
+    ngx_conf_init_uint_value(ecf->popcorn_migrate_policy,
+                             NGX_POPCORN_MIGRATE_ALWAYS);
+    ngx_conf_init_value(ecf->popcorn_migrate_node, NGX_POPCORN_NODE_AUTO);
+    ngx_conf_init_value(ecf->popcorn_migrate_batch, 16);
+    ngx_conf_init_msec_value(ecf->popcorn_migrate_batch_time, 100);
+    ngx_conf_init_value(ecf->popcorn_migrate_drain, 0);
+
+    if (ecf->multi_accept_batch < 0) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "\"multi_accept_batch\" must not be negative");
+        return NGX_CONF_ERROR;
+    }
 
 #if (NGX_HAVE_RTSIG)
 
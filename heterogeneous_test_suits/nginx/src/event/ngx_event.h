@@ -465,15 +465,36 @@ extern ngx_os_io_t  ngx_io;
 #define NGX_EVENT_CONF        0x02000000
 
 
+#define NGX_POPCORN_MIGRATE_OFF     0
+#define NGX_POPCORN_MIGRATE_ALWAYS  1
+#define NGX_POPCORN_MIGRATE_BATCH   2
+#define NGX_POPCORN_MIGRATE_PIN     3
+#define NGX_POPCORN_MIGRATE_SPREAD  4
+
+#define NGX_POPCORN_HOME_NODE       0
+#define NGX_POPCORN_NODE_AUTO       -2  /* "popcorn_migrate_node auto" */
+#define NGX_POPCORN_CPU_ANY         ((ngx_atomic_uint_t) -1)
+
+/* region ID of the worker event cycle for popcorn_profile.h */
+#define NGX_POPCORN_REGION_EVENTS   1
+
+
 typedef struct {
     ngx_uint_t    connections;
     ngx_uint_t    use;
 
     ngx_flag_t    multi_accept;
+    ngx_int_t     multi_accept_batch;
     ngx_flag_t    accept_mutex;
 
     ngx_msec_t    accept_mutex_delay;
 
+    ngx_uint_t    popcorn_migrate_policy;
+    ngx_int_t     popcorn_migrate_node;
+    ngx_int_t     popcorn_migrate_batch;
+    ngx_msec_t    popcorn_migrate_batch_time;
+    ngx_flag_t    popcorn_migrate_drain;
+
     u_char       *name;
 
 #if (NGX_DEBUG)
@@ -505,6 +526,43 @@ extern ngx_int_t              ngx_accept_disabled;
 
 #if (NGX_STAT_STUB)
 
+#define NGX_STAT_MSEC_BUCKETS  16
+#define NGX_STAT_USEC_BUCKETS  24
+
+/* parse, rewrite, access, content, filter, send and migrate, see ngx_http */
+#define NGX_STAT_TIMERS        7
+
+/*
+ * each worker counts into a slot of its own, so the counters never share
+ * a cache line or a page with another worker; stub_status sums the slots
+ */
+
+typedef struct {
+    ngx_atomic_t                accepted;
+    ngx_atomic_t                handled;
+    ngx_atomic_t                requests;
+    ngx_atomic_t                active;
+    ngx_atomic_t                reading;
+    ngx_atomic_t                writing;
+
+    ngx_atomic_t                bytes_in;
+    ngx_atomic_t                bytes_out;
+    ngx_atomic_t                status[6];    /* other, 1xx ... 5xx */
+    ngx_atomic_t                msec[NGX_STAT_MSEC_BUCKETS];
+    ngx_atomic_t                timed;
+    ngx_atomic_t                usec[NGX_STAT_TIMERS][NGX_STAT_USEC_BUCKETS];
+} ngx_stat_slot_t;
+
+
+#define ngx_stat_slot(i)                                                      \
+    ((ngx_stat_slot_t *) (ngx_stat_slots + (i) * ngx_stat_slot_size))
+
+
+extern u_char        *ngx_stat_slots;
+extern ngx_uint_t     ngx_stat_slots_n;
+extern size_t         ngx_stat_slot_size;
+extern ngx_stat_slot_t  *ngx_stat;
+
 extern ngx_atomic_t  *ngx_stat_accepted;
 extern ngx_atomic_t  *ngx_stat_handled;
 extern ngx_atomic_t  *ngx_stat_requests;
@@ -515,6 +573,27 @@ extern ngx_atomic_t  *ngx_stat_writing;
 #endif
 
 
+typedef struct {
+    ngx_atomic_t                pid;
+    ngx_atomic_t                node;
+    ngx_atomic_t                cpu;          /* or NGX_POPCORN_CPU_ANY */
+    ngx_atomic_t                migrations;
+    ngx_atomic_t                failed;
+    ngx_atomic_t                home_msec;
+    ngx_atomic_t                remote_msec;
+    ngx_atomic_t                accepted;
+    ngx_atomic_t                accept_full;  /* batches cut by the budget */
+} ngx_popcorn_stat_t;
+
+
+extern ngx_popcorn_stat_t    *ngx_popcorn_stats;
+extern ngx_uint_t             ngx_popcorn_stats_n;
+extern ngx_popcorn_stat_t     ngx_popcorn_local;
+
+/* the time the worker has spent in migrations, requests take differences */
+extern ngx_usec_t             ngx_popcorn_migrate_usec;
+
+
 #define NGX_UPDATE_TIME         1
 #define NGX_POST_EVENTS         2
 #define NGX_POST_THREAD_EVENTS  4
@@ -522,6 +601,7 @@ extern ngx_atomic_t  *ngx_stat_writing;
 
 extern sig_atomic_t           ngx_event_timer_alarm;
 extern ngx_uint_t             ngx_event_flags;
+extern ngx_msec_t             ngx_event_loop_lag;
 extern ngx_module_t           ngx_events_module;
 extern ngx_module_t           ngx_event_core_module;
 
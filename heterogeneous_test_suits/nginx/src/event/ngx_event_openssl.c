@@ -19,6 +19,11 @@ static int ngx_http_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store);
 static void ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where,
     int ret);
 static void ngx_ssl_handshake_handler(ngx_event_t *ev);
+#ifdef SSL_MODE_ASYNC
+static ngx_int_t ngx_ssl_async_wait(ngx_connection_t *c);
+static void ngx_ssl_async_handler(ngx_event_t *ev);
+static void ngx_ssl_async_release(ngx_connection_t *c);
+#endif
 static ngx_int_t ngx_ssl_handle_recv(ngx_connection_t *c, int n);
 static void ngx_ssl_write_handler(ngx_event_t *wev);
 static void ngx_ssl_read_handler(ngx_event_t *rev);
@@ -38,6 +43,16 @@ static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
+#ifdef SSL_CTX_set_tlsext_ticket_key_cb
+static int ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
+    unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
+    HMAC_CTX *hctx, int enc);
+static ngx_int_t ngx_ssl_session_ticket_key_derive(ngx_ssl_ticket_keys_t *keys,
+    time_t period);
+static ngx_int_t ngx_ssl_session_ticket_key_hmac(ngx_ssl_ticket_keys_t *keys,
+    time_t period, ngx_ssl_ticket_key_t *key);
+#endif
+
 static void *ngx_openssl_create_conf(ngx_cycle_t *cycle);
 static char *ngx_openssl_engine(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static void ngx_openssl_exit(ngx_cycle_t *cycle);
@@ -82,6 +97,7 @@ ngx_module_t  ngx_openssl_module = {
 int  ngx_ssl_connection_index;
 int  ngx_ssl_server_conf_index;
 int  ngx_ssl_session_cache_index;
+int  ngx_ssl_ticket_keys_index;
 int  ngx_ssl_certificate_index;
 int  ngx_ssl_stapling_index;
 
@@ -139,6 +155,14 @@ ngx_ssl_init(ngx_log_t *log)
         return NGX_ERROR;
     }
 
+    ngx_ssl_ticket_keys_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL,
+                                                         NULL);
+    if (ngx_ssl_ticket_keys_index == -1) {
+        ngx_ssl_error(NGX_LOG_ALERT, log, 0,
+                      "SSL_CTX_get_ex_new_index() failed");
+        return NGX_ERROR;
+    }
+
     ngx_ssl_certificate_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL,
                                                          NULL);
     if (ngx_ssl_certificate_index == -1) {
@@ -723,6 +747,29 @@ ngx_ssl_handshake(ngx_connection_t *c)
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_do_handshake: %d", n);
 
+    sslerr = (n == 1) ? 0 : SSL_get_error(c->ssl->connection, n);
+
+#ifdef SSL_MODE_ASYNC
+
+    if (sslerr == SSL_ERROR_WANT_ASYNC) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_do_handshake async");
+
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
+
+        if (ngx_ssl_async_wait(c) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    if (c->ssl->async) {
+        ngx_ssl_async_release(c);
+    }
+
+#endif
+
     if (n == 1) {
 
         if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
@@ -792,11 +839,23 @@ ngx_ssl_handshake(ngx_connection_t *c)
             c->ssl->connection->s3->flags |= SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS;
         }
 
+#ifdef SSL_MODE_ASYNC
+        /* only the private key operation of a handshake is offloaded */
+        SSL_clear_mode(c->ssl->connection, SSL_MODE_ASYNC);
+#endif
+
+#ifdef BIO_get_ktls_send
+        if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "BIO_get_ktls_send(): 1");
+
+            c->ssl->sendfile = 1;
+        }
+#endif
+
         return NGX_OK;
     }
 
-    sslerr = SSL_get_error(c->ssl->connection, n);
-
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
 
     if (sslerr == SSL_ERROR_WANT_READ) {
@@ -867,6 +926,159 @@ ngx_ssl_handshake_handler(ngx_event_t *ev)
 }
 
 
+#ifdef SSL_MODE_ASYNC
+
+/*
+ * an engine that runs the private key operation asynchronously, in its own
+ * threads or on another node, pauses the handshake and signals a wait fd
+ * when the result is ready; the fd is watched through a connection of its
+ * own, so the worker serves other connections in the meantime
+ */
+
+ngx_int_t
+ngx_ssl_async(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_flag_t enable)
+{
+    if (enable) {
+        SSL_CTX_set_mode(ssl->ctx, SSL_MODE_ASYNC);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_ssl_async_wait(ngx_connection_t *c)
+{
+    size_t             nfds;
+    OSSL_ASYNC_FD      fd;
+    ngx_connection_t  *ac;
+
+    nfds = 0;
+
+    if (SSL_get_all_async_fds(c->ssl->connection, NULL, &nfds) == 0
+        || nfds > 1)
+    {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL_get_all_async_fds() failed");
+        return NGX_ERROR;
+    }
+
+    if (nfds == 0) {
+
+        /* the engine provides no wait fd, the job is polled */
+
+        ngx_post_event(c->read, &ngx_posted_events);
+
+        return NGX_OK;
+    }
+
+    (void) SSL_get_all_async_fds(c->ssl->connection, &fd, &nfds);
+
+    ac = c->ssl->async;
+
+    if (ac) {
+        if (ac->fd == (ngx_socket_t) fd) {
+            return NGX_OK;
+        }
+
+        ngx_ssl_async_release(c);
+    }
+
+    ac = ngx_get_connection((ngx_socket_t) fd, c->log);
+    if (ac == NULL) {
+        return NGX_ERROR;
+    }
+
+    ac->data = c;
+    ac->read->handler = ngx_ssl_async_handler;
+    ac->read->log = c->log;
+    ac->write->log = c->log;
+    ac->log = c->log;
+
+    c->ssl->async = ac;
+
+    if (ngx_handle_read_event(ac->read, 0) != NGX_OK) {
+        ngx_ssl_async_release(c);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_async_handler(ngx_event_t *ev)
+{
+    ngx_connection_t  *c, *ac;
+
+    ac = ev->data;
+    c = ac->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL async handler");
+
+    ngx_ssl_handshake_handler(c->read);
+}
+
+
+static void
+ngx_ssl_async_release(ngx_connection_t *c)
+{
+    ngx_connection_t  *ac;
+
+    ac = c->ssl->async;
+    c->ssl->async = NULL;
+
+    /* the wait fd belongs to the engine and is not closed */
+
+    if (ac->read->active || ac->read->disabled) {
+        ngx_del_event(ac->read, NGX_READ_EVENT, 0);
+    }
+
+    ngx_free_connection(ac);
+
+    ac->fd = (ngx_socket_t) -1;
+}
+
+#else
+
+ngx_int_t
+ngx_ssl_async(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_flag_t enable)
+{
+    if (enable) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                      "\"ssl_async\" is ignored, not supported");
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+/*
+ * with kernel TLS the records are encrypted by the kernel once the
+ * handshake is done, so files are sent with sendfile() as on plain
+ * connections; ciphers the kernel does not support stay in user space
+ */
+
+ngx_int_t
+ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_flag_t enable)
+{
+    if (!enable) {
+        return NGX_OK;
+    }
+
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ssl->ctx, SSL_OP_ENABLE_KTLS);
+#else
+    ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                  "\"ssl_ktls\" is ignored, not supported");
+#endif
+
+    return NGX_OK;
+}
+
+
 ssize_t
 ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl)
 {
@@ -1110,6 +1322,10 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
     ssize_t      send, size;
     ngx_buf_t   *buf;
 
+    if (c->ssl->sendfile) {
+        return ngx_io.send_chain(c, in, limit);
+    }
+
     if (!c->ssl->buffer) {
 
         while (in) {
@@ -1358,6 +1574,20 @@ ngx_ssl_shutdown(ngx_connection_t *c)
     int        n, sslerr, mode;
     ngx_err_t  err;
 
+#ifdef SSL_MODE_ASYNC
+
+    if (c->ssl->async) {
+
+        /* the handshake is paused in the engine, nothing can be sent */
+
+        ngx_ssl_async_release(c);
+
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+    }
+
+#endif
+
     if (c->timedout) {
         mode = SSL_RECEIVED_SHUTDOWN|SSL_SENT_SHUTDOWN;
         SSL_set_quiet_shutdown(c->ssl->connection, 1);
@@ -2161,6 +2391,240 @@ ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
 }
 
 
+#ifdef SSL_CTX_set_tlsext_ticket_key_cb
+
+/*
+ * the ticket keys are derived from a secret generated by the master process,
+ * so every worker computes the same keys for a period on its own, and neither
+ * a shared memory zone nor a lock is needed to rotate them
+ */
+
+ngx_int_t
+ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_flag_t enable,
+    time_t rotate)
+{
+    ngx_ssl_ticket_keys_t  *keys;
+
+    if (!enable) {
+        SSL_CTX_set_options(ssl->ctx, SSL_OP_NO_TICKET);
+        return NGX_OK;
+    }
+
+    keys = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_ticket_keys_t));
+    if (keys == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (RAND_bytes(keys->secret, sizeof(keys->secret)) != 1) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "RAND_bytes() failed");
+        return NGX_ERROR;
+    }
+
+    keys->rotate = rotate;
+    keys->period = -1;
+
+    if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_ticket_keys_index, keys) == 0) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_set_ex_data() failed");
+        return NGX_ERROR;
+    }
+
+    if (SSL_CTX_set_tlsext_ticket_key_cb(ssl->ctx,
+                                         ngx_ssl_session_ticket_key_callback)
+        == 0)
+    {
+        ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                      "nginx was built with Session Tickets support, however, "
+                      "now it is linked dynamically to an OpenSSL library "
+                      "which has no tlsext support, "
+                      "therefore Session Tickets are not available");
+    }
+
+    return NGX_OK;
+}
+
+
+static int
+ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
+    unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
+    HMAC_CTX *hctx, int enc)
+{
+    time_t                  period;
+    ngx_uint_t              i;
+    ngx_ssl_ticket_key_t   *key;
+    ngx_ssl_ticket_keys_t  *keys;
+#if (NGX_DEBUG)
+    ngx_connection_t       *c;
+#endif
+
+    keys = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl_conn),
+                               ngx_ssl_ticket_keys_index);
+
+    period = ngx_time() / keys->rotate;
+
+    if (keys->period != period) {
+        if (ngx_ssl_session_ticket_key_derive(keys, period) != NGX_OK) {
+            return -1;
+        }
+    }
+
+#if (NGX_DEBUG)
+    c = ngx_ssl_get_connection(ssl_conn);
+#endif
+
+    if (enc == 1) {
+
+        /* encrypt session ticket */
+
+        key = &keys->key[0];
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "ssl session ticket encrypt, period: %T", period);
+
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_128_cbc())) != 1) {
+            return -1;
+        }
+
+        if (EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key->aes_key, iv)
+            != 1)
+        {
+            return -1;
+        }
+
+        if (HMAC_Init_ex(hctx, key->hmac_key, 16, EVP_sha256(), NULL) != 1) {
+            return -1;
+        }
+
+        ngx_memcpy(name, key->name, 16);
+
+        return 1;
+    }
+
+    /* decrypt session ticket */
+
+    for (i = 0; i < 2; i++) {
+        if (ngx_memcmp(name, keys->key[i].name, 16) == 0) {
+            break;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl session ticket decrypt, period: %T, key: %ui",
+                   period, i);
+
+    if (i == 2) {
+        return 0;
+    }
+
+    key = &keys->key[i];
+
+    if (HMAC_Init_ex(hctx, key->hmac_key, 16, EVP_sha256(), NULL) != 1) {
+        return -1;
+    }
+
+    if (EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key->aes_key, iv)
+        != 1)
+    {
+        return -1;
+    }
+
+    /* a ticket of the previous period is renewed */
+
+    return (i == 0) ? 1 : 2;
+}
+
+
+static ngx_int_t
+ngx_ssl_session_ticket_key_derive(ngx_ssl_ticket_keys_t *keys, time_t period)
+{
+    ngx_int_t  rc;
+
+    if (keys->period == period - 1) {
+        keys->key[1] = keys->key[0];
+        rc = NGX_OK;
+
+    } else {
+        rc = ngx_ssl_session_ticket_key_hmac(keys, period - 1, &keys->key[1]);
+    }
+
+    if (rc == NGX_OK) {
+        rc = ngx_ssl_session_ticket_key_hmac(keys, period, &keys->key[0]);
+    }
+
+    if (rc != NGX_OK) {
+        keys->period = -1;
+        return NGX_ERROR;
+    }
+
+    keys->period = period;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_ssl_session_ticket_key_hmac(ngx_ssl_ticket_keys_t *keys, time_t period,
+    ngx_ssl_ticket_key_t *key)
+{
+    u_char        msg[9], md[EVP_MAX_MD_SIZE];
+    uint64_t      n;
+    ngx_uint_t    i;
+    unsigned int  len;
+
+    n = (uint64_t) period;
+
+    for (i = 1; i < 9; i++) {
+        msg[i] = (u_char) (n >> (64 - 8 * i));
+    }
+
+    /* the key name and the keys are taken from different digests */
+
+    msg[0] = 'n';
+
+    if (HMAC(EVP_sha256(), keys->secret, sizeof(keys->secret), msg, 9, md,
+             &len)
+        == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(key->name, md, 16);
+
+    msg[0] = 'k';
+
+    if (HMAC(EVP_sha256(), keys->secret, sizeof(keys->secret), msg, 9, md,
+             &len)
+        == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(key->hmac_key, md, 16);
+    ngx_memcpy(key->aes_key, md + 16, 16);
+
+    return NGX_OK;
+}
+
+#else
+
+ngx_int_t
+ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_flag_t enable,
+    time_t rotate)
+{
+    if (!enable) {
+        SSL_CTX_set_options(ssl->ctx, SSL_OP_NO_TICKET);
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                  "\"ssl_session_ticket_rotate\" is ignored, not supported");
+
+    return NGX_OK;
+}
+
+#endif
+
+
 void
 ngx_ssl_cleanup_ctx(void *data)
 {
@@ -17,7 +17,9 @@
 #include <openssl/conf.h>
 #include <openssl/engine.h>
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
 #include <openssl/ocsp.h>
+#include <openssl/rand.h>
 
 #define NGX_SSL_NAME     "OpenSSL"
 
@@ -43,11 +45,19 @@ typedef struct {
     ngx_event_handler_pt        saved_read_handler;
     ngx_event_handler_pt        saved_write_handler;
 
+#ifdef SSL_MODE_ASYNC
+    /* the wait fd of a private key operation offloaded to an engine */
+    ngx_connection_t           *async;
+#endif
+
     unsigned                    handshaked:1;
     unsigned                    renegotiation:1;
     unsigned                    buffer:1;
     unsigned                    no_wait_shutdown:1;
     unsigned                    no_send_shutdown:1;
+
+    /* the kernel encrypts the records, plain writes and sendfile() work */
+    unsigned                    sendfile:1;
 } ngx_ssl_connection_t;
 
 
@@ -82,6 +92,23 @@ typedef struct {
 } ngx_ssl_session_cache_t;
 
 
+typedef struct {
+    u_char                      name[16];
+    u_char                      hmac_key[16];
+    u_char                      aes_key[16];
+} ngx_ssl_ticket_key_t;
+
+
+typedef struct {
+    u_char                      secret[32];
+    time_t                      rotate;
+
+    /* the keys of the current and the previous periods, per worker */
+    time_t                      period;
+    ngx_ssl_ticket_key_t        key[2];
+} ngx_ssl_ticket_keys_t;
+
+
 
 #define NGX_SSL_SSLv2    0x0002
 #define NGX_SSL_SSLv3    0x0004
@@ -115,6 +142,10 @@ ngx_int_t ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name);
 ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
     ssize_t builtin_session_cache, ngx_shm_zone_t *shm_zone, time_t timeout);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
+ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_flag_t enable, time_t rotate);
+ngx_int_t ngx_ssl_async(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_flag_t enable);
+ngx_int_t ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_flag_t enable);
 ngx_int_t ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c,
     ngx_uint_t flags);
 
@@ -171,6 +202,7 @@ void ngx_ssl_cleanup_ctx(void *data);
 extern int  ngx_ssl_connection_index;
 extern int  ngx_ssl_server_conf_index;
 extern int  ngx_ssl_session_cache_index;
+extern int  ngx_ssl_ticket_keys_index;
 extern int  ngx_ssl_certificate_index;
 extern int  ngx_ssl_stapling_index;
 
@@ -15,6 +15,15 @@ ngx_mutex_t  *ngx_event_timer_mutex;
 #endif
 
 
+#if (NGX_EVENT_TIMER_WHEEL)
+
+static void ngx_event_timer_wheel_cascade(ngx_uint_t level, ngx_msec_t now);
+
+
+ngx_event_timer_wheel_t           ngx_event_timer_wheel;
+
+#else
+
 ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
 static ngx_rbtree_node_t          ngx_event_timer_sentinel;
 
@@ -24,11 +33,33 @@ static ngx_rbtree_node_t          ngx_event_timer_sentinel;
  * a minimum timer value only
  */
 
+#endif
+
+
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+#if (NGX_EVENT_TIMER_WHEEL)
+    ngx_uint_t          level, slot;
+    ngx_rbtree_node_t  *head;
+
+    ngx_event_timer_wheel.now = ngx_current_msec;
+    ngx_event_timer_wheel.count = 0;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        ngx_event_timer_wheel.busy[level] = 0;
+
+        for (slot = 0; slot < NGX_TIMER_WHEEL_SLOTS; slot++) {
+            head = &ngx_event_timer_wheel.slots[level][slot];
+            head->left = head;
+            head->right = head;
+        }
+    }
+
+#else
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
+#endif
 
 #if (NGX_THREADS)
 
@@ -48,6 +79,310 @@ ngx_event_timer_init(ngx_log_t *log)
 }
 
 
+#if (NGX_EVENT_TIMER_WHEEL)
+
+static ngx_inline ngx_uint_t
+ngx_event_timer_wheel_first(uint64_t busy)
+{
+#if ( __GNUC__ )
+    return (ngx_uint_t) __builtin_ctzll(busy);
+#else
+    ngx_uint_t  n;
+
+    for (n = 0; (busy & 1) == 0; n++) {
+        busy >>= 1;
+    }
+
+    return n;
+#endif
+}
+
+
+/*
+ * a slot is a circular list of the timer nodes linked by their left and right
+ * pointers, the parent pointer of a node is the head of its slot
+ */
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    ngx_msec_t          expire;
+    ngx_uint_t          level, slot;
+    ngx_msec_int_t      delta;
+    ngx_rbtree_node_t  *head;
+
+    expire = node->key;
+    delta = (ngx_msec_int_t) (expire - ngx_event_timer_wheel.now);
+
+    if (delta < 0) {
+
+        /* the timer has already expired, it goes to the next slot to expire */
+
+        expire = ngx_event_timer_wheel.now;
+        level = 0;
+
+    } else {
+        for (level = 0; level < NGX_TIMER_WHEEL_LEVELS - 1; level++) {
+            if ((ngx_msec_t) delta
+                < (ngx_msec_t) 1 << (level + 1) * NGX_TIMER_WHEEL_BITS)
+            {
+                break;
+            }
+        }
+
+        if ((ngx_msec_t) delta
+            >= (ngx_msec_t) 1 << NGX_TIMER_WHEEL_LEVELS * NGX_TIMER_WHEEL_BITS)
+        {
+            /* waits in the last slot of the wheel and is inserted again */
+
+            expire = ngx_event_timer_wheel.now
+                     + ((ngx_msec_t) 1
+                        << NGX_TIMER_WHEEL_LEVELS * NGX_TIMER_WHEEL_BITS) - 1;
+        }
+    }
+
+    slot = (expire >> level * NGX_TIMER_WHEEL_BITS) & NGX_TIMER_WHEEL_MASK;
+    head = &ngx_event_timer_wheel.slots[level][slot];
+
+    node->parent = head;
+    node->left = head->left;
+    node->right = head;
+    head->left->right = node;
+    head->left = node;
+
+    ngx_event_timer_wheel.busy[level] |= (uint64_t) 1 << slot;
+    ngx_event_timer_wheel.count++;
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          n;
+    ngx_rbtree_node_t  *head;
+
+    head = node->parent;
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    if (head->right == head) {
+        n = head - &ngx_event_timer_wheel.slots[0][0];
+
+        ngx_event_timer_wheel.busy[n / NGX_TIMER_WHEEL_SLOTS] &=
+                           ~((uint64_t) 1 << (n % NGX_TIMER_WHEEL_SLOTS));
+    }
+
+    ngx_event_timer_wheel.count--;
+}
+
+
+/* the timers of the slot of the level that begins "now" go down the wheel */
+
+static void
+ngx_event_timer_wheel_cascade(ngx_uint_t level, ngx_msec_t now)
+{
+    ngx_uint_t          slot;
+    ngx_rbtree_node_t  *head, *node;
+
+    slot = (now >> level * NGX_TIMER_WHEEL_BITS) & NGX_TIMER_WHEEL_MASK;
+    head = &ngx_event_timer_wheel.slots[level][slot];
+
+    while (head->right != head) {
+        node = head->right;
+
+        ngx_event_timer_wheel_delete(node);
+        ngx_event_timer_wheel_insert(node);
+    }
+}
+
+
+/*
+ * the nearest timer is the first busy slot of the level 0, or the first
+ * busy slot of an upper level to go down the wheel, whichever is earlier
+ */
+
+ngx_msec_t
+ngx_event_find_timer(void)
+{
+    uint64_t         busy;
+    ngx_msec_t       now, start, expire, t;
+    ngx_uint_t       level, shift, slot, found;
+    ngx_msec_int_t   timer;
+
+    if (ngx_event_timer_wheel.count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    ngx_mutex_lock(ngx_event_timer_mutex);
+
+    now = ngx_event_timer_wheel.now;
+    expire = now;
+    found = 0;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+
+        busy = ngx_event_timer_wheel.busy[level];
+
+        if (busy == 0) {
+            continue;
+        }
+
+        shift = level * NGX_TIMER_WHEEL_BITS;
+
+        /* the first slot of the level that has not begun yet */
+
+        start = now + ((ngx_msec_t) 1 << shift) - 1;
+        start = start >> shift << shift;
+
+        slot = (start >> shift) & NGX_TIMER_WHEEL_MASK;
+
+        if (slot) {
+            busy = (busy >> slot) | (busy << (NGX_TIMER_WHEEL_SLOTS - slot));
+        }
+
+        t = start + ((ngx_msec_t) ngx_event_timer_wheel_first(busy) << shift);
+
+        if (!found || (ngx_msec_int_t) (t - expire) < 0) {
+            expire = t;
+            found = 1;
+        }
+    }
+
+    ngx_mutex_unlock(ngx_event_timer_mutex);
+
+    timer = (ngx_msec_int_t) (expire - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+void
+ngx_event_expire_timers(void)
+{
+    uint64_t            busy;
+    ngx_msec_t          now, next;
+    ngx_uint_t          level, slot;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *head, *node;
+
+    ngx_mutex_lock(ngx_event_timer_mutex);
+
+    for ( ;; ) {
+
+        now = ngx_event_timer_wheel.now;
+
+        if ((ngx_msec_int_t) (now - ngx_current_msec) > 0) {
+            break;
+        }
+
+        if (ngx_event_timer_wheel.count == 0) {
+            ngx_event_timer_wheel.now = ngx_current_msec;
+            break;
+        }
+
+        for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+
+            if (now & (((ngx_msec_t) 1 << level * NGX_TIMER_WHEEL_BITS) - 1)) {
+                break;
+            }
+
+            ngx_event_timer_wheel_cascade(level, now);
+        }
+
+        slot = now & NGX_TIMER_WHEEL_MASK;
+        head = &ngx_event_timer_wheel.slots[0][slot];
+
+        while (head->right != head) {
+            node = head->right;
+
+            ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+#if (NGX_THREADS)
+
+            if (ngx_threaded && ngx_trylock(ev->lock) == 0) {
+
+                /*
+                 * We cannot change the timer of the event that is being
+                 * handled by another thread, so we exit and expire the rest
+                 * of the slot the next time.
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                               "event %p is busy in expire timers", ev);
+
+                ngx_mutex_unlock(ngx_event_timer_mutex);
+                return;
+            }
+#endif
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ngx_event_timer_wheel_delete(node);
+
+            ngx_mutex_unlock(ngx_event_timer_mutex);
+
+#if (NGX_DEBUG)
+            ev->timer.left = NULL;
+            ev->timer.right = NULL;
+            ev->timer.parent = NULL;
+#endif
+
+            ev->timer_set = 0;
+
+#if (NGX_THREADS)
+            if (ngx_threaded) {
+                ev->posted_timedout = 1;
+
+                ngx_post_event(ev, &ngx_posted_events);
+
+                ngx_unlock(ev->lock);
+
+                ngx_mutex_lock(ngx_event_timer_mutex);
+
+                continue;
+            }
+#endif
+
+            ev->timedout = 1;
+
+            ev->handler(ev);
+
+            ngx_mutex_lock(ngx_event_timer_mutex);
+        }
+
+        /* skip to the next busy slot of the level 0 or to the next round */
+
+        busy = ngx_event_timer_wheel.busy[0] & ~(((uint64_t) 2 << slot) - 1);
+
+        if (busy) {
+            next = (now & ~(ngx_msec_t) NGX_TIMER_WHEEL_MASK)
+                   + ngx_event_timer_wheel_first(busy);
+
+        } else {
+            next = (now | NGX_TIMER_WHEEL_MASK) + 1;
+        }
+
+        /*
+         * the wheel stays at the current millisecond: the timers added
+         * later and already expired go to its slot, and are found at once
+         */
+
+        if ((ngx_msec_int_t) (next - ngx_current_msec) > 0) {
+            ngx_event_timer_wheel.now = ngx_current_msec;
+            break;
+        }
+
+        ngx_event_timer_wheel.now = next;
+    }
+
+    ngx_mutex_unlock(ngx_event_timer_mutex);
+}
+
+#else
+
 ngx_msec_t
 ngx_event_find_timer(void)
 {
@@ -156,3 +491,5 @@ ngx_event_expire_timers(void)
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 }
+
+#endif
@@ -19,6 +19,29 @@
 #define NGX_TIMER_LAZY_DELAY  300
 
 
+#if (NGX_EVENT_TIMER_WHEEL)
+
+/*
+ * a hierarchical timing wheel: the level L has 64 slots of 64^L milliseconds
+ * each, the five levels cover about 12 days and the longer timers wait in
+ * the last level
+ */
+
+#define NGX_TIMER_WHEEL_BITS    6
+#define NGX_TIMER_WHEEL_SLOTS   (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK    (NGX_TIMER_WHEEL_SLOTS - 1)
+#define NGX_TIMER_WHEEL_LEVELS  5
+
+typedef struct {
+    ngx_msec_t          now;        /* the timers expired up to it */
+    ngx_uint_t          count;
+    uint64_t            busy[NGX_TIMER_WHEEL_LEVELS];
+    ngx_rbtree_node_t   slots[NGX_TIMER_WHEEL_LEVELS][NGX_TIMER_WHEEL_SLOTS];
+} ngx_event_timer_wheel_t;
+
+#endif
+
+
 ngx_int_t ngx_event_timer_init(ngx_log_t *log);
 ngx_msec_t ngx_event_find_timer(void);
 void ngx_event_expire_timers(void);
@@ -29,8 +52,24 @@ extern ngx_mutex_t  *ngx_event_timer_mutex;
 #endif
 
 
+#if (NGX_EVENT_TIMER_WHEEL)
+
+void ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node);
+void ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node);
+
+extern ngx_event_timer_wheel_t  ngx_event_timer_wheel;
+
+#define ngx_event_timers_empty()  (ngx_event_timer_wheel.count == 0)
+
+#else
+
 extern ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
 
+#define ngx_event_timers_empty()                                              \
+    (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel)
+
+#endif
+
 
 static ngx_inline void
 ngx_event_del_timer(ngx_event_t *ev)
@@ -41,7 +80,11 @@ ngx_event_del_timer(ngx_event_t *ev)
 
     ngx_mutex_lock(ngx_event_timer_mutex);
 
+#if (NGX_EVENT_TIMER_WHEEL)
+    ngx_event_timer_wheel_delete(&ev->timer);
+#else
     ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+#endif
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
@@ -91,7 +134,11 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
 
     ngx_mutex_lock(ngx_event_timer_mutex);
 
+#if (NGX_EVENT_TIMER_WHEEL)
+    ngx_event_timer_wheel_insert(&ev->timer);
+#else
     ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+#endif
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
@@ -10,24 +10,11 @@
 #include <ngx_http.h>
 
 
-#if 0
-
-typedef struct {
-    ngx_buf_t     *buf;
-    size_t         size;
-    ngx_pool_t    *pool;
-    size_t         alloc_size;
-    ngx_chain_t  **last_out;
-} ngx_http_autoindex_ctx_t;
-
-#endif
-
-
 typedef struct {
     ngx_str_t      name;
-    size_t         utf_len;
     size_t         escape;
     size_t         escape_html;
+    size_t         escape_json;
 
     unsigned       dir:1;
 
@@ -36,28 +23,107 @@ typedef struct {
 } ngx_http_autoindex_entry_t;
 
 
+/*
+ * a sorted listing of a directory; a cached listing has its entries,
+ * their names and the path in the same allocation
+ */
+
+typedef struct {
+    uint32_t                      hash;
+    ngx_str_t                     path;
+    time_t                        mtime;        /* of the directory */
+    time_t                        expire;
+
+    ngx_uint_t                    count;        /* of the requests sending it */
+    ngx_uint_t                    evicted;      /* unsigned  evicted:1; */
+
+    ngx_http_autoindex_entry_t   *entries;
+    ngx_uint_t                    nentries;
+} ngx_http_autoindex_listing_t;
+
+
+typedef struct {
+    ngx_http_autoindex_listing_t *listing;
+    ngx_uint_t                    next;         /* the entry to send */
+
+    ngx_chain_t                  *free;
+    ngx_chain_t                  *busy;
+
+    unsigned                      utf8:1;
+} ngx_http_autoindex_ctx_t;
+
+
+typedef struct {
+    /* a direct mapped cache of the listings of the worker */
+    ngx_http_autoindex_listing_t **listings;
+    ngx_uint_t                    nlistings;
+    time_t                        valid;
+} ngx_http_autoindex_main_conf_t;
+
+
 typedef struct {
     ngx_flag_t     enable;
+    ngx_uint_t     format;
     ngx_flag_t     localtime;
     ngx_flag_t     exact_size;
 } ngx_http_autoindex_loc_conf_t;
 
 
+#define NGX_HTTP_AUTOINDEX_HTML         0
+#define NGX_HTTP_AUTOINDEX_JSON         1
+
 #define NGX_HTTP_AUTOINDEX_PREALLOCATE  50
 
 #define NGX_HTTP_AUTOINDEX_NAME_LEN     50
 
-
+#define NGX_HTTP_AUTOINDEX_BUF_SIZE     32768
+
+
+static ngx_int_t ngx_http_autoindex_open_error(ngx_http_request_t *r,
+    ngx_err_t err, ngx_str_t *path, char *name);
+static ngx_http_autoindex_listing_t *ngx_http_autoindex_read(
+    ngx_http_request_t *r, ngx_dir_t *dir, ngx_str_t *path, size_t allocated,
+    ngx_pool_t *pool);
+static ngx_http_autoindex_listing_t *ngx_http_autoindex_find_listing(
+    ngx_http_request_t *r, ngx_str_t *path, uint32_t hash, time_t mtime);
+static ngx_http_autoindex_listing_t *ngx_http_autoindex_cache_listing(
+    ngx_http_request_t *r, ngx_http_autoindex_listing_t *tmp);
+static ngx_int_t ngx_http_autoindex_hold_listing(ngx_http_request_t *r,
+    ngx_http_autoindex_listing_t *listing);
+static void ngx_http_autoindex_release_listing(void *data);
+static ngx_buf_t *ngx_http_autoindex_head(ngx_http_request_t *r,
+    ngx_http_autoindex_loc_conf_t *alcf);
+static ngx_int_t ngx_http_autoindex_send(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static void ngx_http_autoindex_write_handler(ngx_http_request_t *r);
+static size_t ngx_http_autoindex_html_len(ngx_http_autoindex_entry_t *entry);
+static u_char *ngx_http_autoindex_html(u_char *p,
+    ngx_http_autoindex_entry_t *entry, ngx_http_autoindex_loc_conf_t *alcf,
+    ngx_uint_t utf8);
+static size_t ngx_http_autoindex_json_len(ngx_http_autoindex_entry_t *entry);
+static u_char *ngx_http_autoindex_json(u_char *p,
+    ngx_http_autoindex_entry_t *entry, ngx_uint_t first);
 static int ngx_libc_cdecl ngx_http_autoindex_cmp_entries(const void *one,
     const void *two);
 static ngx_int_t ngx_http_autoindex_error(ngx_http_request_t *r,
     ngx_dir_t *dir, ngx_str_t *name);
 static ngx_int_t ngx_http_autoindex_init(ngx_conf_t *cf);
+static char *ngx_http_autoindex_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static void *ngx_http_autoindex_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_autoindex_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_autoindex_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_autoindex_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
 
 
+static ngx_conf_enum_t  ngx_http_autoindex_format[] = {
+    { ngx_string("html"), NGX_HTTP_AUTOINDEX_HTML },
+    { ngx_string("json"), NGX_HTTP_AUTOINDEX_JSON },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_command_t  ngx_http_autoindex_commands[] = {
 
     { ngx_string("autoindex"),
@@ -67,6 +133,13 @@ static ngx_command_t  ngx_http_autoindex_commands[] = {
       offsetof(ngx_http_autoindex_loc_conf_t, enable),
       NULL },
 
+    { ngx_string("autoindex_format"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_autoindex_loc_conf_t, format),
+      &ngx_http_autoindex_format },
+
     { ngx_string("autoindex_localtime"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -81,6 +154,13 @@ static ngx_command_t  ngx_http_autoindex_commands[] = {
       offsetof(ngx_http_autoindex_loc_conf_t, exact_size),
       NULL },
 
+    { ngx_string("autoindex_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_autoindex_cache,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -89,8 +169,8 @@ static ngx_http_module_t  ngx_http_autoindex_module_ctx = {
     NULL,                                  /* preconfiguration */
     ngx_http_autoindex_init,               /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
-    NULL,                                  /* init main configuration */
+    ngx_http_autoindex_create_main_conf,   /* create main configuration */
+    ngx_http_autoindex_init_main_conf,     /* init main configuration */
 
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
@@ -129,33 +209,36 @@ static u_char header[] =
 ;
 
 static u_char tail[] =
+"</pre><hr>"
 "</body>" CRLF
 "</html>" CRLF
 ;
 
 
+static u_char json_head[] = "[";
+
+static u_char json_tail[] = CRLF "]" CRLF;
+
+
 static ngx_int_t
 ngx_http_autoindex_handler(ngx_http_request_t *r)
 {
-    u_char                         *last, *filename, scale;
-    off_t                           length;
-    size_t                          len, char_len, escape_html, allocated, root;
-    ngx_tm_t                        tm;
-    ngx_err_t                       err;
-    ngx_buf_t                      *b;
-    ngx_int_t                       rc, size;
-    ngx_str_t                       path;
-    ngx_dir_t                       dir;
-    ngx_uint_t                      i, level, utf8;
-    ngx_pool_t                     *pool;
-    ngx_time_t                     *tp;
-    ngx_chain_t                     out;
-    ngx_array_t                     entries;
-    ngx_http_autoindex_entry_t     *entry;
-    ngx_http_autoindex_loc_conf_t  *alcf;
-
-    static char  *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
-                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    u_char                          *last;
+    size_t                           allocated, root;
+    time_t                           mtime;
+    uint32_t                         hash;
+    ngx_err_t                        err;
+    ngx_buf_t                       *b;
+    ngx_int_t                        rc;
+    ngx_str_t                        path;
+    ngx_dir_t                        dir;
+    ngx_pool_t                      *pool;
+    ngx_chain_t                      out;
+    ngx_file_info_t                  fi;
+    ngx_http_autoindex_ctx_t        *ctx;
+    ngx_http_autoindex_listing_t    *listing;
+    ngx_http_autoindex_loc_conf_t   *alcf;
+    ngx_http_autoindex_main_conf_t  *amcf;
 
     if (r->uri.data[r->uri.len - 1] != '/') {
         return NGX_DECLINED;
@@ -189,55 +272,54 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http autoindex: \"%s\"", path.data);
 
-    if (ngx_open_dir(&path, &dir) == NGX_ERROR) {
-        err = ngx_errno;
+    amcf = ngx_http_get_module_main_conf(r, ngx_http_autoindex_module);
 
-        if (err == NGX_ENOENT
-            || err == NGX_ENOTDIR
-            || err == NGX_ENAMETOOLONG)
-        {
-            level = NGX_LOG_ERR;
-            rc = NGX_HTTP_NOT_FOUND;
+    listing = NULL;
+    hash = 0;
+    mtime = 0;
 
-        } else if (err == NGX_EACCES) {
-            level = NGX_LOG_ERR;
-            rc = NGX_HTTP_FORBIDDEN;
+    if (amcf->nlistings) {
 
-        } else {
-            level = NGX_LOG_CRIT;
-            rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        if (ngx_file_info(path.data, &fi) == NGX_FILE_ERROR) {
+            return ngx_http_autoindex_open_error(r, ngx_errno, &path,
+                                                 ngx_file_info_n);
         }
 
-        ngx_log_error(level, r->connection->log, err,
-                      ngx_open_dir_n " \"%s\" failed", path.data);
-
-        return rc;
-    }
-
-#if (NGX_SUPPRESS_WARN)
+        if (!ngx_is_dir(&fi)) {
+            return ngx_http_autoindex_open_error(r, NGX_ENOTDIR, &path,
+                                                 ngx_file_info_n);
+        }
 
-    /* MSVC thinks 'entries' may be used without having been initialized */
-    ngx_memzero(&entries, sizeof(ngx_array_t));
+        hash = ngx_crc32_long(path.data, path.len);
+        mtime = ngx_file_mtime(&fi);
 
-#endif
+        listing = ngx_http_autoindex_find_listing(r, &path, hash, mtime);
 
-    /* TODO: pool should be temporary pool */
-    pool = r->pool;
+        if (listing && ngx_http_autoindex_hold_listing(r, listing) != NGX_OK) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
 
-    if (ngx_array_init(&entries, pool, 40, sizeof(ngx_http_autoindex_entry_t))
-        != NGX_OK)
-    {
-        return ngx_http_autoindex_error(r, &dir, &path);
+    if (listing == NULL && ngx_open_dir(&path, &dir) == NGX_ERROR) {
+        err = ngx_errno;
+        return ngx_http_autoindex_open_error(r, err, &path, ngx_open_dir_n);
     }
 
     r->headers_out.status = NGX_HTTP_OK;
-    r->headers_out.content_type_len = sizeof("text/html") - 1;
-    ngx_str_set(&r->headers_out.content_type, "text/html");
+
+    if (alcf->format == NGX_HTTP_AUTOINDEX_JSON) {
+        r->headers_out.content_type_len = sizeof("application/json") - 1;
+        ngx_str_set(&r->headers_out.content_type, "application/json");
+
+    } else {
+        r->headers_out.content_type_len = sizeof("text/html") - 1;
+        ngx_str_set(&r->headers_out.content_type, "text/html");
+    }
 
     rc = ngx_http_send_header(r);
 
     if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        if (ngx_close_dir(&dir) == NGX_ERROR) {
+        if (listing == NULL && ngx_close_dir(&dir) == NGX_ERROR) {
             ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
                           ngx_close_dir_n " \"%V\" failed", &path);
         }
@@ -245,63 +327,202 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
         return rc;
     }
 
-    filename = path.data;
-    filename[path.len] = '/';
+    if (listing == NULL) {
+
+        /*
+         * a listing is cached only if the directory has not been changed
+         * in the current second: a later change in the same second would
+         * not change its modification time
+         */
+
+        if (amcf->nlistings && mtime < ngx_time()) {
+            pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, r->connection->log);
+            if (pool == NULL) {
+                return ngx_http_autoindex_error(r, &dir, &path);
+            }
+
+        } else {
+            pool = NULL;
+        }
+
+        listing = ngx_http_autoindex_read(r, &dir, &path, allocated,
+                                          pool ? pool : r->pool);
+
+        if (pool) {
+            if (listing) {
+                listing->hash = hash;
+                listing->mtime = mtime;
+
+                listing = ngx_http_autoindex_cache_listing(r, listing);
+            }
+
+            ngx_destroy_pool(pool);
+        }
+
+        if (listing == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_autoindex_ctx_t));
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_http_set_ctx(r, ctx, ngx_http_autoindex_module);
+
+    ctx->listing = listing;
 
     if (r->headers_out.charset.len == 5
         && ngx_strncasecmp(r->headers_out.charset.data, (u_char *) "utf-8", 5)
            == 0)
     {
-        utf8 = 1;
+        ctx->utf8 = 1;
+    }
+
+    b = ngx_http_autoindex_head(r, alcf);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_output_filter(r, &out);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    rc = ngx_http_autoindex_send(r, ctx);
+
+    if (rc == NGX_DONE) {
+        r->main->count++;
+        r->write_event_handler = ngx_http_autoindex_write_handler;
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_open_error(ngx_http_request_t *r, ngx_err_t err,
+    ngx_str_t *path, char *name)
+{
+    ngx_int_t   rc;
+    ngx_uint_t  level;
+
+    if (err == NGX_ENOENT
+        || err == NGX_ENOTDIR
+        || err == NGX_ENAMETOOLONG)
+    {
+        level = NGX_LOG_ERR;
+        rc = NGX_HTTP_NOT_FOUND;
+
+    } else if (err == NGX_EACCES) {
+        level = NGX_LOG_ERR;
+        rc = NGX_HTTP_FORBIDDEN;
 
     } else {
-        utf8 = 0;
+        level = NGX_LOG_CRIT;
+        rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
+    ngx_log_error(level, r->connection->log, err,
+                  "%s \"%s\" failed", name, path->data);
+
+    return rc;
+}
+
+
+/*
+ * reads and sorts the entries of the directory and closes it; the entries
+ * are allocated from the pool
+ */
+
+static ngx_http_autoindex_listing_t *
+ngx_http_autoindex_read(ngx_http_request_t *r, ngx_dir_t *dir,
+    ngx_str_t *path, size_t allocated, ngx_pool_t *pool)
+{
+    u_char                        *last, *filename;
+    size_t                         len;
+    ngx_err_t                      err;
+    ngx_array_t                    entries;
+    ngx_http_autoindex_entry_t    *entry;
+    ngx_http_autoindex_listing_t  *listing;
+
+#if (NGX_SUPPRESS_WARN)
+
+    /* MSVC thinks 'entries' may be used without having been initialized */
+    ngx_memzero(&entries, sizeof(ngx_array_t));
+
+#endif
+
+    listing = ngx_pcalloc(pool, sizeof(ngx_http_autoindex_listing_t));
+    if (listing == NULL) {
+        (void) ngx_http_autoindex_error(r, dir, path);
+        return NULL;
+    }
+
+    listing->path = *path;
+
+    if (ngx_array_init(&entries, pool, 40, sizeof(ngx_http_autoindex_entry_t))
+        != NGX_OK)
+    {
+        (void) ngx_http_autoindex_error(r, dir, path);
+        return NULL;
+    }
+
+    filename = path->data;
+    filename[path->len] = '/';
+    last = filename + path->len + 1;
+
     for ( ;; ) {
         ngx_set_errno(0);
 
-        if (ngx_read_dir(&dir) == NGX_ERROR) {
+        if (ngx_read_dir(dir) == NGX_ERROR) {
             err = ngx_errno;
 
             if (err != NGX_ENOMOREFILES) {
                 ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
-                              ngx_read_dir_n " \"%V\" failed", &path);
-                return ngx_http_autoindex_error(r, &dir, &path);
+                              ngx_read_dir_n " \"%V\" failed", path);
+                (void) ngx_http_autoindex_error(r, dir, path);
+                return NULL;
             }
 
             break;
         }
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http autoindex file: \"%s\"", ngx_de_name(&dir));
+                       "http autoindex file: \"%s\"", ngx_de_name(dir));
 
-        len = ngx_de_namelen(&dir);
+        len = ngx_de_namelen(dir);
 
-        if (ngx_de_name(&dir)[0] == '.') {
+        if (ngx_de_name(dir)[0] == '.') {
             continue;
         }
 
-        if (!dir.valid_info) {
+        if (!dir->valid_info) {
 
             /* 1 byte for '/' and 1 byte for terminating '\0' */
 
-            if (path.len + 1 + len + 1 > allocated) {
-                allocated = path.len + 1 + len + 1
-                                     + NGX_HTTP_AUTOINDEX_PREALLOCATE;
+            if (path->len + 1 + len + 1 > allocated) {
+                allocated = path->len + 1 + len + 1
+                                      + NGX_HTTP_AUTOINDEX_PREALLOCATE;
 
                 filename = ngx_pnalloc(pool, allocated);
                 if (filename == NULL) {
-                    return ngx_http_autoindex_error(r, &dir, &path);
+                    (void) ngx_http_autoindex_error(r, dir, path);
+                    return NULL;
                 }
 
-                last = ngx_cpystrn(filename, path.data, path.len + 1);
+                last = ngx_cpystrn(filename, path->data, path->len + 1);
                 *last++ = '/';
             }
 
-            ngx_cpystrn(last, ngx_de_name(&dir), len + 1);
+            ngx_cpystrn(last, ngx_de_name(dir), len + 1);
 
-            if (ngx_de_info(filename, &dir) == NGX_FILE_ERROR) {
+            if (ngx_de_info(filename, dir) == NGX_FILE_ERROR) {
                 err = ngx_errno;
 
                 if (err != NGX_ENOENT) {
@@ -312,52 +533,225 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
                         continue;
                     }
 
-                    return ngx_http_autoindex_error(r, &dir, &path);
+                    (void) ngx_http_autoindex_error(r, dir, path);
+                    return NULL;
                 }
 
-                if (ngx_de_link_info(filename, &dir) == NGX_FILE_ERROR) {
+                if (ngx_de_link_info(filename, dir) == NGX_FILE_ERROR) {
                     ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
                                   ngx_de_link_info_n " \"%s\" failed",
                                   filename);
-                    return ngx_http_autoindex_error(r, &dir, &path);
+                    (void) ngx_http_autoindex_error(r, dir, path);
+                    return NULL;
                 }
             }
         }
 
         entry = ngx_array_push(&entries);
         if (entry == NULL) {
-            return ngx_http_autoindex_error(r, &dir, &path);
+            (void) ngx_http_autoindex_error(r, dir, path);
+            return NULL;
         }
 
         entry->name.len = len;
 
         entry->name.data = ngx_pnalloc(pool, len + 1);
         if (entry->name.data == NULL) {
-            return ngx_http_autoindex_error(r, &dir, &path);
+            (void) ngx_http_autoindex_error(r, dir, path);
+            return NULL;
         }
 
-        ngx_cpystrn(entry->name.data, ngx_de_name(&dir), len + 1);
+        ngx_cpystrn(entry->name.data, ngx_de_name(dir), len + 1);
 
-        entry->escape = 2 * ngx_escape_uri(NULL, ngx_de_name(&dir), len,
+        entry->escape = 2 * ngx_escape_uri(NULL, ngx_de_name(dir), len,
                                            NGX_ESCAPE_URI_COMPONENT);
 
         entry->escape_html = ngx_escape_html(NULL, entry->name.data,
                                              entry->name.len);
 
-        if (utf8) {
-            entry->utf_len = ngx_utf8_length(entry->name.data, entry->name.len);
+        entry->escape_json = ngx_escape_json(NULL, entry->name.data,
+                                             entry->name.len);
+
+        entry->dir = ngx_de_is_dir(dir);
+        entry->mtime = ngx_de_mtime(dir);
+        entry->size = ngx_de_size(dir);
+    }
+
+    if (ngx_close_dir(dir) == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_dir_n " \"%V\" failed", path);
+    }
+
+    if (entries.nelts > 1) {
+        ngx_qsort(entries.elts, (size_t) entries.nelts,
+                  sizeof(ngx_http_autoindex_entry_t),
+                  ngx_http_autoindex_cmp_entries);
+    }
+
+    listing->entries = entries.elts;
+    listing->nentries = entries.nelts;
+
+    return listing;
+}
+
+
+static ngx_http_autoindex_listing_t *
+ngx_http_autoindex_find_listing(ngx_http_request_t *r, ngx_str_t *path,
+    uint32_t hash, time_t mtime)
+{
+    ngx_http_autoindex_listing_t    *listing;
+    ngx_http_autoindex_main_conf_t  *amcf;
+
+    amcf = ngx_http_get_module_main_conf(r, ngx_http_autoindex_module);
+
+    listing = amcf->listings[hash % amcf->nlistings];
+
+    if (listing
+        && listing->hash == hash
+        && listing->mtime == mtime
+        && listing->expire > ngx_time()
+        && listing->path.len == path->len
+        && ngx_strncmp(listing->path.data, path->data, path->len) == 0)
+    {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http autoindex listing \"%V\", %ui entries",
+                       &listing->path, listing->nentries);
+
+        return listing;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * copies the listing read into a temporary pool to the cache of the worker
+ * and holds it for the request
+ */
+
+static ngx_http_autoindex_listing_t *
+ngx_http_autoindex_cache_listing(ngx_http_request_t *r,
+    ngx_http_autoindex_listing_t *tmp)
+{
+    u_char                          *p;
+    size_t                           size;
+    ngx_uint_t                       i;
+    ngx_http_autoindex_entry_t      *entry;
+    ngx_http_autoindex_listing_t    *listing, **slot;
+    ngx_http_autoindex_main_conf_t  *amcf;
+
+    size = sizeof(ngx_http_autoindex_listing_t)
+           + tmp->nentries * sizeof(ngx_http_autoindex_entry_t)
+           + tmp->path.len;
+
+    for (i = 0; i < tmp->nentries; i++) {
+        size += tmp->entries[i].name.len + 1;
+    }
+
+    listing = ngx_alloc(size, r->connection->log);
+    if (listing == NULL) {
+        return NULL;
+    }
+
+    *listing = *tmp;
+
+    amcf = ngx_http_get_module_main_conf(r, ngx_http_autoindex_module);
+
+    listing->expire = ngx_time() + amcf->valid;
+    listing->count = 0;
+    listing->evicted = 0;
+
+    entry = (ngx_http_autoindex_entry_t *) &listing[1];
+    listing->entries = entry;
+
+    ngx_memcpy(entry, tmp->entries,
+               tmp->nentries * sizeof(ngx_http_autoindex_entry_t));
+
+    p = (u_char *) &entry[listing->nentries];
+
+    for (i = 0; i < listing->nentries; i++) {
+        entry[i].name.data = p;
+        p = ngx_cpymem(p, tmp->entries[i].name.data, entry[i].name.len + 1);
+    }
+
+    listing->path.data = p;
+    ngx_memcpy(p, tmp->path.data, tmp->path.len);
+
+    if (ngx_http_autoindex_hold_listing(r, listing) != NGX_OK) {
+        ngx_free(listing);
+        return NULL;
+    }
+
+    slot = &amcf->listings[listing->hash % amcf->nlistings];
+
+    if (*slot) {
+        if ((*slot)->count) {
+            (*slot)->evicted = 1;
+
         } else {
-            entry->utf_len = len;
+            ngx_free(*slot);
         }
+    }
+
+    *slot = listing;
 
-        entry->dir = ngx_de_is_dir(&dir);
-        entry->mtime = ngx_de_mtime(&dir);
-        entry->size = ngx_de_size(&dir);
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http autoindex listing \"%V\" cached, %ui entries",
+                   &listing->path, listing->nentries);
+
+    return listing;
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_hold_listing(ngx_http_request_t *r,
+    ngx_http_autoindex_listing_t *listing)
+{
+    ngx_pool_cleanup_t  *cln;
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
     }
 
-    if (ngx_close_dir(&dir) == NGX_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
-                      ngx_close_dir_n " \"%s\" failed", &path);
+    cln->handler = ngx_http_autoindex_release_listing;
+    cln->data = listing;
+
+    listing->count++;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_autoindex_release_listing(void *data)
+{
+    ngx_http_autoindex_listing_t  *listing = data;
+
+    if (--listing->count == 0 && listing->evicted) {
+        ngx_free(listing);
+    }
+}
+
+
+static ngx_buf_t *
+ngx_http_autoindex_head(ngx_http_request_t *r,
+    ngx_http_autoindex_loc_conf_t *alcf)
+{
+    size_t      len, escape_html;
+    ngx_buf_t  *b;
+
+    if (alcf->format == NGX_HTTP_AUTOINDEX_JSON) {
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NULL;
+        }
+
+        b->memory = 1;
+        b->pos = json_head;
+        b->last = json_head + sizeof(json_head) - 1;
+
+        return b;
     }
 
     escape_html = ngx_escape_html(NULL, r->uri.data, r->uri.len);
@@ -367,34 +761,11 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
           + sizeof(header) - 1
           + r->uri.len + escape_html
           + sizeof("</h1>") - 1
-          + sizeof("<hr><pre><a href=\"../\">../</a>" CRLF) - 1
-          + sizeof("</pre><hr>") - 1
-          + sizeof(tail) - 1;
-
-    entry = entries.elts;
-    for (i = 0; i < entries.nelts; i++) {
-        len += sizeof("<a href=\"") - 1
-            + entry[i].name.len + entry[i].escape
-            + 1                                          /* 1 is for "/" */
-            + sizeof("\">") - 1
-            + entry[i].name.len - entry[i].utf_len
-            + entry[i].escape_html
-            + NGX_HTTP_AUTOINDEX_NAME_LEN + sizeof("&gt;") - 2
-            + sizeof("</a>") - 1
-            + sizeof(" 28-Sep-1970 12:00 ") - 1
-            + 20                                         /* the file size */
-            + 2;
-    }
+          + sizeof("<hr><pre><a href=\"../\">../</a>" CRLF) - 1;
 
     b = ngx_create_temp_buf(r->pool, len);
     if (b == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
-
-    if (entries.nelts > 1) {
-        ngx_qsort(entry, (size_t) entries.nelts,
-                  sizeof(ngx_http_autoindex_entry_t),
-                  ngx_http_autoindex_cmp_entries);
+        return NULL;
     }
 
     b->last = ngx_cpymem(b->last, title, sizeof(title) - 1);
@@ -415,168 +786,456 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
     b->last = ngx_cpymem(b->last, "<hr><pre><a href=\"../\">../</a>" CRLF,
                          sizeof("<hr><pre><a href=\"../\">../</a>" CRLF) - 1);
 
-    tp = ngx_timeofday();
+    return b;
+}
 
-    for (i = 0; i < entries.nelts; i++) {
-        b->last = ngx_cpymem(b->last, "<a href=\"", sizeof("<a href=\"") - 1);
 
-        if (entry[i].escape) {
-            ngx_escape_uri(b->last, entry[i].name.data, entry[i].name.len,
-                           NGX_ESCAPE_URI_COMPONENT);
+/*
+ * the entries are formatted into a few recycled buffers; the main request
+ * formats the next buffer only when the client has read the previous ones,
+ * and returns NGX_DONE to wait for it
+ */
 
-            b->last += entry[i].name.len + entry[i].escape;
+static ngx_int_t
+ngx_http_autoindex_send(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx)
+{
+    size_t                          len;
+    ngx_int_t                       rc;
+    ngx_buf_t                      *b;
+    ngx_chain_t                    *cl, out;
+    ngx_connection_t               *c;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_autoindex_entry_t     *entry;
+    ngx_http_autoindex_listing_t   *listing;
+    ngx_http_autoindex_loc_conf_t  *alcf;
 
-        } else {
-            b->last = ngx_cpymem(b->last, entry[i].name.data,
-                                 entry[i].name.len);
+    c = r->connection;
+
+    alcf = ngx_http_get_module_loc_conf(r, ngx_http_autoindex_module);
+
+    listing = ctx->listing;
+    entry = listing->entries;
+
+    while (ctx->next < listing->nentries) {
+
+        if (r == r->main && (ctx->busy || c->buffered)) {
+            clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+            if (!c->write->delayed) {
+                ngx_add_timer(c->write, clcf->send_timeout);
+            }
+
+            if (ngx_handle_write_event(c->write, clcf->send_lowat) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            return NGX_DONE;
         }
 
-        if (entry[i].dir) {
-            *b->last++ = '/';
+        cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
+        if (cl == NULL) {
+            return NGX_ERROR;
         }
 
-        *b->last++ = '"';
-        *b->last++ = '>';
+        b = cl->buf;
 
-        len = entry[i].utf_len;
+        if (b->start == NULL) {
+            b->start = ngx_palloc(r->pool, NGX_HTTP_AUTOINDEX_BUF_SIZE);
+            if (b->start == NULL) {
+                return NGX_ERROR;
+            }
 
-        if (entry[i].name.len != len) {
-            if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
-                char_len = NGX_HTTP_AUTOINDEX_NAME_LEN - 3 + 1;
+            b->pos = b->start;
+            b->last = b->start;
+            b->end = b->start + NGX_HTTP_AUTOINDEX_BUF_SIZE;
+            b->temporary = 1;
+            b->tag = (ngx_buf_tag_t) &ngx_http_autoindex_module;
+        }
+
+        do {
+            if (alcf->format == NGX_HTTP_AUTOINDEX_JSON) {
+                len = ngx_http_autoindex_json_len(&entry[ctx->next]);
 
             } else {
-                char_len = NGX_HTTP_AUTOINDEX_NAME_LEN + 1;
+                len = ngx_http_autoindex_html_len(&entry[ctx->next]);
             }
 
-            last = b->last;
-            b->last = ngx_utf8_cpystrn(b->last, entry[i].name.data,
-                                       char_len, entry[i].name.len + 1);
-
-            if (entry[i].escape_html) {
-                b->last = (u_char *) ngx_escape_html(last, entry[i].name.data,
-                                                     b->last - last);
-            }
+            if ((size_t) (b->end - b->last) < len) {
 
-            last = b->last;
+                if (b->last != b->pos) {
+                    break;
+                }
 
-        } else {
-            if (entry[i].escape_html) {
-                if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
-                    char_len = NGX_HTTP_AUTOINDEX_NAME_LEN - 3;
+                /* an entry larger than the buffer */
 
-                } else {
-                    char_len = len;
+                b->start = ngx_palloc(r->pool, len);
+                if (b->start == NULL) {
+                    return NGX_ERROR;
                 }
 
-                b->last = (u_char *) ngx_escape_html(b->last,
-                                                  entry[i].name.data, char_len);
-                last = b->last;
+                b->pos = b->start;
+                b->last = b->start;
+                b->end = b->start + len;
+            }
+
+            if (alcf->format == NGX_HTTP_AUTOINDEX_JSON) {
+                b->last = ngx_http_autoindex_json(b->last, &entry[ctx->next],
+                                                  ctx->next == 0);
 
             } else {
-                b->last = ngx_cpystrn(b->last, entry[i].name.data,
-                                      NGX_HTTP_AUTOINDEX_NAME_LEN + 1);
-                last = b->last - 3;
+                b->last = ngx_http_autoindex_html(b->last, &entry[ctx->next],
+                                                  alcf, ctx->utf8);
             }
+
+            ctx->next++;
+
+        } while (ctx->next < listing->nentries);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http autoindex sent %ui of %ui entries",
+                       ctx->next, listing->nentries);
+
+        rc = ngx_http_output_filter(r, cl);
+
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &cl,
+                                (ngx_buf_tag_t) &ngx_http_autoindex_module);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
         }
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->memory = 1;
+
+    if (alcf->format == NGX_HTTP_AUTOINDEX_JSON) {
+        b->pos = json_tail;
+        b->last = json_tail + sizeof(json_tail) - 1;
+
+    } else {
+        b->pos = tail;
+        b->last = tail + sizeof(tail) - 1;
+    }
+
+    if (r == r->main) {
+        b->last_buf = 1;
+    }
+
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_output_filter(r, &out);
+
+    if (rc == NGX_AGAIN && r == r->main) {
+        /* the request is finalized when the rest is sent */
+        return NGX_OK;
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_http_autoindex_write_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_chain_t               *cl;
+    ngx_event_t               *wev;
+    ngx_connection_t          *c;
+    ngx_http_core_loc_conf_t  *clcf;
+    ngx_http_autoindex_ctx_t  *ctx;
+
+    c = r->connection;
+    wev = c->write;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http autoindex write handler");
+
+    if (wev->timedout) {
+        if (!wev->delayed) {
+            ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                          "client timed out");
+            c->timedout = 1;
+
+            ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+            return;
+        }
+
+        wev->timedout = 0;
+        wev->delayed = 0;
+    }
+
+    if (wev->delayed) {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+        }
+
+        return;
+    }
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_autoindex_module);
+
+    rc = ngx_http_output_filter(r, NULL);
+
+    if (rc != NGX_ERROR) {
+        cl = NULL;
+
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &cl,
+                                (ngx_buf_tag_t) &ngx_http_autoindex_module);
+
+        rc = ngx_http_autoindex_send(r, ctx);
+
+        if (rc == NGX_DONE) {
+            return;
+        }
+    }
+
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    ngx_http_finalize_request(r, rc);
+}
+
+
+static size_t
+ngx_http_autoindex_html_len(ngx_http_autoindex_entry_t *entry)
+{
+    /* the name is counted twice for the bytes of its utf-8 characters */
+
+    return sizeof("<a href=\"") - 1
+           + entry->name.len + entry->escape
+           + 1                                          /* 1 is for "/" */
+           + sizeof("\">") - 1
+           + entry->name.len
+           + entry->escape_html
+           + NGX_HTTP_AUTOINDEX_NAME_LEN + sizeof("&gt;") - 2
+           + sizeof("</a>") - 1
+           + sizeof(" 28-Sep-1970 12:00 ") - 1
+           + 20                                         /* the file size */
+           + 2;
+}
+
+
+static u_char *
+ngx_http_autoindex_html(u_char *p, ngx_http_autoindex_entry_t *entry,
+    ngx_http_autoindex_loc_conf_t *alcf, ngx_uint_t utf8)
+{
+    u_char       *last, scale;
+    off_t         length;
+    size_t        len, char_len;
+    ngx_tm_t      tm;
+    ngx_int_t     size;
+    ngx_time_t   *tp;
+
+    static char  *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+    p = ngx_cpymem(p, "<a href=\"", sizeof("<a href=\"") - 1);
+
+    if (entry->escape) {
+        ngx_escape_uri(p, entry->name.data, entry->name.len,
+                       NGX_ESCAPE_URI_COMPONENT);
+
+        p += entry->name.len + entry->escape;
+
+    } else {
+        p = ngx_cpymem(p, entry->name.data, entry->name.len);
+    }
 
+    if (entry->dir) {
+        *p++ = '/';
+    }
+
+    *p++ = '"';
+    *p++ = '>';
+
+    if (utf8) {
+        len = ngx_utf8_length(entry->name.data, entry->name.len);
+
+    } else {
+        len = entry->name.len;
+    }
+
+    if (entry->name.len != len) {
         if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
-            b->last = ngx_cpymem(last, "..&gt;</a>", sizeof("..&gt;</a>") - 1);
+            char_len = NGX_HTTP_AUTOINDEX_NAME_LEN - 3 + 1;
 
         } else {
-            if (entry[i].dir && NGX_HTTP_AUTOINDEX_NAME_LEN - len > 0) {
-                *b->last++ = '/';
-                len++;
-            }
-
-            b->last = ngx_cpymem(b->last, "</a>", sizeof("</a>") - 1);
-            ngx_memset(b->last, ' ', NGX_HTTP_AUTOINDEX_NAME_LEN - len);
-            b->last += NGX_HTTP_AUTOINDEX_NAME_LEN - len;
+            char_len = NGX_HTTP_AUTOINDEX_NAME_LEN + 1;
         }
 
-        *b->last++ = ' ';
+        last = p;
+        p = ngx_utf8_cpystrn(p, entry->name.data, char_len,
+                             entry->name.len + 1);
 
-        ngx_gmtime(entry[i].mtime + tp->gmtoff * 60 * alcf->localtime, &tm);
+        if (entry->escape_html) {
+            p = (u_char *) ngx_escape_html(last, entry->name.data, p - last);
+        }
 
-        b->last = ngx_sprintf(b->last, "%02d-%s-%d %02d:%02d ",
-                              tm.ngx_tm_mday,
-                              months[tm.ngx_tm_mon - 1],
-                              tm.ngx_tm_year,
-                              tm.ngx_tm_hour,
-                              tm.ngx_tm_min);
+        last = p;
+
+    } else {
+        if (entry->escape_html) {
+            if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
+                char_len = NGX_HTTP_AUTOINDEX_NAME_LEN - 3;
 
-        if (alcf->exact_size) {
-            if (entry[i].dir) {
-                b->last = ngx_cpymem(b->last,  "                  -",
-                                     sizeof("                  -") - 1);
             } else {
-                b->last = ngx_sprintf(b->last, "%19O", entry[i].size);
+                char_len = len;
             }
 
+            p = (u_char *) ngx_escape_html(p, entry->name.data, char_len);
+            last = p;
+
         } else {
-            if (entry[i].dir) {
-                b->last = ngx_cpymem(b->last,  "      -",
-                                     sizeof("      -") - 1);
+            p = ngx_cpystrn(p, entry->name.data,
+                            NGX_HTTP_AUTOINDEX_NAME_LEN + 1);
+            last = p - 3;
+        }
+    }
 
-            } else {
-                length = entry[i].size;
-
-                if (length > 1024 * 1024 * 1024 - 1) {
-                    size = (ngx_int_t) (length / (1024 * 1024 * 1024));
-                    if ((length % (1024 * 1024 * 1024))
-                                                > (1024 * 1024 * 1024 / 2 - 1))
-                    {
-                        size++;
-                    }
-                    scale = 'G';
+    if (len > NGX_HTTP_AUTOINDEX_NAME_LEN) {
+        p = ngx_cpymem(last, "..&gt;</a>", sizeof("..&gt;</a>") - 1);
 
-                } else if (length > 1024 * 1024 - 1) {
-                    size = (ngx_int_t) (length / (1024 * 1024));
-                    if ((length % (1024 * 1024)) > (1024 * 1024 / 2 - 1)) {
-                        size++;
-                    }
-                    scale = 'M';
+    } else {
+        if (entry->dir && NGX_HTTP_AUTOINDEX_NAME_LEN - len > 0) {
+            *p++ = '/';
+            len++;
+        }
 
-                } else if (length > 9999) {
-                    size = (ngx_int_t) (length / 1024);
-                    if (length % 1024 > 511) {
-                        size++;
-                    }
-                    scale = 'K';
+        p = ngx_cpymem(p, "</a>", sizeof("</a>") - 1);
+        ngx_memset(p, ' ', NGX_HTTP_AUTOINDEX_NAME_LEN - len);
+        p += NGX_HTTP_AUTOINDEX_NAME_LEN - len;
+    }
+
+    *p++ = ' ';
+
+    tp = ngx_timeofday();
+
+    ngx_gmtime(entry->mtime + tp->gmtoff * 60 * alcf->localtime, &tm);
 
-                } else {
-                    size = (ngx_int_t) length;
-                    scale = '\0';
+    p = ngx_sprintf(p, "%02d-%s-%d %02d:%02d ",
+                    tm.ngx_tm_mday,
+                    months[tm.ngx_tm_mon - 1],
+                    tm.ngx_tm_year,
+                    tm.ngx_tm_hour,
+                    tm.ngx_tm_min);
+
+    if (alcf->exact_size) {
+        if (entry->dir) {
+            p = ngx_cpymem(p,  "                  -",
+                           sizeof("                  -") - 1);
+        } else {
+            p = ngx_sprintf(p, "%19O", entry->size);
+        }
+
+    } else {
+        if (entry->dir) {
+            p = ngx_cpymem(p,  "      -", sizeof("      -") - 1);
+
+        } else {
+            length = entry->size;
+
+            if (length > 1024 * 1024 * 1024 - 1) {
+                size = (ngx_int_t) (length / (1024 * 1024 * 1024));
+                if ((length % (1024 * 1024 * 1024))
+                                            > (1024 * 1024 * 1024 / 2 - 1))
+                {
+                    size++;
                 }
+                scale = 'G';
 
-                if (scale) {
-                    b->last = ngx_sprintf(b->last, "%6i%c", size, scale);
+            } else if (length > 1024 * 1024 - 1) {
+                size = (ngx_int_t) (length / (1024 * 1024));
+                if ((length % (1024 * 1024)) > (1024 * 1024 / 2 - 1)) {
+                    size++;
+                }
+                scale = 'M';
 
-                } else {
-                    b->last = ngx_sprintf(b->last, " %6i", size);
+            } else if (length > 9999) {
+                size = (ngx_int_t) (length / 1024);
+                if (length % 1024 > 511) {
+                    size++;
                 }
+                scale = 'K';
+
+            } else {
+                size = (ngx_int_t) length;
+                scale = '\0';
+            }
+
+            if (scale) {
+                p = ngx_sprintf(p, "%6i%c", size, scale);
+
+            } else {
+                p = ngx_sprintf(p, " %6i", size);
             }
         }
+    }
+
+    *p++ = CR;
+    *p++ = LF;
+
+    return p;
+}
 
-        *b->last++ = CR;
-        *b->last++ = LF;
+
+static size_t
+ngx_http_autoindex_json_len(ngx_http_autoindex_entry_t *entry)
+{
+    return sizeof("," CRLF "{ \"name\":\"") - 1
+           + entry->name.len + entry->escape_json
+           + sizeof("\", \"type\":\"directory\"") - 1
+           + sizeof(", \"mtime\":\"Mon, 28 Sep 1970 06:00:00 GMT\"") - 1
+           + sizeof(", \"size\":") - 1 + NGX_OFF_T_LEN
+           + sizeof(" }") - 1;
+}
+
+
+static u_char *
+ngx_http_autoindex_json(u_char *p, ngx_http_autoindex_entry_t *entry,
+    ngx_uint_t first)
+{
+    if (!first) {
+        *p++ = ',';
     }
 
-    /* TODO: free temporary pool */
+    p = ngx_cpymem(p, CRLF "{ \"name\":\"", sizeof(CRLF "{ \"name\":\"") - 1);
 
-    b->last = ngx_cpymem(b->last, "</pre><hr>", sizeof("</pre><hr>") - 1);
+    if (entry->escape_json) {
+        p = (u_char *) ngx_escape_json(p, entry->name.data, entry->name.len);
 
-    b->last = ngx_cpymem(b->last, tail, sizeof(tail) - 1);
+    } else {
+        p = ngx_cpymem(p, entry->name.data, entry->name.len);
+    }
 
-    if (r == r->main) {
-        b->last_buf = 1;
+    if (entry->dir) {
+        p = ngx_cpymem(p, "\", \"type\":\"directory\"",
+                       sizeof("\", \"type\":\"directory\"") - 1);
+
+    } else {
+        p = ngx_cpymem(p, "\", \"type\":\"file\"",
+                       sizeof("\", \"type\":\"file\"") - 1);
     }
 
-    b->last_in_chain = 1;
+    p = ngx_cpymem(p, ", \"mtime\":\"", sizeof(", \"mtime\":\"") - 1);
+    p = ngx_http_time(p, entry->mtime);
+    *p++ = '"';
 
-    out.buf = b;
-    out.next = NULL;
+    if (!entry->dir) {
+        p = ngx_sprintf(p, ", \"size\":%O", entry->size);
+    }
 
-    return ngx_http_output_filter(r, &out);
+    *p++ = ' ';
+    *p++ = '}';
+
+    return p;
 }
 
 
@@ -600,53 +1259,112 @@ ngx_http_autoindex_cmp_entries(const void *one, const void *two)
 }
 
 
-#if 0
+static ngx_int_t
+ngx_http_autoindex_error(ngx_http_request_t *r, ngx_dir_t *dir, ngx_str_t *name)
+{
+    if (ngx_close_dir(dir) == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_dir_n " \"%V\" failed", name);
+    }
 
-static ngx_buf_t *
-ngx_http_autoindex_alloc(ngx_http_autoindex_ctx_t *ctx, size_t size)
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+}
+
+
+static char *
+ngx_http_autoindex_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    ngx_chain_t  *cl;
+    ngx_http_autoindex_main_conf_t *amcf = conf;
 
-    if (ctx->buf) {
+    ngx_int_t   n;
+    ngx_str_t  *value, s;
 
-        if ((size_t) (ctx->buf->end - ctx->buf->last) >= size) {
-            return ctx->buf;
+    if (amcf->nlistings != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "has an invalid parameter after \"off\"";
         }
 
-        ctx->size += ctx->buf->last - ctx->buf->pos;
+        amcf->nlistings = 0;
+        return NGX_CONF_OK;
     }
 
-    ctx->buf = ngx_create_temp_buf(ctx->pool, ctx->alloc_size);
-    if (ctx->buf == NULL) {
-        return NULL;
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid number of listings \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
     }
 
-    cl = ngx_alloc_chain_link(ctx->pool);
-    if (cl == NULL) {
-        return NULL;
+    amcf->nlistings = n;
+
+    if (cf->args->nelts == 2) {
+        return NGX_CONF_OK;
     }
 
-    cl->buf = ctx->buf;
-    cl->next = NULL;
+    if (ngx_strncmp(value[2].data, "valid=", 6) == 0) {
+
+        s.len = value[2].len - 6;
+        s.data = value[2].data + 6;
 
-    *ctx->last_out = cl;
-    ctx->last_out = &cl->next;
+        amcf->valid = ngx_parse_time(&s, 1);
+        if (amcf->valid != (time_t) NGX_ERROR) {
+            return NGX_CONF_OK;
+        }
+    }
 
-    return ctx->buf;
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+    return NGX_CONF_ERROR;
 }
 
-#endif
 
+static void *
+ngx_http_autoindex_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_autoindex_main_conf_t  *amcf;
 
-static ngx_int_t
-ngx_http_autoindex_error(ngx_http_request_t *r, ngx_dir_t *dir, ngx_str_t *name)
+    amcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_autoindex_main_conf_t));
+    if (amcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     amcf->listings = NULL;
+     */
+
+    amcf->nlistings = NGX_CONF_UNSET_UINT;
+    amcf->valid = NGX_CONF_UNSET;
+
+    return amcf;
+}
+
+
+static char *
+ngx_http_autoindex_init_main_conf(ngx_conf_t *cf, void *conf)
 {
-    if (ngx_close_dir(dir) == NGX_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
-                      ngx_close_dir_n " \"%V\" failed", name);
+    ngx_http_autoindex_main_conf_t *amcf = conf;
+
+    ngx_conf_init_uint_value(amcf->nlistings, 0);
+    ngx_conf_init_value(amcf->valid, 60);
+
+    if (amcf->nlistings) {
+        amcf->listings = ngx_pcalloc(cf->pool, amcf->nlistings
+                                     * sizeof(ngx_http_autoindex_listing_t *));
+        if (amcf->listings == NULL) {
+            return NGX_CONF_ERROR;
+        }
     }
 
-    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    return NGX_CONF_OK;
 }
 
 
@@ -661,6 +1379,7 @@ ngx_http_autoindex_create_loc_conf(ngx_conf_t *cf)
     }
 
     conf->enable = NGX_CONF_UNSET;
+    conf->format = NGX_CONF_UNSET_UINT;
     conf->localtime = NGX_CONF_UNSET;
     conf->exact_size = NGX_CONF_UNSET;
 
@@ -675,6 +1394,8 @@ ngx_http_autoindex_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_autoindex_loc_conf_t *conf = child;
 
     ngx_conf_merge_value(conf->enable, prev->enable, 0);
+    ngx_conf_merge_uint_value(conf->format, prev->format,
+                              NGX_HTTP_AUTOINDEX_HTML);
     ngx_conf_merge_value(conf->localtime, prev->localtime, 0);
     ngx_conf_merge_value(conf->exact_size, prev->exact_size, 1);
 
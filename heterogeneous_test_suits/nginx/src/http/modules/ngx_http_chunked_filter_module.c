@@ -13,9 +13,15 @@
 typedef struct {
     ngx_chain_t         *free;
     ngx_chain_t         *busy;
+
+    /* the small buffers held to be sent in the next chunk */
+    ngx_chain_t         *pending;
+    ngx_chain_t        **last;
+    off_t                size;
 } ngx_http_chunked_filter_ctx_t;
 
 
+static u_char *ngx_http_chunked_size(u_char *p, off_t size);
 static ngx_int_t ngx_http_chunked_filter_init(ngx_conf_t *cf);
 
 
@@ -96,6 +102,14 @@ ngx_http_chunked_header_filter(ngx_http_request_t *r)
 }
 
 
+/*
+ * The small buffers passed without flush are held and fused into one
+ * chunk with the buffers that follow, as long as the write filter would
+ * have postponed them anyway: nothing waits in it and the data are less
+ * than postpone_output.  This saves the chunk framing and the iovecs of
+ * streams of small buffers, and does not delay them.
+ */
+
 static ngx_int_t
 ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
@@ -103,27 +117,50 @@ ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     off_t                           size;
     ngx_int_t                       rc;
     ngx_buf_t                      *b;
+    ngx_uint_t                      hold, last_buf;
     ngx_chain_t                    *out, *cl, *tl, **ll;
+    ngx_http_core_loc_conf_t       *clcf;
     ngx_http_chunked_filter_ctx_t  *ctx;
 
-    if (in == NULL || !r->chunked || r->header_only) {
+    if (!r->chunked || r->header_only) {
         return ngx_http_next_body_filter(r, in);
     }
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_chunked_filter_module);
 
-    out = NULL;
-    ll = &out;
+    if (in == NULL && ctx->pending == NULL) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    if (ctx->pending) {
+        out = ctx->pending;
+        ll = ctx->last;
+
+    } else {
+        out = NULL;
+        ll = &out;
+    }
 
-    size = 0;
-    cl = in;
+    size = ctx->size;
+    hold = (in != NULL && r->out == NULL);
+    last_buf = 0;
 
-    for ( ;; ) {
+    for (cl = in; cl; cl = cl->next) {
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http chunk: %d", ngx_buf_size(cl->buf));
 
         size += ngx_buf_size(cl->buf);
 
+        /* the write filter does not postpone the recycled buffers either */
+
+        if (cl->buf->flush
+            || cl->buf->recycled
+            || cl->buf->sync
+            || cl->buf->last_buf)
+        {
+            hold = 0;
+        }
+
         if (cl->buf->flush
             || cl->buf->sync
             || ngx_buf_in_memory(cl->buf)
@@ -139,13 +176,32 @@ ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             ll = &tl->next;
         }
 
-        if (cl->next == NULL) {
-            break;
+        if (cl->buf->last_buf) {
+            cl->buf->last_buf = 0;
+            last_buf = 1;
         }
+    }
+
+    *ll = NULL;
+
+    if (hold) {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-        cl = cl->next;
+        if (size < (off_t) clcf->postpone_output) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http chunk held: %O", size);
+
+            ctx->pending = out;
+            ctx->last = ll;
+            ctx->size = size;
+
+            return NGX_OK;
+        }
     }
 
+    ctx->pending = NULL;
+    ctx->size = 0;
+
     if (size) {
         tl = ngx_chain_get_free_buf(r->pool, &ctx->free);
         if (tl == NULL) {
@@ -171,13 +227,13 @@ ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         b->memory = 0;
         b->temporary = 1;
         b->pos = chunk;
-        b->last = ngx_sprintf(chunk, "%xO" CRLF, size);
+        b->last = ngx_http_chunked_size(chunk, size);
 
         tl->next = out;
         out = tl;
     }
 
-    if (cl->buf->last_buf) {
+    if (last_buf) {
         tl = ngx_chain_get_free_buf(r->pool, &ctx->free);
         if (tl == NULL) {
             return NGX_ERROR;
@@ -192,8 +248,6 @@ ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         b->pos = (u_char *) CRLF "0" CRLF CRLF;
         b->last = b->pos + 7;
 
-        cl->buf->last_buf = 0;
-
         *ll = tl;
 
         if (size == 0) {
@@ -215,9 +269,6 @@ ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         b->last = b->pos + 2;
 
         *ll = tl;
-
-    } else {
-        *ll = NULL;
     }
 
     rc = ngx_http_next_body_filter(r, out);
@@ -229,6 +280,35 @@ ngx_http_chunked_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 }
 
 
+/* the size in lowercase hex and CRLF, as "%xO" CRLF */
+
+static u_char *
+ngx_http_chunked_size(u_char *p, off_t size)
+{
+    u_char        *last;
+    off_t          n;
+    static u_char  hex[] = "0123456789abcdef";
+
+    last = p;
+
+    for (n = size; n; n >>= 4) {
+        last++;
+    }
+
+    p = last;
+
+    do {
+        *--p = hex[size & 0xf];
+        size >>= 4;
+    } while (size);
+
+    *last++ = CR;
+    *last++ = LF;
+
+    return last;
+}
+
+
 static ngx_int_t
 ngx_http_chunked_filter_init(ngx_conf_t *cf)
 {
@@ -26,6 +26,13 @@ typedef struct {
     size_t               memlevel;
     ssize_t              min_length;
 
+    ngx_msec_t           level_lag;
+
+#if (NGX_HAVE_PTHREAD)
+    ngx_thread_pool_t   *thread_pool;
+    size_t               thread_min_length;
+#endif
+
     ngx_array_t         *types_keys;
 } ngx_http_gzip_conf_t;
 
@@ -64,9 +71,24 @@ typedef struct {
     uint32_t             crc32;
     z_stream             zstream;
     ngx_http_request_t  *request;
+
+#if (NGX_HAVE_PTHREAD)
+    ngx_thread_pool_t   *thread_pool;
+    ngx_thread_task_t   *thread_task;
+#endif
 } ngx_http_gzip_ctx_t;
 
 
+#if (NGX_HAVE_PTHREAD)
+
+typedef struct {
+    ngx_http_gzip_ctx_t  *ctx;
+    int                   rc;
+} ngx_http_gzip_thread_ctx_t;
+
+#endif
+
+
 #if (NGX_HAVE_LITTLE_ENDIAN && NGX_HAVE_NONALIGNED)
 
 struct gztrailer {
@@ -101,6 +123,13 @@ static ngx_int_t ngx_http_gzip_filter_deflate(ngx_http_request_t *r,
 static ngx_int_t ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 
+#if (NGX_HAVE_PTHREAD)
+static ngx_int_t ngx_http_gzip_filter_deflate_thread(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, int *rc);
+static void ngx_http_gzip_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_gzip_thread_event_handler(ngx_event_t *ev);
+#endif
+
 static void *ngx_http_gzip_filter_alloc(void *opaque, u_int items,
     u_int size);
 static void ngx_http_gzip_filter_free(void *opaque, void *address);
@@ -117,6 +146,10 @@ static char *ngx_http_gzip_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static char *ngx_http_gzip_window(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data);
+#if (NGX_HAVE_PTHREAD)
+static char *ngx_http_gzip_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#endif
 
 
 static ngx_conf_num_bounds_t  ngx_http_gzip_comp_level_bounds = {
@@ -193,6 +226,31 @@ static ngx_command_t  ngx_http_gzip_filter_commands[] = {
       offsetof(ngx_http_gzip_conf_t, min_length),
       NULL },
 
+    { ngx_string("gzip_comp_level_lag"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_conf_t, level_lag),
+      NULL },
+
+#if (NGX_HAVE_PTHREAD)
+
+    { ngx_string("gzip_thread_pool"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_gzip_thread_pool,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("gzip_thread_min_length"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_gzip_conf_t, thread_min_length),
+      NULL },
+
+#endif
+
       ngx_null_command
 };
 
@@ -292,6 +350,23 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
 
     ngx_http_gzip_filter_memory(r, ctx);
 
+#if (NGX_HAVE_PTHREAD)
+
+    /*
+     * large or unknown length responses are compressed in a thread pool,
+     * the decision is made here while the original length is still known
+     */
+
+    if (conf->thread_pool
+        && (r->headers_out.content_length_n == -1
+            || r->headers_out.content_length_n
+               >= (off_t) conf->thread_min_length))
+    {
+        ctx->thread_pool = conf->thread_pool;
+    }
+
+#endif
+
     h = ngx_list_push(&r->headers_out.headers);
     if (h == NULL) {
         return NGX_ERROR;
@@ -328,6 +403,21 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http gzip filter");
 
+#if (NGX_HAVE_PTHREAD)
+
+    if (ctx->thread_task && ctx->thread_task->event.active) {
+
+        /* the zstream is owned by a pool thread, only queue the data */
+
+        if (in && ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+#endif
+
     if (ctx->buffering) {
 
         /*
@@ -427,6 +517,11 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                 goto failed;
             }
 
+            if (rc == NGX_BUSY) {
+                r->connection->buffered |= NGX_HTTP_GZIP_BUFFERED;
+                return NGX_AGAIN;
+            }
+
             /* rc == NGX_AGAIN */
         }
 
@@ -591,11 +686,32 @@ static ngx_int_t
 ngx_http_gzip_filter_deflate_start(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx)
 {
-    int                    rc;
+    int                    rc, level;
     ngx_http_gzip_conf_t  *conf;
 
     conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
 
+    level = (int) conf->level;
+
+    /*
+     * the compression level is lowered while the worker event loop
+     * lags behind: to the half at the half of the threshold, and
+     * to the fastest level at the threshold
+     */
+
+    if (conf->level_lag) {
+
+        if (ngx_event_loop_lag >= conf->level_lag) {
+            level = 1;
+
+        } else if (ngx_event_loop_lag >= conf->level_lag / 2) {
+            level = (level + 1) / 2;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "gzip level:%d lag:%M", level, ngx_event_loop_lag);
+    }
+
     ctx->preallocated = ngx_palloc(r->pool, ctx->allocated);
     if (ctx->preallocated == NULL) {
         return NGX_ERROR;
@@ -607,7 +723,7 @@ ngx_http_gzip_filter_deflate_start(ngx_http_request_t *r,
     ctx->zstream.zfree = ngx_http_gzip_filter_free;
     ctx->zstream.opaque = ctx;
 
-    rc = deflateInit2(&ctx->zstream, (int) conf->level, Z_DEFLATED,
+    rc = deflateInit2(&ctx->zstream, level, Z_DEFLATED,
                       - ctx->wbits, ctx->memlevel, Z_DEFAULT_STRATEGY);
 
     if (rc != Z_OK) {
@@ -770,7 +886,18 @@ ngx_http_gzip_filter_deflate(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
                  ctx->zstream.avail_in, ctx->zstream.avail_out,
                  ctx->flush, ctx->redo);
 
-    rc = deflate(&ctx->zstream, ctx->flush);
+#if (NGX_HAVE_PTHREAD)
+
+    if (ctx->thread_pool) {
+        if (ngx_http_gzip_filter_deflate_thread(r, ctx, &rc) != NGX_OK) {
+            return NGX_BUSY;
+        }
+
+    } else
+#endif
+    {
+        rc = deflate(&ctx->zstream, ctx->flush);
+    }
 
     if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
         ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
@@ -969,6 +1096,90 @@ ngx_http_gzip_filter_deflate_end(ngx_http_request_t *r,
 }
 
 
+#if (NGX_HAVE_PTHREAD)
+
+/*
+ * the deflate() call is posted to the thread pool and NGX_BUSY is returned,
+ * the filter repeats the call with the same zstream once the task event
+ * has completed and gets the saved deflate() result
+ */
+
+static ngx_int_t
+ngx_http_gzip_filter_deflate_thread(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, int *rc)
+{
+    ngx_thread_task_t           *task;
+    ngx_http_gzip_thread_ctx_t  *tctx;
+
+    task = ctx->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(r->pool,
+                                     sizeof(ngx_http_gzip_thread_ctx_t));
+        if (task == NULL) {
+            *rc = Z_STREAM_ERROR;
+            return NGX_OK;
+        }
+
+        task->handler = ngx_http_gzip_thread_handler;
+        task->event.data = r;
+        task->event.handler = ngx_http_gzip_thread_event_handler;
+        task->event.log = r->connection->log;
+
+        ctx->thread_task = task;
+    }
+
+    tctx = task->ctx;
+
+    if (task->event.complete) {
+        task->event.complete = 0;
+
+        *rc = tctx->rc;
+
+        return NGX_OK;
+    }
+
+    tctx->ctx = ctx;
+
+    if (ngx_thread_task_post(ctx->thread_pool, task) != NGX_OK) {
+        *rc = Z_STREAM_ERROR;
+        return NGX_OK;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_http_gzip_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_gzip_thread_ctx_t  *tctx = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "gzip thread handler");
+
+    tctx->rc = deflate(&tctx->ctx->zstream, tctx->ctx->flush);
+}
+
+
+static void
+ngx_http_gzip_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->connection->write->handler(r->connection->write);
+}
+
+#endif
+
+
 static void *
 ngx_http_gzip_filter_alloc(void *opaque, u_int items, u_int size)
 {
@@ -1123,6 +1334,12 @@ ngx_http_gzip_create_conf(ngx_conf_t *cf)
     conf->wbits = NGX_CONF_UNSET_SIZE;
     conf->memlevel = NGX_CONF_UNSET_SIZE;
     conf->min_length = NGX_CONF_UNSET;
+    conf->level_lag = NGX_CONF_UNSET_MSEC;
+
+#if (NGX_HAVE_PTHREAD)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+    conf->thread_min_length = NGX_CONF_UNSET_SIZE;
+#endif
 
     return conf;
 }
@@ -1147,6 +1364,13 @@ ngx_http_gzip_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->memlevel, prev->memlevel,
                               MAX_MEM_LEVEL - 1);
     ngx_conf_merge_value(conf->min_length, prev->min_length, 20);
+    ngx_conf_merge_msec_value(conf->level_lag, prev->level_lag, 0);
+
+#if (NGX_HAVE_PTHREAD)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+    ngx_conf_merge_size_value(conf->thread_min_length,
+                              prev->thread_min_length, 64 * 1024);
+#endif
 
     if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
                              &prev->types_keys, &prev->types,
@@ -1219,3 +1443,34 @@ ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data)
 
     return "must be 512, 1k, 2k, 4k, 8k, 16k, 32k, 64k, or 128k";
 }
+
+
+#if (NGX_HAVE_PTHREAD)
+
+static char *
+ngx_http_gzip_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gzip_conf_t *gcf = conf;
+
+    ngx_str_t  *value;
+
+    if (gcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        gcf->thread_pool = NULL;
+        return NGX_CONF_OK;
+    }
+
+    gcf->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (gcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+#endif
@@ -9,18 +9,65 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_PTHREAD)
+#include <zlib.h>
+#endif
+
 
 #define NGX_HTTP_GZIP_STATIC_OFF     0
 #define NGX_HTTP_GZIP_STATIC_ON      1
 #define NGX_HTTP_GZIP_STATIC_ALWAYS  2
 
 
+#if (NGX_HAVE_PTHREAD)
+
+#define NGX_HTTP_GZIP_STATIC_BUFSIZE  32768
+
+
+typedef struct {
+    ngx_str_t                     path;
+    size_t                        min_length;
+    ngx_int_t                     level;
+    ngx_thread_pool_t            *thread_pool;
+} ngx_http_gzip_static_store_t;
+
+
+typedef struct {
+    u_char                       *src;
+    u_char                       *dst;
+    u_char                       *tmp;
+    ngx_int_t                     level;
+    ngx_pool_t                   *pool;
+    ngx_err_t                     err;
+    char                         *failed;
+    u_char                       *name;
+} ngx_http_gzip_static_job_t;
+
+#endif
+
+
 typedef struct {
-    ngx_uint_t  enable;
+    ngx_uint_t                     enable;
+#if (NGX_HAVE_PTHREAD)
+    ngx_http_gzip_static_store_t  *store;
+#endif
 } ngx_http_gzip_static_conf_t;
 
 
 static ngx_int_t ngx_http_gzip_static_handler(ngx_http_request_t *r);
+#if (NGX_HAVE_PTHREAD)
+static ngx_int_t ngx_http_gzip_static_open(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_str_t *path, ngx_open_file_info_t *of);
+static ngx_int_t ngx_http_gzip_static_store_open(ngx_http_request_t *r,
+    ngx_http_gzip_static_conf_t *gzcf, ngx_http_core_loc_conf_t *clcf,
+    ngx_str_t *path, ngx_open_file_info_t *of);
+static ngx_int_t ngx_http_gzip_static_store_post(ngx_http_request_t *r,
+    ngx_http_gzip_static_store_t *store, ngx_str_t *src, ngx_str_t *dst);
+static void ngx_http_gzip_static_compress(void *data, ngx_log_t *log);
+static void ngx_http_gzip_static_compress_done(ngx_event_t *ev);
+static char *ngx_http_gzip_static_store(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#endif
 static void *ngx_http_gzip_static_create_conf(ngx_conf_t *cf);
 static char *ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
@@ -44,6 +91,17 @@ static ngx_command_t  ngx_http_gzip_static_commands[] = {
       offsetof(ngx_http_gzip_static_conf_t, enable),
       &ngx_http_gzip_static },
 
+#if (NGX_HAVE_PTHREAD)
+
+    { ngx_string("gzip_static_store"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_gzip_static_store,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+#endif
+
       ngx_null_command
 };
 
@@ -165,6 +223,20 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
         case NGX_ENOTDIR:
         case NGX_ENAMETOOLONG:
 
+#if (NGX_HAVE_PTHREAD)
+
+            if (gzcf->store && rc == NGX_OK && of.err == NGX_ENOENT) {
+                rc = ngx_http_gzip_static_store_open(r, gzcf, clcf, &path,
+                                                     &of);
+                if (rc != NGX_OK) {
+                    return rc;
+                }
+
+                goto found;
+            }
+
+#endif
+
             return NGX_DECLINED;
 
         case NGX_EACCES:
@@ -188,6 +260,10 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
+#if (NGX_HAVE_PTHREAD)
+found:
+#endif
+
     if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
         r->gzip_vary = 1;
 
@@ -285,6 +361,322 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 }
 
 
+#if (NGX_HAVE_PTHREAD)
+
+static ngx_int_t
+ngx_http_gzip_static_open(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_str_t *path, ngx_open_file_info_t *of)
+{
+    ngx_memzero(of, sizeof(ngx_open_file_info_t));
+
+    of->read_ahead = clcf->read_ahead;
+    of->directio = clcf->directio;
+    of->valid = clcf->open_file_cache_valid;
+    of->min_uses = clcf->open_file_cache_min_uses;
+    of->errors = clcf->open_file_cache_errors;
+    of->events = clcf->open_file_cache_events;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, path, of) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_open_cached_file(clcf->open_file_cache, path, of, r->pool);
+}
+
+
+/*
+ * the store keeps a compressed copy of a file under the name built
+ * from the file inode, modification time and size, so a changed file
+ * gets a new variant; a missing variant is compressed in a thread pool
+ * while the current response goes through the gzip filter
+ */
+
+static ngx_int_t
+ngx_http_gzip_static_store_open(ngx_http_request_t *r,
+    ngx_http_gzip_static_conf_t *gzcf, ngx_http_core_loc_conf_t *clcf,
+    ngx_str_t *path, ngx_open_file_info_t *of)
+{
+    u_char                        *last;
+    ngx_str_t                      src, name;
+    ngx_open_file_info_t           sof;
+    ngx_http_gzip_static_store_t  *store;
+
+    store = gzcf->store;
+
+    /* the original file name without the ".gz" suffix */
+
+    src.len = path->len - (sizeof(".gz") - 1);
+    src.data = path->data;
+    src.data[src.len] = '\0';
+
+    if (ngx_http_gzip_static_open(r, clcf, &src, &sof) != NGX_OK
+        || !sof.is_file
+        || sof.size < (off_t) store->min_length)
+    {
+        return NGX_DECLINED;
+    }
+
+    name.len = store->path.len + sizeof("/--.gz.tmp") - 1 + 3 * NGX_INT64_LEN;
+
+    name.data = ngx_pnalloc(r->pool, name.len + 1);
+    if (name.data == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    last = ngx_sprintf(name.data, "%V/%xL-%xT-%xO.gz%Z",
+                       &store->path, (uint64_t) sof.uniq, sof.mtime, sof.size);
+
+    name.len = last - name.data - 1;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http gzip store: \"%s\"", name.data);
+
+    if (ngx_http_gzip_static_open(r, clcf, &name, of) == NGX_OK) {
+        *path = name;
+        return NGX_OK;
+    }
+
+    if (of->err != NGX_ENOENT) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, of->err,
+                      "%s \"%s\" failed", of->failed, name.data);
+        return NGX_DECLINED;
+    }
+
+    (void) ngx_http_gzip_static_store_post(r, store, &src, &name);
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_static_store_post(ngx_http_request_t *r,
+    ngx_http_gzip_static_store_t *store, ngx_str_t *src, ngx_str_t *dst)
+{
+    u_char                      *p;
+    ngx_pool_t                  *pool;
+    ngx_thread_task_t           *task;
+    ngx_http_gzip_static_job_t  *job;
+
+    /* the job outlives the request, so it has its own pool */
+
+    pool = ngx_create_pool(1024, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    task = ngx_thread_task_alloc(pool, sizeof(ngx_http_gzip_static_job_t));
+    if (task == NULL) {
+        goto failed;
+    }
+
+    job = task->ctx;
+
+    job->src = ngx_pnalloc(pool, src->len + 1 + 2 * (dst->len + 1)
+                                 + sizeof(".tmp") - 1);
+    if (job->src == NULL) {
+        goto failed;
+    }
+
+    p = ngx_cpymem(job->src, src->data, src->len + 1);
+
+    job->dst = p;
+    p = ngx_cpymem(p, dst->data, dst->len + 1);
+
+    job->tmp = p;
+    p = ngx_cpymem(p, dst->data, dst->len);
+    (void) ngx_cpystrn(p, (u_char *) ".tmp", sizeof(".tmp"));
+
+    job->level = store->level;
+    job->pool = pool;
+
+    task->handler = ngx_http_gzip_static_compress;
+    task->event.data = job;
+    task->event.handler = ngx_http_gzip_static_compress_done;
+    task->event.log = pool->log;
+
+    if (ngx_thread_task_post(store->thread_pool, task) != NGX_OK) {
+        goto failed;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_gzip_static_compress(void *data, ngx_log_t *log)
+{
+    ngx_http_gzip_static_job_t  *job = data;
+
+    int              rc, flush;
+    u_char          *p;
+    size_t           size;
+    ssize_t          n;
+    z_stream         zs;
+    ngx_fd_t         fd, tfd;
+    ngx_file_info_t  fi;
+    u_char           in[NGX_HTTP_GZIP_STATIC_BUFSIZE];
+    u_char           out[NGX_HTTP_GZIP_STATIC_BUFSIZE];
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "gzip store compress: \"%s\"", job->src);
+
+    if (ngx_file_info(job->dst, &fi) != NGX_FILE_ERROR) {
+
+        /* compressed meanwhile by another worker */
+
+        return;
+    }
+
+    /*
+     * the exclusively created temporary file serializes compression
+     * of the same variant between workers; the one left by a crashed
+     * worker is removed after a minute
+     */
+
+    tfd = ngx_open_tempfile(job->tmp, 1, NGX_FILE_DEFAULT_ACCESS);
+
+    if (tfd == NGX_INVALID_FILE && ngx_errno == NGX_EEXIST
+        && ngx_file_info(job->tmp, &fi) != NGX_FILE_ERROR
+        && ngx_file_mtime(&fi) + 60 < ngx_time())
+    {
+        (void) ngx_delete_file(job->tmp);
+
+        tfd = ngx_open_tempfile(job->tmp, 1, NGX_FILE_DEFAULT_ACCESS);
+    }
+
+    if (tfd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_EEXIST) {
+            job->err = ngx_errno;
+            job->failed = ngx_open_tempfile_n;
+            job->name = job->tmp;
+        }
+
+        return;
+    }
+
+    fd = ngx_open_file(job->src, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        job->err = ngx_errno;
+        job->failed = ngx_open_file_n;
+        job->name = job->src;
+        goto failed;
+    }
+
+    ngx_memzero(&zs, sizeof(z_stream));
+
+    /* the window bits over 15 make zlib write the gzip header and trailer */
+
+    rc = deflateInit2(&zs, (int) job->level, Z_DEFLATED, MAX_WBITS + 16,
+                      MAX_MEM_LEVEL - 1, Z_DEFAULT_STRATEGY);
+
+    if (rc != Z_OK) {
+        job->failed = "deflateInit2()";
+        job->name = job->src;
+        goto close;
+    }
+
+    do {
+        n = ngx_read_fd(fd, in, NGX_HTTP_GZIP_STATIC_BUFSIZE);
+
+        if (n == -1) {
+            job->err = ngx_errno;
+            job->failed = ngx_read_fd_n;
+            job->name = job->src;
+            goto end;
+        }
+
+        zs.next_in = in;
+        zs.avail_in = n;
+        flush = (n == 0) ? Z_FINISH : Z_NO_FLUSH;
+
+        do {
+            zs.next_out = out;
+            zs.avail_out = NGX_HTTP_GZIP_STATIC_BUFSIZE;
+
+            rc = deflate(&zs, flush);
+
+            if (rc == Z_STREAM_ERROR) {
+                job->failed = "deflate()";
+                job->name = job->src;
+                goto end;
+            }
+
+            size = NGX_HTTP_GZIP_STATIC_BUFSIZE - zs.avail_out;
+
+            for (p = out; size; p += n, size -= n) {
+                n = ngx_write_fd(tfd, p, size);
+
+                if (n == -1) {
+                    job->err = ngx_errno;
+                    job->failed = ngx_write_fd_n;
+                    job->name = job->tmp;
+                    goto end;
+                }
+            }
+
+        } while (zs.avail_out == 0);
+
+    } while (flush != Z_FINISH);
+
+    (void) deflateEnd(&zs);
+
+    (void) ngx_close_file(fd);
+
+    if (ngx_close_file(tfd) == NGX_FILE_ERROR) {
+        job->err = ngx_errno;
+        job->failed = ngx_close_file_n;
+        job->name = job->tmp;
+        (void) ngx_delete_file(job->tmp);
+        return;
+    }
+
+    if (ngx_rename_file(job->tmp, job->dst) == NGX_FILE_ERROR) {
+        job->err = ngx_errno;
+        job->failed = ngx_rename_file_n;
+        job->name = job->tmp;
+        (void) ngx_delete_file(job->tmp);
+    }
+
+    return;
+
+end:
+
+    (void) deflateEnd(&zs);
+
+close:
+
+    (void) ngx_close_file(fd);
+
+failed:
+
+    (void) ngx_close_file(tfd);
+    (void) ngx_delete_file(job->tmp);
+}
+
+
+static void
+ngx_http_gzip_static_compress_done(ngx_event_t *ev)
+{
+    ngx_http_gzip_static_job_t  *job = ev->data;
+
+    if (job->failed) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, job->err,
+                      "gzip store %s \"%s\" failed", job->failed, job->name);
+    }
+
+    ngx_destroy_pool(job->pool);
+}
+
+#endif
+
+
 static void *
 ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
 {
@@ -296,6 +688,9 @@ ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
     }
 
     conf->enable = NGX_CONF_UNSET_UINT;
+#if (NGX_HAVE_PTHREAD)
+    conf->store = NGX_CONF_UNSET_PTR;
+#endif
 
     return conf;
 }
@@ -309,6 +704,9 @@ ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_uint_value(conf->enable, prev->enable,
                               NGX_HTTP_GZIP_STATIC_OFF);
+#if (NGX_HAVE_PTHREAD)
+    ngx_conf_merge_ptr_value(conf->store, prev->store, NULL);
+#endif
 
     return NGX_CONF_OK;
 }
@@ -331,3 +729,112 @@ ngx_http_gzip_static_init(ngx_conf_t *cf)
 
     return NGX_OK;
 }
+
+
+#if (NGX_HAVE_PTHREAD)
+
+static char *
+ngx_http_gzip_static_store(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gzip_static_conf_t *gzcf = conf;
+
+    ssize_t                        size;
+    ngx_str_t                     *value, s, *name;
+    ngx_uint_t                     i;
+    ngx_http_gzip_static_store_t  *store;
+
+    if (gzcf->store != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        if (cf->args->nelts != 2) {
+            return "takes no parameters with \"off\"";
+        }
+
+        gzcf->store = NULL;
+        return NGX_CONF_OK;
+    }
+
+    store = ngx_pcalloc(cf->pool, sizeof(ngx_http_gzip_static_store_t));
+    if (store == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    store->path = value[1];
+
+    if (store->path.data[store->path.len - 1] == '/') {
+        store->path.len--;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, &store->path, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    store->min_length = 1024;
+    store->level = 9;
+    name = NULL;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "min_length=", 11) == 0) {
+
+            s.len = value[i].len - 11;
+            s.data = value[i].data + 11;
+
+            size = ngx_parse_size(&s);
+            if (size == NGX_ERROR) {
+                goto invalid;
+            }
+
+            store->min_length = size;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "level=", 6) == 0) {
+
+            store->level = ngx_atoi(value[i].data + 6, value[i].len - 6);
+            if (store->level < 1 || store->level > 9) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "thread_pool=", 12) == 0) {
+
+            name = ngx_palloc(cf->pool, sizeof(ngx_str_t));
+            if (name == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            name->len = value[i].len - 12;
+            name->data = value[i].data + 12;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    store->thread_pool = ngx_thread_pool_add(cf, name);
+    if (store->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    gzcf->store = store;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+#endif
@@ -46,6 +46,11 @@ typedef struct {
     ngx_http_expires_t       expires;
     time_t                   expires_time;
     ngx_array_t             *headers;
+
+    /* the headers above split into per request and constant ones */
+    ngx_array_t             *dynamic;
+    ngx_http_header_block_t *block;
+    ngx_flag_t               compiled;
 } ngx_http_headers_conf_t;
 
 
@@ -63,6 +68,8 @@ static ngx_int_t ngx_http_set_response_header(ngx_http_request_t *r,
 static void *ngx_http_headers_create_conf(ngx_conf_t *cf);
 static char *ngx_http_headers_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static ngx_int_t ngx_http_headers_compile(ngx_conf_t *cf,
+    ngx_http_headers_conf_t *conf);
 static ngx_int_t ngx_http_headers_filter_init(ngx_conf_t *cf);
 static char *ngx_http_headers_expires(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -170,9 +177,11 @@ ngx_http_headers_filter(ngx_http_request_t *r)
         }
     }
 
-    if (conf->headers) {
-        h = conf->headers->elts;
-        for (i = 0; i < conf->headers->nelts; i++) {
+    r->headers_out.header_block = conf->block;
+
+    if (conf->dynamic) {
+        h = conf->dynamic->elts;
+        for (i = 0; i < conf->dynamic->nelts; i++) {
 
             if (ngx_http_complex_value(r, &h[i].value, &value) != NGX_OK) {
                 return NGX_ERROR;
@@ -266,6 +275,7 @@ ngx_http_set_expires(ngx_http_request_t *r, ngx_http_headers_conf_t *conf)
     }
 
     if (conf->expires_time == 0 && conf->expires != NGX_HTTP_EXPIRES_DAILY) {
+        ngx_time_strings();
         ngx_memcpy(expires->value.data, ngx_cached_http_time.data,
                    ngx_cached_http_time.len + 1);
         ngx_str_set(&cc->value, "max-age=0");
@@ -445,6 +455,9 @@ ngx_http_headers_create_conf(ngx_conf_t *cf)
      *
      *     conf->headers = NULL;
      *     conf->expires_time = 0;
+     *     conf->dynamic = NULL;
+     *     conf->block = NULL;
+     *     conf->compiled = 0;
      */
 
     conf->expires = NGX_HTTP_EXPIRES_UNSET;
@@ -469,13 +482,135 @@ ngx_http_headers_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     }
 
     if (conf->headers == NULL) {
+        if (ngx_http_headers_compile(cf, prev) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
         conf->headers = prev->headers;
+        conf->dynamic = prev->dynamic;
+        conf->block = prev->block;
+        conf->compiled = 1;
+
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_http_headers_compile(cf, conf) != NGX_OK) {
+        return NGX_CONF_ERROR;
     }
 
     return NGX_CONF_OK;
 }
 
 
+static ngx_int_t
+ngx_http_headers_compile(ngx_conf_t *cf, ngx_http_headers_conf_t *conf)
+{
+    u_char                   *p;
+    size_t                    len;
+    ngx_uint_t                i, n;
+    ngx_table_elt_t          *t;
+    ngx_http_header_val_t    *h, *hv;
+    ngx_http_header_block_t  *block;
+
+    if (conf->compiled || conf->headers == NULL) {
+        return NGX_OK;
+    }
+
+    conf->compiled = 1;
+
+    /*
+     * add_header values without variables are serialized once here and
+     * copied into the response header as a single block, the rest are
+     * evaluated per request
+     */
+
+    len = 0;
+    n = 0;
+
+    h = conf->headers->elts;
+    for (i = 0; i < conf->headers->nelts; i++) {
+
+        if (h[i].handler != ngx_http_add_header || h[i].value.lengths) {
+            continue;
+        }
+
+        if (h[i].value.value.len) {
+            len += h[i].key.len + sizeof(": ") - 1 + h[i].value.value.len
+                   + sizeof(CRLF) - 1;
+            n++;
+        }
+    }
+
+    if (n == 0) {
+        conf->dynamic = conf->headers;
+        return NGX_OK;
+    }
+
+    block = ngx_palloc(cf->pool, sizeof(ngx_http_header_block_t));
+    if (block == NULL) {
+        return NGX_ERROR;
+    }
+
+    block->text.data = ngx_pnalloc(cf->pool, len);
+    if (block->text.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    block->text.len = len;
+
+    t = ngx_palloc(cf->pool, n * sizeof(ngx_table_elt_t));
+    if (t == NULL) {
+        return NGX_ERROR;
+    }
+
+    block->part.elts = t;
+    block->part.nelts = n;
+    block->part.next = NULL;
+
+    p = block->text.data;
+
+    for (i = 0; i < conf->headers->nelts; i++) {
+
+        if (h[i].handler == ngx_http_add_header && h[i].value.lengths == NULL) {
+
+            if (h[i].value.value.len) {
+                t->hash = 1;
+                t->key = h[i].key;
+                t->value = h[i].value.value;
+                t->lowcase_key = NULL;
+                t++;
+
+                p = ngx_copy(p, h[i].key.data, h[i].key.len);
+                *p++ = ':'; *p++ = ' ';
+                p = ngx_copy(p, h[i].value.value.data, h[i].value.value.len);
+                *p++ = CR; *p++ = LF;
+            }
+
+            continue;
+        }
+
+        if (conf->dynamic == NULL) {
+            conf->dynamic = ngx_array_create(cf->pool, 1,
+                                             sizeof(ngx_http_header_val_t));
+            if (conf->dynamic == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        hv = ngx_array_push(conf->dynamic);
+        if (hv == NULL) {
+            return NGX_ERROR;
+        }
+
+        *hv = h[i];
+    }
+
+    conf->block = block;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_headers_filter_init(ngx_conf_t *cf)
 {
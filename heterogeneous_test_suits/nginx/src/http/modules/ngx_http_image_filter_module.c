@@ -8,6 +8,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 #include <gd.h>
 
@@ -53,6 +54,12 @@ typedef struct {
     ngx_http_complex_value_t    *shcv;
 
     size_t                       buffer_size;
+
+    ngx_str_t                   *store;
+
+#if (NGX_HAVE_PTHREAD)
+    ngx_thread_pool_t           *thread_pool;
+#endif
 } ngx_http_image_filter_conf_t;
 
 
@@ -71,6 +78,33 @@ typedef struct {
     ngx_uint_t                   phase;
     ngx_uint_t                   type;
     ngx_uint_t                   force;
+
+    /* the transform parameters, evaluated before the transform starts */
+
+    ngx_http_image_filter_conf_t *conf;
+    ngx_int_t                    jpeg_quality;
+    ngx_int_t                    sharpen;
+
+    /* the transform result */
+
+    u_char                      *out;
+    int                          size;
+    char                        *failed;
+
+    /* the store variant name and its errors */
+
+    u_char                      *name;
+    u_char                      *tmp;
+    char                        *store_failed;
+    u_char                      *store_name;
+    ngx_err_t                    store_err;
+
+#if (NGX_HAVE_PTHREAD)
+    ngx_thread_task_t           *thread_task;
+#endif
+
+    unsigned                     asis:1;
+    unsigned                     stored:1;
 } ngx_http_image_filter_ctx_t;
 
 
@@ -89,13 +123,27 @@ static ngx_int_t ngx_http_image_size(ngx_http_request_t *r,
 
 static ngx_buf_t *ngx_http_image_resize(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx);
-static gdImagePtr ngx_http_image_source(ngx_http_request_t *r,
+static void ngx_http_image_job(ngx_http_image_filter_ctx_t *ctx,
+    ngx_log_t *log);
+static ngx_buf_t *ngx_http_image_result(ngx_http_request_t *r,
     ngx_http_image_filter_ctx_t *ctx);
-static gdImagePtr ngx_http_image_new(ngx_http_request_t *r, int w, int h,
-    int colors);
-static u_char *ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type,
+static u_char *ngx_http_image_transform(ngx_http_image_filter_ctx_t *ctx,
+    ngx_log_t *log);
+static gdImagePtr ngx_http_image_source(ngx_http_image_filter_ctx_t *ctx);
+static gdImagePtr ngx_http_image_new(ngx_http_image_filter_ctx_t *ctx, int w,
+    int h, int colors);
+static u_char *ngx_http_image_out(ngx_http_image_filter_ctx_t *ctx,
     gdImagePtr img, int *size);
 static void ngx_http_image_cleanup(void *data);
+static void ngx_http_image_store_key(ngx_http_image_filter_ctx_t *ctx);
+static ngx_int_t ngx_http_image_store_read(ngx_http_image_filter_ctx_t *ctx,
+    ngx_log_t *log);
+static void ngx_http_image_store_write(ngx_http_image_filter_ctx_t *ctx);
+static void ngx_http_image_store_cleanup(void *data);
+#if (NGX_HAVE_PTHREAD)
+static void ngx_http_image_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_image_thread_event_handler(ngx_event_t *ev);
+#endif
 static ngx_uint_t ngx_http_image_filter_get_value(ngx_http_request_t *r,
     ngx_http_complex_value_t *cv, ngx_uint_t v);
 static ngx_uint_t ngx_http_image_filter_value(ngx_str_t *value);
@@ -110,6 +158,12 @@ static char *ngx_http_image_filter_jpeg_quality(ngx_conf_t *cf,
     ngx_command_t *cmd, void *conf);
 static char *ngx_http_image_filter_sharpen(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_image_filter_store(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#if (NGX_HAVE_PTHREAD)
+static char *ngx_http_image_filter_thread_pool(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+#endif
 static ngx_int_t ngx_http_image_filter_init(ngx_conf_t *cf);
 
 
@@ -150,6 +204,24 @@ static ngx_command_t  ngx_http_image_filter_commands[] = {
       offsetof(ngx_http_image_filter_conf_t, buffer_size),
       NULL },
 
+    { ngx_string("image_filter_store"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_image_filter_store,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+#if (NGX_HAVE_PTHREAD)
+
+    { ngx_string("image_filter_thread_pool"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_image_filter_thread_pool,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+#endif
+
       ngx_null_command
 };
 
@@ -278,16 +350,16 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "image filter");
 
-    if (in == NULL) {
-        return ngx_http_next_body_filter(r, in);
-    }
-
     ctx = ngx_http_get_module_ctx(r, ngx_http_image_filter_module);
 
     if (ctx == NULL) {
         return ngx_http_next_body_filter(r, in);
     }
 
+    if (in == NULL && ctx->phase != NGX_HTTP_IMAGE_PROCESS) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
     switch (ctx->phase) {
 
     case NGX_HTTP_IMAGE_START:
@@ -345,22 +417,25 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                                               NGX_HTTP_UNSUPPORTED_MEDIA_TYPE);
         }
 
-        /* fall through */
+        out.buf = ngx_http_image_process(r);
 
-    case NGX_HTTP_IMAGE_PROCESS:
+        break;
 
-        out.buf = ngx_http_image_process(r);
+#if (NGX_HAVE_PTHREAD)
 
-        if (out.buf == NULL) {
-            return ngx_http_filter_finalize_request(r,
-                                              &ngx_http_image_filter_module,
-                                              NGX_HTTP_UNSUPPORTED_MEDIA_TYPE);
+    case NGX_HTTP_IMAGE_PROCESS:
+
+        if (!ctx->thread_task->event.complete) {
+            return NGX_AGAIN;
         }
 
-        out.next = NULL;
         ctx->phase = NGX_HTTP_IMAGE_PASS;
 
-        return ngx_http_image_send(r, ctx, &out);
+        out.buf = ngx_http_image_result(r, ctx);
+
+        break;
+
+#endif
 
     case NGX_HTTP_IMAGE_PASS:
 
@@ -373,6 +448,23 @@ ngx_http_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         /* NGX_ERROR resets any pending data */
         return (rc == NGX_OK) ? NGX_ERROR : rc;
     }
+
+    if (out.buf == NULL) {
+
+        if (ctx->phase == NGX_HTTP_IMAGE_PROCESS) {
+            /* the image is being transformed in a thread */
+            return NGX_AGAIN;
+        }
+
+        return ngx_http_filter_finalize_request(r,
+                                              &ngx_http_image_filter_module,
+                                              NGX_HTTP_UNSUPPORTED_MEDIA_TYPE);
+    }
+
+    out.next = NULL;
+    ctx->phase = NGX_HTTP_IMAGE_PASS;
+
+    return ngx_http_image_send(r, ctx, &out);
 }
 
 
@@ -735,17 +827,181 @@ ngx_http_image_size(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 static ngx_buf_t *
 ngx_http_image_resize(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 {
-    int                            sx, sy, dx, dy, ox, oy, ax, ay, size,
-                                   colors, palette, transparent, sharpen,
+    size_t                         len;
+    ngx_http_image_filter_conf_t  *conf;
+#if (NGX_HAVE_PTHREAD)
+    ngx_thread_task_t             *task;
+#endif
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
+
+    /*
+     * the variables are evaluated here, so the transform itself does not
+     * touch the request and may run in a thread
+     */
+
+    ctx->conf = conf;
+
+    if (ctx->type == NGX_HTTP_IMAGE_JPEG) {
+        ctx->jpeg_quality = ngx_http_image_filter_get_value(r, conf->jqcv,
+                                                          conf->jpeg_quality);
+        if (ctx->jpeg_quality <= 0) {
+            return NULL;
+        }
+    }
+
+    ctx->sharpen = ngx_http_image_filter_get_value(r, conf->shcv,
+                                                   conf->sharpen);
+
+    if (conf->store) {
+        len = conf->store->len + sizeof("/") - 1 + 2 * 16;
+
+        ctx->name = ngx_pnalloc(r->pool, len + 1);
+        if (ctx->name == NULL) {
+            return NULL;
+        }
+
+        ctx->tmp = ngx_pnalloc(r->pool, len + sizeof(".tmp"));
+        if (ctx->tmp == NULL) {
+            return NULL;
+        }
+
+        ngx_memcpy(ctx->name, conf->store->data, conf->store->len);
+        ctx->name[conf->store->len] = '/';
+    }
+
+#if (NGX_HAVE_PTHREAD)
+
+    if (conf->thread_pool) {
+        task = ngx_thread_task_alloc(r->pool, 0);
+        if (task == NULL) {
+            return NULL;
+        }
+
+        task->ctx = ctx;
+        task->handler = ngx_http_image_thread_handler;
+        task->event.data = r;
+        task->event.handler = ngx_http_image_thread_event_handler;
+        task->event.log = r->connection->log;
+
+        if (ngx_thread_task_post(conf->thread_pool, task) != NGX_OK) {
+            return NULL;
+        }
+
+        ctx->thread_task = task;
+        ctx->phase = NGX_HTTP_IMAGE_PROCESS;
+
+        r->connection->buffered |= NGX_HTTP_IMAGE_BUFFERED;
+        r->main->blocked++;
+        r->aio = 1;
+
+        return NULL;
+    }
+
+#endif
+
+    ngx_http_image_job(ctx, r->connection->log);
+
+    return ngx_http_image_result(r, ctx);
+}
+
+
+/*
+ * the job looks up the transformed image in the store and transforms
+ * the image only if there is no stored variant yet; it runs either
+ * inline or in a thread and reports errors in the context only
+ */
+
+static void
+ngx_http_image_job(ngx_http_image_filter_ctx_t *ctx, ngx_log_t *log)
+{
+    if (ctx->name) {
+        ngx_http_image_store_key(ctx);
+
+        if (ngx_http_image_store_read(ctx, log) == NGX_OK) {
+            return;
+        }
+    }
+
+    ctx->out = ngx_http_image_transform(ctx, log);
+
+    if (ctx->out && ctx->name) {
+        ngx_http_image_store_write(ctx);
+    }
+}
+
+
+static ngx_buf_t *
+ngx_http_image_result(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
+{
+    ngx_buf_t            *b;
+    ngx_pool_cleanup_t   *cln;
+    ngx_pool_cleanup_pt   handler;
+
+    r->connection->buffered &= ~NGX_HTTP_IMAGE_BUFFERED;
+
+    if (ctx->store_failed) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ctx->store_err,
+                      "image filter store %s \"%s\" failed",
+                      ctx->store_failed, ctx->store_name);
+    }
+
+    if (ctx->asis) {
+        return ngx_http_image_asis(r, ctx);
+    }
+
+    ngx_pfree(r->pool, ctx->image);
+
+    if (ctx->out == NULL) {
+
+        if (ctx->failed) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, ctx->failed);
+        }
+
+        return NULL;
+    }
+
+    handler = ctx->stored ? ngx_http_image_store_cleanup
+                          : ngx_http_image_cleanup;
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        handler(ctx->out);
+        return NULL;
+    }
+
+    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
+    if (b == NULL) {
+        handler(ctx->out);
+        return NULL;
+    }
+
+    cln->handler = handler;
+    cln->data = ctx->out;
+
+    b->pos = ctx->out;
+    b->last = ctx->out + ctx->size;
+    b->memory = 1;
+    b->last_buf = 1;
+
+    ngx_http_image_length(r, b);
+
+    return b;
+}
+
+
+static u_char *
+ngx_http_image_transform(ngx_http_image_filter_ctx_t *ctx, ngx_log_t *log)
+{
+    int                            sx, sy, dx, dy, ox, oy, ax, ay,
+                                   colors, palette, transparent,
                                    red, green, blue, t;
     u_char                        *out;
-    ngx_buf_t                     *b;
     ngx_uint_t                     resize;
     gdImagePtr                     src, dst;
-    ngx_pool_cleanup_t            *cln;
     ngx_http_image_filter_conf_t  *conf;
 
-    src = ngx_http_image_source(r, ctx);
+    src = ngx_http_image_source(ctx);
 
     if (src == NULL) {
         return NULL;
@@ -754,7 +1010,7 @@ ngx_http_image_resize(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
     sx = gdImageSX(src);
     sy = gdImageSY(src);
 
-    conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
+    conf = ctx->conf;
 
     if (!ctx->force
         && ctx->angle == 0
@@ -762,7 +1018,8 @@ ngx_http_image_resize(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
         && (ngx_uint_t) sy <= ctx->max_height)
     {
         gdImageDestroy(src);
-        return ngx_http_image_asis(r, ctx);
+        ctx->asis = 1;
+        return NULL;
     }
 
     colors = gdImageColorsTotal(src);
@@ -836,7 +1093,7 @@ transparent:
     }
 
     if (resize) {
-        dst = ngx_http_image_new(r, dx, dy, palette);
+        dst = ngx_http_image_new(ctx, dx, dy, palette);
         if (dst == NULL) {
             gdImageDestroy(src);
             return NULL;
@@ -869,7 +1126,7 @@ transparent:
 
         case 90:
         case 270:
-            dst = ngx_http_image_new(r, dy, dx, palette);
+            dst = ngx_http_image_new(ctx, dy, dx, palette);
             if (dst == NULL) {
                 gdImageDestroy(src);
                 return NULL;
@@ -893,7 +1150,7 @@ transparent:
             break;
 
         case 180:
-            dst = ngx_http_image_new(r, dx, dy, palette);
+            dst = ngx_http_image_new(ctx, dx, dy, palette);
             if (dst == NULL) {
                 gdImageDestroy(src);
                 return NULL;
@@ -925,7 +1182,7 @@ transparent:
 
         if (ox || oy) {
 
-            dst = ngx_http_image_new(r, dx - ox, dy - oy, colors);
+            dst = ngx_http_image_new(ctx, dx - ox, dy - oy, colors);
 
             if (dst == NULL) {
                 gdImageDestroy(src);
@@ -935,7 +1192,7 @@ transparent:
             ox /= 2;
             oy /= 2;
 
-            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, log, 0,
                            "image crop: %d x %d @ %d x %d",
                            dx, dy, ox, oy);
 
@@ -958,51 +1215,23 @@ transparent:
         gdImageColorTransparent(dst, gdImageColorExact(dst, red, green, blue));
     }
 
-    sharpen = ngx_http_image_filter_get_value(r, conf->shcv, conf->sharpen);
-    if (sharpen > 0) {
-        gdImageSharpen(dst, sharpen);
+    if (ctx->sharpen > 0) {
+        gdImageSharpen(dst, ctx->sharpen);
     }
 
-    out = ngx_http_image_out(r, ctx->type, dst, &size);
+    out = ngx_http_image_out(ctx, dst, &ctx->size);
 
-    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, log, 0,
                    "image: %d x %d %d", sx, sy, colors);
 
     gdImageDestroy(dst);
-    ngx_pfree(r->pool, ctx->image);
-
-    if (out == NULL) {
-        return NULL;
-    }
-
-    cln = ngx_pool_cleanup_add(r->pool, 0);
-    if (cln == NULL) {
-        gdFree(out);
-        return NULL;
-    }
 
-    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
-    if (b == NULL) {
-        gdFree(out);
-        return NULL;
-    }
-
-    cln->handler = ngx_http_image_cleanup;
-    cln->data = out;
-
-    b->pos = out;
-    b->last = out + size;
-    b->memory = 1;
-    b->last_buf = 1;
-
-    ngx_http_image_length(r, b);
-
-    return b;
+    return out;
 }
 
 
 static gdImagePtr
-ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
+ngx_http_image_source(ngx_http_image_filter_ctx_t *ctx)
 {
     char        *failed;
     gdImagePtr   img;
@@ -1032,7 +1261,7 @@ ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
     }
 
     if (img == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, failed);
+        ctx->failed = failed;
     }
 
     return img;
@@ -1040,7 +1269,8 @@ ngx_http_image_source(ngx_http_request_t *r, ngx_http_image_filter_ctx_t *ctx)
 
 
 static gdImagePtr
-ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
+ngx_http_image_new(ngx_http_image_filter_ctx_t *ctx, int w, int h,
+    int colors)
 {
     gdImagePtr  img;
 
@@ -1048,8 +1278,7 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
         img = gdImageCreateTrueColor(w, h);
 
         if (img == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "gdImageCreateTrueColor() failed");
+            ctx->failed = "gdImageCreateTrueColor() failed";
             return NULL;
         }
 
@@ -1057,8 +1286,7 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
         img = gdImageCreate(w, h);
 
         if (img == NULL) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "gdImageCreate() failed");
+            ctx->failed = "gdImageCreate() failed";
             return NULL;
         }
     }
@@ -1068,27 +1296,18 @@ ngx_http_image_new(ngx_http_request_t *r, int w, int h, int colors)
 
 
 static u_char *
-ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type, gdImagePtr img,
+ngx_http_image_out(ngx_http_image_filter_ctx_t *ctx, gdImagePtr img,
     int *size)
 {
-    char                          *failed;
-    u_char                        *out;
-    ngx_int_t                      jq;
-    ngx_http_image_filter_conf_t  *conf;
+    char    *failed;
+    u_char  *out;
 
     out = NULL;
 
-    switch (type) {
+    switch (ctx->type) {
 
     case NGX_HTTP_IMAGE_JPEG:
-        conf = ngx_http_get_module_loc_conf(r, ngx_http_image_filter_module);
-
-        jq = ngx_http_image_filter_get_value(r, conf->jqcv, conf->jpeg_quality);
-        if (jq <= 0) {
-            return NULL;
-        }
-
-        out = gdImageJpegPtr(img, size, jq);
+        out = gdImageJpegPtr(img, size, ctx->jpeg_quality);
         failed = "gdImageJpegPtr() failed";
         break;
 
@@ -1108,7 +1327,7 @@ ngx_http_image_out(ngx_http_request_t *r, ngx_uint_t type, gdImagePtr img,
     }
 
     if (out == NULL) {
-        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, failed);
+        ctx->failed = failed;
     }
 
     return out;
@@ -1122,6 +1341,217 @@ ngx_http_image_cleanup(void *data)
 }
 
 
+/*
+ * the store keeps transformed images under the MD5 of the source image
+ * and of the transform parameters, so a changed image or changed
+ * parameters get a new variant
+ */
+
+static void
+ngx_http_image_store_key(ngx_http_image_filter_ctx_t *ctx)
+{
+    u_char      *p;
+    ngx_md5_t    md5;
+    ngx_uint_t   key[7];
+    u_char       digest[16];
+
+    key[0] = ctx->conf->filter;
+    key[1] = ctx->max_width;
+    key[2] = ctx->max_height;
+    key[3] = ctx->angle;
+    key[4] = (ngx_uint_t) ctx->jpeg_quality;
+    key[5] = (ngx_uint_t) ctx->sharpen;
+    key[6] = (ngx_uint_t) ctx->conf->transparency;
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, ctx->image, ctx->last - ctx->image);
+    ngx_md5_update(&md5, key, sizeof(key));
+    ngx_md5_final(digest, &md5);
+
+    p = ngx_hex_dump(ctx->name + ctx->conf->store->len + 1, digest, 16);
+    *p = '\0';
+
+    p = ngx_cpymem(ctx->tmp, ctx->name, p - ctx->name);
+    (void) ngx_cpystrn(p, (u_char *) ".tmp", sizeof(".tmp"));
+}
+
+
+static ngx_int_t
+ngx_http_image_store_read(ngx_http_image_filter_ctx_t *ctx, ngx_log_t *log)
+{
+    u_char           *p;
+    size_t            size;
+    ssize_t           n;
+    ngx_fd_t          fd;
+    ngx_file_info_t   fi;
+
+    fd = ngx_open_file(ctx->name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ctx->store_err = ngx_errno;
+            ctx->store_failed = ngx_open_file_n;
+            ctx->store_name = ctx->name;
+        }
+
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "image store hit: \"%s\"", ctx->name);
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ctx->store_err = ngx_errno;
+        ctx->store_failed = ngx_fd_info_n;
+        ctx->store_name = ctx->name;
+        goto failed;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size == 0 || size > NGX_MAX_INT32_VALUE) {
+        goto failed;
+    }
+
+    ctx->out = ngx_alloc(size, log);
+    if (ctx->out == NULL) {
+        goto failed;
+    }
+
+    ctx->size = (int) size;
+
+    for (p = ctx->out; size; p += n, size -= n) {
+        n = ngx_read_fd(fd, p, size);
+
+        if (n == -1 || n == 0) {
+            ctx->store_err = (n == -1) ? ngx_errno : 0;
+            ctx->store_failed = ngx_read_fd_n;
+            ctx->store_name = ctx->name;
+
+            ngx_free(ctx->out);
+            ctx->out = NULL;
+
+            goto failed;
+        }
+    }
+
+    (void) ngx_close_file(fd);
+
+    ctx->stored = 1;
+
+    return NGX_OK;
+
+failed:
+
+    (void) ngx_close_file(fd);
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_image_store_write(ngx_http_image_filter_ctx_t *ctx)
+{
+    u_char           *p;
+    size_t            size;
+    ssize_t           n;
+    ngx_fd_t          fd;
+    ngx_file_info_t   fi;
+
+    /*
+     * the exclusively created temporary file keeps workers from writing
+     * the same variant at once; the one left by a crashed worker is
+     * removed after a minute
+     */
+
+    fd = ngx_open_tempfile(ctx->tmp, 1, NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE && ngx_errno == NGX_EEXIST
+        && ngx_file_info(ctx->tmp, &fi) != NGX_FILE_ERROR
+        && ngx_file_mtime(&fi) + 60 < ngx_time())
+    {
+        (void) ngx_delete_file(ctx->tmp);
+
+        fd = ngx_open_tempfile(ctx->tmp, 1, NGX_FILE_DEFAULT_ACCESS);
+    }
+
+    if (fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_EEXIST) {
+            ctx->store_err = ngx_errno;
+            ctx->store_failed = ngx_open_tempfile_n;
+            ctx->store_name = ctx->tmp;
+        }
+
+        return;
+    }
+
+    for (p = ctx->out, size = ctx->size; size; p += n, size -= n) {
+        n = ngx_write_fd(fd, p, size);
+
+        if (n == -1) {
+            ctx->store_err = ngx_errno;
+            ctx->store_failed = ngx_write_fd_n;
+            ctx->store_name = ctx->tmp;
+
+            (void) ngx_close_file(fd);
+            (void) ngx_delete_file(ctx->tmp);
+            return;
+        }
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ctx->store_err = ngx_errno;
+        ctx->store_failed = ngx_close_file_n;
+        ctx->store_name = ctx->tmp;
+        (void) ngx_delete_file(ctx->tmp);
+        return;
+    }
+
+    if (ngx_rename_file(ctx->tmp, ctx->name) == NGX_FILE_ERROR) {
+        ctx->store_err = ngx_errno;
+        ctx->store_failed = ngx_rename_file_n;
+        ctx->store_name = ctx->tmp;
+        (void) ngx_delete_file(ctx->tmp);
+    }
+}
+
+
+static void
+ngx_http_image_store_cleanup(void *data)
+{
+    ngx_free(data);
+}
+
+
+#if (NGX_HAVE_PTHREAD)
+
+static void
+ngx_http_image_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_image_filter_ctx_t  *ctx = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "image thread handler");
+
+    ngx_http_image_job(ctx, log);
+}
+
+
+static void
+ngx_http_image_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->connection->write->handler(r->connection->write);
+}
+
+#endif
+
+
 static ngx_uint_t
 ngx_http_image_filter_get_value(ngx_http_request_t *r,
     ngx_http_complex_value_t *cv, ngx_uint_t v)
@@ -1175,6 +1605,10 @@ ngx_http_image_filter_create_conf(ngx_conf_t *cf)
     conf->angle = NGX_CONF_UNSET_UINT;
     conf->transparency = NGX_CONF_UNSET;
     conf->buffer_size = NGX_CONF_UNSET_SIZE;
+    conf->store = NGX_CONF_UNSET_PTR;
+#if (NGX_HAVE_PTHREAD)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
 
     return conf;
 }
@@ -1223,6 +1657,12 @@ ngx_http_image_filter_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size,
                               1 * 1024 * 1024);
 
+    ngx_conf_merge_ptr_value(conf->store, prev->store, NULL);
+
+#if (NGX_HAVE_PTHREAD)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+
     return NGX_CONF_OK;
 }
 
@@ -1474,6 +1914,77 @@ ngx_http_image_filter_sharpen(ngx_conf_t *cf, ngx_command_t *cmd,
 }
 
 
+static char *
+ngx_http_image_filter_store(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_image_filter_conf_t *imcf = conf;
+
+    ngx_str_t  *value, *path;
+
+    if (imcf->store != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        imcf->store = NULL;
+        return NGX_CONF_OK;
+    }
+
+    path = ngx_palloc(cf->pool, sizeof(ngx_str_t));
+    if (path == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *path = value[1];
+
+    if (path->data[path->len - 1] == '/') {
+        path->len--;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, path, 0) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    imcf->store = path;
+
+    return NGX_CONF_OK;
+}
+
+
+#if (NGX_HAVE_PTHREAD)
+
+static char *
+ngx_http_image_filter_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_image_filter_conf_t *imcf = conf;
+
+    ngx_str_t  *value;
+
+    if (imcf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        imcf->thread_pool = NULL;
+        return NGX_CONF_OK;
+    }
+
+    imcf->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (imcf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_image_filter_init(ngx_conf_t *cf)
 {
@@ -19,15 +19,23 @@ typedef struct {
 
 
 typedef struct {
-    ngx_shm_zone_t     *shm_zone;
-    ngx_rbtree_node_t  *node;
+    ngx_rbtree_t       *rbtree;
+    ngx_slab_pool_t    *shpool;
+} ngx_http_limit_conn_shard_t;
+
+
+typedef struct {
+    ngx_shm_zone_t               *shm_zone;
+    ngx_http_limit_conn_shard_t  *shard;
+    ngx_rbtree_node_t            *node;
 } ngx_http_limit_conn_cleanup_t;
 
 
 typedef struct {
-    ngx_rbtree_t       *rbtree;
-    ngx_int_t           index;
-    ngx_str_t           var;
+    ngx_http_limit_conn_shard_t  *shards;
+    ngx_uint_t                    nshards;
+    ngx_int_t                     index;
+    ngx_str_t                     var;
 } ngx_http_limit_conn_ctx_t;
 
 
@@ -46,6 +54,8 @@ typedef struct {
 static ngx_rbtree_node_t *ngx_http_limit_conn_lookup(ngx_rbtree_t *rbtree,
     ngx_http_variable_value_t *vv, uint32_t hash);
 static void ngx_http_limit_conn_cleanup(void *data);
+static ngx_int_t ngx_http_limit_conn_init_shard(ngx_shm_zone_t *shm_zone,
+    ngx_http_limit_conn_shard_t *shard);
 static ngx_inline void ngx_http_limit_conn_cleanup_all(ngx_pool_t *pool);
 
 static void *ngx_http_limit_conn_create_conf(ngx_conf_t *cf);
@@ -77,7 +87,7 @@ static ngx_conf_enum_t  ngx_http_limit_conn_log_levels[] = {
 static ngx_command_t  ngx_http_limit_conn_commands[] = {
 
     { ngx_string("limit_conn_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE23,
       ngx_http_limit_conn_zone,
       0,
       0,
@@ -150,6 +160,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
     ngx_pool_cleanup_t             *cln;
     ngx_http_variable_value_t      *vv;
     ngx_http_limit_conn_ctx_t      *ctx;
+    ngx_http_limit_conn_shard_t    *shard;
     ngx_http_limit_conn_node_t     *lc;
     ngx_http_limit_conn_conf_t     *lccf;
     ngx_http_limit_conn_limit_t    *limits;
@@ -189,11 +200,12 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(vv->data, len);
 
-        shpool = (ngx_slab_pool_t *) limits[i].shm_zone->shm.addr;
+        shard = &ctx->shards[hash % ctx->nshards];
+        shpool = shard->shpool;
 
         ngx_shmtx_lock(&shpool->mutex);
 
-        node = ngx_http_limit_conn_lookup(ctx->rbtree, vv, hash);
+        node = ngx_http_limit_conn_lookup(shard->rbtree, vv, hash);
 
         if (node == NULL) {
 
@@ -216,7 +228,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
             lc->conn = 1;
             ngx_memcpy(lc->data, vv->data, len);
 
-            ngx_rbtree_insert(ctx->rbtree, node);
+            ngx_rbtree_insert(shard->rbtree, node);
 
         } else {
 
@@ -252,6 +264,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
         lccln = cln->data;
 
         lccln->shm_zone = limits[i].shm_zone;
+        lccln->shard = shard;
         lccln->node = node;
     }
 
@@ -347,11 +360,9 @@ ngx_http_limit_conn_cleanup(void *data)
 
     ngx_slab_pool_t             *shpool;
     ngx_rbtree_node_t           *node;
-    ngx_http_limit_conn_ctx_t   *ctx;
     ngx_http_limit_conn_node_t  *lc;
 
-    ctx = lccln->shm_zone->data;
-    shpool = (ngx_slab_pool_t *) lccln->shm_zone->shm.addr;
+    shpool = lccln->shard->shpool;
     node = lccln->node;
     lc = (ngx_http_limit_conn_node_t *) &node->color;
 
@@ -363,7 +374,7 @@ ngx_http_limit_conn_cleanup(void *data)
     lc->conn--;
 
     if (lc->conn == 0) {
-        ngx_rbtree_delete(ctx->rbtree, node);
+        ngx_rbtree_delete(lccln->shard->rbtree, node);
         ngx_slab_free_locked(shpool, node);
     }
 
@@ -392,9 +403,8 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_limit_conn_ctx_t  *octx = data;
 
-    size_t                      len;
-    ngx_slab_pool_t            *shpool;
-    ngx_rbtree_node_t          *sentinel;
+    ngx_uint_t                  i;
+    ngx_slab_pool_t            *shpool, **stripes;
     ngx_http_limit_conn_ctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -408,32 +418,101 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
-        ctx->rbtree = octx->rbtree;
+        if (ctx->nshards != octx->nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_conn_zone \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, ctx->nshards, octx->nshards);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(ctx->shards, octx->shards,
+                   ctx->nshards * sizeof(ngx_http_limit_conn_shard_t));
 
         return NGX_OK;
     }
 
     shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
+    /* see ngx_http_limit_req_init_zone() for the sharded zone layout */
+
     if (shm_zone->shm.exists) {
-        ctx->rbtree = shpool->data;
+
+        if (ctx->nshards == 1) {
+            ctx->shards[0].shpool = shpool;
+            ctx->shards[0].rbtree = shpool->data;
+
+            return NGX_OK;
+        }
+
+        stripes = shpool->data;
+
+        for (i = 0; i < ctx->nshards; i++) {
+            ctx->shards[i].shpool = stripes[i];
+            ctx->shards[i].rbtree = stripes[i]->data;
+        }
 
         return NGX_OK;
     }
 
-    ctx->rbtree = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_t));
-    if (ctx->rbtree == NULL) {
+    if (ctx->nshards == 1) {
+        ctx->shards[0].shpool = shpool;
+
+        return ngx_http_limit_conn_init_shard(shm_zone, &ctx->shards[0]);
+    }
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    stripes = ngx_slab_stripe(shpool, ctx->nshards);
+    if (stripes == NULL) {
         return NGX_ERROR;
     }
 
-    shpool->data = ctx->rbtree;
+    shpool->data = stripes;
+
+    for (i = 0; i < ctx->nshards; i++) {
+        ctx->shards[i].shpool = stripes[i];
+
+        if (ngx_http_limit_conn_init_shard(shm_zone, &ctx->shards[i])
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+
+#else
+
+    return NGX_ERROR;
+
+#endif
+}
+
+
+static ngx_int_t
+ngx_http_limit_conn_init_shard(ngx_shm_zone_t *shm_zone,
+    ngx_http_limit_conn_shard_t *shard)
+{
+    size_t              len;
+    ngx_slab_pool_t    *shpool;
+    ngx_rbtree_node_t  *sentinel;
+
+    shpool = shard->shpool;
+
+    shard->rbtree = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_t));
+    if (shard->rbtree == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = shard->rbtree;
 
     sentinel = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_node_t));
     if (sentinel == NULL) {
         return NGX_ERROR;
     }
 
-    ngx_rbtree_init(ctx->rbtree, sentinel,
+    ngx_rbtree_init(shard->rbtree, sentinel,
                     ngx_http_limit_conn_rbtree_insert_value);
 
     len = sizeof(" in limit_conn_zone \"\"") + shm_zone->shm.name.len;
@@ -494,6 +573,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     u_char                     *p;
     ssize_t                     size;
     ngx_str_t                  *value, name, s;
+    ngx_int_t                   shards;
     ngx_uint_t                  i;
     ngx_shm_zone_t             *shm_zone;
     ngx_http_limit_conn_ctx_t  *ctx;
@@ -502,6 +582,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx = NULL;
     size = 0;
+    shards = 1;
     name.len = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
@@ -540,6 +621,27 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards < 1 || shards > 64) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid shards \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+            if (shards > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" requires atomic operations",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+#endif
+
+            continue;
+        }
+
         if (value[i].data[0] == '$') {
 
             value[i].len--;
@@ -579,6 +681,21 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (size < (ssize_t) (8 * shards * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small for %i shards",
+                           &name, shards);
+        return NGX_CONF_ERROR;
+    }
+
+    ctx->nshards = shards;
+
+    ctx->shards = ngx_pcalloc(cf->pool,
+                              shards * sizeof(ngx_http_limit_conn_shard_t));
+    if (ctx->shards == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_conn_module);
     if (shm_zone == NULL) {
@@ -634,6 +751,13 @@ ngx_http_limit_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx->var = value[2];
 
+    ctx->nshards = 1;
+
+    ctx->shards = ngx_pcalloc(cf->pool, sizeof(ngx_http_limit_conn_shard_t));
+    if (ctx->shards == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
     n = ngx_parse_size(&value[3]);
 
     if (n == NGX_ERROR) {
@@ -10,6 +10,18 @@
 #include <ngx_http.h>
 
 
+#if (NGX_HAVE_ATOMIC_OPS && NGX_PTR_SIZE == 8)
+#define NGX_HTTP_LIMIT_REQ_GCRA  1
+#endif
+
+
+#define NGX_HTTP_LIMIT_REQ_LEAKY     0
+#define NGX_HTTP_LIMIT_REQ_GCRA_ALG  1
+
+#define NGX_HTTP_LIMIT_REQ_PROBES    8
+#define NGX_HTTP_LIMIT_REQ_ROWS      4
+
+
 typedef struct {
     u_char                       color;
     u_char                       dummy;
@@ -33,11 +45,47 @@ typedef struct {
 typedef struct {
     ngx_http_limit_req_shctx_t  *sh;
     ngx_slab_pool_t             *shpool;
+} ngx_http_limit_req_shard_t;
+
+
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+
+/*
+ * a GCRA zone keeps a theoretical arrival time in microseconds per key
+ * in an open addressing table updated with compare-and-swap only; a key
+ * that does not fit in the table is limited by a count-min sketch of
+ * the arrival times, which may only overestimate them
+ */
+
+typedef struct {
+    ngx_atomic_t                 key;
+    ngx_atomic_t                 tat;
+} ngx_http_limit_req_slot_t;
+
+
+typedef struct {
+    ngx_uint_t                   nslots;
+    ngx_uint_t                   width;
+    ngx_http_limit_req_slot_t   *slots;
+    ngx_atomic_t                *sketch;
+} ngx_http_limit_req_gcra_t;
+
+#endif
+
+
+typedef struct {
+    ngx_http_limit_req_shard_t  *shards;
+    ngx_uint_t                   nshards;
+    ngx_uint_t                   algorithm;
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+    ngx_http_limit_req_gcra_t   *gcra;
+#endif
     /* integer value, 1 corresponds to 0.001 r/s */
     ngx_uint_t                   rate;
     ngx_int_t                    index;
     ngx_str_t                    var;
     ngx_http_limit_req_node_t   *node;
+    ngx_http_limit_req_shard_t  *shard;
 } ngx_http_limit_req_ctx_t;
 
 
@@ -58,12 +106,22 @@ typedef struct {
 
 static void ngx_http_limit_req_delay(ngx_http_request_t *r);
 static ngx_int_t ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
-    ngx_uint_t hash, u_char *data, size_t len, ngx_uint_t *ep,
-    ngx_uint_t account);
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, u_char *data,
+    size_t len, ngx_uint_t *ep, ngx_uint_t account);
 static ngx_msec_t ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n, ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
-    ngx_uint_t n);
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t n);
+static ngx_int_t ngx_http_limit_req_init_shard(ngx_shm_zone_t *shm_zone,
+    ngx_http_limit_req_shard_t *shard);
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+static ngx_int_t ngx_http_limit_req_gcra(ngx_http_limit_req_limit_t *limit,
+    uint32_t hash, u_char *data, size_t len, ngx_uint_t *ep);
+static ngx_int_t ngx_http_limit_req_gcra_update(ngx_atomic_t **cells,
+    ngx_uint_t n, ngx_atomic_uint_t now, ngx_atomic_uint_t t,
+    ngx_atomic_uint_t tau, ngx_uint_t *ep);
+static ngx_int_t ngx_http_limit_req_init_gcra(ngx_shm_zone_t *shm_zone);
+#endif
 
 static void *ngx_http_limit_req_create_conf(ngx_conf_t *cf);
 static char *ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent,
@@ -87,7 +145,7 @@ static ngx_conf_enum_t  ngx_http_limit_req_log_levels[] = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3|NGX_CONF_TAKE4|NGX_CONF_TAKE5,
       ngx_http_limit_req_zone,
       0,
       0,
@@ -150,9 +208,15 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
     ngx_int_t                    rc;
     ngx_uint_t                   n, excess;
     ngx_msec_t                   delay;
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+    ngx_uint_t                   gexcess;
+    ngx_msec_t                   gdelay;
+    ngx_http_limit_req_limit_t  *glimit;
+#endif
     ngx_http_variable_value_t   *vv;
     ngx_http_limit_req_ctx_t    *ctx;
     ngx_http_limit_req_conf_t   *lrcf;
+    ngx_http_limit_req_shard_t  *shard;
     ngx_http_limit_req_limit_t  *limit, *limits;
 
     if (r->main->limit_req_set) {
@@ -170,6 +234,12 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
     limit = NULL;
 #endif
 
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+    gdelay = 0;
+    gexcess = 0;
+    glimit = NULL;
+#endif
+
     for (n = 0; n < lrcf->limits.nelts; n++) {
 
         limit = &limits[n];
@@ -198,12 +268,45 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(vv->data, len);
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+
+        if (ctx->gcra) {
+
+            /*
+             * a GCRA zone charges the request at once, so it stays
+             * charged even if a later limit rejects the request
+             */
+
+            rc = ngx_http_limit_req_gcra(limit, hash, vv->data, len,
+                                         &excess);
+
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "limit_req[%ui] gcra: %i %ui.%03ui",
+                           n, rc, excess / 1000, excess % 1000);
+
+            if (rc == NGX_BUSY) {
+                break;
+            }
 
-        rc = ngx_http_limit_req_lookup(limit, hash, vv->data, len, &excess,
-                                       (n == lrcf->limits.nelts - 1));
+            if (!limit->nodelay && excess * 1000 / ctx->rate > gdelay) {
+                gdelay = excess * 1000 / ctx->rate;
+                gexcess = excess;
+                glimit = limit;
+            }
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+            continue;
+        }
+
+#endif
+
+        shard = &ctx->shards[hash % ctx->nshards];
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        rc = ngx_http_limit_req_lookup(limit, shard, hash, vv->data, len,
+                                       &excess, (n == lrcf->limits.nelts - 1));
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit_req[%ui]: %i %ui.%03ui",
@@ -236,11 +339,11 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
                 continue;
             }
 
-            ngx_shmtx_lock(&ctx->shpool->mutex);
+            ngx_shmtx_lock(&ctx->shard->shpool->mutex);
 
             ctx->node->count--;
 
-            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
 
             ctx->node = NULL;
         }
@@ -256,6 +359,16 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
     delay = ngx_http_limit_req_account(limits, n, &excess, &limit);
 
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+
+    if (gdelay > delay) {
+        delay = gdelay;
+        excess = gexcess;
+        limit = glimit;
+    }
+
+#endif
+
     if (!delay) {
         return NGX_DECLINED;
     }
@@ -351,8 +464,9 @@ ngx_http_limit_req_rbtree_insert_value(ngx_rbtree_node_t *temp,
 
 
 static ngx_int_t
-ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
-    u_char *data, size_t len, ngx_uint_t *ep, ngx_uint_t account)
+ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t hash, u_char *data,
+    size_t len, ngx_uint_t *ep, ngx_uint_t account)
 {
     size_t                      size;
     ngx_int_t                   rc, excess;
@@ -368,8 +482,8 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     ctx = limit->shm_zone->data;
 
-    node = ctx->sh->rbtree.root;
-    sentinel = ctx->sh->rbtree.sentinel;
+    node = shard->sh->rbtree.root;
+    sentinel = shard->sh->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -391,7 +505,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
         if (rc == 0) {
             ngx_queue_remove(&lr->queue);
-            ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+            ngx_queue_insert_head(&shard->sh->queue, &lr->queue);
 
             ms = (ngx_msec_int_t) (now - lr->last);
 
@@ -416,6 +530,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
             lr->count++;
 
             ctx->node = lr;
+            ctx->shard = shard;
 
             return NGX_AGAIN;
         }
@@ -429,14 +544,14 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
            + offsetof(ngx_http_limit_req_node_t, data)
            + len;
 
-    ngx_http_limit_req_expire(ctx, 1);
+    ngx_http_limit_req_expire(ctx, shard, 1);
 
-    node = ngx_slab_alloc_locked(ctx->shpool, size);
+    node = ngx_slab_alloc_locked(shard->shpool, size);
 
     if (node == NULL) {
-        ngx_http_limit_req_expire(ctx, 0);
+        ngx_http_limit_req_expire(ctx, shard, 0);
 
-        node = ngx_slab_alloc_locked(ctx->shpool, size);
+        node = ngx_slab_alloc_locked(shard->shpool, size);
         if (node == NULL) {
             return NGX_ERROR;
         }
@@ -451,9 +566,9 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     ngx_memcpy(lr->data, data, len);
 
-    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    ngx_rbtree_insert(&shard->sh->rbtree, node);
 
-    ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+    ngx_queue_insert_head(&shard->sh->queue, &lr->queue);
 
     if (account) {
         lr->last = now;
@@ -465,6 +580,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
     lr->count = 1;
 
     ctx->node = lr;
+    ctx->shard = shard;
 
     return NGX_AGAIN;
 }
@@ -499,7 +615,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
             continue;
         }
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        ngx_shmtx_lock(&ctx->shard->shpool->mutex);
 
         tp = ngx_timeofday();
 
@@ -516,7 +632,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
         lr->excess = excess;
         lr->count--;
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_shmtx_unlock(&ctx->shard->shpool->mutex);
 
         ctx->node = NULL;
 
@@ -538,7 +654,8 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
 
 
 static void
-ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
+ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shard_t *shard, ngx_uint_t n)
 {
     ngx_int_t                   excess;
     ngx_time_t                 *tp;
@@ -560,11 +677,11 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&ctx->sh->queue)) {
+        if (ngx_queue_empty(&shard->sh->queue)) {
             return;
         }
 
-        q = ngx_queue_last(&ctx->sh->queue);
+        q = ngx_queue_last(&shard->sh->queue);
 
         lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
 
@@ -599,19 +716,205 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
         node = (ngx_rbtree_node_t *)
                    ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
 
-        ngx_rbtree_delete(&ctx->sh->rbtree, node);
+        ngx_rbtree_delete(&shard->sh->rbtree, node);
 
-        ngx_slab_free_locked(ctx->shpool, node);
+        ngx_slab_free_locked(shard->shpool, node);
     }
 }
 
 
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+
+static ngx_int_t
+ngx_http_limit_req_gcra(ngx_http_limit_req_limit_t *limit, uint32_t hash,
+    u_char *data, size_t len, ngx_uint_t *ep)
+{
+    ngx_uint_t                  i;
+    ngx_time_t                 *tp;
+    ngx_atomic_t               *cells[NGX_HTTP_LIMIT_REQ_ROWS];
+    ngx_atomic_uint_t           key, k, fk, now, t, tau, h2;
+    ngx_http_limit_req_ctx_t   *ctx;
+    ngx_http_limit_req_gcra_t  *g;
+    ngx_http_limit_req_slot_t  *slot, *free;
+
+    ctx = limit->shm_zone->data;
+    g = ctx->gcra;
+
+    tp = ngx_timeofday();
+    now = ((ngx_atomic_uint_t) tp->sec * 1000 + tp->msec) * 1000;
+
+    /* the emission interval and the burst tolerance in microseconds */
+
+    t = (ngx_atomic_uint_t) 1000000000 / ctx->rate;
+    tau = (ngx_atomic_uint_t) limit->burst * t / 1000;
+
+    h2 = ngx_murmur_hash2(data, len);
+    key = ((ngx_atomic_uint_t) hash << 32 | h2) | 1;
+
+    free = NULL;
+    fk = 0;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_PROBES; i++) {
+        slot = &g->slots[(hash + i) % g->nslots];
+
+        k = slot->key;
+
+        if (k == key) {
+            cells[0] = &slot->tat;
+            return ngx_http_limit_req_gcra_update(cells, 1, now, t, tau, ep);
+        }
+
+        /* a drained slot behaves as an empty one and may be reused */
+
+        if (free == NULL && (k == 0 || slot->tat <= now)) {
+            free = slot;
+            fk = k;
+        }
+    }
+
+    if (free && ngx_atomic_cmp_set(&free->key, fk, key)) {
+        cells[0] = &free->tat;
+        return ngx_http_limit_req_gcra_update(cells, 1, now, t, tau, ep);
+    }
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_ROWS; i++) {
+        cells[i] = &g->sketch[i * g->width + (hash + i * h2) % g->width];
+    }
+
+    return ngx_http_limit_req_gcra_update(cells, NGX_HTTP_LIMIT_REQ_ROWS,
+                                          now, t, tau, ep);
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_gcra_update(ngx_atomic_t **cells, ngx_uint_t n,
+    ngx_atomic_uint_t now, ngx_atomic_uint_t t, ngx_atomic_uint_t tau,
+    ngx_uint_t *ep)
+{
+    ngx_uint_t         i;
+    ngx_atomic_uint_t  old, tat;
+
+    if (n == 1) {
+
+        /* an own slot is updated exactly */
+
+        for ( ;; ) {
+            old = *cells[0];
+            tat = ngx_max(old, now);
+
+            *ep = (ngx_uint_t) ((tat - now) * 1000 / t);
+
+            if (tat - now > tau) {
+                return NGX_BUSY;
+            }
+
+            if (ngx_atomic_cmp_set(cells[0], old, tat + t)) {
+                return NGX_AGAIN;
+            }
+        }
+    }
+
+    /* the sketch estimate is the least of the arrival times of the cells */
+
+    tat = *cells[0];
+
+    for (i = 1; i < n; i++) {
+        if (*cells[i] < tat) {
+            tat = *cells[i];
+        }
+    }
+
+    tat = ngx_max(tat, now);
+
+    *ep = (ngx_uint_t) ((tat - now) * 1000 / t);
+
+    if (tat - now > tau) {
+        return NGX_BUSY;
+    }
+
+    tat += t;
+
+    for (i = 0; i < n; i++) {
+        do {
+            old = *cells[i];
+
+            if (old >= tat) {
+                break;
+            }
+
+        } while (!ngx_atomic_cmp_set(cells[i], old, tat));
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_init_gcra(ngx_shm_zone_t *shm_zone)
+{
+    size_t                      len;
+    ngx_uint_t                  pages, spages;
+    ngx_slab_pool_t            *shpool;
+    ngx_http_limit_req_ctx_t   *ctx;
+    ngx_http_limit_req_gcra_t  *g;
+
+    ctx = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    /* two pages are left for the header and the log context */
+
+    pages = (shpool->end - shpool->start) / ngx_pagesize - 2;
+    spages = pages / 8 ? pages / 8 : 1;
+    pages -= spages;
+
+    g = ngx_slab_alloc(shpool, sizeof(ngx_http_limit_req_gcra_t));
+    if (g == NULL) {
+        return NGX_ERROR;
+    }
+
+    g->slots = ngx_slab_alloc(shpool, pages * ngx_pagesize);
+    if (g->slots == NULL) {
+        return NGX_ERROR;
+    }
+
+    g->sketch = ngx_slab_alloc(shpool, spages * ngx_pagesize);
+    if (g->sketch == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero((void *) g->slots, pages * ngx_pagesize);
+    ngx_memzero((void *) g->sketch, spages * ngx_pagesize);
+
+    g->nslots = pages * ngx_pagesize / sizeof(ngx_http_limit_req_slot_t);
+    g->width = spages * ngx_pagesize
+               / (NGX_HTTP_LIMIT_REQ_ROWS * sizeof(ngx_atomic_t));
+
+    shpool->data = g;
+    ctx->gcra = g;
+
+    len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in limit_req zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_limit_req_ctx_t  *octx = data;
 
-    size_t                     len;
+    ngx_uint_t                 i;
+    ngx_slab_pool_t           *shpool, **stripes;
     ngx_http_limit_req_ctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -625,40 +928,127 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
-        ctx->sh = octx->sh;
-        ctx->shpool = octx->shpool;
+        if (ctx->nshards != octx->nshards
+            || ctx->algorithm != octx->algorithm)
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses other shards or algorithm "
+                          "than previously", &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(ctx->shards, octx->shards,
+                   ctx->nshards * sizeof(ngx_http_limit_req_shard_t));
+
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+        ctx->gcra = octx->gcra;
+#endif
 
         return NGX_OK;
     }
 
-    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+
+    if (ctx->algorithm == NGX_HTTP_LIMIT_REQ_GCRA_ALG) {
+
+        if (shm_zone->shm.exists) {
+            ctx->gcra = shpool->data;
+            return NGX_OK;
+        }
+
+        return ngx_http_limit_req_init_gcra(shm_zone);
+    }
+
+#endif
+
+    /*
+     * a sharded zone keeps the array of the striped pools in the zone
+     * pool data, and each striped pool has its own tree and lock
+     */
 
     if (shm_zone->shm.exists) {
-        ctx->sh = ctx->shpool->data;
+
+        if (ctx->nshards == 1) {
+            ctx->shards[0].shpool = shpool;
+            ctx->shards[0].sh = shpool->data;
+
+            return NGX_OK;
+        }
+
+        stripes = shpool->data;
+
+        for (i = 0; i < ctx->nshards; i++) {
+            ctx->shards[i].shpool = stripes[i];
+            ctx->shards[i].sh = stripes[i]->data;
+        }
 
         return NGX_OK;
     }
 
-    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_limit_req_shctx_t));
-    if (ctx->sh == NULL) {
+    if (ctx->nshards == 1) {
+        ctx->shards[0].shpool = shpool;
+
+        return ngx_http_limit_req_init_shard(shm_zone, &ctx->shards[0]);
+    }
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    stripes = ngx_slab_stripe(shpool, ctx->nshards);
+    if (stripes == NULL) {
         return NGX_ERROR;
     }
 
-    ctx->shpool->data = ctx->sh;
+    shpool->data = stripes;
+
+    for (i = 0; i < ctx->nshards; i++) {
+        ctx->shards[i].shpool = stripes[i];
+
+        if (ngx_http_limit_req_init_shard(shm_zone, &ctx->shards[i])
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+
+#else
+
+    return NGX_ERROR;
+
+#endif
+}
 
-    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+
+static ngx_int_t
+ngx_http_limit_req_init_shard(ngx_shm_zone_t *shm_zone,
+    ngx_http_limit_req_shard_t *shard)
+{
+    size_t  len;
+
+    shard->sh = ngx_slab_alloc(shard->shpool,
+                               sizeof(ngx_http_limit_req_shctx_t));
+    if (shard->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shard->shpool->data = shard->sh;
+
+    ngx_rbtree_init(&shard->sh->rbtree, &shard->sh->sentinel,
                     ngx_http_limit_req_rbtree_insert_value);
 
-    ngx_queue_init(&ctx->sh->queue);
+    ngx_queue_init(&shard->sh->queue);
 
     len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
 
-    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
-    if (ctx->shpool->log_ctx == NULL) {
+    shard->shpool->log_ctx = ngx_slab_alloc(shard->shpool, len);
+    if (shard->shpool->log_ctx == NULL) {
         return NGX_ERROR;
     }
 
-    ngx_sprintf(ctx->shpool->log_ctx, " in limit_req zone \"%V\"%Z",
+    ngx_sprintf(shard->shpool->log_ctx, " in limit_req zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
     return NGX_OK;
@@ -714,8 +1104,8 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size_t                     len;
     ssize_t                    size;
     ngx_str_t                 *value, name, s;
-    ngx_int_t                  rate, scale;
-    ngx_uint_t                 i;
+    ngx_int_t                  rate, scale, shards;
+    ngx_uint_t                 i, algorithm;
     ngx_shm_zone_t            *shm_zone;
     ngx_http_limit_req_ctx_t  *ctx;
 
@@ -725,6 +1115,8 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size = 0;
     rate = 1;
     scale = 1;
+    shards = 1;
+    algorithm = NGX_HTTP_LIMIT_REQ_LEAKY;
     name.len = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
@@ -787,6 +1179,44 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards < 1 || shards > 64) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid shards \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+            if (shards > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" requires atomic operations",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+#endif
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "algorithm=leaky") == 0) {
+            algorithm = NGX_HTTP_LIMIT_REQ_LEAKY;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "algorithm=gcra") == 0) {
+#if (NGX_HTTP_LIMIT_REQ_GCRA)
+            algorithm = NGX_HTTP_LIMIT_REQ_GCRA_ALG;
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"%V\" requires 64-bit atomic operations",
+                               &value[i]);
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         if (value[i].data[0] == '$') {
 
             value[i].len--;
@@ -828,6 +1258,29 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx->rate = rate * 1000 / scale;
 
+    if (size < (ssize_t) (8 * shards * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small for %i shards",
+                           &name, shards);
+        return NGX_CONF_ERROR;
+    }
+
+    if (algorithm == NGX_HTTP_LIMIT_REQ_GCRA_ALG && shards > 1) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "a gcra zone \"%V\" is lock-free and "
+                           "cannot be sharded", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    ctx->nshards = shards;
+    ctx->algorithm = algorithm;
+
+    ctx->shards = ngx_pcalloc(cf->pool,
+                              shards * sizeof(ngx_http_limit_req_shard_t));
+    if (ctx->shards == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_req_module);
     if (shm_zone == NULL) {
@@ -9,6 +9,10 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_ZLIB)
+#include <zlib.h>
+#endif
+
 
 typedef struct ngx_http_log_op_s  ngx_http_log_op_t;
 
@@ -46,6 +50,59 @@ typedef struct {
 } ngx_http_log_script_t;
 
 
+#if (NGX_HAVE_PTHREAD)
+
+typedef struct {
+    u_char                     *start;
+    size_t                      len;
+    ngx_fd_t                    fd;
+} ngx_http_log_slot_t;
+
+
+/*
+ * the worker fills the slot at "head" and publishes it, the writer thread
+ * writes the slots from "tail" up to "head"; the mutex is taken once
+ * per buffer, not per line
+ */
+
+typedef struct {
+    ngx_http_log_slot_t        *slots;
+    ngx_uint_t                  nslots;
+
+    ngx_uint_t                  head;
+    ngx_uint_t                  tail;
+
+    pthread_mutex_t             mutex;
+    pthread_cond_t              cond;
+
+    /* the writer thread does not log, the worker reports its errors */
+    ngx_err_t                   err;
+    ssize_t                     written;
+    size_t                      failed;
+
+    ngx_uint_t                  dropped;
+    time_t                      error_log_time;
+
+    unsigned                    running:1;
+    unsigned                    drop:1;
+} ngx_http_log_ring_t;
+
+#endif
+
+
+typedef struct {
+    ngx_open_file_t            *file;
+
+    ngx_event_t                *event;
+    ngx_msec_t                  flush;
+    ngx_int_t                   gzip;
+
+#if (NGX_HAVE_PTHREAD)
+    ngx_http_log_ring_t        *ring;
+#endif
+} ngx_http_log_buf_t;
+
+
 typedef struct {
     ngx_open_file_t            *file;
     ngx_http_log_script_t      *script;
@@ -75,6 +132,20 @@ typedef struct {
 
 static void ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log,
     u_char *buf, size_t len);
+static ssize_t ngx_http_log_write_fd(ngx_http_log_buf_t *buffer, ngx_fd_t fd,
+    u_char *buf, size_t len);
+#if (NGX_ZLIB)
+static ssize_t ngx_http_log_gzip(ngx_fd_t fd, u_char *buf, size_t len,
+    ngx_int_t level);
+#endif
+static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
+static void ngx_http_log_flush_buffer(ngx_open_file_t *file, ngx_log_t *log);
+static void ngx_http_log_flush_handler(ngx_event_t *ev);
+#if (NGX_HAVE_PTHREAD)
+static void ngx_http_log_publish(ngx_open_file_t *file, ngx_log_t *log);
+static void ngx_http_log_drain(ngx_http_log_ring_t *ring);
+static void *ngx_http_log_writer(void *data);
+#endif
 static ssize_t ngx_http_log_script_write(ngx_http_request_t *r,
     ngx_http_log_script_t *script, u_char **name, u_char *buf, size_t len);
 
@@ -119,6 +190,7 @@ static char *ngx_http_log_compile_format(ngx_conf_t *cf,
 static char *ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_log_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_log_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_command_t  ngx_http_log_commands[] = {
@@ -132,7 +204,7 @@ static ngx_command_t  ngx_http_log_commands[] = {
 
     { ngx_string("access_log"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF
-                        |NGX_HTTP_LMT_CONF|NGX_CONF_TAKE123,
+                        |NGX_HTTP_LMT_CONF|NGX_CONF_1MORE,
       ngx_http_log_set_log,
       NGX_HTTP_LOC_CONF_OFFSET,
       0,
@@ -171,7 +243,7 @@ ngx_module_t  ngx_http_log_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_log_init_process,             /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -218,6 +290,7 @@ ngx_http_log_handler(ngx_http_request_t *r)
     ngx_http_log_t           *log;
     ngx_open_file_t          *file;
     ngx_http_log_op_t        *op;
+    ngx_http_log_buf_t       *buffer;
     ngx_http_log_loc_conf_t  *lcf;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -262,18 +335,36 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         if (file && file->buffer) {
 
+            buffer = file->data;
+
             if (len > (size_t) (file->last - file->pos)) {
 
-                ngx_http_log_write(r, &log[l], file->buffer,
-                                   file->pos - file->buffer);
+#if (NGX_HAVE_PTHREAD)
+                if (buffer->ring) {
+                    ngx_http_log_publish(file, r->connection->log);
+
+                } else
+#endif
+                {
+                    ngx_http_log_write(r, &log[l], file->buffer,
+                                       file->pos - file->buffer);
 
-                file->pos = file->buffer;
+                    file->pos = file->buffer;
+                }
+
+                if (buffer->event && buffer->event->timer_set) {
+                    ngx_del_timer(buffer->event);
+                }
             }
 
             if (len <= (size_t) (file->last - file->pos)) {
 
                 p = file->pos;
 
+                if (p == file->buffer && buffer->event) {
+                    ngx_add_timer(buffer->event, buffer->flush);
+                }
+
                 for (i = 0; i < log[l].format->ops->nelts; i++) {
                     p = op[i].run(r, p, &op[i]);
                 }
@@ -284,6 +375,14 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
                 continue;
             }
+
+#if (NGX_HAVE_PTHREAD)
+            /* the line is written past the buffers, keep the order */
+
+            if (buffer->ring) {
+                ngx_http_log_drain(buffer->ring);
+            }
+#endif
         }
 
         line = ngx_pnalloc(r->pool, len);
@@ -317,7 +416,7 @@ ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log, u_char *buf,
 
     if (log->script == NULL) {
         name = log->file->name.data;
-        n = ngx_write_fd(log->file->fd, buf, len);
+        n = ngx_http_log_write_fd(log->file->data, log->file->fd, buf, len);
 
     } else {
         name = NULL;
@@ -357,6 +456,324 @@ ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log, u_char *buf,
 }
 
 
+/* may be called by the writer thread, so it must not log */
+
+static ssize_t
+ngx_http_log_write_fd(ngx_http_log_buf_t *buffer, ngx_fd_t fd, u_char *buf,
+    size_t len)
+{
+#if (NGX_ZLIB)
+    if (buffer && buffer->gzip) {
+        return ngx_http_log_gzip(fd, buf, len, buffer->gzip);
+    }
+#endif
+
+    return ngx_write_fd(fd, buf, len);
+}
+
+
+#if (NGX_ZLIB)
+
+/*
+ * every buffer is compressed into a separate gzip member, the members
+ * written one after another form a valid gzip file
+ */
+
+static ssize_t
+ngx_http_log_gzip(ngx_fd_t fd, u_char *buf, size_t len, ngx_int_t level)
+{
+    int        rc;
+    u_char    *out;
+    size_t     size;
+    ssize_t    n;
+    z_stream   zstream;
+
+    ngx_memzero(&zstream, sizeof(z_stream));
+
+    rc = deflateInit2(&zstream, (int) level, Z_DEFLATED, MAX_WBITS + 16,
+                      MAX_MEM_LEVEL - 1, Z_DEFAULT_STRATEGY);
+
+    if (rc != Z_OK) {
+        ngx_set_errno(NGX_ENOMEM);
+        return -1;
+    }
+
+    size = deflateBound(&zstream, len);
+
+    out = malloc(size);
+    if (out == NULL) {
+        deflateEnd(&zstream);
+        return -1;
+    }
+
+    zstream.next_in = buf;
+    zstream.avail_in = len;
+    zstream.next_out = out;
+    zstream.avail_out = size;
+
+    rc = deflate(&zstream, Z_FINISH);
+
+    deflateEnd(&zstream);
+
+    if (rc != Z_STREAM_END) {
+        free(out);
+        ngx_set_errno(NGX_ENOMEM);
+        return -1;
+    }
+
+    size -= zstream.avail_out;
+
+    n = ngx_write_fd(fd, out, size);
+
+    free(out);
+
+    if (n == (ssize_t) size) {
+        return len;
+    }
+
+    return (n == -1) ? -1 : 0;
+}
+
+#endif
+
+
+/* the ngx_open_file_t flush method, called on reopen and on exit */
+
+static void
+ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
+{
+#if (NGX_HAVE_PTHREAD)
+    ngx_http_log_buf_t  *buffer;
+#endif
+
+    ngx_http_log_flush_buffer(file, log);
+
+#if (NGX_HAVE_PTHREAD)
+    buffer = file->data;
+
+    if (buffer->ring) {
+        ngx_http_log_drain(buffer->ring);
+    }
+#endif
+}
+
+
+static void
+ngx_http_log_flush_buffer(ngx_open_file_t *file, ngx_log_t *log)
+{
+    size_t               len;
+    ssize_t              n;
+    ngx_http_log_buf_t  *buffer;
+
+    buffer = file->data;
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+
+    len = file->pos - file->buffer;
+
+    if (len == 0) {
+        return;
+    }
+
+#if (NGX_HAVE_PTHREAD)
+    if (buffer->ring) {
+        ngx_http_log_publish(file, log);
+        return;
+    }
+#endif
+
+    n = ngx_http_log_write_fd(buffer, file->fd, file->buffer, len);
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_write_fd_n " to \"%s\" failed", file->name.data);
+
+    } else if ((size_t) n != len) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
+                      file->name.data, n, len);
+    }
+
+    file->pos = file->buffer;
+}
+
+
+static void
+ngx_http_log_flush_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http log buffer flush handler");
+
+    ngx_http_log_flush_buffer(ev->data, ev->log);
+}
+
+
+#if (NGX_HAVE_PTHREAD)
+
+static void
+ngx_http_log_publish(ngx_open_file_t *file, ngx_log_t *log)
+{
+    size_t                len, size;
+    ssize_t               written;
+    ngx_err_t             err;
+    ngx_uint_t            dropped;
+    ngx_http_log_buf_t   *buffer;
+    ngx_http_log_ring_t  *ring;
+    ngx_http_log_slot_t  *slot;
+
+    buffer = file->data;
+    ring = buffer->ring;
+
+    len = file->pos - file->buffer;
+    size = file->last - file->buffer;
+
+    if (len == 0) {
+        return;
+    }
+
+    if (!ring->running) {
+        written = ngx_http_log_write_fd(buffer, file->fd, file->buffer, len);
+
+        if (written == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_write_fd_n " to \"%s\" failed", file->name.data);
+        }
+
+        file->pos = file->buffer;
+        return;
+    }
+
+    dropped = 0;
+
+    (void) pthread_mutex_lock(&ring->mutex);
+
+    /* the slot being filled is never given to the writer */
+
+    while (ring->head - ring->tail == ring->nslots - 1) {
+
+        if (ring->drop) {
+            dropped = ++ring->dropped;
+            break;
+        }
+
+        (void) pthread_cond_wait(&ring->cond, &ring->mutex);
+    }
+
+    if (dropped == 0) {
+        slot = &ring->slots[ring->head % ring->nslots];
+
+        slot->len = len;
+        slot->fd = file->fd;
+
+        ring->head++;
+
+        (void) pthread_cond_broadcast(&ring->cond);
+    }
+
+    err = ring->err;
+    written = ring->written;
+    len = ring->failed;
+
+    ring->err = 0;
+    ring->failed = 0;
+
+    (void) pthread_mutex_unlock(&ring->mutex);
+
+    if (len && ngx_time() - ring->error_log_time > 59) {
+
+        if (written == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, err,
+                          ngx_write_fd_n " to \"%s\" failed",
+                          file->name.data);
+
+        } else {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          ngx_write_fd_n " to \"%s\" was incomplete: "
+                          "%z of %uz", file->name.data, written, len);
+        }
+
+        ring->error_log_time = ngx_time();
+    }
+
+    if (dropped && ngx_time() - ring->error_log_time > 59) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "access log \"%s\" writer is behind, "
+                      "%ui buffers dropped", file->name.data, dropped);
+
+        ring->error_log_time = ngx_time();
+    }
+
+    file->buffer = ring->slots[ring->head % ring->nslots].start;
+    file->pos = file->buffer;
+    file->last = file->buffer + size;
+}
+
+
+static void
+ngx_http_log_drain(ngx_http_log_ring_t *ring)
+{
+    if (!ring->running) {
+        return;
+    }
+
+    (void) pthread_mutex_lock(&ring->mutex);
+
+    while (ring->tail != ring->head) {
+        (void) pthread_cond_wait(&ring->cond, &ring->mutex);
+    }
+
+    (void) pthread_mutex_unlock(&ring->mutex);
+}
+
+
+static void *
+ngx_http_log_writer(void *data)
+{
+    ngx_http_log_buf_t  *buffer = data;
+
+    ssize_t               n;
+    ngx_http_log_ring_t  *ring;
+    ngx_http_log_slot_t  *slot;
+
+    ring = buffer->ring;
+
+    (void) pthread_mutex_lock(&ring->mutex);
+
+    for ( ;; ) {
+
+        while (ring->tail == ring->head) {
+            (void) pthread_cond_wait(&ring->cond, &ring->mutex);
+        }
+
+        slot = &ring->slots[ring->tail % ring->nslots];
+
+        (void) pthread_mutex_unlock(&ring->mutex);
+
+        n = ngx_http_log_write_fd(buffer, slot->fd, slot->start, slot->len);
+
+        (void) pthread_mutex_lock(&ring->mutex);
+
+        if (n != (ssize_t) slot->len) {
+            ring->err = (n == -1) ? ngx_errno : 0;
+            ring->written = n;
+            ring->failed = slot->len;
+        }
+
+        ring->tail++;
+
+        (void) pthread_cond_broadcast(&ring->cond);
+    }
+
+    /* unreachable */
+
+    return NULL;
+}
+
+#endif
+
+
 static ssize_t
 ngx_http_log_script_write(ngx_http_request_t *r, ngx_http_log_script_t *script,
     u_char **name, u_char *buf, size_t len)
@@ -508,6 +925,8 @@ ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
 static u_char *
 ngx_http_log_time(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
 {
+    ngx_time_strings();
+
     return ngx_cpymem(buf, ngx_cached_http_log_time.data,
                       ngx_cached_http_log_time.len);
 }
@@ -515,6 +934,8 @@ ngx_http_log_time(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
 static u_char *
 ngx_http_log_iso8601(ngx_http_request_t *r, u_char *buf, ngx_http_log_op_t *op)
 {
+    ngx_time_strings();
+
     return ngx_cpymem(buf, ngx_cached_http_log_iso8601.data,
                       ngx_cached_http_log_iso8601.len);
 }
@@ -848,10 +1269,13 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_log_loc_conf_t *llcf = conf;
 
-    ssize_t                     buf;
-    ngx_uint_t                  i, n;
-    ngx_str_t                  *value, name;
+    ssize_t                     size;
+    ngx_int_t                   gzip, nslots;
+    ngx_uint_t                  i, n, drop;
+    ngx_msec_t                  flush;
+    ngx_str_t                  *value, name, s;
     ngx_http_log_t             *log;
+    ngx_http_log_buf_t         *buffer;
     ngx_http_log_fmt_t         *fmt;
     ngx_http_log_main_conf_t   *lmcf;
     ngx_http_script_compile_t   sc;
@@ -946,46 +1370,229 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
 buffer:
 
-    if (cf->args->nelts == 4) {
-        if (ngx_strncmp(value[3].data, "buffer=", 7) != 0) {
+    size = 0;
+    flush = 0;
+    gzip = 0;
+    nslots = 0;
+    drop = 0;
+
+    for (i = 3; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "buffer=", 7) == 0) {
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR || size == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid buffer value \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "flush=", 6) == 0) {
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            flush = ngx_parse_time(&s, 0);
+
+            if (flush == (ngx_msec_t) NGX_ERROR || flush == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid flush time \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "gzip", 4) == 0
+            && (value[i].len == 4 || value[i].data[4] == '='))
+        {
+#if (NGX_ZLIB)
+            if (value[i].len == 4) {
+                gzip = Z_BEST_SPEED;
+                continue;
+            }
+
+            s.len = value[i].len - 5;
+            s.data = value[i].data + 5;
+
+            gzip = ngx_atoi(s.data, s.len);
+
+            if (gzip < 1 || gzip > 9) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid compression level \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+
+#else
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid parameter \"%V\"", &value[3]);
+                               "nginx was built without zlib support");
             return NGX_CONF_ERROR;
+#endif
         }
 
-        if (log->script) {
+        if (ngx_strncmp(value[i].data, "async", 5) == 0
+            && (value[i].len == 5 || value[i].data[5] == '='))
+        {
+#if (NGX_HAVE_PTHREAD)
+            if (value[i].len == 5) {
+                nslots = 4;
+                continue;
+            }
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            nslots = ngx_atoi(s.data, s.len);
+
+            if (nslots < 2) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of async buffers \"%V\", "
+                                   "it must be at least 2", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+
+#else
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "buffered logs cannot have variables in name");
+                               "\"async\" is not supported "
+                               "on this platform");
             return NGX_CONF_ERROR;
+#endif
         }
 
-        name.len = value[3].len - 7;
-        name.data = value[3].data + 7;
+        if (ngx_strcmp(value[i].data, "backpressure=wait") == 0) {
+            drop = 0;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "backpressure=drop") == 0) {
+            drop = 1;
+            continue;
+        }
 
-        buf = ngx_parse_size(&name);
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (flush || gzip || nslots) {
+        if (size == 0) {
+            size = 64 * 1024;
+        }
 
-        if (buf == NGX_ERROR) {
+    } else if (size == 0) {
+
+        if (drop) {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid buffer value \"%V\"", &name);
+                               "\"backpressure\" requires \"async\"");
             return NGX_CONF_ERROR;
         }
 
-        if (log->file->buffer && log->file->last - log->file->pos != buf) {
+        return NGX_CONF_OK;
+    }
+
+    if (log->script) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "buffered logs cannot have variables in name");
+        return NGX_CONF_ERROR;
+    }
+
+    if (log->file->data) {
+        buffer = log->file->data;
+
+        if (log->file->last - log->file->buffer != size) {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                "access_log \"%V\" already defined "
                                "with different buffer size", &value[1]);
             return NGX_CONF_ERROR;
         }
 
-        log->file->buffer = ngx_palloc(cf->pool, buf);
-        if (log->file->buffer == NULL) {
+        if (buffer->flush != flush
+            || buffer->gzip != gzip
+#if (NGX_HAVE_PTHREAD)
+            || (ngx_int_t) (buffer->ring ? buffer->ring->nslots : 0) != nslots
+#endif
+           )
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "access_log \"%V\" already defined "
+                               "with different parameters", &value[1]);
             return NGX_CONF_ERROR;
         }
 
-        log->file->pos = log->file->buffer;
-        log->file->last = log->file->buffer + buf;
+        return NGX_CONF_OK;
+    }
+
+    buffer = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_buf_t));
+    if (buffer == NULL) {
+        return NGX_CONF_ERROR;
     }
 
+    buffer->file = log->file;
+    buffer->gzip = gzip;
+
+    if (flush) {
+        buffer->event = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
+        if (buffer->event == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        buffer->event->data = log->file;
+        buffer->event->handler = ngx_http_log_flush_handler;
+        buffer->event->log = &cf->cycle->new_log;
+
+        buffer->flush = flush;
+    }
+
+#if (NGX_HAVE_PTHREAD)
+
+    if (nslots) {
+        buffer->ring = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_ring_t));
+        if (buffer->ring == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        buffer->ring->slots = ngx_palloc(cf->pool,
+                                     sizeof(ngx_http_log_slot_t) * nslots);
+        if (buffer->ring->slots == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        for (i = 0; i < (ngx_uint_t) nslots; i++) {
+            buffer->ring->slots[i].start = ngx_palloc(cf->pool, size);
+            if (buffer->ring->slots[i].start == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        buffer->ring->nslots = nslots;
+        buffer->ring->drop = drop;
+
+        log->file->buffer = buffer->ring->slots[0].start;
+
+    } else
+#endif
+    {
+        log->file->buffer = ngx_palloc(cf->pool, size);
+        if (log->file->buffer == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    log->file->pos = log->file->buffer;
+    log->file->last = log->file->buffer + size;
+
+    log->file->flush = ngx_http_log_flush;
+    log->file->data = buffer;
+
     return NGX_CONF_OK;
 }
 
@@ -1349,3 +1956,79 @@ ngx_http_log_init(ngx_conf_t *cf)
 
     return NGX_OK;
 }
+
+
+static ngx_int_t
+ngx_http_log_init_process(ngx_cycle_t *cycle)
+{
+#if (NGX_HAVE_PTHREAD)
+
+    int                   err;
+    pthread_t             tid;
+    sigset_t              set, old;
+    ngx_uint_t            i;
+    ngx_list_part_t      *part;
+    ngx_open_file_t      *file;
+    ngx_http_log_buf_t   *buffer;
+    ngx_http_log_ring_t  *ring;
+
+    part = &cycle->open_files.part;
+    file = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            file = part->elts;
+            i = 0;
+        }
+
+        if (file[i].flush != ngx_http_log_flush) {
+            continue;
+        }
+
+        buffer = file[i].data;
+        ring = buffer->ring;
+
+        if (ring == NULL) {
+            continue;
+        }
+
+        if (pthread_mutex_init(&ring->mutex, NULL) != 0
+            || pthread_cond_init(&ring->cond, NULL) != 0)
+        {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                          "access log \"%s\" writer initialization failed, "
+                          "writing synchronously", file[i].name.data);
+            continue;
+        }
+
+        /* the signals must be delivered to the worker, not to the writer */
+
+        sigfillset(&set);
+
+        (void) pthread_sigmask(SIG_BLOCK, &set, &old);
+
+        err = pthread_create(&tid, NULL, ngx_http_log_writer, buffer);
+
+        (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+        if (err != 0) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, err,
+                          "pthread_create() for access log \"%s\" failed, "
+                          "writing synchronously", file[i].name.data);
+            continue;
+        }
+
+        (void) pthread_detach(tid);
+
+        ring->running = 1;
+    }
+
+#endif
+
+    return NGX_OK;
+}
@@ -16,6 +16,36 @@ typedef struct {
 } ngx_http_map_conf_t;
 
 
+/*
+ * A precompiled map file is built offline by contrib/map2db.pl and is
+ * mapped read-only, so all workers share its pages and a reload does not
+ * rebuild it.  All numbers are little-endian, the 32-bit ones are read
+ * as is and the byte order mark rejects the file on other hosts:
+ *
+ *     "NGXMAP01", 0x01020304, nkeys, nbuckets, nslots, seed, 0,
+ *     disp[nbuckets], slots[nslots], records
+ *
+ * A key hashes to a bucket and to a pair (h1, h2), its slot is
+ * (h1 + disp[bucket] * h2) % nslots.  A slot holds the file offset of
+ * a record "klen:16 vlen:16 key value" or 0, keys are lowercase.
+ */
+
+#define NGX_HTTP_MAP_DB_HEADER  32
+
+
+typedef struct {
+    u_char                     *start;
+    size_t                      size;
+    uint32_t                    nbuckets;
+    uint32_t                    nslots;
+    uint32_t                    seed;
+    uint32_t                   *disp;
+    uint32_t                   *slots;
+    u_char                     *name;
+    ngx_log_t                  *log;
+} ngx_http_map_db_t;
+
+
 typedef struct {
     ngx_hash_keys_arrays_t      keys;
 
@@ -26,6 +56,7 @@ typedef struct {
 #endif
 
     ngx_http_variable_value_t  *default_value;
+    ngx_http_map_db_t          *db;
     ngx_conf_t                 *cf;
     ngx_uint_t                  hostnames;      /* unsigned  hostnames:1 */
 } ngx_http_map_conf_ctx_t;
@@ -35,6 +66,7 @@ typedef struct {
     ngx_http_map_t              map;
     ngx_http_complex_value_t    value;
     ngx_http_variable_value_t  *default_value;
+    ngx_http_map_db_t          *db;
     ngx_uint_t                  hostnames;      /* unsigned  hostnames:1 */
 } ngx_http_map_ctx_t;
 
@@ -44,6 +76,11 @@ static int ngx_libc_cdecl ngx_http_map_cmp_dns_wildcards(const void *one,
 static void *ngx_http_map_create_conf(ngx_conf_t *cf);
 static char *ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf);
+static char *ngx_http_map_db_open(ngx_conf_t *cf, ngx_http_map_conf_ctx_t *ctx,
+    ngx_str_t *name);
+static void ngx_http_map_db_cleanup(void *data);
+static ngx_int_t ngx_http_map_db_find(ngx_http_map_db_t *db, ngx_str_t *key,
+    ngx_str_t *value);
 
 
 static ngx_command_t  ngx_http_map_commands[] = {
@@ -110,7 +147,7 @@ ngx_http_map_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_http_map_ctx_t  *map = (ngx_http_map_ctx_t *) data;
 
-    ngx_str_t                   val;
+    ngx_str_t                   val, str;
     ngx_http_variable_value_t  *value;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -126,6 +163,22 @@ ngx_http_map_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 
     value = ngx_http_map_find(r, &map->map, &val);
 
+    if (value == NULL
+        && map->db
+        && ngx_http_map_db_find(map->db, &val, &str) == NGX_OK)
+    {
+        v->len = str.len;
+        v->valid = 1;
+        v->no_cacheable = 0;
+        v->not_found = 0;
+        v->data = str.data;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http map precompiled: \"%v\" \"%v\"", &val, v);
+
+        return NGX_OK;
+    }
+
     if (value == NULL) {
         value = map->default_value;
     }
@@ -257,6 +310,7 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #endif
 
     ctx.default_value = NULL;
+    ctx.db = NULL;
     ctx.cf = &save;
     ctx.hostnames = 0;
 
@@ -279,6 +333,7 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                                              &ngx_http_variable_null_value;
 
     map->hostnames = ctx.hostnames;
+    map->db = ctx.db;
 
     hash.key = ngx_hash_key_lc;
     hash.max_size = mcf->hash_max_size;
@@ -394,6 +449,10 @@ ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
         return ngx_conf_include(cf, dummy, conf);
     }
 
+    if (ngx_strcmp(value[0].data, "precompiled") == 0) {
+        return ngx_http_map_db_open(cf, ctx, &value[1]);
+    }
+
     if (value[1].data[0] == '$') {
         name = value[1];
         name.len--;
@@ -558,3 +617,211 @@ found:
 
     return NGX_CONF_ERROR;
 }
+
+
+static char *
+ngx_http_map_db_open(ngx_conf_t *cf, ngx_http_map_conf_ctx_t *ctx,
+    ngx_str_t *name)
+{
+    u_char              *p;
+    size_t               size;
+    uint32_t            *h;
+    ngx_fd_t             fd;
+    ngx_file_info_t      fi;
+    ngx_pool_cleanup_t  *cln;
+    ngx_http_map_db_t   *db;
+
+    if (ctx->db) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate precompiled map parameter");
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_conf_full_name(cf->cycle, name, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%s\" failed", name->data);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%s\" failed", name->data);
+        goto failed;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size < NGX_HTTP_MAP_DB_HEADER) {
+        goto invalid;
+    }
+
+    p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           "mmap(\"%s\", %uz) failed", name->data, size);
+        goto failed;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    fd = NGX_INVALID_FILE;
+
+    db = ngx_pcalloc(ctx->cf->pool, sizeof(ngx_http_map_db_t));
+    if (db == NULL) {
+        (void) munmap(p, size);
+        return NGX_CONF_ERROR;
+    }
+
+    db->start = p;
+    db->size = size;
+    db->log = ctx->cf->cycle->log;
+
+    db->name = ngx_pstrdup(ctx->cf->pool, name);
+    if (db->name == NULL) {
+        (void) munmap(p, size);
+        return NGX_CONF_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(ctx->cf->pool, 0);
+    if (cln == NULL) {
+        (void) munmap(p, size);
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_map_db_cleanup;
+    cln->data = db;
+
+    h = (uint32_t *) (p + 8);
+
+    if (ngx_strncmp(p, "NGXMAP01", 8) != 0
+        || h[0] != 0x01020304
+        || h[2] == 0
+        || h[3] < 2
+        || (uint64_t) NGX_HTTP_MAP_DB_HEADER
+           + 4 * ((uint64_t) h[2] + h[3]) > size)
+    {
+        goto invalid;
+    }
+
+    db->nbuckets = h[2];
+    db->nslots = h[3];
+    db->seed = h[4];
+    db->disp = (uint32_t *) (p + NGX_HTTP_MAP_DB_HEADER);
+    db->slots = db->disp + db->nbuckets;
+
+    ctx->db = db;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"%s\" is not a precompiled map", name->data);
+
+failed:
+
+    if (fd != NGX_INVALID_FILE && ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return NGX_CONF_ERROR;
+}
+
+
+static void
+ngx_http_map_db_cleanup(void *data)
+{
+    ngx_http_map_db_t  *db = data;
+
+    if (munmap(db->start, db->size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, db->log, ngx_errno,
+                      "munmap(\"%s\", %uz) failed", db->name, db->size);
+    }
+}
+
+
+static uint32_t
+ngx_http_map_db_mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+
+static ngx_int_t
+ngx_http_map_db_find(ngx_http_map_db_t *db, ngx_str_t *key, ngx_str_t *value)
+{
+    u_char    *p;
+    size_t     i, n, klen, vlen;
+    uint32_t   a, b, w, h1, h2, off;
+    uint64_t   slot;
+
+    /* the hash must match the one of contrib/map2db.pl */
+
+    a = 0x811c9dc5 ^ db->seed;
+    b = db->seed ^ (uint32_t) key->len;
+
+    for (i = 0; i < key->len; i += 4) {
+        n = ngx_min(key->len - i, 4);
+        w = 0;
+
+        while (n--) {
+            w = (w << 8) | ngx_tolower(key->data[i + n]);
+        }
+
+        a = (a ^ w) * 0x01000193;
+        b = (b ^ w) * 0x5bd1e995;
+        b ^= b >> 15;
+    }
+
+    h1 = ngx_http_map_db_mix(b) % db->nslots;
+    h2 = ngx_http_map_db_mix(a ^ b ^ 0x9e3779b9) % (db->nslots - 1) + 1;
+
+    slot = (h1 + (uint64_t) db->disp[ngx_http_map_db_mix(a) % db->nbuckets]
+                 * h2)
+           % db->nslots;
+
+    off = db->slots[slot];
+
+    if (off == 0 || off > db->size - 4) {
+        return NGX_DECLINED;
+    }
+
+    p = db->start + off;
+
+    klen = p[0] | (p[1] << 8);
+    vlen = p[2] | (p[3] << 8);
+
+    if (klen != key->len || off + 4 + klen + vlen > db->size) {
+        return NGX_DECLINED;
+    }
+
+    p += 4;
+
+    for (i = 0; i < klen; i++) {
+        if (ngx_tolower(key->data[i]) != p[i]) {
+            return NGX_DECLINED;
+        }
+    }
+
+    value->len = vlen;
+    value->data = p + klen;
+
+    return NGX_OK;
+}
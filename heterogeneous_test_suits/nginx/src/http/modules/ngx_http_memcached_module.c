@@ -10,13 +10,28 @@
 #include <ngx_http.h>
 
 
+typedef struct ngx_http_memcached_pipe_s  ngx_http_memcached_pipe_t;
+
+
 typedef struct {
     ngx_http_upstream_conf_t   upstream;
     ngx_int_t                  index;
     ngx_uint_t                 gzip_flag;
+
+    ngx_flag_t                 pipeline;
+    ngx_uint_t                 pipeline_keys;
+
+    /* one pipe per peer, allocated in a worker */
+    ngx_uint_t                 npipes;
+    ngx_http_memcached_pipe_t *pipes;
 } ngx_http_memcached_loc_conf_t;
 
 
+typedef struct {
+    ngx_array_t                confs;      /* ngx_http_memcached_loc_conf_t * */
+} ngx_http_memcached_main_conf_t;
+
+
 typedef struct {
     size_t                     rest;
     ngx_http_request_t        *request;
@@ -24,6 +39,71 @@ typedef struct {
 } ngx_http_memcached_ctx_t;
 
 
+/*
+ * a key requested through a pipe, the requests for the same key
+ * wait for the single get of the key
+ */
+
+typedef struct {
+    ngx_str_node_t             sn;
+    ngx_queue_t                queue;
+    ngx_queue_t                waiters;
+    ngx_http_memcached_pipe_t *pipe;
+
+    u_char                    *value;
+    size_t                     len;
+    ngx_uint_t                 flags;
+
+    /* the last key of a multi-get line */
+    unsigned                   last:1;
+} ngx_http_memcached_key_t;
+
+
+typedef struct {
+    ngx_queue_t                queue;
+    ngx_http_request_t        *request;
+    ngx_http_memcached_key_t  *key;
+} ngx_http_memcached_waiter_t;
+
+
+#define NGX_HTTP_MEMCACHED_LINE     0
+#define NGX_HTTP_MEMCACHED_DATA     1
+#define NGX_HTTP_MEMCACHED_TRAILER  2
+
+
+/*
+ * a connection to a peer shared by the requests of a worker,
+ * the queued keys are sent as multi-gets without waiting for
+ * the responses to the keys sent before
+ */
+
+struct ngx_http_memcached_pipe_s {
+    ngx_http_memcached_loc_conf_t  *conf;
+    ngx_http_upstream_rr_peer_t    *peer;
+    ngx_connection_t               *connection;
+
+    ngx_rbtree_t                    rbtree;
+    ngx_rbtree_node_t               sentinel;
+
+    ngx_queue_t                     queued;
+    ngx_queue_t                     sent;
+
+    ngx_buf_t                       in;
+    ngx_buf_t                       out;
+
+    ngx_http_memcached_key_t       *current;
+    size_t                          rest;
+    ngx_uint_t                      state;
+
+    ngx_event_t                     flush;
+
+    unsigned                        connecting:1;
+    unsigned                        ended:1;
+};
+
+
+static ngx_int_t ngx_http_memcached_eval_key(ngx_http_request_t *r,
+    ngx_str_t *key);
 static ngx_int_t ngx_http_memcached_create_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_memcached_reinit_request(ngx_http_request_t *r);
 static ngx_int_t ngx_http_memcached_process_header(ngx_http_request_t *r);
@@ -33,6 +113,24 @@ static void ngx_http_memcached_abort_request(ngx_http_request_t *r);
 static void ngx_http_memcached_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
 
+static ngx_int_t ngx_http_memcached_pipe_handler(ngx_http_request_t *r,
+    ngx_http_memcached_loc_conf_t *mlcf);
+static void ngx_http_memcached_pipe_cleanup(void *data);
+static void ngx_http_memcached_pipe_flush(ngx_event_t *ev);
+static void ngx_http_memcached_pipe_connect(ngx_http_memcached_pipe_t *p);
+static ngx_int_t ngx_http_memcached_pipe_send(ngx_http_memcached_pipe_t *p);
+static void ngx_http_memcached_pipe_write_handler(ngx_event_t *wev);
+static void ngx_http_memcached_pipe_read_handler(ngx_event_t *rev);
+static ngx_int_t ngx_http_memcached_pipe_parse(ngx_http_memcached_pipe_t *p);
+static void ngx_http_memcached_pipe_done(ngx_http_memcached_key_t *k,
+    ngx_int_t status);
+static void ngx_http_memcached_pipe_respond(ngx_http_request_t *r,
+    ngx_http_memcached_key_t *k, ngx_int_t status);
+static void ngx_http_memcached_pipe_close(ngx_http_memcached_pipe_t *p,
+    ngx_int_t status);
+
+static ngx_int_t ngx_http_memcached_init_process(ngx_cycle_t *cycle);
+static void *ngx_http_memcached_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_memcached_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_memcached_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -109,6 +207,20 @@ static ngx_command_t  ngx_http_memcached_commands[] = {
       offsetof(ngx_http_memcached_loc_conf_t, gzip_flag),
       NULL },
 
+    { ngx_string("memcached_pipeline"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_memcached_loc_conf_t, pipeline),
+      NULL },
+
+    { ngx_string("memcached_pipeline_keys"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_memcached_loc_conf_t, pipeline_keys),
+      NULL },
+
       ngx_null_command
 };
 
@@ -117,7 +229,7 @@ static ngx_http_module_t  ngx_http_memcached_module_ctx = {
     NULL,                                  /* preconfiguration */
     NULL,                                  /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
+    ngx_http_memcached_create_main_conf,   /* create main configuration */
     NULL,                                  /* init main configuration */
 
     NULL,                                  /* create server configuration */
@@ -135,7 +247,7 @@ ngx_module_t  ngx_http_memcached_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_memcached_init_process,       /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -173,6 +285,12 @@ ngx_http_memcached_handler(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
+    mlcf = ngx_http_get_module_loc_conf(r, ngx_http_memcached_module);
+
+    if (mlcf->pipes) {
+        return ngx_http_memcached_pipe_handler(r, mlcf);
+    }
+
     if (ngx_http_upstream_create(r) != NGX_OK) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
@@ -182,8 +300,6 @@ ngx_http_memcached_handler(ngx_http_request_t *r)
     ngx_str_set(&u->schema, "memcached://");
     u->output.tag = (ngx_buf_tag_t) &ngx_http_memcached_module;
 
-    mlcf = ngx_http_get_module_loc_conf(r, ngx_http_memcached_module);
-
     u->conf = &mlcf->upstream;
 
     u->create_request = ngx_http_memcached_create_request;
@@ -215,13 +331,9 @@ ngx_http_memcached_handler(ngx_http_request_t *r)
 
 
 static ngx_int_t
-ngx_http_memcached_create_request(ngx_http_request_t *r)
+ngx_http_memcached_eval_key(ngx_http_request_t *r, ngx_str_t *key)
 {
-    size_t                          len;
     uintptr_t                       escape;
-    ngx_buf_t                      *b;
-    ngx_chain_t                    *cl;
-    ngx_http_memcached_ctx_t       *ctx;
     ngx_http_variable_value_t      *vv;
     ngx_http_memcached_loc_conf_t  *mlcf;
 
@@ -237,7 +349,39 @@ ngx_http_memcached_create_request(ngx_http_request_t *r)
 
     escape = 2 * ngx_escape_uri(NULL, vv->data, vv->len, NGX_ESCAPE_MEMCACHED);
 
-    len = sizeof("get ") - 1 + vv->len + escape + sizeof(CRLF) - 1;
+    if (escape == 0) {
+        key->len = vv->len;
+        key->data = vv->data;
+        return NGX_OK;
+    }
+
+    key->len = vv->len + escape;
+
+    key->data = ngx_pnalloc(r->pool, key->len);
+    if (key->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_escape_uri(key->data, vv->data, vv->len, NGX_ESCAPE_MEMCACHED);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_memcached_create_request(ngx_http_request_t *r)
+{
+    size_t                     len;
+    ngx_buf_t                 *b;
+    ngx_str_t                  key;
+    ngx_chain_t               *cl;
+    ngx_http_memcached_ctx_t  *ctx;
+
+    if (ngx_http_memcached_eval_key(r, &key) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    len = sizeof("get ") - 1 + key.len + sizeof(CRLF) - 1;
 
     b = ngx_create_temp_buf(r->pool, len);
     if (b == NULL) {
@@ -259,16 +403,8 @@ ngx_http_memcached_create_request(ngx_http_request_t *r)
     ctx = ngx_http_get_module_ctx(r, ngx_http_memcached_module);
 
     ctx->key.data = b->last;
-
-    if (escape == 0) {
-        b->last = ngx_copy(b->last, vv->data, vv->len);
-
-    } else {
-        b->last = (u_char *) ngx_escape_uri(b->last, vv->data, vv->len,
-                                            NGX_ESCAPE_MEMCACHED);
-    }
-
-    ctx->key.len = b->last - ctx->key.data;
+    b->last = ngx_copy(b->last, key.data, key.len);
+    ctx->key.len = key.len;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http memcached request: \"%V\"", &ctx->key);
@@ -554,6 +690,916 @@ ngx_http_memcached_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
 }
 
 
+static ngx_int_t
+ngx_http_memcached_pipe_handler(ngx_http_request_t *r,
+    ngx_http_memcached_loc_conf_t *mlcf)
+{
+    uint32_t                      hash;
+    ngx_str_t                     key;
+    ngx_uint_t                    i, n;
+    ngx_pool_cleanup_t           *cln;
+    ngx_http_memcached_key_t     *k;
+    ngx_http_memcached_pipe_t    *p;
+    ngx_http_memcached_waiter_t  *w;
+
+    if (ngx_http_memcached_eval_key(r, &key) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    hash = ngx_crc32_short(key.data, key.len);
+
+    /* the keys are spread over the peers, a peer down passes to the next */
+
+    n = hash % mlcf->npipes;
+
+    for (i = 0; i < mlcf->npipes; i++) {
+        p = &mlcf->pipes[(n + i) % mlcf->npipes];
+
+        if (!ngx_http_upstream_rr_peer_down(p->peer)) {
+            goto found;
+        }
+    }
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "no live memcached peers for key \"%V\"", &key);
+
+    return NGX_HTTP_BAD_GATEWAY;
+
+found:
+
+    w = ngx_palloc(r->pool, sizeof(ngx_http_memcached_waiter_t));
+    if (w == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    k = (ngx_http_memcached_key_t *) ngx_str_rbtree_lookup(&p->rbtree, &key,
+                                                            hash);
+
+    if (k == NULL) {
+        k = ngx_alloc(sizeof(ngx_http_memcached_key_t) + key.len,
+                      r->connection->log);
+        if (k == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ngx_memzero(k, sizeof(ngx_http_memcached_key_t));
+
+        k->sn.node.key = hash;
+        k->sn.str.len = key.len;
+        k->sn.str.data = (u_char *) k + sizeof(ngx_http_memcached_key_t);
+        ngx_memcpy(k->sn.str.data, key.data, key.len);
+
+        k->pipe = p;
+        ngx_queue_init(&k->waiters);
+
+        ngx_rbtree_insert(&p->rbtree, &k->sn.node);
+        ngx_queue_insert_tail(&p->queued, &k->queue);
+
+        /* the keys queued until the end of the event cycle share a get */
+
+        ngx_post_event((&p->flush), &ngx_posted_events);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http memcached pipeline key: \"%V\" to %V",
+                       &key, &p->peer->name);
+
+    } else {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http memcached pipeline key: \"%V\" collapsed",
+                       &key);
+    }
+
+    w->request = r;
+    w->key = k;
+    ngx_queue_insert_tail(&k->waiters, &w->queue);
+
+    cln->handler = ngx_http_memcached_pipe_cleanup;
+    cln->data = w;
+
+    r->main->count++;
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_memcached_pipe_cleanup(void *data)
+{
+    ngx_http_memcached_waiter_t  *w = data;
+
+    /* the response to the key is still discarded when it arrives */
+
+    if (w->key) {
+        ngx_queue_remove(&w->queue);
+        w->key = NULL;
+    }
+}
+
+
+static void
+ngx_http_memcached_pipe_flush(ngx_event_t *ev)
+{
+    ngx_http_memcached_pipe_t  *p;
+
+    p = ev->data;
+
+    if (ngx_queue_empty(&p->queued)) {
+        return;
+    }
+
+    if (p->connection == NULL) {
+        ngx_http_memcached_pipe_connect(p);
+        return;
+    }
+
+    if (p->connecting) {
+        return;
+    }
+
+    if (ngx_http_memcached_pipe_send(p) != NGX_OK) {
+        ngx_http_memcached_pipe_close(p, NGX_HTTP_BAD_GATEWAY);
+    }
+}
+
+
+static void
+ngx_http_memcached_pipe_connect(ngx_http_memcached_pipe_t *p)
+{
+    ngx_int_t               rc;
+    ngx_connection_t       *c;
+    ngx_peer_connection_t   pc;
+
+    ngx_memzero(&pc, sizeof(ngx_peer_connection_t));
+
+    pc.sockaddr = p->peer->sockaddr;
+    pc.socklen = p->peer->socklen;
+    pc.name = &p->peer->name;
+    pc.get = ngx_event_get_peer;
+    pc.log = ngx_cycle->log;
+    pc.log_error = NGX_ERROR_ERR;
+    pc.local = p->conf->upstream.local;
+    pc.tries = 1;
+
+    rc = ngx_event_connect_peer(&pc);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "memcached pipeline connect to %V: %i", &p->peer->name, rc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+
+        if (pc.connection) {
+            ngx_close_connection(pc.connection);
+        }
+
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "memcached pipeline could not connect to %V",
+                      &p->peer->name);
+
+        ngx_http_memcached_pipe_close(p, NGX_HTTP_BAD_GATEWAY);
+        return;
+    }
+
+    c = pc.connection;
+
+    c->data = p;
+    c->read->handler = ngx_http_memcached_pipe_read_handler;
+    c->write->handler = ngx_http_memcached_pipe_write_handler;
+
+    p->connection = c;
+
+    if (rc == NGX_AGAIN) {
+        p->connecting = 1;
+        ngx_add_timer(c->write, p->conf->upstream.connect_timeout);
+        return;
+    }
+
+    if (ngx_http_memcached_pipe_send(p) != NGX_OK) {
+        ngx_http_memcached_pipe_close(p, NGX_HTTP_BAD_GATEWAY);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_memcached_pipe_send(ngx_http_memcached_pipe_t *p)
+{
+    u_char                    *start;
+    size_t                     size, used;
+    ssize_t                    n;
+    ngx_buf_t                 *b;
+    ngx_uint_t                 i;
+    ngx_queue_t               *q;
+    ngx_connection_t          *c;
+    ngx_http_memcached_key_t  *k;
+
+    c = p->connection;
+    b = &p->out;
+
+    /* build the multi-get lines of the queued keys */
+
+    while (!ngx_queue_empty(&p->queued)) {
+
+        size = sizeof("get" CRLF) - 1;
+
+        for (q = ngx_queue_head(&p->queued), i = 0;
+             q != ngx_queue_sentinel(&p->queued)
+             && i < p->conf->pipeline_keys;
+             q = ngx_queue_next(q), i++)
+        {
+            k = ngx_queue_data(q, ngx_http_memcached_key_t, queue);
+            size += 1 + k->sn.str.len;
+        }
+
+        if ((size_t) (b->end - b->last) < size) {
+            used = b->last - b->pos;
+
+            if ((size_t) (b->end - b->start) < used + size) {
+                start = ngx_alloc(ngx_max(2 * (b->end - b->start),
+                                          (ssize_t) (used + size)),
+                                  c->log);
+                if (start == NULL) {
+                    return NGX_ERROR;
+                }
+
+                ngx_memcpy(start, b->pos, used);
+
+                if (b->start) {
+                    ngx_free(b->start);
+                }
+
+                b->end = start + ngx_max(2 * (b->end - b->start),
+                                         (ssize_t) (used + size));
+                b->start = start;
+
+            } else {
+                ngx_memmove(b->start, b->pos, used);
+            }
+
+            b->pos = b->start;
+            b->last = b->start + used;
+        }
+
+        b->last = ngx_cpymem(b->last, "get", sizeof("get") - 1);
+
+        while (i--) {
+            q = ngx_queue_head(&p->queued);
+            ngx_queue_remove(q);
+            ngx_queue_insert_tail(&p->sent, q);
+
+            k = ngx_queue_data(q, ngx_http_memcached_key_t, queue);
+            k->last = (i == 0);
+
+            *b->last++ = ' ';
+            b->last = ngx_cpymem(b->last, k->sn.str.data, k->sn.str.len);
+        }
+
+        *b->last++ = CR; *b->last++ = LF;
+    }
+
+    while (b->pos < b->last) {
+        n = c->send(c, b->pos, b->last - b->pos);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "memcached pipeline send: %z of %uz",
+                       n, (size_t) (b->last - b->pos));
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (!c->write->timer_set) {
+                ngx_add_timer(c->write, p->conf->upstream.send_timeout);
+            }
+
+            if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            break;
+        }
+
+        b->pos += n;
+    }
+
+    if (b->pos == b->last) {
+        b->pos = b->start;
+        b->last = b->start;
+
+        if (c->write->timer_set) {
+            ngx_del_timer(c->write);
+        }
+    }
+
+    if (!ngx_queue_empty(&p->sent)) {
+        c->idle = 0;
+
+        if (!c->read->timer_set) {
+            ngx_add_timer(c->read, p->conf->upstream.read_timeout);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_memcached_pipe_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t           *c;
+    ngx_http_memcached_pipe_t  *p;
+
+    c = wev->data;
+    p = c->data;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "memcached pipeline to %V timed out", &p->peer->name);
+        ngx_http_memcached_pipe_close(p, NGX_HTTP_GATEWAY_TIME_OUT);
+        return;
+    }
+
+    if (p->connecting) {
+        p->connecting = 0;
+
+        if (wev->timer_set) {
+            ngx_del_timer(wev);
+        }
+    }
+
+    if (ngx_http_memcached_pipe_send(p) != NGX_OK) {
+        ngx_http_memcached_pipe_close(p, NGX_HTTP_BAD_GATEWAY);
+    }
+}
+
+
+static void
+ngx_http_memcached_pipe_read_handler(ngx_event_t *rev)
+{
+    ssize_t                     n;
+    ngx_buf_t                  *b;
+    ngx_connection_t           *c;
+    ngx_http_memcached_pipe_t  *p;
+
+    c = rev->data;
+    p = c->data;
+
+    if (c->close) {
+        /* an exiting worker closes the idle pipe */
+        ngx_http_memcached_pipe_close(p, NGX_HTTP_BAD_GATEWAY);
+        return;
+    }
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "memcached pipeline to %V timed out", &p->peer->name);
+        ngx_http_memcached_pipe_close(p, NGX_HTTP_GATEWAY_TIME_OUT);
+        return;
+    }
+
+    b = &p->in;
+
+    for ( ;; ) {
+
+        if (b->last == b->end) {
+
+            if (b->pos == b->start) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "memcached sent too long response line");
+                ngx_http_memcached_pipe_close(p, NGX_HTTP_BAD_GATEWAY);
+                return;
+            }
+
+            b->last = ngx_movemem(b->start, b->pos, b->last - b->pos);
+            b->pos = b->start;
+        }
+
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+
+            if (n == 0 && !ngx_queue_empty(&p->sent)) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "memcached prematurely closed pipeline "
+                              "connection to %V", &p->peer->name);
+            }
+
+            ngx_http_memcached_pipe_close(p, NGX_HTTP_BAD_GATEWAY);
+            return;
+        }
+
+        b->last += n;
+
+        if (ngx_http_memcached_pipe_parse(p) == NGX_ERROR) {
+            ngx_http_memcached_pipe_close(p, NGX_HTTP_BAD_GATEWAY);
+            return;
+        }
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_memcached_pipe_close(p, NGX_HTTP_BAD_GATEWAY);
+        return;
+    }
+
+    if (ngx_queue_empty(&p->sent) && p->current == NULL) {
+        if (rev->timer_set) {
+            ngx_del_timer(rev);
+        }
+
+        c->idle = 1;
+
+    } else {
+        ngx_add_timer(rev, p->conf->upstream.read_timeout);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_memcached_pipe_parse(ngx_http_memcached_pipe_t *p)
+{
+    u_char                    *lf, *s, *last;
+    size_t                     size;
+    off_t                      len;
+    ngx_int_t                  flags;
+    ngx_str_t                  line, key, response;
+    ngx_buf_t                 *b;
+    ngx_uint_t                 end;
+    ngx_queue_t               *q;
+    ngx_connection_t          *c;
+    ngx_http_memcached_key_t  *k;
+
+    b = &p->in;
+    c = p->connection;
+
+    for ( ;; ) {
+
+        switch (p->state) {
+
+        case NGX_HTTP_MEMCACHED_DATA:
+
+            size = ngx_min((size_t) (b->last - b->pos), p->rest);
+
+            ngx_memcpy(p->current->value + p->current->len - p->rest,
+                       b->pos, size);
+
+            b->pos += size;
+            p->rest -= size;
+
+            if (p->rest) {
+                return NGX_AGAIN;
+            }
+
+            p->state = NGX_HTTP_MEMCACHED_TRAILER;
+
+            /* fall through */
+
+        case NGX_HTTP_MEMCACHED_TRAILER:
+
+            if (b->last - b->pos < 2) {
+                return NGX_AGAIN;
+            }
+
+            if (b->pos[0] != CR || b->pos[1] != LF) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "memcached sent invalid trailer for key \"%V\"",
+                              &p->current->sn.str);
+                return NGX_ERROR;
+            }
+
+            b->pos += 2;
+
+            k = p->current;
+            p->current = NULL;
+            p->state = NGX_HTTP_MEMCACHED_LINE;
+
+            ngx_http_memcached_pipe_done(k, NGX_HTTP_OK);
+
+            break;
+
+        default: /* NGX_HTTP_MEMCACHED_LINE */
+
+            lf = ngx_strlchr(b->pos, b->last, LF);
+
+            if (lf == NULL) {
+                return NGX_AGAIN;
+            }
+
+            line.data = b->pos;
+            line.len = lf - b->pos;
+
+            if (line.len && line.data[line.len - 1] == CR) {
+                line.len--;
+            }
+
+            b->pos = lf + 1;
+            response = line;
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "memcached pipeline: \"%V\"", &line);
+
+            if (ngx_queue_empty(&p->sent) && !p->ended) {
+                goto invalid;
+            }
+
+            if (line.len == sizeof("END") - 1
+                && ngx_strncmp(line.data, "END", sizeof("END") - 1) == 0)
+            {
+                if (p->ended) {
+                    p->ended = 0;
+                    break;
+                }
+
+                /* the keys left in the multi-get were not found */
+
+                do {
+                    q = ngx_queue_head(&p->sent);
+                    ngx_queue_remove(q);
+
+                    k = ngx_queue_data(q, ngx_http_memcached_key_t, queue);
+                    end = k->last;
+
+                    ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                                  "key: \"%V\" was not found by memcached",
+                                  &k->sn.str);
+
+                    ngx_http_memcached_pipe_done(k, NGX_HTTP_NOT_FOUND);
+
+                } while (!end);
+
+                break;
+            }
+
+            if (line.len <= sizeof("VALUE ") - 1
+                || ngx_strncmp(line.data, "VALUE ", sizeof("VALUE ") - 1)
+                   != 0
+                || p->ended)
+            {
+                goto invalid;
+            }
+
+            /* "VALUE <key> <flags> <length>[ <cas>]" */
+
+            last = line.data + line.len;
+
+            key.data = line.data + sizeof("VALUE ") - 1;
+            s = ngx_strlchr(key.data, last, ' ');
+
+            if (s == NULL) {
+                goto invalid;
+            }
+
+            key.len = s - key.data;
+
+            line.data = s + 1;
+            s = ngx_strlchr(line.data, last, ' ');
+
+            if (s == NULL) {
+                goto invalid;
+            }
+
+            flags = ngx_atoi(line.data, s - line.data);
+
+            line.data = s + 1;
+            s = ngx_strlchr(line.data, last, ' ');
+
+            if (s == NULL) {
+                s = last;
+            }
+
+            len = ngx_atoof(line.data, s - line.data);
+
+            if (flags == NGX_ERROR || len == NGX_ERROR) {
+                goto invalid;
+            }
+
+            /* the keys before the value in the multi-get were not found */
+
+            for ( ;; ) {
+                q = ngx_queue_head(&p->sent);
+                k = ngx_queue_data(q, ngx_http_memcached_key_t, queue);
+
+                if (k->sn.str.len == key.len
+                    && ngx_strncmp(k->sn.str.data, key.data, key.len) == 0)
+                {
+                    break;
+                }
+
+                if (k->last) {
+                    ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                                  "memcached sent invalid key \"%V\"", &key);
+                    return NGX_ERROR;
+                }
+
+                ngx_queue_remove(q);
+
+                ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                              "key: \"%V\" was not found by memcached",
+                              &k->sn.str);
+
+                ngx_http_memcached_pipe_done(k, NGX_HTTP_NOT_FOUND);
+            }
+
+            ngx_queue_remove(q);
+
+            if (k->last) {
+                p->ended = 1;
+            }
+
+            k->value = ngx_alloc((size_t) len + 1, c->log);
+            if (k->value == NULL) {
+                ngx_http_memcached_pipe_done(k, NGX_HTTP_INTERNAL_SERVER_ERROR);
+                return NGX_ERROR;
+            }
+
+            k->len = (size_t) len;
+            k->flags = flags;
+
+            p->current = k;
+            p->rest = (size_t) len;
+            p->state = NGX_HTTP_MEMCACHED_DATA;
+
+            break;
+        }
+    }
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                  "memcached sent invalid response: \"%V\"", &response);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_memcached_pipe_done(ngx_http_memcached_key_t *k, ngx_int_t status)
+{
+    ngx_queue_t                  *q;
+    ngx_http_memcached_waiter_t  *w;
+
+    ngx_rbtree_delete(&k->pipe->rbtree, &k->sn.node);
+
+    while (!ngx_queue_empty(&k->waiters)) {
+        q = ngx_queue_head(&k->waiters);
+        ngx_queue_remove(q);
+
+        w = ngx_queue_data(q, ngx_http_memcached_waiter_t, queue);
+        w->key = NULL;
+
+        ngx_http_memcached_pipe_respond(w->request, k, status);
+    }
+
+    if (k->value) {
+        ngx_free(k->value);
+    }
+
+    ngx_free(k);
+}
+
+
+static void
+ngx_http_memcached_pipe_respond(ngx_http_request_t *r,
+    ngx_http_memcached_key_t *k, ngx_int_t status)
+{
+    ngx_int_t                       rc;
+    ngx_buf_t                      *b;
+    ngx_chain_t                     out;
+    ngx_table_elt_t                *h;
+    ngx_connection_t               *c;
+    ngx_http_log_ctx_t             *ctx;
+    ngx_http_memcached_loc_conf_t  *mlcf;
+
+    c = r->connection;
+
+    ctx = c->log->data;
+    ctx->current_request = r;
+
+    if (status != NGX_HTTP_OK) {
+        rc = status;
+        goto done;
+    }
+
+    mlcf = ngx_http_get_module_loc_conf(r, ngx_http_memcached_module);
+
+    if (k->flags & mlcf->gzip_flag) {
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            rc = NGX_ERROR;
+            goto done;
+        }
+
+        h->hash = 1;
+        ngx_str_set(&h->key, "Content-Encoding");
+        ngx_str_set(&h->value, "gzip");
+
+        r->headers_out.content_encoding = h;
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = k->len;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        goto done;
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    if (k->len) {
+        b->pos = ngx_pnalloc(r->pool, k->len);
+        if (b->pos == NULL) {
+            rc = NGX_ERROR;
+            goto done;
+        }
+
+        b->last = ngx_cpymem(b->pos, k->value, k->len);
+        b->memory = 1;
+    }
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_output_filter(r, &out);
+
+done:
+
+    ngx_http_finalize_request(r, rc);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_memcached_pipe_close(ngx_http_memcached_pipe_t *p, ngx_int_t status)
+{
+    ngx_queue_t                keys, *q;
+    ngx_http_memcached_key_t  *k;
+
+    if (p->connection) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "close memcached pipeline to %V", &p->peer->name);
+
+        ngx_close_connection(p->connection);
+        p->connection = NULL;
+    }
+
+    p->connecting = 0;
+    p->ended = 0;
+    p->state = NGX_HTTP_MEMCACHED_LINE;
+
+    p->in.pos = p->in.start;
+    p->in.last = p->in.start;
+    p->out.pos = p->out.start;
+    p->out.last = p->out.start;
+
+    /*
+     * the keys are detached first, the requests failed below
+     * may queue new keys for a new connection
+     */
+
+    ngx_queue_init(&keys);
+
+    if (!ngx_queue_empty(&p->sent)) {
+        ngx_queue_add(&keys, &p->sent);
+        ngx_queue_init(&p->sent);
+    }
+
+    if (!ngx_queue_empty(&p->queued)) {
+        ngx_queue_add(&keys, &p->queued);
+        ngx_queue_init(&p->queued);
+    }
+
+    if (p->current) {
+        ngx_queue_insert_head(&keys, &p->current->queue);
+        p->current = NULL;
+    }
+
+    while (!ngx_queue_empty(&keys)) {
+        q = ngx_queue_head(&keys);
+        ngx_queue_remove(q);
+
+        k = ngx_queue_data(q, ngx_http_memcached_key_t, queue);
+
+        ngx_http_memcached_pipe_done(k, status);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_memcached_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                        i, n;
+    ngx_http_memcached_pipe_t        *p;
+    ngx_http_upstream_rr_peers_t     *peers;
+    ngx_http_memcached_loc_conf_t   **mlcfp, *mlcf;
+    ngx_http_memcached_main_conf_t   *mmcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    mmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_memcached_module);
+
+    if (mmcf == NULL) {
+        return NGX_OK;
+    }
+
+    mlcfp = mmcf->confs.elts;
+
+    for (i = 0; i < mmcf->confs.nelts; i++) {
+        mlcf = mlcfp[i];
+
+        if (!mlcf->pipeline) {
+            continue;
+        }
+
+        /* the backup peers are not used by the pipes */
+
+        peers = mlcf->upstream.upstream->peer.data;
+
+        if (peers == NULL || peers->number == 0) {
+            continue;
+        }
+
+        p = ngx_pcalloc(cycle->pool,
+                        peers->number * sizeof(ngx_http_memcached_pipe_t));
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (n = 0; n < peers->number; n++) {
+            p[n].conf = mlcf;
+            p[n].peer = &peers->peer[n];
+
+            ngx_rbtree_init(&p[n].rbtree, &p[n].sentinel,
+                            ngx_str_rbtree_insert_value);
+
+            ngx_queue_init(&p[n].queued);
+            ngx_queue_init(&p[n].sent);
+
+            p[n].in.start = ngx_palloc(cycle->pool,
+                                       mlcf->upstream.buffer_size);
+            if (p[n].in.start == NULL) {
+                return NGX_ERROR;
+            }
+
+            p[n].in.pos = p[n].in.start;
+            p[n].in.last = p[n].in.start;
+            p[n].in.end = p[n].in.start + mlcf->upstream.buffer_size;
+
+            p[n].flush.handler = ngx_http_memcached_pipe_flush;
+            p[n].flush.data = &p[n];
+            p[n].flush.log = cycle->log;
+        }
+
+        mlcf->npipes = peers->number;
+        mlcf->pipes = p;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_memcached_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_memcached_main_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_memcached_main_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&conf->confs, cf->pool, 4,
+                       sizeof(ngx_http_memcached_loc_conf_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return conf;
+}
+
+
 static void *
 ngx_http_memcached_create_loc_conf(ngx_conf_t *cf)
 {
@@ -572,6 +1618,8 @@ ngx_http_memcached_create_loc_conf(ngx_conf_t *cf)
      *     conf->upstream.temp_path = NULL;
      *     conf->upstream.uri = { 0, NULL };
      *     conf->upstream.location = NULL;
+     *     conf->npipes = 0;
+     *     conf->pipes = NULL;
      */
 
     conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
@@ -597,6 +1645,9 @@ ngx_http_memcached_create_loc_conf(ngx_conf_t *cf)
     conf->index = NGX_CONF_UNSET;
     conf->gzip_flag = NGX_CONF_UNSET_UINT;
 
+    conf->pipeline = NGX_CONF_UNSET;
+    conf->pipeline_keys = NGX_CONF_UNSET_UINT;
+
     return conf;
 }
 
@@ -641,6 +1692,15 @@ ngx_http_memcached_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_uint_value(conf->gzip_flag, prev->gzip_flag, 0);
 
+    ngx_conf_merge_value(conf->pipeline, prev->pipeline, 0);
+    ngx_conf_merge_uint_value(conf->pipeline_keys, prev->pipeline_keys, 64);
+
+    if (conf->pipeline_keys == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"memcached_pipeline_keys\" must be positive");
+        return NGX_CONF_ERROR;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -650,9 +1710,11 @@ ngx_http_memcached_pass(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_memcached_loc_conf_t *mlcf = conf;
 
-    ngx_str_t                 *value;
-    ngx_url_t                  u;
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_str_t                        *value;
+    ngx_url_t                         u;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_http_memcached_loc_conf_t   **mlcfp;
+    ngx_http_memcached_main_conf_t   *mmcf;
 
     if (mlcf->upstream.upstream) {
         return "is duplicate";
@@ -684,5 +1746,16 @@ ngx_http_memcached_pass(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    /* the pipes are created in a worker if "memcached_pipeline" is on */
+
+    mmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_memcached_module);
+
+    mlcfp = ngx_array_push(&mmcf->confs);
+    if (mlcfp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *mlcfp = mlcf;
+
     return NGX_CONF_OK;
 }
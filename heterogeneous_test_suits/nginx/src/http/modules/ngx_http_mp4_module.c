@@ -147,6 +147,18 @@ typedef struct {
 } ngx_http_mp4_file_t;
 
 
+#if (NGX_HAVE_PTHREAD)
+
+typedef struct {
+    ngx_http_mp4_file_t  *mp4;
+    ngx_open_file_info_t  of;
+    ngx_str_t             path;
+    ngx_int_t             rc;
+} ngx_http_mp4_thread_ctx_t;
+
+#endif
+
+
 typedef struct {
     char                 *name;
     ngx_int_t           (*handler)(ngx_http_mp4_file_t *mp4,
@@ -202,6 +214,15 @@ typedef struct {
     &((ngx_http_mp4_trak_t *) mp4->trak.elts)[mp4->trak.nelts - 1]
 
 
+static ngx_int_t ngx_http_mp4_send(ngx_http_request_t *r,
+    ngx_http_mp4_file_t *mp4, ngx_int_t rc, ngx_open_file_info_t *of,
+    ngx_str_t *path);
+#if (NGX_HAVE_PTHREAD)
+static ngx_int_t ngx_http_mp4_thread_process(ngx_http_request_t *r,
+    ngx_http_mp4_file_t *mp4, ngx_open_file_info_t *of, ngx_str_t *path);
+static void ngx_http_mp4_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_mp4_thread_event_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_http_mp4_process(ngx_http_mp4_file_t *mp4);
 static ngx_int_t ngx_http_mp4_read_atom(ngx_http_mp4_file_t *mp4,
     ngx_http_mp4_atom_handler_t *atom, uint64_t atom_data_size);
@@ -399,8 +420,6 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
     ngx_uint_t                 level;
     ngx_str_t                  path, value;
     ngx_log_t                 *log;
-    ngx_buf_t                 *b;
-    ngx_chain_t                out;
     ngx_http_mp4_file_t       *mp4;
     ngx_open_file_info_t       of;
     ngx_http_core_loc_conf_t  *clcf;
@@ -503,7 +522,7 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
     start = -1;
     r->headers_out.content_length_n = of.size;
     mp4 = NULL;
-    b = NULL;
+    rc = NGX_OK;
 
     if (r->args.len) {
 
@@ -533,50 +552,79 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
                 mp4->start = (ngx_uint_t) start;
                 mp4->request = r;
 
-                switch (ngx_http_mp4_process(mp4)) {
+#if (NGX_HAVE_PTHREAD)
+                if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+                    return ngx_http_mp4_thread_process(r, mp4, &of, &path);
+                }
+#endif
 
-                case NGX_DECLINED:
-                    if (mp4->buffer) {
-                        ngx_pfree(r->pool, mp4->buffer);
-                    }
+                rc = ngx_http_mp4_process(mp4);
+            }
+        }
+    }
 
-                    ngx_pfree(r->pool, mp4);
-                    mp4 = NULL;
+    return ngx_http_mp4_send(r, mp4, rc, &of, &path);
+}
 
-                    break;
 
-                case NGX_OK:
-                    r->headers_out.content_length_n = mp4->content_length;
-                    break;
+static ngx_int_t
+ngx_http_mp4_send(ngx_http_request_t *r, ngx_http_mp4_file_t *mp4,
+    ngx_int_t rc, ngx_open_file_info_t *of, ngx_str_t *path)
+{
+    ngx_log_t                 *log;
+    ngx_buf_t                 *b;
+    ngx_chain_t                out;
+    ngx_http_core_loc_conf_t  *clcf;
 
-                default: /* NGX_ERROR */
-                    if (mp4->buffer) {
-                        ngx_pfree(r->pool, mp4->buffer);
-                    }
+    if (mp4) {
 
-                    ngx_pfree(r->pool, mp4);
+        switch (rc) {
 
-                    return NGX_HTTP_INTERNAL_SERVER_ERROR;
-                }
+        case NGX_DECLINED:
+            if (mp4->buffer) {
+                ngx_pfree(r->pool, mp4->buffer);
+            }
+
+            ngx_pfree(r->pool, mp4);
+            mp4 = NULL;
+
+            break;
+
+        case NGX_OK:
+            r->headers_out.content_length_n = mp4->content_length;
+            break;
+
+        default: /* NGX_ERROR */
+            if (mp4->buffer) {
+                ngx_pfree(r->pool, mp4->buffer);
             }
+
+            ngx_pfree(r->pool, mp4);
+
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
     }
 
+    log = r->connection->log;
+    b = NULL;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
     log->action = "sending mp4 to client";
 
-    if (clcf->directio <= of.size) {
+    if (clcf->directio <= of->size) {
 
         /*
          * DIRECTIO is set on transfer only
          * to allow kernel to cache "moov" atom
          */
 
-        if (ngx_directio_on(of.fd) == NGX_FILE_ERROR) {
+        if (ngx_directio_on(of->fd) == NGX_FILE_ERROR) {
             ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
-                          ngx_directio_on_n " \"%s\" failed", path.data);
+                          ngx_directio_on_n " \"%s\" failed", path->data);
         }
 
-        of.is_directio = 1;
+        of->is_directio = 1;
 
         if (mp4) {
             mp4->file.directio = 1;
@@ -584,7 +632,7 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
     }
 
     r->headers_out.status = NGX_HTTP_OK;
-    r->headers_out.last_modified_time = of.mtime;
+    r->headers_out.last_modified_time = of->mtime;
 
     if (ngx_http_set_etag(r) != NGX_OK) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -617,16 +665,16 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
     }
 
     b->file_pos = 0;
-    b->file_last = of.size;
+    b->file_last = of->size;
 
     b->in_file = b->file_last ? 1 : 0;
     b->last_buf = (r == r->main) ? 1 : 0;
     b->last_in_chain = 1;
 
-    b->file->fd = of.fd;
-    b->file->name = path;
+    b->file->fd = of->fd;
+    b->file->name = *path;
     b->file->log = log;
-    b->file->directio = of.is_directio;
+    b->file->directio = of->is_directio;
 
     out.buf = b;
     out.next = NULL;
@@ -635,6 +683,87 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
 }
 
 
+#if (NGX_HAVE_PTHREAD)
+
+/*
+ * the "moov" atom is parsed in a pool thread as a whole, the request is
+ * blocked meanwhile and nothing else touches the request pool
+ */
+
+static ngx_int_t
+ngx_http_mp4_thread_process(ngx_http_request_t *r, ngx_http_mp4_file_t *mp4,
+    ngx_open_file_info_t *of, ngx_str_t *path)
+{
+    ngx_thread_task_t          *task;
+    ngx_http_core_loc_conf_t   *clcf;
+    ngx_http_mp4_thread_ctx_t  *ctx;
+
+    task = ngx_thread_task_alloc(r->pool, sizeof(ngx_http_mp4_thread_ctx_t));
+    if (task == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ctx = task->ctx;
+
+    ctx->mp4 = mp4;
+    ctx->of = *of;
+    ctx->path = *path;
+    ctx->rc = NGX_ERROR;
+
+    task->handler = ngx_http_mp4_thread_handler;
+    task->event.data = ctx;
+    task->event.handler = ngx_http_mp4_thread_event_handler;
+    task->event.log = r->connection->log;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (ngx_thread_task_post(clcf->thread_pool, task) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->main->blocked++;
+    r->main->count++;
+    r->aio = 1;
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_mp4_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_mp4_thread_ctx_t  *ctx = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "mp4 thread handler");
+
+    ctx->rc = ngx_http_mp4_process(ctx->mp4);
+}
+
+
+static void
+ngx_http_mp4_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_int_t                   rc;
+    ngx_connection_t           *c;
+    ngx_http_request_t         *r;
+    ngx_http_mp4_thread_ctx_t  *ctx;
+
+    ctx = ev->data;
+    r = ctx->mp4->request;
+    c = r->connection;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    rc = ngx_http_mp4_send(r, ctx->mp4, ctx->rc, &ctx->of, &ctx->path);
+
+    ngx_http_finalize_request(r, rc);
+    ngx_http_run_posted_requests(c);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_mp4_process(ngx_http_mp4_file_t *mp4)
 {
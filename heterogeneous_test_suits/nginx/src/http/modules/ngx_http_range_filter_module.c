@@ -56,6 +56,8 @@ typedef struct {
     off_t        offset;
     ngx_str_t    boundary_header;
     ngx_array_t  ranges;
+    ngx_uint_t   index;            /* the range being streamed */
+    unsigned     ordered:1;
 } ngx_http_range_filter_ctx_t;
 
 
@@ -72,6 +74,14 @@ static ngx_int_t ngx_http_range_singlepart_body(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in);
 static ngx_int_t ngx_http_range_multipart_body(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in);
+static ngx_int_t ngx_http_range_multipart_stream(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in);
+static ngx_chain_t *ngx_http_range_boundary(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx, ngx_http_range_t *range);
+static ngx_chain_t *ngx_http_range_last_boundary(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx);
+static ngx_buf_t *ngx_http_range_slice(ngx_http_request_t *r, ngx_buf_t *buf,
+    off_t offset, off_t start, off_t end);
 
 static ngx_int_t ngx_http_range_header_filter_init(ngx_conf_t *cf);
 static ngx_int_t ngx_http_range_body_filter_init(ngx_conf_t *cf);
@@ -506,6 +516,21 @@ ngx_http_range_multipart_header(ngx_http_request_t *r,
     len = sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN + sizeof("--" CRLF) - 1;
 
     range = ctx->ranges.elts;
+
+    /*
+     * the ranges in ascending order without overlaps are streamed
+     * from any chain of buffers
+     */
+
+    ctx->ordered = 1;
+
+    for (i = 1; i < ctx->ranges.nelts; i++) {
+        if (range[i].start < range[i - 1].end) {
+            ctx->ordered = 0;
+            break;
+        }
+    }
+
     for (i = 0; i < ctx->ranges.nelts; i++) {
 
         /* the size of the range: "SSSS-EEEE/TTTT" CRLF CRLF */
@@ -591,8 +616,13 @@ ngx_http_range_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         return ngx_http_range_singlepart_body(r, ctx, in);
     }
 
+    if (ctx->ordered) {
+        return ngx_http_range_multipart_stream(r, ctx, in);
+    }
+
     /*
-     * multipart ranges are supported only if whole body is in a single buffer
+     * multipart ranges out of order are supported only
+     * if whole body is in a single buffer
      */
 
     if (ngx_buf_special(in->buf)) {
@@ -739,7 +769,7 @@ ngx_http_range_multipart_body(ngx_http_request_t *r,
 {
     ngx_buf_t         *b, *buf;
     ngx_uint_t         i;
-    ngx_chain_t       *out, *hcl, *rcl, *dcl, **ll;
+    ngx_chain_t       *out, *hcl, *dcl, **ll;
     ngx_http_range_t  *range;
 
     ll = &out;
@@ -748,91 +778,250 @@ ngx_http_range_multipart_body(ngx_http_request_t *r,
 
     for (i = 0; i < ctx->ranges.nelts; i++) {
 
-        /*
-         * The boundary header of the range:
-         * CRLF
-         * "--0123456789" CRLF
-         * "Content-Type: image/jpeg" CRLF
-         * "Content-Range: bytes "
-         */
+        hcl = ngx_http_range_boundary(r, ctx, &range[i]);
+        if (hcl == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* the range data */
 
-        b = ngx_calloc_buf(r->pool);
+        b = ngx_http_range_slice(r, buf, 0, range[i].start, range[i].end);
         if (b == NULL) {
             return NGX_ERROR;
         }
 
-        b->memory = 1;
-        b->pos = ctx->boundary_header.data;
-        b->last = ctx->boundary_header.data + ctx->boundary_header.len;
-
-        hcl = ngx_alloc_chain_link(r->pool);
-        if (hcl == NULL) {
+        dcl = ngx_alloc_chain_link(r->pool);
+        if (dcl == NULL) {
             return NGX_ERROR;
         }
 
-        hcl->buf = b;
+        dcl->buf = b;
 
+        *ll = hcl;
+        hcl->next->next = dcl;
+        ll = &dcl->next;
+    }
 
-        /* "SSSS-EEEE/TTTT" CRLF CRLF */
+    *ll = ngx_http_range_last_boundary(r, ctx);
+    if (*ll == NULL) {
+        return NGX_ERROR;
+    }
 
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
-        }
+    return ngx_http_next_body_filter(r, out);
+}
 
-        b->temporary = 1;
-        b->pos = range[i].content_range.data;
-        b->last = range[i].content_range.data + range[i].content_range.len;
 
-        rcl = ngx_alloc_chain_link(r->pool);
-        if (rcl == NULL) {
-            return NGX_ERROR;
-        }
+/*
+ * The ordered ranges are cut out of the buffers as they pass.  A buffer
+ * may hold the data of several ranges: all but the last part are sent in
+ * copies of the buffer that refer to its data, and the last part in the
+ * buffer itself, which therefore is not reused before all of its parts
+ * are sent.
+ * A buffer outside of the ranges is skipped and is free at once.
+ */
+
+static ngx_int_t
+ngx_http_range_multipart_stream(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in)
+{
+    off_t              start, last;
+    ngx_buf_t         *buf, *b;
+    ngx_uint_t         last_buf;
+    ngx_chain_t       *out, *cl, *hcl, *dcl, **ll;
+    ngx_http_range_t  *range;
 
-        rcl->buf = b;
+    out = NULL;
+    ll = &out;
+    range = ctx->ranges.elts;
 
+    for (cl = in; cl; cl = cl->next) {
 
-        /* the range data */
+        buf = cl->buf;
 
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
+        start = ctx->offset;
+        last = ctx->offset + ngx_buf_size(buf);
+
+        ctx->offset = last;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http range multipart buf: %O-%O", start, last);
+
+        last_buf = buf->last_buf;
+        buf->last_buf = 0;
+
+        if (ngx_buf_special(buf)) {
+
+            if (!last_buf) {
+                dcl = ngx_alloc_chain_link(r->pool);
+                if (dcl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                dcl->buf = buf;
+                *ll = dcl;
+                ll = &dcl->next;
+            }
+
+            goto next;
         }
 
-        b->in_file = buf->in_file;
-        b->temporary = buf->temporary;
-        b->memory = buf->memory;
-        b->mmap = buf->mmap;
-        b->file = buf->file;
+        dcl = NULL;
+
+        while (ctx->index < ctx->ranges.nelts
+               && range[ctx->index].start < last)
+        {
+            if (range[ctx->index].start >= start) {
+                hcl = ngx_http_range_boundary(r, ctx, &range[ctx->index]);
+                if (hcl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                *ll = hcl;
+                ll = &hcl->next->next;
+            }
+
+            b = ngx_http_range_slice(r, buf, start,
+                                     ngx_max(range[ctx->index].start, start),
+                                     ngx_min(range[ctx->index].end, last));
+            if (b == NULL) {
+                return NGX_ERROR;
+            }
+
+            dcl = ngx_alloc_chain_link(r->pool);
+            if (dcl == NULL) {
+                return NGX_ERROR;
+            }
+
+            dcl->buf = b;
+            *ll = dcl;
+            ll = &dcl->next;
 
-        if (buf->in_file) {
-            b->file_pos = buf->file_pos + range[i].start;
-            b->file_last = buf->file_pos + range[i].end;
+            if (range[ctx->index].end > last) {
+                break;
+            }
+
+            ctx->index++;
         }
 
-        if (ngx_buf_in_memory(buf)) {
-            b->pos = buf->pos + (size_t) range[i].start;
-            b->last = buf->pos + (size_t) range[i].end;
+        if (dcl) {
+
+            /* the last part is sent in the buffer itself */
+
+            b = dcl->buf;
+
+            buf->pos = b->pos;
+            buf->last = b->last;
+            buf->file_pos = b->file_pos;
+            buf->file_last = b->file_last;
+
+            dcl->buf = buf;
+
+        } else {
+
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http range multipart skip");
+
+            if (buf->in_file) {
+                buf->file_pos = buf->file_last;
+            }
+
+            buf->pos = buf->last;
+            buf->sync = 1;
         }
 
-        dcl = ngx_alloc_chain_link(r->pool);
-        if (dcl == NULL) {
-            return NGX_ERROR;
+    next:
+
+        if (last_buf) {
+            *ll = ngx_http_range_last_boundary(r, ctx);
+            if (*ll == NULL) {
+                return NGX_ERROR;
+            }
+
+            ll = &(*ll)->next;
+
+            break;
         }
+    }
 
-        dcl->buf = b;
+    *ll = NULL;
 
-        *ll = hcl;
-        hcl->next = rcl;
-        rcl->next = dcl;
-        ll = &dcl->next;
+    if (out == NULL) {
+        return NGX_OK;
     }
 
+    return ngx_http_next_body_filter(r, out);
+}
+
+
+static ngx_chain_t *
+ngx_http_range_boundary(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx, ngx_http_range_t *range)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *hcl, *rcl;
+
+    /*
+     * The boundary header of the range:
+     * CRLF
+     * "--0123456789" CRLF
+     * "Content-Type: image/jpeg" CRLF
+     * "Content-Range: bytes "
+     */
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->memory = 1;
+    b->pos = ctx->boundary_header.data;
+    b->last = ctx->boundary_header.data + ctx->boundary_header.len;
+
+    hcl = ngx_alloc_chain_link(r->pool);
+    if (hcl == NULL) {
+        return NULL;
+    }
+
+    hcl->buf = b;
+
+
+    /* "SSSS-EEEE/TTTT" CRLF CRLF */
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->temporary = 1;
+    b->pos = range->content_range.data;
+    b->last = range->content_range.data + range->content_range.len;
+
+    rcl = ngx_alloc_chain_link(r->pool);
+    if (rcl == NULL) {
+        return NULL;
+    }
+
+    rcl->buf = b;
+
+    hcl->next = rcl;
+    rcl->next = NULL;
+
+    return hcl;
+}
+
+
+static ngx_chain_t *
+ngx_http_range_last_boundary(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *hcl;
+
     /* the last boundary CRLF "--0123456789--" CRLF  */
 
     b = ngx_calloc_buf(r->pool);
     if (b == NULL) {
-        return NGX_ERROR;
+        return NULL;
     }
 
     b->temporary = 1;
@@ -841,7 +1030,7 @@ ngx_http_range_multipart_body(ngx_http_request_t *r,
     b->pos = ngx_pnalloc(r->pool, sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN
                                   + sizeof("--" CRLF) - 1);
     if (b->pos == NULL) {
-        return NGX_ERROR;
+        return NULL;
     }
 
     b->last = ngx_cpymem(b->pos, ctx->boundary_header.data,
@@ -851,15 +1040,46 @@ ngx_http_range_multipart_body(ngx_http_request_t *r,
 
     hcl = ngx_alloc_chain_link(r->pool);
     if (hcl == NULL) {
-        return NGX_ERROR;
+        return NULL;
     }
 
     hcl->buf = b;
     hcl->next = NULL;
 
-    *ll = hcl;
+    return hcl;
+}
 
-    return ngx_http_next_body_filter(r, out);
+
+/* the data from start to end of the buffer that starts at offset */
+
+static ngx_buf_t *
+ngx_http_range_slice(ngx_http_request_t *r, ngx_buf_t *buf, off_t offset,
+    off_t start, off_t end)
+{
+    ngx_buf_t  *b;
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->in_file = buf->in_file;
+    b->temporary = buf->temporary;
+    b->memory = buf->memory;
+    b->mmap = buf->mmap;
+    b->file = buf->file;
+
+    if (buf->in_file) {
+        b->file_pos = buf->file_pos + (start - offset);
+        b->file_last = buf->file_pos + (end - offset);
+    }
+
+    if (ngx_buf_in_memory(buf)) {
+        b->pos = buf->pos + (size_t) (start - offset);
+        b->last = buf->pos + (size_t) (end - offset);
+    }
+
+    return b;
 }
 
 
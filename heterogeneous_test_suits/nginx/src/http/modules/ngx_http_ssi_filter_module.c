@@ -16,6 +16,12 @@
 #define NGX_HTTP_SSI_ADD_PREFIX     1
 #define NGX_HTTP_SSI_ADD_ZERO       2
 
+#define NGX_HTTP_SSI_TEMPLATE_MAX_SIZE  262144
+
+
+#define ngx_http_ssi_replaying(ctx)                                           \
+    ((ctx)->template && (ctx)->op < (ctx)->template->nops)
+
 
 typedef struct {
     ngx_flag_t    enable;
@@ -73,6 +79,27 @@ static ngx_int_t ngx_http_ssi_output(ngx_http_request_t *r,
     ngx_http_ssi_ctx_t *ctx);
 static void ngx_http_ssi_buffered(ngx_http_request_t *r,
     ngx_http_ssi_ctx_t *ctx);
+static ngx_chain_t *ngx_http_ssi_buf(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_command(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_error(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_block_text(ngx_http_request_t *r, size_t saved,
+    u_char *text, size_t len);
+static ngx_int_t ngx_http_ssi_find_template(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx, ngx_http_ssi_main_conf_t *smcf);
+static void ngx_http_ssi_release_template(void *data);
+static ngx_int_t ngx_http_ssi_record_string(ngx_http_ssi_record_t *rec,
+    u_char *data, size_t len, size_t *offset);
+static ngx_int_t ngx_http_ssi_record_text(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_record_op(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx, ngx_int_t rc);
+static void ngx_http_ssi_cache_template(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
+static ngx_int_t ngx_http_ssi_replay(ngx_http_request_t *r,
+    ngx_http_ssi_ctx_t *ctx);
 static ngx_int_t ngx_http_ssi_parse(ngx_http_request_t *r,
     ngx_http_ssi_ctx_t *ctx);
 static ngx_str_t *ngx_http_ssi_get_variable(ngx_http_request_t *r,
@@ -109,6 +136,8 @@ static ngx_int_t ngx_http_ssi_date_gmt_local_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t gmt);
 
 static ngx_int_t ngx_http_ssi_preconfiguration(ngx_conf_t *cf);
+static char *ngx_http_ssi_template_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static void *ngx_http_ssi_create_main_conf(ngx_conf_t *cf);
 static char *ngx_http_ssi_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_ssi_create_loc_conf(ngx_conf_t *cf);
@@ -162,6 +191,13 @@ static ngx_command_t  ngx_http_ssi_filter_commands[] = {
       offsetof(ngx_http_ssi_loc_conf_t, types_keys),
       &ngx_http_html_default_types[0] },
 
+    { ngx_string("ssi_template_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_ssi_template_cache,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -320,8 +356,9 @@ static ngx_http_variable_t  ngx_http_ssi_vars[] = {
 static ngx_int_t
 ngx_http_ssi_header_filter(ngx_http_request_t *r)
 {
-    ngx_http_ssi_ctx_t       *ctx;
-    ngx_http_ssi_loc_conf_t  *slcf;
+    ngx_http_ssi_ctx_t        *ctx;
+    ngx_http_ssi_loc_conf_t   *slcf;
+    ngx_http_ssi_main_conf_t  *smcf;
 
     slcf = ngx_http_get_module_loc_conf(r, ngx_http_ssi_filter_module);
 
@@ -355,7 +392,17 @@ ngx_http_ssi_header_filter(ngx_http_request_t *r)
     ngx_str_set(&ctx->errmsg,
                 "[an error occurred while processing the directive]");
 
-    r->filter_need_in_memory = 1;
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_ssi_filter_module);
+
+    if (smcf->ntemplates
+        && ngx_http_ssi_find_template(r, ctx, smcf) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ctx->template == NULL) {
+        r->filter_need_in_memory = 1;
+    }
 
     if (r == r->main) {
         ngx_http_clear_content_length(r);
@@ -371,19 +418,12 @@ ngx_http_ssi_header_filter(ngx_http_request_t *r)
 static ngx_int_t
 ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
-    size_t                     len;
-    ngx_int_t                  rc;
-    ngx_buf_t                 *b;
-    ngx_uint_t                 i, index;
-    ngx_chain_t               *cl, **ll;
-    ngx_table_elt_t           *param;
-    ngx_http_ssi_ctx_t        *ctx, *mctx;
-    ngx_http_ssi_block_t      *bl;
-    ngx_http_ssi_param_t      *prm;
-    ngx_http_ssi_command_t    *cmd;
-    ngx_http_ssi_loc_conf_t   *slcf;
-    ngx_http_ssi_main_conf_t  *smcf;
-    ngx_str_t                 *params[NGX_HTTP_SSI_MAX_PARAMS + 1];
+    size_t                    len;
+    ngx_int_t                 rc;
+    ngx_buf_t                *b;
+    ngx_chain_t              *cl;
+    ngx_http_ssi_ctx_t       *ctx;
+    ngx_http_ssi_loc_conf_t  *slcf;
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_ssi_filter_module);
 
@@ -391,11 +431,13 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         || (in == NULL
             && ctx->buf == NULL
             && ctx->in == NULL
-            && ctx->busy == NULL))
+            && ctx->busy == NULL
+            && !ngx_http_ssi_replaying(ctx)))
     {
         return ngx_http_next_body_filter(r, in);
     }
 
+
     /* add the incoming chain to the chain ctx->in */
 
     if (in) {
@@ -433,6 +475,10 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         }
     }
 
+    if (ctx->template) {
+        return ngx_http_ssi_replay(r, ctx);
+    }
+
     slcf = ngx_http_get_module_loc_conf(r, ngx_http_ssi_filter_module);
 
     while (ctx->in || ctx->buf) {
@@ -467,6 +513,12 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
             if (ctx->copy_start != ctx->copy_end) {
 
+                if (ctx->record
+                    && ngx_http_ssi_record_text(r, ctx) != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
                 if (ctx->output) {
 
                     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -548,45 +600,14 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                     ctx->last_out = &cl->next;
 
                 } else {
+                    len = ctx->copy_end - ctx->copy_start;
+
                     if (ctx->block
-                        && ctx->saved + (ctx->copy_end - ctx->copy_start))
+                        && ngx_http_ssi_block_text(r, ctx->saved,
+                                                   ctx->copy_start, len)
+                           != NGX_OK)
                     {
-                        b = ngx_create_temp_buf(r->pool,
-                               ctx->saved + (ctx->copy_end - ctx->copy_start));
-
-                        if (b == NULL) {
-                            return NGX_ERROR;
-                        }
-
-                        if (ctx->saved) {
-                            b->last = ngx_cpymem(b->pos, ngx_http_ssi_string,
-                                                 ctx->saved);
-                        }
-
-                        b->last = ngx_cpymem(b->last, ctx->copy_start,
-                                             ctx->copy_end - ctx->copy_start);
-
-                        cl = ngx_alloc_chain_link(r->pool);
-                        if (cl == NULL) {
-                            return NGX_ERROR;
-                        }
-
-                        cl->buf = b;
-                        cl->next = NULL;
-
-                        b = NULL;
-
-                        mctx = ngx_http_get_module_ctx(r->main,
-                                                   ngx_http_ssi_filter_module);
-                        bl = mctx->blocks->elts;
-                        for (ll = &bl[mctx->blocks->nelts - 1].bufs;
-                             *ll;
-                             ll = &(*ll)->next)
-                        {
-                            /* void */
-                        }
-
-                        *ll = cl;
+                        return NGX_ERROR;
                     }
 
                     ctx->saved = 0;
@@ -606,367 +627,907 @@ ngx_http_ssi_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                 continue;
             }
 
+            if (ctx->record && ngx_http_ssi_record_op(r, ctx, rc) != NGX_OK) {
+                return NGX_ERROR;
+            }
 
             b = NULL;
 
             if (rc == NGX_OK) {
 
-                smcf = ngx_http_get_module_main_conf(r,
-                                                   ngx_http_ssi_filter_module);
+                rc = ngx_http_ssi_command(r, ctx);
+
+                if (rc == NGX_OK) {
+                    continue;
+                }
+
+                if (rc == NGX_DONE || rc == NGX_AGAIN || rc == NGX_ERROR) {
+                    ngx_http_ssi_buffered(r, ctx);
+                    return rc;
+                }
+            }
+
+            /* rc == NGX_HTTP_SSI_ERROR */
+
+            if (ngx_http_ssi_error(r, ctx) == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+        }
+
+        if (ctx->buf->last_buf || ngx_buf_in_memory(ctx->buf)) {
+            if (b == NULL) {
+                if (ctx->free) {
+                    cl = ctx->free;
+                    ctx->free = ctx->free->next;
+                    b = cl->buf;
+                    ngx_memzero(b, sizeof(ngx_buf_t));
+
+                } else {
+                    b = ngx_calloc_buf(r->pool);
+                    if (b == NULL) {
+                        return NGX_ERROR;
+                    }
+
+                    cl = ngx_alloc_chain_link(r->pool);
+                    if (cl == NULL) {
+                        return NGX_ERROR;
+                    }
+
+                    cl->buf = b;
+                }
+
+                b->sync = 1;
+
+                cl->next = NULL;
+                *ctx->last_out = cl;
+                ctx->last_out = &cl->next;
+            }
+
+            b->last_buf = ctx->buf->last_buf;
+            b->shadow = ctx->buf;
+
+            if (slcf->ignore_recycled_buffers == 0)  {
+                b->recycled = ctx->buf->recycled;
+            }
+        }
+
+        if (ctx->record && (ctx->buf->last_buf || ctx->buf->last_in_chain)) {
+            ngx_http_ssi_cache_template(r, ctx);
+        }
+
+        ctx->buf = NULL;
+
+        ctx->saved = ctx->looked;
+    }
+
+    if (ctx->out == NULL && ctx->busy == NULL) {
+        return NGX_OK;
+    }
+
+    return ngx_http_ssi_output(r, ctx);
+}
+
+
+static ngx_int_t
+ngx_http_ssi_output(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    ngx_int_t     rc;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+#if 1
+    b = NULL;
+    for (cl = ctx->out; cl; cl = cl->next) {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "ssi out: %p %p", cl->buf, cl->buf->pos);
+        if (cl->buf == b) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "the same buf was used in ssi");
+            ngx_debug_point();
+            return NGX_ERROR;
+        }
+        b = cl->buf;
+    }
+#endif
+
+    rc = ngx_http_next_body_filter(r, ctx->out);
+
+    if (ctx->busy == NULL) {
+        ctx->busy = ctx->out;
+
+    } else {
+        for (cl = ctx->busy; cl->next; cl = cl->next) { /* void */ }
+        cl->next = ctx->out;
+    }
+
+    ctx->out = NULL;
+    ctx->last_out = &ctx->out;
+
+    while (ctx->busy) {
+
+        cl = ctx->busy;
+        b = cl->buf;
+
+        if (ngx_buf_size(b) != 0) {
+            break;
+        }
+
+        if (b->shadow) {
+            b->shadow->pos = b->shadow->last;
+        }
+
+        ctx->busy = cl->next;
+
+        if (ngx_buf_in_memory(b) || b->in_file) {
+            /* add data bufs only to the free buf chain */
+
+            cl->next = ctx->free;
+            ctx->free = cl;
+        }
+    }
+
+    ngx_http_ssi_buffered(r, ctx);
+
+    return rc;
+}
+
+
+static void
+ngx_http_ssi_buffered(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    if (ctx->in || ctx->buf || ngx_http_ssi_replaying(ctx)) {
+        r->buffered |= NGX_HTTP_SSI_BUFFERED;
+
+    } else {
+        r->buffered &= ~NGX_HTTP_SSI_BUFFERED;
+    }
+}
+
+
+static ngx_chain_t *
+ngx_http_ssi_buf(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    if (ctx->free) {
+        cl = ctx->free;
+        ctx->free = ctx->free->next;
+        ngx_memzero(cl->buf, sizeof(ngx_buf_t));
+
+    } else {
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NULL;
+        }
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NULL;
+        }
+
+        cl->buf = b;
+    }
+
+    cl->next = NULL;
+    *ctx->last_out = cl;
+    ctx->last_out = &cl->next;
+
+    return cl;
+}
+
+
+/*
+ * runs the command that ngx_http_ssi_parse() or a template has set in
+ * ctx->command and ctx->params
+ */
+
+static ngx_int_t
+ngx_http_ssi_command(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    size_t                     len;
+    ngx_buf_t                 *b;
+    ngx_uint_t                 i, index;
+    ngx_chain_t               *cl, **ll;
+    ngx_table_elt_t           *param;
+    ngx_http_ssi_ctx_t        *mctx;
+    ngx_http_ssi_block_t      *bl;
+    ngx_http_ssi_param_t      *prm;
+    ngx_http_ssi_command_t    *cmd;
+    ngx_http_ssi_main_conf_t  *smcf;
+    ngx_str_t                 *params[NGX_HTTP_SSI_MAX_PARAMS + 1];
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_ssi_filter_module);
+
+    cmd = ngx_hash_find(&smcf->hash, ctx->key, ctx->command.data,
+                        ctx->command.len);
+
+    if (cmd == NULL) {
+        if (ctx->output) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "invalid SSI command: \"%V\"", &ctx->command);
+            return NGX_HTTP_SSI_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    if (!ctx->output && !cmd->block) {
+
+        if (ctx->block) {
+
+            /* reconstruct the SSI command text */
+
+            len = 5 + ctx->command.len + 4;
+
+            param = ctx->params.elts;
+            for (i = 0; i < ctx->params.nelts; i++) {
+                len += 1 + param[i].key.len + 2
+                    + param[i].value.len + 1;
+            }
+
+            b = ngx_create_temp_buf(r->pool, len);
+
+            if (b == NULL) {
+                return NGX_ERROR;
+            }
+
+            cl = ngx_alloc_chain_link(r->pool);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            cl->buf = b;
+            cl->next = NULL;
+
+            *b->last++ = '<';
+            *b->last++ = '!';
+            *b->last++ = '-';
+            *b->last++ = '-';
+            *b->last++ = '#';
+
+            b->last = ngx_cpymem(b->last, ctx->command.data,
+                                 ctx->command.len);
+
+            for (i = 0; i < ctx->params.nelts; i++) {
+                *b->last++ = ' ';
+                b->last = ngx_cpymem(b->last, param[i].key.data,
+                                     param[i].key.len);
+                *b->last++ = '=';
+                *b->last++ = '"';
+                b->last = ngx_cpymem(b->last, param[i].value.data,
+                                     param[i].value.len);
+                *b->last++ = '"';
+            }
+
+            *b->last++ = ' ';
+            *b->last++ = '-';
+            *b->last++ = '-';
+            *b->last++ = '>';
+
+            mctx = ngx_http_get_module_ctx(r->main,
+                                           ngx_http_ssi_filter_module);
+            bl = mctx->blocks->elts;
+            for (ll = &bl[mctx->blocks->nelts - 1].bufs;
+                 *ll;
+                 ll = &(*ll)->next)
+            {
+                /* void */
+            }
+
+            *ll = cl;
+
+            return NGX_OK;
+        }
+
+        if (cmd->conditional == 0) {
+            return NGX_OK;
+        }
+    }
+
+    if (cmd->conditional
+        && (ctx->conditional == 0
+            || ctx->conditional > cmd->conditional))
+    {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "invalid context of SSI command: \"%V\"",
+                      &ctx->command);
+        return NGX_HTTP_SSI_ERROR;
+    }
+
+    if (ctx->params.nelts > NGX_HTTP_SSI_MAX_PARAMS) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "too many SSI command parameters: \"%V\"",
+                      &ctx->command);
+        return NGX_HTTP_SSI_ERROR;
+    }
+
+    ngx_memzero(params, (NGX_HTTP_SSI_MAX_PARAMS + 1) * sizeof(ngx_str_t *));
+
+    param = ctx->params.elts;
+
+    for (i = 0; i < ctx->params.nelts; i++) {
+
+        for (prm = cmd->params; prm->name.len; prm++) {
+
+            if (param[i].key.len != prm->name.len
+                || ngx_strncmp(param[i].key.data, prm->name.data,
+                               prm->name.len) != 0)
+            {
+                continue;
+            }
+
+            if (!prm->multiple) {
+                if (params[prm->index]) {
+                    ngx_log_error(NGX_LOG_ERR,
+                                  r->connection->log, 0,
+                                  "duplicate \"%V\" parameter "
+                                  "in \"%V\" SSI command",
+                                  &param[i].key, &ctx->command);
+
+                    return NGX_HTTP_SSI_ERROR;
+                }
+
+                params[prm->index] = &param[i].value;
+
+                break;
+            }
+
+            for (index = prm->index; params[index]; index++) {
+                /* void */
+            }
+
+            params[index] = &param[i].value;
+
+            break;
+        }
+
+        if (prm->name.len == 0) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "invalid parameter name: \"%V\" "
+                          "in \"%V\" SSI command",
+                          &param[i].key, &ctx->command);
+
+            return NGX_HTTP_SSI_ERROR;
+        }
+    }
+
+    for (prm = cmd->params; prm->name.len; prm++) {
+        if (prm->mandatory && params[prm->index] == 0) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "mandatory \"%V\" parameter is absent "
+                          "in \"%V\" SSI command",
+                          &prm->name, &ctx->command);
+
+            return NGX_HTTP_SSI_ERROR;
+        }
+    }
+
+    if (cmd->flush && ctx->out) {
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "ssi flush");
+
+        if (ngx_http_ssi_output(r, ctx) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+    return cmd->handler(r, ctx, params);
+}
+
+
+static ngx_int_t
+ngx_http_ssi_error(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    ngx_buf_t                *b;
+    ngx_chain_t              *cl;
+    ngx_http_ssi_loc_conf_t  *slcf;
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_ssi_filter_module);
+
+    if (slcf->silent_errors) {
+        return NGX_OK;
+    }
+
+    cl = ngx_http_ssi_buf(r, ctx);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    b = cl->buf;
+
+    b->memory = 1;
+    b->pos = ctx->errmsg.data;
+    b->last = ctx->errmsg.data + ctx->errmsg.len;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_ssi_block_text(ngx_http_request_t *r, size_t saved, u_char *text,
+    size_t len)
+{
+    ngx_buf_t             *b;
+    ngx_chain_t           *cl, **ll;
+    ngx_http_ssi_ctx_t    *mctx;
+    ngx_http_ssi_block_t  *bl;
+
+    if (saved + len == 0) {
+        return NGX_OK;
+    }
+
+    b = ngx_create_temp_buf(r->pool, saved + len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (saved) {
+        b->last = ngx_cpymem(b->pos, ngx_http_ssi_string, saved);
+    }
+
+    b->last = ngx_cpymem(b->last, text, len);
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    mctx = ngx_http_get_module_ctx(r->main, ngx_http_ssi_filter_module);
+    bl = mctx->blocks->elts;
+    for (ll = &bl[mctx->blocks->nelts - 1].bufs; *ll; ll = &(*ll)->next) {
+        /* void */
+    }
+
+    *ll = cl;
+
+    return NGX_OK;
+}
+
+
+/*
+ * a document served from a file is keyed by its path, modification time
+ * and size: a template found for it replays the texts and commands that
+ * the parser returned for the document, otherwise they are recorded while
+ * the document is parsed and cached as the template at its end
+ */
+
+static ngx_int_t
+ngx_http_ssi_find_template(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
+    ngx_http_ssi_main_conf_t *smcf)
+{
+    u_char                   *last;
+    size_t                    root;
+    uint32_t                  hash;
+    ngx_str_t                 path;
+    ngx_pool_cleanup_t       *cln;
+    ngx_http_ssi_record_t    *rec;
+    ngx_http_ssi_template_t  *t;
+
+    if (r->upstream
+        || r->headers_out.etag == NULL
+        || r->headers_out.last_modified_time == -1
+        || r->headers_out.content_length_n <= 0
+        || r->headers_out.content_length_n > smcf->template_max_size)
+    {
+        return NGX_OK;
+    }
+
+    last = ngx_http_map_uri_to_path(r, &path, &root, 0);
+    if (last == NULL) {
+        return NGX_ERROR;
+    }
+
+    path.len = last - path.data;
+
+    hash = ngx_crc32_long(path.data, path.len);
+
+    t = smcf->templates[hash % smcf->ntemplates];
+
+    if (t
+        && t->hash == hash
+        && t->mtime == r->headers_out.last_modified_time
+        && t->size == r->headers_out.content_length_n
+        && t->value_len == ctx->value_len
+        && t->path.len == path.len
+        && ngx_strncmp(t->path.data, path.data, path.len) == 0)
+    {
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_ssi_release_template;
+        cln->data = t;
+
+        t->count++;
+        ctx->template = t;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http ssi template \"%V\", %ui ops",
+                       &t->path, t->nops);
+
+        return NGX_OK;
+    }
+
+    rec = ngx_pcalloc(r->pool, sizeof(ngx_http_ssi_record_t));
+    if (rec == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&rec->ops, r->pool, 32, sizeof(ngx_http_ssi_op_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&rec->data, r->pool,
+                       (size_t) r->headers_out.content_length_n, 1)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    t = &rec->template;
+
+    t->hash = hash;
+    t->path = path;
+    t->mtime = r->headers_out.last_modified_time;
+    t->size = r->headers_out.content_length_n;
+    t->value_len = ctx->value_len;
+
+    ctx->record = rec;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_ssi_release_template(void *data)
+{
+    ngx_http_ssi_template_t  *t = data;
+
+    if (--t->count == 0 && t->evicted) {
+        ngx_free(t);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_ssi_record_string(ngx_http_ssi_record_t *rec, u_char *data,
+    size_t len, size_t *offset)
+{
+    u_char  *p;
+
+    *offset = rec->data.nelts;
+
+    if (len == 0) {
+        return NGX_OK;
+    }
+
+    p = ngx_array_push_n(&rec->data, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(p, data, len);
+
+    return NGX_OK;
+}
+
+
+/* the text is recorded whether it is output or not, as the parser saw it */
+
+static ngx_int_t
+ngx_http_ssi_record_text(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    size_t                  start, offset;
+    ngx_http_ssi_op_t      *op;
+    ngx_http_ssi_record_t  *rec;
+
+    rec = ctx->record;
+
+    start = rec->data.nelts;
+
+    if (ngx_http_ssi_record_string(rec, ngx_http_ssi_string, ctx->saved,
+                                   &offset)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_ssi_record_string(rec, ctx->copy_start,
+                                   ctx->copy_end - ctx->copy_start, &offset)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
 
-                cmd = ngx_hash_find(&smcf->hash, ctx->key, ctx->command.data,
-                                    ctx->command.len);
+    if (rec->ops.nelts) {
+        op = (ngx_http_ssi_op_t *) rec->ops.elts + rec->ops.nelts - 1;
 
-                if (cmd == NULL) {
-                    if (ctx->output) {
-                        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                                      "invalid SSI command: \"%V\"",
-                                      &ctx->command);
-                        goto ssi_error;
-                    }
+        if (op->type == NGX_HTTP_SSI_OP_TEXT && op->data + op->len == start) {
+            op->len = rec->data.nelts - op->data;
+            return NGX_OK;
+        }
+    }
 
-                    continue;
-                }
+    op = ngx_array_push(&rec->ops);
+    if (op == NULL) {
+        return NGX_ERROR;
+    }
 
-                if (!ctx->output && !cmd->block) {
+    ngx_memzero(op, sizeof(ngx_http_ssi_op_t));
 
-                    if (ctx->block) {
+    op->type = NGX_HTTP_SSI_OP_TEXT;
+    op->data = start;
+    op->len = rec->data.nelts - start;
 
-                        /* reconstruct the SSI command text */
+    return NGX_OK;
+}
 
-                        len = 5 + ctx->command.len + 4;
 
-                        param = ctx->params.elts;
-                        for (i = 0; i < ctx->params.nelts; i++) {
-                            len += 1 + param[i].key.len + 2
-                                + param[i].value.len + 1;
-                        }
+static ngx_int_t
+ngx_http_ssi_record_op(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx,
+    ngx_int_t rc)
+{
+    ngx_uint_t              i;
+    ngx_table_elt_t        *param;
+    ngx_http_ssi_op_t      *op;
+    ngx_http_ssi_record_t  *rec;
 
-                        b = ngx_create_temp_buf(r->pool, len);
+    rec = ctx->record;
 
-                        if (b == NULL) {
-                            return NGX_ERROR;
-                        }
+    op = ngx_array_push(&rec->ops);
+    if (op == NULL) {
+        return NGX_ERROR;
+    }
 
-                        cl = ngx_alloc_chain_link(r->pool);
-                        if (cl == NULL) {
-                            return NGX_ERROR;
-                        }
+    ngx_memzero(op, sizeof(ngx_http_ssi_op_t));
 
-                        cl->buf = b;
-                        cl->next = NULL;
-
-                        *b->last++ = '<';
-                        *b->last++ = '!';
-                        *b->last++ = '-';
-                        *b->last++ = '-';
-                        *b->last++ = '#';
-
-                        b->last = ngx_cpymem(b->last, ctx->command.data,
-                                             ctx->command.len);
-
-                        for (i = 0; i < ctx->params.nelts; i++) {
-                            *b->last++ = ' ';
-                            b->last = ngx_cpymem(b->last, param[i].key.data,
-                                                 param[i].key.len);
-                            *b->last++ = '=';
-                            *b->last++ = '"';
-                            b->last = ngx_cpymem(b->last, param[i].value.data,
-                                                 param[i].value.len);
-                            *b->last++ = '"';
-                        }
+    if (rc != NGX_OK) {
+        op->type = NGX_HTTP_SSI_OP_ERROR;
+        return NGX_OK;
+    }
 
-                        *b->last++ = ' ';
-                        *b->last++ = '-';
-                        *b->last++ = '-';
-                        *b->last++ = '>';
-
-                        mctx = ngx_http_get_module_ctx(r->main,
-                                                   ngx_http_ssi_filter_module);
-                        bl = mctx->blocks->elts;
-                        for (ll = &bl[mctx->blocks->nelts - 1].bufs;
-                             *ll;
-                             ll = &(*ll)->next)
-                        {
-                            /* void */
-                        }
+    op->type = NGX_HTTP_SSI_OP_COMMAND;
+    op->key = ctx->key;
+    op->nparams = ctx->params.nelts;
+    op->len = ctx->command.len;
 
-                        *ll = cl;
+    if (ngx_http_ssi_record_string(rec, ctx->command.data, ctx->command.len,
+                                   &op->data)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
 
-                        b = NULL;
+    param = ctx->params.elts;
 
-                        continue;
-                    }
+    for (i = 0; i < ctx->params.nelts; i++) {
 
-                    if (cmd->conditional == 0) {
-                        continue;
-                    }
-                }
+        op = ngx_array_push(&rec->ops);
+        if (op == NULL) {
+            return NGX_ERROR;
+        }
 
-                if (cmd->conditional
-                    && (ctx->conditional == 0
-                        || ctx->conditional > cmd->conditional))
-                {
-                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                                  "invalid context of SSI command: \"%V\"",
-                                  &ctx->command);
-                    goto ssi_error;
-                }
+        ngx_memzero(op, sizeof(ngx_http_ssi_op_t));
 
-                if (ctx->params.nelts > NGX_HTTP_SSI_MAX_PARAMS) {
-                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                                  "too many SSI command parameters: \"%V\"",
-                                  &ctx->command);
-                    goto ssi_error;
-                }
+        op->type = NGX_HTTP_SSI_OP_PARAM;
+        op->len = param[i].key.len;
+        op->value_len = param[i].value.len;
 
-                ngx_memzero(params,
-                           (NGX_HTTP_SSI_MAX_PARAMS + 1) * sizeof(ngx_str_t *));
+        if (ngx_http_ssi_record_string(rec, param[i].key.data,
+                                       param[i].key.len, &op->data)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
 
-                param = ctx->params.elts;
+        if (ngx_http_ssi_record_string(rec, param[i].value.data,
+                                       param[i].value.len, &op->value)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
 
-                for (i = 0; i < ctx->params.nelts; i++) {
+    return NGX_OK;
+}
 
-                    for (prm = cmd->params; prm->name.len; prm++) {
 
-                        if (param[i].key.len != prm->name.len
-                            || ngx_strncmp(param[i].key.data, prm->name.data,
-                                           prm->name.len) != 0)
-                        {
-                            continue;
-                        }
+static void
+ngx_http_ssi_cache_template(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    size_t                     size;
+    ngx_http_ssi_record_t     *rec;
+    ngx_http_ssi_template_t   *t, **slot;
+    ngx_http_ssi_main_conf_t  *smcf;
 
-                        if (!prm->multiple) {
-                            if (params[prm->index]) {
-                                ngx_log_error(NGX_LOG_ERR,
-                                              r->connection->log, 0,
-                                              "duplicate \"%V\" parameter "
-                                              "in \"%V\" SSI command",
-                                              &param[i].key, &ctx->command);
+    rec = ctx->record;
+    ctx->record = NULL;
 
-                                goto ssi_error;
-                            }
+    size = sizeof(ngx_http_ssi_template_t)
+           + rec->ops.nelts * sizeof(ngx_http_ssi_op_t)
+           + rec->data.nelts + rec->template.path.len;
 
-                            params[prm->index] = &param[i].value;
+    t = ngx_alloc(size, r->connection->log);
+    if (t == NULL) {
+        return;
+    }
 
-                            break;
-                        }
+    *t = rec->template;
 
-                        for (index = prm->index; params[index]; index++) {
-                            /* void */
-                        }
+    t->ops = (ngx_http_ssi_op_t *) &t[1];
+    t->nops = rec->ops.nelts;
+    ngx_memcpy(t->ops, rec->ops.elts, t->nops * sizeof(ngx_http_ssi_op_t));
 
-                        params[index] = &param[i].value;
+    t->data = (u_char *) &t->ops[t->nops];
+    t->path.data = ngx_cpymem(t->data, rec->data.elts, rec->data.nelts);
+    ngx_memcpy(t->path.data, rec->template.path.data, t->path.len);
 
-                        break;
-                    }
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_ssi_filter_module);
 
-                    if (prm->name.len == 0) {
-                        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                                      "invalid parameter name: \"%V\" "
-                                      "in \"%V\" SSI command",
-                                      &param[i].key, &ctx->command);
+    slot = &smcf->templates[t->hash % smcf->ntemplates];
 
-                        goto ssi_error;
-                    }
-                }
+    if (*slot) {
+        if ((*slot)->count) {
+            (*slot)->evicted = 1;
 
-                for (prm = cmd->params; prm->name.len; prm++) {
-                    if (prm->mandatory && params[prm->index] == 0) {
-                        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                                      "mandatory \"%V\" parameter is absent "
-                                      "in \"%V\" SSI command",
-                                      &prm->name, &ctx->command);
+        } else {
+            ngx_free(*slot);
+        }
+    }
 
-                        goto ssi_error;
-                    }
-                }
+    *slot = t;
 
-                if (cmd->flush && ctx->out) {
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http ssi template \"%V\" cached, %ui ops",
+                   &t->path, t->nops);
+}
 
-                    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                                   "ssi flush");
 
-                    if (ngx_http_ssi_output(r, ctx) == NGX_ERROR) {
-                        return NGX_ERROR;
-                    }
-                }
+/*
+ * the document is not parsed but its input is consumed: the template
+ * has all of its texts, and the commands run as they would after parsing
+ */
 
-                rc = cmd->handler(r, ctx, params);
+static ngx_int_t
+ngx_http_ssi_replay(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
+{
+    u_char                   *data;
+    ngx_int_t                 rc;
+    ngx_buf_t                *b;
+    ngx_uint_t                i;
+    ngx_chain_t              *cl;
+    ngx_table_elt_t          *param;
+    ngx_http_ssi_op_t        *op;
+    ngx_http_ssi_template_t  *t;
+
+    for (cl = ctx->in; cl; cl = cl->next) {
+        b = cl->buf;
 
-                if (rc == NGX_OK) {
-                    continue;
-                }
+        if (b->last_buf || b->last_in_chain) {
+            ctx->input_done = 1;
+            ctx->input_last_buf = b->last_buf;
+        }
 
-                if (rc == NGX_DONE || rc == NGX_AGAIN || rc == NGX_ERROR) {
-                    ngx_http_ssi_buffered(r, ctx);
-                    return rc;
-                }
-            }
+        b->pos = b->last;
+        b->file_pos = b->file_last;
+    }
 
+    ctx->in = NULL;
 
-            /* rc == NGX_HTTP_SSI_ERROR */
+    t = ctx->template;
+    data = t->data;
 
-    ssi_error:
+    while (ctx->op < t->nops) {
 
-            if (slcf->silent_errors) {
-                continue;
-            }
+        op = &t->ops[ctx->op];
+        ctx->op += 1 + op->nparams;
 
-            if (ctx->free) {
-                cl = ctx->free;
-                ctx->free = ctx->free->next;
-                b = cl->buf;
-                ngx_memzero(b, sizeof(ngx_buf_t));
+        switch (op->type) {
 
-            } else {
-                b = ngx_calloc_buf(r->pool);
-                if (b == NULL) {
-                    return NGX_ERROR;
-                }
+        case NGX_HTTP_SSI_OP_TEXT:
 
-                cl = ngx_alloc_chain_link(r->pool);
+            if (ctx->output) {
+                cl = ngx_http_ssi_buf(r, ctx);
                 if (cl == NULL) {
                     return NGX_ERROR;
                 }
 
-                cl->buf = b;
-            }
+                b = cl->buf;
 
-            b->memory = 1;
-            b->pos = ctx->errmsg.data;
-            b->last = ctx->errmsg.data + ctx->errmsg.len;
+                b->memory = 1;
+                b->pos = data + op->data;
+                b->last = b->pos + op->len;
 
-            cl->next = NULL;
-            *ctx->last_out = cl;
-            ctx->last_out = &cl->next;
+            } else if (ctx->block) {
+                if (ngx_http_ssi_block_text(r, 0, data + op->data, op->len)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
 
             continue;
-        }
 
-        if (ctx->buf->last_buf || ngx_buf_in_memory(ctx->buf)) {
-            if (b == NULL) {
-                if (ctx->free) {
-                    cl = ctx->free;
-                    ctx->free = ctx->free->next;
-                    b = cl->buf;
-                    ngx_memzero(b, sizeof(ngx_buf_t));
-
-                } else {
-                    b = ngx_calloc_buf(r->pool);
-                    if (b == NULL) {
-                        return NGX_ERROR;
-                    }
+        case NGX_HTTP_SSI_OP_COMMAND:
 
-                    cl = ngx_alloc_chain_link(r->pool);
-                    if (cl == NULL) {
-                        return NGX_ERROR;
-                    }
+            ctx->key = op->key;
+            ctx->command.len = op->len;
+            ctx->command.data = data + op->data;
+            ctx->params.nelts = 0;
 
-                    cl->buf = b;
+            for (i = 1; i <= op->nparams; i++) {
+                param = ngx_array_push(&ctx->params);
+                if (param == NULL) {
+                    return NGX_ERROR;
                 }
 
-                b->sync = 1;
+                param->key.len = op[i].len;
+                param->key.data = data + op[i].data;
 
-                cl->next = NULL;
-                *ctx->last_out = cl;
-                ctx->last_out = &cl->next;
-            }
+                /* the commands evaluate the values in place */
 
-            b->last_buf = ctx->buf->last_buf;
-            b->shadow = ctx->buf;
+                param->value.len = op[i].value_len;
+                param->value.data = ngx_pnalloc(r->pool, op[i].value_len);
+                if (param->value.data == NULL) {
+                    return NGX_ERROR;
+                }
 
-            if (slcf->ignore_recycled_buffers == 0)  {
-                b->recycled = ctx->buf->recycled;
+                ngx_memcpy(param->value.data, data + op[i].value,
+                           op[i].value_len);
             }
-        }
 
-        ctx->buf = NULL;
+            rc = ngx_http_ssi_command(r, ctx);
 
-        ctx->saved = ctx->looked;
-    }
+            if (rc == NGX_OK) {
+                continue;
+            }
 
-    if (ctx->out == NULL && ctx->busy == NULL) {
-        return NGX_OK;
-    }
+            if (rc == NGX_DONE || rc == NGX_AGAIN || rc == NGX_ERROR) {
+                ngx_http_ssi_buffered(r, ctx);
+                return rc;
+            }
 
-    return ngx_http_ssi_output(r, ctx);
-}
+            break;
 
+        default: /* NGX_HTTP_SSI_OP_ERROR */
+            break;
+        }
 
-static ngx_int_t
-ngx_http_ssi_output(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
-{
-    ngx_int_t     rc;
-    ngx_buf_t    *b;
-    ngx_chain_t  *cl;
+        /* rc == NGX_HTTP_SSI_ERROR */
 
-#if 1
-    b = NULL;
-    for (cl = ctx->out; cl; cl = cl->next) {
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "ssi out: %p %p", cl->buf, cl->buf->pos);
-        if (cl->buf == b) {
-            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
-                          "the same buf was used in ssi");
-            ngx_debug_point();
+        if (ngx_http_ssi_error(r, ctx) == NGX_ERROR) {
             return NGX_ERROR;
         }
-        b = cl->buf;
-    }
-#endif
-
-    rc = ngx_http_next_body_filter(r, ctx->out);
-
-    if (ctx->busy == NULL) {
-        ctx->busy = ctx->out;
-
-    } else {
-        for (cl = ctx->busy; cl->next; cl = cl->next) { /* void */ }
-        cl->next = ctx->out;
     }
 
-    ctx->out = NULL;
-    ctx->last_out = &ctx->out;
-
-    while (ctx->busy) {
-
-        cl = ctx->busy;
-        b = cl->buf;
-
-        if (ngx_buf_size(b) != 0) {
-            break;
-        }
-
-        if (b->shadow) {
-            b->shadow->pos = b->shadow->last;
-        }
-
-        ctx->busy = cl->next;
+    if (ctx->input_done && !ctx->output_done) {
+        ctx->output_done = 1;
 
-        if (ngx_buf_in_memory(b) || b->in_file) {
-            /* add data bufs only to the free buf chain */
+        if (ctx->input_last_buf) {
+            cl = ngx_http_ssi_buf(r, ctx);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
 
-            cl->next = ctx->free;
-            ctx->free = cl;
+            cl->buf->last_buf = 1;
         }
     }
 
     ngx_http_ssi_buffered(r, ctx);
 
-    return rc;
-}
-
-
-static void
-ngx_http_ssi_buffered(ngx_http_request_t *r, ngx_http_ssi_ctx_t *ctx)
-{
-    if (ctx->in || ctx->buf) {
-        r->buffered |= NGX_HTTP_SSI_BUFFERED;
-
-    } else {
-        r->buffered &= ~NGX_HTTP_SSI_BUFFERED;
+    if (ctx->out == NULL && ctx->busy == NULL) {
+        return NGX_OK;
     }
+
+    return ngx_http_ssi_output(r, ctx);
 }
 
 
@@ -2811,6 +3372,60 @@ ngx_http_ssi_preconfiguration(ngx_conf_t *cf)
 }
 
 
+static char *
+ngx_http_ssi_template_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_ssi_main_conf_t *smcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value, s;
+
+    if (smcf->ntemplates != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "has an invalid parameter after \"off\"";
+        }
+
+        smcf->ntemplates = 0;
+        return NGX_CONF_OK;
+    }
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid number of templates \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    smcf->ntemplates = n;
+
+    if (cf->args->nelts == 2) {
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[2].data, "max_size=", 9) == 0) {
+
+        s.len = value[2].len - 9;
+        s.data = value[2].data + 9;
+
+        smcf->template_max_size = ngx_parse_offset(&s);
+        if (smcf->template_max_size > 0) {
+            return NGX_CONF_OK;
+        }
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+    return NGX_CONF_ERROR;
+}
+
+
 static void *
 ngx_http_ssi_create_main_conf(ngx_conf_t *cf)
 {
@@ -2828,6 +3443,9 @@ ngx_http_ssi_create_main_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+    smcf->ntemplates = NGX_CONF_UNSET_UINT;
+    smcf->template_max_size = NGX_CONF_UNSET;
+
     return smcf;
 }
 
@@ -2854,6 +3472,18 @@ ngx_http_ssi_init_main_conf(ngx_conf_t *cf, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_init_uint_value(smcf->ntemplates, 0);
+    ngx_conf_init_value(smcf->template_max_size,
+                        NGX_HTTP_SSI_TEMPLATE_MAX_SIZE);
+
+    if (smcf->ntemplates) {
+        smcf->templates = ngx_pcalloc(cf->pool, smcf->ntemplates
+                                      * sizeof(ngx_http_ssi_template_t *));
+        if (smcf->templates == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
     return NGX_CONF_OK;
 }
 
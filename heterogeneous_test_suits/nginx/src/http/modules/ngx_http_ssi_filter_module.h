@@ -30,9 +30,60 @@
 #define NGX_HTTP_SSI_ENTITY_ENCODING  2
 
 
+#define NGX_HTTP_SSI_OP_TEXT          0
+#define NGX_HTTP_SSI_OP_COMMAND       1
+#define NGX_HTTP_SSI_OP_PARAM         2
+#define NGX_HTTP_SSI_OP_ERROR         3
+
+
+/*
+ * a parsed document is a sequence of the texts and commands that the parser
+ * returned for it, a command is followed by its parameters; the strings are
+ * offsets in the data of the template
+ */
+
+typedef struct {
+    ngx_uint_t                type;
+    ngx_uint_t                key;
+    ngx_uint_t                nparams;
+    size_t                    data;
+    size_t                    len;
+    size_t                    value;
+    size_t                    value_len;
+} ngx_http_ssi_op_t;
+
+
+typedef struct {
+    uint32_t                  hash;
+    ngx_str_t                 path;
+    time_t                    mtime;
+    off_t                     size;
+    size_t                    value_len;
+
+    ngx_uint_t                count;        /* of the requests replaying it */
+    ngx_uint_t                evicted;      /* unsigned  evicted:1; */
+
+    ngx_http_ssi_op_t        *ops;
+    ngx_uint_t                nops;
+    u_char                   *data;
+} ngx_http_ssi_template_t;
+
+
+typedef struct {
+    ngx_http_ssi_template_t   template;     /* the key of the document */
+    ngx_array_t               ops;
+    ngx_array_t               data;
+} ngx_http_ssi_record_t;
+
+
 typedef struct {
     ngx_hash_t                hash;
     ngx_hash_keys_arrays_t    commands;
+
+    /* a direct mapped cache of the templates of the worker */
+    ngx_http_ssi_template_t **templates;
+    ngx_uint_t                ntemplates;
+    off_t                     template_max_size;
 } ngx_http_ssi_main_conf_t;
 
 
@@ -76,6 +127,13 @@ typedef struct {
     unsigned                  block:1;
     unsigned                  output:1;
     unsigned                  output_chosen:1;
+    unsigned                  input_done:1;
+    unsigned                  input_last_buf:1;
+    unsigned                  output_done:1;
+
+    ngx_http_ssi_template_t  *template;
+    ngx_uint_t                op;
+    ngx_http_ssi_record_t    *record;
 
     ngx_http_request_t       *wait;
     void                     *value_buf;
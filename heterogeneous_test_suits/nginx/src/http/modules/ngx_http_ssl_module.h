@@ -30,6 +30,12 @@ typedef struct {
 
     time_t                          session_timeout;
 
+    ngx_flag_t                      session_tickets;
+    time_t                          session_ticket_rotate;
+
+    ngx_flag_t                      async;
+    ngx_flag_t                      ktls;
+
     ngx_str_t                       certificate;
     ngx_str_t                       certificate_key;
     ngx_str_t                       dhparam;
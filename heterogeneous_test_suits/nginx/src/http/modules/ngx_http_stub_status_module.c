@@ -10,8 +10,18 @@
 #include <ngx_http.h>
 
 
+static void ngx_http_status_sum(ngx_stat_slot_t *sum);
+static u_char *ngx_http_status_timing(u_char *p, ngx_stat_slot_t *st);
+#if (NGX_HAVE_ATOMIC_OPS)
+static size_t ngx_http_status_locks_size(void);
+static u_char *ngx_http_status_locks(u_char *p);
+static u_char *ngx_http_status_lock(u_char *p, ngx_str_t *name,
+    ngx_uint_t stripe, ngx_shmtx_sh_t *sh);
+#endif
 static char *ngx_http_set_status(ngx_conf_t *cf, ngx_command_t *cmd,
                                  void *conf);
+static char *ngx_http_set_extended_status(ngx_conf_t *cf, ngx_command_t *cmd,
+                                 void *conf);
 
 static ngx_command_t  ngx_http_status_commands[] = {
 
@@ -22,6 +32,13 @@ static ngx_command_t  ngx_http_status_commands[] = {
       0,
       NULL },
 
+    { ngx_string("extended_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_http_set_extended_status,
+      0,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -60,11 +77,14 @@ ngx_module_t  ngx_http_stub_status_module = {
 
 static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
 {
-    size_t             size;
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_atomic_int_t   ap, hn, ac, rq, rd, wr;
+    size_t               size;
+    ngx_int_t            rc;
+    ngx_buf_t           *b;
+    ngx_uint_t           i;
+    ngx_chain_t          out;
+    ngx_stat_slot_t      st;
+    ngx_atomic_int_t     ap, hn, ac, rq, rd, wr, wa;
+    ngx_popcorn_stat_t   ps;
 
     if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -91,7 +111,10 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
     size = sizeof("Active connections:  \n") + NGX_ATOMIC_T_LEN
            + sizeof("server accepts handled requests\n") - 1
            + 6 + 3 * NGX_ATOMIC_T_LEN
-           + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN;
+           + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN
+           + sizeof("popcorn worker pid node cpu migrations failed "
+                    "home_msec remote_msec accepted accept_full active\n") - 1
+           + ngx_popcorn_stats_n * (13 + NGX_INT_T_LEN + 10 * NGX_ATOMIC_T_LEN);
 
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
@@ -101,12 +124,14 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
     out.buf = b;
     out.next = NULL;
 
-    ap = *ngx_stat_accepted;
-    hn = *ngx_stat_handled;
-    ac = *ngx_stat_active;
-    rq = *ngx_stat_requests;
-    rd = *ngx_stat_reading;
-    wr = *ngx_stat_writing;
+    ngx_http_status_sum(&st);
+
+    ap = st.accepted;
+    hn = st.handled;
+    ac = st.active;
+    rq = st.requests;
+    rd = st.reading;
+    wr = st.writing;
 
     b->last = ngx_sprintf(b->last, "Active connections: %uA \n", ac);
 
@@ -118,6 +143,158 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, ac - (rd + wr));
 
+    b->last = ngx_cpymem(b->last, "popcorn worker pid node cpu migrations failed "
+                         "home_msec remote_msec accepted accept_full active\n",
+                         sizeof("popcorn worker pid node cpu migrations failed "
+                                "home_msec remote_msec accepted accept_full active\n")
+                         - 1);
+
+    for (i = 0; i < ngx_popcorn_stats_n; i++) {
+        ps = ngx_popcorn_stats[i];
+
+        if (ps.pid == 0) {
+            continue;
+        }
+
+        b->last = ngx_sprintf(b->last, " %ui %uA %uA ", i, ps.pid, ps.node);
+
+        if (ps.cpu == NGX_POPCORN_CPU_ANY) {
+            *b->last++ = '-';
+
+        } else {
+            b->last = ngx_sprintf(b->last, "%uA", ps.cpu);
+        }
+
+        /* the load of the worker is its active connections */
+
+        wa = (i < ngx_stat_slots_n) ? ngx_stat_slot(i)->active : 0;
+
+        b->last = ngx_sprintf(b->last, " %uA %uA %uA %uA %uA %uA %uA \n",
+                              ps.migrations, ps.failed, ps.home_msec,
+                              ps.remote_msec, ps.accepted, ps.accept_full, wa);
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t ngx_http_extended_status_handler(ngx_http_request_t *r)
+{
+    size_t             size;
+    ngx_int_t          rc;
+    ngx_buf_t         *b;
+    ngx_uint_t         i, n;
+    ngx_chain_t        out;
+    ngx_stat_slot_t    st, *ws;
+
+    if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    size = sizeof("requests bytes_in bytes_out\n") - 1
+           + 4 + 3 * NGX_ATOMIC_T_LEN
+           + sizeof("status other 1xx 2xx 3xx 4xx 5xx\n") - 1
+           + 7 + 6 * NGX_ATOMIC_T_LEN
+           + sizeof("msec\n") - 1
+           + NGX_STAT_MSEC_BUCKETS * (1 + NGX_INT_T_LEN)
+           + 2 + NGX_STAT_MSEC_BUCKETS * (1 + NGX_ATOMIC_T_LEN)
+           + sizeof("timed usec\n") + NGX_ATOMIC_T_LEN
+           + NGX_STAT_USEC_BUCKETS * (1 + NGX_INT_T_LEN)
+           + NGX_STAT_TIMERS * (sizeof(" content ") + 1
+                                + NGX_STAT_USEC_BUCKETS * (1 + NGX_ATOMIC_T_LEN))
+           + sizeof("worker accepted handled requests active reading "
+                    "writing\n") - 1
+           + ngx_stat_slots_n * (8 + NGX_INT_T_LEN + 6 * NGX_ATOMIC_T_LEN);
+
+#if (NGX_HAVE_ATOMIC_OPS)
+    size += ngx_http_status_locks_size();
+#endif
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    ngx_http_status_sum(&st);
+
+    b->last = ngx_sprintf(b->last, "requests bytes_in bytes_out\n"
+                          " %uA %uA %uA \n",
+                          st.requests, st.bytes_in, st.bytes_out);
+
+    b->last = ngx_sprintf(b->last, "status other 1xx 2xx 3xx 4xx 5xx\n"
+                          " %uA %uA %uA %uA %uA %uA \n",
+                          st.status[0], st.status[1], st.status[2],
+                          st.status[3], st.status[4], st.status[5]);
+
+    /* the request time buckets are labelled with their lower bounds */
+
+    b->last = ngx_cpymem(b->last, "msec", sizeof("msec") - 1);
+
+    for (i = 0, n = 0; i < NGX_STAT_MSEC_BUCKETS; i++) {
+        b->last = ngx_sprintf(b->last, " %ui", n);
+        n = n ? n * 2 : 1;
+    }
+
+    *b->last++ = LF;
+
+    for (i = 0; i < NGX_STAT_MSEC_BUCKETS; i++) {
+        b->last = ngx_sprintf(b->last, " %uA", st.msec[i]);
+    }
+
+    *b->last++ = ' ';
+    *b->last++ = LF;
+
+    b->last = ngx_http_status_timing(b->last, &st);
+
+    b->last = ngx_cpymem(b->last, "worker accepted handled requests active "
+                         "reading writing\n",
+                         sizeof("worker accepted handled requests active "
+                                "reading writing\n") - 1);
+
+    for (i = 0; i < ngx_stat_slots_n; i++) {
+        ws = ngx_stat_slot(i);
+
+        b->last = ngx_sprintf(b->last, " %ui %uA %uA %uA %uA %uA %uA \n",
+                              i, ws->accepted, ws->handled, ws->requests,
+                              ws->active, ws->reading, ws->writing);
+    }
+
+#if (NGX_HAVE_ATOMIC_OPS)
+    b->last = ngx_http_status_locks(b->last);
+#endif
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
@@ -133,6 +310,201 @@ static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r)
 }
 
 
+/*
+ * the slots are summed while the workers update them, so the totals are
+ * as consistent as the single shared counters were
+ */
+
+static void
+ngx_http_status_sum(ngx_stat_slot_t *sum)
+{
+    ngx_uint_t        i, k, n;
+    ngx_stat_slot_t  *st;
+
+    ngx_memzero(sum, sizeof(ngx_stat_slot_t));
+
+    for (i = 0; i < ngx_stat_slots_n; i++) {
+        st = ngx_stat_slot(i);
+
+        sum->accepted += st->accepted;
+        sum->handled += st->handled;
+        sum->requests += st->requests;
+        sum->active += st->active;
+        sum->reading += st->reading;
+        sum->writing += st->writing;
+        sum->bytes_in += st->bytes_in;
+        sum->bytes_out += st->bytes_out;
+
+        for (k = 0; k < 6; k++) {
+            sum->status[k] += st->status[k];
+        }
+
+        for (k = 0; k < NGX_STAT_MSEC_BUCKETS; k++) {
+            sum->msec[k] += st->msec[k];
+        }
+
+        sum->timed += st->timed;
+
+        for (k = 0; k < NGX_STAT_TIMERS; k++) {
+            for (n = 0; n < NGX_STAT_USEC_BUCKETS; n++) {
+                sum->usec[k][n] += st->usec[k][n];
+            }
+        }
+    }
+}
+
+
+/*
+ * the timers of the requests sampled by "request_timing", a line per timer
+ * with the buckets labelled with their lower bounds in microseconds
+ */
+
+static u_char *
+ngx_http_status_timing(u_char *p, ngx_stat_slot_t *st)
+{
+    ngx_uint_t  i, k, n;
+
+    static char  *timers[] = {
+        "parse", "rewrite", "access", "content", "filter", "send", "migrate"
+    };
+
+    p = ngx_sprintf(p, "timed %uA usec", st->timed);
+
+    for (i = 0, n = 0; i < NGX_STAT_USEC_BUCKETS; i++) {
+        p = ngx_sprintf(p, " %ui", n);
+        n = n ? n * 2 : 1;
+    }
+
+    *p++ = LF;
+
+    for (k = 0; k < NGX_STAT_TIMERS; k++) {
+        p = ngx_sprintf(p, " %s", timers[k]);
+
+        for (i = 0; i < NGX_STAT_USEC_BUCKETS; i++) {
+            p = ngx_sprintf(p, " %uA", st->usec[k][i]);
+        }
+
+        *p++ = ' ';
+        *p++ = LF;
+    }
+
+    return p;
+}
+
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+/*
+ * the locks are the accept mutex and the slab pool locks of the shared
+ * zones, a zone split with ngx_slab_stripe() has a line per stripe
+ */
+
+#define NGX_HTTP_STATUS_LOCK_LEN                                              \
+    (2 + NGX_INT_T_LEN + 5 * (1 + NGX_ATOMIC_T_LEN) + 2)
+
+
+static size_t
+ngx_http_status_locks_size(void)
+{
+    size_t            size;
+    ngx_uint_t        i;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_slab_pool_t  *sp;
+    ngx_list_part_t  *part;
+
+    size = sizeof("lock acquired contended sleeps wait_usec spin\n") - 1
+           + sizeof("accept_mutex") - 1 + NGX_HTTP_STATUS_LOCK_LEN;
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        for ( /* void */ ; sp; sp = sp->next) {
+            size += shm_zone[i].shm.name.len + NGX_HTTP_STATUS_LOCK_LEN;
+        }
+    }
+
+    return size;
+}
+
+
+static u_char *
+ngx_http_status_locks(u_char *p)
+{
+    ngx_str_t         name;
+    ngx_uint_t        i, n;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_slab_pool_t  *sp;
+    ngx_list_part_t  *part;
+
+    p = ngx_cpymem(p, "lock acquired contended sleeps wait_usec spin\n",
+                   sizeof("lock acquired contended sleeps wait_usec spin\n")
+                   - 1);
+
+    if (ngx_accept_mutex.sh) {
+        ngx_str_set(&name, "accept_mutex");
+        p = ngx_http_status_lock(p, &name, 0, ngx_accept_mutex.sh);
+    }
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        /* the zone itself is the first, then its stripes */
+
+        sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        for (n = 0; sp; sp = sp->next, n++) {
+            p = ngx_http_status_lock(p, &shm_zone[i].shm.name, n, &sp->lock);
+        }
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_lock(u_char *p, ngx_str_t *name, ngx_uint_t stripe,
+    ngx_shmtx_sh_t *sh)
+{
+    p = ngx_sprintf(p, " %V", name);
+
+    if (stripe) {
+        p = ngx_sprintf(p, ":%ui", stripe);
+    }
+
+    return ngx_sprintf(p, " %uA %uA %uA %uA %uA \n",
+                       sh->acquired, sh->contended, sh->sleeps, sh->wait_usec,
+                       sh->spin);
+}
+
+#endif
+
+
 static char *ngx_http_set_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_core_loc_conf_t  *clcf;
@@ -142,3 +514,15 @@ static char *ngx_http_set_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *ngx_http_set_extended_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_extended_status_handler;
+
+    return NGX_CONF_OK;
+}
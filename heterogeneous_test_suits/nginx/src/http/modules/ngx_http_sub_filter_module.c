@@ -13,6 +13,41 @@
 typedef struct {
     ngx_str_t                  match;
     ngx_http_complex_value_t   value;
+} ngx_http_sub_pair_t;
+
+
+typedef struct {
+    ngx_uint_t                 depth;
+    ngx_uint_t                 match;    /* the pair index + 1 */
+    ngx_uint_t                 output;   /* the longest match state */
+    ngx_uint_t                 fail;
+} ngx_http_sub_node_t;
+
+
+/*
+ * the Aho-Corasick automaton of all sub_filter strings of a location,
+ * the bytes are mapped to the classes of the bytes found in the strings,
+ * and the goto and failure functions are folded into a single table
+ * of nstates * nclasses transitions
+ */
+
+typedef struct {
+    u_short                   *next;
+    ngx_http_sub_node_t       *nodes;
+    ngx_uint_t                 nstates;
+    ngx_uint_t                 nclasses;
+    size_t                     max;
+
+    u_char                     class[256];
+
+    /* the bytes any string starts with */
+    u_char                     start[256];
+} ngx_http_sub_tables_t;
+
+
+typedef struct {
+    ngx_array_t               *pairs;
+    ngx_http_sub_tables_t     *tables;
 
     ngx_hash_t                 types;
 
@@ -22,22 +57,21 @@ typedef struct {
 } ngx_http_sub_loc_conf_t;
 
 
-typedef enum {
-    sub_start_state = 0,
-    sub_match_state,
-} ngx_http_sub_state_e;
-
-
 typedef struct {
-    ngx_str_t                  match;
+    ngx_http_sub_tables_t     *tables;
+
     ngx_str_t                  saved;
     ngx_str_t                  looked;
+    ngx_str_t                  flush;
 
     ngx_uint_t                 once;   /* unsigned  once:1 */
+    ngx_uint_t                 left;
+    u_char                    *done;
 
     ngx_buf_t                 *buf;
 
     u_char                    *pos;
+    u_char                    *from;
     u_char                    *copy_start;
     u_char                    *copy_end;
 
@@ -47,7 +81,8 @@ typedef struct {
     ngx_chain_t               *busy;
     ngx_chain_t               *free;
 
-    ngx_str_t                  sub;
+    ngx_str_t                 *sub;
+    ngx_uint_t                 index;
 
     ngx_uint_t                 state;
 } ngx_http_sub_ctx_t;
@@ -57,6 +92,10 @@ static ngx_int_t ngx_http_sub_output(ngx_http_request_t *r,
     ngx_http_sub_ctx_t *ctx);
 static ngx_int_t ngx_http_sub_parse(ngx_http_request_t *r,
     ngx_http_sub_ctx_t *ctx);
+static void ngx_http_sub_flush(ngx_http_sub_ctx_t *ctx, u_char *end,
+    size_t keep);
+static ngx_http_sub_tables_t *ngx_http_sub_build(ngx_conf_t *cf,
+    ngx_array_t *pairs);
 
 static char * ngx_http_sub_filter(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -136,7 +175,7 @@ ngx_http_sub_header_filter(ngx_http_request_t *r)
 
     slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
 
-    if (slcf->match.len == 0
+    if (slcf->tables == NULL
         || r->headers_out.content_length_n == 0
         || ngx_http_test_content_type(r, &slcf->types) == NULL)
     {
@@ -148,19 +187,33 @@ ngx_http_sub_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    ctx->saved.data = ngx_pnalloc(r->pool, slcf->match.len);
+    ctx->saved.data = ngx_pnalloc(r->pool, slcf->tables->max);
     if (ctx->saved.data == NULL) {
         return NGX_ERROR;
     }
 
-    ctx->looked.data = ngx_pnalloc(r->pool, slcf->match.len);
+    ctx->looked.data = ngx_pnalloc(r->pool, slcf->tables->max);
     if (ctx->looked.data == NULL) {
         return NGX_ERROR;
     }
 
+    ctx->sub = ngx_pcalloc(r->pool, slcf->pairs->nelts * sizeof(ngx_str_t));
+    if (ctx->sub == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (slcf->once) {
+        ctx->done = ngx_pcalloc(r->pool, slcf->pairs->nelts);
+        if (ctx->done == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx->left = slcf->pairs->nelts;
+    }
+
     ngx_http_set_ctx(r, ctx, ngx_http_sub_filter_module);
 
-    ctx->match = slcf->match;
+    ctx->tables = slcf->tables;
     ctx->last_out = &ctx->out;
 
     r->filter_need_in_memory = 1;
@@ -181,7 +234,9 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_int_t                  rc;
     ngx_buf_t                 *b;
     ngx_chain_t               *cl;
+    ngx_str_t                 *sub;
     ngx_http_sub_ctx_t        *ctx;
+    ngx_http_sub_pair_t       *pair;
     ngx_http_sub_loc_conf_t   *slcf;
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_sub_filter_module);
@@ -226,72 +281,69 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             ctx->buf = ctx->in->buf;
             ctx->in = ctx->in->next;
             ctx->pos = ctx->buf->pos;
-        }
-
-        if (ctx->state == sub_start_state) {
-            ctx->copy_start = ctx->pos;
-            ctx->copy_end = ctx->pos;
+            ctx->from = ctx->buf->pos;
         }
 
         b = NULL;
 
-        while (ctx->pos < ctx->buf->last) {
+        /* the last buffer flushes the saved bytes of an incomplete match */
 
+        while (ctx->pos < ctx->buf->last
+               || (ctx->buf->last_buf && ctx->saved.len))
+        {
             ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "saved: \"%V\" state: %d", &ctx->saved, ctx->state);
+                           "saved: \"%V\" state: %ui", &ctx->saved, ctx->state);
 
             rc = ngx_http_sub_parse(r, ctx);
 
             ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "parse: %d, looked: \"%V\" %p-%p",
-                           rc, &ctx->looked, ctx->copy_start, ctx->copy_end);
+                           "parse: %d, flush: \"%V\" %p-%p",
+                           rc, &ctx->flush, ctx->copy_start, ctx->copy_end);
 
             if (rc == NGX_ERROR) {
                 return rc;
             }
 
-            if (ctx->copy_start != ctx->copy_end) {
-
-                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                               "saved: \"%V\"", &ctx->saved);
+            if (ctx->flush.len) {
 
-                if (ctx->saved.len) {
-
-                    if (ctx->free) {
-                        cl = ctx->free;
-                        ctx->free = ctx->free->next;
-                        b = cl->buf;
-                        ngx_memzero(b, sizeof(ngx_buf_t));
-
-                    } else {
-                        b = ngx_calloc_buf(r->pool);
-                        if (b == NULL) {
-                            return NGX_ERROR;
-                        }
-
-                        cl = ngx_alloc_chain_link(r->pool);
-                        if (cl == NULL) {
-                            return NGX_ERROR;
-                        }
+                if (ctx->free) {
+                    cl = ctx->free;
+                    ctx->free = ctx->free->next;
+                    b = cl->buf;
+                    ngx_memzero(b, sizeof(ngx_buf_t));
 
-                        cl->buf = b;
+                } else {
+                    b = ngx_calloc_buf(r->pool);
+                    if (b == NULL) {
+                        return NGX_ERROR;
                     }
 
-                    b->pos = ngx_pnalloc(r->pool, ctx->saved.len);
-                    if (b->pos == NULL) {
+                    cl = ngx_alloc_chain_link(r->pool);
+                    if (cl == NULL) {
                         return NGX_ERROR;
                     }
 
-                    ngx_memcpy(b->pos, ctx->saved.data, ctx->saved.len);
-                    b->last = b->pos + ctx->saved.len;
-                    b->memory = 1;
-
-                    *ctx->last_out = cl;
-                    ctx->last_out = &cl->next;
+                    cl->buf = b;
+                }
 
-                    ctx->saved.len = 0;
+                b->pos = ngx_pnalloc(r->pool, ctx->flush.len);
+                if (b->pos == NULL) {
+                    return NGX_ERROR;
                 }
 
+                ngx_memcpy(b->pos, ctx->flush.data, ctx->flush.len);
+                b->last = b->pos + ctx->flush.len;
+                b->memory = 1;
+
+                cl->next = NULL;
+                *ctx->last_out = cl;
+                ctx->last_out = &cl->next;
+
+                ctx->flush.len = 0;
+            }
+
+            if (ctx->copy_start != ctx->copy_end) {
+
                 if (ctx->free) {
                     cl = ctx->free;
                     ctx->free = ctx->free->next;
@@ -329,15 +381,6 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
                 ctx->last_out = &cl->next;
             }
 
-            if (ctx->state == sub_start_state) {
-                ctx->copy_start = ctx->pos;
-                ctx->copy_end = ctx->pos;
-
-            } else {
-                ctx->copy_start = NULL;
-                ctx->copy_end = NULL;
-            }
-
             if (rc == NGX_AGAIN) {
                 continue;
             }
@@ -357,19 +400,22 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
             slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
 
-            if (ctx->sub.data == NULL) {
+            pair = slcf->pairs->elts;
+            sub = &ctx->sub[ctx->index];
+
+            if (sub->data == NULL) {
 
-                if (ngx_http_complex_value(r, &slcf->value, &ctx->sub)
+                if (ngx_http_complex_value(r, &pair[ctx->index].value, sub)
                     != NGX_OK)
                 {
                     return NGX_ERROR;
                 }
             }
 
-            if (ctx->sub.len) {
+            if (sub->len) {
                 b->memory = 1;
-                b->pos = ctx->sub.data;
-                b->last = ctx->sub.data + ctx->sub.len;
+                b->pos = sub->data;
+                b->last = sub->data + sub->len;
 
             } else {
                 b->sync = 1;
@@ -380,7 +426,13 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             *ctx->last_out = cl;
             ctx->last_out = &cl->next;
 
-            ctx->once = slcf->once;
+            if (ctx->done) {
+                ctx->done[ctx->index] = 1;
+
+                if (--ctx->left == 0) {
+                    ctx->once = 1;
+                }
+            }
 
             continue;
         }
@@ -421,9 +473,6 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         }
 
         ctx->buf = NULL;
-
-        ctx->saved.len = ctx->looked.len;
-        ngx_memcpy(ctx->saved.data, ctx->looked.data, ctx->looked.len);
     }
 
     if (ctx->out == NULL && ctx->busy == NULL) {
@@ -506,117 +555,123 @@ ngx_http_sub_output(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx)
 static ngx_int_t
 ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx)
 {
-    u_char                *p, *last, *copy_end, ch, match;
-    size_t                 looked;
-    ngx_http_sub_state_e   state;
+    u_char                 *p, *last;
+    ngx_uint_t              state, m;
+    ngx_http_sub_node_t    *nodes;
+    ngx_http_sub_tables_t  *t;
 
     if (ctx->once) {
         ctx->copy_start = ctx->pos;
         ctx->copy_end = ctx->buf->last;
         ctx->pos = ctx->buf->last;
-        ctx->looked.len = 0;
+        ctx->flush.len = 0;
 
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "once");
 
         return NGX_AGAIN;
     }
 
+    t = ctx->tables;
+    nodes = t->nodes;
     state = ctx->state;
-    looked = ctx->looked.len;
     last = ctx->buf->last;
-    copy_end = ctx->copy_end;
 
     for (p = ctx->pos; p < last; p++) {
 
-        ch = *p;
-        ch = ngx_tolower(ch);
-
-        if (state == sub_start_state) {
+        if (state == 0) {
 
             /* the tight loop */
 
-            match = ctx->match.data[0];
-
-            for ( ;; ) {
-                if (ch == match) {
-                    copy_end = p;
-                    ctx->looked.data[0] = *p;
-                    looked = 1;
-                    state = sub_match_state;
-
-                    goto match_started;
-                }
-
+            while (t->start[*p] == 0) {
                 if (++p == last) {
-                    break;
+                    goto done;
                 }
-
-                ch = *p;
-                ch = ngx_tolower(ch);
             }
+        }
+
+        state = t->next[state * t->nclasses + t->class[*p]];
 
-            ctx->state = state;
-            ctx->pos = p;
-            ctx->looked.len = looked;
-            ctx->copy_end = p;
+        /* the strings already replaced with sub_filter_once are skipped */
 
-            if (ctx->copy_start == NULL) {
-                ctx->copy_start = ctx->buf->pos;
+        for (m = nodes[state].output; m; m = nodes[nodes[m].fail].output) {
+            if (ctx->done == NULL || !ctx->done[nodes[m].match - 1]) {
+                goto found;
             }
+        }
+    }
 
-            return NGX_AGAIN;
+done:
 
-        match_started:
+    if (ctx->buf->last_buf) {
+        state = 0;
+    }
 
-            continue;
-        }
+    ngx_http_sub_flush(ctx, last, nodes[state].depth);
 
-        /* state == sub_match_state */
+    ctx->state = state;
+    ctx->pos = last;
 
-        if (ch == ctx->match.data[looked]) {
-            ctx->looked.data[looked] = *p;
-            looked++;
+    return NGX_AGAIN;
 
-            if (looked == ctx->match.len) {
-                if ((size_t) (p - ctx->pos) < looked) {
-                    ctx->saved.len = 0;
-                }
+found:
 
-                ctx->state = sub_start_state;
-                ctx->pos = p + 1;
-                ctx->looked.len = 0;
-                ctx->copy_end = copy_end;
+    p++;
 
-                if (ctx->copy_start == NULL && copy_end) {
-                    ctx->copy_start = ctx->buf->pos;
-                }
+    ngx_http_sub_flush(ctx, p, nodes[m].depth);
 
-                return NGX_OK;
-            }
-
-        } else if (ch == ctx->match.data[0]) {
-            copy_end = p;
-            ctx->looked.data[0] = *p;
-            looked = 1;
+    /* the matched bytes are dropped */
 
-        } else {
-            copy_end = p;
-            looked = 0;
-            state = sub_start_state;
-        }
-    }
+    ctx->saved.len = 0;
+    ctx->from = p;
 
-    ctx->state = state;
+    ctx->state = 0;
     ctx->pos = p;
-    ctx->looked.len = looked;
+    ctx->index = nodes[m].match - 1;
 
-    ctx->copy_end = (state == sub_start_state) ? p : copy_end;
+    return NGX_OK;
+}
 
-    if (ctx->copy_start == NULL && ctx->copy_end) {
-        ctx->copy_start = ctx->buf->pos;
-    }
 
-    return NGX_AGAIN;
+/*
+ * the bytes pending since the last output are the saved bytes of
+ * the previous buffers followed by the bytes from ctx->from to the end;
+ * all of them but the last "keep" bytes, which may still be matched,
+ * are output as ctx->flush and the ctx->copy_start-ctx->copy_end range,
+ * and the kept bytes are saved
+ */
+
+static void
+ngx_http_sub_flush(ngx_http_sub_ctx_t *ctx, u_char *end, size_t keep)
+{
+    u_char  *data;
+    size_t   pending, n;
+
+    pending = ctx->saved.len + (end - ctx->from);
+
+    n = ngx_min(pending - keep, ctx->saved.len);
+
+    ctx->flush.data = ctx->saved.data;
+    ctx->flush.len = n;
+
+    ctx->copy_start = ctx->from;
+    ctx->copy_end = ctx->from + (pending - keep - n);
+
+    /*
+     * the kept bytes are copied to the spare buffer, so the flushed
+     * bytes remain intact until they are output
+     */
+
+    data = ctx->looked.data;
+
+    ngx_memcpy(data, ctx->saved.data + n, ctx->saved.len - n);
+    ngx_memcpy(data + ctx->saved.len - n, ctx->copy_end,
+               end - ctx->copy_end);
+
+    ctx->looked.data = ctx->saved.data;
+    ctx->saved.data = data;
+    ctx->saved.len = keep;
+
+    ctx->from = end;
 }
 
 
@@ -626,23 +681,51 @@ ngx_http_sub_filter(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_sub_loc_conf_t *slcf = conf;
 
     ngx_str_t                         *value;
+    ngx_uint_t                         i;
+    ngx_http_sub_pair_t               *pair;
     ngx_http_compile_complex_value_t   ccv;
 
-    if (slcf->match.len) {
-        return "is duplicate";
+    value = cf->args->elts;
+
+    if (slcf->pairs == NULL) {
+        slcf->pairs = ngx_array_create(cf->pool, 1,
+                                       sizeof(ngx_http_sub_pair_t));
+        if (slcf->pairs == NULL) {
+            return NGX_CONF_ERROR;
+        }
     }
 
-    value = cf->args->elts;
+    /* an empty string only cancels the inherited strings */
+
+    if (value[1].len == 0) {
+        return NGX_CONF_OK;
+    }
 
     ngx_strlow(value[1].data, value[1].data, value[1].len);
 
-    slcf->match = value[1];
+    pair = slcf->pairs->elts;
+
+    for (i = 0; i < slcf->pairs->nelts; i++) {
+        if (pair[i].match.len == value[1].len
+            && ngx_strncmp(pair[i].match.data, value[1].data, value[1].len)
+               == 0)
+        {
+            return "is duplicate";
+        }
+    }
+
+    pair = ngx_array_push(slcf->pairs);
+    if (pair == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    pair->match = value[1];
 
     ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
 
     ccv.cf = cf;
     ccv.value = &value[2];
-    ccv.complex_value = &slcf->value;
+    ccv.complex_value = &pair->value;
 
     if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
         return NGX_CONF_ERROR;
@@ -652,6 +735,141 @@ ngx_http_sub_filter(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static ngx_http_sub_tables_t *
+ngx_http_sub_build(ngx_conf_t *cf, ngx_array_t *pairs)
+{
+    u_char                 *data;
+    size_t                  len;
+    u_short                *next;
+    ngx_uint_t              i, j, c, s, n, f, head, tail, *queue;
+    ngx_http_sub_pair_t    *pair;
+    ngx_http_sub_node_t    *nodes;
+    ngx_http_sub_tables_t  *t;
+
+    t = ngx_pcalloc(cf->pool, sizeof(ngx_http_sub_tables_t));
+    if (t == NULL) {
+        return NULL;
+    }
+
+    pair = pairs->elts;
+
+    /* the class 0 is for the bytes not found in the strings */
+
+    t->nclasses = 1;
+    len = 1;
+
+    for (i = 0; i < pairs->nelts; i++) {
+
+        for (j = 0; j < pair[i].match.len; j++) {
+            c = pair[i].match.data[j];
+
+            if (t->class[c] == 0) {
+                t->class[c] = (u_char) t->nclasses++;
+            }
+        }
+
+        len += pair[i].match.len;
+
+        if (t->max < pair[i].match.len) {
+            t->max = pair[i].match.len;
+        }
+    }
+
+    /* the strings are in lower case, and the matching is case insensitive */
+
+    for (c = 'A'; c <= 'Z'; c++) {
+        t->class[c] = t->class[c | 0x20];
+    }
+
+    if (len > 0xffff) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the sub_filter strings are too long");
+        return NULL;
+    }
+
+    next = ngx_pcalloc(cf->pool, len * t->nclasses * sizeof(u_short));
+    if (next == NULL) {
+        return NULL;
+    }
+
+    nodes = ngx_pcalloc(cf->pool, len * sizeof(ngx_http_sub_node_t));
+    if (nodes == NULL) {
+        return NULL;
+    }
+
+    queue = ngx_palloc(cf->temp_pool, len * sizeof(ngx_uint_t));
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    /* the trie, the state 0 is the root */
+
+    n = 1;
+
+    for (i = 0; i < pairs->nelts; i++) {
+        data = pair[i].match.data;
+        s = 0;
+
+        for (j = 0; j < pair[i].match.len; j++) {
+            c = t->class[data[j]];
+
+            if (next[s * t->nclasses + c] == 0) {
+                next[s * t->nclasses + c] = (u_short) n;
+                nodes[n].depth = nodes[s].depth + 1;
+                n++;
+            }
+
+            s = next[s * t->nclasses + c];
+        }
+
+        nodes[s].match = i + 1;
+    }
+
+    /*
+     * the failure links are set in the breadth-first order,
+     * and the missing transitions are replaced with the transitions
+     * of the failure state, so the trie becomes a DFA
+     */
+
+    head = 0;
+    tail = 0;
+
+    for (c = 0; c < t->nclasses; c++) {
+        if (next[c]) {
+            queue[tail++] = next[c];
+        }
+    }
+
+    while (head < tail) {
+        s = queue[head++];
+
+        nodes[s].output = nodes[s].match ? s : nodes[nodes[s].fail].output;
+
+        for (c = 0; c < t->nclasses; c++) {
+            f = next[nodes[s].fail * t->nclasses + c];
+
+            if (next[s * t->nclasses + c]) {
+                nodes[next[s * t->nclasses + c]].fail = f;
+                queue[tail++] = next[s * t->nclasses + c];
+
+            } else {
+                next[s * t->nclasses + c] = (u_short) f;
+            }
+        }
+    }
+
+    for (c = 0; c < 256; c++) {
+        t->start[c] = (next[t->class[c]] != 0);
+    }
+
+    t->next = next;
+    t->nodes = nodes;
+    t->nstates = n;
+
+    return t;
+}
+
+
 static void *
 ngx_http_sub_create_conf(ngx_conf_t *cf)
 {
@@ -665,10 +883,8 @@ ngx_http_sub_create_conf(ngx_conf_t *cf)
     /*
      * set by ngx_pcalloc():
      *
-     *     conf->match = { 0, NULL };
-     *     conf->sub = { 0, NULL };
-     *     conf->sub_lengths = NULL;
-     *     conf->sub_values = NULL;
+     *     conf->pairs = NULL;
+     *     conf->tables = NULL;
      *     conf->types = { NULL };
      *     conf->types_keys = NULL;
      */
@@ -686,10 +902,25 @@ ngx_http_sub_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_sub_loc_conf_t *conf = child;
 
     ngx_conf_merge_value(conf->once, prev->once, 1);
-    ngx_conf_merge_str_value(conf->match, prev->match, "");
 
-    if (conf->value.value.len == 0) {
-        conf->value = prev->value;
+    /* the automaton is built once for all locations that inherit it */
+
+    if (prev->tables == NULL && prev->pairs && prev->pairs->nelts) {
+        prev->tables = ngx_http_sub_build(cf, prev->pairs);
+        if (prev->tables == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (conf->pairs == NULL) {
+        conf->pairs = prev->pairs;
+        conf->tables = prev->tables;
+
+    } else if (conf->tables == NULL && conf->pairs->nelts) {
+        conf->tables = ngx_http_sub_build(cf, conf->pairs);
+        if (conf->tables == NULL) {
+            return NGX_CONF_ERROR;
+        }
     }
 
     if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
@@ -0,0 +1,833 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_CHECK_TICK  1000
+
+
+typedef struct {
+    ngx_atomic_t                        down;
+    ngx_atomic_t                        checked;
+
+    /* changed only by the worker that claimed the probe */
+    ngx_uint_t                          fails;
+    ngx_uint_t                          passes;
+
+    uint32_t                            crc;
+} ngx_http_upstream_check_peer_t;
+
+
+typedef struct {
+    ngx_msec_t                          interval;
+    ngx_msec_t                          timeout;
+    ngx_uint_t                          fails;
+    ngx_uint_t                          passes;
+
+    ngx_str_t                           request;
+
+    ngx_http_upstream_srv_conf_t       *upstream;
+
+    /* the primary and the backup peers, in this order */
+    ngx_uint_t                          number;
+    ngx_http_upstream_rr_peer_t       **peer;
+    ngx_http_upstream_check_peer_t     *state;
+
+    ngx_event_t                         event;
+} ngx_http_upstream_check_srv_conf_t;
+
+
+typedef struct {
+    ngx_array_t                         checks;
+    ngx_uint_t                          number;
+    ngx_shm_zone_t                     *shm_zone;
+} ngx_http_upstream_check_main_conf_t;
+
+
+typedef struct {
+    ngx_http_upstream_check_srv_conf_t *conf;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_http_upstream_check_peer_t     *state;
+
+    u_char                             *sent;
+    u_char                              buf[32];
+    size_t                              received;
+} ngx_http_upstream_check_ctx_t;
+
+
+static ngx_int_t ngx_http_upstream_check_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_upstream_check_init_process(ngx_cycle_t *cycle);
+static void ngx_http_upstream_check_tick(ngx_event_t *ev);
+static void ngx_http_upstream_check_probe(
+    ngx_http_upstream_check_srv_conf_t *ucf, ngx_uint_t i);
+static void ngx_http_upstream_check_write_handler(ngx_event_t *ev);
+static void ngx_http_upstream_check_read_handler(ngx_event_t *ev);
+static void ngx_http_upstream_check_dummy_handler(ngx_event_t *ev);
+static void ngx_http_upstream_check_done(ngx_connection_t *c, ngx_uint_t ok);
+static void ngx_http_upstream_check_result(
+    ngx_http_upstream_check_srv_conf_t *ucf, ngx_http_upstream_rr_peer_t *peer,
+    ngx_http_upstream_check_peer_t *state, ngx_uint_t ok);
+
+static void *ngx_http_upstream_check_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_check_init_main_conf(ngx_conf_t *cf,
+    void *conf);
+static void *ngx_http_upstream_check_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_check_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_check,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_check_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_upstream_check_create_main_conf, /* create main configuration */
+    ngx_http_upstream_check_init_main_conf,   /* init main configuration */
+
+    ngx_http_upstream_check_create_conf,   /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_check_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_check_module_ctx,   /* module context */
+    ngx_http_upstream_check_commands,      /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_check_init_process,  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_str_t  ngx_http_upstream_check_zone = ngx_string("upstream_check");
+
+
+/*
+ * the peers of the upstreams with "health_check" get a state in shared
+ * memory, the rr peers point to its down flag before the workers are
+ * forked, so the peer selection in every worker skips a peer as soon as
+ * any worker has found it down
+ */
+
+static ngx_int_t
+ngx_http_upstream_check_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_upstream_check_main_conf_t  *ocmcf = data;
+
+    uint32_t                              crc;
+    ngx_uint_t                            i, j, k;
+    ngx_slab_pool_t                      *shpool;
+    ngx_http_upstream_check_peer_t       *state, *ostate;
+    ngx_http_upstream_check_srv_conf_t  **ucfp;
+    ngx_http_upstream_check_main_conf_t  *cmcf;
+
+    cmcf = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    ostate = NULL;
+
+    if (ocmcf || shm_zone->shm.exists) {
+        ostate = shpool->data;
+    }
+
+    if (ostate) {
+
+        /*
+         * the zone size depends on the number of the peers only,
+         * the states of the peers that are still in place are kept
+         */
+
+        state = ostate;
+
+    } else {
+        state = ngx_slab_alloc(shpool, cmcf->number
+                                       * sizeof(ngx_http_upstream_check_peer_t));
+        if (state == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(state, cmcf->number
+                           * sizeof(ngx_http_upstream_check_peer_t));
+
+        shpool->data = state;
+    }
+
+    ucfp = cmcf->checks.elts;
+    k = 0;
+
+    for (i = 0; i < cmcf->checks.nelts; i++) {
+
+        ucfp[i]->state = &state[k];
+
+        for (j = 0; j < ucfp[i]->number; j++, k++) {
+
+            crc = ngx_crc32_short(ucfp[i]->peer[j]->name.data,
+                                  ucfp[i]->peer[j]->name.len);
+
+            if (state[k].crc != crc) {
+                state[k].down = 0;
+                state[k].checked = 0;
+                state[k].fails = 0;
+                state[k].passes = 0;
+                state[k].crc = crc;
+            }
+
+            ucfp[i]->peer[j]->check = &state[k].down;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * every worker ticks, but a probe of a peer is claimed by swapping its
+ * last check time in shared memory, so each peer is probed by one worker
+ * once in an interval
+ */
+
+static ngx_int_t
+ngx_http_upstream_check_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                            i;
+    ngx_http_upstream_check_srv_conf_t  **ucfp;
+    ngx_http_upstream_check_main_conf_t  *cmcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    cmcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_upstream_check_module);
+
+    if (cmcf == NULL) {
+        return NGX_OK;
+    }
+
+    ucfp = cmcf->checks.elts;
+
+    for (i = 0; i < cmcf->checks.nelts; i++) {
+
+        ucfp[i]->event.handler = ngx_http_upstream_check_tick;
+        ucfp[i]->event.data = ucfp[i];
+        ucfp[i]->event.log = cycle->log;
+
+        ngx_add_timer(&ucfp[i]->event, 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_check_tick(ngx_event_t *ev)
+{
+    ngx_uint_t                           i;
+    ngx_msec_t                           now, checked;
+    ngx_http_upstream_check_peer_t      *state;
+    ngx_http_upstream_check_srv_conf_t  *ucf;
+
+    ucf = ev->data;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    now = ngx_current_msec;
+
+    for (i = 0; i < ucf->number; i++) {
+
+        if (ucf->peer[i]->down) {
+            continue;
+        }
+
+        state = &ucf->state[i];
+        checked = state->checked;
+
+        if (checked && now - checked < ucf->interval) {
+            continue;
+        }
+
+        if (!ngx_atomic_cmp_set(&state->checked, checked, now)) {
+            continue;
+        }
+
+        ngx_http_upstream_check_probe(ucf, i);
+    }
+
+    ngx_add_timer(ev, ngx_min(ucf->interval, NGX_HTTP_UPSTREAM_CHECK_TICK));
+}
+
+
+static void
+ngx_http_upstream_check_probe(ngx_http_upstream_check_srv_conf_t *ucf,
+    ngx_uint_t i)
+{
+    ngx_int_t                       rc;
+    ngx_pool_t                     *pool;
+    ngx_connection_t               *c;
+    ngx_peer_connection_t           pc;
+    ngx_http_upstream_rr_peer_t    *peer;
+    ngx_http_upstream_check_ctx_t  *ctx;
+
+    peer = ucf->peer[i];
+
+    ngx_memzero(&pc, sizeof(ngx_peer_connection_t));
+
+    pc.sockaddr = peer->sockaddr;
+    pc.socklen = peer->socklen;
+    pc.name = &peer->name;
+    pc.get = ngx_event_get_peer;
+    pc.log = ngx_cycle->log;
+    pc.log_error = NGX_ERROR_INFO;
+    pc.tries = 1;
+
+    rc = ngx_event_connect_peer(&pc);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "health check connect to %V: %i", &peer->name, rc);
+
+    if (rc == NGX_ERROR || rc == NGX_DECLINED) {
+        /* connect() failed, the peer is surely unavailable */
+        goto failed;
+    }
+
+    if (rc == NGX_BUSY) {
+        /* no connection left in this worker, the peer is not to blame */
+        return;
+    }
+
+    c = pc.connection;
+
+    pool = ngx_create_pool(128, ngx_cycle->log);
+    if (pool == NULL) {
+        ngx_close_connection(c);
+        return;
+    }
+
+    ctx = ngx_pcalloc(pool, sizeof(ngx_http_upstream_check_ctx_t));
+    if (ctx == NULL) {
+        ngx_destroy_pool(pool);
+        ngx_close_connection(c);
+        return;
+    }
+
+    ctx->conf = ucf;
+    ctx->peer = peer;
+    ctx->state = &ucf->state[i];
+    ctx->sent = ucf->request.data;
+
+    c->pool = pool;
+    c->data = ctx;
+    c->read->handler = ngx_http_upstream_check_read_handler;
+    c->write->handler = ngx_http_upstream_check_write_handler;
+
+    /* the whole probe is limited by the timer on the read event */
+
+    ngx_add_timer(c->read, ucf->timeout);
+
+    if (rc == NGX_AGAIN) {
+        return;
+    }
+
+    ngx_http_upstream_check_write_handler(c->write);
+
+    return;
+
+failed:
+
+    if (pc.connection) {
+        ngx_close_connection(pc.connection);
+    }
+
+    ngx_http_upstream_check_result(ucf, peer, &ucf->state[i], 0);
+}
+
+
+static void
+ngx_http_upstream_check_write_handler(ngx_event_t *ev)
+{
+    int                             err;
+    ssize_t                         n;
+    socklen_t                       len;
+    ngx_connection_t               *c;
+    ngx_http_upstream_check_ctx_t  *ctx;
+
+    c = ev->data;
+    ctx = c->data;
+
+    if (ctx->sent == ctx->conf->request.data) {
+
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            ngx_http_upstream_check_done(c, 0);
+            return;
+        }
+
+        /* without a request the connect alone tells that the peer is up */
+
+        if (ctx->conf->request.len == 0) {
+            ngx_http_upstream_check_done(c, 1);
+            return;
+        }
+    }
+
+    while (ctx->sent < ctx->conf->request.data + ctx->conf->request.len) {
+
+        n = c->send(c, ctx->sent,
+                    ctx->conf->request.data + ctx->conf->request.len
+                    - ctx->sent);
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_check_done(c, 0);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+                ngx_http_upstream_check_done(c, 0);
+            }
+
+            return;
+        }
+
+        ctx->sent += n;
+    }
+
+    c->write->handler = ngx_http_upstream_check_dummy_handler;
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_http_upstream_check_done(c, 0);
+        return;
+    }
+
+    if (c->read->ready) {
+        ngx_http_upstream_check_read_handler(c->read);
+    }
+}
+
+
+static void
+ngx_http_upstream_check_read_handler(ngx_event_t *ev)
+{
+    ssize_t                         n;
+    ngx_uint_t                      status;
+    ngx_connection_t               *c;
+    ngx_http_upstream_check_ctx_t  *ctx;
+
+    c = ev->data;
+    ctx = c->data;
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "health check of %V timed out", &ctx->peer->name);
+        ngx_http_upstream_check_done(c, 0);
+        return;
+    }
+
+    if (ctx->conf->request.len == 0
+        || ctx->sent < ctx->conf->request.data + ctx->conf->request.len)
+    {
+        /* still connecting or sending */
+        return;
+    }
+
+    /* only the status line, "HTTP/1.x NNN", is of interest */
+
+    while (ctx->received < sizeof("HTTP/1.x NNN") - 1) {
+
+        n = c->recv(c, ctx->buf + ctx->received,
+                    sizeof(ctx->buf) - ctx->received);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                ngx_http_upstream_check_done(c, 0);
+            }
+
+            return;
+        }
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_http_upstream_check_done(c, 0);
+            return;
+        }
+
+        ctx->received += n;
+    }
+
+    if (ngx_strncmp(ctx->buf, "HTTP/1.", sizeof("HTTP/1.") - 1) != 0
+        || ctx->buf[8] != ' ')
+    {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "health check of %V got an invalid response",
+                      &ctx->peer->name);
+        ngx_http_upstream_check_done(c, 0);
+        return;
+    }
+
+    status = ngx_atoi(&ctx->buf[9], 3);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "health check of %V status: %ui", &ctx->peer->name,
+                   status);
+
+    ngx_http_upstream_check_done(c, status >= 200 && status < 400);
+}
+
+
+static void
+ngx_http_upstream_check_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check dummy handler");
+}
+
+
+static void
+ngx_http_upstream_check_done(ngx_connection_t *c, ngx_uint_t ok)
+{
+    ngx_pool_t                     *pool;
+    ngx_http_upstream_check_ctx_t  *ctx;
+
+    ctx = c->data;
+
+    ngx_http_upstream_check_result(ctx->conf, ctx->peer, ctx->state, ok);
+
+    pool = c->pool;
+
+    ngx_close_connection(c);
+    ngx_destroy_pool(pool);
+}
+
+
+static void
+ngx_http_upstream_check_result(ngx_http_upstream_check_srv_conf_t *ucf,
+    ngx_http_upstream_rr_peer_t *peer, ngx_http_upstream_check_peer_t *state,
+    ngx_uint_t ok)
+{
+    if (ok) {
+        state->fails = 0;
+
+        if (state->down && ++state->passes >= ucf->passes) {
+            state->down = 0;
+            state->passes = 0;
+
+            ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                          "upstream server %V is up", &peer->name);
+        }
+
+        return;
+    }
+
+    state->passes = 0;
+
+    if (!state->down && ++state->fails >= ucf->fails) {
+        state->down = 1;
+        state->fails = 0;
+
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "upstream server %V is down", &peer->name);
+    }
+}
+
+
+static void *
+ngx_http_upstream_check_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_check_main_conf_t  *cmcf;
+
+    cmcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_check_main_conf_t));
+    if (cmcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&cmcf->checks, cf->pool, 4,
+                       sizeof(ngx_http_upstream_check_srv_conf_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return cmcf;
+}
+
+
+/*
+ * the upstream module is before this one, so the rr peers of every
+ * upstream have been already built by its init_main_conf
+ */
+
+static char *
+ngx_http_upstream_check_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_upstream_check_main_conf_t  *cmcf = conf;
+
+    size_t                                size;
+    ngx_uint_t                            i, j, n;
+    ngx_http_upstream_rr_peers_t         *peers;
+    ngx_http_upstream_check_srv_conf_t  **ucfp, *ucf;
+
+    ucfp = cmcf->checks.elts;
+
+    for (i = 0; i < cmcf->checks.nelts; i++) {
+        ucf = ucfp[i];
+
+        peers = ucf->upstream->peer.data;
+
+        if (peers == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "\"health_check\" requires round robin peers "
+                          "in upstream \"%V\" in %s:%ui",
+                          &ucf->upstream->host, ucf->upstream->file_name,
+                          ucf->upstream->line);
+            return NGX_CONF_ERROR;
+        }
+
+        n = peers->number + (peers->next ? peers->next->number : 0);
+
+        ucf->peer = ngx_palloc(cf->pool,
+                               n * sizeof(ngx_http_upstream_rr_peer_t *));
+        if (ucf->peer == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        n = 0;
+
+        for ( /* void */ ; peers; peers = peers->next) {
+            for (j = 0; j < peers->number; j++) {
+                ucf->peer[n++] = &peers->peer[j];
+            }
+        }
+
+        ucf->number = n;
+        cmcf->number += n;
+    }
+
+    if (cmcf->number == 0) {
+        return NGX_CONF_OK;
+    }
+
+    size = 8 * ngx_pagesize
+           + cmcf->number * sizeof(ngx_http_upstream_check_peer_t);
+
+    cmcf->shm_zone = ngx_shared_memory_add(cf, &ngx_http_upstream_check_zone,
+                                           size,
+                                           &ngx_http_upstream_check_module);
+    if (cmcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cmcf->shm_zone->init = ngx_http_upstream_check_init_zone;
+    cmcf->shm_zone->data = cmcf;
+
+    return NGX_CONF_OK;
+}
+
+
+static void *
+ngx_http_upstream_check_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_check_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_check_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->request = { 0, NULL };
+     *     conf->upstream = NULL;
+     *     conf->peer = NULL;
+     *     conf->state = NULL;
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_check_main_conf_t  *cmcf = conf;
+
+    u_char                                *p;
+    ngx_int_t                              n;
+    ngx_str_t                             *value, s, uri;
+    ngx_uint_t                             i;
+    ngx_msec_t                             msec;
+    ngx_http_upstream_srv_conf_t          *uscf;
+    ngx_http_upstream_check_srv_conf_t    *ucf, **ucfp;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ucf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_check_module);
+
+    if (ucf->upstream) {
+        return "is duplicate";
+    }
+
+    ucf->interval = 5000;
+    ucf->timeout = 1000;
+    ucf->fails = 1;
+    ucf->passes = 1;
+
+    ngx_str_null(&uri);
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = &value[i].data[9];
+
+            msec = ngx_parse_time(&s, 0);
+            if (msec == (ngx_msec_t) NGX_ERROR || msec == 0) {
+                goto invalid;
+            }
+
+            ucf->interval = msec;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            msec = ngx_parse_time(&s, 0);
+            if (msec == (ngx_msec_t) NGX_ERROR || msec == 0) {
+                goto invalid;
+            }
+
+            ucf->timeout = msec;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "uri=", 4) == 0) {
+
+            uri.len = value[i].len - 4;
+            uri.data = &value[i].data[4];
+
+            if (uri.len == 0 || uri.data[0] != '/') {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    /* a probe must be over before the next one of the same peer is claimed */
+
+    if (ucf->timeout > ucf->interval) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "health check timeout is larger than interval");
+        return NGX_CONF_ERROR;
+    }
+
+    if (uri.len) {
+        ucf->request.len = sizeof("GET  HTTP/1.0" CRLF "Host: " CRLF
+                                  "Connection: close" CRLF CRLF) - 1
+                           + uri.len + uscf->host.len;
+
+        p = ngx_pnalloc(cf->pool, ucf->request.len);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ucf->request.data = p;
+
+        ngx_sprintf(p, "GET %V HTTP/1.0" CRLF "Host: %V" CRLF
+                    "Connection: close" CRLF CRLF, &uri, &uscf->host);
+    }
+
+    ucf->upstream = uscf;
+
+    ucfp = ngx_array_push(&cmcf->checks);
+    if (ucfp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *ucfp = ucf;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
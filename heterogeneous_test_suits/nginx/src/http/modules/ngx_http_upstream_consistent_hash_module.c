@@ -0,0 +1,523 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_CHASH_POINTS  160
+
+
+typedef struct {
+    uint32_t                            hash;
+    ngx_uint_t                          peer;
+} ngx_http_upstream_chash_point_t;
+
+
+typedef struct {
+    ngx_http_complex_value_t            key;
+
+    /* the load limit of a peer in percents of its fair share, 0 is none */
+    ngx_uint_t                          bound;
+
+    ngx_http_upstream_chash_point_t    *points;
+    ngx_uint_t                          number;
+
+    ngx_uint_t                         *conns;
+    ngx_uint_t                          total;
+} ngx_http_upstream_chash_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t    rrp;
+
+    ngx_http_upstream_chash_srv_conf_t *conf;
+
+    uint32_t                            hash;
+
+    ngx_event_get_peer_pt               get_rr_peer;
+    ngx_event_free_peer_pt              free_rr_peer;
+} ngx_http_upstream_chash_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_free_chash_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_uint_t ngx_http_upstream_find_chash_point(
+    ngx_http_upstream_chash_srv_conf_t *chcf, uint32_t hash);
+static int ngx_libc_cdecl ngx_http_upstream_chash_cmp_points(const void *one,
+    const void *two);
+static void *ngx_http_upstream_chash_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_chash(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_chash_commands[] = {
+
+    { ngx_string("consistent_hash"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_chash,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_consistent_hash_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_chash_create_conf,   /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_consistent_hash_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_consistent_hash_module_ctx, /* module context */
+    ngx_http_upstream_chash_commands,      /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * every peer is placed on the ring as 160 points per unit of weight, hashed
+ * from its address, so adding or removing a peer moves only the keys of its
+ * own arcs; the ring is sorted once here and searched in O(log n)
+ */
+
+static ngx_int_t
+ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    u_char                              *p;
+    size_t                               len;
+    ngx_uint_t                           i, j, k, n;
+    ngx_http_upstream_rr_peer_t         *peer;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_chash_point_t     *points;
+    ngx_http_upstream_chash_srv_conf_t  *chcf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init consistent hash");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    peers = us->peer.data;
+
+    chcf = ngx_http_conf_upstream_srv_conf(us,
+                                     ngx_http_upstream_consistent_hash_module);
+
+    n = 0;
+
+    for (i = 0; i < peers->number; i++) {
+        if (!peers->peer[i].down) {
+            n += peers->peer[i].weight * NGX_HTTP_UPSTREAM_CHASH_POINTS;
+        }
+    }
+
+    chcf->conns = ngx_pcalloc(cf->pool, sizeof(ngx_uint_t) * peers->number);
+    if (chcf->conns == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (n == 0) {
+        us->peer.init = ngx_http_upstream_init_chash_peer;
+        return NGX_OK;
+    }
+
+    points = ngx_palloc(cf->pool, sizeof(ngx_http_upstream_chash_point_t) * n);
+    if (points == NULL) {
+        return NGX_ERROR;
+    }
+
+    k = 0;
+
+    for (i = 0; i < peers->number; i++) {
+        peer = &peers->peer[i];
+
+        if (peer->down) {
+            continue;
+        }
+
+        len = peer->name.len + 1 + NGX_INT_T_LEN;
+
+        p = ngx_pnalloc(cf->temp_pool, len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (j = 0;
+             j < (ngx_uint_t) peer->weight * NGX_HTTP_UPSTREAM_CHASH_POINTS;
+             j++)
+        {
+            len = ngx_sprintf(p, "%V-%ui", &peer->name, j) - p;
+
+            points[k].hash = ngx_murmur_hash2(p, len);
+            points[k].peer = i;
+            k++;
+        }
+    }
+
+    ngx_qsort(points, n, sizeof(ngx_http_upstream_chash_point_t),
+              ngx_http_upstream_chash_cmp_points);
+
+    chcf->points = points;
+    chcf->number = n;
+
+    us->peer.init = ngx_http_upstream_init_chash_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_str_t                             key;
+    ngx_http_upstream_chash_srv_conf_t   *chcf;
+    ngx_http_upstream_chash_peer_data_t  *chp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init consistent hash peer");
+
+    chcf = ngx_http_conf_upstream_srv_conf(us,
+                                     ngx_http_upstream_consistent_hash_module);
+
+    chp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_chash_peer_data_t));
+    if (chp == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &chp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_complex_value(r, &chcf->key, &key) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "consistent hash key: \"%V\"", &key);
+
+    chp->conf = chcf;
+    chp->hash = ngx_murmur_hash2(key.data, key.len);
+
+    r->upstream->peer.get = ngx_http_upstream_get_chash_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_chash_peer;
+
+    chp->get_rr_peer = ngx_http_upstream_get_round_robin_peer;
+    chp->free_rr_peer = ngx_http_upstream_free_round_robin_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_chash_peer_data_t  *chp = data;
+
+    time_t                               now;
+    uintptr_t                            m;
+    ngx_uint_t                           i, k, n, p, limit, fallback;
+    ngx_http_upstream_rr_peer_t         *peer;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_chash_srv_conf_t  *chcf;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get consistent hash peer, try: %ui", pc->tries);
+
+    chcf = chp->conf;
+    peers = chp->rrp.peers;
+
+    if (peers->single || chcf->number == 0) {
+        return chp->get_rr_peer(pc, &chp->rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    /*
+     * with a bound, a peer takes no more than its share of the requests
+     * in flight times the bound, and the key spills over to the next peer
+     * on the ring; if every peer is over, the first usable one is taken
+     */
+
+    fallback = peers->number;
+
+    i = ngx_http_upstream_find_chash_point(chcf, chp->hash);
+
+    for (k = 0; k < chcf->number; k++, i++) {
+
+        if (i == chcf->number) {
+            i = 0;
+        }
+
+        p = chcf->points[i].peer;
+
+        n = p / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+        if (chp->rrp.tried[n] & m) {
+            continue;
+        }
+
+        peer = &peers->peer[p];
+
+        if (ngx_http_upstream_rr_peer_down(peer)) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        if (chcf->bound == 0) {
+            goto found;
+        }
+
+        if (fallback == peers->number) {
+            fallback = p;
+        }
+
+        limit = ((chcf->total + 1) * peer->weight * chcf->bound
+                 + peers->total_weight * 100 - 1)
+                / (peers->total_weight * 100);
+
+        if (chcf->conns[p] < limit) {
+            goto found;
+        }
+    }
+
+    if (fallback == peers->number) {
+        goto failed;
+    }
+
+    p = fallback;
+    peer = &peers->peer[p];
+
+found:
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get consistent hash peer: %ui, conns: %ui",
+                   p, chcf->conns[p]);
+
+    chp->rrp.current = p;
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    chp->rrp.tried[n] |= m;
+
+    peer->checked = now;
+
+    chcf->conns[p]++;
+    chcf->total++;
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    return NGX_OK;
+
+failed:
+
+    /* all peers failed, mark them as live for quick recovery */
+
+    for (i = 0; i < peers->number; i++) {
+        peers->peer[i].fails = 0;
+    }
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static void
+ngx_http_upstream_free_chash_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_chash_peer_data_t  *chp = data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free consistent hash peer %ui %ui", pc->tries, state);
+
+    if (chp->rrp.peers->single || chp->conf->number == 0) {
+        chp->free_rr_peer(pc, &chp->rrp, state);
+        return;
+    }
+
+    if (state == 0 && pc->tries == 0) {
+        return;
+    }
+
+    chp->conf->conns[chp->rrp.current]--;
+    chp->conf->total--;
+
+    chp->free_rr_peer(pc, &chp->rrp, state);
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_find_chash_point(ngx_http_upstream_chash_srv_conf_t *chcf,
+    uint32_t hash)
+{
+    ngx_uint_t                        i, j, k;
+    ngx_http_upstream_chash_point_t  *point;
+
+    /* find the first point with the hash not less than the key's */
+
+    point = chcf->points;
+
+    i = 0;
+    j = chcf->number;
+
+    while (i < j) {
+        k = (i + j) / 2;
+
+        if (hash > point[k].hash) {
+            i = k + 1;
+
+        } else {
+            j = k;
+        }
+    }
+
+    return (i == chcf->number) ? 0 : i;
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_upstream_chash_cmp_points(const void *one, const void *two)
+{
+    ngx_http_upstream_chash_point_t  *first, *second;
+
+    first = (ngx_http_upstream_chash_point_t *) one;
+    second = (ngx_http_upstream_chash_point_t *) two;
+
+    if (first->hash < second->hash) {
+        return -1;
+    }
+
+    if (first->hash > second->hash) {
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static void *
+ngx_http_upstream_chash_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_chash_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_chash_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->bound = 0;
+     *     conf->points = NULL;
+     *     conf->number = 0;
+     *     conf->conns = NULL;
+     *     conf->total = 0;
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_chash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_chash_srv_conf_t  *chcf = conf;
+
+    ngx_int_t                          n;
+    ngx_str_t                         *value;
+    ngx_http_upstream_srv_conf_t      *uscf;
+    ngx_http_compile_complex_value_t   ccv;
+
+    value = cf->args->elts;
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = &chcf->key;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "bound=", 6) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        n = ngx_atoi(value[2].data + 6, value[2].len - 6);
+
+        if (n == NGX_ERROR || n < 100) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid bound \"%V\", it must be "
+                               "a percentage not less than 100", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        chcf->bound = n;
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_chash;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN;
+
+    return NGX_CONF_OK;
+}
@@ -206,7 +206,7 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
 
             /* ngx_lock_mutex(iphp->rrp.peers->mutex); */
 
-            if (!peer->down) {
+            if (!ngx_http_upstream_rr_peer_down(peer)) {
 
                 if (peer->max_fails == 0 || peer->fails < peer->max_fails) {
                     break;
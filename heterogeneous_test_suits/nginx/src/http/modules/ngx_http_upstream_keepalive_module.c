@@ -10,12 +10,33 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_UPSTREAM_KEEPALIVE_TICK  1000
+
+
 typedef struct {
     ngx_uint_t                         max_cached;
 
+    ngx_msec_t                         timeout;
+    ngx_uint_t                         prewarm;
+    ngx_flag_t                         adaptive;
+
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
 
+    ngx_uint_t                         cached;
+    ngx_uint_t                         warming;
+
+    /* requests in flight, and their peaks in this and the last window */
+    ngx_uint_t                         busy;
+    ngx_uint_t                         peak;
+    ngx_uint_t                         last_peak;
+    ngx_msec_t                         window;
+
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_uint_t                         next_peer;
+
+    ngx_event_t                        event;
+
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
 
@@ -38,6 +59,7 @@ typedef struct {
 #endif
 
     ngx_uint_t                         failed;       /* unsigned:1 */
+    ngx_uint_t                         busy;         /* unsigned:1 */
 
 } ngx_http_upstream_keepalive_peer_data_t;
 
@@ -54,6 +76,12 @@ typedef struct {
 } ngx_http_upstream_keepalive_cache_t;
 
 
+typedef struct {
+    ngx_http_upstream_keepalive_srv_conf_t  *conf;
+    ngx_http_upstream_rr_peer_t             *peer;
+} ngx_http_upstream_keepalive_warm_t;
+
+
 static ngx_int_t ngx_http_upstream_init_keepalive_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us);
 static ngx_int_t ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc,
@@ -64,6 +92,20 @@ static void ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc,
 static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
+static void ngx_http_upstream_keepalive_save(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_connection_t *c,
+    struct sockaddr *sockaddr, socklen_t socklen);
+
+static ngx_int_t ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle);
+static void ngx_http_upstream_keepalive_tick(ngx_event_t *ev);
+static void ngx_http_upstream_keepalive_prune(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_uint_t target);
+static void ngx_http_upstream_keepalive_warm(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf);
+static ngx_int_t ngx_http_upstream_keepalive_connect(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_rr_peer_t *peer);
+static void ngx_http_upstream_keepalive_connect_handler(ngx_event_t *ev);
 
 
 #if (NGX_HTTP_SSL)
@@ -87,6 +129,27 @@ static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
       0,
       NULL },
 
+    { ngx_string("keepalive_timeout"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, timeout),
+      NULL },
+
+    { ngx_string("keepalive_prewarm"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, prewarm),
+      NULL },
+
+    { ngx_string("keepalive_adaptive"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, adaptive),
+      NULL },
+
       ngx_null_command
 };
 
@@ -113,7 +176,7 @@ ngx_module_t  ngx_http_upstream_keepalive_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_keepalive_init_process, /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -136,10 +199,27 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     kcf = ngx_http_conf_upstream_srv_conf(us,
                                           ngx_http_upstream_keepalive_module);
 
+    ngx_conf_init_msec_value(kcf->timeout, 60000);
+    ngx_conf_init_uint_value(kcf->prewarm, 0);
+    ngx_conf_init_value(kcf->adaptive, 0);
+
+    if (kcf->prewarm > kcf->max_cached) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "\"keepalive_prewarm\" %ui is reduced to "
+                           "\"keepalive\" %ui", kcf->prewarm, kcf->max_cached);
+        kcf->prewarm = kcf->max_cached;
+    }
+
     if (kcf->original_init_upstream(cf, us) != NGX_OK) {
         return NGX_ERROR;
     }
 
+    /* the balancers of the tree all keep their peers in round robin data */
+
+    if (kcf->prewarm) {
+        kcf->peers = us->peer.data;
+    }
+
     kcf->original_init_peer = us->peer.init;
 
     us->peer.init = ngx_http_upstream_init_keepalive_peer;
@@ -187,6 +267,8 @@ ngx_http_upstream_init_keepalive_peer(ngx_http_request_t *r,
     }
 
     kp->conf = kcf;
+    kp->failed = 0;
+    kp->busy = 0;
     kp->upstream = r->upstream;
     kp->data = r->upstream->peer.data;
     kp->original_get_peer = r->upstream->peer.get;
@@ -230,6 +312,15 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
         return rc;
     }
 
+    if (!kp->busy) {
+        kp->busy = 1;
+        kp->conf->busy++;
+
+        if (kp->conf->peak < kp->conf->busy) {
+            kp->conf->peak = kp->conf->busy;
+        }
+    }
+
     /* search cache for suitable connection */
 
     cache = &kp->conf->cache;
@@ -248,9 +339,15 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
             ngx_queue_remove(q);
             ngx_queue_insert_head(&kp->conf->free, q);
 
+            kp->conf->cached--;
+
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                            "get keepalive peer: using connection %p", c);
 
+            if (c->read->timer_set) {
+                ngx_del_timer(c->read);
+            }
+
             c->idle = 0;
             c->log = pc->log;
             c->read->log = pc->log;
@@ -273,9 +370,7 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_uint_t state)
 {
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
-    ngx_http_upstream_keepalive_cache_t      *item;
 
-    ngx_queue_t          *q;
     ngx_connection_t     *c;
     ngx_http_upstream_t  *u;
 
@@ -288,6 +383,11 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         kp->failed = 1;
     }
 
+    if (kp->busy) {
+        kp->busy = 0;
+        kp->conf->busy--;
+    }
+
     /* cache valid connections */
 
     u = kp->upstream;
@@ -315,9 +415,26 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free keepalive peer: saving connection %p", c);
 
-    if (ngx_queue_empty(&kp->conf->free)) {
+    pc->connection = NULL;
+
+    ngx_http_upstream_keepalive_save(kp->conf, c, pc->sockaddr, pc->socklen);
+
+invalid:
+
+    kp->original_free_peer(pc, kp->data, state);
+}
+
+
+static void
+ngx_http_upstream_keepalive_save(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_connection_t *c, struct sockaddr *sockaddr, socklen_t socklen)
+{
+    ngx_queue_t                          *q;
+    ngx_http_upstream_keepalive_cache_t  *item;
+
+    if (ngx_queue_empty(&kcf->free)) {
 
-        q = ngx_queue_last(&kp->conf->cache);
+        q = ngx_queue_last(&kcf->cache);
         ngx_queue_remove(q);
 
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
@@ -325,16 +442,16 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         ngx_http_upstream_keepalive_close(item->connection);
 
     } else {
-        q = ngx_queue_head(&kp->conf->free);
+        q = ngx_queue_head(&kcf->free);
         ngx_queue_remove(q);
 
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+        kcf->cached++;
     }
 
     item->connection = c;
-    ngx_queue_insert_head(&kp->conf->cache, q);
-
-    pc->connection = NULL;
+    ngx_queue_insert_head(&kcf->cache, q);
 
     if (c->read->timer_set) {
         ngx_del_timer(c->read);
@@ -353,16 +470,16 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     c->write->log = ngx_cycle->log;
     c->pool->log = ngx_cycle->log;
 
-    item->socklen = pc->socklen;
-    ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
+    item->socklen = socklen;
+    ngx_memcpy(&item->sockaddr, sockaddr, socklen);
+
+    /* an idle connection is closed after keepalive_timeout */
+
+    ngx_add_timer(c->read, kcf->timeout);
 
     if (c->read->ready) {
         ngx_http_upstream_keepalive_close_handler(c->read);
     }
-
-invalid:
-
-    kp->original_free_peer(pc, kp->data, state);
 }
 
 
@@ -389,7 +506,7 @@ ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
 
     c = ev->data;
 
-    if (c->close) {
+    if (c->close || ev->timedout) {
         goto close;
     }
 
@@ -414,6 +531,8 @@ close:
 
     ngx_queue_remove(&item->queue);
     ngx_queue_insert_head(&conf->free, &item->queue);
+
+    conf->cached--;
 }
 
 
@@ -440,6 +559,275 @@ ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 }
 
 
+/*
+ * every worker runs a tick per upstream that prunes the idle connections
+ * beyond the recent demand and connects ahead to keep "keepalive_prewarm"
+ * connections ready, so a worker that was quiet does not have to pay for
+ * the connects when requests arrive
+ */
+
+static ngx_int_t
+ngx_http_upstream_keepalive_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                               i;
+    ngx_http_upstream_srv_conf_t           **uscfp;
+    ngx_http_upstream_main_conf_t           *umcf;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                           ngx_http_upstream_keepalive_module);
+
+        if (kcf->original_init_upstream == NULL
+            || (kcf->prewarm == 0 && !kcf->adaptive))
+        {
+            continue;
+        }
+
+        kcf->window = ngx_current_msec;
+
+        kcf->event.handler = ngx_http_upstream_keepalive_tick;
+        kcf->event.data = kcf;
+        kcf->event.log = cycle->log;
+
+        ngx_add_timer(&kcf->event, 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_keepalive_tick(ngx_event_t *ev)
+{
+    ngx_uint_t                               target;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    kcf = ev->data;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    if (kcf->adaptive) {
+
+        /*
+         * the idle connections are kept for the peak of the requests
+         * in flight over the last two windows
+         */
+
+        if (ngx_current_msec - kcf->window >= kcf->timeout) {
+            kcf->last_peak = kcf->peak;
+            kcf->peak = kcf->busy;
+            kcf->window = ngx_current_msec;
+        }
+
+        target = ngx_max(kcf->peak, kcf->last_peak);
+        target = ngx_max(target, kcf->prewarm);
+
+        ngx_http_upstream_keepalive_prune(kcf, target);
+    }
+
+    ngx_http_upstream_keepalive_warm(kcf);
+
+    ngx_add_timer(ev, NGX_HTTP_UPSTREAM_KEEPALIVE_TICK);
+}
+
+
+static void
+ngx_http_upstream_keepalive_prune(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_uint_t target)
+{
+    ngx_queue_t                          *q;
+    ngx_http_upstream_keepalive_cache_t  *item;
+
+    while (kcf->cached > target) {
+
+        q = ngx_queue_last(&kcf->cache);
+        ngx_queue_remove(q);
+        ngx_queue_insert_head(&kcf->free, q);
+
+        kcf->cached--;
+
+        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "keepalive prune connection %p", item->connection);
+
+        ngx_http_upstream_keepalive_close(item->connection);
+    }
+}
+
+
+static void
+ngx_http_upstream_keepalive_warm(ngx_http_upstream_keepalive_srv_conf_t *kcf)
+{
+    time_t                         now;
+    ngx_uint_t                     n;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = kcf->peers;
+
+    if (peers == NULL) {
+        return;
+    }
+
+    now = ngx_time();
+
+    for (n = 0;
+         kcf->cached + kcf->warming < kcf->prewarm
+         && n < kcf->prewarm + peers->number;
+         n++)
+    {
+        peer = &peers->peer[kcf->next_peer++ % peers->number];
+
+        if (ngx_http_upstream_rr_peer_down(peer)) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        (void) ngx_http_upstream_keepalive_connect(kcf, peer);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_connect(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_int_t                            rc;
+    ngx_connection_t                    *c;
+    ngx_peer_connection_t                pc;
+    ngx_http_upstream_keepalive_warm_t  *w;
+
+    ngx_memzero(&pc, sizeof(ngx_peer_connection_t));
+
+    pc.sockaddr = peer->sockaddr;
+    pc.socklen = peer->socklen;
+    pc.name = &peer->name;
+    pc.get = ngx_event_get_peer;
+    pc.log = ngx_cycle->log;
+    pc.log_error = NGX_ERROR_ERR;
+    pc.tries = 1;
+
+    rc = ngx_event_connect_peer(&pc);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "keepalive prewarm connect to %V: %i", &peer->name, rc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        return NGX_ERROR;
+    }
+
+    c = pc.connection;
+
+    c->pool = ngx_create_pool(128, ngx_cycle->log);
+    if (c->pool == NULL) {
+        ngx_close_connection(c);
+        return NGX_ERROR;
+    }
+
+    w = ngx_palloc(c->pool, sizeof(ngx_http_upstream_keepalive_warm_t));
+    if (w == NULL) {
+        ngx_http_upstream_keepalive_close(c);
+        return NGX_ERROR;
+    }
+
+    w->conf = kcf;
+    w->peer = peer;
+
+    c->data = w;
+    c->read->handler = ngx_http_upstream_keepalive_connect_handler;
+    c->write->handler = ngx_http_upstream_keepalive_connect_handler;
+
+    kcf->warming++;
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, kcf->timeout);
+        return NGX_OK;
+    }
+
+    ngx_http_upstream_keepalive_connect_handler(c->write);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_keepalive_connect_handler(ngx_event_t *ev)
+{
+    int                                  err;
+    socklen_t                            len;
+    ngx_connection_t                    *c;
+    ngx_http_upstream_keepalive_warm_t  *w;
+
+    c = ev->data;
+    w = c->data;
+
+    w->conf->warming--;
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "keepalive prewarm connect to %V timed out",
+                      &w->peer->name);
+        goto failed;
+    }
+
+    err = 0;
+    len = sizeof(int);
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == -1) {
+        err = ngx_socket_errno;
+    }
+
+    if (err) {
+        (void) ngx_connection_error(c, err, "connect() failed");
+        goto failed;
+    }
+
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK
+        || ngx_handle_read_event(c->read, 0) != NGX_OK)
+    {
+        goto failed;
+    }
+
+    ngx_http_upstream_keepalive_save(w->conf, c, w->peer->sockaddr,
+                                     w->peer->socklen);
+
+    return;
+
+failed:
+
+    ngx_http_upstream_keepalive_close(c);
+}
+
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t
@@ -479,9 +867,15 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
      *
      *     conf->original_init_upstream = NULL;
      *     conf->original_init_peer = NULL;
+     *     conf->cached = 0;
+     *     conf->busy = 0;
+     *     conf->peers = NULL;
      */
 
     conf->max_cached = 1;
+    conf->timeout = NGX_CONF_UNSET_MSEC;
+    conf->prewarm = NGX_CONF_UNSET_UINT;
+    conf->adaptive = NGX_CONF_UNSET;
 
     return conf;
 }
@@ -199,7 +199,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
         peer = &peers->peer[i];
 
-        if (peer->down) {
+        if (ngx_http_upstream_rr_peer_down(peer)) {
             continue;
         }
 
@@ -252,7 +252,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
             peer = &peers->peer[i];
 
-            if (peer->down) {
+            if (ngx_http_upstream_rr_peer_down(peer)) {
                 continue;
             }
 
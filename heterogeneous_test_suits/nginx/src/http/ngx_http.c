@@ -37,6 +37,12 @@ static ngx_int_t ngx_http_init_locations(ngx_conf_t *cf,
     ngx_http_core_srv_conf_t *cscf, ngx_http_core_loc_conf_t *pclcf);
 static ngx_int_t ngx_http_init_static_location_trees(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *pclcf);
+#if (NGX_PCRE)
+static ngx_int_t ngx_http_init_regex_location_set(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t *pclcf);
+static ngx_uint_t ngx_http_regex_set_safe(ngx_regex_t *re,
+    ngx_str_t *pattern);
+#endif
 static ngx_int_t ngx_http_cmp_locations(const ngx_queue_t *one,
     const ngx_queue_t *two);
 static ngx_int_t ngx_http_join_exact_locations(ngx_conf_t *cf,
@@ -51,6 +57,14 @@ static ngx_int_t ngx_http_optimize_servers(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf, ngx_array_t *ports);
 static ngx_int_t ngx_http_server_names(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf, ngx_http_conf_addr_t *addr);
+#if (NGX_PCRE)
+static ngx_int_t ngx_http_init_regex_server_sets(ngx_conf_t *cf,
+    ngx_http_conf_addr_t *addr);
+static ngx_int_t ngx_http_init_regex_server_set(ngx_conf_t *cf,
+    ngx_http_conf_addr_t *addr, ngx_http_server_name_set_t *set, size_t len);
+static ngx_int_t ngx_http_init_virtual_names_regex(ngx_conf_t *cf,
+    ngx_http_virtual_names_t *vn, ngx_http_conf_addr_t *addr);
+#endif
 static ngx_int_t ngx_http_cmp_conf_addrs(const void *one, const void *two);
 static int ngx_libc_cdecl ngx_http_cmp_dns_wildcards(const void *one,
     const void *two);
@@ -477,6 +491,16 @@ ngx_http_init_phase_handlers(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf)
     for (i = 0; i < NGX_HTTP_LOG_PHASE; i++) {
         h = cmcf->phases[i].handlers.elts;
 
+        if (i == NGX_HTTP_PREACCESS_PHASE) {
+            cmcf->phase_engine.access_index =
+                                          ph - cmcf->phase_engine.handlers;
+        }
+
+        if (i == NGX_HTTP_TRY_FILES_PHASE) {
+            cmcf->phase_engine.content_index =
+                                          ph - cmcf->phase_engine.handlers;
+        }
+
         switch (i) {
 
         case NGX_HTTP_SERVER_REWRITE_PHASE:
@@ -787,6 +811,10 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         *clcfp = NULL;
 
         ngx_queue_split(locations, regex, &tail);
+
+        if (r > 1 && ngx_http_init_regex_location_set(cf, pclcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
     }
 
 #endif
@@ -795,6 +823,182 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 }
 
 
+#if (NGX_PCRE)
+
+/*
+ * the regex locations are also compiled into a single alternation,
+ * so a URI that matches none of them costs one regex execution;
+ * the patterns that cannot be safely combined leave the locations
+ * tested one by one
+ */
+
+static ngx_int_t
+ngx_http_init_regex_location_set(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t *pclcf)
+{
+    u_char                     *p;
+    size_t                      len;
+    unsigned long               options;
+    ngx_regex_compile_t         rc;
+    ngx_http_core_loc_conf_t  **clcfp;
+    u_char                      errstr[NGX_MAX_CONF_ERRSTR];
+
+    len = 0;
+
+    for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
+
+        if (!ngx_http_regex_set_safe((*clcfp)->regex->regex,
+                                     &(*clcfp)->name))
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                           "regex location \"%V\" prevents the set",
+                           &(*clcfp)->name);
+            return NGX_OK;
+        }
+
+        len += sizeof("|(?i:)") - 1 + (*clcfp)->name.len;
+    }
+
+    p = ngx_pnalloc(cf->pool, len + 1);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern.data = p;
+
+    for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
+
+        if (pcre_fullinfo((*clcfp)->regex->regex->code, NULL,
+                          PCRE_INFO_OPTIONS, &options)
+            != 0)
+        {
+            return NGX_OK;
+        }
+
+        if (clcfp != pclcf->regex_locations) {
+            *p++ = '|';
+        }
+
+        p = ngx_sprintf(p, "%s%V)", (options & PCRE_CASELESS) ? "(?i:" : "(?:",
+                        &(*clcfp)->name);
+    }
+
+    *p = '\0';
+
+    rc.pattern.len = p - rc.pattern.data;
+    rc.pool = cf->pool;
+    rc.options = PCRE_DUPNAMES;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    if (ngx_regex_compile(&rc) != NGX_OK) {
+        ngx_log_error(NGX_LOG_INFO, cf->log, 0,
+                      "regex locations are tested one by one: %V", &rc.err);
+        return NGX_OK;
+    }
+
+    pclcf->regex_set = rc.regex;
+
+    return NGX_OK;
+}
+
+
+/*
+ * the patterns that cannot be safely combined into an alternation refer
+ * to groups by number or use backtracking control verbs
+ */
+
+static ngx_uint_t
+ngx_http_regex_set_safe(ngx_regex_t *re, ngx_str_t *pattern)
+{
+    int     backrefs;
+    u_char  c, *p, *last;
+
+    if (pcre_fullinfo(re->code, NULL, PCRE_INFO_BACKREFMAX, &backrefs) != 0
+        || backrefs)
+    {
+        return 0;
+    }
+
+    last = pattern->data + pattern->len;
+
+    for (p = pattern->data; p + 1 < last; p++) {
+
+        if (*p == '\\') {
+
+            /* \g and \k back references, \Q without \E */
+
+            p++;
+
+            if (*p == 'g' || *p == 'k' || *p == 'Q') {
+                return 0;
+            }
+
+            continue;
+        }
+
+        if (*p != '(') {
+            continue;
+        }
+
+        /* (*COMMIT) and the like would affect the other alternatives */
+
+        if (p[1] == '*') {
+            return 0;
+        }
+
+        if (p[1] != '?') {
+            continue;
+        }
+
+        p += 2;
+
+        if (p == last) {
+            return 0;
+        }
+
+        switch (*p) {
+
+        /* recursion and subroutine calls by number or name */
+
+        case 'R': case '&': case '+': case '-':
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            return 0;
+
+        case 'P':
+            if (p + 1 < last && (p[1] == '>' || p[1] == '=')) {
+                return 0;
+            }
+
+            break;
+        }
+
+        /* the "x" option would make "#" comment out the rest */
+
+        for ( /* void */ ; p < last; p++) {
+            c = (u_char) (*p | 0x20);
+
+            if (c < 'a' || c > 'z') {
+                break;
+            }
+
+            if (*p == 'x') {
+                return 0;
+            }
+        }
+
+        p--;
+    }
+
+    return 1;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_init_static_location_trees(ngx_conf_t *cf,
     ngx_http_core_loc_conf_t *pclcf)
@@ -1225,6 +1429,9 @@ ngx_http_add_addresses(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 #if (NGX_HTTP_SSL)
     ngx_uint_t             ssl;
 #endif
+#if (NGX_HTTP_V2)
+    ngx_uint_t             http2;
+#endif
 
     /*
      * we cannot compare whole sockaddr struct's as kernel
@@ -1277,6 +1484,9 @@ ngx_http_add_addresses(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 #if (NGX_HTTP_SSL)
         ssl = lsopt->ssl || addr[i].opt.ssl;
 #endif
+#if (NGX_HTTP_V2)
+        http2 = lsopt->http2 || addr[i].opt.http2;
+#endif
 
         if (lsopt->set) {
 
@@ -1307,6 +1517,9 @@ ngx_http_add_addresses(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 #if (NGX_HTTP_SSL)
         addr[i].opt.ssl = ssl;
 #endif
+#if (NGX_HTTP_V2)
+        addr[i].opt.http2 = http2;
+#endif
 
         return NGX_OK;
     }
@@ -1350,6 +1563,9 @@ ngx_http_add_address(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 #if (NGX_PCRE)
     addr->nregex = 0;
     addr->regex = NULL;
+    addr->sets.elts = NULL;
+    addr->sets.nelts = 0;
+    addr->ncaptures = 0;
 #endif
     addr->default_server = cscf;
     addr->servers.elts = NULL;
@@ -1588,10 +1804,14 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
         }
     }
 
-#endif
+    return ngx_http_init_regex_server_sets(cf, addr);
+
+#else
 
     return NGX_OK;
 
+#endif
+
 failed:
 
     ngx_destroy_pool(ha.temp_pool);
@@ -1600,6 +1820,181 @@ failed:
 }
 
 
+#if (NGX_PCRE)
+
+/*
+ * The regex server names are compiled into sets of alternations with
+ * each name wrapped in a group, so the highest group a match sets tells
+ * the name matched.  The alternation is anchored and the unanchored names
+ * are prefixed with ".*?", so the first name in the configuration order
+ * wins, as it did when the names were tested one by one.  The names that
+ * cannot be safely combined are tested one by one, and a set is limited
+ * in length as PCRE limits the size of a compiled pattern.
+ */
+
+#define NGX_HTTP_REGEX_SERVER_SET_LEN  4096
+
+
+static ngx_int_t
+ngx_http_init_regex_server_sets(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
+{
+    size_t                       len, size;
+    ngx_uint_t                   i, safe, combine;
+    ngx_http_server_name_t      *sn;
+    ngx_http_server_name_set_t  *set;
+
+    if (ngx_array_init(&addr->sets, cf->pool, 4,
+                       sizeof(ngx_http_server_name_set_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    sn = addr->regex;
+    set = NULL;
+    combine = 0;
+    len = 0;
+
+    for (i = 0; i < addr->nregex; i++) {
+
+        safe = ngx_http_regex_set_safe(sn[i].regex->regex, &sn[i].name);
+        size = sizeof("|(.*?(?i:))") - 1 + sn[i].name.len;
+
+        if (!safe) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                           "regex server name \"%V\" is tested alone",
+                           &sn[i].name);
+        }
+
+        if (set
+            && (safe != combine
+                || (combine && len + size > NGX_HTTP_REGEX_SERVER_SET_LEN)))
+        {
+            if (combine
+                && ngx_http_init_regex_server_set(cf, addr, set, len)
+                   != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            set = NULL;
+        }
+
+        if (set == NULL) {
+            set = ngx_array_push(&addr->sets);
+            if (set == NULL) {
+                return NGX_ERROR;
+            }
+
+            set->regex = NULL;
+            set->first = i;
+            set->groups = NULL;
+
+            combine = safe;
+            len = 0;
+        }
+
+        set->last = i + 1;
+        len += size;
+    }
+
+    if (combine) {
+        return ngx_http_init_regex_server_set(cf, addr, set, len);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_init_regex_server_set(ngx_conf_t *cf, ngx_http_conf_addr_t *addr,
+    ngx_http_server_name_set_t *set, size_t len)
+{
+    int                      captures;
+    u_char                  *p;
+    ngx_uint_t               i, group;
+    unsigned long            options;
+    ngx_regex_compile_t      rc;
+    ngx_http_server_name_t  *sn;
+    u_char                   errstr[NGX_MAX_CONF_ERRSTR];
+
+    if (set->last - set->first < 2) {
+        return NGX_OK;
+    }
+
+    set->groups = ngx_palloc(cf->pool,
+                             (set->last - set->first) * sizeof(ngx_uint_t));
+    if (set->groups == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_pnalloc(cf->pool, sizeof("^(?:)") + len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern.data = p;
+
+    p = ngx_cpymem(p, "^(?:", sizeof("^(?:") - 1);
+
+    sn = addr->regex;
+    group = 1;
+
+    for (i = set->first; i < set->last; i++) {
+
+        if (pcre_fullinfo(sn[i].regex->regex->code, NULL,
+                          PCRE_INFO_OPTIONS, &options)
+            != 0
+            || pcre_fullinfo(sn[i].regex->regex->code, NULL,
+                             PCRE_INFO_CAPTURECOUNT, &captures)
+               != 0)
+        {
+            return NGX_OK;
+        }
+
+        if (i != set->first) {
+            *p++ = '|';
+        }
+
+        p = ngx_sprintf(p, "(%s%s%V))",
+                        (options & PCRE_ANCHORED) ? "" : ".*?",
+                        (options & PCRE_CASELESS) ? "(?i:" : "(?:",
+                        &sn[i].name);
+
+        set->groups[i - set->first] = group;
+        group += 1 + captures;
+    }
+
+    *p++ = ')';
+    *p = '\0';
+
+    rc.pattern.len = p - rc.pattern.data;
+    rc.pool = cf->pool;
+    rc.options = PCRE_DUPNAMES;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    if (ngx_regex_compile(&rc) != NGX_OK) {
+        ngx_log_error(NGX_LOG_INFO, cf->log, 0,
+                      "regex server names from \"%V\" are tested one by one: "
+                      "%V", &sn[set->first].name, &rc.err);
+        return NGX_OK;
+    }
+
+    set->regex = rc.regex;
+
+    if (addr->ncaptures < group * 3) {
+        addr->ncaptures = group * 3;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_cmp_conf_addrs(const void *one, const void *two)
 {
@@ -1717,6 +2112,10 @@ ngx_http_init_listening(ngx_conf_t *cf, ngx_http_conf_port_t *port)
             break;
         }
 
+        if (ngx_clone_listening(cf, ls) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
         addr++;
         last--;
     }
@@ -1791,6 +2190,10 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
     ls->setfib = addr->opt.setfib;
 #endif
 
+#if (NGX_HAVE_REUSEPORT)
+    ls->reuseport = addr->opt.reuseport;
+#endif
+
     return ls;
 }
 
@@ -1820,6 +2223,9 @@ ngx_http_add_addrs(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_HTTP_SSL)
         addrs[i].conf.ssl = addr[i].opt.ssl;
 #endif
+#if (NGX_HTTP_V2)
+        addrs[i].conf.http2 = addr[i].opt.http2;
+#endif
 
         if (addr[i].hash.buckets == NULL
             && (addr[i].wc_head == NULL
@@ -1847,6 +2253,10 @@ ngx_http_add_addrs(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_PCRE)
         vn->nregex = addr[i].nregex;
         vn->regex = addr[i].regex;
+
+        if (ngx_http_init_virtual_names_regex(cf, vn, &addr[i]) != NGX_OK) {
+            return NGX_ERROR;
+        }
 #endif
     }
 
@@ -1854,6 +2264,46 @@ ngx_http_add_addrs(ngx_conf_t *cf, ngx_http_port_t *hport,
 }
 
 
+#if (NGX_PCRE)
+
+/*
+ * the cache of the hosts looked up by the regex names is allocated
+ * at configuration, so every worker process gets its own copy
+ */
+
+static ngx_int_t
+ngx_http_init_virtual_names_regex(ngx_conf_t *cf, ngx_http_virtual_names_t *vn,
+    ngx_http_conf_addr_t *addr)
+{
+    vn->nsets = addr->sets.nelts;
+    vn->sets = addr->sets.elts;
+    vn->ncaptures = addr->ncaptures;
+    vn->captures = NULL;
+    vn->cache = NULL;
+
+    if (addr->nregex == 0) {
+        return NGX_OK;
+    }
+
+    if (vn->ncaptures) {
+        vn->captures = ngx_palloc(cf->pool, vn->ncaptures * sizeof(int));
+        if (vn->captures == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    vn->cache = ngx_pcalloc(cf->pool, NGX_HTTP_SERVER_NAME_CACHE_SIZE
+                                      * sizeof(ngx_http_server_name_cache_t));
+    if (vn->cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 #if (NGX_HAVE_INET6)
 
 static ngx_int_t
@@ -1881,6 +2331,9 @@ ngx_http_add_addrs6(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_HTTP_SSL)
         addrs6[i].conf.ssl = addr[i].opt.ssl;
 #endif
+#if (NGX_HTTP_V2)
+        addrs6[i].conf.http2 = addr[i].opt.http2;
+#endif
 
         if (addr[i].hash.buckets == NULL
             && (addr[i].wc_head == NULL
@@ -1908,6 +2361,10 @@ ngx_http_add_addrs6(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_PCRE)
         vn->nregex = addr[i].nregex;
         vn->regex = addr[i].regex;
+
+        if (ngx_http_init_virtual_names_regex(cf, vn, &addr[i]) != NGX_OK) {
+            return NGX_ERROR;
+        }
 #endif
     }
 
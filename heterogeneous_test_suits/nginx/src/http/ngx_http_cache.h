@@ -45,7 +45,8 @@ typedef struct {
     unsigned                         exists:1;
     unsigned                         updating:1;
     unsigned                         deleting:1;
-                                     /* 11 unused bits */
+    unsigned                         referenced:1;
+                                     /* 10 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
@@ -55,6 +56,22 @@ typedef struct {
 } ngx_http_file_cache_node_t;
 
 
+/*
+ * a response being fetched into the cache by a request of the worker,
+ * the node and key go first as in ngx_http_file_cache_node_t
+ */
+
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_queue_t                      waiters;
+
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN
+                                         - sizeof(ngx_rbtree_key_t)];
+
+    ngx_temp_file_t                 *temp_file;
+} ngx_http_file_cache_fill_t;
+
+
 struct ngx_http_cache_s {
     ngx_file_t                       file;
     ngx_array_t                      keys;
@@ -85,8 +102,15 @@ struct ngx_http_cache_s {
 
     ngx_event_t                      wait_event;
 
+    ngx_http_file_cache_fill_t      *fill;
+    ngx_queue_t                      queue;
+    off_t                            sent;
+
     unsigned                         lock:1;
     unsigned                         waiting:1;
+    unsigned                         filling:1;
+    unsigned                         streaming:1;
+    unsigned                         filled:1;
 
     unsigned                         updated:1;
     unsigned                         updating:1;
@@ -110,9 +134,19 @@ typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
     ngx_queue_t                      queue;
+    ngx_slab_pool_t                 *shpool;
+    ngx_atomic_t                     locks;
+    ngx_atomic_t                     contended;
+    ngx_atomic_t                     reported;
+} ngx_http_file_cache_part_t;
+
+
+typedef struct {
+    ngx_http_file_cache_part_t      *parts;
+    ngx_uint_t                       nparts;
     ngx_atomic_t                     cold;
     ngx_atomic_t                     loading;
-    off_t                            size;
+    ngx_atomic_t                     size;
 } ngx_http_file_cache_sh_t;
 
 
@@ -127,6 +161,9 @@ struct ngx_http_file_cache_s {
 
     time_t                           inactive;
 
+    ngx_uint_t                       partitions;
+    ngx_uint_t                       next_part;
+
     ngx_uint_t                       files;
     ngx_uint_t                       loader_files;
     ngx_msec_t                       last;
@@ -134,6 +171,10 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       loader_threshold;
 
     ngx_shm_zone_t                  *shm_zone;
+
+    /* the responses being fetched by the worker */
+    ngx_rbtree_t                     fills;
+    ngx_rbtree_node_t                fills_sentinel;
 };
 
 
@@ -141,6 +182,8 @@ ngx_int_t ngx_http_file_cache_new(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_create(ngx_http_request_t *r);
 void ngx_http_file_cache_create_key(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
+ngx_int_t ngx_http_file_cache_relock(ngx_http_request_t *r);
+void ngx_http_file_cache_fill(ngx_http_request_t *r, ngx_temp_file_t *tf);
 void ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
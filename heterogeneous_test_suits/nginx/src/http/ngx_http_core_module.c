@@ -56,6 +56,10 @@ static char *ngx_http_core_limit_except(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_directio(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (NGX_HAVE_FILE_AIO || NGX_HAVE_PTHREAD)
+static char *ngx_http_core_set_aio(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#endif
 static char *ngx_http_core_error_page(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_try_files(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -70,8 +74,10 @@ static char *ngx_http_core_internal(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_resolver(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_core_request_timing(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 #if (NGX_HTTP_GZIP)
-static ngx_int_t ngx_http_gzip_accept_encoding(ngx_str_t *ae);
+static ngx_int_t ngx_http_accept_encoding(ngx_str_t *ae, ngx_str_t *encoding);
 static ngx_uint_t ngx_http_gzip_quantity(u_char *p, u_char *last);
 static char *ngx_http_gzip_disable(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -111,20 +117,6 @@ static ngx_conf_enum_t  ngx_http_core_request_body_in_file[] = {
 };
 
 
-#if (NGX_HAVE_FILE_AIO)
-
-static ngx_conf_enum_t  ngx_http_core_aio[] = {
-    { ngx_string("off"), NGX_HTTP_AIO_OFF  },
-    { ngx_string("on"), NGX_HTTP_AIO_ON },
-#if (NGX_HAVE_AIO_SENDFILE)
-    { ngx_string("sendfile"), NGX_HTTP_AIO_SENDFILE },
-#endif
-    { ngx_null_string, 0 }
-};
-
-#endif
-
-
 static ngx_conf_enum_t  ngx_http_core_satisfy[] = {
     { ngx_string("all"), NGX_HTTP_SATISFY_ALL },
     { ngx_string("any"), NGX_HTTP_SATISFY_ANY },
@@ -221,6 +213,13 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_main_conf_t, server_names_hash_bucket_size),
       NULL },
 
+    { ngx_string("request_timing"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_core_request_timing,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("server"),
       NGX_HTTP_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_NOARGS,
       ngx_http_core_server,
@@ -420,14 +419,25 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, sendfile_max_chunk),
       NULL },
 
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_HAVE_PTHREAD)
 
     { ngx_string("aio"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
-      ngx_conf_set_enum_slot,
+      ngx_http_core_set_aio,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+#endif
+
+#if (NGX_HAVE_PTHREAD)
+
+    { ngx_string("aio_write"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_core_loc_conf_t, aio),
-      &ngx_http_core_aio },
+      offsetof(ngx_http_core_loc_conf_t, aio_write),
+      NULL },
 
 #endif
 
@@ -873,17 +883,48 @@ void
 ngx_http_core_run_phases(ngx_http_request_t *r)
 {
     ngx_int_t                   rc;
+    ngx_uint_t                  timer;
+    ngx_usec_t                  start, total;
+    ngx_http_timing_t          *t;
     ngx_http_phase_handler_t   *ph;
     ngx_http_core_main_conf_t  *cmcf;
 
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
 
     ph = cmcf->phase_engine.handlers;
+    t = r->main->timing;
 
     while (ph[r->phase_handler].checker) {
 
+        if (t == NULL) {
+            rc = ph[r->phase_handler].checker(r, &ph[r->phase_handler]);
+
+            if (rc == NGX_OK) {
+                return;
+            }
+
+            continue;
+        }
+
+        if ((ngx_uint_t) r->phase_handler < cmcf->phase_engine.access_index) {
+            timer = NGX_HTTP_TIMING_REWRITE;
+
+        } else if ((ngx_uint_t) r->phase_handler
+                   < cmcf->phase_engine.content_index)
+        {
+            timer = NGX_HTTP_TIMING_ACCESS;
+
+        } else {
+            timer = NGX_HTTP_TIMING_CONTENT;
+        }
+
+        start = ngx_time_usec();
+        total = t->total;
+
         rc = ph[r->phase_handler].checker(r, &ph[r->phase_handler]);
 
+        ngx_http_timing_add(t, timer, start, total);
+
         if (rc == NGX_OK) {
             return;
         }
@@ -891,6 +932,32 @@ ngx_http_core_run_phases(ngx_http_request_t *r)
 }
 
 
+/*
+ * adds the time since "start" to a timer, less the time that the timers
+ * nested in it have added to the total since then
+ */
+
+void
+ngx_http_timing_add(ngx_http_timing_t *t, ngx_uint_t timer, ngx_usec_t start,
+    ngx_usec_t total)
+{
+    ngx_usec_t  now, usec;
+
+    now = ngx_time_usec();
+    total = t->total - total;
+
+    if (now < start + total) {
+        /* the wall clock was stepped back */
+        return;
+    }
+
+    usec = now - start - total;
+
+    t->usec[timer] += usec;
+    t->total += usec;
+}
+
+
 ngx_int_t
 ngx_http_core_generic_phase(ngx_http_request_t *r, ngx_http_phase_handler_t *ph)
 {
@@ -1578,6 +1645,26 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
     if (noregex == 0 && pclcf->regex_locations) {
 
+        if (pclcf->regex_set) {
+
+            /* one pass over the URI rejects all regex locations */
+
+            n = ngx_regex_exec(pclcf->regex_set, &r->uri, NULL, 0);
+
+            if (n == NGX_REGEX_NO_MATCHED) {
+                ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                               "test locations: no regex match");
+                return rc;
+            }
+
+            if (n < 0) {
+                ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                              ngx_regex_exec_n " failed: %i on \"%V\" "
+                              "using regex locations", n, &r->uri);
+                return NGX_ERROR;
+            }
+        }
+
         for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
 
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -1933,27 +2020,58 @@ ngx_http_send_response(ngx_http_request_t *r, ngx_uint_t status,
 ngx_int_t
 ngx_http_send_header(ngx_http_request_t *r)
 {
+    ngx_int_t           rc;
+    ngx_usec_t          start, total;
+    ngx_http_timing_t  *t;
+
     if (r->err_status) {
         r->headers_out.status = r->err_status;
         r->headers_out.status_line.len = 0;
     }
 
-    return ngx_http_top_header_filter(r);
+    t = r->main->timing;
+
+    if (t == NULL) {
+        return ngx_http_top_header_filter(r);
+    }
+
+    start = ngx_time_usec();
+    total = t->total;
+
+    rc = ngx_http_top_header_filter(r);
+
+    ngx_http_timing_add(t, NGX_HTTP_TIMING_FILTER, start, total);
+
+    return rc;
 }
 
 
 ngx_int_t
 ngx_http_output_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
-    ngx_int_t          rc;
-    ngx_connection_t  *c;
+    ngx_int_t           rc;
+    ngx_usec_t          start, total;
+    ngx_connection_t   *c;
+    ngx_http_timing_t  *t;
 
     c = r->connection;
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http output filter \"%V?%V\"", &r->uri, &r->args);
 
-    rc = ngx_http_top_body_filter(r, in);
+    t = r->main->timing;
+
+    if (t == NULL) {
+        rc = ngx_http_top_body_filter(r, in);
+
+    } else {
+        start = ngx_time_usec();
+        total = t->total;
+
+        rc = ngx_http_top_body_filter(r, in);
+
+        ngx_http_timing_add(t, NGX_HTTP_TIMING_FILTER, start, total);
+    }
 
     if (rc == NGX_ERROR) {
         /* NGX_ERROR may be returned by any filter */
@@ -2117,6 +2235,30 @@ ngx_http_auth_basic_user(ngx_http_request_t *r)
 
 ngx_int_t
 ngx_http_gzip_ok(ngx_http_request_t *r)
+{
+    ngx_int_t         rc;
+    static ngx_str_t  gzip = ngx_string("gzip");
+
+    r->gzip_tested = 1;
+
+    rc = ngx_http_encoding_ok(r, &gzip);
+
+    if (rc == NGX_OK) {
+        r->gzip_ok = 1;
+    }
+
+    return rc;
+}
+
+
+/*
+ * the checks are shared by all content codings: a filter for another coding,
+ * e.g. "br", registered after the gzip filter tests its own token here and
+ * sets r->headers_out.content_encoding, so the gzip filter skips the response
+ */
+
+ngx_int_t
+ngx_http_encoding_ok(ngx_http_request_t *r, ngx_str_t *encoding)
 {
     time_t                     date, expires;
     ngx_uint_t                 p;
@@ -2124,8 +2266,6 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
     ngx_table_elt_t           *e, *d, *ae;
     ngx_http_core_loc_conf_t  *clcf;
 
-    r->gzip_tested = 1;
-
     if (r != r->main) {
         return NGX_DECLINED;
     }
@@ -2135,7 +2275,7 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
-    if (ae->value.len < sizeof("gzip") - 1) {
+    if (ae->value.len < encoding->len) {
         return NGX_DECLINED;
     }
 
@@ -2148,8 +2288,11 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
      *   Opera:   "gzip, deflate"
      */
 
-    if (ngx_memcmp(ae->value.data, "gzip,", 5) != 0
-        && ngx_http_gzip_accept_encoding(&ae->value) != NGX_OK)
+    if ((ae->value.len == encoding->len
+         || ae->value.data[encoding->len] != ','
+         || ngx_strncasecmp(ae->value.data, encoding->data, encoding->len)
+            != 0)
+        && ngx_http_accept_encoding(&ae->value, encoding) != NGX_OK)
     {
         return NGX_DECLINED;
     }
@@ -2270,8 +2413,6 @@ ok:
 
 #endif
 
-    r->gzip_ok = 1;
-
     return NGX_OK;
 }
 
@@ -2281,10 +2422,12 @@ ok:
  *     "gzip; q=0.001" ... "gzip; q=1.000"
  * gzip is disabled for the following quantities:
  *     "gzip; q=0" ... "gzip; q=0.000", and for any invalid cases
+ *
+ * the same applies to any other encoding token
  */
 
 static ngx_int_t
-ngx_http_gzip_accept_encoding(ngx_str_t *ae)
+ngx_http_accept_encoding(ngx_str_t *ae, ngx_str_t *encoding)
 {
     u_char  *p, *start, *last;
 
@@ -2292,7 +2435,7 @@ ngx_http_gzip_accept_encoding(ngx_str_t *ae)
     last = start + ae->len;
 
     for ( ;; ) {
-        p = ngx_strcasestrn(start, "gzip", 4 - 1);
+        p = ngx_strcasestrn(start, (char *) encoding->data, encoding->len - 1);
         if (p == NULL) {
             return NGX_DECLINED;
         }
@@ -2301,10 +2444,10 @@ ngx_http_gzip_accept_encoding(ngx_str_t *ae)
             break;
         }
 
-        start = p + 4;
+        start = p + encoding->len;
     }
 
-    p += 4;
+    p += encoding->len;
 
     while (p < last) {
         switch(*p++) {
@@ -3336,6 +3479,8 @@ ngx_http_core_create_main_conf(ngx_conf_t *cf)
     cmcf->variables_hash_max_size = NGX_CONF_UNSET_UINT;
     cmcf->variables_hash_bucket_size = NGX_CONF_UNSET_UINT;
 
+    cmcf->timing = NGX_CONF_UNSET_UINT;
+
     return cmcf;
 }
 
@@ -3372,6 +3517,10 @@ ngx_http_core_init_main_conf(ngx_conf_t *cf, void *conf)
         cmcf->ncaptures = (cmcf->ncaptures + 1) * 3;
     }
 
+    if (cmcf->timing == NGX_CONF_UNSET_UINT) {
+        cmcf->timing = 0;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -3525,8 +3674,12 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     clcf->internal = NGX_CONF_UNSET;
     clcf->sendfile = NGX_CONF_UNSET;
     clcf->sendfile_max_chunk = NGX_CONF_UNSET_SIZE;
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_HAVE_PTHREAD)
     clcf->aio = NGX_CONF_UNSET;
+#endif
+#if (NGX_HAVE_PTHREAD)
+    clcf->aio_write = NGX_CONF_UNSET;
+    clcf->thread_pool = NGX_CONF_UNSET_PTR;
 #endif
     clcf->read_ahead = NGX_CONF_UNSET_SIZE;
     clcf->directio = NGX_CONF_UNSET;
@@ -3744,8 +3897,12 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->sendfile, prev->sendfile, 0);
     ngx_conf_merge_size_value(conf->sendfile_max_chunk,
                               prev->sendfile_max_chunk, 0);
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_HAVE_PTHREAD)
     ngx_conf_merge_value(conf->aio, prev->aio, NGX_HTTP_AIO_OFF);
+#endif
+#if (NGX_HAVE_PTHREAD)
+    ngx_conf_merge_value(conf->aio_write, prev->aio_write, 0);
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
 #endif
     ngx_conf_merge_size_value(conf->read_ahead, prev->read_ahead, 0);
     ngx_conf_merge_off_value(conf->directio, prev->directio,
@@ -4011,6 +4168,19 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[n].data, "reuseport") == 0) {
+#if (NGX_HAVE_REUSEPORT)
+            lsopt.reuseport = 1;
+            lsopt.set = 1;
+            lsopt.bind = 1;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "reuseport is not supported "
+                               "on this platform, ignored");
+#endif
+            continue;
+        }
+
         if (ngx_strcmp(value[n].data, "deferred") == 0) {
 #if (NGX_HAVE_DEFERRED_ACCEPT && defined TCP_DEFER_ACCEPT)
             lsopt.deferred_accept = 1;
@@ -4075,6 +4245,18 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 #endif
         }
 
+        if (ngx_strcmp(value[n].data, "http2") == 0) {
+#if (NGX_HTTP_V2)
+            lsopt.http2 = 1;
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the \"http2\" parameter requires "
+                               "ngx_http_v2_module");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         if (ngx_strncmp(value[n].data, "so_keepalive=", 13) == 0) {
 
             if (ngx_strcmp(&value[n].data[13], "on") == 0) {
@@ -4527,6 +4709,83 @@ ngx_http_core_directio(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+#if (NGX_HAVE_FILE_AIO || NGX_HAVE_PTHREAD)
+
+static char *
+ngx_http_core_set_aio(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t *clcf = conf;
+
+    ngx_str_t  *value;
+#if (NGX_HAVE_PTHREAD)
+    ngx_str_t   name;
+#endif
+
+    if (clcf->aio != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+#if (NGX_HAVE_PTHREAD)
+    clcf->thread_pool = NULL;
+#endif
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        clcf->aio = NGX_HTTP_AIO_OFF;
+        return NGX_CONF_OK;
+    }
+
+#if (NGX_HAVE_FILE_AIO)
+
+    if (ngx_strcmp(value[1].data, "on") == 0) {
+        clcf->aio = NGX_HTTP_AIO_ON;
+        return NGX_CONF_OK;
+    }
+
+#if (NGX_HAVE_AIO_SENDFILE)
+
+    if (ngx_strcmp(value[1].data, "sendfile") == 0) {
+        clcf->aio = NGX_HTTP_AIO_SENDFILE;
+        return NGX_CONF_OK;
+    }
+
+#endif
+#endif
+
+#if (NGX_HAVE_PTHREAD)
+
+    /* "threads" or "threads=pool", the "default" pool is implicit */
+
+    if (ngx_strncmp(value[1].data, "threads", 7) == 0
+        && (value[1].len == 7 || value[1].data[7] == '='))
+    {
+        if (value[1].len > 8) {
+            name.len = value[1].len - 8;
+            name.data = value[1].data + 8;
+
+            clcf->thread_pool = ngx_thread_pool_add(cf, &name);
+
+        } else {
+            clcf->thread_pool = ngx_thread_pool_add(cf, NULL);
+        }
+
+        if (clcf->thread_pool == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        clcf->aio = NGX_HTTP_AIO_THREADS;
+        return NGX_CONF_OK;
+    }
+
+#endif
+
+    return "invalid value";
+}
+
+#endif
+
+
 static char *
 ngx_http_core_error_page(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -4909,6 +5168,62 @@ ngx_http_core_resolver(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_core_request_timing(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_main_conf_t *cmcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (cmcf->timing != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "has parameters with \"off\"";
+        }
+
+        cmcf->timing = 0;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcmp(value[1].data, "on") != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    cmcf->timing = 1;
+
+    if (cf->args->nelts == 2) {
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[2].data, "sample=", 7) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    n = ngx_atoi(value[2].data + 7, value[2].len - 7);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid sample \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    cmcf->timing = n;
+
+    return NGX_CONF_OK;
+}
+
+
 #if (NGX_HTTP_GZIP)
 
 static char *
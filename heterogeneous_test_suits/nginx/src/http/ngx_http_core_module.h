@@ -13,6 +13,10 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_PTHREAD)
+#include <ngx_thread_pool.h>
+#endif
+
 
 #define NGX_HTTP_GZIP_PROXIED_OFF       0x0002
 #define NGX_HTTP_GZIP_PROXIED_EXPIRED   0x0004
@@ -28,6 +32,7 @@
 #define NGX_HTTP_AIO_OFF                0
 #define NGX_HTTP_AIO_ON                 1
 #define NGX_HTTP_AIO_SENDFILE           2
+#define NGX_HTTP_AIO_THREADS            3
 
 
 #define NGX_HTTP_SATISFY_ALL            0
@@ -75,8 +80,14 @@ typedef struct {
 #if (NGX_HTTP_SSL)
     unsigned                   ssl:1;
 #endif
+#if (NGX_HTTP_V2)
+    unsigned                   http2:1;
+#endif
 #if (NGX_HAVE_INET6 && defined IPV6_V6ONLY)
     unsigned                   ipv6only:1;
+#endif
+#if (NGX_HAVE_REUSEPORT)
+    unsigned                   reuseport:1;
 #endif
     unsigned                   so_keepalive:2;
 
@@ -139,6 +150,10 @@ typedef struct {
     ngx_http_phase_handler_t  *handlers;
     ngx_uint_t                 server_rewrite_index;
     ngx_uint_t                 location_rewrite_index;
+
+    /* the first handlers timed as access and as content */
+    ngx_uint_t                 access_index;
+    ngx_uint_t                 content_index;
 } ngx_http_phase_engine_t;
 
 
@@ -171,6 +186,9 @@ typedef struct {
 
     ngx_uint_t                 try_files;       /* unsigned  try_files:1 */
 
+    /* time one of as many requests, 0 if none */
+    ngx_uint_t                 timing;
+
     ngx_http_phase_t           phases[NGX_HTTP_LOG_PHASE + 1];
 } ngx_http_core_main_conf_t;
 
@@ -217,6 +235,9 @@ typedef struct {
 #if (NGX_HTTP_SSL)
     ngx_uint_t                 ssl;   /* unsigned  ssl:1; */
 #endif
+#if (NGX_HTTP_V2)
+    ngx_uint_t                 http2;   /* unsigned  http2:1; */
+#endif
 } ngx_http_addr_conf_t;
 
 
@@ -260,6 +281,9 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_uint_t                 nregex;
     ngx_http_server_name_t    *regex;
+
+    ngx_array_t                sets;  /* array of ngx_http_server_name_set_t */
+    ngx_uint_t                 ncaptures;
 #endif
 
     /* the default server configuration for this address:port */
@@ -320,6 +344,7 @@ struct ngx_http_core_loc_conf_s {
     ngx_http_location_tree_node_t   *static_locations;
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
+    ngx_regex_t                     *regex_set;
 #endif
 
     /* pointer to the modules' loc_conf */
@@ -377,8 +402,12 @@ struct ngx_http_core_loc_conf_s {
                                            /* client_body_in_singe_buffer */
     ngx_flag_t    internal;                /* internal */
     ngx_flag_t    sendfile;                /* sendfile */
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_HAVE_PTHREAD)
     ngx_flag_t    aio;                     /* aio */
+#endif
+#if (NGX_HAVE_PTHREAD)
+    ngx_flag_t    aio_write;               /* aio_write */
+    ngx_thread_pool_t  *thread_pool;
 #endif
     ngx_flag_t    tcp_nopush;              /* tcp_nopush */
     ngx_flag_t    tcp_nodelay;             /* tcp_nodelay */
@@ -460,6 +489,8 @@ struct ngx_http_location_tree_node_s {
 
 
 void ngx_http_core_run_phases(ngx_http_request_t *r);
+void ngx_http_timing_add(ngx_http_timing_t *t, ngx_uint_t timer,
+    ngx_usec_t start, ngx_usec_t total);
 ngx_int_t ngx_http_core_generic_phase(ngx_http_request_t *r,
     ngx_http_phase_handler_t *ph);
 ngx_int_t ngx_http_core_rewrite_phase(ngx_http_request_t *r,
@@ -489,6 +520,7 @@ u_char *ngx_http_map_uri_to_path(ngx_http_request_t *r, ngx_str_t *name,
 ngx_int_t ngx_http_auth_basic_user(ngx_http_request_t *r);
 #if (NGX_HTTP_GZIP)
 ngx_int_t ngx_http_gzip_ok(ngx_http_request_t *r);
+ngx_int_t ngx_http_encoding_ok(ngx_http_request_t *r, ngx_str_t *encoding);
 #endif
 
 
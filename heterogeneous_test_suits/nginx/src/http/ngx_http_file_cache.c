@@ -14,6 +14,16 @@
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_fill_add(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static ngx_http_file_cache_fill_t *ngx_http_file_cache_fill_lookup(
+    ngx_http_file_cache_t *cache, u_char *key);
+static void ngx_http_file_cache_fill_done(ngx_http_cache_t *c,
+    ngx_temp_file_t *tf);
+static ngx_int_t ngx_http_file_cache_open_fill(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_cache_stream(ngx_http_request_t *r);
+static void ngx_http_cache_stream_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
@@ -21,19 +31,30 @@ static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
 #if (NGX_HAVE_FILE_AIO)
 static void ngx_http_cache_aio_event_handler(ngx_event_t *ev);
 #endif
+#if (NGX_HAVE_PTHREAD)
+static ngx_int_t ngx_http_cache_thread_handler(ngx_thread_task_t *task,
+    ngx_file_t *file);
+static void ngx_http_cache_thread_event_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
     ngx_path_t *path);
 static ngx_http_file_cache_node_t *
-    ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key);
+    ngx_http_file_cache_lookup(ngx_http_file_cache_part_t *part, u_char *key);
+static void ngx_http_file_cache_lock_part(ngx_http_file_cache_part_t *part);
 static void ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 static void ngx_http_file_cache_cleanup(void *data);
 static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_forced_expire_part(
+    ngx_http_file_cache_t *cache, ngx_http_file_cache_part_t *part,
+    u_char *name);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_expire_part(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_part_t *part, u_char *name);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
-    ngx_queue_t *q, u_char *name);
+    ngx_http_file_cache_part_t *part, ngx_queue_t *q, u_char *name);
 static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
@@ -60,14 +81,26 @@ ngx_str_t  ngx_http_cache_status[] = {
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
 
+/*
+ * the keys are md5 hashes, so the last byte of a key, which is not used
+ * by the rbtree key, spreads the nodes evenly between the partitions
+ */
+
+#define ngx_http_file_cache_part(cache, key)                                 \
+    (&(cache)->sh->parts[(key)[NGX_HTTP_CACHE_KEY_LEN - 1]                   \
+                         % (cache)->sh->nparts])
+
+
 static ngx_int_t
 ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_file_cache_t  *ocache = data;
 
-    size_t                  len;
-    ngx_uint_t              n;
-    ngx_http_file_cache_t  *cache;
+    size_t                       len;
+    ngx_uint_t                   n;
+    ngx_slab_pool_t            **stripes;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_part_t  *part;
 
     cache = shm_zone->data;
 
@@ -91,6 +124,13 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             }
         }
 
+        if (cache->partitions != ocache->partitions) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different partitions",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
         cache->sh = ocache->sh;
 
         cache->shpool = ocache->shpool;
@@ -121,10 +161,14 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     cache->shpool->data = cache->sh;
 
-    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
-                    ngx_http_file_cache_rbtree_insert_value);
+    len = cache->partitions * sizeof(ngx_http_file_cache_part_t);
+
+    cache->sh->parts = ngx_slab_alloc(cache->shpool, len);
+    if (cache->sh->parts == NULL) {
+        return NGX_ERROR;
+    }
 
-    ngx_queue_init(&cache->sh->queue);
+    cache->sh->nparts = cache->partitions;
 
     cache->sh->cold = 1;
     cache->sh->loading = 0;
@@ -144,6 +188,46 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
     ngx_sprintf(cache->shpool->log_ctx, " in cache keys zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
+    /*
+     * each partition has its own tree, inactive queue, and lock;
+     * the partitions of a partitioned zone are allocated from the pools
+     * striped off the zone pool, so they do not share the slab lock either
+     */
+
+    stripes = NULL;
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    if (cache->partitions > 1) {
+        stripes = ngx_slab_stripe(cache->shpool, cache->partitions);
+        if (stripes == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+    for (n = 0; n < cache->partitions; n++) {
+        part = &cache->sh->parts[n];
+
+        ngx_rbtree_init(&part->rbtree, &part->sentinel,
+                        ngx_http_file_cache_rbtree_insert_value);
+
+        ngx_queue_init(&part->queue);
+
+        part->locks = 0;
+        part->contended = 0;
+        part->reported = 0;
+
+        if (stripes) {
+            part->shpool = stripes[n];
+            part->shpool->log_ctx = cache->shpool->log_ctx;
+
+        } else {
+            part->shpool = cache->shpool;
+        }
+    }
+
     return NGX_OK;
 }
 
@@ -256,6 +340,10 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         return ngx_http_file_cache_read(r, c);
     }
 
+    if (c->fill && !c->filling && c->fill->temp_file) {
+        return ngx_http_file_cache_open_fill(r, c);
+    }
+
     cache = c->file_cache;
 
     if (c->node == NULL) {
@@ -378,29 +466,30 @@ done:
 static ngx_int_t
 ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_msec_t                 now, timer;
-    ngx_http_file_cache_t     *cache;
+    ngx_msec_t                   now, timer;
+    ngx_http_file_cache_part_t  *part;
 
     if (!c->lock) {
         return NGX_DECLINED;
     }
 
-    cache = c->file_cache;
+    part = ngx_http_file_cache_part(c->file_cache, c->key);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_http_file_cache_lock_part(part);
 
     if (!c->node->updating) {
         c->node->updating = 1;
         c->updating = 1;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&part->shpool->mutex);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache lock u:%d wt:%M",
                    c->updating, c->wait_time);
 
     if (c->updating) {
+        ngx_http_file_cache_fill_add(r, c);
         return NGX_DECLINED;
     }
 
@@ -418,7 +507,20 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     timer = c->wait_time - now;
 
-    ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
+    /*
+     * a response fetched by the worker wakes up its waiters itself,
+     * the one fetched by another worker is polled for
+     */
+
+    c->fill = ngx_http_file_cache_fill_lookup(c->file_cache, c->key);
+
+    if (c->fill) {
+        ngx_queue_insert_tail(&c->fill->waiters, &c->queue);
+        ngx_add_timer(&c->wait_event, timer);
+
+    } else {
+        ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
+    }
 
     r->main->blocked++;
 
@@ -429,38 +531,63 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 static void
 ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
 {
-    ngx_uint_t                 wait;
-    ngx_msec_t                 timer;
-    ngx_http_cache_t          *c;
-    ngx_http_request_t        *r;
-    ngx_http_file_cache_t     *cache;
+    ngx_uint_t                   wait;
+    ngx_msec_t                   timer;
+    ngx_http_cache_t            *c;
+    ngx_http_request_t          *r;
+    ngx_http_file_cache_part_t  *part;
 
     r = ev->data;
     c = r->cache;
 
+    if (c->streaming) {
+        r->connection->write->handler(r->connection->write);
+        return;
+    }
+
+    if (!c->waiting) {
+        return;
+    }
+
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
                    "http file cache wait handler wt:%M cur:%M",
                    c->wait_time, ngx_current_msec);
 
+    if (c->fill && c->fill->temp_file) {
+        /* the response header is written, the body is streamed */
+        goto wakeup;
+    }
+
     timer = c->wait_time - ngx_current_msec;
 
     if ((ngx_msec_int_t) timer <= 0) {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
                        "http file cache lock timeout");
         c->lock = 0;
+
+        if (c->fill) {
+            ngx_queue_remove(&c->queue);
+            c->fill = NULL;
+        }
+
         goto wakeup;
     }
 
-    cache = c->file_cache;
+    if (c->fill) {
+        ngx_add_timer(ev, timer);
+        return;
+    }
+
+    part = ngx_http_file_cache_part(c->file_cache, c->key);
     wait = 0;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_http_file_cache_lock_part(part);
 
     if (c->node->updating) {
         wait = 1;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&part->shpool->mutex);
 
     if (wait) {
         ngx_add_timer(ev, (timer > 500) ? 500 : timer);
@@ -469,12 +596,262 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
 
 wakeup:
 
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
+
     c->waiting = 0;
     r->main->blocked--;
     r->connection->write->handler(r->connection->write);
 }
 
 
+ngx_int_t
+ngx_http_file_cache_relock(ngx_http_request_t *r)
+{
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    /* an expired response is waited for like a new one */
+
+    if (c->file.fd != NGX_INVALID_FILE) {
+        ngx_pool_run_cleanup_file(r->pool, c->file.fd);
+        c->file.fd = NGX_INVALID_FILE;
+    }
+
+    c->buf = NULL;
+    c->valid_sec = 0;
+
+    return ngx_http_file_cache_lock(r, c);
+}
+
+
+static void
+ngx_http_file_cache_fill_add(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_fill_t  *fill;
+
+    fill = ngx_palloc(r->pool, sizeof(ngx_http_file_cache_fill_t));
+    if (fill == NULL) {
+        /* the waiters poll for the node */
+        return;
+    }
+
+    ngx_memcpy((u_char *) &fill->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(fill->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    ngx_queue_init(&fill->waiters);
+    fill->temp_file = NULL;
+
+    ngx_rbtree_insert(&c->file_cache->fills, &fill->node);
+
+    c->fill = fill;
+    c->filling = 1;
+}
+
+
+static ngx_http_file_cache_fill_t *
+ngx_http_file_cache_fill_lookup(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_http_file_cache_fill_t  *fill;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->fills.root;
+    sentinel = cache->fills.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        fill = (ngx_http_file_cache_fill_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fill->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return fill;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+void
+ngx_http_file_cache_fill(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    ngx_queue_t                 *q;
+    ngx_http_cache_t            *c, *w;
+    ngx_http_file_cache_fill_t  *fill;
+
+    c = r->cache;
+    fill = c->fill;
+
+    if (fill == NULL || !c->filling) {
+        return;
+    }
+
+    /* the header is written to the file along with the first body part */
+
+    if (tf->file.fd == NGX_INVALID_FILE
+        || tf->offset < (off_t) c->body_start)
+    {
+        return;
+    }
+
+    fill->temp_file = tf;
+
+    for (q = ngx_queue_head(&fill->waiters);
+         q != ngx_queue_sentinel(&fill->waiters);
+         q = ngx_queue_next(q))
+    {
+        w = ngx_queue_data(q, ngx_http_cache_t, queue);
+
+        if (w->streaming && w->sent == tf->offset) {
+            continue;
+        }
+
+        ngx_post_event((&w->wait_event), &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_file_cache_fill_done(ngx_http_cache_t *c, ngx_temp_file_t *tf)
+{
+    ngx_queue_t                 *q;
+    ngx_http_cache_t            *w;
+    ngx_http_file_cache_fill_t  *fill;
+
+    fill = c->fill;
+    c->fill = NULL;
+
+    if (!c->filling) {
+        ngx_queue_remove(&c->queue);
+        return;
+    }
+
+    c->filling = 0;
+
+    ngx_rbtree_delete(&c->file_cache->fills, &fill->node);
+
+    /*
+     * the streaming waiters finish the response, or abort it if it
+     * was not completed, the rest look the node up again
+     */
+
+    while (!ngx_queue_empty(&fill->waiters)) {
+        q = ngx_queue_head(&fill->waiters);
+        ngx_queue_remove(q);
+
+        w = ngx_queue_data(q, ngx_http_cache_t, queue);
+        w->fill = NULL;
+
+        if (tf && w->streaming) {
+            w->length = tf->offset;
+            w->filled = 1;
+        }
+
+        ngx_post_event((&w->wait_event), &ngx_posted_events);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_open_fill(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ssize_t                        n;
+    ngx_temp_file_t               *tf;
+    ngx_pool_cleanup_t            *cln;
+    ngx_pool_cleanup_file_t       *clnf;
+    ngx_http_file_cache_header_t  *h;
+
+    tf = c->fill->temp_file;
+
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_pool_cleanup_file_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    c->file.fd = ngx_open_file(tf->file.name.data, NGX_FILE_RDONLY,
+                               NGX_FILE_OPEN, 0);
+
+    if (c->file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", tf->file.name.data);
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_pool_cleanup_file;
+    clnf = cln->data;
+
+    clnf->fd = c->file.fd;
+    clnf->name = tf->file.name.data;
+    clnf->log = r->pool->log;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache stream: \"%s\" fd:%d",
+                   tf->file.name.data, c->file.fd);
+
+    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the header has just been written, it is in the page cache */
+
+    n = ngx_read_file(&c->file, c->buf->pos, c->body_start, 0);
+
+    if (n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    h = (ngx_http_file_cache_header_t *) c->buf->pos;
+
+    if ((size_t) n < c->header_start
+        || h->crc32 != c->crc32
+        || h->body_start > c->body_start)
+    {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      "cache temp file \"%s\" has invalid header",
+                      tf->file.name.data);
+        return NGX_ERROR;
+    }
+
+    c->buf->last += n;
+
+    c->valid_sec = h->valid_sec;
+    c->last_modified = h->last_modified;
+    c->date = h->date;
+    c->valid_msec = h->valid_msec;
+    c->header_start = h->header_start;
+    c->body_start = h->body_start;
+
+    r->cached = 1;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
@@ -482,6 +859,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     ssize_t                        n;
     ngx_int_t                      rc;
     ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_part_t    *part;
     ngx_http_file_cache_header_t  *h;
 
     n = ngx_http_file_cache_aio_read(r, c);
@@ -523,10 +901,11 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     r->cached = 1;
 
     cache = c->file_cache;
+    part = ngx_http_file_cache_part(cache, c->key);
 
     if (cache->sh->cold) {
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_http_file_cache_lock_part(part);
 
         if (!c->node->exists) {
             c->node->uses = 1;
@@ -535,17 +914,17 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             c->node->uniq = c->uniq;
             c->node->fs_size = c->fs_size;
 
-            cache->sh->size += c->fs_size;
+            (void) ngx_atomic_fetch_add(&cache->sh->size, c->fs_size);
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&part->shpool->mutex);
     }
 
     now = ngx_time();
 
     if (c->valid_sec < now) {
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_http_file_cache_lock_part(part);
 
         if (c->node->updating) {
             rc = NGX_HTTP_CACHE_UPDATING;
@@ -556,7 +935,11 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             rc = NGX_HTTP_CACHE_STALE;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&part->shpool->mutex);
+
+        if (c->updating && c->lock) {
+            ngx_http_file_cache_fill_add(r, c);
+        }
 
         ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http file cache expired: %i %T %T",
@@ -574,15 +957,32 @@ ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
 #if (NGX_HAVE_FILE_AIO)
     ssize_t                    n;
+#endif
+#if (NGX_HAVE_FILE_AIO || NGX_HAVE_PTHREAD)
     ngx_http_core_loc_conf_t  *clcf;
 
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+#endif
+
+#if (NGX_HAVE_PTHREAD)
+
+    if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+        c->file.thread_handler = ngx_http_cache_thread_handler;
+        c->file.thread_ctx = r;
+
+        return ngx_thread_read(&c->file, c->buf->pos, c->body_start, 0,
+                               r->pool);
+    }
+
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+
     if (!ngx_file_aio) {
         goto noaio;
     }
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-
-    if (!clcf->aio) {
+    if (clcf->aio != NGX_HTTP_AIO_ON && clcf->aio != NGX_HTTP_AIO_SENDFILE) {
         goto noaio;
     }
 
@@ -628,22 +1028,74 @@ ngx_http_cache_aio_event_handler(ngx_event_t *ev)
 #endif
 
 
+#if (NGX_HAVE_PTHREAD)
+
+static ngx_int_t
+ngx_http_cache_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    r = file->thread_ctx;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    task->event.data = r;
+    task->event.handler = ngx_http_cache_thread_event_handler;
+
+    if (ngx_thread_task_post(clcf->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_cache_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->connection->write->handler(r->connection->write);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
     ngx_int_t                    rc;
+    ngx_http_file_cache_part_t  *part;
     ngx_http_file_cache_node_t  *fcn;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    part = ngx_http_file_cache_part(cache, c->key);
+
+    ngx_http_file_cache_lock_part(part);
 
     fcn = c->node;
 
     if (fcn == NULL) {
-        fcn = ngx_http_file_cache_lookup(cache, c->key);
+        fcn = ngx_http_file_cache_lookup(part, c->key);
     }
 
     if (fcn) {
-        ngx_queue_remove(&fcn->queue);
+
+        /*
+         * a hit only marks the node as referenced instead of moving it
+         * to the head of the inactive queue, the expiration gives
+         * the referenced nodes a second chance (the CLOCK algorithm)
+         */
+
+        fcn->referenced = 1;
 
         if (c->node == NULL) {
             fcn->uses++;
@@ -678,16 +1130,16 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         goto done;
     }
 
-    fcn = ngx_slab_alloc_locked(cache->shpool,
+    fcn = ngx_slab_alloc_locked(part->shpool,
                                 sizeof(ngx_http_file_cache_node_t));
     if (fcn == NULL) {
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&part->shpool->mutex);
 
         (void) ngx_http_file_cache_forced_expire(cache);
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_http_file_cache_lock_part(part);
 
-        fcn = ngx_slab_alloc_locked(cache->shpool,
+        fcn = ngx_slab_alloc_locked(part->shpool,
                                     sizeof(ngx_http_file_cache_node_t));
         if (fcn == NULL) {
             rc = NGX_ERROR;
@@ -700,12 +1152,14 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
     ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
                NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    ngx_rbtree_insert(&part->rbtree, &fcn->node);
+    ngx_queue_insert_head(&part->queue, &fcn->queue);
 
     fcn->uses = 1;
     fcn->count = 1;
     fcn->updating = 0;
     fcn->deleting = 0;
+    fcn->referenced = 0;
 
 renew:
 
@@ -723,15 +1177,13 @@ done:
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
-
     c->uniq = fcn->uniq;
     c->error = fcn->error;
     c->node = fcn;
 
 failed:
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&part->shpool->mutex);
 
     return rc;
 }
@@ -773,7 +1225,7 @@ ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
 
 
 static ngx_http_file_cache_node_t *
-ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
+ngx_http_file_cache_lookup(ngx_http_file_cache_part_t *part, u_char *key)
 {
     ngx_int_t                    rc;
     ngx_rbtree_key_t             node_key;
@@ -782,8 +1234,8 @@ ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
 
     ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
 
-    node = cache->sh->rbtree.root;
-    sentinel = cache->sh->rbtree.sentinel;
+    node = part->rbtree.root;
+    sentinel = part->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -899,13 +1351,14 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 void
 ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 {
-    off_t                   fs_size;
-    ngx_int_t               rc;
-    ngx_file_uniq_t         uniq;
-    ngx_file_info_t         fi;
-    ngx_http_cache_t        *c;
-    ngx_ext_rename_file_t   ext;
-    ngx_http_file_cache_t  *cache;
+    off_t                        fs_size;
+    ngx_int_t                    rc;
+    ngx_file_uniq_t              uniq;
+    ngx_file_info_t              fi;
+    ngx_http_cache_t            *c;
+    ngx_ext_rename_file_t        ext;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_part_t  *part;
 
     c = r->cache;
 
@@ -951,13 +1404,16 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
         }
     }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    part = ngx_http_file_cache_part(cache, c->key);
+
+    ngx_http_file_cache_lock_part(part);
 
     c->node->count--;
     c->node->uniq = uniq;
     c->node->body_start = c->body_start;
 
-    cache->sh->size += fs_size - c->node->fs_size;
+    (void) ngx_atomic_fetch_add(&cache->sh->size,
+                                fs_size - c->node->fs_size);
     c->node->fs_size = fs_size;
 
     if (rc == NGX_OK) {
@@ -966,7 +1422,11 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     c->node->updating = 0;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&part->shpool->mutex);
+
+    if (c->fill) {
+        ngx_http_file_cache_fill_done(c, tf);
+    }
 }
 
 
@@ -983,6 +1443,26 @@ ngx_http_cache_send(ngx_http_request_t *r)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache send: %s", c->file.name.data);
 
+    if (c->fill) {
+
+        /* the response is streamed as it is written by another request */
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+
+        c->sent = c->body_start;
+        c->streaming = 1;
+
+        r->write_event_handler = ngx_http_cache_stream_handler;
+
+        ngx_http_cache_stream(r);
+
+        return NGX_DONE;
+    }
+
     if (r != r->main && c->length - c->body_start == 0) {
         return ngx_http_send_header(r);
     }
@@ -1023,22 +1503,163 @@ ngx_http_cache_send(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_cache_stream(ngx_http_request_t *r)
+{
+    off_t                      length;
+    ngx_int_t                  rc;
+    ngx_buf_t                 *b;
+    ngx_chain_t                out;
+    ngx_event_t               *wev;
+    ngx_http_cache_t          *c;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = r->cache;
+    wev = r->connection->write;
+
+    if (c->fill == NULL && !c->filled) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "cached response \"%s\" was not completed",
+                      c->file.name.data);
+
+        c->streaming = 0;
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
+
+    length = c->fill ? c->fill->temp_file->offset : c->length;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache stream: %O-%O f:%d",
+                   c->sent, length, c->filled);
+
+    if (c->sent < length || c->filled) {
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            c->streaming = 0;
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            c->streaming = 0;
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        b->file_pos = c->sent;
+        b->file_last = length;
+
+        b->in_file = (length - c->sent) ? 1 : 0;
+        b->flush = 1;
+
+        if (c->filled) {
+            b->last_buf = (r == r->main) ? 1 : 0;
+            b->last_in_chain = 1;
+        }
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+
+        c->sent = length;
+
+        out.buf = b;
+        out.next = NULL;
+
+        rc = ngx_http_output_filter(r, &out);
+
+    } else {
+        rc = ngx_http_output_filter(r, NULL);
+    }
+
+    if (rc == NGX_ERROR || c->filled) {
+        c->streaming = 0;
+        ngx_http_finalize_request(r, rc);
+        return;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r->main, ngx_http_core_module);
+
+    if (r->buffered || r->postponed
+        || (r == r->main && r->connection->buffered))
+    {
+        if (!wev->delayed) {
+            ngx_add_timer(wev, clcf->send_timeout);
+        }
+
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            c->streaming = 0;
+            ngx_http_finalize_request(r, NGX_ERROR);
+        }
+
+        return;
+    }
+
+    if (wev->timer_set && !wev->delayed) {
+        ngx_del_timer(wev);
+    }
+}
+
+
+static void
+ngx_http_cache_stream_handler(ngx_http_request_t *r)
+{
+    ngx_event_t  *wev;
+
+    wev = r->connection->write;
+
+    if (wev->timedout) {
+
+        if (!wev->delayed) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, NGX_ETIMEDOUT,
+                          "client timed out");
+            r->connection->timedout = 1;
+
+            r->cache->streaming = 0;
+            ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+            return;
+        }
+
+        wev->timedout = 0;
+        wev->delayed = 0;
+    }
+
+    if (wev->delayed) {
+        return;
+    }
+
+    ngx_http_cache_stream(r);
+}
+
+
 void
 ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 {
-    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_part_t  *part;
     ngx_http_file_cache_node_t  *fcn;
 
+    if (c->fill) {
+        /* the waiters are woken up after the node is unlocked below */
+        ngx_http_file_cache_fill_done(c, NULL);
+    }
+
+    if (c->wait_event.prev) {
+        ngx_delete_posted_event((&c->wait_event));
+    }
+
     if (c->updated || c->node == NULL) {
         return;
     }
 
-    cache = c->file_cache;
+    part = ngx_http_file_cache_part(c->file_cache, c->key);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache free, fd: %d", c->file.fd);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_http_file_cache_lock_part(part);
 
     fcn = c->node;
     fcn->count--;
@@ -1057,12 +1678,12 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 
     } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
         ngx_queue_remove(&fcn->queue);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
+        ngx_rbtree_delete(&part->rbtree, &fcn->node);
+        ngx_slab_free_locked(part->shpool, fcn);
         c->node = NULL;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&part->shpool->mutex);
 
     c->updated = 1;
     c->updating = 0;
@@ -1108,16 +1729,26 @@ ngx_http_file_cache_cleanup(void *data)
 }
 
 
+static void
+ngx_http_file_cache_lock_part(ngx_http_file_cache_part_t *part)
+{
+    if (!ngx_shmtx_trylock(&part->shpool->mutex)) {
+        (void) ngx_atomic_fetch_add(&part->contended, 1);
+        ngx_shmtx_lock(&part->shpool->mutex);
+    }
+
+    part->locks++;
+}
+
+
 static time_t
 ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 {
-    u_char                      *name;
-    size_t                       len;
-    time_t                       wait;
-    ngx_uint_t                   tries;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
+    u_char      *name;
+    size_t       len;
+    time_t       wait, rc;
+    ngx_uint_t   i, n;
+    ngx_path_t  *path;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                    "http file cache forced expire");
@@ -1132,15 +1763,51 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 
     ngx_memcpy(name, path->name.data, path->name.len);
 
+    /* the partitions are tried round robin starting after the last one */
+
+    wait = 10;
+
+    for (i = 0; i < cache->sh->nparts; i++) {
+        n = cache->next_part++ % cache->sh->nparts;
+
+        rc = ngx_http_file_cache_forced_expire_part(cache,
+                                                    &cache->sh->parts[n],
+                                                    name);
+        if (rc < wait) {
+            wait = rc;
+        }
+
+        if (wait == 0) {
+            break;
+        }
+    }
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static time_t
+ngx_http_file_cache_forced_expire_part(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_part_t *part, u_char *name)
+{
+    time_t                       wait;
+    ngx_uint_t                   tries;
+    ngx_queue_t                 *q, *prev;
+    ngx_http_file_cache_node_t  *fcn;
+
     wait = 10;
     tries = 20;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_http_file_cache_lock_part(part);
 
-    for (q = ngx_queue_last(&cache->sh->queue);
-         q != ngx_queue_sentinel(&cache->sh->queue);
-         q = ngx_queue_prev(q))
+    for (q = ngx_queue_last(&part->queue);
+         q != ngx_queue_sentinel(&part->queue);
+         q = prev)
     {
+        prev = ngx_queue_prev(q);
+
         fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
         ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
@@ -1148,11 +1815,16 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
                   fcn->count, fcn->exists,
                   fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
+        if (fcn->count == 0 && !fcn->referenced) {
+            ngx_http_file_cache_delete(cache, part, q, name);
             wait = 0;
 
         } else {
+
+            /* a referenced node is passed over once, like the CLOCK hand */
+
+            fcn->referenced = 0;
+
             if (--tries) {
                 continue;
             }
@@ -1163,9 +1835,7 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
         break;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
-
-    ngx_free(name);
+    ngx_shmtx_unlock(&part->shpool->mutex);
 
     return wait;
 }
@@ -1174,13 +1844,11 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 static time_t
 ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 {
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       now, wait;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+    u_char      *name;
+    size_t       len;
+    time_t       wait, rc;
+    ngx_uint_t   n;
+    ngx_path_t  *path;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                    "http file cache expire");
@@ -1195,23 +1863,67 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
     ngx_memcpy(name, path->name.data, path->name.len);
 
+    wait = 10;
+
+    for (n = 0; n < cache->sh->nparts; n++) {
+        rc = ngx_http_file_cache_expire_part(cache, &cache->sh->parts[n],
+                                             name);
+        if (rc < wait) {
+            wait = rc;
+        }
+    }
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static time_t
+ngx_http_file_cache_expire_part(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_part_t *part, u_char *name)
+{
+    u_char                      *p;
+    size_t                       len;
+    time_t                       now, wait;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
     now = ngx_time();
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_http_file_cache_lock_part(part);
 
     for ( ;; ) {
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
+        if (ngx_queue_empty(&part->queue)) {
             wait = 10;
             break;
         }
 
-        q = ngx_queue_last(&cache->sh->queue);
+        q = ngx_queue_last(&part->queue);
 
         fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
         wait = fcn->expire - now;
 
+        if (fcn->referenced) {
+
+            /*
+             * the node was hit since it has been queued, so it is moved
+             * to the head of the queue, and the queue is kept ordered
+             * by the expiration time of the nodes that were not hit
+             */
+
+            fcn->referenced = 0;
+
+            if (wait > 0) {
+                ngx_queue_remove(q);
+                ngx_queue_insert_head(&part->queue, &fcn->queue);
+                continue;
+            }
+        }
+
         if (wait > 0) {
             wait = wait > 10 ? 10 : wait;
             break;
@@ -1223,7 +1935,7 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
                        fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
         if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
+            ngx_http_file_cache_delete(cache, part, q, name);
             continue;
         }
 
@@ -1245,24 +1957,22 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
         ngx_queue_remove(q);
         fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        ngx_queue_insert_head(&part->queue, &fcn->queue);
 
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                       "ignore long locked inactive cache entry %*s, count:%d",
                       2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
-
-    ngx_free(name);
+    ngx_shmtx_unlock(&part->shpool->mutex);
 
     return wait;
 }
 
 
 static void
-ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
-    u_char *name)
+ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_part_t *part, ngx_queue_t *q, u_char *name)
 {
     u_char                      *p;
     size_t                       len;
@@ -1272,7 +1982,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
     if (fcn->exists) {
-        cache->sh->size -= fcn->fs_size;
+        (void) ngx_atomic_fetch_add(&cache->sh->size, -fcn->fs_size);
 
         path = cache->path;
         p = name + path->name.len + 1 + path->len;
@@ -1284,7 +1994,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
 
         fcn->count++;
         fcn->deleting = 1;
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&part->shpool->mutex);
 
         len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
         ngx_create_hashed_filename(path, name, len);
@@ -1297,15 +2007,15 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
                           ngx_delete_file_n " \"%s\" failed", name);
         }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_http_file_cache_lock_part(part);
         fcn->count--;
         fcn->deleting = 0;
     }
 
     if (fcn->count == 0) {
         ngx_queue_remove(q);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
+        ngx_rbtree_delete(&part->rbtree, &fcn->node);
+        ngx_slab_free_locked(part->shpool, fcn);
     }
 }
 
@@ -1315,20 +2025,39 @@ ngx_http_file_cache_manager(void *data)
 {
     ngx_http_file_cache_t  *cache = data;
 
-    off_t   size;
-    time_t  next, wait;
+    off_t                        size;
+    time_t                       next, wait;
+    ngx_uint_t                   n;
+    ngx_atomic_uint_t            contended;
+    ngx_http_file_cache_part_t  *part;
 
     next = ngx_http_file_cache_expire(cache);
 
     cache->last = ngx_current_msec;
     cache->files = 0;
 
-    for ( ;; ) {
-        ngx_shmtx_lock(&cache->shpool->mutex);
+    for (n = 0; n < cache->sh->nparts; n++) {
+        part = &cache->sh->parts[n];
 
-        size = cache->sh->size;
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache partition %ui locks:%uA contended:%uA",
+                       n, part->locks, part->contended);
+
+        contended = part->contended;
+
+        if (contended != part->reported) {
+            ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                          "cache \"%V\" partition %ui lock was contended "
+                          "%uA times of %uA",
+                          &cache->shm_zone->shm.name, n,
+                          contended - part->reported, part->locks);
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+            part->reported = contended;
+        }
+    }
+
+    for ( ;; ) {
+        size = cache->sh->size;
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                        "http file cache size: %O", size);
@@ -1493,18 +2222,21 @@ ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
 static ngx_int_t
 ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
+    ngx_http_file_cache_part_t  *part;
     ngx_http_file_cache_node_t  *fcn;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    part = ngx_http_file_cache_part(cache, c->key);
+
+    ngx_http_file_cache_lock_part(part);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    fcn = ngx_http_file_cache_lookup(part, c->key);
 
     if (fcn == NULL) {
 
-        fcn = ngx_slab_alloc_locked(cache->shpool,
+        fcn = ngx_slab_alloc_locked(part->shpool,
                                     sizeof(ngx_http_file_cache_node_t));
         if (fcn == NULL) {
-            ngx_shmtx_unlock(&cache->shpool->mutex);
+            ngx_shmtx_unlock(&part->shpool->mutex);
             return NGX_ERROR;
         }
 
@@ -1513,7 +2245,7 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
                    NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+        ngx_rbtree_insert(&part->rbtree, &fcn->node);
 
         fcn->uses = 1;
         fcn->count = 0;
@@ -1522,12 +2254,13 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         fcn->exists = 1;
         fcn->updating = 0;
         fcn->deleting = 0;
+        fcn->referenced = 0;
         fcn->uniq = 0;
         fcn->valid_sec = 0;
         fcn->body_start = 0;
         fcn->fs_size = c->fs_size;
 
-        cache->sh->size += c->fs_size;
+        (void) ngx_atomic_fetch_add(&cache->sh->size, c->fs_size);
 
     } else {
         ngx_queue_remove(&fcn->queue);
@@ -1535,9 +2268,9 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    ngx_queue_insert_head(&part->queue, &fcn->queue);
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&part->shpool->mutex);
 
     return NGX_OK;
 }
@@ -1592,7 +2325,7 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     time_t                  inactive;
     ssize_t                 size;
     ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files;
+    ngx_int_t               loader_files, partitions;
     ngx_msec_t              loader_sleep, loader_threshold;
     ngx_uint_t              i, n;
     ngx_http_file_cache_t  *cache;
@@ -1602,6 +2335,9 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_rbtree_init(&cache->fills, &cache->fills_sentinel,
+                    ngx_http_file_cache_rbtree_insert_value);
+
     cache->path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
     if (cache->path == NULL) {
         return NGX_CONF_ERROR;
@@ -1611,6 +2347,7 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     loader_files = 100;
     loader_sleep = 50;
     loader_threshold = 200;
+    partitions = 1;
 
     name.len = 0;
     size = 0;
@@ -1766,6 +2503,27 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "partitions=", 11) == 0) {
+
+            partitions = ngx_atoi(value[i].data + 11, value[i].len - 11);
+            if (partitions < 1 || partitions > 256) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid partitions value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+            if (partitions > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" requires atomic operations",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+#endif
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -1778,6 +2536,13 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (partitions > 1 && size < (ssize_t) (partitions * 8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "keys zone \"%V\" is too small for %i partitions",
+                           &name, partitions);
+        return NGX_CONF_ERROR;
+    }
+
     cache->path->manager = ngx_http_file_cache_manager;
     cache->path->loader = ngx_http_file_cache_loader;
     cache->path->data = cache;
@@ -1808,6 +2573,7 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     cache->inactive = inactive;
     cache->max_size = max_size;
+    cache->partitions = partitions;
 
     return NGX_CONF_OK;
 }
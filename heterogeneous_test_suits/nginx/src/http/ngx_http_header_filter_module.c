@@ -432,6 +432,10 @@ ngx_http_header_filter(ngx_http_request_t *r)
                + sizeof(CRLF) - 1;
     }
 
+    if (r->headers_out.header_block) {
+        len += r->headers_out.header_block->text.len;
+    }
+
     b = ngx_create_temp_buf(r->pool, len);
     if (b == NULL) {
         return NGX_ERROR;
@@ -463,6 +467,8 @@ ngx_http_header_filter(ngx_http_request_t *r)
     }
 
     if (r->headers_out.date == NULL) {
+        ngx_time_strings();
+
         b->last = ngx_cpymem(b->last, "Date: ", sizeof("Date: ") - 1);
         b->last = ngx_cpymem(b->last, ngx_cached_http_time.data,
                              ngx_cached_http_time.len);
@@ -595,6 +601,11 @@ ngx_http_header_filter(ngx_http_request_t *r)
         *b->last++ = CR; *b->last++ = LF;
     }
 
+    if (r->headers_out.header_block) {
+        b->last = ngx_copy(b->last, r->headers_out.header_block->text.data,
+                           r->headers_out.header_block->text.len);
+    }
+
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "%*s", (size_t) (b->last - b->pos), b->pos);
 
@@ -98,6 +98,174 @@ static uint32_t  usual[] = {
 #endif
 
 
+/*
+ * The long runs of the URI arguments and of the header values are skipped
+ * 16 bytes at a time, looking for the bytes the state machine acts on.
+ * SSE2 and NEON are the part of the base x86-64 and aarch64 ISAs, so no
+ * run time check is needed.
+ */
+
+#if ( __SSE2__ )
+
+#include <emmintrin.h>
+#define NGX_HTTP_PARSE_SIMD  1
+
+#elif ( __aarch64__ && __ARM_NEON && !__AARCH64EB__ )
+
+#include <arm_neon.h>
+#define NGX_HTTP_PARSE_SIMD  1
+
+#endif
+
+
+#if (NGX_HTTP_PARSE_SIMD)
+
+/*
+ * returns the first CR, LF, '\0', c1 or c2 in the 16 bytes blocks before
+ * "last", or the start of the block where the search stopped: at least
+ * one byte is always left for the state machine
+ */
+
+static ngx_inline u_char *
+ngx_http_parse_skip(u_char *p, u_char *last, u_char c1, u_char c2)
+{
+#if ( __SSE2__ )
+    int      mask;
+    __m128i  v, m, cr, lf, nul, d1, d2;
+
+    cr = _mm_set1_epi8(CR);
+    lf = _mm_set1_epi8(LF);
+    nul = _mm_setzero_si128();
+    d1 = _mm_set1_epi8((char) c1);
+    d2 = _mm_set1_epi8((char) c2);
+
+    while (last - p > 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, nul));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, d1));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, d2));
+
+        mask = _mm_movemask_epi8(m);
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+#else
+    uint8x16_t  v, m, cr, lf, d1, d2;
+    uint64_t    mask;
+
+    cr = vdupq_n_u8(CR);
+    lf = vdupq_n_u8(LF);
+    d1 = vdupq_n_u8(c1);
+    d2 = vdupq_n_u8(c2);
+
+    while (last - p > 16) {
+        v = vld1q_u8(p);
+
+        m = vorrq_u8(vceqq_u8(v, cr), vceqq_u8(v, lf));
+        m = vorrq_u8(m, vceqzq_u8(v));
+        m = vorrq_u8(m, vceqq_u8(v, d1));
+        m = vorrq_u8(m, vceqq_u8(v, d2));
+
+        if (vmaxvq_u8(m)) {
+
+            /* a nibble per byte */
+
+            mask = vget_lane_u64(vreinterpret_u64_u8(
+                       vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+
+        p += 16;
+    }
+
+#endif
+
+    return p;
+}
+
+
+/*
+ * returns the number of the hex digits the 16 bytes at "p" start with and
+ * their value, or 0 if the digits do not end within the 16 bytes; at most
+ * 15 digits are taken, so the value does not overflow off_t
+ */
+
+static ngx_inline ngx_uint_t
+ngx_http_parse_chunk_size(u_char *p, off_t *size)
+{
+    off_t       value;
+    ngx_uint_t  i, n;
+#if ( __SSE2__ )
+    int         mask;
+    __m128i     v, l, d;
+
+    v = _mm_loadu_si128((__m128i *) p);
+    l = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+    /* the signed comparisons leave out the bytes from 0x80 */
+
+    d = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                      _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    d = _mm_or_si128(d,
+                     _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+                                   _mm_cmplt_epi8(l, _mm_set1_epi8('f' + 1))));
+
+    mask = ~_mm_movemask_epi8(d) & 0xffff;
+
+    if (mask == 0) {
+        return 0;
+    }
+
+    n = __builtin_ctz(mask);
+
+#else
+    uint8x16_t  v, l, d;
+    uint64_t    mask;
+
+    v = vld1q_u8(p);
+    l = vorrq_u8(v, vdupq_n_u8(0x20));
+
+    d = vandq_u8(vcgeq_u8(v, vdupq_n_u8('0')), vcleq_u8(v, vdupq_n_u8('9')));
+    d = vorrq_u8(d, vandq_u8(vcgeq_u8(l, vdupq_n_u8('a')),
+                             vcleq_u8(l, vdupq_n_u8('f'))));
+
+    /* a nibble per byte, set for the bytes that are not hex digits */
+
+    mask = ~vget_lane_u64(vreinterpret_u64_u8(
+                vshrn_n_u16(vreinterpretq_u16_u8(d), 4)), 0);
+
+    if (mask == 0) {
+        return 0;
+    }
+
+    n = __builtin_ctzll(mask) >> 2;
+
+#endif
+
+    /* "0"-"9" are 0x30-0x39, "A"-"F" and "a"-"f" are 0x41-0x46 and 0x61-0x66 */
+
+    value = 0;
+
+    for (i = 0; i < n; i++) {
+        value = (value << 4) | ((p[i] & 0xf) + 9 * (p[i] >> 6));
+    }
+
+    *size = value;
+
+    return n;
+}
+
+#endif
+
+
 /* gcc, icc, msvc and others compile these switches as an jump table */
 
 ngx_int_t
@@ -622,6 +790,11 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* URI */
         case sw_uri:
 
+#if (NGX_HTTP_PARSE_SIMD)
+            p = ngx_http_parse_skip(p, b->last, ' ', '#');
+            ch = *p;
+#endif
+
             if (usual[ch >> 5] & (1 << (ch & 0x1f))) {
                 break;
             }
@@ -824,6 +997,9 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 {
     u_char      c, ch, *p;
     ngx_uint_t  hash, i;
+#if (NGX_HTTP_PARSE_SIMD)
+    u_char     *m;
+#endif
     enum {
         sw_start = 0,
         sw_name,
@@ -980,6 +1156,20 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 
         /* header value */
         case sw_value:
+
+#if (NGX_HTTP_PARSE_SIMD)
+            m = ngx_http_parse_skip(p, b->last, CR, CR);
+
+            /* the spaces before the end of the line are not the value */
+
+            while (m > p && m[-1] == ' ') {
+                m--;
+            }
+
+            p = m;
+            ch = *p;
+#endif
+
             switch (ch) {
             case ' ':
                 r->header_end = p;
@@ -993,6 +1183,7 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
                 r->header_end = p;
                 goto done;
             case '\0':
+                r->header_end = p;
                 return NGX_HTTP_PARSE_INVALID_HEADER;
             }
             break;
@@ -1826,6 +2017,9 @@ ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
 {
     u_char     *pos, ch, c;
     ngx_int_t   rc;
+#if (NGX_HTTP_PARSE_SIMD)
+    ngx_uint_t  n;
+#endif
     enum {
         sw_chunk_start = 0,
         sw_chunk_size,
@@ -1860,6 +2054,26 @@ ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
         switch (state) {
 
         case sw_chunk_start:
+
+#if (NGX_HTTP_PARSE_SIMD)
+
+            /*
+             * the whole size is taken at once, the state machine goes on
+             * with the byte after it
+             */
+
+            if (b->last - pos >= 16) {
+                n = ngx_http_parse_chunk_size(pos, &ctx->size);
+
+                if (n) {
+                    state = sw_chunk_size;
+                    pos += n - 1;
+                    break;
+                }
+            }
+
+#endif
+
             if (ch >= '0' && ch <= '9') {
                 state = sw_chunk_size;
                 ctx->size = ch - '0';
@@ -1877,6 +2091,10 @@ ngx_http_parse_chunked(ngx_http_request_t *r, ngx_buf_t *b,
             goto invalid;
 
         case sw_chunk_size:
+            if (ctx->size > NGX_MAX_OFF_T_VALUE / 16) {
+                goto invalid;
+            }
+
             if (ch >= '0' && ch <= '9') {
                 ctx->size = ctx->size * 16 + (ch - '0');
                 break;
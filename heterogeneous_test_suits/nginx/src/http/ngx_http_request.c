@@ -30,12 +30,14 @@ static ngx_int_t ngx_http_process_user_agent(ngx_http_request_t *r,
 static ngx_int_t ngx_http_process_cookie(ngx_http_request_t *r,
     ngx_table_elt_t *h, ngx_uint_t offset);
 
-static ngx_int_t ngx_http_process_request_header(ngx_http_request_t *r);
-static void ngx_http_process_request(ngx_http_request_t *r);
 static ssize_t ngx_http_validate_host(ngx_http_request_t *r, u_char **host,
     size_t len, ngx_uint_t alloc);
 static ngx_int_t ngx_http_find_virtual_server(ngx_http_request_t *r,
     u_char *host, size_t len);
+#if (NGX_PCRE)
+static ngx_int_t ngx_http_find_regex_server(ngx_http_request_t *r,
+    ngx_http_virtual_names_t *vn, ngx_str_t *name, ngx_uint_t key);
+#endif
 
 static void ngx_http_request_handler(ngx_event_t *ev);
 static void ngx_http_terminate_request(ngx_http_request_t *r, ngx_int_t rc);
@@ -51,9 +53,14 @@ static void ngx_http_set_lingering_close(ngx_http_request_t *r);
 static void ngx_http_lingering_close_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_post_action(ngx_http_request_t *r);
 static void ngx_http_close_request(ngx_http_request_t *r, ngx_int_t error);
-static void ngx_http_free_request(ngx_http_request_t *r, ngx_int_t error);
+static void ngx_http_init_timing(ngx_http_request_t *r,
+    ngx_http_core_main_conf_t *cmcf);
+static void ngx_http_timing_parsed(ngx_http_timing_t *t);
+static void ngx_http_timing_done(ngx_http_timing_t *t);
+#if (NGX_STAT_STUB)
+static void ngx_http_stat_request(ngx_http_request_t *r);
+#endif
 static void ngx_http_log_request(ngx_http_request_t *r);
-static void ngx_http_close_connection(ngx_connection_t *c);
 
 static u_char *ngx_http_log_error(ngx_log_t *log, u_char *buf, size_t len);
 static u_char *ngx_http_log_error_handler(ngx_http_request_t *r,
@@ -276,51 +283,10 @@ ngx_http_init_request(ngx_event_t *rev)
         return;
     }
 
-    c->requests++;
-
-    hc = c->data;
-
-    if (hc == NULL) {
-        hc = ngx_pcalloc(c->pool, sizeof(ngx_http_connection_t));
-        if (hc == NULL) {
-            ngx_http_close_connection(c);
-            return;
-        }
-    }
-
-    r = hc->request;
-
-    if (r) {
-        ngx_memzero(r, sizeof(ngx_http_request_t));
-
-        r->pipeline = hc->pipeline;
-
-        if (hc->nbusy) {
-            r->header_in = hc->busy[0];
-        }
-
-    } else {
-        r = ngx_pcalloc(c->pool, sizeof(ngx_http_request_t));
-        if (r == NULL) {
-            ngx_http_close_connection(c);
-            return;
-        }
-
-        hc->request = r;
-    }
-
-    c->data = r;
-    r->http_connection = hc;
-
-    c->sent = 0;
-    r->signature = NGX_HTTP_MODULE;
-
     /* find the server configuration for the address:port */
 
     port = c->listening->servers;
 
-    r->connection = c;
-
     if (port->naddrs > 1) {
 
         /*
@@ -391,6 +357,54 @@ ngx_http_init_request(ngx_event_t *rev)
         }
     }
 
+#if (NGX_HTTP_V2)
+    if (addr_conf->http2) {
+        ngx_http_v2_init(rev, addr_conf);
+        return;
+    }
+#endif
+
+    c->requests++;
+
+    hc = c->data;
+
+    if (hc == NULL) {
+        hc = ngx_pcalloc(c->pool, sizeof(ngx_http_connection_t));
+        if (hc == NULL) {
+            ngx_http_close_connection(c);
+            return;
+        }
+    }
+
+    r = hc->request;
+
+    if (r) {
+        ngx_memzero(r, sizeof(ngx_http_request_t));
+
+        r->pipeline = hc->pipeline;
+
+        if (hc->nbusy) {
+            r->header_in = hc->busy[0];
+        }
+
+    } else {
+        r = ngx_pcalloc(c->pool, sizeof(ngx_http_request_t));
+        if (r == NULL) {
+            ngx_http_close_connection(c);
+            return;
+        }
+
+        hc->request = r;
+    }
+
+    c->data = r;
+    r->http_connection = hc;
+
+    c->sent = 0;
+    r->signature = NGX_HTTP_MODULE;
+
+    r->connection = c;
+
     r->virtual_names = addr_conf->virtual_names;
 
     /* the default server configuration for the address:port */
@@ -433,7 +447,9 @@ ngx_http_init_request(ngx_event_t *rev)
             rev->handler = ngx_http_ssl_handshake;
         }
 
-        r->main_filter_need_in_memory = 1;
+        if (!c->ssl->sendfile) {
+            r->main_filter_need_in_memory = 1;
+        }
     }
     }
 
@@ -501,6 +517,10 @@ ngx_http_init_request(ngx_event_t *rev)
     r->start_sec = tp->sec;
     r->start_msec = tp->msec;
 
+    if (cmcf->timing) {
+        ngx_http_init_timing(r, cmcf);
+    }
+
     r->method = NGX_HTTP_UNKNOWN;
 
     r->headers_in.content_length_n = -1;
@@ -528,6 +548,124 @@ ngx_http_init_request(ngx_event_t *rev)
 }
 
 
+#if (NGX_HTTP_V2)
+
+/*
+ * a request of a multiplexed connection owns its pool and is allocated
+ * from it, the connection "c" is the fake connection of the stream
+ */
+
+ngx_http_request_t *
+ngx_http_create_request(ngx_connection_t *c, ngx_http_core_srv_conf_t *cscf)
+{
+    ngx_pool_t                 *pool;
+    ngx_time_t                 *tp;
+    ngx_http_request_t         *r;
+    ngx_http_log_ctx_t         *ctx;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    pool = ngx_create_pool(cscf->request_pool_size, c->log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    r = ngx_pcalloc(pool, sizeof(ngx_http_request_t));
+    if (r == NULL) {
+        goto failed;
+    }
+
+    r->pool = pool;
+    r->signature = NGX_HTTP_MODULE;
+    r->connection = c;
+
+    r->main_conf = cscf->ctx->main_conf;
+    r->srv_conf = cscf->ctx->srv_conf;
+    r->loc_conf = cscf->ctx->loc_conf;
+
+    r->read_event_handler = ngx_http_block_reading;
+
+    if (ngx_list_init(&r->headers_in.headers, pool, 20,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    if (ngx_array_init(&r->headers_in.cookies, pool, 2,
+                       sizeof(ngx_table_elt_t *))
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    if (ngx_list_init(&r->headers_out.headers, pool, 20,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        goto failed;
+    }
+
+    r->ctx = ngx_pcalloc(pool, sizeof(void *) * ngx_http_max_module);
+    if (r->ctx == NULL) {
+        goto failed;
+    }
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    r->variables = ngx_pcalloc(pool, cmcf->variables.nelts
+                                     * sizeof(ngx_http_variable_value_t));
+    if (r->variables == NULL) {
+        goto failed;
+    }
+
+    c->data = r;
+
+    r->main = r;
+    r->count = 1;
+
+    tp = ngx_timeofday();
+    r->start_sec = tp->sec;
+    r->start_msec = tp->msec;
+
+    if (cmcf->timing) {
+        ngx_http_init_timing(r, cmcf);
+    }
+
+    r->method = NGX_HTTP_UNKNOWN;
+
+    r->headers_in.content_length_n = -1;
+    r->headers_in.keep_alive_n = -1;
+    r->headers_out.content_length_n = -1;
+    r->headers_out.last_modified_time = -1;
+
+    r->uri_changes = NGX_HTTP_MAX_URI_CHANGES + 1;
+    r->subrequests = NGX_HTTP_MAX_SUBREQUESTS + 1;
+
+    r->http_state = NGX_HTTP_READING_REQUEST_STATE;
+
+    ctx = c->log->data;
+    ctx->request = r;
+    ctx->current_request = r;
+    r->log_handler = ngx_http_log_error_handler;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_reading, 1);
+    r->stat_reading = 1;
+    (void) ngx_atomic_fetch_add(ngx_stat_requests, 1);
+#endif
+
+    return r;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NULL;
+}
+
+#endif
+
+
 #if (NGX_HTTP_SSL)
 
 static void
@@ -620,6 +758,11 @@ ngx_http_ssl_handshake_handler(ngx_connection_t *c)
 
         c->ssl->no_wait_shutdown = 1;
 
+        if (c->ssl->sendfile) {
+            r = c->data;
+            r->main_filter_need_in_memory = 0;
+        }
+
         c->log->action = "reading client request line";
 
         c->read->handler = ngx_http_process_request_line;
@@ -715,12 +858,11 @@ ngx_http_ssl_servername(ngx_ssl_conn_t *ssl_conn, int *ad, void *arg)
 static void
 ngx_http_process_request_line(ngx_event_t *rev)
 {
-    u_char                    *host;
-    ssize_t                    n;
-    ngx_int_t                  rc, rv;
-    ngx_connection_t          *c;
-    ngx_http_request_t        *r;
-    ngx_http_core_srv_conf_t  *cscf;
+    u_char              *host;
+    ssize_t              n;
+    ngx_int_t            rc, rv;
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
 
     c = rev->data;
     r = c->data;
@@ -758,116 +900,16 @@ ngx_http_process_request_line(ngx_event_t *rev)
             r->request_length = r->header_in->pos - r->request_start;
 
 
-            if (r->args_start) {
-                r->uri.len = r->args_start - 1 - r->uri_start;
-            } else {
-                r->uri.len = r->uri_end - r->uri_start;
-            }
-
-
-            if (r->complex_uri || r->quoted_uri) {
-
-                r->uri.data = ngx_pnalloc(r->pool, r->uri.len + 1);
-                if (r->uri.data == NULL) {
-                    ngx_http_close_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
-                    return;
-                }
-
-                cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
-
-                rc = ngx_http_parse_complex_uri(r, cscf->merge_slashes);
-
-                if (rc == NGX_HTTP_PARSE_INVALID_REQUEST) {
-                    ngx_log_error(NGX_LOG_INFO, c->log, 0,
-                                  "client sent invalid request");
-                    ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
-                    return;
-                }
-
-            } else {
-                r->uri.data = r->uri_start;
-            }
-
-
-            r->unparsed_uri.len = r->uri_end - r->uri_start;
-            r->unparsed_uri.data = r->uri_start;
-
-            r->valid_unparsed_uri = r->space_in_uri ? 0 : 1;
-
             r->method_name.len = r->method_end - r->request_start + 1;
             r->method_name.data = r->request_line.data;
 
-
             if (r->http_protocol.data) {
                 r->http_protocol.len = r->request_end - r->http_protocol.data;
             }
 
-
-            if (r->uri_ext) {
-                if (r->args_start) {
-                    r->exten.len = r->args_start - 1 - r->uri_ext;
-                } else {
-                    r->exten.len = r->uri_end - r->uri_ext;
-                }
-
-                r->exten.data = r->uri_ext;
-            }
-
-
-            if (r->args_start && r->uri_end > r->args_start) {
-                r->args.len = r->uri_end - r->args_start;
-                r->args.data = r->args_start;
-            }
-
-#if (NGX_WIN32)
-            {
-            u_char  *p, *last;
-
-            p = r->uri.data;
-            last = r->uri.data + r->uri.len;
-
-            while (p < last) {
-
-                if (*p++ == ':') {
-
-                    /*
-                     * this check covers "::$data", "::$index_allocation" and
-                     * ":$i30:$index_allocation"
-                     */
-
-                    if (p < last && *p == '$') {
-                        ngx_log_error(NGX_LOG_INFO, c->log, 0,
-                                      "client sent unsafe win32 URI");
-                        ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
-                        return;
-                    }
-                }
-            }
-
-            p = r->uri.data + r->uri.len - 1;
-
-            while (p > r->uri.data) {
-
-                if (*p == ' ') {
-                    p--;
-                    continue;
-                }
-
-                if (*p == '.') {
-                    p--;
-                    continue;
-                }
-
-                break;
-            }
-
-            if (p != r->uri.data + r->uri.len - 1) {
-                r->uri.len = p + 1 - r->uri.data;
-                ngx_http_set_exten(r);
-            }
-
+            if (ngx_http_process_request_uri(r) != NGX_OK) {
+                return;
             }
-#endif
 
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                            "http request line: \"%V\"", &r->request_line);
@@ -978,6 +1020,115 @@ ngx_http_process_request_line(ngx_event_t *rev)
 }
 
 
+ngx_int_t
+ngx_http_process_request_uri(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_http_core_srv_conf_t  *cscf;
+
+    if (r->args_start) {
+        r->uri.len = r->args_start - 1 - r->uri_start;
+    } else {
+        r->uri.len = r->uri_end - r->uri_start;
+    }
+
+    if (r->complex_uri || r->quoted_uri) {
+
+        r->uri.data = ngx_pnalloc(r->pool, r->uri.len + 1);
+        if (r->uri.data == NULL) {
+            ngx_http_close_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return NGX_ERROR;
+        }
+
+        cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
+
+        rc = ngx_http_parse_complex_uri(r, cscf->merge_slashes);
+
+        if (rc == NGX_HTTP_PARSE_INVALID_REQUEST) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "client sent invalid request");
+            ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+            return NGX_ERROR;
+        }
+
+    } else {
+        r->uri.data = r->uri_start;
+    }
+
+    r->unparsed_uri.len = r->uri_end - r->uri_start;
+    r->unparsed_uri.data = r->uri_start;
+
+    r->valid_unparsed_uri = r->space_in_uri ? 0 : 1;
+
+    if (r->uri_ext) {
+        if (r->args_start) {
+            r->exten.len = r->args_start - 1 - r->uri_ext;
+        } else {
+            r->exten.len = r->uri_end - r->uri_ext;
+        }
+
+        r->exten.data = r->uri_ext;
+    }
+
+    if (r->args_start && r->uri_end > r->args_start) {
+        r->args.len = r->uri_end - r->args_start;
+        r->args.data = r->args_start;
+    }
+
+#if (NGX_WIN32)
+    {
+    u_char  *p, *last;
+
+    p = r->uri.data;
+    last = r->uri.data + r->uri.len;
+
+    while (p < last) {
+
+        if (*p++ == ':') {
+
+            /*
+             * this check covers "::$data", "::$index_allocation" and
+             * ":$i30:$index_allocation"
+             */
+
+            if (p < last && *p == '$') {
+                ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                              "client sent unsafe win32 URI");
+                ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    p = r->uri.data + r->uri.len - 1;
+
+    while (p > r->uri.data) {
+
+        if (*p == ' ') {
+            p--;
+            continue;
+        }
+
+        if (*p == '.') {
+            p--;
+            continue;
+        }
+
+        break;
+    }
+
+    if (p != r->uri.data + r->uri.len - 1) {
+        r->uri.len = p + 1 - r->uri.data;
+        ngx_http_set_exten(r);
+    }
+
+    }
+#endif
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_http_process_request_headers(ngx_event_t *rev)
 {
@@ -1548,7 +1699,7 @@ ngx_http_process_cookie(ngx_http_request_t *r, ngx_table_elt_t *h,
 }
 
 
-static ngx_int_t
+ngx_int_t
 ngx_http_process_request_header(ngx_http_request_t *r)
 {
     if (ngx_http_find_virtual_server(r, r->headers_in.server.data,
@@ -1559,7 +1710,10 @@ ngx_http_process_request_header(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    if (r->headers_in.host == NULL && r->http_version > NGX_HTTP_VERSION_10) {
+    if (r->headers_in.host == NULL
+        && r->http_version > NGX_HTTP_VERSION_10
+        && r->http_version < NGX_HTTP_VERSION_20)
+    {
         ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
                    "client sent HTTP/1.1 request without \"Host\" header");
         ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
@@ -1619,7 +1773,7 @@ ngx_http_process_request_header(ngx_http_request_t *r)
 }
 
 
-static void
+void
 ngx_http_process_request(ngx_http_request_t *r)
 {
     ngx_connection_t  *c;
@@ -1695,6 +1849,10 @@ ngx_http_process_request(ngx_http_request_t *r)
     c->write->handler = ngx_http_request_handler;
     r->read_event_handler = ngx_http_block_reading;
 
+    if (r->timing) {
+        ngx_http_timing_parsed(r->timing);
+    }
+
     ngx_http_handler(r);
 
     ngx_http_run_posted_requests(c);
@@ -1790,6 +1948,7 @@ ngx_http_validate_host(ngx_http_request_t *r, u_char **host, size_t len,
 static ngx_int_t
 ngx_http_find_virtual_server(ngx_http_request_t *r, u_char *host, size_t len)
 {
+    ngx_uint_t                 key;
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
 
@@ -1797,8 +1956,9 @@ ngx_http_find_virtual_server(ngx_http_request_t *r, u_char *host, size_t len)
         return NGX_DECLINED;
     }
 
-    cscf = ngx_hash_find_combined(&r->virtual_names->names,
-                                  ngx_hash_key(host, len), host, len);
+    key = ngx_hash_key(host, len);
+
+    cscf = ngx_hash_find_combined(&r->virtual_names->names, key, host, len);
 
     if (cscf) {
         goto found;
@@ -1807,29 +1967,20 @@ ngx_http_find_virtual_server(ngx_http_request_t *r, u_char *host, size_t len)
 #if (NGX_PCRE)
 
     if (len && r->virtual_names->nregex) {
-        ngx_int_t                n;
-        ngx_uint_t               i;
-        ngx_str_t                name;
-        ngx_http_server_name_t  *sn;
+        ngx_int_t   n;
+        ngx_str_t   name;
 
         name.len = len;
         name.data = host;
 
-        sn = r->virtual_names->regex;
-
-        for (i = 0; i < r->virtual_names->nregex; i++) {
-
-            n = ngx_http_regex_exec(r, sn[i].regex, &name);
-
-            if (n == NGX_OK) {
-                cscf = sn[i].server;
-                goto found;
-            }
+        n = ngx_http_find_regex_server(r, r->virtual_names, &name, key);
 
-            if (n == NGX_DECLINED) {
-                continue;
-            }
+        if (n >= 0) {
+            cscf = r->virtual_names->regex[n].server;
+            goto found;
+        }
 
+        if (n == NGX_ERROR) {
             return NGX_ERROR;
         }
     }
@@ -1854,6 +2005,137 @@ found:
 }
 
 
+#if (NGX_PCRE)
+
+/*
+ * returns the index of the regex server name matched, the result is
+ * cached by the host; the captures of a name are set again on a cache hit
+ */
+
+static ngx_int_t
+ngx_http_find_regex_server(ngx_http_request_t *r, ngx_http_virtual_names_t *vn,
+    ngx_str_t *name, ngx_uint_t key)
+{
+    ngx_int_t                      n;
+    ngx_uint_t                     i, lo, hi, mid;
+    ngx_http_server_name_t        *sn;
+    ngx_http_server_name_set_t    *set, *last;
+    ngx_http_server_name_cache_t  *cache;
+
+    sn = vn->regex;
+
+    cache = &vn->cache[key % NGX_HTTP_SERVER_NAME_CACHE_SIZE];
+
+    if (cache->hash == (uint32_t) key
+        && cache->len == name->len
+        && ngx_memcmp(cache->name, name->data, name->len) == 0)
+    {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http server name cache hit: \"%V\" %uD",
+                       name, cache->regex);
+
+        if (cache->regex == 0) {
+            return NGX_DECLINED;
+        }
+
+        i = cache->regex - 1;
+
+        goto found;
+    }
+
+    last = vn->sets + vn->nsets;
+
+    for (set = vn->sets; set < last; set++) {
+
+        if (set->regex == NULL) {
+
+            for (i = set->first; i < set->last; i++) {
+
+                n = ngx_http_regex_exec(r, sn[i].regex, name);
+
+                if (n == NGX_OK) {
+                    goto cache;
+                }
+
+                if (n == NGX_DECLINED) {
+                    continue;
+                }
+
+                return NGX_ERROR;
+            }
+
+            continue;
+        }
+
+        n = ngx_regex_exec(set->regex, name, vn->captures, vn->ncaptures);
+
+        if (n == NGX_REGEX_NO_MATCHED) {
+            continue;
+        }
+
+        if (n <= 0) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          ngx_regex_exec_n " failed: %i on \"%V\" "
+                          "using regex server names", n, name);
+            return NGX_ERROR;
+        }
+
+        /* the highest group set belongs to the name matched */
+
+        lo = 0;
+        hi = set->last - set->first - 1;
+
+        while (lo < hi) {
+            mid = (lo + hi + 1) / 2;
+
+            if (set->groups[mid] < (ngx_uint_t) n) {
+                lo = mid;
+
+            } else {
+                hi = mid - 1;
+            }
+        }
+
+        i = set->first + lo;
+
+        goto found;
+    }
+
+    i = vn->nregex;
+
+    goto cache;
+
+found:
+
+    if (sn[i].regex->ncaptures) {
+        n = ngx_http_regex_exec(r, sn[i].regex, name);
+
+        if (n != NGX_OK) {
+            if (n == NGX_DECLINED) {
+                ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                              "regex server name \"%V\" does not match "
+                              "\"%V\" again", &sn[i].name, name);
+            }
+
+            return NGX_ERROR;
+        }
+    }
+
+cache:
+
+    if (name->len <= NGX_HTTP_SERVER_NAME_CACHE_LEN) {
+        cache->hash = (uint32_t) key;
+        cache->regex = (i == vn->nregex) ? 0 : i + 1;
+        cache->len = (u_char) name->len;
+        ngx_memcpy(cache->name, name->data, name->len);
+    }
+
+    return (i == vn->nregex) ? NGX_DECLINED : (ngx_int_t) i;
+}
+
+#endif
+
+
 static void
 ngx_http_request_handler(ngx_event_t *ev)
 {
@@ -2211,6 +2493,19 @@ ngx_http_finalize_connection(ngx_http_request_t *r)
         return;
     }
 
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+        ngx_http_close_request(r, 0);
+        return;
+    }
+#endif
+
+    if (r->reading_body) {
+        /* the rest of an unbuffered request body is still in the socket */
+        r->keepalive = 0;
+        r->lingering_close = 1;
+    }
+
     if (!ngx_terminate
          && !ngx_exiting
          && r->keepalive
@@ -2394,6 +2689,19 @@ ngx_http_test_reading(ngx_http_request_t *r)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http test reading");
 
+#if (NGX_HTTP_V2)
+
+    if (r->stream) {
+        if (c->error) {
+            err = 0;
+            goto closed;
+        }
+
+        return;
+    }
+
+#endif
+
 #if (NGX_HAVE_KQUEUE)
 
     if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
@@ -3014,12 +3322,19 @@ ngx_http_close_request(ngx_http_request_t *r, ngx_int_t rc)
         return;
     }
 
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+        ngx_http_v2_close_stream(r->stream, rc);
+        return;
+    }
+#endif
+
     ngx_http_free_request(r, rc);
     ngx_http_close_connection(c);
 }
 
 
-static void
+void
 ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
 {
     ngx_log_t                 *log;
@@ -3059,13 +3374,21 @@ ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
         r->headers_out.status = rc;
     }
 
+    if (r->timing) {
+        ngx_http_timing_done(r->timing);
+    }
+
+#if (NGX_STAT_STUB)
+    ngx_http_stat_request(r);
+#endif
+
     log->action = "logging request";
 
     ngx_http_log_request(r);
 
     log->action = "closing request";
 
-    if (r->connection->timedout) {
+    if (r->connection->timedout && r->connection->fd != (ngx_socket_t) -1) {
         clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
         if (clcf->reset_timedout_connection) {
@@ -3093,6 +3416,116 @@ ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
 }
 
 
+static void
+ngx_http_init_timing(ngx_http_request_t *r, ngx_http_core_main_conf_t *cmcf)
+{
+    static ngx_uint_t  requests;
+
+    if (requests++ % cmcf->timing) {
+        return;
+    }
+
+    r->timing = ngx_pcalloc(r->pool, sizeof(ngx_http_timing_t));
+    if (r->timing == NULL) {
+        return;
+    }
+
+    r->timing->start = ngx_time_usec();
+    r->timing->migrate = ngx_popcorn_migrate_usec;
+}
+
+
+/*
+ * the parse timer runs from the creation of the request until its header
+ * is read and parsed or the request is finalized before that
+ */
+
+static void
+ngx_http_timing_parsed(ngx_http_timing_t *t)
+{
+    ngx_usec_t  now;
+
+    if (t->start == 0) {
+        return;
+    }
+
+    now = ngx_time_usec();
+
+    if (now > t->start) {
+        t->usec[NGX_HTTP_TIMING_PARSE] = now - t->start;
+        t->total += t->usec[NGX_HTTP_TIMING_PARSE];
+    }
+
+    t->start = 0;
+}
+
+
+static void
+ngx_http_timing_done(ngx_http_timing_t *t)
+{
+    ngx_http_timing_parsed(t);
+
+    t->usec[NGX_HTTP_TIMING_MIGRATE] = ngx_popcorn_migrate_usec - t->migrate;
+}
+
+
+#if (NGX_STAT_STUB)
+
+static void
+ngx_http_stat_request(ngx_http_request_t *r)
+{
+    ngx_uint_t          n, i, status;
+    ngx_msec_t          ms;
+    ngx_usec_t          us;
+    ngx_time_t         *tp;
+    ngx_http_timing_t  *t;
+
+    status = r->headers_out.status / 100;
+
+    if (status > 5) {
+        status = 0;
+    }
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_t)
+             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+
+    /* log2 buckets: 0, 1, 2-3, 4-7 ... milliseconds */
+
+    for (n = 0; ms && n < NGX_STAT_MSEC_BUCKETS - 1; n++) {
+        ms >>= 1;
+    }
+
+    (void) ngx_atomic_fetch_add(&ngx_stat->bytes_in, r->request_length);
+    (void) ngx_atomic_fetch_add(&ngx_stat->bytes_out, r->connection->sent);
+    (void) ngx_atomic_fetch_add(&ngx_stat->status[status], 1);
+    (void) ngx_atomic_fetch_add(&ngx_stat->msec[n], 1);
+
+    t = r->timing;
+
+    if (t == NULL) {
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&ngx_stat->timed, 1);
+
+    /* log2 buckets: 0, 1, 2-3, 4-7 ... microseconds */
+
+    for (i = 0; i < NGX_HTTP_TIMING_N; i++) {
+        us = t->usec[i];
+
+        for (n = 0; us && n < NGX_STAT_USEC_BUCKETS - 1; n++) {
+            us >>= 1;
+        }
+
+        (void) ngx_atomic_fetch_add(&ngx_stat->usec[i][n], 1);
+    }
+}
+
+#endif
+
+
 static void
 ngx_http_log_request(ngx_http_request_t *r)
 {
@@ -3111,7 +3544,7 @@ ngx_http_log_request(ngx_http_request_t *r)
 }
 
 
-static void
+void
 ngx_http_close_connection(ngx_connection_t *c)
 {
     ngx_pool_t  *pool;
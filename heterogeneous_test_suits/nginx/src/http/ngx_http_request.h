@@ -23,6 +23,7 @@
 #define NGX_HTTP_VERSION_9                 9
 #define NGX_HTTP_VERSION_10                1000
 #define NGX_HTTP_VERSION_11                1001
+#define NGX_HTTP_VERSION_20                2000
 
 #define NGX_HTTP_UNKNOWN                   0x0001
 #define NGX_HTTP_GET                       0x0002
@@ -165,6 +166,18 @@ typedef struct {
 } ngx_http_header_out_t;
 
 
+/*
+ * constant response headers serialized at configuration time:
+ * "text" is copied into the response header as is, "part" holds
+ * the same headers for the $sent_http_... variables
+ */
+
+typedef struct {
+    ngx_str_t                         text;
+    ngx_list_part_t                   part;
+} ngx_http_header_block_t;
+
+
 typedef struct {
     ngx_list_t                        headers;
 
@@ -254,6 +267,8 @@ typedef struct {
     ngx_table_elt_t                  *expires;
     ngx_table_elt_t                  *etag;
 
+    ngx_http_header_block_t          *header_block;
+
     ngx_str_t                        *override_charset;
 
     size_t                            content_type_len;
@@ -300,11 +315,50 @@ typedef struct {
 typedef struct ngx_http_server_name_s  ngx_http_server_name_t;
 
 
+#if (NGX_PCRE)
+
+/*
+ * the regex server names from "first" up to "last" compiled into one
+ * alternation, "groups" has the group that wraps each of them;
+ * the names of a set without regex are tested one by one
+ */
+
+typedef struct {
+    ngx_regex_t                      *regex;
+    ngx_uint_t                        first;
+    ngx_uint_t                        last;
+    ngx_uint_t                       *groups;
+} ngx_http_server_name_set_t;
+
+
+#define NGX_HTTP_SERVER_NAME_CACHE_SIZE  512
+#define NGX_HTTP_SERVER_NAME_CACHE_LEN   119
+
+typedef struct {
+    uint32_t                          hash;
+    uint32_t                          regex;    /* the name index + 1 or 0 */
+    u_char                            len;
+    u_char                            name[NGX_HTTP_SERVER_NAME_CACHE_LEN];
+} ngx_http_server_name_cache_t;
+
+#endif
+
+
 typedef struct {
      ngx_hash_combined_t              names;
 
      ngx_uint_t                       nregex;
      ngx_http_server_name_t          *regex;
+
+#if (NGX_PCRE)
+     ngx_uint_t                       nsets;
+     ngx_http_server_name_set_t      *sets;
+     int                             *captures;
+     ngx_uint_t                       ncaptures;
+
+     /* the recent hosts looked up by the regex names, private to a worker */
+     ngx_http_server_name_cache_t    *cache;
+#endif
 } ngx_http_virtual_names_t;
 
 
@@ -345,6 +399,31 @@ struct ngx_http_posted_request_s {
 };
 
 
+#define NGX_HTTP_TIMING_PARSE             0
+#define NGX_HTTP_TIMING_REWRITE           1
+#define NGX_HTTP_TIMING_ACCESS            2
+#define NGX_HTTP_TIMING_CONTENT           3
+#define NGX_HTTP_TIMING_FILTER            4
+#define NGX_HTTP_TIMING_SEND              5
+#define NGX_HTTP_TIMING_MIGRATE           6
+#define NGX_HTTP_TIMING_N                 7
+
+
+/*
+ * the microseconds a sampled request has spent in each part of its work,
+ * a timer does not count the time of the timers nested in it: the content
+ * phase handlers send the response through the filters, the filters send
+ * it to the client
+ */
+
+typedef struct {
+    ngx_usec_t                        usec[NGX_HTTP_TIMING_N];
+    ngx_usec_t                        total;      /* of usec[] */
+    ngx_usec_t                        start;
+    ngx_usec_t                        migrate;    /* at the start */
+} ngx_http_timing_t;
+
+
 typedef ngx_int_t (*ngx_http_handler_pt)(ngx_http_request_t *r);
 typedef void (*ngx_http_event_handler_pt)(ngx_http_request_t *r);
 
@@ -382,6 +461,8 @@ struct ngx_http_request_s {
     time_t                            start_sec;
     ngx_msec_t                        start_msec;
 
+    ngx_http_timing_t                *timing;
+
     ngx_uint_t                        method;
     ngx_uint_t                        http_version;
 
@@ -425,6 +506,9 @@ struct ngx_http_request_s {
     ngx_uint_t                        err_status;
 
     ngx_http_connection_t            *http_connection;
+#if (NGX_HTTP_V2)
+    ngx_http_v2_stream_t             *stream;
+#endif
 
     ngx_http_log_handler_pt           log_handler;
 
@@ -464,9 +548,11 @@ struct ngx_http_request_s {
     unsigned                          request_body_in_clean_file:1;
     unsigned                          request_body_file_group_access:1;
     unsigned                          request_body_file_log_level:3;
+    unsigned                          request_body_no_buffering:1;
 
     unsigned                          subrequest_in_memory:1;
     unsigned                          waited:1;
+    unsigned                          reading_body:1;
 
 #if (NGX_HTTP_CACHE)
     unsigned                          cached:1;
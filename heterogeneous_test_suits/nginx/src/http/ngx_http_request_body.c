@@ -13,6 +13,11 @@
 static void ngx_http_read_client_request_body_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_do_read_client_request_body(ngx_http_request_t *r);
 static ngx_int_t ngx_http_write_request_body(ngx_http_request_t *r);
+#if (NGX_HAVE_PTHREAD)
+static ngx_int_t ngx_http_request_body_thread_handler(ngx_thread_task_t *task,
+    ngx_file_t *file);
+static void ngx_http_request_body_thread_event_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_http_read_discarded_request_body(ngx_http_request_t *r);
 static ngx_int_t ngx_http_discard_request_body_filter(ngx_http_request_t *r,
     ngx_buf_t *b);
@@ -46,6 +51,14 @@ ngx_http_read_client_request_body(ngx_http_request_t *r,
         return NGX_OK;
     }
 
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+        r->request_body_no_buffering = 0;
+        rc = ngx_http_v2_read_request_body(r, post_handler);
+        goto done;
+    }
+#endif
+
     if (ngx_http_test_expect(r) != NGX_OK) {
         rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
         goto done;
@@ -72,7 +85,13 @@ ngx_http_read_client_request_body(ngx_http_request_t *r,
 
     r->request_body = rb;
 
+    if (r->headers_in.chunked) {
+        /* the unbuffered body is sent as is, its length must be known */
+        r->request_body_no_buffering = 0;
+    }
+
     if (r->headers_in.content_length_n < 0 && !r->headers_in.chunked) {
+        r->request_body_no_buffering = 0;
         post_handler(r);
         return NGX_OK;
     }
@@ -123,11 +142,18 @@ ngx_http_read_client_request_body(ngx_http_request_t *r,
     if (rb->rest == 0) {
         /* the whole request body was pre-read */
 
+        r->request_body_no_buffering = 0;
+
         if (r->request_body_in_file_only) {
-            if (ngx_http_write_request_body(r) != NGX_OK) {
-                rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
-                goto done;
-            }
+
+            /* the file is written as the last part, possibly in a thread */
+
+            rb->buf = r->header_in;
+            r->read_event_handler = ngx_http_read_client_request_body_handler;
+            r->write_event_handler = ngx_http_request_empty_handler;
+
+            rc = ngx_http_do_read_client_request_body(r);
+            goto done;
         }
 
         post_handler(r);
@@ -173,6 +199,24 @@ ngx_http_read_client_request_body(ngx_http_request_t *r,
 
 done:
 
+    if (r->request_body_no_buffering && (rc == NGX_OK || rc == NGX_AGAIN)) {
+
+        /*
+         * the post handler starts to send the body before it is read,
+         * the rest is read by ngx_http_read_unbuffered_request_body()
+         */
+
+        if (rc == NGX_OK) {
+            r->request_body_no_buffering = 0;
+
+        } else {
+            r->reading_body = 1;
+        }
+
+        r->read_event_handler = ngx_http_block_reading;
+        post_handler(r);
+    }
+
     if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
         r->main->count--;
     }
@@ -181,11 +225,36 @@ done:
 }
 
 
+ngx_int_t
+ngx_http_read_unbuffered_request_body(ngx_http_request_t *r)
+{
+    ngx_int_t  rc;
+
+    if (r->connection->read->timedout) {
+        r->connection->timedout = 1;
+        return NGX_HTTP_REQUEST_TIME_OUT;
+    }
+
+    rc = ngx_http_do_read_client_request_body(r);
+
+    if (rc == NGX_OK) {
+        r->reading_body = 0;
+    }
+
+    return rc;
+}
+
+
 static void
 ngx_http_read_client_request_body_handler(ngx_http_request_t *r)
 {
     ngx_int_t  rc;
 
+    if (r->aio) {
+        /* the temp file write is in progress */
+        return;
+    }
+
     if (r->connection->read->timedout) {
         r->connection->timedout = 1;
         ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
@@ -221,23 +290,44 @@ ngx_http_do_read_client_request_body(ngx_http_request_t *r)
 
     for ( ;; ) {
         for ( ;; ) {
+            if (rb->rest == 0) {
+                /* the whole body has been read, the last part is written */
+                break;
+            }
+
             if (rb->buf->last == rb->buf->end) {
 
-                /* pass buffer to request body filter chain */
+                if (rb->buf->pos != rb->buf->last) {
 
-                out.buf = rb->buf;
-                out.next = NULL;
+                    /* pass buffer to request body filter chain */
 
-                rc = ngx_http_request_body_filter(r, &out);
+                    out.buf = rb->buf;
+                    out.next = NULL;
 
-                if (rc != NGX_OK) {
-                    return rc;
+                    rc = ngx_http_request_body_filter(r, &out);
+
+                    if (rc != NGX_OK) {
+                        return rc;
+                    }
                 }
 
-                /* write to file */
+                if (!r->request_body_no_buffering) {
 
-                if (ngx_http_write_request_body(r) != NGX_OK) {
-                    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+                    /* write to file */
+
+                    rc = ngx_http_write_request_body(r);
+
+                    if (rc == NGX_AGAIN) {
+                        if (c->read->timer_set) {
+                            ngx_del_timer(c->read);
+                        }
+
+                        return NGX_AGAIN;
+                    }
+
+                    if (rc != NGX_OK) {
+                        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+                    }
                 }
 
                 /* update chains */
@@ -249,6 +339,22 @@ ngx_http_do_read_client_request_body(ngx_http_request_t *r)
                 }
 
                 if (rb->busy != NULL) {
+
+                    if (r->request_body_no_buffering) {
+
+                        /* the upstream has not sent the buffer yet */
+
+                        if (c->read->timer_set) {
+                            ngx_del_timer(c->read);
+                        }
+
+                        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+                        }
+
+                        return NGX_AGAIN;
+                    }
+
                     return NGX_HTTP_INTERNAL_SERVER_ERROR;
                 }
 
@@ -315,6 +421,22 @@ ngx_http_do_read_client_request_body(ngx_http_request_t *r)
         }
 
         if (!c->read->ready) {
+
+            if (r->request_body_no_buffering
+                && rb->buf->pos != rb->buf->last)
+            {
+                /* pass what has been read so far to the upstream */
+
+                out.buf = rb->buf;
+                out.next = NULL;
+
+                rc = ngx_http_request_body_filter(r, &out);
+
+                if (rc != NGX_OK) {
+                    return rc;
+                }
+            }
+
             clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
             ngx_add_timer(c->read, clcf->client_body_timeout);
 
@@ -330,11 +452,21 @@ ngx_http_do_read_client_request_body(ngx_http_request_t *r)
         ngx_del_timer(c->read);
     }
 
+    if (r->request_body_no_buffering) {
+        return NGX_OK;
+    }
+
     if (rb->temp_file || r->request_body_in_file_only) {
 
         /* save the last part */
 
-        if (ngx_http_write_request_body(r) != NGX_OK) {
+        rc = ngx_http_write_request_body(r);
+
+        if (rc == NGX_AGAIN) {
+            return NGX_AGAIN;
+        }
+
+        if (rc != NGX_OK) {
             return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
 
@@ -397,6 +529,14 @@ ngx_http_write_request_body(ngx_http_request_t *r)
             tf->access = 0660;
         }
 
+#if (NGX_HAVE_PTHREAD)
+        if (clcf->aio == NGX_HTTP_AIO_THREADS && clcf->aio_write) {
+            tf->file.thread_handler = ngx_http_request_body_thread_handler;
+            tf->file.thread_ctx = r;
+            tf->thread_write = 1;
+        }
+#endif
+
         rb->temp_file = tf;
 
         if (rb->bufs == NULL) {
@@ -425,6 +565,10 @@ ngx_http_write_request_body(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+    if (n == NGX_AGAIN) {
+        return NGX_AGAIN;
+    }
+
     rb->temp_file->offset += n;
 
     /* mark all buffers as written */
@@ -439,6 +583,48 @@ ngx_http_write_request_body(ngx_http_request_t *r)
 }
 
 
+#if (NGX_HAVE_PTHREAD)
+
+static ngx_int_t
+ngx_http_request_body_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    r = file->thread_ctx;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    task->event.data = r;
+    task->event.handler = ngx_http_request_body_thread_event_handler;
+
+    if (ngx_thread_task_post(clcf->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_request_body_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->connection->read->handler(r->connection->read);
+}
+
+#endif
+
+
 ngx_int_t
 ngx_http_discard_request_body(ngx_http_request_t *r)
 {
@@ -450,6 +636,13 @@ ngx_http_discard_request_body(ngx_http_request_t *r)
         return NGX_OK;
     }
 
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+        r->stream->skip_data = 1;
+        return NGX_OK;
+    }
+#endif
+
     if (ngx_http_test_expect(r) != NGX_OK) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
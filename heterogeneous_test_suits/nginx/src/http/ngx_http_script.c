@@ -10,6 +10,10 @@
 #include <ngx_http.h>
 
 
+static ngx_int_t ngx_http_complex_value_parts(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val, ngx_str_t *value);
+static ngx_int_t ngx_http_script_compile_parts(ngx_conf_t *cf,
+    ngx_http_complex_value_t *cv);
 static ngx_int_t ngx_http_script_init_arrays(ngx_http_script_compile_t *sc);
 static ngx_int_t ngx_http_script_done(ngx_http_script_compile_t *sc);
 static ngx_int_t ngx_http_script_add_copy_code(ngx_http_script_compile_t *sc,
@@ -68,6 +72,10 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
         return NGX_OK;
     }
 
+    if (val->parts) {
+        return ngx_http_complex_value_parts(r, val, value);
+    }
+
     ngx_http_script_flush_complex_value(r, val);
 
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
@@ -104,6 +112,66 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 }
 
 
+static ngx_int_t
+ngx_http_complex_value_parts(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val, ngx_str_t *value)
+{
+    u_char                     *p;
+    size_t                      len;
+    ngx_uint_t                  i;
+    ngx_http_script_part_t     *part;
+    ngx_http_variable_value_t  *vv;
+
+    ngx_http_script_flush_complex_value(r, val);
+
+    part = val->parts;
+    len = 0;
+
+    for (i = 0; i < val->nparts; i++) {
+
+        if (part[i].text.data) {
+            len += part[i].text.len;
+            continue;
+        }
+
+        vv = ngx_http_get_indexed_variable(r, part[i].index);
+
+        if (vv && !vv->not_found) {
+            len += vv->len;
+        }
+    }
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    value->len = len;
+    value->data = p;
+
+    for (i = 0; i < val->nparts; i++) {
+
+        if (part[i].text.data) {
+            p = ngx_copy(p, part[i].text.data, part[i].text.len);
+            continue;
+        }
+
+        /* the values are cached by the first pass */
+
+        vv = ngx_http_get_indexed_variable(r, part[i].index);
+
+        if (vv && !vv->not_found) {
+            p = ngx_copy(p, vv->data, vv->len);
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http complex value: \"%V\"", value);
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
 {
@@ -147,6 +215,8 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->flushes = NULL;
     ccv->complex_value->lengths = NULL;
     ccv->complex_value->values = NULL;
+    ccv->complex_value->parts = NULL;
+    ccv->complex_value->nparts = 0;
 
     if (nv == 0 && nc == 0) {
         return NGX_OK;
@@ -208,6 +278,78 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->lengths = lengths.elts;
     ccv->complex_value->values = values.elts;
 
+    return ngx_http_script_compile_parts(ccv->cf, ccv->complex_value);
+}
+
+
+/*
+ * Most complex values are texts and variables only, e.g. "$host$uri".
+ * They are flattened into a list of parts that ngx_http_complex_value()
+ * walks without the length and value code passes of the script engine.
+ * Values with captures or prefixes keep using the codes.
+ */
+
+static ngx_int_t
+ngx_http_script_compile_parts(ngx_conf_t *cf, ngx_http_complex_value_t *cv)
+{
+    u_char                       *ip;
+    ngx_uint_t                    n;
+    ngx_http_script_code_pt       code;
+    ngx_http_script_part_t       *part;
+    ngx_http_script_var_code_t   *vc;
+    ngx_http_script_copy_code_t  *cc;
+
+    n = 0;
+
+    for (ip = cv->values; *(uintptr_t *) ip; n++) {
+        code = *(ngx_http_script_code_pt *) ip;
+
+        if (code == ngx_http_script_copy_code) {
+            cc = (ngx_http_script_copy_code_t *) ip;
+            ip += sizeof(ngx_http_script_copy_code_t)
+                  + ((cc->len + sizeof(uintptr_t) - 1)
+                     & ~(sizeof(uintptr_t) - 1));
+
+        } else if (code == ngx_http_script_copy_var_code) {
+            ip += sizeof(ngx_http_script_var_code_t);
+
+        } else {
+            return NGX_OK;
+        }
+    }
+
+    part = ngx_palloc(cf->pool, n * sizeof(ngx_http_script_part_t));
+    if (part == NULL) {
+        return NGX_ERROR;
+    }
+
+    cv->parts = part;
+    cv->nparts = n;
+
+    for (ip = cv->values; *(uintptr_t *) ip; part++) {
+        code = *(ngx_http_script_code_pt *) ip;
+
+        if (code == ngx_http_script_copy_code) {
+            cc = (ngx_http_script_copy_code_t *) ip;
+
+            part->text.len = cc->len;
+            part->text.data = ip + sizeof(ngx_http_script_copy_code_t);
+            part->index = 0;
+
+            ip += sizeof(ngx_http_script_copy_code_t)
+                  + ((cc->len + sizeof(uintptr_t) - 1)
+                     & ~(sizeof(uintptr_t) - 1));
+
+        } else {
+            vc = (ngx_http_script_var_code_t *) ip;
+
+            ngx_str_null(&part->text);
+            part->index = vc->index;
+
+            ip += sizeof(ngx_http_script_var_code_t);
+        }
+    }
+
     return NGX_OK;
 }
 
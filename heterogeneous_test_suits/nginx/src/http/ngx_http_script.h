@@ -63,11 +63,23 @@ typedef struct {
 } ngx_http_script_compile_t;
 
 
+/* a literal text or, if text.data is NULL, a variable */
+
+typedef struct {
+    ngx_str_t                   text;
+    ngx_uint_t                  index;
+} ngx_http_script_part_t;
+
+
 typedef struct {
     ngx_str_t                   value;
     ngx_uint_t                 *flushes;
     void                       *lengths;
     void                       *values;
+
+    /* the values code as a plain list if it has only texts and variables */
+    ngx_http_script_part_t     *parts;
+    ngx_uint_t                  nparts;
 } ngx_http_complex_value_t;
 
 
@@ -30,9 +30,12 @@ static void ngx_http_upstream_connect(ngx_http_request_t *r,
 static ngx_int_t ngx_http_upstream_reinit(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_send_request(ngx_http_request_t *r,
-    ngx_http_upstream_t *u);
+    ngx_http_upstream_t *u, ngx_uint_t do_write);
+static ngx_int_t ngx_http_upstream_send_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_uint_t do_write);
 static void ngx_http_upstream_send_request_handler(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static void ngx_http_upstream_read_request_handler(ngx_http_request_t *r);
 static void ngx_http_upstream_process_header(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_test_next(ngx_http_request_t *r,
@@ -54,6 +57,15 @@ static void
 static void
     ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
     ngx_uint_t do_write);
+#if (NGX_HAVE_SPLICE)
+static ngx_uint_t ngx_http_upstream_can_splice(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, off_t length);
+static ngx_int_t ngx_http_upstream_init_splice(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_splice(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_splice_cleanup(void *data);
+#endif
 static ngx_int_t ngx_http_upstream_non_buffered_filter_init(void *data);
 static ngx_int_t ngx_http_upstream_non_buffered_filter(void *data,
     ssize_t bytes);
@@ -477,12 +489,13 @@ ngx_http_upstream_init_request(ngx_http_request_t *r)
             return;
         }
 
-        r->write_event_handler = ngx_http_request_empty_handler;
-
         if (rc == NGX_DONE) {
+            /* the cached response may be still streamed */
             return;
         }
 
+        r->write_event_handler = ngx_http_request_empty_handler;
+
         if (rc != NGX_DECLINED) {
             ngx_http_finalize_request(r, rc);
             return;
@@ -729,6 +742,10 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
             u->cache_status = rc;
             rc = NGX_OK;
 
+        } else if (c->lock) {
+            u->cache_status = NGX_HTTP_CACHE_EXPIRED;
+            rc = ngx_http_file_cache_relock(r);
+
         } else {
             rc = NGX_HTTP_CACHE_STALE;
         }
@@ -991,6 +1008,12 @@ ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
         return;
     }
 
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+        return;
+    }
+#endif
+
 #if (NGX_HAVE_KQUEUE)
 
     if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
@@ -1231,7 +1254,7 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
 #endif
 
-    ngx_http_upstream_send_request(r, u);
+    ngx_http_upstream_send_request(r, u, 1);
 }
 
 
@@ -1294,7 +1317,7 @@ ngx_http_upstream_ssl_handshake(ngx_connection_t *c)
         c->write->handler = ngx_http_upstream_handler;
         c->read->handler = ngx_http_upstream_handler;
 
-        ngx_http_upstream_send_request(r, u);
+        ngx_http_upstream_send_request(r, u, 1);
 
         return;
     }
@@ -1374,7 +1397,8 @@ ngx_http_upstream_reinit(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
 
 static void
-ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
+ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    ngx_uint_t do_write)
 {
     ngx_int_t          rc;
     ngx_connection_t  *c;
@@ -1391,21 +1415,28 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     c->log->action = "sending request to upstream";
 
-    rc = ngx_output_chain(&u->output, u->request_sent ? NULL : u->request_bufs);
-
-    u->request_sent = 1;
+    rc = ngx_http_upstream_send_request_body(r, u, do_write);
 
     if (rc == NGX_ERROR) {
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
         return;
     }
 
-    if (c->write->timer_set) {
-        ngx_del_timer(c->write);
+    if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+        ngx_http_upstream_finalize_request(r, u, rc);
+        return;
     }
 
     if (rc == NGX_AGAIN) {
-        ngx_add_timer(c->write, u->conf->send_timeout);
+
+        /* no send timer while only the client body is awaited */
+
+        if (!c->write->ready) {
+            ngx_add_timer(c->write, u->conf->send_timeout);
+
+        } else if (c->write->timer_set) {
+            ngx_del_timer(c->write);
+        }
 
         if (ngx_handle_write_event(c->write, u->conf->send_lowat) != NGX_OK) {
             ngx_http_upstream_finalize_request(r, u,
@@ -1418,6 +1449,10 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     /* rc == NGX_OK */
 
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
     if (c->tcp_nopush == NGX_TCP_NOPUSH_SET) {
         if (ngx_tcp_push(c->fd) == NGX_ERROR) {
             ngx_log_error(NGX_LOG_CRIT, c->log, ngx_socket_errno,
@@ -1492,7 +1527,123 @@ ngx_http_upstream_send_request_handler(ngx_http_request_t *r,
         return;
     }
 
-    ngx_http_upstream_send_request(r, u);
+    ngx_http_upstream_send_request(r, u, 1);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_send_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_uint_t do_write)
+{
+    ngx_int_t     rc;
+    ngx_chain_t  *out, *cl, *ln;
+
+    if (!r->request_body_no_buffering) {
+
+        /* buffered request body */
+
+        if (!u->request_sent) {
+            u->request_sent = 1;
+            out = u->request_bufs;
+
+        } else {
+            out = NULL;
+        }
+
+        return ngx_output_chain(&u->output, out);
+    }
+
+    if (!u->request_sent) {
+        u->request_sent = 1;
+        out = u->request_bufs;
+
+        if (r->request_body->bufs) {
+            for (cl = out; cl->next; cl = cl->next) { /* void */ }
+
+            cl->next = r->request_body->bufs;
+            r->request_body->bufs = NULL;
+        }
+
+        r->read_event_handler = ngx_http_upstream_read_request_handler;
+
+    } else {
+        out = NULL;
+    }
+
+    for ( ;; ) {
+
+        if (do_write) {
+            rc = ngx_output_chain(&u->output, out);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            while (out) {
+                ln = out;
+                out = out->next;
+                ngx_free_chain(r->pool, ln);
+            }
+
+            if (rc == NGX_OK && !r->reading_body) {
+                break;
+            }
+        }
+
+        if (r->reading_body) {
+
+            /* read more of the client body while the upstream accepts it */
+
+            rc = ngx_http_read_unbuffered_request_body(r);
+
+            if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+                return rc;
+            }
+
+            out = r->request_body->bufs;
+            r->request_body->bufs = NULL;
+        }
+
+        /* stop if there is nothing to send */
+
+        if (out == NULL) {
+            rc = NGX_AGAIN;
+            break;
+        }
+
+        do_write = 1;
+    }
+
+    if (!r->reading_body) {
+        if (!u->store && !r->post_action && !u->conf->ignore_client_abort) {
+            r->read_event_handler =
+                                  ngx_http_upstream_rd_check_broken_connection;
+        }
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_http_upstream_read_request_handler(ngx_http_request_t *r)
+{
+    ngx_connection_t     *c;
+    ngx_http_upstream_t  *u;
+
+    c = r->connection;
+    u = r->upstream;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream read request handler");
+
+    if (c->read->timedout) {
+        c->timedout = 1;
+        ngx_http_upstream_finalize_request(r, u, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    ngx_http_upstream_send_request(r, u, 0);
 }
 
 
@@ -2073,7 +2224,9 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
         if (u->cacheable || u->store) {
 
-            if (ngx_shutdown_socket(c->fd, NGX_WRITE_SHUTDOWN) == -1) {
+            if (c->fd != (ngx_socket_t) -1
+                && ngx_shutdown_socket(c->fd, NGX_WRITE_SHUTDOWN) == -1)
+            {
                 ngx_connection_error(c, ngx_socket_errno,
                                      ngx_shutdown_socket_n " failed");
             }
@@ -2097,6 +2250,30 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
+#if (NGX_HAVE_SPLICE)
+
+    /*
+     * a buffered body that would reach the client unchanged is spliced
+     * as well, the pipe sized to the buffers replaces the event pipe with
+     * its user space buffers and temporary files
+     */
+
+    if (u->buffering
+        && !u->cacheable
+        && !u->store
+        && r->limit_rate == 0
+        && u->input_filter
+        && ngx_http_upstream_can_splice(r, u, u->headers_in.content_length_n))
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http upstream splice buffered body");
+
+        u->buffering = 0;
+        u->splice_buffered = 1;
+    }
+
+#endif
+
     if (!u->buffering) {
 
         if (u->input_filter == NULL) {
@@ -2116,6 +2293,13 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
             return;
         }
 
+#if (NGX_HAVE_SPLICE)
+        if (ngx_http_upstream_init_splice(r, u) == NGX_ERROR) {
+            ngx_http_upstream_finalize_request(r, u, 0);
+            return;
+        }
+#endif
+
         if (clcf->tcp_nodelay && c->tcp_nodelay == NGX_TCP_NODELAY_UNSET) {
             ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "tcp_nodelay");
 
@@ -2437,9 +2621,13 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
 
             if (u->busy_bufs == NULL) {
 
-                if (u->length == 0
-                    || upstream->read->eof
-                    || upstream->read->error)
+                if ((u->length == 0
+                     || upstream->read->eof
+                     || upstream->read->error)
+#if (NGX_HAVE_SPLICE)
+                    && u->splice_pending == 0
+#endif
+                   )
                 {
                     ngx_http_upstream_finalize_request(r, u, 0);
                     return;
@@ -2450,6 +2638,35 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
             }
         }
 
+#if (NGX_HAVE_SPLICE)
+
+        if (u->splice && u->busy_bufs == NULL && u->out_bufs == NULL) {
+
+            /* the header and the preread body must leave first */
+
+            if (r->out || downstream->buffered) {
+                if (ngx_http_output_filter(r, NULL) == NGX_ERROR) {
+                    ngx_http_upstream_finalize_request(r, u, 0);
+                    return;
+                }
+
+                if (r->out || downstream->buffered) {
+                    break;
+                }
+            }
+
+            rc = ngx_http_upstream_splice(r, u);
+
+            if (rc == NGX_ERROR || rc == NGX_DONE) {
+                ngx_http_upstream_finalize_request(r, u, 0);
+                return;
+            }
+
+            break;
+        }
+
+#endif
+
         size = b->end - b->last;
 
         if (size && upstream->read->ready) {
@@ -2509,6 +2726,208 @@ ngx_http_upstream_process_non_buffered_request(ngx_http_request_t *r,
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+/*
+ * an unbuffered body of a known length that no body filter needs to see
+ * is moved from the upstream socket to the client socket through a pipe,
+ * it is not copied to user space; a client connection with TLS qualifies
+ * only when the kernel encrypts its records
+ */
+
+static ngx_uint_t
+ngx_http_upstream_can_splice(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    off_t length)
+{
+    if (!u->conf->splice
+        || length <= 0
+        || r->headers_out.content_length_n != length
+        || r->chunked
+        || r != r->main
+        || r->filter_need_in_memory
+        || r->main_filter_need_in_memory
+        || u->ssl)
+    {
+        return 0;
+    }
+
+#if (NGX_HTTP_SSL)
+    if (r->connection->ssl && !r->connection->ssl->sendfile) {
+        return 0;
+    }
+#endif
+
+    return 1;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_splice(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_pool_cleanup_t  *cln;
+
+    if (!ngx_http_upstream_can_splice(r, u, u->length)) {
+        return NGX_DECLINED;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (pipe2(u->splice_pipe, O_NONBLOCK|O_CLOEXEC) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      "pipe2() failed");
+        return NGX_DECLINED;
+    }
+
+    cln->handler = ngx_http_upstream_splice_cleanup;
+    cln->data = u;
+
+#ifdef F_SETPIPE_SZ
+
+    /*
+     * a pipe that stands in for the proxy buffers holds as much, so that
+     * a slow client does not stall the upstream any earlier
+     */
+
+    if (u->splice_buffered
+        && fcntl(u->splice_pipe[1], F_SETPIPE_SZ,
+                 (int) (u->conf->bufs.num * u->conf->bufs.size)) == -1)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, ngx_errno,
+                       "fcntl(F_SETPIPE_SZ) failed");
+    }
+
+#endif
+
+    u->splice_pending = 0;
+    u->splice = 1;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream splice: %d %d",
+                   u->splice_pipe[0], u->splice_pipe[1]);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_splice(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    size_t             size;
+    ssize_t            n;
+    ngx_err_t          err;
+    ngx_connection_t  *downstream, *upstream;
+
+    downstream = r->connection;
+    upstream = u->peer.connection;
+
+    for ( ;; ) {
+
+        if (u->splice_pending) {
+
+            if (!downstream->write->ready) {
+                return NGX_AGAIN;
+            }
+
+            n = splice(u->splice_pipe[0], NULL, downstream->fd, NULL,
+                       u->splice_pending, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, downstream->log, 0,
+                           "splice to client: %z of %uz",
+                           n, u->splice_pending);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err == NGX_EAGAIN) {
+                    downstream->write->ready = 0;
+                    return NGX_AGAIN;
+                }
+
+                if (err == NGX_EINTR) {
+                    continue;
+                }
+
+                downstream->error = 1;
+                ngx_connection_error(downstream, err,
+                                     "splice() to client failed");
+                return NGX_ERROR;
+            }
+
+            u->splice_pending -= n;
+            downstream->sent += n;
+
+            continue;
+        }
+
+        if (u->length == 0 || upstream->read->eof) {
+            return NGX_DONE;
+        }
+
+        if (!upstream->read->ready) {
+            return NGX_AGAIN;
+        }
+
+        size = 65536;
+
+        if ((off_t) size > u->length) {
+            size = (size_t) u->length;
+        }
+
+        n = splice(upstream->fd, NULL, u->splice_pipe[1], NULL, size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, upstream->log, 0,
+                       "splice from upstream: %z of %uz", n, size);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EAGAIN) {
+                upstream->read->ready = 0;
+                return NGX_AGAIN;
+            }
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            upstream->read->error = 1;
+            ngx_connection_error(upstream, err,
+                                 "splice() from upstream failed");
+            return NGX_ERROR;
+        }
+
+        if (n == 0) {
+            upstream->read->eof = 1;
+            continue;
+        }
+
+        u->state->response_length += n;
+        u->splice_pending += n;
+        u->length -= n;
+
+        if (u->length == 0) {
+            u->keepalive = !u->headers_in.connection_close;
+        }
+    }
+}
+
+
+static void
+ngx_http_upstream_splice_cleanup(void *data)
+{
+    ngx_http_upstream_t  *u = data;
+
+    (void) close(u->splice_pipe[0]);
+    (void) close(u->splice_pipe[1]);
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_upstream_non_buffered_filter_init(void *data)
 {
@@ -2688,6 +3107,8 @@ ngx_http_upstream_process_request(ngx_http_request_t *r)
 
         if (u->cacheable) {
 
+            ngx_http_file_cache_fill(r, u->pipe->temp_file);
+
             if (p->upstream_done) {
                 ngx_http_file_cache_update(r, u->pipe->temp_file);
 
@@ -2888,7 +3309,12 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
     if (status) {
         u->state->status = status;
 
-        if (u->peer.tries == 0 || !(u->conf->next_upstream & ft_type)) {
+        /* the streamed request body cannot be sent again */
+
+        if (u->peer.tries == 0
+            || !(u->conf->next_upstream & ft_type)
+            || (u->request_sent && r->request_body_no_buffering))
+        {
 
 #if (NGX_HTTP_CACHE)
 
@@ -144,6 +144,7 @@ typedef struct {
     ngx_uint_t                       next_upstream;
     ngx_uint_t                       store_access;
     ngx_flag_t                       buffering;
+    ngx_flag_t                       splice;
     ngx_flag_t                       pass_request_headers;
     ngx_flag_t                       pass_request_body;
 
@@ -284,6 +285,11 @@ struct ngx_http_upstream_s {
     ngx_chain_t                     *busy_bufs;
     ngx_chain_t                     *free_bufs;
 
+#if (NGX_HAVE_SPLICE)
+    ngx_fd_t                         splice_pipe[2];
+    size_t                           splice_pending;
+#endif
+
     ngx_int_t                      (*input_filter_init)(void *data);
     ngx_int_t                      (*input_filter)(void *data, ssize_t bytes);
     void                            *input_filter_ctx;
@@ -322,6 +328,8 @@ struct ngx_http_upstream_s {
 
     unsigned                         buffering:1;
     unsigned                         keepalive:1;
+    unsigned                         splice:1;
+    unsigned                         splice_buffered:1;
 
     unsigned                         request_sent:1;
     unsigned                         header_sent:1;
@@ -12,8 +12,12 @@
 
 static ngx_int_t ngx_http_upstream_cmp_servers(const void *one,
     const void *two);
+static ngx_int_t ngx_http_upstream_rr_schedule(ngx_conf_t *cf,
+    ngx_http_upstream_rr_peers_t *peers);
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(
     ngx_http_upstream_rr_peer_data_t *rrp);
+static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_scheduled_peer(
+    ngx_http_upstream_rr_peer_data_t *rrp);
 
 #if (NGX_HTTP_SSL)
 
@@ -97,6 +101,10 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                  sizeof(ngx_http_upstream_rr_peer_t),
                  ngx_http_upstream_cmp_servers);
 
+        if (ngx_http_upstream_rr_schedule(cf, peers) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
         /* backup servers */
 
         n = 0;
@@ -155,6 +163,10 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                  sizeof(ngx_http_upstream_rr_peer_t),
                  ngx_http_upstream_cmp_servers);
 
+        if (ngx_http_upstream_rr_schedule(cf, backup) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
         return NGX_OK;
     }
 
@@ -210,12 +222,83 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
     us->peer.data = peers;
 
+    if (ngx_http_upstream_rr_schedule(cf, peers) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
     /* implicitly defined upstream has no backup servers */
 
     return NGX_OK;
 }
 
 
+/*
+ * with static weights the smooth weighted round robin repeats itself after
+ * total weight picks, so a period is run once here and the picks then cost
+ * O(1) instead of a scan over all the peers
+ */
+
+static ngx_int_t
+ngx_http_upstream_rr_schedule(ngx_conf_t *cf,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_int_t    total, *current;
+    ngx_uint_t   i, k, best, *schedule;
+
+    if (peers->number == 1) {
+        return NGX_OK;
+    }
+
+    total = 0;
+
+    for (i = 0; i < peers->number; i++) {
+        if (!peers->peer[i].down) {
+            total += peers->peer[i].weight;
+        }
+    }
+
+    if (total == 0 || total > NGX_HTTP_UPSTREAM_RR_SCHEDULE) {
+        return NGX_OK;
+    }
+
+    schedule = ngx_palloc(cf->pool, total * sizeof(ngx_uint_t));
+    if (schedule == NULL) {
+        return NGX_ERROR;
+    }
+
+    current = ngx_pcalloc(cf->temp_pool, peers->number * sizeof(ngx_int_t));
+    if (current == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (k = 0; k < (ngx_uint_t) total; k++) {
+
+        best = peers->number;
+
+        for (i = 0; i < peers->number; i++) {
+
+            if (peers->peer[i].down) {
+                continue;
+            }
+
+            current[i] += peers->peer[i].weight;
+
+            if (best == peers->number || current[i] > current[best]) {
+                best = i;
+            }
+        }
+
+        current[best] -= total;
+        schedule[k] = best;
+    }
+
+    peers->schedule = schedule;
+    peers->schedule_len = total;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_cmp_servers(const void *one, const void *two)
 {
@@ -430,7 +513,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     if (rrp->peers->single) {
         peer = &rrp->peers->peer[0];
 
-        if (peer->down) {
+        if (ngx_http_upstream_rr_peer_down(peer)) {
             goto failed;
         }
 
@@ -511,6 +594,10 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
     ngx_uint_t                    i, n;
     ngx_http_upstream_rr_peer_t  *peer, *best;
 
+    if (rrp->peers->schedule && rrp->peers->degraded == 0) {
+        return ngx_http_upstream_get_scheduled_peer(rrp);
+    }
+
     now = ngx_time();
 
     best = NULL;
@@ -527,7 +614,7 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 
         peer = &rrp->peers->peer[i];
 
-        if (peer->down) {
+        if (ngx_http_upstream_rr_peer_down(peer)) {
             continue;
         }
 
@@ -543,6 +630,10 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 
         if (peer->effective_weight < peer->weight) {
             peer->effective_weight++;
+
+        } else if (peer->degraded && peer->fails == 0) {
+            peer->degraded = 0;
+            rrp->peers->degraded--;
         }
 
         if (best == NULL || peer->current_weight > best->current_weight) {
@@ -570,6 +661,48 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 }
 
 
+static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_get_scheduled_peer(ngx_http_upstream_rr_peer_data_t *rrp)
+{
+    uintptr_t                      m;
+    ngx_uint_t                     i, k, n;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = rrp->peers;
+
+    /* only the peers already tried by this request are skipped */
+
+    for (k = 0; k < peers->schedule_len; k++) {
+
+        i = peers->schedule[peers->schedule_pos++];
+
+        if (peers->schedule_pos == peers->schedule_len) {
+            peers->schedule_pos = 0;
+        }
+
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (rrp->tried[n] & m) {
+            continue;
+        }
+
+        if (ngx_http_upstream_rr_peer_down(&peers->peer[i])) {
+            continue;
+        }
+
+        rrp->current = i;
+        rrp->tried[n] |= m;
+
+        peers->peer[i].checked = ngx_time();
+
+        return &peers->peer[i];
+    }
+
+    return NULL;
+}
+
+
 void
 ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     ngx_uint_t state)
@@ -608,6 +741,13 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
             peer->effective_weight -= peer->weight / peer->max_fails;
         }
 
+        /* the failures are accounted by the scan until the peer recovers */
+
+        if (!peer->degraded) {
+            peer->degraded = 1;
+            rrp->peers->degraded++;
+        }
+
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                        "free rr peer failed: %ui %i",
                        rrp->current, peer->effective_weight);
@@ -14,6 +14,13 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_UPSTREAM_RR_SCHEDULE  32768
+
+
+#define ngx_http_upstream_rr_peer_down(peer)                                  \
+    ((peer)->down || ((peer)->check && *(peer)->check))
+
+
 typedef struct {
     struct sockaddr                *sockaddr;
     socklen_t                       socklen;
@@ -31,6 +38,10 @@ typedef struct {
     time_t                          fail_timeout;
 
     ngx_uint_t                      down;          /* unsigned  down:1; */
+    ngx_uint_t                      degraded;      /* unsigned  degraded:1; */
+
+    /* the down flag published in shared memory by the health checks */
+    ngx_atomic_t                   *check;
 
 #if (NGX_HTTP_SSL)
     ngx_ssl_session_t              *ssl_session;   /* local to a process */
@@ -49,6 +60,15 @@ struct ngx_http_upstream_rr_peers_s {
 
     ngx_uint_t                      total_weight;
 
+    /*
+     * the smooth weighted round robin order of the peers precomputed
+     * for a period, it is followed while no peer is degraded by failures
+     */
+    ngx_uint_t                     *schedule;
+    ngx_uint_t                      schedule_len;
+    ngx_uint_t                      schedule_pos;
+    ngx_uint_t                      degraded;
+
     unsigned                        single:1;
     unsigned                        weighted:1;
 
@@ -0,0 +1,2997 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * A multiplexed connection is served by a state machine that reads whole
+ * frames from the socket.  Every stream gets a fake connection with fd -1
+ * whose send_chain() packs the response into DATA frames, and a regular
+ * request that runs through the usual phases and filters.  The frames of
+ * all streams are written from a single output queue ordered by weight.
+ */
+
+
+#define NGX_HTTP_V2_INDEX_SIZE             32
+#define ngx_http_v2_index(sid)  (((sid) >> 1) & (NGX_HTTP_V2_INDEX_SIZE - 1))
+
+#define NGX_HTTP_V2_CONTROL_FRAME_SIZE     (NGX_HTTP_V2_FRAME_HEADER_SIZE + 18)
+#define NGX_HTTP_V2_CONTROL_WEIGHT         257
+
+#define NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING        0x1
+#define NGX_HTTP_V2_ENABLE_PUSH_SETTING              0x2
+#define NGX_HTTP_V2_MAX_STREAMS_SETTING              0x3
+#define NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING         0x4
+#define NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING           0x5
+#define NGX_HTTP_V2_MAX_HEADER_LIST_SIZE_SETTING     0x6
+
+#define NGX_HTTP_V2_SETTINGS_PARAM_SIZE    6
+
+
+typedef struct {
+    u_char                          *pos;
+    size_t                           length;
+    ngx_uint_t                       flags;
+    ngx_uint_t                       sid;
+} ngx_http_v2_frame_t;
+
+
+typedef ngx_uint_t (*ngx_http_v2_handler_pt)(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f);
+
+
+static void ngx_http_v2_read_handler(ngx_event_t *rev);
+static void ngx_http_v2_write_handler(ngx_event_t *wev);
+static void ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c);
+static ngx_uint_t ngx_http_v2_process_input(ngx_http_v2_connection_t *h2c);
+
+static ngx_uint_t ngx_http_v2_read_data(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f);
+static ngx_uint_t ngx_http_v2_read_headers(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f);
+static ngx_uint_t ngx_http_v2_read_priority(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f);
+static ngx_uint_t ngx_http_v2_read_rst_stream(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f);
+static ngx_uint_t ngx_http_v2_read_settings(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f);
+static ngx_uint_t ngx_http_v2_read_push_promise(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f);
+static ngx_uint_t ngx_http_v2_read_ping(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f);
+static ngx_uint_t ngx_http_v2_read_goaway(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f);
+static ngx_uint_t ngx_http_v2_read_window_update(
+    ngx_http_v2_connection_t *h2c, ngx_http_v2_frame_t *f);
+static ngx_uint_t ngx_http_v2_read_continuation(
+    ngx_http_v2_connection_t *h2c, ngx_http_v2_frame_t *f);
+
+static ngx_uint_t ngx_http_v2_header_fragment(ngx_http_v2_connection_t *h2c,
+    u_char *pos, size_t size, ngx_uint_t end);
+static ngx_uint_t ngx_http_v2_process_header_block(
+    ngx_http_v2_connection_t *h2c, ngx_uint_t sid, u_char *pos, size_t size);
+static ngx_int_t ngx_http_v2_parse_int(u_char **pos, u_char *end,
+    ngx_uint_t prefix, ngx_uint_t *value);
+static ngx_int_t ngx_http_v2_parse_string(ngx_http_v2_connection_t *h2c,
+    u_char **pos, u_char *end, ngx_str_t *str, u_char *buf);
+static ngx_int_t ngx_http_v2_parse_field(ngx_http_v2_connection_t *h2c,
+    u_char **pos, u_char *end, ngx_http_v2_header_t *header);
+static ngx_int_t ngx_http_v2_state_header(ngx_http_v2_stream_t *stream,
+    ngx_http_v2_header_t *header);
+static ngx_int_t ngx_http_v2_pseudo_header(ngx_http_v2_stream_t *stream,
+    ngx_http_v2_header_t *header);
+static ngx_int_t ngx_http_v2_push_header(ngx_http_request_t *r,
+    ngx_str_t *name, ngx_str_t *value);
+static ngx_int_t ngx_http_v2_copy_str(ngx_pool_t *pool, ngx_str_t *dst,
+    ngx_str_t *src);
+static void ngx_http_v2_run_request(ngx_http_v2_stream_t *stream);
+static ngx_int_t ngx_http_v2_construct_request_line(ngx_http_request_t *r);
+static ngx_int_t ngx_http_v2_construct_cookie_header(ngx_http_request_t *r);
+
+static ngx_http_v2_stream_t *ngx_http_v2_create_stream(
+    ngx_http_v2_connection_t *h2c, ngx_uint_t sid);
+static ngx_http_v2_stream_t *ngx_http_v2_get_stream(
+    ngx_http_v2_connection_t *h2c, ngx_uint_t sid);
+static void ngx_http_v2_process_request_body(ngx_http_v2_stream_t *stream,
+    u_char *pos, size_t size, ngx_uint_t last);
+static void ngx_http_v2_finish_request_body(ngx_http_request_t *r);
+static void ngx_http_v2_read_client_request_body_handler(
+    ngx_http_request_t *r);
+
+static ngx_http_v2_out_frame_t *ngx_http_v2_get_control_frame(
+    ngx_http_v2_connection_t *h2c);
+static ngx_int_t ngx_http_v2_control_frame_handler(
+    ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
+static ngx_int_t ngx_http_v2_send_settings(ngx_http_v2_connection_t *h2c,
+    ngx_uint_t ack);
+static ngx_int_t ngx_http_v2_send_window_update(ngx_http_v2_connection_t *h2c,
+    ngx_uint_t sid, size_t window);
+static ngx_int_t ngx_http_v2_send_rst_stream(ngx_http_v2_connection_t *h2c,
+    ngx_uint_t sid, ngx_uint_t status);
+static ngx_int_t ngx_http_v2_send_goaway(ngx_http_v2_connection_t *h2c,
+    ngx_uint_t status);
+
+static ngx_uint_t ngx_http_v2_stream_error(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_stream_t *stream, ngx_uint_t status);
+static void ngx_http_v2_terminate_stream(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_stream_t *stream);
+static void ngx_http_v2_close_stream_handler(ngx_event_t *ev);
+static void ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
+    ngx_uint_t status);
+
+static ngx_int_t ngx_http_v2_add_variables(ngx_conf_t *cf);
+static ngx_int_t ngx_http_v2_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static void *ngx_http_v2_create_srv_conf(ngx_conf_t *cf);
+static char *ngx_http_v2_merge_srv_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_http_v2_chunk_size(ngx_conf_t *cf, void *post, void *data);
+
+
+static ngx_conf_post_handler_pt  ngx_http_v2_chunk_size_p =
+    ngx_http_v2_chunk_size;
+
+
+static ngx_command_t  ngx_http_v2_commands[] = {
+
+    { ngx_string("http2_max_concurrent_streams"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, concurrent_streams),
+      NULL },
+
+    { ngx_string("http2_chunk_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, chunk_size),
+      &ngx_http_v2_chunk_size_p },
+
+    { ngx_string("http2_max_field_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, max_field_size),
+      NULL },
+
+    { ngx_string("http2_max_header_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, max_header_size),
+      NULL },
+
+    { ngx_string("http2_recv_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, recv_timeout),
+      NULL },
+
+    { ngx_string("http2_idle_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, idle_timeout),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_v2_module_ctx = {
+    ngx_http_v2_add_variables,             /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_v2_create_srv_conf,           /* create server configuration */
+    ngx_http_v2_merge_srv_conf,            /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_v2_module = {
+    NGX_MODULE_V1,
+    &ngx_http_v2_module_ctx,               /* module context */
+    ngx_http_v2_commands,                  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_http_variable_t  ngx_http_v2_vars[] = {
+
+    { ngx_string("http2"), NULL, ngx_http_v2_variable, 0, 0, 0 },
+
+    { ngx_null_string, NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_http_v2_handler_pt  ngx_http_v2_frame_handlers[] = {
+    ngx_http_v2_read_data,
+    ngx_http_v2_read_headers,
+    ngx_http_v2_read_priority,
+    ngx_http_v2_read_rst_stream,
+    ngx_http_v2_read_settings,
+    ngx_http_v2_read_push_promise,
+    ngx_http_v2_read_ping,
+    ngx_http_v2_read_goaway,
+    ngx_http_v2_read_window_update,
+    ngx_http_v2_read_continuation
+};
+
+#define NGX_HTTP_V2_FRAME_TYPES                                               \
+    (sizeof(ngx_http_v2_frame_handlers) / sizeof(ngx_http_v2_handler_pt))
+
+
+static u_char  ngx_http_v2_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+
+/* the request headers that are meaningless in a multiplexed connection */
+
+static ngx_str_t  ngx_http_v2_connection_headers[] = {
+    ngx_string("connection"),
+    ngx_string("keep-alive"),
+    ngx_string("proxy-connection"),
+    ngx_string("transfer-encoding"),
+    ngx_string("upgrade"),
+    ngx_null_string
+};
+
+
+void
+ngx_http_v2_init(ngx_event_t *rev, ngx_http_addr_conf_t *addr_conf)
+{
+    int                        tcp_nodelay;
+    ngx_connection_t          *c;
+    ngx_pool_cleanup_t        *cln;
+    ngx_http_core_loc_conf_t  *clcf;
+    ngx_http_v2_connection_t  *h2c;
+
+    c = rev->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "init http2 connection");
+
+    /*
+     * the frames of all the streams are multiplexed over the connection,
+     * so it is never idle between responses for Nagle to wait on
+     */
+
+    clcf = ngx_http_get_module_loc_conf(addr_conf->default_server->ctx,
+                                        ngx_http_core_module);
+
+    if (clcf->tcp_nodelay && c->tcp_nodelay == NGX_TCP_NODELAY_UNSET) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "tcp_nodelay");
+
+        tcp_nodelay = 1;
+
+        if (setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY,
+                       (const void *) &tcp_nodelay, sizeof(int))
+            == -1)
+        {
+#if (NGX_SOLARIS)
+            /* Solaris returns EINVAL if a socket has been shut down */
+            c->log_error = NGX_ERROR_IGNORE_EINVAL;
+#endif
+
+            ngx_connection_error(c, ngx_socket_errno,
+                                 "setsockopt(TCP_NODELAY) failed");
+
+            c->log_error = NGX_ERROR_INFO;
+            ngx_http_close_connection(c);
+            return;
+        }
+
+        c->tcp_nodelay = NGX_TCP_NODELAY_SET;
+    }
+
+    h2c = ngx_pcalloc(c->pool, sizeof(ngx_http_v2_connection_t));
+    if (h2c == NULL) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    h2c->connection = c;
+    h2c->addr_conf = addr_conf;
+    h2c->h2scf = ngx_http_get_module_srv_conf(addr_conf->default_server->ctx,
+                                              ngx_http_v2_module);
+
+    h2c->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    h2c->recv_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    h2c->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    h2c->frame_size = NGX_HTTP_V2_DEFAULT_FRAME_SIZE;
+
+    h2c->hpack.max = NGX_HTTP_V2_TABLE_SIZE;
+    h2c->hpack_out.max = NGX_HTTP_V2_TABLE_SIZE;
+
+    ngx_queue_init(&h2c->waiting);
+
+    h2c->streams_index = ngx_pcalloc(c->pool, NGX_HTTP_V2_INDEX_SIZE
+                                              * sizeof(ngx_http_v2_stream_t *));
+    if (h2c->streams_index == NULL) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    h2c->in = ngx_create_temp_buf(c->pool, NGX_HTTP_V2_FRAME_HEADER_SIZE
+                                           + NGX_HTTP_V2_DEFAULT_FRAME_SIZE);
+    if (h2c->in == NULL) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    h2c->field = ngx_pnalloc(c->pool, 2 * h2c->h2scf->max_field_size);
+    if (h2c->field == NULL) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    cln->handler = ngx_http_v2_table_free;
+    cln->data = &h2c->hpack;
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    cln->handler = ngx_http_v2_table_free;
+    cln->data = &h2c->hpack_out;
+
+    if (ngx_http_v2_send_settings(h2c, 0) != NGX_OK) {
+        ngx_http_close_connection(c);
+        return;
+    }
+
+    c->data = h2c;
+    c->log->action = "processing HTTP/2 connection";
+
+    rev->handler = ngx_http_v2_read_handler;
+    c->write->handler = ngx_http_v2_write_handler;
+
+    ngx_http_v2_read_handler(rev);
+}
+
+
+static void
+ngx_http_v2_read_handler(ngx_event_t *rev)
+{
+    ssize_t                    n;
+    ngx_buf_t                 *b;
+    ngx_uint_t                 status;
+    ngx_connection_t          *c;
+    ngx_http_v2_connection_t  *h2c;
+
+    c = rev->data;
+    h2c = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http2 read handler");
+
+    b = h2c->in;
+
+    if (rev->timedout) {
+        if (b->pos == b->last && !h2c->hsid) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                           "http2 idle timeout");
+            ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+            return;
+        }
+
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT, "client timed out");
+        c->timedout = 1;
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_PROTOCOL_ERROR);
+        return;
+    }
+
+    if (c->close) {
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+        return;
+    }
+
+    h2c->blocked = 1;
+
+    do {
+        if (b->pos == b->last) {
+            b->pos = b->start;
+            b->last = b->start;
+
+        } else if (b->pos != b->start) {
+            b->last = ngx_movemem(b->start, b->pos, b->last - b->pos);
+            b->pos = b->start;
+        }
+
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            if (n == 0 && (b->pos != b->last || h2c->processing)) {
+                ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                              "client prematurely closed connection");
+            }
+
+            c->error = 1;
+            ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+            return;
+        }
+
+        b->last += n;
+
+        status = ngx_http_v2_process_input(h2c);
+
+        if (status != NGX_HTTP_V2_NO_ERROR) {
+            ngx_http_v2_finalize_connection(h2c, status);
+            return;
+        }
+
+    } while (rev->ready);
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        c->error = 1;
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_INTERNAL_ERROR);
+        return;
+    }
+
+    h2c->blocked = 0;
+
+    ngx_http_v2_handle_connection(h2c);
+}
+
+
+static void
+ngx_http_v2_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t          *c;
+    ngx_http_v2_connection_t  *h2c;
+
+    c = wev->data;
+    h2c = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http2 write handler");
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT, "client timed out");
+        c->timedout = 1;
+        c->error = 1;
+    }
+
+    if (c->error) {
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+        return;
+    }
+
+    if (ngx_http_v2_send_output_queue(h2c) == NGX_ERROR) {
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+        return;
+    }
+
+    ngx_http_v2_handle_connection(h2c);
+}
+
+
+/*
+ * flushes the frames queued while the connection was blocked by the read
+ * handler and switches the connection between the receive and idle states
+ */
+
+static void
+ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c)
+{
+    ngx_event_t       *rev;
+    ngx_connection_t  *c;
+
+    if (h2c->blocked) {
+        return;
+    }
+
+    c = h2c->connection;
+
+    if (c->error) {
+        if (h2c->processing == 0) {
+            ngx_http_close_connection(c);
+        }
+
+        return;
+    }
+
+    if (ngx_http_v2_send_output_queue(h2c) == NGX_ERROR) {
+        return;
+    }
+
+    rev = c->read;
+
+    if (h2c->processing) {
+        if (c->reusable) {
+            ngx_reusable_connection(c, 0);
+            c->idle = 0;
+        }
+
+        if (h2c->in->pos != h2c->in->last || h2c->hsid) {
+            ngx_add_timer(rev, h2c->h2scf->recv_timeout);
+
+        } else if (rev->timer_set) {
+            ngx_del_timer(rev);
+        }
+
+        return;
+    }
+
+    if (ngx_terminate || ngx_exiting) {
+        ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
+        return;
+    }
+
+    if (h2c->in->pos != h2c->in->last || h2c->hsid) {
+        ngx_add_timer(rev, h2c->h2scf->recv_timeout);
+        return;
+    }
+
+    ngx_add_timer(rev, h2c->h2scf->idle_timeout);
+
+    if (!c->reusable && h2c->out == NULL) {
+        ngx_reusable_connection(c, 1);
+        c->idle = 1;
+    }
+}
+
+
+static ngx_uint_t
+ngx_http_v2_process_input(ngx_http_v2_connection_t *h2c)
+{
+    u_char               *p;
+    size_t                size;
+    ngx_buf_t            *b;
+    ngx_uint_t            type, status;
+    ngx_http_v2_frame_t   f;
+
+    b = h2c->in;
+
+    if (!h2c->preface) {
+        size = ngx_min((size_t) (b->last - b->pos),
+                       sizeof(ngx_http_v2_preface) - 1);
+
+        if (ngx_memcmp(b->pos, ngx_http_v2_preface, size) != 0) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent invalid http2 connection preface");
+            return NGX_HTTP_V2_PROTOCOL_ERROR;
+        }
+
+        if (size < sizeof(ngx_http_v2_preface) - 1) {
+            return NGX_HTTP_V2_NO_ERROR;
+        }
+
+        b->pos += size;
+        h2c->preface = 1;
+    }
+
+    for ( ;; ) {
+
+        size = b->last - b->pos;
+
+        if (size < NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+            return NGX_HTTP_V2_NO_ERROR;
+        }
+
+        p = b->pos;
+
+        f.length = p[0] << 16 | p[1] << 8 | p[2];
+        type = p[3];
+        f.flags = p[4];
+        f.sid = ngx_http_v2_parse_uint32(&p[5]) & 0x7fffffff;
+
+        if (f.length > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent too large frame: %uz", f.length);
+            return NGX_HTTP_V2_SIZE_ERROR;
+        }
+
+        if (size < NGX_HTTP_V2_FRAME_HEADER_SIZE + f.length) {
+            return NGX_HTTP_V2_NO_ERROR;
+        }
+
+        f.pos = p + NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 frame type:%ui f:%ui l:%uz sid:%ui",
+                       type, f.flags, f.length, f.sid);
+
+        if (h2c->hsid && type != NGX_HTTP_V2_CONTINUATION_FRAME) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent frame type %ui "
+                          "instead of CONTINUATION", type);
+            return NGX_HTTP_V2_PROTOCOL_ERROR;
+        }
+
+        if (type < NGX_HTTP_V2_FRAME_TYPES) {
+            status = ngx_http_v2_frame_handlers[type](h2c, &f);
+
+            if (status != NGX_HTTP_V2_NO_ERROR) {
+                return status;
+            }
+        }
+
+        b->pos += NGX_HTTP_V2_FRAME_HEADER_SIZE + f.length;
+    }
+}
+
+
+static ngx_uint_t
+ngx_http_v2_read_data(ngx_http_v2_connection_t *h2c, ngx_http_v2_frame_t *f)
+{
+    u_char                *pos;
+    size_t                 size, padding;
+    ngx_http_v2_stream_t  *stream;
+
+    if (f->sid == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent DATA frame with incorrect identifier");
+        return NGX_HTTP_V2_PROTOCOL_ERROR;
+    }
+
+    pos = f->pos;
+    size = f->length;
+
+    if (f->flags & NGX_HTTP_V2_PADDED_FLAG) {
+        if (size == 0) {
+            return NGX_HTTP_V2_SIZE_ERROR;
+        }
+
+        padding = *pos++;
+        size--;
+
+        if (padding > size) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent DATA frame with incorrect padding");
+            return NGX_HTTP_V2_PROTOCOL_ERROR;
+        }
+
+        size -= padding;
+    }
+
+    if (f->length > h2c->recv_window) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client violated connection flow control");
+        return NGX_HTTP_V2_FLOW_CTRL_ERROR;
+    }
+
+    h2c->recv_window -= f->length;
+
+    if (h2c->recv_window < NGX_HTTP_V2_DEFAULT_WINDOW / 2) {
+        if (ngx_http_v2_send_window_update(h2c, 0, NGX_HTTP_V2_DEFAULT_WINDOW
+                                                   - h2c->recv_window)
+            != NGX_OK)
+        {
+            return NGX_HTTP_V2_INTERNAL_ERROR;
+        }
+
+        h2c->recv_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    }
+
+    stream = ngx_http_v2_get_stream(h2c, f->sid);
+
+    if (stream == NULL) {
+        if (f->sid > h2c->last_sid) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent DATA frame for idle stream %ui",
+                          f->sid);
+            return NGX_HTTP_V2_PROTOCOL_ERROR;
+        }
+
+        /* the stream has been closed already */
+
+        if (ngx_http_v2_send_rst_stream(h2c, f->sid,
+                                        NGX_HTTP_V2_STREAM_CLOSED)
+            != NGX_OK)
+        {
+            return NGX_HTTP_V2_INTERNAL_ERROR;
+        }
+
+        return NGX_HTTP_V2_NO_ERROR;
+    }
+
+    if (stream->in_closed) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent DATA frame for half-closed stream %ui",
+                      f->sid);
+        return ngx_http_v2_stream_error(h2c, stream,
+                                        NGX_HTTP_V2_STREAM_CLOSED);
+    }
+
+    if (f->length > stream->recv_window) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client violated flow control for stream %ui", f->sid);
+        return ngx_http_v2_stream_error(h2c, stream,
+                                        NGX_HTTP_V2_FLOW_CTRL_ERROR);
+    }
+
+    stream->recv_window -= f->length;
+
+    if (f->flags & NGX_HTTP_V2_END_STREAM_FLAG) {
+        stream->in_closed = 1;
+
+    } else if (stream->recv_window < NGX_HTTP_V2_DEFAULT_WINDOW / 2
+               && !stream->skip_data)
+    {
+        if (ngx_http_v2_send_window_update(h2c, f->sid,
+                                           NGX_HTTP_V2_DEFAULT_WINDOW
+                                           - stream->recv_window)
+            != NGX_OK)
+        {
+            return NGX_HTTP_V2_INTERNAL_ERROR;
+        }
+
+        stream->recv_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    }
+
+    ngx_http_v2_process_request_body(stream, pos, size,
+                                     f->flags & NGX_HTTP_V2_END_STREAM_FLAG);
+
+    return NGX_HTTP_V2_NO_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_read_headers(ngx_http_v2_connection_t *h2c, ngx_http_v2_frame_t *f)
+{
+    u_char      *pos;
+    size_t       size, padding;
+    ngx_uint_t   weight, dependency;
+
+    if (f->sid == 0 || (f->sid & 1) == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent HEADERS frame with incorrect identifier");
+        return NGX_HTTP_V2_PROTOCOL_ERROR;
+    }
+
+    pos = f->pos;
+    size = f->length;
+    padding = 0;
+    weight = NGX_HTTP_V2_DEFAULT_WEIGHT;
+
+    if (f->flags & NGX_HTTP_V2_PADDED_FLAG) {
+        if (size == 0) {
+            return NGX_HTTP_V2_SIZE_ERROR;
+        }
+
+        padding = *pos++;
+        size--;
+    }
+
+    if (f->flags & NGX_HTTP_V2_PRIORITY_FLAG) {
+        if (size < 5) {
+            return NGX_HTTP_V2_SIZE_ERROR;
+        }
+
+        dependency = ngx_http_v2_parse_uint32(pos) & 0x7fffffff;
+        weight = pos[4] + 1;
+
+        if (dependency == f->sid) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent HEADERS frame for stream %ui "
+                          "with incorrect dependency", f->sid);
+            return NGX_HTTP_V2_PROTOCOL_ERROR;
+        }
+
+        pos += 5;
+        size -= 5;
+    }
+
+    if (padding > size) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent HEADERS frame with incorrect padding");
+        return NGX_HTTP_V2_PROTOCOL_ERROR;
+    }
+
+    size -= padding;
+
+    h2c->hsid = f->sid;
+    h2c->hflags = f->flags;
+    h2c->hweight = weight;
+    h2c->hlen = 0;
+
+    return ngx_http_v2_header_fragment(h2c, pos, size,
+                                       f->flags & NGX_HTTP_V2_END_HEADERS_FLAG);
+}
+
+
+static ngx_uint_t
+ngx_http_v2_read_continuation(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f)
+{
+    if (h2c->hsid == 0 || f->sid != h2c->hsid) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent unexpected CONTINUATION frame");
+        return NGX_HTTP_V2_PROTOCOL_ERROR;
+    }
+
+    return ngx_http_v2_header_fragment(h2c, f->pos, f->length,
+                                       f->flags & NGX_HTTP_V2_END_HEADERS_FLAG);
+}
+
+
+static ngx_uint_t
+ngx_http_v2_header_fragment(ngx_http_v2_connection_t *h2c, u_char *pos,
+    size_t size, ngx_uint_t end)
+{
+    ngx_uint_t  sid;
+
+    if (h2c->hlen + size > h2c->h2scf->max_header_size) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client exceeded http2_max_header_size limit");
+        return NGX_HTTP_V2_ENHANCE_YOUR_CALM;
+    }
+
+    if (!end || h2c->hlen) {
+
+        /* the block is split into several frames */
+
+        if (h2c->hblock == NULL) {
+            h2c->hblock = ngx_pnalloc(h2c->connection->pool,
+                                      h2c->h2scf->max_header_size);
+            if (h2c->hblock == NULL) {
+                return NGX_HTTP_V2_INTERNAL_ERROR;
+            }
+        }
+
+        ngx_memcpy(h2c->hblock + h2c->hlen, pos, size);
+        h2c->hlen += size;
+
+        if (!end) {
+            return NGX_HTTP_V2_NO_ERROR;
+        }
+
+        pos = h2c->hblock;
+        size = h2c->hlen;
+    }
+
+    sid = h2c->hsid;
+    h2c->hsid = 0;
+    h2c->hlen = 0;
+
+    return ngx_http_v2_process_header_block(h2c, sid, pos, size);
+}
+
+
+static ngx_uint_t
+ngx_http_v2_process_header_block(ngx_http_v2_connection_t *h2c,
+    ngx_uint_t sid, u_char *pos, size_t size)
+{
+    u_char                *end;
+    ngx_int_t              rc;
+    ngx_uint_t             refuse, trailers;
+    ngx_http_v2_stream_t  *stream;
+    ngx_http_v2_header_t   header;
+
+    end = pos + size;
+    stream = NULL;
+    refuse = 0;
+    trailers = 0;
+
+    if (sid <= h2c->last_sid) {
+        stream = ngx_http_v2_get_stream(h2c, sid);
+
+        if (stream == NULL || stream->in_closed) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent HEADERS frame for closed stream %ui",
+                          sid);
+            return NGX_HTTP_V2_STREAM_CLOSED;
+        }
+
+        if (!(h2c->hflags & NGX_HTTP_V2_END_STREAM_FLAG)) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent trailers without END_STREAM flag");
+            return NGX_HTTP_V2_PROTOCOL_ERROR;
+        }
+
+        trailers = 1;
+
+    } else {
+        h2c->last_sid = sid;
+
+        if (h2c->goaway) {
+            refuse = 1;
+
+        } else if (h2c->processing >= h2c->h2scf->concurrent_streams) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "concurrent streams exceeded %ui",
+                          h2c->processing);
+            refuse = 1;
+
+        } else {
+            stream = ngx_http_v2_create_stream(h2c, sid);
+            if (stream == NULL) {
+                return NGX_HTTP_V2_INTERNAL_ERROR;
+            }
+
+            stream->weight = h2c->hweight;
+            stream->request->request_length = size;
+        }
+    }
+
+    /* the whole block is decoded to keep the dynamic table in sync */
+
+    while (pos < end) {
+
+        rc = ngx_http_v2_parse_field(h2c, &pos, end, &header);
+
+        if (rc == NGX_DECLINED) {
+            continue;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent invalid header block");
+            return NGX_HTTP_V2_COMP_ERROR;
+        }
+
+        if (rc == NGX_ABORT) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client exceeded http2_max_field_size limit");
+            return NGX_HTTP_V2_ENHANCE_YOUR_CALM;
+        }
+
+        if (stream == NULL || trailers) {
+            continue;
+        }
+
+        if (ngx_http_v2_state_header(stream, &header) != NGX_OK) {
+            ngx_http_finalize_request(stream->request,
+                                      NGX_HTTP_INTERNAL_SERVER_ERROR);
+            stream = NULL;
+        }
+    }
+
+    if (refuse) {
+        if (ngx_http_v2_send_rst_stream(h2c, sid, NGX_HTTP_V2_REFUSED_STREAM)
+            != NGX_OK)
+        {
+            return NGX_HTTP_V2_INTERNAL_ERROR;
+        }
+
+        return NGX_HTTP_V2_NO_ERROR;
+    }
+
+    if (stream == NULL) {
+        return NGX_HTTP_V2_NO_ERROR;
+    }
+
+    if (trailers) {
+        stream->in_closed = 1;
+        ngx_http_v2_process_request_body(stream, NULL, 0, 1);
+        return NGX_HTTP_V2_NO_ERROR;
+    }
+
+    if (h2c->hflags & NGX_HTTP_V2_END_STREAM_FLAG) {
+        stream->in_closed = 1;
+    }
+
+    ngx_http_v2_run_request(stream);
+
+    return NGX_HTTP_V2_NO_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_v2_parse_int(u_char **pos, u_char *end, ngx_uint_t prefix,
+    ngx_uint_t *value)
+{
+    u_char      *p, ch;
+    ngx_uint_t   v, mask, shift;
+
+    p = *pos;
+
+    if (p == end) {
+        return NGX_ERROR;
+    }
+
+    mask = (1 << prefix) - 1;
+    v = *p++ & mask;
+
+    if (v == mask) {
+        shift = 0;
+
+        do {
+            /* values over 2^28 never fit into the limits */
+
+            if (p == end || shift > 21) {
+                return NGX_ERROR;
+            }
+
+            ch = *p++;
+            v += (ngx_uint_t) (ch & 0x7f) << shift;
+            shift += 7;
+
+        } while (ch & 0x80);
+    }
+
+    *pos = p;
+    *value = v;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_parse_string(ngx_http_v2_connection_t *h2c, u_char **pos,
+    u_char *end, ngx_str_t *str, u_char *buf)
+{
+    u_char      *p;
+    size_t       size, max;
+    ngx_uint_t   huff, len;
+
+    p = *pos;
+
+    if (p == end) {
+        return NGX_ERROR;
+    }
+
+    huff = *p & 0x80;
+
+    if (ngx_http_v2_parse_int(&p, end, 7, &len) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (len > (size_t) (end - p)) {
+        return NGX_ERROR;
+    }
+
+    max = h2c->h2scf->max_field_size;
+
+    if (huff) {
+        size = max;
+
+        if (ngx_http_v2_huff_decode(p, len, buf, &size) != NGX_OK) {
+            return (len * 8 / 5 > max) ? NGX_ABORT : NGX_ERROR;
+        }
+
+        str->len = size;
+        str->data = buf;
+
+    } else {
+        if (len > max) {
+            return NGX_ABORT;
+        }
+
+        str->len = len;
+        str->data = p;
+    }
+
+    *pos = p + len;
+
+    return NGX_OK;
+}
+
+
+/*
+ * returns NGX_DECLINED for a dynamic table size update, NGX_ABORT
+ * for a field over http2_max_field_size and NGX_ERROR on invalid coding
+ */
+
+static ngx_int_t
+ngx_http_v2_parse_field(ngx_http_v2_connection_t *h2c, u_char **pos,
+    u_char *end, ngx_http_v2_header_t *header)
+{
+    u_char                *p, ch, *buf;
+    ngx_int_t              rc;
+    ngx_uint_t             index, add;
+    ngx_http_v2_header_t   entry;
+
+    p = *pos;
+    ch = *p;
+    buf = h2c->field;
+
+    if (ch & 0x80) {
+
+        /* indexed header field */
+
+        if (ngx_http_v2_parse_int(&p, end, 7, &index) != NGX_OK
+            || ngx_http_v2_table_get(&h2c->hpack, index, header) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        *pos = p;
+
+        return NGX_OK;
+    }
+
+    if ((ch & 0xe0) == 0x20) {
+
+        /* dynamic table size update */
+
+        if (ngx_http_v2_parse_int(&p, end, 5, &index) != NGX_OK
+            || index > NGX_HTTP_V2_TABLE_SIZE)
+        {
+            return NGX_ERROR;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table size update: %ui", index);
+
+        ngx_http_v2_table_resize(&h2c->hpack, index);
+
+        *pos = p;
+
+        return NGX_DECLINED;
+    }
+
+    /* literal header field with incremental, without or never indexing */
+
+    add = ((ch & 0xc0) == 0x40);
+
+    if (ngx_http_v2_parse_int(&p, end, add ? 6 : 4, &index) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (index) {
+        if (ngx_http_v2_table_get(&h2c->hpack, index, &entry) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        /* the entry may be evicted by ngx_http_v2_table_add() */
+
+        header->name.len = entry.name.len;
+        header->name.data = ngx_cpymem(buf, entry.name.data, entry.name.len)
+                            - entry.name.len;
+
+    } else {
+        rc = ngx_http_v2_parse_string(h2c, &p, end, &header->name, buf);
+        if (rc != NGX_OK) {
+            return rc;
+        }
+    }
+
+    rc = ngx_http_v2_parse_string(h2c, &p, end, &header->value,
+                                  buf + h2c->h2scf->max_field_size);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    if (add) {
+        if (ngx_http_v2_table_add(&h2c->hpack, &header->name, &header->value)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    *pos = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_state_header(ngx_http_v2_stream_t *stream,
+    ngx_http_v2_header_t *header)
+{
+    u_char                    *p, *last, ch;
+    ngx_str_t                 *cookie, name, value, *hn;
+    ngx_http_request_t        *r;
+    ngx_http_core_srv_conf_t  *cscf;
+
+    r = stream->request;
+
+    if (stream->invalid) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 header: \"%V: %V\"", &header->name, &header->value);
+
+    if (header->name.len == 0) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "client sent empty header name");
+        stream->invalid = 1;
+        return NGX_OK;
+    }
+
+    if (header->name.data[0] == ':') {
+
+        if (r->headers_in.headers.part.nelts || stream->cookies) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "client sent pseudo-header \"%V\" "
+                          "after regular headers", &header->name);
+            stream->invalid = 1;
+            return NGX_OK;
+        }
+
+        return ngx_http_v2_pseudo_header(stream, header);
+    }
+
+    cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
+
+    for (p = header->name.data, last = p + header->name.len; p < last; p++) {
+        ch = *p;
+
+        if ((ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9')
+            || ch == '-' || (ch == '_' && cscf->underscores_in_headers))
+        {
+            continue;
+        }
+
+        if (ch <= 0x20 || ch == 0x7f || ch == ':'
+            || (ch >= 'A' && ch <= 'Z'))
+        {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "client sent invalid header name: \"%V\"",
+                          &header->name);
+            stream->invalid = 1;
+            return NGX_OK;
+        }
+
+        if (cscf->ignore_invalid_headers) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "client sent invalid header: \"%V\"",
+                          &header->name);
+            return NGX_OK;
+        }
+    }
+
+    for (p = header->value.data, last = p + header->value.len; p < last; p++) {
+        ch = *p;
+
+        if (ch == '\0' || ch == CR || ch == LF) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "client sent header \"%V\" with invalid value",
+                          &header->name);
+            stream->invalid = 1;
+            return NGX_OK;
+        }
+    }
+
+    for (hn = ngx_http_v2_connection_headers; hn->len; hn++) {
+        if (header->name.len == hn->len
+            && ngx_strncmp(header->name.data, hn->data, hn->len) == 0)
+        {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "client sent connection-specific header \"%V\"",
+                          &header->name);
+            stream->invalid = 1;
+            return NGX_OK;
+        }
+    }
+
+    if (header->name.len == 2
+        && ngx_strncmp(header->name.data, "te", 2) == 0
+        && (header->value.len != 8
+            || ngx_strncmp(header->value.data, "trailers", 8) != 0))
+    {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "client sent invalid \"te\" header");
+        stream->invalid = 1;
+        return NGX_OK;
+    }
+
+    if (header->name.len == 6
+        && ngx_strncmp(header->name.data, "cookie", 6) == 0)
+    {
+        /* the crumbs are joined back in ngx_http_v2_run_request() */
+
+        if (stream->cookies == NULL) {
+            stream->cookies = ngx_array_create(r->pool, 2, sizeof(ngx_str_t));
+            if (stream->cookies == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        cookie = ngx_array_push(stream->cookies);
+        if (cookie == NULL) {
+            return NGX_ERROR;
+        }
+
+        return ngx_http_v2_copy_str(r->pool, cookie, &header->value);
+    }
+
+    if (ngx_http_v2_copy_str(r->pool, &name, &header->name) != NGX_OK
+        || ngx_http_v2_copy_str(r->pool, &value, &header->value) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_v2_push_header(r, &name, &value);
+}
+
+
+static ngx_int_t
+ngx_http_v2_pseudo_header(ngx_http_v2_stream_t *stream,
+    ngx_http_v2_header_t *header)
+{
+    ngx_str_t           *dst;
+    ngx_http_request_t  *r;
+
+    r = stream->request;
+
+    header->name.len--;
+    header->name.data++;
+
+    switch (header->name.len) {
+
+    case 4:
+        if (ngx_strncmp(header->name.data, "path", 4) == 0) {
+            dst = &stream->path;
+            goto found;
+        }
+
+        break;
+
+    case 6:
+        if (ngx_strncmp(header->name.data, "method", 6) == 0) {
+            dst = &r->method_name;
+            goto found;
+        }
+
+        if (ngx_strncmp(header->name.data, "scheme", 6) == 0) {
+            if (stream->scheme) {
+                goto duplicate;
+            }
+
+            stream->scheme = 1;
+            return NGX_OK;
+        }
+
+        break;
+
+    case 9:
+        if (ngx_strncmp(header->name.data, "authority", 9) == 0) {
+            dst = &stream->authority;
+            goto found;
+        }
+
+        break;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                  "client sent unknown pseudo-header \":%V\"", &header->name);
+    stream->invalid = 1;
+
+    return NGX_OK;
+
+found:
+
+    if (dst->len) {
+        goto duplicate;
+    }
+
+    if (header->value.len == 0) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "client sent empty \":%V\" header", &header->name);
+        stream->invalid = 1;
+        return NGX_OK;
+    }
+
+    return ngx_http_v2_copy_str(r->pool, dst, &header->value);
+
+duplicate:
+
+    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                  "client sent duplicate \":%V\" header", &header->name);
+    stream->invalid = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_push_header(ngx_http_request_t *r, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    ngx_table_elt_t            *h;
+    ngx_http_header_t          *hh;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    h = ngx_list_push(&r->headers_in.headers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    h->key = *name;
+    h->value = *value;
+    h->lowcase_key = name->data;
+    h->hash = ngx_hash_key(name->data, name->len);
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    hh = ngx_hash_find(&cmcf->headers_in_hash, h->hash,
+                       h->lowcase_key, h->key.len);
+
+    if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
+        return NGX_ABORT;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_copy_str(ngx_pool_t *pool, ngx_str_t *dst, ngx_str_t *src)
+{
+    dst->data = ngx_pnalloc(pool, src->len + 1);
+    if (dst->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    dst->len = src->len;
+    *ngx_cpymem(dst->data, src->data, src->len) = '\0';
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_run_request(ngx_http_v2_stream_t *stream)
+{
+    ngx_str_t            name;
+    ngx_connection_t    *fc;
+    ngx_http_request_t  *r;
+
+    r = stream->request;
+    fc = r->connection;
+
+    if (stream->invalid) {
+        ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+        goto done;
+    }
+
+    if (ngx_http_v2_construct_request_line(r) != NGX_OK) {
+        goto done;
+    }
+
+    if (stream->cookies && ngx_http_v2_construct_cookie_header(r) != NGX_OK) {
+        goto done;
+    }
+
+    if (r->headers_in.host == NULL && stream->authority.len) {
+        ngx_str_set(&name, "host");
+
+        switch (ngx_http_v2_push_header(r, &name, &stream->authority)) {
+
+        case NGX_OK:
+            break;
+
+        case NGX_ERROR:
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+            /* fall through */
+
+        default:
+            goto done;
+        }
+    }
+
+    r->http_state = NGX_HTTP_PROCESS_REQUEST_STATE;
+
+    if (ngx_http_process_request_header(r) != NGX_OK) {
+        goto done;
+    }
+
+    if (stream->in_closed && r->headers_in.content_length_n > 0) {
+        ngx_log_error(NGX_LOG_INFO, fc->log, 0,
+                      "client sent \"Content-Length\" without body");
+        ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+        goto done;
+    }
+
+    ngx_http_process_request(r);
+
+    return;
+
+done:
+
+    ngx_http_run_posted_requests(fc);
+}
+
+
+static ngx_int_t
+ngx_http_v2_construct_request_line(ngx_http_request_t *r)
+{
+    u_char                *p;
+    size_t                 len;
+    ngx_buf_t             *b;
+    ngx_http_v2_stream_t  *stream;
+
+    static const u_char    ending[] = " HTTP/2.0\r\n";
+
+    stream = r->stream;
+
+    if (r->method_name.len == 0 || stream->path.len == 0 || !stream->scheme) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "client sent no \":method\", \":path\" or \":scheme\"");
+        ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+        return NGX_ERROR;
+    }
+
+    if (stream->path.data[0] != '/'
+        && !(stream->path.len == 1 && stream->path.data[0] == '*'))
+    {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "client sent invalid \":path\" header: \"%V\"",
+                      &stream->path);
+        ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+        return NGX_ERROR;
+    }
+
+    len = r->method_name.len + 1 + stream->path.len + sizeof(ending) - 1;
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(b->last, r->method_name.data, r->method_name.len);
+    *p++ = ' ';
+    p = ngx_cpymem(p, stream->path.data, stream->path.len);
+    b->last = ngx_cpymem(p, ending, sizeof(ending) - 1);
+
+    if (ngx_http_parse_request_line(r, b) != NGX_OK
+        || b->pos != b->last)
+    {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "client sent invalid request line: \"%*s\"",
+                      len - 2, b->start);
+        ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+        return NGX_ERROR;
+    }
+
+    r->request_line.len = r->request_end - r->request_start;
+    r->request_line.data = r->request_start;
+
+    r->method_name.len = r->method_end - r->request_start + 1;
+    r->method_name.data = r->request_line.data;
+
+    if (r->http_protocol.data) {
+        r->http_protocol.len = r->request_end - r->http_protocol.data;
+    }
+
+    if (ngx_http_process_request_uri(r) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 request line: \"%V\"", &r->request_line);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_construct_cookie_header(ngx_http_request_t *r)
+{
+    u_char      *p;
+    size_t       len;
+    ngx_str_t   *vals, name, value;
+    ngx_uint_t   i;
+    ngx_array_t *cookies;
+
+    cookies = r->stream->cookies;
+    vals = cookies->elts;
+
+    len = 0;
+
+    for (i = 0; i < cookies->nelts; i++) {
+        len += vals[i].len + 2;
+    }
+
+    len -= 2;
+
+    p = ngx_pnalloc(r->pool, len + 1);
+    if (p == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return NGX_ERROR;
+    }
+
+    value.len = len;
+    value.data = p;
+
+    p = ngx_cpymem(p, vals[0].data, vals[0].len);
+
+    for (i = 1; i < cookies->nelts; i++) {
+        *p++ = ';'; *p++ = ' ';
+        p = ngx_cpymem(p, vals[i].data, vals[i].len);
+    }
+
+    *p = '\0';
+
+    ngx_str_set(&name, "cookie");
+
+    switch (ngx_http_v2_push_header(r, &name, &value)) {
+
+    case NGX_OK:
+        return NGX_OK;
+
+    case NGX_ERROR:
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+        /* fall through */
+
+    default:
+        return NGX_ERROR;
+    }
+}
+
+
+static ngx_uint_t
+ngx_http_v2_read_priority(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f)
+{
+    ngx_http_v2_stream_t  *stream;
+
+    if (f->length != 5) {
+        return NGX_HTTP_V2_SIZE_ERROR;
+    }
+
+    if (f->sid == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY frame with incorrect identifier");
+        return NGX_HTTP_V2_PROTOCOL_ERROR;
+    }
+
+    /* the dependencies are not tracked, only the weight is used */
+
+    stream = ngx_http_v2_get_stream(h2c, f->sid);
+
+    if (stream) {
+        stream->weight = f->pos[4] + 1;
+    }
+
+    return NGX_HTTP_V2_NO_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_read_rst_stream(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f)
+{
+    ngx_uint_t             status;
+    ngx_http_v2_stream_t  *stream;
+
+    if (f->length != 4) {
+        return NGX_HTTP_V2_SIZE_ERROR;
+    }
+
+    if (f->sid == 0 || f->sid > h2c->last_sid) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent RST_STREAM frame "
+                      "with incorrect identifier");
+        return NGX_HTTP_V2_PROTOCOL_ERROR;
+    }
+
+    status = ngx_http_v2_parse_uint32(f->pos);
+
+    stream = ngx_http_v2_get_stream(h2c, f->sid);
+
+    if (stream == NULL) {
+        return NGX_HTTP_V2_NO_ERROR;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, stream->request->connection->log, 0,
+                  "client terminated stream %ui with status %ui",
+                  f->sid, status);
+
+    stream->in_closed = 1;
+    stream->out_closed = 1;
+
+    ngx_http_v2_terminate_stream(h2c, stream);
+
+    return NGX_HTTP_V2_NO_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_read_settings(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f)
+{
+    u_char                *p, *end;
+    ssize_t                delta;
+    ngx_uint_t             i, id, value;
+    ngx_http_v2_stream_t  *stream;
+
+    if (f->sid != 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent SETTINGS frame with incorrect identifier");
+        return NGX_HTTP_V2_PROTOCOL_ERROR;
+    }
+
+    if (f->flags & NGX_HTTP_V2_ACK_FLAG) {
+        return f->length ? NGX_HTTP_V2_SIZE_ERROR : NGX_HTTP_V2_NO_ERROR;
+    }
+
+    if (f->length % NGX_HTTP_V2_SETTINGS_PARAM_SIZE) {
+        return NGX_HTTP_V2_SIZE_ERROR;
+    }
+
+    end = f->pos + f->length;
+
+    for (p = f->pos; p < end; p += NGX_HTTP_V2_SETTINGS_PARAM_SIZE) {
+        id = ngx_http_v2_parse_uint16(p);
+        value = ngx_http_v2_parse_uint32(&p[2]);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 setting %ui:%ui", id, value);
+
+        switch (id) {
+
+        case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
+
+            value = ngx_min(value, NGX_HTTP_V2_TABLE_SIZE);
+
+            if (value != h2c->hpack_out.max) {
+                ngx_http_v2_table_resize(&h2c->hpack_out, value);
+                h2c->hpack_out_update = 1;
+            }
+
+            break;
+
+        case NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING:
+
+            if (value > NGX_HTTP_V2_MAX_WINDOW) {
+                ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                              "client sent SETTINGS frame with "
+                              "incorrect INITIAL_WINDOW_SIZE value %ui",
+                              value);
+                return NGX_HTTP_V2_FLOW_CTRL_ERROR;
+            }
+
+            delta = (ssize_t) value - (ssize_t) h2c->init_window;
+            h2c->init_window = value;
+
+            if (delta == 0) {
+                break;
+            }
+
+            for (i = 0; i < NGX_HTTP_V2_INDEX_SIZE; i++) {
+                for (stream = h2c->streams_index[i];
+                     stream;
+                     stream = stream->index)
+                {
+                    stream->send_window += delta;
+
+                    if (delta > 0 && stream->send_window > 0) {
+                        ngx_http_v2_wake_stream(stream);
+                    }
+                }
+            }
+
+            break;
+
+        case NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING:
+
+            if (value < NGX_HTTP_V2_DEFAULT_FRAME_SIZE
+                || value > NGX_HTTP_V2_MAX_FRAME_SIZE)
+            {
+                ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                              "client sent SETTINGS frame with "
+                              "incorrect MAX_FRAME_SIZE value %ui", value);
+                return NGX_HTTP_V2_PROTOCOL_ERROR;
+            }
+
+            h2c->frame_size = value;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (ngx_http_v2_send_settings(h2c, 1) != NGX_OK) {
+        return NGX_HTTP_V2_INTERNAL_ERROR;
+    }
+
+    return NGX_HTTP_V2_NO_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_read_push_promise(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f)
+{
+    ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                  "client sent PUSH_PROMISE frame");
+
+    return NGX_HTTP_V2_PROTOCOL_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_read_ping(ngx_http_v2_connection_t *h2c, ngx_http_v2_frame_t *f)
+{
+    u_char                   *p;
+    ngx_http_v2_out_frame_t  *frame;
+
+    if (f->length != 8) {
+        return NGX_HTTP_V2_SIZE_ERROR;
+    }
+
+    if (f->sid != 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PING frame with incorrect identifier");
+        return NGX_HTTP_V2_PROTOCOL_ERROR;
+    }
+
+    if (f->flags & NGX_HTTP_V2_ACK_FLAG) {
+        return NGX_HTTP_V2_NO_ERROR;
+    }
+
+    frame = ngx_http_v2_get_control_frame(h2c);
+    if (frame == NULL) {
+        return NGX_HTTP_V2_INTERNAL_ERROR;
+    }
+
+    p = ngx_http_v2_write_frame_head(frame->buf.last, 8,
+                                     NGX_HTTP_V2_PING_FRAME,
+                                     NGX_HTTP_V2_ACK_FLAG, 0);
+    frame->buf.last = ngx_cpymem(p, f->pos, 8);
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    return NGX_HTTP_V2_NO_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_read_goaway(ngx_http_v2_connection_t *h2c, ngx_http_v2_frame_t *f)
+{
+    if (f->length < 8) {
+        return NGX_HTTP_V2_SIZE_ERROR;
+    }
+
+    if (f->sid != 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent GOAWAY frame with incorrect identifier");
+        return NGX_HTTP_V2_PROTOCOL_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 GOAWAY status:%ui",
+                   (ngx_uint_t) ngx_http_v2_parse_uint32(&f->pos[4]));
+
+    /* the client opens no new streams, the current ones are completed */
+
+    h2c->goaway = 1;
+
+    return NGX_HTTP_V2_NO_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_read_window_update(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_frame_t *f)
+{
+    size_t                 window;
+    ngx_queue_t           *q;
+    ngx_http_v2_stream_t  *stream;
+
+    if (f->length != 4) {
+        return NGX_HTTP_V2_SIZE_ERROR;
+    }
+
+    window = ngx_http_v2_parse_uint32(f->pos) & 0x7fffffff;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 WINDOW_UPDATE sid:%ui window:%uz", f->sid, window);
+
+    if (f->sid) {
+        stream = ngx_http_v2_get_stream(h2c, f->sid);
+
+        if (stream == NULL) {
+            return NGX_HTTP_V2_NO_ERROR;
+        }
+
+        if (window == 0
+            || window > (size_t) (NGX_HTTP_V2_MAX_WINDOW - stream->send_window))
+        {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent incorrect WINDOW_UPDATE "
+                          "for stream %ui", f->sid);
+            return ngx_http_v2_stream_error(h2c, stream,
+                                            NGX_HTTP_V2_FLOW_CTRL_ERROR);
+        }
+
+        stream->send_window += window;
+
+        if (stream->send_window > 0 && !stream->waiting) {
+            ngx_http_v2_wake_stream(stream);
+        }
+
+        return NGX_HTTP_V2_NO_ERROR;
+    }
+
+    if (window == 0
+        || window > (size_t) (NGX_HTTP_V2_MAX_WINDOW - h2c->send_window))
+    {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent incorrect WINDOW_UPDATE for connection");
+        return NGX_HTTP_V2_FLOW_CTRL_ERROR;
+    }
+
+    h2c->send_window += window;
+
+    while (h2c->send_window > 0 && !ngx_queue_empty(&h2c->waiting)) {
+        q = ngx_queue_head(&h2c->waiting);
+        ngx_queue_remove(q);
+
+        stream = ngx_queue_data(q, ngx_http_v2_stream_t, queue);
+        stream->waiting = 0;
+
+        ngx_http_v2_wake_stream(stream);
+    }
+
+    return NGX_HTTP_V2_NO_ERROR;
+}
+
+
+static ngx_http_v2_stream_t *
+ngx_http_v2_create_stream(ngx_http_v2_connection_t *h2c, ngx_uint_t sid)
+{
+    ngx_log_t                 *log;
+    ngx_event_t               *rev, *wev;
+    ngx_connection_t          *c, *fc;
+    ngx_http_log_ctx_t        *ctx;
+    ngx_http_request_t        *r;
+    ngx_http_v2_stream_t      *stream, **index;
+
+    c = h2c->connection;
+
+    fc = h2c->free_fake_connections;
+
+    if (fc) {
+        h2c->free_fake_connections = fc->data;
+
+        rev = fc->read;
+        wev = fc->write;
+        log = fc->log;
+        ctx = log->data;
+
+    } else {
+        fc = ngx_palloc(c->pool, sizeof(ngx_connection_t));
+        rev = ngx_palloc(c->pool, sizeof(ngx_event_t));
+        wev = ngx_palloc(c->pool, sizeof(ngx_event_t));
+        log = ngx_palloc(c->pool, sizeof(ngx_log_t));
+        ctx = ngx_palloc(c->pool, sizeof(ngx_http_log_ctx_t));
+
+        if (fc == NULL || rev == NULL || wev == NULL || log == NULL
+            || ctx == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    ctx->connection = fc;
+    ctx->request = NULL;
+    ctx->current_request = NULL;
+
+    *log = *c->log;
+    log->data = ctx;
+    log->action = "reading client request headers";
+
+    ngx_memcpy(fc, c, sizeof(ngx_connection_t));
+
+    fc->data = NULL;
+    fc->read = rev;
+    fc->write = wev;
+    fc->fd = (ngx_socket_t) -1;
+    fc->log = log;
+    fc->sent = 0;
+    fc->buffer = NULL;
+    fc->buffered = 0;
+    fc->error = 0;
+    fc->timedout = 0;
+    fc->destroyed = 0;
+    fc->idle = 0;
+    fc->reusable = 0;
+    fc->close = 0;
+    fc->sendfile = 0;
+    fc->sndlowat = 1;
+    fc->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+    fc->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+    fc->send_chain = ngx_http_v2_send_chain;
+    fc->need_last_buf = 1;
+
+    /* the events are never added to the event module */
+
+    ngx_memzero(rev, sizeof(ngx_event_t));
+
+    rev->data = fc;
+    rev->ready = 1;
+    rev->active = 1;
+    rev->handler = ngx_http_v2_close_stream_handler;
+    rev->log = log;
+
+    ngx_memzero(wev, sizeof(ngx_event_t));
+
+    wev->data = fc;
+    wev->write = 1;
+    wev->ready = 1;
+    wev->active = 1;
+    wev->handler = ngx_http_v2_close_stream_handler;
+    wev->log = log;
+
+    r = ngx_http_create_request(fc, h2c->addr_conf->default_server);
+    if (r == NULL) {
+        fc->data = h2c->free_fake_connections;
+        h2c->free_fake_connections = fc;
+        return NULL;
+    }
+
+    stream = ngx_pcalloc(r->pool, sizeof(ngx_http_v2_stream_t));
+    if (stream == NULL) {
+        ngx_http_free_request(r, 0);
+        fc->data = h2c->free_fake_connections;
+        h2c->free_fake_connections = fc;
+        return NULL;
+    }
+
+    r->stream = stream;
+    r->virtual_names = h2c->addr_conf->virtual_names;
+
+    /* the DATA frames are copied from memory */
+    r->main_filter_need_in_memory = 1;
+
+    stream->request = r;
+    stream->connection = h2c;
+    stream->id = sid;
+    stream->weight = NGX_HTTP_V2_DEFAULT_WEIGHT;
+    stream->send_window = h2c->init_window;
+    stream->recv_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    stream->last_body = &stream->body;
+
+    index = &h2c->streams_index[ngx_http_v2_index(sid)];
+
+    stream->index = *index;
+    *index = stream;
+
+    h2c->processing++;
+    c->requests++;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 stream %ui created, processing:%ui",
+                   sid, h2c->processing);
+
+    return stream;
+}
+
+
+static ngx_http_v2_stream_t *
+ngx_http_v2_get_stream(ngx_http_v2_connection_t *h2c, ngx_uint_t sid)
+{
+    ngx_http_v2_stream_t  *stream;
+
+    for (stream = h2c->streams_index[ngx_http_v2_index(sid)];
+         stream;
+         stream = stream->index)
+    {
+        if (stream->id == sid) {
+            return stream;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_v2_process_request_body(ngx_http_v2_stream_t *stream, u_char *pos,
+    size_t size, ngx_uint_t last)
+{
+    size_t                     n;
+    ngx_buf_t                 *b;
+    ngx_chain_t               *cl;
+    ngx_connection_t          *fc;
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    r = stream->request;
+    fc = r->connection;
+
+    if (stream->skip_data) {
+        return;
+    }
+
+    if (size) {
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (clcf->client_max_body_size
+            && stream->body_size + (off_t) size > clcf->client_max_body_size)
+        {
+            ngx_log_error(NGX_LOG_ERR, fc->log, 0,
+                          "client intended to send too large body: "
+                          "%O bytes", stream->body_size + (off_t) size);
+
+            stream->skip_data = 1;
+            stream->body_too_large = 1;
+
+            if (r->read_event_handler
+                == ngx_http_v2_read_client_request_body_handler)
+            {
+                ngx_http_finalize_request(r,
+                                          NGX_HTTP_REQUEST_ENTITY_TOO_LARGE);
+                ngx_http_run_posted_requests(fc);
+            }
+
+            return;
+        }
+
+        stream->body_size += size;
+
+        cl = (stream->last_body == &stream->body)
+             ? NULL
+             : (ngx_chain_t *) ((u_char *) stream->last_body
+                                - offsetof(ngx_chain_t, next));
+
+        while (size) {
+            if (cl == NULL || cl->buf->last == cl->buf->end) {
+                b = ngx_create_temp_buf(r->pool, ngx_max(size,
+                                              clcf->client_body_buffer_size));
+                if (b == NULL) {
+                    goto failed;
+                }
+
+                cl = ngx_alloc_chain_link(r->pool);
+                if (cl == NULL) {
+                    goto failed;
+                }
+
+                cl->buf = b;
+                cl->next = NULL;
+
+                *stream->last_body = cl;
+                stream->last_body = &cl->next;
+            }
+
+            b = cl->buf;
+
+            n = ngx_min(size, (size_t) (b->end - b->last));
+            b->last = ngx_cpymem(b->last, pos, n);
+
+            pos += n;
+            size -= n;
+        }
+    }
+
+    if (!last
+        || r->read_event_handler
+           != ngx_http_v2_read_client_request_body_handler)
+    {
+        return;
+    }
+
+    if (fc->read->timer_set) {
+        ngx_del_timer(fc->read);
+    }
+
+    ngx_http_v2_finish_request_body(r);
+
+    r->request_body->post_handler(r);
+
+    ngx_http_run_posted_requests(fc);
+
+    return;
+
+failed:
+
+    stream->skip_data = 1;
+
+    if (r->read_event_handler == ngx_http_v2_read_client_request_body_handler) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        ngx_http_run_posted_requests(fc);
+    }
+}
+
+
+ngx_int_t
+ngx_http_v2_read_request_body(ngx_http_request_t *r,
+    ngx_http_client_body_handler_pt post_handler)
+{
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_request_body_t   *rb;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    stream = r->stream;
+
+    rb = ngx_pcalloc(r->pool, sizeof(ngx_http_request_body_t));
+    if (rb == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    rb->post_handler = post_handler;
+    r->request_body = rb;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (stream->body_too_large
+        || (clcf->client_max_body_size
+            && stream->body_size > clcf->client_max_body_size))
+    {
+        stream->skip_data = 1;
+        return NGX_HTTP_REQUEST_ENTITY_TOO_LARGE;
+    }
+
+    if (stream->skip_data) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (!stream->in_closed) {
+        r->read_event_handler = ngx_http_v2_read_client_request_body_handler;
+        r->write_event_handler = ngx_http_request_empty_handler;
+
+        ngx_add_timer(r->connection->read, clcf->client_body_timeout);
+
+        return NGX_AGAIN;
+    }
+
+    ngx_http_v2_finish_request_body(r);
+
+    post_handler(r);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_finish_request_body(ngx_http_request_t *r)
+{
+    u_char                *p;
+    ngx_str_t              name, value;
+    ngx_http_v2_stream_t  *stream;
+
+    stream = r->stream;
+
+    r->request_body->bufs = stream->body;
+    r->read_event_handler = ngx_http_block_reading;
+
+    if (r->headers_in.content_length_n == stream->body_size
+        || (r->headers_in.content_length_n == -1 && stream->body_size == 0))
+    {
+        return;
+    }
+
+    /* the length is passed to the upstream as the body is not chunked */
+
+    r->headers_in.content_length_n = stream->body_size;
+
+    p = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+    if (p == NULL) {
+        return;
+    }
+
+    value.data = p;
+    value.len = ngx_sprintf(p, "%O", stream->body_size) - p;
+
+    if (r->headers_in.content_length) {
+        r->headers_in.content_length->value = value;
+        return;
+    }
+
+    ngx_str_set(&name, "content-length");
+
+    (void) ngx_http_v2_push_header(r, &name, &value);
+}
+
+
+static void
+ngx_http_v2_read_client_request_body_handler(ngx_http_request_t *r)
+{
+    ngx_connection_t  *fc;
+
+    fc = r->connection;
+
+    if (fc->read->timedout) {
+        ngx_log_error(NGX_LOG_INFO, fc->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        fc->timedout = 1;
+        r->stream->skip_data = 1;
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    if (fc->error) {
+        ngx_log_error(NGX_LOG_INFO, fc->log, 0,
+                      "client prematurely closed stream");
+        r->stream->skip_data = 1;
+        ngx_http_finalize_request(r, NGX_HTTP_CLIENT_CLOSED_REQUEST);
+        return;
+    }
+}
+
+
+u_char *
+ngx_http_v2_write_frame_head(u_char *p, size_t length, ngx_uint_t type,
+    ngx_uint_t flags, ngx_uint_t sid)
+{
+    *p++ = (u_char) (length >> 16);
+    *p++ = (u_char) (length >> 8);
+    *p++ = (u_char) length;
+    *p++ = (u_char) type;
+    *p++ = (u_char) flags;
+
+    return ngx_http_v2_write_uint32(p, sid);
+}
+
+
+ngx_http_v2_out_frame_t *
+ngx_http_v2_get_frame(ngx_pool_t *pool, size_t size)
+{
+    ngx_http_v2_out_frame_t  *frame;
+
+    frame = ngx_palloc(pool, sizeof(ngx_http_v2_out_frame_t) + size);
+    if (frame == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(frame, sizeof(ngx_http_v2_out_frame_t));
+
+    frame->size = size;
+
+    frame->buf.start = (u_char *) frame + sizeof(ngx_http_v2_out_frame_t);
+    frame->buf.pos = frame->buf.start;
+    frame->buf.last = frame->buf.start;
+    frame->buf.end = frame->buf.start + size;
+    frame->buf.temporary = 1;
+
+    frame->chain.buf = &frame->buf;
+
+    return frame;
+}
+
+
+/*
+ * a frame is queued after the frames of higher or equal weight, after
+ * the frames of its own stream and after the frames being sent already;
+ * the header blocks keep their order as they share the HPACK state
+ */
+
+void
+ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame)
+{
+    ngx_http_v2_out_frame_t  **out, **ll;
+
+    ll = &h2c->out;
+
+    for (out = &h2c->out; *out; out = &(*out)->next) {
+
+        if ((*out)->started
+            || (*out)->weight >= frame->weight
+            || (frame->stream && (*out)->stream == frame->stream)
+            || (frame->headers && (*out)->headers))
+        {
+            ll = &(*out)->next;
+        }
+    }
+
+    frame->next = *ll;
+    *ll = frame;
+}
+
+
+ngx_int_t
+ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
+{
+    ngx_chain_t                *cl;
+    ngx_event_t                *wev;
+    ngx_connection_t           *c;
+    ngx_http_core_loc_conf_t   *clcf;
+    ngx_http_v2_out_frame_t    *frame, *next;
+
+    c = h2c->connection;
+    wev = c->write;
+
+    if (c->error) {
+        return NGX_ERROR;
+    }
+
+    if (h2c->out == NULL || !wev->ready) {
+        return NGX_OK;
+    }
+
+    for (frame = h2c->out; frame; frame = frame->next) {
+        frame->chain.next = frame->next ? &frame->next->chain : NULL;
+    }
+
+    cl = c->send_chain(c, &h2c->out->chain, 0);
+
+    if (cl == NGX_CHAIN_ERROR) {
+        c->error = 1;
+
+        if (!h2c->blocked) {
+            ngx_post_event(wev, &ngx_posted_events);
+        }
+
+        return NGX_ERROR;
+    }
+
+    for (frame = h2c->out; frame; frame = next) {
+
+        if (frame->buf.pos != frame->buf.last) {
+            frame->started = (frame->buf.pos != frame->buf.start);
+            break;
+        }
+
+        next = frame->next;
+
+        (void) frame->handler(h2c, frame);
+    }
+
+    h2c->out = frame;
+
+    if (frame == NULL) {
+        if (wev->timer_set) {
+            ngx_del_timer(wev);
+        }
+
+        return NGX_OK;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(h2c->addr_conf->default_server->ctx,
+                                        ngx_http_core_module);
+
+    ngx_add_timer(wev, clcf->send_timeout);
+
+    if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+        c->error = 1;
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_v2_wait_window(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_stream_t *stream)
+{
+    if (!stream->waiting) {
+        ngx_queue_insert_tail(&h2c->waiting, &stream->queue);
+        stream->waiting = 1;
+    }
+}
+
+
+void
+ngx_http_v2_wake_stream(ngx_http_v2_stream_t *stream)
+{
+    ngx_event_t  *wev;
+
+    wev = stream->request->connection->write;
+
+    if (wev->handler == ngx_http_v2_close_stream_handler) {
+
+        /* the deferred close of a stream waits for its frames */
+
+        if (stream->queued == 0) {
+            ngx_post_event(wev, &ngx_posted_events);
+        }
+
+        return;
+    }
+
+    if (wev->ready) {
+        return;
+    }
+
+    wev->ready = 1;
+
+    if (!wev->delayed) {
+        ngx_post_event(wev, &ngx_posted_events);
+    }
+}
+
+
+static ngx_http_v2_out_frame_t *
+ngx_http_v2_get_control_frame(ngx_http_v2_connection_t *h2c)
+{
+    ngx_http_v2_out_frame_t  *frame;
+
+    frame = h2c->free_frames;
+
+    if (frame) {
+        h2c->free_frames = frame->next;
+
+        frame->buf.pos = frame->buf.start;
+        frame->buf.last = frame->buf.start;
+        frame->started = 0;
+
+    } else {
+        frame = ngx_http_v2_get_frame(h2c->connection->pool,
+                                      NGX_HTTP_V2_CONTROL_FRAME_SIZE);
+        if (frame == NULL) {
+            return NULL;
+        }
+    }
+
+    frame->handler = ngx_http_v2_control_frame_handler;
+    frame->weight = NGX_HTTP_V2_CONTROL_WEIGHT;
+
+    return frame;
+}
+
+
+static ngx_int_t
+ngx_http_v2_control_frame_handler(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame)
+{
+    frame->next = h2c->free_frames;
+    h2c->free_frames = frame;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_send_settings(ngx_http_v2_connection_t *h2c, ngx_uint_t ack)
+{
+    u_char                   *p;
+    ngx_http_v2_out_frame_t  *frame;
+
+    frame = ngx_http_v2_get_control_frame(h2c);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = frame->buf.last;
+
+    if (ack) {
+        p = ngx_http_v2_write_frame_head(p, 0, NGX_HTTP_V2_SETTINGS_FRAME,
+                                         NGX_HTTP_V2_ACK_FLAG, 0);
+
+    } else {
+        p = ngx_http_v2_write_frame_head(p,
+                                         2 * NGX_HTTP_V2_SETTINGS_PARAM_SIZE,
+                                         NGX_HTTP_V2_SETTINGS_FRAME,
+                                         NGX_HTTP_V2_NO_FLAG, 0);
+
+        p = ngx_http_v2_write_uint16(p, NGX_HTTP_V2_MAX_STREAMS_SETTING);
+        p = ngx_http_v2_write_uint32(p, h2c->h2scf->concurrent_streams);
+
+        p = ngx_http_v2_write_uint16(p,
+                                     NGX_HTTP_V2_MAX_HEADER_LIST_SIZE_SETTING);
+        p = ngx_http_v2_write_uint32(p, h2c->h2scf->max_header_size);
+    }
+
+    frame->buf.last = p;
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_send_window_update(ngx_http_v2_connection_t *h2c, ngx_uint_t sid,
+    size_t window)
+{
+    u_char                   *p;
+    ngx_http_v2_out_frame_t  *frame;
+
+    frame = ngx_http_v2_get_control_frame(h2c);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_http_v2_write_frame_head(frame->buf.last, 4,
+                                     NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                     NGX_HTTP_V2_NO_FLAG, sid);
+    frame->buf.last = ngx_http_v2_write_uint32(p, window);
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_send_rst_stream(ngx_http_v2_connection_t *h2c, ngx_uint_t sid,
+    ngx_uint_t status)
+{
+    u_char                   *p;
+    ngx_http_v2_out_frame_t  *frame;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 send RST_STREAM sid:%ui status:%ui", sid, status);
+
+    frame = ngx_http_v2_get_control_frame(h2c);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_http_v2_write_frame_head(frame->buf.last, 4,
+                                     NGX_HTTP_V2_RST_STREAM_FRAME,
+                                     NGX_HTTP_V2_NO_FLAG, sid);
+    frame->buf.last = ngx_http_v2_write_uint32(p, status);
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_send_goaway(ngx_http_v2_connection_t *h2c, ngx_uint_t status)
+{
+    u_char                   *p;
+    ngx_http_v2_out_frame_t  *frame;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 send GOAWAY status:%ui", status);
+
+    frame = ngx_http_v2_get_control_frame(h2c);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_http_v2_write_frame_head(frame->buf.last, 8,
+                                     NGX_HTTP_V2_GOAWAY_FRAME,
+                                     NGX_HTTP_V2_NO_FLAG, 0);
+    p = ngx_http_v2_write_uint32(p, h2c->last_sid);
+    frame->buf.last = ngx_http_v2_write_uint32(p, status);
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_stream_error(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_stream_t *stream, ngx_uint_t status)
+{
+    if (ngx_http_v2_send_rst_stream(h2c, stream->id, status) != NGX_OK) {
+        return NGX_HTTP_V2_INTERNAL_ERROR;
+    }
+
+    stream->in_closed = 1;
+    stream->out_closed = 1;
+
+    ngx_http_v2_terminate_stream(h2c, stream);
+
+    return NGX_HTTP_V2_NO_ERROR;
+}
+
+
+static void
+ngx_http_v2_terminate_stream(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_stream_t *stream)
+{
+    ngx_event_t       *ev;
+    ngx_connection_t  *fc;
+
+    fc = stream->request->connection;
+
+    fc->error = 1;
+    stream->skip_data = 1;
+
+    if (stream->waiting) {
+        ngx_queue_remove(&stream->queue);
+        stream->waiting = 0;
+    }
+
+    /* a response blocked on the flow control learns it from a write */
+
+    if (stream->queued || !fc->write->ready) {
+        ev = fc->write;
+        ev->ready = 1;
+
+        if (stream->queued) {
+            return;
+        }
+
+    } else {
+        ev = fc->read;
+        ev->eof = 1;
+    }
+
+    ev->handler(ev);
+}
+
+
+static void
+ngx_http_v2_close_stream_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *fc;
+    ngx_http_request_t  *r;
+
+    fc = ev->data;
+    r = fc->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                   "http2 close stream handler");
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, fc->log, NGX_ETIMEDOUT, "client timed out");
+        fc->timedout = 1;
+        r->stream->queued = 0;
+    }
+
+    ngx_http_v2_close_stream(r->stream, 0);
+}
+
+
+void
+ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc)
+{
+    ngx_event_t               *ev;
+    ngx_connection_t          *fc;
+    ngx_http_v2_stream_t     **index;
+    ngx_http_v2_connection_t  *h2c;
+
+    h2c = stream->connection;
+    fc = stream->request->connection;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 close stream %ui, queued:%ui, processing:%ui",
+                   stream->id, stream->queued, h2c->processing);
+
+    if (stream->queued && !h2c->connection->error) {
+
+        /* the frames of the stream reference its pool */
+
+        fc->write->handler = ngx_http_v2_close_stream_handler;
+        fc->read->handler = ngx_http_v2_close_stream_handler;
+        return;
+    }
+
+    if (!stream->out_closed) {
+        if (ngx_http_v2_send_rst_stream(h2c, stream->id,
+                                        fc->timedout
+                                        ? NGX_HTTP_V2_PROTOCOL_ERROR
+                                        : NGX_HTTP_V2_INTERNAL_ERROR)
+            != NGX_OK)
+        {
+            h2c->connection->error = 1;
+        }
+
+    } else if (!stream->in_closed) {
+
+        /* the response is complete, the rest of the body is not needed */
+
+        if (ngx_http_v2_send_rst_stream(h2c, stream->id,
+                                        NGX_HTTP_V2_NO_ERROR)
+            != NGX_OK)
+        {
+            h2c->connection->error = 1;
+        }
+    }
+
+    for (index = &h2c->streams_index[ngx_http_v2_index(stream->id)];
+         *index;
+         index = &(*index)->index)
+    {
+        if (*index == stream) {
+            *index = stream->index;
+            break;
+        }
+    }
+
+    if (stream->waiting) {
+        ngx_queue_remove(&stream->queue);
+    }
+
+    h2c->processing--;
+
+    ev = fc->read;
+
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
+
+    if (ev->prev) {
+        ngx_delete_posted_event(ev);
+    }
+
+    ev = fc->write;
+
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
+
+    if (ev->prev) {
+        ngx_delete_posted_event(ev);
+    }
+
+    /* the stream is allocated from the request pool */
+
+    ngx_http_free_request(stream->request, rc);
+
+    fc->data = h2c->free_fake_connections;
+    h2c->free_fake_connections = fc;
+
+    ngx_http_v2_handle_connection(h2c);
+}
+
+
+static void
+ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
+    ngx_uint_t status)
+{
+    ngx_uint_t                 i;
+    ngx_event_t               *ev;
+    ngx_connection_t          *c, *fc;
+    ngx_http_v2_stream_t      *stream, *next;
+    ngx_http_v2_out_frame_t   *frame, *fnext;
+
+    c = h2c->connection;
+
+    h2c->blocked = 1;
+
+    if (!c->error && !h2c->goaway) {
+        h2c->goaway = 1;
+
+        if (ngx_http_v2_send_goaway(h2c, status) == NGX_OK) {
+            (void) ngx_http_v2_send_output_queue(h2c);
+        }
+    }
+
+    c->error = 1;
+
+    for (frame = h2c->out; frame; frame = fnext) {
+        fnext = frame->next;
+        (void) frame->handler(h2c, frame);
+    }
+
+    h2c->out = NULL;
+
+    for (i = 0; i < NGX_HTTP_V2_INDEX_SIZE; i++) {
+
+        for (stream = h2c->streams_index[i]; stream; stream = next) {
+            next = stream->index;
+
+            stream->in_closed = 1;
+            stream->out_closed = 1;
+            stream->skip_data = 1;
+
+            fc = stream->request->connection;
+            fc->error = 1;
+
+            ev = fc->read;
+            ev->eof = 1;
+            ev->handler(ev);
+        }
+    }
+
+    h2c->blocked = 0;
+
+    if (h2c->processing) {
+        c->read->handler = ngx_http_empty_handler;
+        c->write->handler = ngx_http_empty_handler;
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+
+        if (c->write->timer_set) {
+            ngx_del_timer(c->write);
+        }
+
+        return;
+    }
+
+    ngx_http_close_connection(c);
+}
+
+
+static ngx_int_t
+ngx_http_v2_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_v2_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
+    uintptr_t data)
+{
+    if (r->main->stream) {
+        v->len = sizeof("h2c") - 1;
+        v->valid = 1;
+        v->no_cacheable = 0;
+        v->not_found = 0;
+        v->data = (u_char *) "h2c";
+
+        return NGX_OK;
+    }
+
+    *v = ngx_http_variable_null_value;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_v2_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_v2_srv_conf_t  *h2scf;
+
+    h2scf = ngx_pcalloc(cf->pool, sizeof(ngx_http_v2_srv_conf_t));
+    if (h2scf == NULL) {
+        return NULL;
+    }
+
+    h2scf->concurrent_streams = NGX_CONF_UNSET_UINT;
+    h2scf->chunk_size = NGX_CONF_UNSET_SIZE;
+    h2scf->max_field_size = NGX_CONF_UNSET_SIZE;
+    h2scf->max_header_size = NGX_CONF_UNSET_SIZE;
+    h2scf->recv_timeout = NGX_CONF_UNSET_MSEC;
+    h2scf->idle_timeout = NGX_CONF_UNSET_MSEC;
+
+    return h2scf;
+}
+
+
+static char *
+ngx_http_v2_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_v2_srv_conf_t *prev = parent;
+    ngx_http_v2_srv_conf_t *conf = child;
+
+    ngx_conf_merge_uint_value(conf->concurrent_streams,
+                              prev->concurrent_streams, 128);
+
+    ngx_conf_merge_size_value(conf->chunk_size, prev->chunk_size, 8 * 1024);
+
+    ngx_conf_merge_size_value(conf->max_field_size, prev->max_field_size,
+                              4096);
+    ngx_conf_merge_size_value(conf->max_header_size, prev->max_header_size,
+                              16384);
+
+    ngx_conf_merge_msec_value(conf->recv_timeout, prev->recv_timeout, 30000);
+    ngx_conf_merge_msec_value(conf->idle_timeout, prev->idle_timeout, 180000);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_v2_chunk_size(ngx_conf_t *cf, void *post, void *data)
+{
+    size_t *sp = data;
+
+    if (*sp == 0) {
+        return "value is too small";
+    }
+
+    if (*sp > NGX_HTTP_V2_MAX_FRAME_SIZE) {
+        *sp = NGX_HTTP_V2_MAX_FRAME_SIZE;
+    }
+
+    return NGX_CONF_OK;
+}
@@ -0,0 +1,237 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_HTTP_V2_H_INCLUDED_
+#define _NGX_HTTP_V2_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_V2_FRAME_HEADER_SIZE      9
+#define NGX_HTTP_V2_DEFAULT_FRAME_SIZE     (1 << 14)
+#define NGX_HTTP_V2_MAX_FRAME_SIZE         ((1 << 24) - 1)
+
+#define NGX_HTTP_V2_DEFAULT_WINDOW         65535
+#define NGX_HTTP_V2_MAX_WINDOW             ((1U << 31) - 1)
+
+#define NGX_HTTP_V2_TABLE_SIZE             4096
+#define NGX_HTTP_V2_DEFAULT_WEIGHT         16
+
+/* frames of a single stream waiting in the output queue */
+#define NGX_HTTP_V2_MAX_QUEUED             4
+
+#define NGX_HTTP_V2_DATA_FRAME             0x0
+#define NGX_HTTP_V2_HEADERS_FRAME          0x1
+#define NGX_HTTP_V2_PRIORITY_FRAME         0x2
+#define NGX_HTTP_V2_RST_STREAM_FRAME       0x3
+#define NGX_HTTP_V2_SETTINGS_FRAME         0x4
+#define NGX_HTTP_V2_PUSH_PROMISE_FRAME     0x5
+#define NGX_HTTP_V2_PING_FRAME             0x6
+#define NGX_HTTP_V2_GOAWAY_FRAME           0x7
+#define NGX_HTTP_V2_WINDOW_UPDATE_FRAME    0x8
+#define NGX_HTTP_V2_CONTINUATION_FRAME     0x9
+
+#define NGX_HTTP_V2_NO_FLAG                0x00
+#define NGX_HTTP_V2_ACK_FLAG               0x01
+#define NGX_HTTP_V2_END_STREAM_FLAG        0x01
+#define NGX_HTTP_V2_END_HEADERS_FLAG       0x04
+#define NGX_HTTP_V2_PADDED_FLAG            0x08
+#define NGX_HTTP_V2_PRIORITY_FLAG          0x20
+
+#define NGX_HTTP_V2_NO_ERROR               0x0
+#define NGX_HTTP_V2_PROTOCOL_ERROR         0x1
+#define NGX_HTTP_V2_INTERNAL_ERROR         0x2
+#define NGX_HTTP_V2_FLOW_CTRL_ERROR        0x3
+#define NGX_HTTP_V2_SETTINGS_TIMEOUT       0x4
+#define NGX_HTTP_V2_STREAM_CLOSED          0x5
+#define NGX_HTTP_V2_SIZE_ERROR             0x6
+#define NGX_HTTP_V2_REFUSED_STREAM         0x7
+#define NGX_HTTP_V2_CANCEL                 0x8
+#define NGX_HTTP_V2_COMP_ERROR             0x9
+#define NGX_HTTP_V2_CONNECT_ERROR          0xa
+#define NGX_HTTP_V2_ENHANCE_YOUR_CALM      0xb
+#define NGX_HTTP_V2_INADEQUATE_SECURITY    0xc
+#define NGX_HTTP_V2_HTTP_1_1_REQUIRED      0xd
+
+
+typedef struct ngx_http_v2_connection_s   ngx_http_v2_connection_t;
+typedef struct ngx_http_v2_out_frame_s    ngx_http_v2_out_frame_t;
+
+
+typedef struct {
+    ngx_uint_t                       concurrent_streams;
+    size_t                           chunk_size;
+    size_t                           max_field_size;
+    size_t                           max_header_size;
+    ngx_msec_t                       recv_timeout;
+    ngx_msec_t                       idle_timeout;
+} ngx_http_v2_srv_conf_t;
+
+
+typedef struct {
+    ngx_str_t                        name;
+    ngx_str_t                        value;
+} ngx_http_v2_header_t;
+
+
+/*
+ * the HPACK dynamic table, the newest entry has the lowest index;
+ * the entries live in a ring of separately allocated headers
+ */
+
+typedef struct {
+    ngx_http_v2_header_t           **entries;
+    ngx_uint_t                       first;
+    ngx_uint_t                       count;
+    ngx_uint_t                       allocated;
+    size_t                           size;
+    size_t                           max;
+} ngx_http_v2_hpack_t;
+
+
+struct ngx_http_v2_stream_s {
+    ngx_http_request_t              *request;
+    ngx_http_v2_connection_t        *connection;
+    ngx_http_v2_stream_t            *index;
+
+    ngx_uint_t                       id;
+    ngx_uint_t                       weight;
+
+    ssize_t                          send_window;
+    size_t                           recv_window;
+
+    ngx_uint_t                       queued;
+    ngx_http_v2_out_frame_t         *free_frames;
+
+    ngx_queue_t                      queue;
+
+    /* the request body as it arrives in DATA frames */
+    ngx_chain_t                     *body;
+    ngx_chain_t                    **last_body;
+    off_t                            body_size;
+
+    ngx_str_t                        path;
+    ngx_str_t                        authority;
+    ngx_array_t                     *cookies;
+
+    unsigned                         in_closed:1;
+    unsigned                         out_closed:1;
+    unsigned                         skip_data:1;
+    unsigned                         body_too_large:1;
+    unsigned                         waiting:1;
+    unsigned                         scheme:1;
+    unsigned                         invalid:1;
+};
+
+
+struct ngx_http_v2_out_frame_s {
+    ngx_http_v2_out_frame_t         *next;
+    ngx_http_v2_stream_t            *stream;
+    ngx_int_t                      (*handler)(ngx_http_v2_connection_t *h2c,
+                                        ngx_http_v2_out_frame_t *frame);
+    ngx_chain_t                      chain;
+    ngx_buf_t                        buf;
+    size_t                           size;
+    ngx_uint_t                       weight;
+
+    unsigned                         started:1;
+    unsigned                         headers:1;
+    unsigned                         fin:1;
+};
+
+
+struct ngx_http_v2_connection_s {
+    ngx_connection_t                *connection;
+    ngx_http_addr_conf_t            *addr_conf;
+    ngx_http_v2_srv_conf_t          *h2scf;
+
+    ngx_uint_t                       processing;
+
+    ssize_t                          send_window;
+    size_t                           recv_window;
+    size_t                           init_window;
+    size_t                           frame_size;
+
+    ngx_queue_t                      waiting;
+
+    ngx_http_v2_stream_t           **streams_index;
+
+    ngx_http_v2_out_frame_t         *out;
+    ngx_http_v2_out_frame_t         *free_frames;
+    ngx_connection_t                *free_fake_connections;
+
+    ngx_buf_t                       *in;
+
+    /* the header block of HEADERS and CONTINUATION frames */
+    u_char                          *hblock;
+    size_t                           hlen;
+    ngx_uint_t                       hsid;
+    ngx_uint_t                       hflags;
+    ngx_uint_t                       hweight;
+
+    u_char                          *field;
+
+    ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_hpack_t              hpack_out;
+
+    ngx_uint_t                       last_sid;
+
+    unsigned                         preface:1;
+    unsigned                         hpack_out_update:1;
+    unsigned                         blocked:1;
+    unsigned                         goaway:1;
+};
+
+
+#define ngx_http_v2_parse_uint16(p)  ((p)[0] << 8 | (p)[1])
+#define ngx_http_v2_parse_uint32(p)                                          \
+    ((uint32_t) (p)[0] << 24 | (p)[1] << 16 | (p)[2] << 8 | (p)[3])
+
+#define ngx_http_v2_write_uint16(p, s)                                        \
+    ((p)[0] = (u_char) ((s) >> 8), (p)[1] = (u_char) (s), (p) + 2)
+#define ngx_http_v2_write_uint32(p, s)                                        \
+    ((p)[0] = (u_char) ((s) >> 24), (p)[1] = (u_char) ((s) >> 16),           \
+     (p)[2] = (u_char) ((s) >> 8), (p)[3] = (u_char) (s), (p) + 4)
+
+
+void ngx_http_v2_init(ngx_event_t *rev, ngx_http_addr_conf_t *addr_conf);
+ngx_int_t ngx_http_v2_read_request_body(ngx_http_request_t *r,
+    ngx_http_client_body_handler_pt post_handler);
+void ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc);
+
+u_char *ngx_http_v2_write_frame_head(u_char *p, size_t length,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid);
+ngx_http_v2_out_frame_t *ngx_http_v2_get_frame(ngx_pool_t *pool, size_t size);
+void ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame);
+ngx_int_t ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c);
+void ngx_http_v2_wait_window(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_stream_t *stream);
+void ngx_http_v2_wake_stream(ngx_http_v2_stream_t *stream);
+
+ngx_int_t ngx_http_v2_table_get(ngx_http_v2_hpack_t *hpack, ngx_uint_t index,
+    ngx_http_v2_header_t *header);
+ngx_int_t ngx_http_v2_table_add(ngx_http_v2_hpack_t *hpack,
+    ngx_str_t *name, ngx_str_t *value);
+void ngx_http_v2_table_resize(ngx_http_v2_hpack_t *hpack, size_t max);
+ngx_uint_t ngx_http_v2_table_find(ngx_http_v2_hpack_t *hpack,
+    ngx_str_t *name, ngx_str_t *value, ngx_uint_t *name_index);
+void ngx_http_v2_table_free(void *data);
+ngx_int_t ngx_http_v2_huff_decode(u_char *src, size_t len, u_char *dst,
+    size_t *size);
+
+ngx_chain_t *ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in,
+    off_t limit);
+
+
+extern ngx_module_t  ngx_http_v2_module;
+
+
+#endif /* _NGX_HTTP_V2_H_INCLUDED_ */
@@ -0,0 +1,1037 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include <nginx.h>
+
+
+/* an integer of up to 2^28 with its prefix octet */
+#define NGX_HTTP_V2_INT_OCTETS             4
+
+#define NGX_HTTP_V2_FIELD_LEN(name, value)                                    \
+    (1 + NGX_HTTP_V2_INT_OCTETS + (name) + NGX_HTTP_V2_INT_OCTETS + (value))
+
+#define NGX_HTTP_V2_STATUS_INDEX           8
+
+/*
+ * the smallest DATA frame sent when more data wait for the flow control
+ * window: about a TCP segment, less is left for the next WINDOW_UPDATE
+ */
+#define NGX_HTTP_V2_MIN_DATA_SIZE          1400
+
+
+typedef enum {
+    ngx_http_v2_without_indexing = 0,
+    ngx_http_v2_incremental_indexing
+} ngx_http_v2_indexing_e;
+
+
+static u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
+    ngx_uint_t value);
+static u_char *ngx_http_v2_write_field(ngx_http_v2_connection_t *h2c,
+    u_char *pos, ngx_str_t *name, ngx_str_t *value,
+    ngx_http_v2_indexing_e indexing);
+static u_char *ngx_http_v2_write_status(u_char *pos, ngx_uint_t status);
+static ngx_uint_t ngx_http_v2_indexed_header(ngx_str_t *name);
+static ngx_uint_t ngx_http_v2_connection_header(ngx_str_t *name);
+static ngx_chain_t *ngx_http_v2_next_data(ngx_chain_t *in, ngx_uint_t *last);
+static ngx_int_t ngx_http_v2_headers_frame_handler(
+    ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
+static ngx_int_t ngx_http_v2_data_frame_handler(
+    ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
+static ngx_int_t ngx_http_v2_filter_init(ngx_conf_t *cf);
+
+
+static ngx_http_module_t  ngx_http_v2_filter_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_v2_filter_init,               /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_v2_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_v2_filter_module_ctx,        /* module context */
+    NULL,                                  /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+
+
+/* the response headers worth a place in the dynamic table of the client */
+
+static ngx_str_t  ngx_http_v2_indexed_headers[] = {
+    ngx_string("server"),
+    ngx_string("content-type"),
+    ngx_string("cache-control"),
+    ngx_string("vary"),
+    ngx_string("accept-ranges"),
+    ngx_string("content-encoding"),
+    ngx_null_string
+};
+
+
+static ngx_str_t  ngx_http_v2_connection_headers[] = {
+    ngx_string("connection"),
+    ngx_string("keep-alive"),
+    ngx_string("proxy-connection"),
+    ngx_string("transfer-encoding"),
+    ngx_string("upgrade"),
+    ngx_null_string
+};
+
+
+static ngx_int_t
+ngx_http_v2_header_filter(ngx_http_request_t *r)
+{
+    u_char                    *p, *start, *last, *lowcase, *tmp;
+    size_t                     len, size, frame_size;
+    ngx_str_t                  name, value, host;
+    ngx_uint_t                 i, n, status, port, nframes, flags;
+    ngx_list_part_t           *part;
+    ngx_table_elt_t           *header;
+    ngx_connection_t          *fc;
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_out_frame_t   *frame;
+    ngx_http_core_loc_conf_t  *clcf;
+    ngx_http_core_srv_conf_t  *cscf;
+    ngx_http_v2_connection_t  *h2c;
+    struct sockaddr_in        *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6       *sin6;
+#endif
+    u_char                     addr[NGX_SOCKADDR_STRLEN];
+
+    stream = r->main->stream;
+
+    if (stream == NULL) {
+        return ngx_http_next_header_filter(r);
+    }
+
+    if (r->header_sent) {
+        return NGX_OK;
+    }
+
+    r->header_sent = 1;
+
+    if (r != r->main) {
+        return NGX_OK;
+    }
+
+    fc = r->connection;
+    h2c = stream->connection;
+
+    if (stream->out_closed || fc->error) {
+        return NGX_ERROR;
+    }
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->header_only = 1;
+    }
+
+    if (r->headers_out.last_modified_time != -1) {
+        if (r->headers_out.status != NGX_HTTP_OK
+            && r->headers_out.status != NGX_HTTP_PARTIAL_CONTENT
+            && r->headers_out.status != NGX_HTTP_NOT_MODIFIED)
+        {
+            r->headers_out.last_modified_time = -1;
+            r->headers_out.last_modified = NULL;
+        }
+    }
+
+    status = r->headers_out.status;
+
+    if (status == 0 && r->headers_out.status_line.len >= 3) {
+        status = ngx_atoi(r->headers_out.status_line.data, 3);
+
+        if (status == (ngx_uint_t) NGX_ERROR) {
+            status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    if (status == NGX_HTTP_NO_CONTENT || status == NGX_HTTP_NOT_MODIFIED) {
+        r->header_only = 1;
+        ngx_str_null(&r->headers_out.content_type);
+        r->headers_out.content_length = NULL;
+        r->headers_out.content_length_n = -1;
+        r->headers_out.last_modified_time = -1;
+        r->headers_out.last_modified = NULL;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    /* the upper bound of the header block */
+
+    len = 1 + NGX_HTTP_V2_INT_OCTETS                    /* table size update */
+          + NGX_HTTP_V2_FIELD_LEN(sizeof(":status") - 1, 3)
+          + NGX_HTTP_V2_FIELD_LEN(sizeof("server") - 1,
+                                  sizeof(NGINX_VER) - 1)
+          + NGX_HTTP_V2_FIELD_LEN(sizeof("date") - 1,
+                                  sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1);
+
+    /* the longest header name for the lowercase copy */
+    n = sizeof("last-modified") - 1;
+
+    if (r->headers_out.content_type.len) {
+        len += NGX_HTTP_V2_FIELD_LEN(sizeof("content-type") - 1,
+                                     r->headers_out.content_type.len
+                                     + sizeof("; charset=") - 1
+                                     + r->headers_out.charset.len);
+    }
+
+    if (r->headers_out.content_length == NULL
+        && r->headers_out.content_length_n >= 0)
+    {
+        len += NGX_HTTP_V2_FIELD_LEN(sizeof("content-length") - 1,
+                                     NGX_OFF_T_LEN);
+    }
+
+    if (r->headers_out.last_modified == NULL
+        && r->headers_out.last_modified_time != -1)
+    {
+        len += NGX_HTTP_V2_FIELD_LEN(sizeof("last-modified") - 1,
+                                     sizeof("Mon, 28 Sep 1970 06:00:00 GMT")
+                                     - 1);
+    }
+
+    ngx_str_null(&host);
+    port = 0;
+
+    if (r->headers_out.location
+        && r->headers_out.location->value.len
+        && r->headers_out.location->value.data[0] == '/')
+    {
+        r->headers_out.location->hash = 0;
+
+        if (clcf->server_name_in_redirect) {
+            cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
+            host = cscf->server_name;
+
+        } else if (r->headers_in.server.len) {
+            host = r->headers_in.server;
+
+        } else {
+            host.len = NGX_SOCKADDR_STRLEN;
+            host.data = addr;
+
+            if (ngx_connection_local_sockaddr(fc, &host, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        switch (fc->local_sockaddr->sa_family) {
+
+#if (NGX_HAVE_INET6)
+        case AF_INET6:
+            sin6 = (struct sockaddr_in6 *) fc->local_sockaddr;
+            port = ntohs(sin6->sin6_port);
+            break;
+#endif
+#if (NGX_HAVE_UNIX_DOMAIN)
+        case AF_UNIX:
+            port = 0;
+            break;
+#endif
+        default: /* AF_INET */
+            sin = (struct sockaddr_in *) fc->local_sockaddr;
+            port = ntohs(sin->sin_port);
+            break;
+        }
+
+        if (!clcf->port_in_redirect || port == 80) {
+            port = 0;
+        }
+
+        len += NGX_HTTP_V2_FIELD_LEN(sizeof("location") - 1,
+                                     sizeof("http://:65535") - 1 + host.len
+                                     + r->headers_out.location->value.len);
+    }
+
+#if (NGX_HTTP_GZIP)
+    if (r->gzip_vary) {
+        if (clcf->gzip_vary) {
+            len += NGX_HTTP_V2_FIELD_LEN(sizeof("vary") - 1,
+                                         sizeof("Accept-Encoding") - 1);
+
+        } else {
+            r->gzip_vary = 0;
+        }
+    }
+#endif
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        len += NGX_HTTP_V2_FIELD_LEN(header[i].key.len, header[i].value.len);
+        n = ngx_max(n, header[i].key.len);
+    }
+
+    if (r->headers_out.header_block) {
+        part = &r->headers_out.header_block->part;
+        header = part->elts;
+
+        for (i = 0; i < part->nelts; i++) {
+            len += NGX_HTTP_V2_FIELD_LEN(header[i].key.len,
+                                         header[i].value.len);
+            n = ngx_max(n, header[i].key.len);
+        }
+    }
+
+    /* the block is split into frames of the size the client accepts */
+
+    frame_size = h2c->frame_size;
+    nframes = len / frame_size + 1;
+
+    frame = ngx_http_v2_get_frame(r->pool,
+                                  len + nframes
+                                        * NGX_HTTP_V2_FRAME_HEADER_SIZE);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    lowcase = ngx_pnalloc(r->pool, n);
+    if (lowcase == NULL) {
+        return NGX_ERROR;
+    }
+
+    tmp = ngx_pnalloc(r->pool, ngx_max(NGX_OFF_T_LEN,
+                                 sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1));
+    if (tmp == NULL) {
+        return NGX_ERROR;
+    }
+
+    start = frame->buf.start + NGX_HTTP_V2_FRAME_HEADER_SIZE;
+    p = start;
+
+    if (h2c->hpack_out_update) {
+        *p = 0x20;
+        p = ngx_http_v2_write_int(p, 5, h2c->hpack_out.max);
+        h2c->hpack_out_update = 0;
+    }
+
+    p = ngx_http_v2_write_status(p, status);
+
+    if (r->headers_out.server == NULL) {
+        ngx_str_set(&name, "server");
+
+        if (clcf->server_tokens) {
+            ngx_str_set(&value, NGINX_VER);
+
+        } else {
+            ngx_str_set(&value, "nginx");
+        }
+
+        p = ngx_http_v2_write_field(h2c, p, &name, &value,
+                                    ngx_http_v2_incremental_indexing);
+        if (p == NULL) {
+            goto failed;
+        }
+    }
+
+    if (r->headers_out.date == NULL) {
+        ngx_str_set(&name, "date");
+        ngx_time_strings();
+        value = ngx_cached_http_time;
+
+        p = ngx_http_v2_write_field(h2c, p, &name, &value,
+                                    ngx_http_v2_without_indexing);
+    }
+
+    if (r->headers_out.content_type.len) {
+        ngx_str_set(&name, "content-type");
+
+        if (r->headers_out.content_type_len == r->headers_out.content_type.len
+            && r->headers_out.charset.len)
+        {
+            size = r->headers_out.content_type.len + sizeof("; charset=") - 1
+                   + r->headers_out.charset.len;
+
+            value.data = ngx_pnalloc(r->pool, size);
+            if (value.data == NULL) {
+                return NGX_ERROR;
+            }
+
+            last = ngx_cpymem(value.data, r->headers_out.content_type.data,
+                              r->headers_out.content_type.len);
+            last = ngx_cpymem(last, "; charset=", sizeof("; charset=") - 1);
+            last = ngx_cpymem(last, r->headers_out.charset.data,
+                              r->headers_out.charset.len);
+
+            value.len = last - value.data;
+
+            /* update r->headers_out.content_type for possible logging */
+
+            r->headers_out.content_type = value;
+
+        } else {
+            value = r->headers_out.content_type;
+        }
+
+        p = ngx_http_v2_write_field(h2c, p, &name, &value,
+                                    ngx_http_v2_incremental_indexing);
+        if (p == NULL) {
+            goto failed;
+        }
+    }
+
+    if (r->headers_out.content_length == NULL
+        && r->headers_out.content_length_n >= 0)
+    {
+        ngx_str_set(&name, "content-length");
+
+        value.data = tmp;
+        value.len = ngx_sprintf(tmp, "%O", r->headers_out.content_length_n)
+                    - tmp;
+
+        p = ngx_http_v2_write_field(h2c, p, &name, &value,
+                                    ngx_http_v2_without_indexing);
+    }
+
+    if (r->headers_out.last_modified == NULL
+        && r->headers_out.last_modified_time != -1)
+    {
+        ngx_str_set(&name, "last-modified");
+
+        value.data = tmp;
+        value.len = ngx_http_time(tmp, r->headers_out.last_modified_time)
+                    - tmp;
+
+        p = ngx_http_v2_write_field(h2c, p, &name, &value,
+                                    ngx_http_v2_without_indexing);
+    }
+
+    if (host.data) {
+        size = sizeof("http://:65535") - 1 + host.len
+               + r->headers_out.location->value.len;
+
+        value.data = ngx_pnalloc(r->pool, size);
+        if (value.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        last = ngx_cpymem(value.data, "http://", sizeof("http://") - 1);
+        last = ngx_cpymem(last, host.data, host.len);
+
+        if (port) {
+            last = ngx_sprintf(last, ":%ui", port);
+        }
+
+        last = ngx_cpymem(last, r->headers_out.location->value.data,
+                          r->headers_out.location->value.len);
+
+        value.len = last - value.data;
+
+        /* update r->headers_out.location->value for possible logging */
+
+        r->headers_out.location->value = value;
+        ngx_str_set(&r->headers_out.location->key, "Location");
+
+        ngx_str_set(&name, "location");
+
+        p = ngx_http_v2_write_field(h2c, p, &name, &value,
+                                    ngx_http_v2_without_indexing);
+    }
+
+#if (NGX_HTTP_GZIP)
+    if (r->gzip_vary) {
+        ngx_str_set(&name, "vary");
+        ngx_str_set(&value, "Accept-Encoding");
+
+        p = ngx_http_v2_write_field(h2c, p, &name, &value,
+                                    ngx_http_v2_incremental_indexing);
+        if (p == NULL) {
+            goto failed;
+        }
+    }
+#endif
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        name.len = header[i].key.len;
+        name.data = lowcase;
+        ngx_strlow(lowcase, header[i].key.data, name.len);
+
+        if (ngx_http_v2_connection_header(&name)) {
+            continue;
+        }
+
+        p = ngx_http_v2_write_field(h2c, p, &name, &header[i].value,
+                                    ngx_http_v2_indexed_header(&name));
+        if (p == NULL) {
+            goto failed;
+        }
+    }
+
+    /* the configured constant headers repeat in every response */
+
+    if (r->headers_out.header_block) {
+        part = &r->headers_out.header_block->part;
+        header = part->elts;
+
+        for (i = 0; i < part->nelts; i++) {
+            name.len = header[i].key.len;
+            name.data = lowcase;
+            ngx_strlow(lowcase, header[i].key.data, name.len);
+
+            if (ngx_http_v2_connection_header(&name)) {
+                continue;
+            }
+
+            p = ngx_http_v2_write_field(h2c, p, &name, &header[i].value,
+                                        ngx_http_v2_incremental_indexing);
+            if (p == NULL) {
+                goto failed;
+            }
+        }
+    }
+
+    len = p - start;
+
+    /* open the gaps for the CONTINUATION frame headers from the end */
+
+    nframes = (len + frame_size - 1) / frame_size;
+
+    if (nframes == 0) {
+        nframes = 1;
+    }
+
+    for (n = nframes - 1; n > 0; n--) {
+        size = ngx_min(frame_size, len - n * frame_size);
+        p = start + n * frame_size;
+
+        (void) ngx_movemem(p + n * NGX_HTTP_V2_FRAME_HEADER_SIZE, p, size);
+
+        (void) ngx_http_v2_write_frame_head(p + (n - 1)
+                                            * NGX_HTTP_V2_FRAME_HEADER_SIZE,
+                                            size,
+                                            NGX_HTTP_V2_CONTINUATION_FRAME,
+                                            n == nframes - 1
+                                            ? NGX_HTTP_V2_END_HEADERS_FLAG
+                                            : NGX_HTTP_V2_NO_FLAG,
+                                            stream->id);
+    }
+
+    flags = (nframes == 1) ? NGX_HTTP_V2_END_HEADERS_FLAG : NGX_HTTP_V2_NO_FLAG;
+
+    if (r->header_only) {
+        flags |= NGX_HTTP_V2_END_STREAM_FLAG;
+        frame->fin = 1;
+        stream->out_closed = 1;
+    }
+
+    (void) ngx_http_v2_write_frame_head(frame->buf.start,
+                                        ngx_min(len, frame_size),
+                                        NGX_HTTP_V2_HEADERS_FRAME, flags,
+                                        stream->id);
+
+    frame->buf.last = start + len + (nframes - 1)
+                                    * NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+    frame->stream = stream;
+    frame->handler = ngx_http_v2_headers_frame_handler;
+    frame->weight = stream->weight;
+    frame->headers = 1;
+
+    r->header_size = frame->buf.last - frame->buf.pos;
+    fc->sent += r->header_size;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                   "http2 header block: %ui, %uz bytes in %ui frames",
+                   status, len, nframes);
+
+    stream->queued++;
+
+    ngx_http_v2_queue_frame(h2c, frame);
+
+    if (r->header_only
+        && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    /* the dynamic tables of the client and the server are out of sync */
+
+    h2c->connection->error = 1;
+
+    return NGX_ERROR;
+}
+
+
+static u_char *
+ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix, ngx_uint_t value)
+{
+    prefix = (1 << prefix) - 1;
+
+    if (value < prefix) {
+        *pos++ |= value;
+        return pos;
+    }
+
+    *pos++ |= prefix;
+    value -= prefix;
+
+    while (value >= 128) {
+        *pos++ = (u_char) (value % 128 + 128);
+        value /= 128;
+    }
+
+    *pos++ = (u_char) value;
+
+    return pos;
+}
+
+
+/*
+ * writes an indexed field if the table has it, otherwise a literal
+ * one, an indexed name is used when possible; the strings are not
+ * Huffman encoded
+ */
+
+static u_char *
+ngx_http_v2_write_field(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_str_t *name, ngx_str_t *value, ngx_http_v2_indexing_e indexing)
+{
+    ngx_uint_t  index, name_index;
+
+    index = ngx_http_v2_table_find(&h2c->hpack_out, name, value, &name_index);
+
+    if (index) {
+        *pos = 0x80;
+        return ngx_http_v2_write_int(pos, 7, index);
+    }
+
+    if (indexing == ngx_http_v2_incremental_indexing
+        && name->len + value->len + 32 <= h2c->hpack_out.max)
+    {
+        *pos = 0x40;
+        pos = ngx_http_v2_write_int(pos, 6, name_index);
+
+    } else {
+        indexing = ngx_http_v2_without_indexing;
+
+        *pos = 0x00;
+        pos = ngx_http_v2_write_int(pos, 4, name_index);
+    }
+
+    if (name_index == 0) {
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, 7, name->len);
+        pos = ngx_cpymem(pos, name->data, name->len);
+    }
+
+    *pos = 0;
+    pos = ngx_http_v2_write_int(pos, 7, value->len);
+    pos = ngx_cpymem(pos, value->data, value->len);
+
+    if (indexing == ngx_http_v2_incremental_indexing
+        && ngx_http_v2_table_add(&h2c->hpack_out, name, value) != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return pos;
+}
+
+
+static u_char *
+ngx_http_v2_write_status(u_char *pos, ngx_uint_t status)
+{
+    ngx_uint_t  index;
+
+    /* RFC 7541, appendix A: the statuses indexed from 8 to 14 */
+
+    switch (status) {
+    case NGX_HTTP_OK:
+        index = 8;
+        break;
+    case NGX_HTTP_NO_CONTENT:
+        index = 9;
+        break;
+    case NGX_HTTP_PARTIAL_CONTENT:
+        index = 10;
+        break;
+    case NGX_HTTP_NOT_MODIFIED:
+        index = 11;
+        break;
+    case NGX_HTTP_BAD_REQUEST:
+        index = 12;
+        break;
+    case NGX_HTTP_NOT_FOUND:
+        index = 13;
+        break;
+    case NGX_HTTP_INTERNAL_SERVER_ERROR:
+        index = 14;
+        break;
+    default:
+        index = 0;
+        break;
+    }
+
+    if (index) {
+        *pos = 0x80;
+        return ngx_http_v2_write_int(pos, 7, index);
+    }
+
+    if (status < 100 || status > 999) {
+        status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    *pos = 0x00;
+    pos = ngx_http_v2_write_int(pos, 4, NGX_HTTP_V2_STATUS_INDEX);
+    *pos++ = 3;
+
+    return ngx_sprintf(pos, "%03ui", status);
+}
+
+
+static ngx_uint_t
+ngx_http_v2_indexed_header(ngx_str_t *name)
+{
+    ngx_str_t  *h;
+
+    for (h = ngx_http_v2_indexed_headers; h->len; h++) {
+        if (name->len == h->len
+            && ngx_strncmp(name->data, h->data, h->len) == 0)
+        {
+            return ngx_http_v2_incremental_indexing;
+        }
+    }
+
+    return ngx_http_v2_without_indexing;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_connection_header(ngx_str_t *name)
+{
+    ngx_str_t  *h;
+
+    for (h = ngx_http_v2_connection_headers; h->len; h++) {
+        if (name->len == h->len
+            && ngx_strncmp(name->data, h->data, h->len) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * packs the response body into DATA frames within the flow control
+ * windows; the data are copied, so the buffers are free on return
+ */
+
+ngx_chain_t *
+ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in, off_t limit)
+{
+    u_char                    *p;
+    size_t                     size, n, frame_size;
+    ssize_t                    window;
+    ngx_uint_t                 last;
+    ngx_chain_t               *cl;
+    ngx_http_request_t        *r;
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_out_frame_t   *frame;
+    ngx_http_v2_connection_t  *h2c;
+
+    r = fc->data;
+    stream = r->stream;
+    h2c = stream->connection;
+
+    if (stream->out_closed) {
+
+        /* the client has reset the stream or the response is complete */
+
+        for (cl = in; cl; cl = cl->next) {
+            cl->buf->pos = cl->buf->last;
+            cl->buf->file_pos = cl->buf->file_last;
+        }
+
+        return NULL;
+    }
+
+    if (h2c->connection->error) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    frame_size = ngx_min(h2c->h2scf->chunk_size, h2c->frame_size);
+
+    if (limit == 0 || limit > (off_t) NGX_MAX_SIZE_T_VALUE) {
+        limit = NGX_MAX_SIZE_T_VALUE;
+    }
+
+    last = 0;
+
+    for ( ;; ) {
+
+        in = ngx_http_v2_next_data(in, &last);
+
+        if (in == NULL && !last) {
+            break;
+        }
+
+        if (stream->queued >= NGX_HTTP_V2_MAX_QUEUED) {
+            fc->write->ready = 0;
+            break;
+        }
+
+        size = 0;
+
+        if (in) {
+            if (limit == 0) {
+                break;
+            }
+
+            if (stream->send_window <= 0) {
+                fc->write->ready = 0;
+                break;
+            }
+
+            if (h2c->send_window <= 0) {
+                ngx_http_v2_wait_window(h2c, stream);
+                fc->write->ready = 0;
+                break;
+            }
+
+            size = ngx_min(frame_size, (size_t) limit);
+            window = ngx_min(stream->send_window, h2c->send_window);
+
+            if ((size_t) window < size
+                && window < NGX_HTTP_V2_MIN_DATA_SIZE
+                && h2c->init_window >= 2 * NGX_HTTP_V2_MIN_DATA_SIZE)
+            {
+                /*
+                 * with the window nearly exhausted the client has consumed
+                 * more than half of it and updates it soon: a runt frame
+                 * is sent only if it carries the rest of the data
+                 */
+
+                n = 0;
+
+                for (cl = in; cl && n <= (size_t) window; cl = cl->next) {
+                    if (ngx_buf_in_memory(cl->buf)) {
+                        n += cl->buf->last - cl->buf->pos;
+                    }
+                }
+
+                if (n > (size_t) window) {
+                    if (h2c->send_window == window) {
+                        ngx_http_v2_wait_window(h2c, stream);
+                    }
+
+                    fc->write->ready = 0;
+                    break;
+                }
+            }
+
+            size = ngx_min(size, (size_t) window);
+        }
+
+        frame = stream->free_frames;
+
+        if (frame) {
+            stream->free_frames = frame->next;
+
+            frame->buf.pos = frame->buf.start;
+            frame->started = 0;
+
+        } else {
+            frame = ngx_http_v2_get_frame(r->pool,
+                                          NGX_HTTP_V2_FRAME_HEADER_SIZE
+                                          + frame_size);
+            if (frame == NULL) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            frame->stream = stream;
+            frame->handler = ngx_http_v2_data_frame_handler;
+        }
+
+        p = frame->buf.start + NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+        while (size && in) {
+
+            if (!ngx_buf_in_memory(in->buf)) {
+                ngx_log_error(NGX_LOG_ALERT, fc->log, 0,
+                              "http2 file buffer in send chain");
+                return NGX_CHAIN_ERROR;
+            }
+
+            n = ngx_min(size, (size_t) (in->buf->last - in->buf->pos));
+
+            p = ngx_cpymem(p, in->buf->pos, n);
+            in->buf->pos += n;
+            size -= n;
+
+            in = ngx_http_v2_next_data(in, &last);
+        }
+
+        size = p - (frame->buf.start + NGX_HTTP_V2_FRAME_HEADER_SIZE);
+
+        if (in) {
+            last = 0;
+        }
+
+        if (last) {
+            stream->out_closed = 1;
+            frame->fin = 1;
+        }
+
+        (void) ngx_http_v2_write_frame_head(frame->buf.start, size,
+                                            NGX_HTTP_V2_DATA_FRAME,
+                                            last ? NGX_HTTP_V2_END_STREAM_FLAG
+                                                 : NGX_HTTP_V2_NO_FLAG,
+                                            stream->id);
+
+        frame->buf.last = p;
+        frame->weight = stream->weight;
+
+        stream->send_window -= size;
+        h2c->send_window -= size;
+        limit -= size;
+
+        fc->sent += NGX_HTTP_V2_FRAME_HEADER_SIZE + size;
+
+        stream->queued++;
+
+        ngx_http_v2_queue_frame(h2c, frame);
+
+        if (last) {
+            break;
+        }
+    }
+
+    if (ngx_http_v2_send_output_queue(h2c) == NGX_ERROR) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    return in;
+}
+
+
+/* skips the consumed and the special buffers, notes the last one */
+
+static ngx_chain_t *
+ngx_http_v2_next_data(ngx_chain_t *in, ngx_uint_t *last)
+{
+    for ( /* void */ ; in; in = in->next) {
+
+        if (!ngx_buf_special(in->buf) && ngx_buf_size(in->buf)) {
+            return in;
+        }
+
+        if (in->buf->last_buf) {
+            *last = 1;
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_v2_headers_frame_handler(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame)
+{
+    ngx_http_v2_stream_t  *stream;
+
+    stream = frame->stream;
+
+    stream->queued--;
+
+    ngx_http_v2_wake_stream(stream);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_data_frame_handler(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame)
+{
+    ngx_http_v2_stream_t  *stream;
+
+    stream = frame->stream;
+
+    stream->queued--;
+
+    frame->next = stream->free_frames;
+    stream->free_frames = frame;
+
+    ngx_http_v2_wake_stream(stream);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_filter_init(ngx_conf_t *cf)
+{
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_v2_header_filter;
+
+    return NGX_OK;
+}
@@ -0,0 +1,496 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_V2_STATIC_TABLE_ENTRIES                                      \
+    (sizeof(ngx_http_v2_static_table) / sizeof(ngx_http_v2_header_t))
+
+/* RFC 7541, 4.1: the size of an entry is its name, value and 32 octets */
+#define NGX_HTTP_V2_ENTRY_SIZE(name, value)  ((name)->len + (value)->len + 32)
+
+
+typedef struct {
+    uint32_t                  code;
+    u_char                    len;
+} ngx_http_v2_huff_code_t;
+
+
+static ngx_int_t ngx_http_v2_huff_init(void);
+
+
+static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
+    { ngx_string(":authority"), ngx_string("") },
+    { ngx_string(":method"), ngx_string("GET") },
+    { ngx_string(":method"), ngx_string("POST") },
+    { ngx_string(":path"), ngx_string("/") },
+    { ngx_string(":path"), ngx_string("/index.html") },
+    { ngx_string(":scheme"), ngx_string("http") },
+    { ngx_string(":scheme"), ngx_string("https") },
+    { ngx_string(":status"), ngx_string("200") },
+    { ngx_string(":status"), ngx_string("204") },
+    { ngx_string(":status"), ngx_string("206") },
+    { ngx_string(":status"), ngx_string("304") },
+    { ngx_string(":status"), ngx_string("400") },
+    { ngx_string(":status"), ngx_string("404") },
+    { ngx_string(":status"), ngx_string("500") },
+    { ngx_string("accept-charset"), ngx_string("") },
+    { ngx_string("accept-encoding"), ngx_string("gzip, deflate") },
+    { ngx_string("accept-language"), ngx_string("") },
+    { ngx_string("accept-ranges"), ngx_string("") },
+    { ngx_string("accept"), ngx_string("") },
+    { ngx_string("access-control-allow-origin"), ngx_string("") },
+    { ngx_string("age"), ngx_string("") },
+    { ngx_string("allow"), ngx_string("") },
+    { ngx_string("authorization"), ngx_string("") },
+    { ngx_string("cache-control"), ngx_string("") },
+    { ngx_string("content-disposition"), ngx_string("") },
+    { ngx_string("content-encoding"), ngx_string("") },
+    { ngx_string("content-language"), ngx_string("") },
+    { ngx_string("content-length"), ngx_string("") },
+    { ngx_string("content-location"), ngx_string("") },
+    { ngx_string("content-range"), ngx_string("") },
+    { ngx_string("content-type"), ngx_string("") },
+    { ngx_string("cookie"), ngx_string("") },
+    { ngx_string("date"), ngx_string("") },
+    { ngx_string("etag"), ngx_string("") },
+    { ngx_string("expect"), ngx_string("") },
+    { ngx_string("expires"), ngx_string("") },
+    { ngx_string("from"), ngx_string("") },
+    { ngx_string("host"), ngx_string("") },
+    { ngx_string("if-match"), ngx_string("") },
+    { ngx_string("if-modified-since"), ngx_string("") },
+    { ngx_string("if-none-match"), ngx_string("") },
+    { ngx_string("if-range"), ngx_string("") },
+    { ngx_string("if-unmodified-since"), ngx_string("") },
+    { ngx_string("last-modified"), ngx_string("") },
+    { ngx_string("link"), ngx_string("") },
+    { ngx_string("location"), ngx_string("") },
+    { ngx_string("max-forwards"), ngx_string("") },
+    { ngx_string("proxy-authenticate"), ngx_string("") },
+    { ngx_string("proxy-authorization"), ngx_string("") },
+    { ngx_string("range"), ngx_string("") },
+    { ngx_string("referer"), ngx_string("") },
+    { ngx_string("refresh"), ngx_string("") },
+    { ngx_string("retry-after"), ngx_string("") },
+    { ngx_string("server"), ngx_string("") },
+    { ngx_string("set-cookie"), ngx_string("") },
+    { ngx_string("strict-transport-security"), ngx_string("") },
+    { ngx_string("transfer-encoding"), ngx_string("") },
+    { ngx_string("user-agent"), ngx_string("") },
+    { ngx_string("vary"), ngx_string("") },
+    { ngx_string("via"), ngx_string("") },
+    { ngx_string("www-authenticate"), ngx_string("") },
+};
+
+
+/* RFC 7541, Appendix B: the codes of the symbols 0-255 and EOS */
+
+static ngx_http_v2_huff_code_t  ngx_http_v2_huff_codes[257] = {
+    { 0x00001ff8, 13 }, { 0x007fffd8, 23 }, { 0x0fffffe2, 28 },
+    { 0x0fffffe3, 28 }, { 0x0fffffe4, 28 }, { 0x0fffffe5, 28 },
+    { 0x0fffffe6, 28 }, { 0x0fffffe7, 28 }, { 0x0fffffe8, 28 },
+    { 0x00ffffea, 24 }, { 0x3ffffffc, 30 }, { 0x0fffffe9, 28 },
+    { 0x0fffffea, 28 }, { 0x3ffffffd, 30 }, { 0x0fffffeb, 28 },
+    { 0x0fffffec, 28 }, { 0x0fffffed, 28 }, { 0x0fffffee, 28 },
+    { 0x0fffffef, 28 }, { 0x0ffffff0, 28 }, { 0x0ffffff1, 28 },
+    { 0x0ffffff2, 28 }, { 0x3ffffffe, 30 }, { 0x0ffffff3, 28 },
+    { 0x0ffffff4, 28 }, { 0x0ffffff5, 28 }, { 0x0ffffff6, 28 },
+    { 0x0ffffff7, 28 }, { 0x0ffffff8, 28 }, { 0x0ffffff9, 28 },
+    { 0x0ffffffa, 28 }, { 0x0ffffffb, 28 }, { 0x00000014,  6 },
+    { 0x000003f8, 10 }, { 0x000003f9, 10 }, { 0x00000ffa, 12 },
+    { 0x00001ff9, 13 }, { 0x00000015,  6 }, { 0x000000f8,  8 },
+    { 0x000007fa, 11 }, { 0x000003fa, 10 }, { 0x000003fb, 10 },
+    { 0x000000f9,  8 }, { 0x000007fb, 11 }, { 0x000000fa,  8 },
+    { 0x00000016,  6 }, { 0x00000017,  6 }, { 0x00000018,  6 },
+    { 0x00000000,  5 }, { 0x00000001,  5 }, { 0x00000002,  5 },
+    { 0x00000019,  6 }, { 0x0000001a,  6 }, { 0x0000001b,  6 },
+    { 0x0000001c,  6 }, { 0x0000001d,  6 }, { 0x0000001e,  6 },
+    { 0x0000001f,  6 }, { 0x0000005c,  7 }, { 0x000000fb,  8 },
+    { 0x00007ffc, 15 }, { 0x00000020,  6 }, { 0x00000ffb, 12 },
+    { 0x000003fc, 10 }, { 0x00001ffa, 13 }, { 0x00000021,  6 },
+    { 0x0000005d,  7 }, { 0x0000005e,  7 }, { 0x0000005f,  7 },
+    { 0x00000060,  7 }, { 0x00000061,  7 }, { 0x00000062,  7 },
+    { 0x00000063,  7 }, { 0x00000064,  7 }, { 0x00000065,  7 },
+    { 0x00000066,  7 }, { 0x00000067,  7 }, { 0x00000068,  7 },
+    { 0x00000069,  7 }, { 0x0000006a,  7 }, { 0x0000006b,  7 },
+    { 0x0000006c,  7 }, { 0x0000006d,  7 }, { 0x0000006e,  7 },
+    { 0x0000006f,  7 }, { 0x00000070,  7 }, { 0x00000071,  7 },
+    { 0x00000072,  7 }, { 0x000000fc,  8 }, { 0x00000073,  7 },
+    { 0x000000fd,  8 }, { 0x00001ffb, 13 }, { 0x0007fff0, 19 },
+    { 0x00001ffc, 13 }, { 0x00003ffc, 14 }, { 0x00000022,  6 },
+    { 0x00007ffd, 15 }, { 0x00000003,  5 }, { 0x00000023,  6 },
+    { 0x00000004,  5 }, { 0x00000024,  6 }, { 0x00000005,  5 },
+    { 0x00000025,  6 }, { 0x00000026,  6 }, { 0x00000027,  6 },
+    { 0x00000006,  5 }, { 0x00000074,  7 }, { 0x00000075,  7 },
+    { 0x00000028,  6 }, { 0x00000029,  6 }, { 0x0000002a,  6 },
+    { 0x00000007,  5 }, { 0x0000002b,  6 }, { 0x00000076,  7 },
+    { 0x0000002c,  6 }, { 0x00000008,  5 }, { 0x00000009,  5 },
+    { 0x0000002d,  6 }, { 0x00000077,  7 }, { 0x00000078,  7 },
+    { 0x00000079,  7 }, { 0x0000007a,  7 }, { 0x0000007b,  7 },
+    { 0x00007ffe, 15 }, { 0x000007fc, 11 }, { 0x00003ffd, 14 },
+    { 0x00001ffd, 13 }, { 0x0ffffffc, 28 }, { 0x000fffe6, 20 },
+    { 0x003fffd2, 22 }, { 0x000fffe7, 20 }, { 0x000fffe8, 20 },
+    { 0x003fffd3, 22 }, { 0x003fffd4, 22 }, { 0x003fffd5, 22 },
+    { 0x007fffd9, 23 }, { 0x003fffd6, 22 }, { 0x007fffda, 23 },
+    { 0x007fffdb, 23 }, { 0x007fffdc, 23 }, { 0x007fffdd, 23 },
+    { 0x007fffde, 23 }, { 0x00ffffeb, 24 }, { 0x007fffdf, 23 },
+    { 0x00ffffec, 24 }, { 0x00ffffed, 24 }, { 0x003fffd7, 22 },
+    { 0x007fffe0, 23 }, { 0x00ffffee, 24 }, { 0x007fffe1, 23 },
+    { 0x007fffe2, 23 }, { 0x007fffe3, 23 }, { 0x007fffe4, 23 },
+    { 0x001fffdc, 21 }, { 0x003fffd8, 22 }, { 0x007fffe5, 23 },
+    { 0x003fffd9, 22 }, { 0x007fffe6, 23 }, { 0x007fffe7, 23 },
+    { 0x00ffffef, 24 }, { 0x003fffda, 22 }, { 0x001fffdd, 21 },
+    { 0x000fffe9, 20 }, { 0x003fffdb, 22 }, { 0x003fffdc, 22 },
+    { 0x007fffe8, 23 }, { 0x007fffe9, 23 }, { 0x001fffde, 21 },
+    { 0x007fffea, 23 }, { 0x003fffdd, 22 }, { 0x003fffde, 22 },
+    { 0x00fffff0, 24 }, { 0x001fffdf, 21 }, { 0x003fffdf, 22 },
+    { 0x007fffeb, 23 }, { 0x007fffec, 23 }, { 0x001fffe0, 21 },
+    { 0x001fffe1, 21 }, { 0x003fffe0, 22 }, { 0x001fffe2, 21 },
+    { 0x007fffed, 23 }, { 0x003fffe1, 22 }, { 0x007fffee, 23 },
+    { 0x007fffef, 23 }, { 0x000fffea, 20 }, { 0x003fffe2, 22 },
+    { 0x003fffe3, 22 }, { 0x003fffe4, 22 }, { 0x007ffff0, 23 },
+    { 0x003fffe5, 22 }, { 0x003fffe6, 22 }, { 0x007ffff1, 23 },
+    { 0x03ffffe0, 26 }, { 0x03ffffe1, 26 }, { 0x000fffeb, 20 },
+    { 0x0007fff1, 19 }, { 0x003fffe7, 22 }, { 0x007ffff2, 23 },
+    { 0x003fffe8, 22 }, { 0x01ffffec, 25 }, { 0x03ffffe2, 26 },
+    { 0x03ffffe3, 26 }, { 0x03ffffe4, 26 }, { 0x07ffffde, 27 },
+    { 0x07ffffdf, 27 }, { 0x03ffffe5, 26 }, { 0x00fffff1, 24 },
+    { 0x01ffffed, 25 }, { 0x0007fff2, 19 }, { 0x001fffe3, 21 },
+    { 0x03ffffe6, 26 }, { 0x07ffffe0, 27 }, { 0x07ffffe1, 27 },
+    { 0x03ffffe7, 26 }, { 0x07ffffe2, 27 }, { 0x00fffff2, 24 },
+    { 0x001fffe4, 21 }, { 0x001fffe5, 21 }, { 0x03ffffe8, 26 },
+    { 0x03ffffe9, 26 }, { 0x0ffffffd, 28 }, { 0x07ffffe3, 27 },
+    { 0x07ffffe4, 27 }, { 0x07ffffe5, 27 }, { 0x000fffec, 20 },
+    { 0x00fffff3, 24 }, { 0x000fffed, 20 }, { 0x001fffe6, 21 },
+    { 0x003fffe9, 22 }, { 0x001fffe7, 21 }, { 0x001fffe8, 21 },
+    { 0x007ffff3, 23 }, { 0x003fffea, 22 }, { 0x003fffeb, 22 },
+    { 0x01ffffee, 25 }, { 0x01ffffef, 25 }, { 0x00fffff4, 24 },
+    { 0x00fffff5, 24 }, { 0x03ffffea, 26 }, { 0x007ffff4, 23 },
+    { 0x03ffffeb, 26 }, { 0x07ffffe6, 27 }, { 0x03ffffec, 26 },
+    { 0x03ffffed, 26 }, { 0x07ffffe7, 27 }, { 0x07ffffe8, 27 },
+    { 0x07ffffe9, 27 }, { 0x07ffffea, 27 }, { 0x07ffffeb, 27 },
+    { 0x0ffffffe, 28 }, { 0x07ffffec, 27 }, { 0x07ffffed, 27 },
+    { 0x07ffffee, 27 }, { 0x07ffffef, 27 }, { 0x07fffff0, 27 },
+    { 0x03ffffee, 26 }, { 0x3fffffff, 30 }
+};
+
+
+/*
+ * the decoding tree is built once per process from the codes:
+ * a node holds the indices of its children, a negative index
+ * is a leaf with the symbol -(index + 1)
+ */
+
+static int16_t  ngx_http_v2_huff_tree[512][2];
+static ngx_uint_t  ngx_http_v2_huff_nodes;
+
+
+ngx_int_t
+ngx_http_v2_table_get(ngx_http_v2_hpack_t *hpack, ngx_uint_t index,
+    ngx_http_v2_header_t *header)
+{
+    if (index == 0) {
+        return NGX_ERROR;
+    }
+
+    if (index <= NGX_HTTP_V2_STATIC_TABLE_ENTRIES) {
+        *header = ngx_http_v2_static_table[index - 1];
+        return NGX_OK;
+    }
+
+    index -= NGX_HTTP_V2_STATIC_TABLE_ENTRIES;
+
+    if (index > hpack->count) {
+        return NGX_ERROR;
+    }
+
+    /* the newest entry is the last one in the ring */
+
+    index = (hpack->first + hpack->count - index) % hpack->allocated;
+
+    *header = *hpack->entries[index];
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_v2_table_add(ngx_http_v2_hpack_t *hpack, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    size_t                  size;
+    ngx_uint_t              i, n;
+    ngx_http_v2_header_t   *h, **entries;
+
+    size = NGX_HTTP_V2_ENTRY_SIZE(name, value);
+
+    if (size > hpack->max) {
+
+        /* RFC 7541, 4.4: an entry larger than the table empties it */
+
+        ngx_http_v2_table_resize(hpack, 0);
+        ngx_http_v2_table_resize(hpack, hpack->max);
+
+        return NGX_OK;
+    }
+
+    while (hpack->size + size > hpack->max) {
+        h = hpack->entries[hpack->first];
+
+        hpack->size -= NGX_HTTP_V2_ENTRY_SIZE(&h->name, &h->value);
+        hpack->first = (hpack->first + 1) % hpack->allocated;
+        hpack->count--;
+
+        ngx_free(h);
+    }
+
+    if (hpack->count == hpack->allocated) {
+        n = hpack->allocated ? hpack->allocated * 2 : 16;
+
+        entries = ngx_alloc(n * sizeof(ngx_http_v2_header_t *), ngx_cycle->log);
+        if (entries == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < hpack->count; i++) {
+            entries[i] = hpack->entries[(hpack->first + i) % hpack->allocated];
+        }
+
+        if (hpack->entries) {
+            ngx_free(hpack->entries);
+        }
+
+        hpack->entries = entries;
+        hpack->first = 0;
+        hpack->allocated = n;
+    }
+
+    h = ngx_alloc(sizeof(ngx_http_v2_header_t) + name->len + value->len,
+                  ngx_cycle->log);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    h->name.len = name->len;
+    h->name.data = (u_char *) h + sizeof(ngx_http_v2_header_t);
+    ngx_memcpy(h->name.data, name->data, name->len);
+
+    h->value.len = value->len;
+    h->value.data = h->name.data + name->len;
+    ngx_memcpy(h->value.data, value->data, value->len);
+
+    hpack->entries[(hpack->first + hpack->count) % hpack->allocated] = h;
+    hpack->count++;
+    hpack->size += size;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_v2_table_resize(ngx_http_v2_hpack_t *hpack, size_t max)
+{
+    ngx_http_v2_header_t  *h;
+
+    while (hpack->count && hpack->size > max) {
+        h = hpack->entries[hpack->first];
+
+        hpack->size -= NGX_HTTP_V2_ENTRY_SIZE(&h->name, &h->value);
+        hpack->first = (hpack->first + 1) % hpack->allocated;
+        hpack->count--;
+
+        ngx_free(h);
+    }
+
+    hpack->max = max;
+}
+
+
+ngx_uint_t
+ngx_http_v2_table_find(ngx_http_v2_hpack_t *hpack, ngx_str_t *name,
+    ngx_str_t *value, ngx_uint_t *name_index)
+{
+    ngx_uint_t             i;
+    ngx_http_v2_header_t  *h;
+
+    *name_index = 0;
+
+    for (i = 0; i < hpack->count; i++) {
+        h = hpack->entries[(hpack->first + hpack->count - 1 - i)
+                           % hpack->allocated];
+
+        if (h->name.len != name->len
+            || ngx_strncmp(h->name.data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        if (h->value.len == value->len
+            && ngx_strncmp(h->value.data, value->data, value->len) == 0)
+        {
+            return NGX_HTTP_V2_STATIC_TABLE_ENTRIES + 1 + i;
+        }
+
+        if (*name_index == 0) {
+            *name_index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + 1 + i;
+        }
+    }
+
+    for (i = 0; i < NGX_HTTP_V2_STATIC_TABLE_ENTRIES; i++) {
+        h = &ngx_http_v2_static_table[i];
+
+        if (h->name.len != name->len
+            || ngx_strncmp(h->name.data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        if (h->value.len && h->value.len == value->len
+            && ngx_strncmp(h->value.data, value->data, value->len) == 0)
+        {
+            return i + 1;
+        }
+
+        if (*name_index == 0) {
+            *name_index = i + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+void
+ngx_http_v2_table_free(void *data)
+{
+    ngx_http_v2_hpack_t  *hpack = data;
+
+    ngx_http_v2_table_resize(hpack, 0);
+
+    if (hpack->entries) {
+        ngx_free(hpack->entries);
+        hpack->entries = NULL;
+    }
+
+    hpack->allocated = 0;
+    hpack->first = 0;
+}
+
+
+/*
+ * decodes a Huffman encoded string of "len" octets into "dst",
+ * "size" passes the space available and returns the decoded length
+ */
+
+ngx_int_t
+ngx_http_v2_huff_decode(u_char *src, size_t len, u_char *dst, size_t *size)
+{
+    u_char      *p, *last;
+    ngx_int_t    node;
+    ngx_uint_t   bit, bits, ones;
+
+    if (ngx_http_v2_huff_nodes == 0 && ngx_http_v2_huff_init() != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    p = dst;
+    last = dst + *size;
+
+    node = 0;
+    bits = 0;
+    ones = 1;
+
+    while (len--) {
+
+        for (bit = 0x80; bit; bit >>= 1) {
+            node = ngx_http_v2_huff_tree[node][(*src & bit) ? 1 : 0];
+
+            bits++;
+            ones &= (*src & bit) ? 1 : 0;
+
+            if (node > 0) {
+                continue;
+            }
+
+            if (node == 0) {
+                return NGX_ERROR;
+            }
+
+            node = -(node + 1);
+
+            if (node == 256 || p == last) {
+                /* EOS must not be decoded */
+                return NGX_ERROR;
+            }
+
+            *p++ = (u_char) node;
+
+            node = 0;
+            bits = 0;
+            ones = 1;
+        }
+
+        src++;
+    }
+
+    /* RFC 7541, 5.2: the padding is less than 8 most significant bits of EOS */
+
+    if (bits > 7 || !ones) {
+        return NGX_ERROR;
+    }
+
+    *size = p - dst;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_huff_init(void)
+{
+    int16_t     next;
+    uint32_t    code;
+    ngx_uint_t  i, n, node, bit;
+
+    ngx_memzero(ngx_http_v2_huff_tree, sizeof(ngx_http_v2_huff_tree));
+
+    n = 1;
+
+    for (i = 0; i < 257; i++) {
+        code = ngx_http_v2_huff_codes[i].code;
+        node = 0;
+
+        for (bit = ngx_http_v2_huff_codes[i].len; bit > 1; bit--) {
+            next = ngx_http_v2_huff_tree[node][(code >> (bit - 1)) & 1];
+
+            if (next < 0) {
+                return NGX_ERROR;
+            }
+
+            if (next == 0) {
+                if (n == 512) {
+                    return NGX_ERROR;
+                }
+
+                next = (int16_t) n++;
+                ngx_http_v2_huff_tree[node][(code >> (bit - 1)) & 1] = next;
+            }
+
+            node = next;
+        }
+
+        ngx_http_v2_huff_tree[node][code & 1] = (int16_t) -(i + 1);
+    }
+
+    ngx_http_v2_huff_nodes = n;
+
+    return NGX_OK;
+}
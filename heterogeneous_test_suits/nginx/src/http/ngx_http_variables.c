@@ -83,6 +83,8 @@ static ngx_int_t ngx_http_variable_request_body_file(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_request_time(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_variable_request_timing(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_status(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 
@@ -246,6 +248,34 @@ static ngx_http_variable_t  ngx_http_core_variables[] = {
     { ngx_string("request_time"), NULL, ngx_http_variable_request_time,
       0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("request_time_parse"), NULL,
+      ngx_http_variable_request_timing, NGX_HTTP_TIMING_PARSE,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("request_time_rewrite"), NULL,
+      ngx_http_variable_request_timing, NGX_HTTP_TIMING_REWRITE,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("request_time_access"), NULL,
+      ngx_http_variable_request_timing, NGX_HTTP_TIMING_ACCESS,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("request_time_content"), NULL,
+      ngx_http_variable_request_timing, NGX_HTTP_TIMING_CONTENT,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("request_time_filter"), NULL,
+      ngx_http_variable_request_timing, NGX_HTTP_TIMING_FILTER,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("request_time_send"), NULL,
+      ngx_http_variable_request_timing, NGX_HTTP_TIMING_SEND,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("request_time_migrate"), NULL,
+      ngx_http_variable_request_timing, NGX_HTTP_TIMING_MIGRATE,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_string("status"), NULL,
       ngx_http_variable_status, 0,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
@@ -780,9 +810,21 @@ static ngx_int_t
 ngx_http_variable_unknown_header_out(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    return ngx_http_variable_unknown_header(v, (ngx_str_t *) data,
-                                            &r->headers_out.headers.part,
-                                            sizeof("sent_http_") - 1);
+    if (ngx_http_variable_unknown_header(v, (ngx_str_t *) data,
+                                         &r->headers_out.headers.part,
+                                         sizeof("sent_http_") - 1)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (v->not_found && r->headers_out.header_block) {
+        return ngx_http_variable_unknown_header(v, (ngx_str_t *) data,
+                                          &r->headers_out.header_block->part,
+                                          sizeof("sent_http_") - 1);
+    }
+
+    return NGX_OK;
 }
 
 
@@ -1906,6 +1948,45 @@ ngx_http_variable_request_time(ngx_http_request_t *r,
 }
 
 
+/* the timers of the requests that "request_timing" samples, in seconds */
+
+static ngx_int_t
+ngx_http_variable_request_timing(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char             *p;
+    ngx_usec_t          usec;
+    ngx_http_timing_t  *t;
+
+    t = r->main->timing;
+
+    if (t == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    if (data == NGX_HTTP_TIMING_MIGRATE) {
+        usec = ngx_popcorn_migrate_usec - t->migrate;
+
+    } else {
+        usec = t->usec[data];
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_INT64_LEN + 7);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%uL.%06uL", usec / 1000000, usec % 1000000) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_variable_connection(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -50,8 +50,10 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
     off_t                      size, sent, nsent, limit;
     ngx_uint_t                 last, flush;
     ngx_msec_t                 delay;
+    ngx_usec_t                 start, total;
     ngx_chain_t               *cl, *ln, **ll, *chain;
     ngx_connection_t          *c;
+    ngx_http_timing_t         *t;
     ngx_http_core_loc_conf_t  *clcf;
 
     c = r->connection;
@@ -184,7 +186,10 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
         return NGX_AGAIN;
     }
 
-    if (size == 0 && !(c->buffered & NGX_LOWLEVEL_BUFFERED)) {
+    if (size == 0
+        && !(c->buffered & NGX_LOWLEVEL_BUFFERED)
+        && !(last && c->need_last_buf))
+    {
         if (last || flush) {
             for (cl = r->out; cl; /* void */) {
                 ln = cl;
@@ -235,7 +240,19 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http write filter limit %O", limit);
 
-    chain = c->send_chain(c, r->out, limit);
+    t = r->main->timing;
+
+    if (t == NULL) {
+        chain = c->send_chain(c, r->out, limit);
+
+    } else {
+        start = ngx_time_usec();
+        total = t->total;
+
+        chain = c->send_chain(c, r->out, limit);
+
+        ngx_http_timing_add(t, NGX_HTTP_TIMING_SEND, start, total);
+    }
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
                    "http write filter %p", chain);
@@ -10,6 +10,15 @@
 #include <ngx_event.h>
 #include <ngx_event_connect.h>
 #include <ngx_mail.h>
+#include <ngx_md5.h>
+
+
+typedef struct {
+    u_char                          key[16];
+    time_t                          expire;
+    size_t                          len;
+    u_char                         *data;
+} ngx_mail_auth_http_cache_t;
 
 
 typedef struct {
@@ -23,11 +32,29 @@ typedef struct {
 
     ngx_array_t                    *headers;
 
+    /* idle connections to the auth http server, per worker */
+    ngx_uint_t                      keepalive;
+    ngx_msec_t                      keepalive_timeout;
+    ngx_queue_t                     idle;
+    ngx_queue_t                     free;
+
+    /* successful responses, per worker */
+    ngx_mail_auth_http_cache_t    **cache;
+    ngx_uint_t                      cache_size;
+    time_t                          cache_valid;
+
     u_char                         *file;
     ngx_uint_t                      line;
 } ngx_mail_auth_http_conf_t;
 
 
+typedef struct {
+    ngx_queue_t                     queue;
+    ngx_connection_t               *connection;
+    ngx_mail_auth_http_conf_t      *conf;
+} ngx_mail_auth_http_keepalive_t;
+
+
 typedef struct ngx_mail_auth_http_ctx_s  ngx_mail_auth_http_ctx_t;
 
 typedef void (*ngx_mail_auth_http_handler_pt)(ngx_mail_session_t *s,
@@ -55,10 +82,20 @@ struct ngx_mail_auth_http_ctx_s {
 
     time_t                          sleep;
 
+    off_t                           content_length;
+    u_char                          key[16];
+
+    unsigned                        keepalive:1;
+    unsigned                        cacheable:1;
+
     ngx_pool_t                     *pool;
 };
 
 
+static ngx_int_t ngx_mail_auth_http_connect(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_uint_t cached);
+static ngx_int_t ngx_mail_auth_http_reconnect(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx);
 static void ngx_mail_auth_http_write_handler(ngx_event_t *wev);
 static void ngx_mail_auth_http_read_handler(ngx_event_t *rev);
 static void ngx_mail_auth_http_ignore_status_line(ngx_mail_session_t *s,
@@ -68,6 +105,16 @@ static void ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
 static void ngx_mail_auth_sleep_handler(ngx_event_t *rev);
 static ngx_int_t ngx_mail_auth_http_parse_header_line(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx);
+static void ngx_mail_auth_http_close_peer(ngx_mail_auth_http_ctx_t *ctx);
+static void ngx_mail_auth_http_release_peer(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx);
+static ngx_connection_t *ngx_mail_auth_http_keepalive_get(
+    ngx_mail_session_t *s, ngx_mail_auth_http_conf_t *ahcf);
+static void ngx_mail_auth_http_keepalive_close_handler(ngx_event_t *ev);
+static ngx_int_t ngx_mail_auth_http_cache_lookup(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_mail_auth_http_conf_t *ahcf);
+static void ngx_mail_auth_http_cache_store(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx);
 static void ngx_mail_auth_http_block_read(ngx_event_t *rev);
 static void ngx_mail_auth_http_dummy_handler(ngx_event_t *ev);
 static ngx_buf_t *ngx_mail_auth_http_create_request(ngx_mail_session_t *s,
@@ -81,6 +128,8 @@ static char *ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent,
 static char *ngx_mail_auth_http(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_mail_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_mail_auth_http_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_command_t  ngx_mail_auth_http_commands[] = {
@@ -106,6 +155,27 @@ static ngx_command_t  ngx_mail_auth_http_commands[] = {
       0,
       NULL },
 
+    { ngx_string("auth_http_keepalive"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_auth_http_conf_t, keepalive),
+      NULL },
+
+    { ngx_string("auth_http_keepalive_timeout"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_auth_http_conf_t, keepalive_timeout),
+      NULL },
+
+    { ngx_string("auth_http_cache"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE12,
+      ngx_mail_auth_http_cache,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -185,6 +255,43 @@ ngx_mail_auth_http_init(ngx_mail_session_t *s)
 
     ngx_mail_set_ctx(s, ctx, ngx_mail_auth_http_module);
 
+    s->connection->read->handler = ngx_mail_auth_http_block_read;
+
+    ctx->handler = ngx_mail_auth_http_ignore_status_line;
+    ctx->content_length = -1;
+
+    if (ahcf->cache_size) {
+        rc = ngx_mail_auth_http_cache_lookup(s, ctx, ahcf);
+
+        if (rc == NGX_OK) {
+            ctx->handler(s, ctx);
+            return;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_destroy_pool(ctx->pool);
+            ngx_mail_session_internal_server_error(s);
+            return;
+        }
+    }
+
+    if (ngx_mail_auth_http_connect(s, ctx, 1) != NGX_OK) {
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+    }
+}
+
+
+static ngx_int_t
+ngx_mail_auth_http_connect(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_uint_t cached)
+{
+    ngx_int_t                   rc;
+    ngx_connection_t           *c;
+    ngx_mail_auth_http_conf_t  *ahcf;
+
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
     ctx->peer.sockaddr = ahcf->peer->sockaddr;
     ctx->peer.socklen = ahcf->peer->socklen;
     ctx->peer.name = &ahcf->peer->name;
@@ -192,34 +299,66 @@ ngx_mail_auth_http_init(ngx_mail_session_t *s)
     ctx->peer.log = s->connection->log;
     ctx->peer.log_error = NGX_ERROR_ERR;
 
-    rc = ngx_event_connect_peer(&ctx->peer);
+    c = cached ? ngx_mail_auth_http_keepalive_get(s, ahcf) : NULL;
+
+    if (c) {
+        ctx->peer.connection = c;
+        ctx->peer.cached = 1;
+        rc = NGX_OK;
+
+    } else {
+        ctx->peer.cached = 0;
+
+        rc = ngx_event_connect_peer(&ctx->peer);
 
-    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
-        if (ctx->peer.connection) {
-            ngx_close_connection(ctx->peer.connection);
+        if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+            ngx_mail_auth_http_close_peer(ctx);
+            return NGX_ERROR;
         }
 
-        ngx_destroy_pool(ctx->pool);
-        ngx_mail_session_internal_server_error(s);
-        return;
+        c = ctx->peer.connection;
     }
 
-    ctx->peer.connection->data = s;
-    ctx->peer.connection->pool = s->connection->pool;
-
-    s->connection->read->handler = ngx_mail_auth_http_block_read;
-    ctx->peer.connection->read->handler = ngx_mail_auth_http_read_handler;
-    ctx->peer.connection->write->handler = ngx_mail_auth_http_write_handler;
+    c->data = s;
+    c->pool = s->connection->pool;
 
-    ctx->handler = ngx_mail_auth_http_ignore_status_line;
+    c->read->handler = ngx_mail_auth_http_read_handler;
+    c->write->handler = ngx_mail_auth_http_write_handler;
 
-    ngx_add_timer(ctx->peer.connection->read, ahcf->timeout);
-    ngx_add_timer(ctx->peer.connection->write, ahcf->timeout);
+    ngx_add_timer(c->read, ahcf->timeout);
+    ngx_add_timer(c->write, ahcf->timeout);
 
     if (rc == NGX_OK) {
-        ngx_mail_auth_http_write_handler(ctx->peer.connection->write);
-        return;
+        ngx_mail_auth_http_write_handler(c->write);
     }
+
+    return NGX_OK;
+}
+
+
+/*
+ * a keepalive connection that the auth http server has closed meanwhile
+ * is replaced with a new one if nothing has been read from it yet
+ */
+
+static ngx_int_t
+ngx_mail_auth_http_reconnect(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx)
+{
+    if (!ctx->peer.cached
+        || (ctx->response && ctx->response->last != ctx->response->start))
+    {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http keepalive connection closed");
+
+    ngx_mail_auth_http_close_peer(ctx);
+
+    ctx->request->pos = ctx->request->start;
+
+    return ngx_mail_auth_http_connect(s, ctx, 0);
 }
 
 
@@ -227,6 +366,7 @@ static void
 ngx_mail_auth_http_write_handler(ngx_event_t *wev)
 {
     ssize_t                     n, size;
+    ngx_int_t                   rc;
     ngx_connection_t           *c;
     ngx_mail_session_t         *s;
     ngx_mail_auth_http_ctx_t   *ctx;
@@ -254,7 +394,16 @@ ngx_mail_auth_http_write_handler(ngx_event_t *wev)
     n = ngx_send(c, ctx->request->pos, size);
 
     if (n == NGX_ERROR) {
-        ngx_close_connection(c);
+        rc = ngx_mail_auth_http_reconnect(s, ctx);
+
+        if (rc == NGX_OK) {
+            return;
+        }
+
+        if (rc == NGX_DECLINED) {
+            ngx_close_connection(c);
+        }
+
         ngx_destroy_pool(ctx->pool);
         ngx_mail_session_internal_server_error(s);
         return;
@@ -291,6 +440,7 @@ static void
 ngx_mail_auth_http_read_handler(ngx_event_t *rev)
 {
     ssize_t                     n, size;
+    ngx_int_t                   rc;
     ngx_connection_t          *c;
     ngx_mail_session_t        *s;
     ngx_mail_auth_http_ctx_t  *ctx;
@@ -324,7 +474,7 @@ ngx_mail_auth_http_read_handler(ngx_event_t *rev)
 
     size = ctx->response->end - ctx->response->last;
 
-    n = ngx_recv(c, ctx->response->pos, size);
+    n = ngx_recv(c, ctx->response->last, size);
 
     if (n > 0) {
         ctx->response->last += n;
@@ -337,7 +487,16 @@ ngx_mail_auth_http_read_handler(ngx_event_t *rev)
         return;
     }
 
-    ngx_close_connection(c);
+    rc = ngx_mail_auth_http_reconnect(s, ctx);
+
+    if (rc == NGX_OK) {
+        return;
+    }
+
+    if (rc == NGX_DECLINED) {
+        ngx_close_connection(c);
+    }
+
     ngx_destroy_pool(ctx->pool);
     ngx_mail_session_internal_server_error(s);
 }
@@ -347,7 +506,8 @@ static void
 ngx_mail_auth_http_ignore_status_line(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx)
 {
-    u_char  *p, ch;
+    u_char     *p, ch, *line;
+    ngx_int_t   status;
     enum  {
         sw_start = 0,
         sw_H,
@@ -425,7 +585,7 @@ ngx_mail_auth_http_ignore_status_line(ngx_mail_session_t *s,
             ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
                           "auth http server &V sent invalid response",
                           ctx->peer.name);
-            ngx_close_connection(ctx->peer.connection);
+            ngx_mail_auth_http_close_peer(ctx);
             ngx_destroy_pool(ctx->pool);
             ngx_mail_session_internal_server_error(s);
             return;
@@ -443,6 +603,20 @@ next:
 
 done:
 
+    /* "HTTP/1.1 200": HTTP/1.1 connections are kept alive by default */
+
+    line = ctx->response->start;
+
+    if ((size_t) (p - line) >= sizeof("HTTP/1.x 200") - 1) {
+        ctx->keepalive = (line[7] == '1');
+
+        status = ngx_atoi(&line[9], 3);
+
+        if (status == 204 || status == 304) {
+            ctx->content_length = 0;
+        }
+    }
+
     ctx->response->pos = p + 1;
     ctx->state = 0;
     ctx->handler = ngx_mail_auth_http_process_headers;
@@ -532,7 +706,7 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
 
                 p = ngx_pnalloc(s->connection->pool, size);
                 if (p == NULL) {
-                    ngx_close_connection(ctx->peer.connection);
+                    ngx_mail_auth_http_close_peer(ctx);
                     ngx_destroy_pool(ctx->pool);
                     ngx_mail_session_internal_server_error(s);
                     return;
@@ -597,7 +771,7 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
 
                 s->login.data = ngx_pnalloc(s->connection->pool, s->login.len);
                 if (s->login.data == NULL) {
-                    ngx_close_connection(ctx->peer.connection);
+                    ngx_mail_auth_http_close_peer(ctx);
                     ngx_destroy_pool(ctx->pool);
                     ngx_mail_session_internal_server_error(s);
                     return;
@@ -619,7 +793,7 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
                 s->passwd.data = ngx_pnalloc(s->connection->pool,
                                              s->passwd.len);
                 if (s->passwd.data == NULL) {
-                    ngx_close_connection(ctx->peer.connection);
+                    ngx_mail_auth_http_close_peer(ctx);
                     ngx_destroy_pool(ctx->pool);
                     ngx_mail_session_internal_server_error(s);
                     return;
@@ -657,7 +831,7 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
                 ctx->errcode.data = ngx_pnalloc(s->connection->pool,
                                                 ctx->errcode.len);
                 if (ctx->errcode.data == NULL) {
-                    ngx_close_connection(ctx->peer.connection);
+                    ngx_mail_auth_http_close_peer(ctx);
                     ngx_destroy_pool(ctx->pool);
                     ngx_mail_session_internal_server_error(s);
                     return;
@@ -669,6 +843,40 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
                 continue;
             }
 
+            if (len == sizeof("Connection") - 1
+                && ngx_strncasecmp(ctx->header_name_start,
+                                   (u_char *) "Connection",
+                                   sizeof("Connection") - 1)
+                   == 0)
+            {
+                len = ctx->header_end - ctx->header_start;
+
+                if (len == sizeof("keep-alive") - 1
+                    && ngx_strncasecmp(ctx->header_start,
+                                       (u_char *) "keep-alive",
+                                       sizeof("keep-alive") - 1)
+                       == 0)
+                {
+                    ctx->keepalive = 1;
+
+                } else {
+                    ctx->keepalive = 0;
+                }
+
+                continue;
+            }
+
+            if (len == sizeof("Content-Length") - 1
+                && ngx_strncasecmp(ctx->header_name_start,
+                                   (u_char *) "Content-Length",
+                                   sizeof("Content-Length") - 1)
+                   == 0)
+            {
+                ctx->content_length = ngx_atoof(ctx->header_start,
+                                           ctx->header_end - ctx->header_start);
+                continue;
+            }
+
             /* ignore other headers */
 
             continue;
@@ -678,7 +886,7 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
             ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
                            "mail auth http header done");
 
-            ngx_close_connection(ctx->peer.connection);
+            ngx_mail_auth_http_release_peer(s, ctx);
 
             if (ctx->err.len) {
 
@@ -696,7 +904,7 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
 
                     p = ngx_pnalloc(s->connection->pool, ctx->err.len);
                     if (p == NULL) {
-                        ngx_close_connection(ctx->peer.connection);
+                        ngx_mail_auth_http_close_peer(ctx);
                         ngx_destroy_pool(ctx->pool);
                         ngx_mail_session_internal_server_error(s);
                         return;
@@ -829,6 +1037,10 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
 
             ngx_memcpy(peer->name.data + len, ctx->port.data, ctx->port.len);
 
+            if (ctx->cacheable) {
+                ngx_mail_auth_http_cache_store(s, ctx);
+            }
+
             ngx_destroy_pool(ctx->pool);
             ngx_mail_proxy_init(s, peer);
 
@@ -844,7 +1056,7 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
         ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
                       "auth http server %V sent invalid header in response",
                       ctx->peer.name);
-        ngx_close_connection(ctx->peer.connection);
+        ngx_mail_auth_http_close_peer(ctx);
         ngx_destroy_pool(ctx->pool);
         ngx_mail_session_internal_server_error(s);
 
@@ -1095,6 +1307,269 @@ header_done:
 }
 
 
+static void
+ngx_mail_auth_http_close_peer(ngx_mail_auth_http_ctx_t *ctx)
+{
+    if (ctx->peer.connection) {
+        ngx_close_connection(ctx->peer.connection);
+        ctx->peer.connection = NULL;
+    }
+}
+
+
+/*
+ * the connection is kept alive if the server has allowed it, and the body
+ * of the response, if any, has already been read
+ */
+
+static void
+ngx_mail_auth_http_release_peer(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx)
+{
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_mail_auth_http_conf_t       *ahcf;
+    ngx_mail_auth_http_keepalive_t  *item;
+
+    c = ctx->peer.connection;
+
+    if (c == NULL) {
+        return;
+    }
+
+    ctx->peer.connection = NULL;
+
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
+    if (ahcf->keepalive == 0
+        || !ctx->keepalive
+        || ctx->content_length != ctx->response->last - ctx->response->pos
+        || c->read->eof
+        || c->read->error
+        || c->write->error)
+    {
+        ngx_close_connection(c);
+        return;
+    }
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        return;
+    }
+
+    if (ngx_queue_empty(&ahcf->free)) {
+
+        q = ngx_queue_last(&ahcf->idle);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_mail_auth_http_keepalive_t, queue);
+
+        ngx_close_connection(item->connection);
+
+    } else {
+        q = ngx_queue_head(&ahcf->free);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_mail_auth_http_keepalive_t, queue);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http keepalive connection %p", c);
+
+    item->connection = c;
+    ngx_queue_insert_head(&ahcf->idle, q);
+
+    c->read->handler = ngx_mail_auth_http_keepalive_close_handler;
+    c->write->handler = ngx_mail_auth_http_dummy_handler;
+
+    c->data = item;
+    c->pool = NULL;
+    c->idle = 1;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+
+    ngx_add_timer(c->read, ahcf->keepalive_timeout);
+
+    if (c->read->ready) {
+        ngx_mail_auth_http_keepalive_close_handler(c->read);
+    }
+}
+
+
+static ngx_connection_t *
+ngx_mail_auth_http_keepalive_get(ngx_mail_session_t *s,
+    ngx_mail_auth_http_conf_t *ahcf)
+{
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_mail_auth_http_keepalive_t  *item;
+
+    if (ahcf->keepalive == 0 || ngx_queue_empty(&ahcf->idle)) {
+        return NULL;
+    }
+
+    q = ngx_queue_head(&ahcf->idle);
+    ngx_queue_remove(q);
+    ngx_queue_insert_head(&ahcf->free, q);
+
+    item = ngx_queue_data(q, ngx_mail_auth_http_keepalive_t, queue);
+    c = item->connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http using keepalive connection %p", c);
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    c->idle = 0;
+    c->log = s->connection->log;
+    c->read->log = s->connection->log;
+    c->write->log = s->connection->log;
+
+    return c;
+}
+
+
+static void
+ngx_mail_auth_http_keepalive_close_handler(ngx_event_t *ev)
+{
+    int                              n;
+    char                             buf[1];
+    ngx_connection_t                *c;
+    ngx_mail_auth_http_keepalive_t  *item;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, ev->log, 0,
+                   "mail auth http keepalive close handler");
+
+    c = ev->data;
+
+    if (c->close || ev->timedout) {
+        goto close;
+    }
+
+    n = recv(c->fd, buf, 1, MSG_PEEK);
+
+    if (n == -1 && ngx_socket_errno == NGX_EAGAIN) {
+        /* stale event */
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            goto close;
+        }
+
+        return;
+    }
+
+close:
+
+    item = c->data;
+
+    ngx_close_connection(c);
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&item->conf->free, &item->queue);
+}
+
+
+/*
+ * the responses that let a client log in are cached by the md5 of their
+ * request, which has the login, the password, and the client address;
+ * APOP and CRAM-MD5 requests have a salt of their session and are not
+ * cached
+ */
+
+static ngx_int_t
+ngx_mail_auth_http_cache_lookup(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_mail_auth_http_conf_t *ahcf)
+{
+    uint32_t                     hash;
+    ngx_md5_t                    md5;
+    ngx_mail_auth_http_cache_t  *cached;
+
+    if (s->auth_method == NGX_MAIL_AUTH_APOP
+        || s->auth_method == NGX_MAIL_AUTH_CRAM_MD5)
+    {
+        return NGX_DECLINED;
+    }
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, ctx->request->pos,
+                   ctx->request->last - ctx->request->pos);
+    ngx_md5_final(ctx->key, &md5);
+
+    ngx_memcpy(&hash, ctx->key, sizeof(uint32_t));
+
+    cached = ahcf->cache[hash % ahcf->cache_size];
+
+    if (cached == NULL
+        || ngx_memcmp(cached->key, ctx->key, sizeof(ctx->key)) != 0
+        || cached->expire <= ngx_time())
+    {
+        ctx->cacheable = 1;
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http cached response");
+
+    ctx->response = ngx_create_temp_buf(ctx->pool, cached->len);
+    if (ctx->response == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->response->last = ngx_cpymem(ctx->response->last, cached->data,
+                                     cached->len);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_mail_auth_http_cache_store(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx)
+{
+    size_t                        len;
+    uint32_t                      hash;
+    ngx_mail_auth_http_conf_t    *ahcf;
+    ngx_mail_auth_http_cache_t   *cached, **slot;
+
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
+    len = ctx->response->pos - ctx->response->start;
+
+    cached = ngx_alloc(sizeof(ngx_mail_auth_http_cache_t) + len,
+                       s->connection->log);
+    if (cached == NULL) {
+        return;
+    }
+
+    ngx_memcpy(cached->key, ctx->key, sizeof(ctx->key));
+    cached->expire = ngx_time() + ahcf->cache_valid;
+    cached->len = len;
+    cached->data = (u_char *) &cached[1];
+    ngx_memcpy(cached->data, ctx->response->start, len);
+
+    ngx_memcpy(&hash, ctx->key, sizeof(uint32_t));
+
+    slot = &ahcf->cache[hash % ahcf->cache_size];
+
+    if (*slot) {
+        ngx_free(*slot);
+    }
+
+    *slot = cached;
+}
+
+
 static void
 ngx_mail_auth_http_block_read(ngx_event_t *rev)
 {
@@ -1111,7 +1586,7 @@ ngx_mail_auth_http_block_read(ngx_event_t *rev)
 
         ctx = ngx_mail_get_module_ctx(s, ngx_mail_auth_http_module);
 
-        ngx_close_connection(ctx->peer.connection);
+        ngx_mail_auth_http_close_peer(ctx);
         ngx_destroy_pool(ctx->pool);
         ngx_mail_session_internal_server_error(s);
     }
@@ -1147,6 +1622,7 @@ ngx_mail_auth_http_create_request(ngx_mail_session_t *s, ngx_pool_t *pool,
 
     len = sizeof("GET ") - 1 + ahcf->uri.len + sizeof(" HTTP/1.0" CRLF) - 1
           + sizeof("Host: ") - 1 + ahcf->host_header.len + sizeof(CRLF) - 1
+          + sizeof("Connection: keep-alive" CRLF) - 1
           + sizeof("Auth-Method: ") - 1
                 + ngx_mail_auth_http_method[s->auth_method].len
                 + sizeof(CRLF) - 1
@@ -1181,6 +1657,11 @@ ngx_mail_auth_http_create_request(ngx_mail_session_t *s, ngx_pool_t *pool,
                          ahcf->host_header.len);
     *b->last++ = CR; *b->last++ = LF;
 
+    if (ahcf->keepalive) {
+        b->last = ngx_cpymem(b->last, "Connection: keep-alive" CRLF,
+                             sizeof("Connection: keep-alive" CRLF) - 1);
+    }
+
     b->last = ngx_cpymem(b->last, "Auth-Method: ",
                          sizeof("Auth-Method: ") - 1);
     b->last = ngx_cpymem(b->last,
@@ -1306,6 +1787,10 @@ ngx_mail_auth_http_create_conf(ngx_conf_t *cf)
     }
 
     ahcf->timeout = NGX_CONF_UNSET_MSEC;
+    ahcf->keepalive = NGX_CONF_UNSET_UINT;
+    ahcf->keepalive_timeout = NGX_CONF_UNSET_MSEC;
+    ahcf->cache_size = NGX_CONF_UNSET_UINT;
+    ahcf->cache_valid = NGX_CONF_UNSET;
 
     ahcf->file = cf->conf_file->file.name.data;
     ahcf->line = cf->conf_file->line;
@@ -1320,10 +1805,11 @@ ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_mail_auth_http_conf_t *prev = parent;
     ngx_mail_auth_http_conf_t *conf = child;
 
-    u_char           *p;
-    size_t            len;
-    ngx_uint_t        i;
-    ngx_table_elt_t  *header;
+    u_char                          *p;
+    size_t                           len;
+    ngx_uint_t                       i;
+    ngx_table_elt_t                 *header;
+    ngx_mail_auth_http_keepalive_t  *items;
 
     if (conf->peer == NULL) {
         conf->peer = prev->peer;
@@ -1341,6 +1827,37 @@ ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_msec_value(conf->timeout, prev->timeout, 60000);
 
+    ngx_conf_merge_uint_value(conf->keepalive, prev->keepalive, 0);
+    ngx_conf_merge_msec_value(conf->keepalive_timeout,
+                              prev->keepalive_timeout, 60000);
+
+    ngx_queue_init(&conf->idle);
+    ngx_queue_init(&conf->free);
+
+    if (conf->keepalive) {
+        items = ngx_pcalloc(cf->pool, conf->keepalive
+                                      * sizeof(ngx_mail_auth_http_keepalive_t));
+        if (items == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        for (i = 0; i < conf->keepalive; i++) {
+            items[i].conf = conf;
+            ngx_queue_insert_head(&conf->free, &items[i].queue);
+        }
+    }
+
+    ngx_conf_merge_uint_value(conf->cache_size, prev->cache_size, 0);
+    ngx_conf_merge_value(conf->cache_valid, prev->cache_valid, 60);
+
+    if (conf->cache_size) {
+        conf->cache = ngx_pcalloc(cf->pool, conf->cache_size
+                                        * sizeof(ngx_mail_auth_http_cache_t *));
+        if (conf->cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
     if (conf->headers == NULL) {
         conf->headers = prev->headers;
         conf->header = prev->header;
@@ -1450,3 +1967,59 @@ ngx_mail_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_mail_auth_http_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_mail_auth_http_conf_t *ahcf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value, s;
+
+    if (ahcf->cache_size != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "has an invalid parameter after \"off\"";
+        }
+
+        ahcf->cache_size = 0;
+        return NGX_CONF_OK;
+    }
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid number of responses \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    ahcf->cache_size = n;
+
+    if (cf->args->nelts == 2) {
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strncmp(value[2].data, "valid=", 6) == 0) {
+
+        s.len = value[2].len - 6;
+        s.data = value[2].data + 6;
+
+        ahcf->cache_valid = ngx_parse_time(&s, 1);
+        if (ahcf->cache_valid != (time_t) NGX_ERROR
+            && ahcf->cache_valid > 0)
+        {
+            return NGX_CONF_OK;
+        }
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+    return NGX_CONF_ERROR;
+}
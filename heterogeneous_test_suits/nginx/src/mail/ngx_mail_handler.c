@@ -559,6 +559,7 @@ ngx_mail_send(ngx_event_t *wev)
     n = c->send(c, s->out.data, s->out.len);
 
     if (n > 0) {
+        s->out.data += n;
         s->out.len -= n;
 
         if (wev->timer_set) {
@@ -599,28 +600,34 @@ ngx_int_t
 ngx_mail_read_command(ngx_mail_session_t *s, ngx_connection_t *c)
 {
     ssize_t                    n;
+    u_char                    *p;
     ngx_int_t                  rc;
     ngx_str_t                  l;
     ngx_mail_core_srv_conf_t  *cscf;
 
-    n = c->recv(c, s->buffer->last, s->buffer->end - s->buffer->last);
+    /* the buffer may still have commands that the client has pipelined */
 
-    if (n == NGX_ERROR || n == 0) {
-        ngx_mail_close_connection(c);
-        return NGX_ERROR;
-    }
+    if (s->buffer->last < s->buffer->end) {
 
-    if (n > 0) {
-        s->buffer->last += n;
-    }
+        n = c->recv(c, s->buffer->last, s->buffer->end - s->buffer->last);
 
-    if (n == NGX_AGAIN) {
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            ngx_mail_session_internal_server_error(s);
+        if (n == NGX_ERROR || n == 0) {
+            ngx_mail_close_connection(c);
             return NGX_ERROR;
         }
 
-        return NGX_AGAIN;
+        if (n > 0) {
+            s->buffer->last += n;
+        }
+
+        if (n == NGX_AGAIN && s->buffer->pos == s->buffer->last) {
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                ngx_mail_session_internal_server_error(s);
+                return NGX_ERROR;
+            }
+
+            return NGX_AGAIN;
+        }
     }
 
     cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
@@ -644,7 +651,17 @@ ngx_mail_read_command(ngx_mail_session_t *s, ngx_connection_t *c)
         return NGX_MAIL_PARSE_INVALID_COMMAND;
     }
 
-    if (rc == NGX_IMAP_NEXT || rc == NGX_MAIL_PARSE_INVALID_COMMAND) {
+    if (rc == NGX_MAIL_PARSE_INVALID_COMMAND) {
+
+        /* skip the rest of the invalid command line */
+
+        p = ngx_strlchr(s->buffer->pos, s->buffer->last, LF);
+        s->buffer->pos = p ? p + 1 : s->buffer->last;
+
+        return rc;
+    }
+
+    if (rc == NGX_IMAP_NEXT) {
         return rc;
     }
 
@@ -657,14 +674,40 @@ ngx_mail_read_command(ngx_mail_session_t *s, ngx_connection_t *c)
 }
 
 
+/*
+ * moves the commands that the client has pipelined after the current one
+ * to "start", where the parser expects the next command or argument line;
+ * the blocked session then processes them once its reply is sent
+ */
+
+void
+ngx_mail_next_command(ngx_mail_session_t *s, u_char *start)
+{
+    size_t  size;
+
+    size = s->buffer->last - s->buffer->pos;
+
+    if (size && s->buffer->pos != start) {
+        ngx_memmove(start, s->buffer->pos, size);
+    }
+
+    s->buffer->pos = start;
+    s->buffer->last = start + size;
+
+    s->blocked = (size != 0);
+}
+
+
 void
 ngx_mail_auth(ngx_mail_session_t *s, ngx_connection_t *c)
 {
     s->args.nelts = 0;
-    s->buffer->pos = s->buffer->start;
-    s->buffer->last = s->buffer->start;
     s->state = 0;
 
+    /* keep the IMAP tag for the proxy, it is at the start of the buffer */
+
+    ngx_mail_next_command(s, s->buffer->start + s->tag.len);
+
     if (c->read->timer_set) {
         ngx_del_timer(c->read);
     }
@@ -279,12 +279,10 @@ ngx_mail_imap_auth_state(ngx_event_t *rev)
         if (s->state) {
             /* preserve tag */
             s->arg_start = s->buffer->start + s->tag.len;
-            s->buffer->pos = s->arg_start;
-            s->buffer->last = s->arg_start;
+            ngx_mail_next_command(s, s->arg_start);
 
         } else {
-            s->buffer->pos = s->buffer->start;
-            s->buffer->last = s->buffer->start;
+            ngx_mail_next_command(s, s->buffer->start);
             s->tag.len = 0;
         }
     }
@@ -446,6 +444,11 @@ ngx_mail_imap_starttls(ngx_mail_session_t *s, ngx_connection_t *c)
     if (c->ssl == NULL) {
         sslcf = ngx_mail_get_module_srv_conf(s, ngx_mail_ssl_module);
         if (sslcf->starttls) {
+
+            /* the commands pipelined after STARTTLS are not trusted */
+
+            s->buffer->pos = s->buffer->last;
+
             c->read->handler = ngx_mail_starttls_handler;
             return NGX_OK;
         }
@@ -264,8 +264,8 @@ ngx_mail_pop3_auth_state(ngx_event_t *rev)
     case NGX_OK:
 
         s->args.nelts = 0;
-        s->buffer->pos = s->buffer->start;
-        s->buffer->last = s->buffer->start;
+
+        ngx_mail_next_command(s, s->buffer->start);
 
         if (s->state) {
             s->arg_start = s->buffer->start;
@@ -376,6 +376,11 @@ ngx_mail_pop3_stls(ngx_mail_session_t *s, ngx_connection_t *c)
     if (c->ssl == NULL) {
         sslcf = ngx_mail_get_module_srv_conf(s, ngx_mail_ssl_module);
         if (sslcf->starttls) {
+
+            /* the commands pipelined after STLS are not trusted */
+
+            s->buffer->pos = s->buffer->last;
+
             c->read->handler = ngx_mail_starttls_handler;
             return NGX_OK;
         }
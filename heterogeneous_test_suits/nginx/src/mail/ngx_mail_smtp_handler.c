@@ -504,8 +504,8 @@ ngx_mail_smtp_auth_state(ngx_event_t *rev)
 
     case NGX_OK:
         s->args.nelts = 0;
-        s->buffer->pos = s->buffer->start;
-        s->buffer->last = s->buffer->start;
+
+        ngx_mail_next_command(s, s->buffer->start);
 
         if (s->state) {
             s->arg_start = s->buffer->start;
@@ -671,7 +671,7 @@ ngx_mail_smtp_mail(ngx_mail_session_t *s, ngx_connection_t *c)
         return NGX_OK;
     }
 
-    l.len = s->buffer->last - s->buffer->start;
+    l.len = s->buffer->pos - s->buffer->start;
     l.data = s->buffer->start;
 
     for (i = 0; i < l.len; i++) {
@@ -724,7 +724,7 @@ ngx_mail_smtp_rcpt(ngx_mail_session_t *s, ngx_connection_t *c)
         return NGX_OK;
     }
 
-    l.len = s->buffer->last - s->buffer->start;
+    l.len = s->buffer->pos - s->buffer->start;
     l.data = s->buffer->start;
 
     for (i = 0; i < l.len; i++) {
@@ -795,6 +795,10 @@ ngx_mail_smtp_starttls(ngx_mail_session_t *s, ngx_connection_t *c)
             ngx_str_null(&s->smtp_from);
             ngx_str_null(&s->smtp_to);
 
+            /* and the commands pipelined after STARTTLS */
+
+            s->buffer->pos = s->buffer->last;
+
             c->read->handler = ngx_mail_starttls_handler;
             return NGX_OK;
         }
@@ -832,6 +836,8 @@ ngx_mail_smtp_discard_command(ngx_mail_session_t *s, ngx_connection_t *c,
         return NGX_AGAIN;
     }
 
+    s->buffer->pos = s->buffer->last;
+
     ngx_mail_smtp_log_rejected_command(s, c, err);
 
     s->buffer->pos = s->buffer->start;
@@ -853,7 +859,7 @@ ngx_mail_smtp_log_rejected_command(ngx_mail_session_t *s, ngx_connection_t *c,
         return;
     }
 
-    cmd.len = s->buffer->last - s->buffer->start;
+    cmd.len = s->buffer->pos - s->buffer->start;
     cmd.data = s->buffer->start;
 
     for (i = 0; i < cmd.len; i++) {
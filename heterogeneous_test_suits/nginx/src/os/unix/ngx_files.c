@@ -8,6 +8,10 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+#if (NGX_HAVE_PTHREAD)
+#include <ngx_thread_pool.h>
+#endif
+
 
 #if (NGX_HAVE_FILE_AIO)
 
@@ -16,6 +20,35 @@ ngx_uint_t  ngx_file_aio = 1;
 #endif
 
 
+#if (NGX_HAVE_PTHREAD)
+
+typedef struct {
+    ngx_fd_t     fd;
+    u_char      *buf;
+    size_t       size;
+    off_t        offset;
+
+    ssize_t      read;
+    ngx_err_t    err;
+} ngx_thread_read_ctx_t;
+
+
+typedef struct {
+    ngx_fd_t     fd;
+    ngx_chain_t *chain;
+    off_t        offset;
+
+    ssize_t      written;
+    ngx_err_t    err;
+} ngx_thread_write_chain_to_file_ctx_t;
+
+
+static void ngx_thread_read_handler(void *data, ngx_log_t *log);
+static void ngx_thread_write_chain_to_file_handler(void *data, ngx_log_t *log);
+
+#endif
+
+
 ssize_t
 ngx_read_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
 {
@@ -64,6 +97,216 @@ ngx_read_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
 }
 
 
+#if (NGX_HAVE_PTHREAD)
+
+/*
+ * the read is posted to the thread pool through file->thread_handler,
+ * and the caller repeats the call with the same arguments once the task
+ * event has completed
+ */
+
+ssize_t
+ngx_thread_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
+    ngx_pool_t *pool)
+{
+    ngx_thread_task_t      *task;
+    ngx_thread_read_ctx_t  *ctx;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, file->log, 0,
+                   "thread read: %d, %p, %uz, %O",
+                   file->fd, buf, size, offset);
+
+    task = file->thread_task;
+
+    /* a temp file task may have been created by a chain write */
+
+    if (task == NULL || task->handler != ngx_thread_read_handler) {
+        task = ngx_thread_task_alloc(pool, sizeof(ngx_thread_read_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_thread_read_handler;
+        task->event.log = file->log;
+
+        file->thread_task = task;
+    }
+
+    ctx = task->ctx;
+
+    if (task->event.active) {
+        ngx_log_error(NGX_LOG_ALERT, file->log, 0,
+                      "second thread read for \"%V\"", &file->name);
+        return NGX_AGAIN;
+    }
+
+    if (task->event.complete) {
+        task->event.complete = 0;
+
+        if (ctx->buf == buf && ctx->size == size && ctx->offset == offset) {
+
+            if (ctx->read == -1) {
+                ngx_log_error(NGX_LOG_CRIT, file->log, ctx->err,
+                              "pread() \"%s\" failed", file->name.data);
+                return NGX_ERROR;
+            }
+
+            file->offset += ctx->read;
+
+            return ctx->read;
+        }
+    }
+
+    ctx->fd = file->fd;
+    ctx->buf = buf;
+    ctx->size = size;
+    ctx->offset = offset;
+
+    if (file->thread_handler(task, file) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_thread_read_handler(void *data, ngx_log_t *log)
+{
+    ngx_thread_read_ctx_t  *ctx = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "thread read handler");
+
+    ctx->read = pread(ctx->fd, ctx->buf, ctx->size, ctx->offset);
+
+    ctx->err = (ctx->read == -1) ? ngx_errno : 0;
+}
+
+
+/*
+ * the chain bufs must stay intact until the task event has completed,
+ * the caller then repeats the call with the same chain and offset
+ */
+
+ssize_t
+ngx_thread_write_chain_to_file(ngx_file_t *file, ngx_chain_t *cl, off_t offset,
+    ngx_pool_t *pool)
+{
+    ngx_thread_task_t                     *task;
+    ngx_thread_write_chain_to_file_ctx_t  *ctx;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, file->log, 0,
+                   "thread write chain: %d, %p, %O",
+                   file->fd, cl, offset);
+
+    task = file->thread_task;
+
+    if (task == NULL
+        || task->handler != ngx_thread_write_chain_to_file_handler)
+    {
+        task = ngx_thread_task_alloc(pool,
+                                 sizeof(ngx_thread_write_chain_to_file_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_thread_write_chain_to_file_handler;
+        task->event.log = file->log;
+
+        file->thread_task = task;
+    }
+
+    ctx = task->ctx;
+
+    if (task->event.active) {
+        ngx_log_error(NGX_LOG_ALERT, file->log, 0,
+                      "second thread write for \"%V\"", &file->name);
+        return NGX_AGAIN;
+    }
+
+    if (task->event.complete) {
+        task->event.complete = 0;
+
+        if (ctx->chain == cl && ctx->offset == offset) {
+
+            if (ctx->written == -1) {
+                ngx_log_error(NGX_LOG_CRIT, file->log, ctx->err,
+                              "pwrite() \"%s\" failed", file->name.data);
+                return NGX_ERROR;
+            }
+
+            file->offset += ctx->written;
+
+            return ctx->written;
+        }
+    }
+
+    ctx->fd = file->fd;
+    ctx->chain = cl;
+    ctx->offset = offset;
+
+    if (file->thread_handler(task, file) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_thread_write_chain_to_file_handler(void *data, ngx_log_t *log)
+{
+    ngx_thread_write_chain_to_file_ctx_t *ctx = data;
+
+    u_char       *buf;
+    off_t         offset;
+    size_t        size;
+    ssize_t       n;
+    ngx_chain_t  *cl;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "thread write chain handler");
+
+    offset = ctx->offset;
+    cl = ctx->chain;
+
+    ctx->written = 0;
+    ctx->err = 0;
+
+    while (cl) {
+
+        /* coalesce the neighbouring bufs into one pwrite() */
+
+        buf = cl->buf->pos;
+        size = cl->buf->last - cl->buf->pos;
+
+        for (cl = cl->next; cl && cl->buf->pos == buf + size; cl = cl->next) {
+            size += cl->buf->last - cl->buf->pos;
+        }
+
+        while (size) {
+            n = pwrite(ctx->fd, buf, size, offset);
+
+            if (n == -1) {
+                if (ngx_errno == NGX_EINTR) {
+                    continue;
+                }
+
+                ctx->written = -1;
+                ctx->err = ngx_errno;
+                return;
+            }
+
+            buf += n;
+            size -= n;
+            offset += n;
+            ctx->written += n;
+        }
+    }
+}
+
+#endif
+
+
 ssize_t
 ngx_write_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
 {
@@ -45,6 +45,7 @@
 
 static redisReply *createReplyObject(int type);
 static void *createStringObject(const redisReadTask *task, char *str, size_t len);
+static void *createStringRefObject(const redisReadTask *task, char *str, size_t len);
 static void *createArrayObject(const redisReadTask *task, int elements);
 static void *createIntegerObject(const redisReadTask *task, long long value);
 static void *createDoubleObject(const redisReadTask *task, double value, char *str, size_t len);
@@ -60,7 +61,8 @@ static redisReplyObjectFunctions defaultFunctions = {
     createDoubleObject,
     createNilObject,
     createBoolObject,
-    freeReplyObject
+    freeReplyObject,
+    createStringRefObject
 };
 
 /* Create a reply object */
@@ -98,7 +100,7 @@ void freeReplyObject(void *reply) {
     case REDIS_REPLY_STATUS:
     case REDIS_REPLY_STRING:
     case REDIS_REPLY_DOUBLE:
-        free(r->str);
+        if (!r->borrowed) free(r->str);
         break;
     }
     free(r);
@@ -138,6 +140,29 @@ static void *createStringObject(const redisReadTask *task, char *str, size_t len
     return r;
 }
 
+/* Zero copy flavor of createStringObject(): the reader already terminated
+ * the string in its buffer, see redisReaderSetZeroCopy(). */
+static void *createStringRefObject(const redisReadTask *task, char *str, size_t len) {
+    redisReply *r, *parent;
+
+    r = createReplyObject(task->type);
+    if (r == NULL)
+        return NULL;
+
+    r->str = str;
+    r->len = len;
+    r->borrowed = 1;
+
+    if (task->parent) {
+        parent = task->parent->obj;
+        assert(parent->type == REDIS_REPLY_ARRAY ||
+               parent->type == REDIS_REPLY_MAP ||
+               parent->type == REDIS_REPLY_SET);
+        parent->element[task->idx] = r;
+    }
+    return r;
+}
+
 static void *createArrayObject(const redisReadTask *task, int elements) {
     redisReply *r, *parent;
 
@@ -94,6 +94,7 @@ typedef struct redisReply {
                   and REDIS_REPLY_DOUBLE (in additionl to dval). */
     size_t elements; /* number of elements, for REDIS_REPLY_ARRAY */
     struct redisReply **element; /* elements vector for REDIS_REPLY_ARRAY */
+    int borrowed; /* str points into the reader buffer (zero copy mode) */
 } redisReply;
 
 redisReader *redisReaderCreate(void);
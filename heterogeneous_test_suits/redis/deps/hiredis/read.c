@@ -116,30 +116,61 @@ static char *readBytes(redisReader *r, unsigned int bytes) {
     return NULL;
 }
 
+/* The newline scan below compares 16 bytes at a time with SSE2 on x86-64 and
+ * with NEON on little endian aarch64, both part of the base ISA. */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define READER_SIMD_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON) && !defined(__AARCH64EB__)
+#include <arm_neon.h>
+#define READER_SIMD_NEON 1
+#endif
+
 /* Find pointer to \r\n. */
 static char *seekNewline(char *s, size_t len) {
-    int pos = 0;
-    int _len = len-1;
+    size_t pos = 0;
 
     /* Position should be < len-1 because the character at "pos" should be
      * followed by a \n. Note that strchr cannot be used because it doesn't
      * allow to search a limited length and the buffer that is being searched
      * might not have a trailing NULL character. */
-    while (pos < _len) {
-        while(pos < _len && s[pos] != '\r') pos++;
-        if (pos==_len) {
-            /* Not found. */
-            return NULL;
-        } else {
-            if (s[pos+1] == '\n') {
-                /* Found. */
-                return s+pos;
-            } else {
-                /* Continue searching. */
-                pos++;
-            }
+    if (len < 2) return NULL;
+    len--;
+
+#if defined(READER_SIMD_SSE2)
+    __m128i cr = _mm_set1_epi8('\r');
+    for (; pos+16 <= len; pos += 16) {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)(s+pos)),cr));
+        while (mask) {
+            size_t j = pos+__builtin_ctz(mask);
+            if (s[j+1] == '\n') return s+j;
+            mask &= mask-1;
         }
     }
+#elif defined(READER_SIMD_NEON)
+    uint8x16_t cr = vdupq_n_u8('\r');
+    for (; pos+16 <= len; pos += 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t*)s+pos),cr);
+        /* Narrow the comparison to four bits per byte. */
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(eq),4)),0);
+        while (mask) {
+            int bit = __builtin_ctzll(mask);
+            size_t j = pos+bit/4;
+            if (s[j+1] == '\n') return s+j;
+            mask &= ~(0xfULL << bit);
+        }
+    }
+#endif
+
+    /* The tail shorter than a vector, or the whole buffer. */
+    while (pos < len) {
+        char *p = memchr(s+pos,'\r',len-pos);
+        if (p == NULL) return NULL;
+        if (p[1] == '\n') return p;
+        pos = p-s+1;
+    }
     return NULL;
 }
 
@@ -218,19 +249,36 @@ static int string2ll(const char *s, size_t slen, long long *value) {
     return REDIS_OK;
 }
 
-static char *readLine(redisReader *r, int *_len) {
-    char *p, *s;
-    int len;
-
-    p = r->buf+r->pos;
-    s = seekNewline(p,(r->len-r->pos));
-    if (s != NULL) {
-        len = s-(r->buf+r->pos);
-        r->pos += len+2; /* skip \r\n */
-        if (_len) *_len = len;
-        return p;
+/* Read the "<number>\r\n" line following a '$' or '*' type byte. Plain
+ * numbers of up to 18 digits, that is every real length, are converted while
+ * they are scanned. Anything else (negative numbers, leading zeroes, lines
+ * not complete yet) goes through seekNewline() and string2ll().
+ *
+ * Returns the length of the line without its \r\n and sets "value", or -1
+ * if the line is not complete yet, or -2 if it does not hold a number. The
+ * cursor is not moved. */
+static long readLength(redisReader *r, long long *value) {
+    char *p = r->buf+r->pos, *s;
+    size_t avail = r->len-r->pos, j = 0;
+    long long v = 0;
+
+    while (j < avail && j < 18 && p[j] >= '0' && p[j] <= '9') {
+        v = v*10+(p[j]-'0');
+        j++;
     }
-    return NULL;
+    if (j > 0 && j+1 < avail && p[j] == '\r' && p[j+1] == '\n' &&
+        (p[0] != '0' || j == 1))
+    {
+        *value = v;
+        return j;
+    }
+
+    s = seekNewline(p,avail);
+    if (s == NULL)
+        return -1;
+    if (string2ll(p,s-p,value) == REDIS_ERR)
+        return -2;
+    return s-p;
 }
 
 static void moveToNextTask(redisReader *r) {
@@ -345,22 +393,21 @@ static void moveToNextTask(redisReader *r) {
 static int processBulkItem(redisReader *r) {
     redisReadTask *cur = &(r->rstack[r->ridx]);
     void *obj = NULL;
-    char *p, *s;
+    char *s;
     long long len;
+    long linelen;
     unsigned long bytelen;
     int success = 0;
 
-    p = r->buf+r->pos;
-    s = seekNewline(p,r->len-r->pos);
-    if (s != NULL) {
-        p = r->buf+r->pos;
-        bytelen = s-(r->buf+r->pos)+2; /* include \r\n */
-
-        if (string2ll(p, bytelen - 2, &len) == REDIS_ERR) {
-            __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
-                    "Bad bulk string length");
-            return REDIS_ERR;
-        }
+    linelen = readLength(r,&len);
+    if (linelen == -2) {
+        __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                "Bad bulk string length");
+        return REDIS_ERR;
+    }
+    if (linelen >= 0) {
+        s = r->buf+r->pos+linelen;
+        bytelen = linelen+2; /* include \r\n */
 
         if (len < -1 || (LLONG_MAX > SIZE_MAX && len > (long long)SIZE_MAX)) {
             __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
@@ -379,10 +426,16 @@ static int processBulkItem(redisReader *r) {
             /* Only continue when the buffer contains the entire bulk item. */
             bytelen += len+2; /* include \r\n */
             if (r->pos+bytelen <= r->len) {
-                if (r->fn && r->fn->createString)
+                if (r->zerocopy && r->fn && r->fn->createStringRef) {
+                    /* Terminate the string in place, over the \r that
+                     * follows it: the reader never looks back at it. */
+                    s[2+len] = '\0';
+                    obj = r->fn->createStringRef(cur,s+2,len);
+                } else if (r->fn && r->fn->createString) {
                     obj = r->fn->createString(cur,s+2,len);
-                else
+                } else {
                     obj = (void*)REDIS_REPLY_STRING;
+                }
                 success = 1;
             }
         }
@@ -410,9 +463,9 @@ static int processBulkItem(redisReader *r) {
 static int processAggregateItem(redisReader *r) {
     redisReadTask *cur = &(r->rstack[r->ridx]);
     void *obj;
-    char *p;
     long long elements;
-    int root = 0, len;
+    long len;
+    int root = 0;
 
     /* Set error for nested multi bulks with depth > 7 */
     if (r->ridx == 8) {
@@ -421,12 +474,14 @@ static int processAggregateItem(redisReader *r) {
         return REDIS_ERR;
     }
 
-    if ((p = readLine(r,&len)) != NULL) {
-        if (string2ll(p, len, &elements) == REDIS_ERR) {
-            __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
-                    "Bad multi-bulk length");
-            return REDIS_ERR;
-        }
+    len = readLength(r,&elements);
+    if (len == -2) {
+        __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                "Bad multi-bulk length");
+        return REDIS_ERR;
+    }
+    if (len >= 0) {
+        r->pos += len+2; /* skip \r\n */
 
         root = (r->ridx == 0);
 
@@ -591,6 +646,14 @@ int redisReaderFeed(redisReader *r, const char *buf, size_t len) {
 
     /* Copy the provided buffer. */
     if (buf != NULL && len >= 1) {
+        /* Zero copy replies stay valid until here, so this is where the
+         * consumed part of the buffer is discarded. */
+        if (r->zerocopy && r->pos > 0) {
+            sdsrange(r->buf,r->pos,-1);
+            r->pos = 0;
+            r->len = sdslen(r->buf);
+        }
+
         /* Destroy internal buffer when it is empty and is quite large. */
         if (r->len == 0 && r->maxbuf != 0 && sdsavail(r->buf) > r->maxbuf) {
             sdsfree(r->buf);
@@ -648,8 +711,9 @@ int redisReaderGetReply(redisReader *r, void **reply) {
         return REDIS_ERR;
 
     /* Discard part of the buffer when we've consumed at least 1k, to avoid
-     * doing unnecessary calls to memmove() in sds.c. */
-    if (r->pos >= 1024) {
+     * doing unnecessary calls to memmove() in sds.c. With zero copy replies
+     * this is left to the next redisReaderFeed(). */
+    if (r->pos >= 1024 && !r->zerocopy) {
         sdsrange(r->buf,r->pos,-1);
         r->pos = 0;
         r->len = sdslen(r->buf);
@@ -85,6 +85,9 @@ typedef struct redisReplyObjectFunctions {
     void *(*createNil)(const redisReadTask*);
     void *(*createBool)(const redisReadTask*, int);
     void (*freeObject)(void*);
+    /* Like createString, but the object may keep referencing "str", which is
+     * NULL terminated in the reader buffer. Only used in zero copy mode. */
+    void *(*createStringRef)(const redisReadTask*, char*, size_t);
 } redisReplyObjectFunctions;
 
 typedef struct redisReader {
@@ -95,6 +98,7 @@ typedef struct redisReader {
     size_t pos; /* Buffer cursor */
     size_t len; /* Buffer length */
     size_t maxbuf; /* Max length of unused buffer */
+    int zerocopy; /* Bulk strings reference the buffer, see below */
 
     redisReadTask rstack[9];
     int ridx; /* Index of current read task */
@@ -114,6 +118,12 @@ int redisReaderGetReply(redisReader *r, void **reply);
 #define redisReaderGetObject(_r) (((redisReader*)(_r))->reply)
 #define redisReaderGetError(_r) (((redisReader*)(_r))->errstr)
 
+/* In zero copy mode bulk string replies point into the reader buffer instead
+ * of owning a copy. They stay valid until the next redisReaderFeed() (for a
+ * context, the next read from the socket) or until the reader is freed, so
+ * this suits callers that consume every reply before feeding more data. */
+#define redisReaderSetZeroCopy(_r, _on) (int)(((redisReader*)(_r))->zerocopy = (_on))
+
 #ifdef __cplusplus
 }
 #endif
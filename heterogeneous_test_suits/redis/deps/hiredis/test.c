@@ -419,6 +419,51 @@ static void test_reply_reader(void) {
         ((redisReply*)reply)->elements == 0);
     freeReplyObject(reply);
     redisReaderFree(reader);
+
+    test("Finds a newline past the first vector: ");
+    reader = redisReaderCreate();
+    redisReaderFeed(reader,(char*)"*12345678901234567\r8901234567890",32);
+    ret = redisReaderGetReply(reader,&reply);
+    assert(ret == REDIS_OK && reply == NULL);
+    redisReaderFeed(reader,(char*)"\r\n",2);
+    ret = redisReaderGetReply(reader,&reply);
+    test_cond(ret == REDIS_ERR &&
+              strcasecmp(reader->errstr,"Bad multi-bulk length") == 0);
+    redisReaderFree(reader);
+
+    test("Set error on leading zeroes in bulk length: ");
+    reader = redisReaderCreate();
+    redisReaderFeed(reader,(char*)"$03\r\nfoo\r\n",10);
+    ret = redisReaderGetReply(reader,NULL);
+    test_cond(ret == REDIS_ERR &&
+              strcasecmp(reader->errstr,"Bad bulk string length") == 0);
+    redisReaderFree(reader);
+
+    test("Zero copy strings reference the reader buffer: ");
+    reader = redisReaderCreate();
+    redisReaderSetZeroCopy(reader,1);
+    redisReaderFeed(reader,(char*)"*2\r\n$3\r\nfoo\r\n$",14);
+    redisReaderFeed(reader,(char*)"3\r\nbar\r\n$5\r\nhello\r\n",19);
+    ret = redisReaderGetReply(reader,&reply);
+    {
+        redisReply *r = reply, *second = NULL;
+        void *next = NULL;
+        int ok = ret == REDIS_OK && r->type == REDIS_REPLY_ARRAY &&
+            r->elements == 2 && r->element[0]->borrowed &&
+            r->element[0]->str > reader->buf &&
+            r->element[0]->str < reader->buf+reader->len &&
+            strcmp(r->element[0]->str,"foo") == 0 &&
+            strcmp(r->element[1]->str,"bar") == 0;
+        ret = redisReaderGetReply(reader,&next);
+        second = next;
+        ok = ok && ret == REDIS_OK && second->borrowed &&
+            strcmp(second->str,"hello") == 0 &&
+            strcmp(r->element[0]->str,"foo") == 0;
+        test_cond(ok);
+        freeReplyObject(r);
+        freeReplyObject(second);
+    }
+    redisReaderFree(reader);
 }
 
 static void test_free_null(void) {
@@ -189,6 +189,9 @@ user *ACLCreateUser(const char *name, size_t namelen) {
     listSetMatchMethod(u->patterns,ACLListMatchSds);
     listSetFreeMethod(u->patterns,ACLListFreeSds);
     listSetDupMethod(u->patterns,ACLListDupSds);
+    u->exact_patterns = raxNew();
+    u->prefix_patterns = raxNew();
+    u->glob_patterns = zcalloc(sizeof(stringmatchPattern*));
     memset(u->allowed_commands,0,sizeof(u->allowed_commands));
     raxInsert(Users,(unsigned char*)name,namelen,u,NULL);
     return u;
@@ -211,12 +214,109 @@ user *ACLCreateUnlinkedUser(void) {
     }
 }
 
+/* Return true if some string of the prefix-free radix tree 'prefixes' is a
+ * prefix of 'key'. If there is one, it is the greatest string that is not
+ * greater than 'key': any string between the two would differ from it
+ * before its end, where it can only be greater than 'key' too. */
+static int ACLMatchPrefix(rax *prefixes, unsigned char *key, size_t len) {
+    raxIterator ri;
+    int match = 0;
+
+    if (raxSize(prefixes) == 0) return 0;
+    raxStart(&ri,prefixes);
+    raxSeek(&ri,"<=",key,len);
+    if (raxNext(&ri))
+        match = ri.key_len <= len && memcmp(ri.key,key,ri.key_len) == 0;
+    raxStop(&ri);
+    return match;
+}
+
+/* Order the "prefix*" patterns by length, see ACLCompileUserPatterns(). */
+static int ACLComparePatternLength(const void *a, const void *b) {
+    size_t la = sdslen(*(sds*)a), lb = sdslen(*(sds*)b);
+
+    return (la > lb) - (la < lb);
+}
+
+/* Free the NULL terminated array of compiled glob patterns of the user. */
+static void ACLFreeGlobPatterns(user *u) {
+    stringmatchPattern **glob;
+
+    for (glob = u->glob_patterns; *glob; glob++) stringmatchFree(*glob);
+    zfree(u->glob_patterns);
+}
+
+/* Rebuild the compiled form of the key patterns of the user, see the user
+ * structure. Called every time u->patterns changes. */
+static void ACLCompileUserPatterns(user *u) {
+    listIter li;
+    listNode *ln;
+    sds *prefixes;
+    int nprefixes = 0, nglobs = 0, j;
+
+    raxFree(u->exact_patterns);
+    raxFree(u->prefix_patterns);
+    ACLFreeGlobPatterns(u);
+    u->exact_patterns = raxNew();
+    u->prefix_patterns = raxNew();
+    u->glob_patterns = zmalloc(sizeof(stringmatchPattern*)*
+                               (listLength(u->patterns)+1));
+    prefixes = zmalloc(sizeof(sds)*(listLength(u->patterns)+1));
+
+    listRewind(u->patterns,&li);
+    while((ln = listNext(&li))) {
+        sds pattern = listNodeValue(ln);
+        size_t plen = sdslen(pattern);
+        size_t special = strcspn(pattern,"*?[\\");
+
+        if (special == plen) {
+            raxInsert(u->exact_patterns,(unsigned char*)pattern,plen,
+                      NULL,NULL);
+        } else if (special == plen-1 && pattern[special] == '*') {
+            prefixes[nprefixes++] = pattern;
+        } else {
+            u->glob_patterns[nglobs++] = stringmatchCompile(pattern,plen,0);
+        }
+    }
+    u->glob_patterns[nglobs] = NULL;
+
+    /* Shorter prefixes first, so that a prefix already covered by another
+     * one is never added. */
+    qsort(prefixes,nprefixes,sizeof(sds),ACLComparePatternLength);
+    for (j = 0; j < nprefixes; j++) {
+        unsigned char *prefix = (unsigned char*)prefixes[j];
+        size_t len = sdslen(prefixes[j])-1;
+
+        if (!ACLMatchPrefix(u->prefix_patterns,prefix,len))
+            raxInsert(u->prefix_patterns,prefix,len,NULL,NULL);
+    }
+    zfree(prefixes);
+}
+
+/* Return true if the user key patterns allow 'key'. */
+static int ACLMatchKey(user *u, sds key) {
+    size_t len = sdslen(key);
+    stringmatchPattern **glob;
+
+    if (raxFind(u->exact_patterns,(unsigned char*)key,len) != raxNotFound)
+        return 1;
+    if (ACLMatchPrefix(u->prefix_patterns,(unsigned char*)key,len))
+        return 1;
+    for (glob = u->glob_patterns; *glob; glob++) {
+        if (stringmatchPatternMatch(*glob,key,len)) return 1;
+    }
+    return 0;
+}
+
 /* Release the memory used by the user structure. Note that this function
  * will not remove the user from the Users global radix tree. */
 void ACLFreeUser(user *u) {
     sdsfree(u->name);
     listRelease(u->passwords);
     listRelease(u->patterns);
+    raxFree(u->exact_patterns);
+    raxFree(u->prefix_patterns);
+    ACLFreeGlobPatterns(u);
     ACLResetSubcommands(u);
     zfree(u);
 }
@@ -253,6 +353,7 @@ void ACLCopyUser(user *dst, user *src) {
     listRelease(dst->patterns);
     dst->passwords = listDup(src->passwords);
     dst->patterns = listDup(src->patterns);
+    ACLCompileUserPatterns(dst);
     memcpy(dst->allowed_commands,src->allowed_commands,
            sizeof(dst->allowed_commands));
     dst->flags = src->flags;
@@ -679,9 +780,11 @@ int ACLSetUser(user *u, const char *op, ssize_t oplen) {
     {
         u->flags |= USER_FLAG_ALLKEYS;
         listEmpty(u->patterns);
+        ACLCompileUserPatterns(u);
     } else if (!strcasecmp(op,"resetkeys")) {
         u->flags &= ~USER_FLAG_ALLKEYS;
         listEmpty(u->patterns);
+        ACLCompileUserPatterns(u);
     } else if (!strcasecmp(op,"allcommands") ||
                !strcasecmp(op,"+@all"))
     {
@@ -724,7 +827,12 @@ int ACLSetUser(user *u, const char *op, ssize_t oplen) {
         sds newpat = sdsnewlen(op+1,oplen-1);
         listNode *ln = listSearchKey(u->patterns,newpat);
         /* Avoid re-adding the same pattern multiple times. */
-        if (ln == NULL) listAddNodeTail(u->patterns,newpat);
+        if (ln == NULL) {
+            listAddNodeTail(u->patterns,newpat);
+            ACLCompileUserPatterns(u);
+        } else {
+            sdsfree(newpat);
+        }
         u->flags &= ~USER_FLAG_ALLKEYS;
     } else if (op[0] == '+' && op[1] != '@') {
         if (strchr(op,'|') == NULL) {
@@ -1000,24 +1108,8 @@ int ACLCheckCommandPerm(client *c) {
         int numkeys;
         int *keyidx = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
         for (int j = 0; j < numkeys; j++) {
-            listIter li;
-            listNode *ln;
-            listRewind(u->patterns,&li);
-
-            /* Test this key against every pattern. */
-            int match = 0;
-            while((ln = listNext(&li))) {
-                sds pattern = listNodeValue(ln);
-                size_t plen = sdslen(pattern);
-                int idx = keyidx[j];
-                if (stringmatchlen(pattern,plen,c->argv[idx]->ptr,
-                                   sdslen(c->argv[idx]->ptr),0))
-                {
-                    match = 1;
-                    break;
-                }
-            }
-            if (!match) {
+            /* Test this key against the compiled patterns. */
+            if (!ACLMatchKey(u,c->argv[keyidx[j]]->ptr)) {
                 getKeysFreeResult(keyidx);
                 return ACL_DENIED_KEY;
             }
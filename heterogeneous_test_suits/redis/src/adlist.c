@@ -342,6 +342,24 @@ void listRotate(list *list) {
     list->head = tail;
 }
 
+/* Rotate the list moving the head node to the tail. Unlike removing it and
+ * adding its value again, the node itself is moved, so that pointers to it
+ * stay valid. */
+void listRotateHeadToTail(list *list) {
+    listNode *head = list->head;
+
+    if (listLength(list) <= 1) return;
+
+    /* Detach current head */
+    list->head = head->next;
+    list->head->prev = NULL;
+    /* Move it as tail */
+    list->tail->next = head;
+    head->next = NULL;
+    head->prev = list->tail;
+    list->tail = head;
+}
+
 /* Add all the elements of the list 'o' at the end of the
  * list 'l'. The list 'other' remains empty but otherwise valid. */
 void listJoin(list *l, list *o) {
@@ -30,6 +30,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "fmacros.h"
 #include <stdio.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -43,14 +44,21 @@
 #include "ae.h"
 #include "zmalloc.h"
 #include "config.h"
-#include <migrate.h>
+
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_profile.h"
+#include "popcorn_schedule.h"
+#include "popcorn_nodes.h"
+#include "popcorn_cost.h"
 
 /* Include the best multiplexing layer supported by this system.
  * The following should be ordered by performances, descending. */
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
-    #ifdef HAVE_EPOLL
+    #if defined(HAVE_EPOLL) && defined(HAVE_AE_IOURING)
+    #include "ae_iouring.c"
+    #elif defined(HAVE_EPOLL)
     #include "ae_epoll.c"
     #else
         #ifdef HAVE_KQUEUE
@@ -60,6 +68,9 @@
         #endif
     #endif
 #endif
+
+static long long aeMigrateCostUsec(void);
+
 aeEventLoop *aeCreateEventLoop(int setsize) {
     aeEventLoop *eventLoop;
     int i;
@@ -76,6 +87,17 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     eventLoop->maxfd = -1;
     eventLoop->beforesleep = NULL;
     eventLoop->aftersleep = NULL;
+    eventLoop->migrationPolicy = aeMigrationPolicyAlways;
+    eventLoop->migrationPrivdata = NULL;
+    eventLoop->migrationArrival = NULL;
+    eventLoop->migrationArrivalPrivdata = NULL;
+    eventLoop->migrationDone = NULL;
+    eventLoop->migrationDonePrivdata = NULL;
+    eventLoop->migrationNode = AE_HOME_NODE;
+    eventLoop->migrationHold = 0;
+    eventLoop->sleepUsec = 0;
+    memset(&eventLoop->migrationStats,0,sizeof(eventLoop->migrationStats));
+    eventLoop->migrationStats.migrate_avg_usec = aeMigrateCostUsec();
     if (aeApiCreate(eventLoop) == -1) goto err;
     /* Events with mask == AE_NONE are not set. So let's initialize the
      * vector with it. */
@@ -341,6 +363,144 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
     return processed;
 }
 
+/* Return the UNIX time in microseconds */
+static long long aeUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* The cost of a migrate() call in the model measured by bench/popcornmicro
+ * ($POPCORN_COST, see popcorn_cost.h), or 0 without one: until the first
+ * migration the policies weigh the time events against it instead of
+ * against nothing. The model has round trips, two calls each. */
+static long long aeMigrateCostUsec(void) {
+    double ns;
+
+    if (popcorn_cost_load(NULL) < 0) return 0;
+    ns = popcorn_cost("migrate",POPCORN_COST_ANY,0,1);
+    return ns > 0 ? (long long)(ns/2000) : 0;
+}
+
+/* Moving average used for the time events and migrate() cost estimates:
+ * the first sample initializes it, then every new one weights 1/8. */
+static long long aeMovingAverage(long long avg, long long sample) {
+    return avg ? (avg*7+sample)/8 : sample;
+}
+
+/* Return true if at least one time event should fire now. */
+static int aeTimeEventsDue(aeEventLoop *eventLoop) {
+    aeTimeEvent *shortest = aeSearchNearestTimer(eventLoop);
+    long now_sec, now_ms;
+
+    if (shortest == NULL) return 0;
+    aeGetTime(&now_sec, &now_ms);
+    return now_sec > shortest->when_sec ||
+           (now_sec == shortest->when_sec && now_ms >= shortest->when_ms);
+}
+
+/* Passed to migrate(): runs on the destination node before migrate()
+ * returns. Fault in the pages of the registered events, which the next
+ * aeApiPoll() walks anyway, and let the program refresh its own state. */
+static void aeMigrationArrived(void *privdata) {
+    aeEventLoop *eventLoop = privdata;
+    volatile char *p = (volatile char *)eventLoop->events;
+    volatile char *end = p + (eventLoop->maxfd+1)*sizeof(aeFileEvent);
+
+    for (; p < end; p += PAGE_SIZE) (void)*p;
+    if (eventLoop->migrationArrival)
+        eventLoop->migrationArrival(eventLoop,
+            eventLoop->migrationArrivalPrivdata);
+}
+
+/* Move the event loop thread to node 'nid', or to the best remote node if
+ * 'nid' is AE_MIGRATE_BEST, accounting the time spent in migrate(). Returns
+ * AE_OK if the thread now runs on 'nid'. */
+static int aeMigrateTo(aeEventLoop *eventLoop, int nid) {
+    aeMigrationStats *st = &eventLoop->migrationStats;
+    long long start, elapsed;
+    int retval;
+
+    if (nid == eventLoop->migrationNode) return AE_OK;
+    if (nid == AE_MIGRATE_BEST) {
+        if (eventLoop->migrationNode != AE_HOME_NODE) return AE_OK;
+        nid = POPCORN_NODE_BEST;
+    }
+    start = aeUstime();
+    retval = popcorn_nodes_migrate_cb(AE_REGION_TIME_EVENTS, nid,
+        aeMigrationArrived, eventLoop);
+    elapsed = aeUstime()-start;
+    if (retval != 0 && retval != EBUSY) {
+        st->failed++;
+        return AE_ERR;
+    }
+    eventLoop->migrationNode = popcorn_nodes_current();
+    if (retval == EBUSY) return AE_OK; /* We were already there. */
+    st->migrations++;
+    st->migrate_usec += elapsed;
+    if (elapsed > st->migrate_max_usec) st->migrate_max_usec = elapsed;
+    st->migrate_avg_usec = aeMovingAverage(st->migrate_avg_usec,elapsed);
+    if (eventLoop->migrationDone)
+        eventLoop->migrationDone(eventLoop,elapsed,
+            eventLoop->migrationDonePrivdata);
+    return AE_OK;
+}
+
+/* Run the time events wherever the migration policy wants them to run.
+ * 'fired' is the number of file events processed in this iteration. */
+static int processTimeEventsMigrating(aeEventLoop *eventLoop, int fired) {
+    aeMigrationStats *st = &eventLoop->migrationStats;
+    long long start, elapsed;
+    int processed;
+
+    if (eventLoop->migrationHold > 0) {
+        /* Still batching ticks on the remote node. */
+        eventLoop->migrationHold--;
+        st->held_ticks++;
+    } else if (eventLoop->migrationPolicy) {
+        aeMigrationHint hint;
+        int nid;
+
+        hint.curnode = eventLoop->migrationNode;
+        hint.fired = fired;
+        hint.due = aeTimeEventsDue(eventLoop);
+        hint.te_usec = st->te_avg_usec;
+        hint.migrate_usec = st->migrate_avg_usec;
+        hint.hold = 0;
+        nid = eventLoop->migrationPolicy(eventLoop,&hint,
+                                         eventLoop->migrationPrivdata);
+        if (nid != AE_MIGRATE_STAY &&
+            aeMigrateTo(eventLoop,nid) == AE_OK &&
+            nid != AE_HOME_NODE)
+        {
+            eventLoop->migrationHold = hint.hold;
+        }
+    }
+
+    start = aeUstime();
+    processed = processTimeEvents(eventLoop);
+    elapsed = aeUstime()-start;
+    if (eventLoop->migrationNode == AE_HOME_NODE) {
+        st->local_ticks++;
+        st->local_usec += elapsed;
+    } else {
+        st->remote_ticks++;
+        st->remote_usec += elapsed;
+    }
+    if (processed) st->te_avg_usec = aeMovingAverage(st->te_avg_usec,elapsed);
+
+    /* Go back home unless we are batching more ticks remotely. If this
+     * fails there is nothing better to do than trying again at the next
+     * iteration, and meanwhile the loop keeps running where it is. */
+    if (eventLoop->migrationHold == 0 &&
+        eventLoop->migrationNode != AE_HOME_NODE)
+    {
+        aeMigrateTo(eventLoop,AE_HOME_NODE);
+    }
+    return processed;
+}
+
 /* Process every pending time event, then every pending file event
  * (that may be registered by time event callbacks just processed).
  * Without special flags the function sleeps until some file event
@@ -357,7 +517,7 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
  * The function returns the number of events processed. */
 int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 {
-    int processed = 0, numevents;
+    int processed = 0, numevents = 0;
 
     /* Nothing to do? return ASAP */
     if (!(flags & AE_TIME_EVENTS) && !(flags & AE_FILE_EVENTS)) return 0;
@@ -408,7 +568,17 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 
         /* Call the multiplexing API, will return only on timeout or when
          * some event fires. */
-        numevents = aeApiPoll(eventLoop, tvp);
+        if (tvp == NULL || tvp->tv_sec || tvp->tv_usec) {
+            struct timeval start, end;
+
+            gettimeofday(&start, NULL);
+            numevents = aeApiPoll(eventLoop, tvp);
+            gettimeofday(&end, NULL);
+            eventLoop->sleepUsec += (end.tv_sec-start.tv_sec)*1000000LL +
+                                    (end.tv_usec-start.tv_usec);
+        } else {
+            numevents = aeApiPoll(eventLoop, tvp);
+        }
 
         /* After sleep callback. */
         if (eventLoop->aftersleep != NULL && flags & AE_CALL_AFTER_SLEEP)
@@ -466,11 +636,9 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
         }
     }
 
-    migrate(1, NULL, NULL);
     /* Check time events */
     if (flags & AE_TIME_EVENTS)
-        processed += processTimeEvents(eventLoop);
-    migrate(0, NULL, NULL);
+        processed += processTimeEventsMigrating(eventLoop,numevents);
 
     return processed; /* return the number of processed file/time events */
 }
@@ -519,3 +687,67 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep) {
     eventLoop->aftersleep = aftersleep;
 }
+
+/* Set the policy deciding where time events run. A NULL policy means the
+ * event loop never migrates. A batch in progress is left to complete. */
+void aeSetMigrationPolicy(aeEventLoop *eventLoop, aeMigrationPolicyProc *policy, void *privdata) {
+    eventLoop->migrationPolicy = policy;
+    eventLoop->migrationPrivdata = privdata;
+}
+
+/* Set the callback run on the destination node every time the event loop
+ * thread migrates, before any other event is processed there. */
+void aeSetMigrationArrivalProc(aeEventLoop *eventLoop, aeMigrationArrivalProc *arrival, void *privdata) {
+    eventLoop->migrationArrival = arrival;
+    eventLoop->migrationArrivalPrivdata = privdata;
+}
+
+/* Set the callback run every time the event loop thread migrated, once
+ * migrate() returned, with the microseconds migrate() took. */
+void aeSetMigrationDoneProc(aeEventLoop *eventLoop, aeMigrationDoneProc *done, void *privdata) {
+    eventLoop->migrationDone = done;
+    eventLoop->migrationDonePrivdata = privdata;
+}
+
+void aeGetMigrationStats(aeEventLoop *eventLoop, aeMigrationStats *stats) {
+    *stats = eventLoop->migrationStats;
+}
+
+/* Reset the counters, but not the cost estimates the policies rely on. */
+void aeResetMigrationStats(aeEventLoop *eventLoop) {
+    aeMigrationStats *st = &eventLoop->migrationStats;
+    long long te_avg_usec = st->te_avg_usec;
+    long long migrate_avg_usec = st->migrate_avg_usec;
+
+    memset(st,0,sizeof(*st));
+    st->te_avg_usec = te_avg_usec;
+    st->migrate_avg_usec = migrate_avg_usec;
+}
+
+/* The historical behavior: run every time events processing remotely, on
+ * the node pointed by 'privdata' or on the best one. */
+int aeMigrationPolicyAlways(aeEventLoop *eventLoop, aeMigrationHint *hint, void *privdata) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(hint);
+    return privdata ? *(int*)privdata : AE_MIGRATE_BEST;
+}
+
+int aeMigrationPolicyNever(aeEventLoop *eventLoop, aeMigrationHint *hint, void *privdata) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(hint);
+    AE_NOTUSED(privdata);
+    return AE_MIGRATE_STAY;
+}
+
+/* See the aeAdaptiveMigrationPolicy comment in ae.h. */
+int aeMigrationPolicyAdaptive(aeEventLoop *eventLoop, aeMigrationHint *hint, void *privdata) {
+    aeAdaptiveMigrationPolicy *p = privdata;
+
+    AE_NOTUSED(eventLoop);
+    if (!hint->due || hint->fired > p->max_fired) return AE_MIGRATE_STAY;
+    if (hint->te_usec < p->min_te_usec ||
+        hint->te_usec < p->cost_ratio*hint->migrate_usec)
+        return AE_MIGRATE_STAY;
+    if (hint->fired == 0) hint->hold = p->batch_ticks;
+    return p->nid;
+}
@@ -56,6 +56,14 @@
 #define AE_NOMORE -1
 #define AE_DELETED_EVENT_ID -1
 
+/* Popcorn migration of the time events processing. The event loop thread
+ * lives on AE_HOME_NODE; the migration policy may move it elsewhere while
+ * time events run, and optionally keep it there for a few more ticks. */
+#define AE_HOME_NODE 0
+#define AE_MIGRATE_STAY -1  /* Policy return value: don't change node. */
+#define AE_MIGRATE_BEST -2  /* Node chosen by popcorn_nodes.h. */
+#define AE_REGION_TIME_EVENTS 1 /* popcorn_profile.h region of time events. */
+
 /* Macros */
 #define AE_NOTUSED(V) ((void) V)
 
@@ -67,6 +75,49 @@ typedef int aeTimeProc(struct aeEventLoop *eventLoop, long long id, void *client
 typedef void aeEventFinalizerProc(struct aeEventLoop *eventLoop, void *clientData);
 typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
 
+/* What the migration policy gets to see before every time events run. */
+typedef struct aeMigrationHint {
+    int curnode;            /* Node the event loop thread is running on. */
+    int fired;              /* File events processed in this iteration. */
+    int due;                /* True if at least one time event is due. */
+    long long te_usec;      /* Moving average of time events cost. */
+    long long migrate_usec; /* Moving average of a single migrate() call. */
+    int hold;               /* Out: extra ticks to stay on the target node. */
+} aeMigrationHint;
+
+typedef int aeMigrationPolicyProc(struct aeEventLoop *eventLoop, aeMigrationHint *hint, void *privdata);
+typedef void aeMigrationArrivalProc(struct aeEventLoop *eventLoop, void *privdata);
+typedef void aeMigrationDoneProc(struct aeEventLoop *eventLoop, long long usec, void *privdata);
+
+/* Counters about migrations performed by the event loop. */
+typedef struct aeMigrationStats {
+    long long migrations;       /* Successful migrate() calls. */
+    long long failed;           /* migrate() calls that returned an error. */
+    long long migrate_usec;     /* Total time spent inside migrate(). */
+    long long migrate_max_usec; /* Slowest migrate() call observed. */
+    long long remote_ticks;     /* Time events runs on a remote node. */
+    long long local_ticks;      /* Time events runs on the home node. */
+    long long remote_usec;      /* Time events work done remotely. */
+    long long local_usec;       /* Time events work done on the home node. */
+    long long held_ticks;       /* Iterations spent on remote while batching. */
+    long long te_avg_usec;      /* Moving average of time events cost. */
+    long long migrate_avg_usec; /* Moving average of a migrate() call. */
+} aeMigrationStats;
+
+/* Parameters of the built-in adaptive policy. The time events are offloaded
+ * only when some of them are due, their cost is at least 'cost_ratio' times
+ * the cost of the migration itself, and the loop isn't busy with more than
+ * 'max_fired' file events. When the loop is idle the thread is kept on the
+ * remote node for 'batch_ticks' more iterations. */
+typedef struct aeAdaptiveMigrationPolicy {
+    int nid;                /* Remote node to offload time events to, or
+                               AE_MIGRATE_BEST. */
+    int max_fired;
+    int batch_ticks;
+    long long min_te_usec;  /* Never offload time events cheaper than this. */
+    double cost_ratio;
+} aeAdaptiveMigrationPolicy;
+
 /* File event structure */
 typedef struct aeFileEvent {
     int mask; /* one of AE_(READABLE|WRITABLE|BARRIER) */
@@ -106,6 +157,16 @@ typedef struct aeEventLoop {
     void *apidata; /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
     aeBeforeSleepProc *aftersleep;
+    aeMigrationPolicyProc *migrationPolicy;
+    void *migrationPrivdata;
+    aeMigrationArrivalProc *migrationArrival; /* Run by migrate() on arrival. */
+    void *migrationArrivalPrivdata;
+    aeMigrationDoneProc *migrationDone; /* Run back with the migrate() time. */
+    void *migrationDonePrivdata;
+    int migrationNode;  /* Node the event loop thread is running on. */
+    int migrationHold;  /* Ticks left before going back to AE_HOME_NODE. */
+    aeMigrationStats migrationStats;
+    long long sleepUsec; /* Time spent waiting in aeApiPoll(). */
 } aeEventLoop;
 
 /* Prototypes */
@@ -128,5 +189,13 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep);
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
+void aeSetMigrationPolicy(aeEventLoop *eventLoop, aeMigrationPolicyProc *policy, void *privdata);
+void aeSetMigrationArrivalProc(aeEventLoop *eventLoop, aeMigrationArrivalProc *arrival, void *privdata);
+void aeSetMigrationDoneProc(aeEventLoop *eventLoop, aeMigrationDoneProc *done, void *privdata);
+void aeGetMigrationStats(aeEventLoop *eventLoop, aeMigrationStats *stats);
+void aeResetMigrationStats(aeEventLoop *eventLoop);
+int aeMigrationPolicyAlways(aeEventLoop *eventLoop, aeMigrationHint *hint, void *privdata);
+int aeMigrationPolicyNever(aeEventLoop *eventLoop, aeMigrationHint *hint, void *privdata);
+int aeMigrationPolicyAdaptive(aeEventLoop *eventLoop, aeMigrationHint *hint, void *privdata);
 
 #endif
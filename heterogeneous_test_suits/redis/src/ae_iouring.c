@@ -0,0 +1,397 @@
+/* Linux io_uring based ae.c module
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* The io_uring based ae.c module (build with USE_AE_IOURING=yes).
+ *
+ * Readiness comes from IORING_OP_POLL_ADD requests. They are one-shot: the
+ * event loop is level triggered (a read handler may leave data in the
+ * socket, the accept handler connections in the backlog), so every fd whose
+ * poll completed is polled again by the next aeApiPoll(), and a poll on a
+ * ready fd completes at once. Those polls, the changes of aeApiAddEvent()
+ * and aeApiDelEvent() and the timeout go to the kernel with the same
+ * io_uring_enter(2) that waits for the events: one system call per
+ * iteration of the event loop.
+ *
+ * When the kernel has no io_uring (or is older than 5.5), the loop runs on
+ * ae_epoll.c instead. */
+
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define aeApiState aeEpollState
+#define aeApiCreate aeEpollCreate
+#define aeApiResize aeEpollResize
+#define aeApiFree aeEpollFree
+#define aeApiAddEvent aeEpollAddEvent
+#define aeApiDelEvent aeEpollDelEvent
+#define aeApiPoll aeEpollPoll
+#define aeApiName aeEpollName
+#include "ae_epoll.c"
+#undef aeApiState
+#undef aeApiCreate
+#undef aeApiResize
+#undef aeApiFree
+#undef aeApiAddEvent
+#undef aeApiDelEvent
+#undef aeApiPoll
+#undef aeApiName
+
+#define AE_URING_ENTRIES 1024   /* Requests queued between two system calls. */
+
+/* The user_data of a request: its kind, the fd and its generation, so that
+ * the completion of a poll replaced in the meantime is recognized. */
+#define AE_URING_POLL 0
+#define AE_URING_REMOVE 1
+#define AE_URING_TIMEOUT 2
+#define AE_URING_GEN_MASK 0x3fffffff
+#define AE_URING_DATA(kind,fd,gen) \
+    (((uint64_t)((gen) & AE_URING_GEN_MASK) << 34) | \
+     ((uint64_t)(kind) << 32) | (uint32_t)(fd))
+#define AE_URING_KIND(data) (((data) >> 32) & 3)
+#define AE_URING_FD(data) ((int)(uint32_t)(data))
+#define AE_URING_GEN(data) ((uint32_t)((data) >> 34))
+
+/* struct __kernel_timespec, which older headers don't have. */
+typedef struct aeUringTimespec {
+    int64_t tv_sec;
+    long long tv_nsec;
+} aeUringTimespec;
+
+typedef struct aeApiState {
+    aeEpollState *epoll;    /* Not NULL when running on ae_epoll.c. */
+    int ringfd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned sq_tail_local; /* Our tail, published at the next submission. */
+    unsigned char *armed;   /* Mask of the poll pending on each fd. */
+    uint32_t *gen;          /* Generation of that poll. */
+    int *rearm;             /* Fds whose poll completed, to poll again. */
+    int nrearm;
+} aeApiState;
+
+static int aeUringFellBack = 0;  /* For aeApiName(). */
+
+/* Run 'call' of ae_epoll.c on the state of a loop that fell back to it. */
+#define aeUringOnEpoll(eventLoop,state,call) do { \
+    (eventLoop)->apidata = (state)->epoll; \
+    call; \
+    (eventLoop)->apidata = (state); \
+} while(0)
+
+static int aeUringSetup(aeApiState *state) {
+    struct io_uring_params p;
+
+    memset(&p,0,sizeof(p));
+    state->ringfd = syscall(__NR_io_uring_setup,AE_URING_ENTRIES,&p);
+    if (state->ringfd == -1) return -1;
+    /* Without NODROP the completions that don't fit the ring are lost. */
+    if (!(p.features & IORING_FEAT_NODROP)) goto err;
+
+    state->entries = p.sq_entries;
+    state->sq_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cq_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cq_len > state->sq_len) state->sq_len = state->cq_len;
+        state->cq_len = state->sq_len;
+    }
+    state->sq_ptr = mmap(NULL,state->sq_len,PROT_READ|PROT_WRITE,
+                         MAP_SHARED|MAP_POPULATE,state->ringfd,
+                         IORING_OFF_SQ_RING);
+    if (state->sq_ptr == MAP_FAILED) goto err;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        state->cq_ptr = state->sq_ptr;
+    } else {
+        state->cq_ptr = mmap(NULL,state->cq_len,PROT_READ|PROT_WRITE,
+                             MAP_SHARED|MAP_POPULATE,state->ringfd,
+                             IORING_OFF_CQ_RING);
+        if (state->cq_ptr == MAP_FAILED) goto err_sq;
+    }
+    state->sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL,state->sqes_len,PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE,state->ringfd,
+                       IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) goto err_cq;
+
+    state->sq_head = (unsigned*)((char*)state->sq_ptr + p.sq_off.head);
+    state->sq_tail = (unsigned*)((char*)state->sq_ptr + p.sq_off.tail);
+    state->sq_mask = (unsigned*)((char*)state->sq_ptr + p.sq_off.ring_mask);
+    state->sq_array = (unsigned*)((char*)state->sq_ptr + p.sq_off.array);
+    state->cq_head = (unsigned*)((char*)state->cq_ptr + p.cq_off.head);
+    state->cq_tail = (unsigned*)((char*)state->cq_ptr + p.cq_off.tail);
+    state->cq_mask = (unsigned*)((char*)state->cq_ptr + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)((char*)state->cq_ptr +
+                                         p.cq_off.cqes);
+    state->sq_tail_local = *state->sq_tail;
+    return 0;
+
+err_cq:
+    if (state->cq_ptr != state->sq_ptr) munmap(state->cq_ptr,state->cq_len);
+err_sq:
+    munmap(state->sq_ptr,state->sq_len);
+err:
+    close(state->ringfd);
+    return -1;
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zmalloc(sizeof(aeApiState));
+
+    if (!state) return -1;
+    memset(state,0,sizeof(*state));
+    if (aeUringSetup(state) == -1) {
+        aeUringFellBack = 1;
+        if (aeEpollCreate(eventLoop) == -1) {
+            zfree(state);
+            return -1;
+        }
+        state->epoll = eventLoop->apidata;
+        eventLoop->apidata = state;
+        return 0;
+    }
+    aeUringFellBack = 0;
+    state->armed = zcalloc(eventLoop->setsize);
+    state->gen = zcalloc(sizeof(uint32_t)*eventLoop->setsize);
+    state->rearm = zmalloc(sizeof(int)*eventLoop->setsize);
+    eventLoop->apidata = state;
+    return 0;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    int j;
+
+    if (state->epoll) {
+        aeUringOnEpoll(eventLoop,state,aeEpollResize(eventLoop,setsize));
+        return 0;
+    }
+    state->armed = zrealloc(state->armed,setsize);
+    state->gen = zrealloc(state->gen,sizeof(uint32_t)*setsize);
+    state->rearm = zrealloc(state->rearm,sizeof(int)*setsize);
+    for (j = eventLoop->setsize; j < setsize; j++) {
+        state->armed[j] = AE_NONE;
+        state->gen[j] = 0;
+    }
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (state->epoll) {
+        eventLoop->apidata = state->epoll;
+        aeEpollFree(eventLoop);
+        zfree(state);
+        return;
+    }
+    munmap(state->sqes,state->sqes_len);
+    if (state->cq_ptr != state->sq_ptr) munmap(state->cq_ptr,state->cq_len);
+    munmap(state->sq_ptr,state->sq_len);
+    close(state->ringfd);
+    zfree(state->armed);
+    zfree(state->gen);
+    zfree(state->rearm);
+    zfree(state);
+}
+
+/* Hand the queued requests to the kernel and, if 'wait', wait for at least
+ * one completion. */
+static int aeUringEnter(aeApiState *state, unsigned wait) {
+    unsigned tosubmit;
+
+    __atomic_store_n(state->sq_tail,state->sq_tail_local,__ATOMIC_RELEASE);
+    tosubmit = state->sq_tail_local -
+               __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+    return syscall(__NR_io_uring_enter,state->ringfd,tosubmit,wait,
+                   wait ? IORING_ENTER_GETEVENTS : 0,NULL,0);
+}
+
+/* A free submission entry, NULL if the queue is full and can't be
+ * submitted. */
+static struct io_uring_sqe *aeUringGetSqe(aeApiState *state) {
+    unsigned head = __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+    unsigned idx;
+    struct io_uring_sqe *sqe;
+
+    if (state->sq_tail_local - head >= state->entries) {
+        aeUringEnter(state,0);
+        head = __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+        if (state->sq_tail_local - head >= state->entries) return NULL;
+    }
+    idx = state->sq_tail_local & *state->sq_mask;
+    sqe = &state->sqes[idx];
+    memset(sqe,0,sizeof(*sqe));
+    state->sq_array[idx] = idx;
+    state->sq_tail_local++;
+    return sqe;
+}
+
+/* Make the poll pending on 'fd' the one of 'mask': remove the old poll if
+ * any, then queue the new one. */
+static int aeUringArm(aeApiState *state, int fd, int mask) {
+    struct io_uring_sqe *sqe;
+
+    if (state->armed[fd] == mask) return 0;
+    if (state->armed[fd] != AE_NONE) {
+        if ((sqe = aeUringGetSqe(state)) == NULL) return -1;
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = AE_URING_DATA(AE_URING_POLL,fd,state->gen[fd]);
+        sqe->user_data = AE_URING_DATA(AE_URING_REMOVE,fd,0);
+        state->armed[fd] = AE_NONE;
+    }
+    state->gen[fd]++;
+    if (mask != AE_NONE) {
+        if ((sqe = aeUringGetSqe(state)) == NULL) return -1;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        if (mask & AE_READABLE) sqe->poll_events |= POLLIN;
+        if (mask & AE_WRITABLE) sqe->poll_events |= POLLOUT;
+        sqe->user_data = AE_URING_DATA(AE_URING_POLL,fd,state->gen[fd]);
+        state->armed[fd] = mask;
+    }
+    return 0;
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+    int retval;
+
+    if (state->epoll) {
+        aeUringOnEpoll(eventLoop,state,
+            retval = aeEpollAddEvent(eventLoop,fd,mask));
+        return retval;
+    }
+    return aeUringArm(state,fd,eventLoop->events[fd].mask | mask);
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+    int mask = eventLoop->events[fd].mask & (~delmask), armed;
+
+    if (state->epoll) {
+        aeUringOnEpoll(eventLoop,state,aeEpollDelEvent(eventLoop,fd,delmask));
+        return;
+    }
+    armed = state->armed[fd];
+    aeUringArm(state,fd,mask);
+
+    /* A pending poll holds a reference on the file: the fd is usually
+     * closed next, so remove the poll now, as epoll_ctl() would, for the
+     * peer to see the socket closed. */
+    if (mask == AE_NONE && armed != AE_NONE) aeUringEnter(state,0);
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    aeUringTimespec ts;
+    struct io_uring_sqe *sqe;
+    unsigned head, tail, wait = 1;
+    int j, numevents = 0;
+
+    if (state->epoll) {
+        aeUringOnEpoll(eventLoop,state,
+            numevents = aeEpollPoll(eventLoop,tvp));
+        return numevents;
+    }
+
+    /* Poll again the fds whose poll completed in the previous call. */
+    for (j = 0; j < state->nrearm; j++) {
+        int fd = state->rearm[j];
+
+        if (aeUringArm(state,fd,eventLoop->events[fd].mask) == -1) break;
+    }
+    memmove(state->rearm,state->rearm+j,sizeof(int)*(state->nrearm-j));
+    state->nrearm -= j;
+
+    if (tvp && tvp->tv_sec == 0 && tvp->tv_usec == 0) {
+        wait = 0;
+    } else if (tvp) {
+        /* Completes after the timeout, or with the first event. */
+        if ((sqe = aeUringGetSqe(state)) == NULL) {
+            wait = 0;
+        } else {
+            ts.tv_sec = tvp->tv_sec;
+            ts.tv_nsec = tvp->tv_usec*1000;
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t)(uintptr_t)&ts;
+            sqe->len = 1;
+            sqe->off = 1;
+            sqe->user_data = AE_URING_DATA(AE_URING_TIMEOUT,0,0);
+        }
+    }
+    aeUringEnter(state,wait);
+
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE);
+    while(head != tail && numevents < eventLoop->setsize) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+        uint64_t data = cqe->user_data;
+        int fd = AE_URING_FD(data), mask = 0;
+
+        head++;
+        /* Skip the completions of removes and timeouts, and of the polls
+         * that were replaced since they were queued. */
+        if (AE_URING_KIND(data) != AE_URING_POLL ||
+            AE_URING_GEN(data) != (state->gen[fd] & AE_URING_GEN_MASK))
+            continue;
+
+        /* A poll that failed reports the events it waited for, so that
+         * the handlers find the error. */
+        if (cqe->res < 0) {
+            mask = state->armed[fd];
+        } else {
+            if (cqe->res & POLLIN) mask |= AE_READABLE;
+            if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+            if (cqe->res & POLLERR) mask |= AE_WRITABLE;
+            if (cqe->res & POLLHUP) mask |= AE_WRITABLE;
+        }
+        state->armed[fd] = AE_NONE;
+        state->rearm[state->nrearm++] = fd;
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    __atomic_store_n(state->cq_head,head,__ATOMIC_RELEASE);
+    return numevents;
+}
+
+static char *aeApiName(void) {
+    return aeUringFellBack ? aeEpollName() : "io_uring";
+}
@@ -30,6 +30,7 @@
 #include "server.h"
 #include "bio.h"
 #include "rio.h"
+#include "atomicvar.h"
 
 #include <signal.h>
 #include <fcntl.h>
@@ -41,156 +42,317 @@
 #include <sys/param.h>
 
 void aofUpdateCurrentSize(void);
-void aofClosePipes(void);
+ssize_t aofWrite(int fd, const char *buf, size_t len);
 
 /* ----------------------------------------------------------------------------
- * AOF rewrite buffer implementation.
+ * Multi part AOF
  *
- * The following code implement a simple buffer used in order to accumulate
- * changes while the background process is rewriting the AOF file.
+ * The AOF is a base file plus incremental files, listed in a manifest,
+ * "<appendfilename>.manifest":
  *
- * We only need to append, but can't just use realloc with a large block
- * because 'huge' reallocs are not always handled as one could expect
- * (via remapping of pages at OS level) but may involve copying data.
+ *   seq 7
+ *   base appendonly.aof.5.base.rdb
+ *   incr appendonly.aof.6.incr.aof
+ *   incr appendonly.aof.7.incr.aof
  *
- * For this reason we use a list of blocks, every block is
- * AOF_RW_BUF_BLOCK_SIZE bytes.
+ * When a rewrite starts, the parent switches its writes to a new incremental
+ * file, so that the files before it hold exactly the dataset the child
+ * snapshots. The child writes a new base, and the rewrite is done when the
+ * manifest lists it with the incremental file opened at its start: the old
+ * files are deleted then. No parent to child diff is needed, and the
+ * writes during the rewrite go to disk once.
+ *
+ * A server without a manifest has the single AOF file of the previous
+ * versions, written until the first rewrite makes it the base of a
+ * manifest.
  * ------------------------------------------------------------------------- */
 
-#define AOF_RW_BUF_BLOCK_SIZE (1024*1024*10)    /* 10 MB per block */
-
-typedef struct aofrwblock {
-    unsigned long used, free;
-    char buf[AOF_RW_BUF_BLOCK_SIZE];
-} aofrwblock;
+aofManifest *aofManifestCreate(void) {
+    aofManifest *am = zmalloc(sizeof(*am));
 
-/* This function free the old AOF rewrite buffer if needed, and initialize
- * a fresh new one. It tests for server.aof_rewrite_buf_blocks equal to NULL
- * so can be used for the first initialization as well. */
-void aofRewriteBufferReset(void) {
-    if (server.aof_rewrite_buf_blocks)
-        listRelease(server.aof_rewrite_buf_blocks);
+    am->base = NULL;
+    am->incr = listCreate();
+    listSetFreeMethod(am->incr,(void (*)(void*))sdsfree);
+    am->seq = 0;
+    am->ondisk = 0;
+    return am;
+}
 
-    server.aof_rewrite_buf_blocks = listCreate();
-    listSetFreeMethod(server.aof_rewrite_buf_blocks,zfree);
+void aofManifestFree(aofManifest *am) {
+    sdsfree(am->base);
+    listRelease(am->incr);
+    zfree(am);
 }
 
-/* Return the current size of the AOF rewrite buffer. */
-unsigned long aofRewriteBufferSize(void) {
+aofManifest *aofManifestDup(aofManifest *am) {
+    aofManifest *dup = aofManifestCreate();
     listNode *ln;
     listIter li;
-    unsigned long size = 0;
 
-    listRewind(server.aof_rewrite_buf_blocks,&li);
-    while((ln = listNext(&li))) {
-        aofrwblock *block = listNodeValue(ln);
-        size += block->used;
-    }
-    return size;
+    dup->base = am->base ? sdsdup(am->base) : NULL;
+    listRewind(am->incr,&li);
+    while((ln = listNext(&li)))
+        listAddNodeTail(dup->incr,sdsdup(listNodeValue(ln)));
+    dup->seq = am->seq;
+    dup->ondisk = am->ondisk;
+    return dup;
 }
 
-/* Event handler used to send data to the child process doing the AOF
- * rewrite. We send pieces of our AOF differences buffer so that the final
- * write when the child finishes the rewrite will be small. */
-void aofChildWriteDiffData(aeEventLoop *el, int fd, void *privdata, int mask) {
-    listNode *ln;
-    aofrwblock *block;
-    ssize_t nwritten;
-    UNUSED(el);
-    UNUSED(fd);
-    UNUSED(privdata);
-    UNUSED(mask);
+static sds aofManifestFileName(void) {
+    return sdscatfmt(sdsempty(),"%s.manifest",server.aof_filename);
+}
 
-    while(1) {
-        ln = listFirst(server.aof_rewrite_buf_blocks);
-        block = ln ? ln->value : NULL;
-        if (server.aof_stop_sending_diff || !block) {
-            aeDeleteFileEvent(server.el,server.aof_pipe_write_data_to_child,
-                              AE_WRITABLE);
-            return;
+/* The incremental file written while the AOF waits for its first rewrite:
+ * the manifest gets it, under its final name, with the new base. */
+static sds aofTempIncrFileName(void) {
+    return sdscatfmt(sdsempty(),"temp-%s.incr",server.aof_filename);
+}
+
+static sds aofBaseFileName(long long seq) {
+    return sdscatfmt(sdsempty(),"%s.%I.base.%s",server.aof_filename,seq,
+        server.aof_use_rdb_preamble ? "rdb" : "aof");
+}
+
+static sds aofIncrFileName(long long seq) {
+    return sdscatfmt(sdsempty(),"%s.%I.incr.aof",server.aof_filename,seq);
+}
+
+/* Load the manifest into server.aof_manifest. Without one, the AOF is the
+ * single appendfilename. A manifest that can't be read or parsed is a
+ * fatal error, as it is for the AOF itself. */
+void aofLoadManifestFromDisk(void) {
+    aofManifest *am = aofManifestCreate();
+    sds name = aofManifestFileName(), line;
+    char buf[1024];
+    int linenum = 0;
+    FILE *fp;
+
+    if ((fp = fopen(name,"r")) == NULL) {
+        if (errno != ENOENT) {
+            serverLog(LL_WARNING,"Fatal error: can't open the AOF manifest %s "
+                "for reading: %s",name,strerror(errno));
+            exit(1);
+        }
+        am->base = sdsnew(server.aof_filename);
+        goto done;
+    }
+
+    while(fgets(buf,sizeof(buf),fp) != NULL) {
+        sds *argv;
+        int argc;
+
+        linenum++;
+        line = sdstrim(sdsnew(buf)," \t\r\n");
+        if (line[0] == '#' || line[0] == '\0') {
+            sdsfree(line);
+            continue;
+        }
+        argv = sdssplitargs(line,&argc);
+        sdsfree(line);
+        if (argv == NULL || argc != 2) {
+            if (argv) sdsfreesplitres(argv,argc);
+            goto fmterr;
         }
-        if (block->used > 0) {
-            nwritten = write(server.aof_pipe_write_data_to_child,
-                             block->buf,block->used);
-            if (nwritten <= 0) return;
-            memmove(block->buf,block->buf+nwritten,block->used-nwritten);
-            block->used -= nwritten;
-            block->free += nwritten;
+        if (!strcasecmp(argv[0],"seq")) {
+            am->seq = strtoll(argv[1],NULL,10);
+        } else if (!strcasecmp(argv[0],"base") && am->base == NULL) {
+            am->base = sdsdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"incr")) {
+            listAddNodeTail(am->incr,sdsdup(argv[1]));
+        } else {
+            sdsfreesplitres(argv,argc);
+            goto fmterr;
         }
-        if (block->used == 0) listDelNode(server.aof_rewrite_buf_blocks,ln);
+        sdsfreesplitres(argv,argc);
     }
+    if (ferror(fp)) {
+        serverLog(LL_WARNING,"Fatal error: can't read the AOF manifest %s: %s",
+            name,strerror(errno));
+        exit(1);
+    }
+    fclose(fp);
+    am->ondisk = 1;
+
+done:
+    sdsfree(name);
+    if (server.aof_manifest) aofManifestFree(server.aof_manifest);
+    server.aof_manifest = am;
+    return;
+
+fmterr:
+    serverLog(LL_WARNING,"Fatal error: bad AOF manifest %s at line %d",
+        name,linenum);
+    exit(1);
 }
 
-/* Append data to the AOF rewrite buffer, allocating new blocks if needed. */
-void aofRewriteBufferAppend(unsigned char *s, unsigned long len) {
-    listNode *ln = listLast(server.aof_rewrite_buf_blocks);
-    aofrwblock *block = ln ? ln->value : NULL;
+/* Write the manifest with a temp file, renamed over the old one once it is
+ * on disk. */
+int aofManifestPersist(aofManifest *am) {
+    sds name = aofManifestFileName(), tmpname, buf;
+    listNode *ln;
+    listIter li;
+    int fd = -1;
+
+    tmpname = sdscatfmt(sdsempty(),"temp-%S",name);
+    buf = sdscatfmt(sdsempty(),"# Redis multi part AOF manifest\nseq %I\n",
+        am->seq);
+    if (am->base) {
+        buf = sdscat(buf,"base ");
+        buf = sdscatrepr(buf,am->base,sdslen(am->base));
+        buf = sdscat(buf,"\n");
+    }
+    listRewind(am->incr,&li);
+    while((ln = listNext(&li))) {
+        sds incr = listNodeValue(ln);
 
-    while(len) {
-        /* If we already got at least an allocated block, try appending
-         * at least some piece into it. */
-        if (block) {
-            unsigned long thislen = (block->free < len) ? block->free : len;
-            if (thislen) {  /* The current block is not already full. */
-                memcpy(block->buf+block->used, s, thislen);
-                block->used += thislen;
-                block->free -= thislen;
-                s += thislen;
-                len -= thislen;
-            }
-        }
+        buf = sdscat(buf,"incr ");
+        buf = sdscatrepr(buf,incr,sdslen(incr));
+        buf = sdscat(buf,"\n");
+    }
 
-        if (len) { /* First block to allocate, or need another block. */
-            int numblocks;
-
-            block = zmalloc(sizeof(*block));
-            block->free = AOF_RW_BUF_BLOCK_SIZE;
-            block->used = 0;
-            listAddNodeTail(server.aof_rewrite_buf_blocks,block);
-
-            /* Log every time we cross more 10 or 100 blocks, respectively
-             * as a notice or warning. */
-            numblocks = listLength(server.aof_rewrite_buf_blocks);
-            if (((numblocks+1) % 10) == 0) {
-                int level = ((numblocks+1) % 100) == 0 ? LL_WARNING :
-                                                         LL_NOTICE;
-                serverLog(level,"Background AOF buffer size: %lu MB",
-                    aofRewriteBufferSize()/(1024*1024));
-            }
+    if ((fd = open(tmpname,O_WRONLY|O_CREAT|O_TRUNC,0644)) == -1 ||
+        aofWrite(fd,buf,sdslen(buf)) != (ssize_t)sdslen(buf) ||
+        redis_fsync(fd) == -1 ||
+        rename(tmpname,name) == -1)
+    {
+        serverLog(LL_WARNING,"Error writing the AOF manifest %s: %s",
+            name,strerror(errno));
+        if (fd != -1) {
+            close(fd);
+            unlink(tmpname);
         }
+        sdsfree(buf);
+        sdsfree(tmpname);
+        sdsfree(name);
+        return C_ERR;
     }
+    close(fd);
+    am->ondisk = 1;
+    sdsfree(buf);
+    sdsfree(tmpname);
+    sdsfree(name);
+    return C_OK;
+}
+
+/* Fsync and close an AOF file no longer written, in the bio thread of the
+ * AOF fsyncs: after the fsyncs still pending on it, that also release the
+ * clients waiting for a group commit of its writes. */
+static void aofCloseInBackground(int fd) {
+    bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)fd,
+        (void*)(long)server.aof_write_id,(void*)1);
+    server.aof_fsync_submitted_id = server.aof_write_id;
+}
+
+/* Unlink a file of an old manifest. The unlink of a large file may block,
+ * so we hold it open and leave the last close(2) to a bio thread. */
+static void aofDeleteInBackground(sds name) {
+    int fd = open(name,O_RDONLY|O_NONBLOCK);
 
-    /* Install a file event to send data to the rewrite child if there is
-     * not one already. */
-    if (aeGetFileEvents(server.el,server.aof_pipe_write_data_to_child) == 0) {
-        aeCreateFileEvent(server.el, server.aof_pipe_write_data_to_child,
-            AE_WRITABLE, aofChildWriteDiffData, NULL);
+    if (unlink(name) == -1) {
+        if (errno != ENOENT)
+            serverLog(LL_WARNING,"Can't remove the old AOF file %s: %s",
+                name,strerror(errno));
+    } else {
+        serverLog(LL_VERBOSE,"Removed the old AOF file %s",name);
     }
+    if (fd != -1) bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)fd,NULL,NULL);
 }
 
-/* Write the buffer (possibly composed of multiple blocks) into the specified
- * fd. If a short write or any other error happens -1 is returned,
- * otherwise the number of bytes written is returned. */
-ssize_t aofRewriteBufferWrite(int fd) {
-    listNode *ln;
-    listIter li;
-    ssize_t count = 0;
+static int aofOpenFailed(char *name) {
+    char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
+    char *cwdp = getcwd(cwd,MAXPATHLEN);
 
-    listRewind(server.aof_rewrite_buf_blocks,&li);
-    while((ln = listNext(&li))) {
-        aofrwblock *block = listNodeValue(ln);
-        ssize_t nwritten;
-
-        if (block->used) {
-            nwritten = write(fd,block->buf,block->used);
-            if (nwritten != (ssize_t)block->used) {
-                if (nwritten == 0) errno = EIO;
-                return -1;
-            }
-            count += nwritten;
+    serverLog(LL_WARNING,
+        "Can't open the append only file %s (in server root dir %s): %s",
+        name,cwdp ? cwdp : "unknown",strerror(errno));
+    return C_ERR;
+}
+
+/* Called by rewriteAppendOnlyFileBackground() just before the fork: switch
+ * the AOF writes to a new incremental file, added to the manifest. While
+ * waiting for the first rewrite the file is the temp one instead, truncated
+ * by every attempt: the writes before the fork are in the snapshot. */
+static int aofOpenNewIncr(void) {
+    aofManifest *am;
+    sds name;
+    int fd;
+
+    if (server.aof_state == AOF_OFF) return C_OK;
+
+    if (server.aof_state == AOF_WAIT_REWRITE) {
+        name = aofTempIncrFileName();
+        fd = open(name,O_WRONLY|O_APPEND|O_CREAT|O_TRUNC,0644);
+        if (fd == -1) {
+            aofOpenFailed(name);
+            sdsfree(name);
+            return C_ERR;
         }
+        sdsfree(name);
+        sdsclear(server.aof_buf);
+        if (server.aof_fd != -1) aofCloseInBackground(server.aof_fd);
+        server.aof_fd = fd;
+        server.aof_current_size = 0;
+        server.aof_fsync_offset = 0;
+        server.aof_selected_db = -1;
+        return C_OK;
+    }
+
+    am = aofManifestDup(server.aof_manifest);
+    name = aofIncrFileName(++am->seq);
+    fd = open(name,O_WRONLY|O_APPEND|O_CREAT|O_TRUNC,0644);
+    if (fd == -1) {
+        aofOpenFailed(name);
+        sdsfree(name);
+        aofManifestFree(am);
+        return C_ERR;
+    }
+    listAddNodeTail(am->incr,name);
+    if (aofManifestPersist(am) == C_ERR) {
+        close(fd);
+        unlink(name);
+        aofManifestFree(am);
+        return C_ERR;
+    }
+    aofManifestFree(server.aof_manifest);
+    server.aof_manifest = am;
+
+    /* What was fed so far goes to the old file. */
+    flushAppendOnlyFile(1);
+    aofCloseInBackground(server.aof_fd);
+    server.aof_fd = fd;
+    server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
+    serverLog(LL_NOTICE,"Appending to the new AOF file %s",name);
+    return C_OK;
+}
+
+/* Open the AOF at startup: the last incremental file of the manifest, a new
+ * one if there are none, or the single file without a manifest. */
+void aofOpenOnServerStart(void) {
+    aofManifest *am;
+    sds name;
+
+    aofLoadManifestFromDisk();
+    if (server.aof_state != AOF_ON) return;
+
+    am = server.aof_manifest;
+    if (!am->ondisk) {
+        name = sdsnew(server.aof_filename);
+    } else if (listLength(am->incr)) {
+        name = sdsdup(listNodeValue(listLast(am->incr)));
+    } else {
+        am = aofManifestDup(am);
+        name = aofIncrFileName(++am->seq);
+        listAddNodeTail(am->incr,sdsdup(name));
+        if (aofManifestPersist(am) == C_ERR) exit(1);
+        aofManifestFree(server.aof_manifest);
+        server.aof_manifest = am;
     }
-    return count;
+    server.aof_fd = open(name,O_WRONLY|O_APPEND|O_CREAT,0644);
+    if (server.aof_fd == -1) {
+        aofOpenFailed(name);
+        exit(1);
+    }
+    sdsfree(name);
 }
 
 /* ----------------------------------------------------------------------------
@@ -209,6 +371,121 @@ void aof_background_fsync(int fd) {
     bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)fd,NULL,NULL);
 }
 
+/* ----------------------------------------------------------------------------
+ * Group commit (aof-group-commit)
+ * ------------------------------------------------------------------------- */
+
+/* With "appendfsync always" and aof-group-commit enabled, the AOF buffer is
+ * written as usual before re-entering the event loop, but the fsync is done
+ * by the bio thread instead of inline. The clients whose commands were
+ * written keep their replies in the output buffers until an fsync that
+ * covers the write is done: all the writes done while an fsync runs are
+ * covered by the next one, so a single fsync releases the replies of many
+ * event loop iterations.
+ *
+ * The writes are identified by server.aof_write_id, incremented for every
+ * write of the AOF buffer. A client waits for the write of its command,
+ * that is the next one, in c->aof_fsync_id. */
+
+/* Are replies held until the fsync of their writes? When not, the clients
+ * waiting are released, and rely on whatever fsync policy is in place. */
+static int aofGroupCommitActive(void) {
+    return server.aof_state == AOF_ON &&
+           server.aof_fsync == AOF_FSYNC_ALWAYS &&
+           server.aof_group_commit &&
+           !(server.aof_no_fsync_on_rewrite &&
+             (server.aof_child_pid != -1 || rdbBgsaveInProgress()));
+}
+
+/* Ask the bio thread to fsync the writes done so far, unless an fsync is
+ * already in progress: the next one will cover them. */
+static void aofGroupCommitFsync(void) {
+    if (server.aof_fsync_submitted_id == server.aof_write_id ||
+        aofFsyncInProgress()) return;
+    bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)server.aof_fd,
+        (void*)(long)server.aof_write_id,NULL);
+    server.aof_fsync_submitted_id = server.aof_write_id;
+    server.aof_fsync_offset = server.aof_current_size;
+    server.aof_last_fsync = server.unixtime;
+}
+
+/* Everything written so far is on disk, fsynced by the caller. */
+static void aofGroupCommitSynced(void) {
+    server.aof_fsynced_id = server.aof_write_id;
+}
+
+/* Called when the command of the current client 'c' is fed to the AOF
+ * buffer: hold its replies until the next write is fsynced. */
+void aofGroupCommitWait(client *c) {
+    if (c == NULL || c->fd == -1 || c->flags & CLIENT_MASTER ||
+        !aofGroupCommitActive()) return;
+    if (c->aof_fsync_id == 0) {
+        listAddNodeTail(server.clients_waiting_fsync,c);
+        /* The write handler of a client with a large reply must not send
+         * the new replies, processClientsWaitingAofFsync() installs it
+         * again. */
+        if (aeGetFileEvents(server.el,c->fd) & AE_WRITABLE)
+            aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+    }
+    c->aof_fsync_id = server.aof_write_id+1;
+}
+
+/* Called by the bio thread when the fsync of the write 'id' is done. */
+void aofFsyncDoneFromBioThread(long long id) {
+    atomicSet(server.aof_bio_fsynced_id,id);
+    if (write(server.aof_fsync_pipe[1],"A",1) != 1) {
+        /* Ignore the error: the pipe is full only if the event loop was
+         * already awakened. */
+    }
+}
+
+/* Readable handler for the awake pipe. The bytes are read where the clients
+ * are actually released, in processClientsWaitingAofFsync(). */
+void aofFsyncPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask) {
+    UNUSED(el);
+    UNUSED(fd);
+    UNUSED(privdata);
+    UNUSED(mask);
+}
+
+/* Called from beforeSleep() after the AOF buffer is written: release the
+ * replies of the clients whose writes are on disk, start the next fsync,
+ * and keep the replies of the others out of the pending writes. */
+void processClientsWaitingAofFsync(void) {
+    long long fsynced;
+    listIter li;
+    listNode *ln;
+    char buf[64];
+    int active = aofGroupCommitActive();
+
+    while (read(server.aof_fsync_pipe[0],buf,sizeof(buf)) > 0);
+    if (listLength(server.clients_waiting_fsync) == 0) return;
+
+    atomicGet(server.aof_bio_fsynced_id,fsynced);
+    if (fsynced > server.aof_fsynced_id) server.aof_fsynced_id = fsynced;
+    if (active) aofGroupCommitFsync();
+
+    listRewind(server.clients_waiting_fsync,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        if (active && c->aof_fsync_id > server.aof_fsynced_id) continue;
+        c->aof_fsync_id = 0;
+        listDelNode(server.clients_waiting_fsync,ln);
+        if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+    }
+
+    if (listLength(server.clients_waiting_fsync) == 0) return;
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        if (c->aof_fsync_id == 0) continue;
+        c->flags &= ~CLIENT_PENDING_WRITE;
+        listDelNode(server.clients_pending_write,ln);
+    }
+}
+
 /* Kills an AOFRW child process if exists */
 void killAppendOnlyChild(void) {
     int statloc;
@@ -220,13 +497,9 @@ void killAppendOnlyChild(void) {
     if (kill(server.aof_child_pid,SIGUSR1) != -1) {
         while(wait3(&statloc,0,NULL) != server.aof_child_pid);
     }
-    /* Reset the buffer accumulating changes while the child saves. */
-    aofRewriteBufferReset();
     aofRemoveTempFile(server.aof_child_pid);
     server.aof_child_pid = -1;
     server.aof_rewrite_time_start = -1;
-    /* Close pipes used for IPC between the two processes. */
-    aofClosePipes();
     closeChildInfoPipe();
     updateDictResizePolicy();
 }
@@ -235,9 +508,17 @@ void killAppendOnlyChild(void) {
  * at runtime using the CONFIG command. */
 void stopAppendOnly(void) {
     serverAssert(server.aof_state != AOF_OFF);
-    flushAppendOnlyFile(1);
-    redis_fsync(server.aof_fd);
-    close(server.aof_fd);
+    if (server.aof_fd != -1) {
+        flushAppendOnlyFile(1);
+        redis_fsync(server.aof_fd);
+        close(server.aof_fd);
+    }
+    if (server.aof_state == AOF_WAIT_REWRITE) {
+        /* Not in the manifest yet. */
+        sds name = aofTempIncrFileName();
+        unlink(name);
+        sdsfree(name);
+    }
 
     server.aof_fd = -1;
     server.aof_selected_db = -1;
@@ -248,44 +529,28 @@ void stopAppendOnly(void) {
 /* Called when the user switches from "appendonly no" to "appendonly yes"
  * at runtime using the CONFIG command. */
 int startAppendOnly(void) {
-    char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
-    int newfd;
-
-    newfd = open(server.aof_filename,O_WRONLY|O_APPEND|O_CREAT,0644);
     serverAssert(server.aof_state == AOF_OFF);
-    if (newfd == -1) {
-        char *cwdp = getcwd(cwd,MAXPATHLEN);
-
-        serverLog(LL_WARNING,
-            "Redis needs to enable the AOF but can't open the "
-            "append only file %s (in server root dir %s): %s",
-            server.aof_filename,
-            cwdp ? cwdp : "unknown",
-            strerror(errno));
-        return C_ERR;
-    }
-    if (server.rdb_child_pid != -1) {
+    /* The AOF is written, to a temp incremental file, from the start of the
+     * rewrite that makes its base. */
+    server.aof_state = AOF_WAIT_REWRITE;
+    if (rdbBgsaveInProgress()) {
         server.aof_rewrite_scheduled = 1;
         serverLog(LL_WARNING,"AOF was enabled but there is already a child process saving an RDB file on disk. An AOF background was scheduled to start when possible.");
     } else {
         /* If there is a pending AOF rewrite, we need to switch it off and
          * start a new one: the old one cannot be reused because it is not
-         * accumulating the AOF buffer. */
+         * followed by an incremental file. */
         if (server.aof_child_pid != -1) {
             serverLog(LL_WARNING,"AOF was enabled but there is already an AOF rewriting in background. Stopping background AOF and starting a rewrite now.");
             killAppendOnlyChild();
         }
         if (rewriteAppendOnlyFileBackground() == C_ERR) {
-            close(newfd);
+            server.aof_state = AOF_OFF;
             serverLog(LL_WARNING,"Redis needs to enable the AOF but can't trigger a background AOF rewrite operation. Check the above logs for more info about the error.");
             return C_ERR;
         }
     }
-    /* We correctly switched on AOF, now wait for the rewrite to be complete
-     * in order to append data on disk. */
-    server.aof_state = AOF_WAIT_REWRITE;
     server.aof_last_fsync = server.unixtime;
-    server.aof_fd = newfd;
     return C_OK;
 }
 
@@ -397,7 +662,7 @@ void flushAppendOnlyFile(int force) {
      * useful for graphing / monitoring purposes. */
     if (sync_in_progress) {
         latencyAddSampleIfNeeded("aof-write-pending-fsync",latency);
-    } else if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) {
+    } else if (server.aof_child_pid != -1 || rdbBgsaveInProgress()) {
         latencyAddSampleIfNeeded("aof-write-active-child",latency);
     } else {
         latencyAddSampleIfNeeded("aof-write-alone",latency);
@@ -480,6 +745,7 @@ void flushAppendOnlyFile(int force) {
         }
     }
     server.aof_current_size += nwritten;
+    server.aof_write_id++;
 
     /* Re-use AOF buffer when it is small enough. The maximum comes from the
      * arena size of 4k minus some overhead (but is otherwise arbitrary). */
@@ -494,11 +760,15 @@ try_fsync:
     /* Don't fsync if no-appendfsync-on-rewrite is set to yes and there are
      * children doing I/O in the background. */
     if (server.aof_no_fsync_on_rewrite &&
-        (server.aof_child_pid != -1 || server.rdb_child_pid != -1))
+        (server.aof_child_pid != -1 || rdbBgsaveInProgress()))
             return;
 
     /* Perform the fsync if needed. */
-    if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
+    if (server.aof_fsync == AOF_FSYNC_ALWAYS && server.aof_group_commit) {
+        /* The replies wait for the fsync in the background, see
+         * processClientsWaitingAofFsync(). */
+        aofGroupCommitFsync();
+    } else if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
         /* redis_fsync is defined as fdatasync() for Linux in order to avoid
          * flushing metadata. */
         latencyStartMonitor(latency);
@@ -507,6 +777,7 @@ try_fsync:
         latencyAddSampleIfNeeded("aof-fsync-always",latency);
         server.aof_fsync_offset = server.aof_current_size;
         server.aof_last_fsync = server.unixtime;
+        aofGroupCommitSynced();
     } else if ((server.aof_fsync == AOF_FSYNC_EVERYSEC &&
                 server.unixtime > server.aof_last_fsync)) {
         if (!sync_in_progress) {
@@ -631,16 +902,14 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
 
     /* Append to the AOF buffer. This will be flushed on disk just before
      * of re-entering the event loop, so before the client will get a
-     * positive reply about the operation performed. */
-    if (server.aof_state == AOF_ON)
+     * positive reply about the operation performed. While waiting for the
+     * first rewrite, only what follows the fork of its child is needed. */
+    if (server.aof_state == AOF_ON ||
+        (server.aof_state == AOF_WAIT_REWRITE && server.aof_child_pid != -1))
+    {
         server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
-
-    /* If a background append only file rewriting is in progress we want to
-     * accumulate the differences between the child DB and the current one
-     * in a buffer, so that when the child process will do its work we
-     * can append the differences to the new append only file. */
-    if (server.aof_child_pid != -1)
-        aofRewriteBufferAppend((unsigned char*)buf,sdslen(buf));
+        if (server.aof_group_commit) aofGroupCommitWait(server.current_client);
+    }
 
     sdsfree(buf);
 }
@@ -661,6 +930,7 @@ struct client *createFakeClient(void) {
     c->querybuf_peak = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->buf = NULL;
     c->bufpos = 0;
     c->flags = 0;
     c->btype = BLOCKED_NONE;
@@ -691,15 +961,17 @@ void freeFakeClientArgv(struct client *c) {
 void freeFakeClient(struct client *c) {
     sdsfree(c->querybuf);
     listRelease(c->reply);
+    releaseClientReplyBuffer(c);
     listRelease(c->watched_keys);
     freeClientMultiState(c);
     zfree(c);
 }
 
-/* Replay the append log file. On success C_OK is returned. On non fatal
+/* Replay one append log file. On success C_OK is returned. On non fatal
  * error (the append only file is zero-length) C_ERR is returned. On
- * fatal error an error message is logged and the program exists. */
-int loadAppendOnlyFile(char *filename) {
+ * fatal error an error message is logged and the program exists. Only the
+ * 'last' file of an AOF may be truncated by aof-load-truncated. */
+static int loadSingleAppendOnlyFile(char *filename, int last) {
     struct client *fakeClient;
     FILE *fp = fopen(filename,"r");
     struct redis_stat sb;
@@ -709,7 +981,7 @@ int loadAppendOnlyFile(char *filename) {
     off_t valid_before_multi = 0; /* Offset before MULTI command loaded. */
 
     if (fp == NULL) {
-        serverLog(LL_WARNING,"Fatal error: can't open the append log file for reading: %s",strerror(errno));
+        serverLog(LL_WARNING,"Fatal error: can't open the append log file %s for reading: %s",filename,strerror(errno));
         exit(1);
     }
 
@@ -718,8 +990,6 @@ int loadAppendOnlyFile(char *filename) {
      * a zero length file at startup, that will remain like that if no write
      * operation is received. */
     if (fp && redis_fstat(fileno(fp),&sb) != -1 && sb.st_size == 0) {
-        server.aof_current_size = 0;
-        server.aof_fsync_offset = server.aof_current_size;
         fclose(fp);
         return C_ERR;
     }
@@ -856,9 +1126,6 @@ loaded_ok: /* DB loaded, cleanup and return C_OK to the caller. */
     freeFakeClient(fakeClient);
     server.aof_state = old_aof_state;
     stopLoading();
-    aofUpdateCurrentSize();
-    server.aof_rewrite_base_size = server.aof_current_size;
-    server.aof_fsync_offset = server.aof_current_size;
     return C_OK;
 
 readerr: /* Read error. If feof(fp) is true, fall through to unexpected EOF. */
@@ -869,7 +1136,7 @@ readerr: /* Read error. If feof(fp) is true, fall through to unexpected EOF. */
     }
 
 uxeof: /* Unexpected AOF end of file. */
-    if (server.aof_load_truncated) {
+    if (server.aof_load_truncated && last) {
         serverLog(LL_WARNING,"!!! Warning: short read while loading the AOF file !!!");
         serverLog(LL_WARNING,"!!! Truncating the AOF at offset %llu !!!",
             (unsigned long long) valid_up_to);
@@ -894,6 +1161,8 @@ uxeof: /* Unexpected AOF end of file. */
         }
     }
     if (fakeClient) freeFakeClient(fakeClient); /* avoid valgrind warning */
+    if (server.aof_load_truncated && !last)
+        serverLog(LL_WARNING,"The truncated AOF file %s is not the last one of the manifest, it can't be truncated.",filename);
     serverLog(LL_WARNING,"Unexpected end of file reading the append only file. You can: 1) Make a backup of your AOF file, then use ./redis-check-aof --fix <filename>. 2) Alternatively you can set the 'aof-load-truncated' configuration option to yes and restart the server.");
     exit(1);
 
@@ -903,6 +1172,32 @@ fmterr: /* Format error. */
     exit(1);
 }
 
+/* Replay the AOF: the base and incremental files of the manifest in order,
+ * or the single file without a manifest. C_ERR is returned when they are
+ * all empty, on fatal errors the program exits. */
+int loadAppendOnlyFiles(void) {
+    aofManifest *am = server.aof_manifest;
+    int loaded = 0;
+    listNode *ln;
+    listIter li;
+
+    if (!am->ondisk) {
+        loaded = loadSingleAppendOnlyFile(server.aof_filename,1) == C_OK;
+    } else {
+        if (am->base) loaded = loadSingleAppendOnlyFile(am->base,
+            listLength(am->incr) == 0) == C_OK;
+        listRewind(am->incr,&li);
+        while((ln = listNext(&li))) {
+            if (loadSingleAppendOnlyFile(listNodeValue(ln),
+                    ln == listLast(am->incr)) == C_OK) loaded = 1;
+        }
+    }
+    aofUpdateCurrentSize();
+    server.aof_rewrite_base_size = server.aof_current_size;
+    server.aof_fsync_offset = server.aof_current_size;
+    return loaded ? C_OK : C_ERR;
+}
+
 /* ----------------------------------------------------------------------------
  * AOF rewrite
  * ------------------------------------------------------------------------- */
@@ -1042,14 +1337,15 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
-    } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+               o->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = o->ptr;
         dictIterator *di = dictGetIterator(zs->dict);
         dictEntry *de;
 
         while((de = dictNext(di)) != NULL) {
             sds ele = dictGetKey(de);
-            double *score = dictGetVal(de);
+            double score = zsetDictGetScore(zs,de);
 
             if (count == 0) {
                 int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
@@ -1059,7 +1355,7 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
                 if (rioWriteBulkString(r,"ZADD",4) == 0) return 0;
                 if (rioWriteBulkObject(r,key) == 0) return 0;
             }
-            if (rioWriteBulkDouble(r,*score) == 0) return 0;
+            if (rioWriteBulkDouble(r,score) == 0) return 0;
             if (rioWriteBulkString(r,ele,sdslen(ele)) == 0) return 0;
             if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
@@ -1091,6 +1387,9 @@ static int rioWriteHashIteratorCursor(rio *r, hashTypeIterator *hi, int what) {
     } else if (hi->encoding == OBJ_ENCODING_HT) {
         sds value = hashTypeCurrentFromHashTable(hi, what);
         return rioWriteBulkString(r, value, sdslen(value));
+    } else if (hi->encoding == OBJ_ENCODING_INTMAP) {
+        return rioWriteBulkLongLong(r, (what & OBJ_HASH_KEY) ? hi->imfield :
+                                                               hi->imvalue);
     }
 
     serverPanic("Unknown hash encoding");
@@ -1275,25 +1574,9 @@ int rewriteModuleObject(rio *r, robj *key, robj *o) {
     return io.error ? 0 : 1;
 }
 
-/* This function is called by the child rewriting the AOF file to read
- * the difference accumulated from the parent into a buffer, that is
- * concatenated at the end of the rewrite. */
-ssize_t aofReadDiffFromParent(void) {
-    char buf[65536]; /* Default pipe buffer size on most Linux systems. */
-    ssize_t nread, total = 0;
-
-    while ((nread =
-            read(server.aof_pipe_read_data_from_parent,buf,sizeof(buf))) > 0) {
-        server.aof_child_diff = sdscatlen(server.aof_child_diff,buf,nread);
-        total += nread;
-    }
-    return total;
-}
-
 int rewriteAppendOnlyFileRio(rio *aof) {
     dictIterator *di = NULL;
     dictEntry *de;
-    size_t processed = 0;
     int j;
 
     for (j = 0; j < server.dbnum; j++) {
@@ -1349,11 +1632,6 @@ int rewriteAppendOnlyFileRio(rio *aof) {
                 if (rioWriteBulkObject(aof,&key) == 0) goto werr;
                 if (rioWriteBulkLongLong(aof,expiretime) == 0) goto werr;
             }
-            /* Read some diff from the parent process from time to time. */
-            if (aof->processed_bytes > processed+AOF_READ_DIFF_INTERVAL_BYTES) {
-                processed = aof->processed_bytes;
-                aofReadDiffFromParent();
-            }
         }
         dictReleaseIterator(di);
         di = NULL;
@@ -1376,7 +1654,6 @@ int rewriteAppendOnlyFile(char *filename) {
     rio aof;
     FILE *fp;
     char tmpfile[256];
-    char byte;
 
     /* Note that we have to use a different temp name here compared to the
      * one used by rewriteAppendOnlyFileBackground() function. */
@@ -1387,7 +1664,6 @@ int rewriteAppendOnlyFile(char *filename) {
         return C_ERR;
     }
 
-    server.aof_child_diff = sdsempty();
     rioInitWithFile(&aof,fp);
 
     if (server.aof_rewrite_incremental_fsync)
@@ -1403,51 +1679,6 @@ int rewriteAppendOnlyFile(char *filename) {
         if (rewriteAppendOnlyFileRio(&aof) == C_ERR) goto werr;
     }
 
-    /* Do an initial slow fsync here while the parent is still sending
-     * data, in order to make the next final fsync faster. */
-    if (fflush(fp) == EOF) goto werr;
-    if (fsync(fileno(fp)) == -1) goto werr;
-
-    /* Read again a few times to get more data from the parent.
-     * We can't read forever (the server may receive data from clients
-     * faster than it is able to send data to the child), so we try to read
-     * some more data in a loop as soon as there is a good chance more data
-     * will come. If it looks like we are wasting time, we abort (this
-     * happens after 20 ms without new data). */
-    int nodata = 0;
-    mstime_t start = mstime();
-    while(mstime()-start < 1000 && nodata < 20) {
-        if (aeWait(server.aof_pipe_read_data_from_parent, AE_READABLE, 1) <= 0)
-        {
-            nodata++;
-            continue;
-        }
-        nodata = 0; /* Start counting from zero, we stop on N *contiguous*
-                       timeouts. */
-        aofReadDiffFromParent();
-    }
-
-    /* Ask the master to stop sending diffs. */
-    if (write(server.aof_pipe_write_ack_to_parent,"!",1) != 1) goto werr;
-    if (anetNonBlock(NULL,server.aof_pipe_read_ack_from_parent) != ANET_OK)
-        goto werr;
-    /* We read the ACK from the server using a 10 seconds timeout. Normally
-     * it should reply ASAP, but just in case we lose its reply, we are sure
-     * the child will eventually get terminated. */
-    if (syncRead(server.aof_pipe_read_ack_from_parent,&byte,1,5000) != 1 ||
-        byte != '!') goto werr;
-    serverLog(LL_NOTICE,"Parent agreed to stop sending diffs. Finalizing AOF...");
-
-    /* Read the final diff if any. */
-    aofReadDiffFromParent();
-
-    /* Write the received diff to the file. */
-    serverLog(LL_NOTICE,
-        "Concatenating %.2f MB of AOF diff received from parent.",
-        (double) sdslen(server.aof_child_diff) / (1024*1024));
-    if (rioWrite(&aof,server.aof_child_diff,sdslen(server.aof_child_diff)) == 0)
-        goto werr;
-
     /* Make sure data will not remain on the OS's output buffers */
     if (fflush(fp) == EOF) goto werr;
     if (fsync(fileno(fp)) == -1) goto werr;
@@ -1470,80 +1701,6 @@ werr:
     return C_ERR;
 }
 
-/* ----------------------------------------------------------------------------
- * AOF rewrite pipes for IPC
- * -------------------------------------------------------------------------- */
-
-/* This event handler is called when the AOF rewriting child sends us a
- * single '!' char to signal we should stop sending buffer diffs. The
- * parent sends a '!' as well to acknowledge. */
-void aofChildPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask) {
-    char byte;
-    UNUSED(el);
-    UNUSED(privdata);
-    UNUSED(mask);
-
-    if (read(fd,&byte,1) == 1 && byte == '!') {
-        serverLog(LL_NOTICE,"AOF rewrite child asks to stop sending diffs.");
-        server.aof_stop_sending_diff = 1;
-        if (write(server.aof_pipe_write_ack_to_child,"!",1) != 1) {
-            /* If we can't send the ack, inform the user, but don't try again
-             * since in the other side the children will use a timeout if the
-             * kernel can't buffer our write, or, the children was
-             * terminated. */
-            serverLog(LL_WARNING,"Can't send ACK to AOF child: %s",
-                strerror(errno));
-        }
-    }
-    /* Remove the handler since this can be called only one time during a
-     * rewrite. */
-    aeDeleteFileEvent(server.el,server.aof_pipe_read_ack_from_child,AE_READABLE);
-}
-
-/* Create the pipes used for parent - child process IPC during rewrite.
- * We have a data pipe used to send AOF incremental diffs to the child,
- * and two other pipes used by the children to signal it finished with
- * the rewrite so no more data should be written, and another for the
- * parent to acknowledge it understood this new condition. */
-int aofCreatePipes(void) {
-    int fds[6] = {-1, -1, -1, -1, -1, -1};
-    int j;
-
-    if (pipe(fds) == -1) goto error; /* parent -> children data. */
-    if (pipe(fds+2) == -1) goto error; /* children -> parent ack. */
-    if (pipe(fds+4) == -1) goto error; /* parent -> children ack. */
-    /* Parent -> children data is non blocking. */
-    if (anetNonBlock(NULL,fds[0]) != ANET_OK) goto error;
-    if (anetNonBlock(NULL,fds[1]) != ANET_OK) goto error;
-    if (aeCreateFileEvent(server.el, fds[2], AE_READABLE, aofChildPipeReadable, NULL) == AE_ERR) goto error;
-
-    server.aof_pipe_write_data_to_child = fds[1];
-    server.aof_pipe_read_data_from_parent = fds[0];
-    server.aof_pipe_write_ack_to_parent = fds[3];
-    server.aof_pipe_read_ack_from_child = fds[2];
-    server.aof_pipe_write_ack_to_child = fds[5];
-    server.aof_pipe_read_ack_from_parent = fds[4];
-    server.aof_stop_sending_diff = 0;
-    return C_OK;
-
-error:
-    serverLog(LL_WARNING,"Error opening /setting AOF rewrite IPC pipes: %s",
-        strerror(errno));
-    for (j = 0; j < 6; j++) if(fds[j] != -1) close(fds[j]);
-    return C_ERR;
-}
-
-void aofClosePipes(void) {
-    aeDeleteFileEvent(server.el,server.aof_pipe_read_ack_from_child,AE_READABLE);
-    aeDeleteFileEvent(server.el,server.aof_pipe_write_data_to_child,AE_WRITABLE);
-    close(server.aof_pipe_write_data_to_child);
-    close(server.aof_pipe_read_data_from_parent);
-    close(server.aof_pipe_write_ack_to_parent);
-    close(server.aof_pipe_read_ack_from_child);
-    close(server.aof_pipe_write_ack_to_child);
-    close(server.aof_pipe_read_ack_from_parent);
-}
-
 /* ----------------------------------------------------------------------------
  * AOF background rewrite
  * ------------------------------------------------------------------------- */
@@ -1551,21 +1708,21 @@ void aofClosePipes(void) {
 /* This is how rewriting of the append only file in background works:
  *
  * 1) The user calls BGREWRITEAOF
- * 2) Redis calls this function, that forks():
- *    2a) the child rewrite the append only file in a temp file.
- *    2b) the parent accumulates differences in server.aof_rewrite_buf.
+ * 2) Redis calls this function, that switches the AOF writes to a new
+ *    incremental file and forks():
+ *    2a) the child writes the dataset in a temp file.
+ *    2b) the parent keeps appending to the new incremental file.
  * 3) When the child finished '2a' exists.
- * 4) The parent will trap the exit code, if it's OK, will append the
- *    data accumulated into server.aof_rewrite_buf into the temp file, and
- *    finally will rename(2) the temp file in the actual file name.
- *    The the new file is reopened as the new append only file. Profit!
+ * 4) The parent will trap the exit code, if it's OK, will rename(2) the
+ *    temp file as the new base, and write the manifest with the base and
+ *    the incremental file of '2b' only. The old files are removed. Profit!
  */
 int rewriteAppendOnlyFileBackground(void) {
     pid_t childpid;
     long long start;
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
-    if (aofCreatePipes() != C_OK) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbBgsaveInProgress()) return C_ERR;
+    if (aofOpenNewIncr() != C_OK) return C_ERR;
     openChildInfoPipe();
     start = ustime();
     if ((childpid = fork()) == 0) {
@@ -1594,13 +1751,12 @@ int rewriteAppendOnlyFileBackground(void) {
         /* Parent */
         server.stat_fork_time = ustime()-start;
         server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
-        latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
+        latencyAddEventSample(LATENCY_EVENT_FORK,server.stat_fork_time);
         if (childpid == -1) {
             closeChildInfoPipe();
             serverLog(LL_WARNING,
                 "Can't rewrite append only file in background: fork: %s",
                 strerror(errno));
-            aofClosePipes();
             return C_ERR;
         }
         serverLog(LL_NOTICE,
@@ -1609,11 +1765,6 @@ int rewriteAppendOnlyFileBackground(void) {
         server.aof_rewrite_time_start = time(NULL);
         server.aof_child_pid = childpid;
         updateDictResizePolicy();
-        /* We set appendseldb to -1 in order to force the next call to the
-         * feedAppendOnlyFile() to issue a SELECT command, so the differences
-         * accumulated by the parent into server.aof_rewrite_buf will start
-         * with a SELECT statement and it will be safe to merge. */
-        server.aof_selected_db = -1;
         replicationScriptCacheFlush();
         return C_OK;
     }
@@ -1623,7 +1774,7 @@ int rewriteAppendOnlyFileBackground(void) {
 void bgrewriteaofCommand(client *c) {
     if (server.aof_child_pid != -1) {
         addReplyError(c,"Background append only file rewriting already in progress");
-    } else if (server.rdb_child_pid != -1) {
+    } else if (rdbBgsaveInProgress()) {
         server.aof_rewrite_scheduled = 1;
         addReplyStatus(c,"Background append only file rewriting scheduled");
     } else if (rewriteAppendOnlyFileBackground() == C_OK) {
@@ -1644,19 +1795,32 @@ void aofRemoveTempFile(pid_t childpid) {
 }
 
 /* Update the server.aof_current_size field explicitly using stat(2)
- * to check the size of the file. This is useful after a rewrite or after
+ * to check the size of the files. This is useful after a rewrite or after
  * a restart, normally the size is updated just adding the write length
  * to the current length, that is much faster. */
 void aofUpdateCurrentSize(void) {
+    aofManifest *am = server.aof_manifest;
     struct redis_stat sb;
     mstime_t latency;
+    off_t size = 0;
+    listNode *ln;
+    listIter li;
 
     latencyStartMonitor(latency);
-    if (redis_fstat(server.aof_fd,&sb) == -1) {
-        serverLog(LL_WARNING,"Unable to obtain the AOF file length. stat: %s",
-            strerror(errno));
+    if (!am->ondisk) {
+        if (redis_fstat(server.aof_fd,&sb) == -1) {
+            serverLog(LL_WARNING,"Unable to obtain the AOF file length. stat: %s",
+                strerror(errno));
+        } else {
+            server.aof_current_size = sb.st_size;
+        }
     } else {
-        server.aof_current_size = sb.st_size;
+        if (am->base && redis_stat(am->base,&sb) != -1) size += sb.st_size;
+        listRewind(am->incr,&li);
+        while((ln = listNext(&li))) {
+            if (redis_stat(listNodeValue(ln),&sb) != -1) size += sb.st_size;
+        }
+        server.aof_current_size = size;
     }
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("aof-fstat",latency);
@@ -1666,114 +1830,73 @@ void aofUpdateCurrentSize(void) {
  * Handle this. */
 void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
     if (!bysignal && exitcode == 0) {
-        int newfd, oldfd;
+        aofManifest *am = server.aof_manifest, *newam;
+        sds tempincr = NULL, newincr = NULL;
         char tmpfile[256];
         long long now = ustime();
         mstime_t latency;
+        listNode *ln;
+        listIter li;
 
         serverLog(LL_NOTICE,
             "Background AOF rewrite terminated with success");
 
-        /* Flush the differences accumulated by the parent to the
-         * rewritten AOF. */
+        /* The new base, followed by the incremental file opened when the
+         * rewrite started, if the AOF is on. */
+        newam = aofManifestCreate();
+        newam->seq = am->seq;
+        newam->base = aofBaseFileName(++newam->seq);
+        if (server.aof_state == AOF_ON) {
+            listAddNodeTail(newam->incr,sdsdup(listNodeValue(listLast(am->incr))));
+        } else if (server.aof_state == AOF_WAIT_REWRITE) {
+            tempincr = aofTempIncrFileName();
+            newincr = aofIncrFileName(++newam->seq);
+            listAddNodeTail(newam->incr,sdsdup(newincr));
+        }
+
         latencyStartMonitor(latency);
         snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
             (int)server.aof_child_pid);
-        newfd = open(tmpfile,O_WRONLY|O_APPEND);
-        if (newfd == -1) {
-            serverLog(LL_WARNING,
-                "Unable to open the temporary AOF produced by the child: %s", strerror(errno));
-            goto cleanup;
-        }
-
-        if (aofRewriteBufferWrite(newfd) == -1) {
+        if (rename(tmpfile,newam->base) == -1) {
             serverLog(LL_WARNING,
-                "Error trying to flush the parent diff to the rewritten AOF: %s", strerror(errno));
-            close(newfd);
-            goto cleanup;
-        }
-        latencyEndMonitor(latency);
-        latencyAddSampleIfNeeded("aof-rewrite-diff-write",latency);
-
-        serverLog(LL_NOTICE,
-            "Residual parent diff successfully flushed to the rewritten AOF (%.2f MB)", (double) aofRewriteBufferSize() / (1024*1024));
-
-        /* The only remaining thing to do is to rename the temporary file to
-         * the configured file and switch the file descriptor used to do AOF
-         * writes. We don't want close(2) or rename(2) calls to block the
-         * server on old file deletion.
-         *
-         * There are two possible scenarios:
-         *
-         * 1) AOF is DISABLED and this was a one time rewrite. The temporary
-         * file will be renamed to the configured file. When this file already
-         * exists, it will be unlinked, which may block the server.
-         *
-         * 2) AOF is ENABLED and the rewritten AOF will immediately start
-         * receiving writes. After the temporary file is renamed to the
-         * configured file, the original AOF file descriptor will be closed.
-         * Since this will be the last reference to that file, closing it
-         * causes the underlying file to be unlinked, which may block the
-         * server.
-         *
-         * To mitigate the blocking effect of the unlink operation (either
-         * caused by rename(2) in scenario 1, or by close(2) in scenario 2), we
-         * use a background thread to take care of this. First, we
-         * make scenario 1 identical to scenario 2 by opening the target file
-         * when it exists. The unlink operation after the rename(2) will then
-         * be executed upon calling close(2) for its descriptor. Everything to
-         * guarantee atomicity for this switch has already happened by then, so
-         * we don't care what the outcome or duration of that close operation
-         * is, as long as the file descriptor is released again. */
-        if (server.aof_fd == -1) {
-            /* AOF disabled */
-
-            /* Don't care if this fails: oldfd will be -1 and we handle that.
-             * One notable case of -1 return is if the old file does
-             * not exist. */
-            oldfd = open(server.aof_filename,O_RDONLY|O_NONBLOCK);
-        } else {
-            /* AOF enabled */
-            oldfd = -1; /* We'll set this to the current AOF filedes later. */
+                "Error trying to rename the temporary AOF file %s into %s: %s",
+                tmpfile,
+                newam->base,
+                strerror(errno));
+            goto manifesterr;
         }
-
-        /* Rename the temporary file. This will not unlink the target file if
-         * it exists, because we reference it with "oldfd". */
-        latencyStartMonitor(latency);
-        if (rename(tmpfile,server.aof_filename) == -1) {
+        if (tempincr && rename(tempincr,newincr) == -1) {
             serverLog(LL_WARNING,
                 "Error trying to rename the temporary AOF file %s into %s: %s",
-                tmpfile,
-                server.aof_filename,
+                tempincr,
+                newincr,
                 strerror(errno));
-            close(newfd);
-            if (oldfd != -1) close(oldfd);
-            goto cleanup;
+            unlink(newam->base);
+            goto manifesterr;
+        }
+        if (aofManifestPersist(newam) == C_ERR) {
+            if (tempincr) rename(newincr,tempincr);
+            unlink(newam->base);
+            goto manifesterr;
         }
         latencyEndMonitor(latency);
         latencyAddSampleIfNeeded("aof-rename",latency);
 
-        if (server.aof_fd == -1) {
-            /* AOF disabled, we don't need to set the AOF file descriptor
-             * to this new file, so we can close it. */
-            close(newfd);
-        } else {
-            /* AOF enabled, replace the old fd with the new one. */
-            oldfd = server.aof_fd;
-            server.aof_fd = newfd;
-            if (server.aof_fsync == AOF_FSYNC_ALWAYS)
-                redis_fsync(newfd);
-            else if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
-                aof_background_fsync(newfd);
-            server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
+        /* The files the new base replaces. */
+        if (am->base) aofDeleteInBackground(am->base);
+        listRewind(am->incr,&li);
+        while((ln = listNext(&li))) {
+            if (server.aof_state == AOF_ON && ln == listLast(am->incr)) break;
+            aofDeleteInBackground(listNodeValue(ln));
+        }
+        aofManifestFree(am);
+        server.aof_manifest = newam;
+        sdsfree(tempincr);
+        sdsfree(newincr);
+
+        if (server.aof_fd != -1) {
             aofUpdateCurrentSize();
             server.aof_rewrite_base_size = server.aof_current_size;
-            server.aof_current_size = server.aof_current_size;
-
-            /* Clear regular AOF buffer since its contents was just written to
-             * the new AOF from the background rewrite buffer. */
-            sdsfree(server.aof_buf);
-            server.aof_buf = sdsempty();
         }
 
         server.aof_lastbgrewrite_status = C_OK;
@@ -1783,11 +1906,15 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
         if (server.aof_state == AOF_WAIT_REWRITE)
             server.aof_state = AOF_ON;
 
-        /* Asynchronously close the overwritten AOF. */
-        if (oldfd != -1) bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)oldfd,NULL,NULL);
-
         serverLog(LL_VERBOSE,
             "Background AOF rewrite signal handler took %lldus", ustime()-now);
+        goto cleanup;
+
+manifesterr:
+        aofManifestFree(newam);
+        sdsfree(tempincr);
+        sdsfree(newincr);
+        server.aof_lastbgrewrite_status = C_ERR;
     } else if (!bysignal && exitcode != 0) {
         /* SIGUSR1 is whitelisted, so we have a way to kill a child without
          * tirggering an error condition. */
@@ -1803,8 +1930,6 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
     }
 
 cleanup:
-    aofClosePipes();
-    aofRewriteBufferReset();
     aofRemoveTempFile(server.aof_child_pid);
     server.aof_child_pid = -1;
     server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
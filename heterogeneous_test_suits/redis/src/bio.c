@@ -60,19 +60,57 @@
 
 #include "server.h"
 #include "bio.h"
+#include <stdatomic.h>
 
 static pthread_t bio_threads[BIO_NUM_OPS];
-static pthread_mutex_t bio_mutex[BIO_NUM_OPS];
-static pthread_cond_t bio_newjob_cond[BIO_NUM_OPS];
-static pthread_cond_t bio_step_cond[BIO_NUM_OPS];
-static list *bio_jobs[BIO_NUM_OPS];
-/* The following array is used to hold the number of pending jobs for every
- * OP type. This allows us to export the bioPendingJobsOfType() API that is
- * useful when the main thread wants to perform some operation that may involve
- * objects shared with the background thread. The main thread will just wait
- * that there are no longer jobs of this type to be executed before performing
- * the sensible operation. This data is also useful for reporting. */
-static unsigned long long bio_pending[BIO_NUM_OPS];
+
+/* The job queue of every OP type, each one in its own page: the bio threads
+ * may run on other Popcorn nodes than the main thread, and with the queues
+ * packed together the lock of a thread and the jobs of another would share
+ * a page, which would bounce between the nodes at every job of either. */
+#define BIO_QUEUE_SIZE 4096 /* A page, the unit of sharing of the DSM. */
+
+typedef union bioQueue {
+    struct {
+        pthread_mutex_t mutex;
+        pthread_cond_t newjob_cond;
+        pthread_cond_t step_cond;
+        list *jobs;
+        /* The number of pending jobs. This allows us to export the
+         * bioPendingJobsOfType() API that is useful when the main thread
+         * wants to perform some operation that may involve objects shared
+         * with the background thread. The main thread will just wait that
+         * there are no longer jobs of this type to be executed before
+         * performing the sensible operation. This data is also useful for
+         * reporting. */
+        unsigned long long pending;
+    } q;
+    char padding[BIO_QUEUE_SIZE];
+} bioQueue;
+
+static bioQueue bio_queues[BIO_NUM_OPS]
+    __attribute__((aligned(BIO_QUEUE_SIZE)));
+
+#define bio_mutex(type) (&bio_queues[type].q.mutex)
+#define bio_newjob_cond(type) (&bio_queues[type].q.newjob_cond)
+#define bio_step_cond(type) (&bio_queues[type].q.step_cond)
+#define bio_jobs(type) (bio_queues[type].q.jobs)
+#define bio_pending(type) (bio_queues[type].q.pending)
+
+/* The batches of objects the main thread frees lazily, at most one per event
+ * loop iteration, go through this single producer single consumer ring
+ * instead of bio_jobs(BIO_LAZY_FREE): submitting one takes no lock and
+ * allocates no job, unless the lazyfree thread must be woken up. 'head' is
+ * only written by the main thread, 'tail' by the lazyfree thread, and
+ * 'sleeping' is set by the lazyfree thread, holding its mutex, before it
+ * checks the ring a last time and waits. */
+#define BIO_LAZYFREE_RING_SIZE 1024 /* Must be a power of two. */
+static void *bio_lazyfree_ring[BIO_LAZYFREE_RING_SIZE];
+static _Atomic unsigned long bio_lazyfree_head
+    __attribute__((aligned(BIO_QUEUE_SIZE)));
+static _Atomic unsigned long bio_lazyfree_tail
+    __attribute__((aligned(BIO_QUEUE_SIZE)));
+static _Atomic int bio_lazyfree_sleeping;
 
 /* This structure represents a background Job. It is only used locally to this
  * file as the API does not expose the internals at all. */
@@ -87,10 +125,7 @@ void *bioProcessBackgroundJobs(void *arg);
 void lazyfreeFreeObjectFromBioThread(robj *o);
 void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2);
 void lazyfreeFreeSlotsMapFromBioThread(zskiplist *sl);
-
-/* Make sure we have enough stack to perform all the things we do in the
- * main thread. */
-#define REDIS_THREAD_STACK_SIZE (1024*1024*4)
+void lazyfreeFreeBatchFromBioThread(lazyfreeBatch *batch);
 
 /* Initialize the background system, spawning the thread. */
 void bioInit(void) {
@@ -101,11 +136,11 @@ void bioInit(void) {
 
     /* Initialization of state vars and objects */
     for (j = 0; j < BIO_NUM_OPS; j++) {
-        pthread_mutex_init(&bio_mutex[j],NULL);
-        pthread_cond_init(&bio_newjob_cond[j],NULL);
-        pthread_cond_init(&bio_step_cond[j],NULL);
-        bio_jobs[j] = listCreate();
-        bio_pending[j] = 0;
+        pthread_mutex_init(bio_mutex(j),NULL);
+        pthread_cond_init(bio_newjob_cond(j),NULL);
+        pthread_cond_init(bio_step_cond(j),NULL);
+        bio_jobs(j) = listCreate();
+        bio_pending(j) = 0;
     }
 
     /* Set the stack size as by default it may be small in some system */
@@ -135,17 +170,70 @@ void bioCreateBackgroundJob(int type, void *arg1, void *arg2, void *arg3) {
     job->arg1 = arg1;
     job->arg2 = arg2;
     job->arg3 = arg3;
-    pthread_mutex_lock(&bio_mutex[type]);
-    listAddNodeTail(bio_jobs[type],job);
-    bio_pending[type]++;
-    pthread_cond_signal(&bio_newjob_cond[type]);
-    pthread_mutex_unlock(&bio_mutex[type]);
+    pthread_mutex_lock(bio_mutex(type));
+    listAddNodeTail(bio_jobs(type),job);
+    bio_pending(type)++;
+    pthread_cond_signal(bio_newjob_cond(type));
+    pthread_mutex_unlock(bio_mutex(type));
+}
+
+/* Queue a batch of objects for the lazyfree thread from the main thread.
+ * Returns C_ERR if the ring is full: the caller queues a job instead. */
+int bioSubmitLazyfreeBatch(void *batch) {
+    unsigned long head = atomic_load_explicit(&bio_lazyfree_head,
+                                              memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&bio_lazyfree_tail,memory_order_acquire)
+        == BIO_LAZYFREE_RING_SIZE) return C_ERR;
+    bio_lazyfree_ring[head & (BIO_LAZYFREE_RING_SIZE-1)] = batch;
+    atomic_store(&bio_lazyfree_head,head+1);
+    if (atomic_load(&bio_lazyfree_sleeping)) {
+        pthread_mutex_lock(bio_mutex(BIO_LAZY_FREE));
+        pthread_cond_signal(bio_newjob_cond(BIO_LAZY_FREE));
+        pthread_mutex_unlock(bio_mutex(BIO_LAZY_FREE));
+    }
+    return C_OK;
+}
+
+static unsigned long bioLazyfreeRingLength(void) {
+    return atomic_load(&bio_lazyfree_head) - atomic_load(&bio_lazyfree_tail);
+}
+
+/* Free the batches of the ring, called by the lazyfree thread holding its
+ * mutex, that is released meanwhile. */
+static void bioDrainLazyfreeRing(void) {
+    unsigned long tail = atomic_load_explicit(&bio_lazyfree_tail,
+                                              memory_order_relaxed);
+
+    while (tail != atomic_load_explicit(&bio_lazyfree_head,
+                                        memory_order_acquire))
+    {
+        void *batch = bio_lazyfree_ring[tail & (BIO_LAZYFREE_RING_SIZE-1)];
+
+        pthread_mutex_unlock(bio_mutex(BIO_LAZY_FREE));
+        lazyfreeFreeBatchFromBioThread(batch);
+        pthread_mutex_lock(bio_mutex(BIO_LAZY_FREE));
+        atomic_store_explicit(&bio_lazyfree_tail,++tail,memory_order_release);
+        pthread_cond_broadcast(bio_step_cond(BIO_LAZY_FREE));
+    }
+}
+
+/* Move the bio thread of 'type' to the node its jobs run on: the one the
+ * Popcorn schedule assigns to it, otherwise popcorn-bio-node if set,
+ * otherwise it stays where it is. '*nid' is the node the thread runs on. */
+static void bioFollowNode(unsigned long type, int *nid) {
+    int dflt = server.popcorn_bio_node >= 0 ? server.popcorn_bio_node : *nid;
+
+    popcornMoveThread(POPCORN_REGION_BIO,
+        popcorn_schedule_node(POPCORN_REGION_BIO,type,dflt),nid);
 }
 
 void *bioProcessBackgroundJobs(void *arg) {
     struct bio_job *job;
     unsigned long type = (unsigned long) arg;
+    int nid = 0; /* Threads start on the home node. */
     sigset_t sigset;
+    char arena[16];
 
     /* Check that the type is within the right interval. */
     if (type >= BIO_NUM_OPS) {
@@ -154,12 +242,19 @@ void *bioProcessBackgroundJobs(void *arg) {
         return NULL;
     }
 
+    /* Leave the home node right away, so that the thread and its arena
+     * are in place before the first job. */
+    bioFollowNode(type,&nid);
+
+    snprintf(arena,sizeof(arena),"bio%lu",type);
+    serverThreadArenaInit(arena);
+
     /* Make the thread killable at any time, so that bioKillThreads()
      * can work reliably. */
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
-    pthread_mutex_lock(&bio_mutex[type]);
+    pthread_mutex_lock(bio_mutex(type));
     /* Block SIGALRM so we are sure that only the main thread will
      * receive the watchdog signal. */
     sigemptyset(&sigset);
@@ -172,33 +267,58 @@ void *bioProcessBackgroundJobs(void *arg) {
         listNode *ln;
 
         /* The loop always starts with the lock hold. */
-        if (listLength(bio_jobs[type]) == 0) {
-            pthread_cond_wait(&bio_newjob_cond[type],&bio_mutex[type]);
+        if (type == BIO_LAZY_FREE) bioDrainLazyfreeRing();
+        if (listLength(bio_jobs(type)) == 0) {
+            if (type == BIO_LAZY_FREE) {
+                /* See bio_lazyfree_ring: either the main thread sees we
+                 * sleep, or we see what it queued. */
+                atomic_store(&bio_lazyfree_sleeping,1);
+                if (bioLazyfreeRingLength()) {
+                    atomic_store(&bio_lazyfree_sleeping,0);
+                    continue;
+                }
+            }
+            pthread_cond_wait(bio_newjob_cond(type),bio_mutex(type));
+            if (type == BIO_LAZY_FREE)
+                atomic_store(&bio_lazyfree_sleeping,0);
             continue;
         }
         /* Pop the job from the queue. */
-        ln = listFirst(bio_jobs[type]);
+        ln = listFirst(bio_jobs(type));
         job = ln->value;
         /* It is now possible to unlock the background system as we know have
          * a stand alone job structure to process.*/
-        pthread_mutex_unlock(&bio_mutex[type]);
+        pthread_mutex_unlock(bio_mutex(type));
+
+        /* Run the job where the Popcorn schedule wants us. */
+        bioFollowNode(type,&nid);
 
         /* Process the job accordingly to its type. */
         if (type == BIO_CLOSE_FILE) {
             close((long)job->arg1);
         } else if (type == BIO_AOF_FSYNC) {
             redis_fsync((long)job->arg1);
+            /* arg2 is the AOF write covered by the fsync, for the clients
+             * waiting for a group commit. */
+            if (job->arg2) aofFsyncDoneFromBioThread((long)job->arg2);
+            /* arg3 set: the file is no longer written, close it. */
+            if (job->arg3) close((long)job->arg1);
         } else if (type == BIO_LAZY_FREE) {
             /* What we free changes depending on what arguments are set:
              * arg1 -> free the object at pointer.
              * arg2 & arg3 -> free two dictionaries (a Redis DB).
-             * only arg3 -> free the skiplist. */
+             * only arg2 -> free a batch of objects.
+             * only arg3 -> free the radix tree (slots map or expire index). */
             if (job->arg1)
                 lazyfreeFreeObjectFromBioThread(job->arg1);
             else if (job->arg2 && job->arg3)
                 lazyfreeFreeDatabaseFromBioThread(job->arg2,job->arg3);
+            else if (job->arg2)
+                lazyfreeFreeBatchFromBioThread(job->arg2);
             else if (job->arg3)
                 lazyfreeFreeSlotsMapFromBioThread(job->arg3);
+        } else if (type == BIO_DEFRAG) {
+            activeDefragFromBioThread(job->arg1);
         } else {
             serverPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
@@ -206,21 +326,22 @@ void *bioProcessBackgroundJobs(void *arg) {
 
         /* Lock again before reiterating the loop, if there are no longer
          * jobs to process we'll block again in pthread_cond_wait(). */
-        pthread_mutex_lock(&bio_mutex[type]);
-        listDelNode(bio_jobs[type],ln);
-        bio_pending[type]--;
+        pthread_mutex_lock(bio_mutex(type));
+        listDelNode(bio_jobs(type),ln);
+        bio_pending(type)--;
 
         /* Unblock threads blocked on bioWaitStepOfType() if any. */
-        pthread_cond_broadcast(&bio_step_cond[type]);
+        pthread_cond_broadcast(bio_step_cond(type));
     }
 }
 
 /* Return the number of pending jobs of the specified type. */
 unsigned long long bioPendingJobsOfType(int type) {
     unsigned long long val;
-    pthread_mutex_lock(&bio_mutex[type]);
-    val = bio_pending[type];
-    pthread_mutex_unlock(&bio_mutex[type]);
+    pthread_mutex_lock(bio_mutex(type));
+    val = bio_pending(type);
+    if (type == BIO_LAZY_FREE) val += bioLazyfreeRingLength();
+    pthread_mutex_unlock(bio_mutex(type));
     return val;
 }
 
@@ -236,13 +357,15 @@ unsigned long long bioPendingJobsOfType(int type) {
  */
 unsigned long long bioWaitStepOfType(int type) {
     unsigned long long val;
-    pthread_mutex_lock(&bio_mutex[type]);
-    val = bio_pending[type];
+    pthread_mutex_lock(bio_mutex(type));
+    val = bio_pending(type);
+    if (type == BIO_LAZY_FREE) val += bioLazyfreeRingLength();
     if (val != 0) {
-        pthread_cond_wait(&bio_step_cond[type],&bio_mutex[type]);
-        val = bio_pending[type];
+        pthread_cond_wait(bio_step_cond(type),bio_mutex(type));
+        val = bio_pending(type);
+        if (type == BIO_LAZY_FREE) val += bioLazyfreeRingLength();
     }
-    pthread_mutex_unlock(&bio_mutex[type]);
+    pthread_mutex_unlock(bio_mutex(type));
     return val;
 }
 
@@ -30,6 +30,355 @@
 
 #include "server.h"
 
+/* BITOP operations. */
+#define BITOP_AND   0
+#define BITOP_OR    1
+#define BITOP_XOR   2
+#define BITOP_NOT   3
+
+/* -----------------------------------------------------------------------------
+ * Vector kernels.
+ *
+ * BITCOUNT, BITPOS and BITOP process long strings with AVX2 (or AVX-512 with
+ * VPOPCNTDQ) on x86-64, and with NEON on aarch64. The kernels are compiled
+ * with target attributes, so the rest of the server keeps the baseline ISA,
+ * and only used if the CPU running the thread has them.
+ *
+ * The choice is not a function pointer: each ISA's binary has its own body
+ * of the same functions, so the code stays valid when the event loop thread
+ * migrates to a node of another ISA. What is cached is the SIMD level of the
+ * node the thread runs on, which is reset by bitopsSimdReset() on arrival on
+ * a new node and checked again on the next call.
+ * -------------------------------------------------------------------------- */
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#define BITOPS_SIMD_NONE 0
+#define BITOPS_SIMD_AVX2 1
+#define BITOPS_SIMD_AVX512 2    /* AVX-512 F and VPOPCNTDQ. */
+#define BITOPS_SIMD_NEON 1
+
+/* Strings shorter than this are not worth the dispatch. */
+#define BITOPS_SIMD_MIN_BYTES 256
+
+/* BITOP handles the strings in blocks of this many bytes, so that every
+ * source is read once per block and the result is stored once. */
+#define BITOP_SIMD_BLOCK 128
+
+/* AVX-512 VPOPCNTDQ intrinsics need GCC >= 8 or clang >= 7. */
+#if defined(__x86_64__) && \
+    ((defined(__clang__) && __clang_major__ >= 7) || \
+     (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 8))
+#define HAVE_BITOPS_AVX512 1
+#endif
+
+/* SIMD level of the node running the thread, -1 if not checked yet. */
+static __thread int bitops_simd = -1;
+
+static int bitopsSimdSupported(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+#ifdef HAVE_BITOPS_AVX512
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512vpopcntdq")) return BITOPS_SIMD_AVX512;
+#endif
+    if (__builtin_cpu_supports("avx2")) return BITOPS_SIMD_AVX2;
+    return BITOPS_SIMD_NONE;
+#elif defined(__aarch64__)
+    return BITOPS_SIMD_NEON; /* NEON is part of the base ISA. */
+#else
+    return BITOPS_SIMD_NONE;
+#endif
+}
+
+static inline int bitopsSimdLevel(void) {
+    if (bitops_simd < 0) bitops_simd = bitopsSimdSupported();
+    return bitops_simd;
+}
+
+/* Forget the SIMD level of the calling thread. Called after the thread
+ * migrated, as the new node may be of another ISA. */
+void bitopsSimdReset(void) {
+    bitops_simd = -1;
+}
+
+#if defined(__x86_64__)
+/* Nibble lookup table popcount (Mula et al.), 32 bytes at a time. The byte
+ * counts are summed into 64 bit lanes with VPSADBW. Returns the bits set in
+ * the first 'count' bytes rounded down to a multiple of 32, the number of
+ * bytes processed is stored in '*done'. */
+__attribute__((target("avx2")))
+static size_t popcountAvx2(const unsigned char *p, long count, long *done) {
+    const __m256i lookup = _mm256_setr_epi8(
+        0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+        0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    long j;
+
+    for (j = 0; j+32 <= count; j += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p+j));
+        __m256i lo = _mm256_and_si256(v,low);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v,4),low);
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup,lo),
+                                      _mm256_shuffle_epi8(lookup,hi));
+        acc = _mm256_add_epi64(acc,_mm256_sad_epu8(cnt,_mm256_setzero_si256()));
+    }
+    *done = j;
+    return (size_t)_mm256_extract_epi64(acc,0) +
+           (size_t)_mm256_extract_epi64(acc,1) +
+           (size_t)_mm256_extract_epi64(acc,2) +
+           (size_t)_mm256_extract_epi64(acc,3);
+}
+
+/* Index of the first byte of the first 32 bytes block that is not all
+ * 'skipval' (0 or 0xff), or the length processed if there is none. */
+__attribute__((target("avx2")))
+static unsigned long bitposSkipAvx2(const unsigned char *p,
+                                    unsigned long count, int skipval) {
+    const __m256i ones = _mm256_set1_epi8(-1);
+    unsigned long j;
+
+    for (j = 0; j+32 <= count; j += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p+j));
+        if (skipval ? !_mm256_testc_si256(v,ones) : !_mm256_testz_si256(v,v))
+            break;
+    }
+    return j;
+}
+
+/* Compute 'op' of the sources into 'res' for the first 'len' bytes, rounded
+ * down to a multiple of BITOP_SIMD_BLOCK. Returns the bytes processed. */
+__attribute__((target("avx2")))
+static unsigned long bitopAvx2(int op, unsigned char *res,
+                               unsigned char **src, unsigned long numkeys,
+                               unsigned long len) {
+    unsigned long i, j;
+
+    for (j = 0; j+BITOP_SIMD_BLOCK <= len; j += BITOP_SIMD_BLOCK) {
+        const unsigned char *s = src[0]+j;
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)s);
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(s+32));
+        __m256i a2 = _mm256_loadu_si256((const __m256i*)(s+64));
+        __m256i a3 = _mm256_loadu_si256((const __m256i*)(s+96));
+
+        if (op == BITOP_NOT) {
+            const __m256i ones = _mm256_set1_epi8(-1);
+            a0 = _mm256_xor_si256(a0,ones);
+            a1 = _mm256_xor_si256(a1,ones);
+            a2 = _mm256_xor_si256(a2,ones);
+            a3 = _mm256_xor_si256(a3,ones);
+        }
+        for (i = 1; i < numkeys; i++) {
+            s = src[i]+j;
+            __m256i b0 = _mm256_loadu_si256((const __m256i*)s);
+            __m256i b1 = _mm256_loadu_si256((const __m256i*)(s+32));
+            __m256i b2 = _mm256_loadu_si256((const __m256i*)(s+64));
+            __m256i b3 = _mm256_loadu_si256((const __m256i*)(s+96));
+            if (op == BITOP_AND) {
+                a0 = _mm256_and_si256(a0,b0); a1 = _mm256_and_si256(a1,b1);
+                a2 = _mm256_and_si256(a2,b2); a3 = _mm256_and_si256(a3,b3);
+            } else if (op == BITOP_OR) {
+                a0 = _mm256_or_si256(a0,b0); a1 = _mm256_or_si256(a1,b1);
+                a2 = _mm256_or_si256(a2,b2); a3 = _mm256_or_si256(a3,b3);
+            } else {
+                a0 = _mm256_xor_si256(a0,b0); a1 = _mm256_xor_si256(a1,b1);
+                a2 = _mm256_xor_si256(a2,b2); a3 = _mm256_xor_si256(a3,b3);
+            }
+        }
+        _mm256_storeu_si256((__m256i*)(res+j),a0);
+        _mm256_storeu_si256((__m256i*)(res+j+32),a1);
+        _mm256_storeu_si256((__m256i*)(res+j+64),a2);
+        _mm256_storeu_si256((__m256i*)(res+j+96),a3);
+    }
+    return j;
+}
+
+#ifdef HAVE_BITOPS_AVX512
+/* Same as popcountAvx2(), 64 bytes at a time with VPOPCNTQ. */
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static size_t popcountAvx512(const unsigned char *p, long count, long *done) {
+    __m512i acc = _mm512_setzero_si512();
+    long j;
+
+    for (j = 0; j+64 <= count; j += 64)
+        acc = _mm512_add_epi64(acc,
+            _mm512_popcnt_epi64(_mm512_loadu_si512((const void*)(p+j))));
+    *done = j;
+    return (size_t)_mm512_reduce_add_epi64(acc);
+}
+
+/* Same as bitposSkipAvx2(), 64 bytes at a time. */
+__attribute__((target("avx512f")))
+static unsigned long bitposSkipAvx512(const unsigned char *p,
+                                      unsigned long count, int skipval) {
+    const __m512i skip = _mm512_set1_epi8(skipval ? -1 : 0);
+    unsigned long j;
+
+    for (j = 0; j+64 <= count; j += 64) {
+        __m512i v = _mm512_loadu_si512((const void*)(p+j));
+        if (_mm512_cmpneq_epi64_mask(v,skip)) break;
+    }
+    return j;
+}
+
+/* Same as bitopAvx2(), two 64 bytes vectors per block. */
+__attribute__((target("avx512f")))
+static unsigned long bitopAvx512(int op, unsigned char *res,
+                                 unsigned char **src, unsigned long numkeys,
+                                 unsigned long len) {
+    unsigned long i, j;
+
+    for (j = 0; j+BITOP_SIMD_BLOCK <= len; j += BITOP_SIMD_BLOCK) {
+        const unsigned char *s = src[0]+j;
+        __m512i a0 = _mm512_loadu_si512((const void*)s);
+        __m512i a1 = _mm512_loadu_si512((const void*)(s+64));
+
+        if (op == BITOP_NOT) {
+            const __m512i ones = _mm512_set1_epi64(-1);
+            a0 = _mm512_xor_si512(a0,ones);
+            a1 = _mm512_xor_si512(a1,ones);
+        }
+        for (i = 1; i < numkeys; i++) {
+            s = src[i]+j;
+            __m512i b0 = _mm512_loadu_si512((const void*)s);
+            __m512i b1 = _mm512_loadu_si512((const void*)(s+64));
+            if (op == BITOP_AND) {
+                a0 = _mm512_and_si512(a0,b0); a1 = _mm512_and_si512(a1,b1);
+            } else if (op == BITOP_OR) {
+                a0 = _mm512_or_si512(a0,b0); a1 = _mm512_or_si512(a1,b1);
+            } else {
+                a0 = _mm512_xor_si512(a0,b0); a1 = _mm512_xor_si512(a1,b1);
+            }
+        }
+        _mm512_storeu_si512((void*)(res+j),a0);
+        _mm512_storeu_si512((void*)(res+j+64),a1);
+    }
+    return j;
+}
+#endif /* HAVE_BITOPS_AVX512 */
+
+#elif defined(__aarch64__)
+/* CNT popcount, 64 bytes at a time. The byte counts are widened into 32 bit
+ * lanes, which can't overflow for strings up to 512 MB. */
+static size_t popcountNeon(const unsigned char *p, long count, long *done) {
+    uint32x4_t acc = vdupq_n_u32(0);
+    long j;
+
+    for (j = 0; j+64 <= count; j += 64) {
+        uint8x16_t c = vcntq_u8(vld1q_u8(p+j));
+        c = vaddq_u8(c,vcntq_u8(vld1q_u8(p+j+16)));
+        c = vaddq_u8(c,vcntq_u8(vld1q_u8(p+j+32)));
+        c = vaddq_u8(c,vcntq_u8(vld1q_u8(p+j+48)));
+        acc = vpadalq_u16(acc,vpaddlq_u8(c));
+    }
+    *done = j;
+    return (size_t)vaddvq_u64(vpaddlq_u32(acc));
+}
+
+/* Index of the first byte of the first 32 bytes block that is not all
+ * 'skipval' (0 or 0xff), or the length processed if there is none. */
+static unsigned long bitposSkipNeon(const unsigned char *p,
+                                    unsigned long count, int skipval) {
+    unsigned long j;
+
+    for (j = 0; j+32 <= count; j += 32) {
+        uint8x16_t a = vld1q_u8(p+j), b = vld1q_u8(p+j+16);
+        if (skipval ? vminvq_u8(vandq_u8(a,b)) != UCHAR_MAX
+                    : vmaxvq_u8(vorrq_u8(a,b)) != 0) break;
+    }
+    return j;
+}
+
+/* Compute 'op' of the sources into 'res' for the first 'len' bytes, rounded
+ * down to a multiple of BITOP_SIMD_BLOCK. Returns the bytes processed. */
+static unsigned long bitopNeon(int op, unsigned char *res,
+                               unsigned char **src, unsigned long numkeys,
+                               unsigned long len) {
+    uint8x16_t a[BITOP_SIMD_BLOCK/16];
+    unsigned long i, j;
+    int k;
+
+    for (j = 0; j+BITOP_SIMD_BLOCK <= len; j += BITOP_SIMD_BLOCK) {
+        for (k = 0; k < BITOP_SIMD_BLOCK/16; k++) {
+            a[k] = vld1q_u8(src[0]+j+k*16);
+            if (op == BITOP_NOT) a[k] = vmvnq_u8(a[k]);
+        }
+        for (i = 1; i < numkeys; i++) {
+            const unsigned char *s = src[i]+j;
+            for (k = 0; k < BITOP_SIMD_BLOCK/16; k++) {
+                uint8x16_t b = vld1q_u8(s+k*16);
+                if (op == BITOP_AND) a[k] = vandq_u8(a[k],b);
+                else if (op == BITOP_OR) a[k] = vorrq_u8(a[k],b);
+                else a[k] = veorq_u8(a[k],b);
+            }
+        }
+        for (k = 0; k < BITOP_SIMD_BLOCK/16; k++)
+            vst1q_u8(res+j+k*16,a[k]);
+    }
+    return j;
+}
+#endif
+
+/* Bits set in the leading part of the 'count' bytes at 'p' the vector
+ * kernel of the node can process, whose length is stored in '*done'. */
+static size_t popcountSimd(const unsigned char *p, long count, long *done) {
+    *done = 0;
+    if (count < BITOPS_SIMD_MIN_BYTES) return 0;
+    switch(bitopsSimdLevel()) {
+#if defined(__x86_64__)
+#ifdef HAVE_BITOPS_AVX512
+    case BITOPS_SIMD_AVX512: return popcountAvx512(p,count,done);
+#endif
+    case BITOPS_SIMD_AVX2: return popcountAvx2(p,count,done);
+#elif defined(__aarch64__)
+    case BITOPS_SIMD_NEON: return popcountNeon(p,count,done);
+#endif
+    default: return 0;
+    }
+}
+
+/* Bytes at the start of 'p' that are all 'skipval' (0 or 0xff), rounded
+ * down to the block of the vector kernel of the node. */
+static unsigned long bitposSkipSimd(const unsigned char *p,
+                                    unsigned long count, int skipval) {
+    if (count < BITOPS_SIMD_MIN_BYTES) return 0;
+    switch(bitopsSimdLevel()) {
+#if defined(__x86_64__)
+#ifdef HAVE_BITOPS_AVX512
+    case BITOPS_SIMD_AVX512: return bitposSkipAvx512(p,count,skipval);
+#endif
+    case BITOPS_SIMD_AVX2: return bitposSkipAvx2(p,count,skipval);
+#elif defined(__aarch64__)
+    case BITOPS_SIMD_NEON: return bitposSkipNeon(p,count,skipval);
+#endif
+    default: return 0;
+    }
+}
+
+/* Compute 'op' into 'res' for the leading bytes of the 'len' bytes every
+ * source has, in blocks of BITOP_SIMD_BLOCK. Returns the bytes processed. */
+static unsigned long bitopSimd(int op, unsigned char *res,
+                               unsigned char **src, unsigned long numkeys,
+                               unsigned long len) {
+    if (len < BITOPS_SIMD_MIN_BYTES) return 0;
+    switch(bitopsSimdLevel()) {
+#if defined(__x86_64__)
+#ifdef HAVE_BITOPS_AVX512
+    case BITOPS_SIMD_AVX512: return bitopAvx512(op,res,src,numkeys,len);
+#endif
+    case BITOPS_SIMD_AVX2: return bitopAvx2(op,res,src,numkeys,len);
+#elif defined(__aarch64__)
+    case BITOPS_SIMD_NEON: return bitopNeon(op,res,src,numkeys,len);
+#endif
+    default: return 0;
+    }
+}
+
 /* -----------------------------------------------------------------------------
  * Helpers and low level bit functions.
  * -------------------------------------------------------------------------- */
@@ -43,6 +392,13 @@ size_t redisPopcount(void *s, long count) {
     uint32_t *p4;
     static const unsigned char bitsinbyte[256] = {0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,4,5,5,6,5,6,6,7,5,6,6,7,6,7,7,8};
 
+    long done;
+
+    /* Count with the vector kernel first, if the node has one. */
+    bits = popcountSimd(p,count,&done);
+    p += done;
+    count -= done;
+
     /* Count initial bytes not aligned to 32 bit. */
     while((unsigned long)p & 3 && count) {
         bits += bitsinbyte[*p++];
@@ -129,7 +485,15 @@ long redisBitpos(void *s, unsigned long count, int bit) {
         pos += 8;
     }
 
-    /* Skip bits with full word step. */
+    /* Skip bits with full word step, with the vector kernel first if the
+     * node has one. */
+    if (!found) {
+        unsigned long skipped = bitposSkipSimd(c,count,!bit);
+
+        c += skipped;
+        count -= skipped;
+        pos += skipped*8;
+    }
     l = (unsigned long*) c;
     if (!found) {
         skipval = bit ? 0 : ULONG_MAX;
@@ -392,11 +756,6 @@ void printBits(unsigned char *p, unsigned long count) {
  * Bits related string commands: GETBIT, SETBIT, BITCOUNT, BITOP.
  * -------------------------------------------------------------------------- */
 
-#define BITOP_AND   0
-#define BITOP_OR    1
-#define BITOP_XOR   2
-#define BITOP_NOT   3
-
 #define BITFIELDOP_GET 0
 #define BITFIELDOP_SET 1
 #define BITFIELDOP_INCRBY 2
@@ -663,16 +1022,23 @@ void bitopCommand(client *c) {
          * can take a fast path that performs much better than the
          * vanilla algorithm. On ARM we skip the fast path since it will
          * result in GCC compiling the code using multiple-words load/store
-         * operations that are not supported even in ARM >= v6. */
-        j = 0;
+         * operations that are not supported even in ARM >= v6.
+         *
+         * The vector kernel of the node, if any, goes first: it takes any
+         * number of keys and processes whole blocks, the word at a time
+         * loop below then takes care of the rest. */
+        j = bitopSimd(op,res,src,numkeys,minlen);
+        minlen -= j;
         #ifndef USE_ALIGNED_ACCESS
         if (minlen >= sizeof(unsigned long)*4 && numkeys <= 16) {
             unsigned long *lp[16];
-            unsigned long *lres = (unsigned long*) res;
+            unsigned long *lres = (unsigned long*) (res+j);
 
-            /* Note: sds pointer is always aligned to 8 byte boundary. */
-            memcpy(lp,src,sizeof(unsigned long*)*numkeys);
-            memcpy(res,src[0],minlen);
+            /* Note: sds pointer is always aligned to 8 byte boundary, and
+             * the vector kernel processes whole blocks. */
+            for (i = 0; i < numkeys; i++)
+                lp[i] = (unsigned long*) (src[i]+j);
+            memcpy(res+j,src[0]+j,minlen);
 
             /* Different branches per different operations for speed (sorry). */
             if (op == BITOP_AND) {
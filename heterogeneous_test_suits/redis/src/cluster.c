@@ -449,6 +449,7 @@ void clusterInit(void) {
         server.cluster->stats_bus_messages_received[i] = 0;
     }
     server.cluster->stats_pfail_nodes = 0;
+    server.cluster->stats_gossip_changed_nodes = 0;
     memset(server.cluster->slots,0, sizeof(server.cluster->slots));
     clusterCloseAllSlots();
 
@@ -660,24 +661,55 @@ void clusterAcceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
  * { and } is hashed. This may be useful in the future to force certain
  * keys to be in the same node (assuming no resharding is in progress). */
 unsigned int keyHashSlot(char *key, int keylen) {
-    int s, e; /* start-end indexes of { and } */
-
-    for (s = 0; s < keylen; s++)
-        if (key[s] == '{') break;
+    char *s, *e; /* { and } */
 
     /* No '{' ? Hash the whole key. This is the base case. */
-    if (s == keylen) return crc16(key,keylen) & 0x3FFF;
+    s = memchr(key,'{',keylen);
+    if (s == NULL) return crc16(key,keylen) & 0x3FFF;
 
     /* '{' found? Check if we have the corresponding '}'. */
-    for (e = s+1; e < keylen; e++)
-        if (key[e] == '}') break;
+    e = memchr(s+1,'}',keylen-(s-key)-1);
 
     /* No '}' or nothing between {} ? Hash the whole key. */
-    if (e == keylen || e == s+1) return crc16(key,keylen) & 0x3FFF;
+    if (e == NULL || e == s+1) return crc16(key,keylen) & 0x3FFF;
 
     /* If we are here there is both a { and a } on its right. Hash
      * what is in the middle between { and }. */
-    return crc16(key+s+1,e-s-1) & 0x3FFF;
+    return crc16(s+1,e-s-1) & 0x3FFF;
+}
+
+/* Return the hash slot of the keys of the command, COMMAND_SLOT_NOKEYS if it
+ * has no keys, or COMMAND_SLOT_CROSS if they don't all hash to the same
+ * slot. Most commands have a single key at a fixed position: they don't need
+ * getKeysFromCommand(). */
+int getCommandSlot(struct redisCommand *cmd, robj **argv, int argc) {
+    int *keyindex, numkeys, slot = COMMAND_SLOT_NOKEYS, j;
+
+    if (!(cmd->flags & CMD_MODULE_GETKEYS) &&
+        (cmd->getkeys_proc == NULL || cmd->flags & CMD_MODULE) &&
+        cmd->firstkey > 0 && cmd->firstkey == cmd->lastkey)
+    {
+        robj *key;
+
+        if (cmd->firstkey >= argc) return COMMAND_SLOT_NOKEYS;
+        key = argv[cmd->firstkey];
+        return keyHashSlot((char*)key->ptr,sdslen(key->ptr));
+    }
+
+    keyindex = getKeysFromCommand(cmd,argv,argc,&numkeys);
+    for (j = 0; j < numkeys; j++) {
+        robj *key = argv[keyindex[j]];
+        int thisslot = keyHashSlot((char*)key->ptr,sdslen(key->ptr));
+
+        if (slot == COMMAND_SLOT_NOKEYS) {
+            slot = thisslot;
+        } else if (slot != thisslot) {
+            slot = COMMAND_SLOT_CROSS;
+            break;
+        }
+    }
+    getKeysFreeResult(keyindex);
+    return slot;
 }
 
 /* -----------------------------------------------------------------------------
@@ -717,6 +749,10 @@ clusterNode *createClusterNode(char *nodename, int flags) {
     node->orphaned_time = 0;
     node->repl_offset_time = 0;
     node->repl_offset = 0;
+    node->gossip_changed = node->ctime;
+    node->gossip_flags = flags;
+    memset(node->gossip_ip,0,sizeof(node->gossip_ip));
+    node->gossip_port = node->gossip_cport = 0;
     listSetFreeMethod(node->fail_reports,zfree);
     return node;
 }
@@ -2345,6 +2381,45 @@ void clusterSetGossipEntry(clusterMsg *hdr, int i, clusterNode *n) {
     gossip->notused1 = 0;
 }
 
+/* With cluster-gossip-delta, the gossip sections are mostly about the nodes
+ * whose state changed recently: their flags or their address. Every packet
+ * still features CLUSTER_GOSSIP_DELTA_MIN random nodes, and all the nodes
+ * in PFAIL state, however the nodes in a stable state are not repeated in
+ * 1/10 of the packets, so the gossip grows with the changes in the cluster
+ * rather than with its size. A change is gossiped about for the validity
+ * time of the failure reports, so that the gossip reaches every node the
+ * same way failure reports do.
+ *
+ * Called by clusterCron() for every node: take note of the changes of its
+ * state, and return 1 if its state changed recently. */
+int clusterNodeGossipChanged(clusterNode *node, mstime_t now) {
+    if (node->gossip_flags != node->flags ||
+        node->gossip_port != node->port ||
+        node->gossip_cport != node->cport ||
+        memcmp(node->gossip_ip,node->ip,sizeof(node->ip)) != 0)
+    {
+        node->gossip_flags = node->flags;
+        node->gossip_port = node->port;
+        node->gossip_cport = node->cport;
+        memcpy(node->gossip_ip,node->ip,sizeof(node->ip));
+        node->gossip_changed = now;
+    }
+    return now - node->gossip_changed <=
+           server.cluster_node_timeout * CLUSTER_FAIL_REPORT_VALIDITY_MULT;
+}
+
+/* Return 1 if the node can be featured in the gossip sections. PFAIL nodes
+ * are added apart. */
+static int clusterNodeIsGossipable(clusterNode *n) {
+    /* In the gossip section don't include:
+     * 1) Nodes in HANDSHAKE state.
+     * 3) Nodes with the NOADDR flag set.
+     * 4) Disconnected nodes if they don't have configured slots.
+     */
+    return !(n->flags & (CLUSTER_NODE_HANDSHAKE|CLUSTER_NODE_NOADDR)) &&
+           !(n->link == NULL && n->numslots == 0);
+}
+
 /* Send a PING or PONG packet to the specified node, making sure to add enough
  * gossip informations. */
 void clusterSendPing(clusterLink *link, int type) {
@@ -2387,6 +2462,14 @@ void clusterSendPing(clusterLink *link, int type) {
      * 10% of the total nodes we have. */
     wanted = floor(dictSize(server.cluster->nodes)/10);
     if (wanted < 3) wanted = 3;
+
+    /* With cluster-gossip-delta, a few random nodes plus the ones that
+     * changed, see clusterNodeGossipChanged(). */
+    int changed_wanted = 0;
+    if (server.cluster_gossip_delta) {
+        wanted = CLUSTER_GOSSIP_DELTA_MIN;
+        changed_wanted = server.cluster->stats_gossip_changed_nodes;
+    }
     if (wanted > freshnodes) wanted = freshnodes;
 
     /* Include all the nodes in PFAIL state, so that failure reports are
@@ -2397,7 +2480,8 @@ void clusterSendPing(clusterLink *link, int type) {
      * later according to the number of gossip sections we really were able
      * to put inside the packet. */
     totlen = sizeof(clusterMsg)-sizeof(union clusterMsgData);
-    totlen += (sizeof(clusterMsgDataGossip)*(wanted+pfail_wanted));
+    totlen += (sizeof(clusterMsgDataGossip)*
+               (wanted+changed_wanted+pfail_wanted));
     /* Note: clusterBuildMessageHdr() expects the buffer to be always at least
      * sizeof(clusterMsg) or more. */
     if (totlen < (int)sizeof(clusterMsg)) totlen = sizeof(clusterMsg);
@@ -2409,6 +2493,30 @@ void clusterSendPing(clusterLink *link, int type) {
         link->node->ping_sent = mstime();
     clusterBuildMessageHdr(hdr,type);
 
+    /* Add the nodes that changed first, the random ones follow. */
+    if (changed_wanted) {
+        dictIterator *di;
+        dictEntry *de;
+        mstime_t validity = server.cluster_node_timeout *
+                            CLUSTER_FAIL_REPORT_VALIDITY_MULT;
+        mstime_t now = mstime();
+
+        di = dictGetSafeIterator(server.cluster->nodes);
+        while((de = dictNext(di)) != NULL && changed_wanted > 0) {
+            clusterNode *node = dictGetVal(de);
+            if (node == myself || node == link->node) continue;
+            if (node->flags & CLUSTER_NODE_PFAIL) continue;
+            if (!clusterNodeIsGossipable(node)) continue;
+            if (now - node->gossip_changed > validity) continue;
+            clusterSetGossipEntry(hdr,gossipcount,node);
+            freshnodes--;
+            gossipcount++;
+            changed_wanted--;
+        }
+        dictReleaseIterator(di);
+        wanted += gossipcount;
+    }
+
     /* Populate the gossip fields */
     int maxiterations = wanted*3;
     while(freshnodes > 0 && gossipcount < wanted && maxiterations--) {
@@ -2422,14 +2530,7 @@ void clusterSendPing(clusterLink *link, int type) {
         /* PFAIL nodes will be added later. */
         if (this->flags & CLUSTER_NODE_PFAIL) continue;
 
-        /* In the gossip section don't include:
-         * 1) Nodes in HANDSHAKE state.
-         * 3) Nodes with the NOADDR flag set.
-         * 4) Disconnected nodes if they don't have configured slots.
-         */
-        if (this->flags & (CLUSTER_NODE_HANDSHAKE|CLUSTER_NODE_NOADDR) ||
-            (this->link == NULL && this->numslots == 0))
-        {
+        if (!clusterNodeIsGossipable(this)) {
             freshnodes--; /* Tecnically not correct, but saves CPU. */
             continue;
         }
@@ -3364,6 +3465,7 @@ void clusterCron(void) {
      * better decisions in other part of the code. */
     di = dictGetSafeIterator(server.cluster->nodes);
     server.cluster->stats_pfail_nodes = 0;
+    server.cluster->stats_gossip_changed_nodes = 0;
     while((de = dictNext(di)) != NULL) {
         clusterNode *node = dictGetVal(de);
 
@@ -3373,6 +3475,9 @@ void clusterCron(void) {
 
         if (node->flags & CLUSTER_NODE_PFAIL)
             server.cluster->stats_pfail_nodes++;
+        if (server.cluster_gossip_delta &&
+            clusterNodeGossipChanged(node,now))
+            server.cluster->stats_gossip_changed_nodes++;
 
         /* A Node in HANDSHAKE state has a limited lifespan equal to the
          * configured node timeout. */
@@ -4944,6 +5049,7 @@ void restoreCommand(client *c) {
  * in serverCron() when they are around for more than a few seconds. */
 #define MIGRATE_SOCKET_CACHE_ITEMS 64 /* max num of items in the cache. */
 #define MIGRATE_SOCKET_CACHE_TTL 10 /* close cached sockets after 10 sec. */
+#define MIGRATE_WRITE_CHUNK (64*1024) /* Send the commands 64K at a time. */
 
 typedef struct migrateCachedSocket {
     int fd;
@@ -5053,6 +5159,29 @@ void migrateCloseTimedoutSockets(void) {
     dictReleaseIterator(di);
 }
 
+/* Write 'len' bytes to the target instance of MIGRATE, MIGRATE_WRITE_CHUNK
+ * bytes at a time. Return C_ERR on write errors and timeouts. */
+static int migrateWrite(int fd, char *buf, size_t len, long timeout) {
+    size_t pos = 0, towrite;
+
+    while ((towrite = len-pos) > 0) {
+        if (towrite > MIGRATE_WRITE_CHUNK) towrite = MIGRATE_WRITE_CHUNK;
+        if (syncWrite(fd,buf+pos,towrite,timeout) != (ssize_t)towrite)
+            return C_ERR;
+        pos += towrite;
+    }
+    return C_OK;
+}
+
+/* Send the commands queued in the 'cmd' buffer, and empty it. */
+static int migrateFlush(int fd, rio *cmd, long timeout) {
+    int retval = migrateWrite(fd,cmd->io.buffer.ptr,
+                              sdslen(cmd->io.buffer.ptr),timeout);
+    sdsclear(cmd->io.buffer.ptr);
+    cmd->io.buffer.pos = 0;
+    return retval;
+}
+
 /* MIGRATE host port key dbid timeout [COPY | REPLACE | AUTH password]
  *
  * On in the multiple keys form:
@@ -5170,24 +5299,37 @@ try_again:
                             so certain keys that were found non expired by the
                             lookupKey() function, may be expired later. */
 
-    /* Create RESTORE payload and generate the protocol to call the command. */
+    /* Relocate valid (non expired) keys into the arrays in successive
+     * positions to remove holes created by the keys that were present
+     * in the first lookup but are now expired after the second lookup.
+     * This is done before sending anything, so that a retry after a
+     * write error finds the arrays as they were. */
+    for (j = 0; j < num_keys; j++) {
+        long long expireat = getExpire(c->db,kv[j]);
+
+        if (expireat != -1 && expireat < mstime()) continue;
+        ov[non_expired] = ov[j];
+        kv[non_expired++] = kv[j];
+    }
+
+    /* Fix the actual number of keys we are migrating. */
+    num_keys = non_expired;
+
+    /* Create RESTORE payload and generate the protocol to call the command.
+     * The commands are sent as soon as MIGRATE_WRITE_CHUNK bytes are queued,
+     * so that the target restores the first keys while we serialize the
+     * next ones, and large payloads are sent as they are rather than copied
+     * in the command buffer. */
+    errno = 0;
     for (j = 0; j < num_keys; j++) {
         long long ttl = 0;
         long long expireat = getExpire(c->db,kv[j]);
 
         if (expireat != -1) {
             ttl = expireat-mstime();
-            if (ttl < 0) {
-                continue;
-            }
             if (ttl < 1) ttl = 1;
         }
 
-        /* Relocate valid (non expired) keys into the array in successive
-         * positions to remove holes created by the keys that were present
-         * in the first lookup but are now expired after the second lookup. */
-        kv[non_expired++] = kv[j];
-
         serverAssertWithInfo(c,NULL,
             rioWriteBulkCount(&cmd,'*',replace ? 5 : 4));
 
@@ -5204,38 +5346,43 @@ try_again:
         /* Emit the payload argument, that is the serialized object using
          * the DUMP format. */
         createDumpPayload(&payload,ov[j],kv[j]);
-        serverAssertWithInfo(c,NULL,
-            rioWriteBulkString(&cmd,payload.io.buffer.ptr,
-                               sdslen(payload.io.buffer.ptr)));
-        sdsfree(payload.io.buffer.ptr);
+        sds dump = payload.io.buffer.ptr;
+        if (sdslen(dump) < MIGRATE_WRITE_CHUNK) {
+            serverAssertWithInfo(c,NULL,
+                rioWriteBulkString(&cmd,dump,sdslen(dump)));
+        } else {
+            serverAssertWithInfo(c,NULL,
+                rioWriteBulkCount(&cmd,'$',sdslen(dump)));
+            if (migrateFlush(cs->fd,&cmd,timeout) == C_ERR ||
+                migrateWrite(cs->fd,dump,sdslen(dump),timeout) == C_ERR)
+            {
+                sdsfree(dump);
+                write_error = 1;
+                goto socket_err;
+            }
+            serverAssertWithInfo(c,NULL,rioWrite(&cmd,"\r\n",2));
+        }
+        sdsfree(dump);
 
         /* Add the REPLACE option to the RESTORE command if it was specified
          * as a MIGRATE option. */
         if (replace)
             serverAssertWithInfo(c,NULL,rioWriteBulkString(&cmd,"REPLACE",7));
-    }
-
-    /* Fix the actual number of keys we are migrating. */
-    num_keys = non_expired;
 
-    /* Transfer the query to the other node in 64K chunks. */
-    errno = 0;
-    {
-        sds buf = cmd.io.buffer.ptr;
-        size_t pos = 0, towrite;
-        int nwritten = 0;
-
-        while ((towrite = sdslen(buf)-pos) > 0) {
-            towrite = (towrite > (64*1024) ? (64*1024) : towrite);
-            nwritten = syncWrite(cs->fd,buf+pos,towrite,timeout);
-            if (nwritten != (signed)towrite) {
-                write_error = 1;
-                goto socket_err;
-            }
-            pos += nwritten;
+        if (sdslen(cmd.io.buffer.ptr) >= MIGRATE_WRITE_CHUNK &&
+            migrateFlush(cs->fd,&cmd,timeout) == C_ERR)
+        {
+            write_error = 1;
+            goto socket_err;
         }
     }
 
+    /* Transfer what is left of the query to the other node. */
+    if (migrateFlush(cs->fd,&cmd,timeout) == C_ERR) {
+        write_error = 1;
+        goto socket_err;
+    }
+
     char buf0[1024]; /* Auth reply. */
     char buf1[1024]; /* Select reply. */
     char buf2[1024]; /* Restore reply. */
@@ -5449,9 +5596,36 @@ void readwriteCommand(client *c) {
  *
  * CLUSTER_REDIR_DOWN_STATE if the cluster is down but the user attempts to
  * execute a command that addresses one or more keys. */
+/* Count the keys of the commands in 'ms' that are missing in this node, and
+ * set '*multiple_keys' if they are not all the same key. Only needed when
+ * the slot is being migrated or imported. */
+static int countMissingKeys(multiState *ms, int *multiple_keys) {
+    robj *firstkey = NULL;
+    int missing_keys = 0, i, j;
+
+    for (i = 0; i < ms->count; i++) {
+        robj **margv = ms->commands[i].argv;
+        int *keyindex, numkeys;
+
+        keyindex = getKeysFromCommand(ms->commands[i].cmd,margv,
+                                      ms->commands[i].argc,&numkeys);
+        for (j = 0; j < numkeys; j++) {
+            robj *thiskey = margv[keyindex[j]];
+
+            if (firstkey == NULL)
+                firstkey = thiskey;
+            else if (!equalStringObjects(firstkey,thiskey))
+                *multiple_keys = 1;
+            if (lookupKeyRead(&server.db[0],thiskey) == NULL)
+                missing_keys++;
+        }
+        getKeysFreeResult(keyindex);
+    }
+    return missing_keys;
+}
+
 clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, int argc, int *hashslot, int *error_code) {
     clusterNode *n = NULL;
-    robj *firstkey = NULL;
     int multiple_keys = 0;
     multiState *ms, _ms;
     multiCmd mc;
@@ -5478,91 +5652,69 @@ clusterNode *getNodeByQuery(client *c, struct redisCommand *cmd, robj **argv, in
     } else {
         /* In order to have a single codepath create a fake Multi State
          * structure if the client is not in MULTI/EXEC state, this way
-         * we have a single codepath below. */
+         * we have a single codepath below. The slot processCommand()
+         * computed for the command of the client is reused. */
         ms = &_ms;
         _ms.commands = &mc;
         _ms.count = 1;
         mc.argv = argv;
         mc.argc = argc;
         mc.cmd = cmd;
+        mc.slot = (argv == c->argv && cmd == c->cmd) ?
+                  c->slot : COMMAND_SLOT_UNKNOWN;
     }
 
     /* Check that all the keys are in the same hash slot, and obtain this
-     * slot and the node associated. */
+     * slot and the node associated. The queued commands of a transaction
+     * got their slot when they were queued. */
     for (i = 0; i < ms->count; i++) {
-        struct redisCommand *mcmd;
-        robj **margv;
-        int margc, *keyindex, numkeys, j;
+        multiCmd *thiscmd = ms->commands+i;
+        int thisslot = thiscmd->slot;
 
-        mcmd = ms->commands[i].cmd;
-        margc = ms->commands[i].argc;
-        margv = ms->commands[i].argv;
+        if (thisslot == COMMAND_SLOT_UNKNOWN)
+            thisslot = getCommandSlot(thiscmd->cmd,thiscmd->argv,
+                                      thiscmd->argc);
+        if (thisslot == COMMAND_SLOT_NOKEYS) continue;
 
-        keyindex = getKeysFromCommand(mcmd,margv,margc,&numkeys);
-        for (j = 0; j < numkeys; j++) {
-            robj *thiskey = margv[keyindex[j]];
-            int thisslot = keyHashSlot((char*)thiskey->ptr,
-                                       sdslen(thiskey->ptr));
-
-            if (firstkey == NULL) {
-                /* This is the first key we see. Check what is the slot
-                 * and node. */
-                firstkey = thiskey;
-                slot = thisslot;
-                n = server.cluster->slots[slot];
-
-                /* Error: If a slot is not served, we are in "cluster down"
-                 * state. However the state is yet to be updated, so this was
-                 * not trapped earlier in processCommand(). Report the same
-                 * error to the client. */
-                if (n == NULL) {
-                    getKeysFreeResult(keyindex);
-                    if (error_code)
-                        *error_code = CLUSTER_REDIR_DOWN_UNBOUND;
-                    return NULL;
-                }
-
-                /* If we are migrating or importing this slot, we need to check
-                 * if we have all the keys in the request (the only way we
-                 * can safely serve the request, otherwise we return a TRYAGAIN
-                 * error). To do so we set the importing/migrating state and
-                 * increment a counter for every missing key. */
-                if (n == myself &&
-                    server.cluster->migrating_slots_to[slot] != NULL)
-                {
-                    migrating_slot = 1;
-                } else if (server.cluster->importing_slots_from[slot] != NULL) {
-                    importing_slot = 1;
-                }
-            } else {
-                /* If it is not the first key, make sure it is exactly
-                 * the same key as the first we saw. */
-                if (!equalStringObjects(firstkey,thiskey)) {
-                    if (slot != thisslot) {
-                        /* Error: multiple keys from different slots. */
-                        getKeysFreeResult(keyindex);
-                        if (error_code)
-                            *error_code = CLUSTER_REDIR_CROSS_SLOT;
-                        return NULL;
-                    } else {
-                        /* Flag this request as one with multiple different
-                         * keys. */
-                        multiple_keys = 1;
-                    }
-                }
-            }
+        /* Error: multiple keys from different slots. */
+        if (thisslot == COMMAND_SLOT_CROSS || (n && thisslot != slot)) {
+            if (error_code) *error_code = CLUSTER_REDIR_CROSS_SLOT;
+            return NULL;
+        }
+        if (n) continue;
+
+        /* This is the first key we see. Check what is the slot and node. */
+        slot = thisslot;
+        n = server.cluster->slots[slot];
+
+        /* Error: If a slot is not served, we are in "cluster down"
+         * state. However the state is yet to be updated, so this was
+         * not trapped earlier in processCommand(). Report the same
+         * error to the client. */
+        if (n == NULL) {
+            if (error_code) *error_code = CLUSTER_REDIR_DOWN_UNBOUND;
+            return NULL;
+        }
 
-            /* Migarting / Improrting slot? Count keys we don't have. */
-            if ((migrating_slot || importing_slot) &&
-                lookupKeyRead(&server.db[0],thiskey) == NULL)
-            {
-                missing_keys++;
-            }
+        /* If we are migrating or importing this slot, we need to check
+         * if we have all the keys in the request (the only way we
+         * can safely serve the request, otherwise we return a TRYAGAIN
+         * error). */
+        if (n == myself &&
+            server.cluster->migrating_slots_to[slot] != NULL)
+        {
+            migrating_slot = 1;
+        } else if (server.cluster->importing_slots_from[slot] != NULL) {
+            importing_slot = 1;
         }
-        getKeysFreeResult(keyindex);
     }
 
-    /* No key at all in command? then we can serve the request
+    /* Migarting / Improrting slot? Count keys we don't have. Slots are
+     * stable most of the time, and then the keys are never looked up. */
+    if (migrating_slot || importing_slot)
+        missing_keys = countMissingKeys(ms,&multiple_keys);
+
+/* No key at all in command? then we can serve the request
      * without redirections or errors in all the cases. */
     if (n == NULL) return myself;
 
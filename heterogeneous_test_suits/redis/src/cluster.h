@@ -17,6 +17,8 @@
 #define CLUSTER_DEFAULT_SLAVE_VALIDITY 10 /* Slave max data age factor. */
 #define CLUSTER_DEFAULT_REQUIRE_FULL_COVERAGE 1
 #define CLUSTER_DEFAULT_SLAVE_NO_FAILOVER 0 /* Failover by default. */
+#define CLUSTER_DEFAULT_GOSSIP_DELTA 0 /* Gossip about 1/10 of the nodes. */
+#define CLUSTER_GOSSIP_DELTA_MIN 3 /* Nodes to gossip about, if unchanged. */
 #define CLUSTER_FAIL_REPORT_VALIDITY_MULT 2 /* Fail report validity. */
 #define CLUSTER_FAIL_UNDO_TIME_MULT 2 /* Undo fail if master is back. */
 #define CLUSTER_FAIL_UNDO_TIME_ADD 10 /* Some additional time. */
@@ -138,6 +140,12 @@ typedef struct clusterNode {
     int cport;                  /* Latest known cluster port of this node. */
     clusterLink *link;          /* TCP/IP link with this node */
     list *fail_reports;         /* List of nodes signaling this as failing */
+    /* What we last told about the node in the gossip sections, and when it
+     * changed, used by cluster-gossip-delta. */
+    mstime_t gossip_changed;    /* Last change of the state below. */
+    int gossip_flags;
+    char gossip_ip[NET_IP_STR_LEN];
+    int gossip_port, gossip_cport;
 } clusterNode;
 
 typedef struct clusterState {
@@ -178,6 +186,9 @@ typedef struct clusterState {
     long long stats_bus_messages_received[CLUSTERMSG_TYPE_COUNT];
     long long stats_pfail_nodes;    /* Number of nodes in PFAIL status,
                                        excluding nodes without address. */
+    long long stats_gossip_changed_nodes; /* Number of nodes whose state
+                                       changed recently (cluster-gossip-delta),
+                                       excluding nodes without address. */
 } clusterState;
 
 /* Redis cluster messages header */
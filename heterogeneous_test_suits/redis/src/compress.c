@@ -0,0 +1,134 @@
+/* compress.c -- Codecs of the compressed list nodes and RDB strings.
+ *
+ * LZF is the historical codec of both. LZ4 compresses and, above all,
+ * decompresses several times faster for a similar ratio, which suits the
+ * interior nodes of the lists that LRANGE and LINDEX keep decompressing.
+ * zstd compresses much better than LZF at a similar speed, which suits the
+ * RDB files. Every compressed blob carries the codec that produced it, so
+ * the codecs can be changed at runtime and old data stays readable.
+ *
+ * All the codecs follow the lzf_compress() / lzf_decompress() contract:
+ * compressData() returns 0 when the result does not fit in 'outlen' bytes,
+ * and decompressData() returns 0 unless it produced exactly 'outlen' bytes.
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "compress.h"
+#include "lzf.h"
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+
+/* The level of the RDB strings: the default one of the zstd command line,
+ * about as fast as LZF with a clearly better ratio. */
+#define COMPRESS_ZSTD_LEVEL 3
+
+/* A context per thread saves an allocation per string, since an RDB
+ * is saved by a child, by the main thread or by a forkless save thread. */
+static __thread ZSTD_CCtx *zstd_cctx;
+static __thread ZSTD_DCtx *zstd_dctx;
+#endif
+
+int compressCodecAvailable(int codec) {
+    switch(codec) {
+    case COMPRESS_LZF: return 1;
+#ifdef USE_LZ4
+    case COMPRESS_LZ4: return 1;
+#endif
+#ifdef USE_ZSTD
+    case COMPRESS_ZSTD: return 1;
+#endif
+    default: return 0;
+    }
+}
+
+const char *compressCodecName(int codec) {
+    switch(codec) {
+    case COMPRESS_LZF: return "lzf";
+    case COMPRESS_LZ4: return "lz4";
+    case COMPRESS_ZSTD: return "zstd";
+    default: return "unknown";
+    }
+}
+
+size_t compressData(int codec, const void *in, size_t inlen, void *out,
+                    size_t outlen)
+{
+    switch(codec) {
+    case COMPRESS_LZF:
+        return lzf_compress(in,inlen,out,outlen);
+#ifdef USE_LZ4
+    case COMPRESS_LZ4: {
+        int n = LZ4_compress_default(in,out,(int)inlen,(int)outlen);
+        return n > 0 ? (size_t)n : 0;
+    }
+#endif
+#ifdef USE_ZSTD
+    case COMPRESS_ZSTD: {
+        size_t n;
+        if (zstd_cctx == NULL && (zstd_cctx = ZSTD_createCCtx()) == NULL)
+            return 0;
+        n = ZSTD_compressCCtx(zstd_cctx,out,outlen,in,inlen,
+                              COMPRESS_ZSTD_LEVEL);
+        return ZSTD_isError(n) ? 0 : n;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+size_t decompressData(int codec, const void *in, size_t inlen, void *out,
+                      size_t outlen)
+{
+    switch(codec) {
+    case COMPRESS_LZF:
+        return lzf_decompress(in,inlen,out,outlen);
+#ifdef USE_LZ4
+    case COMPRESS_LZ4: {
+        int n = LZ4_decompress_safe(in,out,(int)inlen,(int)outlen);
+        return n == (int)outlen ? outlen : 0;
+    }
+#endif
+#ifdef USE_ZSTD
+    case COMPRESS_ZSTD: {
+        size_t n;
+        if (zstd_dctx == NULL && (zstd_dctx = ZSTD_createDCtx()) == NULL)
+            return 0;
+        n = ZSTD_decompressDCtx(zstd_dctx,out,outlen,in,inlen);
+        return (!ZSTD_isError(n) && n == outlen) ? outlen : 0;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
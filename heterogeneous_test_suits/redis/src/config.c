@@ -91,6 +91,33 @@ configEnum aof_fsync_enum[] = {
     {NULL, 0}
 };
 
+configEnum popcorn_migrate_policy_enum[] = {
+    {"always", POPCORN_MIGRATE_ALWAYS},
+    {"never", POPCORN_MIGRATE_NEVER},
+    {"adaptive", POPCORN_MIGRATE_ADAPTIVE},
+    {NULL, 0}
+};
+
+configEnum popcorn_cron_keyspace_enum[] = {
+    {"home", POPCORN_CRON_KEYSPACE_HOME},
+    {"release", POPCORN_CRON_KEYSPACE_RELEASE},
+    {"remote", POPCORN_CRON_KEYSPACE_REMOTE},
+    {NULL, 0}
+};
+
+/* Only the codecs compiled in are listed, so CONFIG SET of a codec the
+ * binary can't decode is rejected like any other unknown value. */
+configEnum compress_codec_enum[] = {
+    {"lzf", COMPRESS_LZF},
+#ifdef USE_LZ4
+    {"lz4", COMPRESS_LZ4},
+#endif
+#ifdef USE_ZSTD
+    {"zstd", COMPRESS_ZSTD},
+#endif
+    {NULL, 0}
+};
+
 /* Output buffer limits presets. */
 clientBufferLimitsConfig clientBufferLimitsDefaults[CLIENT_TYPE_OBUF_COUNT] = {
     {0, 0, 0}, /* normal */
@@ -132,6 +159,22 @@ const char *evictPolicyToString(void) {
     return configEnumGetNameOrUnknown(maxmemory_policy_enum,server.maxmemory_policy);
 }
 
+/* Used for INFO generation and by the POPCORN command. */
+const char *popcornMigratePolicyToString(void) {
+    return configEnumGetNameOrUnknown(popcorn_migrate_policy_enum,
+        server.popcorn_migrate_policy);
+}
+
+/* Used by POPCORN POLICY. Returns INT_MIN if 'name' is not a policy. */
+int popcornMigratePolicyFromString(char *name) {
+    return configEnumGetValue(popcorn_migrate_policy_enum,name);
+}
+
+const char *popcornCronKeyspaceToString(void) {
+    return configEnumGetNameOrUnknown(popcorn_cron_keyspace_enum,
+        server.popcorn_cron_keyspace);
+}
+
 /*-----------------------------------------------------------------------------
  * Config file parsing
  *----------------------------------------------------------------------------*/
@@ -318,10 +361,48 @@ void loadServerConfigFromString(char *config) {
             if (server.io_threads_num < 1 || server.io_threads_num > 512) {
                 err = "Invalid number of I/O threads"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"module-worker-threads") && argc == 2) {
+            server.module_worker_threads = atoi(argv[1]);
+            if (server.module_worker_threads < 1 ||
+                server.module_worker_threads > 512)
+            {
+                err = "Invalid number of module worker threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"jemalloc-thread-arenas") && argc == 2) {
+            if ((server.jemalloc_thread_arenas = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"hugepage-dict-tables") && argc == 2) {
+            if ((server.hugepage_dict_tables = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"io-threads-do-reads") && argc == 2) {
             if ((server.io_threads_do_reads = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"io-threads-do-commands") && argc == 2) {
+            if ((server.io_threads_do_commands = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-threads-shard-by-slot") && argc == 2) {
+            if ((server.io_threads_shard_by_slot = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-threads-spin") && argc == 2) {
+            server.io_threads_spin = atoi(argv[1]);
+            if (server.io_threads_spin < 0) {
+                err = "io-threads-spin can't be negative"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-threads-node") && argc == 2) {
+            server.io_threads_node = atoi(argv[1]);
+            if (server.io_threads_node < -1) {
+                err = "io-threads-node must be -1 (unset) or greater";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"io-uring-writes") && argc == 2) {
+            if ((server.io_uring_writes = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"include") && argc == 2) {
             loadServerConfig(argv[1],NULL);
         } else if (!strcasecmp(argv[0],"maxclients") && argc == 2) {
@@ -344,10 +425,20 @@ void loadServerConfigFromString(char *config) {
                 err = "maxmemory-samples must be 1 or greater";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"maxmemory-eviction-batch") && argc == 2) {
+            server.maxmemory_eviction_batch = atoi(argv[1]);
+            if (server.maxmemory_eviction_batch < 1 ||
+                server.maxmemory_eviction_batch > CONFIG_MAX_MAXMEMORY_EVICTION_BATCH)
+            {
+                err = "maxmemory-eviction-batch must be between 1 and 1024";
+                goto loaderr;
+            }
         } else if ((!strcasecmp(argv[0],"proto-max-bulk-len")) && argc == 2) {
             server.proto_max_bulk_len = memtoll(argv[1],NULL);
         } else if ((!strcasecmp(argv[0],"client-query-buffer-limit")) && argc == 2) {
             server.client_max_querybuf_len = memtoll(argv[1],NULL);
+        } else if ((!strcasecmp(argv[0],"client-output-buffer-pause")) && argc == 2) {
+            server.client_obuf_pause = memtoll(argv[1],NULL);
         } else if (!strcasecmp(argv[0],"lfu-log-factor") && argc == 2) {
             server.lfu_log_factor = atoi(argv[1]);
             if (server.lfu_log_factor < 0) {
@@ -395,6 +486,18 @@ void loadServerConfigFromString(char *config) {
                 err = "repl-diskless-sync-delay can't be negative";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"repl-diskless-sync-max-replicas") &&
+                   argc==2)
+        {
+            server.repl_diskless_sync_max_replicas = atoi(argv[1]);
+            if (server.repl_diskless_sync_max_replicas < 0) {
+                err = "repl-diskless-sync-max-replicas can't be negative";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"repl-diskless-compression") && argc==2) {
+            if ((server.repl_diskless_compression = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"repl-backlog-size") && argc == 2) {
             long long size = memtoll(argv[1],NULL);
             if (size <= 0) {
@@ -439,6 +542,40 @@ void loadServerConfigFromString(char *config) {
             if ((server.rdb_compression = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdb-compression-codec") && argc == 2) {
+            server.rdb_compression_codec =
+                configEnumGetValue(compress_codec_enum,argv[1]);
+            if (server.rdb_compression_codec == INT_MIN) {
+                err = "Invalid or not compiled in 'rdb-compression-codec'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-save-threads") && argc == 2) {
+            server.rdb_save_threads = atoi(argv[1]);
+            if (server.rdb_save_threads < 1 ||
+                server.rdb_save_threads > RDB_SAVE_THREADS_MAX) {
+                err = "rdb-save-threads must be between 1 and 64";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-load-threads") && argc == 2) {
+            server.rdb_load_threads = atoi(argv[1]);
+            if (server.rdb_load_threads < 1 ||
+                server.rdb_load_threads > RDB_LOAD_THREADS_MAX) {
+                err = "rdb-load-threads must be between 1 and 64";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-save-forkless") && argc == 2) {
+            if ((server.rdb_save_forkless = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-save-forkless-cpu") &&
+                   argc == 2)
+        {
+            server.rdb_save_forkless_cpu = atoi(argv[1]);
+            if (server.rdb_save_forkless_cpu < 1 ||
+                server.rdb_save_forkless_cpu > 100) {
+                err = "rdb-save-forkless-cpu must be between 1 and 100";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"rdbchecksum") && argc == 2) {
             if ((server.rdb_checksum = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -447,6 +584,17 @@ void loadServerConfigFromString(char *config) {
             if ((server.activerehashing = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"keyspace-open-addressing") && argc == 2) {
+            if ((server.keyspace_open_addressing = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"activerehashing-max-ms") && argc == 2) {
+            server.activerehashing_max_ms = atoi(argv[1]);
+            if (server.activerehashing_max_ms < 1 ||
+                server.activerehashing_max_ms > 1000) {
+                err = "activerehashing-max-ms must be between 1 and 1000";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"lazyfree-lazy-eviction") && argc == 2) {
             if ((server.lazyfree_lazy_eviction = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -459,6 +607,10 @@ void loadServerConfigFromString(char *config) {
             if ((server.lazyfree_lazy_server_del = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"active-expire-index") && argc == 2) {
+            if ((server.active_expire_index = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if ((!strcasecmp(argv[0],"slave-lazy-flush") ||
                     !strcasecmp(argv[0],"replica-lazy-flush")) && argc == 2)
         {
@@ -474,6 +626,10 @@ void loadServerConfigFromString(char *config) {
                 err = "active defrag can't be enabled without proper jemalloc support"; goto loaderr;
 #endif
             }
+        } else if (!strcasecmp(argv[0],"active-defrag-threaded") && argc == 2) {
+            if ((server.active_defrag_threaded = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"daemonize") && argc == 2) {
             if ((server.daemonize = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -511,6 +667,10 @@ void loadServerConfigFromString(char *config) {
                 err = "argument must be 'no', 'always' or 'everysec'";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"aof-group-commit") && argc == 2) {
+            if ((server.aof_group_commit = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"auto-aof-rewrite-percentage") &&
                    argc == 2)
         {
@@ -608,6 +768,8 @@ void loadServerConfigFromString(char *config) {
             server.hash_max_ziplist_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"hash-max-ziplist-value") && argc == 2) {
             server.hash_max_ziplist_value = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"hash-max-intmap-entries") && argc == 2) {
+            server.hash_max_intmap_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"stream-node-max-bytes") && argc == 2) {
             server.stream_node_max_bytes = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"stream-node-max-entries") && argc == 2) {
@@ -620,14 +782,30 @@ void loadServerConfigFromString(char *config) {
             server.list_max_ziplist_size = atoi(argv[1]);
         } else if (!strcasecmp(argv[0],"list-compress-depth") && argc == 2) {
             server.list_compress_depth = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"list-compress-codec") && argc == 2) {
+            server.list_compress_codec =
+                configEnumGetValue(compress_codec_enum,argv[1]);
+            if (server.list_compress_codec == INT_MIN) {
+                err = "Invalid or not compiled in 'list-compress-codec'";
+                goto loaderr;
+            }
+            quicklistSetCompressCodec(server.list_compress_codec);
         } else if (!strcasecmp(argv[0],"set-max-intset-entries") && argc == 2) {
             server.set_max_intset_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"zset-max-ziplist-entries") && argc == 2) {
             server.zset_max_ziplist_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"zset-max-ziplist-value") && argc == 2) {
             server.zset_max_ziplist_value = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"zset-btree") && argc == 2) {
+            if ((server.zset_btree = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"hll-sparse-max-bytes") && argc == 2) {
             server.hll_sparse_max_bytes = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0],"hll-simd") && argc == 2) {
+            if ((server.hll_simd = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"rename-command") && argc == 3) {
             struct redisCommand *cmd = lookupCommand(argv[1]);
             int retval;
@@ -716,6 +894,10 @@ void loadServerConfigFromString(char *config) {
                 err = "argument must be 'yes' or 'no'";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"cluster-gossip-delta") && argc == 2) {
+            if ((server.cluster_gossip_delta = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"lua-time-limit") && argc == 2) {
             server.lua_time_limit = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"lua-replicate-commands") && argc == 2) {
@@ -732,6 +914,14 @@ void loadServerConfigFromString(char *config) {
                 err = "The latency threshold can't be negative";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"hotkeys-sample-rate") && argc == 2) {
+            server.hotkeys_sample_rate = atoi(argv[1]);
+            if (server.hotkeys_sample_rate < 0 ||
+                server.hotkeys_sample_rate > 100)
+            {
+                err = "Invalid hotkeys sample rate, must be between 0 and 100";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"slowlog-max-len") && argc == 2) {
             server.slowlog_max_len = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"client-output-buffer-limit") &&
@@ -810,6 +1000,45 @@ void loadServerConfigFromString(char *config) {
                     "Allowed values: 'upstart', 'systemd', 'auto', or 'no'";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"popcorn-migrate-policy") && argc == 2) {
+            server.popcorn_migrate_policy =
+                configEnumGetValue(popcorn_migrate_policy_enum,argv[1]);
+
+            if (server.popcorn_migrate_policy == INT_MIN) {
+                err = "Invalid option for 'popcorn-migrate-policy'. "
+                    "Allowed values: 'always', 'never' or 'adaptive'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"popcorn-cron-keyspace") && argc == 2) {
+            server.popcorn_cron_keyspace =
+                configEnumGetValue(popcorn_cron_keyspace_enum,argv[1]);
+
+            if (server.popcorn_cron_keyspace == INT_MIN) {
+                err = "Invalid option for 'popcorn-cron-keyspace'. "
+                    "Allowed values: 'home', 'release' or 'remote'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"popcorn-migrate-node") && argc == 2) {
+            server.popcorn_migrate_node = atoi(argv[1]);
+            if (server.popcorn_migrate_node < -1) {
+                err = "popcorn-migrate-node must be -1 (auto) or greater";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"popcorn-bio-node") && argc == 2) {
+            server.popcorn_bio_node = atoi(argv[1]);
+            if (server.popcorn_bio_node < -1) {
+                err = "popcorn-bio-node must be -1 (unset) or greater";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"popcorn-schedule") && argc == 2) {
+            static char buf[256];
+
+            if (loadPopcornSchedule(argv[1],buf,sizeof(buf)) == C_ERR) {
+                err = buf;
+                goto loaderr;
+            }
+            zfree(server.popcorn_schedule);
+            server.popcorn_schedule = argv[1][0] ? zstrdup(argv[1]) : NULL;
         } else if (!strcasecmp(argv[0],"user") && argc >= 2) {
             int argc_err;
             if (ACLAppendUserForLoading(argv,argc,&argc_err) == C_ERR) {
@@ -965,6 +1194,16 @@ void configSetCommand(client *c) {
     } config_set_special_field("masterauth") {
         zfree(server.masterauth);
         server.masterauth = ((char*)o->ptr)[0] ? zstrdup(o->ptr) : NULL;
+    } config_set_special_field("popcorn-schedule") {
+        char buf[256];
+
+        /* Setting the same file again reloads it. */
+        if (loadPopcornSchedule(o->ptr,buf,sizeof(buf)) == C_ERR) {
+            addReplyError(c,buf);
+            return;
+        }
+        zfree(server.popcorn_schedule);
+        server.popcorn_schedule = ((char*)o->ptr)[0] ? zstrdup(o->ptr) : NULL;
     } config_set_special_field("cluster-announce-ip") {
         zfree(server.cluster_announce_ip);
         server.cluster_announce_ip = ((char*)o->ptr)[0] ? zstrdup(o->ptr) : NULL;
@@ -1111,16 +1350,22 @@ void configSetCommand(client *c) {
       "repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay) {
     } config_set_bool_field(
       "repl-diskless-sync",server.repl_diskless_sync) {
+    } config_set_bool_field(
+      "repl-diskless-compression",server.repl_diskless_compression) {
     } config_set_bool_field(
       "cluster-require-full-coverage",server.cluster_require_full_coverage) {
     } config_set_bool_field(
       "cluster-slave-no-failover",server.cluster_slave_no_failover) {
     } config_set_bool_field(
       "cluster-replica-no-failover",server.cluster_slave_no_failover) {
+    } config_set_bool_field(
+      "cluster-gossip-delta",server.cluster_gossip_delta) {
     } config_set_bool_field(
       "aof-rewrite-incremental-fsync",server.aof_rewrite_incremental_fsync) {
     } config_set_bool_field(
       "rdb-save-incremental-fsync",server.rdb_save_incremental_fsync) {
+    } config_set_bool_field(
+      "rdb-save-forkless",server.rdb_save_forkless) {
     } config_set_bool_field(
       "aof-load-truncated",server.aof_load_truncated) {
     } config_set_bool_field(
@@ -1152,6 +1397,8 @@ void configSetCommand(client *c) {
             return;
         }
 #endif
+    } config_set_bool_field(
+      "active-defrag-threaded",server.active_defrag_threaded) {
     } config_set_bool_field(
       "protected-mode",server.protected_mode) {
     } config_set_bool_field(
@@ -1164,12 +1411,27 @@ void configSetCommand(client *c) {
       "lazyfree-lazy-expire",server.lazyfree_lazy_expire) {
     } config_set_bool_field(
       "lazyfree-lazy-server-del",server.lazyfree_lazy_server_del) {
+    } config_set_bool_field(
+      "active-expire-index",server.active_expire_index) {
+        expireIndexConfigure();
+    } config_set_bool_field(
+      "io-uring-writes",server.io_uring_writes) {
+    } config_set_bool_field(
+      "io-threads-do-commands",server.io_threads_do_commands) {
+    } config_set_bool_field(
+      "io-threads-shard-by-slot",server.io_threads_shard_by_slot) {
+    } config_set_bool_field(
+      "hll-simd",server.hll_simd) {
+    } config_set_bool_field(
+      "zset-btree",server.zset_btree) {
     } config_set_bool_field(
       "slave-lazy-flush",server.repl_slave_lazy_flush) {
     } config_set_bool_field(
       "replica-lazy-flush",server.repl_slave_lazy_flush) {
     } config_set_bool_field(
       "no-appendfsync-on-rewrite",server.aof_no_fsync_on_rewrite) {
+    } config_set_bool_field(
+      "aof-group-commit",server.aof_group_commit) {
     } config_set_bool_field(
       "dynamic-hz",server.dynamic_hz) {
 
@@ -1179,8 +1441,20 @@ void configSetCommand(client *c) {
       "tcp-keepalive",server.tcpkeepalive,0,INT_MAX) {
     } config_set_numerical_field(
       "maxmemory-samples",server.maxmemory_samples,1,INT_MAX) {
+    } config_set_numerical_field(
+      "maxmemory-eviction-batch",server.maxmemory_eviction_batch,1,CONFIG_MAX_MAXMEMORY_EVICTION_BATCH) {
+        evictionPoolResize();
     } config_set_numerical_field(
       "lfu-log-factor",server.lfu_log_factor,0,INT_MAX) {
+    } config_set_numerical_field(
+      "popcorn-migrate-node",server.popcorn_migrate_node,-1,INT_MAX) {
+        updatePopcornMigrationPolicy();
+    } config_set_numerical_field(
+      "popcorn-bio-node",server.popcorn_bio_node,-1,INT_MAX) {
+    } config_set_numerical_field(
+      "io-threads-node",server.io_threads_node,-1,INT_MAX) {
+    } config_set_numerical_field(
+      "io-threads-spin",server.io_threads_spin,0,INT_MAX) {
     } config_set_numerical_field(
       "lfu-decay-time",server.lfu_decay_time,0,INT_MAX) {
     } config_set_numerical_field(
@@ -1195,6 +1469,14 @@ void configSetCommand(client *c) {
       "active-defrag-cycle-min",server.active_defrag_cycle_min,1,99) {
     } config_set_numerical_field(
       "active-defrag-cycle-max",server.active_defrag_cycle_max,1,99) {
+    } config_set_numerical_field(
+      "activerehashing-max-ms",server.activerehashing_max_ms,1,1000) {
+    } config_set_numerical_field(
+      "rdb-save-threads",server.rdb_save_threads,1,RDB_SAVE_THREADS_MAX) {
+    } config_set_numerical_field(
+      "rdb-load-threads",server.rdb_load_threads,1,RDB_LOAD_THREADS_MAX) {
+    } config_set_numerical_field(
+      "rdb-save-forkless-cpu",server.rdb_save_forkless_cpu,1,100) {
     } config_set_numerical_field(
       "active-defrag-max-scan-fields",server.active_defrag_max_scan_fields,1,LONG_MAX) {
     } config_set_numerical_field(
@@ -1203,6 +1485,8 @@ void configSetCommand(client *c) {
       "hash-max-ziplist-entries",server.hash_max_ziplist_entries,0,LONG_MAX) {
     } config_set_numerical_field(
       "hash-max-ziplist-value",server.hash_max_ziplist_value,0,LONG_MAX) {
+    } config_set_numerical_field(
+      "hash-max-intmap-entries",server.hash_max_intmap_entries,0,INT_MAX) {
     } config_set_numerical_field(
       "stream-node-max-bytes",server.stream_node_max_bytes,0,LONG_MAX) {
     } config_set_numerical_field(
@@ -1229,6 +1513,8 @@ void configSetCommand(client *c) {
         server.slowlog_max_len = (unsigned long)ll;
     } config_set_numerical_field(
       "latency-monitor-threshold",server.latency_monitor_threshold,0,LLONG_MAX){
+    } config_set_numerical_field(
+      "hotkeys-sample-rate",server.hotkeys_sample_rate,0,100) {
     } config_set_numerical_field(
       "repl-ping-slave-period",server.repl_ping_slave_period,1,INT_MAX) {
     } config_set_numerical_field(
@@ -1239,6 +1525,8 @@ void configSetCommand(client *c) {
       "repl-backlog-ttl",server.repl_backlog_time_limit,0,LONG_MAX) {
     } config_set_numerical_field(
       "repl-diskless-sync-delay",server.repl_diskless_sync_delay,0,INT_MAX) {
+    } config_set_numerical_field(
+      "repl-diskless-sync-max-replicas",server.repl_diskless_sync_max_replicas,0,INT_MAX) {
     } config_set_numerical_field(
       "slave-priority",server.slave_priority,0,INT_MAX) {
     } config_set_numerical_field(
@@ -1297,6 +1585,8 @@ void configSetCommand(client *c) {
       "proto-max-bulk-len",server.proto_max_bulk_len) {
     } config_set_memory_field(
       "client-query-buffer-limit",server.client_max_querybuf_len) {
+    } config_set_memory_field(
+      "client-output-buffer-pause",server.client_obuf_pause) {
     } config_set_memory_field("repl-backlog-size",ll) {
         resizeReplicationBacklog(ll);
     } config_set_memory_field("auto-aof-rewrite-min-size",ll) {
@@ -1310,6 +1600,19 @@ void configSetCommand(client *c) {
       "maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum) {
     } config_set_enum_field(
       "appendfsync",server.aof_fsync,aof_fsync_enum) {
+    } config_set_enum_field(
+      "popcorn-migrate-policy",server.popcorn_migrate_policy,
+      popcorn_migrate_policy_enum) {
+        updatePopcornMigrationPolicy();
+    } config_set_enum_field(
+      "popcorn-cron-keyspace",server.popcorn_cron_keyspace,
+      popcorn_cron_keyspace_enum) {
+    } config_set_enum_field(
+      "list-compress-codec",server.list_compress_codec,compress_codec_enum) {
+        quicklistSetCompressCodec(server.list_compress_codec);
+    } config_set_enum_field(
+      "rdb-compression-codec",server.rdb_compression_codec,
+      compress_codec_enum) {
 
     /* Everyhing else is an error... */
     } config_set_else {
@@ -1381,6 +1684,7 @@ void configGetCommand(client *c) {
     config_get_string_field("unixsocket",server.unixsocket);
     config_get_string_field("logfile",server.logfile);
     config_get_string_field("aclfile",server.acl_filename);
+    config_get_string_field("popcorn-schedule",server.popcorn_schedule);
     config_get_string_field("pidfile",server.pidfile);
     config_get_string_field("slave-announce-ip",server.slave_announce_ip);
     config_get_string_field("replica-announce-ip",server.slave_announce_ip);
@@ -1389,8 +1693,14 @@ void configGetCommand(client *c) {
     config_get_numerical_field("maxmemory",server.maxmemory);
     config_get_numerical_field("proto-max-bulk-len",server.proto_max_bulk_len);
     config_get_numerical_field("client-query-buffer-limit",server.client_max_querybuf_len);
+    config_get_numerical_field("client-output-buffer-pause",server.client_obuf_pause);
     config_get_numerical_field("maxmemory-samples",server.maxmemory_samples);
+    config_get_numerical_field("maxmemory-eviction-batch",server.maxmemory_eviction_batch);
     config_get_numerical_field("lfu-log-factor",server.lfu_log_factor);
+    config_get_numerical_field("popcorn-migrate-node",server.popcorn_migrate_node);
+    config_get_numerical_field("popcorn-bio-node",server.popcorn_bio_node);
+    config_get_numerical_field("io-threads-node",server.io_threads_node);
+    config_get_numerical_field("io-threads-spin",server.io_threads_spin);
     config_get_numerical_field("lfu-decay-time",server.lfu_decay_time);
     config_get_numerical_field("timeout",server.maxidletime);
     config_get_numerical_field("active-defrag-threshold-lower",server.active_defrag_threshold_lower);
@@ -1398,6 +1708,10 @@ void configGetCommand(client *c) {
     config_get_numerical_field("active-defrag-ignore-bytes",server.active_defrag_ignore_bytes);
     config_get_numerical_field("active-defrag-cycle-min",server.active_defrag_cycle_min);
     config_get_numerical_field("active-defrag-cycle-max",server.active_defrag_cycle_max);
+    config_get_numerical_field("activerehashing-max-ms",server.activerehashing_max_ms);
+    config_get_numerical_field("rdb-save-threads",server.rdb_save_threads);
+    config_get_numerical_field("rdb-load-threads",server.rdb_load_threads);
+    config_get_numerical_field("rdb-save-forkless-cpu",server.rdb_save_forkless_cpu);
     config_get_numerical_field("active-defrag-max-scan-fields",server.active_defrag_max_scan_fields);
     config_get_numerical_field("auto-aof-rewrite-percentage",
             server.aof_rewrite_perc);
@@ -1407,6 +1721,8 @@ void configGetCommand(client *c) {
             server.hash_max_ziplist_entries);
     config_get_numerical_field("hash-max-ziplist-value",
             server.hash_max_ziplist_value);
+    config_get_numerical_field("hash-max-intmap-entries",
+            server.hash_max_intmap_entries);
     config_get_numerical_field("stream-node-max-bytes",
             server.stream_node_max_bytes);
     config_get_numerical_field("stream-node-max-entries",
@@ -1428,6 +1744,8 @@ void configGetCommand(client *c) {
             server.slowlog_log_slower_than);
     config_get_numerical_field("latency-monitor-threshold",
             server.latency_monitor_threshold);
+    config_get_numerical_field("hotkeys-sample-rate",
+            server.hotkeys_sample_rate);
     config_get_numerical_field("slowlog-max-len",
             server.slowlog_max_len);
     config_get_numerical_field("port",server.port);
@@ -1436,6 +1754,8 @@ void configGetCommand(client *c) {
     config_get_numerical_field("tcp-backlog",server.tcp_backlog);
     config_get_numerical_field("databases",server.dbnum);
     config_get_numerical_field("io-threads",server.io_threads_num);
+    config_get_numerical_field("module-worker-threads",
+            server.module_worker_threads);
     config_get_numerical_field("repl-ping-slave-period",server.repl_ping_slave_period);
     config_get_numerical_field("repl-ping-replica-period",server.repl_ping_slave_period);
     config_get_numerical_field("repl-timeout",server.repl_timeout);
@@ -1457,6 +1777,7 @@ void configGetCommand(client *c) {
     config_get_numerical_field("cluster-slave-validity-factor",server.cluster_slave_validity_factor);
     config_get_numerical_field("cluster-replica-validity-factor",server.cluster_slave_validity_factor);
     config_get_numerical_field("repl-diskless-sync-delay",server.repl_diskless_sync_delay);
+    config_get_numerical_field("repl-diskless-sync-max-replicas",server.repl_diskless_sync_max_replicas);
     config_get_numerical_field("tcp-keepalive",server.tcpkeepalive);
 
     /* Bool (yes/no) values */
@@ -1466,8 +1787,12 @@ void configGetCommand(client *c) {
             server.cluster_slave_no_failover);
     config_get_bool_field("cluster-replica-no-failover",
             server.cluster_slave_no_failover);
+    config_get_bool_field("cluster-gossip-delta",
+            server.cluster_gossip_delta);
     config_get_bool_field("no-appendfsync-on-rewrite",
             server.aof_no_fsync_on_rewrite);
+    config_get_bool_field("aof-group-commit",
+            server.aof_group_commit);
     config_get_bool_field("slave-serve-stale-data",
             server.repl_serve_stale_data);
     config_get_bool_field("replica-serve-stale-data",
@@ -1486,18 +1811,35 @@ void configGetCommand(client *c) {
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
     config_get_bool_field("activerehashing", server.activerehashing);
+    config_get_bool_field("keyspace-open-addressing",
+            server.keyspace_open_addressing);
     config_get_bool_field("activedefrag", server.active_defrag_enabled);
+    config_get_bool_field("active-defrag-threaded",
+            server.active_defrag_threaded);
     config_get_bool_field("protected-mode", server.protected_mode);
     config_get_bool_field("gopher-enabled", server.gopher_enabled);
     config_get_bool_field("io-threads-do-reads", server.io_threads_do_reads);
+    config_get_bool_field("jemalloc-thread-arenas",
+            server.jemalloc_thread_arenas);
+    config_get_bool_field("hugepage-dict-tables",
+            server.hugepage_dict_tables);
+    config_get_bool_field("io-uring-writes", server.io_uring_writes);
+    config_get_bool_field("io-threads-do-commands", server.io_threads_do_commands);
+    config_get_bool_field("io-threads-shard-by-slot", server.io_threads_shard_by_slot);
+    config_get_bool_field("hll-simd", server.hll_simd);
+    config_get_bool_field("zset-btree", server.zset_btree);
     config_get_bool_field("repl-disable-tcp-nodelay",
             server.repl_disable_tcp_nodelay);
     config_get_bool_field("repl-diskless-sync",
             server.repl_diskless_sync);
+    config_get_bool_field("repl-diskless-compression",
+            server.repl_diskless_compression);
     config_get_bool_field("aof-rewrite-incremental-fsync",
             server.aof_rewrite_incremental_fsync);
     config_get_bool_field("rdb-save-incremental-fsync",
             server.rdb_save_incremental_fsync);
+    config_get_bool_field("rdb-save-forkless",
+            server.rdb_save_forkless);
     config_get_bool_field("aof-load-truncated",
             server.aof_load_truncated);
     config_get_bool_field("aof-use-rdb-preamble",
@@ -1508,6 +1850,8 @@ void configGetCommand(client *c) {
             server.lazyfree_lazy_expire);
     config_get_bool_field("lazyfree-lazy-server-del",
             server.lazyfree_lazy_server_del);
+    config_get_bool_field("active-expire-index",
+            server.active_expire_index);
     config_get_bool_field("slave-lazy-flush",
             server.repl_slave_lazy_flush);
     config_get_bool_field("replica-lazy-flush",
@@ -1526,6 +1870,14 @@ void configGetCommand(client *c) {
             server.aof_fsync,aof_fsync_enum);
     config_get_enum_field("syslog-facility",
             server.syslog_facility,syslog_facility_enum);
+    config_get_enum_field("popcorn-migrate-policy",
+            server.popcorn_migrate_policy,popcorn_migrate_policy_enum);
+    config_get_enum_field("popcorn-cron-keyspace",
+            server.popcorn_cron_keyspace,popcorn_cron_keyspace_enum);
+    config_get_enum_field("list-compress-codec",
+            server.list_compress_codec,compress_codec_enum);
+    config_get_enum_field("rdb-compression-codec",
+            server.rdb_compression_codec,compress_codec_enum);
 
     /* Everything we can't handle with macros follows. */
 
@@ -2250,8 +2602,14 @@ int rewriteConfig(char *path) {
     rewriteConfigUserOption(state);
     rewriteConfigNumericalOption(state,"databases",server.dbnum,CONFIG_DEFAULT_DBNUM);
     rewriteConfigNumericalOption(state,"io-threads",server.dbnum,CONFIG_DEFAULT_IO_THREADS_NUM);
+    rewriteConfigNumericalOption(state,"module-worker-threads",server.module_worker_threads,CONFIG_DEFAULT_MODULE_WORKER_THREADS);
     rewriteConfigYesNoOption(state,"stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err,CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR);
     rewriteConfigYesNoOption(state,"rdbcompression",server.rdb_compression,CONFIG_DEFAULT_RDB_COMPRESSION);
+    rewriteConfigEnumOption(state,"rdb-compression-codec",server.rdb_compression_codec,compress_codec_enum,CONFIG_DEFAULT_RDB_COMPRESSION_CODEC);
+    rewriteConfigNumericalOption(state,"rdb-save-threads",server.rdb_save_threads,CONFIG_DEFAULT_RDB_SAVE_THREADS);
+    rewriteConfigNumericalOption(state,"rdb-load-threads",server.rdb_load_threads,CONFIG_DEFAULT_RDB_LOAD_THREADS);
+    rewriteConfigYesNoOption(state,"rdb-save-forkless",server.rdb_save_forkless,CONFIG_DEFAULT_RDB_SAVE_FORKLESS);
+    rewriteConfigNumericalOption(state,"rdb-save-forkless-cpu",server.rdb_save_forkless_cpu,CONFIG_DEFAULT_RDB_SAVE_FORKLESS_CPU);
     rewriteConfigYesNoOption(state,"rdbchecksum",server.rdb_checksum,CONFIG_DEFAULT_RDB_CHECKSUM);
     rewriteConfigStringOption(state,"dbfilename",server.rdb_filename,CONFIG_DEFAULT_RDB_FILENAME);
     rewriteConfigDirOption(state);
@@ -2270,6 +2628,8 @@ int rewriteConfig(char *path) {
     rewriteConfigYesNoOption(state,"repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay,CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY);
     rewriteConfigYesNoOption(state,"repl-diskless-sync",server.repl_diskless_sync,CONFIG_DEFAULT_REPL_DISKLESS_SYNC);
     rewriteConfigNumericalOption(state,"repl-diskless-sync-delay",server.repl_diskless_sync_delay,CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY);
+    rewriteConfigNumericalOption(state,"repl-diskless-sync-max-replicas",server.repl_diskless_sync_max_replicas,CONFIG_DEFAULT_REPL_DISKLESS_SYNC_MAX_REPLICAS);
+    rewriteConfigYesNoOption(state,"repl-diskless-compression",server.repl_diskless_compression,CONFIG_DEFAULT_REPL_DISKLESS_COMPRESSION);
     rewriteConfigNumericalOption(state,"replica-priority",server.slave_priority,CONFIG_DEFAULT_SLAVE_PRIORITY);
     rewriteConfigNumericalOption(state,"min-replicas-to-write",server.repl_min_slaves_to_write,CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE);
     rewriteConfigNumericalOption(state,"min-replicas-max-lag",server.repl_min_slaves_max_lag,CONFIG_DEFAULT_MIN_SLAVES_MAX_LAG);
@@ -2278,8 +2638,10 @@ int rewriteConfig(char *path) {
     rewriteConfigBytesOption(state,"maxmemory",server.maxmemory,CONFIG_DEFAULT_MAXMEMORY);
     rewriteConfigBytesOption(state,"proto-max-bulk-len",server.proto_max_bulk_len,CONFIG_DEFAULT_PROTO_MAX_BULK_LEN);
     rewriteConfigBytesOption(state,"client-query-buffer-limit",server.client_max_querybuf_len,PROTO_MAX_QUERYBUF_LEN);
+    rewriteConfigBytesOption(state,"client-output-buffer-pause",server.client_obuf_pause,CONFIG_DEFAULT_CLIENT_OBUF_PAUSE);
     rewriteConfigEnumOption(state,"maxmemory-policy",server.maxmemory_policy,maxmemory_policy_enum,CONFIG_DEFAULT_MAXMEMORY_POLICY);
     rewriteConfigNumericalOption(state,"maxmemory-samples",server.maxmemory_samples,CONFIG_DEFAULT_MAXMEMORY_SAMPLES);
+    rewriteConfigNumericalOption(state,"maxmemory-eviction-batch",server.maxmemory_eviction_batch,CONFIG_DEFAULT_MAXMEMORY_EVICTION_BATCH);
     rewriteConfigNumericalOption(state,"lfu-log-factor",server.lfu_log_factor,CONFIG_DEFAULT_LFU_LOG_FACTOR);
     rewriteConfigNumericalOption(state,"lfu-decay-time",server.lfu_decay_time,CONFIG_DEFAULT_LFU_DECAY_TIME);
     rewriteConfigNumericalOption(state,"active-defrag-threshold-lower",server.active_defrag_threshold_lower,CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER);
@@ -2292,6 +2654,7 @@ int rewriteConfig(char *path) {
     rewriteConfigStringOption(state,"appendfilename",server.aof_filename,CONFIG_DEFAULT_AOF_FILENAME);
     rewriteConfigEnumOption(state,"appendfsync",server.aof_fsync,aof_fsync_enum,CONFIG_DEFAULT_AOF_FSYNC);
     rewriteConfigYesNoOption(state,"no-appendfsync-on-rewrite",server.aof_no_fsync_on_rewrite,CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE);
+    rewriteConfigYesNoOption(state,"aof-group-commit",server.aof_group_commit,CONFIG_DEFAULT_AOF_GROUP_COMMIT);
     rewriteConfigNumericalOption(state,"auto-aof-rewrite-percentage",server.aof_rewrite_perc,AOF_REWRITE_PERC);
     rewriteConfigBytesOption(state,"auto-aof-rewrite-min-size",server.aof_rewrite_min_size,AOF_REWRITE_MIN_SIZE);
     rewriteConfigNumericalOption(state,"lua-time-limit",server.lua_time_limit,LUA_SCRIPT_TIME_LIMIT);
@@ -2299,28 +2662,44 @@ int rewriteConfig(char *path) {
     rewriteConfigStringOption(state,"cluster-config-file",server.cluster_configfile,CONFIG_DEFAULT_CLUSTER_CONFIG_FILE);
     rewriteConfigYesNoOption(state,"cluster-require-full-coverage",server.cluster_require_full_coverage,CLUSTER_DEFAULT_REQUIRE_FULL_COVERAGE);
     rewriteConfigYesNoOption(state,"cluster-replica-no-failover",server.cluster_slave_no_failover,CLUSTER_DEFAULT_SLAVE_NO_FAILOVER);
+    rewriteConfigYesNoOption(state,"cluster-gossip-delta",server.cluster_gossip_delta,CLUSTER_DEFAULT_GOSSIP_DELTA);
     rewriteConfigNumericalOption(state,"cluster-node-timeout",server.cluster_node_timeout,CLUSTER_DEFAULT_NODE_TIMEOUT);
     rewriteConfigNumericalOption(state,"cluster-migration-barrier",server.cluster_migration_barrier,CLUSTER_DEFAULT_MIGRATION_BARRIER);
     rewriteConfigNumericalOption(state,"cluster-replica-validity-factor",server.cluster_slave_validity_factor,CLUSTER_DEFAULT_SLAVE_VALIDITY);
     rewriteConfigNumericalOption(state,"slowlog-log-slower-than",server.slowlog_log_slower_than,CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN);
     rewriteConfigNumericalOption(state,"latency-monitor-threshold",server.latency_monitor_threshold,CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD);
+    rewriteConfigNumericalOption(state,"hotkeys-sample-rate",server.hotkeys_sample_rate,CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE);
     rewriteConfigNumericalOption(state,"slowlog-max-len",server.slowlog_max_len,CONFIG_DEFAULT_SLOWLOG_MAX_LEN);
     rewriteConfigNotifykeyspaceeventsOption(state);
     rewriteConfigNumericalOption(state,"hash-max-ziplist-entries",server.hash_max_ziplist_entries,OBJ_HASH_MAX_ZIPLIST_ENTRIES);
     rewriteConfigNumericalOption(state,"hash-max-ziplist-value",server.hash_max_ziplist_value,OBJ_HASH_MAX_ZIPLIST_VALUE);
+    rewriteConfigNumericalOption(state,"hash-max-intmap-entries",server.hash_max_intmap_entries,OBJ_HASH_MAX_INTMAP_ENTRIES);
     rewriteConfigNumericalOption(state,"stream-node-max-bytes",server.stream_node_max_bytes,OBJ_STREAM_NODE_MAX_BYTES);
     rewriteConfigNumericalOption(state,"stream-node-max-entries",server.stream_node_max_entries,OBJ_STREAM_NODE_MAX_ENTRIES);
     rewriteConfigNumericalOption(state,"list-max-ziplist-size",server.list_max_ziplist_size,OBJ_LIST_MAX_ZIPLIST_SIZE);
     rewriteConfigNumericalOption(state,"list-compress-depth",server.list_compress_depth,OBJ_LIST_COMPRESS_DEPTH);
+    rewriteConfigEnumOption(state,"list-compress-codec",server.list_compress_codec,compress_codec_enum,OBJ_LIST_COMPRESS_CODEC);
     rewriteConfigNumericalOption(state,"set-max-intset-entries",server.set_max_intset_entries,OBJ_SET_MAX_INTSET_ENTRIES);
     rewriteConfigNumericalOption(state,"zset-max-ziplist-entries",server.zset_max_ziplist_entries,OBJ_ZSET_MAX_ZIPLIST_ENTRIES);
     rewriteConfigNumericalOption(state,"zset-max-ziplist-value",server.zset_max_ziplist_value,OBJ_ZSET_MAX_ZIPLIST_VALUE);
+    rewriteConfigYesNoOption(state,"zset-btree",server.zset_btree,CONFIG_DEFAULT_ZSET_BTREE);
     rewriteConfigNumericalOption(state,"hll-sparse-max-bytes",server.hll_sparse_max_bytes,CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES);
+    rewriteConfigYesNoOption(state,"hll-simd",server.hll_simd,CONFIG_DEFAULT_HLL_SIMD);
     rewriteConfigYesNoOption(state,"activerehashing",server.activerehashing,CONFIG_DEFAULT_ACTIVE_REHASHING);
+    rewriteConfigNumericalOption(state,"activerehashing-max-ms",server.activerehashing_max_ms,CONFIG_DEFAULT_ACTIVE_REHASHING_MAX_MS);
+    rewriteConfigYesNoOption(state,"keyspace-open-addressing",server.keyspace_open_addressing,CONFIG_DEFAULT_KEYSPACE_OPEN_ADDRESSING);
     rewriteConfigYesNoOption(state,"activedefrag",server.active_defrag_enabled,CONFIG_DEFAULT_ACTIVE_DEFRAG);
+    rewriteConfigYesNoOption(state,"active-defrag-threaded",server.active_defrag_threaded,CONFIG_DEFAULT_ACTIVE_DEFRAG_THREADED);
     rewriteConfigYesNoOption(state,"protected-mode",server.protected_mode,CONFIG_DEFAULT_PROTECTED_MODE);
     rewriteConfigYesNoOption(state,"gopher-enabled",server.gopher_enabled,CONFIG_DEFAULT_GOPHER_ENABLED);
     rewriteConfigYesNoOption(state,"io-threads-do-reads",server.io_threads_do_reads,CONFIG_DEFAULT_IO_THREADS_DO_READS);
+    rewriteConfigYesNoOption(state,"jemalloc-thread-arenas",server.jemalloc_thread_arenas,CONFIG_DEFAULT_JEMALLOC_THREAD_ARENAS);
+    rewriteConfigYesNoOption(state,"hugepage-dict-tables",server.hugepage_dict_tables,CONFIG_DEFAULT_HUGEPAGE_DICT_TABLES);
+    rewriteConfigYesNoOption(state,"io-uring-writes",server.io_uring_writes,CONFIG_DEFAULT_IO_URING_WRITES);
+    rewriteConfigYesNoOption(state,"io-threads-do-commands",server.io_threads_do_commands,CONFIG_DEFAULT_IO_THREADS_DO_COMMANDS);
+    rewriteConfigYesNoOption(state,"io-threads-shard-by-slot",server.io_threads_shard_by_slot,CONFIG_DEFAULT_IO_THREADS_SHARD_BY_SLOT);
+    rewriteConfigNumericalOption(state,"io-threads-node",server.io_threads_node,CONFIG_DEFAULT_IO_THREADS_NODE);
+    rewriteConfigNumericalOption(state,"io-threads-spin",server.io_threads_spin,CONFIG_DEFAULT_IO_THREADS_SPIN);
     rewriteConfigClientoutputbufferlimitOption(state);
     rewriteConfigNumericalOption(state,"hz",server.config_hz,CONFIG_DEFAULT_HZ);
     rewriteConfigYesNoOption(state,"aof-rewrite-incremental-fsync",server.aof_rewrite_incremental_fsync,CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC);
@@ -2331,8 +2710,14 @@ int rewriteConfig(char *path) {
     rewriteConfigYesNoOption(state,"lazyfree-lazy-eviction",server.lazyfree_lazy_eviction,CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-expire",server.lazyfree_lazy_expire,CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE);
     rewriteConfigYesNoOption(state,"lazyfree-lazy-server-del",server.lazyfree_lazy_server_del,CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL);
+    rewriteConfigYesNoOption(state,"active-expire-index",server.active_expire_index,CONFIG_DEFAULT_ACTIVE_EXPIRE_INDEX);
     rewriteConfigYesNoOption(state,"replica-lazy-flush",server.repl_slave_lazy_flush,CONFIG_DEFAULT_SLAVE_LAZY_FLUSH);
     rewriteConfigYesNoOption(state,"dynamic-hz",server.dynamic_hz,CONFIG_DEFAULT_DYNAMIC_HZ);
+    rewriteConfigEnumOption(state,"popcorn-migrate-policy",server.popcorn_migrate_policy,popcorn_migrate_policy_enum,CONFIG_DEFAULT_POPCORN_MIGRATE_POLICY);
+    rewriteConfigNumericalOption(state,"popcorn-migrate-node",server.popcorn_migrate_node,CONFIG_DEFAULT_POPCORN_MIGRATE_NODE);
+    rewriteConfigNumericalOption(state,"popcorn-bio-node",server.popcorn_bio_node,CONFIG_DEFAULT_POPCORN_BIO_NODE);
+    rewriteConfigEnumOption(state,"popcorn-cron-keyspace",server.popcorn_cron_keyspace,popcorn_cron_keyspace_enum,CONFIG_DEFAULT_POPCORN_CRON_KEYSPACE);
+    rewriteConfigStringOption(state,"popcorn-schedule",server.popcorn_schedule,NULL);
 
     /* Rewrite Sentinel config if in Sentinel mode. */
     if (server.sentinel_mode) rewriteConfigSentinelOption(state);
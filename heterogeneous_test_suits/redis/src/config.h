@@ -78,6 +78,18 @@
 #define HAVE_EPOLL 1
 #endif
 
+/* Test for io_uring, used to batch the writes to the clients. */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+/* The io_uring event loop (ae_iouring.c) is built with USE_AE_IOURING. */
+#if defined(HAVE_IO_URING) && defined(USE_AE_IOURING)
+#define HAVE_AE_IOURING 1
+#endif
+
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #define HAVE_KQUEUE 1
 #endif
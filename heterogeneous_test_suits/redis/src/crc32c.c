@@ -0,0 +1,209 @@
+/* crc32c.c -- CRC32C (Castagnoli), with the CRC instructions if available.
+ *
+ * This is the CRC of iSCSI, ext4 and SSE 4.2 / ARMv8: poly 0x1EDC6F41,
+ * reflected, init and xor out 0xffffffff. Check("123456789") is 0xe3069283.
+ * It is not a replacement for the CRC64 of the RDB and DUMP formats, whose
+ * value is part of the format, but it is the cheaper choice for checksums
+ * internal to the server: with SSE 4.2 on x86-64 and the CRC extension of
+ * ARMv8 it runs at several bytes per cycle.
+ *
+ * Every path computes the same values, so a CRC can be started on a node
+ * and continued on another one of a different ISA. Only the choice of the
+ * path is per node: it is cached per thread and reset by crc32cReset()
+ * after every migration of the event loop thread.
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "crc32c.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+#define CRC32C_POLY 0x82f63b78 /* Reflected 0x1EDC6F41. */
+
+/* Slicing-by-8 tables of the software path, built by crc32c_init(). */
+static uint32_t crc32c_table[8][256];
+static int crc32c_table_ready = 0;
+
+/* Whether the node running the thread has the CRC instructions, -1 if not
+ * checked yet. */
+static __thread int crc32c_hw = -1;
+
+/* Build the tables of the software path. Must be called before any thread
+ * uses crc32c(). */
+void crc32c_init(void) {
+    int j, k;
+
+    if (crc32c_table_ready) return;
+    for (j = 0; j < 256; j++) {
+        uint32_t c = j;
+        for (k = 0; k < 8; k++) c = (c >> 1) ^ (CRC32C_POLY & (0-(c & 1)));
+        crc32c_table[0][j] = c;
+    }
+    for (j = 0; j < 256; j++) {
+        for (k = 1; k < 8; k++) {
+            uint32_t c = crc32c_table[k-1][j];
+            crc32c_table[k][j] = crc32c_table[0][c & 0xff] ^ (c >> 8);
+        }
+    }
+    crc32c_table_ready = 1;
+}
+
+/* Forget whether the calling thread can use the CRC instructions. Called
+ * after the thread migrated, as the new node may be of another ISA. */
+void crc32cReset(void) {
+    crc32c_hw = -1;
+}
+
+static int crc32cHwSupported(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#elif defined(__aarch64__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return 0;
+#endif
+}
+
+/* Software path, 8 bytes at a time on little endian. 'crc' is not
+ * inverted here, the caller does it. */
+static uint32_t crc32cSw(uint32_t crc, const unsigned char *p, size_t len) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8) {
+        uint64_t w;
+
+        memcpy(&w,p,sizeof(w));
+        w ^= crc;
+        crc = crc32c_table[7][w & 0xff] ^
+              crc32c_table[6][(w >> 8) & 0xff] ^
+              crc32c_table[5][(w >> 16) & 0xff] ^
+              crc32c_table[4][(w >> 24) & 0xff] ^
+              crc32c_table[3][(w >> 32) & 0xff] ^
+              crc32c_table[2][(w >> 40) & 0xff] ^
+              crc32c_table[1][(w >> 48) & 0xff] ^
+              crc32c_table[0][w >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len--) crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHw(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = crc;
+
+    while (len >= 8) {
+        uint64_t w;
+
+        memcpy(&w,p,sizeof(w));
+        c = _mm_crc32_u64(c,w);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+    while (len--) crc = _mm_crc32_u8(crc,*p++);
+    return crc;
+}
+#elif defined(__aarch64__)
+#ifdef __clang__
+__attribute__((target("crc")))
+#else
+__attribute__((target("+crc")))
+#endif
+static uint32_t crc32cHw(uint32_t crc, const unsigned char *p, size_t len) {
+    while (len >= 8) {
+        uint64_t w;
+
+        memcpy(&w,p,sizeof(w));
+        crc = __crc32cd(crc,w);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = __crc32cb(crc,*p++);
+    return crc;
+}
+#endif
+
+/* Update 'crc' with the 'len' bytes at 'buf'. Start with a 'crc' of 0. */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+
+    crc = ~crc;
+#if defined(__x86_64__) || defined(__aarch64__)
+    if (crc32c_hw < 0) crc32c_hw = crc32cHwSupported();
+    if (crc32c_hw) return ~crc32cHw(crc,p,len);
+#endif
+    return ~crc32cSw(crc,p,len);
+}
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+
+#define UNUSED(x) (void)(x)
+int crc32cTest(int argc, char *argv[]) {
+    unsigned char buf[1000];
+    uint32_t sw, hw;
+    int j, fails = 0;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    crc32c_init();
+    printf("e3069283 == %08x\n", crc32c(0,"123456789",9));
+    if (crc32c(0,"123456789",9) != 0xe3069283) fails++;
+
+    /* The software and the hardware paths must agree, for every length
+     * and alignment, and when the CRC is computed in pieces. */
+    for (j = 0; j < (int)sizeof(buf); j++) buf[j] = (j*131) ^ (j >> 3);
+    for (j = 0; j < 64; j++) {
+        int len = sizeof(buf)-j-(j*7)%16;
+
+        crc32c_hw = 0;
+        sw = crc32c(0,buf+j,len);
+        crc32cReset();
+        hw = crc32c(crc32c(0,buf+j,len/3),buf+j+len/3,len-len/3);
+        if (sw != hw) fails++;
+    }
+    printf("CRC instructions: %s\n", crc32c_hw ? "yes" : "no");
+    printf("Software vs hardware CRC32C: %s\n", fails ? "FAILED" : "OK");
+    return fails != 0;
+}
+#endif
@@ -38,6 +38,9 @@
  * POSSIBILITY OF SUCH DAMAGE. */
 
 #include <stdint.h>
+#include <string.h>
+
+#include "crc64.h"
 
 static const uint64_t crc64_tab[256] = {
     UINT64_C(0x0000000000000000), UINT64_C(0x7ad870c830358979),
@@ -170,26 +173,133 @@ static const uint64_t crc64_tab[256] = {
     UINT64_C(0x536fa08fdfd90e51), UINT64_C(0x29b7d047efec8728),
 };
 
+/* Slicing-by-8 tables: crc64_slice[k][n] is the CRC of byte n followed by k
+ * zero bytes, so 8 bytes can be folded in at a time with 8 lookups. Built
+ * by crc64_init() from crc64_tab, which is crc64_slice[0]. */
+static uint64_t crc64_slice[8][256];
+static int crc64_slice_ready = 0;
+
+/* crc64_pow2[k] appends 2^k zero bytes to a CRC. The operator is linear
+ * over GF(2): crc64_pow2[k][j] is its result for the CRC with only the bit
+ * j set. Built by crc64_init(), used by crc64_combine(). */
+static uint64_t crc64_pow2[64][64];
+
+static uint64_t crc64_apply(const uint64_t *op, uint64_t crc) {
+    uint64_t sum = 0;
+    int j;
+
+    for (j = 0; crc; j++, crc >>= 1)
+        if (crc & 1) sum ^= op[j];
+    return sum;
+}
+
+/* Build the slicing-by-8 tables. Must be called before any thread uses
+ * crc64(), which falls back to a byte at a time until then. */
+void crc64_init(void) {
+    int j, k;
+
+    if (crc64_slice_ready) return;
+    for (j = 0; j < 256; j++) {
+        crc64_slice[0][j] = crc64_tab[j];
+        for (k = 1; k < 8; k++) {
+            uint64_t c = crc64_slice[k-1][j];
+            crc64_slice[k][j] = crc64_tab[(uint8_t)c] ^ (c >> 8);
+        }
+    }
+    for (j = 0; j < 64; j++) {
+        uint64_t c = UINT64_C(1) << j;
+        crc64_pow2[0][j] = crc64_tab[(uint8_t)c] ^ (c >> 8);
+    }
+    for (k = 1; k < 64; k++) {
+        for (j = 0; j < 64; j++)
+            crc64_pow2[k][j] = crc64_apply(crc64_pow2[k-1],
+                                           crc64_pow2[k-1][j]);
+    }
+    crc64_slice_ready = 1;
+}
+
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
-    uint64_t j;
+    uint64_t j = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (crc64_slice_ready) {
+        /* The CRC is reflected, so on little endian the 8 bytes loaded as
+         * a word line up with the low byte of the CRC first. */
+        for (; j+8 <= l; j += 8) {
+            uint64_t w;
 
-    for (j = 0; j < l; j++) {
+            memcpy(&w,s+j,sizeof(w));
+            crc ^= w;
+            crc = crc64_slice[7][crc & 0xff] ^
+                  crc64_slice[6][(crc >> 8) & 0xff] ^
+                  crc64_slice[5][(crc >> 16) & 0xff] ^
+                  crc64_slice[4][(crc >> 24) & 0xff] ^
+                  crc64_slice[3][(crc >> 32) & 0xff] ^
+                  crc64_slice[2][(crc >> 40) & 0xff] ^
+                  crc64_slice[1][(crc >> 48) & 0xff] ^
+                  crc64_slice[0][crc >> 56];
+        }
+    }
+#endif
+    for (; j < l; j++) {
         uint8_t byte = s[j];
         crc = crc64_tab[(uint8_t)crc ^ byte] ^ (crc >> 8);
     }
     return crc;
 }
 
+/* Return the CRC of A followed by B, given the CRC of A, the CRC of B and
+ * the length of B. The CRC of B, computed starting from 0, only misses the
+ * CRC of A carried through the bytes of B, that is through as many zero
+ * bytes. Needs crc64_init(). */
+uint64_t crc64_combine(uint64_t crc1, uint64_t crc2, uint64_t len2) {
+    int k;
+
+    for (k = 0; len2; k++, len2 >>= 1)
+        if (len2 & 1) crc1 = crc64_apply(crc64_pow2[k],crc1);
+    return crc1 ^ crc2;
+}
+
 /* Test main */
 #ifdef REDIS_TEST
 #include <stdio.h>
 
 #define UNUSED(x) (void)(x)
 int crc64Test(int argc, char *argv[]) {
+    unsigned char buf[1000];
+    uint64_t bytewise;
+    int j, fails = 0;
+
     UNUSED(argc);
     UNUSED(argv);
     printf("e9c6d914c4b8d9ca == %016llx\n",
         (unsigned long long) crc64(0,(unsigned char*)"123456789",9));
-    return 0;
+
+    /* The slicing-by-8 CRC must match the byte at a time one, for every
+     * length and alignment. */
+    for (j = 0; j < (int)sizeof(buf); j++) buf[j] = (j*131) ^ (j >> 3);
+    for (j = 0; j < 64; j++) {
+        int len = sizeof(buf)-j-(j*7)%16;
+
+        bytewise = crc64(0,buf+j,len);
+        crc64_init();
+        if (crc64(0,buf+j,len) != bytewise) fails++;
+        crc64_slice_ready = 0;
+    }
+    crc64_init();
+    printf("e9c6d914c4b8d9ca == %016llx\n",
+        (unsigned long long) crc64(0,(unsigned char*)"123456789",9));
+    printf("Slicing-by-8 vs byte at a time: %s\n", fails ? "FAILED" : "OK");
+
+    /* Combining the CRCs of the two parts of the buffer, split anywhere,
+     * must give the CRC of the whole buffer. */
+    bytewise = crc64(0,buf,sizeof(buf));
+    for (j = 0; j <= (int)sizeof(buf); j += 37) {
+        uint64_t crc1 = crc64(0,buf,j), crc2 = crc64(0,buf+j,sizeof(buf)-j);
+
+        if (crc64_combine(crc1,crc2,sizeof(buf)-j) != bytewise) fails++;
+    }
+    printf("Combined vs whole buffer: %s\n", fails ? "FAILED" : "OK");
+    return fails != 0;
 }
 #endif
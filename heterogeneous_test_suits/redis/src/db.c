@@ -76,6 +76,17 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
     }
 }
 
+/* Count a hit or a miss of a key lookup. The commands the I/O threads run
+ * count them apart, see ioThreadRunCommand(). */
+static void statKeyspaceLookup(int hit) {
+    if (server.keyspace_readonly)
+        ioThreadCountLookup(hit);
+    else if (hit)
+        server.stat_keyspace_hits++;
+    else
+        server.stat_keyspace_misses++;
+}
+
 /* Lookup a key for read operations, or return NULL if the key is not found
  * in the specified DB.
  *
@@ -104,9 +115,10 @@ robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
     if (expireIfNeeded(db,key) == 1) {
         /* Key expired. If we are in the context of a master, expireIfNeeded()
          * returns 0 only when the key does not exist at all, so it's safe
-         * to return NULL ASAP. */
-        if (server.masterhost == NULL) {
-            server.stat_keyspace_misses++;
+         * to return NULL ASAP. The commands the I/O threads run are read
+         * only, so the same goes for them on slaves. */
+        if (server.masterhost == NULL || server.keyspace_readonly) {
+            statKeyspaceLookup(0);
             notifyKeyspaceEvent(NOTIFY_KEY_MISS, "keymiss", key, db->id);
             return NULL;
         }
@@ -128,18 +140,18 @@ robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
             server.current_client->cmd &&
             server.current_client->cmd->flags & CMD_READONLY)
         {
-            server.stat_keyspace_misses++;
+            statKeyspaceLookup(0);
             notifyKeyspaceEvent(NOTIFY_KEY_MISS, "keymiss", key, db->id);
             return NULL;
         }
     }
     val = lookupKey(db,key,flags);
     if (val == NULL) {
-        server.stat_keyspace_misses++;
+        statKeyspaceLookup(0);
         notifyKeyspaceEvent(NOTIFY_KEY_MISS, "keymiss", key, db->id);
     }
     else
-        server.stat_keyspace_hits++;
+        statKeyspaceLookup(1);
     return val;
 }
 
@@ -156,6 +168,7 @@ robj *lookupKeyRead(redisDb *db, robj *key) {
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
     expireIfNeeded(db,key);
+    if (server.rdb_forkless) rdbForklessWillModify(db,key);
     return lookupKey(db,key,LOOKUP_NONE);
 }
 
@@ -171,13 +184,53 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
     return o;
 }
 
+/* Prefetch the main dict and expires entries of the keys with the given
+ * hashes. Both dictionaries hash keys with dictSdsHash(). */
+static void dbPrefetchHashes(redisDb *db, const uint64_t *hashes, int count) {
+    dictPrefetch(db->dict,hashes,count,1);
+    if (dictSize(db->expires)) dictPrefetch(db->expires,hashes,count,0);
+}
+
+/* Batched lookups: prefetch what looking up the first DB_PREFETCH_BATCH keys
+ * of 'keys' will touch, so that the lookups that follow, done as usual with
+ * lookupKeyRead() and friends, don't stall on one cache miss after the
+ * other. Commands with many keys call it every DB_PREFETCH_BATCH keys. */
+void dbPrefetchKeys(redisDb *db, robj **keys, int count) {
+    uint64_t hashes[DB_PREFETCH_BATCH];
+    int j;
+
+    if (count > DB_PREFETCH_BATCH) count = DB_PREFETCH_BATCH;
+    for (j = 0; j < count; j++) {
+        sds key = keys[j]->ptr;
+        hashes[j] = dictGenHashFunction(key,sdslen(key));
+    }
+    dbPrefetchHashes(db,hashes,count);
+}
+
+/* Like dbPrefetchKeys() but for keys that are not objects yet, such as the
+ * key arguments of the commands still in a client query buffer. */
+void dbPrefetchKeyBuffers(redisDb *db, const char **keys, const size_t *lens,
+                          int count)
+{
+    uint64_t hashes[DB_PREFETCH_BATCH];
+    int j;
+
+    if (count > DB_PREFETCH_BATCH) count = DB_PREFETCH_BATCH;
+    for (j = 0; j < count; j++)
+        hashes[j] = dictGenHashFunction(keys[j],lens[j]);
+    dbPrefetchHashes(db,hashes,count);
+}
+
 /* Add the key to the DB. It's up to the caller to increment the reference
  * counter of the value if needed.
  *
  * The program is aborted if the key already exists. */
 void dbAdd(redisDb *db, robj *key, robj *val) {
-    sds copy = sdsdup(key->ptr);
-    int retval = dictAdd(db->dict, copy, val);
+    if (server.rdb_forkless) rdbForklessWillModify(db,key);
+
+    /* The dict copies the key, into the entry itself unless its tables are
+     * open (see dbDictType). */
+    int retval = dictAdd(db->dict, key->ptr, val);
 
     serverAssertWithInfo(NULL,key,retval == DICT_OK);
     if (val->type == OBJ_LIST ||
@@ -192,6 +245,8 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
  *
  * The program is aborted if the key was not already present. */
 void dbOverwrite(redisDb *db, robj *key, robj *val) {
+    if (server.rdb_forkless) rdbForklessWillModify(db,key);
+
     dictEntry *de = dictFind(db->dict,key->ptr);
 
     serverAssertWithInfo(NULL,key,de != NULL);
@@ -274,9 +329,14 @@ robj *dbRandomKey(redisDb *db) {
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbSyncDelete(redisDb *db, robj *key) {
+    if (server.rdb_forkless) rdbForklessWillModify(db,key);
+
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
+    if (dictSize(db->expires) > 0) {
+        if (db->expires_index) expireIndexDel(db,key->ptr);
+        dictDelete(db->expires,key->ptr);
+    }
     if (dictDelete(db->dict,key->ptr) == DICT_OK) {
         if (server.cluster_enabled) slotToKeyDel(key);
         return 1;
@@ -361,6 +421,11 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         startdb = enddb = dbnum;
     }
 
+    /* Like a child, a BGSAVE without fork does not survive FLUSHALL, but
+     * the keys of a single db have to be saved before they go. */
+    if (dbnum == -1) rdbForklessKill();
+    else rdbForklessFinishDb(dbnum);
+
     for (int j = startdb; j <= enddb; j++) {
         removed += dictSize(server.db[j].dict);
         if (async) {
@@ -368,6 +433,7 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         } else {
             dictEmpty(server.db[j].dict,callback);
             dictEmpty(server.db[j].expires,callback);
+            expireIndexFlush(&server.db[j]);
         }
     }
     if (server.cluster_enabled) {
@@ -471,6 +537,8 @@ void delGenericCommand(client *c, int lazy) {
     int numdel = 0, j;
 
     for (j = 1; j < c->argc; j++) {
+        if ((j-1) % DB_PREFETCH_BATCH == 0)
+            dbPrefetchKeys(c->db,c->argv+j,c->argc-j);
         expireIfNeeded(c->db,c->argv[j]);
         int deleted  = lazy ? dbAsyncDelete(c->db,c->argv[j]) :
                               dbSyncDelete(c->db,c->argv[j]);
@@ -500,6 +568,8 @@ void existsCommand(client *c) {
     int j;
 
     for (j = 1; j < c->argc; j++) {
+        if ((j-1) % DB_PREFETCH_BATCH == 0)
+            dbPrefetchKeys(c->db,c->argv+j,c->argc-j);
         if (lookupKeyRead(c->db,c->argv[j])) count++;
     }
     addReplyLongLong(c,count);
@@ -540,16 +610,18 @@ void keysCommand(client *c) {
     dictEntry *de;
     sds pattern = c->argv[1]->ptr;
     int plen = sdslen(pattern), allkeys;
+    stringmatchPattern *matcher = NULL;
     unsigned long numkeys = 0;
     void *replylen = addReplyDeferredLen(c);
 
     di = dictGetSafeIterator(c->db->dict);
     allkeys = (pattern[0] == '*' && pattern[1] == '\0');
+    if (!allkeys) matcher = stringmatchCompile(pattern,plen,0);
     while((de = dictNext(di)) != NULL) {
         sds key = dictGetKey(de);
         robj *keyobj;
 
-        if (allkeys || stringmatchlen(pattern,plen,key,sdslen(key),0)) {
+        if (allkeys || stringmatchPatternMatch(matcher,key,sdslen(key))) {
             keyobj = createStringObject(key,sdslen(key));
             if (!keyIsExpired(c->db,keyobj)) {
                 addReplyBulk(c,keyobj);
@@ -559,6 +631,7 @@ void keysCommand(client *c) {
         }
     }
     dictReleaseIterator(di);
+    if (matcher) stringmatchFree(matcher);
     setDeferredArrayLen(c,replylen,numkeys);
 }
 
@@ -584,7 +657,7 @@ void scanCallback(void *privdata, const dictEntry *de) {
     } else if (o->type == OBJ_ZSET) {
         sds sdskey = dictGetKey(de);
         key = createStringObject(sdskey,sdslen(sdskey));
-        val = createStringObjectFromLongDouble(*(double*)dictGetVal(de),0);
+        val = createStringObjectFromLongDouble(zsetDictGetScore((zset*)o->ptr,de),0);
     } else {
         serverPanic("Type not handled in SCAN callback.");
     }
@@ -630,6 +703,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     long count = 10;
     sds pat = NULL;
     int patlen = 0, use_pattern = 0;
+    stringmatchPattern *matcher = NULL;
     dict *ht;
 
     /* Object must be NULL (to iterate keys names), or the type of the object
@@ -670,6 +744,8 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
             goto cleanup;
         }
     }
+    /* Compile the pattern once for all the elements to filter. */
+    if (use_pattern) matcher = stringmatchCompile(pat,patlen,0);
 
     /* Step 2: Iterate the collection.
      *
@@ -688,7 +764,8 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) {
         ht = o->ptr;
         count *= 2; /* We return key / value for this type. */
-    } else if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->type == OBJ_ZSET && (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                                       o->encoding == OBJ_ENCODING_BTREE)) {
         zset *zs = o->ptr;
         ht = zs->dict;
         count *= 2; /* We return key / value for this type. */
@@ -719,6 +796,18 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         while(intsetGet(o->ptr,pos++,&ll))
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
+    } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_INTMAP) {
+        int64_t field, value;
+        uint32_t pos = 0;
+
+        /* Like the ziplist, the intmap is small enough to be returned in
+         * one call: slots move when the table is resized, so a cursor
+         * could not guarantee to return every field. */
+        while(intmapNext(o->ptr,&pos,&field,&value)) {
+            listAddNodeTail(keys,createStringObjectFromLongLong(field));
+            listAddNodeTail(keys,createStringObjectFromLongLong(value));
+        }
+        cursor = 0;
     } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
         unsigned char *p = ziplistIndex(o->ptr,0);
         unsigned char *vstr;
@@ -747,7 +836,8 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         /* Filter element if it does not match the pattern. */
         if (!filter && use_pattern) {
             if (sdsEncodedObject(kobj)) {
-                if (!stringmatchlen(pat, patlen, kobj->ptr, sdslen(kobj->ptr), 0))
+                if (!stringmatchPatternMatch(matcher, kobj->ptr,
+                                             sdslen(kobj->ptr)))
                     filter = 1;
             } else {
                 char buf[LONG_STR_SIZE];
@@ -755,7 +845,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
 
                 serverAssert(kobj->encoding == OBJ_ENCODING_INT);
                 len = ll2string(buf,sizeof(buf),(long)kobj->ptr);
-                if (!stringmatchlen(pat, patlen, buf, len, 0)) filter = 1;
+                if (!stringmatchPatternMatch(matcher, buf, len)) filter = 1;
             }
         }
 
@@ -796,6 +886,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     }
 
 cleanup:
+    if (matcher) stringmatchFree(matcher);
     listSetFreeMethod(keys,decrRefCountVoid);
     listRelease(keys);
 }
@@ -1003,6 +1094,8 @@ int dbSwapDatabases(int id1, int id2) {
     if (id1 < 0 || id1 >= server.dbnum ||
         id2 < 0 || id2 >= server.dbnum) return C_ERR;
     if (id1 == id2) return C_OK;
+    rdbForklessFinishDb(id1);
+    rdbForklessFinishDb(id2);
     redisDb aux = server.db[id1];
     redisDb *db1 = &server.db[id1], *db2 = &server.db[id2];
 
@@ -1011,10 +1104,12 @@ int dbSwapDatabases(int id1, int id2) {
      * remain in the same DB they were. */
     db1->dict = db2->dict;
     db1->expires = db2->expires;
+    db1->expires_index = db2->expires_index;
     db1->avg_ttl = db2->avg_ttl;
 
     db2->dict = aux.dict;
     db2->expires = aux.expires;
+    db2->expires_index = aux.expires_index;
     db2->avg_ttl = aux.avg_ttl;
 
     /* Now we need to handle clients blocked on lists: as an effect
@@ -1068,6 +1163,8 @@ int removeExpire(redisDb *db, robj *key) {
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
     serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
+    if (server.rdb_forkless) rdbForklessWillModify(db,key);
+    if (db->expires_index) expireIndexDel(db,key->ptr);
     return dictDelete(db->expires,key->ptr) == DICT_OK;
 }
 
@@ -1078,9 +1175,15 @@ int removeExpire(redisDb *db, robj *key) {
 void setExpire(client *c, redisDb *db, robj *key, long long when) {
     dictEntry *kde, *de;
 
+    if (server.rdb_forkless) rdbForklessWillModify(db,key);
+
     /* Reuse the sds from the main dict in the expire dict */
     kde = dictFind(db->dict,key->ptr);
     serverAssertWithInfo(NULL,key,kde != NULL);
+    if (db->expires_index) {
+        expireIndexDel(db,dictGetKey(kde));
+        expireIndexAdd(db,dictGetKey(kde),when);
+    }
     de = dictAddOrFind(db->expires,dictGetKey(kde));
     dictSetSignedIntegerVal(de,when);
 
@@ -1179,6 +1282,10 @@ int expireIfNeeded(redisDb *db, robj *key) {
      * we think the key is expired at this time. */
     if (server.masterhost != NULL) return 1;
 
+    /* Likewise while the I/O threads run read only commands: the key will
+     * be deleted later by the main thread. */
+    if (server.keyspace_readonly) return 1;
+
     /* Delete the key */
     server.stat_expiredkeys++;
     propagateExpire(db,key,server.lazyfree_lazy_expire);
@@ -35,6 +35,7 @@
  */
 
 #include "server.h"
+#include "bio.h"
 #include <time.h>
 #include <assert.h>
 #include <stddef.h>
@@ -49,6 +50,130 @@ int je_get_defrag_hint(void* ptr, int *bin_util, int *run_util);
 void defragDictBucketCallback(void *privdata, dictEntry **bucketref);
 dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sds newkey, uint64_t hash, long *defragged);
 
+/* -----------------------------------------------------------------------------
+ * Threaded mode (active-defrag-threaded yes)
+ *
+ * Moving an allocation costs the main thread a mallocx() and a dallocx()
+ * that bypass the thread cache, so they take the arena lock and walk the
+ * bins. In threaded mode the BIO_DEFRAG thread does both: it keeps a small
+ * pool of replacement blocks ready for every small size class the scan
+ * asked for, and it frees the moved blocks in batches. The main thread is
+ * left with the hint check, the memcpy and the pointer swap.
+ *
+ * Every pool is a ring with a single producer (the bio thread) and a single
+ * consumer (the main thread). A block taken from a pool was allocated a
+ * little earlier than it would otherwise be, from the slab jemalloc then
+ * preferred: that is still a full one, as the scan only frees blocks of
+ * the emptier ones.
+ * -------------------------------------------------------------------------- */
+
+#define DEFRAG_POOL_MAX_SIZE 1024 /* Larger blocks are allocated inline. */
+#define DEFRAG_POOL_CLASSES (DEFRAG_POOL_MAX_SIZE/8+1)
+#define DEFRAG_POOL_SLOTS 32      /* Blocks per size class, power of two. */
+#define DEFRAG_FREE_BATCH 256     /* Moved blocks freed by a single job. */
+
+typedef struct defragPool {
+    void *slots[DEFRAG_POOL_SLOTS];
+    unsigned long tail;             /* Written by the bio thread only. */
+    unsigned long head __attribute__((aligned(64))); /* Main thread only. */
+    int wanted;                     /* The bio thread should fill the pool. */
+} defragPool;
+
+typedef struct defragFreeBatch {
+    int count;
+    void *ptrs[DEFRAG_FREE_BATCH];
+} defragFreeBatch;
+
+static defragPool DefragPools[DEFRAG_POOL_CLASSES];
+static defragFreeBatch *DefragFreeBatch = NULL; /* Being filled. */
+static int DefragPoolsWanted = 0; /* A pool was found low since the last job. */
+
+/* Take a block of exactly 'size' bytes from the pools, or return NULL if
+ * there is none ready, asking the bio thread to refill. */
+static void *defragPoolGet(size_t size) {
+    defragPool *pool;
+    unsigned long head, tail;
+    void *ptr;
+
+    if (size > DEFRAG_POOL_MAX_SIZE || size & 7) return NULL;
+    pool = DefragPools+(size>>3);
+    head = pool->head;
+    tail = __atomic_load_n(&pool->tail,__ATOMIC_ACQUIRE);
+    if (tail-head <= DEFRAG_POOL_SLOTS/2 &&
+        !__atomic_load_n(&pool->wanted,__ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&pool->wanted,1,__ATOMIC_RELAXED);
+        DefragPoolsWanted = 1;
+    }
+    if (head == tail) return NULL;
+    ptr = pool->slots[head & (DEFRAG_POOL_SLOTS-1)];
+    __atomic_store_n(&pool->head,head+1,__ATOMIC_RELEASE);
+    return ptr;
+}
+
+/* Submit the batch of moved blocks, and the pending refill requests, to the
+ * bio thread. */
+static void defragSubmitJob(void) {
+    if (!DefragFreeBatch && !DefragPoolsWanted) return;
+    bioCreateBackgroundJob(BIO_DEFRAG,DefragFreeBatch,NULL,NULL);
+    DefragFreeBatch = NULL;
+    DefragPoolsWanted = 0;
+}
+
+/* Queue the moved block 'ptr' to be freed by the bio thread. */
+static void defragFreeLater(void *ptr) {
+    if (!DefragFreeBatch) {
+        DefragFreeBatch = zmalloc(sizeof(*DefragFreeBatch));
+        DefragFreeBatch->count = 0;
+    }
+    DefragFreeBatch->ptrs[DefragFreeBatch->count++] = ptr;
+    if (DefragFreeBatch->count == DEFRAG_FREE_BATCH) defragSubmitJob();
+}
+
+/* Give the blocks left in the pools back, once a scan is over and no other
+ * one follows. Only the main thread takes blocks from the pools, so they
+ * are queued as moved blocks and freed by the bio thread. */
+static void defragDrainPools(void) {
+    int j;
+
+    for (j = 0; j < DEFRAG_POOL_CLASSES; j++) {
+        void *ptr;
+
+        __atomic_store_n(&DefragPools[j].wanted,0,__ATOMIC_RELAXED);
+        while ((ptr = defragPoolGet(j<<3)) != NULL) defragFreeLater(ptr);
+        __atomic_store_n(&DefragPools[j].wanted,0,__ATOMIC_RELAXED);
+    }
+    DefragPoolsWanted = 0;
+    if (DefragFreeBatch) defragSubmitJob();
+}
+
+/* Job of the BIO_DEFRAG thread: free the moved blocks of 'batch', if any,
+ * then fill the pools the main thread found low. */
+void activeDefragFromBioThread(void *batch) {
+    defragFreeBatch *b = batch;
+    int j;
+
+    if (b) {
+        for (j = 0; j < b->count; j++) zfree_no_tcache(b->ptrs[j]);
+        zfree(b);
+    }
+    for (j = 1; j < DEFRAG_POOL_CLASSES; j++) {
+        defragPool *pool = DefragPools+j;
+        unsigned long head, tail;
+
+        if (!__atomic_load_n(&pool->wanted,__ATOMIC_RELAXED)) continue;
+        __atomic_store_n(&pool->wanted,0,__ATOMIC_RELAXED);
+        tail = pool->tail;
+        head = __atomic_load_n(&pool->head,__ATOMIC_ACQUIRE);
+        while (tail-head < DEFRAG_POOL_SLOTS) {
+            pool->slots[tail & (DEFRAG_POOL_SLOTS-1)] =
+                zmalloc_no_tcache(j<<3);
+            tail++;
+            __atomic_store_n(&pool->tail,tail,__ATOMIC_RELEASE);
+        }
+    }
+}
+
 /* Defrag helper for generic allocations.
  *
  * returns NULL in case the allocatoin wasn't moved.
@@ -73,6 +198,15 @@ void* activeDefragAlloc(void *ptr) {
      * make sure not to use the thread cache. so that we don't get back the same
      * pointers we try to free */
     size = zmalloc_size(ptr);
+    if (server.active_defrag_threaded) {
+        /* The bio thread allocated the new block ahead of time, if it
+         * could, and will free the old one. */
+        if ((newptr = defragPoolGet(size)) == NULL)
+            newptr = zmalloc_no_tcache(size);
+        memcpy(newptr, ptr, size);
+        defragFreeLater(ptr);
+        return newptr;
+    }
     newptr = zmalloc_no_tcache(size);
     memcpy(newptr, ptr, size);
     zfree_no_tcache(ptr);
@@ -245,6 +379,40 @@ double *zslDefrag(zskiplist *zsl, double score, sds oldele, sds newele) {
     return NULL;
 }
 
+/* Defrag helper for the B+tree of a sorted set: moves the node at 'node',
+ * fixing the links of the neighbour leaves, and its subtree, including the
+ * separators. Returns the new address of the node. */
+void *defragZbtreeNode(zbtree *zbt, void *node, int height, long *defragged) {
+    void *newnode;
+
+    if ((newnode = activeDefragAlloc(node)))
+        (*defragged)++, node = newnode;
+    if (height == 0) {
+        zbtreeLeaf *leaf = node;
+        if (newnode) {
+            if (leaf->prev) leaf->prev->next = leaf; else zbt->head = leaf;
+            if (leaf->next) leaf->next->prev = leaf; else zbt->tail = leaf;
+        }
+    } else {
+        zbtreeInner *in = node;
+        sds newsds;
+        for (unsigned int j = 0; j < in->count; j++) {
+            if (j && (newsds = activeDefragSds(in->ele[j])))
+                (*defragged)++, in->ele[j] = newsds;
+            in->child[j] = defragZbtreeNode(zbt,in->child[j],height-1,
+                                            defragged);
+        }
+    }
+    return node;
+}
+
+/* Defrag the nodes of the B+tree of a sorted set, but not the elements. */
+long defragZbtreeNodes(zbtree *zbt) {
+    long defragged = 0;
+    zbt->root = defragZbtreeNode(zbt,zbt->root,zbt->height,&defragged);
+    return defragged;
+}
+
 /* Defrag helpler for sorted set.
  * Defrag a single dict entry key name, and corresponding skiplist struct */
 long activeDefragZsetEntry(zset *zs, dictEntry *de) {
@@ -252,6 +420,14 @@ long activeDefragZsetEntry(zset *zs, dictEntry *de) {
     double* newscore;
     long defragged = 0;
     sds sdsele = dictGetKey(de);
+    if (zs->zbt) {
+        /* The leaf slot must be found while the old string is valid. */
+        zbtreeIter it;
+        serverAssert(zbtFind(zs->zbt,dictGetDoubleVal(de),sdsele,&it));
+        if ((newsds = activeDefragSds(sdsele)))
+            defragged++, de->key = zbtIterEle(&it) = newsds;
+        return defragged;
+    }
     if ((newsds = activeDefragSds(sdsele)))
         defragged++, de->key = newsds;
     newscore = zslDefrag(zs->zsl, *(double*)dictGetVal(de), sdsele, newsds);
@@ -393,7 +569,16 @@ long activeDefragSdsListAndDict(list *l, dict *d, int dict_val_type) {
  * NOTE: this is very ugly code, but it let's us avoid the complication of
  * doing a scan on another dict. */
 dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sds newkey, uint64_t hash, long *defragged) {
-    dictEntry **deref = dictFindEntryRefByPtrAndHash(d, oldkey, hash);
+    dictEntry **deref;
+    if (dictIsOpen(d)) {
+        /* The entries of open tables are in the table, not allocations
+         * of their own: there is only the key pointer to replace. */
+        dictEntry *de = dictFindEntryByPtrAndHash(d, oldkey, hash);
+        if (de && newkey)
+            de->key = newkey;
+        return de;
+    }
+    deref = dictFindEntryRefByPtrAndHash(d, oldkey, hash);
     if (deref) {
         dictEntry *de = *deref;
         dictEntry *newde = activeDefragAlloc(de);
@@ -461,11 +646,15 @@ void scanLaterZsetCallback(void *privdata, const dictEntry *_de) {
 }
 
 long scanLaterZset(robj *ob, unsigned long *cursor) {
-    if (ob->type != OBJ_ZSET || ob->encoding != OBJ_ENCODING_SKIPLIST)
+    if (ob->type != OBJ_ZSET || (ob->encoding != OBJ_ENCODING_SKIPLIST &&
+                                 ob->encoding != OBJ_ENCODING_BTREE))
         return 0;
     zset *zs = (zset*)ob->ptr;
     dict *d = zs->dict;
     scanLaterZsetData data = {zs, 0};
+    /* The B+tree nodes are few (one every few dozens elements): move them
+     * all in the first step, then the elements with the dict scan. */
+    if (zs->zbt && *cursor == 0) data.defragged += defragZbtreeNodes(zs->zbt);
     *cursor = dictScan(d, *cursor, scanLaterZsetCallback, defragDictBucketCallback, &data);
     return data.defragged;
 }
@@ -556,6 +745,37 @@ long defragZsetSkiplist(redisDb *db, dictEntry *kde) {
     return defragged;
 }
 
+long defragZsetBtree(redisDb *db, dictEntry *kde) {
+    robj *ob = dictGetVal(kde);
+    long defragged = 0;
+    zset *zs = (zset*)ob->ptr;
+    zset *newzs;
+    zbtree *newzbt;
+    dict *newdict;
+    dictEntry *de;
+    serverAssert(ob->type == OBJ_ZSET && ob->encoding == OBJ_ENCODING_BTREE);
+    if ((newzs = activeDefragAlloc(zs)))
+        defragged++, ob->ptr = zs = newzs;
+    if ((newzbt = activeDefragAlloc(zs->zbt)))
+        defragged++, zs->zbt = newzbt;
+    if (dictSize(zs->dict) > server.active_defrag_max_scan_fields)
+        defragLater(db, kde);
+    else {
+        dictIterator *di = dictGetIterator(zs->dict);
+        defragged += defragZbtreeNodes(zs->zbt);
+        while((de = dictNext(di)) != NULL) {
+            defragged += activeDefragZsetEntry(zs, de);
+        }
+        dictReleaseIterator(di);
+    }
+    /* handle the dict struct */
+    if ((newdict = activeDefragAlloc(zs->dict)))
+        defragged++, zs->dict = newdict;
+    /* defrag the dict tables */
+    defragged += dictDefragTables(zs->dict);
+    return defragged;
+}
+
 long defragHash(redisDb *db, dictEntry *kde) {
     long defragged = 0;
     robj *ob = dictGetVal(kde);
@@ -614,6 +834,7 @@ int scanLaterStraemListpacks(robj *ob, unsigned long *cursor, long long endtime,
     }
 
     stream *s = ob->ptr;
+    s->tail_lp = NULL; /* The listpacks are about to move. */
     raxStart(&ri,s->rax);
     if (*cursor == 0) {
         /* if cursor is 0, we start new iteration */
@@ -743,6 +964,7 @@ long defragStream(redisDb *db, dictEntry *kde) {
     /* handle the main struct */
     if ((news = activeDefragAlloc(s)))
         defragged++, ob->ptr = s = news;
+    s->tail_lp = NULL; /* The listpacks are about to move. */
 
     if (raxSize(s->rax) > server.active_defrag_max_scan_fields) {
         rax *newrax = activeDefragAlloc(s->rax);
@@ -767,8 +989,11 @@ long defragKey(redisDb *db, dictEntry *de) {
     long defragged = 0;
     sds newsds;
 
-    /* Try to defrag the key name. */
-    newsds = activeDefragSds(keysds);
+    /* The value of a key locked by a module job is used by a worker. */
+    if (moduleKeyIsLocked(db->id,keysds)) return 0;
+
+    /* Try to defrag the key name, unless it is part of the entry. */
+    newsds = dictEmbedsKeys(db->dict) ? NULL : activeDefragSds(keysds);
     if (newsds)
         defragged++, de->key = newsds;
     if (dictSize(db->expires)) {
@@ -813,6 +1038,8 @@ long defragKey(redisDb *db, dictEntry *de) {
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_SKIPLIST) {
             defragged += defragZsetSkiplist(db, de);
+        } else if (ob->encoding == OBJ_ENCODING_BTREE) {
+            defragged += defragZsetBtree(db, de);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -822,6 +1049,9 @@ long defragKey(redisDb *db, dictEntry *de) {
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_HT) {
             defragged += defragHash(db, de);
+        } else if (ob->encoding == OBJ_ENCODING_INTMAP) {
+            if ((newzl = activeDefragAlloc(ob->ptr)))
+                defragged++, ob->ptr = newzl;
         } else {
             serverPanic("Unknown hash encoding");
         }
@@ -860,6 +1090,34 @@ void defragDictBucketCallback(void *privdata, dictEntry **bucketref) {
     }
 }
 
+/* Like defragDictBucketCallback(), for the main dict of the db 'privdata'.
+ * When its entries embed their key, moving an entry moves the key, which
+ * the entry and the expires dict have then to point to. */
+void defragDbDictBucketCallback(void *privdata, dictEntry **bucketref) {
+    redisDb *db = privdata;
+
+    if (!dictEmbedsKeys(db->dict)) {
+        defragDictBucketCallback(privdata, bucketref);
+        return;
+    }
+    while(*bucketref) {
+        dictEntry *de = *bucketref, *newde;
+        sds oldkey = dictGetKey(de);
+        size_t keyoff = (char*)oldkey - (char*)de;
+        if ((newde = activeDefragAlloc(de))) {
+            newde->key = (char*)newde + keyoff;
+            *bucketref = newde;
+            if (dictSize(db->expires)) {
+                long defragged = 0;
+                uint64_t hash = dictGetHash(db->dict, newde->key);
+                replaceSateliteDictKeyPtrAndOrDefragDictEntry(db->expires,
+                    oldkey, newde->key, hash, &defragged);
+            }
+        }
+        bucketref = &(*bucketref)->next;
+    }
+}
+
 /* Utility function to get the fragmentation ratio from jemalloc.
  * It is critical to do that by comparing only heap maps that belong to
  * jemalloc, and skip ones the jemalloc keeps as spare. Since we use this
@@ -954,6 +1212,7 @@ int defragLaterStep(redisDb *db, long long endtime) {
 
         /* each time we enter this function we need to fetch the key from the dict again (if it still exists) */
         dictEntry *de = dictFind(db->dict, current_key);
+        if (de && moduleKeyIsLocked(db->id,current_key)) de = NULL;
         key_defragged = server.stat_active_defrag_hits;
         do {
             int quit = 0;
@@ -1085,6 +1344,7 @@ void activeDefragCycle(void) {
                 server.active_defrag_running = 0;
 
                 computeDefragCycles(); /* if another scan is needed, start it right away */
+                if (server.active_defrag_running == 0) defragDrainPools();
                 if (server.active_defrag_running != 0 && ustime() < endtime)
                     continue;
                 break;
@@ -1106,7 +1366,7 @@ void activeDefragCycle(void) {
                 break; /* this will exit the function and we'll continue on the next cycle */
             }
 
-            cursor = dictScan(db->dict, cursor, defragScanCallback, defragDictBucketCallback, db);
+            cursor = dictScan(db->dict, cursor, defragScanCallback, defragDbDictBucketCallback, db);
 
             /* Once in 16 scan iterations, 512 pointer reallocations. or 64 keys
              * (if we have a lot of pointers in one hash bucket or rehasing),
@@ -1127,6 +1387,9 @@ void activeDefragCycle(void) {
         } while(cursor && !quit);
     } while(!quit);
 
+    /* Don't keep moved blocks around until the next cycle. */
+    defragSubmitJob();
+
     latencyEndMonitor(latency);
     latencyAddSampleIfNeeded("active-defrag-cycle",latency);
 }
@@ -1137,4 +1400,8 @@ void activeDefragCycle(void) {
     /* Not implemented yet. */
 }
 
+void activeDefragFromBioThread(void *batch) {
+    UNUSED(batch);
+}
+
 #endif
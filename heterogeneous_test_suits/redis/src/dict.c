@@ -62,9 +62,17 @@
 static int dict_can_resize = 1;
 static unsigned int dict_force_resize_ratio = 5;
 
+/* Using dictDisableRehashSteps() lookups stop moving buckets of the tables
+ * being rehashed, so that they don't write to the dictionaries at all: this
+ * is what allows Redis to look up keys from many threads at once. */
+static int dict_can_rehash_step = 1;
+
 /* -------------------------- private prototypes ---------------------------- */
 
 static int _dictExpandIfNeeded(dict *ht);
+static dictEntry *_dictOpenAddRaw(dict *d, void *key, dictEntry **existing);
+static int _dictOpenMakeRoom(dict *d);
+static unsigned long _dictOpenSize(unsigned long size);
 static unsigned long _dictNextPower(unsigned long size);
 static long _dictKeyIndex(dict *ht, const void *key, uint64_t hash, dictEntry **existing);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
@@ -82,17 +90,244 @@ uint8_t *dictGetHashFunctionSeed(void) {
 }
 
 /* The default hashing function uses SipHash implementation
- * in siphash.c. */
-
+ * in siphash.c. Building with USE_WYHASH selects the faster wyhash in
+ * wyhash.c instead. */
+
+#ifdef USE_WYHASH
+uint64_t wyhash(const uint8_t *in, const size_t inlen, const uint8_t *k);
+uint64_t wyhash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k);
+#define dictKeyedHash wyhash
+#define dictKeyedHashNocase wyhash_nocase
+#else
 uint64_t siphash(const uint8_t *in, const size_t inlen, const uint8_t *k);
 uint64_t siphash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k);
+#define dictKeyedHash siphash
+#define dictKeyedHashNocase siphash_nocase
+#endif
 
 uint64_t dictGenHashFunction(const void *key, int len) {
-    return siphash(key,len,dict_hash_function_seed);
+    return dictKeyedHash(key,len,dict_hash_function_seed);
 }
 
 uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len) {
-    return siphash_nocase(buf,len,dict_hash_function_seed);
+    return dictKeyedHashNocase(buf,len,dict_hash_function_seed);
+}
+
+/* ---------------------------- open addressing ----------------------------- */
+
+/* A dictionary created with dictCreateOpen() keeps its entries in the hash
+ * tables themselves instead of chaining them from an array of buckets: the
+ * entry of a key goes in the first free slot starting from the index of its
+ * hash (linear probing), and a table is filled to 7/8 of its slots at most.
+ *
+ * Every slot also has a control byte: EMPTY, DELETED (the entry was removed,
+ * but lookups must go on past it) or the 7 higher bits of the hash of its
+ * entry, with the DICT_CTRL_FULL bit set. Lookups compare the control bytes
+ * of DICT_GROUP slots at once, with SIMD instructions where we have them,
+ * and only read the entries whose bits match: finding a key costs a cache
+ * miss for the control bytes, one for the entry and one for the key, and a
+ * missing key often just the first one.
+ *
+ * Entries are not chained, so their 'next' field keeps the hash of their
+ * key instead, for rehashing and dictScan() not to compute it again.
+ *
+ * A table is a single allocation: the entries, the count of DELETED slots,
+ * the control bytes and a copy of the first DICT_GROUP of them, so that a
+ * group of control bytes can start at any slot. */
+
+#define DICT_CTRL_EMPTY 0x00
+#define DICT_CTRL_DELETED 0x01
+#define DICT_CTRL_FULL 0x80
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+#define DICT_GROUP 16
+#define DICT_GROUP_SHIFT 0 /* The masks have a bit per slot. */
+#define dictGroupCtz(m) __builtin_ctz(m)
+typedef unsigned int dictGroupMask;
+
+static inline dictGroupMask dictGroupMatch(const unsigned char *ctrl, unsigned char c) {
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g,_mm_set1_epi8((char)c)));
+}
+
+static inline dictGroupMask dictGroupFree(const unsigned char *ctrl) {
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return ~_mm_movemask_epi8(g) & 0xffff;
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+
+#define DICT_GROUP 16
+#define DICT_GROUP_SHIFT 2 /* The masks have a nibble per slot. */
+#define dictGroupCtz(m) __builtin_ctzll(m)
+typedef uint64_t dictGroupMask;
+
+/* Turn the result of a comparison into a mask of the high bit of the
+ * nibble of every slot that matched. */
+static inline dictGroupMask dictGroupMaskOf(uint8x16_t eq) {
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(eq),4);
+    return vget_lane_u64(vreinterpret_u64_u8(n),0) & 0x8888888888888888ULL;
+}
+
+static inline dictGroupMask dictGroupMatch(const unsigned char *ctrl, unsigned char c) {
+    return dictGroupMaskOf(vceqq_u8(vld1q_u8(ctrl),vdupq_n_u8(c)));
+}
+
+static inline dictGroupMask dictGroupFree(const unsigned char *ctrl) {
+    return dictGroupMaskOf(vcltq_u8(vld1q_u8(ctrl),vdupq_n_u8(DICT_CTRL_FULL)));
+}
+#else
+/* Eight slots at a time in a 64 bit word. dictGroupMatch() may report
+ * slots that don't match, but only ones after a slot that does: the first
+ * EMPTY slot of a group is always right, and the others are FULL slots that
+ * fail the comparison of the hash anyway. */
+#define DICT_GROUP 8
+#define DICT_GROUP_SHIFT 3 /* The masks have the high bit of every byte. */
+#define dictGroupCtz(m) __builtin_ctzll(m)
+typedef uint64_t dictGroupMask;
+
+static inline uint64_t dictGroupLoad(const unsigned char *ctrl) {
+    uint64_t g;
+
+    memcpy(&g,ctrl,sizeof(g));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    g = __builtin_bswap64(g);
+#endif
+    return g;
+}
+
+static inline dictGroupMask dictGroupMatch(const unsigned char *ctrl, unsigned char c) {
+    uint64_t x = dictGroupLoad(ctrl) ^ (0x0101010101010101ULL * c);
+    return (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+}
+
+static inline dictGroupMask dictGroupFree(const unsigned char *ctrl) {
+    return ~dictGroupLoad(ctrl) & 0x8080808080808080ULL;
+}
+#endif
+
+/* Offset from the start of a group of the first slot in the mask. */
+static inline unsigned long dictGroupFirst(dictGroupMask m) {
+    return dictGroupCtz(m) >> DICT_GROUP_SHIFT;
+}
+
+#define dictOpenHash(he) ((uintptr_t)(he)->next)
+#define dictOpenTag(h) (DICT_CTRL_FULL | ((h) >> (sizeof(uintptr_t)*8-7)))
+#define dictOpenMaxFill(size) ((size)*7/8)
+/* The fill up to which an open table waits when it is not allowed to grow,
+ * see the expandAllowed callback of dictType. */
+#define dictOpenHardFill(size) ((size)-(size)/16-1)
+
+static inline dictEntry *dictOpenSlots(dictht *ht) {
+    return (dictEntry*)ht->table;
+}
+
+static inline unsigned long *dictOpenDeleted(dictht *ht) {
+    return (unsigned long*)(dictOpenSlots(ht)+ht->size);
+}
+
+static inline unsigned char *dictOpenCtrl(dictht *ht) {
+    return (unsigned char*)(dictOpenDeleted(ht)+1);
+}
+
+static size_t dictOpenAllocSize(unsigned long size) {
+    return size*sizeof(dictEntry)+sizeof(unsigned long)+size+DICT_GROUP;
+}
+
+/* Bytes of the table of a hash table of 'size' buckets or slots. */
+static size_t dictTableAllocSize(dict *d, unsigned long size) {
+    return d->open ? dictOpenAllocSize(size) : size*sizeof(dictEntry*);
+}
+
+static void _dictFreeTable(dict *d, dictht *ht) {
+    if (d->type->hugeTables)
+        zfree_huge(ht->table, dictTableAllocSize(d,ht->size));
+    else
+        zfree(ht->table);
+}
+
+static void dictOpenSetCtrl(dictht *ht, unsigned long i, unsigned char c) {
+    unsigned char *ctrl = dictOpenCtrl(ht);
+    unsigned long j;
+
+    ctrl[i] = c;
+    /* Keep the copy of the first group up to date. Tables smaller than a
+     * group have it several times. */
+    for (j = i; j < DICT_GROUP; j += ht->size) ctrl[ht->size+j] = c;
+}
+
+/* Return the slot of 'key' in the table, or -1 if it is not there. */
+static long dictOpenLookup(dict *d, dictht *ht, const void *key, uintptr_t h) {
+    dictEntry *slots = dictOpenSlots(ht);
+    unsigned char *ctrl = dictOpenCtrl(ht);
+    unsigned long pos = h & ht->sizemask;
+    unsigned char tag = dictOpenTag(h);
+
+    /* The entry is most likely in the first slot: load it while we look at
+     * the control bytes. */
+    __builtin_prefetch(slots+pos);
+    while(1) {
+        dictGroupMask match = dictGroupMatch(ctrl+pos,tag);
+        dictGroupMask empty = dictGroupMatch(ctrl+pos,DICT_CTRL_EMPTY);
+
+        /* The key can't be after the first EMPTY slot. */
+        if (empty) match &= (empty & -empty)-1;
+        while(match) {
+            unsigned long i = (pos+dictGroupFirst(match)) & ht->sizemask;
+            dictEntry *he = slots+i;
+
+            if (dictOpenHash(he) == h &&
+                (key == he->key || dictCompareKeys(d, key, he->key)))
+                return i;
+            match &= match-1;
+        }
+        if (empty) return -1;
+        pos = (pos+DICT_GROUP) & ht->sizemask;
+    }
+}
+
+/* Take the first free slot in the probe sequence of the hash 'h' and return
+ * its entry, with only 'next' set. The caller sets the key and value. */
+static dictEntry *dictOpenInsert(dictht *ht, uintptr_t h) {
+    unsigned char *ctrl = dictOpenCtrl(ht);
+    unsigned long pos = h & ht->sizemask, i;
+    dictGroupMask free;
+    dictEntry *he;
+
+    while((free = dictGroupFree(ctrl+pos)) == 0)
+        pos = (pos+DICT_GROUP) & ht->sizemask;
+    i = (pos+dictGroupFirst(free)) & ht->sizemask;
+    if (ctrl[i] == DICT_CTRL_DELETED) (*dictOpenDeleted(ht))--;
+    dictOpenSetCtrl(ht,i,dictOpenTag(h));
+    he = dictOpenSlots(ht)+i;
+    he->next = (dictEntry*)h;
+    ht->used++;
+    return he;
+}
+
+/* Free the slot 'i'. When the next slot is EMPTY no probe sequence goes
+ * through this one, so it can be EMPTY too rather than DELETED. */
+static void dictOpenRemove(dictht *ht, unsigned long i) {
+    if (dictOpenCtrl(ht)[(i+1) & ht->sizemask] == DICT_CTRL_EMPTY) {
+        dictOpenSetCtrl(ht,i,DICT_CTRL_EMPTY);
+    } else {
+        dictOpenSetCtrl(ht,i,DICT_CTRL_DELETED);
+        (*dictOpenDeleted(ht))++;
+    }
+    ht->used--;
+}
+
+/* The first entry in the bucket 'i' of the table, or NULL. */
+static dictEntry *dictBucket(dict *d, dictht *ht, unsigned long i) {
+    if (!d->open) return ht->table[i];
+    return (dictOpenCtrl(ht)[i] & DICT_CTRL_FULL) ? dictOpenSlots(ht)+i : NULL;
+}
+
+/* The entry after 'he' in its bucket: open tables have one per bucket. */
+static dictEntry *dictBucketNext(dict *d, dictEntry *he) {
+    return d->open ? NULL : he->next;
 }
 
 /* ----------------------------- API implementation ------------------------- */
@@ -117,6 +352,19 @@ dict *dictCreate(dictType *type,
     return d;
 }
 
+/* Create a new hash table with open addressing tables, see the top of the
+ * open addressing section. It works with the same API as the others, but
+ * callers must not keep its entries across other calls on the dictionary:
+ * rehashing moves them. */
+dict *dictCreateOpen(dictType *type,
+        void *privDataPtr)
+{
+    dict *d = dictCreate(type,privDataPtr);
+
+    d->open = 1;
+    return d;
+}
+
 /* Initialize the hash table */
 int _dictInit(dict *d, dictType *type,
         void *privDataPtr)
@@ -127,6 +375,7 @@ int _dictInit(dict *d, dictType *type,
     d->privdata = privDataPtr;
     d->rehashidx = -1;
     d->iterators = 0;
+    d->open = 0;
     return DICT_OK;
 }
 
@@ -152,15 +401,20 @@ int dictExpand(dict *d, unsigned long size)
         return DICT_ERR;
 
     dictht n; /* the new hash table */
-    unsigned long realsize = _dictNextPower(size);
+    unsigned long realsize = d->open ? _dictOpenSize(size) :
+                                       _dictNextPower(size);
 
-    /* Rehashing to the same table size is not useful. */
-    if (realsize == d->ht[0].size) return DICT_ERR;
+    /* Rehashing to the same table size is not useful, unless it is to get
+     * rid of the DELETED slots of an open table. */
+    if (realsize == d->ht[0].size &&
+        !(d->open && *dictOpenDeleted(&d->ht[0]))) return DICT_ERR;
 
     /* Allocate the new hash table and initialize all pointers to NULL */
     n.size = realsize;
     n.sizemask = realsize-1;
-    n.table = zcalloc(realsize*sizeof(dictEntry*));
+    n.table = d->type->hugeTables ?
+              zcalloc_huge(dictTableAllocSize(d,realsize)) :
+              zcalloc(dictTableAllocSize(d,realsize));
     n.used = 0;
 
     /* Is this the first initialization? If so it's not really a rehashing
@@ -195,11 +449,19 @@ int dictRehash(dict *d, int n) {
         /* Note that rehashidx can't overflow as we are sure there are more
          * elements because ht[0].used != 0 */
         assert(d->ht[0].size > (unsigned long)d->rehashidx);
-        while(d->ht[0].table[d->rehashidx] == NULL) {
+        while((de = dictBucket(d,&d->ht[0],d->rehashidx)) == NULL) {
             d->rehashidx++;
             if (--empty_visits == 0) return 1;
         }
-        de = d->ht[0].table[d->rehashidx];
+        if (d->open) {
+            /* Move the entry, its hash is in the 'next' field. */
+            nextde = dictOpenInsert(&d->ht[1],dictOpenHash(de));
+            nextde->key = de->key;
+            nextde->v = de->v;
+            dictOpenRemove(&d->ht[0],d->rehashidx);
+            d->rehashidx++;
+            continue;
+        }
         /* Move all the keys in this bucket from the old to the new hash HT */
         while(de) {
             uint64_t h;
@@ -219,7 +481,7 @@ int dictRehash(dict *d, int n) {
 
     /* Check if we already rehashed the whole table... */
     if (d->ht[0].used == 0) {
-        zfree(d->ht[0].table);
+        _dictFreeTable(d,&d->ht[0]);
         d->ht[0] = d->ht[1];
         _dictReset(&d->ht[1]);
         d->rehashidx = -1;
@@ -237,18 +499,31 @@ long long timeInMilliseconds(void) {
     return (((long long)tv.tv_sec)*1000)+(tv.tv_usec/1000);
 }
 
-/* Rehash for an amount of time between ms milliseconds and ms+1 milliseconds */
-int dictRehashMilliseconds(dict *d, int ms) {
-    long long start = timeInMilliseconds();
+static long long timeInMicroseconds(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* Rehash for an amount of time a bit over us microseconds: the time is
+ * checked every 100 steps. */
+int dictRehashMicroseconds(dict *d, long long us) {
+    long long start = timeInMicroseconds();
     int rehashes = 0;
 
     while(dictRehash(d,100)) {
         rehashes += 100;
-        if (timeInMilliseconds()-start > ms) break;
+        if (timeInMicroseconds()-start > us) break;
     }
     return rehashes;
 }
 
+/* Rehash for an amount of time between ms milliseconds and ms+1 milliseconds */
+int dictRehashMilliseconds(dict *d, int ms) {
+    return dictRehashMicroseconds(d,(long long)ms*1000);
+}
+
 /* This function performs just a step of rehashing, and only if there are
  * no safe iterators bound to our hash table. When we have iterators in the
  * middle of a rehashing we can't mess with the two hash tables otherwise
@@ -258,7 +533,7 @@ int dictRehashMilliseconds(dict *d, int ms) {
  * dictionary so that the hash table automatically migrates from H1 to H2
  * while it is actively used. */
 static void _dictRehashStep(dict *d) {
-    if (d->iterators == 0) dictRehash(d,1);
+    if (d->iterators == 0 && dict_can_rehash_step) dictRehash(d,1);
 }
 
 /* Add an element to the target hash table */
@@ -296,6 +571,7 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
     dictht *ht;
 
     if (dictIsRehashing(d)) _dictRehashStep(d);
+    if (d->open) return _dictOpenAddRaw(d,key,existing);
 
     /* Get the index of the new element, or -1 if
      * the element already exists. */
@@ -307,12 +583,39 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
      * system it is more likely that recently added entries are accessed
      * more frequently. */
     ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = zmalloc(sizeof(*entry));
+    if (dictEmbedsKeys(d)) {
+        entry = zmalloc(sizeof(*entry)+d->type->embedKeyLen(key));
+        entry->key = d->type->embedKey(entry+1,key);
+    } else {
+        entry = zmalloc(sizeof(*entry));
+        dictSetKey(d, entry, key);
+    }
     entry->next = ht->table[index];
     ht->table[index] = entry;
     ht->used++;
+    return entry;
+}
 
-    /* Set the hash entry fields. */
+/* dictAddRaw() for open tables. */
+static dictEntry *_dictOpenAddRaw(dict *d, void *key, dictEntry **existing)
+{
+    uintptr_t h = dictHashKey(d,key);
+    dictEntry *entry;
+    int table;
+    long i;
+
+    if (existing) *existing = NULL;
+    if (_dictExpandIfNeeded(d) == DICT_ERR)
+        return NULL;
+    for (table = 0; table <= 1; table++) {
+        if ((i = dictOpenLookup(d, &d->ht[table], key, h)) != -1) {
+            if (existing) *existing = dictOpenSlots(&d->ht[table])+i;
+            return NULL;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+
+    entry = dictOpenInsert(dictIsRehashing(d) ? &d->ht[1] : &d->ht[0], h);
     dictSetKey(d, entry, key);
     return entry;
 }
@@ -358,6 +661,35 @@ dictEntry *dictAddOrFind(dict *d, void *key) {
     return entry ? entry : existing;
 }
 
+/* dictGenericDelete() for open tables. The entry is part of the table, so
+ * dictUnlink() returns a copy of it, that dictFreeUnlinkedEntry() frees as
+ * the unlinked entries of the other dictionaries. */
+static dictEntry *_dictOpenGenericDelete(dict *d, const void *key, uintptr_t h, int nofree) {
+    dictEntry *he;
+    int table;
+    long i;
+
+    for (table = 0; table <= 1; table++) {
+        if ((i = dictOpenLookup(d, &d->ht[table], key, h)) != -1) {
+            he = dictOpenSlots(&d->ht[table])+i;
+            if (nofree) {
+                dictEntry *copy = zmalloc(sizeof(*copy));
+
+                *copy = *he;
+                copy->next = NULL;
+                he = copy;
+            } else {
+                dictFreeKey(d, he);
+                dictFreeVal(d, he);
+            }
+            dictOpenRemove(&d->ht[table],i);
+            return he;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return NULL; /* not found */
+}
+
 /* Search and remove an element. This is an helper function for
  * dictDelete() and dictUnlink(), please check the top comment
  * of those functions. */
@@ -370,6 +702,7 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
 
     if (dictIsRehashing(d)) _dictRehashStep(d);
     h = dictHashKey(d, key);
+    if (d->open) return _dictOpenGenericDelete(d,key,h,nofree);
 
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
@@ -448,18 +781,18 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
 
         if (callback && (i & 65535) == 0) callback(d->privdata);
 
-        if ((he = ht->table[i]) == NULL) continue;
+        if ((he = dictBucket(d,ht,i)) == NULL) continue;
         while(he) {
-            nextHe = he->next;
+            nextHe = dictBucketNext(d,he);
             dictFreeKey(d, he);
             dictFreeVal(d, he);
-            zfree(he);
+            if (!d->open) zfree(he);
             ht->used--;
             he = nextHe;
         }
     }
     /* Free the table and the allocated cache structure */
-    zfree(ht->table);
+    _dictFreeTable(d,ht);
     /* Re-initialize the table */
     _dictReset(ht);
     return DICT_OK; /* never fails */
@@ -482,6 +815,13 @@ dictEntry *dictFind(dict *d, const void *key)
     if (dictIsRehashing(d)) _dictRehashStep(d);
     h = dictHashKey(d, key);
     for (table = 0; table <= 1; table++) {
+        if (d->open) {
+            long i = dictOpenLookup(d, &d->ht[table], key, h);
+
+            if (i != -1) return dictOpenSlots(&d->ht[table])+i;
+            if (!dictIsRehashing(d)) return NULL;
+            continue;
+        }
         idx = h & d->ht[table].sizemask;
         he = d->ht[table].table[idx];
         while(he) {
@@ -501,6 +841,70 @@ void *dictFetchValue(dict *d, const void *key) {
     return he ? dictGetVal(he) : NULL;
 }
 
+/* Prepare the lookup of 'count' keys, given their hashes as returned by
+ * dictHashKey(): the buckets of all the keys are prefetched first, then the
+ * entries the buckets point to, then their keys (and values when 'vals' is
+ * true, for dictionaries of pointers), so that the cache misses of the batch
+ * overlap instead of stalling one lookup after the other. Only the first
+ * entry of a chain, or the home slot of an open table, is prefetched: that's
+ * where the key almost always is.
+ *
+ * The dictionary is not modified, not even by a rehashing step, so the keys
+ * are then looked up with dictFind() as usual, finding the cache warm. */
+void dictPrefetch(dict *d, const uint64_t *hashes, int count, int vals) {
+    int tables = dictIsRehashing(d) ? 2 : 1, table, j;
+
+    if (dictSize(d) == 0) return;
+    for (table = 0; table < tables; table++) {
+        dictht *ht = &d->ht[table];
+
+        if (ht->size == 0) continue;
+        for (j = 0; j < count; j++) {
+            unsigned long idx = hashes[j] & ht->sizemask;
+
+            if (d->open) {
+                __builtin_prefetch(dictOpenCtrl(ht)+idx);
+                __builtin_prefetch(dictOpenSlots(ht)+idx);
+            } else {
+                __builtin_prefetch(ht->table+idx);
+            }
+        }
+    }
+    for (table = 0; table < tables; table++) {
+        dictht *ht = &d->ht[table];
+
+        if (ht->size == 0) continue;
+        for (j = 0; j < count; j++) {
+            unsigned long idx = hashes[j] & ht->sizemask;
+
+            if (d->open) {
+                if (dictOpenCtrl(ht)[idx] & DICT_CTRL_FULL)
+                    __builtin_prefetch(dictOpenSlots(ht)[idx].key);
+            } else if (ht->table[idx]) {
+                __builtin_prefetch(ht->table[idx]);
+            }
+        }
+    }
+    for (table = 0; table < tables; table++) {
+        dictht *ht = &d->ht[table];
+
+        if (ht->size == 0) continue;
+        for (j = 0; j < count; j++) {
+            unsigned long idx = hashes[j] & ht->sizemask;
+            dictEntry *he;
+
+            if (d->open) {
+                if (!(dictOpenCtrl(ht)[idx] & DICT_CTRL_FULL)) continue;
+                he = dictOpenSlots(ht)+idx;
+            } else {
+                if ((he = ht->table[idx]) == NULL) continue;
+                __builtin_prefetch(he->key);
+            }
+            if (vals) __builtin_prefetch(he->v.val);
+        }
+    }
+}
+
 /* A fingerprint is a 64 bit number that represents the state of the dictionary
  * at a given time, it's just a few dict properties xored together.
  * When an unsafe iterator is initialized, we get the dict fingerprint, and check
@@ -580,14 +984,14 @@ dictEntry *dictNext(dictIterator *iter)
                     break;
                 }
             }
-            iter->entry = ht->table[iter->index];
+            iter->entry = dictBucket(iter->d, ht, iter->index);
         } else {
             iter->entry = iter->nextEntry;
         }
         if (iter->entry) {
             /* We need to save the 'next' here, the iterator user
              * may delete the entry we are returning. */
-            iter->nextEntry = iter->entry->next;
+            iter->nextEntry = dictBucketNext(iter->d, iter->entry);
             return iter->entry;
         }
     }
@@ -622,13 +1026,14 @@ dictEntry *dictGetRandomKey(dict *d)
             h = d->rehashidx + (random() % (d->ht[0].size +
                                             d->ht[1].size -
                                             d->rehashidx));
-            he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] :
-                                      d->ht[0].table[h];
+            he = (h >= d->ht[0].size) ?
+                 dictBucket(d, &d->ht[1], h - d->ht[0].size) :
+                 dictBucket(d, &d->ht[0], h);
         } while(he == NULL);
     } else {
         do {
             h = random() & d->ht[0].sizemask;
-            he = d->ht[0].table[h];
+            he = dictBucket(d, &d->ht[0], h);
         } while(he == NULL);
     }
 
@@ -639,12 +1044,12 @@ dictEntry *dictGetRandomKey(dict *d)
     listlen = 0;
     orighe = he;
     while(he) {
-        he = he->next;
+        he = dictBucketNext(d, he);
         listlen++;
     }
     listele = random() % listlen;
     he = orighe;
-    while(listele--) he = he->next;
+    while(listele--) he = dictBucketNext(d, he);
     return he;
 }
 
@@ -711,7 +1116,7 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
                     continue;
             }
             if (i >= d->ht[j].size) continue; /* Out of range for this table. */
-            dictEntry *he = d->ht[j].table[i];
+            dictEntry *he = dictBucket(d, &d->ht[j], i);
 
             /* Count contiguous empty buckets, and jump to other
              * locations if they reach 'count' (with a minimum of 5). */
@@ -728,7 +1133,7 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
                      * empty while iterating. */
                     *des = he;
                     des++;
-                    he = he->next;
+                    he = dictBucketNext(d, he);
                     stored++;
                     if (stored == count) return stored;
                 }
@@ -775,6 +1180,40 @@ static unsigned long rev(unsigned long v) {
     return v;
 }
 
+/* Emit the entries of the bucket 'idx' of the table for dictScan(). The
+ * bucket of an open table is made of the entries whose hash has this index:
+ * they are all between the slot 'idx' and the next EMPTY one. */
+static void dictScanBucket(dict *d, dictht *t, unsigned long idx,
+                           dictScanFunction *fn,
+                           dictScanBucketFunction* bucketfn,
+                           void *privdata)
+{
+    const dictEntry *de, *next;
+
+    if (d->open) {
+        /* The entries are not allocations of their own, there is no
+         * bucket to hand to bucketfn. */
+        dictEntry *slots = dictOpenSlots(t);
+        unsigned char *ctrl = dictOpenCtrl(t);
+        unsigned long i;
+
+        for (i = idx; ctrl[i] != DICT_CTRL_EMPTY; i = (i+1) & t->sizemask) {
+            if ((ctrl[i] & DICT_CTRL_FULL) &&
+                (dictOpenHash(slots+i) & t->sizemask) == idx)
+                fn(privdata, slots+i);
+        }
+        return;
+    }
+
+    if (bucketfn) bucketfn(privdata, &t->table[idx]);
+    de = t->table[idx];
+    while (de) {
+        next = de->next;
+        fn(privdata, de);
+        de = next;
+    }
+}
+
 /* dictScan() is used to iterate over the elements of a dictionary.
  *
  * Iterating works the following way:
@@ -866,7 +1305,6 @@ unsigned long dictScan(dict *d,
                        void *privdata)
 {
     dictht *t0, *t1;
-    const dictEntry *de, *next;
     unsigned long m0, m1;
 
     if (dictSize(d) == 0) return 0;
@@ -876,13 +1314,7 @@ unsigned long dictScan(dict *d,
         m0 = t0->sizemask;
 
         /* Emit entries at cursor */
-        if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
-        de = t0->table[v & m0];
-        while (de) {
-            next = de->next;
-            fn(privdata, de);
-            de = next;
-        }
+        dictScanBucket(d, t0, v & m0, fn, bucketfn, privdata);
 
         /* Set unmasked bits so incrementing the reversed cursor
          * operates on the masked bits */
@@ -907,25 +1339,13 @@ unsigned long dictScan(dict *d,
         m1 = t1->sizemask;
 
         /* Emit entries at cursor */
-        if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
-        de = t0->table[v & m0];
-        while (de) {
-            next = de->next;
-            fn(privdata, de);
-            de = next;
-        }
+        dictScanBucket(d, t0, v & m0, fn, bucketfn, privdata);
 
         /* Iterate over indices in larger table that are the expansion
          * of the index pointed to by the cursor in the smaller table */
         do {
             /* Emit entries at cursor */
-            if (bucketfn) bucketfn(privdata, &t1->table[v & m1]);
-            de = t1->table[v & m1];
-            while (de) {
-                next = de->next;
-                fn(privdata, de);
-                de = next;
-            }
+            dictScanBucket(d, t1, v & m1, fn, bucketfn, privdata);
 
             /* Increment the reverse cursor not covered by the smaller mask.*/
             v |= ~m1;
@@ -940,17 +1360,67 @@ unsigned long dictScan(dict *d,
     return v;
 }
 
+/* Has a scan started with a cursor of 0, and now at 'cursor', gone past the
+ * elements with the given hash? Those elements were returned by dictScan()
+ * if they were in the dictionary at the time, whatever the resizes since,
+ * and the elements dictScan() returns again after the table shrinks are
+ * past the cursor it was called with. A 0 cursor is taken as the start of
+ * the scan, not its end. */
+int dictScanPassed(unsigned long cursor, uint64_t hash) {
+    return rev(hash) < rev(cursor);
+}
+
+/* Call 'fn' for every entry in the buckets from 'start' (included) to 'end'
+ * (excluded), the buckets of the second table, while rehashing, coming after
+ * those of the first one: dictSlots() buckets in total. Unlike dictScan()
+ * this modifies nothing, so that threads can each visit their range of a
+ * dictionary that doesn't change meanwhile, its rehashing paused. */
+void dictScanSlots(dict *d, unsigned long start, unsigned long end,
+                   dictScanFunction *fn, void *privdata)
+{
+    unsigned long i;
+
+    if (end > dictSlots(d)) end = dictSlots(d);
+    for (i = start; i < end; i++) {
+        int table = i >= d->ht[0].size;
+        dictEntry *he, *nextHe;
+
+        he = dictBucket(d, &d->ht[table], table ? i-d->ht[0].size : i);
+        while (he) {
+            nextHe = dictBucketNext(d, he);
+            fn(privdata, he);
+            he = nextHe;
+        }
+    }
+}
+
 /* ------------------------- private functions ------------------------------ */
 
 /* Expand the hash table if needed */
 static int _dictExpandIfNeeded(dict *d)
 {
     /* Incremental rehashing already in progress. Return. */
-    if (dictIsRehashing(d)) return DICT_OK;
+    if (dictIsRehashing(d)) return d->open ? _dictOpenMakeRoom(d) : DICT_OK;
 
     /* If the hash table is empty expand it to the initial size. */
     if (d->ht[0].size == 0) return dictExpand(d, DICT_HT_INITIAL_SIZE);
 
+    /* An open table can't hold more than its fill limit, whether we are
+     * allowed to resize or not. The DELETED slots count: a rehash to the
+     * same size is just what gets rid of them. */
+    if (d->open) {
+        dictht *ht = &d->ht[0];
+        unsigned long fill = ht->used + *dictOpenDeleted(ht);
+
+        if (fill < dictOpenMaxFill(ht->size)) return DICT_OK;
+        if (fill < dictOpenHardFill(ht->size) && d->type->expandAllowed &&
+            !d->type->expandAllowed(
+                dictOpenAllocSize(_dictOpenSize(ht->used*2)),
+                (double)fill/ht->size))
+            return DICT_OK;
+        return dictExpand(d, ht->used*2);
+    }
+
     /* If we reached the 1:1 ratio, and we are allowed to resize the hash
      * table (global setting) or we should avoid it but the ratio between
      * elements/buckets is over the "safe" threshold, we resize doubling
@@ -964,6 +1434,26 @@ static int _dictExpandIfNeeded(dict *d)
     return DICT_OK;
 }
 
+/* Make sure the new table of an open dictionary in the middle of a rehash
+ * has room for one more entry, besides the ones still to move to it. That
+ * is only a problem when the rehash is stalled by safe iterators or the new
+ * table is not larger than the old one: if there is no iterator we finish
+ * the rehash and grow the table as usual, otherwise the table goes over its
+ * fill limit, but must keep an EMPTY slot. */
+static int _dictOpenMakeRoom(dict *d)
+{
+    dictht *ht = &d->ht[1];
+    unsigned long fill = ht->used + *dictOpenDeleted(ht) + d->ht[0].used;
+
+    if (fill < dictOpenMaxFill(ht->size)) return DICT_OK;
+    if (d->iterators == 0) {
+        while(dictRehash(d,100));
+        return _dictExpandIfNeeded(d);
+    }
+    assert(fill < ht->size-1);
+    return DICT_OK;
+}
+
 /* Our hash table capability is a power of two */
 static unsigned long _dictNextPower(unsigned long size)
 {
@@ -977,6 +1467,17 @@ static unsigned long _dictNextPower(unsigned long size)
     }
 }
 
+/* The size of an open table for 'size' entries: the slots over its fill
+ * limit must stay free. */
+static unsigned long _dictOpenSize(unsigned long size)
+{
+    unsigned long realsize = _dictNextPower(size);
+
+    while(dictOpenMaxFill(realsize) < size && realsize < LONG_MAX)
+        realsize *= 2;
+    return realsize;
+}
+
 /* Returns the index of a free slot that can be populated with
  * a hash entry for the given 'key'.
  * If the key already exists, -1 is returned
@@ -1024,6 +1525,14 @@ void dictDisableResize(void) {
     dict_can_resize = 0;
 }
 
+void dictEnableRehashSteps(void) {
+    dict_can_rehash_step = 1;
+}
+
+void dictDisableRehashSteps(void) {
+    dict_can_rehash_step = 0;
+}
+
 uint64_t dictGetHash(dict *d, const void *key) {
     return dictHashKey(d, key);
 }
@@ -1038,6 +1547,7 @@ dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t h
     unsigned long idx, table;
 
     if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
+    if (d->open) return NULL; /* see dictFindEntryByPtrAndHash() */
     for (table = 0; table <= 1; table++) {
         idx = hash & d->ht[table].sizemask;
         heref = &d->ht[table].table[idx];
@@ -1053,6 +1563,51 @@ dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t h
     return NULL;
 }
 
+/* Like dictFindEntryRefByPtrAndHash(), but return the dictEntry itself.
+ * Open tables have no reference to their entries, only this one works with
+ * them. */
+dictEntry *dictFindEntryByPtrAndHash(dict *d, const void *oldptr, uint64_t hash) {
+    unsigned long table;
+
+    if (!d->open) {
+        dictEntry **heref = dictFindEntryRefByPtrAndHash(d, oldptr, hash);
+        return heref ? *heref : NULL;
+    }
+    if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
+    for (table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+        dictEntry *slots = dictOpenSlots(ht);
+        unsigned char *ctrl = dictOpenCtrl(ht);
+        unsigned long i;
+
+        for (i = hash & ht->sizemask; ctrl[i] != DICT_CTRL_EMPTY;
+             i = (i+1) & ht->sizemask)
+        {
+            if ((ctrl[i] & DICT_CTRL_FULL) && slots[i].key == oldptr)
+                return slots+i;
+        }
+        if (!dictIsRehashing(d)) return NULL;
+    }
+    return NULL;
+}
+
+/* Return the memory used by the hash tables and entries of the dictionary,
+ * not counting the keys and values. */
+size_t dictMemUsage(const dict *d) {
+    size_t mem = 0;
+    int table;
+
+    for (table = 0; table <= 1; table++) {
+        const dictht *ht = &d->ht[table];
+
+        if (d->open)
+            mem += ht->size ? dictOpenAllocSize(ht->size) : 0;
+        else
+            mem += ht->size*sizeof(dictEntry*) + ht->used*sizeof(dictEntry);
+    }
+    return mem;
+}
+
 /* ------------------------------- Debugging ---------------------------------*/
 
 #define DICT_STATS_VECTLEN 50
@@ -1117,16 +1672,70 @@ size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
     return strlen(buf);
 }
 
+/* The stats of an open table: instead of chains, the distribution of the
+ * number of slots a lookup probes to find each entry. */
+size_t _dictGetStatsOpenHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
+    unsigned long i, probes, maxprobes = 0, totprobes = 0, deleted = 0;
+    unsigned long plvector[DICT_STATS_VECTLEN];
+    dictEntry *slots = dictOpenSlots(ht);
+    unsigned char *ctrl = dictOpenCtrl(ht);
+    size_t l = 0;
+
+    if (ht->used == 0) {
+        return snprintf(buf,bufsize,
+            "No stats available for empty dictionaries\n");
+    }
+
+    /* Compute stats. */
+    for (i = 0; i < DICT_STATS_VECTLEN; i++) plvector[i] = 0;
+    for (i = 0; i < ht->size; i++) {
+        if (ctrl[i] == DICT_CTRL_DELETED) deleted++;
+        if (!(ctrl[i] & DICT_CTRL_FULL)) continue;
+        probes = ((i - dictOpenHash(slots+i)) & ht->sizemask) + 1;
+        plvector[(probes < DICT_STATS_VECTLEN) ? probes : (DICT_STATS_VECTLEN-1)]++;
+        if (probes > maxprobes) maxprobes = probes;
+        totprobes += probes;
+    }
+
+    /* Generate human readable stats. */
+    l += snprintf(buf+l,bufsize-l,
+        "Hash table %d stats (%s, open addressing):\n"
+        " table size: %ld\n"
+        " number of elements: %ld\n"
+        " deleted slots: %ld\n"
+        " max probe length: %ld\n"
+        " avg probe length: %.02f\n"
+        " Probe length distribution:\n",
+        tableid, (tableid == 0) ? "main hash table" : "rehashing target",
+        ht->size, ht->used, deleted, maxprobes,
+        (float)totprobes/ht->used);
+
+    for (i = 1; i < DICT_STATS_VECTLEN; i++) {
+        if (plvector[i] == 0) continue;
+        if (l >= bufsize) break;
+        l += snprintf(buf+l,bufsize-l,
+            "   %s%ld: %ld (%.02f%%)\n",
+            (i == DICT_STATS_VECTLEN-1)?">= ":"",
+            i, plvector[i], ((float)plvector[i]/ht->used)*100);
+    }
+
+    /* Unlike snprintf(), return the number of characters actually written. */
+    if (bufsize) buf[bufsize-1] = '\0';
+    return strlen(buf);
+}
+
 void dictGetStats(char *buf, size_t bufsize, dict *d) {
     size_t l;
     char *orig_buf = buf;
     size_t orig_bufsize = bufsize;
+    size_t (*getstats)(char *, size_t, dictht *, int) =
+        d->open ? _dictGetStatsOpenHt : _dictGetStatsHt;
 
-    l = _dictGetStatsHt(buf,bufsize,&d->ht[0],0);
+    l = getstats(buf,bufsize,&d->ht[0],0);
     buf += l;
     bufsize -= l;
     if (dictIsRehashing(d) && bufsize > 0) {
-        _dictGetStatsHt(buf,bufsize,&d->ht[1],1);
+        getstats(buf,bufsize,&d->ht[1],1);
     }
     /* Make sure there is a NULL term at the end. */
     if (orig_bufsize) orig_buf[orig_bufsize-1] = '\0';
@@ -1173,18 +1782,22 @@ dictType BenchmarkDictType = {
     printf(msg ": %ld items in %lld ms\n", count, elapsed); \
 } while(0);
 
-/* dict-benchmark [count] */
+/* dict-benchmark [count] [open] */
 int main(int argc, char **argv) {
     long j;
     long long start, elapsed;
-    dict *dict = dictCreate(&BenchmarkDictType,NULL);
+    dict *dict;
     long count = 0;
 
-    if (argc == 2) {
+    if (argc >= 2) {
         count = strtol(argv[1],NULL,10);
     } else {
         count = 5000000;
     }
+    if (argc >= 3 && !strcmp(argv[2],"open"))
+        dict = dictCreateOpen(&BenchmarkDictType,NULL);
+    else
+        dict = dictCreate(&BenchmarkDictType,NULL);
 
     start_benchmark();
     for (j = 0; j < count; j++) {
@@ -34,6 +34,7 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifndef __DICT_H
 #define __DICT_H
@@ -62,10 +63,25 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata, const void *key1, const void *key2);
     void (*keyDestructor)(void *privdata, void *key);
     void (*valDestructor)(void *privdata, void *obj);
+    /* Open tables only: may an open table grow by moreMem bytes, or fill
+     * over its usual limit instead? usedRatio is its current fill. */
+    int (*expandAllowed)(size_t moreMem, double usedRatio);
+    /* Chained tables only: the key is copied into its entry, which is
+     * embedKeyLen(key) bytes larger, by embedKey(), in place of keyDup().
+     * It is freed with the entry, keyDestructor is not called. */
+    size_t (*embedKeyLen)(const void *key);
+    void *(*embedKey)(void *buf, const void *key);
+    /* Allocate the tables with zcalloc_huge(). Must not change while a dict
+     * of the type exists. */
+    int hugeTables;
 } dictType;
 
 /* This is our hash table structure. Every dictionary has two of this as we
- * implement incremental rehashing, for the old to the new table. */
+ * implement incremental rehashing, for the old to the new table.
+ *
+ * In a dictionary created with dictCreateOpen() 'table' is not an array of
+ * buckets but the entries themselves, followed by control bytes: see the
+ * open addressing section of dict.c. */
 typedef struct dictht {
     dictEntry **table;
     unsigned long size;
@@ -79,6 +95,7 @@ typedef struct dict {
     dictht ht[2];
     long rehashidx; /* rehashing not in progress if rehashidx == -1 */
     unsigned long iterators; /* number of iterators currently running */
+    int open; /* open addressing tables, see dictCreateOpen() */
 } dict;
 
 /* If safe is set to 1 this is a safe iterator, that means, you can call
@@ -122,7 +139,7 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
     do { (entry)->v.d = _val_; } while(0)
 
 #define dictFreeKey(d, entry) \
-    if ((d)->type->keyDestructor) \
+    if ((d)->type->keyDestructor && !dictEmbedsKeys(d)) \
         (d)->type->keyDestructor((d)->privdata, (entry)->key)
 
 #define dictSetKey(d, entry, _key_) do { \
@@ -146,9 +163,15 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 #define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size)
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
 #define dictIsRehashing(d) ((d)->rehashidx != -1)
+#define dictIsOpen(d) ((d)->open)
+#define dictEmbedsKeys(d) (!(d)->open && (d)->type->embedKey)
+/* Like a safe iterator, stop rehashing steps until resumed. */
+#define dictPauseRehashing(d) ((d)->iterators++)
+#define dictResumeRehashing(d) ((d)->iterators--)
 
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);
+dict *dictCreateOpen(dictType *type, void *privDataPtr);
 int dictExpand(dict *d, unsigned long size);
 int dictAdd(dict *d, void *key, void *val);
 dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing);
@@ -160,6 +183,7 @@ void dictFreeUnlinkedEntry(dict *d, dictEntry *he);
 void dictRelease(dict *d);
 dictEntry * dictFind(dict *d, const void *key);
 void *dictFetchValue(dict *d, const void *key);
+void dictPrefetch(dict *d, const uint64_t *hashes, int count, int vals);
 int dictResize(dict *d);
 dictIterator *dictGetIterator(dict *d);
 dictIterator *dictGetSafeIterator(dict *d);
@@ -169,18 +193,25 @@ dictEntry *dictGetRandomKey(dict *d);
 dictEntry *dictGetFairRandomKey(dict *d);
 unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count);
 void dictGetStats(char *buf, size_t bufsize, dict *d);
+size_t dictMemUsage(const dict *d);
 uint64_t dictGenHashFunction(const void *key, int len);
 uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len);
 void dictEmpty(dict *d, void(callback)(void*));
 void dictEnableResize(void);
 void dictDisableResize(void);
+void dictEnableRehashSteps(void);
+void dictDisableRehashSteps(void);
 int dictRehash(dict *d, int n);
 int dictRehashMilliseconds(dict *d, int ms);
+int dictRehashMicroseconds(dict *d, long long us);
 void dictSetHashFunctionSeed(uint8_t *seed);
 uint8_t *dictGetHashFunctionSeed(void);
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata);
+void dictScanSlots(dict *d, unsigned long start, unsigned long end, dictScanFunction *fn, void *privdata);
+int dictScanPassed(unsigned long cursor, uint64_t hash);
 uint64_t dictGetHash(dict *d, const void *key);
 dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t hash);
+dictEntry *dictFindEntryByPtrAndHash(dict *d, const void *oldptr, uint64_t hash);
 
 /* Hash table types */
 extern dictType dictTypeHeapStringCopyKey;
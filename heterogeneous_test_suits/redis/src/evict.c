@@ -48,8 +48,14 @@
  * instead of the idle time, so that we still evict by larger value (larger
  * inverse frequency means to evict keys with the least frequent accesses).
  *
- * Empty entries have the key pointer set to NULL. */
+ * Empty entries have the key pointer set to NULL.
+ *
+ * The pool has EVPOOL_SIZE entries, or more when maxmemory-eviction-batch
+ * asks to evict many keys per freeMemoryIfNeeded() call: a batch needs a
+ * pool with at least as many good candidates as the keys it evicts. */
 #define EVPOOL_SIZE 16
+#define EVPOOL_WARM_LEVEL 0.9 /* Memory level from which cron fills the pool. */
+#define EVPOOL_WARM_MAX_ROUNDS 16 /* Max sampling rounds per db per cron. */
 #define EVPOOL_CACHED_SDS_SIZE 255
 struct evictionPoolEntry {
     unsigned long long idle;    /* Object idle time (inverse frequency for LFU) */
@@ -59,6 +65,7 @@ struct evictionPoolEntry {
 };
 
 static struct evictionPoolEntry *EvictionPoolLRU;
+static int EvictionPoolSize;
 
 /* ----------------------------------------------------------------------------
  * Implementation of eviction, aging and LRU
@@ -135,19 +142,67 @@ unsigned long long estimateObjectIdleTime(robj *o) {
  * one key that can be evicted, if there is at least one key that can be
  * evicted in the whole database. */
 
+/* Return the number of entries of the eviction pool for the current
+ * maxmemory-eviction-batch setting. */
+static int evictionPoolWantedSize(void) {
+    int size = server.maxmemory_eviction_batch*2;
+    return size > EVPOOL_SIZE ? size : EVPOOL_SIZE;
+}
+
 /* Create a new eviction pool. */
 void evictionPoolAlloc(void) {
     struct evictionPoolEntry *ep;
-    int j;
+    int j, size = evictionPoolWantedSize();
 
-    ep = zmalloc(sizeof(*ep)*EVPOOL_SIZE);
-    for (j = 0; j < EVPOOL_SIZE; j++) {
+    ep = zmalloc(sizeof(*ep)*size);
+    for (j = 0; j < size; j++) {
         ep[j].idle = 0;
         ep[j].key = NULL;
         ep[j].cached = sdsnewlen(NULL,EVPOOL_CACHED_SDS_SIZE);
         ep[j].dbid = 0;
     }
     EvictionPoolLRU = ep;
+    EvictionPoolSize = size;
+}
+
+/* Reallocate the eviction pool after maxmemory-eviction-batch changed.
+ * The candidates are forgotten, the next sampling finds new ones. */
+void evictionPoolResize(void) {
+    int j;
+
+    if (evictionPoolWantedSize() == EvictionPoolSize) return;
+    for (j = 0; j < EvictionPoolSize; j++) {
+        struct evictionPoolEntry *e = EvictionPoolLRU+j;
+        if (e->key && e->key != e->cached) sdsfree(e->key);
+        sdsfree(e->cached);
+    }
+    zfree(EvictionPoolLRU);
+    evictionPoolAlloc();
+}
+
+/* Return the eviction score of a key according to the policy: this is
+ * called idle just because the code initially handled LRU, but is in fact
+ * just a score where an higher score means better candidate. 'o' is the
+ * value of the key and 'when' its expire time, only the one the policy
+ * needs has to be valid. */
+static unsigned long long evictionPoolScore(robj *o, long long when) {
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_LRU) {
+        return estimateObjectIdleTime(o);
+    } else if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+        /* When we use an LRU policy, we sort the keys by idle time
+         * so that we expire keys starting from greater idle time.
+         * However when the policy is an LFU one, we have a frequency
+         * estimation, and we want to evict keys with lower frequency
+         * first. So inside the pool we put objects using the inverted
+         * frequency subtracting the actual frequency to the maximum
+         * frequency of 255. */
+        return 255-LFUDecrAndReturn(o);
+    } else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
+        /* In this case the sooner the expire the better. */
+        return ULLONG_MAX - when;
+    } else {
+        serverPanic("Unknown eviction policy in evictionPoolScore()");
+    }
 }
 
 /* This is an helper function for freeMemoryIfNeeded(), it is used in order
@@ -179,53 +234,35 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
         if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
             if (sampledict != keydict) de = dictFind(keydict, key);
             o = dictGetVal(de);
-        }
-
-        /* Calculate the idle time according to the policy. This is called
-         * idle just because the code initially handled LRU, but is in fact
-         * just a score where an higher score means better candidate. */
-        if (server.maxmemory_policy & MAXMEMORY_FLAG_LRU) {
-            idle = estimateObjectIdleTime(o);
-        } else if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-            /* When we use an LRU policy, we sort the keys by idle time
-             * so that we expire keys starting from greater idle time.
-             * However when the policy is an LFU one, we have a frequency
-             * estimation, and we want to evict keys with lower frequency
-             * first. So inside the pool we put objects using the inverted
-             * frequency subtracting the actual frequency to the maximum
-             * frequency of 255. */
-            idle = 255-LFUDecrAndReturn(o);
-        } else if (server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL) {
-            /* In this case the sooner the expire the better. */
-            idle = ULLONG_MAX - (long)dictGetVal(de);
         } else {
-            serverPanic("Unknown eviction policy in evictionPoolPopulate()");
+            o = NULL;
         }
+        idle = evictionPoolScore(o,(long)dictGetVal(de));
 
         /* Insert the element inside the pool.
          * First, find the first empty bucket or the first populated
          * bucket that has an idle time smaller than our idle time. */
         k = 0;
-        while (k < EVPOOL_SIZE &&
+        while (k < EvictionPoolSize &&
                pool[k].key &&
                pool[k].idle < idle) k++;
-        if (k == 0 && pool[EVPOOL_SIZE-1].key != NULL) {
+        if (k == 0 && pool[EvictionPoolSize-1].key != NULL) {
             /* Can't insert if the element is < the worst element we have
              * and there are no empty buckets. */
             continue;
-        } else if (k < EVPOOL_SIZE && pool[k].key == NULL) {
+        } else if (k < EvictionPoolSize && pool[k].key == NULL) {
             /* Inserting into empty position. No setup needed before insert. */
         } else {
             /* Inserting in the middle. Now k points to the first element
              * greater than the element to insert.  */
-            if (pool[EVPOOL_SIZE-1].key == NULL) {
+            if (pool[EvictionPoolSize-1].key == NULL) {
                 /* Free space on the right? Insert at k shifting
                  * all the elements from k to end to the right. */
 
                 /* Save SDS before overwriting. */
-                sds cached = pool[EVPOOL_SIZE-1].cached;
+                sds cached = pool[EvictionPoolSize-1].cached;
                 memmove(pool+k+1,pool+k,
-                    sizeof(pool[0])*(EVPOOL_SIZE-k-1));
+                    sizeof(pool[0])*(EvictionPoolSize-k-1));
                 pool[k].cached = cached;
             } else {
                 /* No free space on right? Insert at k-1 */
@@ -357,14 +394,17 @@ size_t freeMemoryGetNotCountedMemory(void) {
         listIter li;
         listNode *ln;
 
+        /* The slaves share the replication buffer past the backlog. */
+        overhead += replicationBufferNotCountedMemory();
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             client *slave = listNodeValue(ln);
-            overhead += getClientOutputBufferMemoryUsage(slave);
+            overhead += getClientOutputBufferMemoryUsage(slave) -
+                        getClientReplBufferMemoryUsage(slave);
         }
     }
     if (server.aof_state != AOF_OFF) {
-        overhead += sdsalloc(server.aof_buf)+aofRewriteBufferSize();
+        overhead += sdsalloc(server.aof_buf);
     }
     return overhead;
 }
@@ -449,9 +489,11 @@ int freeMemoryIfNeeded(void) {
     if (server.masterhost && server.repl_slave_ignore_maxmemory) return C_OK;
 
     size_t mem_reported, mem_tofree, mem_freed;
-    mstime_t latency, eviction_latency;
+    long long cycle_start, del_start, del_usec;
     long long delta;
     int slaves = listLength(server.slaves);
+    int batch = server.maxmemory_eviction_batch, evicted = 0;
+    lazyfreeBatch *lazybatch = NULL;
 
     /* When clients are paused the dataset should be static not just from the
      * POV of clients not being able to write, but also from the POV of
@@ -465,8 +507,11 @@ int freeMemoryIfNeeded(void) {
     if (server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
         goto cant_free; /* We need to free memory, but policy forbids. */
 
-    latencyStartMonitor(latency);
-    while (mem_freed < mem_tofree) {
+    /* With maxmemory-eviction-batch we don't stop as soon as we are back
+     * under the limit, but after evicting at least 'batch' keys, so that the
+     * next writes find some room and don't have to evict again. */
+    cycle_start = ustime();
+    while (mem_freed < mem_tofree || evicted < batch) {
         int j, k, i, keys_freed = 0;
         static unsigned int next_db = 0;
         sds bestkey = NULL;
@@ -485,20 +530,26 @@ int freeMemoryIfNeeded(void) {
 
                 /* We don't want to make local-db choices when expiring keys,
                  * so to start populate the eviction pool sampling keys from
-                 * every DB. */
+                 * every DB. A pool larger than the default one is only
+                 * populated once it is half empty: it is kept full by
+                 * evictionPoolWarm(), and a batch can take many keys from
+                 * it before sampling again. */
+                int populate = EvictionPoolSize == EVPOOL_SIZE ||
+                               pool[EvictionPoolSize/2].key == NULL;
                 for (i = 0; i < server.dbnum; i++) {
                     db = server.db+i;
                     dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
                             db->dict : db->expires;
                     if ((keys = dictSize(dict)) != 0) {
-                        evictionPoolPopulate(i, dict, db->dict, pool);
+                        if (populate)
+                            evictionPoolPopulate(i, dict, db->dict, pool);
                         total_keys += keys;
                     }
                 }
                 if (!total_keys) break; /* No keys to evict. */
 
                 /* Go backward from best to worst element to evict. */
-                for (k = EVPOOL_SIZE-1; k >= 0; k--) {
+                for (k = EvictionPoolSize-1; k >= 0; k--) {
                     if (pool[k].key == NULL) continue;
                     bestdbid = pool[k].dbid;
 
@@ -510,6 +561,25 @@ int freeMemoryIfNeeded(void) {
                             pool[k].key);
                     }
 
+                    /* The key may have been accessed, or its expire changed,
+                     * since it was sampled: if its score is now worse, it is
+                     * no longer the candidate we picked. Treat it as a
+                     * ghost, later sampling will find it again if it
+                     * deserves it. */
+                    if (de) {
+                        robj *o = NULL;
+
+                        if (server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) {
+                            dictEntry *kde = (server.maxmemory_policy &
+                                              MAXMEMORY_FLAG_ALLKEYS) ? de :
+                                dictFind(server.db[pool[k].dbid].dict,
+                                         pool[k].key);
+                            o = dictGetVal(kde);
+                        }
+                        if (evictionPoolScore(o,(long)dictGetVal(de)) <
+                            pool[k].idle) de = NULL;
+                    }
+
                     /* Remove the entry from the pool. */
                     if (pool[k].key != pool[k].cached)
                         sdsfree(pool[k].key);
@@ -563,14 +633,16 @@ int freeMemoryIfNeeded(void) {
              * AOF and Output buffer memory will be freed eventually so
              * we only care about memory used by the key space. */
             delta = (long long) zmalloc_used_memory();
-            latencyStartMonitor(eviction_latency);
-            if (server.lazyfree_lazy_eviction)
+            del_start = ustime();
+            if (server.lazyfree_lazy_eviction && batch > 1)
+                dbAsyncDeleteBatched(db,keyobj,&lazybatch);
+            else if (server.lazyfree_lazy_eviction)
                 dbAsyncDelete(db,keyobj);
             else
                 dbSyncDelete(db,keyobj);
-            latencyEndMonitor(eviction_latency);
-            latencyAddSampleIfNeeded("eviction-del",eviction_latency);
-            latencyRemoveNestedEvent(latency,eviction_latency);
+            del_usec = ustime()-del_start;
+            latencyAddSampleIfNeeded("eviction-del",del_usec/1000);
+            cycle_start += del_usec; /* Not part of the cycle itself. */
             delta -= (long long) zmalloc_used_memory();
             mem_freed += delta;
             server.stat_evictedkeys++;
@@ -578,6 +650,7 @@ int freeMemoryIfNeeded(void) {
                 keyobj, db->id);
             decrRefCount(keyobj);
             keys_freed++;
+            evicted++;
 
             /* When the memory to free starts to be big enough, we may
              * start spending so much time here that is impossible to
@@ -591,8 +664,15 @@ int freeMemoryIfNeeded(void) {
              * check, from time to time, if we already reached our target
              * memory, since the "mem_freed" amount is computed only
              * across the dbAsyncDelete() call, while the thread can
-             * release the memory all the time. */
-            if (server.lazyfree_lazy_eviction && !(keys_freed % 16)) {
+             * release the memory all the time. The values of a batch are
+             * handed to the thread at the same time, or there would be
+             * nothing released yet to check. */
+            if (server.lazyfree_lazy_eviction && !(evicted % 16)) {
+                if (lazybatch) {
+                    lazyfreeBatchSubmit(lazybatch);
+                    lazybatch = NULL;
+                }
+                lazyfreeFlushPending();
                 if (getMaxmemoryState(NULL,NULL,NULL,NULL) == C_OK) {
                     /* Let's satisfy our stop condition. */
                     mem_freed = mem_tofree;
@@ -601,16 +681,19 @@ int freeMemoryIfNeeded(void) {
         }
 
         if (!keys_freed) {
-            latencyEndMonitor(latency);
-            latencyAddSampleIfNeeded("eviction-cycle",latency);
+            /* Nothing left to evict: fine if only the batch is short. */
+            if (mem_freed >= mem_tofree) break;
+            latencyAddEventSample(LATENCY_EVENT_EVICTION,ustime()-cycle_start);
             goto cant_free; /* nothing to free... */
         }
     }
-    latencyEndMonitor(latency);
-    latencyAddSampleIfNeeded("eviction-cycle",latency);
+    if (lazybatch) lazyfreeBatchSubmit(lazybatch);
+    latencyAddEventSample(LATENCY_EVENT_EVICTION,ustime()-cycle_start);
     return C_OK;
 
 cant_free:
+    if (lazybatch) lazyfreeBatchSubmit(lazybatch);
+    lazyfreeFlushPending();
     /* We are here if we are not able to reclaim memory. There is only one
      * last thing we can try: check if the lazyfree thread has jobs in queue
      * and wait... */
@@ -622,6 +705,40 @@ cant_free:
     return C_ERR;
 }
 
+/* Called by serverCron() to keep the eviction pool full of good candidates
+ * when maxmemory-eviction-batch is used, so that the write that crosses the
+ * memory limit finds the candidates of its batch already sampled instead of
+ * sampling them itself. Nothing is done while memory is under
+ * EVPOOL_WARM_LEVEL of the limit, the pool would only grow stale. */
+void evictionPoolWarm(void) {
+    float level;
+    int i, rounds;
+
+    if (EvictionPoolSize == EVPOOL_SIZE || !server.maxmemory) return;
+    if (!(server.maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)) &&
+        server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL) return;
+    if (server.masterhost && server.repl_slave_ignore_maxmemory) return;
+    if (server.lua_timedout || server.loading || clientsArePaused()) return;
+    getMaxmemoryState(NULL,NULL,NULL,&level);
+    if (level < EVPOOL_WARM_LEVEL) return;
+
+    /* Every round samples maxmemory-samples keys per DB: do enough rounds
+     * to fill the pool once, as the sampling replaces the worst entries
+     * when it is full. */
+    rounds = EvictionPoolSize/server.maxmemory_samples;
+    if (rounds > EVPOOL_WARM_MAX_ROUNDS) rounds = EVPOOL_WARM_MAX_ROUNDS;
+    if (rounds < 1) rounds = 1;
+    while (rounds--) {
+        for (i = 0; i < server.dbnum; i++) {
+            redisDb *db = server.db+i;
+            dict *d = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
+                      db->dict : db->expires;
+            if (dictSize(d) != 0)
+                evictionPoolPopulate(i,d,db->dict,EvictionPoolLRU);
+        }
+    }
+}
+
 /* This is a wrapper for freeMemoryIfNeeded() that only really calls the
  * function if right now there are the conditions to do so safely:
  *
@@ -32,6 +32,176 @@
 
 #include "server.h"
 
+/*-----------------------------------------------------------------------------
+ * Time ordered index of the expires
+ *
+ * With active-expire-index enabled every DB keeps, besides the 'expires'
+ * dict, a radix tree of the keys with an expire, ordered by expire time:
+ * every element is the time as 8 bytes big endian followed by the key name.
+ * The active expire cycle then walks the tree from the start and finds all
+ * the expired keys and nothing else, instead of sampling random keys, so a
+ * burst of keys expiring together is reclaimed as fast as it is found.
+ *----------------------------------------------------------------------------*/
+
+/* Max number of keys collected from the index before deleting them: the
+ * tree can't be modified while an iterator is walking it. */
+#define EXPIRE_INDEX_BATCH 128
+
+/* Write the index element of 'key' expiring at 'when' to 'buf', that has
+ * room for 8+sdslen(key) bytes. The sign bit is flipped, so that times
+ * before 1970 still sort before the others. */
+static void expireIndexEncode(unsigned char *buf, sds key, long long when) {
+    uint64_t t = (uint64_t)when ^ (1ULL << 63);
+    int j;
+
+    for (j = 7; j >= 0; j--) {
+        buf[j] = t & 0xff;
+        t >>= 8;
+    }
+    memcpy(buf+8,key,sdslen(key));
+}
+
+static long long expireIndexDecodeTime(unsigned char *buf) {
+    uint64_t t = 0;
+    int j;
+
+    for (j = 0; j < 8; j++) t = (t << 8) | buf[j];
+    return (long long)(t ^ (1ULL << 63));
+}
+
+static void expireIndexUpdate(redisDb *db, sds key, long long when, int add) {
+    unsigned char buf[64];
+    unsigned char *indexed = buf;
+    size_t len = sdslen(key)+8;
+
+    if (len > sizeof(buf)) indexed = zmalloc(len);
+    expireIndexEncode(indexed,key,when);
+    if (add)
+        raxInsert(db->expires_index,indexed,len,NULL,NULL);
+    else
+        raxRemove(db->expires_index,indexed,len,NULL);
+    if (indexed != buf) zfree(indexed);
+}
+
+/* Add 'key', expiring at 'when', to the index of 'db'. */
+void expireIndexAdd(redisDb *db, sds key, long long when) {
+    expireIndexUpdate(db,key,when,1);
+}
+
+/* Remove 'key' from the index of 'db', if it has an expire. Must be called
+ * before the key is removed from db->expires. */
+void expireIndexDel(redisDb *db, sds key) {
+    dictEntry *de = dictFind(db->expires,key);
+
+    if (de) expireIndexUpdate(db,key,dictGetSignedIntegerVal(de),0);
+}
+
+/* Empty the index of 'db'. */
+void expireIndexFlush(redisDb *db) {
+    if (db->expires_index == NULL) return;
+    raxFree(db->expires_index);
+    db->expires_index = raxNew();
+}
+
+/* Create or release the indexes of all the DBs after active-expire-index
+ * changed. Enabling it at runtime indexes all the keys with an expire at
+ * once, which takes a time proportional to their number. */
+void expireIndexConfigure(void) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+
+        if (server.active_expire_index && db->expires_index == NULL) {
+            dictIterator *di = dictGetIterator(db->expires);
+            dictEntry *de;
+
+            db->expires_index = raxNew();
+            while((de = dictNext(di)) != NULL)
+                expireIndexAdd(db,dictGetKey(de),dictGetSignedIntegerVal(de));
+            dictReleaseIterator(di);
+        } else if (!server.active_expire_index && db->expires_index) {
+            raxFree(db->expires_index);
+            db->expires_index = NULL;
+        }
+    }
+}
+
+/* Fold a sample of TTLs into the average TTL of the DB, a running average
+ * where the new sample weights 2%. */
+static void activeExpireUpdateAvgTTL(redisDb *db, long long ttl_sum,
+                                     int ttl_samples)
+{
+    long long avg_ttl;
+
+    if (ttl_samples == 0) return;
+    avg_ttl = ttl_sum/ttl_samples;
+    if (db->avg_ttl == 0) db->avg_ttl = avg_ttl;
+    db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
+}
+
+/* Expire the keys of 'db' whose time is up, walking the index in time order
+ * until a key expiring in the future is found. Values are released by the
+ * lazyfree thread, in batches. Returns 1 if the cycle ran out of time, the
+ * one started at 'start' having 'timelimit' microseconds, 0 otherwise. */
+static int activeExpireIndexCycle(redisDb *db, long long start,
+                                  long long timelimit)
+{
+    lazyfreeBatch *batch = NULL;
+    long long now, ttl_sum = 0;
+    int j, n, ttl_samples = 0, timedout = 0;
+
+    do {
+        robj *keys[EXPIRE_INDEX_BATCH];
+        raxIterator ri;
+
+        now = mstime();
+        n = 0;
+        raxStart(&ri,db->expires_index);
+        raxSeek(&ri,"^",NULL,0);
+        while (n < EXPIRE_INDEX_BATCH && raxNext(&ri)) {
+            if (expireIndexDecodeTime(ri.key) >= now) break;
+            keys[n++] = createStringObject((char*)ri.key+8,ri.key_len-8);
+        }
+        raxStop(&ri);
+
+        for (j = 0; j < n; j++) {
+            long long when = getExpire(db,keys[j]);
+
+            /* A module reacting to the previous notifications may have
+             * changed the key in the meantime. */
+            if (when != -1 && now > when) {
+                propagateExpire(db,keys[j],server.lazyfree_lazy_expire);
+                dbAsyncDeleteBatched(db,keys[j],&batch);
+                notifyKeyspaceEvent(NOTIFY_EXPIRED,
+                    "expired",keys[j],db->id);
+                server.stat_expiredkeys++;
+            }
+            decrRefCount(keys[j]);
+        }
+        if (n == EXPIRE_INDEX_BATCH && ustime()-start > timelimit) {
+            timedout = 1;
+            server.stat_expired_time_cap_reached_count++;
+        }
+    } while (n == EXPIRE_INDEX_BATCH && !timedout);
+    if (batch) lazyfreeBatchSubmit(batch);
+
+    /* The index needs no sampling, but a few keys are still sampled to
+     * keep the average TTL of the DB up to date. */
+    for (j = 0; j < 5 && dictSize(db->expires); j++) {
+        dictEntry *de = dictGetRandomKey(db->expires);
+        long long ttl = dictGetSignedIntegerVal(de)-now;
+
+        if (ttl > 0) {
+            ttl_sum += ttl;
+            ttl_samples++;
+        }
+    }
+    if (dictSize(db->expires) == 0) db->avg_ttl = 0;
+    activeExpireUpdateAvgTTL(db,ttl_sum,ttl_samples);
+    return timedout;
+}
+
 /*-----------------------------------------------------------------------------
  * Incremental collection of expired keys.
  *
@@ -129,6 +299,9 @@ void activeExpireCycle(int type) {
     if (dbs_per_call > server.dbnum || timelimit_exit)
         dbs_per_call = server.dbnum;
 
+    /* With the index an idle DB costs a single lookup, check all of them. */
+    if (server.active_expire_index) dbs_per_call = server.dbnum;
+
     /* We can use at max ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC percentage of CPU time
      * per iteration. Since this function gets called with a frequency of
      * server.hz times per second, the following is the max amount of
@@ -155,6 +328,11 @@ void activeExpireCycle(int type) {
          * distribute the time evenly across DBs. */
         current_db++;
 
+        if (db->expires_index) {
+            timelimit_exit = activeExpireIndexCycle(db,start,timelimit);
+            continue;
+        }
+
         /* Continue to expire if at the end of the cycle more than 25%
          * of the keys were expired. */
         do {
@@ -203,15 +381,7 @@ void activeExpireCycle(int type) {
             total_expired += expired;
 
             /* Update the average TTL stats for this database. */
-            if (ttl_samples) {
-                long long avg_ttl = ttl_sum/ttl_samples;
-
-                /* Do a simple running average with a few samples.
-                 * We just use the current estimate with a weight of 2%
-                 * and the previous estimate with a weight of 98%. */
-                if (db->avg_ttl == 0) db->avg_ttl = avg_ttl;
-                db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
-            }
+            activeExpireUpdateAvgTTL(db,ttl_sum,ttl_samples);
 
             /* We can't block forever here even if there are many keys to
              * expire. So after a given amount of milliseconds return to the
@@ -230,7 +400,7 @@ void activeExpireCycle(int type) {
     }
 
     elapsed = ustime()-start;
-    latencyAddSampleIfNeeded("expire-cycle",elapsed/1000);
+    latencyAddEventSample(LATENCY_EVENT_EXPIRE,elapsed);
 
     /* Update our estimate of keys existing but yet to be expired.
      * Running average with this sample accounting for 5%. */
@@ -0,0 +1,373 @@
+/* fpconv_dtoa.c - Shortest round-trip formatting of doubles.
+ *
+ * Every double reply (ZSCORE, ZRANGE WITHSCORES, INCRBYFLOAT...) and every
+ * score written to the RDB or the AOF was formatted with "%.17g", that goes
+ * through the generic printf() machinery and always emits 17 significant
+ * digits, so that 1.1 becomes 1.1000000000000001. This implements Grisu2
+ * (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+ * with Integers", PLDI 2010): the double and its rounding boundaries are
+ * scaled by a cached power of ten so that the digits can be generated with
+ * 64 bit integer arithmetic only, stopping as soon as they identify the
+ * double. The result always reads back as the same double with strtod(),
+ * and it is the shortest such string in the vast majority of cases.
+ *
+ * The digits are laid out like "%.17g" would, so that formatting integers,
+ * exponents and small values does not change for the clients: plain
+ * notation for decimal exponents from -4 to 16, "d.ddde+XX" otherwise.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fpconv_dtoa.h"
+
+#define NPOWERS 87
+#define STEPPOWERS 8
+#define FIRSTPOWER -348 /* 10^-348 */
+#define EXPMAX -32
+#define EXPMIN -60
+
+#define FRACMASK 0x000FFFFFFFFFFFFFULL
+#define EXPMASK 0x7FF0000000000000ULL
+#define HIDDENBIT 0x0010000000000000ULL
+#define SIGNMASK 0x8000000000000000ULL
+#define EXPBIAS (1023 + 52)
+
+/* A floating point number frac * 2^exp, with 64 bits of mantissa. */
+typedef struct fp {
+    uint64_t frac;
+    int exp;
+} fp;
+
+/* 10^(FIRSTPOWER + i*STEPPOWERS), normalized and rounded to 64 bits. */
+static const fp powersTen[NPOWERS] = {
+    { 18054884314459144840U, -1220 }, { 13451937075301367670U, -1193 },
+    { 10022474136428063862U, -1166 }, { 14934650266808366570U, -1140 },
+    { 11127181549972568877U, -1113 }, { 16580792590934885855U, -1087 },
+    { 12353653155963782858U, -1060 }, { 18408377700990114895U, -1034 },
+    { 13715310171984221708U, -1007 }, { 10218702384817765436U, -980 },
+    { 15227053142812498563U, -954 }, { 11345038669416679861U, -927 },
+    { 16905424996341287883U, -901 }, { 12595523146049147757U, -874 },
+    { 9384396036005875287U, -847 }, { 13983839803942852151U, -821 },
+    { 10418772551374772303U, -794 }, { 15525180923007089351U, -768 },
+    { 11567161174868858868U, -741 }, { 17236413322193710309U, -715 },
+    { 12842128665889583758U, -688 }, { 9568131466127621947U, -661 },
+    { 14257626930069360058U, -635 }, { 10622759856335341974U, -608 },
+    { 15829145694278690180U, -582 }, { 11793632577567316726U, -555 },
+    { 17573882009934360870U, -529 }, { 13093562431584567480U, -502 },
+    { 9755464219737475723U, -475 }, { 14536774485912137811U, -449 },
+    { 10830740992659433045U, -422 }, { 16139061738043178685U, -396 },
+    { 12024538023802026127U, -369 }, { 17917957937422433684U, -343 },
+    { 13349918974505688015U, -316 }, { 9946464728195732843U, -289 },
+    { 14821387422376473014U, -263 }, { 11042794154864902060U, -236 },
+    { 16455045573212060422U, -210 }, { 12259964326927110867U, -183 },
+    { 18268770466636286478U, -157 }, { 13611294676837538539U, -130 },
+    { 10141204801825835212U, -103 }, { 15111572745182864684U, -77 },
+    { 11258999068426240000U, -50 }, { 16777216000000000000U, -24 },
+    { 12500000000000000000U, 3 }, { 9313225746154785156U, 30 },
+    { 13877787807814456755U, 56 }, { 10339757656912845936U, 83 },
+    { 15407439555097886824U, 109 }, { 11479437019748901445U, 136 },
+    { 17105694144590052135U, 162 }, { 12744735289059618216U, 189 },
+    { 9495567745759798747U, 216 }, { 14149498560666738074U, 242 },
+    { 10542197943230523224U, 269 }, { 15709099088952724970U, 295 },
+    { 11704190886730495818U, 322 }, { 17440603504673385349U, 348 },
+    { 12994262207056124023U, 375 }, { 9681479787123295682U, 402 },
+    { 14426529090290212157U, 428 }, { 10748601772107342003U, 455 },
+    { 16016664761464807395U, 481 }, { 11933345169920330789U, 508 },
+    { 17782069995880619868U, 534 }, { 13248674568444952270U, 561 },
+    { 9871031767461413346U, 588 }, { 14708983551653345445U, 614 },
+    { 10959046745042015199U, 641 }, { 16330252207878254650U, 667 },
+    { 12166986024289022870U, 694 }, { 18130221999122236476U, 720 },
+    { 13508068024458167312U, 747 }, { 10064294952495520794U, 774 },
+    { 14996968138956309548U, 800 }, { 11173611982879273257U, 827 },
+    { 16649979327439178909U, 853 }, { 12405201291620119593U, 880 },
+    { 9242595204427927429U, 907 }, { 13772540099066387757U, 933 },
+    { 10261342003245940623U, 960 }, { 15290591125556738113U, 986 },
+    { 11392378155556871081U, 1013 }, { 16975966327722178521U, 1039 },
+    { 12648080533535911531U, 1066 },
+};
+
+static const uint64_t tens[] = {
+    10000000000000000000ULL, 1000000000000000000ULL, 100000000000000000ULL,
+    10000000000000000ULL, 1000000000000000ULL, 100000000000000ULL,
+    10000000000000ULL, 1000000000000ULL, 100000000000ULL,
+    10000000000ULL, 1000000000ULL, 100000000ULL,
+    10000000ULL, 1000000ULL, 100000ULL,
+    10000ULL, 1000ULL, 100ULL,
+    10ULL, 1ULL
+};
+
+static uint64_t doubleBits(double d) {
+    uint64_t bits;
+    memcpy(&bits,&d,sizeof(bits));
+    return bits;
+}
+
+static fp buildFp(double d) {
+    uint64_t bits = doubleBits(d);
+    fp f;
+
+    f.frac = bits & FRACMASK;
+    f.exp = (bits & EXPMASK) >> 52;
+    if (f.exp) {
+        f.frac += HIDDENBIT;
+        f.exp -= EXPBIAS;
+    } else {
+        f.exp = -EXPBIAS + 1; /* Subnormal. */
+    }
+    return f;
+}
+
+static void normalize(fp *f) {
+    int shift = 64 - 52 - 1;
+
+    while ((f->frac & HIDDENBIT) == 0) {
+        f->frac <<= 1;
+        f->exp--;
+    }
+    f->frac <<= shift;
+    f->exp -= shift;
+}
+
+/* The boundaries of the interval of the reals rounding to 'f', normalized
+ * with the same exponent. */
+static void normalizedBoundaries(fp *f, fp *lower, fp *upper) {
+    int ushift = 64 - 52 - 2;
+    int lshift = f->frac == HIDDENBIT ? 2 : 1;
+
+    upper->frac = (f->frac << 1) + 1;
+    upper->exp = f->exp - 1;
+    while ((upper->frac & (HIDDENBIT << 1)) == 0) {
+        upper->frac <<= 1;
+        upper->exp--;
+    }
+    upper->frac <<= ushift;
+    upper->exp -= ushift;
+
+    lower->frac = (f->frac << lshift) - 1;
+    lower->exp = f->exp - lshift;
+    lower->frac <<= lower->exp - upper->exp;
+    lower->exp = upper->exp;
+}
+
+/* The cached power of ten that brings the binary exponent 'exp' in the
+ * [EXPMIN,EXPMAX] range, and its decimal exponent in '*k'. */
+static fp cachedPow10(int exp, int *k) {
+    const double one_log_ten = 0.30102999566398114;
+    int approx = -(exp + NPOWERS) * one_log_ten;
+    int idx = (approx - FIRSTPOWER) / STEPPOWERS;
+
+    while (1) {
+        int current = exp + powersTen[idx].exp + 64;
+
+        if (current < EXPMIN) {
+            idx++;
+            continue;
+        }
+        if (current > EXPMAX) {
+            idx--;
+            continue;
+        }
+        *k = FIRSTPOWER + idx * STEPPOWERS;
+        return powersTen[idx];
+    }
+}
+
+/* The upper 64 bits of the 128 bits product, rounded. */
+static fp multiply(fp *a, fp *b) {
+    const uint64_t lomask = 0x00000000FFFFFFFFULL;
+    uint64_t ah_bl = (a->frac >> 32) * (b->frac & lomask);
+    uint64_t al_bh = (a->frac & lomask) * (b->frac >> 32);
+    uint64_t al_bl = (a->frac & lomask) * (b->frac & lomask);
+    uint64_t ah_bh = (a->frac >> 32) * (b->frac >> 32);
+    uint64_t tmp = (ah_bl & lomask) + (al_bh & lomask) + (al_bl >> 32);
+    fp f;
+
+    tmp += 1ULL << 31; /* Round up. */
+    f.frac = ah_bh + (ah_bl >> 32) + (al_bh >> 32) + (tmp >> 32);
+    f.exp = a->exp + b->exp + 64;
+    return f;
+}
+
+/* Move the last digit towards the double while still inside the interval. */
+static void roundDigit(char *digits, int ndigits, uint64_t delta,
+                       uint64_t rem, uint64_t kappa, uint64_t frac)
+{
+    while (rem < frac && delta - rem >= kappa &&
+           (rem + kappa < frac || frac - rem > rem + kappa - frac))
+    {
+        digits[ndigits - 1]--;
+        rem += kappa;
+    }
+}
+
+static int generateDigits(fp *f, fp *upper, fp *lower, char *digits, int *K) {
+    uint64_t wfrac = upper->frac - f->frac;
+    uint64_t delta = upper->frac - lower->frac;
+    uint64_t one = 1ULL << -upper->exp;
+    uint64_t part1 = upper->frac >> -upper->exp;
+    uint64_t part2 = upper->frac & (one - 1);
+    const uint64_t *divp, *unit;
+    int idx = 0, kappa = 10;
+
+    /* The integer part, at most 10 digits. */
+    for (divp = tens + 10; kappa > 0; divp++) {
+        uint64_t div = *divp;
+        unsigned digit = part1 / div;
+        uint64_t tmp;
+
+        if (digit || idx) digits[idx++] = digit + '0';
+        part1 -= digit * div;
+        kappa--;
+        tmp = (part1 << -upper->exp) + part2;
+        if (tmp <= delta) {
+            *K += kappa;
+            roundDigit(digits,idx,delta,tmp,div << -upper->exp,wfrac);
+            return idx;
+        }
+    }
+
+    /* The fractional part. */
+    unit = tens + 18;
+    while (1) {
+        unsigned digit;
+
+        part2 *= 10;
+        delta *= 10;
+        kappa--;
+        digit = part2 >> -upper->exp;
+        if (digit || idx) digits[idx++] = digit + '0';
+        part2 &= one - 1;
+        if (part2 < delta) {
+            *K += kappa;
+            roundDigit(digits,idx,delta,part2,one,wfrac * *unit);
+            return idx;
+        }
+        unit--;
+    }
+}
+
+/* Generate the digits of 'd', a finite non zero positive double, returning
+ * their number. The value is digits * 10^K. */
+static int grisu2(double d, char *digits, int *K) {
+    fp w = buildFp(d);
+    fp lower, upper, cp;
+    int k;
+
+    normalizedBoundaries(&w,&lower,&upper);
+    normalize(&w);
+    cp = cachedPow10(upper.exp,&k);
+    w = multiply(&w,&cp);
+    upper = multiply(&upper,&cp);
+    lower = multiply(&lower,&cp);
+    lower.frac++;
+    upper.frac--;
+    *K = -k;
+    return generateDigits(&w,&upper,&lower,digits,K);
+}
+
+/* Lay out the digits like "%.17g": 'exp' is the decimal exponent of the
+ * first digit. */
+static int emitDigits(char *digits, int ndigits, char *dest, int K) {
+    int exp = ndigits + K - 1;
+    int len = 0, j;
+
+    if (exp < -4 || exp >= 17) {
+        dest[len++] = digits[0];
+        if (ndigits > 1) {
+            dest[len++] = '.';
+            memcpy(dest + len,digits + 1,ndigits - 1);
+            len += ndigits - 1;
+        }
+        dest[len++] = 'e';
+        dest[len++] = exp < 0 ? '-' : '+';
+        if (exp < 0) exp = -exp;
+        if (exp >= 100) {
+            dest[len++] = '0' + exp / 100;
+            exp %= 100;
+        }
+        dest[len++] = '0' + exp / 10;
+        dest[len++] = '0' + exp % 10;
+    } else if (K >= 0) {
+        /* An integer: the digits and the zeros. */
+        memcpy(dest,digits,ndigits);
+        len = ndigits;
+        for (j = 0; j < K; j++) dest[len++] = '0';
+    } else if (exp >= 0) {
+        /* The decimal point falls inside the digits. */
+        memcpy(dest,digits,exp + 1);
+        len = exp + 1;
+        dest[len++] = '.';
+        memcpy(dest + len,digits + exp + 1,ndigits - exp - 1);
+        len += ndigits - exp - 1;
+    } else {
+        /* 0.000ddd */
+        dest[len++] = '0';
+        dest[len++] = '.';
+        for (j = 0; j < -exp - 1; j++) dest[len++] = '0';
+        memcpy(dest + len,digits,ndigits);
+        len += ndigits;
+    }
+    return len;
+}
+
+/* Write the shortest representation of 'd' that reads back as the same
+ * double into 'dest', that must have room for FPCONV_DTOA_MAX bytes. Returns
+ * the length of the string, that is not null terminated. NaN and infinite
+ * values are written as "nan", "inf" and "-inf". */
+int fpconv_dtoa(double d, char *dest) {
+    char digits[18];
+    uint64_t bits = doubleBits(d);
+    int len = 0, ndigits, K = 0;
+
+    if (bits & SIGNMASK) dest[len++] = '-';
+    if ((bits & ~SIGNMASK) == 0) {
+        dest[len++] = '0';
+        return len;
+    }
+    if ((bits & EXPMASK) == EXPMASK) {
+        if (bits & FRACMASK) {
+            memcpy(dest,"nan",3);
+            return 3;
+        }
+        memcpy(dest + len,"inf",3);
+        return len + 3;
+    }
+
+    ndigits = grisu2(d,digits,&K);
+    /* "%g" never shows the trailing zeros of the fraction. */
+    while (ndigits > 1 && digits[ndigits - 1] == '0') {
+        ndigits--;
+        K++;
+    }
+    return len + emitDigits(digits,ndigits,dest + len,K);
+}
@@ -31,6 +31,7 @@
 #include "geo.h"
 #include "geohash_helper.h"
 #include "debugmacro.h"
+#include <math.h>
 
 /* Things exported from t_zset.c only for geo.c, since it is the only other
  * part of Redis that requires close zset introspection. */
@@ -182,52 +183,117 @@ void addReplyDoubleDistance(client *c, double d) {
     addReplyBulkCBuffer(c, dbuf, dlen);
 }
 
-/* Helper function for geoGetPointsInRange(): given a sorted set score
- * representing a point, and another point (the center of our search) and
- * a radius, appends this entry as a geoPoint into the specified geoArray
- * only if the point is within the search area.
- *
- * returns C_OK if the point is included, or REIDS_ERR if it is outside. */
-int geoAppendIfWithinRadius(geoArray *ga, double lon, double lat, double radius, double score, sds member) {
-    double distance, xy[2];
-
-    if (!decodeGeohash(score,xy)) return C_ERR; /* Can't decode. */
-    /* Note that geohashGetDistanceIfInRadiusWGS84() takes arguments in
-     * reverse order: longitude first, latitude later. */
-    if (!geohashGetDistanceIfInRadiusWGS84(lon,lat, xy[0], xy[1],
-                                           radius, &distance))
+/* The center and radius of a GEORADIUS search, with what the distance filter
+ * needs computed once per query instead of once per candidate. */
+typedef struct geoSearch {
+    double lon, lat;            /* Center, in degrees. */
+    double radius;              /* Meters. */
+    double lat_r, cos_lat;      /* Center latitude in radians, its cosine. */
+    double max_dlat;            /* Latitude difference always too far. */
+    double max_a;               /* Haversine 'a' term always too far. */
+    double bounds[4];           /* Exact bounding box, see geoSearchInit(). */
+} geoSearch;
+
+/* Slack, in degrees or radians, so that rounding never excludes a point
+ * that the distance computation includes. */
+#define GEO_SEARCH_SLACK 1e-9
+
+/* Degrees to radians, as geohash_helper.c converts them. */
+#define GEO_D_R (M_PI / 180.0)
+
+/* Max number of geohash cells the search area is covered with, and of
+ * additional steps of precision tried to reach it. */
+#define GEO_SEARCH_MAX_CELLS 16
+#define GEO_SEARCH_MAX_REFINE 4
+
+static void geoSearchInit(geoSearch *gs, double lon, double lat,
+                          double radius)
+{
+    double r = radius / EARTH_RADIUS_IN_METERS; /* Angular radius. */
+    double rdeg = r / GEO_D_R;
+
+    gs->lon = lon;
+    gs->lat = lat;
+    gs->radius = radius;
+    gs->lat_r = lat * GEO_D_R;
+    gs->cos_lat = cos(gs->lat_r);
+
+    /* The distance is at least the latitude difference times the earth
+     * radius, and grows with the 'a' term of the haversine formula:
+     * distance = 2 * R * asin(sqrt(a)). */
+    gs->max_dlat = r + GEO_SEARCH_SLACK;
+    gs->max_a = (r/2 < M_PI/2) ? sin(r/2)*sin(r/2)*(1+GEO_SEARCH_SLACK) +
+                                 GEO_SEARCH_SLACK : 2;
+
+    /* Unlike geohashBoundingBox(), that is good enough to choose the boxes
+     * but slightly too small in longitude, this is the exact box of the
+     * circle on the sphere: the longitude extent is asin(sin(r)/cos(lat)),
+     * and all the longitudes when the circle includes a pole. */
+    gs->bounds[1] = lat - rdeg - GEO_SEARCH_SLACK;
+    gs->bounds[3] = lat + rdeg + GEO_SEARCH_SLACK;
+    if (r >= M_PI/2 || gs->bounds[1] <= -90 || gs->bounds[3] >= 90 ||
+        sin(r) >= gs->cos_lat)
     {
-        return C_ERR;
+        gs->bounds[0] = -180;
+        gs->bounds[2] = 180;
+    } else {
+        double dlon = asin(sin(r)/gs->cos_lat) / GEO_D_R;
+
+        gs->bounds[0] = lon - dlon - GEO_SEARCH_SLACK;
+        gs->bounds[2] = lon + dlon + GEO_SEARCH_SLACK;
     }
+}
+
+/* Return 1 if the point of the sorted set 'score' is within the search
+ * radius, filling its coordinates and its distance from the center. The
+ * distance is the one geohashGetDistance() computes, bit for bit, but the
+ * points too far by latitude alone, or by the haversine term, are rejected
+ * before the asin() and sqrt(). */
+static int geoSearchMatch(geoSearch *gs, double score, double *xy,
+                          double *distance)
+{
+    double lat2r, u, v, a;
+
+    if (!decodeGeohash(score,xy)) return 0; /* Can't decode. */
+    lat2r = xy[1] * GEO_D_R;
+    if (fabs(lat2r - gs->lat_r) > gs->max_dlat) return 0;
+    u = sin((lat2r - gs->lat_r) / 2);
+    v = sin((xy[0] * GEO_D_R - gs->lon * GEO_D_R) / 2);
+    a = u * u + gs->cos_lat * cos(lat2r) * v * v;
+    if (a > gs->max_a) return 0;
+    *distance = 2.0 * EARTH_RADIUS_IN_METERS * asin(sqrt(a));
+    return *distance <= gs->radius;
+}
 
-    /* Append the new element. */
+static void geoAppendPoint(geoArray *ga, double *xy, double distance,
+                           double score, sds member)
+{
     geoPoint *gp = geoArrayAppend(ga);
     gp->longitude = xy[0];
     gp->latitude = xy[1];
     gp->dist = distance;
     gp->member = member;
     gp->score = score;
-    return C_OK;
 }
 
 /* Query a Redis sorted set to extract all the elements between 'min' and
  * 'max', appending them into the array of geoPoint structures 'gparray'.
  * The command returns the number of elements added to the array.
  *
- * Elements which are farest than 'radius' from the specified 'x' and 'y'
- * coordinates are not included.
+ * Elements which are farest than the search radius from its center are not
+ * included, and their member is never copied.
  *
  * The ability of this function to append to an existing set of points is
  * important for good performances because querying by radius is performed
  * using multiple queries to the sorted set, that we later need to sort
  * via qsort. Similarly we need to be able to reject points outside the search
  * radius area ASAP in order to allocate and process more points than needed. */
-int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double lat, double radius, geoArray *ga) {
+int geoGetPointsInRange(robj *zobj, double min, double max, geoSearch *gs, geoArray *ga) {
     /* minex 0 = include min in range; maxex 1 = exclude max in range */
     /* That's: min <= val < max */
     zrangespec range = { .min = min, .max = max, .minex = 0, .maxex = 1 };
     size_t origincount = ga->used;
-    sds member;
+    double xy[2], distance;
 
     if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
         unsigned char *zl = zobj->ptr;
@@ -250,12 +316,14 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
             if (!zslValueLteMax(score, &range))
                 break;
 
-            /* We know the element exists. ziplistGet should always succeed */
-            ziplistGet(eptr, &vstr, &vlen, &vlong);
-            member = (vstr == NULL) ? sdsfromlonglong(vlong) :
-                                      sdsnewlen(vstr,vlen);
-            if (geoAppendIfWithinRadius(ga,lon,lat,radius,score,member)
-                == C_ERR) sdsfree(member);
+            if (geoSearchMatch(gs,score,xy,&distance)) {
+                /* We know the element exists. ziplistGet should always
+                 * succeed */
+                ziplistGet(eptr, &vstr, &vlen, &vlong);
+                geoAppendPoint(ga,xy,distance,score,(vstr == NULL) ?
+                               sdsfromlonglong(vlong) :
+                               sdsnewlen(vstr,vlen));
+            }
             zzlNext(zl, &eptr, &sptr);
         }
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
@@ -269,16 +337,35 @@ int geoGetPointsInRange(robj *zobj, double min, double max, double lon, double l
         }
 
         while (ln) {
-            sds ele = ln->ele;
             /* Abort when the node is no longer in range. */
             if (!zslValueLteMax(ln->score, &range))
                 break;
 
-            ele = sdsdup(ele);
-            if (geoAppendIfWithinRadius(ga,lon,lat,radius,ln->score,ele)
-                == C_ERR) sdsfree(ele);
+            if (geoSearchMatch(gs,ln->score,xy,&distance))
+                geoAppendPoint(ga,xy,distance,ln->score,sdsdup(ln->ele));
             ln = ln->level[0].forward;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zbtree *zbt = ((zset*)zobj->ptr)->zbt;
+        zbtreeIter it;
+        int valid;
+
+        if (!zbtFirstInRange(zbt, &range, &it)) {
+            /* Nothing exists starting at our min.  No results. */
+            return 0;
+        }
+
+        do {
+            double score = zbtIterScore(&it);
+            /* Abort when the element is no longer in range. */
+            if (!zslValueLteMax(score, &range))
+                break;
+
+            if (geoSearchMatch(gs,score,xy,&distance))
+                geoAppendPoint(ga,xy,distance,score,
+                               sdsdup(zbtIterEle(&it)));
+            valid = zbtNext(&it);
+        } while (valid);
     }
     return ga->used - origincount;
 }
@@ -312,71 +399,104 @@ void scoresOfGeoHashBox(GeoHashBits hash, GeoHashFix52Bits *min, GeoHashFix52Bit
     *max = geohashAlign52Bits(hash);
 }
 
-/* Obtain all members between the min/max of this geohash bounding box.
- * Populate a geoArray of GeoPoints by calling geoGetPointsInRange().
- * Return the number of points added to the array. */
-int membersOfGeoHashBox(robj *zobj, GeoHashBits hash, geoArray *ga, double lon, double lat, double radius) {
-    GeoHashFix52Bits min, max;
+/* Can the geohash box 'cell' contain points of the search area? The box is
+ * tested against the bounding box of the circle, longitudes shifted by a
+ * full turn too when the bounding box crosses the antimeridian. */
+static int geoCellIntersects(geoSearch *gs, GeoHashBits cell) {
+    GeoHashRange long_range, lat_range;
+    GeoHashArea area;
+    double *b = gs->bounds;
+    int shift;
+
+    geohashGetCoordRange(&long_range,&lat_range);
+    geohashDecode(long_range,lat_range,cell,&area);
+    if (area.latitude.max < b[1] || area.latitude.min > b[3]) return 0;
+    for (shift = -360; shift <= 360; shift += 360) {
+        if (area.longitude.max >= b[0]+shift &&
+            area.longitude.min <= b[2]+shift) return 1;
+    }
+    return 0;
+}
+
+static int geoRangeCompare(const void *a, const void *b) {
+    const GeoHashFix52Bits *ra = a, *rb = b;
 
-    scoresOfGeoHashBox(hash,&min,&max);
-    return geoGetPointsInRange(zobj, min, max, lon, lat, radius, ga);
+    if (ra[0] == rb[0]) return 0;
+    return ra[0] < rb[0] ? -1 : 1;
 }
 
-/* Search all eight neighbors + self geohash box */
-int membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double lon, double lat, double radius, geoArray *ga) {
-    GeoHashBits neighbors[9];
-    unsigned int i, count = 0, last_processed = 0;
-    int debugmsg = 0;
-
-    neighbors[0] = n.hash;
-    neighbors[1] = n.neighbors.north;
-    neighbors[2] = n.neighbors.south;
-    neighbors[3] = n.neighbors.east;
-    neighbors[4] = n.neighbors.west;
-    neighbors[5] = n.neighbors.north_east;
-    neighbors[6] = n.neighbors.north_west;
-    neighbors[7] = n.neighbors.south_east;
-    neighbors[8] = n.neighbors.south_west;
-
-    /* For each neighbor (*and* our own hashbox), get all the matching
-     * members and add them to the potential result list. */
-    for (i = 0; i < sizeof(neighbors) / sizeof(*neighbors); i++) {
-        if (HASHISZERO(neighbors[i])) {
-            if (debugmsg) D("neighbors[%d] is zero",i);
-            continue;
-        }
+/* Cover the search area with the boxes of 'n', then split the boxes in
+ * their four sub-boxes (their sorted set ranges are the four quarters of
+ * the range of the box) as long as dropping the sub-boxes out of the area
+ * keeps the cells under GEO_SEARCH_MAX_CELLS. Dense areas are so scanned
+ * with tighter ranges than the nine boxes of the estimated step. The ranges
+ * of the cells are then sorted and the adjacent or duplicated ones merged,
+ * so that each part of the sorted set is scanned once.
+ *
+ * 'ranges' gets [min,max) pairs, the number of pairs is returned. */
+static int geoSearchRanges(GeoHashRadius n, geoSearch *gs,
+                           GeoHashFix52Bits *ranges)
+{
+    GeoHashBits cells[GEO_SEARCH_MAX_CELLS], next[GEO_SEARCH_MAX_CELLS];
+    GeoHashBits boxes[9] = {
+        n.hash, n.neighbors.north, n.neighbors.south, n.neighbors.east,
+        n.neighbors.west, n.neighbors.north_east, n.neighbors.north_west,
+        n.neighbors.south_east, n.neighbors.south_west
+    };
+    int ncells = 0, nnext, i, j, k, level;
+
+    for (i = 0; i < 9; i++) {
+        if (HASHISZERO(boxes[i])) continue;
+        cells[ncells++] = boxes[i];
+    }
 
-        /* Debugging info. */
-        if (debugmsg) {
-            GeoHashRange long_range, lat_range;
-            geohashGetCoordRange(&long_range,&lat_range);
-            GeoHashArea myarea = {{0}};
-            geohashDecode(long_range, lat_range, neighbors[i], &myarea);
-
-            /* Dump center square. */
-            D("neighbors[%d]:\n",i);
-            D("area.longitude.min: %f\n", myarea.longitude.min);
-            D("area.longitude.max: %f\n", myarea.longitude.max);
-            D("area.latitude.min: %f\n", myarea.latitude.min);
-            D("area.latitude.max: %f\n", myarea.latitude.max);
-            D("\n");
+    for (level = 0; level < GEO_SEARCH_MAX_REFINE; level++) {
+        nnext = 0;
+        for (i = 0; i < ncells && nnext <= GEO_SEARCH_MAX_CELLS; i++) {
+            if (cells[i].step >= GEO_STEP_MAX) break;
+            for (k = 0; k < 4; k++) {
+                GeoHashBits sub = {cells[i].bits << 2 | k, cells[i].step+1};
+
+                if (!geoCellIntersects(gs,sub)) continue;
+                if (nnext == GEO_SEARCH_MAX_CELLS) {
+                    nnext++;
+                    break;
+                }
+                next[nnext++] = sub;
+            }
         }
+        if (i < ncells || nnext > GEO_SEARCH_MAX_CELLS) break;
+        memcpy(cells,next,sizeof(GeoHashBits)*nnext);
+        ncells = nnext;
+    }
 
-        /* When a huge Radius (in the 5000 km range or more) is used,
-         * adjacent neighbors can be the same, leading to duplicated
-         * elements. Skip every range which is the same as the one
-         * processed previously. */
-        if (last_processed &&
-            neighbors[i].bits == neighbors[last_processed].bits &&
-            neighbors[i].step == neighbors[last_processed].step)
-        {
-            if (debugmsg)
-                D("Skipping processing of %d, same as previous\n",i);
-            continue;
+    for (i = 0; i < ncells; i++)
+        scoresOfGeoHashBox(cells[i],ranges+i*2,ranges+i*2+1);
+    qsort(ranges,ncells,sizeof(GeoHashFix52Bits)*2,geoRangeCompare);
+    for (i = 0, j = -1; i < ncells; i++) {
+        if (j >= 0 && ranges[i*2] <= ranges[j*2+1]) {
+            if (ranges[i*2+1] > ranges[j*2+1])
+                ranges[j*2+1] = ranges[i*2+1];
+        } else {
+            j++;
+            ranges[j*2] = ranges[i*2];
+            ranges[j*2+1] = ranges[i*2+1];
         }
-        count += membersOfGeoHashBox(zobj, neighbors[i], ga, lon, lat, radius);
-        last_processed = i;
     }
+    return j+1;
+}
+
+/* Search the boxes of 'n', see geoSearchRanges(). Returns the number of
+ * points added to 'ga'. */
+int membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double lon, double lat, double radius, geoArray *ga) {
+    GeoHashFix52Bits ranges[GEO_SEARCH_MAX_CELLS*2];
+    geoSearch gs;
+    int nranges, i, count = 0;
+
+    geoSearchInit(&gs,lon,lat,radius);
+    nranges = geoSearchRanges(n,&gs,ranges);
+    for (i = 0; i < nranges; i++)
+        count += geoGetPointsInRange(zobj,ranges[i*2],ranges[i*2+1],&gs,ga);
     return count;
 }
 
@@ -643,15 +763,13 @@ void georadiusGeneric(client *c, int flags) {
         }
 
         for (i = 0; i < returned_items; i++) {
-            zskiplistNode *znode;
             geoPoint *gp = ga->array+i;
             gp->dist /= conversion; /* Fix according to unit. */
             double score = storedist ? gp->dist : gp->score;
             size_t elelen = sdslen(gp->member);
 
             if (maxelelen < elelen) maxelelen = elelen;
-            znode = zslInsert(zs->zsl,score,gp->member);
-            serverAssert(dictAdd(zs->dict,gp->member,&znode->score) == DICT_OK);
+            zsetInsertNew(zs,score,gp->member);
             gp->member = NULL;
         }
 
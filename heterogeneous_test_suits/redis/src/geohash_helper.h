@@ -47,6 +47,8 @@ typedef struct {
     GeoHashNeighbors neighbors;
 } GeoHashRadius;
 
+extern const double EARTH_RADIUS_IN_METERS;
+
 int GeoHashBitsComparator(const GeoHashBits *a, const GeoHashBits *b);
 uint8_t geohashEstimateStepsByRadius(double range_meters, double lat);
 int geohashBoundingBox(double longitude, double latitude, double radius_meters,
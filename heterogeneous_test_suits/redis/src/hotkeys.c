@@ -0,0 +1,326 @@
+/* hotkeys.c -- Sampling profiler of the keys and commands being called.
+ *
+ * With "hotkeys-sample-rate" above zero, call() samples that percentage of
+ * the commands. For every sampled command:
+ *
+ * - Its keys are counted in a Count-Min sketch, and the keys with the
+ *   highest estimates are kept in a small min-heap, so that the hottest
+ *   keys can be listed without MONITOR and without a counter per key.
+ * - Its duration is added to a log2 histogram of the command (see
+ *   latencyHistogramAdd() in latency.c).
+ *
+ * The sketch uses conservative updates (only the smallest counters of the
+ * key are incremented), and all the counts are halved every minute, so the
+ * report follows the current traffic. Counts are numbers of samples: with a
+ * 1% rate a key counted 50 times was accessed about 5000 times.
+ *
+ * HOTKEYS TOP, HOTKEYS LATENCY and HOTKEYS RESET report and clear the data.
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+#define HOTKEYS_CMS_DEPTH 4
+#define HOTKEYS_CMS_WIDTH 4096      /* Must be a power of two. */
+#define HOTKEYS_TOP_MAX 64          /* Keys kept in the heap. */
+
+typedef struct hotkeyEntry {
+    sds key;
+    int dbid;
+    uint64_t hash;
+    uint32_t count;
+} hotkeyEntry;
+
+typedef struct hotkeysState {
+    uint32_t cms[HOTKEYS_CMS_DEPTH][HOTKEYS_CMS_WIDTH];
+    hotkeyEntry top[HOTKEYS_TOP_MAX];   /* Min-heap by count. */
+    int toplen;
+    unsigned long long samples;         /* Sampled commands. */
+} hotkeysState;
+
+/* Allocated at the first sample. */
+static hotkeysState *hk = NULL;
+
+/* ---------------------------- Top-K heap ---------------------------------- */
+
+static void hotkeysSwap(int i, int j) {
+    hotkeyEntry tmp = hk->top[i];
+    hk->top[i] = hk->top[j];
+    hk->top[j] = tmp;
+}
+
+static void hotkeysSiftUp(int i) {
+    while (i > 0 && hk->top[(i-1)/2].count > hk->top[i].count) {
+        hotkeysSwap(i,(i-1)/2);
+        i = (i-1)/2;
+    }
+}
+
+static void hotkeysSiftDown(int i) {
+    while (1) {
+        int min = i, l = 2*i+1, r = 2*i+2;
+
+        if (l < hk->toplen && hk->top[l].count < hk->top[min].count) min = l;
+        if (r < hk->toplen && hk->top[r].count < hk->top[min].count) min = r;
+        if (min == i) break;
+        hotkeysSwap(i,min);
+        i = min;
+    }
+}
+
+/* Update the heap with the new estimate of the key. */
+static void hotkeysUpdateTop(robj *key, int dbid, uint64_t hash,
+                             uint32_t count) {
+    int j;
+
+    for (j = 0; j < hk->toplen; j++) {
+        hotkeyEntry *e = hk->top+j;
+        if (e->hash == hash && e->dbid == dbid &&
+            sdslen(e->key) == sdslen(key->ptr) &&
+            memcmp(e->key,key->ptr,sdslen(e->key)) == 0)
+        {
+            e->count = count;
+            hotkeysSiftDown(j);
+            return;
+        }
+    }
+
+    if (hk->toplen < HOTKEYS_TOP_MAX) {
+        j = hk->toplen++;
+    } else if (count > hk->top[0].count) {
+        sdsfree(hk->top[0].key);
+        j = 0;
+    } else {
+        return;
+    }
+    hk->top[j].key = sdsdup(key->ptr);
+    hk->top[j].dbid = dbid;
+    hk->top[j].hash = hash;
+    hk->top[j].count = count;
+    if (j == 0) hotkeysSiftDown(0);
+    else hotkeysSiftUp(j);
+}
+
+/* ------------------------------ Sampling ---------------------------------- */
+
+/* Count an access to the key in the sketch, and return its new estimate.
+ * The rows are indexed by double hashing of a single 64 bit hash. */
+static uint32_t hotkeysCountKey(uint64_t hash) {
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash>>32)|1;
+    uint32_t *ctr[HOTKEYS_CMS_DEPTH];
+    uint32_t min = UINT32_MAX;
+    int j;
+
+    for (j = 0; j < HOTKEYS_CMS_DEPTH; j++) {
+        ctr[j] = &hk->cms[j][(h1+j*h2) & (HOTKEYS_CMS_WIDTH-1)];
+        if (*ctr[j] < min) min = *ctr[j];
+    }
+    /* Conservative update: counters above min+1 already overestimate. */
+    for (j = 0; j < HOTKEYS_CMS_DEPTH; j++)
+        if (*ctr[j] == min) (*ctr[j])++;
+    return min+1;
+}
+
+/* Return non zero if the command about to be called should be sampled. The
+ * intervals between samples are random, with the configured rate as mean,
+ * so that periodic traffic is not aliased. */
+int hotkeysShouldSample(void) {
+    long long interval;
+
+    if (--server.hotkeys_countdown > 0) return 0;
+    interval = 100/server.hotkeys_sample_rate;
+    server.hotkeys_countdown = 1+(interval > 1 ? random()%(2*interval-1) : 0);
+    return 1;
+}
+
+/* Record the keys of a sampled command. Called by call() before the command
+ * runs, since commands may rewrite their arguments. */
+void hotkeysSampleKeys(client *c) {
+    int *keys, numkeys, j;
+
+    if (hk == NULL) hk = zcalloc(sizeof(*hk));
+    hk->samples++;
+    if (c->cmd->getkeys_proc == NULL && c->cmd->firstkey == 0) return;
+
+    keys = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
+    for (j = 0; j < numkeys; j++) {
+        robj *key = c->argv[keys[j]];
+        uint64_t hash;
+
+        if (!sdsEncodedObject(key)) continue;
+        hash = dictGenHashFunction(key->ptr,sdslen(key->ptr)) ^
+               ((uint64_t)c->db->id * 0x9e3779b97f4a7c15ULL);
+        hotkeysUpdateTop(key,c->db->id,hash,hotkeysCountKey(hash));
+    }
+    getKeysFreeResult(keys);
+}
+
+/* Record the duration of a sampled command. */
+void hotkeysSampleLatency(struct redisCommand *cmd, long long duration) {
+    if (cmd->latency_hist == NULL)
+        cmd->latency_hist = zcalloc(sizeof(latencyHistogram));
+    latencyHistogramAdd(cmd->latency_hist,duration);
+}
+
+/* Halve every count, called by serverCron() once a minute. */
+void hotkeysDecay(void) {
+    int i, j;
+
+    if (hk == NULL) return;
+    for (i = 0; i < HOTKEYS_CMS_DEPTH; i++)
+        for (j = 0; j < HOTKEYS_CMS_WIDTH; j++)
+            hk->cms[i][j] >>= 1;
+    /* Halving keeps the heap property. */
+    for (j = 0; j < hk->toplen; j++) hk->top[j].count >>= 1;
+}
+
+/* Forget all the samples. */
+void hotkeysReset(void) {
+    dictIterator *di;
+    dictEntry *de;
+    int j;
+
+    if (hk) {
+        for (j = 0; j < hk->toplen; j++) sdsfree(hk->top[j].key);
+        zfree(hk);
+        hk = NULL;
+    }
+    di = dictGetIterator(server.commands);
+    while ((de = dictNext(di)) != NULL) {
+        struct redisCommand *cmd = dictGetVal(de);
+        zfree(cmd->latency_hist);
+        cmd->latency_hist = NULL;
+    }
+    dictReleaseIterator(di);
+}
+
+/* ----------------------------- HOTKEYS ------------------------------------ */
+
+static int hotkeysCompareDesc(const void *a, const void *b) {
+    const hotkeyEntry *ea = a, *eb = b;
+
+    if (ea->count > eb->count) return -1;
+    if (ea->count < eb->count) return 1;
+    return 0;
+}
+
+/* HOTKEYS TOP [count] */
+static void hotkeysTopCommand(client *c, long count) {
+    hotkeyEntry top[HOTKEYS_TOP_MAX];
+    int len = hk ? hk->toplen : 0, j;
+
+    if (len) memcpy(top,hk->top,sizeof(hotkeyEntry)*len);
+    qsort(top,len,sizeof(hotkeyEntry),hotkeysCompareDesc);
+    if (count < len) len = count;
+    addReplyArrayLen(c,len);
+    for (j = 0; j < len; j++) {
+        addReplyArrayLen(c,3);
+        addReplyBulkCBuffer(c,top[j].key,sdslen(top[j].key));
+        addReplyLongLong(c,top[j].dbid);
+        addReplyLongLong(c,top[j].count);
+    }
+}
+
+/* HOTKEYS LATENCY [command ...] */
+static void hotkeysLatencyCommand(client *c) {
+    struct redisCommand *cmd;
+    long len = 0;
+    int j;
+
+    if (c->argc > 2) {
+        addReplyArrayLen(c,c->argc-2);
+        for (j = 2; j < c->argc; j++) {
+            addReplyArrayLen(c,2);
+            addReplyBulk(c,c->argv[j]);
+            cmd = lookupCommand(c->argv[j]->ptr);
+            if (cmd && cmd->latency_hist)
+                latencyHistogramReply(c,cmd->latency_hist);
+            else
+                addReplyArrayLen(c,0);
+        }
+    } else {
+        dictIterator *di = dictGetIterator(server.commands);
+        dictEntry *de;
+        void *replylen = addReplyDeferredLen(c);
+
+        while ((de = dictNext(di)) != NULL) {
+            cmd = dictGetVal(de);
+            if (cmd->latency_hist == NULL) continue;
+            addReplyArrayLen(c,2);
+            addReplyBulkCString(c,cmd->name);
+            latencyHistogramReply(c,cmd->latency_hist);
+            len++;
+        }
+        dictReleaseIterator(di);
+        setDeferredArrayLen(c,replylen,len);
+    }
+}
+
+void hotkeysCommand(client *c) {
+    const char *help[] = {
+"TOP [count]            -- Returns the hottest sampled keys, as (key, db, samples).",
+"LATENCY [command ...]  -- Returns the histograms of the sampled commands durations,",
+"                          as pairs of upper bound in usec and count.",
+"INFO                   -- Returns the sampling rate and number of samples.",
+"RESET                  -- Forgets all the samples.",
+"HELP                   -- Prints this help.",
+NULL
+    };
+
+    if (!strcasecmp(c->argv[1]->ptr,"top") && c->argc <= 3) {
+        long count = HOTKEYS_TOP_MAX;
+
+        if (c->argc == 3) {
+            if (getLongFromObjectOrReply(c,c->argv[2],&count,NULL) != C_OK)
+                return;
+            if (count < 1) {
+                addReplyError(c,"count must be positive");
+                return;
+            }
+        }
+        hotkeysTopCommand(c,count);
+    } else if (!strcasecmp(c->argv[1]->ptr,"latency")) {
+        hotkeysLatencyCommand(c);
+    } else if (!strcasecmp(c->argv[1]->ptr,"info") && c->argc == 2) {
+        addReplyMapLen(c,3);
+        addReplyBulkCString(c,"sample-rate");
+        addReplyLongLong(c,server.hotkeys_sample_rate);
+        addReplyBulkCString(c,"samples");
+        addReplyLongLong(c,hk ? hk->samples : 0);
+        addReplyBulkCString(c,"tracked-keys");
+        addReplyLongLong(c,hk ? hk->toplen : 0);
+    } else if (!strcasecmp(c->argv[1]->ptr,"reset") && c->argc == 2) {
+        hotkeysReset();
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"help") && c->argc == 2) {
+        addReplyHelp(c, help);
+    } else {
+        addReplySubcommandSyntaxError(c);
+    }
+}
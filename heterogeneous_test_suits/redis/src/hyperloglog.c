@@ -478,6 +478,310 @@ int hllPatLen(unsigned char *ele, size_t elesize, long *regp) {
     return count;
 }
 
+/* ============================ Vector kernels  ============================= */
+
+/* With the default 16384 registers of 6 bits, the dense registers can be
+ * unpacked with SIMD instructions: every 3 bytes hold 4 registers, so a
+ * byte shuffle puts each group of 3 bytes in a 32 bit lane, and 3 shifts
+ * move the registers 2 to 4 of the lane in their own byte. Packing is the
+ * same steps the other way around. This is done 32 registers at a time
+ * with AVX2 on x86-64, and 16 registers at a time with NEON on aarch64.
+ *
+ * The unpacked registers are used for the max-merge of PFMERGE and of
+ * PFCOUNT with multiple keys, and for the register histogram of PFCOUNT.
+ * The histogram itself is counted into four tables, so that runs of equal
+ * registers do not wait for each other's increment.
+ *
+ * As in bitops.c the kernels are selected with a switch on the SIMD level
+ * of the node the thread runs on, reset by hllSimdReset() after every
+ * migration of the event loop thread. The "hll-simd" option disables them,
+ * which is how utils/hyperloglog/hll-simd-bench.rb compares the two. */
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#define HLL_SIMD_NONE 0
+#define HLL_SIMD_AVX2 1
+#define HLL_SIMD_NEON 1
+
+/* Only the default layout of the registers has vector kernels. */
+#define HLL_SIMD_LAYOUT (HLL_REGISTERS == 16384 && HLL_BITS == 6)
+
+/* SIMD level of the node running the thread, -1 if not checked yet. */
+static __thread int hll_simd = -1;
+
+static int hllSimdSupported(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? HLL_SIMD_AVX2 : HLL_SIMD_NONE;
+#elif defined(__aarch64__)
+    return HLL_SIMD_NEON; /* NEON is part of the base ISA. */
+#else
+    return HLL_SIMD_NONE;
+#endif
+}
+
+static inline int hllSimdLevel(void) {
+    if (!server.hll_simd || !HLL_SIMD_LAYOUT) return HLL_SIMD_NONE;
+    if (hll_simd < 0) hll_simd = hllSimdSupported();
+    return hll_simd;
+}
+
+/* Forget the SIMD level of the calling thread. Called after the thread
+ * migrated, as the new node may be of another ISA. */
+void hllSimdReset(void) {
+    hll_simd = -1;
+}
+
+/* Add 'len' (a multiple of 4) unpacked registers to the four histograms. */
+static inline void hllHistoBytes(const uint8_t *r, int len, int histo[4][64]) {
+    int j;
+
+    for (j = 0; j < len; j += 4) {
+        histo[0][r[j]]++;
+        histo[1][r[j+1]]++;
+        histo[2][r[j+2]]++;
+        histo[3][r[j+3]]++;
+    }
+}
+
+#if defined(__x86_64__)
+/* Unpack the 32 registers stored in the 24 bytes at 'r'. The load starts 4
+ * bytes before 'r', so that each 128 bit lane has its 12 bytes, which is
+ * fine since the dense registers follow the HLL header. */
+__attribute__((target("avx2")))
+static inline __m256i hllUnpackAvx2(const uint8_t *r) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        4,5,6,-1, 7,8,9,-1, 10,11,12,-1, 13,14,15,-1,
+        0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1);
+    __m256i x = _mm256_loadu_si256((const __m256i*)(r-4));
+
+    x = _mm256_shuffle_epi8(x,shuffle);
+    return _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_and_si256(x,_mm256_set1_epi32(0x3f)),
+            _mm256_and_si256(_mm256_slli_epi32(x,2),
+                             _mm256_set1_epi32(0x3f00))),
+        _mm256_or_si256(
+            _mm256_and_si256(_mm256_slli_epi32(x,4),
+                             _mm256_set1_epi32(0x3f0000)),
+            _mm256_and_si256(_mm256_slli_epi32(x,6),
+                             _mm256_set1_epi32(0x3f000000))));
+}
+
+/* Pack the 32 registers at 'max' into the 24 bytes at 'r'. Each lane is
+ * stored with 16 bytes, 4 bytes past the 24 are overwritten. */
+__attribute__((target("avx2")))
+static inline void hllPackAvx2(uint8_t *r, const uint8_t *max) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+        0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+    __m256i x = _mm256_loadu_si256((const __m256i*)max);
+
+    x = _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_and_si256(x,_mm256_set1_epi32(0x3f)),
+            _mm256_and_si256(_mm256_srli_epi32(x,2),
+                             _mm256_set1_epi32(0xfc0))),
+        _mm256_or_si256(
+            _mm256_and_si256(_mm256_srli_epi32(x,4),
+                             _mm256_set1_epi32(0x3f000)),
+            _mm256_and_si256(_mm256_srli_epi32(x,6),
+                             _mm256_set1_epi32(0xfc0000))));
+    x = _mm256_shuffle_epi8(x,shuffle);
+    _mm_storeu_si128((__m128i*)r,_mm256_castsi256_si128(x));
+    _mm_storeu_si128((__m128i*)(r+12),_mm256_extracti128_si256(x,1));
+}
+
+/* The last 32 registers are left to the caller: unpacking them would read
+ * past the registers, and packing them would write past them. */
+#define HLL_AVX2_GROUPS (HLL_REGISTERS/32-1)
+
+__attribute__((target("avx2")))
+static void hllDenseRegHistoAvx2(uint8_t *registers, int histo[4][64]) {
+    uint8_t buf[32];
+    int j;
+
+    for (j = 0; j < HLL_AVX2_GROUPS; j++) {
+        _mm256_storeu_si256((__m256i*)buf,hllUnpackAvx2(registers+j*24));
+        hllHistoBytes(buf,32,histo);
+    }
+}
+
+__attribute__((target("avx2")))
+static void hllMergeDenseAvx2(uint8_t *max, uint8_t *registers) {
+    int j;
+
+    for (j = 0; j < HLL_AVX2_GROUPS; j++) {
+        __m256i *m = (__m256i*)(max+j*32);
+        _mm256_storeu_si256(m,_mm256_max_epu8(_mm256_loadu_si256(m),
+                                hllUnpackAvx2(registers+j*24)));
+    }
+}
+
+__attribute__((target("avx2")))
+static void hllDensePackAvx2(uint8_t *registers, uint8_t *max) {
+    int j;
+
+    for (j = 0; j < HLL_AVX2_GROUPS; j++)
+        hllPackAvx2(registers+j*24,max+j*32);
+}
+
+#elif defined(__aarch64__)
+/* Unpack the 16 registers stored in the 12 bytes at 'r'. The load reads 4
+ * bytes past them. */
+static inline uint8x16_t hllUnpackNeon(const uint8_t *r) {
+    static const uint8_t shuffle[16] = {
+        0,1,2,255, 3,4,5,255, 6,7,8,255, 9,10,11,255};
+    uint32x4_t x = vreinterpretq_u32_u8(
+        vqtbl1q_u8(vld1q_u8(r),vld1q_u8(shuffle)));
+
+    x = vorrq_u32(
+        vorrq_u32(vandq_u32(x,vdupq_n_u32(0x3f)),
+                  vandq_u32(vshlq_n_u32(x,2),vdupq_n_u32(0x3f00))),
+        vorrq_u32(vandq_u32(vshlq_n_u32(x,4),vdupq_n_u32(0x3f0000)),
+                  vandq_u32(vshlq_n_u32(x,6),vdupq_n_u32(0x3f000000))));
+    return vreinterpretq_u8_u32(x);
+}
+
+/* Pack the 16 registers at 'max' into the 12 bytes at 'r', 4 bytes past
+ * them are overwritten. */
+static inline void hllPackNeon(uint8_t *r, const uint8_t *max) {
+    static const uint8_t shuffle[16] = {
+        0,1,2,4,5,6,8,9,10,12,13,14,255,255,255,255};
+    uint32x4_t x = vreinterpretq_u32_u8(vld1q_u8(max));
+
+    x = vorrq_u32(
+        vorrq_u32(vandq_u32(x,vdupq_n_u32(0x3f)),
+                  vandq_u32(vshrq_n_u32(x,2),vdupq_n_u32(0xfc0))),
+        vorrq_u32(vandq_u32(vshrq_n_u32(x,4),vdupq_n_u32(0x3f000)),
+                  vandq_u32(vshrq_n_u32(x,6),vdupq_n_u32(0xfc0000))));
+    vst1q_u8(r,vqtbl1q_u8(vreinterpretq_u8_u32(x),vld1q_u8(shuffle)));
+}
+
+/* The last 16 registers are left to the caller: unpacking them would read
+ * past the registers, and packing them would write past them. */
+#define HLL_NEON_GROUPS (HLL_REGISTERS/16-1)
+
+static void hllDenseRegHistoNeon(uint8_t *registers, int histo[4][64]) {
+    uint8_t buf[16];
+    int j;
+
+    for (j = 0; j < HLL_NEON_GROUPS; j++) {
+        vst1q_u8(buf,hllUnpackNeon(registers+j*12));
+        hllHistoBytes(buf,16,histo);
+    }
+}
+
+static void hllMergeDenseNeon(uint8_t *max, uint8_t *registers) {
+    int j;
+
+    for (j = 0; j < HLL_NEON_GROUPS; j++)
+        vst1q_u8(max+j*16,vmaxq_u8(vld1q_u8(max+j*16),
+                                   hllUnpackNeon(registers+j*12)));
+}
+
+static void hllDensePackNeon(uint8_t *registers, uint8_t *max) {
+    int j;
+
+    for (j = 0; j < HLL_NEON_GROUPS; j++)
+        hllPackNeon(registers+j*12,max+j*16);
+}
+#endif
+
+/* Number of leading registers the vector kernels of the node process, zero
+ * if there are none. The rest is left to the scalar code. */
+static int hllSimdRegisters(void) {
+    switch(hllSimdLevel()) {
+#if defined(__x86_64__)
+    case HLL_SIMD_AVX2: return HLL_AVX2_GROUPS*32;
+#elif defined(__aarch64__)
+    case HLL_SIMD_NEON: return HLL_NEON_GROUPS*16;
+#endif
+    default: return 0;
+    }
+}
+
+/* Add the dense 'registers' to 'reghisto' with the vector kernel of the
+ * node. Returns 0 if there is none and nothing was done. */
+static int hllDenseRegHistoSimd(uint8_t *registers, int *reghisto) {
+    int histo[4][64] = {{0}};
+    int done = hllSimdRegisters(), j;
+
+    if (done == 0) return 0;
+#if defined(__x86_64__)
+    hllDenseRegHistoAvx2(registers,histo);
+#elif defined(__aarch64__)
+    hllDenseRegHistoNeon(registers,histo);
+#endif
+    for (j = done; j < HLL_REGISTERS; j++) {
+        unsigned long reg;
+        HLL_DENSE_GET_REGISTER(reg,registers,j);
+        histo[0][reg]++;
+    }
+    for (j = 0; j < 64; j++)
+        reghisto[j] += histo[0][j]+histo[1][j]+histo[2][j]+histo[3][j];
+    return 1;
+}
+
+/* Set max[i] to MAX(max[i],registers[i]) for the dense 'registers' with the
+ * vector kernel of the node. Returns 0 if there is none. */
+static int hllMergeDenseSimd(uint8_t *max, uint8_t *registers) {
+    int done = hllSimdRegisters(), j;
+
+    if (done == 0) return 0;
+#if defined(__x86_64__)
+    hllMergeDenseAvx2(max,registers);
+#elif defined(__aarch64__)
+    hllMergeDenseNeon(max,registers);
+#endif
+    for (j = done; j < HLL_REGISTERS; j++) {
+        uint8_t val;
+        HLL_DENSE_GET_REGISTER(val,registers,j);
+        if (val > max[j]) max[j] = val;
+    }
+    return 1;
+}
+
+/* Store the HLL_REGISTERS registers at 'max', which must not exceed
+ * HLL_REGISTER_MAX, into the dense 'registers' with the vector kernel of
+ * the node. Returns 0 if there is none. */
+static int hllDensePackSimd(uint8_t *registers, uint8_t *max) {
+    int done = hllSimdRegisters(), j;
+
+    if (done == 0) return 0;
+#if defined(__x86_64__)
+    hllDensePackAvx2(registers,max);
+#elif defined(__aarch64__)
+    hllDensePackNeon(registers,max);
+#endif
+    for (j = done; j < HLL_REGISTERS; j++)
+        HLL_DENSE_SET_REGISTER(registers,j,max[j]);
+    return 1;
+}
+
+/* Add the HLL_RAW 'registers' to 'reghisto' the same way, skipping blocks
+ * of 32 zero registers. Returns 0 if the node has no vector kernels. */
+static int hllRawRegHistoSimd(uint8_t *registers, int *reghisto) {
+    int histo[4][64] = {{0}};
+    int j;
+
+    if (hllSimdRegisters() == 0) return 0;
+    for (j = 0; j < HLL_REGISTERS; j += 32) {
+        uint64_t *w = (uint64_t*)(registers+j);
+        if ((w[0]|w[1]|w[2]|w[3]) == 0)
+            histo[0][0] += 32;
+        else
+            hllHistoBytes(registers+j,32,histo);
+    }
+    for (j = 0; j < 64; j++)
+        reghisto[j] += histo[0][j]+histo[1][j]+histo[2][j]+histo[3][j];
+    return 1;
+}
+
 /* ================== Dense representation implementation  ================== */
 
 /* Low level function to set the dense HLL register at 'index' to the
@@ -519,6 +823,8 @@ int hllDenseAdd(uint8_t *registers, unsigned char *ele, size_t elesize) {
 void hllDenseRegHisto(uint8_t *registers, int* reghisto) {
     int j;
 
+    if (hllDenseRegHistoSimd(registers,reghisto)) return;
+
     /* Redis default is to use 16384 registers 6 bits each. The code works
      * with other values by modifying the defines, but for our target value
      * we take a faster path with unrolled loops. */
@@ -947,6 +1253,8 @@ void hllRawRegHisto(uint8_t *registers, int* reghisto) {
     uint8_t *bytes;
     int j;
 
+    if (hllRawRegHistoSimd(registers,reghisto)) return;
+
     for (j = 0; j < HLL_REGISTERS/8; j++) {
         if (*word == 0) {
             reghisto[0] += 8;
@@ -1072,6 +1380,7 @@ int hllMerge(uint8_t *max, robj *hll) {
     if (hdr->encoding == HLL_DENSE) {
         uint8_t val;
 
+        if (hllMergeDenseSimd(max,hdr->registers)) return C_OK;
         for (i = 0; i < HLL_REGISTERS; i++) {
             HLL_DENSE_GET_REGISTER(val,hdr->registers,i);
             if (val > max[i]) max[i] = val;
@@ -1360,13 +1669,19 @@ void pfmergeCommand(client *c) {
     }
 
     /* Write the resulting HLL to the destination HLL registers and
-     * invalidate the cached value. */
-    for (j = 0; j < HLL_REGISTERS; j++) {
-        if (max[j] == 0) continue;
-        hdr = o->ptr;
-        switch(hdr->encoding) {
-        case HLL_DENSE: hllDenseSet(hdr->registers,j,max[j]); break;
-        case HLL_SPARSE: hllSparseSet(o,j,max[j]); break;
+     * invalidate the cached value. A dense destination is merged into
+     * 'max' first if the node has vector kernels, then written at once. */
+    hdr = o->ptr;
+    if (hdr->encoding == HLL_DENSE && hllMergeDenseSimd(max,hdr->registers)) {
+        hllDensePackSimd(hdr->registers,max);
+    } else {
+        for (j = 0; j < HLL_REGISTERS; j++) {
+            if (max[j] == 0) continue;
+            hdr = o->ptr;
+            switch(hdr->encoding) {
+            case HLL_DENSE: hllDenseSet(hdr->registers,j,max[j]); break;
+            case HLL_SPARSE: hllSparseSet(o,j,max[j]); break;
+            }
         }
     }
     hdr = o->ptr; /* o->ptr may be different now, as a side effect of
@@ -0,0 +1,317 @@
+/* intmap.c - Compact hash table of integer fields and values.
+ *
+ * Hashes that outgrow the ziplist but only hold integers, such as counters
+ * keyed by numeric IDs, can use this encoding instead of a dict of SDS
+ * strings: every field costs 16 bytes of slot plus the free slots kept by
+ * the load factor, instead of a dictEntry, two SDS strings and their
+ * allocator overhead.
+ *
+ * The table uses linear probing in a single allocation. Deletions shift the
+ * following entries back instead of leaving tombstones, so lookups never
+ * probe more than the cluster the field belongs to.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intmap.h"
+#include "zmalloc.h"
+
+/* Smallest table. Hashes are only converted to an intmap once they outgrow
+ * the ziplist, so there is no point in starting smaller. */
+#define INTMAP_MIN_SIZE 64
+
+/* The table grows when more than 3/4 of the slots are used, and shrinks
+ * when less than 1/8 are. */
+#define INTMAP_GROW(len,size) ((uint64_t)(len)*4 > (uint64_t)(size)*3)
+#define INTMAP_SHRINK(len,size) \
+    ((size) > INTMAP_MIN_SIZE && (uint64_t)(len)*8 < (size))
+
+/* The bitmap of used slots follows the entries. */
+#define intmapUsedMap(im) ((uint8_t*)((im)->entries+(im)->size))
+#define intmapUsed(im,i) (intmapUsedMap(im)[(i)>>3] & (1<<((i)&7)))
+#define intmapSetUsed(im,i) (intmapUsedMap(im)[(i)>>3] |= (1<<((i)&7)))
+#define intmapClearUsed(im,i) (intmapUsedMap(im)[(i)>>3] &= ~(1<<((i)&7)))
+
+/* Fields are often dense ranges of IDs, so they are mixed before being
+ * masked (this is the MurmurHash3 64 bit finalizer). */
+static uint32_t intmapHash(int64_t field) {
+    uint64_t h = (uint64_t)field;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+static size_t intmapAllocSize(uint32_t size) {
+    return sizeof(intmap)+(size_t)size*sizeof(intmapEntry)+(size+7)/8;
+}
+
+static intmap *intmapCreate(uint32_t size) {
+    intmap *im = zmalloc(intmapAllocSize(size));
+    im->size = size;
+    im->length = 0;
+    memset(intmapUsedMap(im),0,(size+7)/8);
+    return im;
+}
+
+/* Return the slot holding "field", or the free slot where it should be
+ * inserted. The table always has free slots, so the probe terminates. */
+static uint32_t intmapLookup(intmap *im, int64_t field) {
+    uint32_t mask = im->size-1;
+    uint32_t i = intmapHash(field) & mask;
+
+    while(intmapUsed(im,i) && im->entries[i].field != field)
+        i = (i+1) & mask;
+    return i;
+}
+
+/* Move every entry to a new table of "size" slots. */
+static intmap *intmapResize(intmap *im, uint32_t size) {
+    intmap *newim = intmapCreate(size);
+    uint32_t i;
+
+    for (i = 0; i < im->size; i++) {
+        if (!intmapUsed(im,i)) continue;
+        uint32_t j = intmapLookup(newim,im->entries[i].field);
+        newim->entries[j] = im->entries[i];
+        intmapSetUsed(newim,j);
+    }
+    newim->length = im->length;
+    zfree(im);
+    return newim;
+}
+
+/* Create an empty intmap. */
+intmap *intmapNew(void) {
+    return intmapCreate(INTMAP_MIN_SIZE);
+}
+
+/* Set "field" to "value". When "update" is not NULL it is set to 1 if the
+ * field already existed and to 0 if it was added. */
+intmap *intmapSet(intmap *im, int64_t field, int64_t value, int *update) {
+    uint32_t i = intmapLookup(im,field);
+
+    if (intmapUsed(im,i)) {
+        im->entries[i].value = value;
+        if (update) *update = 1;
+        return im;
+    }
+    if (update) *update = 0;
+    if (INTMAP_GROW(im->length+1,im->size)) {
+        im = intmapResize(im,im->size*2);
+        i = intmapLookup(im,field);
+    }
+    im->entries[i].field = field;
+    im->entries[i].value = value;
+    intmapSetUsed(im,i);
+    im->length++;
+    return im;
+}
+
+/* Delete "field". When "deleted" is not NULL it is set to 1 if the field
+ * existed and to 0 otherwise. */
+intmap *intmapDelete(intmap *im, int64_t field, int *deleted) {
+    uint32_t mask = im->size-1;
+    uint32_t i = intmapLookup(im,field), j = i;
+
+    if (!intmapUsed(im,i)) {
+        if (deleted) *deleted = 0;
+        return im;
+    }
+    if (deleted) *deleted = 1;
+
+    /* Shift back the entries of the cluster that would not be found
+     * anymore once slot "i" is free: the ones whose home slot is not
+     * cyclically in (i,j]. */
+    while(1) {
+        j = (j+1) & mask;
+        if (!intmapUsed(im,j)) break;
+        uint32_t home = intmapHash(im->entries[j].field) & mask;
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        im->entries[i] = im->entries[j];
+        i = j;
+    }
+    intmapClearUsed(im,i);
+    im->length--;
+
+    if (INTMAP_SHRINK(im->length,im->size))
+        im = intmapResize(im,im->size/2);
+    return im;
+}
+
+/* Return 1 and set "value" (when not NULL) if "field" exists, return 0
+ * otherwise. */
+int intmapFind(intmap *im, int64_t field, int64_t *value) {
+    uint32_t i = intmapLookup(im,field);
+
+    if (!intmapUsed(im,i)) return 0;
+    if (value) *value = im->entries[i].value;
+    return 1;
+}
+
+/* Iterate the entries: "pos" must start at zero, and is advanced past the
+ * returned entry. Return 0 when there are no more entries. */
+int intmapNext(intmap *im, uint32_t *pos, int64_t *field, int64_t *value) {
+    uint32_t i;
+
+    for (i = *pos; i < im->size; i++) {
+        if (!intmapUsed(im,i)) continue;
+        *field = im->entries[i].field;
+        *value = im->entries[i].value;
+        *pos = i+1;
+        return 1;
+    }
+    *pos = im->size;
+    return 0;
+}
+
+/* Return the number of fields. */
+uint32_t intmapLen(const intmap *im) {
+    return im->length;
+}
+
+/* Return the size of the allocation in bytes. */
+size_t intmapBlobLen(const intmap *im) {
+    return intmapAllocSize(im->size);
+}
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include <time.h>
+
+#define assert(_e) ((_e)?(void)0:(_assert(#_e,__FILE__,__LINE__),exit(1)))
+static void _assert(char *estr, char *file, int line) {
+    printf("\n\n=== ASSERTION FAILED ===\n");
+    printf("==> %s:%d '%s' is not true\n",file,line,estr);
+}
+
+static void ok(void) {
+    printf("OK\n");
+}
+
+/* Every used slot must be reachable from the home slot of its field
+ * without crossing a free slot. */
+static void checkConsistency(intmap *im) {
+    uint32_t mask = im->size-1, i, j, len = 0;
+
+    for (i = 0; i < im->size; i++) {
+        if (!intmapUsed(im,i)) continue;
+        len++;
+        for (j = intmapHash(im->entries[i].field) & mask; j != i;
+             j = (j+1) & mask)
+            assert(intmapUsed(im,j));
+    }
+    assert(len == im->length);
+    assert(!INTMAP_GROW(im->length,im->size));
+}
+
+#define UNUSED(x) (void)(x)
+int intmapTest(int argc, char **argv) {
+    intmap *im;
+    int64_t value;
+    int flag, i;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(time(NULL));
+
+    printf("Basic set, find and delete: "); {
+        im = intmapNew();
+        im = intmapSet(im,5,50,&flag); assert(!flag);
+        im = intmapSet(im,-5,-50,&flag); assert(!flag);
+        im = intmapSet(im,INT64_MAX,1,&flag); assert(!flag);
+        im = intmapSet(im,5,55,&flag); assert(flag);
+        assert(intmapLen(im) == 3);
+        assert(intmapFind(im,5,&value) && value == 55);
+        assert(intmapFind(im,-5,&value) && value == -50);
+        assert(intmapFind(im,INT64_MAX,&value) && value == 1);
+        assert(!intmapFind(im,6,NULL));
+        im = intmapDelete(im,5,&flag); assert(flag);
+        im = intmapDelete(im,5,&flag); assert(!flag);
+        assert(!intmapFind(im,5,NULL));
+        assert(intmapLen(im) == 2);
+        checkConsistency(im);
+        zfree(im);
+        ok();
+    }
+
+    printf("Random operations against a reference: "); {
+        int64_t ref[4096];
+        uint8_t present[4096];
+        uint32_t pos = 0, count = 0;
+        int64_t field;
+
+        memset(present,0,sizeof(present));
+        im = intmapNew();
+        for (i = 0; i < 200000; i++) {
+            int f = rand() % 4096;
+            /* Grow and shrink in waves to go through the resizes. */
+            int del = (i/20000) % 2 ? rand()%4 != 0 : rand()%4 == 0;
+
+            if (del) {
+                im = intmapDelete(im,f-2048,&flag);
+                assert(flag == present[f]);
+                present[f] = 0;
+            } else {
+                ref[f] = rand();
+                im = intmapSet(im,f-2048,ref[f],&flag);
+                assert(flag == present[f]);
+                present[f] = 1;
+            }
+            if (i % 1000 == 0) checkConsistency(im);
+        }
+        checkConsistency(im);
+        for (i = 0; i < 4096; i++) {
+            assert(intmapFind(im,i-2048,&value) == present[i]);
+            if (present[i]) {
+                assert(value == ref[i]);
+                count++;
+            }
+        }
+        assert(intmapLen(im) == count);
+        count = 0;
+        while(intmapNext(im,&pos,&field,&value)) {
+            assert(present[field+2048] && ref[field+2048] == value);
+            count++;
+        }
+        assert(intmapLen(im) == count);
+        zfree(im);
+        ok();
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __INTMAP_H
+#define __INTMAP_H
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct intmapEntry {
+    int64_t field;
+    int64_t value;
+} intmapEntry;
+
+/* Open addressing table of integer fields and values. The entries are
+ * followed by a bitmap of the used slots. */
+typedef struct intmap {
+    uint32_t size;      /* Number of slots, a power of two. */
+    uint32_t length;    /* Number of fields. */
+    intmapEntry entries[];
+} intmap;
+
+intmap *intmapNew(void);
+intmap *intmapSet(intmap *im, int64_t field, int64_t value, int *update);
+intmap *intmapDelete(intmap *im, int64_t field, int *deleted);
+int intmapFind(intmap *im, int64_t field, int64_t *value);
+int intmapNext(intmap *im, uint32_t *pos, int64_t *field, int64_t *value);
+uint32_t intmapLen(const intmap *im);
+size_t intmapBlobLen(const intmap *im);
+
+#ifdef REDIS_TEST
+int intmapTest(int argc, char *argv[]);
+#endif
+
+#endif // __INTMAP_H
@@ -108,6 +108,74 @@ static intset *intsetResize(intset *is, uint32_t len) {
     return is;
 }
 
+/* ----------------------------------------------------------------------------
+ * Vector kernels.
+ *
+ * The int16 and int32 encodings are scanned with SSE2 on x86-64 and with
+ * NEON on aarch64, both part of the base ISA, so no runtime check is needed.
+ * The kernels load the contents as they are, so they are only used on
+ * little endian hosts.
+ * -------------------------------------------------------------------------- */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define INTSET_SIMD_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON) && !defined(__AARCH64EB__)
+#include <arm_neon.h>
+#define INTSET_SIMD_NEON 1
+#endif
+
+/* intsetSearch() stops the binary search and scans what is left when the
+ * range is down to this many elements. */
+#define INTSET_SCAN_MAX 32
+
+/* intsetIntersect() looks up every element of the smaller set in the larger
+ * one instead of merging them when the larger is this many times bigger. */
+#define INTSET_PROBE_RATIO 32
+
+/* Return the number of elements less than "value" among the "count" ones
+ * starting at "pos". The value must fit the encoding of the intset. */
+static uint32_t intsetCountLess(intset *is, uint32_t pos, uint32_t count,
+                                int64_t value) {
+    uint8_t enc = intrev32ifbe(is->encoding);
+    uint32_t j = 0, less = 0;
+
+#if defined(INTSET_SIMD_SSE2)
+    if (enc == INTSET_ENC_INT16) {
+        const int16_t *p = ((const int16_t*)is->contents)+pos;
+        __m128i v = _mm_set1_epi16((int16_t)value);
+        for (; j+8 <= count; j += 8) {
+            __m128i e = _mm_loadu_si128((const __m128i*)(p+j));
+            less += __builtin_popcount(
+                _mm_movemask_epi8(_mm_cmplt_epi16(e,v)))/2;
+        }
+    } else if (enc == INTSET_ENC_INT32) {
+        const int32_t *p = ((const int32_t*)is->contents)+pos;
+        __m128i v = _mm_set1_epi32((int32_t)value);
+        for (; j+4 <= count; j += 4) {
+            __m128i e = _mm_loadu_si128((const __m128i*)(p+j));
+            less += __builtin_popcount(
+                _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(e,v))));
+        }
+    }
+#elif defined(INTSET_SIMD_NEON)
+    if (enc == INTSET_ENC_INT16) {
+        const int16_t *p = ((const int16_t*)is->contents)+pos;
+        int16x8_t v = vdupq_n_s16((int16_t)value);
+        for (; j+8 <= count; j += 8)
+            less += vaddvq_u16(vshrq_n_u16(vcltq_s16(vld1q_s16(p+j),v),15));
+    } else if (enc == INTSET_ENC_INT32) {
+        const int32_t *p = ((const int32_t*)is->contents)+pos;
+        int32x4_t v = vdupq_n_s32((int32_t)value);
+        for (; j+4 <= count; j += 4)
+            less += vaddvq_u32(vshrq_n_u32(vcltq_s32(vld1q_s32(p+j),v),31));
+    }
+#endif
+    for (; j < count; j++)
+        less += _intsetGetEncoded(is,pos+j,enc) < value;
+    return less;
+}
+
 /* Search for the position of "value". Return 1 when the value was found and
  * sets "pos" to the position of the value within the intset. Return 0 when
  * the value is not present in the intset and sets "pos" to the position
@@ -132,7 +200,10 @@ static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
         }
     }
 
-    while(max >= min) {
+    /* Small sets, and the end of the search on larger ones, are scanned:
+     * the value is between the first and the last element, so it fits the
+     * encoding of the intset. */
+    while(max-min >= INTSET_SCAN_MAX) {
         mid = ((unsigned int)min + (unsigned int)max) >> 1;
         cur = _intsetGet(is,mid);
         if (value > cur) {
@@ -140,17 +211,13 @@ static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
         } else if (value < cur) {
             max = mid-1;
         } else {
-            break;
+            if (pos) *pos = mid;
+            return 1;
         }
     }
-
-    if (value == cur) {
-        if (pos) *pos = mid;
-        return 1;
-    } else {
-        if (pos) *pos = min;
-        return 0;
-    }
+    min += intsetCountLess(is,min,max-min+1,value);
+    if (pos) *pos = min;
+    return min <= max && _intsetGet(is,min) == value;
 }
 
 /* Upgrades the intset to a larger encoding and inserts the given integer. */
@@ -256,6 +323,237 @@ uint8_t intsetFind(intset *is, int64_t value) {
     return valenc <= intrev32ifbe(is->encoding) && intsetSearch(is,value,NULL);
 }
 
+/* Create an intset with the given encoding and room for "len" elements.
+ * The length is left to zero: the caller fills the contents and then sets
+ * it. */
+static intset *intsetNewEncoded(uint8_t enc, uint32_t len) {
+    intset *is = zmalloc(sizeof(intset)+(size_t)len*enc);
+    is->encoding = intrev32ifbe(enc);
+    is->length = 0;
+    return is;
+}
+
+/* Copy "count" elements of "src" starting at "from" to "dst" starting at
+ * "to". The encoding of "dst" must be able to hold them. */
+static void intsetCopy(intset *dst, uint32_t to, intset *src, uint32_t from,
+                       uint32_t count) {
+    uint8_t srcenc = intrev32ifbe(src->encoding);
+
+    if (srcenc == intrev32ifbe(dst->encoding)) {
+        memcpy(dst->contents+(size_t)to*srcenc,
+               src->contents+(size_t)from*srcenc,(size_t)count*srcenc);
+    } else {
+        while(count--) _intsetSet(dst,to++,_intsetGetEncoded(src,from++,srcenc));
+    }
+}
+
+/* Return the number of elements less than "value" among the "count" ones
+ * starting at "pos", like intsetCountLess(), but for any value. */
+static uint32_t intsetRunLess(intset *is, uint32_t pos, uint32_t count,
+                              int64_t value) {
+    if (_intsetValueEncoding(value) > intrev32ifbe(is->encoding))
+        return value > 0 ? count : 0;
+    return intsetCountLess(is,pos,count,value);
+}
+
+#if defined(INTSET_SIMD_SSE2) || defined(INTSET_SIMD_NEON)
+/* Return a bitmap of the elements of the block "a" that are also in the
+ * block "b". Blocks are 8 elements long for int16 and 4 for int32: every
+ * element of "a" is compared with every element of "b" by rotating "b". */
+static inline int intsetBlockMatch16(const int16_t *a, const int16_t *b) {
+#if defined(INTSET_SIMD_SSE2)
+    __m128i va = _mm_loadu_si128((const __m128i*)a);
+    __m128i vb = _mm_loadu_si128((const __m128i*)b);
+    __m128i m = _mm_cmpeq_epi16(va,vb);
+    int mask, bits = 0;
+
+#define INTSET_ROT16(v,n) \
+    _mm_or_si128(_mm_srli_si128(v,2*(n)),_mm_slli_si128(v,16-2*(n)))
+    m = _mm_or_si128(m,_mm_cmpeq_epi16(va,INTSET_ROT16(vb,1)));
+    m = _mm_or_si128(m,_mm_cmpeq_epi16(va,INTSET_ROT16(vb,2)));
+    m = _mm_or_si128(m,_mm_cmpeq_epi16(va,INTSET_ROT16(vb,3)));
+    m = _mm_or_si128(m,_mm_cmpeq_epi16(va,INTSET_ROT16(vb,4)));
+    m = _mm_or_si128(m,_mm_cmpeq_epi16(va,INTSET_ROT16(vb,5)));
+    m = _mm_or_si128(m,_mm_cmpeq_epi16(va,INTSET_ROT16(vb,6)));
+    m = _mm_or_si128(m,_mm_cmpeq_epi16(va,INTSET_ROT16(vb,7)));
+#undef INTSET_ROT16
+    /* Every 16 bit lane sets two bits of the byte mask. */
+    mask = _mm_movemask_epi8(m);
+    for (int l = 0; l < 8; l++) bits |= ((mask >> (2*l)) & 1) << l;
+    return bits;
+#else
+    int16x8_t va = vld1q_s16(a), vb = vld1q_s16(b);
+    uint16x8_t m = vceqq_s16(va,vb);
+    uint16_t lanes[8];
+    int bits = 0;
+
+    m = vorrq_u16(m,vceqq_s16(va,vextq_s16(vb,vb,1)));
+    m = vorrq_u16(m,vceqq_s16(va,vextq_s16(vb,vb,2)));
+    m = vorrq_u16(m,vceqq_s16(va,vextq_s16(vb,vb,3)));
+    m = vorrq_u16(m,vceqq_s16(va,vextq_s16(vb,vb,4)));
+    m = vorrq_u16(m,vceqq_s16(va,vextq_s16(vb,vb,5)));
+    m = vorrq_u16(m,vceqq_s16(va,vextq_s16(vb,vb,6)));
+    m = vorrq_u16(m,vceqq_s16(va,vextq_s16(vb,vb,7)));
+    vst1q_u16(lanes,m);
+    for (int l = 0; l < 8; l++) bits |= (lanes[l] & 1) << l;
+    return bits;
+#endif
+}
+
+static inline int intsetBlockMatch32(const int32_t *a, const int32_t *b) {
+#if defined(INTSET_SIMD_SSE2)
+    __m128i va = _mm_loadu_si128((const __m128i*)a);
+    __m128i vb = _mm_loadu_si128((const __m128i*)b);
+    __m128i m = _mm_cmpeq_epi32(va,vb);
+
+    m = _mm_or_si128(m,_mm_cmpeq_epi32(va,
+            _mm_shuffle_epi32(vb,_MM_SHUFFLE(0,3,2,1))));
+    m = _mm_or_si128(m,_mm_cmpeq_epi32(va,
+            _mm_shuffle_epi32(vb,_MM_SHUFFLE(1,0,3,2))));
+    m = _mm_or_si128(m,_mm_cmpeq_epi32(va,
+            _mm_shuffle_epi32(vb,_MM_SHUFFLE(2,1,0,3))));
+    return _mm_movemask_ps(_mm_castsi128_ps(m));
+#else
+    int32x4_t va = vld1q_s32(a), vb = vld1q_s32(b);
+    uint32x4_t m = vceqq_s32(va,vb);
+    uint32_t lanes[4];
+    int bits = 0;
+
+    m = vorrq_u32(m,vceqq_s32(va,vextq_s32(vb,vb,1)));
+    m = vorrq_u32(m,vceqq_s32(va,vextq_s32(vb,vb,2)));
+    m = vorrq_u32(m,vceqq_s32(va,vextq_s32(vb,vb,3)));
+    vst1q_u32(lanes,m);
+    for (int l = 0; l < 4; l++) bits |= (lanes[l] & 1) << l;
+    return bits;
+#endif
+}
+
+/* Intersect "a" and "b", that have the same int16 or int32 encoding, one
+ * block at a time, appending the common elements to "dst" that has the
+ * same encoding too. The block with the smallest last element is consumed
+ * after each comparison, so no pair of elements is compared twice. Update
+ * "i" and "j" to the first elements that were not consumed, and return the
+ * number of elements appended. The caller merges the tails. */
+static uint32_t intsetIntersectBlocks(intset *a, intset *b, intset *dst,
+                                      uint32_t *i, uint32_t *j) {
+    uint8_t enc = intrev32ifbe(a->encoding);
+    uint32_t alen = intrev32ifbe(a->length), blen = intrev32ifbe(b->length);
+    uint32_t ai = *i, bj = *j, k = 0;
+
+    if (enc == INTSET_ENC_INT16) {
+        const int16_t *pa = (const int16_t*)a->contents;
+        const int16_t *pb = (const int16_t*)b->contents;
+        int16_t *pd = (int16_t*)dst->contents;
+        while(ai+8 <= alen && bj+8 <= blen) {
+            int bits = intsetBlockMatch16(pa+ai,pb+bj);
+            int16_t amax = pa[ai+7], bmax = pb[bj+7];
+            for (int l = 0; bits; l++, bits >>= 1)
+                if (bits & 1) pd[k++] = pa[ai+l];
+            if (amax <= bmax) ai += 8;
+            if (bmax <= amax) bj += 8;
+        }
+    } else if (enc == INTSET_ENC_INT32) {
+        const int32_t *pa = (const int32_t*)a->contents;
+        const int32_t *pb = (const int32_t*)b->contents;
+        int32_t *pd = (int32_t*)dst->contents;
+        while(ai+4 <= alen && bj+4 <= blen) {
+            int bits = intsetBlockMatch32(pa+ai,pb+bj);
+            int32_t amax = pa[ai+3], bmax = pb[bj+3];
+            for (int l = 0; bits; l++, bits >>= 1)
+                if (bits & 1) pd[k++] = pa[ai+l];
+            if (amax <= bmax) ai += 4;
+            if (bmax <= amax) bj += 4;
+        }
+    }
+    *i = ai;
+    *j = bj;
+    return k;
+}
+#endif
+
+/* Return a new intset with the elements that are both in "a" and "b". */
+intset *intsetIntersect(intset *a, intset *b) {
+    uint32_t alen, blen, i = 0, j = 0, k = 0;
+    uint8_t aenc, benc;
+    intset *is;
+
+    /* Make "a" the smaller set. */
+    if (intrev32ifbe(a->length) > intrev32ifbe(b->length)) {
+        is = a; a = b; b = is;
+    }
+    alen = intrev32ifbe(a->length);
+    blen = intrev32ifbe(b->length);
+    aenc = intrev32ifbe(a->encoding);
+    benc = intrev32ifbe(b->encoding);
+    is = intsetNewEncoded(aenc < benc ? aenc : benc,alen);
+
+    if (alen && blen/alen >= INTSET_PROBE_RATIO) {
+        /* Merging would walk the whole larger set for a few elements. */
+        for (i = 0; i < alen; i++) {
+            int64_t v = _intsetGetEncoded(a,i,aenc);
+            if (intsetFind(b,v)) _intsetSet(is,k++,v);
+        }
+    } else {
+#if defined(INTSET_SIMD_SSE2) || defined(INTSET_SIMD_NEON)
+        if (aenc == benc && aenc != INTSET_ENC_INT64)
+            k = intsetIntersectBlocks(a,b,is,&i,&j);
+#endif
+        while(i < alen && j < blen) {
+            int64_t va = _intsetGetEncoded(a,i,aenc);
+            int64_t vb = _intsetGetEncoded(b,j,benc);
+            if (va < vb) {
+                i++;
+            } else if (va > vb) {
+                j++;
+            } else {
+                _intsetSet(is,k++,va);
+                i++;
+                j++;
+            }
+        }
+    }
+    is->length = intrev32ifbe(k);
+    return intsetResize(is,k);
+}
+
+/* Return a new intset with the elements that are in "a", in "b" or in
+ * both. Runs of elements of one set that sort before the next element of
+ * the other are found with the vector kernels and copied in bulk. */
+intset *intsetUnion(intset *a, intset *b) {
+    uint32_t alen = intrev32ifbe(a->length), blen = intrev32ifbe(b->length);
+    uint8_t aenc = intrev32ifbe(a->encoding), benc = intrev32ifbe(b->encoding);
+    uint32_t i = 0, j = 0, k = 0, n;
+    intset *is = intsetNewEncoded(aenc > benc ? aenc : benc,alen+blen);
+
+    while(i < alen && j < blen) {
+        int64_t va = _intsetGetEncoded(a,i,aenc);
+        int64_t vb = _intsetGetEncoded(b,j,benc);
+        if (va < vb) {
+            n = alen-i < INTSET_SCAN_MAX ? alen-i : INTSET_SCAN_MAX;
+            n = intsetRunLess(a,i,n,vb);
+            intsetCopy(is,k,a,i,n);
+            i += n;
+            k += n;
+        } else if (va > vb) {
+            n = blen-j < INTSET_SCAN_MAX ? blen-j : INTSET_SCAN_MAX;
+            n = intsetRunLess(b,j,n,va);
+            intsetCopy(is,k,b,j,n);
+            j += n;
+            k += n;
+        } else {
+            _intsetSet(is,k++,va);
+            i++;
+            j++;
+        }
+    }
+    intsetCopy(is,k,a,i,alen-i);
+    k += alen-i;
+    intsetCopy(is,k,b,j,blen-j);
+    k += blen-j;
+    is->length = intrev32ifbe(k);
+    return intsetResize(is,k);
+}
+
 /* Return random member */
 int64_t intsetRandom(intset *is) {
     return _intsetGet(is,rand()%intrev32ifbe(is->length));
@@ -487,6 +785,61 @@ int intsetTest(int argc, char **argv) {
         ok();
     }
 
+    printf("Search against linear scan: "); {
+        int bits;
+        for (bits = 10; bits <= 30; bits += 10) {
+            is = createSet(bits,1000);
+            for (i = 0; i < 10000; i++) {
+                int64_t v = rand() % ((1LL<<bits)-1), cur = 0;
+                uint32_t pos, j = 0;
+                uint8_t found = intsetSearch(is,v,&pos);
+                while(intsetGet(is,j,&cur) && cur < v) j++;
+                assert(pos == j);
+                assert(found == (j < intsetLen(is) && cur == v));
+            }
+            zfree(is);
+        }
+        ok();
+    }
+
+    printf("Intersection and union: "); {
+        int bits[] = {10, 14, 20, 30}, sizes[] = {0, 5, 100, 2000};
+        for (int x = 0; x < 16; x++) {
+            intset *a = createSet(bits[x%4],sizes[x/4]);
+            intset *b = createSet(bits[(x/4)%4],sizes[x%4]);
+            intset *inter, *uni;
+            uint32_t ninter = 0, nuni;
+            int64_t v;
+
+            /* Also cover the int64 encoding and mixed encodings. */
+            if (x%3 == 0) b = intsetAdd(b,1LL<<40,NULL);
+            inter = intsetIntersect(a,b);
+            uni = intsetUnion(a,b);
+            nuni = intsetLen(b);
+
+            for (uint32_t j = 0; intsetGet(a,j,&v); j++) {
+                if (intsetFind(b,v)) {
+                    assert(intsetFind(inter,v));
+                    ninter++;
+                } else {
+                    nuni++;
+                }
+                assert(intsetFind(uni,v));
+            }
+            for (uint32_t j = 0; intsetGet(b,j,&v); j++)
+                assert(intsetFind(uni,v));
+            assert(intsetLen(inter) == ninter);
+            assert(intsetLen(uni) == nuni);
+            if (ninter > 1) checkConsistency(inter);
+            if (nuni > 1) checkConsistency(uni);
+            zfree(a);
+            zfree(b);
+            zfree(inter);
+            zfree(uni);
+        }
+        ok();
+    }
+
     return 0;
 }
 #endif
@@ -127,6 +127,21 @@ void latencyAddSample(char *event, mstime_t latency) {
     if (ts->idx == LATENCY_TS_LEN) ts->idx = 0;
 }
 
+/* Histograms of the LATENCY_EVENT_* classes, see LATENCY HISTOGRAM. */
+static char *latencyEventNames[LATENCY_EVENT_NUM] = {
+    "fork", "popcorn-migrate", "active-rehash", "eviction-cycle",
+    "expire-cycle"
+};
+static latencyHistogram latencyEventHist[LATENCY_EVENT_NUM];
+
+/* Account a duration of 'usec' microseconds of the event class 'event' in
+ * its histogram, and in the time series of the event if it is over the
+ * latency-monitor-threshold. */
+void latencyAddEventSample(int event, long long usec) {
+    latencyHistogramAdd(&latencyEventHist[event],usec);
+    latencyAddSampleIfNeeded(latencyEventNames[event],usec/1000);
+}
+
 /* Reset data for the specified event, or all the events data if 'event' is
  * NULL.
  *
@@ -147,9 +162,60 @@ int latencyResetEvent(char *event_to_reset) {
         }
     }
     dictReleaseIterator(di);
+
+    for (int j = 0; j < LATENCY_EVENT_NUM; j++) {
+        if (event_to_reset == NULL ||
+            strcasecmp(latencyEventNames[j],event_to_reset) == 0)
+            memset(&latencyEventHist[j],0,sizeof(latencyHistogram));
+    }
     return resets;
 }
 
+/* Add a duration in microseconds to the histogram. */
+void latencyHistogramAdd(latencyHistogram *h, long long usec) {
+    int b = usec <= 0 ? 0 : 64-__builtin_clzll((unsigned long long)usec);
+
+    if (b >= LATENCY_HIST_BUCKETS) b = LATENCY_HIST_BUCKETS-1;
+    h->count[b]++;
+}
+
+/* Reply with the non empty buckets of the histogram, as a flat array of
+ * the upper bound in microseconds (exclusive) of every bucket followed by
+ * its count. The upper bound of the last bucket is reported as -1. */
+void latencyHistogramReply(client *c, latencyHistogram *h) {
+    int b, buckets = 0;
+
+    for (b = 0; b < LATENCY_HIST_BUCKETS; b++)
+        if (h->count[b]) buckets++;
+    addReplyArrayLen(c,buckets*2);
+    for (b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+        if (!h->count[b]) continue;
+        addReplyLongLong(c,b == LATENCY_HIST_BUCKETS-1 ? -1 : 1LL<<b);
+        addReplyLongLong(c,h->count[b]);
+    }
+}
+
+/* Reply to LATENCY HISTOGRAM with a map of the event classes named in
+ * argv[2..] (all of them if none is given) to their histograms. Unknown
+ * classes are left out. */
+void latencyCommandReplyWithHistograms(client *c) {
+    int j, k, found = 0;
+    int want[LATENCY_EVENT_NUM];
+
+    for (j = 0; j < LATENCY_EVENT_NUM; j++) {
+        want[j] = c->argc == 2;
+        for (k = 2; k < c->argc && !want[j]; k++)
+            want[j] = !strcasecmp(c->argv[k]->ptr,latencyEventNames[j]);
+        found += want[j];
+    }
+    addReplyMapLen(c,found);
+    for (j = 0; j < LATENCY_EVENT_NUM; j++) {
+        if (!want[j]) continue;
+        addReplyBulkCString(c,latencyEventNames[j]);
+        latencyHistogramReply(c,&latencyEventHist[j]);
+    }
+}
+
 /* ------------------------ Latency reporting (doctor) ---------------------- */
 
 /* Analyze the samples available for a given event and return a structure
@@ -232,6 +298,8 @@ sds createLatencyReport(void) {
     int advise_mass_eviction = 0;   /* Avoid mass eviction of keys. */
     int advise_relax_fsync_policy = 0; /* appendfsync always is slow. */
     int advise_disable_thp = 0;     /* AnonHugePages detected. */
+    int advise_forkless_cpu = 0;    /* Lower rdb-save-forkless-cpu. */
+    int advise_forkless_copy = 0;   /* Large keys modified while saving. */
     int advices = 0;
 
     /* Return ASAP if the latency engine is disabled and it looks like it
@@ -376,6 +444,17 @@ sds createLatencyReport(void) {
             advices++;
         }
 
+        /* BGSAVE without fork. */
+        if (!strcasecmp(event,"forkless-save-cycle")) {
+            advise_forkless_cpu = 1;
+            advices++;
+        }
+
+        if (!strcasecmp(event,"forkless-save-copy")) {
+            advise_forkless_copy = 1;
+            advices++;
+        }
+
         report = sdscatlen(report,"\n",1);
     }
     dictReleaseIterator(di);
@@ -463,6 +542,14 @@ sds createLatencyReport(void) {
             report = sdscat(report,"- Sudden changes to the 'maxmemory' setting via 'CONFIG SET', or allocation of large objects via sets or sorted sets intersections, STORE option of SORT, Redis Cluster large keys migrations (RESTORE command), may create sudden memory pressure forcing the server to block trying to evict keys. \n");
         }
 
+        if (advise_forkless_cpu && server.rdb_save_forkless_cpu > 1) {
+            report = sdscat(report,"- A BGSAVE without fork serializes the keys in slices of up to 'rdb-save-forkless-cpu' percent of every server cron period. Try a lower value, or a higher 'hz', to make the slices shorter: the save will take longer.\n");
+        }
+
+        if (advise_forkless_copy) {
+            report = sdscat(report,"- During a BGSAVE without fork, a key is saved before it is first modified, deleted, or its database flushed or swapped, if the save did not reach it yet. If you have very large objects that are modified during the saves, try to fragment those objects into multiple smaller objects.\n");
+        }
+
         if (advise_disable_thp) {
             report = sdscat(report,"- I detected a non zero amount of anonymous huge pages used by your process. This creates very serious latency events in different conditions, especially when Redis is persisting on disk. To disable THP support use the command 'echo never > /sys/kernel/mm/transparent_hugepage/enabled', make sure to also add it into /etc/rc.local so that the command will be executed again after a reboot. Note that even if you have already disabled THP, you still need to restart the Redis process to get rid of the huge pages already created.\n");
         }
@@ -562,6 +649,7 @@ sds latencyCommandGenSparkeline(char *event, struct latencyTimeSeries *ts) {
  *
  * LATENCY HISTORY: return time-latency samples for the specified event.
  * LATENCY LATEST: return the latest latency for all the events classes.
+ * LATENCY HISTOGRAM: return the duration histograms of some event classes.
  * LATENCY DOCTOR: returns a human readable analysis of instance latency.
  * LATENCY GRAPH: provide an ASCII graph of the latency of the specified event.
  * LATENCY RESET: reset data of a specified event or all the data if no event provided.
@@ -571,6 +659,9 @@ void latencyCommand(client *c) {
 "DOCTOR              -- Returns a human readable latency analysis report.",
 "GRAPH   <event>     -- Returns an ASCII latency graph for the event class.",
 "HISTORY <event>     -- Returns time-latency samples for the event class.",
+"HISTOGRAM [event ...] -- Returns the duration histograms of fork,",
+"                       popcorn-migrate, active-rehash, eviction-cycle and",
+"                       expire-cycle (default: all of them).",
 "LATEST              -- Returns the latest latency samples for all events.",
 "RESET   [event ...] -- Resets latency data of one or more event classes.",
 "                       (default: reset all data for all event classes)",
@@ -601,6 +692,9 @@ NULL
         graph = latencyCommandGenSparkeline(event,ts);
         addReplyBulkCString(c,graph);
         sdsfree(graph);
+    } else if (!strcasecmp(c->argv[1]->ptr,"histogram") && c->argc >= 2) {
+        /* LATENCY HISTOGRAM [event ...] */
+        latencyCommandReplyWithHistograms(c);
     } else if (!strcasecmp(c->argv[1]->ptr,"latest") && c->argc == 2) {
         /* LATENCY LATEST */
         latencyCommandReplyWithLatestEvents(c);
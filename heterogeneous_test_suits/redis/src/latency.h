@@ -61,8 +61,28 @@ struct latencyStats {
     time_t period;          /* Number of seconds since first event and now. */
 };
 
+/* Histogram of durations in microseconds. Bucket 0 counts durations below
+ * 1 us, bucket b > 0 durations in [2^(b-1), 2^b) us, and the last bucket
+ * everything above. */
+#define LATENCY_HIST_BUCKETS 25
+typedef struct latencyHistogram {
+    uint64_t count[LATENCY_HIST_BUCKETS];
+} latencyHistogram;
+
+/* Event classes that also keep a histogram of all their durations, not only
+ * of the ones over latency-monitor-threshold. The buckets are the same for
+ * every class and every instance, so histograms can be summed. */
+#define LATENCY_EVENT_FORK 0            /* "fork" */
+#define LATENCY_EVENT_MIGRATE 1         /* "popcorn-migrate" */
+#define LATENCY_EVENT_REHASH 2          /* "active-rehash" */
+#define LATENCY_EVENT_EVICTION 3        /* "eviction-cycle" */
+#define LATENCY_EVENT_EXPIRE 4          /* "expire-cycle" */
+#define LATENCY_EVENT_NUM 5
+
 void latencyMonitorInit(void);
 void latencyAddSample(char *event, mstime_t latency);
+void latencyHistogramAdd(latencyHistogram *h, long long usec);
+void latencyAddEventSample(int event, long long usec);
 int THPIsEnabled(void);
 
 /* Latency monitoring macros. */
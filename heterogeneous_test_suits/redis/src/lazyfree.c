@@ -6,6 +6,12 @@
 static size_t lazyfree_objects = 0;
 pthread_mutex_t lazyfree_objects_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* The objects the main thread deletes lazily during an event loop iteration
+ * are collected here and handed to the lazyfree thread as a single job by
+ * lazyfreeFlushPending(), called from beforeSleep(), instead of one job,
+ * mutex and wakeup per object. */
+static lazyfreeBatch *lazyfree_pending = NULL;
+
 /* Return the number of currently pending objects to free. */
 size_t lazyfreeGetPendingObjectsCount(void) {
     size_t aux;
@@ -38,6 +44,9 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
     } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_SKIPLIST){
         zset *zs = obj->ptr;
         return zs->zsl->length;
+    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_BTREE) {
+        zset *zs = obj->ptr;
+        return zs->zbt->length;
     } else if (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) {
         dict *ht = obj->ptr;
         return dictSize(ht);
@@ -51,10 +60,32 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
  * a lazy free list instead of being freed synchronously. The lazy free list
  * will be reclaimed in a different bio.c thread. */
 #define LAZYFREE_THRESHOLD 64
-int dbAsyncDelete(redisDb *db, robj *key) {
+
+/* Free 'o' in the lazyfree thread, with the other objects of the current
+ * event loop iteration. Threads other than the main one, like those of the
+ * modules holding the GIL, submit a job right away. */
+static void lazyfreeAddPending(robj *o) {
+    if (!pthread_equal(pthread_self(),server.main_thread_id)) {
+        atomicIncr(lazyfree_objects,1);
+        bioCreateBackgroundJob(BIO_LAZY_FREE,o,NULL,NULL);
+        return;
+    }
+    if (lazyfree_pending == NULL)
+        lazyfree_pending = zcalloc(sizeof(lazyfreeBatch));
+    lazyfree_pending->objs[lazyfree_pending->count++] = o;
+    if (lazyfree_pending->count == LAZYFREE_BATCH_SIZE)
+        lazyfreeFlushPending();
+}
+
+static int dbAsyncDeleteGeneric(redisDb *db, robj *key, lazyfreeBatch **batch) {
+    if (server.rdb_forkless) rdbForklessWillModify(db,key);
+
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
+    if (dictSize(db->expires) > 0) {
+        if (db->expires_index) expireIndexDel(db,key->ptr);
+        dictDelete(db->expires,key->ptr);
+    }
 
     /* If the value is composed of a few allocations, to free in a lazy way
      * is actually just slower... So under a certain limit we just free
@@ -72,9 +103,16 @@ int dbAsyncDelete(redisDb *db, robj *key) {
          * objects, and then call dbDelete(). In this case we'll fall
          * through and reach the dictFreeUnlinkedEntry() call, that will be
          * equivalent to just calling decrRefCount(). */
-        if (free_effort > LAZYFREE_THRESHOLD && val->refcount == 1) {
-            atomicIncr(lazyfree_objects,1);
-            bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
+        if (batch && val->refcount == 1) {
+            if (*batch == NULL) *batch = zcalloc(sizeof(lazyfreeBatch));
+            (*batch)->objs[(*batch)->count++] = val;
+            if ((*batch)->count == LAZYFREE_BATCH_SIZE) {
+                lazyfreeBatchSubmit(*batch);
+                *batch = NULL;
+            }
+            dictSetVal(db->dict,de,NULL);
+        } else if (free_effort > LAZYFREE_THRESHOLD && val->refcount == 1) {
+            lazyfreeAddPending(val);
             dictSetVal(db->dict,de,NULL);
         }
     }
@@ -90,12 +128,40 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     }
 }
 
+int dbAsyncDelete(redisDb *db, robj *key) {
+    return dbAsyncDeleteGeneric(db,key,NULL);
+}
+
+/* Like dbAsyncDelete(), but the value is added to '*batch' whatever its
+ * size, to be released with the rest of the batch by a single job of the
+ * lazyfree thread: one job per small object would cost more than freeing
+ * it. '*batch' is created if NULL, and submitted and set to NULL when
+ * full. The caller submits the last one with lazyfreeBatchSubmit(). */
+int dbAsyncDeleteBatched(redisDb *db, robj *key, lazyfreeBatch **batch) {
+    return dbAsyncDeleteGeneric(db,key,batch);
+}
+
+/* Hand a batch of objects to the lazyfree thread. From the main thread
+ * this takes no lock unless the thread sleeps, see bioSubmitLazyfreeBatch(). */
+void lazyfreeBatchSubmit(lazyfreeBatch *batch) {
+    atomicIncr(lazyfree_objects,batch->count);
+    if (!pthread_equal(pthread_self(),server.main_thread_id) ||
+        bioSubmitLazyfreeBatch(batch) == C_ERR)
+        bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,batch,NULL);
+}
+
+/* Submit the objects deleted so far in this event loop iteration. */
+void lazyfreeFlushPending(void) {
+    if (lazyfree_pending == NULL) return;
+    lazyfreeBatchSubmit(lazyfree_pending);
+    lazyfree_pending = NULL;
+}
+
 /* Free an object, if the object is huge enough, free it in async way. */
 void freeObjAsync(robj *o) {
     size_t free_effort = lazyfreeGetFreeEffort(o);
     if (free_effort > LAZYFREE_THRESHOLD && o->refcount == 1) {
-        atomicIncr(lazyfree_objects,1);
-        bioCreateBackgroundJob(BIO_LAZY_FREE,o,NULL,NULL);
+        lazyfreeAddPending(o);
     } else {
         decrRefCount(o);
     }
@@ -106,10 +172,17 @@ void freeObjAsync(robj *o) {
  * lazy freeing. */
 void emptyDbAsync(redisDb *db) {
     dict *oldht1 = db->dict, *oldht2 = db->expires;
-    db->dict = dictCreate(&dbDictType,NULL);
-    db->expires = dictCreate(&keyptrDictType,NULL);
+    db->dict = createDbDict(&dbDictType);
+    db->expires = createDbDict(&keyptrDictType);
     atomicIncr(lazyfree_objects,dictSize(oldht1));
     bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
+    if (db->expires_index) {
+        rax *oldidx = db->expires_index;
+
+        db->expires_index = raxNew();
+        atomicIncr(lazyfree_objects,oldidx->numele);
+        bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,oldidx);
+    }
 }
 
 /* Empty the slots-keys map of Redis CLuster by creating a new empty one
@@ -131,6 +204,15 @@ void lazyfreeFreeObjectFromBioThread(robj *o) {
     atomicDecr(lazyfree_objects,1);
 }
 
+/* Release a batch of objects from the lazyfree thread. */
+void lazyfreeFreeBatchFromBioThread(lazyfreeBatch *batch) {
+    size_t j, count = batch->count;
+
+    for (j = 0; j < count; j++) decrRefCount(batch->objs[j]);
+    zfree(batch);
+    atomicDecr(lazyfree_objects,count);
+}
+
 /* Release a database from the lazyfree thread. The 'db' pointer is the
  * database which was substitutied with a fresh one in the main thread
  * when the database was logically deleted. 'sl' is a skiplist used by
@@ -0,0 +1,606 @@
+/* memanalyze.c -- Background analysis of the memory used by the keyspace.
+ *
+ * MEMORY ANALYZE START forks a child that walks a snapshot of all the dbs,
+ * estimates the memory of every key as MEMORY USAGE does, and aggregates
+ * the estimates by type (with a log2 histogram of the key sizes) and by key
+ * prefix, the prefix being the key up to its DEPTH-th separator. The dict
+ * buckets are split in ranges that several threads of the child visit in
+ * parallel, each with its own counters, merged at the end.
+ *
+ * Unlike redis-cli --bigkeys/--memkeys this takes no SCAN round trips and
+ * no time from the event loop after the fork. The child writes its report
+ * to a temporary file that serverCron() loads when the child exits, then
+ * MEMORY ANALYZE RESULT returns it until the next analysis.
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+#include <pthread.h>
+
+#define MEMANALYZE_TASK_SLOTS 4096      /* Dict buckets of a task. */
+#define MEMANALYZE_BUCKETS 64           /* Log2 buckets of the key sizes. */
+#define MEMANALYZE_TYPES (OBJ_STREAM+1)
+#define MEMANALYZE_MAX_PREFIXES 100000  /* Per thread, see "untracked". */
+#define MEMANALYZE_MAX_DEPTH 16
+#define MEMANALYZE_MAX_TOP 10000
+#define MEMANALYZE_DEF_THREADS 4
+#define MEMANALYZE_DEF_TOP 100
+
+#define MEMANALYZE_NONE 0
+#define MEMANALYZE_RUNNING 1
+#define MEMANALYZE_DONE 2
+#define MEMANALYZE_FAILED 3
+#define MEMANALYZE_ABORTED 4
+
+static char *memAnalyzeStatusName[] = {
+    "none", "running", "done", "failed", "aborted"
+};
+
+static char *memAnalyzeTypeName[MEMANALYZE_TYPES] = {
+    "string", "list", "set", "zset", "hash", "module", "stream"
+};
+
+typedef struct memAnalyzeStat {
+    unsigned long long keys;
+    unsigned long long bytes;
+} memAnalyzeStat;
+
+typedef struct memAnalyzeTypeStat {
+    unsigned long long keys;
+    unsigned long long bytes;
+    unsigned long long hist[MEMANALYZE_BUCKETS]; /* Keys of 2^i..2^(i+1)-1 */
+} memAnalyzeTypeStat;
+
+typedef struct memAnalyzeOptions {
+    char separator;
+    int depth;
+    int top;
+    int threads;
+    long long samples;
+} memAnalyzeOptions;
+
+/* The work shared by the threads of the child. The tasks of the db 'j' are
+ * first[j] .. first[j+1]-1, as in rdbSaveKeysThreaded(). */
+typedef struct memAnalyzeJob {
+    memAnalyzeOptions *opt;
+    long *first;
+    long ntasks;
+    long next;                      /* Next task to take, atomically. */
+} memAnalyzeJob;
+
+typedef struct memAnalyzeWorker {
+    memAnalyzeJob *job;
+    memAnalyzeTypeStat types[MEMANALYZE_TYPES];
+    dict *prefixes;                 /* sds prefix -> memAnalyzeStat */
+    memAnalyzeStat untracked;       /* Keys of prefixes past the limit. */
+    pthread_t tid;
+} memAnalyzeWorker;
+
+typedef struct memAnalyzePrefix {
+    sds prefix;
+    memAnalyzeStat stat;
+} memAnalyzePrefix;
+
+/* The analysis as seen by the parent. */
+static struct {
+    pid_t child_pid;
+    int status;
+    int abort;
+    time_t start;
+    long long start_us;
+    long long duration;             /* Milliseconds. */
+    memAnalyzeOptions opt;
+    memAnalyzeTypeStat types[MEMANALYZE_TYPES];
+    memAnalyzeStat untracked;
+    memAnalyzePrefix *prefixes;     /* By decreasing bytes. */
+    unsigned long nprefixes;
+} ma = { .child_pid = -1 };
+
+static void memAnalyzeStatFree(void *privdata, void *val) {
+    UNUSED(privdata);
+    zfree(val);
+}
+
+static dictType memAnalyzePrefixDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    memAnalyzeStatFree          /* val destructor */
+};
+
+/* ----------------------------- The child ---------------------------------- */
+
+/* Length of the prefix of 'key' up to its depth-th separator, or up to its
+ * last separator if it has less. Keys without separator have an empty
+ * prefix. */
+static size_t memAnalyzePrefixLen(sds key, char separator, int depth) {
+    size_t len = sdslen(key), plen = 0;
+    char *p = key, *end = key+len;
+
+    while (depth-- && p < end) {
+        char *sep = memchr(p,separator,end-p);
+
+        if (sep == NULL) break;
+        plen = sep-key;
+        p = sep+1;
+    }
+    return plen;
+}
+
+static void memAnalyzeCallback(void *privdata, const dictEntry *de) {
+    memAnalyzeWorker *w = privdata;
+    memAnalyzeOptions *opt = w->job->opt;
+    sds key = dictGetKey(de);
+    robj *o = dictGetVal(de);
+    size_t bytes, plen;
+    memAnalyzeTypeStat *ts;
+    memAnalyzeStat *ps;
+    dictEntry *pe;
+    sds prefix;
+
+    bytes = objectComputeSize(o,opt->samples);
+    bytes += sdsAllocSize(key);
+    bytes += sizeof(dictEntry);
+
+    ts = w->types+(o->type < MEMANALYZE_TYPES ? o->type : OBJ_MODULE);
+    ts->keys++;
+    ts->bytes += bytes;
+    ts->hist[bytes ? 63-__builtin_clzll(bytes) : 0]++;
+
+    plen = memAnalyzePrefixLen(key,opt->separator,opt->depth);
+    prefix = sdsnewlen(key,plen);
+    if ((pe = dictFind(w->prefixes,prefix)) != NULL) {
+        sdsfree(prefix);
+        ps = dictGetVal(pe);
+    } else if (dictSize(w->prefixes) < MEMANALYZE_MAX_PREFIXES) {
+        ps = zcalloc(sizeof(*ps));
+        dictAdd(w->prefixes,prefix,ps);
+    } else {
+        sdsfree(prefix);
+        ps = &w->untracked;
+    }
+    ps->keys++;
+    ps->bytes += bytes;
+}
+
+static void *memAnalyzeThreadMain(void *arg) {
+    memAnalyzeWorker *w = arg;
+    memAnalyzeJob *job = w->job;
+    long i;
+
+    while ((i = __atomic_fetch_add(&job->next,1,__ATOMIC_RELAXED)) <
+           job->ntasks)
+    {
+        int j = 0;
+
+        while (job->first[j+1] <= i) j++;
+        dictScanSlots(server.db[j].dict,
+                      (unsigned long)(i-job->first[j])*MEMANALYZE_TASK_SLOTS,
+                      (unsigned long)(i-job->first[j]+1)*MEMANALYZE_TASK_SLOTS,
+                      memAnalyzeCallback,w);
+    }
+    return NULL;
+}
+
+static int memAnalyzePrefixCompare(const void *a, const void *b) {
+    const memAnalyzePrefix *pa = a, *pb = b;
+
+    if (pa->stat.bytes == pb->stat.bytes) return 0;
+    return pa->stat.bytes > pb->stat.bytes ? -1 : 1;
+}
+
+/* Write the report loaded by memAnalyzeLoadReport(): the type counters, the
+ * untracked counter, the number of prefixes, then every prefix as its
+ * counters, its length as uint32_t and its bytes. */
+static int memAnalyzeWriteReport(char *filename, memAnalyzeWorker *w,
+                                 memAnalyzePrefix *prefixes, uint64_t count)
+{
+    FILE *fp = fopen(filename,"w");
+    uint64_t j;
+
+    if (fp == NULL) return C_ERR;
+    if (fwrite(w->types,sizeof(w->types),1,fp) != 1 ||
+        fwrite(&w->untracked,sizeof(w->untracked),1,fp) != 1 ||
+        fwrite(&count,sizeof(count),1,fp) != 1) goto werr;
+    for (j = 0; j < count; j++) {
+        uint32_t len = sdslen(prefixes[j].prefix);
+
+        if (fwrite(&prefixes[j].stat,sizeof(memAnalyzeStat),1,fp) != 1 ||
+            fwrite(&len,sizeof(len),1,fp) != 1 ||
+            (len && fwrite(prefixes[j].prefix,len,1,fp) != 1)) goto werr;
+    }
+    if (fclose(fp) == EOF) return C_ERR;
+    return C_OK;
+
+werr:
+    fclose(fp);
+    return C_ERR;
+}
+
+/* Analyze the keyspace with opt->threads threads, the calling one included,
+ * and write the report in 'filename'. */
+static int memAnalyzeRun(memAnalyzeOptions *opt, char *filename) {
+    memAnalyzeWorker *workers, *w;
+    memAnalyzePrefix *prefixes;
+    memAnalyzeJob job;
+    dictIterator *di;
+    dictEntry *de;
+    unsigned long count = 0;
+    int j, k, started = 1, retval;
+
+    job.opt = opt;
+    job.first = zmalloc(sizeof(long)*(server.dbnum+1));
+    job.ntasks = 0;
+    job.next = 0;
+    for (j = 0; j < server.dbnum; j++) {
+        dict *d = server.db[j].dict;
+
+        job.first[j] = job.ntasks;
+        if (dictSize(d))
+            job.ntasks += (dictSlots(d)+MEMANALYZE_TASK_SLOTS-1)/
+                          MEMANALYZE_TASK_SLOTS;
+    }
+    job.first[server.dbnum] = job.ntasks;
+
+    workers = zcalloc(sizeof(*workers)*opt->threads);
+    for (j = 0; j < opt->threads; j++) {
+        workers[j].job = &job;
+        workers[j].prefixes = dictCreate(&memAnalyzePrefixDictType,NULL);
+    }
+    for (j = 1; j < opt->threads; j++) {
+        if (pthread_create(&workers[j].tid,NULL,memAnalyzeThreadMain,
+                           workers+j) != 0) break;
+        started++;
+    }
+    memAnalyzeThreadMain(workers);
+    for (j = 1; j < started; j++) pthread_join(workers[j].tid,NULL);
+
+    /* Merge everything in the first worker. */
+    w = workers;
+    for (j = 1; j < opt->threads; j++) {
+        memAnalyzeWorker *o = workers+j;
+
+        for (k = 0; k < MEMANALYZE_TYPES; k++) {
+            int b;
+
+            w->types[k].keys += o->types[k].keys;
+            w->types[k].bytes += o->types[k].bytes;
+            for (b = 0; b < MEMANALYZE_BUCKETS; b++)
+                w->types[k].hist[b] += o->types[k].hist[b];
+        }
+        w->untracked.keys += o->untracked.keys;
+        w->untracked.bytes += o->untracked.bytes;
+
+        di = dictGetIterator(o->prefixes);
+        while ((de = dictNext(di)) != NULL) {
+            memAnalyzeStat *src = dictGetVal(de), *dst;
+            dictEntry *we = dictFind(w->prefixes,dictGetKey(de));
+
+            if (we) {
+                dst = dictGetVal(we);
+                dst->keys += src->keys;
+                dst->bytes += src->bytes;
+            } else {
+                dictAdd(w->prefixes,sdsdup(dictGetKey(de)),src);
+                dictSetVal(o->prefixes,de,NULL);
+            }
+        }
+        dictReleaseIterator(di);
+        dictRelease(o->prefixes);
+    }
+
+    /* Keep the prefixes using the most memory. */
+    prefixes = zmalloc(sizeof(*prefixes)*(dictSize(w->prefixes)+1));
+    di = dictGetIterator(w->prefixes);
+    while ((de = dictNext(di)) != NULL) {
+        prefixes[count].prefix = dictGetKey(de);
+        prefixes[count].stat = *(memAnalyzeStat*)dictGetVal(de);
+        count++;
+    }
+    dictReleaseIterator(di);
+    qsort(prefixes,count,sizeof(*prefixes),memAnalyzePrefixCompare);
+    if (count > (unsigned long)opt->top) count = opt->top;
+
+    retval = memAnalyzeWriteReport(filename,w,prefixes,count);
+    zfree(prefixes);
+    dictRelease(w->prefixes);
+    zfree(workers);
+    zfree(job.first);
+    return retval;
+}
+
+/* ----------------------------- The parent --------------------------------- */
+
+static void memAnalyzeTempFile(char *buf, size_t len, pid_t pid) {
+    snprintf(buf,len,"temp-analyze-%d.bin",(int)pid);
+}
+
+static void memAnalyzeFreeReport(void) {
+    unsigned long j;
+
+    for (j = 0; j < ma.nprefixes; j++) sdsfree(ma.prefixes[j].prefix);
+    zfree(ma.prefixes);
+    ma.prefixes = NULL;
+    ma.nprefixes = 0;
+    memset(ma.types,0,sizeof(ma.types));
+    memset(&ma.untracked,0,sizeof(ma.untracked));
+}
+
+static int memAnalyzeLoadReport(char *filename) {
+    FILE *fp = fopen(filename,"r");
+    uint64_t count;
+
+    if (fp == NULL) return C_ERR;
+    if (fread(ma.types,sizeof(ma.types),1,fp) != 1 ||
+        fread(&ma.untracked,sizeof(ma.untracked),1,fp) != 1 ||
+        fread(&count,sizeof(count),1,fp) != 1 ||
+        count > MEMANALYZE_MAX_TOP) goto rerr;
+    ma.prefixes = zcalloc(sizeof(memAnalyzePrefix)*(count+1));
+    for (ma.nprefixes = 0; ma.nprefixes < count; ma.nprefixes++) {
+        memAnalyzePrefix *p = ma.prefixes+ma.nprefixes;
+        uint32_t len;
+
+        if (fread(&p->stat,sizeof(p->stat),1,fp) != 1 ||
+            fread(&len,sizeof(len),1,fp) != 1) goto rerr;
+        p->prefix = sdsnewlen(SDS_NOINIT,len);
+        if (len && fread(p->prefix,len,1,fp) != 1) {
+            sdsfree(p->prefix);
+            goto rerr;
+        }
+    }
+    fclose(fp);
+    return C_OK;
+
+rerr:
+    fclose(fp);
+    memAnalyzeFreeReport();
+    return C_ERR;
+}
+
+int memoryAnalyzeInProgress(void) {
+    return ma.child_pid != -1;
+}
+
+/* Called by serverCron() for every child that terminated: returns 0 if 'pid'
+ * is not the analysis child. */
+int memoryAnalyzeChildDone(pid_t pid, int exitcode, int bysignal) {
+    char tmpfile[64];
+
+    if (ma.child_pid == -1 || pid != ma.child_pid) return 0;
+    memAnalyzeTempFile(tmpfile,sizeof(tmpfile),pid);
+    ma.child_pid = -1;
+    ma.duration = (ustime()-ma.start_us)/1000;
+    if (!bysignal && exitcode == 0 && memAnalyzeLoadReport(tmpfile) == C_OK) {
+        ma.status = MEMANALYZE_DONE;
+        serverLog(LL_NOTICE,"Memory analysis terminated with success");
+    } else {
+        ma.status = ma.abort ? MEMANALYZE_ABORTED : MEMANALYZE_FAILED;
+        if (!ma.abort)
+            serverLog(LL_WARNING,"Memory analysis failed");
+    }
+    unlink(tmpfile);
+    updateDictResizePolicy();
+    return 1;
+}
+
+void memoryAnalyzeKillChild(void) {
+    char tmpfile[64];
+
+    if (ma.child_pid == -1) return;
+    serverLog(LL_WARNING,"Killing the memory analysis child %ld",
+        (long)ma.child_pid);
+    kill(ma.child_pid,SIGUSR1);
+    memAnalyzeTempFile(tmpfile,sizeof(tmpfile),ma.child_pid);
+    unlink(tmpfile);
+}
+
+static int memAnalyzeStart(memAnalyzeOptions *opt) {
+    char tmpfile[64];
+    long long start = ustime();
+    pid_t childpid;
+
+    if ((childpid = fork()) == 0) {
+        /* Child */
+        closeListeningSockets(0);
+        redisSetProcTitle("redis-memory-analyze");
+        memAnalyzeTempFile(tmpfile,sizeof(tmpfile),getpid());
+        exitFromChild(memAnalyzeRun(opt,tmpfile) == C_OK ? 0 : 1);
+    }
+
+    /* Parent */
+    server.stat_fork_time = ustime()-start;
+    latencyAddEventSample(LATENCY_EVENT_FORK,server.stat_fork_time);
+    if (childpid == -1) {
+        serverLog(LL_WARNING,"Can't analyze the memory in background: "
+            "fork: %s", strerror(errno));
+        return C_ERR;
+    }
+    serverLog(LL_NOTICE,"Memory analysis started by pid %d",childpid);
+    memAnalyzeFreeReport();
+    ma.child_pid = childpid;
+    ma.status = MEMANALYZE_RUNNING;
+    ma.abort = 0;
+    ma.start = time(NULL);
+    ma.start_us = start;
+    ma.duration = 0;
+    ma.opt = *opt;
+    updateDictResizePolicy();
+    return C_OK;
+}
+
+static void memAnalyzeReplyResult(client *c) {
+    unsigned long long keys = 0, bytes = 0;
+    unsigned long j;
+    int k;
+
+    if (ma.status != MEMANALYZE_DONE) {
+        addReplyMapLen(c,1);
+        addReplyBulkCString(c,"status");
+        addReplyBulkCString(c,memAnalyzeStatusName[ma.status]);
+        return;
+    }
+    for (k = 0; k < MEMANALYZE_TYPES; k++) {
+        keys += ma.types[k].keys;
+        bytes += ma.types[k].bytes;
+    }
+
+    addReplyMapLen(c,10);
+    addReplyBulkCString(c,"status");
+    addReplyBulkCString(c,memAnalyzeStatusName[ma.status]);
+    addReplyBulkCString(c,"start");
+    addReplyLongLong(c,ma.start);
+    addReplyBulkCString(c,"duration-ms");
+    addReplyLongLong(c,ma.duration);
+    addReplyBulkCString(c,"separator");
+    addReplyBulkCBuffer(c,&ma.opt.separator,1);
+    addReplyBulkCString(c,"depth");
+    addReplyLongLong(c,ma.opt.depth);
+    addReplyBulkCString(c,"keys");
+    addReplyLongLong(c,keys);
+    addReplyBulkCString(c,"bytes");
+    addReplyLongLong(c,bytes);
+
+    /* Types: keys, bytes, and the non empty buckets of the histogram as
+     * [max-bytes, keys] pairs. */
+    addReplyBulkCString(c,"types");
+    addReplyMapLen(c,MEMANALYZE_TYPES);
+    for (k = 0; k < MEMANALYZE_TYPES; k++) {
+        memAnalyzeTypeStat *ts = ma.types+k;
+        int b, buckets = 0;
+
+        for (b = 0; b < MEMANALYZE_BUCKETS; b++) buckets += ts->hist[b] != 0;
+        addReplyBulkCString(c,memAnalyzeTypeName[k]);
+        addReplyMapLen(c,3);
+        addReplyBulkCString(c,"keys");
+        addReplyLongLong(c,ts->keys);
+        addReplyBulkCString(c,"bytes");
+        addReplyLongLong(c,ts->bytes);
+        addReplyBulkCString(c,"histogram");
+        addReplyArrayLen(c,buckets);
+        for (b = 0; b < MEMANALYZE_BUCKETS; b++) {
+            if (ts->hist[b] == 0) continue;
+            addReplyArrayLen(c,2);
+            addReplyLongLong(c,b == 63 ? LLONG_MAX : (long long)
+                             ((2ULL<<b)-1));
+            addReplyLongLong(c,ts->hist[b]);
+        }
+    }
+
+    /* Prefixes as [prefix, keys, bytes]. */
+    addReplyBulkCString(c,"prefixes");
+    addReplyArrayLen(c,ma.nprefixes);
+    for (j = 0; j < ma.nprefixes; j++) {
+        memAnalyzePrefix *p = ma.prefixes+j;
+
+        addReplyArrayLen(c,3);
+        addReplyBulkCBuffer(c,p->prefix,sdslen(p->prefix));
+        addReplyLongLong(c,p->stat.keys);
+        addReplyLongLong(c,p->stat.bytes);
+    }
+    addReplyBulkCString(c,"untracked");
+    addReplyArrayLen(c,2);
+    addReplyLongLong(c,ma.untracked.keys);
+    addReplyLongLong(c,ma.untracked.bytes);
+}
+
+/* MEMORY ANALYZE START [SEPARATOR <char>] [DEPTH <n>] [TOP <n>]
+ *                      [THREADS <n>] [SAMPLES <count>]
+ * MEMORY ANALYZE RESULT
+ * MEMORY ANALYZE ABORT */
+void memoryAnalyzeCommand(client *c) {
+    char *sub = c->argv[2]->ptr;
+
+    if (!strcasecmp(sub,"start")) {
+        memAnalyzeOptions opt = {':', 1, MEMANALYZE_DEF_TOP,
+                                 MEMANALYZE_DEF_THREADS,
+                                 OBJ_COMPUTE_SIZE_DEF_SAMPLES};
+        long long val;
+        int j;
+
+        for (j = 3; j < c->argc; j++) {
+            char *name = c->argv[j]->ptr;
+
+            if (j+1 >= c->argc) {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+            if (!strcasecmp(name,"separator")) {
+                if (sdslen(c->argv[j+1]->ptr) != 1) {
+                    addReplyError(c,"The separator must be one character");
+                    return;
+                }
+                opt.separator = ((char*)c->argv[j+1]->ptr)[0];
+                j++;
+                continue;
+            }
+            if (getLongLongFromObjectOrReply(c,c->argv[j+1],&val,NULL)
+                != C_OK) return;
+            if (!strcasecmp(name,"depth") &&
+                val >= 1 && val <= MEMANALYZE_MAX_DEPTH) {
+                opt.depth = val;
+            } else if (!strcasecmp(name,"top") &&
+                       val >= 1 && val <= MEMANALYZE_MAX_TOP) {
+                opt.top = val;
+            } else if (!strcasecmp(name,"threads") &&
+                       val >= 1 && val <= RDB_SAVE_THREADS_MAX) {
+                opt.threads = val;
+            } else if (!strcasecmp(name,"samples") && val >= 0) {
+                opt.samples = val ? val : LLONG_MAX;
+            } else {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+            j++;
+        }
+        if (ma.child_pid != -1) {
+            addReplyError(c,"A memory analysis is already in progress");
+            return;
+        }
+        if (memAnalyzeStart(&opt) == C_ERR) {
+            addReplyError(c,"Can't fork the memory analysis child");
+            return;
+        }
+        addReplyStatus(c,"Background memory analysis started");
+    } else if (!strcasecmp(sub,"result") && c->argc == 3) {
+        memAnalyzeReplyResult(c);
+    } else if (!strcasecmp(sub,"abort") && c->argc == 3) {
+        if (ma.child_pid == -1) {
+            addReplyError(c,"No memory analysis in progress");
+            return;
+        }
+        ma.abort = 1;
+        kill(ma.child_pid,SIGUSR1);
+        addReply(c,shared.ok);
+    } else {
+        addReplySubcommandSyntaxError(c);
+    }
+}
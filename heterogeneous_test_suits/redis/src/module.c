@@ -29,6 +29,7 @@
 
 #include "server.h"
 #include "cluster.h"
+#include "bio.h"
 #include <dlfcn.h>
 
 #define REDISMODULE_CORE 1
@@ -51,6 +52,7 @@ struct RedisModule {
     list *using;    /* List of modules we use some APIs of. */
     list *filters;  /* List of filters the module has registered. */
     int in_call;    /* RM_Call() nesting level */
+    int jobs;       /* Worker pool jobs submitted and not completed. */
 };
 typedef struct RedisModule RedisModule;
 
@@ -160,6 +162,7 @@ struct RedisModuleKey {
     uint32_t zstart;        /* Start pos for positional ranges. */
     uint32_t zend;          /* End pos for positional ranges. */
     void *zcurrent;         /* Zset iterator current node. */
+    zbtreeIter zbtcur;      /* B+tree position zcurrent points to. */
     int zer;                /* Zset iterator end reached flag
                                (true if end was reached). */
 };
@@ -291,6 +294,38 @@ typedef struct RedisModuleCommandFilter {
 /* Registered filters */
 static list *moduleCommandFilters;
 
+/* A job submitted to the worker pool with RM_SubmitJob(). */
+typedef void (*RedisModuleJobFunc) (RedisModuleCtx *ctx, RedisModuleKey **keys, int numkeys, void *privdata);
+
+typedef struct RedisModuleJob {
+    RedisModule *module;
+    RedisModuleBlockedClient *bc;   /* Client waiting for the job. */
+    RedisModuleCtx *ctx;            /* Thread safe context bound to 'bc'. */
+    RedisModuleJobFunc work;        /* Called in a worker thread. */
+    void *privdata;                 /* Passed to 'work' and to the reply
+                                       callback. */
+    int dbid;
+    int mode;                       /* REDISMODULE_READ and/or WRITE. */
+    int numkeys;
+    robj **keynames;                /* Keys locked by the job. */
+    RedisModuleKey **keys;          /* Opened when the job is started. */
+} RedisModuleJob;
+
+/* Jobs started and not yet picked by a worker, and jobs that the workers
+ * completed, protected by moduleJobsMutex. */
+static pthread_mutex_t moduleJobsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t moduleJobsCond = PTHREAD_COND_INITIALIZER;
+static list *moduleJobsQueued;
+static list *moduleJobsDone;
+static int moduleWorkersStarted = 0;
+
+/* The following are only accessed by the main thread: the jobs waiting for
+ * keys locked by other jobs, the clients waiting to run a command touching
+ * locked keys, and the locked keys (db id followed by the key name). */
+static list *moduleJobsWaiting;
+static list *moduleKeyLockWaiters;
+static rax *moduleKeyLocks;
+
 /* --------------------------------------------------------------------------
  * Prototypes
  * -------------------------------------------------------------------------- */
@@ -303,6 +338,7 @@ void moduleReplicateMultiIfNeeded(RedisModuleCtx *ctx);
 void RM_ZsetRangeStop(RedisModuleKey *kp);
 static void zsetKeyReset(RedisModuleKey *key);
 void RM_FreeDict(RedisModuleCtx *ctx, RedisModuleDict *d);
+static void moduleHandleCompletedJobs(void);
 
 /* --------------------------------------------------------------------------
  * Heap allocation raw functions
@@ -754,6 +790,7 @@ void RM_SetModuleAttribs(RedisModuleCtx *ctx, const char *name, int ver, int api
     module->using = listCreate();
     module->filters = listCreate();
     module->in_call = 0;
+    module->jobs = 0;
     ctx->module = module;
 }
 
@@ -1989,6 +2026,11 @@ int zsetInitScoreRange(RedisModuleKey *key, double min, double max, int minex, i
         zskiplist *zsl = zs->zsl;
         key->zcurrent = first ? zslFirstInRange(zsl,zrs) :
                                 zslLastInRange(zsl,zrs);
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtree *zbt = ((zset*)key->value->ptr)->zbt;
+        int found = first ? zbtFirstInRange(zbt,zrs,&key->zbtcur) :
+                            zbtLastInRange(zbt,zrs,&key->zbtcur);
+        key->zcurrent = found ? &key->zbtcur : NULL;
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2053,6 +2095,11 @@ int zsetInitLexRange(RedisModuleKey *key, RedisModuleString *min, RedisModuleStr
         zskiplist *zsl = zs->zsl;
         key->zcurrent = first ? zslFirstInLexRange(zsl,zlrs) :
                                 zslLastInLexRange(zsl,zlrs);
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtree *zbt = ((zset*)key->value->ptr)->zbt;
+        int found = first ? zbtFirstInLexRange(zbt,zlrs,&key->zbtcur) :
+                            zbtLastInLexRange(zbt,zlrs,&key->zbtcur);
+        key->zcurrent = found ? &key->zbtcur : NULL;
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2103,6 +2150,11 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
         zskiplistNode *ln = key->zcurrent;
         if (score) *score = ln->score;
         str = createStringObject(ln->ele,sdslen(ln->ele));
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtreeIter *it = key->zcurrent;
+        sds ele = zbtIterEle(it);
+        if (score) *score = zbtIterScore(it);
+        str = createStringObject(ele,sdslen(ele));
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2168,6 +2220,27 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
             key->zcurrent = next;
             return 1;
         }
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtreeIter next = key->zbtcur;
+        if (!zbtNext(&next)) {
+            key->zer = 1;
+            return 0;
+        } else {
+            /* Are we still within the range? */
+            if (key->ztype == REDISMODULE_ZSET_RANGE_SCORE &&
+                !zslValueLteMax(zbtIterScore(&next),&key->zrs))
+            {
+                key->zer = 1;
+                return 0;
+            } else if (key->ztype == REDISMODULE_ZSET_RANGE_LEX) {
+                if (!zslLexValueLteMax(zbtIterEle(&next),&key->zlrs)) {
+                    key->zer = 1;
+                    return 0;
+                }
+            }
+            key->zbtcur = next;
+            return 1;
+        }
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2231,6 +2304,27 @@ int RM_ZsetRangePrev(RedisModuleKey *key) {
             key->zcurrent = prev;
             return 1;
         }
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtreeIter prev = key->zbtcur;
+        if (!zbtPrev(&prev)) {
+            key->zer = 1;
+            return 0;
+        } else {
+            /* Are we still within the range? */
+            if (key->ztype == REDISMODULE_ZSET_RANGE_SCORE &&
+                !zslValueGteMin(zbtIterScore(&prev),&key->zrs))
+            {
+                key->zer = 1;
+                return 0;
+            } else if (key->ztype == REDISMODULE_ZSET_RANGE_LEX) {
+                if (!zslLexValueGteMin(zbtIterEle(&prev),&key->zlrs)) {
+                    key->zer = 1;
+                    return 0;
+                }
+            }
+            key->zbtcur = prev;
+            return 1;
+        }
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2817,11 +2911,11 @@ RedisModuleCallReply *RM_Call(RedisModuleCtx *ctx, const char *cmdname, const ch
      * The first thing we need is to create a single string from the client
      * output buffers. */
     sds proto = sdsnewlen(c->buf,c->bufpos);
-    c->bufpos = 0;
+    releaseClientReplyBuffer(c);
     while(listLength(c->reply)) {
         clientReplyBlock *o = listNodeValue(listFirst(c->reply));
 
-        proto = sdscatlen(proto,o->buf,o->used);
+        proto = sdscatlen(proto,replyBlockData(o),o->used);
         listDelNode(c->reply,listFirst(c->reply));
     }
     reply = moduleCreateCallReplyFromProto(ctx,proto);
@@ -3702,6 +3796,9 @@ void moduleHandleBlockedClients(void) {
     listNode *ln;
     RedisModuleBlockedClient *bc;
 
+    /* Completed worker pool jobs unblock their clients first. */
+    moduleHandleCompletedJobs();
+
     pthread_mutex_lock(&moduleUnblockedClientsMutex);
     /* Here we unblock all the pending clients blocked in modules operations
      * so we can read every pending "awake byte" in the pipe. */
@@ -3901,6 +3998,339 @@ void moduleReleaseGIL(void) {
     pthread_mutex_unlock(&moduleGIL);
 }
 
+/* --------------------------------------------------------------------------
+ * Worker pool
+ *
+ * Modules with compute heavy commands can run them in the worker threads
+ * of Redis instead of handling their own threads: RM_SubmitJob() blocks
+ * the client, locks the keys the job declares, and runs the job in a worker
+ * without the server lock. The keys stay locked until the job completes,
+ * so the job can access their values while the main thread keeps serving
+ * the other keys: the commands that touch a locked key wait for the job.
+ * -------------------------------------------------------------------------- */
+
+/* Return the name under which 'key' of the db 'dbid' is locked. */
+static sds moduleKeyLockName(int dbid, robj *key) {
+    sds name = sdsnewlen(&dbid,sizeof(dbid));
+    char buf[LONG_STR_SIZE];
+
+    if (sdsEncodedObject(key)) return sdscatsds(name,key->ptr);
+    return sdscatlen(name,buf,ll2string(buf,sizeof(buf),(long)key->ptr));
+}
+
+/* Return the job holding the lock 'name', or NULL. The name is freed. */
+static RedisModuleJob *moduleKeyLockFind(sds name) {
+    RedisModuleJob *job;
+
+    job = raxFind(moduleKeyLocks,(unsigned char*)name,sdslen(name));
+    sdsfree(name);
+    return job == raxNotFound ? NULL : job;
+}
+
+/* Return the job holding the lock of 'key' of the db 'dbid', or NULL. */
+static RedisModuleJob *moduleKeyLockOwner(int dbid, robj *key) {
+    if (raxSize(moduleKeyLocks) == 0) return NULL;
+    return moduleKeyLockFind(moduleKeyLockName(dbid,key));
+}
+
+/* Return 1 if 'key' of the db 'dbid' is locked by a job. */
+int moduleKeyIsLocked(int dbid, sds key) {
+    if (raxSize(moduleKeyLocks) == 0) return 0;
+    return moduleKeyLockFind(sdscatsds(sdsnewlen(&dbid,sizeof(dbid)),key))
+           != NULL;
+}
+
+/* Return 1 if one of the keys of the job is locked by another job. */
+static int moduleJobKeysLocked(RedisModuleJob *job) {
+    int j;
+
+    for (j = 0; j < job->numkeys; j++)
+        if (moduleKeyLockOwner(job->dbid,job->keynames[j])) return 1;
+    return 0;
+}
+
+static void *moduleWorkerMain(void *arg) {
+    RedisModuleJob *job;
+    sigset_t sigset;
+    char arena[16];
+
+    snprintf(arena,sizeof(arena),"module%ld",(long)arg);
+    serverThreadArenaInit(arena);
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in module worker thread: %s",
+            strerror(errno));
+
+    pthread_mutex_lock(&moduleJobsMutex);
+    while(1) {
+        if (listLength(moduleJobsQueued) == 0) {
+            pthread_cond_wait(&moduleJobsCond,&moduleJobsMutex);
+            continue;
+        }
+        job = listNodeValue(listFirst(moduleJobsQueued));
+        listDelNode(moduleJobsQueued,listFirst(moduleJobsQueued));
+        pthread_mutex_unlock(&moduleJobsMutex);
+
+        job->work(job->ctx,job->keys,job->numkeys,job->privdata);
+
+        /* Hand the job back to the main thread, that is awaken using the
+         * same pipe of the blocked clients. */
+        pthread_mutex_lock(&moduleJobsMutex);
+        listAddNodeTail(moduleJobsDone,job);
+        if (write(server.module_blocked_pipe[1],"J",1) != 1) {
+            /* Ignore the error, this is best-effort. */
+        }
+    }
+    return NULL;
+}
+
+/* Spawn the worker threads, the first time a job is submitted. */
+static void moduleStartWorkers(void) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    size_t stacksize;
+    int j;
+
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr,&stacksize);
+    if (!stacksize) stacksize = 1;
+    while (stacksize < REDIS_THREAD_STACK_SIZE) stacksize *= 2;
+    pthread_attr_setstacksize(&attr, stacksize);
+
+    for (j = 0; j < server.module_worker_threads; j++) {
+        if (pthread_create(&thread,&attr,moduleWorkerMain,(void*)(long)j) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize module workers.");
+            exit(1);
+        }
+    }
+    moduleWorkersStarted = 1;
+}
+
+/* Lock and open the keys of the job, and queue it for the workers. */
+static void moduleStartJob(RedisModuleJob *job) {
+    redisDb *db = server.db+job->dbid;
+    int j;
+
+    job->keys = zcalloc(sizeof(RedisModuleKey*)*(job->numkeys ? job->numkeys : 1));
+    for (j = 0; j < job->numkeys; j++) {
+        sds name = moduleKeyLockName(job->dbid,job->keynames[j]);
+        raxInsert(moduleKeyLocks,(unsigned char*)name,sdslen(name),job,NULL);
+        sdsfree(name);
+
+        /* A BGSAVE without fork must save the key before it changes. */
+        if (job->mode & REDISMODULE_WRITE)
+            rdbForklessWillModify(db,job->keynames[j]);
+
+        /* The value is referenced so that it survives the key being
+         * deleted by an expire or an eviction while the job runs. */
+        job->keys[j] = RM_OpenKey(job->ctx,job->keynames[j],job->mode);
+        if (job->keys[j] && job->keys[j]->value)
+            incrRefCount(job->keys[j]->value);
+    }
+
+    if (!moduleWorkersStarted) moduleStartWorkers();
+    pthread_mutex_lock(&moduleJobsMutex);
+    listAddNodeTail(moduleJobsQueued,job);
+    pthread_cond_signal(&moduleJobsCond);
+    pthread_mutex_unlock(&moduleJobsMutex);
+}
+
+/* Run in a worker thread the function 'work', after locking the 'numkeys'
+ * keys in 'keys', then reply to the client from the main thread. This
+ * function must be called from a command implementation, and blocks its
+ * client like RedisModule_BlockClient() does:
+ *
+ *     work:            called in a worker thread as
+ *                      work(ctx,keyhandles,numkeys,privdata). The keys are
+ *                      opened in 'mode' (REDISMODULE_READ and/or WRITE)
+ *                      before the job starts: with REDISMODULE_READ the
+ *                      handle of a missing key is NULL. 'ctx' is a thread
+ *                      safe context bound to the blocked client, so the
+ *                      RedisModule_Reply* functions can be used in order
+ *                      to accumulate the reply.
+ *
+ *     reply_callback:  optional, called in the main thread once the job
+ *                      completed. RedisModule_GetBlockedClientPrivateData()
+ *                      returns 'privdata'.
+ *
+ *     free_privdata:   optional, called in the main thread to free
+ *                      'privdata'.
+ *
+ * The job only waits for the jobs that locked some of the same keys, and
+ * while it runs the commands touching its keys wait for it to complete.
+ * Commands that do not declare their keys and may write (FLUSHALL) or are
+ * administrative (DEBUG, SAVE) wait for all the jobs with keys.
+ *
+ * The job must only access the values of its keys: it must not create or
+ * delete keys, call RedisModule_Call(), or use keys it did not declare
+ * without RedisModule_ThreadSafeContextLock(). Keys can be created, and
+ * changes propagated with RedisModule_Replicate(), in the reply callback.
+ *
+ * The function returns REDISMODULE_ERR, after replying with an error, if
+ * the command was called from Lua or MULTI, where clients can't block. */
+int RM_SubmitJob(RedisModuleCtx *ctx, RedisModuleString **keys, int numkeys, int mode, RedisModuleJobFunc work, RedisModuleCmdFunc reply_callback, void (*free_privdata)(RedisModuleCtx*,void*), void *privdata) {
+    RedisModuleBlockedClient *bc;
+    RedisModuleJob *job;
+    int j;
+
+    if (ctx->client == NULL || ctx->flags & REDISMODULE_CTX_THREAD_SAFE)
+        return REDISMODULE_ERR;
+    bc = RM_BlockClient(ctx,reply_callback,NULL,free_privdata,0);
+    if (bc->client == NULL) {
+        /* Called from Lua or MULTI: the client already got an error. */
+        RM_UnblockClient(bc,privdata);
+        return REDISMODULE_ERR;
+    }
+
+    job = zmalloc(sizeof(*job));
+    job->module = ctx->module;
+    job->bc = bc;
+    job->ctx = RM_GetThreadSafeContext(bc);
+    job->work = work;
+    job->privdata = privdata;
+    job->dbid = ctx->client->db->id;
+    job->mode = mode;
+    job->numkeys = numkeys;
+    job->keynames = zmalloc(sizeof(robj*)*(numkeys ? numkeys : 1));
+    for (j = 0; j < numkeys; j++) {
+        job->keynames[j] = keys[j];
+        incrRefCount(keys[j]);
+    }
+    job->keys = NULL;
+    job->module->jobs++;
+
+    if (moduleJobKeysLocked(job))
+        listAddNodeTail(moduleJobsWaiting,job);
+    else
+        moduleStartJob(job);
+    return REDISMODULE_OK;
+}
+
+/* Complete the jobs run by the workers: unlock their keys, and unblock
+ * their clients, whose reply callbacks are then called by
+ * moduleHandleBlockedClients(). Then start the jobs and run the commands
+ * that were waiting for the released keys. */
+static void moduleHandleCompletedJobs(void) {
+    list *done;
+    listIter li;
+    listNode *ln;
+    int j;
+
+    pthread_mutex_lock(&moduleJobsMutex);
+    if (listLength(moduleJobsDone) == 0) {
+        pthread_mutex_unlock(&moduleJobsMutex);
+        return;
+    }
+    done = moduleJobsDone;
+    moduleJobsDone = listCreate();
+    pthread_mutex_unlock(&moduleJobsMutex);
+
+    while (listLength(done)) {
+        RedisModuleJob *job = listNodeValue(listFirst(done));
+        listDelNode(done,listFirst(done));
+
+        for (j = 0; j < job->numkeys; j++) {
+            sds name = moduleKeyLockName(job->dbid,job->keynames[j]);
+            raxRemove(moduleKeyLocks,(unsigned char*)name,sdslen(name),NULL);
+            sdsfree(name);
+            if (job->keys[j]) {
+                robj *value = job->keys[j]->value;
+                RM_CloseKey(job->keys[j]);
+                if (value) decrRefCount(value);
+            }
+            decrRefCount(job->keynames[j]);
+        }
+        job->module->jobs--;
+        RM_FreeThreadSafeContext(job->ctx);
+        RM_UnblockClient(job->bc,job->privdata);
+        zfree(job->keys);
+        zfree(job->keynames);
+        zfree(job);
+    }
+    listRelease(done);
+
+    /* Start the jobs no longer waiting for locked keys, in order. */
+    listRewind(moduleJobsWaiting,&li);
+    while ((ln = listNext(&li))) {
+        RedisModuleJob *job = listNodeValue(ln);
+        if (moduleJobKeysLocked(job)) continue;
+        listDelNode(moduleJobsWaiting,ln);
+        moduleStartJob(job);
+    }
+
+    /* Let the waiting clients try again: the ones whose keys are still
+     * locked will wait again. */
+    while (listLength(moduleKeyLockWaiters)) {
+        client *c = listNodeValue(listFirst(moduleKeyLockWaiters));
+        listDelNode(moduleKeyLockWaiters,listFirst(moduleKeyLockWaiters));
+        unblockClient(c);
+    }
+}
+
+/* Return 1 if the command 'cmd' must wait for the jobs holding key locks
+ * in the db 'dbid'. */
+static int moduleCommandNeedsKeyLocks(int dbid, struct redisCommand *cmd,
+                                      robj **argv, int argc)
+{
+    int *keys, numkeys, j, locked = 0;
+
+    if (cmd->getkeys_proc == NULL && cmd->firstkey == 0)
+        return (cmd->flags & (CMD_WRITE|CMD_ADMIN)) != 0;
+    keys = getKeysFromCommand(cmd,argv,argc,&numkeys);
+    for (j = 0; j < numkeys && !locked; j++)
+        if (moduleKeyLockOwner(dbid,argv[keys[j]])) locked = 1;
+    getKeysFreeResult(keys);
+    return locked;
+}
+
+/* Called by processCommand() before running the command of 'c': if the
+ * command touches keys locked by a worker pool job, block the client until
+ * the keys are released and return 1, otherwise return 0. */
+int moduleWaitForKeyLocks(client *c) {
+    int locked = 0, j;
+
+    if (raxSize(moduleKeyLocks) == 0) return 0;
+    if (c->cmd->proc == execCommand && c->flags & CLIENT_MULTI) {
+        for (j = 0; j < c->mstate.count && !locked; j++) {
+            multiCmd *mc = c->mstate.commands+j;
+            locked = moduleCommandNeedsKeyLocks(c->db->id,mc->cmd,
+                                                mc->argv,mc->argc);
+        }
+    } else {
+        locked = moduleCommandNeedsKeyLocks(c->db->id,c->cmd,
+                                            c->argv,c->argc);
+    }
+    if (!locked) return 0;
+
+    /* The command is run again once unblocked, without filtering it a
+     * second time. */
+    c->flags |= CLIENT_PENDING_COMMAND;
+    c->bpop.keylock_filtered = 1;
+    c->bpop.timeout = 0;
+    blockClient(c,BLOCKED_KEYLOCK);
+    listAddNodeTail(moduleKeyLockWaiters,c);
+    return 1;
+}
+
+/* Called by unblockClient() for clients waiting for key locks. When the
+ * client is still in the waiting list it was not unblocked because the
+ * keys were released, but because it was freed or unblocked with CLIENT
+ * UNBLOCK: its command is dropped. */
+void unblockClientWaitingKeyLocks(client *c) {
+    listNode *ln = listSearchKey(moduleKeyLockWaiters,c);
+
+    if (ln == NULL) return;
+    listDelNode(moduleKeyLockWaiters,ln);
+    c->flags &= ~CLIENT_PENDING_COMMAND;
+    c->bpop.keylock_filtered = 0;
+    resetClient(c);
+}
+
 
 /* --------------------------------------------------------------------------
  * Module Keyspace Notifications API
@@ -4914,6 +5344,11 @@ int RM_UnregisterCommandFilter(RedisModuleCtx *ctx, RedisModuleCommandFilter *fi
     return REDISMODULE_OK;
 }
 
+/* Return 1 if some module registered a command filter. */
+int moduleHasCommandFilters(void) {
+    return listLength(moduleCommandFilters) != 0;
+}
+
 void moduleCallCommandFilters(client *c) {
     if (listLength(moduleCommandFilters) == 0) return;
 
@@ -5063,6 +5498,13 @@ void moduleInitModulesSystem(void) {
     /* Set up filter list */
     moduleCommandFilters = listCreate();
 
+    /* Set up the worker pool queues. The threads are started lazily. */
+    moduleJobsQueued = listCreate();
+    moduleJobsDone = listCreate();
+    moduleJobsWaiting = listCreate();
+    moduleKeyLockWaiters = listCreate();
+    moduleKeyLocks = raxNew();
+
     moduleRegisterCoreAPI();
     if (pipe(server.module_blocked_pipe) == -1) {
         serverLog(LL_WARNING,
@@ -5186,7 +5628,8 @@ int moduleLoad(const char *path, void **module_argv, int module_argc) {
  * to the following values depending on the type of error:
  *
  * * ENONET: No such module having the specified name.
- * * EBUSY: The module exports a new data type and can only be reloaded. */
+ * * EBUSY: The module exports a new data type and can only be reloaded.
+ * * EAGAIN: The module has worker pool jobs in progress. */
 int moduleUnload(sds name) {
     struct RedisModule *module = dictFetchValue(modules,name);
 
@@ -5199,6 +5642,9 @@ int moduleUnload(sds name) {
     } else if (listLength(module->usedby)) {
         errno = EPERM;
         return REDISMODULE_ERR;
+    } else if (module->jobs) {
+        errno = EAGAIN;
+        return REDISMODULE_ERR;
     }
 
     moduleUnregisterCommands(module);
@@ -5292,6 +5738,9 @@ NULL
                 errmsg = "the module exports APIs used by other modules. "
                          "Please unload them first and try again";
                 break;
+            case EAGAIN:
+                errmsg = "the module has jobs in progress, try again later";
+                break;
             default:
                 errmsg = "operation not possible.";
                 break;
@@ -5425,6 +5874,7 @@ void moduleRegisterCoreAPI(void) {
     REGISTER_API(FreeThreadSafeContext);
     REGISTER_API(ThreadSafeContextLock);
     REGISTER_API(ThreadSafeContextUnlock);
+    REGISTER_API(SubmitJob);
     REGISTER_API(DigestAddStringBuffer);
     REGISTER_API(DigestAddLongLong);
     REGISTER_API(DigestEndSequence);
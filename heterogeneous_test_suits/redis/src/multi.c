@@ -35,11 +35,12 @@
 void initClientMultiState(client *c) {
     c->mstate.commands = NULL;
     c->mstate.count = 0;
+    c->mstate.alloc = 0;
     c->mstate.cmd_flags = 0;
 }
 
-/* Release all the resources associated with MULTI/EXEC state */
-void freeClientMultiState(client *c) {
+/* Release the queued commands, keeping the array that holds them. */
+static void releaseMultiCommands(client *c) {
     int j;
 
     for (j = 0; j < c->mstate.count; j++) {
@@ -50,30 +51,47 @@ void freeClientMultiState(client *c) {
             decrRefCount(mc->argv[i]);
         zfree(mc->argv);
     }
+    c->mstate.count = 0;
+    c->mstate.cmd_flags = 0;
+}
+
+/* Release all the resources associated with MULTI/EXEC state */
+void freeClientMultiState(client *c) {
+    releaseMultiCommands(c);
     zfree(c->mstate.commands);
+    c->mstate.commands = NULL;
+    c->mstate.alloc = 0;
 }
 
-/* Add a new command into the MULTI commands queue */
+/* Add a new command into the MULTI commands queue. The queue takes over
+ * the argv of the client, which gets a new one for its next command. */
 void queueMultiCommand(client *c) {
     multiCmd *mc;
-    int j;
 
-    c->mstate.commands = zrealloc(c->mstate.commands,
-            sizeof(multiCmd)*(c->mstate.count+1));
+    if (c->mstate.count == c->mstate.alloc) {
+        c->mstate.alloc = c->mstate.alloc ? c->mstate.alloc*2 :
+                                            MULTI_QUEUE_INITIAL;
+        c->mstate.commands = zrealloc(c->mstate.commands,
+                sizeof(multiCmd)*c->mstate.alloc);
+    }
     mc = c->mstate.commands+c->mstate.count;
     mc->cmd = c->cmd;
     mc->argc = c->argc;
-    mc->argv = zmalloc(sizeof(robj*)*c->argc);
-    memcpy(mc->argv,c->argv,sizeof(robj*)*c->argc);
-    for (j = 0; j < c->argc; j++)
-        incrRefCount(mc->argv[j]);
+    mc->slot = c->slot;
+    mc->argv = c->argv;
+    c->argv = NULL;
+    c->argc = 0;
     c->mstate.count++;
     c->mstate.cmd_flags |= c->cmd->flags;
 }
 
+/* End the transaction of the client. The queue array is kept for the next
+ * one unless a large transaction made it grow. */
 void discardTransaction(client *c) {
-    freeClientMultiState(c);
-    initClientMultiState(c);
+    if (c->mstate.alloc > MULTI_QUEUE_KEEP)
+        freeClientMultiState(c);
+    else
+        releaseMultiCommands(c);
     c->flags &= ~(CLIENT_MULTI|CLIENT_DIRTY_CAS|CLIENT_DIRTY_EXEC);
     unwatchAllKeys(c);
 }
@@ -125,6 +143,7 @@ void execCommand(client *c) {
         addReplyError(c,"EXEC without MULTI");
         return;
     }
+    if (watchedKeysTouched(c)) c->flags |= CLIENT_DIRTY_CAS;
 
     /* Check if we need to abort the EXEC because:
      * 1) Some WATCHed key was touched.
@@ -215,12 +234,20 @@ handle_monitor:
 
 /* ===================== WATCH (CAS alike for MULTI/EXEC) ===================
  *
- * The implementation uses a per-DB hash table mapping keys to list of clients
- * WATCHing those keys, so that given a key that is going to be modified
- * we can mark all the associated clients as dirty.
+ * The implementation uses a per-DB hash table mapping every WATCHed key to
+ * a version, bumped every time the key is modified, and the number of
+ * clients watching it. Every client keeps the list of the keys it WATCHed
+ * with the version they had then, and EXEC fails if one of them changed
+ * since: a write to a key costs the same however many clients watch it.
  *
- * Also every client contains a list of WATCHed keys so that's possible to
- * un-watch such keys when the client is freed or when UNWATCH is called. */
+ * The list of the client is also used to un-watch its keys when the client
+ * is freed or when UNWATCH is called. */
+
+/* Value of db->watched_keys. */
+typedef struct watchedKeyState {
+    unsigned long long version; /* Bumped by every change of the key. */
+    long watchers;              /* Clients watching the key. */
+} watchedKeyState;
 
 /* In the client->watched_keys list we need to use watchedKey structures
  * as in order to identify a key in Redis we need both the key name and the
@@ -228,11 +255,13 @@ handle_monitor:
 typedef struct watchedKey {
     robj *key;
     redisDb *db;
+    watchedKeyState *state;     /* Its entry in db->watched_keys. */
+    unsigned long long version; /* state->version when WATCHed. */
 } watchedKey;
 
 /* Watch for the specified key */
 void watchForKey(client *c, robj *key) {
-    list *clients = NULL;
+    watchedKeyState *state;
     listIter li;
     listNode *ln;
     watchedKey *wk;
@@ -245,17 +274,19 @@ void watchForKey(client *c, robj *key) {
             return; /* Key already watched */
     }
     /* This key is not already watched in this DB. Let's add it */
-    clients = dictFetchValue(c->db->watched_keys,key);
-    if (!clients) {
-        clients = listCreate();
-        dictAdd(c->db->watched_keys,key,clients);
+    state = dictFetchValue(c->db->watched_keys,key);
+    if (!state) {
+        state = zcalloc(sizeof(*state));
+        dictAdd(c->db->watched_keys,key,state);
         incrRefCount(key);
     }
-    listAddNodeTail(clients,c);
+    state->watchers++;
     /* Add the new key to the list of keys watched by this client */
     wk = zmalloc(sizeof(*wk));
     wk->key = key;
     wk->db = c->db;
+    wk->state = state;
+    wk->version = state->version;
     incrRefCount(key);
     listAddNodeTail(c->watched_keys,wk);
 }
@@ -269,17 +300,11 @@ void unwatchAllKeys(client *c) {
     if (listLength(c->watched_keys) == 0) return;
     listRewind(c->watched_keys,&li);
     while((ln = listNext(&li))) {
-        list *clients;
         watchedKey *wk;
 
-        /* Lookup the watched key -> clients list and remove the client
-         * from the list */
+        /* Kill the entry of the key if this was the only client */
         wk = listNodeValue(ln);
-        clients = dictFetchValue(wk->db->watched_keys, wk->key);
-        serverAssertWithInfo(c,NULL,clients != NULL);
-        listDelNode(clients,listSearchKey(clients,c));
-        /* Kill the entry at all if this was the only client */
-        if (listLength(clients) == 0)
+        if (--wk->state->watchers == 0)
             dictDelete(wk->db->watched_keys, wk->key);
         /* Remove this watched key from the client->watched list */
         listDelNode(c->watched_keys,ln);
@@ -288,25 +313,29 @@ void unwatchAllKeys(client *c) {
     }
 }
 
-/* "Touch" a key, so that if this key is being WATCHed by some client the
- * next EXEC will fail. */
-void touchWatchedKey(redisDb *db, robj *key) {
-    list *clients;
+/* Was one of the keys WATCHed by the client modified since? */
+int watchedKeysTouched(client *c) {
     listIter li;
     listNode *ln;
 
-    if (dictSize(db->watched_keys) == 0) return;
-    clients = dictFetchValue(db->watched_keys, key);
-    if (!clients) return;
-
-    /* Mark all the clients watching this key as CLIENT_DIRTY_CAS */
-    /* Check if we are already watching for this key */
-    listRewind(clients,&li);
+    if (c->flags & CLIENT_DIRTY_CAS) return 1;
+    listRewind(c->watched_keys,&li);
     while((ln = listNext(&li))) {
-        client *c = listNodeValue(ln);
+        watchedKey *wk = listNodeValue(ln);
 
-        c->flags |= CLIENT_DIRTY_CAS;
+        if (wk->version != wk->state->version) return 1;
     }
+    return 0;
+}
+
+/* "Touch" a key, so that if this key is being WATCHed by some client the
+ * next EXEC will fail. */
+void touchWatchedKey(redisDb *db, robj *key) {
+    watchedKeyState *state;
+
+    if (dictSize(db->watched_keys) == 0) return;
+    state = dictFetchValue(db->watched_keys, key);
+    if (state) state->version++;
 }
 
 /* On FLUSHDB or FLUSHALL all the watched keys that are present before the
@@ -314,25 +343,23 @@ void touchWatchedKey(redisDb *db, robj *key) {
  * be touched. "dbid" is the DB that's getting the flush. -1 if it is
  * a FLUSHALL operation (all the DBs flushed). */
 void touchWatchedKeysOnFlush(int dbid) {
-    listIter li1, li2;
-    listNode *ln;
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+        dictIterator *di;
+        dictEntry *de;
+
+        if (dbid != -1 && db->id != dbid) continue;
+        if (dictSize(db->watched_keys) == 0) continue;
+        di = dictGetIterator(db->watched_keys);
+        while((de = dictNext(di)) != NULL) {
+            robj *key = dictGetKey(de);
+            watchedKeyState *state = dictGetVal(de);
 
-    /* For every client, check all the waited keys */
-    listRewind(server.clients,&li1);
-    while((ln = listNext(&li1))) {
-        client *c = listNodeValue(ln);
-        listRewind(c->watched_keys,&li2);
-        while((ln = listNext(&li2))) {
-            watchedKey *wk = listNodeValue(ln);
-
-            /* For every watched key matching the specified DB, if the
-             * key exists, mark the client as dirty, as the key will be
-             * removed. */
-            if (dbid == -1 || wk->db->id == dbid) {
-                if (dictFind(wk->db->dict, wk->key->ptr) != NULL)
-                    c->flags |= CLIENT_DIRTY_CAS;
-            }
+            if (dictFind(db->dict, key->ptr) != NULL) state->version++;
         }
+        dictReleaseIterator(di);
     }
 }
 
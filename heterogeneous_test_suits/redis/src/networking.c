@@ -29,6 +29,10 @@
 
 #include "server.h"
 #include "atomicvar.h"
+#include "uring.h"
+#include "slowlog.h"
+#include "cluster.h"
+#include "fpconv_dtoa.h"
 #include <sys/socket.h>
 #include <sys/uio.h>
 #include <math.h>
@@ -36,6 +40,7 @@
 
 static void setProtocolError(const char *errstr, client *c);
 int postponeClientRead(client *c);
+static int ioThreadRunCommand(client *c);
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -56,16 +61,127 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
     }
 }
 
+/* Idle clients don't keep I/O buffers: the query buffer and the reply
+ * buffer are borrowed from these pools while the client has data in
+ * flight, and given back once drained, so that the memory used scales with
+ * the active clients rather than with the connected ones. The I/O threads
+ * read and write clients too, so every thread has its own pools. Buffers
+ * given back to a full pool are freed. */
+#define CLIENT_BUF_POOL_SIZE 64
+
+typedef struct clientBufPool {
+    int len;
+    void *bufs[CLIENT_BUF_POOL_SIZE];
+} clientBufPool;
+
+static __thread clientBufPool replyBufPool, queryBufPool;
+
+/* The blocks of the reply lists are pooled the same way: the chunks the
+ * replies that don't fit the reply buffer are copied to, and the header only
+ * blocks that reference an object (see _addReplyObjectToList(): a message
+ * published to many subscribers costs each of them one of these, not a
+ * copy). The blocks are given back by freeClientReplyValue(), in the thread
+ * that sent them. Any block of the allocation size of a chunk is one, see
+ * reply_chunk_size, including the replies a bit longer than a chunk. */
+#define REPLY_OBJ_POOL_SIZE 1024
+
+typedef struct replyObjPool {
+    int len;
+    clientReplyBlock *blocks[REPLY_OBJ_POOL_SIZE];
+} replyObjPool;
+
+static __thread clientBufPool replyChunkPool;
+static __thread replyObjPool replyObjBlockPool;
+
+/* Usable size of a chunk, the same in every thread, set by the first. */
+static size_t reply_chunk_size = 0;
+
+static clientReplyBlock *replyChunkGet(void) {
+    clientReplyBlock *block;
+
+    if (replyChunkPool.len) return replyChunkPool.bufs[--replyChunkPool.len];
+    block = zmalloc(PROTO_REPLY_CHUNK_BYTES + sizeof(clientReplyBlock));
+    /* take over the allocation's internal fragmentation */
+    block->size = zmalloc_usable(block) - sizeof(clientReplyBlock);
+    reply_chunk_size = block->size;
+    return block;
+}
+
+static clientReplyBlock *replyObjBlockGet(void) {
+    if (replyObjBlockPool.len)
+        return replyObjBlockPool.blocks[--replyObjBlockPool.len];
+    return zmalloc(sizeof(clientReplyBlock));
+}
+
 /* Client.reply list dup and free methods. */
 void *dupClientReplyValue(void *o) {
     clientReplyBlock *old = o;
-    clientReplyBlock *buf = zmalloc(sizeof(clientReplyBlock) + old->size);
+    clientReplyBlock *buf;
+
+    if (old->obj) {
+        buf = replyObjBlockGet();
+        memcpy(buf, o, sizeof(clientReplyBlock));
+        incrRefCount(buf->obj);
+        return buf;
+    }
+    buf = zmalloc(sizeof(clientReplyBlock) + old->size);
     memcpy(buf, o, sizeof(clientReplyBlock) + old->size);
     return buf;
 }
 
 void freeClientReplyValue(void *o) {
-    zfree(o);
+    clientReplyBlock *block = o;
+
+    if (block == NULL) return;
+    if (block->obj) {
+        decrRefCount(block->obj);
+        if (replyObjBlockPool.len < REPLY_OBJ_POOL_SIZE) {
+            replyObjBlockPool.blocks[replyObjBlockPool.len++] = block;
+            return;
+        }
+    } else if (block->size == reply_chunk_size &&
+               replyChunkPool.len < CLIENT_BUF_POOL_SIZE)
+    {
+        replyChunkPool.bufs[replyChunkPool.len++] = block;
+        return;
+    }
+    zfree(block);
+}
+
+static char *replyBufferGet(void) {
+    if (replyBufPool.len) return replyBufPool.bufs[--replyBufPool.len];
+    return zmalloc(PROTO_REPLY_CHUNK_BYTES);
+}
+
+/* Empty the reply buffer of the client and give it back to the pool. */
+void releaseClientReplyBuffer(client *c) {
+    c->bufpos = 0;
+    if (c->buf == NULL) return;
+    if (replyBufPool.len < CLIENT_BUF_POOL_SIZE)
+        replyBufPool.bufs[replyBufPool.len++] = c->buf;
+    else
+        zfree(c->buf);
+    c->buf = NULL;
+}
+
+/* Return an empty query buffer with room for PROTO_IOBUF_LEN bytes. */
+static sds queryBufferGet(void) {
+    if (queryBufPool.len) return queryBufPool.bufs[--queryBufPool.len];
+    return sdsMakeRoomFor(sdsempty(),PROTO_IOBUF_LEN);
+}
+
+/* Give back the query buffer of the client to the pool if it was consumed
+ * and the client is between two commands. Buffers grown for big arguments
+ * are freed instead. */
+void releaseClientQueryBuffer(client *c) {
+    size_t alloc = sdsalloc(c->querybuf);
+
+    if (sdslen(c->querybuf) || c->reqtype || alloc < PROTO_IOBUF_LEN) return;
+    if (alloc <= PROTO_IOBUF_LEN*2 && queryBufPool.len < CLIENT_BUF_POOL_SIZE)
+        queryBufPool.bufs[queryBufPool.len++] = c->querybuf;
+    else
+        sdsfree(c->querybuf);
+    c->querybuf = sdsempty();
 }
 
 int listMatchObjects(void *a, void *b) {
@@ -111,6 +227,7 @@ client *createClient(int fd) {
     c->resp = 2;
     c->fd = fd;
     c->name = NULL;
+    c->buf = NULL;
     c->bufpos = 0;
     c->qb_pos = 0;
     c->querybuf = sdsempty();
@@ -119,6 +236,8 @@ client *createClient(int fd) {
     c->reqtype = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->cmdq = NULL;
+    c->cmdq_pos = c->cmdq_len = c->cmdq_size = 0;
     c->cmd = c->lastcmd = NULL;
     c->user = DefaultUser;
     c->multibulklen = 0;
@@ -135,12 +254,18 @@ client *createClient(int fd) {
     c->read_reploff = 0;
     c->repl_ack_off = 0;
     c->repl_ack_time = 0;
+    c->repl_sync_start = 0;
+    c->repl_sync_time = 0;
+    c->repl_sync_bytes = 0;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
     c->slave_listening_port = 0;
     c->slave_ip[0] = '\0';
     c->slave_capa = SLAVE_CAPA_NONE;
     c->reply = listCreate();
     c->reply_bytes = 0;
     c->obuf_soft_limit_reached_time = 0;
+    c->read_paused = 0;
     listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
     c->btype = BLOCKED_NONE;
@@ -152,7 +277,11 @@ client *createClient(int fd) {
     c->bpop.xread_group_noack = 0;
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
+    c->bpop.keylock_filtered = 0;
     c->woff = 0;
+    c->shard_slot = -1;
+    c->slot = COMMAND_SLOT_UNKNOWN;
+    c->aof_fsync_id = 0;
     c->watched_keys = listCreate();
     c->pubsub_channels = dictCreate(&objectKeyPointerValueDictType,NULL);
     c->pubsub_patterns = listCreate();
@@ -174,9 +303,10 @@ client *createClient(int fd) {
  * buffers can hold, then we'll really install the handler. */
 void clientInstallWriteHandler(client *c) {
     /* Schedule the client to write the output buffers to the socket only
-     * if not already done and, for slaves, if the slave can actually receive
-     * writes at this stage. */
-    if (!(c->flags & CLIENT_PENDING_WRITE) &&
+     * if not already done, if the client is not waiting for an AOF fsync
+     * (see aofGroupCommitWait()) and, for slaves, if the slave can actually
+     * receive writes at this stage. */
+    if (!(c->flags & CLIENT_PENDING_WRITE) && c->aof_fsync_id == 0 &&
         (c->replstate == REPL_STATE_NONE ||
          (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
     {
@@ -215,8 +345,13 @@ void clientInstallWriteHandler(client *c) {
  * data should be appended to the output buffers. */
 int prepareClientToWrite(client *c) {
     /* If it's the Lua client we always return ok without installing any
-     * handler since there is no socket at all. */
-    if (c->flags & (CLIENT_LUA|CLIENT_MODULE)) return C_OK;
+     * handler since there is no socket at all. A reply that can't be
+     * recorded ends the recording of the direct reply to the script. */
+    if (c->flags & (CLIENT_LUA|CLIENT_MODULE)) {
+        if (c->flags & CLIENT_LUA && server.lua_direct_reply)
+            luaReplyFlush(c);
+        return C_OK;
+    }
 
     /* CLIENT REPLY OFF / SKIP handling: don't send replies. */
     if (c->flags & (CLIENT_REPLY_OFF|CLIENT_REPLY_SKIP)) return C_ERR;
@@ -229,8 +364,11 @@ int prepareClientToWrite(client *c) {
     if (c->fd <= 0) return C_ERR; /* Fake client for AOF loading. */
 
     /* Schedule the client to write the output buffers to the socket, unless
-     * it should already be setup to do so (it has already pending data). */
-    if (!clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+     * it should already be setup to do so (it has already pending data).
+     * An I/O thread running a command leaves it to the main thread, see
+     * handleClientsWithPendingReadsUsingThreads(). */
+    if (!clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_READ))
+        clientInstallWriteHandler(c);
 
     /* Authorize the caller to queue in the output buffer of this client. */
     return C_OK;
@@ -241,7 +379,7 @@ int prepareClientToWrite(client *c) {
  * -------------------------------------------------------------------------- */
 
 int _addReplyToBuffer(client *c, const char *s, size_t len) {
-    size_t available = sizeof(c->buf)-c->bufpos;
+    size_t available = PROTO_REPLY_CHUNK_BYTES-c->bufpos;
 
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return C_OK;
 
@@ -252,6 +390,7 @@ int _addReplyToBuffer(client *c, const char *s, size_t len) {
     /* Check that the buffer has enough space available for this string. */
     if (len > available) return C_ERR;
 
+    if (c->buf == NULL) c->buf = replyBufferGet();
     memcpy(c->buf+c->bufpos,s,len);
     c->bufpos+=len;
     return C_OK;
@@ -267,8 +406,8 @@ void _addReplyProtoToList(client *c, const char *s, size_t len) {
      * addDeferredMultiBulkLength() is used, it sets a dummy node to NULL just
      * fo fill it later, when the size of the bulk length is set. */
 
-    /* Append to tail string when possible. */
-    if (tail) {
+    /* Append to tail string when possible (not to an object block). */
+    if (tail && !tail->obj) {
         /* Copy the part we can fit into the tail, and leave the rest for a
          * new node */
         size_t avail = tail->size - tail->used;
@@ -281,11 +420,15 @@ void _addReplyProtoToList(client *c, const char *s, size_t len) {
     if (len) {
         /* Create a new node, make sure it is allocated to at
          * least PROTO_REPLY_CHUNK_BYTES */
-        size_t size = len < PROTO_REPLY_CHUNK_BYTES? PROTO_REPLY_CHUNK_BYTES: len;
-        tail = zmalloc(size + sizeof(clientReplyBlock));
-        /* take over the allocation's internal fragmentation */
-        tail->size = zmalloc_usable(tail) - sizeof(clientReplyBlock);
+        if (len <= PROTO_REPLY_CHUNK_BYTES) {
+            tail = replyChunkGet();
+        } else {
+            tail = zmalloc(len + sizeof(clientReplyBlock));
+            /* take over the allocation's internal fragmentation */
+            tail->size = zmalloc_usable(tail) - sizeof(clientReplyBlock);
+        }
         tail->used = len;
+        tail->obj = NULL;
         memcpy(tail->buf, s, len);
         listAddNodeTail(c->reply, tail);
         c->reply_bytes += tail->size;
@@ -293,6 +436,25 @@ void _addReplyProtoToList(client *c, const char *s, size_t len) {
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
+/* Queue the string object 'obj' itself, rather than a copy of its bytes, as
+ * the next reply block: writeToClient() sends it from the object's own sds.
+ * The block holds a reference, and the commands that modify a string in
+ * place make a copy first when it is shared (see dbUnshareStringValue()), so
+ * the bytes do not change before they are sent. */
+void _addReplyObjectToList(client *c, robj *obj) {
+    clientReplyBlock *block;
+
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+
+    block = replyObjBlockGet();
+    block->size = block->used = sdslen(obj->ptr);
+    block->obj = obj;
+    incrRefCount(obj);
+    listAddNodeTail(c->reply, block);
+    c->reply_bytes += block->size;
+    asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
 /* -----------------------------------------------------------------------------
  * Higher level functions to queue data on the client output buffer.
  * The following functions are the ones that commands implementations will call.
@@ -300,6 +462,21 @@ void _addReplyProtoToList(client *c, const char *s, size_t len) {
 
 /* Add the object 'obj' string representation to the client output buffer. */
 void addReply(client *c, robj *obj) {
+    if (c->flags & CLIENT_LUA && server.lua_direct_reply) {
+        if (obj == shared.czero || obj == shared.cone) {
+            luaReplyAddLongLong(obj == shared.cone);
+            return;
+        } else if (obj == shared.ok) {
+            luaReplyAddStatus("OK",2);
+            return;
+        } else if (obj == shared.null[2] || obj == shared.nullarray[2]) {
+            luaReplyAddNull();
+            return;
+        } else if (obj == shared.emptyarray) {
+            luaReplyAddArrayLen(0);
+            return;
+        }
+    }
     if (prepareClientToWrite(c) != C_OK) return;
 
     if (sdsEncodedObject(obj)) {
@@ -465,6 +642,7 @@ void setDeferredAggregateLen(client *c, void *node, long length, char prefix) {
         /* Take over the allocation's internal fragmentation */
         buf->size = zmalloc_usable(buf) - sizeof(clientReplyBlock);
         buf->used = lenstr_len;
+        buf->obj = NULL;
         memcpy(buf->buf, lenstr, lenstr_len);
         listNodeValue(ln) = buf;
         c->reply_bytes += buf->size;
@@ -510,17 +688,27 @@ void addReplyDouble(client *c, double d) {
                               d > 0 ? 6 : 7);
         }
     } else {
-        char dbuf[MAX_LONG_DOUBLE_CHARS+3],
-             sbuf[MAX_LONG_DOUBLE_CHARS+32];
-        int dlen, slen;
+        char dbuf[FPCONV_DTOA_MAX], sbuf[FPCONV_DTOA_MAX+8];
+        int dlen, slen = 0;
+
+        dlen = fpconv_dtoa(d,dbuf);
         if (c->resp == 2) {
-            dlen = snprintf(dbuf,sizeof(dbuf),"%.17g",d);
-            slen = snprintf(sbuf,sizeof(sbuf),"$%d\r\n%s\r\n",dlen,dbuf);
-            addReplyProto(c,sbuf,slen);
+            if (c->flags & CLIENT_LUA && server.lua_direct_reply) {
+                luaReplyAddBulk(dbuf,dlen);
+                return;
+            }
+            sbuf[slen++] = '$';
+            slen += ll2string(sbuf+slen,sizeof(sbuf)-slen,dlen);
+            sbuf[slen++] = '\r';
+            sbuf[slen++] = '\n';
         } else {
-            dlen = snprintf(dbuf,sizeof(dbuf),",%.17g\r\n",d);
-            addReplyProto(c,dbuf,dlen);
+            sbuf[slen++] = ',';
         }
+        memcpy(sbuf+slen,dbuf,dlen);
+        slen += dlen;
+        sbuf[slen++] = '\r';
+        sbuf[slen++] = '\n';
+        addReplyProto(c,sbuf,slen);
     }
 }
 
@@ -566,7 +754,9 @@ void addReplyLongLongWithPrefix(client *c, long long ll, char prefix) {
 }
 
 void addReplyLongLong(client *c, long long ll) {
-    if (ll == 0)
+    if (c->flags & CLIENT_LUA && server.lua_direct_reply)
+        luaReplyAddLongLong(ll);
+    else if (ll == 0)
         addReply(c,shared.czero);
     else if (ll == 1)
         addReply(c,shared.cone);
@@ -575,7 +765,9 @@ void addReplyLongLong(client *c, long long ll) {
 }
 
 void addReplyAggregateLen(client *c, long length, int prefix) {
-    if (prefix == '*' && length < OBJ_SHARED_BULKHDR_LEN)
+    if (prefix == '*' && c->flags & CLIENT_LUA && server.lua_direct_reply)
+        luaReplyAddArrayLen(length);
+    else if (prefix == '*' && length < OBJ_SHARED_BULKHDR_LEN)
         addReply(c,shared.mbulkhdr[length]);
     else
         addReplyLongLongWithPrefix(c,length,prefix);
@@ -608,7 +800,9 @@ void addReplyPushLen(client *c, long length) {
 }
 
 void addReplyNull(client *c) {
-    if (c->resp == 2) {
+    if (c->flags & CLIENT_LUA && server.lua_direct_reply) {
+        luaReplyAddNull();
+    } else if (c->resp == 2) {
         addReplyProto(c,"$-1\r\n",5);
     } else {
         addReplyProto(c,"_\r\n",3);
@@ -628,13 +822,26 @@ void addReplyBool(client *c, int b) {
  * RESP2 protocol, however for RESP3 the reply will always be just the
  * Null type "_\r\n". */
 void addReplyNullArray(client *c) {
-    if (c->resp == 2) {
+    if (c->flags & CLIENT_LUA && server.lua_direct_reply) {
+        luaReplyAddNull();
+    } else if (c->resp == 2) {
         addReplyProto(c,"*-1\r\n",5);
     } else {
         addReplyProto(c,"_\r\n",3);
     }
 }
 
+/* Add the protocol already encoded in the string object 'obj'. Large objects
+ * are referenced rather than copied, like the bulks of addReplyBulk(), so
+ * the same reply can be queued to many clients for the cost of one. */
+void addReplyProtoObject(client *c, robj *obj) {
+    if (sdslen(obj->ptr) >= PROTO_REPLY_OBJ_MIN) {
+        if (prepareClientToWrite(c) == C_OK) _addReplyObjectToList(c,obj);
+    } else {
+        addReply(c,obj);
+    }
+}
+
 /* Create the length prefix of a bulk reply, example: $2234 */
 void addReplyBulkLen(client *c, robj *obj) {
     size_t len = stringObjectLen(obj);
@@ -645,15 +852,38 @@ void addReplyBulkLen(client *c, robj *obj) {
         addReplyLongLongWithPrefix(c,len,'$');
 }
 
-/* Add a Redis Object as a bulk reply */
+/* Add a Redis Object as a bulk reply. Strings of PROTO_REPLY_OBJ_MIN bytes
+ * or more are not copied in the output buffer but referenced from it. */
 void addReplyBulk(client *c, robj *obj) {
+    if (c->flags & CLIENT_LUA && server.lua_direct_reply) {
+        if (sdsEncodedObject(obj)) {
+            luaReplyAddBulk(obj->ptr,sdslen(obj->ptr));
+        } else {
+            char buf[32];
+            size_t len = ll2string(buf,sizeof(buf),(long)obj->ptr);
+            luaReplyAddBulk(buf,len);
+        }
+        return;
+    }
     addReplyBulkLen(c,obj);
-    addReply(c,obj);
+    /* Referencing the value changes its refcount: not while the I/O threads
+     * share the keyspace. */
+    if (sdsEncodedObject(obj) && sdslen(obj->ptr) >= PROTO_REPLY_OBJ_MIN &&
+        !server.keyspace_readonly)
+    {
+        if (prepareClientToWrite(c) == C_OK) _addReplyObjectToList(c,obj);
+    } else {
+        addReply(c,obj);
+    }
     addReply(c,shared.crlf);
 }
 
 /* Add a C buffer as bulk reply */
 void addReplyBulkCBuffer(client *c, const void *p, size_t len) {
+    if (c->flags & CLIENT_LUA && server.lua_direct_reply) {
+        luaReplyAddBulk(p,len);
+        return;
+    }
     addReplyLongLongWithPrefix(c,len,'$');
     addReplyProto(c,p,len);
     addReply(c,shared.crlf);
@@ -661,6 +891,11 @@ void addReplyBulkCBuffer(client *c, const void *p, size_t len) {
 
 /* Add sds to reply (takes ownership of sds and frees it) */
 void addReplyBulkSds(client *c, sds s)  {
+    if (c->flags & CLIENT_LUA && server.lua_direct_reply) {
+        luaReplyAddBulk(s,sdslen(s));
+        sdsfree(s);
+        return;
+    }
     addReplyLongLongWithPrefix(c,sdslen(s),'$');
     addReplySds(c,s);
     addReply(c,shared.crlf);
@@ -750,30 +985,48 @@ void addReplySubcommandSyntaxError(client *c) {
 void AddReplyFromClient(client *dst, client *src) {
     if (prepareClientToWrite(dst) != C_OK)
         return;
-    addReplyProto(dst,src->buf, src->bufpos);
+    if (src->bufpos) addReplyProto(dst,src->buf, src->bufpos);
     if (listLength(src->reply))
         listJoin(dst->reply,src->reply);
     dst->reply_bytes += src->reply_bytes;
     src->reply_bytes = 0;
-    src->bufpos = 0;
+    releaseClientReplyBuffer(src);
 }
 
 /* Copy 'src' client output buffers into 'dst' client output buffers.
  * The function takes care of freeing the old output buffers of the
- * destination client. */
+ * destination client. For slaves, 'dst' starts from the same position of
+ * the shared replication buffer as 'src'. */
 void copyClientOutputBuffer(client *dst, client *src) {
     listRelease(dst->reply);
     dst->sentlen = 0;
     dst->reply = listDup(src->reply);
-    memcpy(dst->buf,src->buf,src->bufpos);
-    dst->bufpos = src->bufpos;
+    releaseClientReplyBuffer(dst);
+    if (src->bufpos) {
+        dst->buf = replyBufferGet();
+        memcpy(dst->buf,src->buf,src->bufpos);
+        dst->bufpos = src->bufpos;
+    }
     dst->reply_bytes = src->reply_bytes;
+
+    freeReplicaReferencedReplBuffer(dst);
+    if (src->ref_repl_buf_node) {
+        dst->ref_repl_buf_node = src->ref_repl_buf_node;
+        dst->ref_block_pos = src->ref_block_pos;
+        ((replBufBlock*)listNodeValue(dst->ref_repl_buf_node))->refcount++;
+    }
 }
 
 /* Return true if the specified client has pending reply buffers to write to
  * the socket. */
 int clientHasPendingReplies(client *c) {
-    return c->bufpos || listLength(c->reply);
+    if (c->bufpos || listLength(c->reply)) return 1;
+    if (c->ref_repl_buf_node) {
+        replBufBlock *b = listNodeValue(c->ref_repl_buf_node);
+        return c->ref_block_pos < b->used ||
+               listNextNode(c->ref_repl_buf_node) != NULL;
+    }
+    return 0;
 }
 
 #define MAX_ACCEPTS_PER_CALL 1000
@@ -892,6 +1145,20 @@ static void freeClientArgv(client *c) {
         decrRefCount(c->argv[j]);
     c->argc = 0;
     c->cmd = NULL;
+    c->slot = COMMAND_SLOT_UNKNOWN;
+}
+
+/* Free the commands an I/O thread parsed but the client did not run. */
+static void freeClientQueuedCommands(client *c) {
+    int i, j;
+    for (i = c->cmdq_pos; i < c->cmdq_len; i++) {
+        for (j = 0; j < c->cmdq[i].argc; j++)
+            decrRefCount(c->cmdq[i].argv[j]);
+        zfree(c->cmdq[i].argv);
+    }
+    zfree(c->cmdq);
+    c->cmdq = NULL;
+    c->cmdq_pos = c->cmdq_len = c->cmdq_size = 0;
 }
 
 /* Close all the slaves connections. This is useful in chained replication
@@ -950,6 +1217,14 @@ void unlinkClient(client *c) {
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 
+    /* Remove from the list of clients waiting for an AOF fsync. */
+    if (c->aof_fsync_id) {
+        ln = listSearchKey(server.clients_waiting_fsync,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_waiting_fsync,ln);
+        c->aof_fsync_id = 0;
+    }
+
     /* Remove from the list of pending reads if needed. */
     if (c->flags & CLIENT_PENDING_READ) {
         ln = listSearchKey(server.clients_pending_read,c);
@@ -1021,12 +1296,15 @@ void freeClient(client *c) {
 
     /* Free data structures. */
     listRelease(c->reply);
+    releaseClientReplyBuffer(c);
     freeClientArgv(c);
+    freeClientQueuedCommands(c);
 
     /* Unlink the client: this will close the socket, remove the I/O
      * handlers, and remove references of the client from different
      * places where active clients may be referenced. */
     unlinkClient(c);
+    if (c->read_paused) server.clients_read_paused--;
 
     /* Master/slave cleanup Case 1:
      * we lost the connection with a slave. */
@@ -1039,6 +1317,7 @@ void freeClient(client *c) {
         ln = listSearchKey(l,c);
         serverAssert(ln != NULL);
         listDelNode(l,ln);
+        freeReplicaReferencedReplBuffer(c);
         /* We need to remember the time when we started to have zero
          * attached slaves, as after some time we'll free the replication
          * backlog. */
@@ -1106,74 +1385,133 @@ client *lookupClientByID(uint64_t id) {
     return (c == raxNotFound) ? NULL : c;
 }
 
-/* Write data in output buffers to client. Return C_OK if the client
- * is still valid after the call, C_ERR if it was freed because of some
- * error.
- *
- * This function is called by threads, but always with handler_installed
- * set to 0. So when handler_installed is set to 0 the function must be
- * thread safe. */
-int writeToClient(int fd, client *c, int handler_installed) {
-    ssize_t nwritten = 0, totwritten = 0;
-    size_t objlen;
+/* Fill 'iov' with the static buffer and the first blocks of the reply list
+ * of 'c', the referenced objects from their own memory, then for slaves the
+ * blocks of the shared replication buffer, up to NET_MAX_WRITEV_IOVCNT
+ * entries and about NET_MAX_WRITES_PER_EVENT bytes. The empty blocks on
+ * head are dropped first. Returns the number of entries, 0 if there is
+ * nothing to send. */
+static int clientReplyIov(client *c, struct iovec *iov) {
+    int iovcnt = 0;
+    size_t iovbytes = 0, offset = c->sentlen;
     clientReplyBlock *o;
+    listIter li;
+    listNode *ln;
 
-    while(clientHasPendingReplies(c)) {
-        if (c->bufpos > 0) {
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+    while(c->bufpos == 0 && listLength(c->reply)) {
+        o = listNodeValue(listFirst(c->reply));
+        if (o->used != 0) break;
+        c->reply_bytes -= o->size;
+        listDelNode(c->reply,listFirst(c->reply));
+    }
 
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if ((int)c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
+    /* c->sentlen counts the bytes sent of the static buffer when it is
+     * not empty, of the first block of the list otherwise. */
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf+c->sentlen;
+        iov[iovcnt].iov_len = c->bufpos-c->sentlen;
+        iovbytes += iov[iovcnt++].iov_len;
+        offset = 0;
+    }
+    listRewind(c->reply,&li);
+    while((ln = listNext(&li)) && iovcnt < NET_MAX_WRITEV_IOVCNT &&
+          iovbytes < NET_MAX_WRITES_PER_EVENT)
+    {
+        o = listNodeValue(ln);
+        if (o->used == 0) continue;
+        iov[iovcnt].iov_base = replyBlockData(o)+offset;
+        iov[iovcnt].iov_len = o->used-offset;
+        iovbytes += iov[iovcnt++].iov_len;
+        offset = 0;
+    }
+    if (ln == NULL && c->ref_repl_buf_node) {
+        offset = c->ref_block_pos;
+        ln = c->ref_repl_buf_node;
+        while(ln && iovcnt < NET_MAX_WRITEV_IOVCNT &&
+              iovbytes < NET_MAX_WRITES_PER_EVENT)
+        {
+            replBufBlock *b = listNodeValue(ln);
+            if (b->used > offset) {
+                iov[iovcnt].iov_base = b->buf+offset;
+                iov[iovcnt].iov_len = b->used-offset;
+                iovbytes += iov[iovcnt++].iov_len;
             }
-        } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = o->used;
+            offset = 0;
+            ln = listNextNode(ln);
+        }
+    }
+    return iovcnt;
+}
 
-            if (objlen == 0) {
-                c->reply_bytes -= o->size;
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
-            }
+/* Account for 'nwritten' bytes sent of the shared replication buffer by
+ * the slave 'c', moving its reference to the blocks that follow: the ones
+ * left behind may then be released. */
+static void clientReplBufferSent(client *c, size_t nwritten) {
+    int moved = 0;
+
+    while(nwritten > 0) {
+        replBufBlock *b = listNodeValue(c->ref_repl_buf_node);
+        listNode *next = listNextNode(c->ref_repl_buf_node);
+        size_t left = b->used-c->ref_block_pos;
 
-            nwritten = write(fd, o->buf + c->sentlen, objlen - c->sentlen);
-            if (nwritten <= 0) break;
+        if (nwritten < left || next == NULL) {
+            serverAssert(nwritten <= left);
+            c->ref_block_pos += nwritten;
+            break;
+        }
+        nwritten -= left;
+        b->refcount--;
+        ((replBufBlock*)listNodeValue(next))->refcount++;
+        c->ref_repl_buf_node = next;
+        c->ref_block_pos = 0;
+        moved = 1;
+    }
+    if (moved) incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+}
+
+/* Account for 'nwritten' bytes sent of what clientReplyIov() returned:
+ * advance c->sentlen and drop what was fully sent. */
+static void clientReplySent(client *c, size_t nwritten) {
+    clientReplyBlock *o;
+    size_t left;
+
+    if (c->bufpos > 0) {
+        left = c->bufpos-c->sentlen;
+        if (nwritten < left) {
             c->sentlen += nwritten;
-            totwritten += nwritten;
-
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                c->reply_bytes -= o->size;
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                /* If there are no longer objects in the list, we expect
-                 * the count of reply bytes to be exactly zero. */
-                if (listLength(c->reply) == 0)
-                    serverAssert(c->reply_bytes == 0);
-            }
+            return;
         }
-        /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
-         * bytes, in a single threaded server it's a good idea to serve
-         * other clients as well, even if a very large request comes from
-         * super fast link that is always able to accept data (in real world
-         * scenario think about 'KEYS *' against the loopback interface).
-         *
-         * However if we are over the maxmemory limit we ignore that and
-         * just deliver as much data as it is possible to deliver.
-         *
-         * Moreover, we also send as much as possible if the client is
-         * a slave (otherwise, on high-speed traffic, the replication
-         * buffer will grow indefinitely) */
-        if (totwritten > NET_MAX_WRITES_PER_EVENT &&
-            (server.maxmemory == 0 ||
-             zmalloc_used_memory() < server.maxmemory) &&
-            !(c->flags & CLIENT_SLAVE)) break;
+        /* The buffer was sent, set bufpos to zero to continue with the
+         * remainder of the reply. */
+        nwritten -= left;
+        releaseClientReplyBuffer(c);
+        c->sentlen = 0;
+    }
+    while(nwritten > 0 && listLength(c->reply)) {
+        o = listNodeValue(listFirst(c->reply));
+        left = o->used-c->sentlen;
+        if (nwritten < left) {
+            c->sentlen += nwritten;
+            nwritten = 0;
+            break;
+        }
+        /* The object on head was fully sent, go to the next one. */
+        nwritten -= left;
+        c->reply_bytes -= o->size;
+        listDelNode(c->reply,listFirst(c->reply));
+        c->sentlen = 0;
     }
+    /* If there are no longer objects in the list, we expect the count of
+     * reply bytes to be exactly zero. */
+    if (listLength(c->reply) == 0) serverAssert(c->reply_bytes == 0);
+    if (nwritten > 0) clientReplBufferSent(c,nwritten);
+}
+
+/* What follows the writes of writeToClient(): 'nwritten' is the result of
+ * the last write, 'totwritten' the bytes sent in all. */
+static int writeToClientDone(client *c, ssize_t nwritten, ssize_t totwritten,
+                             int handler_installed)
+{
     server.stat_net_output_bytes += totwritten;
     if (nwritten == -1) {
         if (errno == EAGAIN) {
@@ -1209,11 +1547,212 @@ int writeToClient(int fd, client *c, int handler_installed) {
     return C_OK;
 }
 
+/* Write data in output buffers to client. Return C_OK if the client
+ * is still valid after the call, C_ERR if it was freed because of some
+ * error.
+ *
+ * This function is called by threads, but always with handler_installed
+ * set to 0. So when handler_installed is set to 0 the function must be
+ * thread safe. */
+int writeToClient(int fd, client *c, int handler_installed) {
+    struct iovec iov[NET_MAX_WRITEV_IOVCNT];
+    ssize_t nwritten = 0, totwritten = 0;
+    int iovcnt;
+
+    while(clientHasPendingReplies(c)) {
+        if ((iovcnt = clientReplyIov(c,iov)) == 0) continue;
+        nwritten = writev(fd,iov,iovcnt);
+        if (nwritten <= 0) break;
+        clientReplySent(c,nwritten);
+        totwritten += nwritten;
+
+        /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
+         * bytes, in a single threaded server it's a good idea to serve
+         * other clients as well, even if a very large request comes from
+         * super fast link that is always able to accept data (in real world
+         * scenario think about 'KEYS *' against the loopback interface).
+         *
+         * However if we are over the maxmemory limit we ignore that and
+         * just deliver as much data as it is possible to deliver.
+         *
+         * Moreover, we also send as much as possible if the client is
+         * a slave (otherwise, on high-speed traffic, the replication
+         * buffer will grow indefinitely) */
+        if (totwritten > NET_MAX_WRITES_PER_EVENT &&
+            (server.maxmemory == 0 ||
+             zmalloc_used_memory() < server.maxmemory) &&
+            !(c->flags & CLIENT_SLAVE)) break;
+    }
+    return writeToClientDone(c,nwritten,totwritten,handler_installed);
+}
+
 /* Write event handler. Just send data to the client. */
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(el);
     UNUSED(mask);
-    writeToClient(fd,privdata,1);
+    if (writeToClient(fd,privdata,1) == C_OK) resumeClientReading(privdata);
+}
+
+/* If after the synchronous writes we still have data to output to the
+ * client, we need to install the writable handler. */
+static void installClientWriteHandler(client *c) {
+    int ae_flags = AE_WRITABLE;
+
+    resumeClientReading(c);
+    if (!clientHasPendingReplies(c)) return;
+    /* For the fsync=always policy, we want that a given FD is never
+     * served for reading and writing in the same event loop iteration,
+     * so that in the middle of receiving the query, and serving it
+     * to the client, we'll call beforeSleep() that will do the
+     * actual fsync of AOF to disk. AE_BARRIER ensures that. */
+    if (server.aof_state == AOF_ON &&
+        server.aof_fsync == AOF_FSYNC_ALWAYS)
+    {
+        ae_flags |= AE_BARRIER;
+    }
+    if (aeCreateFileEvent(server.el, c->fd, ae_flags,
+        sendReplyToClient, c) == AE_ERR)
+    {
+            freeClientAsync(c);
+    }
+}
+
+/* ==========================================================================
+ * Writes batched with io_uring (io-uring-writes)
+ * ========================================================================== */
+
+#define URING_WRITES_BATCH 256 /* Client writes per io_uring submission. */
+
+typedef struct uringClientWrite {
+    client *c;
+    int done;
+    struct iovec iov[NET_MAX_WRITEV_IOVCNT];
+} uringClientWrite;
+
+static uringRing *uring_writes_ring = NULL;
+static uringClientWrite *uring_writes = NULL;
+static int uring_writes_failed = 0;    /* io_uring is not usable here. */
+
+/* Set up the ring at the first use. Returns C_ERR, once logged, if io_uring
+ * can't be used, and the clients are then written one by one. */
+static int uringWritesInit(void) {
+    if (uring_writes_ring) return C_OK;
+    if (uring_writes_failed) return C_ERR;
+    uring_writes_ring = uringCreate(URING_WRITES_BATCH);
+    if (uring_writes_ring == NULL) {
+        serverLog(LL_WARNING,
+            "io-uring-writes: io_uring is not available (%s), "
+            "writing to clients with one system call each.",
+            strerror(errno));
+        uring_writes_failed = 1;
+        return C_ERR;
+    }
+    uring_writes = zmalloc(sizeof(uringClientWrite)*
+                           uringEntries(uring_writes_ring));
+    serverLog(LL_NOTICE,"io-uring-writes: batching the writes to clients.");
+    return C_OK;
+}
+
+/* Send a write of 'count' clients of uring_writes with a single system call,
+ * then do for each one what writeToClient() does after its writes. A
+ * client whose reply doesn't fit its write gets the writable handler, as
+ * when NET_MAX_WRITES_PER_EVENT is reached. */
+static void uringWritesFlush(int count) {
+    uint64_t id;
+    int j, res;
+
+    if (count == 0) return;
+    if (uringSubmitAndWait(uring_writes_ring) == -1) {
+        serverLog(LL_WARNING,
+            "io-uring-writes: io_uring_enter() failed (%s).",strerror(errno));
+    } else {
+        server.stat_io_uring_batches++;
+        server.stat_io_uring_writes += count;
+    }
+    while(uringNextCompletion(uring_writes_ring,&id,&res)) {
+        uringClientWrite *w = &uring_writes[id];
+        client *c = w->c;
+
+        /* A kernel that can't do non blocking writes to sockets: nothing
+         * was sent, write this client below and stop using io_uring. */
+        if (res == -EOPNOTSUPP || res == -EINVAL) {
+            if (!uring_writes_failed)
+                serverLog(LL_WARNING,
+                    "io-uring-writes: non blocking socket writes are not "
+                    "supported (%s), writing to clients with one system "
+                    "call each.",strerror(-res));
+            uring_writes_failed = 1;
+            continue;
+        }
+        w->done = 1;
+        if (res > 0) clientReplySent(c,res);
+        else if (res < 0) errno = -res;
+        if (writeToClientDone(c,res < 0 ? -1 : res,res > 0 ? res : 0,0)
+            == C_ERR) continue;
+        installClientWriteHandler(c);
+    }
+    /* Clients whose write could not be submitted. */
+    for (j = 0; j < count; j++) {
+        if (uring_writes[j].done) continue;
+        if (writeToClient(uring_writes[j].c->fd,uring_writes[j].c,0) == C_ERR)
+            continue;
+        installClientWriteHandler(uring_writes[j].c);
+    }
+    if (uring_writes_failed) {
+        uringRelease(uring_writes_ring);
+        zfree(uring_writes);
+        uring_writes_ring = NULL;
+        uring_writes = NULL;
+    }
+}
+
+/* handleClientsWithPendingWrites() with the writes queued to the io_uring
+ * and sent in batches. Returns C_ERR if io_uring can't be used. */
+static int handleClientsWithPendingWritesUsingUring(void) {
+    listIter li;
+    listNode *ln;
+    int count = 0, iovcnt;
+
+    if (uringWritesInit() == C_ERR) return C_ERR;
+
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_WRITE;
+        listDelNode(server.clients_pending_write,ln);
+
+        /* If a client is protected, don't do anything,
+         * that may trigger write error or recreate handler. */
+        if (c->flags & CLIENT_PROTECTED) continue;
+
+        /* io_uring turned out to be unusable during this call. */
+        if (uring_writes_ring == NULL) {
+            if (writeToClient(c->fd,c,0) == C_OK)
+                installClientWriteHandler(c);
+            continue;
+        }
+
+        uringClientWrite *w = &uring_writes[count];
+        if ((iovcnt = clientReplyIov(c,w->iov)) == 0) {
+            writeToClientDone(c,0,0,0);
+            continue;
+        }
+        w->c = c;
+        w->done = 0;
+        if (uringPrepWritev(uring_writes_ring,c->fd,w->iov,iovcnt,count)
+            == -1)
+        {
+            if (writeToClient(c->fd,c,0) == C_OK)
+                installClientWriteHandler(c);
+            continue;
+        }
+        if (++count == (int)uringEntries(uring_writes_ring)) {
+            uringWritesFlush(count);
+            count = 0;
+        }
+    }
+    uringWritesFlush(count);
+    return C_OK;
 }
 
 /* This function is called just before entering the event loop, in the hope
@@ -1225,6 +1764,12 @@ int handleClientsWithPendingWrites(void) {
     listNode *ln;
     int processed = listLength(server.clients_pending_write);
 
+    if (processed == 0) return 0;
+
+    /* With io-uring-writes the clients are written in batches. */
+    if (server.io_uring_writes &&
+        handleClientsWithPendingWritesUsingUring() == C_OK) return processed;
+
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
@@ -1240,24 +1785,7 @@ int handleClientsWithPendingWrites(void) {
 
         /* If after the synchronous writes above we still have data to
          * output to the client, we need to install the writable handler. */
-        if (clientHasPendingReplies(c)) {
-            int ae_flags = AE_WRITABLE;
-            /* For the fsync=always policy, we want that a given FD is never
-             * served for reading and writing in the same event loop iteration,
-             * so that in the middle of receiving the query, and serving it
-             * to the client, we'll call beforeSleep() that will do the
-             * actual fsync of AOF to disk. AE_BARRIER ensures that. */
-            if (server.aof_state == AOF_ON &&
-                server.aof_fsync == AOF_FSYNC_ALWAYS)
-            {
-                ae_flags |= AE_BARRIER;
-            }
-            if (aeCreateFileEvent(server.el, c->fd, ae_flags,
-                sendReplyToClient, c) == AE_ERR)
-            {
-                    freeClientAsync(c);
-            }
-        }
+        installClientWriteHandler(c);
     }
     return processed;
 }
@@ -1309,7 +1837,8 @@ void protectClient(client *c) {
 void unprotectClient(client *c) {
     if (c->flags & CLIENT_PROTECTED) {
         c->flags &= ~CLIENT_PROTECTED;
-        aeCreateFileEvent(server.el,c->fd,AE_READABLE,readQueryFromClient,c);
+        if (!c->read_paused)
+            aeCreateFileEvent(server.el,c->fd,AE_READABLE,readQueryFromClient,c);
         if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
     }
 }
@@ -1579,9 +2108,11 @@ int processCommandAndResetClient(client *c) {
         /* Don't reset the client structure for clients blocked in a
          * module blocking command, so that the reply callback will
          * still be able to access the client argv and argc field.
-         * The client will be reset in unblockClientFromModule(). */
+         * The client will be reset in unblockClientFromModule().
+         * Clients waiting for module key locks keep the command to run
+         * it once unblocked. */
         if (!(c->flags & CLIENT_BLOCKED) ||
-            c->btype != BLOCKED_MODULE)
+            (c->btype != BLOCKED_MODULE && c->btype != BLOCKED_KEYLOCK))
         {
             resetClient(c);
         }
@@ -1594,13 +2125,182 @@ int processCommandAndResetClient(client *c) {
     return deadclient ? C_ERR : C_OK;
 }
 
+/* Parse the "<prefix><number>\r\n" header of a multibulk or bulk at 'p',
+ * without consuming the query buffer. Return the first byte after it, or
+ * NULL if it is not complete or not valid. */
+static const char *peekQueryHeader(const char *p, const char *end,
+                                   char prefix, long long *ll)
+{
+    const char *newline;
+
+    if (p >= end || *p != prefix) return NULL;
+    newline = memchr(p+1,'\r',end-(p+1));
+    if (newline == NULL || newline+1 >= end || newline[1] != '\n') return NULL;
+    if (!string2ll(p+1,newline-(p+1),ll)) return NULL;
+    return newline+2;
+}
+
+/* Prefetch the keys of the next DB_PREFETCH_BATCH commands (at most) that
+ * are complete in the query buffer, so that a pipeline of single key
+ * commands looks them up as one batch. The second argument is taken as the
+ * key: it is the first key of almost every command having keys, and for the
+ * others the prefetch is only wasted. Only the first PROTO_IOBUF_LEN bytes
+ * from c->qb_pos are scanned.
+ *
+ * Return the offset in the query buffer up to which the commands were
+ * scanned, the caller calls us again once it processed them. */
+static size_t prefetchQueryBufferKeys(client *c) {
+    const char *keys[DB_PREFETCH_BATCH];
+    size_t lens[DB_PREFETCH_BATCH];
+    const char *p = c->querybuf+c->qb_pos, *scanned = p;
+    const char *end = c->querybuf+sdslen(c->querybuf);
+    int count = 0, commands = 0;
+
+    if (end-p > PROTO_IOBUF_LEN) end = p+PROTO_IOBUF_LEN;
+    while(commands < DB_PREFETCH_BATCH) {
+        const char *key = NULL;
+        long long argc, len, j;
+
+        if ((p = peekQueryHeader(p,end,'*',&argc)) == NULL) break;
+        for (j = 0; j < argc; j++) {
+            p = peekQueryHeader(p,end,'$',&len);
+            if (p == NULL || len < 0 || end-p < len+2) {
+                p = NULL;
+                break;
+            }
+            if (j == 1) {
+                key = p;
+                lens[count] = len;
+            }
+            p += len+2;
+        }
+        if (p == NULL) break;
+        if (key) keys[count++] = key;
+        scanned = p;
+        commands++;
+    }
+    /* There is nothing to overlap with a single command. */
+    if (commands > 1 && count) dbPrefetchKeyBuffers(c->db,keys,lens,count);
+    return scanned-c->querybuf;
+}
+
+/* Return 1 if the query buffer of 'c' starts with a whole RESP command that
+ * processMultibulkBuffer() can parse without a protocol error, 0 otherwise.
+ * An I/O thread that already queued commands for the client only parses
+ * such a command, leaving a partial command or an error (reported after the
+ * queued commands run) to the main thread. */
+static int querybufHasCommand(client *c) {
+    const char *p = c->querybuf+c->qb_pos;
+    const char *end = c->querybuf+sdslen(c->querybuf);
+    long long argc, ll;
+
+    if ((p = peekQueryHeader(p,end,'*',&argc)) == NULL ||
+        argc > 1024*1024) return 0;
+    while(argc-- > 0) {
+        if ((p = peekQueryHeader(p,end,'$',&ll)) == NULL ||
+            ll < 0 || ll > server.proto_max_bulk_len ||
+            end-p < ll+2) return 0;
+        p += ll+2;
+    }
+    return 1;
+}
+
+/* Move the command just parsed in c->argv to the queue of commands for the
+ * main thread to run, and get the client ready to parse the next one. This
+ * is how I/O threads hand over whole pipelines of parsed commands. */
+static void queueClientCommand(client *c) {
+    if (c->cmdq_pos == c->cmdq_len) {
+        c->cmdq_pos = c->cmdq_len = 0;
+    } else if (c->cmdq_len == c->cmdq_size) {
+        memmove(c->cmdq,c->cmdq+c->cmdq_pos,
+                sizeof(clientQueuedCommand)*(c->cmdq_len-c->cmdq_pos));
+        c->cmdq_len -= c->cmdq_pos;
+        c->cmdq_pos = 0;
+    }
+    if (c->cmdq_len == c->cmdq_size) {
+        c->cmdq_size = c->cmdq_size ? c->cmdq_size*2 : 4;
+        c->cmdq = zrealloc(c->cmdq,sizeof(clientQueuedCommand)*c->cmdq_size);
+    }
+
+    /* A command of no arguments (an empty multibulk) is queued too, so that
+     * the main thread resets the client for it in order. */
+    c->cmdq[c->cmdq_len].argc = c->argc;
+    c->cmdq[c->cmdq_len].argv = c->argc ? c->argv : NULL;
+    c->cmdq_len++;
+    if (c->argc) c->argv = NULL;
+    c->argc = 0;
+    c->reqtype = 0;
+    c->multibulklen = 0;
+    c->bulklen = -1;
+}
+
+/* Set up the next queued command of 'c' in c->argv, for the main thread to
+ * run. */
+static void popClientCommand(client *c) {
+    clientQueuedCommand *qc = c->cmdq+c->cmdq_pos++;
+
+    serverAssertWithInfo(c,NULL,c->argc == 0 && c->multibulklen == 0);
+    if (qc->argv) {
+        zfree(c->argv);
+        c->argv = qc->argv;
+    }
+    c->argc = qc->argc;
+    server.stat_io_parsed_commands++;
+}
+
+/* With client-output-buffer-pause, stop reading from a client whose
+ * output buffers reached the limit: its commands stay in the socket until
+ * it reads the replies, and writing them drops the buffers back to half the
+ * limit, see resumeClientReading(). That's a soft limit that keeps
+ * pipelines in check long before client-output-buffer-limit disconnects
+ * them. The replicas, the masters and the MONITORs are never paused. Only
+ * called by the main thread, that owns the file events. Returns 1 if the
+ * client is paused. */
+static int pauseClientReading(client *c) {
+    if (c->read_paused) return 1;
+    if (server.client_obuf_pause == 0 || c->fd == -1 ||
+        c->flags & (CLIENT_MASTER|CLIENT_SLAVE|CLIENT_PENDING_READ) ||
+        getClientOutputBufferMemoryUsage(c) < server.client_obuf_pause)
+        return 0;
+    aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
+    c->read_paused = 1;
+    server.clients_read_paused++;
+    server.stat_client_read_pauses++;
+    return 1;
+}
+
+/* Read again from a client paused by pauseClientReading() once its output
+ * buffers are down to half the limit (or the limit was lifted), and run the
+ * commands it had already sent at the next beforeSleep(). Called by the
+ * main thread after each write to the client. */
+void resumeClientReading(client *c) {
+    if (!c->read_paused) return;
+    if (server.client_obuf_pause &&
+        getClientOutputBufferMemoryUsage(c) > server.client_obuf_pause/2)
+        return;
+    c->read_paused = 0;
+    server.clients_read_paused--;
+    if (c->flags & CLIENT_PROTECTED) return; /* unprotectClient() will. */
+    if (aeCreateFileEvent(server.el,c->fd,AE_READABLE,
+        readQueryFromClient,c) == AE_ERR)
+    {
+        freeClientAsync(c);
+        return;
+    }
+    if (sdslen(c->querybuf) > 0 || c->cmdq_pos < c->cmdq_len)
+        queueClientForReprocessing(c);
+}
+
 /* This function is called every time, in the client structure 'c', there is
  * more query buffer to process, because we read more data from the socket
  * or because a client was blocked and later reactivated, so there could be
  * pending query buffer, already representing a full command, to process. */
 void processInputBuffer(client *c) {
-    /* Keep processing while there is something in the input buffer */
-    while(c->qb_pos < sdslen(c->querybuf)) {
+    size_t prefetched = 0;
+
+    /* Keep processing while there is something in the input buffer, or
+     * commands an I/O thread already parsed out of it. */
+    while(c->cmdq_pos < c->cmdq_len || c->qb_pos < sdslen(c->querybuf)) {
         /* Return if clients are paused. */
         if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
 
@@ -1608,8 +2308,10 @@ void processInputBuffer(client *c) {
         if (c->flags & CLIENT_BLOCKED) break;
 
         /* Don't process more buffers from clients that have already pending
-         * commands to execute in c->argv. */
-        if (c->flags & CLIENT_PENDING_COMMAND) break;
+         * commands to execute in c->cmdq, unless we are the I/O thread
+         * queueing them. */
+        if ((c->flags & (CLIENT_PENDING_COMMAND|CLIENT_PENDING_READ)) ==
+            CLIENT_PENDING_COMMAND) break;
 
         /* Don't process input from the master while there is a busy script
          * condition on the slave. We want just to accumulate the replication
@@ -1624,46 +2326,80 @@ void processInputBuffer(client *c) {
          * The same applies for clients we want to terminate ASAP. */
         if (c->flags & (CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP)) break;
 
-        /* Determine request type when unknown. */
-        if (!c->reqtype) {
-            if (c->querybuf[c->qb_pos] == '*') {
-                c->reqtype = PROTO_REQ_MULTIBULK;
+        /* Don't run more commands for a client that doesn't read the
+         * replies of the previous ones. */
+        if (pauseClientReading(c)) break;
+
+        if (c->cmdq_pos < c->cmdq_len && !(c->flags & CLIENT_PENDING_READ)) {
+            /* The commands an I/O thread parsed come first. */
+            popClientCommand(c);
+        } else {
+            /* In an I/O thread, past the first command, only parse whole
+             * RESP commands, up to PROTO_QUEUED_CMDS_MAX of them. */
+            if (c->cmdq_pos < c->cmdq_len &&
+                (c->cmdq_len-c->cmdq_pos >= PROTO_QUEUED_CMDS_MAX ||
+                 !querybufHasCommand(c))) break;
+
+            /* Prefetch the keys of the pipelined commands that follow,
+             * unless we are in an I/O thread: the keyspace belongs to the
+             * main one. */
+            if (c->qb_pos >= prefetched && !c->reqtype &&
+                !(c->flags & CLIENT_PENDING_READ))
+            {
+                prefetched = prefetchQueryBufferKeys(c);
+            }
+
+            /* Determine request type when unknown. */
+            if (!c->reqtype) {
+                if (c->querybuf[c->qb_pos] == '*') {
+                    c->reqtype = PROTO_REQ_MULTIBULK;
+                } else {
+                    c->reqtype = PROTO_REQ_INLINE;
+                }
+            }
+
+            if (c->reqtype == PROTO_REQ_INLINE) {
+                if (processInlineBuffer(c) != C_OK) break;
+                /* If the Gopher mode and we got zero or one argument, process
+                 * the request in Gopher mode. */
+                if (server.gopher_enabled &&
+                    ((c->argc == 1 && ((char*)(c->argv[0]->ptr))[0] == '/') ||
+                      c->argc == 0))
+                {
+                    processGopherRequest(c);
+                    resetClient(c);
+                    c->flags |= CLIENT_CLOSE_AFTER_REPLY;
+                    break;
+                }
+            } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
+                if (processMultibulkBuffer(c) != C_OK) break;
             } else {
-                c->reqtype = PROTO_REQ_INLINE;
+                serverPanic("Unknown request type");
             }
-        }
 
-        if (c->reqtype == PROTO_REQ_INLINE) {
-            if (processInlineBuffer(c) != C_OK) break;
-            /* If the Gopher mode and we got zero or one argument, process
-             * the request in Gopher mode. */
-            if (server.gopher_enabled &&
-                ((c->argc == 1 && ((char*)(c->argv[0]->ptr))[0] == '/') ||
-                  c->argc == 0))
-            {
-                processGopherRequest(c);
-                resetClient(c);
-                c->flags |= CLIENT_CLOSE_AFTER_REPLY;
-                break;
+            /* If we are in the context of an I/O thread, we can't really
+             * execute the command here, unless it is one of the read only
+             * commands the threads may run and no command parsed before it
+             * waits for the main thread. All we can do is to queue it and
+             * flag the client as one that needs to process commands, then
+             * go on parsing the next one. */
+            if (c->flags & CLIENT_PENDING_READ) {
+                if (c->argc && c->cmdq_pos == c->cmdq_len &&
+                    server.keyspace_readonly && ioThreadRunCommand(c) == C_OK)
+                {
+                    resetClient(c);
+                    continue;
+                }
+                queueClientCommand(c);
+                c->flags |= CLIENT_PENDING_COMMAND;
+                continue;
             }
-        } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != C_OK) break;
-        } else {
-            serverPanic("Unknown request type");
         }
 
         /* Multibulk processing could see a <= 0 length. */
         if (c->argc == 0) {
             resetClient(c);
         } else {
-            /* If we are in the context of an I/O thread, we can't really
-             * execute the command here. All we can do is to flag the client
-             * as one that needs to process the command. */
-            if (c->flags & CLIENT_PENDING_READ) {
-                c->flags |= CLIENT_PENDING_COMMAND;
-                break;
-            }
-
             /* We are finally ready to execute the command. */
             if (processCommandAndResetClient(c) == C_ERR) {
                 /* If the client is no longer valid, we avoid exiting this
@@ -1679,6 +2415,7 @@ void processInputBuffer(client *c) {
         sdsrange(c->querybuf,c->qb_pos,-1);
         c->qb_pos = 0;
     }
+    releaseClientQueryBuffer(c);
 }
 
 /* This is a wrapper for processInputBuffer that also cares about handling
@@ -1717,6 +2454,10 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
      * the event loop. This is the case if threaded I/O is enabled. */
     if (postponeClientRead(c)) return;
 
+    /* Called again by the event loop before the I/O threads got to read
+     * from the client: leave the read, and the commands, to them. */
+    if (el && c->flags & CLIENT_PENDING_READ) return;
+
     readlen = PROTO_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -1736,10 +2477,15 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 
     qblen = sdslen(c->querybuf);
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
+    if (qblen == 0 && sdsavail(c->querybuf) < (size_t)readlen) {
+        sdsfree(c->querybuf);
+        c->querybuf = queryBufferGet();
+    }
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
     nread = read(fd, c->querybuf+qblen, readlen);
     if (nread == -1) {
         if (errno == EAGAIN) {
+            releaseClientQueryBuffer(c);
             return;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
@@ -1849,7 +2595,7 @@ sds catClientInfoString(sds s, client *client) {
     if (client->flags & CLIENT_PUBSUB) *p++ = 'P';
     if (client->flags & CLIENT_MULTI) *p++ = 'x';
     if (client->flags & CLIENT_BLOCKED) *p++ = 'b';
-    if (client->flags & CLIENT_DIRTY_CAS) *p++ = 'd';
+    if (watchedKeysTouched(client)) *p++ = 'd';
     if (client->flags & CLIENT_CLOSE_AFTER_REPLY) *p++ = 'c';
     if (client->flags & CLIENT_UNBLOCKED) *p++ = 'u';
     if (client->flags & CLIENT_CLOSE_ASAP) *p++ = 'A';
@@ -2303,7 +3049,20 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
  * enforcing the client output length limits. */
 unsigned long getClientOutputBufferMemoryUsage(client *c) {
     unsigned long list_item_size = sizeof(listNode) + sizeof(clientReplyBlock);
-    return c->reply_bytes + (list_item_size*listLength(c->reply));
+    return c->reply_bytes + (list_item_size*listLength(c->reply)) +
+           getClientReplBufferMemoryUsage(c);
+}
+
+/* The part of getClientOutputBufferMemoryUsage() of a slave that is in the
+ * shared replication buffer: the blocks from the one it references to the
+ * tail, that can't be released before the slave sends them. */
+unsigned long getClientReplBufferMemoryUsage(client *c) {
+    replBufBlock *first, *last;
+
+    if (c->ref_repl_buf_node == NULL) return 0;
+    first = listNodeValue(c->ref_repl_buf_node);
+    last = listNodeValue(listLast(server.repl_buffer_blocks));
+    return last->repl_offset + last->size - first->repl_offset;
 }
 
 /* Get the class of a client, used in order to enforce limits to different
@@ -2396,7 +3155,8 @@ int checkClientOutputBufferLimits(client *c) {
 void asyncCloseClientOnOutputBufferLimitReached(client *c) {
     if (c->fd == -1) return; /* It is unsafe to free fake clients. */
     serverAssert(c->reply_bytes < SIZE_MAX-(1024*64));
-    if (c->reply_bytes == 0 || c->flags & CLIENT_CLOSE_ASAP) return;
+    if ((c->reply_bytes == 0 && c->ref_repl_buf_node == NULL) ||
+        c->flags & CLIENT_CLOSE_ASAP) return;
     if (checkClientOutputBufferLimits(c)) {
         sds client = catClientInfoString(sdsempty(),c);
 
@@ -2520,52 +3280,281 @@ int tio_debug = 0;
 #define IO_THREADS_OP_READ 0
 #define IO_THREADS_OP_WRITE 1
 
+/* What the main thread hands over to an I/O thread, each one in its own
+ * page: with the threads on other Popcorn nodes (io-threads-node or the
+ * schedule), a thread spinning on its pending count then only keeps its own
+ * page, instead of taking the others' counters, and the lists next to them,
+ * away at every poll. */
+#define IO_THREAD_STATE_SIZE 4096 /* A page, the unit of sharing of the DSM. */
+#define IO_THREADS_SPIN_MIN 1000  /* Shortest adaptive spin, in polls. */
+
+typedef struct ioThread {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;    /* Signaled by the main thread if parked. */
+    _Atomic unsigned long pending;
+    _Atomic int parked;     /* Waiting on cond for pending work? */
+    int op;         /* IO_THREADS_OP_WRITE or IO_THREADS_OP_READ. */
+    list clients;   /* The clients the thread serves in this batch. */
+
+    /* Polls of pending before parking, between IO_THREADS_SPIN_MIN and
+     * io-threads-spin: doubled when work comes while spinning, halved
+     * when the thread had to park. Then the time spent each way, for
+     * INFO iothreads. */
+    _Atomic int spin_budget;
+    _Atomic long long spin_usec;
+    _Atomic long long parked_usec;
+    _Atomic long long parks;
+} ioThread;
+
+typedef union ioThreadState {
+    ioThread t;
+    char padding[IO_THREAD_STATE_SIZE];
+} ioThreadState;
+
 pthread_t io_threads[IO_THREADS_MAX_NUM];
-pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
-_Atomic unsigned long io_threads_pending[IO_THREADS_MAX_NUM];
+static ioThreadState io_threads_state[IO_THREADS_MAX_NUM]
+    __attribute__((aligned(IO_THREAD_STATE_SIZE)));
 int io_threads_active;  /* Are the threads currently spinning waiting I/O? */
-int io_threads_op;      /* IO_THREADS_OP_WRITE or IO_THREADS_OP_READ. */
-list *io_threads_list[IO_THREADS_MAX_NUM];
+
+#define io_threads_mutex(id) (&io_threads_state[id].t.mutex)
+#define io_threads_pending(id) (io_threads_state[id].t.pending)
+#define io_threads_list(id) (&io_threads_state[id].t.clients)
+
+/* With io-threads-do-commands the I/O threads don't just parse the commands
+ * they read: they also run the read only fast ones (GET, HGET, ZSCORE, ...)
+ * themselves, if nothing else in the client state or in the server state
+ * needs the main thread. While the threads read, the main thread only waits
+ * for them, so the keyspace is not modified: it is shared by the readers
+ * as long as they don't write to it either. Rehash steps are paused, keys
+ * found expired are not deleted, large values are copied in the replies
+ * rather than referenced, and the stats are counted per thread, to be added
+ * to the server ones by the main thread. */
+#define IO_THREAD_CMD_STATS 32
+
+typedef struct ioThreadStats {
+    long long numcommands;
+    long long keyspace_hits;
+    long long keyspace_misses;
+    int numcmds;            /* Used entries of 'cmds'. */
+    struct {
+        struct redisCommand *cmd;
+        long long calls, microseconds;
+    } cmds[IO_THREAD_CMD_STATS];
+} ioThreadStats;
+
+ioThreadStats io_threads_stats[IO_THREADS_MAX_NUM];
+static __thread ioThreadStats *io_thread_stats; /* NULL in the main thread. */
+static pthread_mutex_t io_threads_slowlog_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return 1 if the state of the server lets the I/O threads run commands
+ * during the next read. */
+static int ioThreadsCanRunCommands(void) {
+    return server.io_threads_do_commands &&
+           !server.loading &&
+           !server.lua_timedout &&
+           !server.cluster_enabled &&
+           !clientsArePaused() &&
+           listLength(server.monitors) == 0 &&
+           !moduleHasCommandFilters() &&
+           !(server.notify_keyspace_events & NOTIFY_KEY_MISS) &&
+           /* Reaching the limit frees the client from the thread. */
+           !server.client_obuf_limits[CLIENT_TYPE_NORMAL].hard_limit_bytes &&
+           !server.client_obuf_limits[CLIENT_TYPE_NORMAL].soft_limit_bytes &&
+           !(server.masterhost && server.repl_state != REPL_STATE_CONNECTED &&
+             server.repl_serve_stale_data == 0);
+}
+
+/* Called by ioThreadRunCommand(), by the way of lookupKeyRead(). */
+void ioThreadCountLookup(int hit) {
+    if (hit)
+        io_thread_stats->keyspace_hits++;
+    else
+        io_thread_stats->keyspace_misses++;
+}
+
+/* Run the command parsed in the client from an I/O thread, if it is a read
+ * only fast command that processCommand() would just call() in the current
+ * state of the client. Return C_OK if the command was run, C_ERR if it is
+ * left to the main thread. */
+static int ioThreadRunCommand(client *c) {
+    ioThreadStats *st = io_thread_stats;
+    struct redisCommand *cmd;
+    long long start, duration;
+    int j;
+
+    if (c->flags & (CLIENT_MULTI|CLIENT_PUBSUB|CLIENT_BLOCKED|
+                    CLIENT_REPLY_OFF|CLIENT_REPLY_SKIP|CLIENT_REPLY_SKIP_NEXT|
+                    CLIENT_LUA_DEBUG|CLIENT_CLOSE_AFTER_REPLY|
+                    CLIENT_CLOSE_ASAP)) return C_ERR;
+    if ((!(DefaultUser->flags & USER_FLAG_NOPASS) && !c->authenticated) ||
+        DefaultUser->flags & USER_FLAG_DISABLED) return C_ERR;
+
+    /* Errors, including the arity ones, are for the main thread to reply. */
+    cmd = lookupCommand(c->argv[0]->ptr);
+    if (cmd == NULL ||
+        (cmd->flags & (CMD_READONLY|CMD_FAST)) != (CMD_READONLY|CMD_FAST) ||
+        cmd->flags & (CMD_RANDOM|CMD_MODULE|CMD_ADMIN|CMD_PUBSUB) ||
+        (cmd->arity > 0 && cmd->arity != c->argc) ||
+        c->argc < -cmd->arity) return C_ERR;
+    c->cmd = c->lastcmd = cmd;
+    if (ACLCheckCommandPerm(c) != ACL_OK) return C_ERR;
+    if (server.io_threads_shard_by_slot) clientTrackShardSlot(c);
+
+    for (j = 0; j < st->numcmds; j++)
+        if (st->cmds[j].cmd == cmd) break;
+    if (j == st->numcmds) {
+        if (j == IO_THREAD_CMD_STATS) return C_ERR;
+        st->cmds[j].cmd = cmd;
+        st->cmds[j].calls = st->cmds[j].microseconds = 0;
+        st->numcmds++;
+    }
+
+    start = ustime();
+    cmd->proc(c);
+    duration = ustime()-start;
+    st->cmds[j].calls++;
+    st->cmds[j].microseconds += duration;
+    st->numcommands++;
+    c->woff = server.master_repl_offset;
+
+    /* What call() would do for slow commands: rare enough for a lock. */
+    if ((server.slowlog_log_slower_than >= 0 &&
+         duration >= server.slowlog_log_slower_than) ||
+        (server.latency_monitor_threshold &&
+         duration/1000 >= server.latency_monitor_threshold))
+    {
+        pthread_mutex_lock(&io_threads_slowlog_mutex);
+        latencyAddSampleIfNeeded("fast-command",duration/1000);
+        slowlogPushEntryIfNeeded(c,c->argv,c->argc,duration);
+        pthread_mutex_unlock(&io_threads_slowlog_mutex);
+    }
+    return C_OK;
+}
+
+/* With io-threads-shard-by-slot each I/O thread owns a range of the hash
+ * slots, and serves the clients whose last command used a key in its range:
+ * the keys of a slot are then always accessed from the same thread, and so
+ * from the same node when the threads follow a Popcorn schedule. Commands
+ * with keys in many slots are run by the main thread as usual, and clients
+ * that didn't use keys yet are spread evenly across the threads. */
+void clientTrackShardSlot(client *c) {
+    int firstkey = c->cmd->firstkey;
+    robj *key;
+
+    if (c->slot >= 0) {
+        c->shard_slot = c->slot;
+        return;
+    }
+    if (firstkey <= 0 || firstkey >= c->argc) return;
+    key = c->argv[firstkey];
+    if (sdsEncodedObject(key))
+        c->shard_slot = keyHashSlot(key->ptr,sdslen(key->ptr));
+}
+
+/* Return the I/O thread that should serve the client 'c', that is the
+ * 'item_id'-th client in the list to handle. */
+static int ioThreadOfClient(client *c, int item_id) {
+    if (server.io_threads_shard_by_slot && c->shard_slot != -1)
+        return (long)c->shard_slot*server.io_threads_num/CLUSTER_SLOTS;
+    return item_id % server.io_threads_num;
+}
+
+/* Add the stats of the commands the I/O threads ran to the server ones. */
+static void ioThreadsMergeStats(void) {
+    for (int i = 0; i < server.io_threads_num; i++) {
+        ioThreadStats *st = io_threads_stats+i;
+
+        server.stat_numcommands += st->numcommands;
+        server.stat_io_threaded_commands += st->numcommands;
+        server.stat_keyspace_hits += st->keyspace_hits;
+        server.stat_keyspace_misses += st->keyspace_misses;
+        for (int j = 0; j < st->numcmds; j++) {
+            st->cmds[j].cmd->calls += st->cmds[j].calls;
+            st->cmds[j].cmd->microseconds += st->cmds[j].microseconds;
+        }
+        st->numcommands = st->keyspace_hits = st->keyspace_misses = 0;
+        st->numcmds = 0;
+    }
+}
+
+/* Move the I/O thread 'id' to the node its batches run on: the one the
+ * Popcorn schedule assigns to it, otherwise io-threads-node if set,
+ * otherwise it stays where it is. '*nid' is the node the thread runs on. */
+static void ioThreadFollowNode(long id, int *nid) {
+    int dflt = server.io_threads_node >= 0 ? server.io_threads_node : *nid;
+
+    popcornMoveThread(POPCORN_REGION_IO_THREADS,
+        popcorn_schedule_node(POPCORN_REGION_IO_THREADS,id,dflt),nid);
+}
 
 void *IOThreadMain(void *myid) {
     /* The ID is the thread number (from 0 to server.iothreads_num-1), and is
      * used by the thread to just manipulate a single sub-array of clients. */
     long id = (unsigned long)myid;
+    int nid = 0; /* Threads start on the home node. */
+    char arena[16];
+    ioThread *t = &io_threads_state[id].t;
+
+    /* Leave the home node right away, so that the thread and its arena
+     * are in place before the first batch. */
+    ioThreadFollowNode(id,&nid);
 
+    io_thread_stats = io_threads_stats+id;
+    snprintf(arena,sizeof(arena),"io%ld",id);
+    serverThreadArenaInit(arena);
+
+    t->spin_budget = server.io_threads_spin;
     while(1) {
-        /* Wait for start */
-        for (int j = 0; j < 1000000; j++) {
-            if (io_threads_pending[id] != 0) break;
+        /* Wait for start: poll for a while, then park. */
+        long long start = ustime(), budget = t->spin_budget;
+        for (int j = 0; j < budget; j++) {
+            if (t->pending != 0) break;
         }
+        t->spin_usec += ustime()-start;
 
-        /* Give the main thread a chance to stop this thread. */
-        if (io_threads_pending[id] == 0) {
-            pthread_mutex_lock(&io_threads_mutex[id]);
-            pthread_mutex_unlock(&io_threads_mutex[id]);
-            continue;
+        if (t->pending != 0) {
+            budget *= 2;
+        } else {
+            /* The main thread checks 'parked' after setting 'pending', and
+             * holds the mutex while this thread is stopped. */
+            start = ustime();
+            pthread_mutex_lock(&t->mutex);
+            t->parked = 1;
+            while (t->pending == 0) pthread_cond_wait(&t->cond,&t->mutex);
+            t->parked = 0;
+            pthread_mutex_unlock(&t->mutex);
+            t->parked_usec += ustime()-start;
+            t->parks++;
+            budget /= 2;
         }
+        if (budget < IO_THREADS_SPIN_MIN) budget = IO_THREADS_SPIN_MIN;
+        if (budget > server.io_threads_spin) budget = server.io_threads_spin;
+        t->spin_budget = budget;
 
-        serverAssert(io_threads_pending[id] != 0);
+        serverAssert(t->pending != 0);
 
-        if (tio_debug) printf("[%ld] %d to handle\n", id, (int)listLength(io_threads_list[id]));
+        /* Run the batch where the schedule or io-threads-node want us. */
+        ioThreadFollowNode(id,&nid);
+
+        if (tio_debug) printf("[%ld] %d to handle\n", id, (int)listLength(&t->clients));
 
         /* Process: note that the main thread will never touch our list
-         * before we drop the pending count to 0. */
+         * before we drop the pending count to 0. It empties the list then,
+         * freeing the nodes where it allocated them. */
         listIter li;
         listNode *ln;
-        listRewind(io_threads_list[id],&li);
+        listRewind(&t->clients,&li);
         while((ln = listNext(&li))) {
             client *c = listNodeValue(ln);
-            if (io_threads_op == IO_THREADS_OP_WRITE) {
+            if (t->op == IO_THREADS_OP_WRITE) {
                 writeToClient(c->fd,c,0);
-            } else if (io_threads_op == IO_THREADS_OP_READ) {
+            } else if (t->op == IO_THREADS_OP_READ) {
                 readQueryFromClient(NULL,c->fd,c,0);
             } else {
                 serverPanic("io_threads_op value is unknown");
             }
         }
-        listEmpty(io_threads_list[id]);
-        io_threads_pending[id] = 0;
+        t->pending = 0;
 
         if (tio_debug) printf("[%ld] Done\n", id);
     }
@@ -2588,10 +3577,11 @@ void initThreadedIO(void) {
     /* Spawn the I/O threads. */
     for (int i = 0; i < server.io_threads_num; i++) {
         pthread_t tid;
-        pthread_mutex_init(&io_threads_mutex[i],NULL);
-        io_threads_pending[i] = 0;
-        io_threads_list[i] = listCreate();
-        pthread_mutex_lock(&io_threads_mutex[i]); /* Thread will be stopped. */
+        pthread_mutex_init(io_threads_mutex(i),NULL);
+        pthread_cond_init(&io_threads_state[i].t.cond,NULL);
+        io_threads_pending(i) = 0;
+        memset(io_threads_list(i),0,sizeof(list));
+        pthread_mutex_lock(io_threads_mutex(i)); /* Thread will be stopped. */
         if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)i) != 0) {
             serverLog(LL_WARNING,"Fatal: Can't initialize IO thread.");
             exit(1);
@@ -2600,12 +3590,42 @@ void initThreadedIO(void) {
     }
 }
 
+/* Give the I/O thread 't' its pending count, waking it up if it parked. */
+static void setIOThreadPending(ioThread *t, int op, unsigned long count) {
+    t->op = op;
+    t->pending = count;
+    if (count && t->parked) {
+        pthread_mutex_lock(&t->mutex);
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&t->mutex);
+    }
+}
+
+/* The "iothreads" section of INFO. The parked time of a thread parked now
+ * is added when it wakes up. */
+sds genIOThreadsInfoString(sds info) {
+    info = sdscatprintf(info,
+        "io_threads_active:%d\r\n"
+        "io_threads_spin:%d\r\n",
+        io_threads_active, server.io_threads_spin);
+    if (server.io_threads_num == 1) return info;
+    for (int j = 0; j < server.io_threads_num; j++) {
+        ioThread *t = &io_threads_state[j].t;
+        info = sdscatprintf(info,
+            "io_thread_%d:spin_usec=%lld,parked_usec=%lld,parks=%lld,"
+            "spin_budget=%d,parked=%d\r\n",
+            j, (long long)t->spin_usec, (long long)t->parked_usec,
+            (long long)t->parks, (int)t->spin_budget, (int)t->parked);
+    }
+    return info;
+}
+
 void startThreadedIO(void) {
     if (tio_debug) { printf("S"); fflush(stdout); }
     if (tio_debug) printf("--- STARTING THREADED IO ---\n");
     serverAssert(io_threads_active == 0);
     for (int j = 0; j < server.io_threads_num; j++)
-        pthread_mutex_unlock(&io_threads_mutex[j]);
+        pthread_mutex_unlock(io_threads_mutex(j));
     io_threads_active = 1;
 }
 
@@ -2619,7 +3639,7 @@ void stopThreadedIO(void) {
         (int) listLength(server.clients_pending_write));
     serverAssert(io_threads_active == 1);
     for (int j = 0; j < server.io_threads_num; j++)
-        pthread_mutex_lock(&io_threads_mutex[j]);
+        pthread_mutex_lock(io_threads_mutex(j));
     io_threads_active = 0;
 }
 
@@ -2669,26 +3689,32 @@ int handleClientsWithPendingWritesUsingThreads(void) {
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
         c->flags &= ~CLIENT_PENDING_WRITE;
-        int target_id = item_id % server.io_threads_num;
-        listAddNodeTail(io_threads_list[target_id],c);
+
+        /* The slaves move their references into the shared replication
+         * buffer as they write, releasing blocks: they are written below
+         * by the main thread. */
+        if (getClientType(c) == CLIENT_TYPE_SLAVE) continue;
+        int target_id = ioThreadOfClient(c,item_id);
+        listAddNodeTail(io_threads_list(target_id),c);
         item_id++;
     }
 
     /* Give the start condition to the waiting threads, by setting the
      * start condition atomic var. */
-    io_threads_op = IO_THREADS_OP_WRITE;
     for (int j = 0; j < server.io_threads_num; j++) {
-        int count = listLength(io_threads_list[j]);
-        io_threads_pending[j] = count;
+        int count = listLength(io_threads_list(j));
+        setIOThreadPending(&io_threads_state[j].t,IO_THREADS_OP_WRITE,count);
     }
 
     /* Wait for all threads to end their work. */
     while(1) {
         unsigned long pending = 0;
         for (int j = 0; j < server.io_threads_num; j++)
-            pending += io_threads_pending[j];
+            pending += io_threads_pending(j);
         if (pending == 0) break;
     }
+    for (int j = 0; j < server.io_threads_num; j++)
+        listEmpty(io_threads_list(j));
     if (tio_debug) printf("I/O WRITE All threads finshed\n");
 
     /* Run the list of clients again to install the write handler where
@@ -2697,6 +3723,10 @@ int handleClientsWithPendingWritesUsingThreads(void) {
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
 
+        if (getClientType(c) == CLIENT_TYPE_SLAVE &&
+            writeToClient(c->fd,c,0) == C_ERR) continue;
+        resumeClientReading(c);
+
         /* Install the write handler if there are pending writes in some
          * of the clients. */
         if (clientHasPendingReplies(c) &&
@@ -2731,8 +3761,8 @@ int postponeClientRead(client *c) {
  * readable handler will just put normal clients into a queue of clients to
  * process (instead of serving them synchronously). This function runs
  * the queue using the I/O threads, and process them in order to accumulate
- * the reads in the buffers, and also parse the first command available
- * rendering it in the client structures. */
+ * the reads in the buffers, and also parse the commands available, queued
+ * in the client structures for the main thread to run. */
 int handleClientsWithPendingReadsUsingThreads(void) {
     if (!io_threads_active || !server.io_threads_do_reads) return 0;
     int processed = listLength(server.clients_pending_read);
@@ -2747,37 +3777,53 @@ int handleClientsWithPendingReadsUsingThreads(void) {
     int item_id = 0;
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
-        int target_id = item_id % server.io_threads_num;
-        listAddNodeTail(io_threads_list[target_id],c);
+        int target_id = ioThreadOfClient(c,item_id);
+        listAddNodeTail(io_threads_list(target_id),c);
         item_id++;
     }
 
+    /* Let the threads run the commands they can: until they are done the
+     * keyspace is read only. */
+    if (ioThreadsCanRunCommands()) {
+        server.keyspace_readonly = 1;
+        dictDisableRehashSteps();
+    }
+
     /* Give the start condition to the waiting threads, by setting the
      * start condition atomic var. */
-    io_threads_op = IO_THREADS_OP_READ;
     for (int j = 0; j < server.io_threads_num; j++) {
-        int count = listLength(io_threads_list[j]);
-        io_threads_pending[j] = count;
+        int count = listLength(io_threads_list(j));
+        setIOThreadPending(&io_threads_state[j].t,IO_THREADS_OP_READ,count);
     }
 
     /* Wait for all threads to end their work. */
     while(1) {
         unsigned long pending = 0;
         for (int j = 0; j < server.io_threads_num; j++)
-            pending += io_threads_pending[j];
+            pending += io_threads_pending(j);
         if (pending == 0) break;
     }
+    for (int j = 0; j < server.io_threads_num; j++)
+        listEmpty(io_threads_list(j));
     if (tio_debug) printf("I/O READ All threads finshed\n");
 
+    if (server.keyspace_readonly) {
+        server.keyspace_readonly = 0;
+        dictEnableRehashSteps();
+        ioThreadsMergeStats();
+    }
+
     /* Run the list of clients again to process the new buffers. */
     listRewind(server.clients_pending_read,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
         c->flags &= ~CLIENT_PENDING_READ;
-        if (c->flags & CLIENT_PENDING_COMMAND) {
-            c->flags &= ~ CLIENT_PENDING_COMMAND;
-            processCommandAndResetClient(c);
-        }
+        /* Replies of commands the thread ran. */
+        if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+        /* Run the commands the threads queued, then whatever is left in
+         * the query buffer. A blocked client keeps the flag for the command
+         * waiting for module key locks. */
+        if (!(c->flags & CLIENT_BLOCKED)) c->flags &= ~CLIENT_PENDING_COMMAND;
         processInputBufferAndReplicate(c);
     }
     listEmpty(server.clients_pending_read);
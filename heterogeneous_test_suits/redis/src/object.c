@@ -251,9 +251,15 @@ robj *createZsetObject(void) {
     robj *o;
 
     zs->dict = dictCreate(&zsetDictType,NULL);
-    zs->zsl = zslCreate();
+    if (server.zset_btree) {
+        zs->zsl = NULL;
+        zs->zbt = zbtCreate();
+    } else {
+        zs->zsl = zslCreate();
+        zs->zbt = NULL;
+    }
     o = createObject(OBJ_ZSET,zs);
-    o->encoding = OBJ_ENCODING_SKIPLIST;
+    o->encoding = server.zset_btree ? OBJ_ENCODING_BTREE : OBJ_ENCODING_SKIPLIST;
     return o;
 }
 
@@ -314,6 +320,12 @@ void freeZsetObject(robj *o) {
         zslFree(zs->zsl);
         zfree(zs);
         break;
+    case OBJ_ENCODING_BTREE:
+        zs = o->ptr;
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+        zfree(zs);
+        break;
     case OBJ_ENCODING_ZIPLIST:
         zfree(o->ptr);
         break;
@@ -328,6 +340,7 @@ void freeHashObject(robj *o) {
         dictRelease((dict*) o->ptr);
         break;
     case OBJ_ENCODING_ZIPLIST:
+    case OBJ_ENCODING_INTMAP:
         zfree(o->ptr);
         break;
     default:
@@ -741,6 +754,8 @@ char *strEncoding(int encoding) {
     case OBJ_ENCODING_ZIPLIST: return "ziplist";
     case OBJ_ENCODING_INTSET: return "intset";
     case OBJ_ENCODING_SKIPLIST: return "skiplist";
+    case OBJ_ENCODING_BTREE: return "btree";
+    case OBJ_ENCODING_INTMAP: return "intmap";
     case OBJ_ENCODING_EMBSTR: return "embstr";
     default: return "unknown";
     }
@@ -776,7 +791,6 @@ size_t streamRadixTreeMemoryUsage(rax *rax) {
  * Note that the returned value is just an approximation, especially in the
  * case of aggregated data types where only "sample_size" elements
  * are checked and averaged to estimate the total size. */
-#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
 size_t objectComputeSize(robj *o, size_t sample_size) {
     sds ele, ele2;
     dict *d;
@@ -842,12 +856,31 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
                 znode = znode->level[0].forward;
             }
             if (samples) asize += (double)elesize/samples*dictSize(d);
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
+            d = ((zset*)o->ptr)->dict;
+            zbtree *zbt = ((zset*)o->ptr)->zbt;
+            zbtreeLeaf *leaf = zbt->head;
+            unsigned int j;
+            asize = sizeof(*o)+sizeof(zset)+sizeof(*zbt)+
+                    zbt->nodes*zmalloc_size(leaf)+
+                    (sizeof(struct dictEntry*)*dictSlots(d));
+            while(leaf != NULL && samples < sample_size) {
+                for (j = 0; j < leaf->count && samples < sample_size; j++) {
+                    elesize += sdsAllocSize(leaf->ele[j]);
+                    elesize += sizeof(struct dictEntry);
+                    samples++;
+                }
+                leaf = leaf->next;
+            }
+            if (samples) asize += (double)elesize/samples*dictSize(d);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
         if (o->encoding == OBJ_ENCODING_ZIPLIST) {
             asize = sizeof(*o)+(ziplistBlobLen(o->ptr));
+        } else if (o->encoding == OBJ_ENCODING_INTMAP) {
+            asize = sizeof(*o)+zmalloc_size(o->ptr);
         } else if (o->encoding == OBJ_ENCODING_HT) {
             d = o->ptr;
             di = dictGetIterator(d);
@@ -977,13 +1010,15 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
 
     mem_total += server.initial_memory_usage;
 
-    mem = 0;
+    /* The replication buffer is backlog up to the backlog size, the rest
+     * is output of the slaves. */
+    mem = server.repl_buffer_mem - replicationBufferNotCountedMemory();
     if (server.repl_backlog)
         mem += zmalloc_size(server.repl_backlog);
     mh->repl_backlog = mem;
     mem_total += mem;
 
-    mem = 0;
+    mem = replicationBufferNotCountedMemory();
     if (listLength(server.slaves)) {
         listIter li;
         listNode *ln;
@@ -991,9 +1026,15 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         listRewind(server.slaves,&li);
         while((ln = listNext(&li))) {
             client *c = listNodeValue(ln);
-            mem += getClientOutputBufferMemoryUsage(c);
-            mem += sdsAllocSize(c->querybuf);
-            mem += sizeof(client);
+            size_t obuf = getClientOutputBufferMemoryUsage(c) -
+                          getClientReplBufferMemoryUsage(c);
+            size_t cmem = obuf + sdsAllocSize(c->querybuf) + sizeof(client);
+
+            if (c->buf) cmem += PROTO_REPLY_CHUNK_BYTES;
+            mem += cmem;
+            mh->clients_class_count[CLIENT_TYPE_SLAVE]++;
+            mh->clients_class[CLIENT_TYPE_SLAVE] += cmem;
+            mh->clients_class_obuf[CLIENT_TYPE_SLAVE] += obuf;
         }
     }
     mh->clients_slaves = mem;
@@ -1009,9 +1050,15 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
             client *c = listNodeValue(ln);
             if (c->flags & CLIENT_SLAVE && !(c->flags & CLIENT_MONITOR))
                 continue;
-            mem += getClientOutputBufferMemoryUsage(c);
-            mem += sdsAllocSize(c->querybuf);
-            mem += sizeof(client);
+            size_t obuf = getClientOutputBufferMemoryUsage(c);
+            size_t cmem = obuf + sdsAllocSize(c->querybuf) + sizeof(client);
+            int class = getClientType(c);
+
+            if (c->buf) cmem += PROTO_REPLY_CHUNK_BYTES;
+            mem += cmem;
+            mh->clients_class_count[class]++;
+            mh->clients_class[class] += cmem;
+            mh->clients_class_obuf[class] += obuf;
         }
     }
     mh->clients_normal = mem;
@@ -1020,7 +1067,6 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
     mem = 0;
     if (server.aof_state != AOF_OFF) {
         mem += sdsalloc(server.aof_buf);
-        mem += aofRewriteBufferSize();
     }
     mh->aof_buffer = mem;
     mem_total+=mem;
@@ -1046,14 +1092,12 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         mh->db = zrealloc(mh->db,sizeof(mh->db[0])*(mh->num_dbs+1));
         mh->db[mh->num_dbs].dbid = j;
 
-        mem = dictSize(db->dict) * sizeof(dictEntry) +
-              dictSlots(db->dict) * sizeof(dictEntry*) +
+        mem = dictMemUsage(db->dict) +
               dictSize(db->dict) * sizeof(robj);
         mh->db[mh->num_dbs].overhead_ht_main = mem;
         mem_total+=mem;
 
-        mem = dictSize(db->expires) * sizeof(dictEntry) +
-              dictSlots(db->expires) * sizeof(dictEntry*);
+        mem = dictMemUsage(db->expires);
         mh->db[mh->num_dbs].overhead_ht_expires = mem;
         mem_total+=mem;
 
@@ -1304,6 +1348,9 @@ void memoryCommand(client *c) {
 "PURGE -- Attempt to purge dirty pages for reclamation by the allocator.",
 "STATS -- Return information about the memory usage of the server.",
 "USAGE <key> [SAMPLES <count>] -- Return memory in bytes used by <key> and its value. Nested values are sampled up to <count> times (default: 5).",
+"ANALYZE START [SEPARATOR <char>] [DEPTH <n>] [TOP <n>] [THREADS <n>] [SAMPLES <count>] -- Aggregate the memory used by the keys per type and key prefix in a background child.",
+"ANALYZE RESULT -- Return the report of the last background analysis.",
+"ANALYZE ABORT -- Stop the background analysis in progress.",
 NULL
         };
         addReplyHelp(c, help);
@@ -1335,6 +1382,8 @@ NULL
         usage += sdsAllocSize(dictGetKey(de));
         usage += sizeof(dictEntry);
         addReplyLongLong(c,usage);
+    } else if (!strcasecmp(c->argv[1]->ptr,"analyze") && c->argc >= 3) {
+        memoryAnalyzeCommand(c);
     } else if (!strcasecmp(c->argv[1]->ptr,"stats") && c->argc == 2) {
         struct redisMemOverhead *mh = getMemoryOverheadData();
 
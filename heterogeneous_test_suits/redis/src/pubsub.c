@@ -134,6 +134,69 @@ int listMatchPubsubPattern(void *a, void *b) {
            (equalStringObjects(pa->pattern,pb->pattern));
 }
 
+/* Patterns are indexed by their literal prefix, the part before the first
+ * glob special character: any channel matching the pattern starts with it.
+ * To publish we only try the patterns whose prefix is a prefix of the
+ * channel, instead of every pattern of every client. */
+static size_t pubsubPatternPrefixLen(sds pattern) {
+    return strcspn(pattern,"*?[\\");
+}
+
+/* An entry of the lists of the prefix index: the pattern is compiled once,
+ * when the first client subscribes to it, not at every message. */
+typedef struct pubsubIndexedPattern {
+    robj *pattern;
+    stringmatchPattern *matcher;
+} pubsubIndexedPattern;
+
+/* Add the pattern to the prefix index. Called once per distinct pattern,
+ * with the key object of server.pubsub_patterns_dict: the lists of the index
+ * are searched by pointer. The max prefix length is never lowered, it just
+ * bounds the lookups of pubsubPublishMessage(). */
+static void pubsubIndexPattern(robj *pattern) {
+    size_t len = pubsubPatternPrefixLen(pattern->ptr);
+    list *patterns = raxFind(server.pubsub_pattern_prefixes,
+                             pattern->ptr,len);
+    pubsubIndexedPattern *ip = zmalloc(sizeof(*ip));
+
+    if (patterns == raxNotFound) {
+        patterns = listCreate();
+        raxInsert(server.pubsub_pattern_prefixes,pattern->ptr,len,
+                  patterns,NULL);
+    }
+    ip->pattern = pattern;
+    ip->matcher = stringmatchCompile(pattern->ptr,sdslen(pattern->ptr),0);
+    listAddNodeTail(patterns,ip);
+    if (len > server.pubsub_pattern_prefix_maxlen)
+        server.pubsub_pattern_prefix_maxlen = len;
+}
+
+/* Remove the pattern from the prefix index, once no client is subscribed
+ * to it anymore. */
+static void pubsubUnindexPattern(robj *pattern) {
+    size_t len = pubsubPatternPrefixLen(pattern->ptr);
+    list *patterns = raxFind(server.pubsub_pattern_prefixes,
+                             pattern->ptr,len);
+    pubsubIndexedPattern *ip = NULL;
+    listNode *ln;
+    listIter li;
+
+    serverAssert(patterns != raxNotFound);
+    listRewind(patterns,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        ip = ln->value;
+        if (ip->pattern == pattern) break;
+    }
+    serverAssert(ln != NULL);
+    stringmatchFree(ip->matcher);
+    zfree(ip);
+    listDelNode(patterns,ln);
+    if (listLength(patterns) == 0) {
+        raxRemove(server.pubsub_pattern_prefixes,pattern->ptr,len,NULL);
+        listRelease(patterns);
+    }
+}
+
 /* Return the number of channels + patterns a client is subscribed to. */
 int clientSubscriptionsCount(client *c) {
     return dictSize(c->pubsub_channels)+
@@ -213,6 +276,18 @@ int pubsubSubscribePattern(client *c, robj *pattern) {
         pat->pattern = getDecodedObject(pattern);
         pat->client = c;
         listAddNodeTail(server.pubsub_patterns,pat);
+        /* Add the client to the pattern -> list of clients hash table */
+        dictEntry *de = dictFind(server.pubsub_patterns_dict,pat->pattern);
+        list *clients;
+        if (de == NULL) {
+            clients = listCreate();
+            dictAdd(server.pubsub_patterns_dict,pat->pattern,clients);
+            incrRefCount(pat->pattern);
+            pubsubIndexPattern(pat->pattern);
+        } else {
+            clients = dictGetVal(de);
+        }
+        listAddNodeTail(clients,c);
     }
     /* Notify the client */
     addReplyPubsubPatSubscribed(c,pattern);
@@ -234,6 +309,18 @@ int pubsubUnsubscribePattern(client *c, robj *pattern, int notify) {
         pat.pattern = pattern;
         ln = listSearchKey(server.pubsub_patterns,&pat);
         listDelNode(server.pubsub_patterns,ln);
+        /* Remove the client from the pattern -> clients list hash table */
+        dictEntry *de = dictFind(server.pubsub_patterns_dict,pattern);
+        serverAssertWithInfo(c,NULL,de != NULL);
+        list *clients = dictGetVal(de);
+        ln = listSearchKey(clients,c);
+        serverAssertWithInfo(c,NULL,ln != NULL);
+        listDelNode(clients,ln);
+        if (listLength(clients) == 0) {
+            /* The index references the key of the entry: unindex first. */
+            pubsubUnindexPattern(dictGetKey(de));
+            dictDelete(server.pubsub_patterns_dict,pattern);
+        }
     }
     /* Notify the client */
     if (notify) addReplyPubsubPatUnsubscribed(c,pattern);
@@ -276,42 +363,106 @@ int pubsubUnsubscribeAllPatterns(client *c, int notify) {
     return count;
 }
 
+/* Append 'o' as a bulk string to the protocol in 's'. */
+static sds pubsubCatBulk(sds s, robj *o) {
+    o = getDecodedObject(o);
+    s = sdscatfmt(s,"$%U\r\n",(unsigned long long)sdslen(o->ptr));
+    s = sdscatsds(s,o->ptr);
+    s = sdscatlen(s,"\r\n",2);
+    decrRefCount(o);
+    return s;
+}
+
+/* Encode the "message" (or "pmessage" if 'pat' is not NULL) the clients
+ * using the protocol 'resp' receive. */
+static robj *pubsubEncodeMessage(int resp, robj *pat, robj *channel,
+                                 robj *msg)
+{
+    sds s = sdsnew(resp == 2 ? "*" : ">");
+
+    s = sdscatfmt(s,"%i\r\n",pat ? 4 : 3);
+    if (pat) {
+        s = sdscatsds(s,shared.pmessagebulk->ptr);
+        s = pubsubCatBulk(s,pat);
+    } else {
+        s = sdscatsds(s,shared.messagebulk->ptr);
+    }
+    s = pubsubCatBulk(s,channel);
+    s = pubsubCatBulk(s,msg);
+    return createObject(OBJ_STRING,s);
+}
+
+/* Send the message to the clients of the list, that subscribed to the
+ * channel or, if 'pat' is not NULL, to the pattern 'pat'. With more than one
+ * client the message is encoded once per protocol version, and every client
+ * gets the same encoded reply: copied in one go, or just referenced if large,
+ * see addReplyProtoObject(). Returns the number of clients. */
+static int pubsubDeliverMessage(list *clients, robj *pat, robj *channel,
+                                robj *msg)
+{
+    robj *encoded[2] = {NULL, NULL}; /* RESP2, RESP3. */
+    listNode *ln;
+    listIter li;
+    int j;
+
+    if (listLength(clients) == 1) {
+        client *c = listNodeValue(listFirst(clients));
+        if (pat)
+            addReplyPubsubPatMessage(c,pat,channel,msg);
+        else
+            addReplyPubsubMessage(c,channel,msg);
+        return 1;
+    }
+
+    listRewind(clients,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        client *c = ln->value;
+        int idx = c->resp == 2 ? 0 : 1;
+
+        if (encoded[idx] == NULL)
+            encoded[idx] = pubsubEncodeMessage(c->resp,pat,channel,msg);
+        addReplyProtoObject(c,encoded[idx]);
+    }
+    for (j = 0; j < 2; j++) if (encoded[j]) decrRefCount(encoded[j]);
+    return listLength(clients);
+}
+
 /* Publish a message */
 int pubsubPublishMessage(robj *channel, robj *message) {
     int receivers = 0;
     dictEntry *de;
-    listNode *ln;
-    listIter li;
 
     /* Send to clients listening for that channel */
     de = dictFind(server.pubsub_channels,channel);
-    if (de) {
-        list *list = dictGetVal(de);
-        listNode *ln;
-        listIter li;
-
-        listRewind(list,&li);
-        while ((ln = listNext(&li)) != NULL) {
-            client *c = ln->value;
-            addReplyPubsubMessage(c,channel,message);
-            receivers++;
-        }
-    }
-    /* Send to clients listening to matching channels */
-    if (listLength(server.pubsub_patterns)) {
-        listRewind(server.pubsub_patterns,&li);
-        channel = getDecodedObject(channel);
-        while ((ln = listNext(&li)) != NULL) {
-            pubsubPattern *pat = ln->value;
+    if (de) receivers += pubsubDeliverMessage(dictGetVal(de),NULL,
+                                              channel,message);
 
-            if (stringmatchlen((char*)pat->pattern->ptr,
-                                sdslen(pat->pattern->ptr),
-                                (char*)channel->ptr,
-                                sdslen(channel->ptr),0))
-            {
-                addReplyPubsubPatMessage(pat->client,
-                    pat->pattern,channel,message);
-                receivers++;
+    /* Send to clients listening to matching channels: only the patterns
+     * whose literal prefix is a prefix of the channel can match it. */
+    if (dictSize(server.pubsub_patterns_dict)) {
+        size_t len, maxlen;
+
+        channel = getDecodedObject(channel);
+        maxlen = sdslen(channel->ptr);
+        if (maxlen > server.pubsub_pattern_prefix_maxlen)
+            maxlen = server.pubsub_pattern_prefix_maxlen;
+        for (len = 0; len <= maxlen; len++) {
+            list *patterns = raxFind(server.pubsub_pattern_prefixes,
+                                     channel->ptr,len);
+            listNode *ln;
+            listIter li;
+
+            if (patterns == raxNotFound) continue;
+            listRewind(patterns,&li);
+            while ((ln = listNext(&li)) != NULL) {
+                pubsubIndexedPattern *ip = ln->value;
+                robj *pat = ip->pattern;
+
+                if (!stringmatchPatternMatch(ip->matcher,channel->ptr,
+                                             sdslen(channel->ptr))) continue;
+                de = dictFind(server.pubsub_patterns_dict,pat);
+                receivers += pubsubDeliverMessage(dictGetVal(de),pat,
+                                                  channel,message);
             }
         }
         decrRefCount(channel);
@@ -387,24 +538,27 @@ NULL
     {
         /* PUBSUB CHANNELS [<pattern>] */
         sds pat = (c->argc == 2) ? NULL : c->argv[2]->ptr;
+        stringmatchPattern *matcher = NULL;
         dictIterator *di = dictGetIterator(server.pubsub_channels);
         dictEntry *de;
         long mblen = 0;
         void *replylen;
 
+        if (pat) matcher = stringmatchCompile(pat,sdslen(pat),0);
         replylen = addReplyDeferredLen(c);
         while((de = dictNext(di)) != NULL) {
             robj *cobj = dictGetKey(de);
             sds channel = cobj->ptr;
 
-            if (!pat || stringmatchlen(pat, sdslen(pat),
-                                       channel, sdslen(channel),0))
+            if (!pat || stringmatchPatternMatch(matcher,channel,
+                                                sdslen(channel)))
             {
                 addReplyBulk(c,cobj);
                 mblen++;
             }
         }
         dictReleaseIterator(di);
+        if (matcher) stringmatchFree(matcher);
         setDeferredArrayLen(c,replylen,mblen);
     } else if (!strcasecmp(c->argv[1]->ptr,"numsub") && c->argc >= 2) {
         /* PUBSUB NUMSUB [Channel_1 ... Channel_N] */
@@ -33,7 +33,7 @@
 #include "zmalloc.h"
 #include "ziplist.h"
 #include "util.h" /* for ll2string */
-#include "lzf.h"
+#include "compress.h"
 
 #if defined(REDIS_TEST) || defined(REDIS_TEST_VERBOSE)
 #include <stdio.h> /* for printf (debug printing), snprintf (genstr) */
@@ -172,6 +172,14 @@ void quicklistRelease(quicklist *quicklist) {
     zfree(quicklist);
 }
 
+/* Codec of the nodes compressed from now on. The nodes compressed before
+ * keep their own, see quicklistLZF. */
+static int quicklist_codec = COMPRESS_LZF;
+
+void quicklistSetCompressCodec(int codec) {
+    quicklist_codec = codec;
+}
+
 /* Compress the ziplist in 'node' and update encoding details.
  * Returns 1 if ziplist compressed successfully.
  * Returns 0 if compression failed or if ziplist too small to compress. */
@@ -187,10 +195,11 @@ REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
     quicklistLZF *lzf = zmalloc(sizeof(*lzf) + node->sz);
 
     /* Cancel if compression fails or doesn't compress small enough */
-    if (((lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed,
-                                 node->sz)) == 0) ||
+    lzf->codec = quicklist_codec;
+    if (((lzf->sz = compressData(lzf->codec, node->zl, node->sz,
+                                 lzf->compressed, node->sz)) == 0) ||
         lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
-        /* lzf_compress aborts/rejects compression if value not compressable. */
+        /* compressData aborts/rejects compression if value not compressable. */
         zfree(lzf);
         return 0;
     }
@@ -219,7 +228,8 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 
     void *decompressed = zmalloc(node->sz);
     quicklistLZF *lzf = (quicklistLZF *)node->zl;
-    if (lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
+    if (decompressData(lzf->codec, lzf->compressed, lzf->sz, decompressed,
+                       node->sz) == 0) {
         /* Someone requested decompress, but we can't decompress.  Not good. */
         zfree(decompressed);
         return 0;
@@ -256,6 +266,11 @@ size_t quicklistGetLzf(const quicklistNode *node, void **data) {
     return lzf->sz;
 }
 
+/* Return the codec of the compressed data of this quicklistNode. */
+int quicklistGetCodec(const quicklistNode *node) {
+    return ((quicklistLZF *)node->zl)->codec;
+}
+
 #define quicklistAllowsCompression(_ql) ((_ql)->compress != 0)
 
 /* Force 'quicklist' to meet compression guidelines set by compress depth.
@@ -54,13 +54,16 @@ typedef struct quicklistNode {
     unsigned int extra : 10; /* more bits to steal for future usage */
 } quicklistNode;
 
-/* quicklistLZF is a 4+N byte struct holding 'sz' followed by 'compressed'.
+/* quicklistLZF is a 8+N byte struct holding 'sz' and 'codec' followed by
+ * 'compressed'.
  * 'sz' is byte length of 'compressed' field.
- * 'compressed' is LZF data with total (compressed) length 'sz'
+ * 'codec' is the COMPRESS_* codec (see compress.h) that produced it.
+ * 'compressed' is the compressed data with total length 'sz'
  * NOTE: uncompressed length is stored in quicklistNode->sz.
  * When quicklistNode->zl is compressed, node->zl points to a quicklistLZF */
 typedef struct quicklistLZF {
-    unsigned int sz; /* LZF size in bytes*/
+    unsigned int sz; /* Compressed size in bytes*/
+    unsigned int codec;
     char compressed[];
 } quicklistLZF;
 
@@ -157,6 +160,8 @@ int quicklistPop(quicklist *quicklist, int where, unsigned char **data,
 unsigned long quicklistCount(const quicklist *ql);
 int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len);
 size_t quicklistGetLzf(const quicklistNode *node, void **data);
+int quicklistGetCodec(const quicklistNode *node);
+void quicklistSetCompressCodec(int codec);
 
 #ifdef REDIS_TEST
 int quicklistTest(int argc, char *argv[]);
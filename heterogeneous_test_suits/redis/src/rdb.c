@@ -28,10 +28,11 @@
  */
 
 #include "server.h"
-#include "lzf.h"    /* LZF compression library */
+#include "compress.h" /* LZF, LZ4 and zstd codecs */
 #include "zipmap.h"
 #include "endianconv.h"
 #include "stream.h"
+#include "fpconv_dtoa.h"
 
 #include <math.h>
 #include <sys/types.h>
@@ -313,13 +314,32 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value,enc);
 }
 
-ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
-                       size_t original_len) {
+/* Map a COMPRESS_* codec to its RDB string encoding, and back. */
+static int rdbCodecEncoding(int codec) {
+    switch(codec) {
+    case COMPRESS_LZ4: return RDB_ENC_LZ4;
+    case COMPRESS_ZSTD: return RDB_ENC_ZSTD;
+    default: return RDB_ENC_LZF;
+    }
+}
+
+static int rdbEncodingCodec(int enc) {
+    switch(enc) {
+    case RDB_ENC_LZ4: return COMPRESS_LZ4;
+    case RDB_ENC_ZSTD: return COMPRESS_ZSTD;
+    default: return COMPRESS_LZF;
+    }
+}
+
+/* Save data compressed with 'codec'. The LZF encoding is the only one that
+ * older versions can load, the others need a server built with the codec. */
+ssize_t rdbSaveCompressedBlob(rio *rdb, int codec, void *data,
+                              size_t compress_len, size_t original_len) {
     unsigned char byte;
     ssize_t n, nwritten = 0;
 
     /* Data compressed! Let's save it on disk */
-    byte = (RDB_ENCVAL<<6)|RDB_ENC_LZF;
+    byte = (RDB_ENCVAL<<6)|rdbCodecEncoding(codec);
     if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
     nwritten += n;
 
@@ -338,7 +358,9 @@ writeerr:
     return -1;
 }
 
+/* Save the string compressed with the codec of rdb-compression-codec. */
 ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
+    int codec = server.rdb_compression_codec;
     size_t comprlen, outlen;
     void *out;
 
@@ -346,26 +368,33 @@ ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
     if (len <= 4) return 0;
     outlen = len-4;
     if ((out = zmalloc(outlen+1)) == NULL) return 0;
-    comprlen = lzf_compress(s, len, out, outlen);
+    comprlen = compressData(codec, s, len, out, outlen);
     if (comprlen == 0) {
         zfree(out);
         return 0;
     }
-    ssize_t nwritten = rdbSaveLzfBlob(rdb, out, comprlen, len);
+    ssize_t nwritten = rdbSaveCompressedBlob(rdb, codec, out, comprlen, len);
     zfree(out);
     return nwritten;
 }
 
-/* Load an LZF compressed string in RDB format. The returned value
- * changes according to 'flags'. For more info check the
+/* Load a string compressed with the codec of the RDB encoding 'enc'. The
+ * returned value changes according to 'flags'. For more info check the
  * rdbGenericLoadStringObject() function. */
-void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
+void *rdbLoadLzfStringObject(rio *rdb, int enc, int flags, size_t *lenptr) {
+    int codec = rdbEncodingCodec(enc);
     int plain = flags & RDB_LOAD_PLAIN;
     int sds = flags & RDB_LOAD_SDS;
     uint64_t len, clen;
     unsigned char *c = NULL;
     char *val = NULL;
 
+    if (!compressCodecAvailable(codec)) {
+        rdbExitReportCorruptRDB("String compressed with %s, which this "
+                                "server was built without",
+                                compressCodecName(codec));
+        return NULL; /* Never reached. */
+    }
     if ((clen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
     if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
     if ((c = zmalloc(clen)) == NULL) goto err;
@@ -380,8 +409,10 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
 
     /* Load the compressed representation and uncompress it to target. */
     if (rioRead(rdb,c,clen) == 0) goto err;
-    if (lzf_decompress(c,clen,val,len) == 0) {
-        if (rdbCheckMode) rdbCheckSetError("Invalid LZF compressed string");
+    if (decompressData(codec,c,clen,val,len) == 0) {
+        if (rdbCheckMode)
+            rdbCheckSetError("Invalid %s compressed string",
+                             compressCodecName(codec));
         goto err;
     }
     zfree(c);
@@ -415,7 +446,7 @@ ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len) {
         }
     }
 
-    /* Try LZF compression - under 20 bytes it's unable to compress even
+    /* Try compression - under 20 bytes it's unable to compress even
      * aaaaaaaaaaaaaaaaaa so skip it */
     if (server.rdb_compression && len > 20) {
         n = rdbSaveLzfStringObject(rdb,s,len);
@@ -493,7 +524,9 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
         case RDB_ENC_INT32:
             return rdbLoadIntegerObject(rdb,len,flags,lenptr);
         case RDB_ENC_LZF:
-            return rdbLoadLzfStringObject(rdb,flags,lenptr);
+        case RDB_ENC_LZ4:
+        case RDB_ENC_ZSTD:
+            return rdbLoadLzfStringObject(rdb,len,flags,lenptr);
         default:
             rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
         }
@@ -562,11 +595,10 @@ int rdbSaveDoubleValue(rio *rdb, double val) {
         double min = -4503599627370495; /* (2^52)-1 */
         double max = 4503599627370496; /* -(2^52) */
         if (val > min && val < max && val == ((double)((long long)val)))
-            ll2string((char*)buf+1,sizeof(buf)-1,(long long)val);
+            buf[0] = ll2string((char*)buf+1,sizeof(buf)-1,(long long)val);
         else
 #endif
-            snprintf((char*)buf+1,sizeof(buf)-1,"%.17g",val);
-        buf[0] = strlen((char*)buf+1);
+            buf[0] = fpconv_dtoa(val,(char*)buf+1);
         len = buf[0]+1;
     }
     return rdbWriteRaw(rdb,buf,len);
@@ -641,14 +673,16 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
     case OBJ_ZSET:
         if (o->encoding == OBJ_ENCODING_ZIPLIST)
             return rdbSaveType(rdb,RDB_TYPE_ZSET_ZIPLIST);
-        else if (o->encoding == OBJ_ENCODING_SKIPLIST)
+        else if (o->encoding == OBJ_ENCODING_SKIPLIST ||
+                 o->encoding == OBJ_ENCODING_BTREE)
             return rdbSaveType(rdb,RDB_TYPE_ZSET_2);
         else
             serverPanic("Unknown sorted set encoding");
     case OBJ_HASH:
         if (o->encoding == OBJ_ENCODING_ZIPLIST)
             return rdbSaveType(rdb,RDB_TYPE_HASH_ZIPLIST);
-        else if (o->encoding == OBJ_ENCODING_HT)
+        else if (o->encoding == OBJ_ENCODING_HT ||
+                 o->encoding == OBJ_ENCODING_INTMAP)
             return rdbSaveType(rdb,RDB_TYPE_HASH);
         else
             serverPanic("Unknown hash encoding");
@@ -768,10 +802,28 @@ ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key) {
             nwritten += n;
 
             while(node) {
-                if (quicklistNodeIsCompressed(node)) {
+                if (quicklistNodeIsCompressed(node) &&
+                    quicklistGetCodec(node) == server.rdb_compression_codec)
+                {
                     void *data;
                     size_t compress_len = quicklistGetLzf(node, &data);
-                    if ((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
+                    if ((n = rdbSaveCompressedBlob(rdb,server.rdb_compression_codec,data,compress_len,node->sz)) == -1) return -1;
+                    nwritten += n;
+                } else if (quicklistNodeIsCompressed(node)) {
+                    /* Compressed with another list-compress-codec: write it
+                     * with the codec of rdb-compression-codec instead. */
+                    void *data;
+                    size_t compress_len = quicklistGetLzf(node, &data);
+                    unsigned char *zl = zmalloc(node->sz);
+                    if (decompressData(quicklistGetCodec(node),data,
+                                       compress_len,zl,node->sz) == 0)
+                    {
+                        zfree(zl);
+                        return -1;
+                    }
+                    n = rdbSaveRawString(rdb,zl,node->sz);
+                    zfree(zl);
+                    if (n == -1) return -1;
                     nwritten += n;
                 } else {
                     if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1;
@@ -847,6 +899,30 @@ ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key) {
                 nwritten += n;
                 zn = zn->backward;
             }
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
+            zbtree *zbt = ((zset*)o->ptr)->zbt;
+            zbtreeIter it;
+
+            if ((n = rdbSaveLen(rdb,zbt->length)) == -1) return -1;
+            nwritten += n;
+
+            /* Same order as the skiplist: loading from the greatest to the
+             * smallest always inserts in the first leaf, that is split at
+             * its head, so the loaded tree has full leaves. */
+            if (zbtGetElementByRank(zbt,zbt->length,&it)) {
+                do {
+                    sds ele = zbtIterEle(&it);
+                    if ((n = rdbSaveRawString(rdb,
+                        (unsigned char*)ele,sdslen(ele))) == -1)
+                    {
+                        return -1;
+                    }
+                    nwritten += n;
+                    if ((n = rdbSaveBinaryDoubleValue(rdb,
+                        zbtIterScore(&it))) == -1) return -1;
+                    nwritten += n;
+                } while(zbtPrev(&it));
+            }
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -888,6 +964,21 @@ ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key) {
                 nwritten += n;
             }
             dictReleaseIterator(di);
+        } else if (o->encoding == OBJ_ENCODING_INTMAP) {
+            int64_t field, value;
+            uint32_t pos = 0;
+
+            if ((n = rdbSaveLen(rdb,intmapLen(o->ptr))) == -1) return -1;
+            nwritten += n;
+
+            while(intmapNext(o->ptr,&pos,&field,&value)) {
+                if ((n = rdbSaveLongLongAsStringObject(rdb,field)) == -1)
+                    return -1;
+                nwritten += n;
+                if ((n = rdbSaveLongLongAsStringObject(rdb,value)) == -1)
+                    return -1;
+                nwritten += n;
+            }
         } else {
             serverPanic("Unknown hash encoding");
         }
@@ -1091,6 +1182,215 @@ int rdbSaveInfoAuxFields(rio *rdb, int flags, rdbSaveInfo *rsi) {
     return 1;
 }
 
+/* -----------------------------------------------------------------------------
+ * Saving the keys with multiple threads (rdb-save-threads)
+ * -------------------------------------------------------------------------- */
+
+/* The buckets of the db dicts are split in tasks of RDB_SAVE_TASK_SLOTS
+ * buckets. The threads serialize the keys of a task, compression included,
+ * in a buffer of their own, and the saving thread writes the buffers of the
+ * tasks in their order: the file is the one a single thread writes, with
+ * the keys of a db in another order. The threads serialize at most
+ * RDB_SAVE_TASKS_PER_THREAD tasks each ahead of the writing, so the buffers
+ * take a bounded amount of memory. */
+#define RDB_SAVE_TASK_SLOTS 4096
+#define RDB_SAVE_TASKS_PER_THREAD 4
+
+typedef struct rdbSaveTask {
+    sds buf;            /* The keys of the task in RDB format. */
+    list *deferred;     /* Module keys, left to the saving thread. */
+    int done;           /* Set once buf and deferred are complete. */
+} rdbSaveTask;
+
+typedef struct rdbSaveJob {
+    long *first;        /* Index of the first task of every db. */
+    long ntasks;        /* Tasks of all the dbs. */
+    long next;          /* First task not taken yet. */
+    long written;       /* Tasks written so far. */
+    long window;        /* Task i uses ring[i % window]. */
+    rdbSaveTask *ring;
+    int stop;           /* Set to make the threads exit. */
+    pthread_mutex_t lock;
+    pthread_cond_t todo;    /* Signaled when more tasks can be taken. */
+    pthread_cond_t done;    /* Signaled when a task is done. */
+} rdbSaveJob;
+
+typedef struct rdbSaveTaskCtx {
+    redisDb *db;
+    rio *rdb;
+    rdbSaveTask *task;
+} rdbSaveTaskCtx;
+
+static void rdbSaveTaskCallback(void *privdata, const dictEntry *de) {
+    rdbSaveTaskCtx *ctx = privdata;
+    robj key, *o = dictGetVal(de);
+
+    /* Modules don't expect to save values from other threads. */
+    if (o->type == OBJ_MODULE) {
+        listAddNodeTail(ctx->task->deferred,(void*)de);
+        return;
+    }
+    initStaticStringObject(key,dictGetKey(de));
+    rdbSaveKeyValuePair(ctx->rdb,&key,o,getExpire(ctx->db,&key));
+}
+
+/* Return the db of the task 'i', setting 'start' to its first bucket. */
+static int rdbSaveTaskDb(rdbSaveJob *job, long i, unsigned long *start) {
+    int j = 0;
+
+    while (job->first[j+1] <= i) j++;
+    *start = (unsigned long)(i-job->first[j])*RDB_SAVE_TASK_SLOTS;
+    return j;
+}
+
+/* Serialize the task 'i' in 't'. Writing to a buffer can't fail. */
+static void rdbSaveTaskRun(rdbSaveJob *job, long i, rdbSaveTask *t) {
+    unsigned long start;
+    int dbid = rdbSaveTaskDb(job,i,&start);
+    rio r;
+    rdbSaveTaskCtx ctx = {server.db+dbid, &r, t};
+
+    rioInitWithBuffer(&r,sdsempty());
+    t->deferred = listCreate();
+    dictScanSlots(server.db[dbid].dict,start,start+RDB_SAVE_TASK_SLOTS,
+                  rdbSaveTaskCallback,&ctx);
+    t->buf = r.io.buffer.ptr;
+}
+
+static void *rdbSaveThreadMain(void *arg) {
+    rdbSaveJob *job = arg;
+
+    pthread_mutex_lock(&job->lock);
+    while(1) {
+        long i;
+        rdbSaveTask *t;
+
+        while (!job->stop && job->next < job->ntasks &&
+               job->next >= job->written+job->window)
+            pthread_cond_wait(&job->todo,&job->lock);
+        if (job->stop || job->next >= job->ntasks) break;
+        i = job->next++;
+        t = job->ring+(i % job->window);
+        pthread_mutex_unlock(&job->lock);
+
+        rdbSaveTaskRun(job,i,t);
+
+        pthread_mutex_lock(&job->lock);
+        t->done = 1;
+        pthread_cond_signal(&job->done);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* Write the keys of all the dbs as rdbSaveRio() does, serializing them with
+ * 'threads' threads. The db dicts are not modified meanwhile
+ * (we are the saving child, or the server is blocked in SAVE), and their
+ * rehashing is paused, so the threads only read them. A task no thread took
+ * yet when it is its turn to be written is serialized by the caller: this
+ * also covers the threads failing to start. Returns -1 on write errors. */
+static int rdbSaveKeysThreaded(rio *rdb, int threads) {
+    pthread_t tids[RDB_SAVE_THREADS_MAX];
+    int ntids = 0, dbid = -1, j, err = 0;
+    rdbSaveJob job;
+    long i;
+
+    job.first = zmalloc(sizeof(long)*(server.dbnum+1));
+    job.ntasks = 0;
+    for (j = 0; j < server.dbnum; j++) {
+        dict *d = server.db[j].dict;
+
+        job.first[j] = job.ntasks;
+        if (dictSize(d))
+            job.ntasks += (dictSlots(d)+RDB_SAVE_TASK_SLOTS-1)/
+                          RDB_SAVE_TASK_SLOTS;
+        dictPauseRehashing(d);
+        dictPauseRehashing(server.db[j].expires);
+    }
+    job.first[server.dbnum] = job.ntasks;
+    job.next = job.written = 0;
+    job.window = threads*RDB_SAVE_TASKS_PER_THREAD;
+    job.ring = zcalloc(sizeof(rdbSaveTask)*job.window);
+    job.stop = 0;
+    pthread_mutex_init(&job.lock,NULL);
+    pthread_cond_init(&job.todo,NULL);
+    pthread_cond_init(&job.done,NULL);
+    for (j = 0; j < threads; j++) {
+        if (pthread_create(tids+ntids,NULL,rdbSaveThreadMain,&job) == 0)
+            ntids++;
+    }
+
+    for (i = 0; i < job.ntasks && !err; i++) {
+        rdbSaveTask *t = job.ring+(i % job.window);
+        unsigned long start;
+        redisDb *db;
+        listIter li;
+        listNode *ln;
+
+        pthread_mutex_lock(&job.lock);
+        if (job.next == i) {
+            job.next++;
+            pthread_mutex_unlock(&job.lock);
+            rdbSaveTaskRun(&job,i,t);
+        } else {
+            while (!t->done) pthread_cond_wait(&job.done,&job.lock);
+            pthread_mutex_unlock(&job.lock);
+        }
+
+        /* The first task of a db starts with the db opcodes. */
+        j = rdbSaveTaskDb(&job,i,&start);
+        db = server.db+j;
+        if (j != dbid) {
+            dbid = j;
+            if (rdbSaveType(rdb,RDB_OPCODE_SELECTDB) == -1 ||
+                rdbSaveLen(rdb,dbid) == -1 ||
+                rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1 ||
+                rdbSaveLen(rdb,dictSize(db->dict)) == -1 ||
+                rdbSaveLen(rdb,dictSize(db->expires)) == -1) err = 1;
+        }
+        if (!err && rdbWriteRaw(rdb,t->buf,sdslen(t->buf)) == -1) err = 1;
+        listRewind(t->deferred,&li);
+        while (!err && (ln = listNext(&li)) != NULL) {
+            dictEntry *de = listNodeValue(ln);
+            robj key;
+
+            initStaticStringObject(key,dictGetKey(de));
+            if (rdbSaveKeyValuePair(rdb,&key,dictGetVal(de),
+                                    getExpire(db,&key)) == -1) err = 1;
+        }
+        sdsfree(t->buf);
+        listRelease(t->deferred);
+        t->buf = NULL;
+        t->deferred = NULL;
+        t->done = 0;
+
+        pthread_mutex_lock(&job.lock);
+        job.written++;
+        pthread_cond_broadcast(&job.todo);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    pthread_mutex_lock(&job.lock);
+    job.stop = 1;
+    pthread_cond_broadcast(&job.todo);
+    pthread_mutex_unlock(&job.lock);
+    for (j = 0; j < ntids; j++) pthread_join(tids[j],NULL);
+    for (i = 0; i < job.window; i++) {
+        sdsfree(job.ring[i].buf);
+        if (job.ring[i].deferred) listRelease(job.ring[i].deferred);
+    }
+    for (j = 0; j < server.dbnum; j++) {
+        dictResumeRehashing(server.db[j].dict);
+        dictResumeRehashing(server.db[j].expires);
+    }
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.todo);
+    pthread_cond_destroy(&job.done);
+    zfree(job.ring);
+    zfree(job.first);
+    return err ? -1 : 0;
+}
+
 /* Produces a dump of the database in RDB format sending it to the specified
  * Redis I/O channel. On success C_OK is returned, otherwise C_ERR
  * is returned and part of the output, or all the output, can be
@@ -1103,9 +1403,8 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     dictIterator *di = NULL;
     dictEntry *de;
     char magic[10];
-    int j;
+    int j, threads = server.rdb_save_threads;
     uint64_t cksum;
-    size_t processed = 0;
 
     if (server.rdb_checksum)
         rdb->update_cksum = rioGenericUpdateChecksum;
@@ -1113,7 +1412,9 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
     if (rdbSaveInfoAuxFields(rdb,flags,rsi) == -1) goto werr;
 
-    for (j = 0; j < server.dbnum; j++) {
+    if (threads > 1 && rdbSaveKeysThreaded(rdb,threads) == -1)
+        goto werr;
+    for (j = 0; threads == 1 && j < server.dbnum; j++) {
         redisDb *db = server.db+j;
         dict *d = db->dict;
         if (dictSize(d) == 0) continue;
@@ -1143,16 +1444,6 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
             initStaticStringObject(key,keystr);
             expire = getExpire(db,&key);
             if (rdbSaveKeyValuePair(rdb,&key,o,expire) == -1) goto werr;
-
-            /* When this RDB is produced as part of an AOF rewrite, move
-             * accumulated diff from parent to child while rewriting in
-             * order to have a smaller final write. */
-            if (flags & RDB_SAVE_AOF_PREAMBLE &&
-                rdb->processed_bytes > processed+AOF_READ_DIFF_INTERVAL_BYTES)
-            {
-                processed = rdb->processed_bytes;
-                aofReadDiffFromParent();
-            }
         }
         dictReleaseIterator(di);
         di = NULL; /* So that we don't release it again on error. */
@@ -1279,14 +1570,440 @@ werr:
     return C_ERR;
 }
 
+/* -----------------------------------------------------------------------------
+ * Saving in background without fork (rdb-save-forkless)
+ * -------------------------------------------------------------------------- */
+
+/* Instead of forking a child that sees a copy-on-write image of the dataset,
+ * the keys are serialized by the main thread itself, a slice at a time from
+ * serverCron(), while a thread writes the produced buffers to the file.
+ *
+ * The dump has to be the dataset at the time the save started, so a key
+ * that is about to be modified, deleted or created, and that the scan of its
+ * db did not reach yet, is saved before the change happens (its current
+ * value being still the original one), and remembered in the 'handled' set
+ * of the db so that the scan skips it later. Whether the scan reached a key
+ * or not depends only on the hash of the key and on the scan cursor, see
+ * dictScanPassed(). The keys created after the start are in 'handled' as
+ * well, without having been saved. */
+#define RDB_FORKLESS_FLUSH_BYTES (1024*1024) /* Hand buffers of this size. */
+#define RDB_FORKLESS_QUEUE_BYTES (32*1024*1024) /* Max bytes to be written. */
+
+typedef struct rdbForklessDb {
+    unsigned long cursor;   /* Scan cursor, 0 before the first step. */
+    int done;               /* Every key of the db is in the dump. */
+    dict *handled;          /* Keys not reached by the scan, already saved
+                               or created after the start. */
+} rdbForklessDb;
+
+typedef struct rdbForkless {
+    rdbForklessDb *dbs;
+    int curdb;              /* Db being scanned. */
+    int outdb;              /* Db of the last SELECTDB written. */
+    unsigned long prev;     /* Cursor of the running dictScan() call. */
+    int scripts;            /* Save the Lua scripts (rdbSaveInfo given). */
+    rio rdb;                /* Buffer the keys are serialized in. */
+    int failed;             /* Serializing a key failed. */
+    char *filename;
+    char tmpfile[256];
+    long long start;        /* ustime() of the start. */
+    /* Shared with the writing thread, under 'lock'. */
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* Signaled when buffers are queued or on stop. */
+    list *queue;            /* Buffers to write, in order. */
+    size_t queued;          /* Bytes in 'queue'. */
+    int closing;            /* No more buffers, flush and close the file. */
+    int stop;               /* Killed, close the file and discard the rest. */
+    int done;               /* The thread is over. */
+    int err;                /* errno of the first write error, if any. */
+    FILE *fp;
+    rio file;
+} rdbForkless;
+
+static void *rdbForklessThreadMain(void *arg) {
+    rdbForkless *fl = arg;
+    int err = 0;
+
+    pthread_mutex_lock(&fl->lock);
+    while(1) {
+        listNode *ln;
+        sds buf;
+
+        while (!listLength(fl->queue) && !fl->closing && !fl->stop)
+            pthread_cond_wait(&fl->cond,&fl->lock);
+        if (fl->stop || !listLength(fl->queue)) break;
+        ln = listFirst(fl->queue);
+        buf = listNodeValue(ln);
+        listDelNode(fl->queue,ln);
+        pthread_mutex_unlock(&fl->lock);
+
+        if (!err && rioWrite(&fl->file,buf,sdslen(buf)) == 0)
+            err = errno ? errno : EIO;
+
+        pthread_mutex_lock(&fl->lock);
+        fl->queued -= sdslen(buf);
+        sdsfree(buf);
+    }
+    pthread_mutex_unlock(&fl->lock);
+
+    if (!err && !fl->stop) {
+        if (fflush(fl->fp) == EOF || fsync(fileno(fl->fp)) == -1) err = errno;
+    }
+    if (fclose(fl->fp) == EOF && !err) err = errno;
+
+    pthread_mutex_lock(&fl->lock);
+    fl->err = err;
+    fl->done = 1;
+    pthread_mutex_unlock(&fl->lock);
+    return NULL;
+}
+
+/* Hand what was serialized so far to the writing thread. */
+static void rdbForklessFlush(rdbForkless *fl) {
+    sds buf = fl->rdb.io.buffer.ptr;
+
+    if (sdslen(buf) == 0) return;
+    fl->rdb.io.buffer.ptr = sdsempty();
+    fl->rdb.io.buffer.pos = 0;
+    pthread_mutex_lock(&fl->lock);
+    listAddNodeTail(fl->queue,buf);
+    fl->queued += sdslen(buf);
+    pthread_cond_signal(&fl->cond);
+    pthread_mutex_unlock(&fl->lock);
+}
+
+static size_t rdbForklessQueued(rdbForkless *fl) {
+    size_t queued;
+
+    pthread_mutex_lock(&fl->lock);
+    queued = fl->queued;
+    pthread_mutex_unlock(&fl->lock);
+    return queued;
+}
+
+static void rdbForklessSaveKey(rdbForkless *fl, int dbid, sds keystr,
+                               robj *o)
+{
+    robj key;
+
+    if (fl->outdb != dbid) {
+        if (rdbSaveType(&fl->rdb,RDB_OPCODE_SELECTDB) == -1 ||
+            rdbSaveLen(&fl->rdb,dbid) == -1) fl->failed = 1;
+        fl->outdb = dbid;
+    }
+    initStaticStringObject(key,keystr);
+    if (rdbSaveKeyValuePair(&fl->rdb,&key,o,getExpire(server.db+dbid,&key))
+        == -1) fl->failed = 1;
+    if (sdslen(fl->rdb.io.buffer.ptr) >= RDB_FORKLESS_FLUSH_BYTES)
+        rdbForklessFlush(fl);
+}
+
+static void rdbForklessDbDone(rdbForkless *fl, int dbid) {
+    rdbForklessDb *fdb = fl->dbs+dbid;
+
+    fdb->done = 1;
+    fdb->cursor = 0;
+    if (fdb->handled) {
+        dictRelease(fdb->handled);
+        fdb->handled = NULL;
+    }
+}
+
+static void rdbForklessScanCallback(void *privdata, const dictEntry *de) {
+    rdbForkless *fl = privdata;
+    rdbForklessDb *fdb = fl->dbs+fl->curdb;
+    redisDb *db = server.db+fl->curdb;
+    sds keystr = dictGetKey(de);
+
+    /* Returned again after the table shrunk. */
+    if (dictScanPassed(fl->prev,dictGetHash(db->dict,keystr))) return;
+    if (dictDelete(fdb->handled,keystr) == DICT_OK) return;
+    rdbForklessSaveKey(fl,fl->curdb,keystr,dictGetVal(de));
+}
+
+/* Run one dictScan() step on the db 'dbid'. */
+static void rdbForklessScanStep(rdbForkless *fl, int dbid) {
+    rdbForklessDb *fdb = fl->dbs+dbid;
+    int curdb = fl->curdb;
+
+    fl->curdb = dbid;
+    fl->prev = fdb->cursor;
+    fdb->cursor = dictScan(server.db[dbid].dict,fdb->cursor,
+                           rdbForklessScanCallback,NULL,fl);
+    if (fdb->cursor == 0) rdbForklessDbDone(fl,dbid);
+    fl->curdb = curdb;
+}
+
+/* Every key is in the dump: write the trailer and let the thread close the
+ * file. */
+static void rdbForklessEnd(rdbForkless *fl) {
+    uint64_t cksum;
+
+    if (fl->scripts && dictSize(server.lua_scripts)) {
+        dictIterator *di = dictGetIterator(server.lua_scripts);
+        dictEntry *de;
+
+        while((de = dictNext(di)) != NULL) {
+            robj *body = dictGetVal(de);
+            if (rdbSaveAuxField(&fl->rdb,"lua",3,body->ptr,
+                                sdslen(body->ptr)) == -1) fl->failed = 1;
+        }
+        dictReleaseIterator(di);
+    }
+    if (rdbSaveType(&fl->rdb,RDB_OPCODE_EOF) == -1) fl->failed = 1;
+    cksum = fl->rdb.cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(&fl->rdb,&cksum,8) == 0) fl->failed = 1;
+    rdbForklessFlush(fl);
+
+    pthread_mutex_lock(&fl->lock);
+    fl->closing = 1;
+    pthread_cond_signal(&fl->cond);
+    pthread_mutex_unlock(&fl->lock);
+}
+
+static void rdbForklessFree(rdbForkless *fl) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) rdbForklessDbDone(fl,j);
+    zfree(fl->dbs);
+    while (listLength(fl->queue)) {
+        listNode *ln = listFirst(fl->queue);
+        sdsfree(listNodeValue(ln));
+        listDelNode(fl->queue,ln);
+    }
+    listRelease(fl->queue);
+    sdsfree(fl->rdb.io.buffer.ptr);
+    pthread_mutex_destroy(&fl->lock);
+    pthread_cond_destroy(&fl->cond);
+    zfree(fl->filename);
+    zfree(fl);
+}
+
+/* Is a BGSAVE in progress, with a child or without? */
+int rdbBgsaveInProgress(void) {
+    return server.rdb_child_pid != -1 || server.rdb_forkless != NULL;
+}
+
+/* Start a BGSAVE without fork: the header and the sizes of the dbs are
+ * written now, the keys by rdbForklessCron() and the hooks below. */
+int rdbSaveBackgroundForkless(char *filename, rdbSaveInfo *rsi) {
+    rdbForkless *fl;
+    char magic[10];
+    int j;
+
+    fl = zcalloc(sizeof(*fl));
+    fl->start = ustime();
+    snprintf(fl->tmpfile,sizeof(fl->tmpfile),"temp-forkless-%d.rdb",
+        (int) getpid());
+    fl->fp = fopen(fl->tmpfile,"w");
+    if (!fl->fp) {
+        serverLog(LL_WARNING,"Failed opening the RDB file %s for saving: %s",
+            fl->tmpfile, strerror(errno));
+        zfree(fl);
+        server.lastbgsave_status = C_ERR;
+        return C_ERR;
+    }
+    rioInitWithFile(&fl->file,fl->fp);
+    if (server.rdb_save_incremental_fsync)
+        rioSetAutoSync(&fl->file,REDIS_AUTOSYNC_BYTES);
+    rioInitWithBuffer(&fl->rdb,sdsempty());
+    if (server.rdb_checksum)
+        fl->rdb.update_cksum = rioGenericUpdateChecksum;
+    fl->filename = zstrdup(filename);
+    fl->scripts = rsi != NULL;
+    fl->queue = listCreate();
+    pthread_mutex_init(&fl->lock,NULL);
+    pthread_cond_init(&fl->cond,NULL);
+
+    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    rdbWriteRaw(&fl->rdb,magic,9);
+    rdbSaveInfoAuxFields(&fl->rdb,RDB_SAVE_NONE,rsi);
+
+    /* The resize hints of all the dbs go first, as the keys of a db may be
+     * written before the scan gets to it. */
+    fl->dbs = zcalloc(sizeof(rdbForklessDb)*server.dbnum);
+    fl->outdb = -1;
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+j;
+
+        if (dictSize(db->dict) == 0) {
+            fl->dbs[j].done = 1;
+            continue;
+        }
+        fl->dbs[j].handled = dictCreate(&setDictType,NULL);
+        rdbSaveType(&fl->rdb,RDB_OPCODE_SELECTDB);
+        rdbSaveLen(&fl->rdb,j);
+        rdbSaveType(&fl->rdb,RDB_OPCODE_RESIZEDB);
+        rdbSaveLen(&fl->rdb,dictSize(db->dict));
+        rdbSaveLen(&fl->rdb,dictSize(db->expires));
+        fl->outdb = j;
+    }
+    rdbForklessFlush(fl);
+
+    if (pthread_create(&fl->tid,NULL,rdbForklessThreadMain,fl) != 0) {
+        serverLog(LL_WARNING,"Can't save in background: pthread_create: %s",
+            strerror(errno));
+        fclose(fl->fp);
+        unlink(fl->tmpfile);
+        rdbForklessFree(fl);
+        server.lastbgsave_status = C_ERR;
+        return C_ERR;
+    }
+
+    server.rdb_forkless = fl;
+    server.rdb_save_time_start = time(NULL);
+    server.rdb_child_type = RDB_CHILD_TYPE_DISK;
+    latencyAddSampleIfNeeded("forkless-save-start",(ustime()-fl->start)/1000);
+    serverLog(LL_NOTICE,"Background saving started without fork");
+    return C_OK;
+}
+
+/* A key of 'db' is about to be modified, deleted or created: save it first
+ * if the scan did not reach it. */
+void rdbForklessWillModify(redisDb *db, robj *key) {
+    rdbForkless *fl = server.rdb_forkless;
+    rdbForklessDb *fdb;
+    dictEntry *de;
+
+    if (fl == NULL) return;
+    fdb = fl->dbs+db->id;
+    if (fdb->done ||
+        dictScanPassed(fdb->cursor,dictGetHash(db->dict,key->ptr)) ||
+        dictFind(fdb->handled,key->ptr)) return;
+
+    if ((de = dictFind(db->dict,key->ptr)) != NULL) {
+        long long start = ustime();
+
+        rdbForklessSaveKey(fl,db->id,dictGetKey(de),dictGetVal(de));
+        latencyAddSampleIfNeeded("forkless-save-copy",(ustime()-start)/1000);
+    }
+    dictAdd(fdb->handled,sdsdup(key->ptr),NULL);
+}
+
+/* Call rdbForklessWillModify() for the keys of a write command. Most of the
+ * changes are caught by the db.c functions already, but not those done in
+ * place on values looked up for reading. */
+void rdbForklessWillCall(client *c) {
+    int *keys, numkeys, j;
+
+    if (server.rdb_forkless == NULL || !(c->cmd->flags & CMD_WRITE)) return;
+    keys = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
+    for (j = 0; j < numkeys; j++)
+        rdbForklessWillModify(c->db,c->argv[keys[j]]);
+    getKeysFreeResult(keys);
+}
+
+/* The db 'dbid' is about to be emptied or swapped: save the rest of it. */
+void rdbForklessFinishDb(int dbid) {
+    rdbForkless *fl = server.rdb_forkless;
+    long long start;
+
+    if (fl == NULL || fl->dbs[dbid].done) return;
+    start = ustime();
+    while (!fl->dbs[dbid].done) rdbForklessScanStep(fl,dbid);
+    rdbForklessFlush(fl);
+    latencyAddSampleIfNeeded("forkless-save-copy",(ustime()-start)/1000);
+}
+
+/* Stop the save in progress and remove its temp file, the analog of
+ * killRDBChild(). serverCron() does the rest of the cleanup. */
+void rdbForklessKill(void) {
+    rdbForkless *fl = server.rdb_forkless;
+    int j;
+
+    if (fl == NULL || fl->stop) return;
+    for (j = 0; j < server.dbnum; j++) rdbForklessDbDone(fl,j);
+    pthread_mutex_lock(&fl->lock);
+    fl->stop = 1;
+    pthread_cond_signal(&fl->cond);
+    pthread_mutex_unlock(&fl->lock);
+    pthread_join(fl->tid,NULL);
+    unlink(fl->tmpfile);
+}
+
+/* Called from serverCron(): serialize keys for a share of the CPU time set
+ * by rdb-save-forkless-cpu, or handle the end of the save. */
+void rdbForklessCron(void) {
+    rdbForkless *fl = server.rdb_forkless;
+    long long start, timelimit;
+    int done, err, iterations = 0, status = C_OK;
+
+    if (fl == NULL) return;
+    pthread_mutex_lock(&fl->lock);
+    done = fl->done;
+    err = fl->err;
+    pthread_mutex_unlock(&fl->lock);
+
+    if (!fl->closing && !fl->stop) {
+        /* Let the thread catch up if it is too far behind. */
+        if (rdbForklessQueued(fl) > RDB_FORKLESS_QUEUE_BYTES) return;
+
+        start = ustime();
+        timelimit = 1000000*server.rdb_save_forkless_cpu/server.hz/100;
+        if (timelimit <= 0) timelimit = 1;
+        while (fl->curdb < server.dbnum) {
+            if (fl->dbs[fl->curdb].done) {
+                fl->curdb++;
+                continue;
+            }
+            rdbForklessScanStep(fl,fl->curdb);
+            if ((++iterations & 15) == 0 &&
+                (ustime()-start > timelimit ||
+                 rdbForklessQueued(fl) > RDB_FORKLESS_QUEUE_BYTES)) break;
+        }
+        if (fl->curdb == server.dbnum) rdbForklessEnd(fl);
+        else rdbForklessFlush(fl);
+        latencyAddSampleIfNeeded("forkless-save-cycle",(ustime()-start)/1000);
+        return;
+    }
+    if (!done) return;
+
+    if (fl->stop) {
+        serverLog(LL_WARNING,"Background saving without fork stopped");
+        status = C_ERR;
+    } else {
+        pthread_join(fl->tid,NULL);
+        if (err || fl->failed) {
+            serverLog(LL_WARNING,"Background saving error: %s",
+                err ? strerror(err) : "can't serialize a key");
+            status = C_ERR;
+        } else if (rename(fl->tmpfile,fl->filename) == -1) {
+            serverLog(LL_WARNING,
+                "Error moving temp DB file %s on the final destination %s: %s",
+                fl->tmpfile, fl->filename, strerror(errno));
+            status = C_ERR;
+        }
+        if (status == C_ERR) {
+            unlink(fl->tmpfile);
+            server.lastbgsave_status = C_ERR;
+        } else {
+            serverLog(LL_NOTICE,
+                "Background saving terminated with success");
+            server.dirty = server.dirty - server.dirty_before_bgsave;
+            server.lastsave = time(NULL);
+            server.lastbgsave_status = C_OK;
+        }
+    }
+    rdbForklessFree(fl);
+    server.rdb_forkless = NULL;
+    server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+    server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
+    server.rdb_save_time_start = -1;
+    updateSlavesWaitingBgsave(status,RDB_CHILD_TYPE_DISK);
+}
+
 int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
     pid_t childpid;
     long long start;
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbBgsaveInProgress()) return C_ERR;
 
     server.dirty_before_bgsave = server.dirty;
     server.lastbgsave_try = time(NULL);
+    if (server.rdb_save_forkless)
+        return rdbSaveBackgroundForkless(filename,rsi);
     openChildInfoPipe();
 
     start = ustime();
@@ -1314,7 +2031,7 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
         /* Parent */
         server.stat_fork_time = ustime()-start;
         server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
-        latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
+        latencyAddEventSample(LATENCY_EVENT_FORK,server.stat_fork_time);
         if (childpid == -1) {
             closeChildInfoPipe();
             server.lastbgsave_status = C_ERR;
@@ -1478,8 +2195,16 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key) {
             /* Don't care about integer-encoded strings. */
             if (sdslen(sdsele) > maxelelen) maxelelen = sdslen(sdsele);
 
-            znode = zslInsert(zs->zsl,score,sdsele);
-            dictAdd(zs->dict,sdsele,&znode->score);
+            if (zs->zbt) {
+                dictEntry *de;
+
+                zbtInsert(zs->zbt,score,sdsele);
+                if ((de = dictAddRaw(zs->dict,sdsele,NULL)) != NULL)
+                    dictSetDoubleVal(de,score);
+            } else {
+                znode = zslInsert(zs->zsl,score,sdsele);
+                dictAdd(zs->dict,sdsele,&znode->score);
+            }
         }
 
         /* Convert *after* loading, since sorted sets are not stored ordered. */
@@ -1496,9 +2221,11 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key) {
 
         o = createHashObject();
 
-        /* Too many entries? Use a hash table. */
+        /* Too many entries? Use an intmap while the fields and values are
+         * integers, or a hash table. */
         if (len > server.hash_max_ziplist_entries)
-            hashTypeConvert(o, OBJ_ENCODING_HT);
+            hashTypeConvert(o, len <= server.hash_max_intmap_entries ?
+                               OBJ_ENCODING_INTMAP : OBJ_ENCODING_HT);
 
         /* Load every field and value into the ziplist */
         while (o->encoding == OBJ_ENCODING_ZIPLIST && len > 0) {
@@ -1528,6 +2255,33 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key) {
             sdsfree(value);
         }
 
+        /* Load fields and values into the intmap */
+        while (o->encoding == OBJ_ENCODING_INTMAP && len > 0) {
+            long long llfield, llvalue;
+            int update;
+
+            len--;
+            if ((field = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
+                == NULL) return NULL;
+            if ((value = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
+                == NULL) return NULL;
+
+            /* Convert to hash table at the first string, and add the pair
+             * there. */
+            if (!string2ll(field,sdslen(field),&llfield) ||
+                !string2ll(value,sdslen(value),&llvalue))
+            {
+                hashTypeConvert(o, OBJ_ENCODING_HT);
+                if (dictAdd((dict*)o->ptr, field, value) == DICT_ERR)
+                    rdbExitReportCorruptRDB("Duplicate keys detected");
+                break;
+            }
+            o->ptr = intmapSet(o->ptr,llfield,llvalue,&update);
+            if (update) rdbExitReportCorruptRDB("Duplicate keys detected");
+            sdsfree(field);
+            sdsfree(value);
+        }
+
         if (o->encoding == OBJ_ENCODING_HT && len > DICT_HT_INITIAL_SIZE)
             dictExpand(o->ptr,len);
 
@@ -1623,13 +2377,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key) {
                 o->type = OBJ_ZSET;
                 o->encoding = OBJ_ENCODING_ZIPLIST;
                 if (zsetLength(o) > server.zset_max_ziplist_entries)
-                    zsetConvert(o,OBJ_ENCODING_SKIPLIST);
+                    zsetConvert(o,zsetLargeEncoding());
                 break;
             case RDB_TYPE_HASH_ZIPLIST:
                 o->type = OBJ_HASH;
                 o->encoding = OBJ_ENCODING_ZIPLIST;
                 if (hashTypeLength(o) > server.hash_max_ziplist_entries)
-                    hashTypeConvert(o, OBJ_ENCODING_HT);
+                    hashTypeConvert(o, hashTypeLargeEncoding(o));
                 break;
             default:
                 rdbExitReportCorruptRDB("Unknown RDB encoding type %d",rdbtype);
@@ -1807,6 +2561,9 @@ void startLoading(FILE *fp) {
     server.loading = 1;
     server.loading_start_time = time(NULL);
     server.loading_loaded_bytes = 0;
+    server.loading_read_keys = 0;
+    server.loading_decoded_keys = 0;
+    server.loading_loaded_keys = 0;
     if (fstat(fileno(fp), &sb) == -1) {
         server.loading_total_bytes = 0;
     } else {
@@ -1845,12 +2602,373 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
     }
 }
 
+/* -----------------------------------------------------------------------------
+ * Loading the keys with multiple threads (rdb-load-threads)
+ * -------------------------------------------------------------------------- */
+
+/* The server thread reads the keys of the file in batches, copying them in
+ * a buffer as they are, with the values still compressed. The threads
+ * decode the batches, creating the objects of the keys, and the server
+ * thread adds the objects of every batch to the dbs in the order of the
+ * file. At most RDB_LOAD_BATCHES_PER_THREAD batches per thread are read
+ * ahead of the adding, so the buffers take a bounded amount of memory. */
+#define RDB_LOAD_BATCH_KEYS 256
+#define RDB_LOAD_BATCH_BYTES (1024*256)
+#define RDB_LOAD_BATCHES_PER_THREAD 4
+
+typedef struct rdbLoadKey {
+    int dbid;
+    int type;                   /* RDB type of the value. */
+    long long expiretime, lfu_freq, lru_idle;
+    robj *key, *val;            /* Set once decoded, NULL on errors. */
+} rdbLoadKey;
+
+typedef struct rdbLoadBatch {
+    sds buf;                    /* The keys of the batch in RDB format. */
+    rdbLoadKey keys[RDB_LOAD_BATCH_KEYS];
+    int count;
+    int done;                   /* Set once the keys are decoded. */
+} rdbLoadBatch;
+
+typedef struct rdbLoadJob {
+    long read;                  /* Batches the server thread read. */
+    long next;                  /* First batch not taken yet. */
+    long added;                 /* Batches added to the dbs. */
+    long window;                /* Batch i uses ring[i % window]. */
+    rdbLoadBatch *ring;
+    long long decoded;          /* Keys decoded so far. */
+    int stop;                   /* Set to make the threads exit. */
+    pthread_t tids[RDB_LOAD_THREADS_MAX];
+    int ntids;
+    pthread_mutex_t lock;
+    pthread_cond_t todo;        /* Signaled when a batch is read. */
+    pthread_cond_t done;        /* Signaled when a batch is decoded. */
+} rdbLoadJob;
+
+/* Copy 'len' bytes of 'rdb' at the end of the buffer of 'raw'. */
+static int rdbLoadCopyRaw(rio *rdb, rio *raw, uint64_t len) {
+    sds buf = sdsMakeRoomFor(raw->io.buffer.ptr,len);
+
+    raw->io.buffer.ptr = buf;
+    if (len && rioRead(rdb,buf+sdslen(buf),len) == 0) return -1;
+    sdsIncrLen(buf,len);
+    raw->io.buffer.pos += len;
+    return 0;
+}
+
+static int rdbLoadCopyLen(rio *rdb, rio *raw, uint64_t *lenptr) {
+    if (rdbLoadLenByRef(rdb,NULL,lenptr) == -1) return -1;
+    rdbSaveLen(raw,*lenptr);
+    return 0;
+}
+
+/* Copy a string as rdbGenericLoadStringObject() reads it. */
+static int rdbLoadCopyString(rio *rdb, rio *raw) {
+    int isencoded;
+    uint64_t len, clen;
+
+    if (rdbLoadLenByRef(rdb,&isencoded,&len) == -1) return -1;
+    if (!isencoded) {
+        rdbSaveLen(raw,len);
+        return rdbLoadCopyRaw(rdb,raw,len);
+    }
+    rdbSaveType(raw,(RDB_ENCVAL<<6)|len);
+    switch(len) {
+    case RDB_ENC_INT8: return rdbLoadCopyRaw(rdb,raw,1);
+    case RDB_ENC_INT16: return rdbLoadCopyRaw(rdb,raw,2);
+    case RDB_ENC_INT32: return rdbLoadCopyRaw(rdb,raw,4);
+    case RDB_ENC_LZF:
+    case RDB_ENC_LZ4:
+    case RDB_ENC_ZSTD:
+        if (rdbLoadCopyLen(rdb,raw,&clen) == -1 ||
+            rdbLoadCopyLen(rdb,raw,&len) == -1) return -1;
+        return rdbLoadCopyRaw(rdb,raw,clen);
+    default:
+        rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
+        return -1; /* Never reached. */
+    }
+}
+
+/* Copy a value of the RDB type 'rdbtype' as rdbLoadObject() reads it, for
+ * any type but the module ones. On short reads -1 is returned. */
+static int rdbLoadCopyObject(int rdbtype, rio *rdb, rio *raw) {
+    uint64_t len, pel_size, consumers, cgroups;
+    unsigned char byte;
+
+    switch(rdbtype) {
+    case RDB_TYPE_STRING:
+    case RDB_TYPE_HASH_ZIPMAP:
+    case RDB_TYPE_LIST_ZIPLIST:
+    case RDB_TYPE_SET_INTSET:
+    case RDB_TYPE_ZSET_ZIPLIST:
+    case RDB_TYPE_HASH_ZIPLIST:
+        return rdbLoadCopyString(rdb,raw);
+    case RDB_TYPE_LIST:
+    case RDB_TYPE_SET:
+    case RDB_TYPE_LIST_QUICKLIST:
+        if (rdbLoadCopyLen(rdb,raw,&len) == -1) return -1;
+        while(len--)
+            if (rdbLoadCopyString(rdb,raw) == -1) return -1;
+        return 0;
+    case RDB_TYPE_HASH:
+        if (rdbLoadCopyLen(rdb,raw,&len) == -1) return -1;
+        while(len--) {
+            if (rdbLoadCopyString(rdb,raw) == -1 ||
+                rdbLoadCopyString(rdb,raw) == -1) return -1;
+        }
+        return 0;
+    case RDB_TYPE_ZSET_2:
+    case RDB_TYPE_ZSET:
+        if (rdbLoadCopyLen(rdb,raw,&len) == -1) return -1;
+        while(len--) {
+            if (rdbLoadCopyString(rdb,raw) == -1) return -1;
+            if (rdbtype == RDB_TYPE_ZSET_2) {
+                if (rdbLoadCopyRaw(rdb,raw,sizeof(double)) == -1) return -1;
+                continue;
+            }
+            /* See rdbLoadDoubleValue(). */
+            if (rioRead(rdb,&byte,1) == 0) return -1;
+            rdbSaveType(raw,byte);
+            if (byte < 253 && rdbLoadCopyRaw(rdb,raw,byte) == -1) return -1;
+        }
+        return 0;
+    case RDB_TYPE_STREAM_LISTPACKS:
+        /* See the stream part of rdbLoadObject(). */
+        if (rdbLoadCopyLen(rdb,raw,&len) == -1) return -1;
+        while(len--) {
+            if (rdbLoadCopyString(rdb,raw) == -1 ||
+                rdbLoadCopyString(rdb,raw) == -1) return -1;
+        }
+        if (rdbLoadCopyLen(rdb,raw,&len) == -1 ||
+            rdbLoadCopyLen(rdb,raw,&len) == -1 ||
+            rdbLoadCopyLen(rdb,raw,&len) == -1 ||
+            rdbLoadCopyLen(rdb,raw,&cgroups) == -1) return -1;
+        while(cgroups--) {
+            if (rdbLoadCopyString(rdb,raw) == -1 ||
+                rdbLoadCopyLen(rdb,raw,&len) == -1 ||
+                rdbLoadCopyLen(rdb,raw,&len) == -1 ||
+                rdbLoadCopyLen(rdb,raw,&pel_size) == -1) return -1;
+            while(pel_size--) {
+                if (rdbLoadCopyRaw(rdb,raw,sizeof(streamID)+8) == -1 ||
+                    rdbLoadCopyLen(rdb,raw,&len) == -1) return -1;
+            }
+            if (rdbLoadCopyLen(rdb,raw,&consumers) == -1) return -1;
+            while(consumers--) {
+                if (rdbLoadCopyString(rdb,raw) == -1 ||
+                    rdbLoadCopyRaw(rdb,raw,8) == -1 ||
+                    rdbLoadCopyLen(rdb,raw,&pel_size) == -1 ||
+                    rdbLoadCopyRaw(rdb,raw,pel_size*sizeof(streamID)) == -1)
+                    return -1;
+            }
+        }
+        return 0;
+    default:
+        rdbExitReportCorruptRDB("Unknown RDB encoding type %d",rdbtype);
+        return -1; /* Never reached. */
+    }
+}
+
+/* Create the objects of the keys of 'b'. The objects are only reachable
+ * from the batch, so the threads don't share anything but the read only
+ * configuration. Decoding stops at the first error, leaving the remaining
+ * keys NULL. */
+static void rdbLoadBatchRun(rdbLoadBatch *b) {
+    rio r;
+    int j;
+
+    rioInitWithBuffer(&r,b->buf);
+    for (j = 0; j < b->count; j++) {
+        rdbLoadKey *k = b->keys+j;
+
+        if ((k->key = rdbLoadStringObject(&r)) == NULL) break;
+        if ((k->val = rdbLoadObject(k->type,&r,k->key)) == NULL) break;
+    }
+}
+
+static void *rdbLoadThreadMain(void *arg) {
+    rdbLoadJob *job = arg;
+
+    pthread_mutex_lock(&job->lock);
+    while(1) {
+        rdbLoadBatch *b;
+
+        while (!job->stop && job->next >= job->read)
+            pthread_cond_wait(&job->todo,&job->lock);
+        if (job->stop) break;
+        b = job->ring+(job->next++ % job->window);
+        pthread_mutex_unlock(&job->lock);
+
+        rdbLoadBatchRun(b);
+
+        pthread_mutex_lock(&job->lock);
+        b->done = 1;
+        job->decoded += b->count;
+        pthread_cond_signal(&job->done);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* Start 'threads' threads decoding the keys read by rdbLoadRio(). */
+static rdbLoadJob *rdbLoadJobCreate(int threads) {
+    rdbLoadJob *job = zcalloc(sizeof(*job));
+    int j;
+
+    job->window = threads*RDB_LOAD_BATCHES_PER_THREAD;
+    job->ring = zcalloc(sizeof(rdbLoadBatch)*job->window);
+    for (j = 0; j < job->window; j++) job->ring[j].buf = sdsempty();
+    pthread_mutex_init(&job->lock,NULL);
+    pthread_cond_init(&job->todo,NULL);
+    pthread_cond_init(&job->done,NULL);
+    for (j = 0; j < threads; j++) {
+        if (pthread_create(job->tids+job->ntids,NULL,rdbLoadThreadMain,
+                           job) == 0) job->ntids++;
+    }
+    return job;
+}
+
+static void rdbLoadJobRelease(rdbLoadJob *job) {
+    int j;
+
+    pthread_mutex_lock(&job->lock);
+    job->stop = 1;
+    pthread_cond_broadcast(&job->todo);
+    pthread_mutex_unlock(&job->lock);
+    for (j = 0; j < job->ntids; j++) pthread_join(job->tids[j],NULL);
+    for (j = 0; j < job->window; j++) sdsfree(job->ring[j].buf);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->todo);
+    pthread_cond_destroy(&job->done);
+    zfree(job->ring);
+    zfree(job);
+}
+
+/* Add the decoded key 'k' to its db, unless it is already expired. See
+ * rdbLoadRio() for 'now', 'lru_clock' and 'loading_aof'. */
+static int rdbLoadAddKey(rdbLoadKey *k, long long now, long long lru_clock,
+                         int loading_aof)
+{
+    redisDb *db = server.db+k->dbid;
+
+    if (k->key == NULL || k->val == NULL) return -1;
+    server.loading_loaded_keys++;
+
+    /* Check if the key already expired. This function is used when loading
+     * an RDB file from disk, either at startup, or when an RDB was
+     * received from the master. In the latter case, the master is
+     * responsible for key expiry. If we would expire keys here, the
+     * snapshot taken by the master may not be reflected on the slave. */
+    if (server.masterhost == NULL && !loading_aof && k->expiretime != -1 &&
+        k->expiretime < now)
+    {
+        decrRefCount(k->key);
+        decrRefCount(k->val);
+    } else {
+        /* Add the new object in the hash table */
+        dbAdd(db,k->key,k->val);
+
+        /* Set the expire time if needed */
+        if (k->expiretime != -1) setExpire(NULL,db,k->key,k->expiretime);
+
+        /* Set usage information (for eviction). */
+        objectSetLRUOrLFU(k->val,k->lfu_freq,k->lru_idle,lru_clock);
+
+        /* Decrement the key refcount since dbAdd() will take its
+         * own reference. */
+        decrRefCount(k->key);
+    }
+    return 0;
+}
+
+/* Add the keys of the oldest batch not added yet, decoding it here if no
+ * thread took it: this also covers the threads failing to start. Returns
+ * -1 if the batch has keys that can't be decoded. */
+static int rdbLoadAddBatch(rdbLoadJob *job, long long now,
+                           long long lru_clock, int loading_aof)
+{
+    rdbLoadBatch *b = job->ring+(job->added % job->window);
+    int j, err = 0;
+
+    pthread_mutex_lock(&job->lock);
+    if (job->next == job->added) {
+        job->next++;
+        pthread_mutex_unlock(&job->lock);
+        rdbLoadBatchRun(b);
+        pthread_mutex_lock(&job->lock);
+        job->decoded += b->count;
+    } else {
+        while (!b->done) pthread_cond_wait(&job->done,&job->lock);
+    }
+    server.loading_decoded_keys = job->decoded;
+    pthread_mutex_unlock(&job->lock);
+
+    for (j = 0; j < b->count; j++) {
+        if (!err && rdbLoadAddKey(b->keys+j,now,lru_clock,loading_aof) == -1)
+            err = 1;
+        b->keys[j].key = b->keys[j].val = NULL;
+    }
+    sdsclear(b->buf);
+    b->count = 0;
+    b->done = 0;
+    job->added++;
+    return err ? -1 : 0;
+}
+
+/* Hand the batch being read to the threads, if it has keys. */
+static void rdbLoadReadBatch(rdbLoadJob *job) {
+    if (job->ring[job->read % job->window].count == 0) return;
+    pthread_mutex_lock(&job->lock);
+    job->read++;
+    pthread_cond_signal(&job->todo);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* Add all the keys read so far. */
+static int rdbLoadAddAll(rdbLoadJob *job, long long now, long long lru_clock,
+                         int loading_aof)
+{
+    rdbLoadReadBatch(job);
+    while (job->added < job->read) {
+        if (rdbLoadAddBatch(job,now,lru_clock,loading_aof) == -1) return -1;
+    }
+    return 0;
+}
+
+/* Read a key with a value of the RDB type 'type' in the batch being read,
+ * adding the oldest batch to the dbs when all the ring is in use. */
+static int rdbLoadQueueKey(rdbLoadJob *job, rio *rdb, rdbLoadKey *k,
+                           long long now, long long lru_clock,
+                           int loading_aof)
+{
+    rdbLoadBatch *b = job->ring+(job->read % job->window);
+    rio raw;
+
+    rioInitWithBuffer(&raw,b->buf);
+    raw.io.buffer.pos = sdslen(b->buf);
+    if (rdbLoadCopyString(rdb,&raw) == -1 ||
+        rdbLoadCopyObject(k->type,rdb,&raw) == -1)
+    {
+        b->buf = raw.io.buffer.ptr;
+        return -1;
+    }
+    b->buf = raw.io.buffer.ptr;
+    b->keys[b->count++] = *k;
+    if (b->count < RDB_LOAD_BATCH_KEYS && sdslen(b->buf) < RDB_LOAD_BATCH_BYTES)
+        return 0;
+
+    rdbLoadReadBatch(job);
+    if (job->read-job->added == job->window)
+        return rdbLoadAddBatch(job,now,lru_clock,loading_aof);
+    return 0;
+}
+
 /* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
  * otherwise C_ERR is returned and 'errno' is set accordingly. */
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
     uint64_t dbid;
     int type, rdbver;
     redisDb *db = server.db+0;
+    rdbLoadJob *job = NULL;
     char buf[1024];
 
     rdb->update_cksum = rdbLoadProgressCallback;
@@ -1873,8 +2991,11 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
     long long lru_idle = -1, lfu_freq = -1, expiretime = -1, now = mstime();
     long long lru_clock = LRU_CLOCK();
 
+    if (server.rdb_load_threads > 1)
+        job = rdbLoadJobCreate(server.rdb_load_threads);
+
     while(1) {
-        robj *key, *val;
+        rdbLoadKey k;
 
         /* Read type. */
         if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
@@ -1906,6 +3027,8 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
             continue; /* Read next opcode. */
         } else if (type == RDB_OPCODE_EOF) {
             /* EOF: End of file, exit the main loop. */
+            if (job && rdbLoadAddAll(job,now,lru_clock,loading_aof) == -1)
+                goto eoferr;
             break;
         } else if (type == RDB_OPCODE_SELECTDB) {
             /* SELECTDB: Select the specified database. */
@@ -2020,31 +3143,26 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
             }
         }
 
-        /* Read key */
-        if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
-        /* Read value */
-        if ((val = rdbLoadObject(type,rdb,key)) == NULL) goto eoferr;
-        /* Check if the key already expired. This function is used when loading
-         * an RDB file from disk, either at startup, or when an RDB was
-         * received from the master. In the latter case, the master is
-         * responsible for key expiry. If we would expire keys here, the
-         * snapshot taken by the master may not be reflected on the slave. */
-        if (server.masterhost == NULL && !loading_aof && expiretime != -1 && expiretime < now) {
-            decrRefCount(key);
-            decrRefCount(val);
+        k.dbid = db-server.db;
+        k.type = type;
+        k.expiretime = expiretime;
+        k.lfu_freq = lfu_freq;
+        k.lru_idle = lru_idle;
+        server.loading_read_keys++;
+        if (job && type != RDB_TYPE_MODULE && type != RDB_TYPE_MODULE_2) {
+            if (rdbLoadQueueKey(job,rdb,&k,now,lru_clock,loading_aof) == -1)
+                goto eoferr;
         } else {
-            /* Add the new object in the hash table */
-            dbAdd(db,key,val);
-
-            /* Set the expire time if needed */
-            if (expiretime != -1) setExpire(NULL,db,key,expiretime);
-
-            /* Set usage information (for eviction). */
-            objectSetLRUOrLFU(val,lfu_freq,lru_idle,lru_clock);
-
-            /* Decrement the key refcount since dbAdd() will take its
-             * own reference. */
-            decrRefCount(key);
+            /* Module values are loaded here after the keys read before
+             * them, modules don't expect other threads to load them. */
+            if (job && rdbLoadAddAll(job,now,lru_clock,loading_aof) == -1)
+                goto eoferr;
+            /* Read key */
+            if ((k.key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            /* Read value */
+            if ((k.val = rdbLoadObject(type,rdb,k.key)) == NULL) goto eoferr;
+            server.loading_decoded_keys++;
+            rdbLoadAddKey(&k,now,lru_clock,loading_aof);
         }
 
         /* Reset the state that is key-specified and is populated by
@@ -2068,6 +3186,7 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
             }
         }
     }
+    if (job) rdbLoadJobRelease(job);
     return C_OK;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
@@ -2166,7 +3285,7 @@ void backgroundSaveDoneHandlerSocket(int exitcode, int bysignal) {
         if (read(server.rdb_pipe_read_result_from_child, ok_slaves, readlen) ==
                  readlen)
         {
-            readlen = ok_slaves[0]*sizeof(uint64_t)*2;
+            readlen = ok_slaves[0]*sizeof(uint64_t)*3;
 
             /* Make space for enough elements as specified by the first
              * uint64_t element in the array. */
@@ -2200,8 +3319,8 @@ void backgroundSaveDoneHandlerSocket(int exitcode, int bysignal) {
              * continue the replication process, we need to find it in the list,
              * and it must have an error code set to 0 (which means success). */
             for (j = 0; j < ok_slaves[0]; j++) {
-                if (slave->id == ok_slaves[2*j+1]) {
-                    errorcode = ok_slaves[2*j+2];
+                if (slave->id == ok_slaves[3*j+1]) {
+                    errorcode = ok_slaves[3*j+2];
                     break; /* Found in slaves list. */
                 }
             }
@@ -2216,6 +3335,9 @@ void backgroundSaveDoneHandlerSocket(int exitcode, int bysignal) {
                 serverLog(LL_WARNING,
                 "Slave %s correctly received the streamed RDB file.",
                     replicationGetSlaveName(slave));
+                slave->repl_sync_bytes = ok_slaves[3*j+3];
+                slave->repl_sync_time = mstime() - slave->repl_sync_start;
+                if (slave->repl_sync_time == 0) slave->repl_sync_time = 1;
                 /* Restore the socket as non-blocking. */
                 anetNonBlock(NULL,slave->fd);
                 anetSendTimeout(NULL,slave->fd,0);
@@ -2264,7 +3386,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
     long long start;
     int pipefds[2];
 
-    if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    if (server.aof_child_pid != -1 || rdbBgsaveInProgress()) return C_ERR;
 
     /* Before to fork, create a pipe that will be used in order to
      * send back to the parent the IDs of the slaves that successfully
@@ -2290,6 +3412,9 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
             clientids[numfds] = slave->id;
             fds[numfds++] = slave->fd;
             replicationSetupSlaveForFullResync(slave,getPsyncInitialOffset());
+            slave->repl_sync_start = mstime();
+            slave->repl_sync_time = 0;
+            slave->repl_sync_bytes = 0;
             /* Put the socket in blocking mode to simplify RDB transfer.
              * We'll restore it when the children returns (since duped socket
              * will share the O_NONBLOCK attribute with the parent). */
@@ -2312,6 +3437,10 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
         closeListeningSockets(0);
         redisSetProcTitle("redis-rdb-to-slaves");
 
+        /* LZF costs CPU in the child for every transfer: on fast links
+         * the slaves are better served by the raw payload. */
+        if (!server.repl_diskless_compression) server.rdb_compression = 0;
+
         retval = rdbSaveRioWithEOFMark(&slave_sockets,NULL,rsi);
         if (retval == C_OK && rioFlush(&slave_sockets) == 0)
             retval = C_ERR;
@@ -2332,18 +3461,19 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
              * with the RDB file as expected, so we need to send a report
              * to the parent via the pipe. The format of the message is:
              *
-             * <len> <slave[0].id> <slave[0].error> ...
+             * <len> <slave[0].id> <slave[0].error> <slave[0].bytes> ...
              *
-             * len, slave IDs, and slave errors, are all uint64_t integers,
-             * so basically the reply is composed of 64 bits for the len field
-             * plus 2 additional 64 bit integers for each entry, for a total
-             * of 'len' entries.
+             * len, slave IDs, slave errors and byte counts are all uint64_t
+             * integers, so basically the reply is composed of 64 bits for
+             * the len field plus 3 additional 64 bit integers for each
+             * entry, for a total of 'len' entries.
              *
              * The 'id' represents the slave's client ID, so that the master
-             * can match the report with a specific slave, and 'error' is
+             * can match the report with a specific slave, 'error' is
              * set to 0 if the replication process terminated with a success
-             * or the error code if an error occurred. */
-            void *msg = zmalloc(sizeof(uint64_t)*(1+2*numfds));
+             * or the error code if an error occurred, and 'bytes' is the
+             * size of the payload the slave received. */
+            void *msg = zmalloc(sizeof(uint64_t)*(1+3*numfds));
             uint64_t *len = msg;
             uint64_t *ids = len+1;
             int j, msglen;
@@ -2352,13 +3482,14 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
             for (j = 0; j < numfds; j++) {
                 *ids++ = clientids[j];
                 *ids++ = slave_sockets.io.fdset.state[j];
+                *ids++ = slave_sockets.processed_bytes;
             }
 
             /* Write the message to the parent. If we have no good slaves or
              * we are unable to transfer the message to the parent, we exit
              * with an error so that the parent will abort the replication
              * process with all the childre that were waiting. */
-            msglen = sizeof(uint64_t)*(1+2*numfds);
+            msglen = sizeof(uint64_t)*(1+3*numfds);
             if (*len == 0 ||
                 write(server.rdb_pipe_write_result_to_parent,msg,msglen)
                 != msglen)
@@ -2397,7 +3528,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
         } else {
             server.stat_fork_time = ustime()-start;
             server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
-            latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
+            latencyAddEventSample(LATENCY_EVENT_FORK,server.stat_fork_time);
 
             serverLog(LL_NOTICE,"Background RDB transfer started by pid %d",
                 childpid);
@@ -2414,7 +3545,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
 }
 
 void saveCommand(client *c) {
-    if (server.rdb_child_pid != -1) {
+    if (rdbBgsaveInProgress()) {
         addReplyError(c,"Background save already in progress");
         return;
     }
@@ -2445,7 +3576,7 @@ void bgsaveCommand(client *c) {
     rdbSaveInfo rsi, *rsiptr;
     rsiptr = rdbPopulateSaveInfo(&rsi);
 
-    if (server.rdb_child_pid != -1) {
+    if (rdbBgsaveInProgress()) {
         addReplyError(c,"Background save already in progress");
     } else if (server.aof_child_pid != -1) {
         if (schedule) {
@@ -40,11 +40,13 @@
 #include <signal.h>
 #include <assert.h>
 #include <math.h>
+#include <limits.h>
 #include <pthread.h>
 
 #include <sds.h> /* Use hiredis sds. */
 #include "ae.h"
 #include "hiredis.h"
+#include "async.h"
 #include "adlist.h"
 #include "dict.h"
 #include "zmalloc.h"
@@ -56,11 +58,47 @@
 #define MAX_LATENCY_PRECISION 3
 #define MAX_THREADS 500
 #define CLUSTER_SLOTS 16384
+#define LATENCY_HIST_MAX_US (1LL<<36) /* ~19 hours, larger values are clamped */
+#define LATENCY_HIST_DEFAULT_DIGITS 3
+#define LATENCY_HIST_MAX_DIGITS 4
+#define MAX_DATASIZE (1024*1024*1024)
+
+/* Key distributions of -r. */
+#define KEYDIST_UNIFORM 0
+#define KEYDIST_ZIPF 1
+#define KEYDIST_HOTSPOT 2
+#define KEYDIST_SEQUENTIAL 3
+
+/* Value size distributions of --mix. */
+#define DATADIST_FIXED 0
+#define DATADIST_UNIFORM 1
+#define DATADIST_EXP 2
 
 #define CLIENT_GET_EVENTLOOP(c) \
     (c->thread_id >= 0 ? config.threads[c->thread_id]->el : config.el)
+#define CLIENT_GET_STATS(c) \
+    (c->thread_id >= 0 ? &config.threads[c->thread_id]->stats : &config.stats)
+#define CLIENT_GET_POOL(c) \
+    (c->thread_id >= 0 ? config.threads[c->thread_id]->pool : config.pool)
 
 struct benchmarkThread;
+struct connPool;
+struct latencyHistogram;
+struct mixEntry;
+
+/* Request accounting of an event loop, the main one or the one of a thread.
+ * It is only written by the thread running the loop, so the hot path takes
+ * no lock and no shared cache line: showThroughput() sums the counters of
+ * all the loops, and benchmark() merges them once the run is over. */
+typedef struct benchmarkStats {
+    int requests;           /* Requests the loop has to complete */
+    int requests_issued;
+    int requests_finished;  /* Read by other threads with atomicGet() */
+    struct latencyHistogram *latency;
+    list *clients;          /* Clients served by the loop */
+    pthread_mutex_t requests_finished_mutex; /* Fallback of atomicvar.h */
+    char padding[64];       /* Keep the loops off each other's lines */
+} benchmarkStats;
 struct clusterNode;
 struct redisConfig;
 
@@ -72,20 +110,38 @@ static struct config {
     int numclients;
     int liveclients;
     int requests;
-    int requests_issued;
-    int requests_finished;
+    int requests_finished;  /* Of all the loops, once the run is over */
+    benchmarkStats stats;   /* Main event loop, without threads */
     int keysize;
     int datasize;
     int randomkeys;
     int randomkeys_keyspacelen;
+    int keydist;            /* KEYDIST_* */
+    double zipf_theta;      /* Skew of the zipf distribution, in (0,1) */
+    double zipf_zetan;      /* Precomputed by initZipf() */
+    double zipf_eta;
+    double hotspot_keys;    /* Fraction of the keys that are hot */
+    double hotspot_prob;    /* Probability that a request hits a hot key */
+    long long sequential_key;
+    int datadist;           /* DATADIST_* */
+    int datasize_min;
+    int datasize_max;
+    char *mixdata;          /* datasize_max bytes of values for --mix */
+    struct mixEntry *mix;   /* Weighted commands of --mix, or NULL */
+    int mix_count;
+    long long mix_weight;   /* Sum of the weights of the entries */
+    const char *mixspec;
     int keepalive;
     int pipeline;
+    long long rate;         /* Requests per second in open loop mode, or 0 */
+    double rate_interval;   /* Microseconds between two sends of a client */
     int showerrors;
     long long start;
     long long totlatency;
-    long long *latency;
+    struct latencyHistogram *latency;      /* Of all the loops, merged */
+    struct latencyHistogram *live_latency; /* Scratch for showThroughput() */
+    int latency_digits;
     const char *title;
-    list *clients;
     int quiet;
     int csv;
     int loop;
@@ -97,6 +153,8 @@ static struct config {
     int precision;
     int num_threads;
     struct benchmarkThread **threads;
+    int connections;        /* Shared connections per loop, or 0 */
+    struct connPool *pool;  /* Shared connections of the main loop */
     int cluster_mode;
     int cluster_node_count;
     struct clusterNode **cluster_nodes;
@@ -105,17 +163,17 @@ static struct config {
     int is_updating_slots;
     int slots_last_update;
     /* Thread mutexes to be used as fallbacks by atomicvar.h */
-    pthread_mutex_t requests_issued_mutex;
-    pthread_mutex_t requests_finished_mutex;
     pthread_mutex_t liveclients_mutex;
     pthread_mutex_t is_fetching_slots_mutex;
     pthread_mutex_t is_updating_slots_mutex;
     pthread_mutex_t updating_slots_mutex;
     pthread_mutex_t slots_last_update_mutex;
+    pthread_mutex_t sequential_key_mutex;
 } config;
 
 typedef struct _client {
-    redisContext *context;
+    redisContext *context;  /* Own connection, or NULL when sharing 'conn' */
+    redisAsyncContext *conn; /* Connection of the loop pool (--connections) */
     sds obuf;
     char **randptr;         /* Pointers to :rand: strings inside the command buf */
     size_t randlen;         /* Number of pointers in client->randptr */
@@ -134,6 +192,8 @@ typedef struct _client {
     int thread_id;
     struct clusterNode *cluster_node;
     int slots_last_update;
+    double next_send;       /* Intended time of the next send (--rate) */
+    long long send_timer;   /* Time event waiting for next_send, or -1 */
 } *client;
 
 /* Threads. */
@@ -142,8 +202,45 @@ typedef struct benchmarkThread {
     int index;
     pthread_t thread;
     aeEventLoop *el;
+    benchmarkStats stats;
+    struct connPool *pool;
 } benchmarkThread;
 
+/* Shared connections.
+ *
+ * With --connections the clients of an event loop do not open a connection
+ * each, but share the ones of the loop, over which hiredis pipelines their
+ * commands automatically: the commands issued during an iteration of the
+ * loop are appended to the output buffer of the connection, leave in a
+ * single write once the socket is writable, and the replies are dispatched
+ * to the clients in order. A connection is only used by its loop, so no
+ * locking is needed. */
+typedef struct connPool {
+    aeEventLoop *el;
+    int size;
+    int next;               /* Round robin cursor for new clients */
+    int closing;            /* Set while the connections are freed */
+    redisAsyncContext **conns;
+} connPool;
+
+/* Latency histograms.
+ *
+ * Latencies are recorded in microseconds into log-linear buckets, in the
+ * spirit of HdrHistogram: values below 2^sub_bits get a bucket each, then
+ * every power of two is split into 2^(sub_bits-1) buckets, so a value is
+ * known with 'latency_digits' significant digits. The memory used and the
+ * cost of a sample do not depend on the number of requests, and the
+ * histograms of the threads are merged by summing their counters. */
+typedef struct latencyHistogram {
+    int sub_bits;           /* Log2 of the number of linear buckets */
+    int buckets;            /* Number of entries in 'counts' */
+    long long count;        /* Number of recorded values */
+    long long sum;          /* Sum of the recorded values, for the average */
+    long long min;
+    long long max;
+    long long *counts;
+} latencyHistogram;
+
 /* Cluster. */
 typedef struct clusterNode {
     char *ip;
@@ -173,6 +270,9 @@ typedef struct redisConfig {
 
 /* Prototypes */
 static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+static void scheduleClientWrite(client c);
+static void sendClientRequest(client c);
+static client createClient(char *cmd, size_t len, client from, int thread_id);
 static void createMissingClients(client c);
 static benchmarkThread *createBenchmarkThread(int index);
 static void freeBenchmarkThread(benchmarkThread *thread);
@@ -187,6 +287,14 @@ static void updateClusterSlotsConfiguration();
 int showThroughput(struct aeEventLoop *eventLoop, long long id,
                    void *clientData);
 
+/* Latency histograms */
+static latencyHistogram *latHistCreate(int digits);
+static void latHistFree(latencyHistogram *h);
+static void latHistReset(latencyHistogram *h);
+static void latHistRecord(latencyHistogram *h, long long us);
+static void latHistMerge(latencyHistogram *dst, latencyHistogram *src);
+static long long latHistPercentile(latencyHistogram *h, double perc);
+
 /* Dict callbacks */
 static uint64_t dictSdsHash(const void *key);
 static int dictSdsKeyCompare(void *privdata, const void *key1,
@@ -309,31 +417,28 @@ static void freeRedisConfig(redisConfig *cfg) {
 
 static void freeClient(client c) {
     aeEventLoop *el = CLIENT_GET_EVENTLOOP(c);
+    benchmarkStats *stats = CLIENT_GET_STATS(c);
     listNode *ln;
-    aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
-    aeDeleteFileEvent(el,c->context->fd,AE_READABLE);
-    if (c->thread_id >= 0) {
-        int requests_finished = 0;
-        atomicGet(config.requests_finished, requests_finished);
-        if (requests_finished >= config.requests) {
-            aeStop(el);
-        }
+    if (c->context) {
+        aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+        aeDeleteFileEvent(el,c->context->fd,AE_READABLE);
     }
-    redisFree(c->context);
+    if (c->send_timer != -1) aeDeleteTimeEvent(el,c->send_timer);
+    if (c->thread_id >= 0 && stats->requests_finished >= stats->requests)
+        aeStop(el);
+    ln = listSearchKey(stats->clients,c);
+    assert(ln != NULL);
+    listDelNode(stats->clients,ln);
+    atomicDecr(config.liveclients,1);
+    if (c->context) redisFree(c->context);
     sdsfree(c->obuf);
     zfree(c->randptr);
     zfree(c->stagptr);
     zfree(c);
-    if (config.num_threads) pthread_mutex_lock(&(config.liveclients_mutex));
-    config.liveclients--;
-    ln = listSearchKey(config.clients,c);
-    assert(ln != NULL);
-    listDelNode(config.clients,ln);
-    if (config.num_threads) pthread_mutex_unlock(&(config.liveclients_mutex));
 }
 
-static void freeAllClients(void) {
-    listNode *ln = config.clients->head, *next;
+static void freeClientList(list *clients) {
+    listNode *ln = clients->head, *next;
 
     while(ln) {
         next = ln->next;
@@ -342,13 +447,278 @@ static void freeAllClients(void) {
     }
 }
 
+static void freeAllClients(void) {
+    int i;
+
+    freeClientList(config.stats.clients);
+    for (i = 0; config.threads && i < config.num_threads; i++)
+        freeClientList(config.threads[i]->stats.clients);
+}
+
 static void resetClient(client c) {
     aeEventLoop *el = CLIENT_GET_EVENTLOOP(c);
-    aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
-    aeDeleteFileEvent(el,c->context->fd,AE_READABLE);
-    aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,writeHandler,c);
+    if (c->context) {
+        aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+        aeDeleteFileEvent(el,c->context->fd,AE_READABLE);
+    }
     c->written = 0;
     c->pending = config.pipeline;
+    scheduleClientWrite(c);
+}
+
+static int sendTimerHandler(aeEventLoop *el, long long id, void *clientData) {
+    client c = clientData;
+    UNUSED(id);
+
+    c->send_timer = -1;
+    if (c->conn)
+        scheduleClientWrite(c);
+    else
+        aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,writeHandler,c);
+    return AE_NOMORE;
+}
+
+/* Arrange for the next request of the client to be written. In open loop
+ * mode (--rate) every client sends on a fixed timeline, whatever the time
+ * the server takes to reply, so wait for the intended time of the next send
+ * if it is still ahead. Time events have a millisecond resolution: the
+ * send may be early by less than a millisecond, never late. */
+static void scheduleClientWrite(client c) {
+    aeEventLoop *el = CLIENT_GET_EVENTLOOP(c);
+    long long wait = 0;
+
+    if (config.rate) wait = (long long)(c->next_send-ustime())/1000;
+    if (wait > 0)
+        c->send_timer = aeCreateTimeEvent(el,wait,sendTimerHandler,c,NULL);
+    else if (c->conn)
+        sendClientRequest(c);
+    else
+        aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,writeHandler,c);
+}
+
+/* Workloads.
+ *
+ * -r draws the keys from the distribution selected with --key-dist, and
+ * --mix replaces the single command of a run with a weighted mix of
+ * commands, built again for every request with values whose size follows
+ * --data-size-dist. */
+
+typedef struct mixEntry {
+    const char *name;       /* Command name, as sent */
+    const char *keyprefix;  /* Keys are <keyprefix>:{tag}:<12 digits> */
+    int nkeys;              /* Number of keys (MGET, MSET) */
+    int value;              /* Whether every key is followed by a value */
+    const char *field;      /* Hash field, sent after the key, or NULL */
+    long long weight;
+} mixEntry;
+
+static mixEntry mixCommands[] = {
+    {"GET","key",1,0,NULL,0},
+    {"SET","key",1,1,NULL,0},
+    {"INCR","counter",1,0,NULL,0},
+    {"DEL","key",1,0,NULL,0},
+    {"EXISTS","key",1,0,NULL,0},
+    {"MGET","key",10,0,NULL,0},
+    {"MSET","key",10,1,NULL,0},
+    {"LPUSH","mylist",1,1,NULL,0},
+    {"RPOP","mylist",1,0,NULL,0},
+    {"HSET","myhash",1,1,"field",0},
+    {"HGET","myhash",1,0,"field",0},
+    {NULL,NULL,0,0,NULL,0}
+};
+
+static double randomUnit(void) {
+    return random()/((double)RAND_MAX+1);
+}
+
+/* Zipf distribution as generated by YCSB (Gray et al., "Quickly generating
+ * billion-record synthetic databases"): the setup is linear in the number
+ * of keys, every draw is constant time. */
+static void initZipf(void) {
+    long long n = config.randomkeys_keyspacelen, i;
+    double theta = config.zipf_theta, zeta2;
+
+    config.zipf_zetan = 0;
+    for (i = 1; i <= n; i++) config.zipf_zetan += 1/pow((double)i,theta);
+    zeta2 = 1+1/pow(2.0,theta);
+    config.zipf_eta = (1-pow(2.0/n,1-theta))/(1-zeta2/config.zipf_zetan);
+}
+
+static long long nextZipfKey(long long n) {
+    double theta = config.zipf_theta;
+    double u = randomUnit(), uz = u*config.zipf_zetan;
+    long long k;
+
+    if (uz < 1) return 0;
+    if (uz < 1+pow(0.5,theta)) return 1 % n;
+    k = (long long)(n*pow(config.zipf_eta*u-config.zipf_eta+1,1/(1-theta)));
+    return k < n ? k : n-1;
+}
+
+/* Next key to use, in [0, keyspacelen). */
+static long long nextRandomKey(void) {
+    long long n = config.randomkeys_keyspacelen, hot, k;
+
+    if (n == 0) return 0;
+    switch(config.keydist) {
+    case KEYDIST_ZIPF:
+        return nextZipfKey(n);
+    case KEYDIST_HOTSPOT:
+        hot = (long long)(n*config.hotspot_keys);
+        if (hot < 1) hot = 1;
+        if (hot == n || randomUnit() < config.hotspot_prob)
+            return random() % hot;
+        return hot + random() % (n-hot);
+    case KEYDIST_SEQUENTIAL:
+        atomicGetIncr(config.sequential_key, k, 1);
+        return k % n;
+    default:
+        return random() % n;
+    }
+}
+
+/* Size of the next value sent by --mix. */
+static int nextDataSize(void) {
+    double size;
+
+    switch(config.datadist) {
+    case DATADIST_UNIFORM:
+        return config.datasize_min +
+               random() % (config.datasize_max-config.datasize_min+1);
+    case DATADIST_EXP:
+        size = -config.datasize*log(1-randomUnit());
+        if (size < 1) return 1;
+        return size < config.datasize_max ? (int)size : config.datasize_max;
+    default:
+        return config.datasize;
+    }
+}
+
+static sds mixAppendBulk(sds s, const char *p, size_t len) {
+    char buf[32];
+    int l = snprintf(buf,sizeof(buf),"$%zu\r\n",len);
+
+    s = sdscatlen(s,buf,l);
+    s = sdscatlen(s,p,len);
+    return sdscatlen(s,"\r\n",2);
+}
+
+static sds mixAppendCommand(sds s, mixEntry *e) {
+    char buf[64];
+    int j, l, argc = 1 + e->nkeys*(1+e->value) + (e->field != NULL);
+
+    l = snprintf(buf,sizeof(buf),"*%d\r\n",argc);
+    s = sdscatlen(s,buf,l);
+    s = mixAppendBulk(s,e->name,strlen(e->name));
+    for (j = 0; j < e->nkeys; j++) {
+        l = snprintf(buf,sizeof(buf),"%s:{tag}:%012lld",e->keyprefix,
+            nextRandomKey());
+        s = mixAppendBulk(s,buf,l);
+        if (e->field) s = mixAppendBulk(s,e->field,strlen(e->field));
+        if (e->value) s = mixAppendBulk(s,config.mixdata,nextDataSize());
+    }
+    return s;
+}
+
+/* Replace the pipeline of the client with new commands of the mix. */
+static void buildMixRequest(client c) {
+    int j, i;
+
+    sdsrange(c->obuf,0,c->prefixlen-1);
+    if (c->prefixlen == 0) sdsclear(c->obuf);
+    for (j = 0; j < config.pipeline; j++) {
+        long long w = random() % config.mix_weight;
+
+        for (i = 0; w >= config.mix[i].weight; i++) w -= config.mix[i].weight;
+        c->obuf = mixAppendCommand(c->obuf,&config.mix[i]);
+    }
+}
+
+/* Parse the argument of --mix, "<command>:<weight>[:<keys>],...". */
+static int parseMix(const char *spec) {
+    sds *parts;
+    int count, j, ok = 1;
+
+    parts = sdssplitlen(spec,strlen(spec),",",1,&count);
+    zfree(config.mix);
+    config.mix = zcalloc(sizeof(mixEntry)*(count ? count : 1));
+    config.mix_count = 0;
+    config.mix_weight = 0;
+    for (j = 0; j < count && ok; j++) {
+        mixEntry *e = config.mix+config.mix_count;
+        char *name = parts[j], *weight = strchr(name,':'), *nkeys = NULL;
+        int i;
+
+        if (weight) {
+            *weight++ = '\0';
+            if ((nkeys = strchr(weight,':')) != NULL) *nkeys++ = '\0';
+        }
+        for (i = 0; mixCommands[i].name; i++)
+            if (!strcasecmp(mixCommands[i].name,name)) break;
+        if (mixCommands[i].name == NULL) {
+            fprintf(stderr,"Unsupported command in --mix: %s\n",name);
+            ok = 0;
+            break;
+        }
+        *e = mixCommands[i];
+        e->weight = weight ? atoll(weight) : 1;
+        if (nkeys && e->nkeys > 1) e->nkeys = atoi(nkeys);
+        if (e->weight <= 0 || e->nkeys < 1) ok = 0;
+        config.mix_weight += e->weight;
+        config.mix_count++;
+    }
+    sdsfreesplitres(parts,count);
+    if (config.mix_count == 0) ok = 0;
+    return ok;
+}
+
+/* Parse the argument of --key-dist. */
+static int parseKeyDist(const char *spec) {
+    if (!strcasecmp(spec,"uniform")) {
+        config.keydist = KEYDIST_UNIFORM;
+    } else if (!strncasecmp(spec,"zipf",4)) {
+        config.keydist = KEYDIST_ZIPF;
+        if (spec[4] == ':') config.zipf_theta = atof(spec+5);
+        else if (spec[4] != '\0') return 0;
+        if (config.zipf_theta <= 0 || config.zipf_theta >= 1) return 0;
+    } else if (!strncasecmp(spec,"hotspot",7)) {
+        config.keydist = KEYDIST_HOTSPOT;
+        if (spec[7] == ':') {
+            if (sscanf(spec+8,"%lf:%lf",&config.hotspot_keys,
+                       &config.hotspot_prob) != 2) return 0;
+        } else if (spec[7] != '\0') {
+            return 0;
+        }
+        if (config.hotspot_keys <= 0 || config.hotspot_keys > 1 ||
+            config.hotspot_prob < 0 || config.hotspot_prob > 1) return 0;
+    } else if (!strcasecmp(spec,"sequential")) {
+        config.keydist = KEYDIST_SEQUENTIAL;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/* Parse the argument of --data-size-dist. */
+static int parseDataSizeDist(const char *spec) {
+    if (!strcasecmp(spec,"fixed")) {
+        config.datadist = DATADIST_FIXED;
+    } else if (!strncasecmp(spec,"uniform:",8)) {
+        config.datadist = DATADIST_UNIFORM;
+        if (sscanf(spec+8,"%d:%d",&config.datasize_min,
+                   &config.datasize_max) != 2) return 0;
+        if (config.datasize_min < 1 ||
+            config.datasize_max < config.datasize_min ||
+            config.datasize_max > MAX_DATASIZE) return 0;
+    } else if (!strncasecmp(spec,"exp:",4)) {
+        config.datadist = DATADIST_EXP;
+        config.datasize = atoi(spec+4);
+        if (config.datasize < 1 || config.datasize > MAX_DATASIZE/16)
+            return 0;
+    } else {
+        return 0;
+    }
+    return 1;
 }
 
 static void randomizeClientKey(client c) {
@@ -356,9 +726,7 @@ static void randomizeClientKey(client c) {
 
     for (i = 0; i < c->randlen; i++) {
         char *p = c->randptr[i]+11;
-        size_t r = 0;
-        if (config.randomkeys_keyspacelen != 0)
-            r = random() % config.randomkeys_keyspacelen;
+        size_t r = nextRandomKey();
         size_t j;
 
         for (j = 0; j < 12; j++) {
@@ -396,9 +764,8 @@ static void setClusterKeyHashTag(client c) {
 }
 
 static void clientDone(client c) {
-    int requests_finished = 0;
-    atomicGet(config.requests_finished, requests_finished);
-    if (requests_finished >= config.requests) {
+    benchmarkStats *stats = CLIENT_GET_STATS(c);
+    if (stats->requests_finished >= stats->requests) {
         freeClient(c);
         if (!config.num_threads && config.el) aeStop(config.el);
         return;
@@ -406,16 +773,39 @@ static void clientDone(client c) {
     if (config.keepalive) {
         resetClient(c);
     } else {
-        if (config.num_threads) pthread_mutex_lock(&(config.liveclients_mutex));
-        config.liveclients--;
-        createMissingClients(c);
-        config.liveclients++;
-        if (config.num_threads)
-            pthread_mutex_unlock(&(config.liveclients_mutex));
+        /* Replace the client with a new connection served by the same
+         * loop, so that the loops keep their share of the clients. */
+        createClient(NULL,0,c,c->thread_id);
         freeClient(c);
     }
 }
 
+/* Print an error reply of the server, no more than once per second (-e). */
+static void showReplyError(client c, redisReply *r) {
+    /* TODO: static lasterr_time not thread-safe */
+    static time_t lasterr_time = 0;
+    time_t now = time(NULL);
+    if (lasterr_time != now) {
+        lasterr_time = now;
+        if (c->cluster_node) {
+            printf("Error from server %s:%d: %s\n",
+                   c->cluster_node->ip,
+                   c->cluster_node->port,
+                   r->str);
+        } else printf("Error from server: %s\n", r->str);
+    }
+}
+
+/* Account for a reply to one of the requests of the client. */
+static void clientRequestFinished(client c) {
+    benchmarkStats *stats = CLIENT_GET_STATS(c);
+    if (stats->requests_finished < stats->requests)
+        latHistRecord(stats->latency, c->latency);
+    atomicSet(stats->requests_finished,
+              stats->requests_finished+1);
+    c->pending--;
+}
+
 static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     client c = privdata;
     void *reply = NULL;
@@ -445,20 +835,7 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                 redisReply *r = reply;
                 int is_err = (r->type == REDIS_REPLY_ERROR);
 
-                if (is_err && config.showerrors) {
-                    /* TODO: static lasterr_time not thread-safe */
-                    static time_t lasterr_time = 0;
-                    time_t now = time(NULL);
-                    if (lasterr_time != now) {
-                        lasterr_time = now;
-                        if (c->cluster_node) {
-                            printf("Error from server %s:%d: %s\n",
-                                   c->cluster_node->ip,
-                                   c->cluster_node->port,
-                                   r->str);
-                        } else printf("Error from server: %s\n", r->str);
-                    }
-                }
+                if (is_err && config.showerrors) showReplyError(c,r);
 
                 /* Try to update slots configuration if reply error is
                  * MOVED/ASK/CLUSTERDOWN and the key(s) used by the command
@@ -500,11 +877,7 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                     }
                     continue;
                 }
-                int requests_finished = 0;
-                atomicGetIncr(config.requests_finished, requests_finished, 1);
-                if (requests_finished < config.requests)
-                    config.latency[requests_finished] = c->latency;
-                c->pending--;
+                clientRequestFinished(c);
                 if (c->pending == 0) {
                     clientDone(c);
                     break;
@@ -516,6 +889,34 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* Prepare the next request of the client: randomize the keys and take the
+ * start time. Returns 0, after freeing the client, if the loop already
+ * issued all its requests. */
+static int initClientRequest(client c) {
+    /* Enforce upper bound to number of requests. */
+    benchmarkStats *stats = CLIENT_GET_STATS(c);
+    if (stats->requests_issued++ >= stats->requests) {
+        freeClient(c);
+        return 0;
+    }
+
+    /* Really initialize: randomize keys and set start time. */
+    if (config.mix) buildMixRequest(c);
+    else if (config.randomkeys) randomizeClientKey(c);
+    if (config.cluster_mode && c->staglen > 0) setClusterKeyHashTag(c);
+    atomicGet(config.slots_last_update, c->slots_last_update);
+    c->start = ustime();
+    c->latency = -1;
+    /* In open loop mode the latency is measured from the intended send
+     * time, so that a stall of the server also counts for the requests
+     * that could not be sent during it (coordinated omission). */
+    if (config.rate) {
+        if (c->next_send < c->start) c->start = (long long)c->next_send;
+        c->next_send += config.rate_interval;
+    }
+    return 1;
+}
+
 static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     client c = privdata;
     UNUSED(el);
@@ -523,22 +924,7 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(mask);
 
     /* Initialize request when nothing was written. */
-    if (c->written == 0) {
-        /* Enforce upper bound to number of requests. */
-        int requests_issued = 0;
-        atomicGetIncr(config.requests_issued, requests_issued, 1);
-        if (requests_issued >= config.requests) {
-            freeClient(c);
-            return;
-        }
-
-        /* Really initialize: randomize keys and set start time. */
-        if (config.randomkeys) randomizeClientKey(c);
-        if (config.cluster_mode && c->staglen > 0) setClusterKeyHashTag(c);
-        atomicGet(config.slots_last_update, c->slots_last_update);
-        c->start = ustime();
-        c->latency = -1;
-    }
+    if (c->written == 0 && initClientRequest(c) == 0) return;
     if (sdslen(c->obuf) > c->written) {
         void *ptr = c->obuf+c->written;
         ssize_t nwritten = write(c->context->fd,ptr,sdslen(c->obuf)-c->written);
@@ -556,6 +942,224 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* Shared connections implementation. */
+
+/* hiredis ae adapter, as in hiredis/adapters/ae.h and sentinel.c. */
+typedef struct redisAeEvents {
+    redisAsyncContext *context;
+    aeEventLoop *loop;
+    int fd;
+    int reading, writing;
+} redisAeEvents;
+
+static void redisAeReadEvent(aeEventLoop *el, int fd, void *privdata, int mask) {
+    ((void)el); ((void)fd); ((void)mask);
+
+    redisAeEvents *e = (redisAeEvents*)privdata;
+    redisAsyncHandleRead(e->context);
+}
+
+static void redisAeWriteEvent(aeEventLoop *el, int fd, void *privdata, int mask) {
+    ((void)el); ((void)fd); ((void)mask);
+
+    redisAeEvents *e = (redisAeEvents*)privdata;
+    redisAsyncHandleWrite(e->context);
+}
+
+static void redisAeAddRead(void *privdata) {
+    redisAeEvents *e = (redisAeEvents*)privdata;
+    if (!e->reading) {
+        e->reading = 1;
+        aeCreateFileEvent(e->loop,e->fd,AE_READABLE,redisAeReadEvent,e);
+    }
+}
+
+static void redisAeDelRead(void *privdata) {
+    redisAeEvents *e = (redisAeEvents*)privdata;
+    if (e->reading) {
+        e->reading = 0;
+        aeDeleteFileEvent(e->loop,e->fd,AE_READABLE);
+    }
+}
+
+static void redisAeAddWrite(void *privdata) {
+    redisAeEvents *e = (redisAeEvents*)privdata;
+    if (!e->writing) {
+        e->writing = 1;
+        aeCreateFileEvent(e->loop,e->fd,AE_WRITABLE,redisAeWriteEvent,e);
+    }
+}
+
+static void redisAeDelWrite(void *privdata) {
+    redisAeEvents *e = (redisAeEvents*)privdata;
+    if (e->writing) {
+        e->writing = 0;
+        aeDeleteFileEvent(e->loop,e->fd,AE_WRITABLE);
+    }
+}
+
+static void redisAeCleanup(void *privdata) {
+    redisAeDelRead(privdata);
+    redisAeDelWrite(privdata);
+    zfree(privdata);
+}
+
+static void redisAeAttach(aeEventLoop *loop, redisAsyncContext *ac) {
+    redisAeEvents *e = zmalloc(sizeof(*e));
+
+    e->context = ac;
+    e->loop = loop;
+    e->fd = ac->c.fd;
+    e->reading = e->writing = 0;
+    ac->ev.addRead = redisAeAddRead;
+    ac->ev.delRead = redisAeDelRead;
+    ac->ev.addWrite = redisAeAddWrite;
+    ac->ev.delWrite = redisAeDelWrite;
+    ac->ev.cleanup = redisAeCleanup;
+    ac->ev.data = e;
+}
+
+static void connPoolDisconnected(const redisAsyncContext *ac, int status) {
+    connPool *pool = ac->data;
+    UNUSED(status);
+
+    if (pool->closing) return;
+    fprintf(stderr,"Error: %s\n",
+        ac->err ? ac->errstr : "Server closed the connection");
+    exit(1);
+}
+
+/* Open 'size' connections served by the loop 'el'. AUTH and SELECT are sent
+ * once per connection, ahead of the commands of the clients, so these do
+ * not need a prefix. */
+static connPool *createConnPool(aeEventLoop *el, int size) {
+    connPool *pool = zmalloc(sizeof(*pool));
+    int j;
+
+    pool->el = el;
+    pool->size = size;
+    pool->next = 0;
+    pool->closing = 0;
+    pool->conns = zmalloc(sizeof(redisAsyncContext*)*size);
+    for (j = 0; j < size; j++) {
+        redisAsyncContext *ac;
+
+        if (config.hostsocket == NULL)
+            ac = redisAsyncConnect(config.hostip,config.hostport);
+        else
+            ac = redisAsyncConnectUnix(config.hostsocket);
+        if (ac == NULL || ac->err) {
+            fprintf(stderr,"Could not connect to Redis at ");
+            if (config.hostsocket == NULL)
+                fprintf(stderr,"%s:%d",config.hostip,config.hostport);
+            else
+                fprintf(stderr,"%s",config.hostsocket);
+            fprintf(stderr,": %s\n",ac ? ac->errstr : "out of memory");
+            exit(1);
+        }
+        /* Replies are freed as soon as their callback returns. */
+        ac->c.reader->maxbuf = 0;
+        redisReaderSetZeroCopy(ac->c.reader,1);
+        ac->data = pool;
+        redisAeAttach(el,ac);
+        redisAsyncSetDisconnectCallback(ac,connPoolDisconnected);
+        if (config.auth) {
+            const char *argv[2] = {"AUTH", config.auth};
+            redisAsyncCommandArgv(ac,NULL,NULL,2,argv,NULL);
+        }
+        if (config.dbnum != 0) {
+            const char *argv[2] = {"SELECT", config.dbnumstr};
+            redisAsyncCommandArgv(ac,NULL,NULL,2,argv,NULL);
+        }
+        pool->conns[j] = ac;
+    }
+    return pool;
+}
+
+/* Free the connections. The callbacks of the requests still in flight are
+ * called with a NULL reply, and ignore it since 'closing' is set. */
+static void freeConnPool(connPool *pool) {
+    int j;
+
+    if (pool == NULL) return;
+    pool->closing = 1;
+    for (j = 0; j < pool->size; j++) redisAsyncFree(pool->conns[j]);
+    zfree(pool->conns);
+    zfree(pool);
+}
+
+static void createConnPools(void) {
+    int i;
+
+    if (!config.num_threads) {
+        config.pool = createConnPool(config.el,config.connections);
+        return;
+    }
+    for (i = 0; i < config.num_threads; i++)
+        config.threads[i]->pool =
+            createConnPool(config.threads[i]->el,config.connections);
+}
+
+static void freeConnPools(void) {
+    int i;
+
+    freeConnPool(config.pool);
+    config.pool = NULL;
+    for (i = 0; config.threads && i < config.num_threads; i++) {
+        freeConnPool(config.threads[i]->pool);
+        config.threads[i]->pool = NULL;
+    }
+}
+
+/* Length of the command starting at 'p' in the output buffer of a client,
+ * which only holds commands in the multi bulk format. */
+static size_t commandLength(const char *p) {
+    const char *s = strchr(p,'\n')+1;
+    long argc = strtol(p+1,NULL,10);
+
+    while (argc--) {
+        long len = strtol(s+1,NULL,10);
+        s = strchr(s,'\n')+1+len+2;
+    }
+    return s-p;
+}
+
+static void connReplyCallback(redisAsyncContext *ac, void *reply,
+                              void *privdata)
+{
+    client c = privdata;
+    redisReply *r = reply;
+
+    if (r == NULL) {
+        if (((connPool*)ac->data)->closing) return;
+        fprintf(stderr,"Error: %s\n",ac->errstr);
+        exit(1);
+    }
+
+    /* As in readHandler(), the latency of the pipeline is the one of its
+     * first reply. */
+    if (c->latency < 0) c->latency = ustime()-(c->start);
+    if (r->type == REDIS_REPLY_ERROR && config.showerrors)
+        showReplyError(c,r);
+    clientRequestFinished(c);
+    if (c->pending == 0) clientDone(c);
+}
+
+/* The writeHandler() of clients sharing a connection: queue the commands of
+ * the next request, each with its own callback. */
+static void sendClientRequest(client c) {
+    char *p, *end;
+
+    if (initClientRequest(c) == 0) return;
+    p = c->obuf;
+    end = c->obuf+sdslen(c->obuf);
+    while (p < end) {
+        size_t len = commandLength(p);
+        redisAsyncFormattedCommand(c->conn,connReplyCallback,c,p,len);
+        p += len;
+    }
+}
+
 /* Create a benchmark client, configured to send the command passed as 'cmd' of
  * 'len' bytes.
  *
@@ -581,11 +1185,17 @@ static client createClient(char *cmd, size_t len, client from, int thread_id) {
     int j;
     int is_cluster_client = (config.cluster_mode && thread_id >= 0);
     client c = zmalloc(sizeof(struct _client));
+    connPool *pool;
 
     const char *ip = NULL;
     int port = 0;
     c->cluster_node = NULL;
-    if (config.hostsocket == NULL || is_cluster_client) {
+    c->context = NULL;
+    c->conn = NULL;
+    c->thread_id = thread_id;
+    if ((pool = CLIENT_GET_POOL(c)) != NULL) {
+        c->conn = pool->conns[pool->next++ % pool->size];
+    } else if (config.hostsocket == NULL || is_cluster_client) {
         if (!is_cluster_client) {
             ip = config.hostip;
             port = config.hostport;
@@ -605,7 +1215,7 @@ static client createClient(char *cmd, size_t len, client from, int thread_id) {
     } else {
         c->context = redisConnectUnixNonBlock(config.hostsocket);
     }
-    if (c->context->err) {
+    if (c->context && c->context->err) {
         fprintf(stderr,"Could not connect to Redis at ");
         if (config.hostsocket == NULL || is_cluster_client)
             fprintf(stderr,"%s:%d: %s\n",ip,port,c->context->errstr);
@@ -613,9 +1223,20 @@ static client createClient(char *cmd, size_t len, client from, int thread_id) {
             fprintf(stderr,"%s: %s\n",config.hostsocket,c->context->errstr);
         exit(1);
     }
-    c->thread_id = thread_id;
-    /* Suppress hiredis cleanup of unused buffers for max speed. */
-    c->context->reader->maxbuf = 0;
+    c->send_timer = -1;
+    /* Spread the timelines of the clients over the interval, or continue
+     * the one of the client we replace. */
+    if (from)
+        c->next_send = from->next_send;
+    else
+        c->next_send = ustime()+config.rate_interval*random()/RAND_MAX;
+    if (c->context) {
+        /* Suppress hiredis cleanup of unused buffers for max speed. */
+        c->context->reader->maxbuf = 0;
+        /* Every reply is freed before the next read, so the bulk strings
+         * can point into the reader buffer instead of being copied. */
+        redisReaderSetZeroCopy(c->context->reader,1);
+    }
 
     /* Build the request buffer:
      * Queue N requests accordingly to the pipeline size, or simply clone
@@ -625,7 +1246,7 @@ static client createClient(char *cmd, size_t len, client from, int thread_id) {
      * These commands are discarded after the first response, so if the client is
      * reused the commands will not be used again. */
     c->prefix_pending = 0;
-    if (config.auth) {
+    if (config.auth && c->context) {
         char *buf = NULL;
         int len = redisFormatCommand(&buf, "AUTH %s", config.auth);
         c->obuf = sdscatlen(c->obuf, buf, len);
@@ -637,7 +1258,7 @@ static client createClient(char *cmd, size_t len, client from, int thread_id) {
      * buffer with the SELECT command, that will be discarded the first
      * time the replies are received, so if the client is reused the
      * SELECT command will not be used again. */
-    if (config.dbnum != 0 && !is_cluster_client) {
+    if (config.dbnum != 0 && !is_cluster_client && c->context) {
         c->obuf = sdscatprintf(c->obuf,"*2\r\n$6\r\nSELECT\r\n$%d\r\n%s\r\n",
             (int)sdslen(config.dbnumstr),config.dbnumstr);
         c->prefix_pending++;
@@ -719,15 +1340,15 @@ static client createClient(char *cmd, size_t len, client from, int thread_id) {
             }
         }
     }
-    aeEventLoop *el = NULL;
-    if (thread_id < 0) el = config.el;
-    else {
-        benchmarkThread *thread = config.threads[thread_id];
-        el = thread->el;
+    if (config.idlemode == 0) {
+        /* Shared connections are only used by their loop, once it runs. */
+        if (c->conn)
+            c->send_timer = aeCreateTimeEvent(CLIENT_GET_EVENTLOOP(c),0,
+                                              sendTimerHandler,c,NULL);
+        else
+            scheduleClientWrite(c);
     }
-    if (config.idlemode == 0)
-        aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,writeHandler,c);
-    listAddNodeTail(config.clients,c);
+    listAddNodeTail(CLIENT_GET_STATS(c)->clients,c);
     atomicIncr(config.liveclients, 1);
     atomicGet(config.slots_last_update, c->slots_last_update);
     return c;
@@ -749,8 +1370,94 @@ static void createMissingClients(client c) {
     }
 }
 
-static int compareLatency(const void *a, const void *b) {
-    return (*(long long*)a)-(*(long long*)b);
+/* Latency histograms implementation. */
+
+/* Index of the bucket holding the value 'v'. */
+static int latHistIndex(latencyHistogram *h, long long v) {
+    int shift;
+
+    if (v < (1LL << h->sub_bits)) return (int)v;
+    shift = (63 - __builtin_clzll((unsigned long long)v)) - h->sub_bits + 1;
+    return (shift << (h->sub_bits-1)) + (int)(v >> shift);
+}
+
+/* Highest value that falls into the bucket 'idx'. */
+static long long latHistBucketMax(latencyHistogram *h, int idx) {
+    int shift;
+    long long m;
+
+    if (idx < (1 << h->sub_bits)) return idx;
+    shift = (idx >> (h->sub_bits-1)) - 1;
+    m = idx - ((long long)shift << (h->sub_bits-1));
+    return ((m+1) << shift) - 1;
+}
+
+static latencyHistogram *latHistCreate(int digits) {
+    latencyHistogram *h = zmalloc(sizeof(*h));
+    long long ratio = 1;
+
+    /* The buckets of a power of two must be 10^digits at least. */
+    h->sub_bits = 1;
+    while (digits--) ratio *= 10;
+    while ((1LL << (h->sub_bits-1)) < ratio) h->sub_bits++;
+    h->buckets = latHistIndex(h,LATENCY_HIST_MAX_US)+1;
+    h->counts = zcalloc(sizeof(long long)*h->buckets);
+    latHistReset(h);
+    return h;
+}
+
+static void latHistFree(latencyHistogram *h) {
+    if (h == NULL) return;
+    zfree(h->counts);
+    zfree(h);
+}
+
+static void latHistReset(latencyHistogram *h) {
+    memset(h->counts,0,sizeof(long long)*h->buckets);
+    h->count = 0;
+    h->sum = 0;
+    h->min = LLONG_MAX;
+    h->max = 0;
+}
+
+static void latHistRecord(latencyHistogram *h, long long us) {
+    if (us < 0) us = 0;
+    if (us > LATENCY_HIST_MAX_US) us = LATENCY_HIST_MAX_US;
+    h->counts[latHistIndex(h,us)]++;
+    h->count++;
+    h->sum += us;
+    if (us < h->min) h->min = us;
+    if (us > h->max) h->max = us;
+}
+
+/* Add the counters of 'src' to 'dst'. Both must use the same digits. */
+static void latHistMerge(latencyHistogram *dst, latencyHistogram *src) {
+    int i;
+
+    for (i = 0; i < src->buckets; i++) dst->counts[i] += src->counts[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+/* Value under which 'perc' percent of the recorded values are, reported as
+ * the highest value of its bucket, like HdrHistogram does. */
+static long long latHistPercentile(latencyHistogram *h, double perc) {
+    long long target, seen = 0;
+    int i;
+
+    if (h->count == 0) return 0;
+    target = (long long)ceil(perc/100*h->count);
+    if (target < 1) target = 1;
+    for (i = 0; i < h->buckets; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            long long v = latHistBucketMax(h,i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
 }
 
 static int ipow(int base, int exp) {
@@ -764,9 +1471,10 @@ static int ipow(int base, int exp) {
 }
 
 static void showLatencyReport(void) {
-    int i, curlat = 0;
-    int usbetweenlat = ipow(10, MAX_LATENCY_PRECISION-config.precision);
-    float perc, reqpersec;
+    latencyHistogram *h = config.latency;
+    long long seen = 0, curlat = 0;
+    int i, precision = 0, have_line = 0;
+    float reqpersec;
 
     reqpersec = (float)config.requests_finished/((float)config.totlatency/1000);
     if (!config.quiet && !config.csv) {
@@ -776,6 +1484,18 @@ static void showLatencyReport(void) {
         printf("  %d parallel clients\n", config.numclients);
         printf("  %d bytes payload\n", config.datasize);
         printf("  keep alive: %d\n", config.keepalive);
+        if (config.rate)
+            printf("  open loop: %lld requests per second\n", config.rate);
+        if (config.randomkeys && config.keydist == KEYDIST_ZIPF)
+            printf("  keys: zipf (theta %.2f) over %d keys\n",
+                config.zipf_theta, config.randomkeys_keyspacelen);
+        else if (config.randomkeys && config.keydist == KEYDIST_HOTSPOT)
+            printf("  keys: %.0f%% of the requests on %.0f%% of %d keys\n",
+                config.hotspot_prob*100, config.hotspot_keys*100,
+                config.randomkeys_keyspacelen);
+        else if (config.randomkeys && config.keydist == KEYDIST_SEQUENTIAL)
+            printf("  keys: sequential over %d keys\n",
+                config.randomkeys_keyspacelen);
         if (config.cluster_mode) {
             printf("  cluster mode: yes (%d masters)\n",
                    config.cluster_node_count);
@@ -803,25 +1523,47 @@ static void showLatencyReport(void) {
 
         printf("\n");
 
-        qsort(config.latency,config.requests,sizeof(long long),compareLatency);
-        for (i = 0; i < config.requests; i++) {
-            if (config.latency[i]/usbetweenlat != curlat ||
-                i == (config.requests-1))
-            {
-                /* After the 2 milliseconds latency to have percentages split
-                 * by decimals will just add a lot of noise to the output. */
-                if (config.latency[i] >= 2000) {
-                    config.precision = 0;
-                    usbetweenlat = ipow(10,
-                        MAX_LATENCY_PRECISION-config.precision);
-                }
-
-                curlat = config.latency[i]/usbetweenlat;
-                perc = ((float)(i+1)*100)/config.requests;
-                printf("%.2f%% <= %.*f milliseconds\n", perc, config.precision,
-                    curlat/pow(10.0, config.precision));
+        /* Cumulative distribution, one line per latency at the requested
+         * precision. After the 2 milliseconds latency to have percentages
+         * split by decimals will just add a lot of noise to the output. */
+        for (i = 0; i < h->buckets; i++) {
+            long long v, lat;
+            int prec, us;
+
+            if (h->counts[i] == 0) continue;
+            v = latHistBucketMax(h,i);
+            if (v > h->max) v = h->max;
+            prec = v >= 2000 ? 0 : config.precision;
+            /* Round up, as the line is an upper bound. */
+            us = ipow(10, MAX_LATENCY_PRECISION-prec);
+            lat = (v+us-1)/us;
+            if (have_line && (lat != curlat || prec != precision)) {
+                printf("%.2f%% <= %.*f milliseconds\n",
+                    (float)seen*100/h->count, precision,
+                    curlat/pow(10.0, precision));
             }
+            seen += h->counts[i];
+            curlat = lat;
+            precision = prec;
+            have_line = 1;
         }
+        if (have_line) {
+            printf("%.2f%% <= %.*f milliseconds\n",
+                (float)seen*100/h->count, precision,
+                curlat/pow(10.0, precision));
+        }
+
+        printf("\nlatency summary (msec):\n");
+        printf("  %9s %9s %9s %9s %9s %9s %9s\n",
+            "avg", "min", "p50", "p99", "p99.9", "p99.99", "max");
+        printf("  %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+            h->count ? (double)h->sum/h->count/1000 : 0,
+            h->count ? (double)h->min/1000 : 0,
+            (double)latHistPercentile(h,50)/1000,
+            (double)latHistPercentile(h,99)/1000,
+            (double)latHistPercentile(h,99.9)/1000,
+            (double)latHistPercentile(h,99.99)/1000,
+            (double)h->max/1000);
         printf("%.2f requests per second\n\n", reqpersec);
     } else if (config.csv) {
         printf("\"%s\",\"%.2f\"\n", config.title, reqpersec);
@@ -830,6 +1572,50 @@ static void showLatencyReport(void) {
     }
 }
 
+static void initBenchmarkStats(benchmarkStats *stats) {
+    stats->requests = 0;
+    stats->requests_issued = 0;
+    stats->requests_finished = 0;
+    stats->latency = latHistCreate(config.latency_digits);
+    stats->clients = listCreate();
+    pthread_mutex_init(&stats->requests_finished_mutex,NULL);
+}
+
+static void freeBenchmarkStats(benchmarkStats *stats) {
+    latHistFree(stats->latency);
+    listRelease(stats->clients);
+    pthread_mutex_destroy(&stats->requests_finished_mutex);
+}
+
+/* Requests finished by all the loops so far. */
+static int getRequestsFinished(void) {
+    int i, finished, total;
+
+    atomicGet(config.stats.requests_finished,total);
+    for (i = 0; config.threads && i < config.num_threads; i++) {
+        atomicGet(config.threads[i]->stats.requests_finished,finished);
+        total += finished;
+    }
+    return total;
+}
+
+/* Split the requests among the threads, in proportion of the number of
+ * clients each one serves, so that they all finish at about the same
+ * time and a thread without clients has nothing to wait for. */
+static void assignThreadRequests(void) {
+    long long clients = 0;
+    int i;
+
+    for (i = 0; i < config.num_threads; i++) {
+        benchmarkStats *stats = &config.threads[i]->stats;
+        long long from = (long long)config.requests*clients/config.numclients;
+
+        clients += listLength(stats->clients);
+        stats->requests =
+            (long long)config.requests*clients/config.numclients - from;
+    }
+}
+
 static void initBenchmarkThreads() {
     int i;
     if (config.threads) freeBenchmarkThreads();
@@ -855,23 +1641,35 @@ static void startBenchmarkThreads() {
 
 static void benchmark(char *title, char *cmd, int len) {
     client c;
+    int i;
 
     config.title = title;
-    config.requests_issued = 0;
     config.requests_finished = 0;
+    config.stats.requests = config.num_threads ? 0 : config.requests;
+    config.stats.requests_issued = 0;
+    config.stats.requests_finished = 0;
+    latHistReset(config.stats.latency);
 
     if (config.num_threads) initBenchmarkThreads();
+    if (config.connections) createConnPools();
 
     int thread_id = config.num_threads > 0 ? 0 : -1;
     c = createClient(cmd,len,NULL,thread_id);
     createMissingClients(c);
+    if (config.num_threads) assignThreadRequests();
 
     config.start = mstime();
     if (!config.num_threads) aeMain(config.el);
     else startBenchmarkThreads();
     config.totlatency = mstime()-config.start;
+    config.requests_finished = getRequestsFinished();
+    latHistReset(config.latency);
+    latHistMerge(config.latency,config.stats.latency);
+    for (i = 0; i < config.num_threads; i++)
+        latHistMerge(config.latency,config.threads[i]->stats.latency);
 
     showLatencyReport();
+    freeConnPools();
     freeAllClients();
     if (config.threads) freeBenchmarkThreads();
 }
@@ -883,12 +1681,15 @@ static benchmarkThread *createBenchmarkThread(int index) {
     if (thread == NULL) return NULL;
     thread->index = index;
     thread->el = aeCreateEventLoop(1024*10);
-    aeCreateTimeEvent(thread->el,1,showThroughput,NULL,NULL);
+    thread->pool = NULL;
+    initBenchmarkStats(&thread->stats);
+    aeCreateTimeEvent(thread->el,1,showThroughput,thread,NULL);
     return thread;
 }
 
 static void freeBenchmarkThread(benchmarkThread *thread) {
     if (thread->el) aeDeleteEventLoop(thread->el);
+    freeBenchmarkStats(&thread->stats);
     zfree(thread);
 }
 
@@ -1294,7 +2095,7 @@ int parseOptions(int argc, const char **argv) {
             if (lastarg) goto invalid;
             config.datasize = atoi(argv[++i]);
             if (config.datasize < 1) config.datasize=1;
-            if (config.datasize > 1024*1024*1024) config.datasize = 1024*1024*1024;
+            if (config.datasize > MAX_DATASIZE) config.datasize = MAX_DATASIZE;
         } else if (!strcmp(argv[i],"-P")) {
             if (lastarg) goto invalid;
             config.pipeline = atoi(argv[++i]);
@@ -1340,6 +2141,26 @@ int parseOptions(int argc, const char **argv) {
             config.precision = atoi(argv[++i]);
             if (config.precision < 0) config.precision = 0;
             if (config.precision > MAX_LATENCY_PRECISION) config.precision = MAX_LATENCY_PRECISION;
+        } else if (!strcmp(argv[i],"--latency-digits")) {
+            if (lastarg) goto invalid;
+            config.latency_digits = atoi(argv[++i]);
+            if (config.latency_digits < 1) config.latency_digits = 1;
+            if (config.latency_digits > LATENCY_HIST_MAX_DIGITS)
+                config.latency_digits = LATENCY_HIST_MAX_DIGITS;
+        } else if (!strcmp(argv[i],"--key-dist")) {
+            if (lastarg) goto invalid;
+            if (!parseKeyDist(argv[++i])) goto invalid;
+        } else if (!strcmp(argv[i],"--data-size-dist")) {
+            if (lastarg) goto invalid;
+            if (!parseDataSizeDist(argv[++i])) goto invalid;
+        } else if (!strcmp(argv[i],"--mix")) {
+            if (lastarg) goto invalid;
+            config.mixspec = argv[++i];
+            if (!parseMix(config.mixspec)) goto invalid;
+        } else if (!strcmp(argv[i],"--rate")) {
+            if (lastarg) goto invalid;
+            config.rate = atoll(argv[++i]);
+            if (config.rate < 0) config.rate = 0;
         } else if (!strcmp(argv[i],"--threads")) {
              if (lastarg) goto invalid;
              config.num_threads = atoi(argv[++i]);
@@ -1348,6 +2169,10 @@ int parseOptions(int argc, const char **argv) {
                        MAX_THREADS);
                 config.num_threads = MAX_THREADS;
              } else if (config.num_threads < 0) config.num_threads = 0;
+        } else if (!strcmp(argv[i],"--connections")) {
+            if (lastarg) goto invalid;
+            config.connections = atoi(argv[++i]);
+            if (config.connections < 0) config.connections = 0;
         } else if (!strcmp(argv[i],"--cluster")) {
             config.cluster_mode = 1;
         } else if (!strcmp(argv[i],"--help")) {
@@ -1379,6 +2204,10 @@ usage:
 " -d <size>          Data size of SET/GET value in bytes (default 3)\n"
 " --dbnum <db>       SELECT the specified db number (default 0)\n"
 " --threads <num>    Enable multi-thread mode.\n"
+" --connections <num> Share <num> connections per thread (or overall without\n"
+"                    --threads) between the clients, pipelining the commands\n"
+"                    of the clients automatically. Default 0: one connection\n"
+"                    per client.\n"
 " --cluster          Enable cluster mode.\n"
 " -k <boolean>       1=keep alive 0=reconnect (default 1)\n"
 " -r <keyspacelen>   Use random keys for SET/GET/INCR, random values for SADD\n"
@@ -1392,11 +2221,29 @@ usage:
 "                    (no more than 1 error per second is displayed)\n"
 " -q                 Quiet. Just show query/sec values\n"
 " --precision        Number of decimal places to display in latency output (default 0)\n"
+" --latency-digits <digits> Significant digits kept by the latency histograms,\n"
+"                    from 1 to 4 (default 3).\n"
 " --csv              Output in CSV format\n"
 " -l                 Loop. Run the tests forever\n"
 " -t <tests>         Only run the comma separated list of tests. The test\n"
 "                    names are the same as the ones produced as output.\n"
-" -I                 Idle mode. Just open N idle connections and wait.\n\n"
+" -I                 Idle mode. Just open N idle connections and wait.\n"
+" --rate <rps>       Open loop mode: send <rps> requests per second overall,\n"
+"                    every client on a fixed timeline, and measure latency\n"
+"                    from the intended send time, so that server stalls are\n"
+"                    not hidden by the clients waiting for replies.\n"
+" --key-dist <dist>  Distribution of the keys drawn by -r: uniform (default),\n"
+"                    zipf[:<theta>] with 0 < theta < 1 (default 0.99),\n"
+"                    hotspot[:<keys>:<prob>] where the fraction <keys> of the\n"
+"                    keyspace gets <prob> of the requests (default 0.2:0.8),\n"
+"                    or sequential.\n"
+" --mix <commands>   Run a single test mixing the given commands with the\n"
+"                    given weights, as in \"get:80,set:20,mget:5:20\" (the\n"
+"                    third field is the number of keys of MGET and MSET).\n"
+"                    Supported: get, set, incr, del, exists, mget, mset,\n"
+"                    lpush, rpop, hset, hget. Keys are drawn as with -r.\n"
+" --data-size-dist <dist> Size of the values sent by --mix: fixed (-d, the\n"
+"                    default), uniform:<min>:<max> or exp:<mean>.\n\n"
 "Examples:\n\n"
 " Run the benchmark with the default configuration against 127.0.0.1:6379:\n"
 "   $ redis-benchmark\n\n"
@@ -1419,21 +2266,25 @@ usage:
 int showThroughput(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     UNUSED(eventLoop);
     UNUSED(id);
-    UNUSED(clientData);
+    benchmarkThread *thread = clientData;
+    latencyHistogram *h = config.stats.latency;
     int liveclients = 0;
-    int requests_finished = 0;
+    int requests_finished = getRequestsFinished();
     atomicGet(config.liveclients, liveclients);
-    atomicGet(config.requests_finished, requests_finished);
 
-    if (liveclients == 0 && requests_finished != config.requests) {
+    if (liveclients == 0 && requests_finished < config.requests) {
         fprintf(stderr,"All clients disconnected... aborting.\n");
         exit(1);
     }
-    if (config.num_threads && requests_finished >= config.requests) {
+    if (thread && !config.idlemode &&
+        thread->stats.requests_finished >= thread->stats.requests)
+    {
         aeStop(eventLoop);
         return AE_NOMORE;
     }
     if (config.csv) return 250;
+    /* With threads only the first one reports, for all of them. */
+    if (thread && thread->index != 0) return 250;
     if (config.idlemode == 1) {
         printf("clients: %d\r", config.liveclients);
         fflush(stdout);
@@ -1441,7 +2292,20 @@ int showThroughput(struct aeEventLoop *eventLoop, long long id, void *clientData
     }
     float dt = (float)(mstime()-config.start)/1000.0;
     float rps = (float)requests_finished/dt;
-    printf("%s: %.2f\r", config.title, rps);
+    /* The histograms of the other threads are read while they are updated,
+     * so the percentiles may miss the last few requests. */
+    if (config.num_threads) {
+        int i;
+
+        h = config.live_latency;
+        latHistReset(h);
+        for (i = 0; i < config.num_threads; i++)
+            latHistMerge(h,config.threads[i]->stats.latency);
+    }
+    printf("%s: %.2f (p50=%.3f p99=%.3f p99.9=%.3f msec)\r", config.title,
+        rps, (double)latHistPercentile(h,50)/1000,
+        (double)latHistPercentile(h,99)/1000,
+        (double)latHistPercentile(h,99.9)/1000);
     fflush(stdout);
     return 250; /* every 250ms */
 }
@@ -1482,12 +2346,26 @@ int main(int argc, const char **argv) {
     config.showerrors = 0;
     config.randomkeys = 0;
     config.randomkeys_keyspacelen = 0;
+    config.keydist = KEYDIST_UNIFORM;
+    config.zipf_theta = 0.99;
+    config.hotspot_keys = 0.2;
+    config.hotspot_prob = 0.8;
+    config.sequential_key = 0;
+    config.datadist = DATADIST_FIXED;
+    config.mixdata = NULL;
+    config.mix = NULL;
+    config.mix_count = 0;
+    config.mix_weight = 0;
+    config.mixspec = NULL;
     config.quiet = 0;
     config.csv = 0;
     config.loop = 0;
     config.idlemode = 0;
+    config.rate = 0;
+    config.rate_interval = 0;
     config.latency = NULL;
-    config.clients = listCreate();
+    config.live_latency = NULL;
+    config.latency_digits = LATENCY_HIST_DEFAULT_DIGITS;
     config.hostip = "127.0.0.1";
     config.hostport = 6379;
     config.hostsocket = NULL;
@@ -1497,6 +2375,8 @@ int main(int argc, const char **argv) {
     config.precision = 1;
     config.num_threads = 0;
     config.threads = NULL;
+    config.connections = 0;
+    config.pool = NULL;
     config.cluster_mode = 0;
     config.cluster_node_count = 0;
     config.cluster_nodes = NULL;
@@ -1509,7 +2389,34 @@ int main(int argc, const char **argv) {
     argc -= i;
     argv += i;
 
-    config.latency = zmalloc(sizeof(long long)*config.requests);
+    config.latency = latHistCreate(config.latency_digits);
+    initBenchmarkStats(&config.stats);
+    if (config.keydist == KEYDIST_ZIPF && config.randomkeys_keyspacelen)
+        initZipf();
+    if (config.datadist == DATADIST_FIXED) {
+        config.datasize_min = config.datasize_max = config.datasize;
+    } else if (config.datadist == DATADIST_EXP) {
+        config.datasize_min = 1;
+        config.datasize_max = config.datasize*16;
+    }
+    if (config.mix) {
+        if (config.cluster_mode) {
+            fprintf(stderr, "--mix is not supported in cluster mode.\n");
+            exit(1);
+        }
+        config.mixdata = zmalloc(config.datasize_max);
+        memset(config.mixdata,'x',config.datasize_max);
+    }
+    if (config.connections && config.cluster_mode) {
+        fprintf(stderr, "--connections is not supported in cluster mode.\n");
+        exit(1);
+    }
+    if (config.rate) {
+        config.rate_interval =
+            (double)config.numclients*config.pipeline*1000000/config.rate;
+    }
+    if (config.num_threads)
+        config.live_latency = latHistCreate(config.latency_digits);
 
     if (config.cluster_mode) {
         /* Fetch cluster configuration. */
@@ -1554,13 +2461,12 @@ int main(int argc, const char **argv) {
     }
 
     if (config.num_threads > 0) {
-        pthread_mutex_init(&(config.requests_issued_mutex), NULL);
-        pthread_mutex_init(&(config.requests_finished_mutex), NULL);
         pthread_mutex_init(&(config.liveclients_mutex), NULL);
         pthread_mutex_init(&(config.is_fetching_slots_mutex), NULL);
         pthread_mutex_init(&(config.is_updating_slots_mutex), NULL);
         pthread_mutex_init(&(config.updating_slots_mutex), NULL);
         pthread_mutex_init(&(config.slots_last_update_mutex), NULL);
+        pthread_mutex_init(&(config.sequential_key_mutex), NULL);
     }
 
     if (config.keepalive == 0) {
@@ -1581,6 +2487,18 @@ int main(int argc, const char **argv) {
         /* and will wait for every */
     }
 
+    /* Run the mix of commands of --mix. */
+    if (config.mix) {
+        sds title = sdscatprintf(sdsempty(),"MIX (%s)",config.mixspec);
+
+        do {
+            benchmark(title,"",0);
+        } while(config.loop);
+
+        if (config.redis_config != NULL) freeRedisConfig(config.redis_config);
+        return 0;
+    }
+
     /* Run benchmark with command in the remainder of the arguments. */
     if (argc) {
         sds title = sdsnew(argv[0]);
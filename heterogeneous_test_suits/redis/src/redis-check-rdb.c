@@ -31,22 +31,37 @@
 #include "rdb.h"
 
 #include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 void createSharedObjects(void);
 void rdbLoadProgressCallback(rio *r, const void *buf, size_t len);
 int rdbCheckMode = 0;
 
-struct {
+typedef struct rdbCheckState {
     rio *rio;
     robj *key;                      /* Current key we are reading. */
     int key_type;                   /* Current key type if != -1. */
-    unsigned long keys;             /* Number of keys processed. */
-    unsigned long expires;          /* Number of keys with an expire. */
-    unsigned long already_expired;  /* Number of keys already expired. */
     int doing;                      /* The state while reading the RDB. */
     int error_set;                  /* True if error is populated. */
     char error[1024];
-} rdbstate;
+} rdbCheckState;
+
+/* Every thread reading the RDB has its own state, so that errors are
+ * reported with the offset and the key of the thread that found them. */
+static __thread rdbCheckState rdbstate;
+
+struct {
+    unsigned long keys;             /* Number of keys processed. */
+    unsigned long expires;          /* Number of keys with an expire. */
+    unsigned long already_expired;  /* Number of keys already expired. */
+} rdbstats;
+
+/* Options of redis-check-rdb. */
+static int rdbCheckFast = 0;        /* --fast: skip the values. */
+static int rdbCheckThreads = 0;     /* --threads, 0 for one per core. */
+
+static pthread_mutex_t rdbCheckOutputLock = PTHREAD_MUTEX_INITIALIZER;
 
 /* At every loading step try to remember what we were about to do, so that
  * we can log this information when an error is encountered. */
@@ -88,11 +103,11 @@ char *rdb_type_string[] = {
     "stream"
 };
 
-/* Show a few stats collected into 'rdbstate' */
+/* Show a few stats collected into 'rdbstats' */
 void rdbShowGenericInfo(void) {
-    printf("[info] %lu keys read\n", rdbstate.keys);
-    printf("[info] %lu expires\n", rdbstate.expires);
-    printf("[info] %lu already expired\n", rdbstate.already_expired);
+    printf("[info] %lu keys read\n", rdbstats.keys);
+    printf("[info] %lu expires\n", rdbstats.expires);
+    printf("[info] %lu already expired\n", rdbstats.already_expired);
 }
 
 /* Called on RDB errors. Provides details about the RDB and the offset
@@ -105,6 +120,7 @@ void rdbCheckError(const char *fmt, ...) {
     vsnprintf(msg, sizeof(msg), fmt, ap);
     va_end(ap);
 
+    pthread_mutex_lock(&rdbCheckOutputLock);
     printf("--- RDB ERROR DETECTED ---\n");
     printf("[offset %llu] %s\n",
         (unsigned long long) (rdbstate.rio ?
@@ -121,6 +137,7 @@ void rdbCheckError(const char *fmt, ...) {
              sizeof(rdb_type_string)/sizeof(char*)) ?
                 rdb_type_string[rdbstate.key_type] : "unknown");
     rdbShowGenericInfo();
+    pthread_mutex_unlock(&rdbCheckOutputLock);
 }
 
 /* Print informations during RDB checking. */
@@ -172,23 +189,479 @@ void rdbCheckSetupSignals(void) {
     sigaction(SIGILL, &act, NULL);
 }
 
+/* Report the error of the last failed read with rdbstate.error, or as an
+ * unexpected EOF if the loading functions didn't tell more. */
+static void rdbCheckReadError(void) {
+    if (rdbstate.error_set) {
+        rdbCheckError(rdbstate.error);
+    } else {
+        rdbCheckError("Unexpected EOF reading RDB file");
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Skipping values
+ *
+ * With the file mapped in memory the structure of a value can be checked
+ * without creating it: the lengths are read and the bytes they cover are
+ * skipped, compressed strings included, as rdbLoadObject() would read them.
+ * -------------------------------------------------------------------------- */
+
+/* Skip 'len' bytes of the memory rio 'r'. */
+static int rdbCheckSkip(rio *r, uint64_t len) {
+    if (r->io.mem.len-r->io.mem.pos < len) return -1;
+    r->io.mem.pos += len;
+    r->processed_bytes += len;
+    return 0;
+}
+
+/* Skip a string as rdbGenericLoadStringObject() reads it. */
+static int rdbCheckSkipString(rio *r) {
+    int isencoded;
+    uint64_t len, clen;
+
+    if (rdbLoadLenByRef(r,&isencoded,&len) == -1) return -1;
+    if (!isencoded) return rdbCheckSkip(r,len);
+    switch(len) {
+    case RDB_ENC_INT8: return rdbCheckSkip(r,1);
+    case RDB_ENC_INT16: return rdbCheckSkip(r,2);
+    case RDB_ENC_INT32: return rdbCheckSkip(r,4);
+    case RDB_ENC_LZF:
+    case RDB_ENC_LZ4:
+    case RDB_ENC_ZSTD:
+        if (rdbLoadLenByRef(r,NULL,&clen) == -1 ||
+            rdbLoadLenByRef(r,NULL,&len) == -1) return -1;
+        return rdbCheckSkip(r,clen);
+    default:
+        rdbCheckSetError("Unknown RDB string encoding type %d",(int)len);
+        return -1;
+    }
+}
+
+/* Skip a value of the RDB type 'rdbtype' as rdbLoadObject() reads it in
+ * RDB check mode. Returns -1 on errors. */
+static int rdbCheckSkipObject(int rdbtype, rio *r) {
+    uint64_t len, pel_size, consumers, cgroups, opcode;
+    unsigned char byte;
+
+    switch(rdbtype) {
+    case RDB_TYPE_STRING:
+    case RDB_TYPE_HASH_ZIPMAP:
+    case RDB_TYPE_LIST_ZIPLIST:
+    case RDB_TYPE_SET_INTSET:
+    case RDB_TYPE_ZSET_ZIPLIST:
+    case RDB_TYPE_HASH_ZIPLIST:
+        return rdbCheckSkipString(r);
+    case RDB_TYPE_LIST:
+    case RDB_TYPE_SET:
+    case RDB_TYPE_LIST_QUICKLIST:
+        if (rdbLoadLenByRef(r,NULL,&len) == -1) return -1;
+        while(len--)
+            if (rdbCheckSkipString(r) == -1) return -1;
+        return 0;
+    case RDB_TYPE_HASH:
+        if (rdbLoadLenByRef(r,NULL,&len) == -1) return -1;
+        while(len--) {
+            if (rdbCheckSkipString(r) == -1 ||
+                rdbCheckSkipString(r) == -1) return -1;
+        }
+        return 0;
+    case RDB_TYPE_ZSET_2:
+    case RDB_TYPE_ZSET:
+        if (rdbLoadLenByRef(r,NULL,&len) == -1) return -1;
+        while(len--) {
+            if (rdbCheckSkipString(r) == -1) return -1;
+            if (rdbtype == RDB_TYPE_ZSET_2) {
+                if (rdbCheckSkip(r,sizeof(double)) == -1) return -1;
+                continue;
+            }
+            /* See rdbLoadDoubleValue(). */
+            if (rioRead(r,&byte,1) == 0) return -1;
+            if (byte < 253 && rdbCheckSkip(r,byte) == -1) return -1;
+        }
+        return 0;
+    case RDB_TYPE_STREAM_LISTPACKS:
+        /* See the stream part of rdbLoadObject(). */
+        if (rdbLoadLenByRef(r,NULL,&len) == -1) return -1;
+        while(len--) {
+            if (rdbCheckSkipString(r) == -1 ||
+                rdbCheckSkipString(r) == -1) return -1;
+        }
+        if (rdbLoadLenByRef(r,NULL,&len) == -1 ||
+            rdbLoadLenByRef(r,NULL,&len) == -1 ||
+            rdbLoadLenByRef(r,NULL,&len) == -1 ||
+            rdbLoadLenByRef(r,NULL,&cgroups) == -1) return -1;
+        while(cgroups--) {
+            if (rdbCheckSkipString(r) == -1 ||
+                rdbLoadLenByRef(r,NULL,&len) == -1 ||
+                rdbLoadLenByRef(r,NULL,&len) == -1 ||
+                rdbLoadLenByRef(r,NULL,&pel_size) == -1) return -1;
+            while(pel_size--) {
+                if (rdbCheckSkip(r,sizeof(streamID)+8) == -1 ||
+                    rdbLoadLenByRef(r,NULL,&len) == -1) return -1;
+            }
+            if (rdbLoadLenByRef(r,NULL,&consumers) == -1) return -1;
+            while(consumers--) {
+                if (rdbCheckSkipString(r) == -1 ||
+                    rdbCheckSkip(r,8) == -1 ||
+                    rdbLoadLenByRef(r,NULL,&pel_size) == -1) return -1;
+                if (pel_size > UINT64_MAX/sizeof(streamID) ||
+                    rdbCheckSkip(r,pel_size*sizeof(streamID)) == -1)
+                    return -1;
+            }
+        }
+        return 0;
+    case RDB_TYPE_MODULE_2:
+        /* See rdbLoadCheckModuleValue(). */
+        if (rdbLoadLenByRef(r,NULL,&len) == -1) return -1;
+        while(1) {
+            if (rdbLoadLenByRef(r,NULL,&opcode) == -1) return -1;
+            if (opcode == RDB_MODULE_OPCODE_EOF) return 0;
+            if (opcode == RDB_MODULE_OPCODE_SINT ||
+                opcode == RDB_MODULE_OPCODE_UINT)
+            {
+                if (rdbLoadLenByRef(r,NULL,&len) == -1) return -1;
+            } else if (opcode == RDB_MODULE_OPCODE_STRING) {
+                if (rdbCheckSkipString(r) == -1) return -1;
+            } else if (opcode == RDB_MODULE_OPCODE_FLOAT) {
+                if (rdbCheckSkip(r,sizeof(float)) == -1) return -1;
+            } else if (opcode == RDB_MODULE_OPCODE_DOUBLE) {
+                if (rdbCheckSkip(r,sizeof(double)) == -1) return -1;
+            }
+        }
+    default:
+        rdbCheckSetError("Values of RDB type %d can't be checked",rdbtype);
+        return -1;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Records
+ * -------------------------------------------------------------------------- */
+
+#define RDB_CHECK_SKIP 1    /* Skip the values instead of decoding them. */
+#define RDB_CHECK_QUIET 2   /* Don't log the DBs and the AUX fields. */
+
+/* Check the record at the current position of 'r': an opcode with its
+ * arguments, or a key with its value. The values are created with
+ * rdbLoadObject(), or only skipped with RDB_CHECK_SKIP, which needs a
+ * memory rio. An expire is stored in 'expiretime'. Returns the type of
+ * the record, or -1 on errors. */
+static int rdbCheckRecord(rio *r, int rdbver, int flags,
+                          long long *expiretime)
+{
+    uint64_t dbid, len;
+    int type;
+
+    rdbstate.doing = RDB_CHECK_DOING_READ_TYPE;
+    if ((type = rdbLoadType(r)) == -1) return -1;
+
+    if (type == RDB_OPCODE_EXPIRETIME) {
+        /* EXPIRETIME: load an expire associated with the next key
+         * to load. Note that after loading an expire we need to
+         * load the actual type, and continue. */
+        rdbstate.doing = RDB_CHECK_DOING_READ_EXPIRE;
+        if ((*expiretime = rdbLoadTime(r)) == -1) return -1;
+        *expiretime *= 1000;
+    } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
+        /* EXPIRETIME_MS: milliseconds precision expire times introduced
+         * with RDB v3. Like EXPIRETIME but no with more precision. */
+        rdbstate.doing = RDB_CHECK_DOING_READ_EXPIRE;
+        if ((*expiretime = rdbLoadMillisecondTime(r,rdbver)) == -1)
+            return -1;
+    } else if (type == RDB_OPCODE_FREQ) {
+        /* FREQ: LFU frequency. */
+        uint8_t byte;
+        if (rioRead(r,&byte,1) == 0) return -1;
+    } else if (type == RDB_OPCODE_IDLE) {
+        /* IDLE: LRU idle time. */
+        if (rdbLoadLenByRef(r,NULL,&len) == -1) return -1;
+    } else if (type == RDB_OPCODE_EOF) {
+        /* EOF: End of file. */
+    } else if (type == RDB_OPCODE_SELECTDB) {
+        /* SELECTDB: Select the specified database. */
+        rdbstate.doing = RDB_CHECK_DOING_READ_LEN;
+        if (rdbLoadLenByRef(r,NULL,&dbid) == -1) return -1;
+        if (!(flags & RDB_CHECK_QUIET))
+            rdbCheckInfo("Selecting DB ID %d", (int)dbid);
+    } else if (type == RDB_OPCODE_RESIZEDB) {
+        /* RESIZEDB: Hint about the size of the keys in the currently
+         * selected data base, in order to avoid useless rehashing. */
+        rdbstate.doing = RDB_CHECK_DOING_READ_LEN;
+        if (rdbLoadLenByRef(r,NULL,&len) == -1 ||
+            rdbLoadLenByRef(r,NULL,&len) == -1) return -1;
+    } else if (type == RDB_OPCODE_AUX) {
+        /* AUX: generic string-string fields. Use to add state to RDB
+         * which is backward compatible. Implementations of RDB loading
+         * are requierd to skip AUX fields they don't understand.
+         *
+         * An AUX field is composed of two strings: key and value. */
+        robj *auxkey, *auxval;
+        rdbstate.doing = RDB_CHECK_DOING_READ_AUX;
+        if ((auxkey = rdbLoadStringObject(r)) == NULL) return -1;
+        if ((auxval = rdbLoadStringObject(r)) == NULL) {
+            decrRefCount(auxkey);
+            return -1;
+        }
+        if (!(flags & RDB_CHECK_QUIET))
+            rdbCheckInfo("AUX FIELD %s = '%s'",
+                (char*)auxkey->ptr, (char*)auxval->ptr);
+        decrRefCount(auxkey);
+        decrRefCount(auxval);
+    } else if (!rdbIsObjectType(type)) {
+        rdbCheckSetError("Invalid object type: %d", type);
+        return -1;
+    } else if (flags & RDB_CHECK_SKIP) {
+        rdbstate.key_type = type;
+        rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
+        if (rdbCheckSkipString(r) == -1) return -1;
+        rdbstate.doing = RDB_CHECK_DOING_READ_OBJECT_VALUE;
+        if (rdbCheckSkipObject(type,r) == -1) return -1;
+        rdbstate.key_type = -1;
+    } else {
+        robj *key, *val;
+
+        rdbstate.key_type = type;
+        rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
+        if ((key = rdbLoadStringObject(r)) == NULL) return -1;
+        rdbstate.key = key;
+        rdbstate.doing = RDB_CHECK_DOING_READ_OBJECT_VALUE;
+        if ((val = rdbLoadObject(type,r,key)) == NULL) return -1;
+        rdbstate.key = NULL;
+        decrRefCount(key);
+        decrRefCount(val);
+        rdbstate.key_type = -1;
+    }
+    return type;
+}
+
+/* -----------------------------------------------------------------------------
+ * Checking the regions of a mapped file with multiple threads
+ *
+ * The file is mapped in memory and walked by the main thread, skipping the
+ * values, so that it can be cut in regions of whole records. The threads
+ * compute the CRC64 of the regions, combined in the order of the file by
+ * the main thread, and unless --fast is used they also decode the keys of
+ * the regions with rdbLoadObject(). The regions are only offsets in the
+ * mapping, and at most RDB_CHECK_REGIONS_PER_THREAD per thread are cut
+ * ahead of the oldest one not checked, so the threads read the pages the
+ * walk just brought in.
+ * -------------------------------------------------------------------------- */
+
+#define RDB_CHECK_REGION_BYTES (1024*1024*4)
+#define RDB_CHECK_REGIONS_PER_THREAD 4
+
+typedef struct rdbCheckRegion {
+    size_t start, end;          /* Offsets of the bytes of the region. */
+    uint64_t cksum;             /* CRC64 of the bytes of the region. */
+    int failed;                 /* Set if a key can't be decoded. */
+    int done;                   /* Set once checked. */
+} rdbCheckRegion;
+
+typedef struct rdbCheckJob {
+    const unsigned char *map;   /* The file, mapped in memory. */
+    int rdbver;
+    int decode;                 /* Decode the keys, not only the CRC64. */
+    long cut;                   /* Regions cut by the walk. */
+    long next;                  /* First region not taken yet. */
+    long checked;               /* Regions whose CRC64 was combined. */
+    long window;                /* Region i uses ring[i % window]. */
+    rdbCheckRegion *ring;
+    uint64_t cksum;             /* CRC64 of the regions checked. */
+    int stop;                   /* Set to make the threads exit. */
+    pthread_t tids[RDB_LOAD_THREADS_MAX];
+    int ntids;
+    pthread_mutex_t lock;
+    pthread_cond_t todo;        /* Signaled when a region is cut. */
+    pthread_cond_t done;        /* Signaled when a region is checked. */
+} rdbCheckJob;
+
+/* Decode the keys of the region 'rg'. The header of the file, at the start
+ * of the first region, was already checked by the walk. The state of the
+ * thread is restored before returning, as the main thread may be walking
+ * the file. */
+static int rdbCheckDecodeRegion(rdbCheckJob *job, rdbCheckRegion *rg) {
+    size_t start = rg->start ? rg->start : 9;
+    long long expiretime = -1;
+    rdbCheckState saved = rdbstate;
+    int retval = 0;
+    rio r;
+
+    rioInitWithMemory(&r,job->map+start,rg->end-start);
+    r.processed_bytes = start;
+    rdbstate.rio = &r;
+    rdbstate.key = NULL;
+    rdbstate.key_type = -1;
+    rdbstate.error_set = 0;
+    while (r.io.mem.pos < r.io.mem.len) {
+        if (rdbCheckRecord(&r,job->rdbver,RDB_CHECK_QUIET,&expiretime) == -1) {
+            rdbCheckReadError();
+            retval = -1;
+            break;
+        }
+    }
+    rdbstate = saved;
+    return retval;
+}
+
+static void rdbCheckRegionRun(rdbCheckJob *job, rdbCheckRegion *rg) {
+    rg->cksum = crc64(0,job->map+rg->start,rg->end-rg->start);
+    if (job->decode && rdbCheckDecodeRegion(job,rg) == -1) rg->failed = 1;
+}
+
+static void *rdbCheckThreadMain(void *arg) {
+    rdbCheckJob *job = arg;
+
+    pthread_mutex_lock(&job->lock);
+    while(1) {
+        rdbCheckRegion *rg;
+
+        while (!job->stop && job->next >= job->cut)
+            pthread_cond_wait(&job->todo,&job->lock);
+        if (job->stop) break;
+        rg = job->ring+(job->next++ % job->window);
+        pthread_mutex_unlock(&job->lock);
+
+        rdbCheckRegionRun(job,rg);
+
+        pthread_mutex_lock(&job->lock);
+        rg->done = 1;
+        pthread_cond_signal(&job->done);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* Start 'threads' threads checking the regions of the file 'map'. */
+static rdbCheckJob *rdbCheckJobCreate(const unsigned char *map, int rdbver,
+                                      int threads)
+{
+    rdbCheckJob *job = zcalloc(sizeof(*job));
+    int j;
+
+    job->map = map;
+    job->rdbver = rdbver;
+    job->decode = !rdbCheckFast;
+    job->window = threads*RDB_CHECK_REGIONS_PER_THREAD;
+    job->ring = zcalloc(sizeof(rdbCheckRegion)*job->window);
+    pthread_mutex_init(&job->lock,NULL);
+    pthread_cond_init(&job->todo,NULL);
+    pthread_cond_init(&job->done,NULL);
+    for (j = 0; j < threads; j++) {
+        if (pthread_create(job->tids+job->ntids,NULL,rdbCheckThreadMain,
+                           job) == 0) job->ntids++;
+    }
+    return job;
+}
+
+static void rdbCheckJobRelease(rdbCheckJob *job) {
+    int j;
+
+    pthread_mutex_lock(&job->lock);
+    job->stop = 1;
+    pthread_cond_broadcast(&job->todo);
+    pthread_mutex_unlock(&job->lock);
+    for (j = 0; j < job->ntids; j++) pthread_join(job->tids[j],NULL);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->todo);
+    pthread_cond_destroy(&job->done);
+    zfree(job->ring);
+    zfree(job);
+}
+
+/* Combine the CRC64 of the oldest region not checked yet, checking it here
+ * if no thread took it: this also covers the threads failing to start.
+ * Returns -1 if the region has keys that can't be decoded. */
+static int rdbCheckCollect(rdbCheckJob *job) {
+    rdbCheckRegion *rg = job->ring+(job->checked % job->window);
+    int failed;
+
+    pthread_mutex_lock(&job->lock);
+    if (job->next == job->checked) {
+        job->next++;
+        pthread_mutex_unlock(&job->lock);
+        rdbCheckRegionRun(job,rg);
+    } else {
+        while (!rg->done) pthread_cond_wait(&job->done,&job->lock);
+        pthread_mutex_unlock(&job->lock);
+    }
+    job->cksum = crc64_combine(job->cksum,rg->cksum,rg->end-rg->start);
+    failed = rg->failed;
+    rg->failed = rg->done = 0;
+    job->checked++;
+    return failed ? -1 : 0;
+}
+
+/* Hand the bytes from 'start' to 'end' to the threads, checking the oldest
+ * region when all the ring is in use. */
+static int rdbCheckCut(rdbCheckJob *job, size_t start, size_t end) {
+    rdbCheckRegion *rg = job->ring+(job->cut % job->window);
+
+    rg->start = start;
+    rg->end = end;
+    pthread_mutex_lock(&job->lock);
+    job->cut++;
+    pthread_cond_signal(&job->todo);
+    pthread_mutex_unlock(&job->lock);
+    if (job->cut-job->checked == job->window) return rdbCheckCollect(job);
+    return 0;
+}
+
+/* Check all the regions cut so far. */
+static int rdbCheckCollectAll(rdbCheckJob *job) {
+    while (job->checked < job->cut)
+        if (rdbCheckCollect(job) == -1) return -1;
+    return 0;
+}
+
+/* Return the number of threads checking the regions: --threads, or one per
+ * core. */
+static int rdbCheckThreadCount(void) {
+    long cores;
+
+    if (rdbCheckThreads) return rdbCheckThreads;
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) return 1;
+    return cores < RDB_LOAD_THREADS_MAX ? (int)cores : RDB_LOAD_THREADS_MAX;
+}
+
 /* Check the specified RDB file. Return 0 if the RDB looks sane, otherwise
  * 1 is returned.
  * The file is specified as a filename in 'rdbfilename' if 'fp' is not NULL,
- * otherwise the already open file 'fp' is checked. */
+ * otherwise the already open file 'fp' is checked. In the latter case the
+ * file position is left at the end of the RDB.
+ *
+ * The file is mapped in memory and its regions checked by multiple
+ * threads, see above. Files that can't be mapped are read with stdio,
+ * decoding every key in this thread. */
 int redis_check_rdb(char *rdbfilename, FILE *fp) {
-    uint64_t dbid;
-    int type, rdbver;
+    int type, rdbver, flags = 0;
     char buf[1024];
     long long expiretime, now = mstime();
-    static rio rdb; /* Pointed by global struct riostate. */
+    static rio rdb; /* Pointed by the state of this thread. */
+    unsigned char *map = MAP_FAILED;
+    rdbCheckJob *job = NULL;
+    struct redis_stat sb;
+    size_t start = 0;
+    int retval = 1;
 
     int closefile = (fp == NULL);
     if (fp == NULL && (fp = fopen(rdbfilename,"r")) == NULL) return 1;
 
-    rioInitWithFile(&rdb,fp);
+    if (redis_fstat(fileno(fp),&sb) != -1 && S_ISREG(sb.st_mode) &&
+        sb.st_size > 0)
+    {
+        map = mmap(NULL,sb.st_size,PROT_READ,MAP_PRIVATE,fileno(fp),0);
+    }
+    if (map != MAP_FAILED) {
+        madvise(map,sb.st_size,MADV_SEQUENTIAL);
+        rioInitWithMemory(&rdb,map,sb.st_size);
+        flags = RDB_CHECK_SKIP;
+    } else {
+        rioInitWithFile(&rdb,fp);
+        rdb.update_cksum = rdbLoadProgressCallback;
+    }
     rdbstate.rio = &rdb;
-    rdb.update_cksum = rdbLoadProgressCallback;
     if (rioRead(&rdb,buf,9) == 0) goto eoferr;
     buf[9] = '\0';
     if (memcmp(buf,"REDIS",5) != 0) {
@@ -200,105 +673,42 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
         rdbCheckError("Can't handle RDB format version %d",rdbver);
         goto err;
     }
+    if (map != MAP_FAILED) {
+        int threads = rdbCheckThreadCount();
+
+        rdbCheckInfo("Checking with %d thread%s%s", threads,
+            threads == 1 ? "" : "s",
+            rdbCheckFast ? ", values skipped (--fast)" : "");
+        job = rdbCheckJobCreate(map,rdbver,threads);
+    }
 
     expiretime = -1;
     startLoading(fp);
     while(1) {
-        robj *key, *val;
+        if ((type = rdbCheckRecord(&rdb,rdbver,flags,&expiretime)) == -1)
+            goto eoferr;
+        if (type == RDB_OPCODE_EOF) break;
+        if (!rdbIsObjectType(type)) continue;
 
-        /* Read type. */
-        rdbstate.doing = RDB_CHECK_DOING_READ_TYPE;
-        if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
-
-        /* Handle special types. */
-        if (type == RDB_OPCODE_EXPIRETIME) {
-            rdbstate.doing = RDB_CHECK_DOING_READ_EXPIRE;
-            /* EXPIRETIME: load an expire associated with the next key
-             * to load. Note that after loading an expire we need to
-             * load the actual type, and continue. */
-            if ((expiretime = rdbLoadTime(&rdb)) == -1) goto eoferr;
-            expiretime *= 1000;
-            continue; /* Read next opcode. */
-        } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
-            /* EXPIRETIME_MS: milliseconds precision expire times introduced
-             * with RDB v3. Like EXPIRETIME but no with more precision. */
-            rdbstate.doing = RDB_CHECK_DOING_READ_EXPIRE;
-            if ((expiretime = rdbLoadMillisecondTime(&rdb, rdbver)) == -1) goto eoferr;
-            continue; /* Read next opcode. */
-        } else if (type == RDB_OPCODE_FREQ) {
-            /* FREQ: LFU frequency. */
-            uint8_t byte;
-            if (rioRead(&rdb,&byte,1) == 0) goto eoferr;
-            continue; /* Read next opcode. */
-        } else if (type == RDB_OPCODE_IDLE) {
-            /* IDLE: LRU idle time. */
-            if (rdbLoadLen(&rdb,NULL) == RDB_LENERR) goto eoferr;
-            continue; /* Read next opcode. */
-        } else if (type == RDB_OPCODE_EOF) {
-            /* EOF: End of file, exit the main loop. */
-            break;
-        } else if (type == RDB_OPCODE_SELECTDB) {
-            /* SELECTDB: Select the specified database. */
-            rdbstate.doing = RDB_CHECK_DOING_READ_LEN;
-            if ((dbid = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
-                goto eoferr;
-            rdbCheckInfo("Selecting DB ID %d", dbid);
-            continue; /* Read type again. */
-        } else if (type == RDB_OPCODE_RESIZEDB) {
-            /* RESIZEDB: Hint about the size of the keys in the currently
-             * selected data base, in order to avoid useless rehashing. */
-            uint64_t db_size, expires_size;
-            rdbstate.doing = RDB_CHECK_DOING_READ_LEN;
-            if ((db_size = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
-                goto eoferr;
-            if ((expires_size = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
-                goto eoferr;
-            continue; /* Read type again. */
-        } else if (type == RDB_OPCODE_AUX) {
-            /* AUX: generic string-string fields. Use to add state to RDB
-             * which is backward compatible. Implementations of RDB loading
-             * are requierd to skip AUX fields they don't understand.
-             *
-             * An AUX field is composed of two strings: key and value. */
-            robj *auxkey, *auxval;
-            rdbstate.doing = RDB_CHECK_DOING_READ_AUX;
-            if ((auxkey = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-            if ((auxval = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-
-            rdbCheckInfo("AUX FIELD %s = '%s'",
-                (char*)auxkey->ptr, (char*)auxval->ptr);
-            decrRefCount(auxkey);
-            decrRefCount(auxval);
-            continue; /* Read type again. */
-        } else {
-            if (!rdbIsObjectType(type)) {
-                rdbCheckError("Invalid object type: %d", type);
-                goto err;
-            }
-            rdbstate.key_type = type;
-        }
-
-        /* Read key */
-        rdbstate.doing = RDB_CHECK_DOING_READ_KEY;
-        if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
-        rdbstate.key = key;
-        rdbstate.keys++;
-        /* Read value */
-        rdbstate.doing = RDB_CHECK_DOING_READ_OBJECT_VALUE;
-        if ((val = rdbLoadObject(type,&rdb,key)) == NULL) goto eoferr;
+        rdbstats.keys++;
         /* Check if the key already expired. */
         if (expiretime != -1 && expiretime < now)
-            rdbstate.already_expired++;
-        if (expiretime != -1) rdbstate.expires++;
-        rdbstate.key = NULL;
-        decrRefCount(key);
-        decrRefCount(val);
-        rdbstate.key_type = -1;
+            rdbstats.already_expired++;
+        if (expiretime != -1) rdbstats.expires++;
         expiretime = -1;
+
+        /* Cut the records read so far in a region of their own. */
+        if (job && rdb.io.mem.pos-start >= RDB_CHECK_REGION_BYTES) {
+            if (rdbCheckCut(job,start,rdb.io.mem.pos) == -1) goto err;
+            start = rdb.io.mem.pos;
+        }
     }
+    if (job && (rdbCheckCut(job,start,rdb.io.mem.pos) == -1 ||
+                rdbCheckCollectAll(job) == -1)) goto err;
+
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && server.rdb_checksum) {
-        uint64_t cksum, expected = rdb.cksum;
+        uint64_t cksum, expected = job ? job->cksum : rdb.cksum;
 
         rdbstate.doing = RDB_CHECK_DOING_CHECK_SUM;
         if (rioRead(&rdb,&cksum,8) == 0) goto eoferr;
@@ -312,19 +722,21 @@ int redis_check_rdb(char *rdbfilename, FILE *fp) {
             rdbCheckInfo("Checksum OK");
         }
     }
-
-    if (closefile) fclose(fp);
-    return 0;
+    retval = 0;
+    goto cleanup;
 
 eoferr: /* unexpected end of file is handled here with a fatal exit */
-    if (rdbstate.error_set) {
-        rdbCheckError(rdbstate.error);
-    } else {
-        rdbCheckError("Unexpected EOF reading RDB file");
-    }
+    rdbCheckReadError();
 err:
+    retval = 1;
+cleanup:
+    /* Whoever reads 'fp' after us continues after the RDB. */
+    if (map != MAP_FAILED) fseeko(fp,rdb.io.mem.pos,SEEK_SET);
+    if (job) rdbCheckJobRelease(job);
+    if (map != MAP_FAILED) munmap(map,sb.st_size);
+    rdbstate.rio = NULL;
     if (closefile) fclose(fp);
-    return 1;
+    return retval;
 }
 
 /* RDB check main: called form redis.c when Redis is executed with the
@@ -338,12 +750,37 @@ err:
  * When called with fp = NULL, the function never returns, but exits with the
  * status code according to success (RDB is sane) or error (RDB is corrupted).
  * Otherwise if called with a non NULL fp, the function returns C_OK or
- * C_ERR depending on the success or failure. */
+ * C_ERR depending on the success or failure.
+ *
+ * As a standalone executable it accepts these options before the file name:
+ *
+ * --fast         Only check the structure of the file and its checksum,
+ *                skipping the values instead of creating them.
+ * --threads <n>  Check the regions of the file with 'n' threads, one per
+ *                core by default. */
 int redis_check_rdb_main(int argc, char **argv, FILE *fp) {
-    if (argc != 2 && fp == NULL) {
-        fprintf(stderr, "Usage: %s <rdb-file-name>\n", argv[0]);
-        exit(1);
+    char *filename;
+    int j;
+
+    if (fp == NULL) {
+        for (j = 1; j < argc-1; j++) {
+            if (!strcmp(argv[j],"--fast")) {
+                rdbCheckFast = 1;
+            } else if (!strcmp(argv[j],"--threads") && j+1 < argc-1) {
+                rdbCheckThreads = atoi(argv[++j]);
+                if (rdbCheckThreads < 1 ||
+                    rdbCheckThreads > RDB_LOAD_THREADS_MAX) break;
+            } else {
+                break;
+            }
+        }
+        if (argc < 2 || j != argc-1) {
+            fprintf(stderr, "Usage: %s [--fast] [--threads <n>] "
+                            "<rdb-file-name>\n", argv[0]);
+            exit(1);
+        }
     }
+    filename = argv[argc-1];
     /* In order to call the loading functions we need to create the shared
      * integer objects, however since this function may be called from
      * an already initialized Redis instance, check if we really need to. */
@@ -351,9 +788,10 @@ int redis_check_rdb_main(int argc, char **argv, FILE *fp) {
         createSharedObjects();
     server.loading_process_events_interval_bytes = 0;
     rdbCheckMode = 1;
-    rdbCheckInfo("Checking RDB file %s", argv[1]);
+    rdbstate.key_type = -1;
+    rdbCheckInfo("Checking RDB file %s", filename);
     rdbCheckSetupSignals();
-    int retval = redis_check_rdb(argv[1],fp);
+    int retval = redis_check_rdb(filename,fp);
     if (retval == 0) {
         rdbCheckInfo("\\o/ RDB looks OK! \\o/");
         rdbShowGenericInfo();
@@ -76,9 +76,11 @@ char *replicationGetSlaveName(client *c) {
 
 void createReplicationBacklog(void) {
     serverAssert(server.repl_backlog == NULL);
-    server.repl_backlog = zmalloc(server.repl_backlog_size);
+    /* Without a backlog there are no slaves, so nobody kept any block. */
+    serverAssert(listLength(server.repl_buffer_blocks) == 0);
+    server.repl_backlog = zmalloc(sizeof(replBacklog));
+    server.repl_backlog->ref_repl_buf_node = NULL;
     server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
 
     /* We don't have any data inside our buffer, but virtually the first
      * byte we have is the next byte that will be generated for the
@@ -87,65 +89,185 @@ void createReplicationBacklog(void) {
 }
 
 /* This function is called when the user modifies the replication backlog
- * size at runtime. It is up to the function to both update the
- * server.repl_backlog_size and to resize the buffer and setup it so that
- * it contains the same data as the previous one (possibly less data, but
- * the most recent bytes, or the same data and more free space in case the
- * buffer is enlarged). */
+ * size at runtime. The backlog is just the history of the shared replication
+ * buffer, so growing it only means releasing the blocks later, and shrinking
+ * it releases the oldest blocks no slave needs right away. */
 void resizeReplicationBacklog(long long newsize) {
     if (newsize < CONFIG_REPL_BACKLOG_MIN_SIZE)
         newsize = CONFIG_REPL_BACKLOG_MIN_SIZE;
     if (server.repl_backlog_size == newsize) return;
 
     server.repl_backlog_size = newsize;
-    if (server.repl_backlog != NULL) {
-        /* What we actually do is to flush the old buffer and realloc a new
-         * empty one. It will refill with new data incrementally.
-         * The reason is that copying a few gigabytes adds latency and even
-         * worse often we need to alloc additional space before freeing the
-         * old buffer. */
-        zfree(server.repl_backlog);
-        server.repl_backlog = zmalloc(server.repl_backlog_size);
-        server.repl_backlog_histlen = 0;
-        server.repl_backlog_idx = 0;
-        /* Next byte we have is... the next since the buffer is empty. */
-        server.repl_backlog_off = server.master_repl_offset+1;
-    }
+    if (server.repl_backlog != NULL)
+        incrementalTrimReplicationBacklog(SIZE_MAX);
+}
+
+/* Release the block 'ln' of the replication buffer, that must be the head
+ * of the list. */
+static void freeReplicationBufferHead(listNode *ln) {
+    replBufBlock *b = listNodeValue(ln);
+
+    serverAssert(ln == listFirst(server.repl_buffer_blocks));
+    server.repl_buffer_mem -= b->size+sizeof(replBufBlock)+sizeof(listNode);
+    zfree(b);
+    listDelNode(server.repl_buffer_blocks,ln);
 }
 
 void freeReplicationBacklog(void) {
     serverAssert(listLength(server.slaves) == 0);
+    while(listLength(server.repl_buffer_blocks))
+        freeReplicationBufferHead(listFirst(server.repl_buffer_blocks));
     zfree(server.repl_backlog);
     server.repl_backlog = NULL;
 }
 
-/* Add data to the replication backlog.
+/* Release the blocks on head of the replication buffer that are only
+ * referenced by the backlog, as long as the backlog holds more history than
+ * repl-backlog-size, and at most 'max_blocks' of them: this is called when
+ * the stream grows and when slaves move forward, so the blocks are released
+ * a few at a time. The tail block is never released. */
+void incrementalTrimReplicationBacklog(size_t max_blocks) {
+    listNode *first;
+    replBufBlock *b;
+    size_t trimmed = 0;
+
+    while(server.repl_backlog_histlen > server.repl_backlog_size &&
+          trimmed < max_blocks &&
+          listLength(server.repl_buffer_blocks) > 1)
+    {
+        first = listFirst(server.repl_buffer_blocks);
+        b = listNodeValue(first);
+        if (b->refcount != 1) break; /* A slave still has to send it. */
+
+        /* Make the backlog start from the next block. */
+        server.repl_backlog->ref_repl_buf_node = listNextNode(first);
+        ((replBufBlock*)listNodeValue(listNextNode(first)))->refcount++;
+        server.repl_backlog_histlen -= b->used;
+        freeReplicationBufferHead(first);
+        trimmed++;
+    }
+    first = listFirst(server.repl_buffer_blocks);
+    if (first) {
+        b = listNodeValue(first);
+        server.repl_backlog_off = b->repl_offset;
+    }
+}
+
+/* Drop the reference of the slave 'c' to the replication buffer. Like
+ * when its own output buffer is released, all the blocks it was the last
+ * one to need are released at once. */
+void freeReplicaReferencedReplBuffer(client *c) {
+    if (c->ref_repl_buf_node == NULL) return;
+    ((replBufBlock*)listNodeValue(c->ref_repl_buf_node))->refcount--;
+    c->ref_repl_buf_node = NULL;
+    c->ref_block_pos = 0;
+    incrementalTrimReplicationBacklog(SIZE_MAX);
+}
+
+/* Append a new empty block, for at least 'len' bytes, to the replication
+ * buffer. */
+static replBufBlock *createReplicationBufferBlock(size_t len) {
+    size_t size = len < PROTO_REPLY_CHUNK_BYTES ? PROTO_REPLY_CHUNK_BYTES : len;
+    replBufBlock *b = zmalloc(size+sizeof(replBufBlock));
+
+    /* Take over the allocation's internal fragmentation. */
+    b->size = zmalloc_usable(b)-sizeof(replBufBlock);
+    b->used = 0;
+    b->refcount = 0;
+    b->repl_offset = server.master_repl_offset+1;
+    listAddNodeTail(server.repl_buffer_blocks,b);
+    server.repl_buffer_mem += b->size+sizeof(replBufBlock)+sizeof(listNode);
+    return b;
+}
+
+/* Add data to the replication buffer, that is, to the replication backlog
+ * and to the output of all the slaves that are not waiting for a BGSAVE to
+ * start: the bytes are copied once and the slaves that don't reference
+ * the buffer yet start from them.
  * This function also increments the global replication offset stored at
  * server.master_repl_offset, because there is no case where we want to feed
  * the backlog without incrementing the offset. */
 void feedReplicationBacklog(void *ptr, size_t len) {
     unsigned char *p = ptr;
+    listNode *ln, *start;
+    listIter li;
+    replBufBlock *tail;
+    size_t start_pos;
+    int new_blocks = 0;
 
-    server.master_repl_offset += len;
+    if (len == 0) return;
+
+    /* Schedule the write of the slaves that had nothing left to send. This
+     * must be checked before a new block is appended to the buffer. */
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
+        if (!clientHasPendingReplies(slave)) clientInstallWriteHandler(slave);
+    }
+
+    ln = listLast(server.repl_buffer_blocks);
+    tail = ln ? listNodeValue(ln) : NULL;
+    if (tail == NULL || tail->used == tail->size) {
+        tail = createReplicationBufferBlock(len);
+        new_blocks++;
+    }
+    start = listLast(server.repl_buffer_blocks);
+    start_pos = tail->used;
+    if (server.repl_backlog->ref_repl_buf_node == NULL) {
+        server.repl_backlog->ref_repl_buf_node = start;
+        tail->refcount++;
+        server.repl_backlog_off = tail->repl_offset;
+    }
+
+    /* Make the slaves not referencing the buffer yet start from here. */
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
+        if (slave->ref_repl_buf_node == NULL) {
+            slave->ref_repl_buf_node = start;
+            slave->ref_block_pos = start_pos;
+            tail->refcount++;
+        }
+    }
 
-    /* This is a circular buffer, so write as much data we can at every
-     * iteration and rewind the "idx" index if we reach the limit. */
     while(len) {
-        size_t thislen = server.repl_backlog_size - server.repl_backlog_idx;
+        size_t thislen = tail->size - tail->used;
+        if (thislen == 0) {
+            tail = createReplicationBufferBlock(len);
+            new_blocks++;
+            continue;
+        }
         if (thislen > len) thislen = len;
-        memcpy(server.repl_backlog+server.repl_backlog_idx,p,thislen);
-        server.repl_backlog_idx += thislen;
-        if (server.repl_backlog_idx == server.repl_backlog_size)
-            server.repl_backlog_idx = 0;
+        memcpy(tail->buf+tail->used,p,thislen);
+        tail->used += thislen;
+        server.master_repl_offset += thislen;
+        server.repl_backlog_histlen += thislen;
         len -= thislen;
         p += thislen;
-        server.repl_backlog_histlen += thislen;
     }
-    if (server.repl_backlog_histlen > server.repl_backlog_size)
-        server.repl_backlog_histlen = server.repl_backlog_size;
-    /* Set the offset of the first byte we have in the backlog. */
-    server.repl_backlog_off = server.master_repl_offset -
-                              server.repl_backlog_histlen + 1;
+
+    /* The output of the slaves only grows when blocks are added. */
+    if (new_blocks) {
+        listRewind(server.slaves,&li);
+        while((ln = listNext(&li))) {
+            client *slave = ln->value;
+            if (slave->ref_repl_buf_node)
+                asyncCloseClientOnOutputBufferLimitReached(slave);
+        }
+        incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+    }
+}
+
+/* Memory of the replication buffer that is not backlog, but output of the
+ * slaves that still have to send it. */
+size_t replicationBufferNotCountedMemory(void) {
+    if (listLength(server.slaves) == 0 ||
+        server.repl_buffer_mem <= (size_t)server.repl_backlog_size) return 0;
+    return server.repl_buffer_mem - server.repl_backlog_size;
 }
 
 /* Wrapper for feedReplicationBacklog() that takes Redis string objects
@@ -169,12 +291,14 @@ void feedReplicationBacklogWithObject(robj *o) {
  * as well. This function is used if the instance is a master: we use
  * the commands received by our clients in order to create the replication
  * stream. Instead if the instance is a slave and has sub-slaves attached,
- * we use replicationFeedSlavesFromMaster() */
+ * we use replicationFeedSlavesFromMaster()
+ *
+ * The command is encoded once in the replication buffer, that the backlog
+ * and the slaves share (see feedReplicationBacklog()). */
 void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
-    listNode *ln;
-    listIter li;
     int j, len;
     char llstr[LONG_STR_SIZE];
+    char aux[LONG_STR_SIZE+3];
 
     /* If the instance is not a top level master, return ASAP: we'll just proxy
      * the stream of data we receive from our master instead, in order to
@@ -207,68 +331,35 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
                 dictid_len, llstr));
         }
 
-        /* Add the SELECT command into the backlog. */
-        if (server.repl_backlog) feedReplicationBacklogWithObject(selectcmd);
-
-        /* Send it to slaves. */
-        listRewind(slaves,&li);
-        while((ln = listNext(&li))) {
-            client *slave = ln->value;
-            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-            addReply(slave,selectcmd);
-        }
+        /* Add the SELECT command into the backlog and slaves output. */
+        feedReplicationBacklogWithObject(selectcmd);
 
         if (dictid < 0 || dictid >= PROTO_SHARED_SELECT_CMDS)
             decrRefCount(selectcmd);
     }
     server.slaveseldb = dictid;
 
-    /* Write the command to the replication backlog if any. */
-    if (server.repl_backlog) {
-        char aux[LONG_STR_SIZE+3];
+    /* Write the command to the replication backlog and slaves output,
+     * starting from the multi bulk reply length. */
+    aux[0] = '*';
+    len = ll2string(aux+1,sizeof(aux)-1,argc);
+    aux[len+1] = '\r';
+    aux[len+2] = '\n';
+    feedReplicationBacklog(aux,len+3);
+
+    for (j = 0; j < argc; j++) {
+        long objlen = stringObjectLen(argv[j]);
 
-        /* Add the multi bulk reply length. */
-        aux[0] = '*';
-        len = ll2string(aux+1,sizeof(aux)-1,argc);
+        /* We need to feed the buffer with the object as a bulk reply
+         * not just as a plain string, so create the $..CRLF payload len
+         * and add the final CRLF */
+        aux[0] = '$';
+        len = ll2string(aux+1,sizeof(aux)-1,objlen);
         aux[len+1] = '\r';
         aux[len+2] = '\n';
         feedReplicationBacklog(aux,len+3);
-
-        for (j = 0; j < argc; j++) {
-            long objlen = stringObjectLen(argv[j]);
-
-            /* We need to feed the buffer with the object as a bulk reply
-             * not just as a plain string, so create the $..CRLF payload len
-             * and add the final CRLF */
-            aux[0] = '$';
-            len = ll2string(aux+1,sizeof(aux)-1,objlen);
-            aux[len+1] = '\r';
-            aux[len+2] = '\n';
-            feedReplicationBacklog(aux,len+3);
-            feedReplicationBacklogWithObject(argv[j]);
-            feedReplicationBacklog(aux+len+1,2);
-        }
-    }
-
-    /* Write the command to every slave. */
-    listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
-        client *slave = ln->value;
-
-        /* Don't feed slaves that are still waiting for BGSAVE to start */
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-
-        /* Feed slaves that are waiting for the initial SYNC (so these commands
-         * are queued in the output buffer until the initial SYNC completes),
-         * or are already in sync with the master. */
-
-        /* Add the multi bulk length. */
-        addReplyArrayLen(slave,argc);
-
-        /* Finally any additional argument that was not stored inside the
-         * static buffer if any (from j to argc). */
-        for (j = 0; j < argc; j++)
-            addReplyBulk(slave,argv[j]);
+        feedReplicationBacklogWithObject(argv[j]);
+        feedReplicationBacklog(aux+len+1,2);
     }
 }
 
@@ -276,8 +367,7 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
  * to our sub-slaves. */
 #include <ctype.h>
 void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen) {
-    listNode *ln;
-    listIter li;
+    UNUSED(slaves);
 
     /* Debugging: this is handy to see the stream sent from master
      * to slaves. Disabled with if(0). */
@@ -289,15 +379,8 @@ void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t bufle
         printf("\n");
     }
 
+    /* The backlog holds the stream for the slaves as well. */
     if (server.repl_backlog) feedReplicationBacklog(buf,buflen);
-    listRewind(slaves,&li);
-    while((ln = listNext(&li))) {
-        client *slave = ln->value;
-
-        /* Don't feed slaves that are still waiting for BGSAVE to start */
-        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) continue;
-        addReplyProto(slave,buf,buflen);
-    }
 }
 
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc) {
@@ -340,9 +423,12 @@ void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv,
 }
 
 /* Feed the slave 'c' with the replication backlog starting from the
- * specified 'offset' up to the end of the backlog. */
+ * specified 'offset' up to the end of the backlog: the slave just references
+ * the block of the replication buffer holding 'offset'. */
 long long addReplyReplicationBacklog(client *c, long long offset) {
-    long long j, skip, len;
+    long long skip;
+    listNode *ln;
+    replBufBlock *b;
 
     serverLog(LL_DEBUG, "[PSYNC] Replica request offset: %lld", offset);
 
@@ -357,37 +443,28 @@ long long addReplyReplicationBacklog(client *c, long long offset) {
              server.repl_backlog_off);
     serverLog(LL_DEBUG, "[PSYNC] History len: %lld",
              server.repl_backlog_histlen);
-    serverLog(LL_DEBUG, "[PSYNC] Current index: %lld",
-             server.repl_backlog_idx);
 
     /* Compute the amount of bytes we need to discard. */
     skip = offset - server.repl_backlog_off;
     serverLog(LL_DEBUG, "[PSYNC] Skipping: %lld", skip);
-
-    /* Point j to the oldest byte, that is actually our
-     * server.repl_backlog_off byte. */
-    j = (server.repl_backlog_idx +
-        (server.repl_backlog_size-server.repl_backlog_histlen)) %
-        server.repl_backlog_size;
-    serverLog(LL_DEBUG, "[PSYNC] Index of first byte: %lld", j);
-
-    /* Discard the amount of data to seek to the specified 'offset'. */
-    j = (j + skip) % server.repl_backlog_size;
-
-    /* Feed slave with data. Since it is a circular buffer we have to
-     * split the reply in two parts if we are cross-boundary. */
-    len = server.repl_backlog_histlen - skip;
-    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld", len);
-    while(len) {
-        long long thislen =
-            ((server.repl_backlog_size - j) < len) ?
-            (server.repl_backlog_size - j) : len;
-
-        serverLog(LL_DEBUG, "[PSYNC] addReply() length: %lld", thislen);
-        addReplySds(c,sdsnewlen(server.repl_backlog + j, thislen));
-        len -= thislen;
-        j = 0;
-    }
+    if (skip == server.repl_backlog_histlen) return 0;
+
+    /* Slaves usually reconnect missing just the most recent data, so look
+     * for the block backward from the tail. */
+    serverAssert(c->ref_repl_buf_node == NULL);
+    ln = listLast(server.repl_buffer_blocks);
+    b = listNodeValue(ln);
+    while(b->repl_offset > offset) {
+        ln = listPrevNode(ln);
+        b = listNodeValue(ln);
+    }
+    c->ref_repl_buf_node = ln;
+    c->ref_block_pos = offset - b->repl_offset;
+    b->refcount++;
+    clientInstallWriteHandler(c);
+
+    serverLog(LL_DEBUG, "[PSYNC] Reply total length: %lld",
+             server.repl_backlog_histlen - skip);
     return server.repl_backlog_histlen - skip;
 }
 
@@ -624,6 +701,48 @@ int startBgsaveForReplication(int mincapa) {
     return retval;
 }
 
+/* Start a BGSAVE good for replication if we have slaves in
+ * WAIT_BGSAVE_START state.
+ *
+ * In case of diskless replication, we make sure to wait the specified
+ * number of seconds (according to configuration) so that other slaves
+ * have the time to arrive and share the same transfer before we start
+ * streaming, unless repl-diskless-sync-max-replicas slaves are already
+ * waiting. */
+void startBgsaveForWaitingSlaves(void) {
+    time_t idle, max_idle = 0;
+    int slaves_waiting = 0;
+    int mincapa = -1;
+    listNode *ln;
+    listIter li;
+
+    if (rdbBgsaveInProgress() || server.aof_child_pid != -1) return;
+
+    listRewind(server.slaves,&li);
+    while((ln = listNext(&li))) {
+        client *slave = ln->value;
+        if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) {
+            idle = server.unixtime - slave->lastinteraction;
+            if (idle > max_idle) max_idle = idle;
+            slaves_waiting++;
+            mincapa = (mincapa == -1) ? slave->slave_capa :
+                                        (mincapa & slave->slave_capa);
+        }
+    }
+
+    if (slaves_waiting &&
+        (!server.repl_diskless_sync ||
+         max_idle > server.repl_diskless_sync_delay ||
+         (server.repl_diskless_sync_max_replicas &&
+          slaves_waiting >= server.repl_diskless_sync_max_replicas)))
+    {
+        /* Start the BGSAVE. The called function may start a
+         * BGSAVE with socket target or disk target depending on the
+         * configuration and slaves capabilities. */
+        startBgsaveForReplication(mincapa);
+    }
+}
+
 /* SYNC and PSYNC command implemenation. */
 void syncCommand(client *c) {
     /* ignore SYNC if already slave or in monitor mode */
@@ -700,7 +819,7 @@ void syncCommand(client *c) {
     }
 
     /* CASE 1: BGSAVE is in progress, with disk target. */
-    if (server.rdb_child_pid != -1 &&
+    if (rdbBgsaveInProgress() &&
         server.rdb_child_type == RDB_CHILD_TYPE_DISK)
     {
         /* Ok a background save is in progress. Let's check if it is a good
@@ -743,8 +862,11 @@ void syncCommand(client *c) {
         if (server.repl_diskless_sync && (c->slave_capa & SLAVE_CAPA_EOF)) {
             /* Diskless replication RDB child is created inside
              * replicationCron() since we want to delay its start a
-             * few seconds to wait for more slaves to arrive. */
-            if (server.repl_diskless_sync_delay)
+             * few seconds to wait for more slaves to arrive. If this
+             * slave completes the configured batch, start right away. */
+            if (server.repl_diskless_sync_max_replicas)
+                startBgsaveForWaitingSlaves();
+            if (server.repl_diskless_sync_delay && !rdbBgsaveInProgress())
                 serverLog(LL_NOTICE,"Delay next BGSAVE for diskless SYNC");
         } else {
             /* Target is disk (or the slave is not capable of supporting
@@ -915,8 +1037,11 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
         return;
     }
     slave->repldboff += nwritten;
+    slave->repl_sync_bytes += nwritten;
     server.stat_net_output_bytes += nwritten;
     if (slave->repldboff == slave->repldbsize) {
+        slave->repl_sync_time = mstime() - slave->repl_sync_start;
+        if (slave->repl_sync_time == 0) slave->repl_sync_time = 1;
         close(slave->repldbfd);
         slave->repldbfd = -1;
         aeDeleteFileEvent(server.el,slave->fd,AE_WRITABLE);
@@ -986,6 +1111,9 @@ void updateSlavesWaitingBgsave(int bgsaveerr, int type) {
                 }
                 slave->repldboff = 0;
                 slave->repldbsize = buf.st_size;
+                slave->repl_sync_start = mstime();
+                slave->repl_sync_time = 0;
+                slave->repl_sync_bytes = 0;
                 slave->replstate = SLAVE_STATE_SEND_BULK;
                 slave->replpreamble = sdscatprintf(sdsempty(),"$%lld\r\n",
                     (unsigned long long) slave->repldbsize);
@@ -1266,6 +1394,13 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
                     (long) server.rdb_child_pid);
             killRDBChild();
         }
+        if (server.rdb_forkless) {
+            serverLog(LL_NOTICE,
+                "Replica is about to load the RDB file received from the "
+                "master, but there is a pending BGSAVE without fork. "
+                "Stopping it to avoid any race");
+            rdbForklessKill();
+        }
 
         if (rename(server.repl_transfer_tmpfile,server.rdb_filename) == -1) {
             serverLog(LL_WARNING,"Failed trying to rename the temp DB into %s in MASTER <-> REPLICA synchronization: %s", 
@@ -2191,7 +2326,7 @@ void replicationCacheMaster(client *c) {
     listEmpty(c->reply);
     c->sentlen = 0;
     c->reply_bytes = 0;
-    c->bufpos = 0;
+    releaseClientReplyBuffer(c);
     resetClient(c);
 
     /* Save the master. Server.master will be set to null later by
@@ -2707,40 +2842,8 @@ void replicationCron(void) {
     }
 
     /* Start a BGSAVE good for replication if we have slaves in
-     * WAIT_BGSAVE_START state.
-     *
-     * In case of diskless replication, we make sure to wait the specified
-     * number of seconds (according to configuration) so that other slaves
-     * have the time to arrive before we start streaming. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
-        time_t idle, max_idle = 0;
-        int slaves_waiting = 0;
-        int mincapa = -1;
-        listNode *ln;
-        listIter li;
-
-        listRewind(server.slaves,&li);
-        while((ln = listNext(&li))) {
-            client *slave = ln->value;
-            if (slave->replstate == SLAVE_STATE_WAIT_BGSAVE_START) {
-                idle = server.unixtime - slave->lastinteraction;
-                if (idle > max_idle) max_idle = idle;
-                slaves_waiting++;
-                mincapa = (mincapa == -1) ? slave->slave_capa :
-                                            (mincapa & slave->slave_capa);
-            }
-        }
-
-        if (slaves_waiting &&
-            (!server.repl_diskless_sync ||
-             max_idle > server.repl_diskless_sync_delay))
-        {
-            /* Start the BGSAVE. The called function may start a
-             * BGSAVE with socket target or disk target depending on the
-             * configuration and slaves capabilities. */
-            startBgsaveForReplication(mincapa);
-        }
-    }
+     * WAIT_BGSAVE_START state. */
+    startBgsaveForWaitingSlaves();
 
     /* Refresh the number of slaves with lag <= min-slaves-max-lag. */
     refreshGoodSlavesCount();
@@ -103,6 +103,55 @@ void rioInitWithBuffer(rio *r, sds s) {
     r->io.buffer.pos = 0;
 }
 
+/* ---------------------- Read only memory implementation ------------------- */
+
+/* Returns 1 or 0 for success/failure. */
+static size_t rioMemoryRead(rio *r, void *buf, size_t len) {
+    if (r->io.mem.len-r->io.mem.pos < len)
+        return 0; /* not enough memory to return len bytes. */
+    memcpy(buf,r->io.mem.ptr+r->io.mem.pos,len);
+    r->io.mem.pos += len;
+    return 1;
+}
+
+/* The memory is read only: writes always fail. */
+static size_t rioMemoryWrite(rio *r, const void *buf, size_t len) {
+    UNUSED(r);
+    UNUSED(buf);
+    UNUSED(len);
+    return 0;
+}
+
+/* Returns read position in memory. */
+static off_t rioMemoryTell(rio *r) {
+    return r->io.mem.pos;
+}
+
+static int rioMemoryFlush(rio *r) {
+    UNUSED(r);
+    return 1;
+}
+
+static const rio rioMemoryIO = {
+    rioMemoryRead,
+    rioMemoryWrite,
+    rioMemoryTell,
+    rioMemoryFlush,
+    NULL,           /* update_checksum */
+    0,              /* current checksum */
+    0,              /* bytes read or written */
+    0,              /* read/write chunk size */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+/* Read the 'len' bytes at 'buf', that must stay valid while 'r' is used. */
+void rioInitWithMemory(rio *r, const void *buf, size_t len) {
+    *r = rioMemoryIO;
+    r->io.mem.ptr = buf;
+    r->io.mem.len = len;
+    r->io.mem.pos = 0;
+}
+
 /* --------------------- Stdio file pointer implementation ------------------- */
 
 /* Returns 1 or 0 for success/failure. */
@@ -346,6 +395,6 @@ size_t rioWriteBulkDouble(rio *r, double d) {
     char dbuf[128];
     unsigned int dlen;
 
-    dlen = snprintf(dbuf,sizeof(dbuf),"%.17g",d);
+    dlen = d2string(dbuf,sizeof(dbuf),d);
     return rioWriteBulkString(r,dbuf,dlen);
 }
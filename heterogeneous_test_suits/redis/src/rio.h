@@ -67,6 +67,12 @@ struct _rio {
             sds ptr;
             off_t pos;
         } buffer;
+        /* Read only memory source, such as a file mapped in memory. */
+        struct {
+            const char *ptr;
+            size_t len;
+            size_t pos;
+        } mem;
         /* Stdio file pointer target. */
         struct {
             FILE *fp;
@@ -126,6 +132,7 @@ static inline int rioFlush(rio *r) {
 
 void rioInitWithFile(rio *r, FILE *fp);
 void rioInitWithBuffer(rio *r, sds s);
+void rioInitWithMemory(rio *r, const void *buf, size_t len);
 void rioInitWithFdset(rio *r, int *fds, int numfds);
 
 void rioFreeFdset(rio *r);
@@ -218,6 +218,153 @@ char *redisProtocolToLuaType_MultiBulk(lua_State *lua, char *reply, int atype) {
     return p;
 }
 
+/* ---------------------------------------------------------------------------
+ * Direct replies.
+ *
+ * Most commands called by scripts reply with bulks, integers, nulls, +OK or
+ * arrays of those. While server.lua_direct_reply is set, the addReply*()
+ * functions record such replies of the Lua client here instead of encoding
+ * them, and luaRedisGenericCommand() converts them into Lua values without
+ * parsing any protocol. Any other kind of reply calls luaReplyFlush() that
+ * encodes what was recorded so far: the rest of the reply is then built and
+ * converted from RESP as usual.
+ * ------------------------------------------------------------------------- */
+
+#define LUA_REPLY_BULK 0
+#define LUA_REPLY_STATUS 1
+#define LUA_REPLY_INT 2
+#define LUA_REPLY_ARRAY 3
+#define LUA_REPLY_NULL 4
+
+/* Strings bigger than this are not kept in the arena between calls. */
+#define LUA_REPLY_ARENA_MAX (1024*64)
+
+typedef struct luaReplyEntry {
+    int type;
+    long long val;  /* Integer, array length or offset of the string. */
+    size_t len;     /* Length of the string of bulks and status replies. */
+} luaReplyEntry;
+
+static struct {
+    luaReplyEntry *entries;
+    size_t count, size;
+    sds arena;      /* Strings of the entries, one after the other. */
+} luaReply;
+
+static luaReplyEntry *luaReplyNewEntry(int type) {
+    luaReplyEntry *e;
+
+    if (luaReply.count == luaReply.size) {
+        luaReply.size = luaReply.size ? luaReply.size*2 : 16;
+        luaReply.entries = zrealloc(luaReply.entries,
+                                    sizeof(luaReplyEntry)*luaReply.size);
+    }
+    e = luaReply.entries+luaReply.count++;
+    e->type = type;
+    e->val = 0;
+    e->len = 0;
+    return e;
+}
+
+static void luaReplyAddString(int type, const char *p, size_t len) {
+    luaReplyEntry *e = luaReplyNewEntry(type);
+
+    if (luaReply.arena == NULL) luaReply.arena = sdsempty();
+    e->val = sdslen(luaReply.arena);
+    e->len = len;
+    luaReply.arena = sdscatlen(luaReply.arena,p,len);
+}
+
+void luaReplyAddBulk(const char *p, size_t len) {
+    luaReplyAddString(LUA_REPLY_BULK,p,len);
+}
+
+void luaReplyAddStatus(const char *p, size_t len) {
+    luaReplyAddString(LUA_REPLY_STATUS,p,len);
+}
+
+void luaReplyAddLongLong(long long ll) {
+    luaReplyNewEntry(LUA_REPLY_INT)->val = ll;
+}
+
+void luaReplyAddArrayLen(long length) {
+    luaReplyNewEntry(LUA_REPLY_ARRAY)->val = length;
+}
+
+/* Null bulks and null arrays, both are false in Lua. */
+void luaReplyAddNull(void) {
+    luaReplyNewEntry(LUA_REPLY_NULL);
+}
+
+static void luaReplyReset(void) {
+    luaReply.count = 0;
+    if (luaReply.arena == NULL) return;
+    if (sdsalloc(luaReply.arena) > LUA_REPLY_ARENA_MAX) {
+        sdsfree(luaReply.arena);
+        luaReply.arena = NULL;
+    } else {
+        sdsclear(luaReply.arena);
+    }
+}
+
+/* Stop recording the replies of the Lua client 'c', and encode the ones
+ * recorded so far in its output buffer. */
+void luaReplyFlush(client *c) {
+    size_t j;
+
+    server.lua_direct_reply = 0;
+    for (j = 0; j < luaReply.count; j++) {
+        luaReplyEntry *e = luaReply.entries+j;
+
+        switch(e->type) {
+        case LUA_REPLY_BULK:
+            addReplyBulkCBuffer(c,luaReply.arena+e->val,e->len);
+            break;
+        case LUA_REPLY_STATUS:
+            addReplyStatusLength(c,luaReply.arena+e->val,e->len);
+            break;
+        case LUA_REPLY_INT: addReplyLongLong(c,e->val); break;
+        case LUA_REPLY_ARRAY: addReplyArrayLen(c,e->val); break;
+        case LUA_REPLY_NULL: addReplyNull(c); break;
+        }
+    }
+    luaReplyReset();
+}
+
+/* Push on the Lua stack the value of the recorded reply starting at the
+ * entry '*idx', with the conversion rules of redisProtocolToLuaType(), and
+ * advance '*idx' past it. */
+static void luaReplyToLuaType(lua_State *lua, size_t *idx) {
+    luaReplyEntry *e = luaReply.entries+(*idx)++;
+    long long j;
+
+    switch(e->type) {
+    case LUA_REPLY_BULK:
+        lua_pushlstring(lua,luaReply.arena+e->val,e->len);
+        break;
+    case LUA_REPLY_STATUS:
+        lua_newtable(lua);
+        lua_pushstring(lua,"ok");
+        lua_pushlstring(lua,luaReply.arena+e->val,e->len);
+        lua_settable(lua,-3);
+        break;
+    case LUA_REPLY_INT:
+        lua_pushnumber(lua,(lua_Number)e->val);
+        break;
+    case LUA_REPLY_ARRAY:
+        lua_newtable(lua);
+        for (j = 0; j < e->val; j++) {
+            lua_pushnumber(lua,j+1);
+            luaReplyToLuaType(lua,idx);
+            lua_settable(lua,-3);
+        }
+        break;
+    case LUA_REPLY_NULL:
+        lua_pushboolean(lua,0);
+        break;
+    }
+}
+
 /* This function is used in order to push an error on the Lua stack in the
  * format used by redis.pcall to return errors, which is a lua table
  * with a single "err" field set to the error string. Note that this
@@ -605,25 +752,46 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
         if (server.lua_repl & PROPAGATE_REPL)
             call_flags |= CMD_CALL_PROPAGATE_REPL;
     }
+    /* Record the reply to skip the RESP round trip, unless the debugger
+     * is going to log it. */
+    server.lua_direct_reply = !(ldb.active && ldb.step);
     call(c,call_flags);
 
+    if (server.lua_direct_reply && luaReply.count) {
+        size_t idx = 0;
+
+        server.lua_direct_reply = 0;
+        luaReplyToLuaType(lua,&idx);
+        if ((cmd->flags & CMD_SORT_FOR_SCRIPT) &&
+            (server.lua_replicate_commands == 0) &&
+            luaReply.entries[0].type == LUA_REPLY_ARRAY)
+        {
+            luaSortArray(lua);
+        }
+        luaReplyReset();
+        raise_error = 0; /* Errors are never recorded. */
+        goto cleanup;
+    }
+    server.lua_direct_reply = 0;
+
     /* Convert the result of the Redis command into a suitable Lua type.
      * The first thing we need is to create a single string from the client
      * output buffers. */
-    if (listLength(c->reply) == 0 && c->bufpos < PROTO_REPLY_CHUNK_BYTES) {
+    if (listLength(c->reply) == 0 && c->bufpos > 0 &&
+        c->bufpos < PROTO_REPLY_CHUNK_BYTES)
+    {
         /* This is a fast path for the common case of a reply inside the
          * client static buffer. Don't create an SDS string but just use
          * the client buffer directly. */
         c->buf[c->bufpos] = '\0';
         reply = c->buf;
-        c->bufpos = 0;
     } else {
         reply = sdsnewlen(c->buf,c->bufpos);
-        c->bufpos = 0;
+        releaseClientReplyBuffer(c);
         while(listLength(c->reply)) {
             clientReplyBlock *o = listNodeValue(listFirst(c->reply));
 
-            reply = sdscatlen(reply,o->buf,o->used);
+            reply = sdscatlen(reply,replyBlockData(o),o->used);
             listDelNode(c->reply,listFirst(c->reply));
         }
     }
@@ -642,6 +810,7 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
             luaSortArray(lua);
     }
     if (reply != c->buf) sdsfree(reply);
+    else releaseClientReplyBuffer(c);
     c->reply_bytes = 0;
 
 cleanup:
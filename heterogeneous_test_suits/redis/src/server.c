@@ -56,6 +56,8 @@
 #include <locale.h>
 #include <sys/socket.h>
 #include <migrate.h>
+#include "popcorn_profile.h"
+#include "popcorn_ranges.h"
 /* Our shared "common" objects */
 
 struct sharedObjectsStruct shared;
@@ -992,6 +994,14 @@ struct redisCommand redisCommandTable[] = {
      "admin no-script ok-loading ok-stale",
      0,NULL,0,0,0,0,0,0},
 
+    {"hotkeys",hotkeysCommand,-2,
+     "admin no-script random ok-loading ok-stale",
+     0,NULL,0,0,0,0,0,0},
+
+    {"popcorn",popcornCommand,-2,
+     "admin no-script random ok-loading ok-stale",
+     0,NULL,0,0,0,0,0,0},
+
     {"lolwut",lolwutCommand,-1,
      "read-only fast",
      0,NULL,0,0,0,0,0,0},
@@ -1179,6 +1189,21 @@ void dictSdsDestructor(void *privdata, void *val)
     sdsfree(val);
 }
 
+void *dictSdsDup(void *privdata, const void *key)
+{
+    DICT_NOTUSED(privdata);
+
+    return sdsdup((const sds)key);
+}
+
+size_t dictSdsEmbedLen(const void *key) {
+    return sdsEmbedSize(sdslen((const sds)key));
+}
+
+void *dictSdsEmbed(void *buf, const void *key) {
+    return sdsEmbed(buf,key,sdslen((const sds)key));
+}
+
 int dictObjKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -1283,13 +1308,26 @@ dictType zsetDictType = {
 };
 
 /* Db->dict, keys are sds strings, vals are Redis objects. */
+/* Don't grow the open table of a db when its new table would take us over
+ * maxmemory: we would evict as many keys to make room for it. The table
+ * fills some more meanwhile, see keyspace-open-addressing. */
+int dictExpandAllowed(size_t moreMem, double usedRatio) {
+    UNUSED(usedRatio);
+    if (!server.maxmemory) return 1;
+    return zmalloc_used_memory()-freeMemoryGetNotCountedMemory()+moreMem <=
+           server.maxmemory;
+}
+
 dictType dbDictType = {
     dictSdsHash,                /* hash function */
-    NULL,                       /* key dup */
+    dictSdsDup,                 /* key dup */
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     dictSdsDestructor,          /* key destructor */
-    dictObjectDestructor   /* val destructor */
+    dictObjectDestructor,       /* val destructor */
+    dictExpandAllowed,          /* allow to expand */
+    dictSdsEmbedLen,            /* embedded key length */
+    dictSdsEmbed                /* embed key */
 };
 
 /* server.lua_scripts sha (as sds string) -> scripts (as robj) cache. */
@@ -1309,7 +1347,8 @@ dictType keyptrDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     NULL,                       /* key destructor */
-    NULL                        /* val destructor */
+    NULL,                       /* val destructor */
+    dictExpandAllowed           /* allow to expand */
 };
 
 /* Command table. sds string -> command struct pointer. */
@@ -1401,6 +1440,13 @@ dictType replScriptCacheDictType = {
     NULL                        /* val destructor */
 };
 
+/* Create the main dictionary or the expires of a database, with open
+ * addressing tables if keyspace-open-addressing is set. */
+dict *createDbDict(dictType *type) {
+    if (server.keyspace_open_addressing) return dictCreateOpen(type,NULL);
+    return dictCreate(type,NULL);
+}
+
 int htNeedsResize(dict *dict) {
     long long size, used;
 
@@ -1421,23 +1467,43 @@ void tryResizeHashTables(int dbid) {
 
 /* Our hash table implementation performs rehashing incrementally while
  * we write/read from the hash table. Still if the server is idle, the hash
- * table will use two tables for a long time. So we try to use 1 millisecond
- * of CPU time at every call of this function to perform some rehahsing.
+ * table will use two tables for a long time. So we try to use 'usec'
+ * microseconds of CPU time at every call of this function to perform some
+ * rehahsing, see activeRehashBudget().
  *
- * The function returns 1 if some rehashing was performed, otherwise 0
- * is returned. */
-int incrementallyRehash(int dbid) {
+ * The function returns the microseconds spent rehashing, so 0 if there was
+ * nothing to rehash. */
+long long incrementallyRehash(int dbid, long long usec) {
+    long long start = ustime(), spent = 0;
+
     /* Keys dictionary */
     if (dictIsRehashing(server.db[dbid].dict)) {
-        dictRehashMilliseconds(server.db[dbid].dict,1);
-        return 1; /* already used our millisecond for this loop... */
+        dictRehashMicroseconds(server.db[dbid].dict,usec);
+        spent = ustime()-start+1;
     }
     /* Expires */
-    if (dictIsRehashing(server.db[dbid].expires)) {
-        dictRehashMilliseconds(server.db[dbid].expires,1);
-        return 1; /* already used our millisecond for this loop... */
+    if (spent < usec && dictIsRehashing(server.db[dbid].expires)) {
+        dictRehashMicroseconds(server.db[dbid].expires,usec-spent);
+        spent = ustime()-start+1;
     }
-    return 0;
+    server.stat_active_rehash_usec += spent;
+    if (spent) latencyAddEventSample(LATENCY_EVENT_REHASH,spent);
+    return spent;
+}
+
+/* The time databasesCron() gives to the rehashing: half of the time the
+ * event loop slept since the previous call, between ACTIVE_REHASH_MIN_USEC
+ * and activerehashing-max-ms. A saturated server keeps serving its clients
+ * while an idle one gets over the doubled memory of a resize sooner. */
+static long long activeRehashBudget(void) {
+    static long long prev_sleep_usec = 0;
+    long long budget = (server.el->sleepUsec-prev_sleep_usec)/2;
+
+    prev_sleep_usec = server.el->sleepUsec;
+    if (budget > server.activerehashing_max_ms*1000LL)
+        budget = server.activerehashing_max_ms*1000LL;
+    if (budget < ACTIVE_REHASH_MIN_USEC) budget = ACTIVE_REHASH_MIN_USEC;
+    return budget;
 }
 
 /* This function is called once a background process of some kind terminates,
@@ -1447,10 +1513,27 @@ int incrementallyRehash(int dbid) {
  * for dict.c to resize the hash tables accordingly to the fact we have o not
  * running childs. */
 void updateDictResizePolicy(void) {
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1)
+    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+        !memoryAnalyzeInProgress())
+    {
         dictEnableResize();
-    else
+        zmalloc_set_huge_advise(1);
+    } else {
         dictDisableResize();
+        /* A table forced to grow now is not worth a huge page the next
+         * write of the parent copies whole. */
+        zmalloc_set_huge_advise(0);
+    }
+}
+
+/* Give the calling thread a jemalloc arena of its own, named 'name' in
+ * INFO memory, if jemalloc-thread-arenas is enabled. */
+void serverThreadArenaInit(const char *name) {
+    if (!server.jemalloc_thread_arenas) return;
+    if (zmalloc_thread_arena_create(name) == -1)
+        serverLog(LL_WARNING,
+            "Warning: can't create the jemalloc arena of the %s thread, "
+            "it will use the default arenas.", name);
 }
 
 /* ======================= Cron: called every 100 ms ======================== */
@@ -1669,6 +1752,9 @@ void clientsCron(void) {
         //serverLog(LL_WARNING,"Before cron track expansive");
         if (clientsCronTrackExpansiveClients(c)) continue;
         //serverLog(LL_WARNING,"After cron track expansive");
+        /* Paused clients resume after their writes, this catches the ones
+         * that have nothing to write when the limit is raised. */
+        resumeClientReading(c);
     }
 }
 
@@ -1713,14 +1799,17 @@ void databasesCron(void) {
 
         /* Rehash */
         if (server.activerehashing) {
+            long long budget = activeRehashBudget();
+
             for (j = 0; j < dbs_per_call; j++) {
-                int work_done = incrementallyRehash(rehash_db);
-                if (work_done) {
-                    /* If the function did some work, stop here, we'll do
-                     * more at the next cron loop. */
+                budget -= incrementallyRehash(rehash_db,budget);
+                if (budget <= 0) {
+                    /* If the function used all our time, stop here, we'll
+                     * do more at the next cron loop. */
                     break;
                 } else {
-                    /* If this db didn't need rehash, we'll try the next one. */
+                    /* This db doesn't need rehash anymore, we'll try the
+                     * next one. */
                     rehash_db++;
                     rehash_db %= server.dbnum;
                 }
@@ -1748,53 +1837,9 @@ void updateCachedTime(void) {
     //server.daylight_active = tm.tm_isdst;
 }
 
-/* This is our timer interrupt, called server.hz times per second.
- * Here is where we do a number of things that need to be done asynchronously.
- * For instance:
- *
- * - Active expired keys collection (it is also performed in a lazy way on
- *   lookup).
- * - Software watchdog.
- * - Update some statistic.
- * - Incremental rehashing of the DBs hash tables.
- * - Triggering BGSAVE / AOF rewrite, and handling of terminated children.
- * - Clients timeout of different kinds.
- * - Replication reconnection.
- * - Many more...
- *
- * Everything directly called here will be called server.hz times per second,
- * so in order to throttle execution of things we want to do less frequently
- * a macro is used: run_with_period(milliseconds) { .... }
- */
-
-int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
-    int j;
-    UNUSED(eventLoop);
-    UNUSED(id);
-    UNUSED(clientData);
-
-    /* Software watchdog: deliver the SIGALRM that will reach the signal
-     * handler if we don't return here fast enough. */
-    if (server.watchdog_period) watchdogScheduleSignal(server.watchdog_period);
-
-    /* Update the time cache. */
-    updateCachedTime();
-
-    server.hz = server.config_hz;
-    /* Adapt the server.hz value to the number of configured clients. If we have
-     * many clients, we want to call serverCron() with an higher frequency. */
-    if (server.dynamic_hz) {
-        while (listLength(server.clients) / server.hz >
-               MAX_CLIENTS_PER_CLOCK_TICK)
-        {
-            server.hz *= 2;
-            if (server.hz > CONFIG_MAX_HZ) {
-                server.hz = CONFIG_MAX_HZ;
-                break;
-            }
-        }
-    }
-
+/* The statistics serverCron() samples: they only read counters of the
+ * server and of the allocator. */
+static void statsCron(void) {
     run_with_period(100) {
         trackInstantaneousMetric(STATS_METRIC_COMMAND,server.stat_numcommands);
         trackInstantaneousMetric(STATS_METRIC_NET_INPUT,
@@ -1847,6 +1892,177 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         if (!server.cron_malloc_stats.allocator_allocated)
             server.cron_malloc_stats.allocator_allocated = server.cron_malloc_stats.zmalloc_used;
     }
+}
+
+/* Page faults taken so far by the calling thread. On Popcorn the faults of
+ * a thread running on a remote node are the pages it pulled over, and the
+ * ones taken at home are the pages that it pulled back. */
+static long long popcornThreadFaults(void) {
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_THREAD,&ru) == -1) return 0;
+    return (long long)ru.ru_minflt+ru.ru_majflt;
+}
+
+/* Counters of the serverCron() sub-tasks, by POPCORN_CRON_* task. */
+typedef struct popcornCronStats {
+    long long runs;             /* Runs on the home node. */
+    long long remote_runs;      /* Runs on a remote node. */
+    long long deferred;         /* Remote ticks that left it to home. */
+    long long faults;           /* Page faults of the runs at home. */
+    long long remote_faults;    /* Page faults of the remote runs. */
+    long long usec;             /* Time spent in the runs. */
+} popcornCronStats;
+
+static popcornCronStats popcorn_cron_stats[POPCORN_CRON_TASKS];
+
+/* Names of the sub-tasks in INFO popcorn, and whether they touch the
+ * keyspace (or the clients), and if so whether popcornReleaseKeyspace()
+ * covers what they touch. */
+static const struct {
+    const char *name;
+    int keyspace;
+    int releasable;
+} popcornCronTasks[POPCORN_CRON_TASKS] = {
+    {"stats", 0, 0},
+    {"clients", 1, 0},
+    {"databases", 1, 1},
+    {"eviction", 1, 1}
+};
+
+/* Give up the ownership of the pages of the hash tables of a dictionary. */
+static void popcornReleaseDict(dict *d) {
+    struct popcorn_range r;
+    int j;
+
+    for (j = 0; j < 2; j++) {
+        r.addr = d->ht[j].table;
+        r.len = d->ht[j].size*sizeof(dictEntry*);
+        r.write = 1;
+        if (r.addr) popcorn_release_ranges(&r,1);
+    }
+}
+
+/* Called on a remote node once a keyspace sub-task ran there: release the
+ * hash tables of the databases, which the commands served at home are going
+ * to need first, so that the home node gets them back without invalidating
+ * them one page at a time. The keys and values are left alone, they are
+ * scattered over the heap. */
+static void popcornReleaseKeyspace(void) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        popcornReleaseDict(server.db[j].dict);
+        popcornReleaseDict(server.db[j].expires);
+    }
+}
+
+/* Run the serverCron() sub-task 'task', that calls 'proc', where its class
+ * and popcorn-cron-keyspace want it to run. A keyspace sub-task that should
+ * not run on the remote node the time events are processed on is left to
+ * popcornRunDeferredCron(), at home. */
+static void popcornCronRun(int task, void (*proc)(void)) {
+    popcornCronStats *cs = &popcorn_cron_stats[task];
+    int remote = server.el->migrationNode != AE_HOME_NODE;
+    long long start, faults;
+
+    if (remote && popcornCronTasks[task].keyspace &&
+        (server.popcorn_cron_keyspace == POPCORN_CRON_KEYSPACE_HOME ||
+         (server.popcorn_cron_keyspace == POPCORN_CRON_KEYSPACE_RELEASE &&
+          !popcornCronTasks[task].releasable)))
+    {
+        server.popcorn_cron_deferred |= 1<<task;
+        cs->deferred++;
+        return;
+    }
+
+    start = ustime();
+    faults = popcornThreadFaults();
+    proc();
+    if (remote && popcornCronTasks[task].keyspace &&
+        server.popcorn_cron_keyspace == POPCORN_CRON_KEYSPACE_RELEASE)
+    {
+        popcornReleaseKeyspace();
+    }
+    faults = popcornThreadFaults()-faults;
+    if (remote) {
+        cs->remote_runs++;
+        cs->remote_faults += faults;
+    } else {
+        cs->runs++;
+        cs->faults += faults;
+    }
+    cs->usec += ustime()-start;
+}
+
+/* Called by beforeSleep(): run at home the sub-tasks serverCron() deferred
+ * while the time events ran remotely, once each however many ticks were
+ * processed there. */
+void popcornRunDeferredCron(void) {
+    static void (*procs[POPCORN_CRON_TASKS])(void) = {
+        statsCron, clientsCron, databasesCron, evictionPoolWarm
+    };
+    int task;
+
+    if (server.popcorn_cron_deferred == 0 ||
+        server.el->migrationNode != AE_HOME_NODE) return;
+
+    for (task = 0; task < POPCORN_CRON_TASKS; task++) {
+        if (!(server.popcorn_cron_deferred & (1<<task))) continue;
+        server.popcorn_cron_deferred &= ~(1<<task);
+        popcornCronRun(task,procs[task]);
+    }
+}
+
+/* This is our timer interrupt, called server.hz times per second.
+ * Here is where we do a number of things that need to be done asynchronously.
+ * For instance:
+ *
+ * - Active expired keys collection (it is also performed in a lazy way on
+ *   lookup).
+ * - Software watchdog.
+ * - Update some statistic.
+ * - Incremental rehashing of the DBs hash tables.
+ * - Triggering BGSAVE / AOF rewrite, and handling of terminated children.
+ * - Clients timeout of different kinds.
+ * - Replication reconnection.
+ * - Many more...
+ *
+ * Everything directly called here will be called server.hz times per second,
+ * so in order to throttle execution of things we want to do less frequently
+ * a macro is used: run_with_period(milliseconds) { .... }
+ */
+
+int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    int j;
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+
+    /* Software watchdog: deliver the SIGALRM that will reach the signal
+     * handler if we don't return here fast enough. */
+    if (server.watchdog_period) watchdogScheduleSignal(server.watchdog_period);
+
+    /* Update the time cache. */
+    updateCachedTime();
+
+    server.hz = server.config_hz;
+    /* Adapt the server.hz value to the number of configured clients. If we have
+     * many clients, we want to call serverCron() with an higher frequency. */
+    if (server.dynamic_hz) {
+        while (listLength(server.clients) / server.hz >
+               MAX_CLIENTS_PER_CLOCK_TICK)
+        {
+            server.hz *= 2;
+            if (server.hz > CONFIG_MAX_HZ) {
+                server.hz = CONFIG_MAX_HZ;
+                break;
+            }
+        }
+    }
+
+    /* Sample the metrics and the memory usage. */
+    popcornCronRun(POPCORN_CRON_STATS,statsCron);
 
     /* We received a SIGTERM, shutting down here in a safe way, as it is
      * not ok doing so inside the signal handler. */
@@ -1883,22 +2099,29 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     }
 
     /* We need to do a few operations on clients asynchronously. */
-    clientsCron();
+    popcornCronRun(POPCORN_CRON_CLIENTS,clientsCron);
 
     /* Handle background operations on Redis databases. */
-    databasesCron();
+    popcornCronRun(POPCORN_CRON_DATABASES,databasesCron);
+
+    /* Sample eviction candidates ahead of the writes that will need them. */
+    run_with_period(100)
+        popcornCronRun(POPCORN_CRON_EVICTION,evictionPoolWarm);
 
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+    if (!rdbBgsaveInProgress() && server.aof_child_pid == -1 &&
         server.aof_rewrite_scheduled)
     {
         rewriteAppendOnlyFileBackground();
     }
 
+    /* Make progress with a BGSAVE without fork, or handle its end. */
+    if (server.rdb_forkless) rdbForklessCron();
+
     /* Check if a background saving or AOF rewrite in progress terminated. */
     if (server.rdb_child_pid != -1 || server.aof_child_pid != -1 ||
-        ldbPendingChildren())
+        ldbPendingChildren() || memoryAnalyzeInProgress())
     {
         int statloc;
         pid_t pid;
@@ -1922,16 +2145,21 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
                 backgroundRewriteDoneHandler(exitcode,bysignal);
                 if (!bysignal && exitcode == 0) receiveChildInfo();
             } else {
-                if (!ldbRemoveChild(pid)) {
+                if (!ldbRemoveChild(pid) &&
+                    !memoryAnalyzeChildDone(pid,exitcode,bysignal))
+                {
                     serverLog(LL_WARNING,
                         "Warning, detected child with unmatched pid: %ld",
                         (long)pid);
                 }
             }
             updateDictResizePolicy();
-            closeChildInfoPipe();
+            /* The pipe is shared with a still running RDB/AOF child if
+             * the one that exited was another kind of child. */
+            if (server.rdb_child_pid == -1 && server.aof_child_pid == -1)
+                closeChildInfoPipe();
         }
-    } else {
+    } else if (server.rdb_forkless == NULL) {
         /* If there is not a background saving/rewrite in progress check if
          * we have to save/rewrite now. */
         for (j = 0; j < server.saveparamslen; j++) {
@@ -1958,7 +2186,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 
         /* Trigger an AOF rewrite if needed. */
         if (server.aof_state == AOF_ON &&
-            server.rdb_child_pid == -1 &&
+            !rdbBgsaveInProgress() &&
             server.aof_child_pid == -1 &&
             server.aof_rewrite_perc &&
             server.aof_current_size > server.aof_rewrite_min_size)
@@ -2007,6 +2235,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         migrateCloseTimedoutSockets();
     }
 
+    /* Age the HOTKEYS counters. */
+    run_with_period(60000) hotkeysDecay();
+
     /* Stop the I/O threads if we don't have enough pending work. */
     stopThreadedIOIfNeeded();
 
@@ -2017,7 +2248,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
      * Note: this code must be after the replicationCron() call above so
      * make sure when refactoring this file to keep this order. This is useful
      * because we want to give priority to RDB savings for replication. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+    if (!rdbBgsaveInProgress() && server.aof_child_pid == -1 &&
         server.rdb_bgsave_scheduled &&
         (server.unixtime-server.lastbgsave_try > CONFIG_BGSAVE_RETRY_DELAY ||
          server.lastbgsave_status == C_OK))
@@ -2044,6 +2275,9 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
      * later in this function. */
     if (server.cluster_enabled) clusterBeforeSleep();
 
+    /* Catch up with the serverCron() work left to the home node. */
+    popcornRunDeferredCron();
+
     /* Run a fast expire cycle (the called function will return
      * ASAP if a fast cycle is not needed). */
     if (server.active_expire_enabled && server.masterhost == NULL)
@@ -2080,12 +2314,20 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
 
+    /* With aof-group-commit, send the replies of the clients whose writes
+     * are fsynced, and hold the others. */
+    processClientsWaitingAofFsync();
+
     /* Handle writes with pending output buffers. */
     handleClientsWithPendingWritesUsingThreads();
 
     /* Close clients that need to be closed asynchronous */
     freeClientsInAsyncFreeQueue();
 
+    /* Hand the objects deleted during this iteration to the lazyfree
+     * thread, as a single job. */
+    lazyfreeFlushPending();
+
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
      * time. */
@@ -2235,6 +2477,7 @@ void initServerConfig(void) {
     server.tcpkeepalive = CONFIG_DEFAULT_TCP_KEEPALIVE;
     server.active_expire_enabled = 1;
     server.active_defrag_enabled = CONFIG_DEFAULT_ACTIVE_DEFRAG;
+    server.active_defrag_threaded = CONFIG_DEFAULT_ACTIVE_DEFRAG_THREADED;
     server.active_defrag_ignore_bytes = CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES;
     server.active_defrag_threshold_lower = CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER;
     server.active_defrag_threshold_upper = CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER;
@@ -2242,7 +2485,19 @@ void initServerConfig(void) {
     server.active_defrag_cycle_max = CONFIG_DEFAULT_DEFRAG_CYCLE_MAX;
     server.active_defrag_max_scan_fields = CONFIG_DEFAULT_DEFRAG_MAX_SCAN_FIELDS;
     server.proto_max_bulk_len = CONFIG_DEFAULT_PROTO_MAX_BULK_LEN;
+    server.popcorn_migrate_policy = CONFIG_DEFAULT_POPCORN_MIGRATE_POLICY;
+    server.popcorn_migrate_node = CONFIG_DEFAULT_POPCORN_MIGRATE_NODE;
+    server.popcorn_bio_node = CONFIG_DEFAULT_POPCORN_BIO_NODE;
+    server.popcorn_adaptive.min_te_usec = POPCORN_ADAPTIVE_MIN_TE_USEC;
+    server.popcorn_adaptive.cost_ratio = POPCORN_ADAPTIVE_COST_RATIO;
+    server.popcorn_adaptive.max_fired = POPCORN_ADAPTIVE_MAX_FIRED;
+    server.popcorn_adaptive.batch_ticks = POPCORN_ADAPTIVE_BATCH_TICKS;
+    server.popcorn_schedule = NULL;
+    server.popcorn_cron_keyspace = CONFIG_DEFAULT_POPCORN_CRON_KEYSPACE;
+    server.popcorn_cron_deferred = 0;
     server.client_max_querybuf_len = PROTO_MAX_QUERYBUF_LEN;
+    server.client_obuf_pause = CONFIG_DEFAULT_CLIENT_OBUF_PAUSE;
+    server.clients_read_paused = 0;
     server.saveparams = NULL;
     server.loading = 0;
     server.logfile = zstrdup(CONFIG_DEFAULT_LOGFILE);
@@ -2254,6 +2509,7 @@ void initServerConfig(void) {
     server.supervised_mode = SUPERVISED_NONE;
     server.aof_state = AOF_OFF;
     server.aof_fsync = CONFIG_DEFAULT_AOF_FSYNC;
+    server.aof_group_commit = CONFIG_DEFAULT_AOF_GROUP_COMMIT;
     server.aof_no_fsync_on_rewrite = CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE;
     server.aof_rewrite_perc = AOF_REWRITE_PERC;
     server.aof_rewrite_min_size = AOF_REWRITE_MIN_SIZE;
@@ -2264,6 +2520,10 @@ void initServerConfig(void) {
     server.aof_rewrite_time_start = -1;
     server.aof_lastbgrewrite_status = C_OK;
     server.aof_delayed_fsync = 0;
+    server.aof_write_id = 0;
+    server.aof_fsync_submitted_id = 0;
+    server.aof_fsynced_id = 0;
+    server.aof_bio_fsynced_id = 0;
     server.aof_fd = -1;
     server.aof_selected_db = -1; /* Make sure the first time will not match */
     server.aof_flush_postponed_start = 0;
@@ -2276,9 +2536,16 @@ void initServerConfig(void) {
     server.aof_filename = zstrdup(CONFIG_DEFAULT_AOF_FILENAME);
     server.acl_filename = zstrdup(CONFIG_DEFAULT_ACL_FILENAME);
     server.rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;
+    server.rdb_compression_codec = CONFIG_DEFAULT_RDB_COMPRESSION_CODEC;
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
+    server.rdb_save_threads = CONFIG_DEFAULT_RDB_SAVE_THREADS;
+    server.rdb_load_threads = CONFIG_DEFAULT_RDB_LOAD_THREADS;
+    server.rdb_save_forkless = CONFIG_DEFAULT_RDB_SAVE_FORKLESS;
+    server.rdb_save_forkless_cpu = CONFIG_DEFAULT_RDB_SAVE_FORKLESS_CPU;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
+    server.activerehashing_max_ms = CONFIG_DEFAULT_ACTIVE_REHASHING_MAX_MS;
+    server.keyspace_open_addressing = CONFIG_DEFAULT_KEYSPACE_OPEN_ADDRESSING;
     server.active_defrag_running = 0;
     server.notify_keyspace_events = 0;
     server.maxclients = CONFIG_DEFAULT_MAX_CLIENTS;
@@ -2288,16 +2555,21 @@ void initServerConfig(void) {
     server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;
     server.maxmemory_policy = CONFIG_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
+    server.maxmemory_eviction_batch = CONFIG_DEFAULT_MAXMEMORY_EVICTION_BATCH;
     server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
     server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
     server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
     server.hash_max_ziplist_value = OBJ_HASH_MAX_ZIPLIST_VALUE;
+    server.hash_max_intmap_entries = OBJ_HASH_MAX_INTMAP_ENTRIES;
     server.list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
     server.list_compress_depth = OBJ_LIST_COMPRESS_DEPTH;
+    server.list_compress_codec = OBJ_LIST_COMPRESS_CODEC;
     server.set_max_intset_entries = OBJ_SET_MAX_INTSET_ENTRIES;
     server.zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
+    server.zset_btree = CONFIG_DEFAULT_ZSET_BTREE;
     server.hll_sparse_max_bytes = CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES;
+    server.hll_simd = CONFIG_DEFAULT_HLL_SIMD;
     server.stream_node_max_bytes = OBJ_STREAM_NODE_MAX_BYTES;
     server.stream_node_max_entries = OBJ_STREAM_NODE_MAX_ENTRIES;
     server.shutdown_asap = 0;
@@ -2307,6 +2579,7 @@ void initServerConfig(void) {
     server.cluster_slave_validity_factor = CLUSTER_DEFAULT_SLAVE_VALIDITY;
     server.cluster_require_full_coverage = CLUSTER_DEFAULT_REQUIRE_FULL_COVERAGE;
     server.cluster_slave_no_failover = CLUSTER_DEFAULT_SLAVE_NO_FAILOVER;
+    server.cluster_gossip_delta = CLUSTER_DEFAULT_GOSSIP_DELTA;
     server.cluster_configfile = zstrdup(CONFIG_DEFAULT_CLUSTER_CONFIG_FILE);
     server.cluster_announce_ip = CONFIG_DEFAULT_CLUSTER_ANNOUNCE_IP;
     server.cluster_announce_port = CONFIG_DEFAULT_CLUSTER_ANNOUNCE_PORT;
@@ -2318,10 +2591,20 @@ void initServerConfig(void) {
     server.lazyfree_lazy_eviction = CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION;
     server.lazyfree_lazy_expire = CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE;
     server.lazyfree_lazy_server_del = CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL;
+    server.active_expire_index = CONFIG_DEFAULT_ACTIVE_EXPIRE_INDEX;
     server.always_show_logo = CONFIG_DEFAULT_ALWAYS_SHOW_LOGO;
     server.lua_time_limit = LUA_SCRIPT_TIME_LIMIT;
     server.io_threads_num = CONFIG_DEFAULT_IO_THREADS_NUM;
+    server.module_worker_threads = CONFIG_DEFAULT_MODULE_WORKER_THREADS;
     server.io_threads_do_reads = CONFIG_DEFAULT_IO_THREADS_DO_READS;
+    server.io_uring_writes = CONFIG_DEFAULT_IO_URING_WRITES;
+    server.jemalloc_thread_arenas = CONFIG_DEFAULT_JEMALLOC_THREAD_ARENAS;
+    server.hugepage_dict_tables = CONFIG_DEFAULT_HUGEPAGE_DICT_TABLES;
+    server.io_threads_do_commands = CONFIG_DEFAULT_IO_THREADS_DO_COMMANDS;
+    server.io_threads_shard_by_slot = CONFIG_DEFAULT_IO_THREADS_SHARD_BY_SLOT;
+    server.io_threads_node = CONFIG_DEFAULT_IO_THREADS_NODE;
+    server.io_threads_spin = CONFIG_DEFAULT_IO_THREADS_SPIN;
+    server.keyspace_readonly = 0;
 
     server.lruclock = getLRUClock();
     resetServerSaveParams();
@@ -2347,6 +2630,8 @@ void initServerConfig(void) {
     server.repl_disable_tcp_nodelay = CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY;
     server.repl_diskless_sync = CONFIG_DEFAULT_REPL_DISKLESS_SYNC;
     server.repl_diskless_sync_delay = CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY;
+    server.repl_diskless_sync_max_replicas = CONFIG_DEFAULT_REPL_DISKLESS_SYNC_MAX_REPLICAS;
+    server.repl_diskless_compression = CONFIG_DEFAULT_REPL_DISKLESS_COMPRESSION;
     server.repl_ping_slave_period = CONFIG_DEFAULT_REPL_PING_SLAVE_PERIOD;
     server.repl_timeout = CONFIG_DEFAULT_REPL_TIMEOUT;
     server.repl_min_slaves_to_write = CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE;
@@ -2360,8 +2645,8 @@ void initServerConfig(void) {
     server.repl_backlog = NULL;
     server.repl_backlog_size = CONFIG_DEFAULT_REPL_BACKLOG_SIZE;
     server.repl_backlog_histlen = 0;
-    server.repl_backlog_idx = 0;
     server.repl_backlog_off = 0;
+    server.repl_buffer_mem = 0;
     server.repl_backlog_time_limit = CONFIG_DEFAULT_REPL_BACKLOG_TIME_LIMIT;
     server.repl_no_slaves_since = time(NULL);
 
@@ -2401,6 +2686,8 @@ void initServerConfig(void) {
 
     /* Latency monitor */
     server.latency_monitor_threshold = CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD;
+    server.hotkeys_sample_rate = CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE;
+    server.hotkeys_countdown = 1;
 
     /* Debugging */
     server.assert_failed = "<no assertion failed>";
@@ -2681,6 +2968,7 @@ void resetServerStats(void) {
     server.stat_active_defrag_misses = 0;
     server.stat_active_defrag_key_hits = 0;
     server.stat_active_defrag_key_misses = 0;
+    server.stat_active_rehash_usec = 0;
     server.stat_active_defrag_scanned = 0;
     server.stat_fork_time = 0;
     server.stat_fork_rate = 0;
@@ -2697,7 +2985,307 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_io_uring_batches = 0;
+    server.stat_io_uring_writes = 0;
+    server.stat_io_threaded_commands = 0;
+    server.stat_io_parsed_commands = 0;
+    server.stat_client_read_pauses = 0;
     server.aof_delayed_fsync = 0;
+    resetPopcornStats();
+}
+
+/* Migrations of the threads following the popcorn-schedule, by region.
+ * Updated by the IO and bio threads, hence the mutex. */
+typedef struct popcornRegionStats {
+    long long migrations;
+    long long failed;
+    long long migrate_usec;
+} popcornRegionStats;
+
+static popcornRegionStats popcorn_region_stats[POPCORN_REGIONS];
+static pthread_mutex_t popcorn_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Names of the regions in INFO popcorn, indexed by region ID. */
+static const char *popcornRegionNames[POPCORN_REGIONS] = {
+    "none", "time_events", "io_threads", "bio"
+};
+
+/* Install in the event loop the migration policy selected with the
+ * popcorn-migrate-policy option. Called at startup and every time one of
+ * the popcorn-migrate-* options is modified via CONFIG SET. */
+void updatePopcornMigrationPolicy(void) {
+    if (server.el == NULL) return;
+    server.popcorn_migrate_target = server.popcorn_migrate_node < 0 ?
+        AE_MIGRATE_BEST : server.popcorn_migrate_node;
+    switch(server.popcorn_migrate_policy) {
+    case POPCORN_MIGRATE_NEVER:
+        aeSetMigrationPolicy(server.el,aeMigrationPolicyNever,NULL);
+        break;
+    case POPCORN_MIGRATE_ADAPTIVE:
+        server.popcorn_adaptive.nid = server.popcorn_migrate_target;
+        aeSetMigrationPolicy(server.el,aeMigrationPolicyAdaptive,
+            &server.popcorn_adaptive);
+        break;
+    default:
+        aeSetMigrationPolicy(server.el,aeMigrationPolicyAlways,
+            &server.popcorn_migrate_target);
+        break;
+    }
+}
+
+/* Run on the destination node of every migration of the event loop thread,
+ * so that the first event processed there sees a fresh cached time instead
+ * of the one taken before migrate(), and the bit operations, HyperLogLog
+ * commands and CRC32C check again the SIMD and CRC instructions of the node. */
+static void popcornMigrationArrived(aeEventLoop *el, void *privdata) {
+    UNUSED(el);
+    UNUSED(privdata);
+    updateCachedTime();
+    bitopsSimdReset();
+    hllSimdReset();
+    crc32cReset();
+}
+
+/* Run once the event loop thread migrated, see aeSetMigrationDoneProc(). */
+static void popcornMigrationDone(aeEventLoop *el, long long usec,
+                                 void *privdata) {
+    UNUSED(el);
+    UNUSED(privdata);
+    latencyAddEventSample(LATENCY_EVENT_MIGRATE,usec);
+}
+
+/* Load the thread schedule in 'path', or drop the current one if 'path' is
+ * empty. On error C_ERR is returned, the current schedule is left in place
+ * and 'err' is set to the reason. */
+int loadPopcornSchedule(const char *path, char *err, size_t errlen) {
+    int line;
+
+    if (path[0] == '\0') {
+        popcorn_schedule_clear();
+        return C_OK;
+    }
+    if (popcorn_schedule_load(path,&line) == 0) return C_OK;
+    if (line)
+        snprintf(err,errlen,"Invalid line %d in Popcorn schedule '%s'",
+            line,path);
+    else
+        snprintf(err,errlen,"Can't load Popcorn schedule '%s': %s",
+            path,strerror(errno));
+    return C_ERR;
+}
+
+/* Move the calling thread, running on node '*nid' on behalf of 'region', to
+ * node 'target', accounting the migration to the region. '*nid' is updated
+ * when the thread moves. */
+void popcornMoveThread(int region, int target, int *nid) {
+    long long start, elapsed;
+    int retval;
+
+    if (target == *nid) return;
+    start = ustime();
+    retval = POPCORN_PROFILE_MIGRATE(region,target);
+    elapsed = ustime()-start;
+    if (retval == 0 || retval == EBUSY) *nid = target;
+    if (retval == EBUSY) return;
+    if (region < 0 || region >= POPCORN_REGIONS) return;
+
+    pthread_mutex_lock(&popcorn_stats_mutex);
+    if (retval == 0) {
+        popcorn_region_stats[region].migrations++;
+        popcorn_region_stats[region].migrate_usec += elapsed;
+    } else {
+        popcorn_region_stats[region].failed++;
+    }
+    pthread_mutex_unlock(&popcorn_stats_mutex);
+}
+
+/* Reset the counters of INFO popcorn. The event loop keeps the cost
+ * estimates its migration policy relies on. */
+void resetPopcornStats(void) {
+    if (server.el) aeResetMigrationStats(server.el);
+    pthread_mutex_lock(&popcorn_stats_mutex);
+    memset(popcorn_region_stats,0,sizeof(popcorn_region_stats));
+    pthread_mutex_unlock(&popcorn_stats_mutex);
+    memset(popcorn_cron_stats,0,sizeof(popcorn_cron_stats));
+}
+
+/* Fill 'rs' with the migration counters of every region. The time events
+ * ones come from the event loop, the others from popcornMoveThread(). */
+static void getPopcornRegionStats(popcornRegionStats *rs) {
+    aeMigrationStats st;
+
+    pthread_mutex_lock(&popcorn_stats_mutex);
+    memcpy(rs,popcorn_region_stats,sizeof(popcorn_region_stats));
+    pthread_mutex_unlock(&popcorn_stats_mutex);
+
+    aeGetMigrationStats(server.el,&st);
+    rs[AE_REGION_TIME_EVENTS].migrations = st.migrations;
+    rs[AE_REGION_TIME_EVENTS].failed = st.failed;
+    rs[AE_REGION_TIME_EVENTS].migrate_usec = st.migrate_usec;
+}
+
+static double popcornAvgMigrateUsec(popcornRegionStats *rs) {
+    return rs->migrations ? (double)rs->migrate_usec/rs->migrations : 0;
+}
+
+/* Append the "# Popcorn" INFO section to 'info'. */
+static sds genPopcornInfoString(sds info) {
+    popcornRegionStats rs[POPCORN_REGIONS];
+    aeMigrationStats st;
+    int j;
+
+    aeGetMigrationStats(server.el,&st);
+    getPopcornRegionStats(rs);
+    info = sdscatprintf(info,
+        "# Popcorn\r\n"
+        "popcorn_migrate_policy:%s\r\n"
+        "popcorn_migrate_node:%d\r\n"
+        "popcorn_bio_node:%d\r\n"
+        "popcorn_io_threads_node:%d\r\n"
+        "popcorn_home_node:%d\r\n"
+        "popcorn_current_node:%d\r\n"
+        "popcorn_schedule_entries:%d\r\n"
+        "popcorn_migrations:%lld\r\n"
+        "popcorn_failed_migrations:%lld\r\n"
+        "popcorn_avg_migrate_usec:%.2f\r\n"
+        "popcorn_max_migrate_usec:%lld\r\n"
+        "popcorn_remote_te_ticks:%lld\r\n"
+        "popcorn_local_te_ticks:%lld\r\n"
+        "popcorn_held_te_ticks:%lld\r\n"
+        "popcorn_remote_te_usec:%lld\r\n"
+        "popcorn_local_te_usec:%lld\r\n",
+        popcornMigratePolicyToString(),
+        server.popcorn_migrate_node,
+        server.popcorn_bio_node,
+        server.io_threads_node,
+        AE_HOME_NODE,
+        server.el->migrationNode,
+        popcorn_schedule_size(),
+        st.migrations,
+        st.failed,
+        popcornAvgMigrateUsec(&rs[AE_REGION_TIME_EVENTS]),
+        st.migrate_max_usec,
+        st.remote_ticks,
+        st.local_ticks,
+        st.held_ticks,
+        st.remote_usec,
+        st.local_usec);
+    for (j = 1; j < POPCORN_REGIONS; j++) {
+        info = sdscatprintf(info,
+            "popcorn_region_%s:migrations=%lld,failed=%lld,"
+            "avg_migrate_usec=%.2f\r\n",
+            popcornRegionNames[j], rs[j].migrations, rs[j].failed,
+            popcornAvgMigrateUsec(&rs[j]));
+    }
+    info = sdscatprintf(info,"popcorn_cron_keyspace:%s\r\n",
+        popcornCronKeyspaceToString());
+    for (j = 0; j < POPCORN_CRON_TASKS; j++) {
+        popcornCronStats *cs = &popcorn_cron_stats[j];
+
+        info = sdscatprintf(info,
+            "popcorn_cron_%s:runs=%lld,remote_runs=%lld,deferred=%lld,"
+            "faults=%lld,remote_faults=%lld,usec=%lld\r\n",
+            popcornCronTasks[j].name, cs->runs, cs->remote_runs,
+            cs->deferred, cs->faults, cs->remote_faults, cs->usec);
+    }
+    return info;
+}
+
+/* POPCORN <subcommand> [<args>] */
+void popcornCommand(client *c) {
+    if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"help")) {
+        const char *help[] = {
+"STATS -- Return the migration counters of the event loop, of each region and of each serverCron() sub-task.",
+"RESET -- Reset the migration counters.",
+"POLICY [<policy>] -- Return or set the migration policy of the time events (always, never or adaptive).",
+NULL
+        };
+        addReplyHelp(c, help);
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"stats")) {
+        popcornRegionStats rs[POPCORN_REGIONS];
+        aeMigrationStats st;
+        int j;
+
+        aeGetMigrationStats(server.el,&st);
+        getPopcornRegionStats(rs);
+        addReplyMapLen(c,14+(POPCORN_REGIONS-1)+POPCORN_CRON_TASKS);
+        addReplyBulkCString(c,"policy");
+        addReplyBulkCString(c,popcornMigratePolicyToString());
+        addReplyBulkCString(c,"migrate.node");
+        addReplyLongLong(c,server.popcorn_migrate_node);
+        addReplyBulkCString(c,"home.node");
+        addReplyLongLong(c,AE_HOME_NODE);
+        addReplyBulkCString(c,"current.node");
+        addReplyLongLong(c,server.el->migrationNode);
+        addReplyBulkCString(c,"migrations");
+        addReplyLongLong(c,st.migrations);
+        addReplyBulkCString(c,"failed.migrations");
+        addReplyLongLong(c,st.failed);
+        addReplyBulkCString(c,"avg.migrate.usec");
+        addReplyDouble(c,popcornAvgMigrateUsec(&rs[AE_REGION_TIME_EVENTS]));
+        addReplyBulkCString(c,"max.migrate.usec");
+        addReplyLongLong(c,st.migrate_max_usec);
+        addReplyBulkCString(c,"remote.te.ticks");
+        addReplyLongLong(c,st.remote_ticks);
+        addReplyBulkCString(c,"local.te.ticks");
+        addReplyLongLong(c,st.local_ticks);
+        addReplyBulkCString(c,"held.te.ticks");
+        addReplyLongLong(c,st.held_ticks);
+        addReplyBulkCString(c,"remote.te.usec");
+        addReplyLongLong(c,st.remote_usec);
+        addReplyBulkCString(c,"local.te.usec");
+        addReplyLongLong(c,st.local_usec);
+        for (j = 1; j < POPCORN_REGIONS; j++) {
+            addReplyBulkSds(c,sdscatprintf(sdsempty(),"region.%s",
+                popcornRegionNames[j]));
+            addReplyMapLen(c,3);
+            addReplyBulkCString(c,"migrations");
+            addReplyLongLong(c,rs[j].migrations);
+            addReplyBulkCString(c,"failed");
+            addReplyLongLong(c,rs[j].failed);
+            addReplyBulkCString(c,"avg.migrate.usec");
+            addReplyDouble(c,popcornAvgMigrateUsec(&rs[j]));
+        }
+        addReplyBulkCString(c,"cron.keyspace");
+        addReplyBulkCString(c,popcornCronKeyspaceToString());
+        for (j = 0; j < POPCORN_CRON_TASKS; j++) {
+            popcornCronStats *cs = &popcorn_cron_stats[j];
+
+            addReplyBulkSds(c,sdscatprintf(sdsempty(),"cron.%s",
+                popcornCronTasks[j].name));
+            addReplyMapLen(c,6);
+            addReplyBulkCString(c,"runs");
+            addReplyLongLong(c,cs->runs);
+            addReplyBulkCString(c,"remote.runs");
+            addReplyLongLong(c,cs->remote_runs);
+            addReplyBulkCString(c,"deferred");
+            addReplyLongLong(c,cs->deferred);
+            addReplyBulkCString(c,"faults");
+            addReplyLongLong(c,cs->faults);
+            addReplyBulkCString(c,"remote.faults");
+            addReplyLongLong(c,cs->remote_faults);
+            addReplyBulkCString(c,"usec");
+            addReplyLongLong(c,cs->usec);
+        }
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"reset")) {
+        resetPopcornStats();
+        addReply(c,shared.ok);
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"policy")) {
+        addReplyBulkCString(c,popcornMigratePolicyToString());
+    } else if (c->argc == 3 && !strcasecmp(c->argv[1]->ptr,"policy")) {
+        int policy = popcornMigratePolicyFromString(c->argv[2]->ptr);
+
+        if (policy == INT_MIN) {
+            addReplyError(c,"Invalid Popcorn migration policy. "
+                "Must be one of: always, never, adaptive");
+            return;
+        }
+        server.popcorn_migrate_policy = policy;
+        updatePopcornMigrationPolicy();
+        addReply(c,shared.ok);
+    } else {
+        addReplySubcommandSyntaxError(c);
+    }
 }
 
 void initServer(void) {
@@ -2714,11 +3302,14 @@ void initServer(void) {
 
     server.hz = server.config_hz;
     server.pid = getpid();
+    server.main_thread_id = pthread_self();
+    serverThreadArenaInit("main");
     server.current_client = NULL;
     server.clients = listCreate();
     server.clients_index = raxNew();
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
+    server.repl_buffer_blocks = listCreate();
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
     server.clients_pending_read = listCreate();
@@ -2726,6 +3317,7 @@ void initServer(void) {
     server.unblocked_clients = listCreate();
     server.ready_keys = listCreate();
     server.clients_waiting_acks = listCreate();
+    server.clients_waiting_fsync = listCreate();
     server.get_ack_from_slaves = 0;
     server.clients_paused = 0;
     server.system_memory_size = zmalloc_get_memory_size();
@@ -2739,6 +3331,9 @@ void initServer(void) {
             strerror(errno));
         exit(1);
     }
+    updatePopcornMigrationPolicy();
+    aeSetMigrationArrivalProc(server.el,popcornMigrationArrived,NULL);
+    aeSetMigrationDoneProc(server.el,popcornMigrationDone,NULL);
     server.db = zmalloc(sizeof(redisDb)*server.dbnum);
 
     /* Open the TCP listening socket for the user commands. */
@@ -2765,18 +3360,25 @@ void initServer(void) {
     }
 
     /* Create the Redis databases, and initialize other internal state. */
+    dbDictType.hugeTables = server.hugepage_dict_tables;
+    keyptrDictType.hugeTables = server.hugepage_dict_tables;
     for (j = 0; j < server.dbnum; j++) {
-        server.db[j].dict = dictCreate(&dbDictType,NULL);
-        server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        server.db[j].dict = createDbDict(&dbDictType);
+        server.db[j].expires = createDbDict(&keyptrDictType);
+        server.db[j].expires_index =
+            server.active_expire_index ? raxNew() : NULL;
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
-        server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
+        server.db[j].watched_keys = dictCreate(&objectKeyHeapPointerValueDictType,NULL);
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
         server.db[j].defrag_later = listCreate();
     }
     evictionPoolAlloc(); /* Initialize the LRU keys pool. */
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
+    server.pubsub_patterns_dict = dictCreate(&keylistDictType,NULL);
+    server.pubsub_pattern_prefixes = raxNew();
+    server.pubsub_pattern_prefix_maxlen = 0;
     server.pubsub_patterns = listCreate();
     listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
     listSetMatchMethod(server.pubsub_patterns,listMatchPubsubPattern);
@@ -2784,11 +3386,12 @@ void initServer(void) {
     server.rdb_child_pid = -1;
     server.aof_child_pid = -1;
     server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+    server.rdb_forkless = NULL;
     server.rdb_bgsave_scheduled = 0;
     server.child_info_pipe[0] = -1;
     server.child_info_pipe[1] = -1;
     server.child_info_data.magic = 0;
-    aofRewriteBufferReset();
+    server.aof_manifest = NULL;
     server.aof_buf = sdsempty();
     server.lastsave = time(NULL); /* At startup we consider the DB saved. */
     server.lastbgsave_try = 0;    /* At startup we never tried to BGSAVE. */
@@ -2842,17 +3445,26 @@ void initServer(void) {
                 "blocked clients subsystem.");
     }
 
-    /* Open the AOF file if needed. */
-    if (server.aof_state == AOF_ON) {
-        server.aof_fd = open(server.aof_filename,
-                               O_WRONLY|O_APPEND|O_CREAT,0644);
-        if (server.aof_fd == -1) {
-            serverLog(LL_WARNING, "Can't open the append-only file: %s",
-                strerror(errno));
-            exit(1);
-        }
+    /* Register a readable event for the pipe used by the bio thread to awake
+     * the event loop when the clients waiting for an AOF group commit can
+     * get their replies. */
+    if (pipe(server.aof_fsync_pipe) == -1) {
+        serverLog(LL_WARNING,"Can't create the pipe for AOF group commits: %s",
+            strerror(errno));
+        exit(1);
+    }
+    anetNonBlock(NULL,server.aof_fsync_pipe[0]);
+    anetNonBlock(NULL,server.aof_fsync_pipe[1]);
+    if (aeCreateFileEvent(server.el, server.aof_fsync_pipe[0], AE_READABLE,
+        aofFsyncPipeReadable,NULL) == AE_ERR) {
+            serverPanic(
+                "Error registering the readable event for the AOF group "
+                "commits.");
     }
 
+    /* Open the AOF file if needed. */
+    aofOpenOnServerStart();
+
     /* 32 bit instances are limited to 4GB of address space, so if there is
      * no explicit limit in the user provided configuration we set a limit
      * at 3 GB using maxmemory with 'noeviction' policy'. This avoids
@@ -3150,6 +3762,7 @@ void preventCommandReplication(client *c) {
 void call(client *c, int flags) {
     long long dirty, start, duration;
     int client_old_flags = c->flags;
+    int sampled = 0;
     struct redisCommand *real_cmd = c->cmd;
 
     /* Sent the command to clients in MONITOR mode, only if the commands are
@@ -3167,6 +3780,18 @@ void call(client *c, int flags) {
     redisOpArray prev_also_propagate = server.also_propagate;
     redisOpArrayInit(&server.also_propagate);
 
+    /* A BGSAVE without fork saves the keys of the command first, if they
+     * are still to be saved. */
+    if (server.rdb_forkless) rdbForklessWillCall(c);
+
+    /* Sample the keys of the command for HOTKEYS. */
+    if (server.hotkeys_sample_rate && !server.loading &&
+        hotkeysShouldSample())
+    {
+        sampled = 1;
+        hotkeysSampleKeys(c);
+    }
+
     /* Call the command. */
     dirty = server.dirty;
     start = ustime();
@@ -3205,6 +3830,7 @@ void call(client *c, int flags) {
         real_cmd->microseconds += duration;
         real_cmd->calls++;
     }
+    if (sampled) hotkeysSampleLatency(real_cmd,duration);
 
     /* Propagate the command into the AOF and replication link */
     if (flags & CMD_CALL_PROPAGATE &&
@@ -3277,7 +3903,10 @@ void call(client *c, int flags) {
  * other operations can be performed by the caller. Otherwise
  * if C_ERR is returned the client was destroyed (i.e. after QUIT). */
 int processCommand(client *c) {
-    moduleCallCommandFilters(c);
+    if (c->bpop.keylock_filtered)
+        c->bpop.keylock_filtered = 0;
+    else
+        moduleCallCommandFilters(c);
 
     /* The QUIT command is handled separately. Normal command procs will
      * go through checking for replication and QUIT will cause trouble
@@ -3310,6 +3939,12 @@ int processCommand(client *c) {
         return C_OK;
     }
 
+    /* The hash slot of the keys is needed by the cluster redirection, by
+     * EXEC for the queued commands and by the I/O threads sharding:
+     * compute it once, here. */
+    if (server.cluster_enabled || server.io_threads_shard_by_slot)
+        c->slot = getCommandSlot(c->cmd,c->argv,c->argc);
+
     /* Check if the user is authenticated. This check is skipped in case
      * the default user is flagged as "nopass" and is active. */
     int auth_required = !(DefaultUser->flags & USER_FLAG_NOPASS) &&
@@ -3326,6 +3961,7 @@ int processCommand(client *c) {
     /* Check if the user can run this command according to the current
      * ACLs. */
     int acl_retval = ACLCheckCommandPerm(c);
+    if (server.io_threads_shard_by_slot) clientTrackShardSlot(c);
     if (acl_retval != ACL_OK) {
         flagTransaction(c);
         if (acl_retval == ACL_DENIED_CMD)
@@ -3487,6 +4123,8 @@ int processCommand(client *c) {
         queueMultiCommand(c);
         addReply(c,shared.queued);
     } else {
+        /* Wait for the module jobs holding the keys of the command. */
+        if (moduleWaitForKeyLocks(c)) return C_OK;
         call(c,CMD_CALL_FULL);
         c->woff = server.master_repl_offset;
         if (listLength(server.ready_keys))
@@ -3521,6 +4159,9 @@ int prepareForShutdown(int flags) {
     /* Kill all the Lua debugger forked sessions. */
     ldbKillForkedSessions();
 
+    /* Kill the memory analysis child: its report would be lost anyway. */
+    memoryAnalyzeKillChild();
+
     /* Kill the saving child if there is a background saving in progress.
        We want to avoid race conditions, for instance our saving child may
        overwrite the synchronous saving did by SHUTDOWN. */
@@ -3528,6 +4169,10 @@ int prepareForShutdown(int flags) {
         serverLog(LL_WARNING,"There is a child saving an .rdb. Killing it!");
         killRDBChild();
     }
+    if (server.rdb_forkless) {
+        serverLog(LL_WARNING,"There is a BGSAVE without fork in progress. Stopping it!");
+        rdbForklessKill();
+    }
 
     if (server.aof_state != AOF_OFF) {
         /* Kill the AOF saving child as the AOF we already have may be longer
@@ -3576,7 +4221,15 @@ int prepareForShutdown(int flags) {
      * send them pending writes. */
     flushSlavesOutputBuffers();
 
-    /* Close the listening sockets. Apparently this allows faster restarts. */
+    /* Close the listening sockets. Apparently this allows faster restarts.
+     * Their events go first: the io_uring event loop holds a reference on
+     * the sockets it polls, which would keep them open until the exit. */
+    for (int j = 0; j < server.ipfd_count; j++)
+        aeDeleteFileEvent(server.el,server.ipfd[j],AE_READABLE);
+    if (server.sofd != -1) aeDeleteFileEvent(server.el,server.sofd,AE_READABLE);
+    if (server.cluster_enabled)
+        for (int j = 0; j < server.cfd_count; j++)
+            aeDeleteFileEvent(server.el,server.cfd[j],AE_READABLE);
     closeListeningSockets(1);
     serverLog(LL_WARNING,"%s is now ready to exit, bye bye...",
         server.sentinel_mode ? "Sentinel" : "Redis");
@@ -3883,10 +4536,12 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_recent_max_input_buffer:%zu\r\n"
             "client_recent_max_output_buffer:%zu\r\n"
-            "blocked_clients:%d\r\n",
+            "blocked_clients:%d\r\n"
+            "read_paused_clients:%d\r\n",
             listLength(server.clients)-listLength(server.slaves),
             maxin, maxout,
-            server.blocked_clients);
+            server.blocked_clients,
+            server.clients_read_paused);
     }
 
     /* Memory */
@@ -4003,7 +4658,27 @@ sds genRedisInfoString(char *section) {
             server.active_defrag_running,
             lazyfreeGetPendingObjectsCount()
         );
+
+        /* The memory of the clients by class, mem_clients_slaves and
+         * mem_clients_normal split further. */
+        for (j = 0; j < CLIENT_TYPE_COUNT; j++) {
+            info = sdscatprintf(info,
+                "mem_clients_class_%s:clients=%zu,mem=%zu,obuf=%zu\r\n",
+                getClientTypeName(j), mh->clients_class_count[j],
+                mh->clients_class[j], mh->clients_class_obuf[j]);
+        }
         freeMemoryOverheadData(mh);
+
+        /* Per thread arenas, see jemalloc-thread-arenas. */
+        const char *arena_name;
+        size_t arena_allocated, arena_active, arena_resident;
+        for (j = 0; zmalloc_get_arena_info(j,&arena_name,&arena_allocated,
+                                           &arena_active,&arena_resident); j++)
+        {
+            info = sdscatprintf(info,
+                "arena_%s:allocated=%zu,active=%zu,resident=%zu\r\n",
+                arena_name, arena_allocated, arena_active, arena_resident);
+        }
     }
 
     /* Persistence */
@@ -4029,11 +4704,11 @@ sds genRedisInfoString(char *section) {
             "aof_last_cow_size:%zu\r\n",
             server.loading,
             server.dirty,
-            server.rdb_child_pid != -1,
+            rdbBgsaveInProgress(),
             (intmax_t)server.lastsave,
             (server.lastbgsave_status == C_OK) ? "ok" : "err",
             (intmax_t)server.rdb_save_time_last,
-            (intmax_t)((server.rdb_child_pid == -1) ?
+            (intmax_t)(!rdbBgsaveInProgress() ?
                 -1 : time(NULL)-server.rdb_save_time_start),
             server.stat_rdb_cow_bytes,
             server.aof_state != AOF_OFF,
@@ -4052,16 +4727,18 @@ sds genRedisInfoString(char *section) {
                 "aof_base_size:%lld\r\n"
                 "aof_pending_rewrite:%d\r\n"
                 "aof_buffer_length:%zu\r\n"
-                "aof_rewrite_buffer_length:%lu\r\n"
+                "aof_incr_files:%lu\r\n"
                 "aof_pending_bio_fsync:%llu\r\n"
-                "aof_delayed_fsync:%lu\r\n",
+                "aof_delayed_fsync:%lu\r\n"
+                "aof_fsync_waiting_clients:%lu\r\n",
                 (long long) server.aof_current_size,
                 (long long) server.aof_rewrite_base_size,
                 server.aof_rewrite_scheduled,
                 sdslen(server.aof_buf),
-                aofRewriteBufferSize(),
+                listLength(server.aof_manifest->incr),
                 bioPendingJobsOfType(BIO_AOF_FSYNC),
-                server.aof_delayed_fsync);
+                server.aof_delayed_fsync,
+                listLength(server.clients_waiting_fsync));
         }
 
         if (server.loading) {
@@ -4093,6 +4770,24 @@ sds genRedisInfoString(char *section) {
                 perc,
                 (intmax_t)eta
             );
+
+            /* The keys that went through every stage of the loading, and
+             * the keys per second of every stage. */
+            if (elapsed == 0) elapsed = 1;
+            info = sdscatprintf(info,
+                "loading_read_keys:%lld\r\n"
+                "loading_decoded_keys:%lld\r\n"
+                "loading_loaded_keys:%lld\r\n"
+                "loading_read_keys_per_sec:%lld\r\n"
+                "loading_decoded_keys_per_sec:%lld\r\n"
+                "loading_loaded_keys_per_sec:%lld\r\n",
+                server.loading_read_keys,
+                server.loading_decoded_keys,
+                server.loading_loaded_keys,
+                server.loading_read_keys/elapsed,
+                server.loading_decoded_keys/elapsed,
+                server.loading_loaded_keys/elapsed
+            );
         }
     }
 
@@ -4126,7 +4821,13 @@ sds genRedisInfoString(char *section) {
             "active_defrag_hits:%lld\r\n"
             "active_defrag_misses:%lld\r\n"
             "active_defrag_key_hits:%lld\r\n"
-            "active_defrag_key_misses:%lld\r\n",
+            "active_defrag_key_misses:%lld\r\n"
+            "active_rehash_usec:%lld\r\n"
+            "io_uring_write_batches:%lld\r\n"
+            "io_uring_writes:%lld\r\n"
+            "io_threaded_commands:%lld\r\n"
+            "io_threaded_parsed_commands:%lld\r\n"
+            "client_read_pauses:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -4152,7 +4853,13 @@ sds genRedisInfoString(char *section) {
             server.stat_active_defrag_hits,
             server.stat_active_defrag_misses,
             server.stat_active_defrag_key_hits,
-            server.stat_active_defrag_key_misses);
+            server.stat_active_defrag_key_misses,
+            server.stat_active_rehash_usec,
+            server.stat_io_uring_batches,
+            server.stat_io_uring_writes,
+            server.stat_io_threaded_commands,
+            server.stat_io_parsed_commands,
+            server.stat_client_read_pauses);
     }
 
     /* Replication */
@@ -4234,6 +4941,8 @@ sds genRedisInfoString(char *section) {
                 char ip[NET_IP_STR_LEN], *slaveip = slave->slave_ip;
                 int port;
                 long lag = 0;
+                long long sync_ms;
+                double sync_kbps;
 
                 if (slaveip[0] == '\0') {
                     if (anetPeerToString(slave->fd,ip,sizeof(ip),&port) == -1)
@@ -4256,11 +4965,21 @@ sds genRedisInfoString(char *section) {
                 if (slave->replstate == SLAVE_STATE_ONLINE)
                     lag = time(NULL) - slave->repl_ack_time;
 
+                /* Full sync transfer metrics: while the transfer is in
+                 * progress the time is the one elapsed so far. */
+                sync_ms = slave->repl_sync_time;
+                if (sync_ms == 0 && slave->repl_sync_start)
+                    sync_ms = mstime() - slave->repl_sync_start;
+                sync_kbps = sync_ms ?
+                    (double)slave->repl_sync_bytes/1024/sync_ms*1000 : 0;
+
                 info = sdscatprintf(info,
                     "slave%d:ip=%s,port=%d,state=%s,"
-                    "offset=%lld,lag=%ld\r\n",
+                    "offset=%lld,lag=%ld,sync_bytes=%lld,sync_ms=%lld,"
+                    "sync_kbps=%.2f\r\n",
                     slaveid,slaveip,slave->slave_listening_port,state,
-                    slave->repl_ack_off, lag);
+                    slave->repl_ack_off, lag, slave->repl_sync_bytes,
+                    sync_ms, sync_kbps);
                 slaveid++;
             }
         }
@@ -4298,6 +5017,19 @@ sds genRedisInfoString(char *section) {
         (long)c_ru.ru_utime.tv_sec, (long)c_ru.ru_utime.tv_usec);
     }
 
+    /* I/O threads */
+    if (allsections || defsections || !strcasecmp(section,"iothreads")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,"# IOThreads\r\n");
+        info = genIOThreadsInfoString(info);
+    }
+
+    /* Popcorn */
+    if (allsections || defsections || !strcasecmp(section,"popcorn")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = genPopcornInfoString(info);
+    }
+
     /* Command statistics */
     if (allsections || !strcasecmp(section,"commandstats")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -4557,7 +5289,7 @@ int checkForSentinelMode(int argc, char **argv) {
 void loadDataFromDisk(void) {
     long long start = ustime();
     if (server.aof_state == AOF_ON) {
-        if (loadAppendOnlyFile(server.aof_filename) == C_OK)
+        if (loadAppendOnlyFiles() == C_OK)
             serverLog(LL_NOTICE,"DB loaded from append only file: %.3f seconds",(float)(ustime()-start)/1000000);
     } else {
         rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
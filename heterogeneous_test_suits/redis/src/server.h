@@ -52,6 +52,7 @@
 typedef long long mstime_t; /* millisecond time type. */
 
 #include "ae.h"      /* Event driven programming library */
+#include "popcorn_schedule.h" /* Popcorn thread schedules */
 #include "sds.h"     /* Dynamic safe strings */
 #include "dict.h"    /* Hash tables */
 #include "adlist.h"  /* Linked lists */
@@ -59,10 +60,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
 #include "intset.h"  /* Compact integer set structure */
+#include "intmap.h"  /* Compact integer hash table structure */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
 #include "latency.h" /* Latency monitor API */
 #include "sparkline.h" /* ASCII graphs API */
+#include "compress.h"  /* Pluggable block compression codecs */
 #include "quicklist.h"  /* Lists are encoded as linked lists of
                            N-elements flat arrays */
 #include "rax.h"     /* Radix tree */
@@ -72,6 +75,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "sha1.h"
 #include "endianconv.h"
 #include "crc64.h"
+#include "crc32c.h"
 
 /* Error codes */
 #define C_OK                    0
@@ -88,10 +92,19 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_CLIENT_TIMEOUT       0   /* Default client timeout: infinite */
 #define CONFIG_DEFAULT_DBNUM     16
 #define CONFIG_DEFAULT_IO_THREADS_NUM 1         /* Single threaded by default */
+#define CONFIG_DEFAULT_MODULE_WORKER_THREADS 4
 #define CONFIG_DEFAULT_IO_THREADS_DO_READS 0    /* Read + parse from threads? */
+#define CONFIG_DEFAULT_IO_THREADS_DO_COMMANDS 0 /* Run reads in threads? */
+#define CONFIG_DEFAULT_IO_THREADS_SHARD_BY_SLOT 0 /* Threads own slots? */
+#define CONFIG_DEFAULT_IO_THREADS_NODE -1       /* Leave the IO threads home. */
+#define CONFIG_DEFAULT_IO_THREADS_SPIN 1000000  /* Polls before parking. */
+#define CONFIG_DEFAULT_IO_URING_WRITES 0        /* Batch writes with io_uring? */
+#define CONFIG_DEFAULT_JEMALLOC_THREAD_ARENAS 0 /* An arena per thread? */
+#define CONFIG_DEFAULT_HUGEPAGE_DICT_TABLES 0   /* Keyspace in huge pages? */
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
+#define NET_MAX_WRITEV_IOVCNT 16 /* Reply blocks sent by a single writev(2). */
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000
 #define OBJ_SHARED_BULKHDR_LEN 32
@@ -99,7 +112,6 @@ typedef long long mstime_t; /* millisecond time type. */
 #define AOF_REWRITE_PERC  100
 #define AOF_REWRITE_MIN_SIZE (64*1024*1024)
 #define AOF_REWRITE_ITEMS_PER_CMD 64
-#define AOF_READ_DIFF_INTERVAL_BYTES (1024*10)
 #define CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN 10000
 #define CONFIG_DEFAULT_SLOWLOG_MAX_LEN 128
 #define CONFIG_DEFAULT_MAX_CLIENTS 10000
@@ -112,6 +124,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_REPL_BACKLOG_SIZE (1024*1024)    /* 1mb */
 #define CONFIG_DEFAULT_REPL_BACKLOG_TIME_LIMIT (60*60)  /* 1 hour */
 #define CONFIG_REPL_BACKLOG_MIN_SIZE (1024*16)          /* 16k */
+#define REPL_BACKLOG_TRIM_BLOCKS_PER_CALL 10 /* See incrementalTrimReplicationBacklog(). */
 #define CONFIG_BGSAVE_RETRY_DELAY 5 /* Wait a few secs before trying again. */
 #define CONFIG_DEFAULT_PID_FILE "/var/run/redis.pid"
 #define CONFIG_DEFAULT_SYSLOG_IDENT "redis"
@@ -128,10 +141,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_SYSLOG_ENABLED 0
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
+#define CONFIG_DEFAULT_RDB_COMPRESSION_CODEC COMPRESS_LZF
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
+#define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_MAX_REPLICAS 0
+#define CONFIG_DEFAULT_REPL_DISKLESS_COMPRESSION 1
 #define CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA 1
 #define CONFIG_DEFAULT_SLAVE_READ_ONLY 1
 #define CONFIG_DEFAULT_SLAVE_IGNORE_MAXMEMORY 1
@@ -140,6 +156,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
 #define CONFIG_DEFAULT_MAXMEMORY 0
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
+#define CONFIG_DEFAULT_MAXMEMORY_EVICTION_BATCH 1
+#define CONFIG_MAX_MAXMEMORY_EVICTION_BATCH 1024
 #define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
 #define CONFIG_DEFAULT_LFU_DECAY_TIME 1
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
@@ -147,8 +165,17 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
 #define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 1
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
+#define CONFIG_DEFAULT_ACTIVE_REHASHING_MAX_MS 10 /* Max rehash per cron. */
+#define CONFIG_DEFAULT_KEYSPACE_OPEN_ADDRESSING 0
+#define ACTIVE_REHASH_MIN_USEC 100  /* Rehash per cron of a saturated server. */
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
 #define CONFIG_DEFAULT_RDB_SAVE_INCREMENTAL_FSYNC 1
+#define CONFIG_DEFAULT_RDB_SAVE_THREADS 1
+#define RDB_SAVE_THREADS_MAX 64
+#define CONFIG_DEFAULT_RDB_LOAD_THREADS 1
+#define RDB_LOAD_THREADS_MAX 64
+#define CONFIG_DEFAULT_RDB_SAVE_FORKLESS 0
+#define CONFIG_DEFAULT_RDB_SAVE_FORKLESS_CPU 25
 #define CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE 0
 #define CONFIG_DEFAULT_MIN_SLAVES_MAX_LAG 10
 #define CONFIG_DEFAULT_ACL_FILENAME ""
@@ -157,12 +184,15 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_BINDADDR_MAX 16
 #define CONFIG_MIN_RESERVED_FDS 32
 #define CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD 0
+#define CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE 0
 #define CONFIG_DEFAULT_SLAVE_LAZY_FLUSH 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL 0
+#define CONFIG_DEFAULT_ACTIVE_EXPIRE_INDEX 0
 #define CONFIG_DEFAULT_ALWAYS_SHOW_LOGO 0
 #define CONFIG_DEFAULT_ACTIVE_DEFRAG 0
+#define CONFIG_DEFAULT_ACTIVE_DEFRAG_THREADED 0
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER 10 /* don't defrag when fragmentation is below 10% */
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER 100 /* maximum defrag force at 100% fragmentation */
 #define CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES (100<<20) /* don't defrag if frag overhead is below 100mb */
@@ -170,6 +200,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_DEFRAG_CYCLE_MAX 75 /* 75% CPU max (at upper threshold) */
 #define CONFIG_DEFAULT_DEFRAG_MAX_SCAN_FIELDS 1000 /* keys with more than 1000 fields will be processed separately */
 #define CONFIG_DEFAULT_PROTO_MAX_BULK_LEN (512ll*1024*1024) /* Bulk request max size */
+#define CONFIG_DEFAULT_CLIENT_OBUF_PAUSE 0 /* Never stop reading from clients. */
+#define CONFIG_DEFAULT_POPCORN_MIGRATE_POLICY POPCORN_MIGRATE_ALWAYS
+#define CONFIG_DEFAULT_POPCORN_MIGRATE_NODE -1 /* Pick the best node. */
+#define CONFIG_DEFAULT_POPCORN_BIO_NODE -1 /* Leave the bio threads home. */
+#define CONFIG_DEFAULT_POPCORN_CRON_KEYSPACE POPCORN_CRON_KEYSPACE_HOME
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
@@ -190,6 +225,9 @@ typedef long long mstime_t; /* millisecond time type. */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_REPLY_OBJ_MIN     (1024*16) /* Bulks replied by reference. */
+#define PROTO_QUEUED_CMDS_MAX   64   /* Max commands an I/O thread parses
+                                        ahead for a single client. */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define REDIS_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -289,7 +327,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_PENDING_READ (1<<29) /* The client has pending reads and was put
                                        in the list of clients we can read
                                        from. */
-#define CLIENT_PENDING_COMMAND (1<<30) /* */
+#define CLIENT_PENDING_COMMAND (1<<30) /* Used in threaded I/O to signal after
+                                          we return single threaded that the
+                                          client has already pending commands
+                                          to be executed in c->cmdq, or that
+                                          c->argv waits for module key
+                                          locks. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -299,7 +342,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define BLOCKED_MODULE 3  /* Blocked by a loadable module. */
 #define BLOCKED_STREAM 4  /* XREAD. */
 #define BLOCKED_ZSET 5    /* BZPOP et al. */
-#define BLOCKED_NUM 6     /* Number of blocked states. */
+#define BLOCKED_KEYLOCK 6 /* Keys locked by a module worker pool job. */
+#define BLOCKED_NUM 7     /* Number of blocked states. */
 
 /* Client request types */
 #define PROTO_REQ_INLINE 1
@@ -314,6 +358,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_TYPE_OBUF_COUNT 3 /* Number of clients to expose to output
                                     buffer configuration. Just the first
                                     three: normal, slave, pubsub. */
+#define CLIENT_TYPE_COUNT 4 /* All the classes, for the memory breakdown. */
 
 /* Slave replication state. Used in server.repl_state for slaves to remember
  * what to do next. */
@@ -376,6 +421,40 @@ typedef long long mstime_t; /* millisecond time type. */
 #define SUPERVISED_SYSTEMD 2
 #define SUPERVISED_UPSTART 3
 
+/* Popcorn migration policies for the time events of the event loop. */
+#define POPCORN_MIGRATE_ALWAYS 0   /* Migrate at every event loop iteration. */
+#define POPCORN_MIGRATE_NEVER 1    /* Never leave the home node. */
+#define POPCORN_MIGRATE_ADAPTIVE 2 /* Migrate only when it is worth it. */
+
+/* Defaults of the adaptive policy, see aeAdaptiveMigrationPolicy. */
+#define POPCORN_ADAPTIVE_MIN_TE_USEC 100
+#define POPCORN_ADAPTIVE_COST_RATIO 2.0
+#define POPCORN_ADAPTIVE_MAX_FIRED 32
+#define POPCORN_ADAPTIVE_BATCH_TICKS 10
+
+/* Regions of the popcorn-schedule file (AE_REGION_TIME_EVENTS is 1). The
+ * thread ID is the IO thread ID and the BIO_* job type respectively. */
+#define POPCORN_REGION_IO_THREADS 2
+#define POPCORN_REGION_BIO 3
+#define POPCORN_REGIONS 4
+
+/* Sub-tasks of serverCron() accounted separately in INFO popcorn. Those
+ * touching the keyspace or the clients follow popcorn-cron-keyspace when the
+ * time events run on a remote node, the others run wherever the time events
+ * run. */
+#define POPCORN_CRON_STATS 0     /* Metrics and memory sampling: CPU only. */
+#define POPCORN_CRON_CLIENTS 1   /* clientsCron(). */
+#define POPCORN_CRON_DATABASES 2 /* databasesCron(): expire, resize, rehash. */
+#define POPCORN_CRON_EVICTION 3  /* evictionPoolWarm(). */
+#define POPCORN_CRON_TASKS 4
+
+/* popcorn-cron-keyspace: where the keyspace sub-tasks of serverCron() run
+ * while the time events run on a remote node. */
+#define POPCORN_CRON_KEYSPACE_HOME 0    /* Deferred to the home node. */
+#define POPCORN_CRON_KEYSPACE_RELEASE 1 /* Remotely, then the pages of the
+                                           hash tables are released. */
+#define POPCORN_CRON_KEYSPACE_REMOTE 2  /* Remotely. */
+
 /* Anti-warning macro... */
 #define UNUSED(V) ((void) V)
 
@@ -387,22 +466,27 @@ typedef long long mstime_t; /* millisecond time type. */
 #define AOF_FSYNC_ALWAYS 1
 #define AOF_FSYNC_EVERYSEC 2
 #define CONFIG_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
+#define CONFIG_DEFAULT_AOF_GROUP_COMMIT 0
 
 /* Zipped structures related defaults */
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
 #define OBJ_HASH_MAX_ZIPLIST_VALUE 64
+#define OBJ_HASH_MAX_INTMAP_ENTRIES 0
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
 #define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
+#define CONFIG_DEFAULT_ZSET_BTREE 0
 #define OBJ_STREAM_NODE_MAX_BYTES 4096
 #define OBJ_STREAM_NODE_MAX_ENTRIES 100
 
 /* List defaults */
 #define OBJ_LIST_MAX_ZIPLIST_SIZE -2
 #define OBJ_LIST_COMPRESS_DEPTH 0
+#define OBJ_LIST_COMPRESS_CODEC COMPRESS_LZF
 
 /* HyperLogLog defines */
 #define CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES 3000
+#define CONFIG_DEFAULT_HLL_SIMD 1
 
 /* Sets operations codes */
 #define SET_OP_UNION 0
@@ -630,6 +714,8 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
 #define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
 #define OBJ_ENCODING_STREAM 10 /* Encoded as a radix tree of listpacks */
+#define OBJ_ENCODING_BTREE 11  /* Encoded as B+tree */
+#define OBJ_ENCODING_INTMAP 12 /* Encoded as intmap */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -663,15 +749,39 @@ struct evictionPoolEntry; /* Defined in evict.c */
  * which is actually a linked list of blocks like that, that is: client->reply. */
 typedef struct clientReplyBlock {
     size_t size, used;
+    robj *obj;      /* If not NULL, the block has no buf but refers to this
+                       string object (refcount held), sent from its own sds:
+                       see addReplyBulk(). size and used are then its length. */
     char buf[];
 } clientReplyBlock;
 
+/* The bytes of a reply block. */
+#define replyBlockData(o) ((o)->obj ? (char*)(o)->obj->ptr : (o)->buf)
+
+/* The replication stream is stored once, in the list of blocks
+ * server.repl_buffer_blocks, shared by the backlog and by all the slaves:
+ * each of them references the first block it still needs, and the blocks
+ * referenced by nobody are released from the head of the list once out of
+ * the backlog (see incrementalTrimReplicationBacklog()). */
+typedef struct replBufBlock {
+    int refcount;           /* Slaves, and the backlog, starting here. */
+    long long repl_offset;  /* Replication offset of the first byte. */
+    size_t size, used;
+    char buf[];
+} replBufBlock;
+
+/* The backlog always references the head of server.repl_buffer_blocks. */
+typedef struct replBacklog {
+    listNode *ref_repl_buf_node; /* NULL until the first byte is fed. */
+} replBacklog;
+
 /* Redis database representation. There are multiple databases identified
  * by integers from 0 (the default database) up to the max configured
  * database. The database number is the 'id' field in the structure. */
 typedef struct redisDb {
     dict *dict;                 /* The keyspace for this DB */
     dict *expires;              /* Timeout of keys with a timeout set */
+    rax *expires_index;         /* Keys with a timeout by time, or NULL */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
@@ -680,16 +790,37 @@ typedef struct redisDb {
     list *defrag_later;         /* List of key names to attempt to defrag one by one, gradually. */
 } redisDb;
 
+/* Objects released together by a single job of the lazyfree thread, see
+ * dbAsyncDeleteBatched(). */
+#define LAZYFREE_BATCH_SIZE 1024
+typedef struct lazyfreeBatch {
+    size_t count;
+    robj *objs[LAZYFREE_BATCH_SIZE];
+} lazyfreeBatch;
+
 /* Client MULTI/EXEC state */
+/* The hash slot of the keys of a command, see getCommandSlot(), when it is
+ * not a slot. */
+#define COMMAND_SLOT_NOKEYS -1  /* The command has no keys. */
+#define COMMAND_SLOT_CROSS -2   /* Its keys hash to different slots. */
+#define COMMAND_SLOT_UNKNOWN -3 /* Not computed. */
+
 typedef struct multiCmd {
     robj **argv;
     int argc;
     struct redisCommand *cmd;
+    int slot;               /* Hash slot of the keys, or COMMAND_SLOT_*. */
 } multiCmd;
 
+/* Initial size of the queue of a transaction, and the largest kept from one
+ * transaction to the next. */
+#define MULTI_QUEUE_INITIAL 4
+#define MULTI_QUEUE_KEEP 64
+
 typedef struct multiState {
     multiCmd *commands;     /* Array of MULTI commands */
     int count;              /* Total number of MULTI commands */
+    int alloc;              /* Size of the commands array. */
     int cmd_flags;          /* The accumulated command flags OR-ed together.
                                So if at least a command has a given flag, it
                                will be set in this field. */
@@ -706,7 +837,8 @@ typedef struct blockingState {
 
     /* BLOCKED_LIST, BLOCKED_ZSET and BLOCKED_STREAM */
     dict *keys;             /* The keys we are waiting to terminate a blocking
-                             * operation such as BLPOP or XREAD. Or NULL. */
+                             * operation such as BLPOP or XREAD, to a bkinfo
+                             * (see blocked.c). Or NULL. */
     robj *target;           /* The key that should receive the element,
                              * for BRPOPLPUSH. */
 
@@ -725,6 +857,10 @@ typedef struct blockingState {
     void *module_blocked_handle; /* RedisModuleBlockedClient structure.
                                     which is opaque for the Redis core, only
                                     handled in module.c. */
+
+    /* BLOCKED_KEYLOCK */
+    int keylock_filtered;   /* The command in argv already went through the
+                               module command filters. */
 } blockingState;
 
 /* The following structure represents a node in the server.ready_keys list,
@@ -783,8 +919,25 @@ typedef struct user {
     list *patterns;  /* A list of allowed key patterns. If this field is NULL
                         the user cannot mention any key in a command, unless
                         the flag ALLKEYS is set in the user. */
+
+    /* The patterns above, compiled by ACLCompileUserPatterns() so that a key
+     * is checked against all of them at once: those without wildcards are
+     * looked up in 'exact_patterns', those like "prefix*" in
+     * 'prefix_patterns', where no prefix is a prefix of another, and only
+     * the others are matched one by one, compiled by stringmatchCompile().
+     * 'glob_patterns' is NULL terminated. */
+    rax *exact_patterns;
+    rax *prefix_patterns;
+    stringmatchPattern **glob_patterns;
 } user;
 
+/* A command parsed by an I/O thread, waiting in the client queue to be
+ * executed by the main thread. */
+typedef struct clientQueuedCommand {
+    int argc;
+    robj **argv;
+} clientQueuedCommand;
+
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a linked list. */
 typedef struct client {
@@ -802,6 +955,10 @@ typedef struct client {
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size. */
     int argc;               /* Num of arguments of current command. */
     robj **argv;            /* Arguments of current command. */
+    clientQueuedCommand *cmdq; /* Commands parsed by I/O threads, to run. */
+    int cmdq_pos;           /* Next command to run in cmdq. */
+    int cmdq_len;           /* Commands in cmdq, including the run ones. */
+    int cmdq_size;          /* Allocated entries of cmdq. */
     struct redisCommand *cmd, *lastcmd;  /* Last command executed. */
     user *user;             /* User associated with this connection. If the
                                user is set to NULL the connection can do
@@ -816,6 +973,8 @@ typedef struct client {
     time_t ctime;           /* Client creation time. */
     time_t lastinteraction; /* Time of the last interaction, used for timeout */
     time_t obuf_soft_limit_reached_time;
+    int read_paused;        /* Not read from because of its output buffers,
+                               see client-output-buffer-pause. */
     int flags;              /* Client flags: CLIENT_* macros. */
     int authenticated;      /* Needed when the default user requires auth. */
     int replstate;          /* Replication state if this is a slave. */
@@ -824,6 +983,13 @@ typedef struct client {
     off_t repldboff;        /* Replication DB file offset. */
     off_t repldbsize;       /* Replication DB file size. */
     sds replpreamble;       /* Replication DB preamble. */
+    listNode *ref_repl_buf_node; /* Slave: next block of the shared replication
+                                    buffer to send, NULL if none yet. */
+    size_t ref_block_pos;   /* Bytes of that block already sent. */
+    long long repl_sync_start; /* Full sync RDB transfer start (ms). */
+    long long repl_sync_time;  /* Full sync RDB transfer time (ms), 0 while
+                                  the transfer is in progress. */
+    long long repl_sync_bytes; /* Full sync RDB bytes sent to the slave. */
     long long read_reploff; /* Read replication offset if this is a master. */
     long long reploff;      /* Applied replication offset if this is a master. */
     long long repl_ack_off; /* Replication ack offset, if this is a slave. */
@@ -839,6 +1005,14 @@ typedef struct client {
     int btype;              /* Type of blocking op if CLIENT_BLOCKED. */
     blockingState bpop;     /* blocking state */
     long long woff;         /* Last write global replication offset. */
+    int shard_slot;         /* Hash slot of the first key of the last command,
+                               -1 if none (io-threads-shard-by-slot). */
+    int slot;               /* Hash slot of the keys of the current command,
+                               or COMMAND_SLOT_*, computed by processCommand()
+                               in cluster mode or with io-threads-shard-by-slot,
+                               COMMAND_SLOT_UNKNOWN otherwise. */
+    long long aof_fsync_id; /* AOF write to fsync before sending the replies
+                               (aof-group-commit), 0 if none. */
     list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
@@ -847,7 +1021,8 @@ typedef struct client {
 
     /* Response buffer */
     int bufpos;
-    char buf[PROTO_REPLY_CHUNK_BYTES];
+    char *buf;              /* PROTO_REPLY_CHUNK_BYTES reply buffer borrowed
+                               from the pool while bufpos > 0, or NULL. */
 } client;
 
 struct saveparam {
@@ -894,11 +1069,59 @@ typedef struct zskiplist {
     int level;
 } zskiplist;
 
+/* Large sorted sets can use a B+tree instead of the skiplist (see zbtree.c).
+ * Leaves keep the scores and the elements in two arrays, inner nodes the
+ * number of elements below every child, so that ranks are computed on the
+ * way down. Both node types fit a 1024 bytes allocation. */
+#define ZBT_LEAF_CAP 62
+#define ZBT_INNER_CAP 31
+
+typedef struct zbtreeLeaf {
+    struct zbtreeLeaf *prev, *next;
+    unsigned int count;
+    double score[ZBT_LEAF_CAP];
+    sds ele[ZBT_LEAF_CAP];
+} zbtreeLeaf;
+
+typedef struct zbtreeInner {
+    unsigned int count;                 /* Number of children. */
+    unsigned long size[ZBT_INNER_CAP];  /* Elements below every child. */
+    double score[ZBT_INNER_CAP];        /* child[i] only holds elements >= */
+    sds ele[ZBT_INNER_CAP];             /* (score[i],ele[i]), for i > 0. */
+    void *child[ZBT_INNER_CAP];
+} zbtreeInner;
+
+typedef struct zbtree {
+    void *root;
+    zbtreeLeaf *head, *tail;
+    unsigned long length;
+    unsigned long nodes;    /* Leaves and inner nodes, for MEMORY USAGE. */
+    int height;             /* Levels of inner nodes, 0 if root is a leaf. */
+} zbtree;
+
+/* Position of an element inside a zbtree. */
+typedef struct zbtreeIter {
+    zbtreeLeaf *leaf;
+    unsigned int idx;
+    unsigned long rank;     /* 1-based, like the skiplist ranks. */
+} zbtreeIter;
+
+#define zbtIterScore(it) ((it)->leaf->score[(it)->idx])
+#define zbtIterEle(it) ((it)->leaf->ele[(it)->idx])
+
+/* With OBJ_ENCODING_SKIPLIST 'zsl' is set and the dict values point to the
+ * scores inside the skiplist nodes. With OBJ_ENCODING_BTREE 'zbt' is set and
+ * the dict values are the scores themselves, since elements move inside and
+ * between the leaves: use zsetDictGetScore() to read them. */
 typedef struct zset {
     dict *dict;
     zskiplist *zsl;
+    zbtree *zbt;
 } zset;
 
+#define zsetDictGetScore(zs,de) \
+    ((zs)->zbt ? dictGetDoubleVal(de) : *(double*)dictGetVal(de))
+
 typedef struct clientBufferLimitsConfig {
     unsigned long long hard_limit_bytes;
     unsigned long long soft_limit_bytes;
@@ -940,6 +1163,11 @@ struct redisMemOverhead {
     size_t repl_backlog;
     size_t clients_slaves;
     size_t clients_normal;
+    /* The clients again, by class (CLIENT_TYPE_*): their number, memory
+     * and the part of it in the output buffers. */
+    size_t clients_class_count[CLIENT_TYPE_COUNT];
+    size_t clients_class[CLIENT_TYPE_COUNT];
+    size_t clients_class_obuf[CLIENT_TYPE_COUNT];
     size_t aof_buffer;
     size_t lua_caches;
     size_t overhead_total;
@@ -984,6 +1212,17 @@ typedef struct rdbSaveInfo {
 
 #define RDB_SAVE_INFO_INIT {-1,0,"000000000000000000000000000000",-1}
 
+/* The files of a multi part AOF, as listed in its manifest: a base, the
+ * dataset as of the last rewrite, and the incremental files written since
+ * then, replayed in order after it. Without a manifest on disk the AOF is
+ * the single appendfilename, that the first rewrite turns into a base. */
+typedef struct aofManifest {
+    sds base;           /* Base file, NULL if there is none. */
+    list *incr;         /* Incremental files, sds names, oldest first. */
+    long long seq;      /* Last sequence number used in a file name. */
+    int ondisk;         /* Is there a manifest on disk? */
+} aofManifest;
+
 struct malloc_stats {
     size_t zmalloc_used;
     size_t process_rss;
@@ -1011,6 +1250,7 @@ struct clusterState;
 struct redisServer {
     /* General */
     pid_t pid;                  /* Main process pid. */
+    pthread_t main_thread_id;   /* Thread running the event loop. */
     char *configfile;           /* Absolute config file path, or NULL */
     char *executable;           /* Absolute executable file path. */
     char **exec_argv;           /* Executable argv vector (copy). */
@@ -1026,6 +1266,8 @@ struct redisServer {
     _Atomic unsigned int lruclock; /* Clock for LRU eviction */
     int shutdown_asap;          /* SHUTDOWN needed ASAP */
     int activerehashing;        /* Incremental rehash in serverCron() */
+    int activerehashing_max_ms; /* Max time of that rehash per cron call. */
+    int keyspace_open_addressing; /* Open addressing db dictionaries. */
     int active_defrag_running;  /* Active defragmentation running (holds current scan aggressiveness) */
     char *pidfile;              /* PID file path */
     int arch_bits;              /* 32 or 64 depending on sizeof(long) */
@@ -1042,6 +1284,7 @@ struct redisServer {
     int module_blocked_pipe[2]; /* Pipe used to awake the event loop if a
                                    client blocked on a module command needs
                                    to be processed. */
+    int module_worker_threads;  /* Threads running module jobs. */
     /* Networking */
     int port;                   /* TCP listening port */
     int tcp_backlog;            /* TCP listen() backlog */
@@ -1071,6 +1314,17 @@ struct redisServer {
                                    queries. Will still serve RESP2 queries. */
     int io_threads_num;         /* Number of IO threads to use. */
     int io_threads_do_reads;    /* Read and parse from IO threads? */
+    int io_threads_do_commands; /* Run read only commands in IO threads? */
+    int io_threads_shard_by_slot; /* Route clients to the IO thread owning
+                                     the hash slot of their keys? */
+    int io_threads_node;        /* Node of the IO threads without a schedule
+                                   entry, -1 to leave them. */
+    int io_threads_spin;        /* Max polls of an idle IO thread, then park. */
+    int jemalloc_thread_arenas; /* A jemalloc arena for every thread. */
+    int hugepage_dict_tables;   /* Keyspace hash tables in huge pages. */
+    int keyspace_readonly;      /* True while IO threads run commands: the
+                                   keyspace must not be modified. */
+    int io_uring_writes;        /* Batch the writes to clients with io_uring? */
 
     /* RDB / AOF loading information */
     int loading;                /* We are loading data from disk if true */
@@ -1078,6 +1332,9 @@ struct redisServer {
     off_t loading_loaded_bytes;
     time_t loading_start_time;
     off_t loading_process_events_interval_bytes;
+    long long loading_read_keys;    /* Keys read from the file so far. */
+    long long loading_decoded_keys; /* Keys turned into objects so far. */
+    long long loading_loaded_keys;  /* Keys added to the dbs so far. */
     /* Fast pointers to often looked up command */
     struct redisCommand *delCommand, *multiCommand, *lpushCommand,
                         *lpopCommand, *rpopCommand, *zpopminCommand,
@@ -1098,6 +1355,7 @@ struct redisServer {
     long long stat_active_defrag_misses;    /* number of allocations scanned but not moved */
     long long stat_active_defrag_key_hits;  /* number of keys with moved allocations */
     long long stat_active_defrag_key_misses;/* number of keys scanned and not moved */
+    long long stat_active_rehash_usec; /* Time spent in the active rehashing. */
     long long stat_active_defrag_scanned;   /* number of dictEntries scanned */
     size_t stat_peak_memory;        /* Max used memory record */
     long long stat_fork_time;       /* Time needed to perform latest fork() */
@@ -1113,6 +1371,11 @@ struct redisServer {
     struct malloc_stats cron_malloc_stats; /* sampled in serverCron(). */
     _Atomic long long stat_net_input_bytes; /* Bytes read from network. */
     _Atomic long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_io_uring_batches; /* io_uring submissions of client writes. */
+    long long stat_io_uring_writes; /* Client writes sent through io_uring. */
+    long long stat_io_threaded_commands; /* Commands run by the IO threads. */
+    long long stat_io_parsed_commands; /* Commands parsed by I/O threads. */
+    long long stat_client_read_pauses; /* Clients paused by their output. */
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
     /* The following two are used to track instantaneous metrics, like
@@ -1129,6 +1392,7 @@ struct redisServer {
     int tcpkeepalive;               /* Set SO_KEEPALIVE if non-zero. */
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
     int active_defrag_enabled;
+    int active_defrag_threaded;        /* Allocate and free in a bio thread */
     size_t active_defrag_ignore_bytes; /* minimum amount of fragmentation waste to start active defrag */
     int active_defrag_threshold_lower; /* minimum percentage of fragmentation to start active defrag */
     int active_defrag_threshold_upper; /* maximum percentage of fragmentation at which we use maximum effort */
@@ -1136,6 +1400,9 @@ struct redisServer {
     int active_defrag_cycle_max;       /* maximal effort for defrag in CPU percentage */
     unsigned long active_defrag_max_scan_fields; /* maximum number of fields of set/hash/zset/list to process from within the main dict scan */
     _Atomic size_t client_max_querybuf_len; /* Limit for client query buffer length */
+    size_t client_obuf_pause;       /* Stop reading from clients with more
+                                       output buffers than this, 0 = never. */
+    int clients_read_paused;        /* Clients not read from because of it. */
     int dbnum;                      /* Total number of configured DBs */
     int supervised;                 /* 1 if supervised, 0 otherwise. */
     int supervised_mode;            /* See SUPERVISED_* */
@@ -1151,9 +1418,16 @@ struct redisServer {
     off_t aof_rewrite_base_size;    /* AOF size on latest startup or rewrite. */
     off_t aof_current_size;         /* AOF current size. */
     off_t aof_fsync_offset;         /* AOF offset which is already synced to disk. */
+    int aof_group_commit;           /* Fsync "always" in background? */
+    long long aof_write_id;         /* Count of AOF buffer writes. */
+    long long aof_fsync_submitted_id; /* Last write a bio fsync was asked for. */
+    long long aof_fsynced_id;       /* Last write known to be on disk. */
+    long long aof_bio_fsynced_id;   /* Last write fsynced by bio, atomic. */
+    int aof_fsync_pipe[2];          /* Awakes the event loop on bio fsyncs. */
+    list *clients_waiting_fsync;    /* Clients with replies held for fsync. */
     int aof_rewrite_scheduled;      /* Rewrite once BGSAVE terminates. */
     pid_t aof_child_pid;            /* PID if rewriting process */
-    list *aof_rewrite_buf_blocks;   /* Hold changes during an AOF rewrite. */
+    aofManifest *aof_manifest;      /* Base and incremental AOF files. */
     sds aof_buf;      /* AOF buffer, written before entering the event loop */
     int aof_fd;       /* File descriptor of currently selected AOF file */
     int aof_selected_db; /* Currently selected DB in AOF */
@@ -1169,16 +1443,6 @@ struct redisServer {
     int aof_last_write_errno;       /* Valid if aof_last_write_status is ERR */
     int aof_load_truncated;         /* Don't stop on unexpected AOF EOF. */
     int aof_use_rdb_preamble;       /* Use RDB preamble on AOF rewrites. */
-    /* AOF pipes used to communicate between parent and child during rewrite. */
-    int aof_pipe_write_data_to_child;
-    int aof_pipe_read_data_from_parent;
-    int aof_pipe_write_ack_to_parent;
-    int aof_pipe_read_ack_from_child;
-    int aof_pipe_write_ack_to_child;
-    int aof_pipe_read_ack_from_parent;
-    int aof_stop_sending_diff;     /* If true stop sending accumulated diffs
-                                      to child process. */
-    sds aof_child_diff;             /* AOF diff accumulator child side. */
     /* RDB persistence */
     long long dirty;                /* Changes to DB from the last save */
     long long dirty_before_bgsave;  /* Used to restore dirty on failed BGSAVE */
@@ -1187,7 +1451,13 @@ struct redisServer {
     int saveparamslen;              /* Number of saving points */
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
+    int rdb_compression_codec;      /* COMPRESS_* codec for RDB strings. */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_save_threads;           /* Threads serializing the keys. */
+    int rdb_load_threads;           /* Threads decoding the keys. */
+    int rdb_save_forkless;          /* BGSAVE without fork? */
+    int rdb_save_forkless_cpu;      /* Max CPU percentage of that BGSAVE. */
+    struct rdbForkless *rdb_forkless; /* BGSAVE without fork in progress. */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -1219,13 +1489,14 @@ struct redisServer {
     long long second_replid_offset; /* Accept offsets up to this for replid2. */
     int slaveseldb;                 /* Last SELECTed DB in replication output */
     int repl_ping_slave_period;     /* Master pings the slave every N seconds */
-    char *repl_backlog;             /* Replication backlog for partial syncs */
-    long long repl_backlog_size;    /* Backlog circular buffer size */
+    replBacklog *repl_backlog;      /* Replication backlog for partial syncs */
+    long long repl_backlog_size;    /* Backlog size: history to keep */
     long long repl_backlog_histlen; /* Backlog actual data length */
-    long long repl_backlog_idx;     /* Backlog circular buffer current offset,
-                                       that is the next byte will'll write to.*/
     long long repl_backlog_off;     /* Replication "master offset" of first
                                        byte in the replication backlog buffer.*/
+    list *repl_buffer_blocks;       /* Replication buffer: replBufBlock list
+                                       shared by the backlog and slaves. */
+    size_t repl_buffer_mem;         /* Memory used by repl_buffer_blocks. */
     time_t repl_backlog_time_limit; /* Time without slaves after the backlog
                                        gets released. */
     time_t repl_no_slaves_since;    /* We have no slaves since that time.
@@ -1235,6 +1506,10 @@ struct redisServer {
     int repl_good_slaves_count;     /* Number of slaves with lag <= max_lag. */
     int repl_diskless_sync;         /* Send RDB to slaves sockets directly. */
     int repl_diskless_sync_delay;   /* Delay to start a diskless repl BGSAVE. */
+    int repl_diskless_sync_max_replicas; /* Start the diskless BGSAVE without
+                                            waiting the delay once this many
+                                            slaves are waiting. 0 = disabled. */
+    int repl_diskless_compression;  /* Use LZF in diskless RDB transfers. */
     /* Replication (slave) */
     char *masteruser;               /* AUTH with this user and masterauth with master */
     char *masterauth;               /* AUTH with this password with master */
@@ -1278,6 +1553,7 @@ struct redisServer {
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
+    int maxmemory_eviction_batch;   /* Min keys to evict once over the limit */
     int lfu_log_factor;             /* LFU logarithmic counter factor. */
     int lfu_decay_time;             /* LFU counter decay factor. */
     long long proto_max_bulk_len;   /* Protocol bulk length maximum size. */
@@ -1295,15 +1571,19 @@ struct redisServer {
     /* Zip structure config, see redis.conf for more information  */
     size_t hash_max_ziplist_entries;
     size_t hash_max_ziplist_value;
+    size_t hash_max_intmap_entries;
     size_t set_max_intset_entries;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
+    int zset_btree;                 /* B+tree instead of skiplist for zsets? */
     size_t hll_sparse_max_bytes;
+    int hll_simd;                   /* Vector kernels for PFCOUNT/PFMERGE? */
     size_t stream_node_max_bytes;
     int64_t stream_node_max_entries;
     /* List parameters */
     int list_max_ziplist_size;
     int list_compress_depth;
+    int list_compress_codec;
     /* time cache */
     _Atomic time_t unixtime;    /* Unix time sampled every cron cycle. */
     time_t timezone;            /* Cached timezone. As set by tzset(). */
@@ -1312,6 +1592,9 @@ struct redisServer {
     /* Pubsub */
     dict *pubsub_channels;  /* Map channels to list of subscribed clients */
     list *pubsub_patterns;  /* A list of pubsub_patterns */
+    dict *pubsub_patterns_dict; /* Map patterns to list of subscribed clients */
+    rax *pubsub_pattern_prefixes; /* Literal prefix -> list of patterns */
+    size_t pubsub_pattern_prefix_maxlen; /* Longest prefix ever indexed */
     int notify_keyspace_events; /* Events to propagate via Pub/Sub. This is an
                                    xor of NOTIFY_... flags. */
     /* Cluster */
@@ -1325,6 +1608,7 @@ struct redisServer {
                                           there is at least an uncovered slot.*/
     int cluster_slave_no_failover;  /* Prevent slave from starting a failover
                                        if the master is in failure state. */
+    int cluster_gossip_delta;   /* Gossip mostly about the nodes that changed. */
     char *cluster_announce_ip;  /* IP address to announce on cluster bus. */
     int cluster_announce_port;     /* base port to announce on cluster bus. */
     int cluster_announce_bus_port; /* bus port to announce on cluster bus. */
@@ -1351,13 +1635,19 @@ struct redisServer {
                              execution. */
     int lua_kill;         /* Kill the script if true. */
     int lua_always_replicate_commands; /* Default replication type. */
+    int lua_direct_reply; /* Replies to lua_client are recorded instead of
+                             encoded, see luaReplyFlush(). */
     /* Lazy free */
     int lazyfree_lazy_eviction;
     int lazyfree_lazy_expire;
     int lazyfree_lazy_server_del;
+    int active_expire_index;        /* Find expired keys by time order? */
     /* Latency monitor */
     long long latency_monitor_threshold;
     dict *latency_events;
+    /* HOTKEYS sampling */
+    int hotkeys_sample_rate;        /* Percentage of the commands sampled. */
+    long long hotkeys_countdown;    /* Commands before the next sample. */
     /* ACLs */
     char *acl_filename;     /* ACL Users file. NULL if not configured. */
     /* Assert & bug reporting */
@@ -1368,6 +1658,18 @@ struct redisServer {
     int watchdog_period;  /* Software watchdog period in ms. 0 = off */
     /* System hardware info */
     size_t system_memory_size;  /* Total memory in system as reported by OS */
+    /* Popcorn */
+    int popcorn_migrate_policy; /* See POPCORN_MIGRATE_* */
+    int popcorn_migrate_node;   /* Node the time events are offloaded to,
+                                   -1 to pick the best one. */
+    int popcorn_migrate_target; /* popcorn_migrate_node for the policies. */
+    aeAdaptiveMigrationPolicy popcorn_adaptive; /* Adaptive policy state. */
+    char *popcorn_schedule;     /* Thread schedule file, NULL if none. */
+    int popcorn_bio_node;       /* Node of the bio threads without a
+                                   schedule entry, -1 to leave them. */
+    int popcorn_cron_keyspace;  /* See POPCORN_CRON_KEYSPACE_* */
+    int popcorn_cron_deferred;  /* POPCORN_CRON_* sub-tasks, as bits, left
+                                   by serverCron() to the home node. */
 };
 
 typedef struct pubsubPattern {
@@ -1391,6 +1693,7 @@ struct redisCommand {
     int lastkey;  /* The last argument that's a key */
     int keystep;  /* The step between first and last key */
     long long microseconds, calls;
+    latencyHistogram *latency_hist; /* Sampled durations, see hotkeys.c. */
     int id;     /* Command ID. This is a progressive ID starting from 0 that
                    is assigned at runtime, and is used in order to check
                    ACLs. A connection is able to execute a given command if
@@ -1450,6 +1753,9 @@ typedef struct {
 
     dictIterator *di;
     dictEntry *de;
+
+    uint32_t impos;             /* intmap slot after the current entry. */
+    int64_t imfield, imvalue;   /* intmap current entry. */
 } hashTypeIterator;
 
 #include "stream.h"  /* Stream data type header file. */
@@ -1498,6 +1804,10 @@ void moduleAcquireGIL(void);
 void moduleReleaseGIL(void);
 void moduleNotifyKeyspaceEvent(int type, const char *event, robj *key, int dbid);
 void moduleCallCommandFilters(client *c);
+int moduleHasCommandFilters(void);
+int moduleKeyIsLocked(int dbid, sds key);
+int moduleWaitForKeyLocks(client *c);
+void unblockClientWaitingKeyLocks(client *c);
 
 /* Utils */
 long long ustime(void);
@@ -1507,6 +1817,8 @@ void getRandomBytes(unsigned char *p, size_t len);
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
 void exitFromChild(int retcode);
 size_t redisPopcount(void *s, long count);
+void bitopsSimdReset(void);
+void hllSimdReset(void);
 void redisSetProcTitle(char *title);
 
 /* networking.c -- Networking and Client related operations */
@@ -1515,6 +1827,9 @@ void closeTimedoutClients(void);
 void freeClient(client *c);
 void freeClientAsync(client *c);
 void resetClient(client *c);
+void releaseClientReplyBuffer(client *c);
+void releaseClientQueryBuffer(client *c);
+void resumeClientReading(client *c);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void *addReplyDeferredLen(client *c);
 void setDeferredArrayLen(client *c, void *node, long length);
@@ -1524,6 +1839,7 @@ void setDeferredAttributeLen(client *c, void *node, long length);
 void setDeferredPushLen(client *c, void *node, long length);
 void processInputBuffer(client *c);
 void processInputBufferAndReplicate(client *c);
+int processCommandAndResetClient(client *c);
 void processGopherRequest(client *c);
 void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
@@ -1534,6 +1850,7 @@ void addReplyNullArray(client *c);
 void addReplyBool(client *c, int b);
 void addReplyVerbatim(client *c, const char *s, size_t len, const char *ext);
 void addReplyProto(client *c, const char *s, size_t len);
+void addReplyProtoObject(client *c, robj *obj);
 void AddReplyFromClient(client *c, client *src);
 void addReplyBulk(client *c, robj *obj);
 void addReplyBulkCString(client *c, const char *s);
@@ -1544,6 +1861,7 @@ void addReplySds(client *c, sds s);
 void addReplyBulkSds(client *c, sds s);
 void addReplyError(client *c, const char *err);
 void addReplyStatus(client *c, const char *status);
+void addReplyStatusLength(client *c, const char *s, size_t len);
 void addReplyDouble(client *c, double d);
 void addReplyHumanLongDouble(client *c, long double d);
 void addReplyLongLong(client *c, long long ll);
@@ -1569,6 +1887,7 @@ void rewriteClientCommandVector(client *c, int argc, ...);
 void rewriteClientCommandArgument(client *c, int i, robj *newval);
 void replaceClientCommandVector(client *c, int argc, robj **argv);
 unsigned long getClientOutputBufferMemoryUsage(client *c);
+unsigned long getClientReplBufferMemoryUsage(client *c);
 void freeClientsInAsyncFreeQueue(void);
 void asyncCloseClientOnOutputBufferLimitReached(client *c);
 int getClientType(client *c);
@@ -1584,13 +1903,17 @@ int handleClientsWithPendingWrites(void);
 int handleClientsWithPendingWritesUsingThreads(void);
 int handleClientsWithPendingReadsUsingThreads(void);
 int stopThreadedIOIfNeeded(void);
+void ioThreadCountLookup(int hit);
+void clientTrackShardSlot(client *c);
 int clientHasPendingReplies(client *c);
+void clientInstallWriteHandler(client *c);
 void unlinkClient(client *c);
 int writeToClient(int fd, client *c, int handler_installed);
 void linkClient(client *c);
 void protectClient(client *c);
 void unprotectClient(client *c);
 void initThreadedIO(void);
+sds genIOThreadsInfoString(sds info);
 
 /* Needed by main */
 void redisOutOfMemoryHandler(size_t allocation_size);
@@ -1602,6 +1925,11 @@ void usage(void);
 int redisIsSupervised(int mode);
 void daemonize(void);
 void initServer(void);
+void updatePopcornMigrationPolicy(void);
+int loadPopcornSchedule(const char *path, char *err, size_t errlen);
+void popcornMoveThread(int region, int target, int *nid);
+void popcornRunDeferredCron(void);
+void resetPopcornStats(void);
 void createPidFile(void);
 void redisAsciiArt(void);
 void checkTcpBacklogSettings(void);
@@ -1642,6 +1970,7 @@ void freeClientMultiState(client *c);
 void queueMultiCommand(client *c);
 void touchWatchedKey(redisDb *db, robj *key);
 void touchWatchedKeysOnFlush(int dbid);
+int watchedKeysTouched(client *c);
 void discardTransaction(client *c);
 void flagTransaction(client *c);
 void execCommandPropagateMulti(client *c);
@@ -1706,6 +2035,7 @@ void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t bufle
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc);
 void updateSlavesWaitingBgsave(int bgsaveerr, int type);
 void replicationCron(void);
+void startBgsaveForWaitingSlaves(void);
 void replicationHandleMasterDisconnection(void);
 void replicationCacheMaster(client *c);
 void resizeReplicationBacklog(long long newsize);
@@ -1729,6 +2059,9 @@ void clearReplicationId2(void);
 void chopReplicationBacklog(void);
 void replicationCacheMasterUsingMyself(void);
 void feedReplicationBacklog(void *ptr, size_t len);
+void incrementalTrimReplicationBacklog(size_t max_blocks);
+void freeReplicaReferencedReplBuffer(client *c);
+size_t replicationBufferNotCountedMemory(void);
 
 /* Generic persistence functions */
 void startLoading(FILE *fp);
@@ -1744,20 +2077,29 @@ int writeCommandsDeniedByDiskError(void);
 #include "rdb.h"
 int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi);
 void killRDBChild(void);
+int rdbBgsaveInProgress(void);
+int rdbSaveBackgroundForkless(char *filename, rdbSaveInfo *rsi);
+void rdbForklessCron(void);
+void rdbForklessWillModify(redisDb *db, robj *key);
+void rdbForklessWillCall(client *c);
+void rdbForklessFinishDb(int dbid);
+void rdbForklessKill(void);
 
 /* AOF persistence */
 void flushAppendOnlyFile(int force);
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
 void aofRemoveTempFile(pid_t childpid);
 int rewriteAppendOnlyFileBackground(void);
-int loadAppendOnlyFile(char *filename);
+int loadAppendOnlyFiles(void);
+void aofOpenOnServerStart(void);
 void stopAppendOnly(void);
 int startAppendOnly(void);
 void backgroundRewriteDoneHandler(int exitcode, int bysignal);
-void aofRewriteBufferReset(void);
-unsigned long aofRewriteBufferSize(void);
-ssize_t aofReadDiffFromParent(void);
 void killAppendOnlyChild(void);
+void aofGroupCommitWait(client *c);
+void aofFsyncDoneFromBioThread(long long id);
+void aofFsyncPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask);
+void processClientsWaitingAofFsync(void);
 
 /* Child info */
 void openChildInfoPipe(void);
@@ -1851,6 +2193,31 @@ int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec);
 int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec);
 int zslLexValueGteMin(sds value, zlexrangespec *spec);
 int zslLexValueLteMax(sds value, zlexrangespec *spec);
+int sdscmplex(sds a, sds b);
+int zsetLargeEncoding(void);
+void zsetInsertNew(zset *zs, double score, sds ele);
+
+/* Sorted set B+tree (zbtree.c) */
+zbtree *zbtCreate(void);
+void zbtFree(zbtree *zbt);
+void zbtInsert(zbtree *zbt, double score, sds ele);
+int zbtDelete(zbtree *zbt, double score, sds ele, sds *removed);
+void zbtUpdateScore(zbtree *zbt, double curscore, sds ele, double newscore);
+int zbtFind(zbtree *zbt, double score, sds ele, zbtreeIter *it);
+unsigned long zbtGetRank(zbtree *zbt, double score, sds ele);
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreeIter *it);
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreeIter *it);
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreeIter *it);
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeIter *it);
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeIter *it);
+int zbtNext(zbtreeIter *it);
+int zbtPrev(zbtreeIter *it);
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict);
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict);
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict);
+#ifdef REDIS_TEST
+int zbtreeTest(int argc, char *argv[]);
+#endif
 
 /* Core functions */
 int getMaxmemoryState(size_t *total, size_t *logical, size_t *tofree, float *level);
@@ -1880,7 +2247,9 @@ void serverLogRaw(int level, const char *msg);
 void serverLogFromHandler(int level, const char *msg);
 void usage(void);
 void updateDictResizePolicy(void);
+void serverThreadArenaInit(const char *name);
 int htNeedsResize(dict *dict);
+dict *createDbDict(dictType *type);
 void populateCommandTable(void);
 void resetCommandTableStats(void);
 void adjustOpenFilesLimit(void);
@@ -1888,9 +2257,13 @@ void closeListeningSockets(int unlink_unix_socket);
 void updateCachedTime(void);
 void resetServerStats(void);
 void activeDefragCycle(void);
+void activeDefragFromBioThread(void *batch);
 unsigned int getLRUClock(void);
 unsigned int LRU_CLOCK(void);
 const char *evictPolicyToString(void);
+const char *popcornMigratePolicyToString(void);
+int popcornMigratePolicyFromString(char *name);
+const char *popcornCronKeyspaceToString(void);
 struct redisMemOverhead *getMemoryOverheadData(void);
 void freeMemoryOverheadData(struct redisMemOverhead *mh);
 
@@ -1919,6 +2292,7 @@ void setTypeConvert(robj *subject, int enc);
 #define HASH_SET_COPY 0
 
 void hashTypeConvert(robj *o, int enc);
+int hashTypeLargeEncoding(robj *o);
 void hashTypeTryConversion(robj *subject, robj **argv, int start, int end);
 int hashTypeExists(robj *o, sds key);
 int hashTypeDelete(robj *o, sds key);
@@ -1934,6 +2308,7 @@ sds hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what);
 void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll);
 sds hashTypeCurrentObjectNewSds(hashTypeIterator *hi, int what);
 robj *hashTypeLookupWriteOrCreate(client *c, robj *key);
+int hashTypeGetValue(robj *o, sds field, unsigned char **vstr, unsigned int *vlen, long long *vll);
 robj *hashTypeGetValueObject(robj *o, sds field);
 int hashTypeSet(robj *o, sds field, sds value, int flags);
 
@@ -1969,12 +2344,18 @@ robj *lookupKeyWrite(redisDb *db, robj *key);
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags);
+#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
+size_t objectComputeSize(robj *o, size_t sample_size);
 robj *objectCommandLookup(client *c, robj *key);
 robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply);
 void objectSetLRUOrLFU(robj *val, long long lfu_freq, long long lru_idle,
                        long long lru_clock);
 #define LOOKUP_NONE 0
 #define LOOKUP_NOTOUCH (1<<0)
+#define DB_PREFETCH_BATCH 16    /* Keys prefetched together, see db.c. */
+void dbPrefetchKeys(redisDb *db, robj **keys, int count);
+void dbPrefetchKeyBuffers(redisDb *db, const char **keys, const size_t *lens,
+                          int count);
 void dbAdd(redisDb *db, robj *key, robj *val);
 void dbOverwrite(redisDb *db, robj *key, robj *val);
 void setKey(redisDb *db, robj *key, robj *val);
@@ -2001,6 +2382,9 @@ void slotToKeyAdd(robj *key);
 void slotToKeyDel(robj *key);
 void slotToKeyFlush(void);
 int dbAsyncDelete(redisDb *db, robj *key);
+int dbAsyncDeleteBatched(redisDb *db, robj *key, lazyfreeBatch **batch);
+void lazyfreeBatchSubmit(lazyfreeBatch *batch);
+void lazyfreeFlushPending(void);
 void emptyDbAsync(redisDb *db);
 void slotToKeyFlushAsync(void);
 size_t lazyfreeGetPendingObjectsCount(void);
@@ -2020,6 +2404,7 @@ int *xreadGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys)
 void clusterInit(void);
 unsigned short crc16(const char *buf, int len);
 unsigned int keyHashSlot(char *key, int keylen);
+int getCommandSlot(struct redisCommand *cmd, robj **argv, int argc);
 void clusterCron(void);
 void clusterPropagatePublish(robj *channel, robj *message);
 void migrateCloseTimedoutSockets(void);
@@ -2044,6 +2429,12 @@ int ldbRemoveChild(pid_t pid);
 void ldbKillForkedSessions(void);
 int ldbPendingChildren(void);
 sds luaCreateFunction(client *c, lua_State *lua, robj *body);
+void luaReplyAddBulk(const char *p, size_t len);
+void luaReplyAddStatus(const char *p, size_t len);
+void luaReplyAddLongLong(long long ll);
+void luaReplyAddArrayLen(long length);
+void luaReplyAddNull(void);
+void luaReplyFlush(client *c);
 
 /* Blocked clients */
 void processUnblockedClients(void);
@@ -2059,6 +2450,10 @@ void blockForKeys(client *c, int btype, robj **keys, int numkeys, mstime_t timeo
 
 /* expire.c -- Handling of expired keys */
 void activeExpireCycle(int type);
+void expireIndexAdd(redisDb *db, sds key, long long when);
+void expireIndexDel(redisDb *db, sds key);
+void expireIndexFlush(redisDb *db);
+void expireIndexConfigure(void);
 void expireSlaveKeys(void);
 void rememberSlaveKeyWithExpire(redisDb *db, robj *key);
 void flushSlaveKeysWithExpireList(void);
@@ -2066,15 +2461,34 @@ size_t getSlaveKeyWithExpireCount(void);
 
 /* evict.c -- maxmemory handling and LRU eviction. */
 void evictionPoolAlloc(void);
+void evictionPoolResize(void);
+void evictionPoolWarm(void);
 #define LFU_INIT_VAL 5
 unsigned long LFUGetTimeInMinutes(void);
 uint8_t LFULogIncr(uint8_t value);
 unsigned long LFUDecrAndReturn(robj *o);
 
+/* hotkeys.c -- Sampling of the keys and commands latency. */
+int hotkeysShouldSample(void);
+void hotkeysSampleKeys(client *c);
+void hotkeysSampleLatency(struct redisCommand *cmd, long long duration);
+void hotkeysDecay(void);
+void hotkeysReset(void);
+
+/* memanalyze.c -- Background analysis of the keyspace memory. */
+int memoryAnalyzeInProgress(void);
+int memoryAnalyzeChildDone(pid_t pid, int exitcode, int bysignal);
+void memoryAnalyzeKillChild(void);
+void memoryAnalyzeCommand(client *c);
+void latencyHistogramReply(client *c, latencyHistogram *h);
+
 /* Keys hashing / comparison functions for dict.c hash tables. */
 uint64_t dictSdsHash(const void *key);
 int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
 void dictSdsDestructor(void *privdata, void *val);
+void *dictSdsDup(void *privdata, const void *key);
+size_t dictSdsEmbedLen(const void *key);
+void *dictSdsEmbed(void *buf, const void *key);
 
 /* Git SHA1 */
 char *redisGitSHA1(void);
@@ -2261,6 +2675,8 @@ void pfcountCommand(client *c);
 void pfmergeCommand(client *c);
 void pfdebugCommand(client *c);
 void latencyCommand(client *c);
+void hotkeysCommand(client *c);
+void popcornCommand(client *c);
 void moduleCommand(client *c);
 void securityWarningCommand(client *c);
 void xaddCommand(client *c);
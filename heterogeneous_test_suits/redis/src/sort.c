@@ -42,97 +42,188 @@ redisSortOperation *createSortOperation(int type, robj *pattern) {
     return so;
 }
 
-/* Return the value associated to the key with a name obtained using
- * the following rules:
+/* Elements are looked up in batches of this many keys, prefetched together
+ * before the first lookup of the batch. */
+#define SORT_LOOKUP_BATCH DB_PREFETCH_BATCH
+
+/* A BY or GET pattern, parsed once for the whole SORT. The name of the key
+ * of an element is obtained using the following rules:
  *
- * 1) The first occurrence of '*' in 'pattern' is substituted with 'subst'.
+ * 1) The first occurrence of '*' in the pattern is substituted with the
+ *    element.
  *
- * 2) If 'pattern' matches the "->" string, everything on the left of
+ * 2) If the pattern matches the "->" string, everything on the right of
  *    the arrow is treated as the name of a hash field, and the part on the
  *    left as the key name containing a hash. The value of the specified
  *    field is returned.
  *
- * 3) If 'pattern' equals "#", the function simply returns 'subst' itself so
- *    that the SORT command can be used like: SORT key GET # to retrieve
- *    the Set/List elements directly.
+ * 3) If the pattern equals "#", the element itself is returned so that the
+ *    SORT command can be used like: SORT key GET # to retrieve the Set/List
+ *    elements directly.
  *
- * The returned object will always have its refcount increased by 1
- * when it is non-NULL. */
-robj *lookupKeyByPattern(redisDb *db, robj *pattern, robj *subst, int writeflag) {
-    char *p, *f, *k;
-    sds spat, ssub;
-    robj *keyobj, *fieldobj = NULL, *o;
-    int prefixlen, sublen, postfixlen, fieldlen;
-
-    /* If the pattern is "#" return the substitution object itself in order
-     * to implement the "SORT ... GET #" feature. */
-    spat = pattern->ptr;
+ * The names of a batch are written into the same key objects over and over,
+ * so that a lookup allocates nothing. */
+typedef struct sortPattern {
+    int self;               /* Pattern "#". */
+    const char *prefix;     /* Before the '*', NULL if there is no '*'. */
+    size_t prefixlen;
+    const char *postfix;    /* After the '*', up to the "->" if any. */
+    size_t postfixlen;
+    sds field;              /* Hash field, NULL if not a hash dereference. */
+    robj *keys[SORT_LOOKUP_BATCH];
+} sortPattern;
+
+/* The value a pattern resolves to: a string object owned by the keyspace
+ * or the element itself, or the value of a hash field, which is either
+ * vstr/vlen or, when vstr is NULL, the integer vll. Valid until the next
+ * lookup. */
+typedef struct sortValue {
+    robj *obj;
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+} sortValue;
+
+void sortPatternInit(sortPattern *sp, robj *pattern) {
+    sds spat = pattern->ptr;
+    char *p, *f;
+
+    memset(sp,0,sizeof(*sp));
     if (spat[0] == '#' && spat[1] == '\0') {
-        incrRefCount(subst);
-        return subst;
+        sp->self = 1;
+        return;
     }
 
-    /* The substitution object may be specially encoded. If so we create
-     * a decoded object on the fly. Otherwise getDecodedObject will just
-     * increment the ref count, that we'll decrement later. */
-    subst = getDecodedObject(subst);
-    ssub = subst->ptr;
-
-    /* If we can't find '*' in the pattern we return NULL as to GET a
-     * fixed key does not make sense. */
+    /* If we can't find '*' in the pattern the lookups return nothing as to
+     * GET a fixed key does not make sense. */
     p = strchr(spat,'*');
-    if (!p) {
-        decrRefCount(subst);
-        return NULL;
-    }
+    if (!p) return;
 
-    /* Find out if we're dealing with a hash dereference. */
+    sp->prefix = spat;
+    sp->prefixlen = p-spat;
+    sp->postfix = p+1;
     if ((f = strstr(p+1, "->")) != NULL && *(f+2) != '\0') {
-        fieldlen = sdslen(spat)-(f-spat)-2;
-        fieldobj = createStringObject(f+2,fieldlen);
+        sp->field = sdsnewlen(f+2,sdslen(spat)-(f-spat)-2);
+        sp->postfixlen = f-(p+1);
     } else {
-        fieldlen = 0;
+        sp->postfixlen = sdslen(spat)-(p+1-spat);
+    }
+}
+
+void sortPatternRelease(sortPattern *sp) {
+    int j;
+
+    for (j = 0; j < SORT_LOOKUP_BATCH; j++)
+        if (sp->keys[j]) decrRefCount(sp->keys[j]);
+    sdsfree(sp->field);
+}
+
+/* Write the key names of the next elements, up to a batch, into the key
+ * objects of the pattern and prefetch them, ready for sortPatternLookup(). */
+void sortPatternPrepare(redisDb *db, sortPattern *sp, redisSortObject *vector,
+                        int count)
+{
+    char buf[LONG_STR_SIZE];
+    const char *ele;
+    size_t elelen;
+    int j;
+
+    if (sp->self || !sp->prefix) return;
+    if (count > SORT_LOOKUP_BATCH) count = SORT_LOOKUP_BATCH;
+    for (j = 0; j < count; j++) {
+        robj *subst = vector[j].obj, *key = sp->keys[j];
+
+        /* Somebody else may still hold the object of the previous lookup,
+         * the expire of the key for instance: leave it to them. */
+        if (key && key->refcount != 1) {
+            decrRefCount(key);
+            key = NULL;
+        }
+        if (!key) key = sp->keys[j] = createObject(OBJ_STRING,sdsempty());
+
+        if (subst->encoding == OBJ_ENCODING_INT) {
+            elelen = ll2string(buf,sizeof(buf),(long)subst->ptr);
+            ele = buf;
+        } else {
+            ele = subst->ptr;
+            elelen = sdslen(subst->ptr);
+        }
+        key->ptr = sdscpylen(key->ptr,sp->prefix,sp->prefixlen);
+        key->ptr = sdscatlen(key->ptr,ele,elelen);
+        key->ptr = sdscatlen(key->ptr,sp->postfix,sp->postfixlen);
+    }
+    dbPrefetchKeys(db,sp->keys,count);
+}
+
+/* Resolve the pattern for the element 'subst', at position 'slot' of the
+ * batch prepared by sortPatternPrepare(). Returns C_ERR when the key does
+ * not exist, is of the wrong type or lacks the field. */
+int sortPatternLookup(redisDb *db, sortPattern *sp, int slot, robj *subst,
+                      int writeflag, sortValue *v)
+{
+    robj *o;
+
+    if (sp->self) {
+        v->obj = subst;
+        return C_OK;
     }
+    if (!sp->prefix) return C_ERR;
 
-    /* Perform the '*' substitution. */
-    prefixlen = p-spat;
-    sublen = sdslen(ssub);
-    postfixlen = sdslen(spat)-(prefixlen+1)-(fieldlen ? fieldlen+2 : 0);
-    keyobj = createStringObject(NULL,prefixlen+sublen+postfixlen);
-    k = keyobj->ptr;
-    memcpy(k,spat,prefixlen);
-    memcpy(k+prefixlen,ssub,sublen);
-    memcpy(k+prefixlen+sublen,p+1,postfixlen);
-    decrRefCount(subst); /* Incremented by decodeObject() */
-
-    /* Lookup substituted key */
     if (!writeflag)
-        o = lookupKeyRead(db,keyobj);
+        o = lookupKeyRead(db,sp->keys[slot]);
     else
-        o = lookupKeyWrite(db,keyobj);
-    if (o == NULL) goto noobj;
+        o = lookupKeyWrite(db,sp->keys[slot]);
+    if (o == NULL) return C_ERR;
+
+    if (sp->field) {
+        if (o->type != OBJ_HASH) return C_ERR;
+        v->obj = NULL;
+        v->vstr = NULL;
+        return hashTypeGetValue(o,sp->field,&v->vstr,&v->vlen,&v->vll);
+    }
+    if (o->type != OBJ_STRING) return C_ERR;
+    v->obj = o;
+    return C_OK;
+}
+
+/* A new string object with the value, for the callers that keep it. */
+robj *sortValueGetObject(sortValue *v) {
+    if (v->obj) return getDecodedObject(v->obj);
+    if (v->vstr) return createStringObject((char*)v->vstr,v->vlen);
+    return createObject(OBJ_STRING,sdsfromlonglong(v->vll));
+}
 
-    if (fieldobj) {
-        if (o->type != OBJ_HASH) goto noobj;
+/* Parse the value as a score, the whole string as strtod() does. */
+int sortValueGetScore(sortValue *v, double *score) {
+    char buf[128], *s, *eptr;
+    sds tmp = NULL;
+    int retval = C_OK;
+
+    if (v->obj && v->obj->encoding == OBJ_ENCODING_INT) {
+        /* Don't need to decode the object if it's integer-encoded (the
+         * only encoding supported) so far. We can just cast it */
+        *score = (long)v->obj->ptr;
+        return C_OK;
+    }
+    if (!v->obj && !v->vstr) {
+        *score = v->vll;
+        return C_OK;
+    }
 
-        /* Retrieve value from hash by the field name. The returend object
-         * is a new object with refcount already incremented. */
-        o = hashTypeGetValueObject(o, fieldobj->ptr);
+    if (v->obj) {
+        s = v->obj->ptr;
+    } else if (v->vlen < sizeof(buf)) {
+        memcpy(buf,v->vstr,v->vlen);
+        buf[v->vlen] = '\0';
+        s = buf;
     } else {
-        if (o->type != OBJ_STRING) goto noobj;
-
-        /* Every object that this function returns needs to have its refcount
-         * increased. sortCommand decreases it again. */
-        incrRefCount(o);
+        s = tmp = sdsnewlen(v->vstr,v->vlen);
     }
-    decrRefCount(keyobj);
-    if (fieldobj) decrRefCount(fieldobj);
-    return o;
-
-noobj:
-    decrRefCount(keyobj);
-    if (fieldlen) decrRefCount(fieldobj);
-    return NULL;
+    errno = 0;
+    *score = strtod(s,&eptr);
+    if (eptr[0] != '\0' || errno == ERANGE || isnan(*score)) retval = C_ERR;
+    sdsfree(tmp);
+    return retval;
 }
 
 /* sortCompare() is used by qsort in sortCommand(). Given that qsort_r with
@@ -187,6 +278,79 @@ int sortCompare(const void *s1, const void *s2) {
     return server.sort_desc ? -cmp : cmp;
 }
 
+/* Vectors at least this long are sorted by score with sortByScore(). */
+#define SORT_RADIX_MIN_LEN 512
+
+/* The bits of a score as an unsigned integer in the same order as the
+ * score: flip the sign bit of the positive doubles and all the bits of the
+ * negative ones. */
+static uint64_t sortScoreKey(double score) {
+    uint64_t u;
+
+    if (score == 0) score = 0; /* -0.0 sorts as 0.0 */
+    memcpy(&u,&score,sizeof(u));
+    return (u & (1ULL<<63)) ? ~u : u | (1ULL<<63);
+}
+
+/* Numeric sort of the whole vector, the same order as qsort() with
+ * sortCompare(): an LSD radix sort on the scores, skipping the bytes every
+ * score shares, then the elements of a same score in lexicographic order
+ * with qsort(). Scores usually differ, so that instead of n log n calls of
+ * sortCompare() it is a few linear passes over the vector. */
+void sortByScore(redisSortObject *vector, long len, int desc) {
+    redisSortObject *tmpv = zmalloc(sizeof(*tmpv)*len), *src = vector,
+                    *dst = tmpv, *swapv;
+    uint64_t *keys = zmalloc(sizeof(*keys)*len*2), *srck = keys,
+             *dstk = keys+len, *swapk;
+    long (*count)[256] = zcalloc(sizeof(long)*8*256);
+    long j, i, pos;
+    int b;
+
+    for (j = 0; j < len; j++) {
+        keys[j] = sortScoreKey(vector[j].u.score);
+        for (b = 0; b < 8; b++) count[b][(keys[j] >> (b*8)) & 0xff]++;
+    }
+
+    for (b = 0; b < 8; b++) {
+        int shift = b*8;
+
+        if (count[b][(keys[0] >> shift) & 0xff] == len) continue;
+        for (pos = 0, i = 0; i < 256; i++) {
+            long c = count[b][i];
+            count[b][i] = pos;
+            pos += c;
+        }
+        for (j = 0; j < len; j++) {
+            pos = count[b][(srck[j] >> shift) & 0xff]++;
+            dst[pos] = src[j];
+            dstk[pos] = srck[j];
+        }
+        swapv = src; src = dst; dst = swapv;
+        swapk = srck; srck = dstk; dstk = swapk;
+    }
+    if (src != vector) memcpy(vector,src,sizeof(*vector)*len);
+
+    /* Ties, ascending: the descending order is the reverse of it. */
+    server.sort_desc = 0;
+    for (j = 0; j < len; j = i) {
+        for (i = j+1; i < len && srck[i] == srck[j]; i++);
+        if (i-j > 1)
+            qsort(vector+j,i-j,sizeof(redisSortObject),sortCompare);
+    }
+    server.sort_desc = desc;
+    if (desc) {
+        for (j = 0, i = len-1; j < i; j++, i--) {
+            redisSortObject t = vector[j];
+            vector[j] = vector[i];
+            vector[i] = t;
+        }
+    }
+
+    zfree(count);
+    zfree(keys);
+    zfree(tmpv);
+}
+
 /* The SORT command is the most complex command in Redis. Warning: this code
  * is optimized for speed and a bit less for readability */
 void sortCommand(client *c) {
@@ -200,6 +364,8 @@ void sortCommand(client *c) {
     int syntax_error = 0;
     robj *sortval, *sortby = NULL, *storekey = NULL;
     redisSortObject *vector; /* Resulting vector to sort */
+    sortPattern bypat, *getpat = NULL;
+    sortValue v;
 
     /* Create a list of operations to perform for every sorted element.
      * Operations can be GET */
@@ -309,8 +475,8 @@ void sortCommand(client *c) {
     }
 
     /* Destructively convert encoded sorted sets for SORT. */
-    if (sortval->type == OBJ_ZSET)
-        zsetConvert(sortval, OBJ_ENCODING_SKIPLIST);
+    if (sortval->type == OBJ_ZSET && sortval->encoding == OBJ_ENCODING_ZIPLIST)
+        zsetConvert(sortval, zsetLargeEncoding());
 
     /* Objtain the length of the object to sort. */
     switch(sortval->type) {
@@ -395,6 +561,32 @@ void sortCommand(client *c) {
             j++;
         }
         setTypeReleaseIterator(si);
+    } else if (sortval->type == OBJ_ZSET && dontsort &&
+               sortval->encoding == OBJ_ENCODING_BTREE) {
+        /* Same as below, for the B+tree encoding. */
+        zbtree *zbt = ((zset*)sortval->ptr)->zbt;
+        zbtreeIter it;
+        sds sdsele;
+        int rangelen = vectorlen;
+
+        if (rangelen > 0) {
+            serverAssertWithInfo(c,sortval,zbtGetElementByRank(zbt,
+                desc ? zbt->length-start : (unsigned long)start+1,&it));
+        }
+        while(rangelen--) {
+            sdsele = zbtIterEle(&it);
+            vector[j].obj = createStringObject(sdsele,sdslen(sdsele));
+            vector[j].u.score = 0;
+            vector[j].u.cmpobj = NULL;
+            j++;
+            if (rangelen) {
+                serverAssertWithInfo(c,sortval,
+                    desc ? zbtPrev(&it) : zbtNext(&it));
+            }
+        }
+        /* Fix start/end: output code is not aware of this optimization. */
+        end -= start;
+        start = 0;
     } else if (sortval->type == OBJ_ZSET && dontsort) {
         /* Special handling for a sorted set, if 'dontsort' is true.
          * This makes sure we return elements in the sorted set original
@@ -455,56 +647,56 @@ void sortCommand(client *c) {
 
     /* Now it's time to load the right scores in the sorting vector */
     if (!dontsort) {
+        if (sortby) sortPatternInit(&bypat,sortby);
         for (j = 0; j < vectorlen; j++) {
-            robj *byval;
             if (sortby) {
                 /* lookup value to sort by */
-                byval = lookupKeyByPattern(c->db,sortby,vector[j].obj,storekey!=NULL);
-                if (!byval) continue;
+                if (j % SORT_LOOKUP_BATCH == 0)
+                    sortPatternPrepare(c->db,&bypat,vector+j,
+                        vectorlen-j);
+                if (sortPatternLookup(c->db,&bypat,j % SORT_LOOKUP_BATCH,
+                        vector[j].obj,storekey!=NULL,&v) == C_ERR) continue;
             } else {
                 /* use object itself to sort by */
-                byval = vector[j].obj;
+                v.obj = vector[j].obj;
             }
 
             if (alpha) {
-                if (sortby) vector[j].u.cmpobj = getDecodedObject(byval);
-            } else {
-                if (sdsEncodedObject(byval)) {
-                    char *eptr;
-
-                    vector[j].u.score = strtod(byval->ptr,&eptr);
-                    if (eptr[0] != '\0' || errno == ERANGE ||
-                        isnan(vector[j].u.score))
-                    {
-                        int_conversion_error = 1;
-                    }
-                } else if (byval->encoding == OBJ_ENCODING_INT) {
-                    /* Don't need to decode the object if it's
-                     * integer-encoded (the only encoding supported) so
-                     * far. We can just cast it */
-                    vector[j].u.score = (long)byval->ptr;
-                } else {
-                    serverAssertWithInfo(c,sortval,1 != 1);
-                }
-            }
-
-            /* when the object was retrieved using lookupKeyByPattern,
-             * its refcount needs to be decreased. */
-            if (sortby) {
-                decrRefCount(byval);
+                if (sortby) vector[j].u.cmpobj = sortValueGetObject(&v);
+            } else if (sortValueGetScore(&v,&vector[j].u.score) == C_ERR) {
+                int_conversion_error = 1;
             }
         }
+        if (sortby) sortPatternRelease(&bypat);
 
         server.sort_desc = desc;
         server.sort_alpha = alpha;
         server.sort_bypattern = sortby ? 1 : 0;
         server.sort_store = storekey ? 1 : 0;
-        if (sortby && (start != 0 || end != vectorlen-1))
+        if (int_conversion_error) {
+            /* Nothing to sort, the reply is an error. */
+        } else if (!alpha && vectorlen >= SORT_RADIX_MIN_LEN)
+            sortByScore(vector,vectorlen,desc);
+        else if (sortby && (start != 0 || end != vectorlen-1))
             pqsort(vector,vectorlen,sizeof(redisSortObject),sortCompare, start,end);
         else
             qsort(vector,vectorlen,sizeof(redisSortObject),sortCompare);
     }
 
+    /* The GET patterns, looked up in batches like the BY one. */
+    if (getop) {
+        listNode *ln;
+        listIter li;
+
+        getpat = zmalloc(sizeof(sortPattern)*getop);
+        j = 0;
+        listRewind(operations,&li);
+        while((ln = listNext(&li))) {
+            redisSortOperation *sop = ln->value;
+            sortPatternInit(getpat+j++,sop->pattern);
+        }
+    }
+
     /* Send command output to the output buffer, performing the specified
      * GET/DEL/INCR/DECR operations if any. */
     outputlen = getop ? getop*(end-start+1) : end-start+1;
@@ -514,26 +706,23 @@ void sortCommand(client *c) {
         /* STORE option not specified, sent the sorting result to client */
         addReplyArrayLen(c,outputlen);
         for (j = start; j <= end; j++) {
-            listNode *ln;
-            listIter li;
+            int slot = (j-start) % SORT_LOOKUP_BATCH, k;
 
             if (!getop) addReplyBulk(c,vector[j].obj);
-            listRewind(operations,&li);
-            while((ln = listNext(&li))) {
-                redisSortOperation *sop = ln->value;
-                robj *val = lookupKeyByPattern(c->db,sop->pattern,
-                    vector[j].obj,storekey!=NULL);
-
-                if (sop->type == SORT_OP_GET) {
-                    if (!val) {
-                        addReplyNull(c);
-                    } else {
-                        addReplyBulk(c,val);
-                        decrRefCount(val);
-                    }
+            for (k = 0; k < getop; k++) {
+                if (slot == 0)
+                    sortPatternPrepare(c->db,getpat+k,vector+j,
+                        end-j+1);
+                if (sortPatternLookup(c->db,getpat+k,slot,vector[j].obj,0,&v)
+                    == C_ERR)
+                {
+                    addReplyNull(c);
+                } else if (v.obj) {
+                    addReplyBulk(c,v.obj);
+                } else if (v.vstr) {
+                    addReplyBulkCBuffer(c,v.vstr,v.vlen);
                 } else {
-                    /* Always fails */
-                    serverAssertWithInfo(c,sortval,sop->type == SORT_OP_GET);
+                    addReplyBulkLongLong(c,v.vll);
                 }
             }
         }
@@ -542,30 +731,27 @@ void sortCommand(client *c) {
 
         /* STORE option specified, set the sorting result as a List object */
         for (j = start; j <= end; j++) {
-            listNode *ln;
-            listIter li;
+            int slot = (j-start) % SORT_LOOKUP_BATCH, k;
 
             if (!getop) {
                 listTypePush(sobj,vector[j].obj,LIST_TAIL);
             } else {
-                listRewind(operations,&li);
-                while((ln = listNext(&li))) {
-                    redisSortOperation *sop = ln->value;
-                    robj *val = lookupKeyByPattern(c->db,sop->pattern,
-                        vector[j].obj,storekey!=NULL);
-
-                    if (sop->type == SORT_OP_GET) {
-                        if (!val) val = createStringObject("",0);
-
-                        /* listTypePush does an incrRefCount, so we should take care
-                         * care of the incremented refcount caused by either
-                         * lookupKeyByPattern or createStringObject("",0) */
-                        listTypePush(sobj,val,LIST_TAIL);
-                        decrRefCount(val);
-                    } else {
-                        /* Always fails */
-                        serverAssertWithInfo(c,sortval,sop->type == SORT_OP_GET);
-                    }
+                for (k = 0; k < getop; k++) {
+                    robj *val;
+
+                    if (slot == 0)
+                        sortPatternPrepare(c->db,getpat+k,vector+j,
+                            end-j+1);
+                    if (sortPatternLookup(c->db,getpat+k,slot,vector[j].obj,1,
+                                          &v) == C_ERR)
+                        val = createStringObject("",0);
+                    else
+                        val = sortValueGetObject(&v);
+
+                    /* listTypePush does an incrRefCount, so we should take
+                     * care of the refcount of the new object. */
+                    listTypePush(sobj,val,LIST_TAIL);
+                    decrRefCount(val);
                 }
             }
         }
@@ -589,6 +775,8 @@ void sortCommand(client *c) {
 
     decrRefCount(sortval);
     listRelease(operations);
+    for (j = 0; j < getop; j++) sortPatternRelease(getpat+j);
+    zfree(getpat);
     for (j = 0; j < vectorlen; j++) {
         if (alpha && vector[j].u.cmpobj)
             decrRefCount(vector[j].u.cmpobj);
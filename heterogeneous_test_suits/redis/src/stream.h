@@ -18,6 +18,8 @@ typedef struct stream {
     uint64_t length;        /* Number of elements inside this stream. */
     streamID last_id;       /* Zero if there are yet no items. */
     rax *cgroups;           /* Consumer groups dictionary: name -> streamCG */
+    unsigned char *tail_lp; /* Cached tail listpack, or NULL if unknown. */
+    uint64_t tail_key[2];   /* Radix tree key of 'tail_lp'. */
 } stream;
 
 /* We define an iterator to iterate stream items in an abstract way, without
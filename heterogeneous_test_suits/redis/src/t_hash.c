@@ -97,6 +97,21 @@ sds hashTypeGetFromHashTable(robj *o, sds field) {
     return dictGetVal(de);
 }
 
+/* Get the value from an intmap encoded hash, identified by field.
+ * Returns -1 when the field cannot be found. Fields that are not integers
+ * are never found. */
+int hashTypeGetFromIntmap(robj *o, sds field, long long *vll) {
+    long long llfield;
+    int64_t value;
+
+    serverAssert(o->encoding == OBJ_ENCODING_INTMAP);
+
+    if (!string2ll(field,sdslen(field),&llfield) ||
+        !intmapFind(o->ptr,llfield,&value)) return -1;
+    *vll = value;
+    return 0;
+}
+
 /* Higher level function of hashTypeGet*() that returns the hash value
  * associated with the specified field. If the field is found C_OK
  * is returned, otherwise C_ERR. The returned object is returned by
@@ -118,6 +133,10 @@ int hashTypeGetValue(robj *o, sds field, unsigned char **vstr, unsigned int *vle
             *vlen = sdslen(value);
             return C_OK;
         }
+    } else if (o->encoding == OBJ_ENCODING_INTMAP) {
+        *vstr = NULL;
+        if (hashTypeGetFromIntmap(o, field, vll) == 0)
+            return C_OK;
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -155,6 +174,11 @@ size_t hashTypeGetValueLength(robj *o, sds field) {
 
         if ((aux = hashTypeGetFromHashTable(o, field)) != NULL)
             len = sdslen(aux);
+    } else if (o->encoding == OBJ_ENCODING_INTMAP) {
+        long long vll;
+
+        if (hashTypeGetFromIntmap(o, field, &vll) == 0)
+            len = sdigits10(vll);
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -172,6 +196,10 @@ int hashTypeExists(robj *o, sds field) {
         if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0) return 1;
     } else if (o->encoding == OBJ_ENCODING_HT) {
         if (hashTypeGetFromHashTable(o, field) != NULL) return 1;
+    } else if (o->encoding == OBJ_ENCODING_INTMAP) {
+        long long vll;
+
+        if (hashTypeGetFromIntmap(o, field, &vll) == 0) return 1;
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -235,7 +263,7 @@ int hashTypeSet(robj *o, sds field, sds value, int flags) {
 
         /* Check if the ziplist needs to be converted to a hash table */
         if (hashTypeLength(o) > server.hash_max_ziplist_entries)
-            hashTypeConvert(o, OBJ_ENCODING_HT);
+            hashTypeConvert(o, hashTypeLargeEncoding(o));
     } else if (o->encoding == OBJ_ENCODING_HT) {
         dictEntry *de = dictFind(o->ptr,field);
         if (de) {
@@ -263,6 +291,19 @@ int hashTypeSet(robj *o, sds field, sds value, int flags) {
             }
             dictAdd(o->ptr,f,v);
         }
+    } else if (o->encoding == OBJ_ENCODING_INTMAP) {
+        long long llfield, llvalue;
+
+        /* A string field or value needs a real hash table. */
+        if (!string2ll(field,sdslen(field),&llfield) ||
+            !string2ll(value,sdslen(value),&llvalue))
+        {
+            hashTypeConvert(o, OBJ_ENCODING_HT);
+            return hashTypeSet(o, field, value, flags);
+        }
+        o->ptr = intmapSet(o->ptr,llfield,llvalue,&update);
+        if (intmapLen(o->ptr) > server.hash_max_intmap_entries)
+            hashTypeConvert(o, OBJ_ENCODING_HT);
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -301,6 +342,11 @@ int hashTypeDelete(robj *o, sds field) {
             if (htNeedsResize(o->ptr)) dictResize(o->ptr);
         }
 
+    } else if (o->encoding == OBJ_ENCODING_INTMAP) {
+        long long llfield;
+
+        if (string2ll(field,sdslen(field),&llfield))
+            o->ptr = intmapDelete(o->ptr,llfield,&deleted);
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -315,6 +361,8 @@ unsigned long hashTypeLength(const robj *o) {
         length = ziplistLen(o->ptr) / 2;
     } else if (o->encoding == OBJ_ENCODING_HT) {
         length = dictSize((const dict*)o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_INTMAP) {
+        length = intmapLen(o->ptr);
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -331,6 +379,8 @@ hashTypeIterator *hashTypeInitIterator(robj *subject) {
         hi->vptr = NULL;
     } else if (hi->encoding == OBJ_ENCODING_HT) {
         hi->di = dictGetIterator(subject->ptr);
+    } else if (hi->encoding == OBJ_ENCODING_INTMAP) {
+        hi->impos = 0;
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -374,6 +424,9 @@ int hashTypeNext(hashTypeIterator *hi) {
         hi->vptr = vptr;
     } else if (hi->encoding == OBJ_ENCODING_HT) {
         if ((hi->de = dictNext(hi->di)) == NULL) return C_ERR;
+    } else if (hi->encoding == OBJ_ENCODING_INTMAP) {
+        if (!intmapNext(hi->subject->ptr,&hi->impos,&hi->imfield,
+                        &hi->imvalue)) return C_ERR;
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -431,6 +484,9 @@ void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr,
         sds ele = hashTypeCurrentFromHashTable(hi, what);
         *vstr = (unsigned char*) ele;
         *vlen = sdslen(ele);
+    } else if (hi->encoding == OBJ_ENCODING_INTMAP) {
+        *vstr = NULL;
+        *vll = (what & OBJ_HASH_KEY) ? hi->imfield : hi->imvalue;
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -462,12 +518,59 @@ robj *hashTypeLookupWriteOrCreate(client *c, robj *key) {
     return o;
 }
 
+/* Return the encoding a ziplist encoded hash that outgrows the ziplist
+ * should be converted to: an intmap when every field and value is an
+ * integer and the hash fits hash-max-intmap-entries, a hash table
+ * otherwise. The ziplist already stores integer strings as integers. */
+int hashTypeLargeEncoding(robj *o) {
+    unsigned char *zl = o->ptr, *p;
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+
+    serverAssert(o->encoding == OBJ_ENCODING_ZIPLIST);
+    if (hashTypeLength(o) > server.hash_max_intmap_entries)
+        return OBJ_ENCODING_HT;
+
+    for (p = ziplistIndex(zl,0); p != NULL; p = ziplistNext(zl,p)) {
+        ziplistGet(p,&vstr,&vlen,&vll);
+        if (vstr) return OBJ_ENCODING_HT;
+    }
+    return OBJ_ENCODING_INTMAP;
+}
+
 void hashTypeConvertZiplist(robj *o, int enc) {
     serverAssert(o->encoding == OBJ_ENCODING_ZIPLIST);
 
     if (enc == OBJ_ENCODING_ZIPLIST) {
         /* Nothing to do... */
 
+    } else if (enc == OBJ_ENCODING_INTMAP) {
+        hashTypeIterator *hi;
+        intmap *im = intmapNew();
+
+        hi = hashTypeInitIterator(o);
+        while (hashTypeNext(hi) != C_ERR) {
+            unsigned char *vstr;
+            unsigned int vlen;
+            long long field, value;
+            int update;
+
+            hashTypeCurrentFromZiplist(hi,OBJ_HASH_KEY,&vstr,&vlen,&field);
+            serverAssert(vstr == NULL);
+            hashTypeCurrentFromZiplist(hi,OBJ_HASH_VALUE,&vstr,&vlen,&value);
+            serverAssert(vstr == NULL);
+            im = intmapSet(im,field,value,&update);
+            if (update) {
+                serverLogHexDump(LL_WARNING,"ziplist with dup elements dump",
+                    o->ptr,ziplistBlobLen(o->ptr));
+                serverPanic("Ziplist corruption detected");
+            }
+        }
+        hashTypeReleaseIterator(hi);
+        zfree(o->ptr);
+        o->encoding = OBJ_ENCODING_INTMAP;
+        o->ptr = im;
     } else if (enc == OBJ_ENCODING_HT) {
         hashTypeIterator *hi;
         dict *dict;
@@ -497,9 +600,34 @@ void hashTypeConvertZiplist(robj *o, int enc) {
     }
 }
 
+void hashTypeConvertIntmap(robj *o, int enc) {
+    serverAssert(o->encoding == OBJ_ENCODING_INTMAP);
+
+    if (enc == OBJ_ENCODING_INTMAP) {
+        /* Nothing to do... */
+
+    } else if (enc == OBJ_ENCODING_HT) {
+        intmap *im = o->ptr;
+        dict *dict = dictCreate(&hashDictType, NULL);
+        int64_t field, value;
+        uint32_t pos = 0;
+
+        dictExpand(dict,intmapLen(im));
+        while (intmapNext(im,&pos,&field,&value))
+            dictAdd(dict,sdsfromlonglong(field),sdsfromlonglong(value));
+        zfree(im);
+        o->encoding = OBJ_ENCODING_HT;
+        o->ptr = dict;
+    } else {
+        serverPanic("Unknown hash encoding");
+    }
+}
+
 void hashTypeConvert(robj *o, int enc) {
     if (o->encoding == OBJ_ENCODING_ZIPLIST) {
         hashTypeConvertZiplist(o, enc);
+    } else if (o->encoding == OBJ_ENCODING_INTMAP) {
+        hashTypeConvertIntmap(o, enc);
     } else if (o->encoding == OBJ_ENCODING_HT) {
         serverPanic("Not implemented");
     } else {
@@ -671,6 +799,13 @@ static void addHashFieldToReply(client *c, robj *o, sds field) {
             addReplyNull(c);
         else
             addReplyBulkCBuffer(c, value, sdslen(value));
+    } else if (o->encoding == OBJ_ENCODING_INTMAP) {
+        long long vll;
+
+        if (hashTypeGetFromIntmap(o, field, &vll) < 0)
+            addReplyNull(c);
+        else
+            addReplyBulkLongLong(c, vll);
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -762,6 +897,9 @@ static void addHashIteratorCursorToReply(client *c, hashTypeIterator *hi, int wh
     } else if (hi->encoding == OBJ_ENCODING_HT) {
         sds value = hashTypeCurrentFromHashTable(hi, what);
         addReplyBulkCBuffer(c, value, sdslen(value));
+    } else if (hi->encoding == OBJ_ENCODING_INTMAP) {
+        addReplyBulkLongLong(c, (what & OBJ_HASH_KEY) ? hi->imfield :
+                                                        hi->imvalue);
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -789,6 +789,51 @@ int qsortCompareSetsByRevCardinality(const void *s1, const void *s2) {
     return 0;
 }
 
+/* Reply with, or store at "dstkey", the intersection of the "setnum"
+ * intsets in "sets", sorted from the smallest to the largest. */
+static void sinterIntsets(client *c, robj **sets, unsigned long setnum,
+                          robj *dstkey) {
+    intset *is = sets[0]->ptr;
+    unsigned long j;
+
+    for (j = 1; j < setnum && intsetLen(is); j++) {
+        intset *next = intsetIntersect(is,sets[j]->ptr);
+        if (j > 1) zfree(is);
+        is = next;
+    }
+
+    if (!dstkey) {
+        int64_t intobj;
+        uint32_t pos;
+
+        addReplySetLen(c,intsetLen(is));
+        for (pos = 0; intsetGet(is,pos,&intobj); pos++)
+            addReplyBulkLongLong(c,intobj);
+        if (is != sets[0]->ptr) zfree(is);
+    } else {
+        /* If we have a target key where to store the resulting set
+         * create this key with the result set inside, if not empty. */
+        int deleted = dbDelete(c->db,dstkey);
+        if (intsetLen(is) > 0) {
+            robj *dstset = createIntsetObject();
+            zfree(dstset->ptr);
+            dstset->ptr = is;
+            dbAdd(c->db,dstkey,dstset);
+            addReplyLongLong(c,intsetLen(is));
+            notifyKeyspaceEvent(NOTIFY_SET,"sinterstore",
+                dstkey,c->db->id);
+        } else {
+            if (is != sets[0]->ptr) zfree(is);
+            addReply(c,shared.czero);
+            if (deleted)
+                notifyKeyspaceEvent(NOTIFY_GENERIC,"del",
+                    dstkey,c->db->id);
+        }
+        signalModifiedKey(c->db,dstkey);
+        server.dirty++;
+    }
+}
+
 void sinterGenericCommand(client *c, robj **setkeys,
                           unsigned long setnum, robj *dstkey) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
@@ -827,6 +872,16 @@ void sinterGenericCommand(client *c, robj **setkeys,
      * algorithm's performance */
     qsort(sets,setnum,sizeof(robj*),qsortCompareSetsByCardinality);
 
+    /* When every set is an intset they are already sorted, so they are
+     * intersected pairwise with the merge kernels of intset.c. */
+    for (j = 0; j < setnum; j++)
+        if (sets[j]->encoding != OBJ_ENCODING_INTSET) break;
+    if (setnum > 1 && j == setnum) {
+        sinterIntsets(c,sets,setnum,dstkey);
+        zfree(sets);
+        return;
+    }
+
     /* The first thing we should output is the total number of elements...
      * since this is a multi-bulk write, but at this stage we don't know
      * the intersection set size, so we use a trick, append an empty object
@@ -936,6 +991,7 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
     sds ele;
     int j, cardinality = 0;
     int diff_algo = 1;
+    int intset_union = 1;
 
     for (j = 0; j < setnum; j++) {
         robj *setobj = dstkey ?
@@ -950,6 +1006,7 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
             return;
         }
         sets[j] = setobj;
+        if (setobj->encoding != OBJ_ENCODING_INTSET) intset_union = 0;
     }
 
     /* Select what DIFF algorithm to use.
@@ -990,7 +1047,20 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
      * this set object will be the resulting object to set into the target key*/
     dstset = createIntsetObject();
 
-    if (op == SET_OP_UNION) {
+    if (op == SET_OP_UNION && intset_union) {
+        /* Every set is an intset: they are merged with the kernels of
+         * intset.c, without going through an sds for every element. */
+        for (j = 0; j < setnum; j++) {
+            if (!sets[j]) continue; /* non existing keys are like empty sets */
+
+            intset *is = intsetUnion(dstset->ptr,sets[j]->ptr);
+            zfree(dstset->ptr);
+            dstset->ptr = is;
+        }
+        cardinality = intsetLen(dstset->ptr);
+        if (intsetLen(dstset->ptr) > server.set_max_intset_entries)
+            setTypeConvert(dstset,OBJ_ENCODING_HT);
+    } else if (op == SET_OP_UNION) {
         /* Union is trivial, just add every element of every set to the
          * temporary set. */
         for (j = 0; j < setnum; j++) {
@@ -56,6 +56,7 @@ stream *streamNew(void) {
     s->last_id.ms = 0;
     s->last_id.seq = 0;
     s->cgroups = NULL; /* Created on demand to save memory when not used. */
+    s->tail_lp = NULL;
     return s;
 }
 
@@ -177,20 +178,30 @@ int streamAppendItem(stream *s, robj **argv, int64_t numfields, streamID *added_
      * or return an error. */
     if (use_id && streamCompareID(use_id,&s->last_id) <= 0) return C_ERR;
 
-    /* Add the new entry. */
-    raxIterator ri;
-    raxStart(&ri,s->rax);
-    raxSeek(&ri,"$",NULL,0);
-
     size_t lp_bytes = 0;        /* Total bytes in the tail listpack. */
     unsigned char *lp = NULL;   /* Tail listpack pointer. */
-
-    /* Get a reference to the tail node listpack. */
-    if (raxNext(&ri)) {
-        lp = ri.data;
+    unsigned char *tail_lp;     /* The same, as found in the radix tree. */
+    uint64_t tail_key[2];       /* Its key in the radix tree. */
+
+    /* Get a reference to the tail node listpack. It is cached in the stream
+     * by the previous append, unless something else changed the radix tree
+     * or moved the listpacks since, so most of the time we don't need to
+     * seek the tail of the tree. */
+    if (s->tail_lp == NULL && raxSize(s->rax)) {
+        raxIterator ri;
+        raxStart(&ri,s->rax);
+        raxSeek(&ri,"$",NULL,0);
+        raxNext(&ri);
+        serverAssert(ri.key_len == sizeof(s->tail_key));
+        s->tail_lp = ri.data;
+        memcpy(s->tail_key,ri.key,sizeof(s->tail_key));
+        raxStop(&ri);
+    }
+    tail_lp = lp = s->tail_lp;
+    if (lp) {
+        memcpy(tail_key,s->tail_key,sizeof(tail_key));
         lp_bytes = lpBytes(lp);
     }
-    raxStop(&ri);
 
     /* Generate the new entry ID. */
     streamID id;
@@ -270,8 +281,7 @@ int streamAppendItem(stream *s, robj **argv, int64_t numfields, streamID *added_
          * master entry. */
         flags |= STREAM_ITEM_FLAG_SAMEFIELDS;
     } else {
-        serverAssert(ri.key_len == sizeof(rax_key));
-        memcpy(rax_key,ri.key,sizeof(rax_key));
+        memcpy(rax_key,tail_key,sizeof(rax_key));
 
         /* Read the master ID from the radix tree key. */
         streamDecodeID(rax_key,&master_id);
@@ -349,8 +359,10 @@ int streamAppendItem(stream *s, robj **argv, int64_t numfields, streamID *added_
     lp = lpAppendInteger(lp,lp_count);
 
     /* Insert back into the tree in order to update the listpack pointer. */
-    if (ri.data != lp)
+    if (tail_lp != lp)
         raxInsert(s->rax,(unsigned char*)&rax_key,sizeof(rax_key),lp,NULL);
+    s->tail_lp = lp;
+    memcpy(s->tail_key,rax_key,sizeof(rax_key));
     s->length++;
     s->last_id = id;
     if (added_id) *added_id = id;
@@ -388,6 +400,7 @@ int64_t streamTrimByLength(stream *s, size_t maxlen, int approx) {
         if (s->length - entries >= maxlen) {
             lpFree(lp);
             raxRemove(s->rax,ri.key,ri.key_len,NULL);
+            s->tail_lp = NULL;
             raxSeek(&ri,">=",ri.key,ri.key_len);
             s->length -= entries;
             deleted += entries;
@@ -455,6 +468,7 @@ int64_t streamTrimByLength(stream *s, size_t maxlen, int approx) {
 
         /* Update the listpack with the new pointer. */
         raxInsert(s->rax,ri.key,ri.key_len,lp,NULL);
+        s->tail_lp = NULL;
 
         break; /* If we are here, there was enough to delete in the current
                   node, so no need to go to the next node. */
@@ -719,6 +733,7 @@ void streamIteratorRemoveEntry(streamIterator *si, streamID *current) {
          * node. */
         lpFree(lp);
         raxRemove(si->stream->rax,si->ri.key,si->ri.key_len,NULL);
+        si->stream->tail_lp = NULL;
     } else {
         /* In the base case we alter the counters of valid/deleted entries. */
         lp = lpReplaceInteger(lp,&p,aux-1);
@@ -727,8 +742,10 @@ void streamIteratorRemoveEntry(streamIterator *si, streamID *current) {
         lp = lpReplaceInteger(lp,&p,aux+1);
 
         /* Update the listpack with the new pointer. */
-        if (si->lp != lp)
+        if (si->lp != lp) {
             raxInsert(si->stream->rax,si->ri.key,si->ri.key_len,lp,NULL);
+            si->stream->tail_lp = NULL;
+        }
     }
 
     /* Update the number of entries counter. */
@@ -968,13 +985,16 @@ size_t streamReplyWithRange(client *c, stream *s, streamID *start, streamID *end
                 streamFreeNACK(nack);
                 nack = raxFind(group->pel,buf,sizeof(buf));
                 serverAssert(nack != raxNotFound);
-                raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
+                /* Move the entry to the PEL of the new consumer, unless it
+                 * is already there. */
+                if (nack->consumer != consumer) {
+                    raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
+                    raxInsert(consumer->pel,buf,sizeof(buf),nack,NULL);
+                }
                 /* Update the consumer and NACK metadata. */
                 nack->consumer = consumer;
                 nack->delivery_time = mstime();
                 nack->delivery_count = 1;
-                /* Add the entry in the new consumer local PEL. */
-                raxInsert(consumer->pel,buf,sizeof(buf),nack,NULL);
             } else if (group_inserted == 1 && consumer_inserted == 0) {
                 serverPanic("NACK half-created. Should not be possible.");
             }
@@ -1893,19 +1913,27 @@ void xackCommand(client *c) {
         return;
     }
 
-    int acknowledged = 0;
-    for (int j = 3; j < c->argc; j++) {
-        streamID id;
+    /* Parse all the IDs first, so that a bad ID doesn't leave the PEL with
+     * only part of the IDs acknowledged. */
+    int acknowledged = 0, numids = c->argc-3;
+    streamID static_ids[STREAMID_STATIC_VECTOR_LEN];
+    streamID *ids = static_ids;
+    if (numids > STREAMID_STATIC_VECTOR_LEN)
+        ids = zmalloc(sizeof(streamID)*numids);
+    for (int j = 0; j < numids; j++) {
+        if (streamParseStrictIDOrReply(c,c->argv[j+3],&ids[j],0) != C_OK)
+            goto cleanup;
+    }
+
+    for (int j = 0; j < numids; j++) {
         unsigned char buf[sizeof(streamID)];
-        if (streamParseStrictIDOrReply(c,c->argv[j],&id,0) != C_OK) return;
-        streamEncodeID(buf,&id);
+        streamNACK *nack;
+        streamEncodeID(buf,&ids[j]);
 
-        /* Lookup the ID in the group PEL: it will have a reference to the
-         * NACK structure that will have a reference to the consumer, so that
-         * we are able to remove the entry from both PELs. */
-        streamNACK *nack = raxFind(group->pel,buf,sizeof(buf));
-        if (nack != raxNotFound) {
-            raxRemove(group->pel,buf,sizeof(buf),NULL);
+        /* Remove the ID from the group PEL: the NACK we get back has a
+         * reference to the consumer, so that we are able to remove the
+         * entry from its PEL too. A single walk of the group PEL. */
+        if (raxRemove(group->pel,buf,sizeof(buf),(void**)&nack)) {
             raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
             streamFreeNACK(nack);
             acknowledged++;
@@ -1913,6 +1941,8 @@ void xackCommand(client *c) {
         }
     }
     addReplyLongLong(c,acknowledged);
+cleanup:
+    if (ids != static_ids) zfree(ids);
 }
 
 /* XPENDING <key> <group> [<start> <stop> <count> [<consumer>]]
@@ -2273,11 +2303,16 @@ void xclaimCommand(client *c) {
                 mstime_t this_idle = now - nack->delivery_time;
                 if (this_idle < minidle) continue;
             }
-            /* Remove the entry from the old consumer.
-             * Note that nack->consumer is NULL if we created the
-             * NACK above because of the FORCE option. */
-            if (nack->consumer)
-                raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
+            /* Move the entry from the old consumer to the new one, unless
+             * they are the same, which is common when a consumer claims
+             * again the entries it is still processing. Note that
+             * nack->consumer is NULL if we created the NACK above because
+             * of the FORCE option. */
+            if (nack->consumer != consumer) {
+                if (nack->consumer)
+                    raxRemove(nack->consumer->pel,buf,sizeof(buf),NULL);
+                raxInsert(consumer->pel,buf,sizeof(buf),nack,NULL);
+            }
             /* Update the consumer and idle time. */
             nack->consumer = consumer;
             nack->delivery_time = deliverytime;
@@ -2288,8 +2323,6 @@ void xclaimCommand(client *c) {
             } else if (!justid) {
                 nack->delivery_count++;
             }
-            /* Add the entry in the new consumer local PEL. */
-            raxInsert(consumer->pel,buf,sizeof(buf),nack,NULL);
             /* Send the reply for this entry. */
             if (justid) {
                 addReplyStreamID(c,&id);
@@ -287,6 +287,8 @@ void mgetCommand(client *c) {
 
     addReplyArrayLen(c,c->argc-1);
     for (j = 1; j < c->argc; j++) {
+        if ((j-1) % DB_PREFETCH_BATCH == 0)
+            dbPrefetchKeys(c->db,c->argv+j,c->argc-j);
         robj *o = lookupKeyRead(c->db,c->argv[j]);
         if (o == NULL) {
             addReplyNull(c);
@@ -1153,12 +1153,36 @@ unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsig
  * Common sorted set API
  *----------------------------------------------------------------------------*/
 
+/* The encoding sorted sets are converted to when they get too large for a
+ * ziplist: the skiplist, or the B+tree if "zset-btree" is enabled. */
+int zsetLargeEncoding(void) {
+    return server.zset_btree ? OBJ_ENCODING_BTREE : OBJ_ENCODING_SKIPLIST;
+}
+
+/* Add the element 'ele', that must not already exist, to a skiplist or
+ * B+tree encoded sorted set. The sorted set takes ownership of 'ele'. */
+void zsetInsertNew(zset *zs, double score, sds ele) {
+    if (zs->zbt) {
+        dictEntry *de;
+
+        zbtInsert(zs->zbt,score,ele);
+        de = dictAddRaw(zs->dict,ele,NULL);
+        serverAssert(de != NULL);
+        dictSetDoubleVal(de,score);
+    } else {
+        zskiplistNode *znode = zslInsert(zs->zsl,score,ele);
+        serverAssert(dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+    }
+}
+
 unsigned long zsetLength(const robj *zobj) {
     unsigned long length = 0;
     if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
         length = zzlLength(zobj->ptr);
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
         length = ((const zset*)zobj->ptr)->zsl->length;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        length = ((const zset*)zobj->ptr)->zbt->length;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1179,12 +1203,19 @@ void zsetConvert(robj *zobj, int encoding) {
         unsigned int vlen;
         long long vlong;
 
-        if (encoding != OBJ_ENCODING_SKIPLIST)
+        if (encoding != OBJ_ENCODING_SKIPLIST &&
+            encoding != OBJ_ENCODING_BTREE)
             serverPanic("Unknown target encoding");
 
         zs = zmalloc(sizeof(*zs));
         zs->dict = dictCreate(&zsetDictType,NULL);
-        zs->zsl = zslCreate();
+        if (encoding == OBJ_ENCODING_BTREE) {
+            zs->zsl = NULL;
+            zs->zbt = zbtCreate();
+        } else {
+            zs->zsl = zslCreate();
+            zs->zbt = NULL;
+        }
 
         eptr = ziplistIndex(zl,0);
         serverAssertWithInfo(NULL,zobj,eptr != NULL);
@@ -1199,14 +1230,13 @@ void zsetConvert(robj *zobj, int encoding) {
             else
                 ele = sdsnewlen((char*)vstr,vlen);
 
-            node = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->dict,ele,&node->score) == DICT_OK);
+            zsetInsertNew(zs,score,ele);
             zzlNext(zl,&eptr,&sptr);
         }
 
         zfree(zobj->ptr);
         zobj->ptr = zs;
-        zobj->encoding = OBJ_ENCODING_SKIPLIST;
+        zobj->encoding = encoding;
     } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
         unsigned char *zl = ziplistNew();
 
@@ -1228,6 +1258,25 @@ void zsetConvert(robj *zobj, int encoding) {
             node = next;
         }
 
+        zfree(zs);
+        zobj->ptr = zl;
+        zobj->encoding = OBJ_ENCODING_ZIPLIST;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        unsigned char *zl = ziplistNew();
+        zbtreeIter it;
+
+        if (encoding != OBJ_ENCODING_ZIPLIST)
+            serverPanic("Unknown target encoding");
+
+        zs = zobj->ptr;
+        if (zbtGetElementByRank(zs->zbt,1,&it)) {
+            do {
+                zl = zzlInsertAt(zl,NULL,zbtIterEle(&it),zbtIterScore(&it));
+            } while(zbtNext(&it));
+        }
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+
         zfree(zs);
         zobj->ptr = zl;
         zobj->encoding = OBJ_ENCODING_ZIPLIST;
@@ -1241,9 +1290,8 @@ void zsetConvert(robj *zobj, int encoding) {
  * expected ranges. */
 void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
     if (zobj->encoding == OBJ_ENCODING_ZIPLIST) return;
-    zset *zset = zobj->ptr;
 
-    if (zset->zsl->length <= server.zset_max_ziplist_entries &&
+    if (zsetLength(zobj) <= server.zset_max_ziplist_entries &&
         maxelelen <= server.zset_max_ziplist_value)
             zsetConvert(zobj,OBJ_ENCODING_ZIPLIST);
 }
@@ -1257,11 +1305,13 @@ int zsetScore(robj *zobj, sds member, double *score) {
 
     if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
         if (zzlFind(zobj->ptr, member, score) == NULL) return C_ERR;
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
         dictEntry *de = dictFind(zs->dict, member);
         if (de == NULL) return C_ERR;
-        *score = *(double*)dictGetVal(de);
+        *score = zsetDictGetScore(zs,de);
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1358,9 +1408,9 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
              * becomes too long *before* executing zzlInsert. */
             zobj->ptr = zzlInsert(zobj->ptr,ele,score);
             if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries)
-                zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
+                zsetConvert(zobj,zsetLargeEncoding());
             if (sdslen(ele) > server.zset_max_ziplist_value)
-                zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
+                zsetConvert(zobj,zsetLargeEncoding());
             if (newscore) *newscore = score;
             *flags |= ZADD_ADDED;
             return 1;
@@ -1368,7 +1418,9 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
             *flags |= ZADD_NOP;
             return 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
         zskiplistNode *znode;
         dictEntry *de;
@@ -1380,7 +1432,7 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
                 *flags |= ZADD_NOP;
                 return 1;
             }
-            curscore = *(double*)dictGetVal(de);
+            curscore = zsetDictGetScore(zs,de);
 
             /* Prepare the score for the increment if needed. */
             if (incr) {
@@ -1394,18 +1446,21 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
 
             /* Remove and re-insert when score changes. */
             if (score != curscore) {
-                znode = zslUpdateScore(zs->zsl,curscore,ele,score);
                 /* Note that we did not removed the original element from
                  * the hash table representing the sorted set, so we just
                  * update the score. */
-                dictGetVal(de) = &znode->score; /* Update score ptr. */
+                if (zs->zbt) {
+                    zbtUpdateScore(zs->zbt,curscore,ele,score);
+                    dictSetDoubleVal(de,score);
+                } else {
+                    znode = zslUpdateScore(zs->zsl,curscore,ele,score);
+                    dictGetVal(de) = &znode->score; /* Update score ptr. */
+                }
                 *flags |= ZADD_UPDATED;
             }
             return 1;
         } else if (!xx) {
-            ele = sdsdup(ele);
-            znode = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+            zsetInsertNew(zs,score,sdsdup(ele));
             *flags |= ZADD_ADDED;
             if (newscore) *newscore = score;
             return 1;
@@ -1429,7 +1484,9 @@ int zsetDel(robj *zobj, sds ele) {
             zobj->ptr = zzlDelete(zobj->ptr,eptr);
             return 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
         dictEntry *de;
         double score;
@@ -1437,7 +1494,7 @@ int zsetDel(robj *zobj, sds ele) {
         de = dictUnlink(zs->dict,ele);
         if (de != NULL) {
             /* Get the score in order to delete from the skiplist later. */
-            score = *(double*)dictGetVal(de);
+            score = zsetDictGetScore(zs,de);
 
             /* Delete from the hash table and later from the skiplist.
              * Note that the order is important: deleting from the skiplist
@@ -1447,7 +1504,8 @@ int zsetDel(robj *zobj, sds ele) {
             dictFreeUnlinkedEntry(zs->dict,de);
 
             /* Delete from skiplist. */
-            int retval = zslDelete(zs->zsl,score,ele,NULL);
+            int retval = zs->zbt ? zbtDelete(zs->zbt,score,ele,NULL) :
+                                   zslDelete(zs->zsl,score,ele,NULL);
             serverAssert(retval);
 
             if (htNeedsResize(zs->dict)) dictResize(zs->dict);
@@ -1501,16 +1559,18 @@ long zsetRank(robj *zobj, sds ele, int reverse) {
         } else {
             return -1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
         dictEntry *de;
         double score;
 
         de = dictFind(zs->dict,ele);
         if (de != NULL) {
-            score = *(double*)dictGetVal(de);
-            rank = zslGetRank(zsl,score,ele);
+            score = zsetDictGetScore(zs,de);
+            rank = zs->zbt ? zbtGetRank(zs->zbt,score,ele) :
+                             zslGetRank(zs->zsl,score,ele);
             /* Existing elements always have a rank. */
             serverAssert(rank != 0);
             if (reverse)
@@ -1754,17 +1814,25 @@ void zremrangeGenericCommand(client *c, int rangetype) {
             dbDelete(c->db,key);
             keyremoved = 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST ||
+               zobj->encoding == OBJ_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
         switch(rangetype) {
         case ZRANGE_RANK:
-            deleted = zslDeleteRangeByRank(zs->zsl,start+1,end+1,zs->dict);
+            deleted = zs->zbt ?
+                zbtDeleteRangeByRank(zs->zbt,start+1,end+1,zs->dict) :
+                zslDeleteRangeByRank(zs->zsl,start+1,end+1,zs->dict);
             break;
         case ZRANGE_SCORE:
-            deleted = zslDeleteRangeByScore(zs->zsl,&range,zs->dict);
+            deleted = zs->zbt ?
+                zbtDeleteRangeByScore(zs->zbt,&range,zs->dict) :
+                zslDeleteRangeByScore(zs->zsl,&range,zs->dict);
             break;
         case ZRANGE_LEX:
-            deleted = zslDeleteRangeByLex(zs->zsl,&lexrange,zs->dict);
+            deleted = zs->zbt ?
+                zbtDeleteRangeByLex(zs->zbt,&lexrange,zs->dict) :
+                zslDeleteRangeByLex(zs->zsl,&lexrange,zs->dict);
             break;
         }
         if (htNeedsResize(zs->dict)) dictResize(zs->dict);
@@ -1833,6 +1901,10 @@ typedef struct {
                 zset *zs;
                 zskiplistNode *node;
             } sl;
+            struct {
+                zbtreeIter pos;
+                int valid;
+            } bt;
         } zset;
     } iter;
 } zsetopsrc;
@@ -1890,6 +1962,9 @@ void zuiInitIterator(zsetopsrc *op) {
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             it->sl.zs = op->subject->ptr;
             it->sl.node = it->sl.zs->zsl->header->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            it->bt.valid = zbtGetElementByRank(zs->zbt,1,&it->bt.pos);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1915,7 +1990,8 @@ void zuiClearIterator(zsetopsrc *op) {
         iterzset *it = &op->iter.zset;
         if (op->encoding == OBJ_ENCODING_ZIPLIST) {
             UNUSED(it); /* skip */
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_SKIPLIST ||
+                   op->encoding == OBJ_ENCODING_BTREE) {
             UNUSED(it); /* skip */
         } else {
             serverPanic("Unknown sorted set encoding");
@@ -1944,6 +2020,9 @@ unsigned long zuiLength(zsetopsrc *op) {
         } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
             zset *zs = op->subject->ptr;
             return zs->zsl->length;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            return zs->zbt->length;
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -2006,6 +2085,14 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->sl.node = it->sl.node->level[0].forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            if (!it->bt.valid)
+                return 0;
+            val->ele = zbtIterEle(&it->bt.pos);
+            val->score = zbtIterScore(&it->bt.pos);
+
+            /* Move to next element. */
+            it->bt.valid = zbtNext(&it->bt.pos);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -2114,11 +2201,12 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             } else {
                 return 0;
             }
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_SKIPLIST ||
+                   op->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = op->subject->ptr;
             dictEntry *de;
             if ((de = dictFind(zs->dict,val->ele)) != NULL) {
-                *score = *(double*)dictGetVal(de);
+                *score = zsetDictGetScore(zs,de);
                 return 1;
             } else {
                 return 0;
@@ -2183,7 +2271,6 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     size_t maxelelen = 0;
     robj *dstobj;
     zset *dstzset;
-    zskiplistNode *znode;
     int touched = 0;
 
     /* expect setnum input keys to be given */
@@ -2302,8 +2389,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 /* Only continue when present in every input. */
                 if (j == setnum) {
                     tmp = zuiNewSdsFromValue(&zval);
-                    znode = zslInsert(dstzset->zsl,score,tmp);
-                    dictAdd(dstzset->dict,tmp,&znode->score);
+                    zsetInsertNew(dstzset,score,tmp);
                     if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
                 }
             }
@@ -2368,8 +2454,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
         while((de = dictNext(di)) != NULL) {
             sds ele = dictGetKey(de);
             score = dictGetDoubleVal(de);
-            znode = zslInsert(dstzset->zsl,score,ele);
-            dictAdd(dstzset->dict,ele,&znode->score);
+            zsetInsertNew(dstzset,score,ele);
         }
         dictReleaseIterator(di);
         dictRelease(accumulator);
@@ -2379,7 +2464,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
 
     if (dbDelete(c->db,dstkey))
         touched = 1;
-    if (dstzset->zsl->length) {
+    if (dictSize(dstzset->dict)) {
         zsetConvertToZiplistIfNeeded(dstobj,maxelelen);
         dbAdd(c->db,dstkey,dstobj);
         addReplyLongLong(c,zsetLength(dstobj));
@@ -2510,6 +2595,23 @@ void zrangeGenericCommand(client *c, int reverse) {
             if (withscores) addReplyDouble(c,ln->score);
             ln = reverse ? ln->backward : ln->level[0].forward;
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zbtree *zbt = ((zset*)zobj->ptr)->zbt;
+        zbtreeIter it;
+        sds ele;
+
+        serverAssertWithInfo(c,zobj,zbtGetElementByRank(zbt,
+            reverse ? llen-start : start+1,&it));
+        while(rangelen--) {
+            ele = zbtIterEle(&it);
+            if (withscores && c->resp > 2) addReplyArrayLen(c,2);
+            addReplyBulkCBuffer(c,ele,sdslen(ele));
+            if (withscores) addReplyDouble(c,zbtIterScore(&it));
+            if (rangelen) {
+                serverAssertWithInfo(c,zobj,
+                    reverse ? zbtPrev(&it) : zbtNext(&it));
+            }
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2523,6 +2625,19 @@ void zrevrangeCommand(client *c) {
     zrangeGenericCommand(c,1);
 }
 
+/* Move a B+tree iterator 'offset' elements forward, or backward if 'reverse'
+ * is true, for the LIMIT option of the range commands. Unlike the skiplist,
+ * the tree jumps there by rank. Returns 0 if there is no such element. */
+static int zbtSkipOffset(zbtree *zbt, zbtreeIter *it, long offset, int reverse) {
+    if (offset == 0) return 1;
+    if (offset < 0) return 0;
+    if (reverse) {
+        if ((unsigned long)offset >= it->rank) return 0;
+        return zbtGetElementByRank(zbt,it->rank-offset,it);
+    }
+    return zbtGetElementByRank(zbt,it->rank+offset,it);
+}
+
 /* This command implements ZRANGEBYSCORE, ZREVRANGEBYSCORE. */
 void genericZrangebyscoreCommand(client *c, int reverse) {
     zrangespec range;
@@ -2701,6 +2816,48 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zbtree *zbt = ((zset*)zobj->ptr)->zbt;
+        zbtreeIter it;
+        int valid;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            valid = zbtLastInRange(zbt,&range,&it);
+        } else {
+            valid = zbtFirstInRange(zbt,&range,&it);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!valid) {
+            addReplyNull(c);
+            return;
+        }
+
+        /* We don't know in advance how many matching elements there are in the
+         * list, so we push this object that will represent the multi-bulk
+         * length in the output buffer, and will "fix" it later */
+        replylen = addReplyDeferredLen(c);
+
+        valid = zbtSkipOffset(zbt,&it,offset,reverse);
+        while (valid && limit--) {
+            double score = zbtIterScore(&it);
+            sds ele = zbtIterEle(&it);
+
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslValueGteMin(score,&range)) break;
+            } else {
+                if (!zslValueLteMax(score,&range)) break;
+            }
+
+            rangelen++;
+            if (withscores && c->resp > 2) addReplyArrayLen(c,2);
+            addReplyBulkCBuffer(c,ele,sdslen(ele));
+            if (withscores) addReplyDouble(c,score);
+
+            valid = reverse ? zbtPrev(&it) : zbtNext(&it);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2787,6 +2944,14 @@ void zcountCommand(client *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zbtree *zbt = ((zset*)zobj->ptr)->zbt;
+        zbtreeIter first, last;
+
+        /* The iterators already carry the ranks of both ends. */
+        if (zbtFirstInRange(zbt,&range,&first) &&
+            zbtLastInRange(zbt,&range,&last))
+            count = last.rank-first.rank+1;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2865,6 +3030,13 @@ void zlexcountCommand(client *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zbtree *zbt = ((zset*)zobj->ptr)->zbt;
+        zbtreeIter first, last;
+
+        if (zbtFirstInLexRange(zbt,&range,&first) &&
+            zbtLastInLexRange(zbt,&range,&last))
+            count = last.rank-first.rank+1;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -3045,6 +3217,46 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        zbtree *zbt = ((zset*)zobj->ptr)->zbt;
+        zbtreeIter it;
+        int valid;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            valid = zbtLastInLexRange(zbt,&range,&it);
+        } else {
+            valid = zbtFirstInLexRange(zbt,&range,&it);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!valid) {
+            addReplyNull(c);
+            zslFreeLexRange(&range);
+            return;
+        }
+
+        /* We don't know in advance how many matching elements there are in the
+         * list, so we push this object that will represent the multi-bulk
+         * length in the output buffer, and will "fix" it later */
+        replylen = addReplyDeferredLen(c);
+
+        valid = zbtSkipOffset(zbt,&it,offset,reverse);
+        while (valid && limit--) {
+            sds ele = zbtIterEle(&it);
+
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslLexValueGteMin(ele,&range)) break;
+            } else {
+                if (!zslLexValueLteMax(ele,&range)) break;
+            }
+
+            rangelen++;
+            addReplyBulkCBuffer(c,ele,sdslen(ele));
+
+            valid = reverse ? zbtPrev(&it) : zbtNext(&it);
+        }
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -3206,6 +3418,15 @@ void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey
             serverAssertWithInfo(c,zobj,zln != NULL);
             ele = sdsdup(zln->ele);
             score = zln->score;
+        } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+            zbtree *zbt = ((zset*)zobj->ptr)->zbt;
+            zbtreeIter it;
+
+            /* Get the first or last element in the sorted set. */
+            serverAssertWithInfo(c,zobj,zbtGetElementByRank(zbt,
+                where == ZSET_MAX ? zbt->length : 1,&it));
+            ele = sdsdup(zbtIterEle(&it));
+            score = zbtIterScore(&it);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -0,0 +1,240 @@
+/* uring.c -- A small io_uring ring to batch socket writes.
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include "config.h"
+#include "uring.h"
+#include "zmalloc.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_setup)
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+#ifndef RWF_NOWAIT
+#define RWF_NOWAIT 0x00000008
+#endif
+
+/* The rings shared with the kernel, mapped as io_uring_setup(2) describes.
+ * Our own producer index of the submission queue is 'sq_tail_local': the
+ * kernel sees the entries queued since the last submission only when it is
+ * published in *sq_tail. */
+struct uringRing {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned sq_tail_local;
+    unsigned queued;        /* Prepared, not yet submitted. */
+    unsigned inflight;      /* Submitted, completion not yet collected. */
+};
+
+uringRing *uringCreate(unsigned entries) {
+    struct io_uring_params p;
+    uringRing *r;
+    int fd;
+
+    memset(&p,0,sizeof(p));
+    fd = syscall(__NR_io_uring_setup,entries,&p);
+    if (fd == -1) return NULL;
+
+    r = zcalloc(sizeof(*r));
+    r->fd = fd;
+    r->entries = p.sq_entries;
+    r->sq_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+    r->sq_ptr = mmap(NULL,r->sq_len,PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) goto err;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL,r->cq_len,PROT_READ|PROT_WRITE,
+                         MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) goto err;
+    }
+    r->sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL,r->sqes_len,PROT_READ|PROT_WRITE,
+                   MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto err;
+
+    r->sq_head = (unsigned*)((char*)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned*)((char*)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned*)((char*)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)((char*)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned*)((char*)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned*)((char*)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned*)((char*)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)((char*)r->cq_ptr + p.cq_off.cqes);
+    r->sq_tail_local = *r->sq_tail;
+    return r;
+
+err:
+    if (r->sqes != NULL && r->sqes != MAP_FAILED) munmap(r->sqes,r->sqes_len);
+    if (r->cq_ptr != NULL && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr,r->cq_len);
+    if (r->sq_ptr != NULL && r->sq_ptr != MAP_FAILED)
+        munmap(r->sq_ptr,r->sq_len);
+    close(fd);
+    zfree(r);
+    return NULL;
+}
+
+void uringRelease(uringRing *r) {
+    munmap(r->sqes,r->sqes_len);
+    if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr,r->cq_len);
+    munmap(r->sq_ptr,r->sq_len);
+    close(r->fd);
+    zfree(r);
+}
+
+/* The number of writes that can be prepared before they must be submitted. */
+unsigned uringEntries(uringRing *r) {
+    return r->entries;
+}
+
+/* Queue a writev(2) of 'iov' to 'fd', to be sent by the next
+ * uringSubmitAndWait(). 'data' comes back with its completion.
+ * Returns -1 if the submission queue is full. */
+int uringPrepWritev(uringRing *r, int fd, const struct iovec *iov,
+                    int iovcnt, uint64_t data)
+{
+    unsigned head = __atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE);
+    unsigned idx;
+    struct io_uring_sqe *sqe;
+
+    if (r->sq_tail_local - head >= r->entries ||
+        r->inflight + r->queued >= r->entries) return -1;
+    idx = r->sq_tail_local & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe,0,sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = iovcnt;
+    /* Fail with -EAGAIN when the socket buffer is full, rather than
+     * waiting in the kernel for the socket to be writable. */
+    sqe->rw_flags = RWF_NOWAIT;
+    sqe->user_data = data;
+    r->sq_array[idx] = idx;
+    r->sq_tail_local++;
+    r->queued++;
+    return 0;
+}
+
+/* Submit the queued writes and wait for all of them to complete, with a
+ * single io_uring_enter(2) unless it gets interrupted. The writes are
+ * RWF_NOWAIT, so every one completes at once, with -EAGAIN if the socket
+ * buffer is full. Returns the number of writes submitted, -1 on error. */
+int uringSubmitAndWait(uringRing *r) {
+    unsigned submitted = r->queued, tosubmit, ready;
+    int ret;
+
+    if (submitted == 0) return 0;
+    __atomic_store_n(r->sq_tail,r->sq_tail_local,__ATOMIC_RELEASE);
+    r->queued = 0;
+    r->inflight += submitted;
+    while(1) {
+        tosubmit = r->sq_tail_local -
+                   __atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE);
+        ready = __atomic_load_n(r->cq_tail,__ATOMIC_ACQUIRE) - *r->cq_head;
+        if (tosubmit == 0 && ready >= r->inflight) break;
+        ret = syscall(__NR_io_uring_enter,r->fd,tosubmit,
+                      ready >= r->inflight ? 0 : r->inflight - ready,
+                      IORING_ENTER_GETEVENTS,NULL,0);
+        if (ret == -1 && errno != EINTR && errno != EAGAIN &&
+            errno != EBUSY) return -1;
+    }
+    return submitted;
+}
+
+/* Collect the next completed write: its 'data' and the result of writev(2),
+ * or -errno. Returns 0 if there are no more. */
+int uringNextCompletion(uringRing *r, uint64_t *data, int *res) {
+    unsigned head = *r->cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n(r->cq_tail,__ATOMIC_ACQUIRE)) return 0;
+    cqe = &r->cqes[head & *r->cq_mask];
+    *data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head,head+1,__ATOMIC_RELEASE);
+    r->inflight--;
+    return 1;
+}
+
+#else /* No io_uring. */
+
+uringRing *uringCreate(unsigned entries) {
+    (void)entries;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void uringRelease(uringRing *r) {
+    (void)r;
+}
+
+unsigned uringEntries(uringRing *r) {
+    (void)r;
+    return 0;
+}
+
+int uringPrepWritev(uringRing *r, int fd, const struct iovec *iov,
+                    int iovcnt, uint64_t data)
+{
+    (void)r; (void)fd; (void)iov; (void)iovcnt; (void)data;
+    return -1;
+}
+
+int uringSubmitAndWait(uringRing *r) {
+    (void)r;
+    errno = ENOSYS;
+    return -1;
+}
+
+int uringNextCompletion(uringRing *r, uint64_t *data, int *res) {
+    (void)r; (void)data; (void)res;
+    return 0;
+}
+
+#endif
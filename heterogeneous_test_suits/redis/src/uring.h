@@ -0,0 +1,53 @@
+/* uring.h -- A small io_uring ring to batch socket writes.
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __URING_H
+#define __URING_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* The ring is only driven by the main thread: writes are queued with
+ * uringPrepWritev(), sent all together by uringSubmitAndWait() with a single
+ * system call, and their results collected with uringNextCompletion().
+ *
+ * Without io_uring support at build time (HAVE_IO_URING, see config.h) or
+ * in the running kernel, uringCreate() returns NULL and sets errno. */
+typedef struct uringRing uringRing;
+
+uringRing *uringCreate(unsigned entries);
+void uringRelease(uringRing *r);
+unsigned uringEntries(uringRing *r);
+int uringPrepWritev(uringRing *r, int fd, const struct iovec *iov,
+                    int iovcnt, uint64_t data);
+int uringSubmitAndWait(uringRing *r);
+int uringNextCompletion(uringRing *r, uint64_t *data, int *res);
+
+#endif
@@ -42,6 +42,8 @@
 #include <time.h>
 
 #include "util.h"
+#include "zmalloc.h"
+#include "fpconv_dtoa.h"
 #include "sha1.h"
 
 /* Glob-style pattern matching. */
@@ -171,8 +173,279 @@ int stringmatch(const char *pattern, const char *string, int nocase) {
     return stringmatchlen(pattern,strlen(pattern),string,strlen(string),nocase);
 }
 
-/* Fuzz stringmatchlen() trying to crash it with bad input. */
+/* Compiled glob-style patterns.
+ *
+ * stringmatchlen() walks the pattern again for every string, and backtracks
+ * at every '*': matching many strings against the same pattern (KEYS, SCAN
+ * MATCH, PSUBSCRIBE) is better done compiling the pattern once. The pattern
+ * is split at its '*' into segments, sequences of atoms that match one
+ * character each: a set of 256 bits, so that '?', classes and nocase are
+ * just a lookup. Only the first segment is anchored at the start of the
+ * string and only the last one at its end, the others are matched at their
+ * leftmost position, so a match never backtracks: it is linear in the
+ * string length for segments of exact characters, found with memmem(), and
+ * at most proportional to string length * segment length for the others.
+ *
+ * The semantics are exactly the ones of stringmatchlen(), even where they
+ * are questionable: a non empty pattern never matches the empty string, and
+ * classes are scanned the same way, so "[a-]" is the range from 'a' to ']'.
+ * To keep them, the set of a class is built asking stringmatchClass(), that
+ * is the class loop of stringmatchlen(), about every possible character. */
+
+typedef struct stringmatchSegment {
+    int len;                /* Number of atoms. */
+    unsigned char *sets;    /* 32 bytes per atom: the characters it matches. */
+    char *exact;            /* Not NULL if every atom matches one character
+                               only: the characters to match, in order. */
+} stringmatchSegment;
+
+struct stringmatchPattern {
+    int empty;              /* The pattern is "": it matches only "". */
+    int lead_star;          /* The pattern starts with '*'. */
+    int trail_star;         /* The pattern ends with '*'. */
+    int numsegs;
+    stringmatchSegment *segs;
+};
+
+/* Match the character 'c' against the class at 'pattern', just after its
+ * '[', like stringmatchlen() does. Return the match, and the number of
+ * pattern bytes of the class, including the closing ']', in '*consumed'. */
+static int stringmatchClass(const char *pattern, int patternLen, char c,
+                            int nocase, int *consumed)
+{
+    int origLen = patternLen;
+    int not, match = 0;
+
+    not = patternLen && pattern[0] == '^';
+    if (not) {
+        pattern++;
+        patternLen--;
+    }
+    while(1) {
+        if (patternLen >= 2 && pattern[0] == '\\') {
+            pattern++;
+            patternLen--;
+            if (pattern[0] == c)
+                match = 1;
+        } else if (patternLen == 0) {
+            /* Unterminated class: it ends with the pattern. */
+            break;
+        } else if (pattern[0] == ']') {
+            pattern++;
+            patternLen--;
+            break;
+        } else if (patternLen >= 3 && pattern[1] == '-') {
+            int start = pattern[0];
+            int end = pattern[2];
+            int sc = c;
+            if (start > end) {
+                int t = start;
+                start = end;
+                end = t;
+            }
+            if (nocase) {
+                start = tolower(start);
+                end = tolower(end);
+                sc = tolower(sc);
+            }
+            pattern += 2;
+            patternLen -= 2;
+            if (sc >= start && sc <= end)
+                match = 1;
+        } else {
+            if (!nocase) {
+                if (pattern[0] == c)
+                    match = 1;
+            } else {
+                if (tolower((int)pattern[0]) == tolower((int)c))
+                    match = 1;
+            }
+        }
+        pattern++;
+        patternLen--;
+    }
+    *consumed = origLen - patternLen;
+    return not ? !match : match;
+}
+
+/* Append an atom to the segment 'seg', with room for 'maxatoms'. */
+static unsigned char *stringmatchAddAtom(stringmatchSegment *seg,
+                                         int maxatoms)
+{
+    if (seg->sets == NULL) {
+        seg->sets = zcalloc((size_t)maxatoms*32);
+        seg->exact = zmalloc(maxatoms);
+    }
+    return seg->sets + (size_t)(seg->len++)*32;
+}
+
+/* Set in 'set' the characters matching the literal 'lit'. Return the number
+ * of them. */
+static int stringmatchLiteralSet(unsigned char *set, char lit, int nocase) {
+    int j, count = 0;
+
+    for (j = 0; j < 256; j++) {
+        char c = (char)j;
+        int match = nocase ? tolower((int)c) == tolower((int)lit) : c == lit;
+        if (match) {
+            set[j>>3] |= 1<<(j&7);
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Compile the glob-style pattern for stringmatchPatternMatch(). */
+stringmatchPattern *stringmatchCompile(const char *pattern, int patternLen,
+                                       int nocase)
+{
+    stringmatchPattern *p = zcalloc(sizeof(*p));
+    stringmatchSegment *seg = NULL;
+    int exact = 1, j;
+
+    p->empty = patternLen == 0;
+    /* There are at most patternLen/2+1 segments and patternLen atoms. */
+    p->segs = zcalloc(sizeof(stringmatchSegment)*(patternLen/2+1));
+    while(patternLen) {
+        unsigned char *set;
+
+        if (pattern[0] == '*') {
+            while(patternLen && pattern[0] == '*') {
+                pattern++;
+                patternLen--;
+            }
+            if (seg == NULL && p->numsegs == 0) p->lead_star = 1;
+            if (patternLen == 0) p->trail_star = 1;
+            if (seg && !exact) {
+                zfree(seg->exact);
+                seg->exact = NULL;
+            }
+            seg = NULL;
+            continue;
+        }
+        if (seg == NULL) {
+            seg = p->segs + p->numsegs++;
+            exact = 1;
+        }
+        set = stringmatchAddAtom(seg,patternLen);
+        if (pattern[0] == '?') {
+            memset(set,0xff,32);
+            exact = 0;
+            pattern++;
+            patternLen--;
+        } else if (pattern[0] == '[') {
+            int consumed = 0;
+
+            for (j = 0; j < 256; j++) {
+                if (stringmatchClass(pattern+1,patternLen-1,(char)j,nocase,
+                                     &consumed))
+                    set[j>>3] |= 1<<(j&7);
+            }
+            exact = 0;
+            pattern += 1+consumed;
+            patternLen -= 1+consumed;
+        } else {
+            if (pattern[0] == '\\' && patternLen >= 2) {
+                pattern++;
+                patternLen--;
+            }
+            if (stringmatchLiteralSet(set,pattern[0],nocase) != 1)
+                exact = 0;
+            seg->exact[seg->len-1] = pattern[0];
+            pattern++;
+            patternLen--;
+        }
+    }
+    if (seg && !exact) {
+        zfree(seg->exact);
+        seg->exact = NULL;
+    }
+    return p;
+}
+
+void stringmatchFree(stringmatchPattern *p) {
+    int j;
+
+    for (j = 0; j < p->numsegs; j++) {
+        zfree(p->segs[j].sets);
+        zfree(p->segs[j].exact);
+    }
+    zfree(p->segs);
+    zfree(p);
+}
+
+/* Return true if 'seg' matches the string at 's', that has room for it. */
+static int stringmatchSegmentAt(stringmatchSegment *seg, const char *s) {
+    const unsigned char *set = seg->sets;
+    int j;
+
+    if (seg->exact) return memcmp(seg->exact,s,seg->len) == 0;
+    for (j = 0; j < seg->len; j++, set += 32) {
+        unsigned char c = s[j];
+        if (!(set[c>>3] & (1<<(c&7)))) return 0;
+    }
+    return 1;
+}
+
+/* Return the leftmost offset of the string, from 'from', where 'seg' matches
+ * ending before 'to', or -1. */
+static long stringmatchSegmentFind(stringmatchSegment *seg, const char *s,
+                                   long from, long to)
+{
+    long j;
+
+    if (seg->exact) {
+        const char *found;
+
+        if (to-from < seg->len) return -1;
+        found = memmem(s+from,to-from,seg->exact,seg->len);
+        return found ? found-s : -1;
+    }
+    for (j = from; j+seg->len <= to; j++)
+        if (stringmatchSegmentAt(seg,s+j)) return j;
+    return -1;
+}
+
+/* Like stringmatchlen(), for a pattern compiled by stringmatchCompile(). */
+int stringmatchPatternMatch(stringmatchPattern *p, const char *string,
+                            int stringLen)
+{
+    stringmatchSegment *seg;
+    int first = 0, last = p->numsegs-1, j;
+    long start = 0, end = stringLen;
+
+    if (stringLen == 0) return p->empty;
+    if (p->numsegs == 0) return !p->empty; /* Just stars. */
+
+    /* The anchored segments first: a mismatch of the literal prefix or
+     * suffix of the pattern is the common case, and the cheapest. */
+    if (!p->lead_star) {
+        seg = p->segs;
+        if (seg->len > end || !stringmatchSegmentAt(seg,string)) return 0;
+        if (p->numsegs == 1 && !p->trail_star) return seg->len == end;
+        start = seg->len;
+        first++;
+    }
+    if (!p->trail_star) {
+        seg = p->segs+last;
+        if (seg->len > end-start ||
+            !stringmatchSegmentAt(seg,string+end-seg->len)) return 0;
+        end -= seg->len;
+        last--;
+    }
+    for (j = first; j <= last; j++) {
+        long pos = stringmatchSegmentFind(p->segs+j,string,start,end);
+        if (pos == -1) return 0;
+        start = pos+p->segs[j].len;
+    }
+    return 1;
+}
+
+/* Fuzz stringmatchlen() trying to crash it with bad input, then check that
+ * compiled patterns match the same strings, with inputs made mostly of the
+ * glob special characters. Returns -1 if they disagree. */
 int stringmatchlen_fuzz_test(void) {
+    static const char alphabet[] = "ab*?[]^-\\A\xe9";
     char str[32];
     char pat[32];
     int cycles = 10000000;
@@ -184,6 +457,23 @@ int stringmatchlen_fuzz_test(void) {
         for (int j = 0; j < patlen; j++) pat[j] = rand() % 128;
         total_matches += stringmatchlen(pat, patlen, str, strlen, 0);
     }
+    cycles = 1000000;
+    while(cycles--) {
+        int strlen = rand() % 16;
+        int patlen = rand() % 16;
+        int nocase = rand() % 2;
+        stringmatchPattern *p;
+        for (int j = 0; j < strlen; j++)
+            str[j] = alphabet[rand() % (sizeof(alphabet)-1)];
+        for (int j = 0; j < patlen; j++)
+            pat[j] = alphabet[rand() % (sizeof(alphabet)-1)];
+        pat[patlen] = '\0';
+        p = stringmatchCompile(pat, patlen, nocase);
+        if (stringmatchPatternMatch(p, str, strlen) !=
+            stringmatchlen(pat, patlen, str, strlen, nocase)) total_matches = -1;
+        stringmatchFree(p);
+        if (total_matches == -1) break;
+    }
     return total_matches;
 }
 
@@ -392,6 +682,17 @@ int string2ll(const char *s, size_t slen, long long *value) {
         return 0;
     }
 
+    /* With up to 18 digits the value can't overflow: skip the checks. */
+    if (slen-plen <= 17) {
+        while (plen < slen) {
+            unsigned int digit = (unsigned char)p[0]-'0';
+
+            if (digit > 9) return 0;
+            v = v*10+digit;
+            p++; plen++;
+        }
+    }
+
     /* Parse all the other digits, checking for overflow at every step. */
     while (plen < slen && p[0] >= '0' && p[0] <= '9') {
         if (v > (ULLONG_MAX / 10)) /* Overflow. */
@@ -469,7 +770,9 @@ int string2ld(const char *s, size_t slen, long double *dp) {
 }
 
 /* Convert a double to a string representation. Returns the number of bytes
- * required. The representation should always be parsable by strtod(3).
+ * required, or zero if there is not enough room in the buffer. The
+ * representation is the shortest one that strtod(3) reads back as the same
+ * double, see fpconv_dtoa().
  * This function does not support human-friendly formatting like ld2string
  * does. It is intended mainly to be used inside t_zset.c when writing scores
  * into a ziplist representing a sorted set. */
@@ -504,7 +807,15 @@ int d2string(char *buf, size_t len, double value) {
             len = ll2string(buf,len,(long long)value);
         else
 #endif
-            len = snprintf(buf,len,"%.17g",value);
+        {
+            char dbuf[FPCONV_DTOA_MAX];
+            int dlen = fpconv_dtoa(value,dbuf);
+
+            if ((size_t)dlen >= len) return 0;
+            memcpy(buf,dbuf,dlen);
+            buf[dlen] = '\0';
+            len = dlen;
+        }
     }
 
     return len;
@@ -751,6 +1062,21 @@ static void test_string2ll(void) {
 
     strcpy(buf,"9223372036854775808"); /* overflow */
     assert(string2ll(buf,strlen(buf),&v) == 0);
+
+    /* The longest strings parsed without overflow checks. */
+    strcpy(buf,"999999999999999999");
+    assert(string2ll(buf,strlen(buf),&v) == 1);
+    assert(v == 999999999999999999LL);
+
+    strcpy(buf,"-999999999999999999");
+    assert(string2ll(buf,strlen(buf),&v) == 1);
+    assert(v == -999999999999999999LL);
+
+    strcpy(buf,"12345678901234567a");
+    assert(string2ll(buf,strlen(buf),&v) == 0);
+
+    strcpy(buf,"99999999999999999999"); /* overflow */
+    assert(string2ll(buf,strlen(buf),&v) == 0);
 }
 
 static void test_string2l(void) {
@@ -843,6 +1169,86 @@ static void test_ll2string(void) {
     assert(!strcmp(buf, "9223372036854775807"));
 }
 
+static void test_d2string(void) {
+    char buf[128];
+    double v;
+    int sz, j;
+
+    /* The shortest representation, laid out like "%.17g". */
+    sz = d2string(buf, sizeof buf, 1.1);
+    assert(sz == 3 && !strcmp(buf, "1.1"));
+    sz = d2string(buf, sizeof buf, -0.0001);
+    assert(sz == 7 && !strcmp(buf, "-0.0001"));
+    sz = d2string(buf, sizeof buf, 1e-5);
+    assert(sz == 5 && !strcmp(buf, "1e-05"));
+    sz = d2string(buf, sizeof buf, 1.5e300);
+    assert(sz == 8 && !strcmp(buf, "1.5e+300"));
+    sz = d2string(buf, sizeof buf, 1e17);
+    assert(sz == 5 && !strcmp(buf, "1e+17"));
+    sz = d2string(buf, sizeof buf, 12345678901234567.0);
+    assert(sz == 17 && !strcmp(buf, "12345678901234568"));
+    sz = d2string(buf, sizeof buf, 5e-324);
+    assert(sz == 6 && !strcmp(buf, "5e-324"));
+    sz = d2string(buf, sizeof buf, 1.7976931348623157e308);
+    assert(sz == 23 && !strcmp(buf, "1.7976931348623157e+308"));
+    sz = d2string(buf, 3, 1.25);
+    assert(sz == 0);
+
+    /* Whatever the double, it must read back the same. */
+    for (j = 0; j < 1000000; j++) {
+        uint64_t bits = ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^
+                        (uint64_t)rand();
+        memcpy(&v, &bits, sizeof(v));
+        if (!isfinite(v)) continue;
+        sz = d2string(buf, sizeof buf, v);
+        assert(sz > 0 && strtod(buf, NULL) == v);
+    }
+}
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* Compare the conversions with the libc ones they replace. */
+static void benchmark_conversions(void) {
+    char buf[128];
+    long long start, ll, sum = 0;
+    double scores[1024];
+    int j, len, num = 1000000;
+
+    for (j = 0; j < 1024; j++)
+        scores[j] = (double)rand() / ((double)(rand() % 1000) + 1);
+
+    start = usec();
+    for (j = 0; j < num; j++) sum += ll2string(buf,sizeof(buf),j*7919LL);
+    printf("ll2string: %d conversions, %lldusec\n", num, usec()-start);
+    start = usec();
+    for (j = 0; j < num; j++) sum += snprintf(buf,sizeof(buf),"%lld",j*7919LL);
+    printf("snprintf(%%lld): %d conversions, %lldusec\n", num, usec()-start);
+
+    len = ll2string(buf,sizeof(buf),123456789012LL);
+    start = usec();
+    for (j = 0; j < num; j++) {
+        string2ll(buf,len,&ll);
+        sum += ll;
+    }
+    printf("string2ll: %d conversions, %lldusec\n", num, usec()-start);
+    start = usec();
+    for (j = 0; j < num; j++) sum += strtoll(buf,NULL,10);
+    printf("strtoll: %d conversions, %lldusec\n", num, usec()-start);
+
+    start = usec();
+    for (j = 0; j < num; j++) sum += d2string(buf,sizeof(buf),scores[j&1023]);
+    printf("d2string: %d conversions, %lldusec\n", num, usec()-start);
+    start = usec();
+    for (j = 0; j < num; j++)
+        sum += snprintf(buf,sizeof(buf),"%.17g",scores[j&1023]);
+    printf("snprintf(%%.17g): %d conversions, %lldusec\n", num, usec()-start);
+    if (sum == 42) printf("\n"); /* Keep the loops. */
+}
+
 #define UNUSED(x) (void)(x)
 int utilTest(int argc, char **argv) {
     UNUSED(argc);
@@ -851,6 +1257,8 @@ int utilTest(int argc, char **argv) {
     test_string2ll();
     test_string2l();
     test_ll2string();
+    test_d2string();
+    benchmark_conversions();
     return 0;
 }
 #endif
@@ -41,6 +41,13 @@
 int stringmatchlen(const char *p, int plen, const char *s, int slen, int nocase);
 int stringmatch(const char *p, const char *s, int nocase);
 int stringmatchlen_fuzz_test(void);
+
+/* A glob-style pattern compiled by stringmatchCompile(), to match many
+ * strings with the semantics of stringmatchlen() but without backtracking. */
+typedef struct stringmatchPattern stringmatchPattern;
+stringmatchPattern *stringmatchCompile(const char *p, int plen, int nocase);
+int stringmatchPatternMatch(stringmatchPattern *p, const char *s, int slen);
+void stringmatchFree(stringmatchPattern *p);
 long long memtoll(const char *p, int *err);
 uint32_t digits10(uint64_t v);
 uint32_t sdigits10(int64_t v);
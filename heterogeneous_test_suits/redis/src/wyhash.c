@@ -0,0 +1,184 @@
+/*
+   wyhash for the Redis hash tables
+
+   Based on wyhash final version 4 by Wang Yi <godspeed_china@yeah.net>,
+   released into the public domain (The Unlicense).
+
+   Copyright (c) 2019 Salvatore Sanfilippo <antirez@gmail.com>
+
+   To the extent possible under law, the author(s) have dedicated all copyright
+   and related and neighboring rights to this software to the public domain
+   worldwide. This software is distributed without any warranty.
+
+   ----------------------------------------------------------------------------
+
+   This is an alternative to siphash.c for the dict hash function, selected
+   at build time with "make USE_WYHASH=yes". It hashes 16 or 48 bytes per
+   64x64->128 bit multiplication instead of 8 bytes per SipHash round, and
+   short keys, the common case, with two multiplications. It was changed in
+   the following ways:
+
+   1. The 128 bit key of the dict seed is used: k0 and k1 are mixed into
+      the seed instead of the 64 bit seed of the original.
+   2. A case insensitive variant, as for SipHash: the bytes are lower cased
+      eight at a time while loaded.
+   3. The input is always read as little endian, so every ISA computes the
+      same hashes. This is required for the heterogeneous build: a thread
+      can migrate between x86-64 and aarch64 while the tables are in use,
+      so there is no per ISA variant to dispatch to. Both ISAs have the
+      64x64->128 bit multiplication the function is built on (MUL/MULX and
+      MUL/UMULH).
+
+   wyhash is not a cryptographic PRF as SipHash is meant to be. It is keyed
+   with the random seed, but its resistance to hash flooding was studied
+   much less, so it is not the default.
+ */
+#include <stdint.h>
+#include <string.h>
+
+static const uint64_t wyp[4] = {
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+    0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+static inline void wymum(uint64_t *a, uint64_t *b) {
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wymix(uint64_t a, uint64_t b) {
+    wymum(&a,&b);
+    return a^b;
+}
+
+/* Lower case the ASCII letters of the 8 bytes in 'v', as siptlw() does for
+ * one byte: bytes with the high bit set are left alone. */
+static inline uint64_t wytlw(uint64_t v) {
+    uint64_t heptets = v & 0x7f7f7f7f7f7f7f7fULL;
+    uint64_t gt_z = heptets + 0x2525252525252525ULL; /* 0x7f - 'Z' */
+    uint64_t ge_a = heptets + 0x3f3f3f3f3f3f3f3fULL; /* 0x80 - 'A' */
+    uint64_t upper = ~v & (ge_a ^ gt_z) & 0x8080808080808080ULL;
+    return v | (upper >> 2);
+}
+
+static inline uint64_t wyr8(const uint8_t *p, int nocase) {
+    uint64_t v;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&v,p,sizeof(v));
+#else
+    v = ((uint64_t)p[0]) | ((uint64_t)p[1] << 8) |
+        ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+        ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+        ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+#endif
+    return nocase ? wytlw(v) : v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p, int nocase) {
+    uint64_t v = ((uint64_t)p[0]) | ((uint64_t)p[1] << 8) |
+                 ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24);
+    return nocase ? wytlw(v) : v;
+}
+
+/* 1 to 3 bytes. */
+static inline uint64_t wyr3(const uint8_t *p, size_t k, int nocase) {
+    uint64_t v = (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) |
+                 p[k-1];
+    return nocase ? wytlw(v) : v;
+}
+
+static inline uint64_t wyhash_generic(const uint8_t *p, size_t len,
+                                      const uint8_t *k, int nocase)
+{
+    uint64_t k0, k1, seed, a, b;
+
+    memcpy(&k0,k,sizeof(k0));
+    memcpy(&k1,k+8,sizeof(k1));
+    seed = wymix(k0^wyp[0],k1^wyp[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wyr4(p,nocase) << 32) | wyr4(p+((len >> 3) << 2),nocase);
+            b = (wyr4(p+len-4,nocase) << 32) |
+                wyr4(p+len-4-((len >> 3) << 2),nocase);
+        } else if (len > 0) {
+            a = wyr3(p,len,nocase);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p,nocase)^wyp[1],wyr8(p+8,nocase)^seed);
+                see1 = wymix(wyr8(p+16,nocase)^wyp[2],wyr8(p+24,nocase)^see1);
+                see2 = wymix(wyr8(p+32,nocase)^wyp[3],wyr8(p+40,nocase)^see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1^see2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p,nocase)^wyp[1],wyr8(p+8,nocase)^seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p+i-16,nocase);
+        b = wyr8(p+i-8,nocase);
+    }
+    a ^= wyp[1];
+    b ^= seed;
+    wymum(&a,&b);
+    return wymix(a^wyp[0]^len,b^wyp[1]);
+}
+
+uint64_t wyhash(const uint8_t *in, const size_t inlen, const uint8_t *k) {
+    return wyhash_generic(in,inlen,k,0);
+}
+
+uint64_t wyhash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k)
+{
+    return wyhash_generic(in,inlen,k,1);
+}
+
+#ifdef WYHASH_TEST
+#include <stdio.h>
+
+/* Compare wyhash_nocase() with wyhash() of the lower cased input, for all
+ * the lengths the different paths take. Returns 0 on success. */
+int wyhash_test(void) {
+    uint8_t in[128], lower[128], k[16];
+    int i, j, fails = 0;
+
+    for (i = 0; i < 16; i++) k[i] = i;
+    for (i = 0; i < 128; i++) {
+        in[i] = "aZ@[`{\xc1\xe1Mm0 "[i % 12] + (i % 5 == 0 ? 0 : i % 3);
+        lower[i] = (in[i] >= 'A' && in[i] <= 'Z') ? in[i]+('a'-'A') : in[i];
+    }
+    for (i = 0; i <= 128; i++) {
+        if (wyhash_nocase(in,i,k) != wyhash(lower,i,k)) fails++;
+        for (j = 0; j < i; j++) {
+            /* Every byte must change the hash. */
+            lower[j] ^= 1;
+            if (wyhash(lower,i,k) == wyhash_nocase(in,i,k)) fails++;
+            lower[j] ^= 1;
+        }
+    }
+    if (wyhash((uint8_t*)"hello",5,k) ==
+        wyhash((uint8_t*)"hello",5,(uint8_t*)"1234567812345678")) fails++;
+    return fails != 0;
+}
+
+int main(void) {
+    if (wyhash_test() == 0) {
+        printf("wyhash test: OK\n");
+        return 0;
+    } else {
+        printf("wyhash test: FAILED\n");
+        return 1;
+    }
+}
+#endif
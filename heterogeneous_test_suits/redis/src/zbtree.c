@@ -0,0 +1,976 @@
+/* zbtree.c -- B+tree ordered index for large sorted sets.
+ *
+ * This is the alternative to the skiplist selected by "zset-btree yes": the
+ * sorted set is still a hash table mapping elements to scores, plus an index
+ * ordered by (score, element), but the index is a B+tree:
+ *
+ * - Leaves hold up to ZBT_LEAF_CAP elements, with the scores and the element
+ *   pointers in two arrays, and are linked in both directions. A range scan
+ *   by score reads consecutive memory instead of following one pointer per
+ *   element, and ZREVRANGE walks the leaves backward.
+ * - Inner nodes hold up to ZBT_INNER_CAP children. For every child they keep
+ *   the number of elements below it, so ZRANK and the positional lookups of
+ *   ZRANGE cost a single root to leaf walk, and a separator key: child[i]
+ *   only holds elements >= (score[i],ele[i]), and child[i-1] elements that
+ *   are smaller. A tree of ten millions elements is four or five levels high.
+ *
+ * Like in the skiplist, the SDS strings of the elements are shared with the
+ * hash table and freed by the tree. Separators are private copies instead,
+ * since a separator stays valid after the element it was taken from is
+ * deleted. The hash table values are the scores themselves (see the zset
+ * struct), because elements move inside and between the leaves.
+ *
+ * Nodes other than the root never get empty: a node with less than a quarter
+ * of its capacity after a deletion is merged with a sibling, or takes some of
+ * its entries. Leaves are split in two halves, except when an element is
+ * appended to the last leaf or prepended to the first one: then the full leaf
+ * is left as it is, so that loading an ordered set fills the leaves.
+ *
+ * Copyright (c) 2019, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include <math.h>
+
+#define ZBT_LEAF_MIN (ZBT_LEAF_CAP/4)
+#define ZBT_INNER_MIN (ZBT_INNER_CAP/4)
+
+/*-----------------------------------------------------------------------------
+ * Nodes
+ *----------------------------------------------------------------------------*/
+
+static zbtreeLeaf *zbtLeafCreate(zbtree *zbt) {
+    zbtreeLeaf *leaf = zmalloc(sizeof(*leaf));
+    leaf->prev = leaf->next = NULL;
+    leaf->count = 0;
+    zbt->nodes++;
+    return leaf;
+}
+
+static zbtreeInner *zbtInnerCreate(zbtree *zbt) {
+    zbtreeInner *in = zmalloc(sizeof(*in));
+    in->count = 0;
+    in->ele[0] = NULL;
+    zbt->nodes++;
+    return in;
+}
+
+/* Number of elements in the subtree rooted at 'node', which is a leaf if
+ * 'height' is zero. */
+static unsigned long zbtNodeSize(void *node, int height) {
+    if (height == 0) return ((zbtreeLeaf*)node)->count;
+
+    zbtreeInner *in = node;
+    unsigned long size = 0;
+    for (unsigned int j = 0; j < in->count; j++) size += in->size[j];
+    return size;
+}
+
+static unsigned int zbtNodeCount(void *node, int height) {
+    return height ? ((zbtreeInner*)node)->count : ((zbtreeLeaf*)node)->count;
+}
+
+static void zbtFreeNode(void *node, int height) {
+    if (height == 0) {
+        zbtreeLeaf *leaf = node;
+        for (unsigned int j = 0; j < leaf->count; j++) sdsfree(leaf->ele[j]);
+    } else {
+        zbtreeInner *in = node;
+        for (unsigned int j = 0; j < in->count; j++) {
+            if (j) sdsfree(in->ele[j]);
+            zbtFreeNode(in->child[j],height-1);
+        }
+    }
+    zfree(node);
+}
+
+/* Create a new empty B+tree. */
+zbtree *zbtCreate(void) {
+    zbtree *zbt = zmalloc(sizeof(*zbt));
+    zbt->length = 0;
+    zbt->nodes = 0;
+    zbt->height = 0;
+    zbt->root = zbt->head = zbt->tail = zbtLeafCreate(zbt);
+    return zbt;
+}
+
+/* Free a whole B+tree, with the SDS strings of its elements. */
+void zbtFree(zbtree *zbt) {
+    zbtFreeNode(zbt->root,zbt->height);
+    zfree(zbt);
+}
+
+/*-----------------------------------------------------------------------------
+ * Search
+ *----------------------------------------------------------------------------*/
+
+static inline int zbtKeyCompare(double s1, sds e1, double s2, sds e2) {
+    if (s1 < s2) return -1;
+    if (s1 > s2) return 1;
+    return sdscmp(e1,e2);
+}
+
+/* Index of the child of 'in' that may hold the element (score,ele): the last
+ * one whose separator is <= than the element. */
+static unsigned int zbtChildIndex(zbtreeInner *in, double score, sds ele) {
+    unsigned int lo = 1, hi = in->count;
+
+    while (lo < hi) {
+        unsigned int mid = (lo+hi)/2;
+        if (zbtKeyCompare(in->score[mid],in->ele[mid],score,ele) <= 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo-1;
+}
+
+/* Index of the first element of 'leaf' that is >= (score,ele). */
+static unsigned int zbtLeafLowerBound(zbtreeLeaf *leaf, double score, sds ele) {
+    unsigned int lo = 0, hi = leaf->count;
+
+    while (lo < hi) {
+        unsigned int mid = (lo+hi)/2;
+        if (zbtKeyCompare(leaf->score[mid],leaf->ele[mid],score,ele) < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Predicates used to seek a position in the tree. They must be true for the
+ * elements at the start of the order and false for the ones after, like
+ * "score is less than the range minimum". */
+typedef int zbtPredicate(double score, sds ele, void *arg);
+
+typedef struct {
+    double score;
+    sds ele;
+} zbtKey;
+
+static int zbtLessThanKey(double score, sds ele, void *arg) {
+    zbtKey *key = arg;
+    return zbtKeyCompare(score,ele,key->score,key->ele) < 0;
+}
+
+static int zbtBeforeMin(double score, sds ele, void *arg) {
+    UNUSED(ele);
+    return !zslValueGteMin(score,arg);
+}
+
+static int zbtNotAfterMax(double score, sds ele, void *arg) {
+    UNUSED(ele);
+    return zslValueLteMax(score,arg);
+}
+
+static int zbtLexBeforeMin(double score, sds ele, void *arg) {
+    UNUSED(score);
+    return !zslLexValueGteMin(ele,arg);
+}
+
+static int zbtLexNotAfterMax(double score, sds ele, void *arg) {
+    UNUSED(score);
+    return zslLexValueLteMax(ele,arg);
+}
+
+/* Set 'it' to the first element for which 'pred' is false. The position may
+ * be one past the last element of the leaf ('idx' equal to 'count'), with
+ * 'rank' being the rank that element would have. */
+static void zbtSeek(zbtree *zbt, zbtPredicate *pred, void *arg, zbtreeIter *it) {
+    void *node = zbt->root;
+    unsigned long rank = 0;
+    unsigned int lo, hi, j;
+
+    for (int h = zbt->height; h > 0; h--) {
+        zbtreeInner *in = node;
+        lo = 1; hi = in->count;
+        while (lo < hi) {
+            unsigned int mid = (lo+hi)/2;
+            if (pred(in->score[mid],in->ele[mid],arg))
+                lo = mid+1;
+            else
+                hi = mid;
+        }
+        for (j = 0; j < lo-1; j++) rank += in->size[j];
+        node = in->child[lo-1];
+    }
+
+    zbtreeLeaf *leaf = node;
+    lo = 0; hi = leaf->count;
+    while (lo < hi) {
+        unsigned int mid = (lo+hi)/2;
+        if (pred(leaf->score[mid],leaf->ele[mid],arg))
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    it->leaf = leaf;
+    it->idx = lo;
+    it->rank = rank+lo+1;
+}
+
+/* Move 'it' from a position returned by zbtSeek() to the element there, or
+ * to the element before it. Return 0 if there is no such element. */
+static int zbtSeekFirst(zbtree *zbt, zbtPredicate *pred, void *arg, zbtreeIter *it) {
+    zbtSeek(zbt,pred,arg,it);
+    if (it->idx == it->leaf->count) {
+        it->leaf = it->leaf->next;
+        it->idx = 0;
+        if (it->leaf == NULL) return 0;
+    }
+    return 1;
+}
+
+static int zbtSeekLast(zbtree *zbt, zbtPredicate *pred, void *arg, zbtreeIter *it) {
+    zbtSeek(zbt,pred,arg,it);
+    return zbtPrev(it);
+}
+
+/* Move the iterator to the next / previous element. Return 0 when there are
+ * no more elements, in which case the iterator can't be used anymore. */
+int zbtNext(zbtreeIter *it) {
+    if (++it->idx >= it->leaf->count) {
+        it->leaf = it->leaf->next;
+        it->idx = 0;
+        if (it->leaf == NULL) return 0;
+    }
+    it->rank++;
+    return 1;
+}
+
+int zbtPrev(zbtreeIter *it) {
+    if (it->idx == 0) {
+        it->leaf = it->leaf->prev;
+        if (it->leaf == NULL) return 0;
+        it->idx = it->leaf->count;
+    }
+    it->idx--;
+    it->rank--;
+    return 1;
+}
+
+/* Find the element with matching score and element. Returns 1 and sets 'it'
+ * if found, otherwise 0 is returned. */
+int zbtFind(zbtree *zbt, double score, sds ele, zbtreeIter *it) {
+    zbtKey key = {score, ele};
+
+    if (!zbtSeekFirst(zbt,zbtLessThanKey,&key,it)) return 0;
+    return zbtIterScore(it) == score && sdscmp(zbtIterEle(it),ele) == 0;
+}
+
+/* Find the rank for an element by both score and key.
+ * Returns 0 when the element cannot be found, rank otherwise. Like in the
+ * skiplist, the rank is 1-based. */
+unsigned long zbtGetRank(zbtree *zbt, double score, sds ele) {
+    zbtreeIter it;
+
+    if (!zbtFind(zbt,score,ele,&it)) return 0;
+    return it.rank;
+}
+
+/* Finds an element by its rank. The rank argument needs to be 1-based.
+ * Returns 0 if the rank is out of range. */
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreeIter *it) {
+    if (rank == 0 || rank > zbt->length) return 0;
+
+    /* Check if the element is trivial to find, before walking the tree. */
+    if (rank == 1) {
+        it->leaf = zbt->head;
+        it->idx = 0;
+    } else if (rank == zbt->length) {
+        it->leaf = zbt->tail;
+        it->idx = zbt->tail->count-1;
+    } else {
+        void *node = zbt->root;
+        unsigned long left = rank-1;
+
+        for (int h = zbt->height; h > 0; h--) {
+            zbtreeInner *in = node;
+            unsigned int j = 0;
+            while (left >= in->size[j]) left -= in->size[j++];
+            node = in->child[j];
+        }
+        it->leaf = node;
+        it->idx = left;
+    }
+    it->rank = rank;
+    return 1;
+}
+
+/* Returns if there is a part of the B+tree in the score range. */
+static int zbtIsInRange(zbtree *zbt, zrangespec *range) {
+    /* Test for ranges that will always be empty. */
+    if (range->min > range->max ||
+            (range->min == range->max && (range->minex || range->maxex)))
+        return 0;
+    if (zbt->length == 0 ||
+        !zslValueGteMin(zbt->tail->score[zbt->tail->count-1],range) ||
+        !zslValueLteMax(zbt->head->score[0],range))
+        return 0;
+    return 1;
+}
+
+/* Find the first / last element in the specified score range. Returns 0
+ * when no element is contained in the range, otherwise 1 and 'it' is set. */
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreeIter *it) {
+    if (!zbtIsInRange(zbt,range)) return 0;
+    if (!zbtSeekFirst(zbt,zbtBeforeMin,range,it)) return 0;
+    return zslValueLteMax(zbtIterScore(it),range);
+}
+
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreeIter *it) {
+    if (!zbtIsInRange(zbt,range)) return 0;
+    if (!zbtSeekLast(zbt,zbtNotAfterMax,range,it)) return 0;
+    return zslValueGteMin(zbtIterScore(it),range);
+}
+
+/* Returns if there is a part of the B+tree in the lex range. */
+static int zbtIsInLexRange(zbtree *zbt, zlexrangespec *range) {
+    /* Test for ranges that will always be empty. */
+    int cmp = sdscmplex(range->min,range->max);
+    if (cmp > 0 || (cmp == 0 && (range->minex || range->maxex)))
+        return 0;
+    if (zbt->length == 0 ||
+        !zslLexValueGteMin(zbt->tail->ele[zbt->tail->count-1],range) ||
+        !zslLexValueLteMax(zbt->head->ele[0],range))
+        return 0;
+    return 1;
+}
+
+/* Find the first / last element in the specified lex range. Returns 0 when
+ * no element is contained in the range, otherwise 1 and 'it' is set. */
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeIter *it) {
+    if (!zbtIsInLexRange(zbt,range)) return 0;
+    if (!zbtSeekFirst(zbt,zbtLexBeforeMin,range,it)) return 0;
+    return zslLexValueLteMax(zbtIterEle(it),range);
+}
+
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeIter *it) {
+    if (!zbtIsInLexRange(zbt,range)) return 0;
+    if (!zbtSeekLast(zbt,zbtLexNotAfterMax,range,it)) return 0;
+    return zslLexValueGteMin(zbtIterEle(it),range);
+}
+
+/*-----------------------------------------------------------------------------
+ * Insertion
+ *----------------------------------------------------------------------------*/
+
+/* Move the elements of 'leaf' starting at 'split' to a new leaf, linked
+ * after it, that is returned. */
+static zbtreeLeaf *zbtLeafSplit(zbtree *zbt, zbtreeLeaf *leaf, unsigned int split) {
+    zbtreeLeaf *right = zbtLeafCreate(zbt);
+
+    right->count = leaf->count-split;
+    memcpy(right->score,leaf->score+split,sizeof(double)*right->count);
+    memcpy(right->ele,leaf->ele+split,sizeof(sds)*right->count);
+    leaf->count = split;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    else
+        zbt->tail = right;
+    leaf->next = right;
+    return right;
+}
+
+/* Move the children of 'in' starting at 'split' to a new inner node that is
+ * returned. The separator of child 'split' is the one of the new node, and
+ * is returned by reference: it is up to the caller to store it. */
+static zbtreeInner *zbtInnerSplit(zbtree *zbt, zbtreeInner *in, unsigned int split, double *sepscore, sds *sepele) {
+    zbtreeInner *right = zbtInnerCreate(zbt);
+    unsigned int n = in->count-split;
+
+    *sepscore = in->score[split];
+    *sepele = in->ele[split];
+    memcpy(right->size,in->size+split,sizeof(unsigned long)*n);
+    memcpy(right->score+1,in->score+split+1,sizeof(double)*(n-1));
+    memcpy(right->ele+1,in->ele+split+1,sizeof(sds)*(n-1));
+    memcpy(right->child,in->child+split,sizeof(void*)*n);
+    right->count = n;
+    in->count = split;
+    return right;
+}
+
+/* Insert the child 'child' with 'size' elements and separator (score,ele)
+ * at position 'pos' (> 0) of 'in', that must not be full. */
+static void zbtInnerInsertAt(zbtreeInner *in, unsigned int pos, void *child, unsigned long size, double score, sds ele) {
+    unsigned int n = in->count-pos;
+
+    memmove(in->size+pos+1,in->size+pos,sizeof(unsigned long)*n);
+    memmove(in->score+pos+1,in->score+pos,sizeof(double)*n);
+    memmove(in->ele+pos+1,in->ele+pos,sizeof(sds)*n);
+    memmove(in->child+pos+1,in->child+pos,sizeof(void*)*n);
+    in->size[pos] = size;
+    in->score[pos] = score;
+    in->ele[pos] = ele;
+    in->child[pos] = child;
+    in->count++;
+}
+
+/* Insert (score,ele) in the subtree rooted at 'node'. If the node was split,
+ * the new node at its right is returned, and its separator is set by
+ * reference. Otherwise NULL is returned. */
+static void *zbtInsertNode(zbtree *zbt, void *node, int height, double score, sds ele, double *sepscore, sds *sepele) {
+    if (height == 0) {
+        zbtreeLeaf *leaf = node, *right = NULL;
+        unsigned int pos = zbtLeafLowerBound(leaf,score,ele);
+
+        if (leaf->count == ZBT_LEAF_CAP) {
+            unsigned int split;
+
+            if (pos == leaf->count && leaf->next == NULL)
+                split = leaf->count;    /* Appending to the last leaf. */
+            else if (pos == 0 && leaf->prev == NULL)
+                split = 0;              /* Prepending to the first leaf. */
+            else
+                split = leaf->count/2;
+            right = zbtLeafSplit(zbt,leaf,split);
+            if (pos > split || (pos == split && split == ZBT_LEAF_CAP)) {
+                leaf = right;
+                pos -= split;
+            }
+        }
+
+        memmove(leaf->score+pos+1,leaf->score+pos,
+                sizeof(double)*(leaf->count-pos));
+        memmove(leaf->ele+pos+1,leaf->ele+pos,sizeof(sds)*(leaf->count-pos));
+        leaf->score[pos] = score;
+        leaf->ele[pos] = ele;
+        leaf->count++;
+
+        if (right) {
+            *sepscore = right->score[0];
+            *sepele = sdsdup(right->ele[0]);
+        }
+        return right;
+    }
+
+    zbtreeInner *in = node, *right = NULL;
+    unsigned int i = zbtChildIndex(in,score,ele);
+    double childscore;
+    sds childele;
+    void *child;
+
+    child = zbtInsertNode(zbt,in->child[i],height-1,score,ele,
+                          &childscore,&childele);
+    in->size[i]++;
+    if (child == NULL) return NULL;
+
+    /* The child was split: add the new node after it. */
+    unsigned long childsize = zbtNodeSize(child,height-1);
+    unsigned int pos = i+1;
+
+    in->size[i] -= childsize;
+    if (in->count == ZBT_INNER_CAP) {
+        unsigned int split = in->count/2;
+
+        right = zbtInnerSplit(zbt,in,split,sepscore,sepele);
+        if (pos > split) {
+            zbtInnerInsertAt(right,pos-split,child,childsize,
+                             childscore,childele);
+            return right;
+        }
+    }
+    zbtInnerInsertAt(in,pos,child,childsize,childscore,childele);
+    return right;
+}
+
+/* Insert a new element in the B+tree. Assumes the element does not already
+ * exist (up to the caller to enforce that). The tree takes ownership of the
+ * passed SDS string 'ele'. */
+void zbtInsert(zbtree *zbt, double score, sds ele) {
+    double sepscore;
+    sds sepele;
+    void *right;
+
+    serverAssert(!isnan(score));
+    right = zbtInsertNode(zbt,zbt->root,zbt->height,score,ele,
+                          &sepscore,&sepele);
+    if (right) {
+        zbtreeInner *root = zbtInnerCreate(zbt);
+
+        root->child[0] = zbt->root;
+        root->size[0] = zbtNodeSize(zbt->root,zbt->height);
+        root->child[1] = right;
+        root->size[1] = zbtNodeSize(right,zbt->height);
+        root->score[1] = sepscore;
+        root->ele[1] = sepele;
+        root->count = 2;
+        zbt->root = root;
+        zbt->height++;
+    }
+    zbt->length++;
+}
+
+/*-----------------------------------------------------------------------------
+ * Deletion
+ *----------------------------------------------------------------------------*/
+
+/* Remove the child at position 'pos' (> 0) of 'in', without freeing it. */
+static void zbtInnerRemoveAt(zbtreeInner *in, unsigned int pos) {
+    unsigned int n = in->count-pos-1;
+
+    memmove(in->size+pos,in->size+pos+1,sizeof(unsigned long)*n);
+    memmove(in->score+pos,in->score+pos+1,sizeof(double)*n);
+    memmove(in->ele+pos,in->ele+pos+1,sizeof(sds)*n);
+    memmove(in->child+pos,in->child+pos+1,sizeof(void*)*n);
+    in->count--;
+}
+
+/* Child 'i' of 'parent' has too few entries after a deletion: merge it with
+ * a sibling if they fit a single node, otherwise share the entries of both
+ * evenly. */
+static void zbtRebalance(zbtree *zbt, zbtreeInner *parent, unsigned int i, int height) {
+    unsigned int l = (i > 0) ? i-1 : i, r = l+1;
+
+    if (height == 0) {
+        zbtreeLeaf *left = parent->child[l], *right = parent->child[r];
+        unsigned int total = left->count+right->count;
+
+        if (total <= ZBT_LEAF_CAP) {
+            memcpy(left->score+left->count,right->score,
+                   sizeof(double)*right->count);
+            memcpy(left->ele+left->count,right->ele,sizeof(sds)*right->count);
+            left->count = total;
+            left->next = right->next;
+            if (right->next)
+                right->next->prev = left;
+            else
+                zbt->tail = left;
+            zfree(right);
+            zbt->nodes--;
+            sdsfree(parent->ele[r]);
+            parent->size[l] = total;
+            zbtInnerRemoveAt(parent,r);
+            return;
+        }
+
+        if (left->count > total/2) {
+            unsigned int n = left->count-total/2;
+            memmove(right->score+n,right->score,sizeof(double)*right->count);
+            memmove(right->ele+n,right->ele,sizeof(sds)*right->count);
+            memcpy(right->score,left->score+left->count-n,sizeof(double)*n);
+            memcpy(right->ele,left->ele+left->count-n,sizeof(sds)*n);
+            left->count -= n;
+            right->count += n;
+        } else {
+            unsigned int n = total/2-left->count;
+            memcpy(left->score+left->count,right->score,sizeof(double)*n);
+            memcpy(left->ele+left->count,right->ele,sizeof(sds)*n);
+            memmove(right->score,right->score+n,
+                    sizeof(double)*(right->count-n));
+            memmove(right->ele,right->ele+n,sizeof(sds)*(right->count-n));
+            left->count += n;
+            right->count -= n;
+        }
+        sdsfree(parent->ele[r]);
+        parent->score[r] = right->score[0];
+        parent->ele[r] = sdsdup(right->ele[0]);
+        parent->size[l] = left->count;
+        parent->size[r] = right->count;
+        return;
+    }
+
+    /* Inner nodes: the separator in the parent moves down to the node that
+     * receives the first child of 'right', and the one of the new first
+     * child of 'right' moves up. */
+    zbtreeInner *left = parent->child[l], *right = parent->child[r];
+    unsigned int total = left->count+right->count;
+
+    if (total <= ZBT_INNER_CAP) {
+        unsigned int base = left->count;
+        memcpy(left->size+base,right->size,sizeof(unsigned long)*right->count);
+        memcpy(left->score+base,right->score,sizeof(double)*right->count);
+        memcpy(left->ele+base,right->ele,sizeof(sds)*right->count);
+        memcpy(left->child+base,right->child,sizeof(void*)*right->count);
+        left->score[base] = parent->score[r];
+        left->ele[base] = parent->ele[r];
+        left->count = total;
+        zfree(right);
+        zbt->nodes--;
+        parent->size[l] += parent->size[r];
+        zbtInnerRemoveAt(parent,r);
+        return;
+    }
+
+    if (left->count > total/2) {
+        unsigned int n = left->count-total/2, from = left->count-n;
+        memmove(right->size+n,right->size,sizeof(unsigned long)*right->count);
+        memmove(right->score+n,right->score,sizeof(double)*right->count);
+        memmove(right->ele+n,right->ele,sizeof(sds)*right->count);
+        memmove(right->child+n,right->child,sizeof(void*)*right->count);
+        right->score[n] = parent->score[r];
+        right->ele[n] = parent->ele[r];
+        memcpy(right->size,left->size+from,sizeof(unsigned long)*n);
+        memcpy(right->score,left->score+from,sizeof(double)*n);
+        memcpy(right->ele,left->ele+from,sizeof(sds)*n);
+        memcpy(right->child,left->child+from,sizeof(void*)*n);
+        parent->score[r] = right->score[0];
+        parent->ele[r] = right->ele[0];
+        right->ele[0] = NULL;
+        left->count -= n;
+        right->count += n;
+    } else {
+        unsigned int n = total/2-left->count, base = left->count;
+        memcpy(left->size+base,right->size,sizeof(unsigned long)*n);
+        memcpy(left->score+base,right->score,sizeof(double)*n);
+        memcpy(left->ele+base,right->ele,sizeof(sds)*n);
+        memcpy(left->child+base,right->child,sizeof(void*)*n);
+        left->score[base] = parent->score[r];
+        left->ele[base] = parent->ele[r];
+        parent->score[r] = right->score[n];
+        parent->ele[r] = right->ele[n];
+        memmove(right->size,right->size+n,
+                sizeof(unsigned long)*(right->count-n));
+        memmove(right->score,right->score+n,sizeof(double)*(right->count-n));
+        memmove(right->ele,right->ele+n,sizeof(sds)*(right->count-n));
+        memmove(right->child,right->child+n,sizeof(void*)*(right->count-n));
+        right->ele[0] = NULL;
+        left->count += n;
+        right->count -= n;
+    }
+    parent->size[l] = zbtNodeSize(left,height);
+    parent->size[r] = zbtNodeSize(right,height);
+}
+
+/* Delete from the subtree rooted at 'node' the element (score,ele), or, if
+ * 'ele' is NULL, the element at 0-based position 'pos' inside the subtree.
+ * Returns 1 if the element was found. Its SDS string is freed, unless
+ * 'removed' is not NULL: then it is returned by reference. */
+static int zbtDeleteNode(zbtree *zbt, void *node, int height, double score, sds ele, unsigned long pos, sds *removed) {
+    if (height == 0) {
+        zbtreeLeaf *leaf = node;
+        unsigned int idx;
+
+        if (ele) {
+            idx = zbtLeafLowerBound(leaf,score,ele);
+            if (idx == leaf->count || leaf->score[idx] != score ||
+                sdscmp(leaf->ele[idx],ele) != 0) return 0;
+        } else {
+            idx = pos;
+        }
+        if (removed)
+            *removed = leaf->ele[idx];
+        else
+            sdsfree(leaf->ele[idx]);
+        memmove(leaf->score+idx,leaf->score+idx+1,
+                sizeof(double)*(leaf->count-idx-1));
+        memmove(leaf->ele+idx,leaf->ele+idx+1,
+                sizeof(sds)*(leaf->count-idx-1));
+        leaf->count--;
+        return 1;
+    }
+
+    zbtreeInner *in = node;
+    unsigned int i;
+
+    if (ele) {
+        i = zbtChildIndex(in,score,ele);
+    } else {
+        i = 0;
+        while (pos >= in->size[i]) pos -= in->size[i++];
+    }
+    if (!zbtDeleteNode(zbt,in->child[i],height-1,score,ele,pos,removed))
+        return 0;
+    in->size[i]--;
+    if (zbtNodeCount(in->child[i],height-1) <
+        (height == 1 ? ZBT_LEAF_MIN : ZBT_INNER_MIN))
+    {
+        zbtRebalance(zbt,in,i,height-1);
+    }
+    return 1;
+}
+
+/* Free the root while it is an inner node with a single child. */
+static void zbtShrink(zbtree *zbt) {
+    while (zbt->height > 0 && ((zbtreeInner*)zbt->root)->count == 1) {
+        zbtreeInner *root = zbt->root;
+        zbt->root = root->child[0];
+        zfree(root);
+        zbt->nodes--;
+        zbt->height--;
+    }
+}
+
+/* Delete an element with matching score/element from the B+tree.
+ * The function returns 1 if the element was found and deleted, otherwise
+ * 0 is returned.
+ *
+ * If 'removed' is NULL the SDS string of the element is freed, otherwise
+ * it is returned by reference, so that the caller can reuse it. */
+int zbtDelete(zbtree *zbt, double score, sds ele, sds *removed) {
+    if (!zbtDeleteNode(zbt,zbt->root,zbt->height,score,ele,0,removed))
+        return 0;
+    zbt->length--;
+    zbtShrink(zbt);
+    return 1;
+}
+
+/* Update the score of an element inside the B+tree. Note that the element
+ * must exist and must match 'curscore'. Like zslUpdateScore(), the hash
+ * table side is up to the caller.
+ *
+ * If the element stays at the same position the score is just updated in
+ * place, otherwise the element is removed and inserted again. */
+void zbtUpdateScore(zbtree *zbt, double curscore, sds ele, double newscore) {
+    zbtreeIter it;
+
+    serverAssert(zbtFind(zbt,curscore,ele,&it));
+
+    /* The separators of the inner nodes bound the first and the last
+     * element of a leaf, except for the first and the last leaf of the
+     * tree, so the neighbours must be in the same leaf. */
+    zbtreeLeaf *leaf = it.leaf;
+    unsigned int idx = it.idx;
+    if ((idx > 0 ? leaf->score[idx-1] < newscore : leaf->prev == NULL) &&
+        (idx+1 < leaf->count ? leaf->score[idx+1] > newscore :
+                               leaf->next == NULL))
+    {
+        leaf->score[idx] = newscore;
+        return;
+    }
+
+    sds removed;
+    serverAssert(zbtDelete(zbt,curscore,ele,&removed));
+    zbtInsert(zbt,newscore,removed);
+}
+
+/* Delete all the elements with rank between start and end from the B+tree.
+ * Start and end are inclusive and 1-based. The elements are removed from the
+ * hash table 'dict' of the sorted set too. */
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict) {
+    unsigned long removed = 0;
+
+    if (end > zbt->length) end = zbt->length;
+    while (start <= end) {
+        sds ele;
+
+        zbtDeleteNode(zbt,zbt->root,zbt->height,0,NULL,start-1,&ele);
+        zbt->length--;
+        zbtShrink(zbt);
+        dictDelete(dict,ele);
+        sdsfree(ele);
+        removed++;
+        end--;
+    }
+    return removed;
+}
+
+/* Delete all the elements in the score range from the B+tree, and from the
+ * hash table of the sorted set. */
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict) {
+    zbtreeIter first, last;
+
+    if (!zbtFirstInRange(zbt,range,&first) ||
+        !zbtLastInRange(zbt,range,&last)) return 0;
+    return zbtDeleteRangeByRank(zbt,first.rank,last.rank,dict);
+}
+
+/* Same for a lex range. */
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict) {
+    zbtreeIter first, last;
+
+    if (!zbtFirstInLexRange(zbt,range,&first) ||
+        !zbtLastInLexRange(zbt,range,&last)) return 0;
+    return zbtDeleteRangeByRank(zbt,first.rank,last.rank,dict);
+}
+
+/*-----------------------------------------------------------------------------
+ * Tests
+ *----------------------------------------------------------------------------*/
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+#include <assert.h>
+
+/* Check the invariants of the subtree rooted at 'node', whose elements must
+ * be within (lo,hi) when set. Return the number of elements. */
+static unsigned long zbtCheckNode(zbtree *zbt, void *node, int height, int isroot, double *loscore, sds loele, double *hiscore, sds hiele, zbtreeLeaf **prevleaf) {
+    if (height == 0) {
+        zbtreeLeaf *leaf = node;
+        assert(isroot || leaf->count > 0);
+        assert(leaf->prev == *prevleaf);
+        if (*prevleaf) assert((*prevleaf)->next == leaf);
+        else assert(zbt->head == leaf);
+        for (unsigned int j = 0; j < leaf->count; j++) {
+            if (j) assert(zbtKeyCompare(leaf->score[j-1],leaf->ele[j-1],
+                                        leaf->score[j],leaf->ele[j]) < 0);
+            if (loscore) assert(zbtKeyCompare(*loscore,loele,
+                                leaf->score[j],leaf->ele[j]) <= 0);
+            if (hiscore) assert(zbtKeyCompare(leaf->score[j],leaf->ele[j],
+                                *hiscore,hiele) < 0);
+        }
+        *prevleaf = leaf;
+        return leaf->count;
+    }
+
+    zbtreeInner *in = node;
+    unsigned long total = 0;
+    assert(in->count >= (isroot ? 2 : ZBT_INNER_MIN));
+    for (unsigned int j = 0; j < in->count; j++) {
+        double *lo = j ? &in->score[j] : loscore;
+        sds loe = j ? in->ele[j] : loele;
+        double *hi = j+1 < in->count ? &in->score[j+1] : hiscore;
+        sds hie = j+1 < in->count ? in->ele[j+1] : hiele;
+        unsigned long size = zbtCheckNode(zbt,in->child[j],height-1,0,
+                                          lo,loe,hi,hie,prevleaf);
+        assert(size == in->size[j]);
+        total += size;
+    }
+    return total;
+}
+
+static void zbtCheck(zbtree *zbt) {
+    zbtreeLeaf *last = NULL;
+    unsigned long len = zbtCheckNode(zbt,zbt->root,zbt->height,1,
+                                     NULL,NULL,NULL,NULL,&last);
+    assert(len == zbt->length);
+    assert(zbt->tail == last && last->next == NULL);
+}
+
+int zbtreeTest(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    int n = 20000, j;
+    long *scores = zmalloc(sizeof(long)*n); /* -1 means not in the tree. */
+    zbtree *zbt = zbtCreate();
+    dict *d = dictCreate(&zsetDictType,NULL);
+    zbtreeIter it;
+
+    srandom(1234);
+    for (j = 0; j < n; j++) scores[j] = -1;
+
+    printf("Random insert, delete and update: ");
+    for (long op = 0; op < 200000; op++) {
+        j = random() % n;
+        sds ele = sdsfromlonglong(j);
+        if (scores[j] == -1) {
+            scores[j] = random() % 1000;
+            zbtInsert(zbt,scores[j],ele);
+            ele = NULL;
+        } else if (random() % 2) {
+            assert(zbtDelete(zbt,scores[j],ele,NULL));
+            assert(!zbtFind(zbt,scores[j],ele,&it));
+            scores[j] = -1;
+        } else {
+            long newscore = random() % 1000;
+            zbtUpdateScore(zbt,scores[j],ele,newscore);
+            scores[j] = newscore;
+        }
+        sdsfree(ele);
+        if (op % 5000 == 0) zbtCheck(zbt);
+    }
+    zbtCheck(zbt);
+    printf("ok (%lu elements, height %d)\n",zbt->length,zbt->height);
+
+    printf("Ranks and iteration: ");
+    unsigned long rank = 0;
+    if (zbtGetElementByRank(zbt,1,&it)) {
+        do {
+            rank++;
+            assert(it.rank == rank);
+            assert(zbtGetRank(zbt,zbtIterScore(&it),zbtIterEle(&it)) == rank);
+            zbtreeIter byrank;
+            assert(zbtGetElementByRank(zbt,rank,&byrank));
+            assert(byrank.leaf == it.leaf && byrank.idx == it.idx);
+        } while(zbtNext(&it));
+    }
+    assert(rank == zbt->length);
+    assert(zbtGetElementByRank(zbt,zbt->length,&it));
+    while(zbtPrev(&it)) rank--;
+    assert(rank == 1);
+    printf("ok\n");
+
+    printf("Score ranges: ");
+    for (j = 0; j < 1000; j++) {
+        zrangespec range;
+        zbtreeIter first, last;
+        unsigned long count = 0;
+        int k;
+
+        range.min = random() % 1000;
+        range.max = range.min + random() % 50;
+        range.minex = random() % 2;
+        range.maxex = random() % 2;
+        for (k = 0; k < n; k++) {
+            if (scores[k] != -1 && zslValueGteMin(scores[k],&range) &&
+                zslValueLteMax(scores[k],&range)) count++;
+        }
+        if (count == 0) {
+            assert(!zbtFirstInRange(zbt,&range,&first));
+            assert(!zbtLastInRange(zbt,&range,&last));
+        } else {
+            assert(zbtFirstInRange(zbt,&range,&first));
+            assert(zbtLastInRange(zbt,&range,&last));
+            assert(last.rank-first.rank+1 == count);
+        }
+    }
+    printf("ok\n");
+
+    printf("Range deletion: ");
+    for (j = 0; j < n; j++) {
+        if (scores[j] != -1) {
+            sds ele = sdsfromlonglong(j);
+            zbtFind(zbt,scores[j],ele,&it);
+            dictEntry *de = dictAddRaw(d,zbtIterEle(&it),NULL);
+            dictSetDoubleVal(de,scores[j]);
+            sdsfree(ele);
+        }
+    }
+    zrangespec range = {100, 200, 0, 1};
+    unsigned long before = zbt->length;
+    unsigned long removed = zbtDeleteRangeByScore(zbt,&range,d);
+    assert(zbt->length == before-removed && dictSize(d) == zbt->length);
+    zbtCheck(zbt);
+    assert(!zbtFirstInRange(zbt,&range,&it));
+    removed = zbtDeleteRangeByRank(zbt,1,zbt->length,d);
+    assert(zbt->length == 0 && zbt->height == 0 && zbt->nodes == 1);
+    assert(dictSize(d) == 0);
+    zbtCheck(zbt);
+    printf("ok\n");
+
+    printf("Ordered loads fill the leaves: ");
+    for (j = 0; j < n; j++) zbtInsert(zbt,j,sdsfromlonglong(j));
+    zbtCheck(zbt);
+    assert(zbt->nodes < (unsigned long)n/ZBT_LEAF_CAP*11/10+2);
+    zbtFree(zbt);
+    zbt = zbtCreate();
+    for (j = n-1; j >= 0; j--) zbtInsert(zbt,j,sdsfromlonglong(j));
+    zbtCheck(zbt);
+    assert(zbt->nodes < (unsigned long)n/ZBT_LEAF_CAP*11/10+2);
+    printf("ok\n");
+
+    zbtFree(zbt);
+    dictRelease(d);
+    zfree(scores);
+    return 0;
+}
+#endif
@@ -614,62 +614,79 @@ unsigned char *ziplistResize(unsigned char *zl, unsigned int len) {
  * The pointer "p" points to the first entry that does NOT need to be
  * updated, i.e. consecutive fields MAY need an update. */
 unsigned char *__ziplistCascadeUpdate(unsigned char *zl, unsigned char *p) {
-    size_t curlen = intrev32ifbe(ZIPLIST_BYTES(zl)), rawlen, rawlensize;
-    size_t offset, noffset, extra;
-    unsigned char *np;
-    zlentry cur, next;
-
+    size_t curlen = intrev32ifbe(ZIPLIST_BYTES(zl));
+    size_t firstlen, prevlen, lastoffset = 0, offset, extra = 0;
+    unsigned char *tail = zl+intrev32ifbe(ZIPLIST_TAIL_OFFSET(zl));
+    int tailgrows = 0;
+    zlentry cur;
+
+    if (p[0] == ZIP_END) return zl;
+    zipEntry(p, &cur);
+    firstlen = prevlen = cur.headersize + cur.len;
+    p += prevlen;
+
+    /* First pass: find the run of entries whose "prevlen" field must grow
+     * from 1 to 5 bytes, each one because the previous entry grew, so that
+     * the ziplist is resized once and every byte is moved once, instead of
+     * a resize and a move of the whole tail per entry. */
     while (p[0] != ZIP_END) {
         zipEntry(p, &cur);
-        rawlen = cur.headersize + cur.len;
-        rawlensize = zipStorePrevEntryLength(NULL,rawlen);
-
-        /* Abort if there is no next entry. */
-        if (p[rawlen] == ZIP_END) break;
-        zipEntry(p+rawlen, &next);
 
         /* Abort when "prevlen" has not changed. */
-        if (next.prevrawlen == rawlen) break;
-
-        if (next.prevrawlensize < rawlensize) {
-            /* The "prevlen" field of "next" needs more bytes to hold
-             * the raw length of "cur". */
-            offset = p-zl;
-            extra = rawlensize-next.prevrawlensize;
-            zl = ziplistResize(zl,curlen+extra);
-            p = zl+offset;
-
-            /* Current pointer and offset for next element. */
-            np = p+rawlen;
-            noffset = np-zl;
-
-            /* Update tail offset when next element is not the tail element. */
-            if ((zl+intrev32ifbe(ZIPLIST_TAIL_OFFSET(zl))) != np) {
-                ZIPLIST_TAIL_OFFSET(zl) =
-                    intrev32ifbe(intrev32ifbe(ZIPLIST_TAIL_OFFSET(zl))+extra);
-            }
-
-            /* Move the tail to the back. */
-            memmove(np+rawlensize,
-                np+next.prevrawlensize,
-                curlen-noffset-next.prevrawlensize-1);
-            zipStorePrevEntryLength(np,rawlen);
+        if (cur.prevrawlen == prevlen) break;
 
-            /* Advance the cursor */
-            p += rawlen;
-            curlen += extra;
-        } else {
-            if (next.prevrawlensize > rawlensize) {
+        if (cur.prevrawlensize >= zipStorePrevEntryLength(NULL,prevlen)) {
+            if (cur.prevrawlensize > zipStorePrevEntryLength(NULL,prevlen)) {
                 /* This would result in shrinking, which we want to avoid.
-                 * So, set "rawlen" in the available bytes. */
-                zipStorePrevEntryLengthLarge(p+rawlen,rawlen);
+                 * So, set "prevlen" in the available bytes. */
+                zipStorePrevEntryLengthLarge(p,prevlen);
             } else {
-                zipStorePrevEntryLength(p+rawlen,rawlen);
+                zipStorePrevEntryLength(p,prevlen);
             }
-
-            /* Stop here, as the raw length of "next" has not changed. */
+            /* Stop here, as the raw length of the entry has not changed. */
             break;
         }
+
+        /* The entry grows by ZIP_BIG_PREVLEN's encoding size minus one. */
+        lastoffset = p-zl;
+        if (p == tail) tailgrows = 1;
+        prevlen = cur.headersize + cur.len + 4;
+        extra += 4;
+        p += cur.headersize + cur.len;
+    }
+    if (extra == 0) return zl;
+
+    /* The entries after the run move by 'extra' bytes: so does the tail
+     * entry, unless it is the last entry of the run. */
+    ZIPLIST_TAIL_OFFSET(zl) = intrev32ifbe(
+        intrev32ifbe(ZIPLIST_TAIL_OFFSET(zl)) + extra - (tailgrows ? 4 : 0));
+
+    offset = p-zl;
+    zl = ziplistResize(zl,curlen+extra);
+    memmove(zl+offset+extra,zl+offset,curlen-offset-1);
+
+    /* Second pass, from the last entry of the run to the first one: move
+     * the entry to its new place, after its 5 bytes "prevlen" field. The
+     * "prevlen" of the entries still in place tells where the previous
+     * one starts. */
+    offset = lastoffset;
+    while (extra > 0) {
+        unsigned char *e = zl+offset;
+        size_t rawlen, newprevlen;
+
+        zipEntry(e, &cur);
+        rawlen = cur.headersize + cur.len;
+        extra -= 4;
+        memmove(e+extra+5,e+1,rawlen-1);
+        if (extra > 0) {
+            /* The previous entry of the run grows by 4 bytes. */
+            newprevlen = cur.prevrawlen + 4;
+            offset -= cur.prevrawlen;
+        } else {
+            /* The entry before the run, whose "prevlen" field was stale. */
+            newprevlen = firstlen;
+        }
+        zipStorePrevEntryLengthLarge(e+extra,newprevlen);
     }
     return zl;
 }
@@ -1921,6 +1938,41 @@ int ziplistTest(int argc, char **argv) {
         printf("SUCCESS\n\n");
     }
 
+    printf("Cascade update:\n");
+    {
+        char data[600];
+        zlentry e[6];
+        memset(data,'x',sizeof(data));
+
+        /* Entries of 250 bytes take 253 bytes with a 1 byte "prevlen": a
+         * larger head makes all of them grow, up to the tail. */
+        zl = ziplistNew();
+        for (int i = 0; i < 4; i++)
+            zl = ziplistPush(zl,(unsigned char*)data,250,ZIPLIST_TAIL);
+        zl = ziplistPush(zl,(unsigned char*)data,300,ZIPLIST_HEAD);
+        verify(zl,e);
+        assert(e[1].prevrawlensize == 5 && e[1].prevrawlen == 303);
+        for (int i = 2; i < 5; i++)
+            assert(e[i].prevrawlensize == 5 && e[i].prevrawlen == 257);
+        zfree(zl);
+
+        /* The run stops at an entry that already has a 5 bytes "prevlen",
+         * before the tail. */
+        zl = ziplistNew();
+        zl = ziplistPush(zl,(unsigned char*)data,250,ZIPLIST_TAIL);
+        zl = ziplistPush(zl,(unsigned char*)data,250,ZIPLIST_TAIL);
+        zl = ziplistPush(zl,(unsigned char*)data,600,ZIPLIST_TAIL);
+        zl = ziplistPush(zl,(unsigned char*)data,250,ZIPLIST_TAIL);
+        zl = ziplistPush(zl,(unsigned char*)"tail",4,ZIPLIST_TAIL);
+        zl = ziplistPush(zl,(unsigned char*)data,300,ZIPLIST_HEAD);
+        verify(zl,e);
+        assert(e[3].prevrawlen == 257 && e[4].prevrawlen == 607);
+        assert(e[5].prevrawlen == 257);
+        assert(ziplistCompare(ziplistIndex(zl,-1),(unsigned char*)"tail",4));
+        zfree(zl);
+        printf("SUCCESS\n\n");
+    }
+
     printf("Stress with variable ziplist size:\n");
     {
         stress(ZIPLIST_HEAD,100000,16384,256);
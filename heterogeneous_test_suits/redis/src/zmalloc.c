@@ -28,6 +28,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "fmacros.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -71,21 +72,48 @@ void zlibc_free(void *ptr) {
 #define dallocx(ptr,flags) je_dallocx(ptr,flags)
 #endif
 
-#define update_zmalloc_stat_alloc(__n) do { \
-    size_t _n = (__n); \
-    if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
-    atomicIncr(used_memory,__n); \
-} while(0)
-
-#define update_zmalloc_stat_free(__n) do { \
-    size_t _n = (__n); \
-    if (_n&(sizeof(long)-1)) _n += sizeof(long)-(_n&(sizeof(long)-1)); \
-    atomicDecr(used_memory,__n); \
-} while(0)
+/* The used memory is accounted per thread: every thread that allocates gets
+ * a slot of its own the first time it does, and only ever writes to that
+ * slot, so allocating and freeing need no atomic operation and no cache line
+ * (or, under Popcorn, no DSM page) is written by more than one thread.
+ * zmalloc_used_memory() sums the slots. Memory freed by another thread than
+ * the one that allocated it makes single slots wrap around, the sum is
+ * right anyway. Threads past ZMALLOC_THREAD_SLOTS share 'used_memory',
+ * updated atomically as before. The slot of a thread that exits is never
+ * reused: it still holds the memory that thread allocated. */
+#define ZMALLOC_THREAD_SLOTS 32
+#define ZMALLOC_SLOT_SIZE 4096 /* A page, the unit of sharing of the DSM. */
+
+typedef union zmallocThreadSlot {
+    volatile size_t used;
+    char padding[ZMALLOC_SLOT_SIZE];
+} zmallocThreadSlot;
+
+static zmallocThreadSlot used_memory_thread[ZMALLOC_THREAD_SLOTS]
+    __attribute__((aligned(ZMALLOC_SLOT_SIZE)));
+static int used_memory_slots = 0; /* Slots assigned so far. */
+pthread_mutex_t used_memory_slots_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int zmalloc_thread_slot = -1;
 
 static size_t used_memory = 0;
 pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static inline void zmallocStatUpdate(size_t n, int incr) {
+    if (zmalloc_thread_slot == -1)
+        atomicGetIncr(used_memory_slots,zmalloc_thread_slot,1);
+    if (zmalloc_thread_slot < ZMALLOC_THREAD_SLOTS) {
+        zmallocThreadSlot *slot = used_memory_thread+zmalloc_thread_slot;
+        if (incr) slot->used += n; else slot->used -= n;
+    } else if (incr) {
+        atomicIncr(used_memory,n);
+    } else {
+        atomicDecr(used_memory,n);
+    }
+}
+
+#define update_zmalloc_stat_alloc(__n) zmallocStatUpdate((__n),1)
+#define update_zmalloc_stat_free(__n) zmallocStatUpdate((__n),0)
+
 static void zmalloc_default_oom(size_t size) {
     fprintf(stderr, "zmalloc: Out of memory trying to allocate %zu bytes\n",
         size);
@@ -219,7 +247,12 @@ char *zstrdup(const char *s) {
 
 size_t zmalloc_used_memory(void) {
     size_t um;
+    int j, slots;
+
     atomicGet(used_memory,um);
+    atomicGet(used_memory_slots,slots);
+    if (slots > ZMALLOC_THREAD_SLOTS) slots = ZMALLOC_THREAD_SLOTS;
+    for (j = 0; j < slots; j++) um += used_memory_thread[j].used;
     return um;
 }
 
@@ -336,6 +369,159 @@ int zmalloc_get_allocator_info(size_t *allocated,
 }
 #endif
 
+/* Per thread arenas. A thread calling zmalloc_thread_arena_create() gets a
+ * jemalloc arena of its own: everything it allocates from then on comes from
+ * pages only that thread touches first, so the kernel (and under Popcorn the
+ * DSM) places them on the node the thread runs on, and the dataset of the
+ * main thread is never interleaved with the buffers of the background
+ * threads. The arenas are registered under a name to be reported by
+ * zmalloc_get_arena_info(). */
+#if defined(USE_JEMALLOC)
+#define ZMALLOC_MAX_ARENAS 64
+#define ZMALLOC_ARENA_NAME_LEN 16
+
+static struct {
+    char name[ZMALLOC_ARENA_NAME_LEN];
+    unsigned index;
+} zmalloc_arenas[ZMALLOC_MAX_ARENAS];
+static int zmalloc_arenas_num = 0;
+pthread_mutex_t zmalloc_arenas_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Create an arena and bind the calling thread to it. Returns 0 on success,
+ * -1 if jemalloc refused or too many arenas exist already. */
+int zmalloc_thread_arena_create(const char *name) {
+    unsigned arena;
+    size_t sz = sizeof(arena);
+    int slot;
+
+    pthread_mutex_lock(&zmalloc_arenas_mutex);
+    if (zmalloc_arenas_num == ZMALLOC_MAX_ARENAS ||
+        je_mallctl("arenas.create", &arena, &sz, NULL, 0) != 0)
+    {
+        pthread_mutex_unlock(&zmalloc_arenas_mutex);
+        return -1;
+    }
+    slot = zmalloc_arenas_num++;
+    snprintf(zmalloc_arenas[slot].name, ZMALLOC_ARENA_NAME_LEN, "%s", name);
+    zmalloc_arenas[slot].index = arena;
+    pthread_mutex_unlock(&zmalloc_arenas_mutex);
+    return je_mallctl("thread.arena", NULL, NULL, &arena, sizeof(arena)) ?
+           -1 : 0;
+}
+
+/* Fill the stats of the arena number 'j' (in creation order) and return 1,
+ * or return 0 if there is no such arena. The jemalloc stats are refreshed
+ * when j is 0, so a caller walking all the arenas gets a coherent view. */
+int zmalloc_get_arena_info(int j, const char **name, size_t *allocated,
+                           size_t *active, size_t *resident) {
+    char ctl[64];
+    size_t sz = sizeof(size_t), small = 0, large = 0, pactive = 0, page = 0;
+    unsigned arena;
+
+    pthread_mutex_lock(&zmalloc_arenas_mutex);
+    if (j >= zmalloc_arenas_num) {
+        pthread_mutex_unlock(&zmalloc_arenas_mutex);
+        return 0;
+    }
+    *name = zmalloc_arenas[j].name;
+    arena = zmalloc_arenas[j].index;
+    pthread_mutex_unlock(&zmalloc_arenas_mutex);
+
+    if (j == 0) {
+        uint64_t epoch = 1;
+        size_t esz = sizeof(epoch);
+        je_mallctl("epoch", &epoch, &esz, &epoch, esz);
+    }
+    *allocated = *active = *resident = 0;
+    snprintf(ctl, sizeof(ctl), "stats.arenas.%u.small.allocated", arena);
+    je_mallctl(ctl, &small, &sz, NULL, 0);
+    snprintf(ctl, sizeof(ctl), "stats.arenas.%u.large.allocated", arena);
+    je_mallctl(ctl, &large, &sz, NULL, 0);
+    snprintf(ctl, sizeof(ctl), "stats.arenas.%u.pactive", arena);
+    je_mallctl(ctl, &pactive, &sz, NULL, 0);
+    snprintf(ctl, sizeof(ctl), "stats.arenas.%u.resident", arena);
+    je_mallctl(ctl, resident, &sz, NULL, 0);
+    je_mallctl("arenas.page", &page, &sz, NULL, 0);
+    *allocated = small+large;
+    *active = pactive*page;
+    return 1;
+}
+#else
+int zmalloc_thread_arena_create(const char *name) {
+    ((void)name);
+    return -1;
+}
+
+int zmalloc_get_arena_info(int j, const char **name, size_t *allocated,
+                           size_t *active, size_t *resident) {
+    ((void)j); ((void)name); ((void)allocated); ((void)active);
+    ((void)resident);
+    return 0;
+}
+#endif
+
+/* Huge page allocations, for the few large and hot arrays (the hash tables of
+ * the keyspace) that are worth a TLB entry per 2MB instead of per 4KB,
+ * without asking transparent huge pages for the whole heap: the rest of the
+ * heap keeps small pages, so a fork child does not make every write to a
+ * value copy 2MB. Allocations of at least ZMALLOC_HUGE_PAGE_SIZE are mapped
+ * directly, aligned to a huge page, and advised MADV_HUGEPAGE if
+ * zmalloc_set_huge_advise() allows it; smaller ones go to zcalloc(). The
+ * caller passes the size back to zfree_huge(), which needs it to tell the
+ * two kinds apart, and must not use zmalloc_size() on them. */
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+static int zmalloc_huge_advise = 1;
+
+void zmalloc_set_huge_advise(int enable) {
+    zmalloc_huge_advise = enable;
+}
+
+static size_t zmalloc_huge_map_size(size_t size) {
+    return (size+ZMALLOC_HUGE_PAGE_SIZE-1) & ~((size_t)ZMALLOC_HUGE_PAGE_SIZE-1);
+}
+
+void *zcalloc_huge(size_t size) {
+#if defined(__linux__)
+    if (size >= ZMALLOC_HUGE_PAGE_SIZE) {
+        size_t mapsize = zmalloc_huge_map_size(size);
+        size_t lead, trail;
+        char *map, *ptr;
+
+        /* Map one huge page more, and unmap what is around the aligned
+         * region. */
+        map = mmap(NULL, mapsize+ZMALLOC_HUGE_PAGE_SIZE, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) zmalloc_oom_handler(size);
+        ptr = (char*)zmalloc_huge_map_size((size_t)map);
+        lead = ptr-map;
+        trail = ZMALLOC_HUGE_PAGE_SIZE-lead;
+        if (lead) munmap(map, lead);
+        if (trail) munmap(ptr+mapsize, trail);
+#ifdef MADV_HUGEPAGE
+        if (zmalloc_huge_advise) madvise(ptr, mapsize, MADV_HUGEPAGE);
+#endif
+        update_zmalloc_stat_alloc(mapsize);
+        return ptr;
+    }
+#endif
+    return zcalloc(size);
+}
+
+void zfree_huge(void *ptr, size_t size) {
+#if defined(__linux__)
+    if (ptr != NULL && size >= ZMALLOC_HUGE_PAGE_SIZE) {
+        size_t mapsize = zmalloc_huge_map_size(size);
+        munmap(ptr, mapsize);
+        update_zmalloc_stat_free(mapsize);
+        return;
+    }
+#endif
+    zfree(ptr);
+}
+
 /* Get the sum of the specified field (converted form kb to bytes) in
  * /proc/self/smaps. The field must be specified with trailing ":" as it
  * apperas in the smaps output.
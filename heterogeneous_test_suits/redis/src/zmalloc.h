@@ -90,6 +90,14 @@ size_t zmalloc_get_private_dirty(long pid);
 size_t zmalloc_get_smap_bytes_by_field(char *field, long pid);
 size_t zmalloc_get_memory_size(void);
 void zlibc_free(void *ptr);
+int zmalloc_thread_arena_create(const char *name);
+int zmalloc_get_arena_info(int j, const char **name, size_t *allocated,
+                           size_t *active, size_t *resident);
+
+#define ZMALLOC_HUGE_PAGE_SIZE (2*1024*1024)
+void *zcalloc_huge(size_t size);
+void zfree_huge(void *ptr, size_t size);
+void zmalloc_set_huge_advise(int enable);
 
 #ifdef HAVE_DEFRAG
 void zfree_no_tcache(void *ptr);
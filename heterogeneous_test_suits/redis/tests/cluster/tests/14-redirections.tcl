@@ -0,0 +1,78 @@
+# Check the redirections of single key, multi key and MULTI/EXEC requests,
+# on stable slots and on slots being migrated.
+
+source "../tests/includes/init-tests.tcl"
+
+test "Create a 2 nodes cluster" {
+    create_cluster 2 0
+}
+
+# Return the ID of the master serving 'key', the one that does not reply
+# with a redirection.
+proc key_master {key} {
+    for {set id 0} {$id < 2} {incr id} {
+        if {![catch {R $id exists $key}]} {return $id}
+    }
+    fail "No master serves $key"
+}
+
+set owner [key_master "{t}"]
+set other [expr {1-$owner}]
+set slot [R $owner cluster keyslot "{t}"]
+
+test "Single key commands are served or redirected with MOVED" {
+    assert_equal OK [R $owner set "{t}1" a]
+    catch {R $other get "{t}1"} err
+    assert_match "MOVED $slot *" $err
+}
+
+test "Commands with keys in different slots are rejected" {
+    catch {R $owner mset "{t}1" a "{u}1" b} err
+    assert_match "CROSSSLOT*" $err
+}
+
+test "EXEC checks the slots of all the queued commands" {
+    R $owner multi
+    R $owner set "{t}1" a
+    R $owner set "{t}2" b
+    assert_equal {OK OK} [R $owner exec]
+
+    # A key of another slot served by the same node: every command can be
+    # queued, the transaction as a whole is rejected.
+    for {set j 0} {1} {incr j} {
+        if {[R $owner cluster keyslot k$j] != $slot &&
+            [key_master k$j] == $owner} break
+    }
+    R $owner multi
+    R $owner set "{t}1" a
+    R $owner set k$j b
+    catch {R $owner exec} err
+    assert_match "CROSSSLOT*" $err
+}
+
+test "Missing keys of a migrating slot are redirected with ASK" {
+    set owner_id [dict get [get_myself $owner] id]
+    set other_id [dict get [get_myself $other] id]
+    R $owner cluster setslot $slot migrating $other_id
+    R $other cluster setslot $slot importing $owner_id
+
+    assert_equal a [R $owner get "{t}1"]
+    catch {R $owner get "{t}missing"} err
+    assert_match "ASK $slot *" $err
+
+    catch {R $other get "{t}missing"} err
+    assert_match "MOVED $slot *" $err
+    R $other asking
+    assert_equal {} [R $other get "{t}missing"]
+    R $other asking
+    catch {R $other mget "{t}1" "{t}missing"} err
+    assert_match "TRYAGAIN*" $err
+}
+
+test "Requests are served again once the slot is stable" {
+    R $owner cluster setslot $slot stable
+    R $other cluster setslot $slot stable
+    assert_equal {a {}} [R $owner mget "{t}1" "{t}missing"]
+    catch {R $other get "{t}1"} err
+    assert_match "MOVED $slot *" $err
+}
@@ -257,4 +257,94 @@ tags {"aof"} {
             r expire x -1
         }
     }
+
+    start_server {overrides {appendonly {yes} appendfilename {appendonly.aof} appendfsync {always} aof-group-commit {yes}}} {
+        test {AOF group commit replies in order once the writes are fsynced} {
+            set clients {}
+            for {set j 0} {$j < 10} {incr j} {
+                set rd [redis_deferring_client]
+                for {set i 0} {$i < 100} {incr i} {
+                    $rd incr counter:$j
+                    $rd get counter:$j
+                }
+                lappend clients $rd
+            }
+            foreach rd $clients {
+                for {set i 1} {$i <= 100} {incr i} {
+                    assert_equal $i [$rd read]
+                    assert_equal $i [$rd read]
+                }
+                $rd close
+            }
+            assert_equal 0 [s aof_fsync_waiting_clients]
+            set digest [r debug digest]
+            r debug loadaof
+            assert_equal $digest [r debug digest]
+        }
+    }
+
+    ## A rewrite turns the AOF into a base and an incremental file, listed in
+    ## the manifest. The next rewrite replaces both.
+    set mp_path [tmpdir server.multipart.aof]
+    set mp_overrides [list dir $mp_path appendonly yes \
+        appendfilename appendonly.aof auto-aof-rewrite-percentage 0]
+
+    proc read_manifest {path} {
+        set fp [open [file join $path appendonly.aof.manifest] r]
+        set content [read $fp]
+        close $fp
+        set _ $content
+    }
+
+    start_server [list overrides $mp_overrides] {
+        test {AOF rewrite writes a base and an incremental file} {
+            for {set j 0} {$j < 100} {incr j} {r set key:$j $j}
+            r bgrewriteaof
+            waitForBgrewriteaof r
+            for {set j 0} {$j < 100} {incr j} {r incr key:$j}
+            assert_match {*base "appendonly.aof.2.base.rdb"*incr "appendonly.aof.1.incr.aof"*} \
+                [read_manifest $mp_path]
+            assert {![file exists [file join $mp_path appendonly.aof]]}
+            assert_equal 1 [s aof_incr_files]
+            set digest [r debug digest]
+            r debug loadaof
+            assert_equal $digest [r debug digest]
+        }
+
+        test {AOF rewrite removes the files of the previous base} {
+            r config set aof-use-rdb-preamble no
+            r bgrewriteaof
+            waitForBgrewriteaof r
+            r del key:0
+            assert_match {*base "appendonly.aof.4.base.aof"*incr "appendonly.aof.3.incr.aof"*} \
+                [read_manifest $mp_path]
+            assert {![file exists [file join $mp_path appendonly.aof.1.incr.aof]]}
+            assert {![file exists [file join $mp_path appendonly.aof.2.base.rdb]]}
+            set digest [r debug digest]
+            r debug loadaof
+            assert_equal $digest [r debug digest]
+        }
+    }
+
+    start_server [list overrides $mp_overrides] {
+        test {The base and incremental files are loaded at startup} {
+            assert_equal 99 [r dbsize]
+            assert_equal 2 [r get key:1]
+            assert_equal $digest [r debug digest]
+        }
+    }
+
+    start_server [list overrides [list dir [tmpdir server.multipart.aof]]] {
+        test {Turning on AOF writes the incremental file from the rewrite start} {
+            r set foo bar
+            r config set appendonly yes
+            r set bar foo
+            waitForBgrewriteaof r
+            r set baz foo
+            assert_equal 1 [s aof_incr_files]
+            set digest [r debug digest]
+            r debug loadaof
+            assert_equal $digest [r debug digest]
+        }
+    }
 }
@@ -58,6 +58,116 @@ start_server [list overrides [list "dir" $server_path]] {
     }
 }
 
+start_server [list overrides [list "dir" [tmpdir "server.rdb-threads-test"]]] {
+    test {Test RDB saved with rdb-save-threads} {
+        r config set rdb-save-threads 4
+        createComplexDataset r 10000
+        for {set j 0} {$j < 1000} {incr j} {
+            r set volatile:$j $j ex 1000
+        }
+        r select 1
+        createComplexDataset r 1000
+        r select 9
+        set digest [r debug digest]
+        r debug reload
+        set newdigest [r debug digest]
+        assert {$digest eq $newdigest}
+    }
+
+    test {Test RDB loaded with rdb-load-threads} {
+        r config set rdb-save-threads 1
+        r config set rdb-load-threads 4
+        r xadd stream * f v
+        r xgroup create stream group 0
+        r xreadgroup group group consumer streams stream >
+        set digest [r debug digest]
+        r debug reload
+        set newdigest [r debug digest]
+        assert {$digest eq $newdigest}
+        assert_equal 1 [llength [r xpending stream group - + 10]]
+    }
+
+    test {redis-check-rdb checks the RDB with threads and with --fast} {
+        r save
+        set rdb [file join [lindex [r config get dir] 1] dump.rdb]
+        foreach opts {{--threads 3} {--fast --threads 3} {--threads 1}} {
+            set result [exec src/redis-check-rdb {*}$opts $rdb]
+            assert_match "*Checksum OK*RDB looks OK*" $result
+        }
+
+        # Flip a byte in the middle of a copy of the RDB.
+        set fp [open $rdb r]
+        fconfigure $fp -translation binary
+        set data [read $fp]
+        close $fp
+        set pos [expr {[string length $data]/2}]
+        binary scan [string index $data $pos] c byte
+        set data [string replace $data $pos $pos \
+            [binary format c [expr {$byte ^ 0x55}]]]
+        set fp [open $rdb.corrupted w]
+        fconfigure $fp -translation binary
+        puts -nonewline $fp $data
+        close $fp
+        foreach opts {{--threads 3} {--fast}} {
+            catch {exec src/redis-check-rdb {*}$opts $rdb.corrupted} result
+            assert_match "*RDB ERROR DETECTED*" $result
+        }
+        file delete $rdb.corrupted
+    }
+}
+
+set forkless_path [tmpdir "server.rdb-forkless-test"]
+
+start_server [list overrides [list "dir" $forkless_path]] {
+    test {Test BGSAVE with rdb-save-forkless} {
+        r config set rdb-save-forkless yes
+        r config set rdb-save-forkless-cpu 1
+        r config set dbfilename forkless.rdb
+        r debug populate 200000
+        for {set j 0} {$j < 1000} {incr j} {
+            r rpush list:$j a b c
+            r set volatile:$j $j ex 1000
+        }
+        r select 1
+        r debug populate 10000 db1
+        r select 2
+        r debug populate 10000 db2
+        r select 9
+        set digest [r debug digest]
+
+        # Modify the keys while the save is in progress: the file must have
+        # the dataset at the time BGSAVE was called.
+        r bgsave
+        for {set j 0} {$j < 1000} {incr j} {
+            r del key:[expr {$j*97}]
+            r set key:$j changed
+            r set new:$j $j
+            r lpush list:$j d
+            r expire key:[expr {$j+100000}] 100
+            r persist volatile:$j
+            r rename key:[expr {$j+150000}] renamed:$j
+        }
+        r select 1
+        r flushdb
+        r swapdb 9 2
+        r set key:1 changed
+        assert_equal 1 [s rdb_bgsave_in_progress]
+        wait_for_condition 500 100 {
+            [s rdb_bgsave_in_progress] == 0
+        } else {
+            fail "BGSAVE without fork did not terminate"
+        }
+        assert_equal ok [s rdb_last_bgsave_status]
+
+        # Load it as the RDB preamble of an AOF, DEBUG RELOAD would save a
+        # new RDB file first.
+        file copy [file join $forkless_path forkless.rdb] \
+            [file join $forkless_path appendonly.aof]
+        r debug loadaof
+        assert_equal $digest [r debug digest]
+    }
+}
+
 # Helper function to start a server and kill it, just to check the error
 # logged.
 set defaults {}
@@ -267,6 +267,111 @@ foreach dl {no yes} {
     }
 }
 
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    $master config set repl-diskless-sync yes
+    $master config set repl-diskless-sync-delay 1000
+    $master config set repl-diskless-sync-max-replicas 2
+    $master config set repl-diskless-compression no
+    for {set j 0} {$j < 1000} {incr j} {
+        $master set key:$j [string repeat x 100]
+    }
+    start_server {} {
+        set slave0 [srv 0 client]
+        start_server {} {
+            set slave1 [srv 0 client]
+            test "Diskless sync starts once repl-diskless-sync-max-replicas are waiting" {
+                $slave0 slaveof $master_host $master_port
+                $slave1 slaveof $master_host $master_port
+
+                # The delay is too long to expire: the transfer can only
+                # start because both the replicas are waiting.
+                wait_for_condition 100 100 {
+                    [lindex [$slave0 role] 3] eq {connected} &&
+                    [lindex [$slave1 role] 3] eq {connected}
+                } else {
+                    fail "Replicas not synchronized before the delay expired"
+                }
+                assert_equal [$master debug digest] [$slave0 debug digest]
+                assert_equal [$master debug digest] [$slave1 debug digest]
+            }
+
+            test "INFO replication reports the full sync transfer of every replica" {
+                # The replicas may be done loading before the master reaps
+                # the child that fed them.
+                wait_for_condition 50 100 {
+                    [regexp -all {state=online} [$master info replication]] == 2
+                } else {
+                    fail "Replicas not online from the point of view of the master"
+                }
+                set info [$master info replication]
+                assert {[regexp {slave0:[^\r]*sync_bytes=(\d+),sync_ms=(\d+)} $info - bytes0 ms0]}
+                assert {[regexp {slave1:[^\r]*sync_bytes=(\d+),sync_ms=(\d+)} $info - bytes1 ms1]}
+                # Both the replicas got the same uncompressed payload.
+                assert_equal $bytes0 $bytes1
+                assert {$bytes0 > 100000}
+                assert {$ms0 > 0 && $ms1 > 0}
+            }
+        }
+    }
+}
+
+start_server {tags {"repl"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    start_server {} {
+        set slave0 [srv 0 client]
+        set slave0_pid [srv 0 pid]
+        start_server {} {
+            set slave1 [srv 0 client]
+            set slave1_pid [srv 0 pid]
+            test "Replicas share the replication buffer of the master" {
+                $slave0 slaveof $master_host $master_port
+                $slave1 slaveof $master_host $master_port
+                wait_for_condition 50 100 {
+                    [regexp -all {state=online} [$master info replication]] == 2
+                } else {
+                    fail "Replicas not online"
+                }
+
+                # Stop both the replicas, so that the stream accumulates on
+                # the master. The writes of the script are replicated one by
+                # one.
+                exec kill -SIGSTOP $slave0_pid
+                exec kill -SIGSTOP $slave1_pid
+                $master eval {
+                    redis.replicate_commands()
+                    local payload = string.rep('x',100000)
+                    for j=1,1000 do redis.call('set','key',payload) end
+                } 0
+
+                # Every replica has the whole stream to send, but the stream
+                # is held only once.
+                set omem {}
+                foreach line [split [$master client list type replica] "\n"] {
+                    if {[regexp {omem=(\d+)} $line - m]} {lappend omem $m}
+                }
+                assert_equal 2 [llength $omem]
+                set omem_max [lindex [lsort -integer $omem] end]
+                assert {$omem_max > 20000000}
+                assert {[s -2 mem_clients_slaves] <= $omem_max}
+
+                exec kill -SIGCONT $slave0_pid
+                exec kill -SIGCONT $slave1_pid
+                wait_for_condition 50 100 {
+                    [$master debug digest] eq [$slave0 debug digest] &&
+                    [$master debug digest] eq [$slave1 debug digest]
+                } else {
+                    fail "Replicas not consistent after the stream was sent"
+                }
+            }
+        }
+    }
+}
+
 start_server {tags {"repl"}} {
     set master [srv 0 client]
     set master_host [srv 0 host]
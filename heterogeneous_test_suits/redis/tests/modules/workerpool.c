@@ -0,0 +1,58 @@
+#define _POSIX_C_SOURCE 199309L
+#define REDISMODULE_EXPERIMENTAL_API
+#include "redismodule.h"
+
+#include <time.h>
+
+/* Runs in a worker: sleep while holding the key, then reply with the
+ * length of its string value. */
+static void WorkerPool_StrlenJob(RedisModuleCtx *ctx, RedisModuleKey **keys, int numkeys, void *privdata)
+{
+    long long *delay = privdata;
+    struct timespec ts = { *delay / 1000, (*delay % 1000) * 1000000 };
+    size_t len = 0;
+
+    (void) numkeys;
+
+    nanosleep(&ts, NULL);
+    if (keys[0] && RedisModule_KeyType(keys[0]) == REDISMODULE_KEYTYPE_STRING)
+        RedisModule_StringDMA(keys[0], &len, REDISMODULE_READ);
+    RedisModule_ReplyWithLongLong(ctx, len);
+}
+
+static void WorkerPool_FreeDelay(RedisModuleCtx *ctx, void *privdata)
+{
+    (void) ctx;
+    RedisModule_Free(privdata);
+}
+
+/* WP.STRLEN key delay-ms */
+int WorkerPool_StrlenCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    long long *delay;
+
+    if (argc != 3) return RedisModule_WrongArity(ctx);
+    delay = RedisModule_Alloc(sizeof(*delay));
+    if (RedisModule_StringToLongLong(argv[2], delay) != REDISMODULE_OK) {
+        RedisModule_Free(delay);
+        return RedisModule_ReplyWithError(ctx, "ERR invalid delay");
+    }
+    RedisModule_SubmitJob(ctx, argv+1, 1, REDISMODULE_READ,
+            WorkerPool_StrlenJob, NULL, WorkerPool_FreeDelay, delay);
+    return REDISMODULE_OK;
+}
+
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    (void) argv;
+    (void) argc;
+
+    if (RedisModule_Init(ctx,"workerpool",1,REDISMODULE_APIVER_1)
+            == REDISMODULE_ERR) return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"wp.strlen",
+                WorkerPool_StrlenCommand,"readonly",1,1,1) == REDISMODULE_ERR)
+            return REDISMODULE_ERR;
+
+    return REDISMODULE_OK;
+}
@@ -63,6 +63,7 @@ set ::all_tests {
     unit/lazyfree
     unit/wait
     unit/pendingquerybuf
+    unit/popcorn
 }
 # Index to the next test to run in the ::all_tests list.
 set ::next_test 0
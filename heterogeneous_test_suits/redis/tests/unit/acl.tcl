@@ -55,6 +55,20 @@ start_server {tags {"acl"}} {
         set e
     } {*NOPERM*key*}
 
+    test {Exact, prefix and glob key patterns are all honored} {
+        r ACL setuser newuser allcommands resetkeys ~k:a ~k:b* ~k:bc* \
+            ~k:ab* ~k:a?z ~k:\\*x ~k:*end
+        foreach key {k:a k:b k:bcd k:abz k:ab k:axz k:*x k:the_end} {
+            r SET $key v
+        }
+        set denied {}
+        foreach key {k:aa k:c k:ayyz k:ax k:endx k:B} {
+            if {[catch {r SET $key v} e]} {lappend denied $key}
+        }
+        r ACL setuser newuser allkeys; # Undo keys ACL
+        set denied
+    } {k:aa k:c k:ayyz k:ax k:endx k:B}
+
     test {Users can be configured to authenticate with any password} {
         r ACL setuser newuser nopass
         r AUTH newuser zipzapblabla
@@ -192,6 +192,25 @@ start_server {tags {"bitops"}} {
         }
     }
 
+    foreach op {and or xor} {
+        test "BITOP $op fuzzing with more than 16 long keys" {
+            for {set i 0} {$i < 3} {incr i} {
+                r flushall
+                set vec {}
+                set veckeys {}
+                set numvec [expr {[randomInt 8]+17}]
+                for {set j 0} {$j < $numvec} {incr j} {
+                    set str [randstring 300 700]
+                    lappend vec $str
+                    lappend veckeys vector_$j
+                    r set vector_$j $str
+                }
+                r bitop $op target {*}$veckeys
+                assert_equal [r get target] [simulate_bit_op $op {*}$vec]
+            }
+        }
+    }
+
     test {BITOP with integer encoded source objects} {
         r set a 1
         r set b 2
@@ -341,6 +341,34 @@ start_server {tags {"dump"}} {
         }
     }
 
+    test {MIGRATE with multiple keys: many small keys and large values} {
+        set first [srv 0 client]
+        r flushdb
+        set keys {}
+        for {set j 0} {$j < 2000} {incr j} {
+            r set key:$j [string repeat x 100]
+            lappend keys key:$j
+        }
+        r set big:1 [string repeat a 200000]
+        r rpush big:2 {*}[lrepeat 1000 [string repeat b 100]]
+        r set volatile foo px 100000
+        lappend keys big:1 big:2 volatile
+        start_server {tags {"repl"}} {
+            set second [srv 0 client]
+            set second_host [srv 0 host]
+            set second_port [srv 0 port]
+
+            set ret [r -1 migrate $second_host $second_port "" 9 5000 keys {*}$keys]
+            assert {$ret eq {OK}}
+            assert {[$first dbsize] == 0}
+            assert {[$second dbsize] == 2003}
+            assert {[$second get key:1999] eq [string repeat x 100]}
+            assert {[$second get big:1] eq [string repeat a 200000]}
+            assert {[$second llen big:2] == 1000}
+            assert {[$second pttl volatile] > 0}
+        }
+    }
+
     test {MIGRATE AUTH: correct and wrong password cases} {
         set first [srv 0 client]
         r del list
@@ -160,6 +160,55 @@ start_server {tags {"expire"}} {
         list $size1 $size2
     } {3 0}
 
+    test {Redis should actively expire keys with the expire index} {
+        r flushdb
+        r config set active-expire-index yes
+        for {set j 0} {$j < 1000} {incr j} {
+            r psetex key:$j 300 a
+        }
+        r psetex later 100000 a
+        r set persistent a
+        r pexpire persistent 300
+        r persist persistent
+        r set moved a
+        r pexpire moved 300
+        r pexpire moved 100000
+        set size1 [r dbsize]
+        wait_for_condition 50 100 {
+            [r dbsize] == 3
+        } else {
+            fail "keys not expired by the index"
+        }
+        set keys [lsort [r keys *]]
+        r config set active-expire-index no
+        list $size1 $keys
+    } {1003 {later moved persistent}}
+
+    test {Expire index follows FLUSHDB, SWAPDB and CONFIG SET} {
+        r flushall
+        r psetex a 200 a
+        r config set active-expire-index yes
+        r select 10
+        r psetex b 200 b
+        r swapdb 9 10
+        r flushdb async
+        r psetex c 200 c
+        r select 9
+        wait_for_condition 50 100 {
+            [r dbsize] == 0
+        } else {
+            fail "keys not expired by the index"
+        }
+        r select 10
+        wait_for_condition 50 100 {
+            [r dbsize] == 0
+        } else {
+            fail "keys not expired by the index"
+        }
+        r select 9
+        r config set active-expire-index no
+    } {OK}
+
     test {Redis should lazy expire keys} {
         r flushdb
         r debug set-active-expire 0
@@ -115,6 +115,12 @@ start_server {tags {"geo"}} {
         llength [r GEORADIUS users 0 0 50000 km WITHCOORD]
     } {1}
 
+    test {GEORADIUS across the antimeridian} {
+        r del dateline
+        r geoadd dateline 179.999 0 east -179.999 0 west 170 0 far
+        lsort [r georadius dateline 179.9995 0 1 km]
+    } {east west}
+
     test {GEORADIUSBYMEMBER simple (sorted)} {
         r georadiusbymember nyc "wtc one" 7 km
     } {{wtc one} {union square} {central park n/q/r} 4545 {lic market}}
@@ -194,6 +194,41 @@ start_server {tags {"hll"}} {
         assert {$err < (double($card)/100)*5}
     }
 
+    test {PFCOUNT / PFMERGE give the same results with and without hll-simd} {
+        r del hll1 hll2 hll3 hll4 full
+        for {set j 1} {$j <= 4} {incr j} {
+            set elements {}
+            for {set x 0} {$x < [expr {$j == 4 ? 100 : 20000}]} {incr x} {
+                lappend elements [randomInt 1000000]
+            }
+            r pfadd hll$j {*}$elements
+        }
+        assert_equal [r pfdebug encoding hll1] dense
+        assert_equal [r pfdebug encoding hll4] sparse
+        # Every register set to the maximum value of 63.
+        r set full [r get hll1]
+        r setrange full 16 [string repeat "\xff" 12288]
+
+        set results {}
+        foreach simd {no yes} {
+            r config set hll-simd $simd
+            set res {}
+            lappend res [r pfcount hll1 hll2 hll3 hll4]
+            r del dest
+            r pfmerge dest hll1 hll4
+            lappend res [r pfcount dest] [r pfdebug getreg dest]
+            r pfmerge dest hll2 hll3
+            lappend res [r pfcount dest] [r pfdebug getreg dest]
+            r del dest
+            r pfmerge dest hll1 full
+            lappend res [r pfdebug getreg dest]
+            lappend results $res
+        }
+        r config set hll-simd yes
+        assert_equal [lindex $results 0] [lindex $results 1]
+        assert_equal [lindex $results 1 5] [lrepeat 16384 63]
+    }
+
     test {PFDEBUG GETREG returns the HyperLogLog raw registers} {
         r del hll
         r pfadd hll 1 2 3
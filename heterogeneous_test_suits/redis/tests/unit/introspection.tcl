@@ -3,6 +3,20 @@ start_server {tags {"introspection"}} {
         r client list
     } {*addr=*:* fd=* age=* idle=* flags=N db=9 sub=0 psub=0 multi=-1 qbuf=26 qbuf-free=* obl=0 oll=0 omem=0 events=r cmd=client*}
 
+    test {Idle clients give back their I/O buffers} {
+        set clients {}
+        for {set j 0} {$j < 100} {incr j} {
+            set rd [redis_deferring_client]
+            $rd ping
+            assert_equal PONG [$rd read]
+            lappend clients $rd
+        }
+        # An idle client only keeps an empty query buffer.
+        set idle [regexp -all {qbuf=0 qbuf-free=0 obl=0} [r client list]]
+        foreach rd $clients {$rd close}
+        assert {$idle >= 100}
+    }
+
     test {MONITOR can log executed commands} {
         set rd [redis_deferring_client]
         $rd monitor
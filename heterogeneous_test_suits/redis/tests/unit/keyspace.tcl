@@ -24,6 +24,17 @@ start_server {tags {"keyspace"}} {
         lsort [r keys *]
     } {foo_a foo_b foo_c key_x key_y key_z}
 
+    test {KEYS and SCAN MATCH with wildcards, classes and escapes} {
+        set keys [r keys *]
+        foreach pattern {*_? k*y_* *o*_[a-b] {foo_\a} {[fk]??_[xa]}
+                         *_*_* *a *c* ??? {[a-z]*[a-z]} {}} {
+            set expected [lsort [lsearch -all -inline -glob $keys $pattern]]
+            assert_equal $expected [lsort [r keys $pattern]]
+            assert_equal $expected \
+                [lsort [lindex [r scan 0 match $pattern count 100] 1]]
+        }
+    }
+
     test {DBSIZE} {
         r dbsize
     } {6}
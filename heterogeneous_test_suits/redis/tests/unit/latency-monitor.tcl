@@ -61,4 +61,52 @@ start_server {tags {"latency-monitor"}} {
         after 500
         assert_match {*expire-cycle*} [r latency latest]
     }
+
+    test {LATENCY HISTOGRAM counts all the events of a class} {
+        r config set latency-monitor-threshold 0
+        r latency reset
+        r bgsave
+        waitForBgsave r
+        after 300 ;# Let a few expire cycles run.
+        set h [r latency histogram fork expire-cycle unknown-event]
+        assert_equal {fork expire-cycle} [dict keys $h]
+        set total 0
+        foreach {bound count} [dict get $h fork] {incr total $count}
+        assert_equal 1 $total
+        assert {[llength [dict get $h expire-cycle]] > 0}
+    }
+}
+
+start_server {tags {"hotkeys"}} {
+    test {HOTKEYS TOP reports the most accessed keys} {
+        r config set hotkeys-sample-rate 100
+        r hotkeys reset
+        for {set j 0} {$j < 100} {incr j} {
+            r set hot $j
+            if {$j % 10 == 0} {r get cold:$j}
+        }
+        set top [r hotkeys top 1]
+        assert_equal 1 [llength $top]
+        lassign [lindex $top 0] key db count
+        assert_equal {hot 9 100} [list $key $db $count]
+        assert {[llength [r hotkeys top]] == 11}
+    }
+
+    test {HOTKEYS LATENCY reports the sampled commands} {
+        set reply [r hotkeys latency set unknown-command]
+        lassign [lindex $reply 0] name hist
+        assert_equal set $name
+        set total 0
+        foreach {bound count} $hist {incr total $count}
+        assert_equal 100 $total
+        assert_equal {unknown-command {}} [lindex $reply 1]
+    }
+
+    test {HOTKEYS RESET and sampling disabled} {
+        r config set hotkeys-sample-rate 0
+        r hotkeys reset
+        r set hot 1
+        assert_equal {} [r hotkeys top]
+        assert_equal {} [r hotkeys latency]
+    }
 }
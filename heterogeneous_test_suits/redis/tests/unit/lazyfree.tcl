@@ -36,4 +36,32 @@ start_server {tags {"lazyfree"}} {
             fail "Memory is not reclaimed by FLUSHDB ASYNC"
         }
     }
+
+    test "UNLINK of many medium objects in one pipeline is freed in background" {
+        r flushdb
+        set orig_mem [s used_memory]
+        set args {}
+        for {set i 0} {$i < 100} {incr i} {
+            lappend args $i
+        }
+        for {set j 0} {$j < 2000} {incr j} {
+            r sadd set:$j {*}$args
+        }
+        set peak_mem [s used_memory]
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 2000} {incr j} {
+            $rd unlink set:$j
+        }
+        for {set j 0} {$j < 2000} {incr j} {
+            assert_equal 1 [$rd read]
+        }
+        $rd close
+        assert_equal 0 [r dbsize]
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0 &&
+            [s used_memory] < $peak_mem
+        } else {
+            fail "Memory is not reclaimed by batched UNLINK"
+        }
+    }
 }
@@ -141,6 +141,41 @@ start_server {tags {"maxmemory"}} {
             }
         }
     }
+
+    foreach lazy {no yes} {
+        test "maxmemory - eviction in batches (lazyfree-lazy-eviction $lazy)" {
+            r flushall
+            r config set lazyfree-lazy-eviction $lazy
+            r config set maxmemory-eviction-batch 64
+            set used [s used_memory]
+            set limit [expr {$used+200*1024}]
+            r config set maxmemory $limit
+            r config set maxmemory-policy allkeys-lru
+            set numkeys 0
+            while 1 {
+                r set "key:$numkeys" [string repeat x 100]
+                incr numkeys
+                if {[s used_memory]+4096 > $limit} break
+            }
+            # Every time the limit is crossed at least a full batch goes,
+            # so there are far fewer evicting writes than evicted keys.
+            set evicting 0
+            for {set j 0} {$j < $numkeys} {incr j} {
+                set before [s evicted_keys]
+                r set "foo:$j" [string repeat x 100]
+                set evicted [expr {[s evicted_keys]-$before}]
+                if {$evicted} {
+                    incr evicting
+                    assert {$evicted >= 64}
+                }
+            }
+            assert {$evicting > 0 && $evicting < $numkeys/32}
+            assert {[s used_memory] < ($limit+4096)}
+            r config set maxmemory-eviction-batch 1
+            r config set lazyfree-lazy-eviction no
+            r config set maxmemory 0
+        }
+    }
 }
 
 proc test_slave_buffers {test_name cmd_count payload_len limit_memory pipeline} {
@@ -36,6 +36,67 @@ start_server {tags {"memefficiency"}} {
     }
 }
 
+start_server {tags {"memefficiency"}} {
+    test "MEMORY ANALYZE aggregates the keys by type and prefix" {
+        r flushall
+        for {set j 0} {$j < 1000} {incr j} {
+            r set user:$j [string repeat x 100]
+            if {$j < 100} {r rpush queue:jobs:$j a b c}
+        }
+        r set noprefix 1
+        r memory analyze start threads 3
+        wait_for_condition 50 100 {
+            [dict get [r memory analyze result] status] eq {done}
+        } else {
+            fail "Memory analysis not terminated"
+        }
+        set res [r memory analyze result]
+        assert_equal 1101 [dict get $res keys]
+        set types [dict get $res types]
+        assert_equal 1001 [dict get [dict get $types string] keys]
+        assert_equal 100 [dict get [dict get $types list] keys]
+        set prefixes [dict get $res prefixes]
+        assert_equal {user 1000} [lrange [lindex $prefixes 0] 0 1]
+        assert {[lsearch -index 0 -exact $prefixes queue] != -1}
+        assert {[lsearch -index 0 -exact $prefixes {}] != -1}
+    }
+
+    test "MEMORY ANALYZE DEPTH keeps more key segments" {
+        r memory analyze start depth 2 separator :
+        wait_for_condition 50 100 {
+            [dict get [r memory analyze result] status] eq {done}
+        } else {
+            fail "Memory analysis not terminated"
+        }
+        set prefixes [dict get [r memory analyze result] prefixes]
+        set idx [lsearch -index 0 -exact $prefixes queue:jobs]
+        assert_equal 100 [lindex $prefixes $idx 1]
+    }
+
+    test "MEMORY ANALYZE refuses a bad separator" {
+        catch {r memory analyze start separator ::} e
+        set e
+    } {*one character*}
+}
+
+start_server {tags {"memefficiency"} overrides {jemalloc-thread-arenas yes hugepage-dict-tables yes}} {
+    test "Keyspace in huge page tables and per thread arenas" {
+        # 300k keys grow the main table past a huge page.
+        r debug populate 300000
+        r bgsave
+        r debug populate 400000 other
+        waitForBgsave r
+        assert_equal 700000 [r dbsize]
+        assert_equal {value:299999} [r get key:299999]
+        r flushall
+        assert_equal 0 [r dbsize]
+        if {[string match {*jemalloc*} [s mem_allocator]]} {
+            assert_match {*arena_main:allocated=*} [r info memory]
+            assert_match {*arena_bio0:*} [r info memory]
+        }
+    }
+}
+
 start_server {tags {"defrag"}} {
     if {[string match {*jemalloc*} [s mem_allocator]]} {
         test "Active defrag" {
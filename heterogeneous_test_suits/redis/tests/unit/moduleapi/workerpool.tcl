@@ -0,0 +1,79 @@
+set testmodule [file normalize tests/modules/workerpool.so]
+
+start_server {tags {"modules"}} {
+    r module load $testmodule
+
+    test {Worker pool job replies from the worker} {
+        r set foo abcd
+        r wp.strlen foo 0
+    } {4}
+
+    test {Commands on other keys run while a job holds its keys} {
+        set rd [redis_deferring_client]
+        r set foo abcd
+        $rd wp.strlen foo 500
+        after 100
+        set start [clock milliseconds]
+        r set bar 1
+        assert {[clock milliseconds]-$start < 300}
+        assert_equal 4 [$rd read]
+        $rd close
+    }
+
+    test {Commands on locked keys wait for the job} {
+        set rd [redis_deferring_client]
+        r set foo abcd
+        $rd wp.strlen foo 500
+        after 100
+        r set foo abcdef
+        # The job saw the value before the SET.
+        assert_equal 4 [$rd read]
+        assert_equal abcdef [r get foo]
+        $rd close
+    }
+
+    test {EXEC and FLUSHALL wait for the job} {
+        set rd [redis_deferring_client]
+        r set foo abcd
+        $rd wp.strlen foo 300
+        after 100
+        r multi
+        r append foo ef
+        assert_equal {6} [r exec]
+        assert_equal 4 [$rd read]
+
+        $rd wp.strlen foo 300
+        after 100
+        r flushall
+        assert_equal 6 [$rd read]
+        assert_equal 0 [r exists foo]
+        $rd close
+    }
+
+    test {CLIENT UNBLOCK drops a command waiting for a job} {
+        set rd [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        r set foo abcd
+        $rd wp.strlen foo 500
+        after 100
+        $rd2 client id
+        set id [$rd2 read]
+        $rd2 set foo abcdef
+        after 100
+        assert_equal 1 [r client unblock $id]
+        assert_equal {} [$rd2 read]
+        assert_equal 4 [$rd read]
+        assert_equal abcd [r get foo]
+        $rd close
+        $rd2 close
+    }
+
+    test {MODULE UNLOAD waits for the jobs} {
+        set rd [redis_deferring_client]
+        $rd wp.strlen foo 300
+        after 100
+        assert_equal OK [r module unload workerpool]
+        assert_equal 4 [$rd read]
+        $rd close
+    }
+}
@@ -253,6 +253,63 @@ start_server {tags {"multi"}} {
         r exec
     } {11}
 
+    test {A write to a key fails the EXEC of every client WATCHing it} {
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            set c [redis [srv 0 host] [srv 0 port]]
+            $c select 9
+            $c watch x
+            lappend clients $c
+        }
+        r set x 10
+        set res {}
+        foreach c $clients {
+            $c multi
+            $c ping
+            lappend res [$c exec]
+            $c close
+        }
+        lsort -unique $res
+    } {{}}
+
+    test {UNWATCH of a client does not unwatch the key for the others} {
+        set c [redis [srv 0 host] [srv 0 port]]
+        $c select 9
+        r watch x
+        $c watch x
+        $c unwatch
+        $c close
+        r set x 20
+        r multi
+        r ping
+        r exec
+    } {}
+
+    test {CLIENT LIST flags a client whose WATCHed key was touched} {
+        set c [redis [srv 0 host] [srv 0 port]]
+        $c select 9
+        $c client setname watcher
+        $c watch x
+        set before [regexp {name=watcher [^\n]*flags=d} [r client list]]
+        r set x 30
+        set after [regexp {name=watcher [^\n]*flags=d} [r client list]]
+        $c close
+        list $before $after
+    } {0 1}
+
+    test {MULTI with many queued commands, then a short one} {
+        r del mylist
+        r multi
+        for {set j 0} {$j < 200} {incr j} {
+            r rpush mylist $j
+        }
+        set res [r exec]
+        r multi
+        r llen mylist
+        r lindex mylist 199
+        list [llength $res] [lindex $res end] [r exec]
+    } {200 200 {200 199}}
+
     test {MULTI / EXEC is propagated correctly (single write command)} {
         set repl [attach_to_replication_stream]
         r multi
@@ -70,4 +70,45 @@ start_server {tags {"obuf-limits"}} {
         assert {$omem >= 100000 && $time_elapsed < 6}
         $rd1 close
     }
+
+    test {Reading stops while the output buffers are over the pause limit} {
+        r config set client-output-buffer-limit {normal 0 0 0}
+        r config set client-output-buffer-pause 200000
+        r set big [string repeat x 100000]
+        set rd1 [redis_deferring_client]
+
+        # Far more replies than the socket buffers hold, left unread.
+        for {set j 0} {$j < 1000} {incr j} {
+            $rd1 write "*2\r\n\$3\r\nget\r\n\$3\r\nbig\r\n"
+        }
+        $rd1 flush
+        wait_for_condition 50 100 {
+            [s read_paused_clients] == 1
+        } else {
+            fail "The client was not paused"
+        }
+        set clients [split [r client list] "\r\n"]
+        regexp {omem=([0-9]+)} [lindex $clients 1] - omem
+        assert {$omem < 400000}
+
+        # Reading the replies resumes the client, all are there.
+        for {set j 0} {$j < 1000} {incr j} {
+            assert_equal 100000 [string length [$rd1 read]]
+        }
+        assert_equal 0 [s read_paused_clients]
+        assert {[s client_read_pauses] > 0}
+        r config set client-output-buffer-pause 0
+        $rd1 close
+    }
+
+    test {INFO memory breaks down the clients by class} {
+        set rd1 [redis_deferring_client]
+        $rd1 subscribe foo
+        $rd1 read
+        set info [r info memory]
+        assert_match "*mem_clients_class_pubsub:clients=1,*" $info
+        assert_match "*mem_clients_class_normal:clients=*" $info
+        assert_match "*mem_clients_class_slave:clients=0,mem=0,obuf=0*" $info
+        $rd1 close
+    }
 }
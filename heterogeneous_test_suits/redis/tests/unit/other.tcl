@@ -246,3 +246,70 @@ start_server {tags {"other"}} {
         r save
     } {OK}
 }
+
+foreach shard {no yes} {
+    start_server [list tags {"other"} overrides [list io-threads 2 io-threads-do-reads yes io-threads-do-commands yes io-threads-shard-by-slot $shard]] {
+        test "Read only commands run by the I/O threads (shard by slot: $shard)" {
+            r flushall
+            for {set j 0} {$j < 100} {incr j} {
+                r set key:$j val:$j
+                r hset hash:$j field $j
+            }
+            r set longval [string repeat x 20000]
+            r set expired foo px 1
+            after 10
+            set clients {}
+            for {set i 0} {$i < 8} {incr i} {
+                set rd [redis_deferring_client]
+                lappend clients $rd
+            }
+            set err {}
+            for {set round 0} {$round < 10} {incr round} {
+                foreach rd $clients {
+                    for {set j 0} {$j < 100} {incr j} {
+                        $rd get key:$j
+                        $rd hget hash:$j field
+                    }
+                    $rd get longval
+                    $rd get expired
+                    $rd incr counter
+                }
+                foreach rd $clients {
+                    for {set j 0} {$j < 100} {incr j} {
+                        if {[$rd read] ne "val:$j" || [$rd read] ne $j} {
+                            set err "Wrong reply for key $j"
+                        }
+                    }
+                    if {[string length [$rd read]] != 20000} {
+                        set err "Wrong reply for longval"
+                    }
+                    if {[$rd read] ne {}} {set err "Expired key returned"}
+                    $rd read
+                }
+            }
+            foreach rd $clients {$rd close}
+            list $err [r get counter] [r exists expired]
+        } {{} 80 0}
+    }
+}
+
+start_server {tags {"other"} overrides {io-threads 2 io-threads-do-reads yes io-threads-spin 0}} {
+    test {Idle I/O threads park with io-threads-spin 0} {
+        set clients {}
+        for {set i 0} {$i < 8} {incr i} {
+            lappend clients [redis_deferring_client]
+        }
+        for {set round 0} {$round < 10} {incr round} {
+            foreach rd $clients {
+                for {set j 0} {$j < 10} {incr j} {$rd incr counter}
+            }
+            foreach rd $clients {
+                for {set j 0} {$j < 10} {incr j} {$rd read}
+            }
+        }
+        foreach rd $clients {$rd close}
+        set info [r info iothreads]
+        regexp {io_thread_1:.*parks=([0-9]+),spin_budget=([0-9]+)} $info - parks budget
+        list [r get counter] [expr {$parks > 0}] $budget
+    } {800 1 0}
+}
@@ -0,0 +1,171 @@
+proc write_popcorn_schedule {path lines} {
+    set fp [open $path w]
+    foreach line $lines {puts $fp $line}
+    close $fp
+}
+
+start_server {tags {"popcorn"}} {
+    set schedule [file normalize [tmpfile popcorn-schedule]]
+
+    test {popcorn-migrate-node picks the node by default} {
+        lindex [r config get popcorn-migrate-node] 1
+    } {-1}
+
+    test {CONFIG SET popcorn-migrate-node accepts -1 and node IDs only} {
+        r config set popcorn-migrate-node 1
+        r config set popcorn-migrate-node -1
+        catch {r config set popcorn-migrate-node -2} e
+        list [lindex [r config get popcorn-migrate-node] 1] $e
+    } {-1 *Invalid argument*}
+
+    test {popcorn-schedule is empty by default} {
+        lindex [r config get popcorn-schedule] 1
+    } {}
+
+    test {CONFIG SET popcorn-schedule loads the schedule} {
+        write_popcorn_schedule $schedule {
+            {# IO threads on the home node, bio threads offloaded}
+            {2 * 0}
+            {3 * 1}
+        }
+        r config set popcorn-schedule $schedule
+        lindex [r config get popcorn-schedule] 1
+    } $schedule
+
+    test {CONFIG SET popcorn-schedule rejects invalid schedules} {
+        write_popcorn_schedule $schedule {{2 * 0} {3 x 1}}
+        catch {r config set popcorn-schedule $schedule} e
+        set e
+    } {*Invalid line 2*}
+
+    test {CONFIG SET popcorn-schedule rejects missing files} {
+        catch {r config set popcorn-schedule $schedule.missing} e
+        list $e [lindex [r config get popcorn-schedule] 1]
+    } [list {*Can't load Popcorn schedule*} $schedule]
+
+    test {CONFIG SET popcorn-schedule to empty string drops the schedule} {
+        r config set popcorn-schedule ""
+        lindex [r config get popcorn-schedule] 1
+    } {}
+
+    test {INFO popcorn reports the migration counters} {
+        list [s popcorn_migrate_policy] [s popcorn_home_node] \
+             [string is integer [s popcorn_migrations]] \
+             [string match {migrations=*} [s popcorn_region_bio]]
+    } {always 0 1 1}
+
+    test {POPCORN POLICY returns and sets the migration policy} {
+        set old [r popcorn policy]
+        r popcorn policy adaptive
+        set new [r popcorn policy]
+        r popcorn policy $old
+        list $old $new [lindex [r config get popcorn-migrate-policy] 1]
+    } {always adaptive always}
+
+    test {POPCORN POLICY rejects unknown policies} {
+        catch {r popcorn policy sometimes} e
+        set e
+    } {*Invalid Popcorn migration policy*}
+
+    test {POPCORN STATS returns the counters} {
+        set stats [r popcorn stats]
+        list [dict get $stats policy] [dict exists $stats migrations] \
+             [dict exists [dict get $stats region.io_threads] migrations]
+    } {always 1 1}
+
+    test {CONFIG SET popcorn-cron-keyspace} {
+        set res {}
+        foreach v {release remote home} {
+            r config set popcorn-cron-keyspace $v
+            lappend res [lindex [r config get popcorn-cron-keyspace] 1]
+        }
+        catch {r config set popcorn-cron-keyspace away} e
+        lappend res $e
+    } {release remote home *Invalid argument*}
+
+    test {Keyspace cron tasks are deferred to the home node} {
+        r popcorn reset
+        after 300
+        set stats [r popcorn stats]
+        set databases [dict get $stats cron.databases]
+        set cstats [dict get $stats cron.stats]
+        list [dict get $stats cron.keyspace] \
+             [expr {[dict get $databases deferred] > 0}] \
+             [expr {[dict get $databases runs] > 0}] \
+             [dict get $databases remote.runs] \
+             [expr {[dict get $cstats remote.runs] > 0}] \
+             [string match {runs=*,remote_faults=*} [s popcorn_cron_clients]]
+    } {home 1 1 0 1 1}
+
+    test {Keyspace cron tasks run remotely with popcorn-cron-keyspace release} {
+        r config set popcorn-cron-keyspace release
+        r popcorn reset
+        after 300
+        set stats [r popcorn stats]
+        r config set popcorn-cron-keyspace home
+        list [expr {[dict get $stats cron.databases remote.runs] > 0}] \
+             [expr {[dict get $stats cron.clients deferred] > 0}]
+    } {1 1}
+
+    test {POPCORN RESET clears the counters} {
+        after 300
+        set before [dict get [r popcorn stats] remote.te.ticks]
+        r popcorn reset
+        set after [dict get [r popcorn stats] remote.te.ticks]
+        expr {$before > 1 && $after < $before}
+    } {1}
+}
+
+set schedule [file normalize [tmpfile popcorn-schedule]]
+write_popcorn_schedule $schedule {{2 * 0} {2 1 1} {3 * 1}}
+
+start_server [list tags {"popcorn"} overrides [list io-threads 2 popcorn-schedule $schedule]] {
+    test {Server loads popcorn-schedule at startup} {
+        lindex [r config get popcorn-schedule] 1
+    } $schedule
+
+    test {IO and bio threads serve requests under a schedule} {
+        r config set lazyfree-lazy-server-del yes
+        for {set j 0} {$j < 100} {incr j} {
+            r sadd myset $j
+        }
+        r set foo bar
+        r unlink myset
+        r get foo
+    } {bar}
+}
+
+start_server {tags {"popcorn"} overrides {popcorn-bio-node 1}} {
+    test {Bio threads leave for popcorn-bio-node at startup} {
+        wait_for_condition 50 100 {
+            [string match {migrations=4,*} [s popcorn_region_bio]]
+        } else {
+            fail "Bio threads did not migrate: [s popcorn_region_bio]"
+        }
+        list [lindex [r config get popcorn-bio-node] 1] [s popcorn_bio_node]
+    } {1 1}
+
+    test {CONFIG SET popcorn-bio-node accepts -1 and node IDs only} {
+        r config set popcorn-bio-node -1
+        catch {r config set popcorn-bio-node -2} e
+        list [lindex [r config get popcorn-bio-node] 1] $e
+    } {-1 *Invalid argument*}
+}
+
+start_server {tags {"popcorn"} overrides {io-threads 2 io-threads-node 1}} {
+    test {IO threads leave for io-threads-node at startup} {
+        wait_for_condition 50 100 {
+            [string match {migrations=2,*} [s popcorn_region_io_threads]]
+        } else {
+            fail "IO threads did not migrate: [s popcorn_region_io_threads]"
+        }
+        r set foo bar
+        list [r get foo] [s popcorn_io_threads_node]
+    } {bar 1}
+
+    test {CONFIG SET io-threads-node accepts -1 and node IDs only} {
+        r config set io-threads-node -1
+        catch {r config set io-threads-node -2} e
+        list [lindex [r config get io-threads-node] 1] $e
+    } {-1 *Invalid argument*}
+}
@@ -176,6 +176,58 @@ start_server {tags {"pubsub"}} {
         $rd2 close
     }
 
+    test "PUBLISH/PSUBSCRIBE with patterns sharing prefixes" {
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+
+        assert_equal {1 2 3 4} [psubscribe $rd1 {* ab* abc? a\\*}]
+        assert_equal {1 2} [psubscribe $rd2 {ab* x[yz]}]
+        assert_equal 3 [r publish ab hello]
+        assert_equal {pmessage * ab hello} [$rd1 read]
+        assert_equal {pmessage ab* ab hello} [$rd1 read]
+        assert_equal {pmessage ab* ab hello} [$rd2 read]
+        assert_equal 2 [r publish a* hello]
+        assert_equal 2 [r publish xz hello]
+        assert_equal {pmessage * a* hello} [$rd1 read]
+        assert_equal [list pmessage {a\*} a* hello] [$rd1 read]
+        assert_equal {pmessage * xz hello} [$rd1 read]
+        assert_equal [list pmessage {x[yz]} xz hello] [$rd2 read]
+
+        # A pattern stays indexed while a client is subscribed to it
+        assert_equal {1} [punsubscribe $rd2 {x[yz]}]
+        assert_equal 1 [r publish xy hello]
+        assert_equal {pmessage * xy hello} [$rd1 read]
+        assert_equal {0} [punsubscribe $rd2 {ab*}]
+        assert_equal 3 [r publish abcd hello]
+        assert_equal {pmessage * abcd hello} [$rd1 read]
+        assert_equal {pmessage ab* abcd hello} [$rd1 read]
+        assert_equal {pmessage abc? abcd hello} [$rd1 read]
+        assert_equal 4 [r pubsub numpat]
+
+        # clean up clients
+        $rd1 close
+        $rd2 close
+    }
+
+    test "PUBLISH/SUBSCRIBE delivers large messages to many clients" {
+        set clients {}
+        for {set j 0} {$j < 5} {incr j} {
+            set rd [redis_deferring_client]
+            assert_equal {1} [subscribe $rd {big}]
+            lappend clients $rd
+        }
+        set prd [redis_deferring_client]
+        assert_equal {1} [psubscribe $prd {b*}]
+        set payload [string repeat x 100000]
+        assert_equal 6 [r publish big $payload]
+        foreach rd $clients {
+            assert_equal [list message big $payload] [$rd read]
+            $rd close
+        }
+        assert_equal [list pmessage b* big $payload] [$prd read]
+        $prd close
+    }
+
     test "PUBLISH/PSUBSCRIBE after PUNSUBSCRIBE without arguments" {
         set rd1 [redis_deferring_client]
         assert_equal {1 2 3} [psubscribe $rd1 {chan1.* chan2.* chan3.*}]
@@ -111,6 +111,30 @@ start_server {tags {"scripting"}} {
         } 1 mykey
     } {boolean 1}
 
+    test {EVAL - Redis mixed replies -> Lua type conversion} {
+        r del mykey myzset myhash
+        r zadd myzset 1.5 a 2 b
+        r hset myhash f v
+        r eval {
+            local ok = redis.call('set',KEYS[1],'x')
+            local mget = redis.call('mget',KEYS[1],'nokey')
+            local zset = redis.call('zrange',KEYS[2],0,-1,'withscores')
+            local hash = redis.call('hgetall',KEYS[3])
+            local incr = redis.call('zincrby',KEYS[2],1,'a')
+            return {ok['ok'],mget[1],type(mget[2]),zset,hash,incr}
+        } 3 mykey myzset myhash
+    } {OK x boolean {a 1.5 b 2} {f v} 2.5}
+
+    test {EVAL - Redis reply partially built before a deferred length} {
+        r del mykey
+        r set mykey x
+        # SCAN replies with a cursor and then a deferred length array.
+        r eval {
+            local reply = redis.call('scan',0,'match','mykey')
+            return {type(reply[1]),reply[1],reply[2][1]}
+        } 0
+    } {string 0 mykey}
+
     test {EVAL - Is the Lua client using the currently selected DB?} {
         r set mykey "this is DB 9"
         r select 10
@@ -58,6 +58,29 @@ start_server {
         }
     }
 
+    test "Big list: SORT BY key with equal and negative weights" {
+        r del tosort
+        set tosort {}
+        for {set i 0} {$i < 2000} {incr i} {
+            set w [lindex {-1.5 -0 0 3 1e10 -1e10 7} [expr {$i % 7}]]
+            r rpush tosort $i
+            r set weight_$i $w
+            r hset wobj_$i weight $w
+            lappend tosort [list $i $w]
+        }
+        # Equal weights are sorted by the element, lexicographically.
+        set sorted [lsort -index 1 -real [lsort -index 0 -ascii $tosort]]
+        set result {}
+        foreach e $sorted {lappend result [lindex $e 0]}
+        assert_equal $result [r sort tosort BY weight_*]
+        assert_equal $result [r sort tosort BY wobj_*->weight]
+        set sorted [lsort -index 1 -real -decreasing \
+            [lsort -index 0 -ascii -decreasing $tosort]]
+        set result {}
+        foreach e $sorted {lappend result [lindex $e 0] [lindex $e 1]}
+        assert_equal $result [r sort tosort BY weight_* DESC GET # GET wobj_*->weight]
+    }
+
     set result [create_random_dataset 16 lpush]
     test "SORT GET #" {
         assert_equal [lsort -integer $result] [r sort tosort GET #]
@@ -516,6 +516,65 @@ start_server {tags {"hash"}} {
         }
     }
 
+    test {Integer hashes above the ziplist limits use the intmap encoding} {
+        r config set hash-max-ziplist-entries 32
+        r config set hash-max-intmap-entries 1000
+        r del myhash
+        array set counters {}
+        for {set i 0} {$i < 500} {incr i} {
+            set field [expr {[randomInt 100000]-50000}]
+            set incr [randomSignedInt 1000]
+            if {![info exists counters($field)]} {set counters($field) 0}
+            incr counters($field) $incr
+            assert_equal $counters($field) [r hincrby myhash $field $incr]
+        }
+        assert_encoding intmap myhash
+        assert_equal [array size counters] [r hlen myhash]
+        foreach field [array names counters] {
+            assert_equal $counters($field) [r hget myhash $field]
+            assert_equal [string length $counters($field)] \
+                [r hstrlen myhash $field]
+        }
+        assert_equal [lsort [array get counters]] [lsort [r hgetall myhash]]
+        set res [r hscan myhash 0 count 10]
+        assert_equal 0 [lindex $res 0]
+        assert_equal [lsort [array get counters]] [lsort [lindex $res 1]]
+
+        r debug reload
+        assert_encoding intmap myhash
+        assert_equal [lsort [array get counters]] [lsort [r hgetall myhash]]
+
+        set field [lindex [array names counters] 0]
+        assert_equal 1 [r hdel myhash $field]
+        assert_equal 0 [r hexists myhash $field]
+        assert_equal 0 [r hexists myhash foo]
+        assert_equal [expr {[array size counters]-1}] [r hlen myhash]
+    }
+
+    test {Intmap hashes convert to hashtable on strings or size} {
+        r config set hash-max-ziplist-entries 32
+        r config set hash-max-intmap-entries 100
+        r del myhash
+        for {set i 0} {$i < 64} {incr i} { r hset myhash $i $i }
+        assert_encoding intmap myhash
+        r hset myhash 64 foo
+        assert_encoding hashtable myhash
+        assert_equal foo [r hget myhash 64]
+        assert_equal 63 [r hget myhash 63]
+
+        r del myhash
+        for {set i 0} {$i < 64} {incr i} { r hset myhash $i $i }
+        r hincrbyfloat myhash 0 1.5
+        assert_encoding hashtable myhash
+        assert_equal 1.5 [r hget myhash 0]
+
+        r del myhash
+        for {set i 0} {$i < 101} {incr i} { r hset myhash $i $i }
+        assert_encoding hashtable myhash
+        assert_equal 101 [r hlen myhash]
+        r config set hash-max-intmap-entries 0
+    }
+
     # The following test can only be executed if we don't use Valgrind, and if
     # we are using x86_64 architecture, because:
     #
@@ -26,6 +26,33 @@ start_server {
         r ping ; # It's enough if the server is still alive
     } {PONG}
 
+    foreach codec {lzf lz4 zstd} {
+        # Skip the codecs that are not compiled in.
+        if {[catch {r config set list-compress-codec $codec}]} continue
+        r config set list-compress-codec lzf
+
+        foreach rdbcodec [lsort -unique [list $codec lzf]] {
+            test "Compressed list nodes survive DEBUG RELOAD - $codec, rdb $rdbcodec" {
+                r config set list-compress-codec $codec
+                r config set rdb-compression-codec $rdbcodec
+                r config set list-compress-depth 1
+                r del l
+                set expected {}
+                for {set j 0} {$j < 200} {incr j} {
+                    set ele "element:$j:[string repeat x 64]"
+                    r rpush l $ele
+                    lappend expected $ele
+                }
+                r debug reload
+                set res [r lrange l 0 -1]
+                r config set list-compress-depth 0
+                r config set list-compress-codec lzf
+                r config set rdb-compression-codec lzf
+                assert_equal $expected $res
+            }
+        }
+    }
+
     test {Stress tester for #3343-alike bugs} {
         r del key
         for {set j 0} {$j < 10000} {incr j} {
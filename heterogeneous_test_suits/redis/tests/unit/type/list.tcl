@@ -198,6 +198,43 @@ start_server {
         assert_equal [$rd read] {list2 b}
     }
 
+    test "BLPOP serves the remaining clients in FIFO order after some left" {
+        r del queue
+        set clients {}
+        for {set j 0} {$j < 20} {incr j} {
+            set rd [redis_deferring_client]
+            $rd blpop queue 0
+            lappend clients $rd
+            wait_for_condition 50 100 {
+                [s blocked_clients] == $j+1
+            } else {
+                fail "Client $j did not block"
+            }
+        }
+        # Leave the queue from its middle and its ends.
+        foreach j {0 5 6 11 19} {
+            [lindex $clients $j] close
+        }
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 15
+        } else {
+            fail "Clients did not leave the queue"
+        }
+        for {set j 0} {$j < 15} {incr j} {
+            r rpush queue $j
+        }
+        set served {}
+        set j 0
+        foreach rd $clients {
+            if {[lsearch -exact {0 5 6 11 19} $j] == -1} {
+                lappend served [lindex [$rd read] 1]
+                $rd close
+            }
+            incr j
+        }
+        set served
+    } {0 1 2 3 4 5 6 7 8 9 10 11 12 13 14}
+
     test "MULTI/EXEC is isolated from the point of view of BLPOP" {
         set rd [redis_deferring_client]
         r del list
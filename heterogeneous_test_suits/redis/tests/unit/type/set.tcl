@@ -273,6 +273,34 @@ start_server {
         lsort [r sinter set1 set2]
     } {1 2 3}
 
+    test "SINTER and SUNION of intsets with mixed encodings" {
+        r del set1 set2 setres
+        for {set i 0} {$i < 400} {incr i} {
+            r sadd set1 [expr {$i*3}]
+            r sadd set2 [expr {$i*5}]
+        }
+        r sadd set2 100000 5000000000
+        assert_encoding intset set1
+        assert_encoding intset set2
+        set inter {}
+        for {set i 0} {$i < 400*3} {incr i 15} { lappend inter $i }
+        assert_equal $inter [lsort -integer [r sinter set1 set2]]
+        assert_equal [llength $inter] [r sinterstore setres set1 set2]
+        assert_encoding intset setres
+        assert_equal 722 [llength [r sunion set1 set2]]
+    }
+
+    test "SUNIONSTORE of intsets over set-max-intset-entries converts" {
+        r del set1 set2 setres
+        for {set i 0} {$i < 300} {incr i} {
+            r sadd set1 $i
+            r sadd set2 [expr {$i+300}]
+        }
+        assert_equal 600 [r sunionstore setres set1 set2]
+        assert_encoding hashtable setres
+        assert_equal 1 [r sismember setres 599]
+    }
+
     test "SINTERSTORE against non existing keys should delete dstkey" {
         r set setres xxx
         assert_equal 0 [r sinterstore setres foo111 bar222]
@@ -93,6 +93,18 @@ start_server {
         assert {[r XACK mystream mygroup $id1 $id2] eq 1}
     }
 
+    test {XACK with an invalid ID acknowledges nothing} {
+        r del ackstream
+        r xadd ackstream 1-0 a 1
+        r xadd ackstream 2-0 a 2
+        r xgroup create ackstream g1 0
+        r xreadgroup group g1 c1 streams ackstream >
+        assert_error "*Invalid stream ID*" {r XACK ackstream g1 1-0 foo}
+        assert {[lindex [r XPENDING ackstream g1] 0] == 2}
+        assert {[r XACK ackstream g1 1-0 2-0 1-0] eq 2}
+        assert {[lindex [r XPENDING ackstream g1] 0] == 0}
+    }
+
     test {PEL NACK reassignment after XGROUP SETID event} {
         r del events
         r xadd events * f1 v1
@@ -238,6 +250,20 @@ start_server {
         assert {[lindex $reply 0 3] == 2}
     }
 
+    test {XCLAIM by the owner keeps the entry in its PEL} {
+        r del mystream
+        set id1 [r XADD mystream * a 1]
+        r XGROUP CREATE mystream mygroup 0
+        r XREADGROUP GROUP mygroup client1 STREAMS mystream >
+        r XCLAIM mystream mygroup client1 0 $id1 JUSTID
+        r XREADGROUP GROUP mygroup client1 STREAMS mystream 0
+        set reply [r XPENDING mystream mygroup - + 10 client1]
+        assert {[llength $reply] == 1}
+        assert {[lindex $reply 0 0] eq $id1}
+        assert {[r XACK mystream mygroup $id1] eq 1}
+        assert {[llength [r XPENDING mystream mygroup - + 10 client1]] == 0}
+    }
+
     start_server {} {
         set master [srv -1 client]
         set master_host [srv -1 host]
@@ -246,6 +246,24 @@ start_server {
         assert {[lindex $result 1 1 1] eq {value2}}
     }
 
+    test {XADD after the tail node was deleted or trimmed} {
+        r del somestream
+        r config set stream-node-max-entries 4
+        for {set j 0} {$j < 10} {incr j} {r xadd somestream * item $j}
+        # Empty the tail node, so that it gets removed.
+        foreach item [lrange [r xrange somestream - +] 8 9] {
+            r xdel somestream [lindex $item 0]
+        }
+        r xadd somestream * item 10
+        r xtrim somestream maxlen 1
+        r xadd somestream * item 11
+        set result [r xrange somestream - +]
+        r config set stream-node-max-entries 100
+        assert {[llength $result] == 2}
+        assert {[lindex $result 0 1 1] eq {10}}
+        assert {[lindex $result 1 1 1] eq {11}}
+    }
+
     # Here the idea is to check the consistency of the stream data structure
     # as we remove all the elements down to zero elements.
     test {XDEL fuzz test} {
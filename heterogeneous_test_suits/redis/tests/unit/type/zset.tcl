@@ -10,9 +10,15 @@ start_server {tags {"zset"}} {
         if {$encoding == "ziplist"} {
             r config set zset-max-ziplist-entries 128
             r config set zset-max-ziplist-value 64
+            r config set zset-btree no
         } elseif {$encoding == "skiplist"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-btree no
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-ziplist-entries 0
+            r config set zset-max-ziplist-value 0
+            r config set zset-btree yes
         } else {
             puts "Unknown sorted set encoding"
             exit
@@ -737,6 +743,8 @@ start_server {tags {"zset"}} {
 
     basics ziplist
     basics skiplist
+    basics btree
+    r config set zset-btree no
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
         r del seta setb setc
@@ -790,10 +798,17 @@ start_server {tags {"zset"}} {
             # Little extra to allow proper fuzzing in the sorting stresser
             r config set zset-max-ziplist-entries 256
             r config set zset-max-ziplist-value 64
+            r config set zset-btree no
             set elements 128
         } elseif {$encoding == "skiplist"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-btree no
+            if {$::accurate} {set elements 1000} else {set elements 100}
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-ziplist-entries 0
+            r config set zset-max-ziplist-value 0
+            r config set zset-btree yes
             if {$::accurate} {set elements 1000} else {set elements 100}
         } else {
             puts "Unknown sorted set encoding"
@@ -810,8 +825,10 @@ start_server {tags {"zset"}} {
             }
 
             assert_encoding $encoding zscoretest
+            # Scores are replied with the shortest digits that read back
+            # as the same double, Tcl formats them with 17 digits.
             for {set i 0} {$i < $elements} {incr i} {
-                assert_equal [lindex $aux $i] [r zscore zscoretest $i]
+                assert {[lindex $aux $i] == [r zscore zscoretest $i]}
             }
         }
 
@@ -826,8 +843,10 @@ start_server {tags {"zset"}} {
 
             r debug reload
             assert_encoding $encoding zscoretest
+            # Scores are replied with the shortest digits that read back
+            # as the same double, Tcl formats them with 17 digits.
             for {set i 0} {$i < $elements} {incr i} {
-                assert_equal [lindex $aux $i] [r zscore zscoretest $i]
+                assert {[lindex $aux $i] == [r zscore zscoretest $i]}
             }
         }
 
@@ -1200,6 +1219,70 @@ start_server {tags {"zset"}} {
     tags {"slow"} {
         stressers ziplist
         stressers skiplist
+        stressers btree
+        r config set zset-btree no
+    }
+
+    test {ZSET B+tree matches the skiplist with many elements} {
+        r config set zset-max-ziplist-entries 0
+        r del zbt zsl
+        r config set zset-btree yes
+        r zadd zbt 0 seed
+        r config set zset-btree no
+        r zadd zsl 0 seed
+        assert_encoding btree zbt
+        assert_encoding skiplist zsl
+
+        # Enough elements for a few levels of inner nodes, with deletions
+        # and score updates merging and splitting the nodes.
+        for {set j 0} {$j < 20000} {incr j} {
+            set ele [randomInt 8000]
+            set op [randomInt 10]
+            if {$op < 6} {
+                set score [randomInt 500]
+                r zadd zbt $score $ele
+                r zadd zsl $score $ele
+            } elseif {$op < 8} {
+                r zrem zbt $ele
+                r zrem zsl $ele
+            } else {
+                r zincrby zbt 1.5 $ele
+                r zincrby zsl 1.5 $ele
+            }
+        }
+        set min [randomInt 300]
+        set max [expr {$min+[randomInt 200]}]
+        r zremrangebyscore zbt $min [expr {$min+20}]
+        r zremrangebyscore zsl $min [expr {$min+20}]
+        r zremrangebyrank zbt 100 400
+        r zremrangebyrank zsl 100 400
+
+        assert_equal [r zcard zsl] [r zcard zbt]
+        assert_equal [r zrange zsl 0 -1 withscores] [r zrange zbt 0 -1 withscores]
+        assert_equal [r zrevrange zsl 10 500] [r zrevrange zbt 10 500]
+        assert_equal [r zcount zsl $min $max] [r zcount zbt $min $max]
+        assert_equal [r zrangebyscore zsl $min $max limit 50 100] \
+                     [r zrangebyscore zbt $min $max limit 50 100]
+        assert_equal [r zrevrangebyscore zsl $max $min limit 50 100] \
+                     [r zrevrangebyscore zbt $max $min limit 50 100]
+        for {set j 0} {$j < 200} {incr j} {
+            set ele [randomInt 8000]
+            assert_equal [r zrank zsl $ele] [r zrank zbt $ele]
+            assert_equal [r zrevrank zsl $ele] [r zrevrank zbt $ele]
+        }
+        assert_equal [r zpopmax zsl 5] [r zpopmax zbt 5]
+        assert_equal [r zpopmin zsl 5] [r zpopmin zbt 5]
+        assert_equal [r debug digest-value zsl] [r debug digest-value zbt]
+
+        r debug reload
+        assert_encoding skiplist zsl
+        assert_encoding skiplist zbt
+        r config set zset-btree yes
+        r debug reload
+        assert_encoding btree zbt
+        assert_equal [r zrange zsl 0 -1 withscores] [r zrange zbt 0 -1 withscores]
+        r config set zset-btree no
+        r config set zset-max-ziplist-entries 128
     }
 
     test {ZSET skiplist order consistency when elements are moved} {
@@ -0,0 +1,53 @@
+# hll-simd-bench.rb
+# BSD license, See the COPYING file for more information.
+#
+# Compare the speed of PFCOUNT and PFMERGE on dense HyperLogLogs with the
+# vector kernels ("hll-simd yes") and with the plain code ("hll-simd no").
+#
+# Usage: ruby hll-simd-bench.rb [keys] [elements per key] [iterations]
+
+require 'rubygems'
+require 'redis'
+
+numkeys = (ARGV[0] || 50).to_i
+numele = (ARGV[1] || 20000).to_i
+iterations = (ARGV[2] || 200).to_i
+
+r = Redis.new
+keys = (0...numkeys).map {|j| "hll-bench:#{j}"}
+r.del(keys)
+keys.each {|k|
+    numele.times.each_slice(1000) {|slice|
+        r.pfadd(k,slice.map {rand(1<<48)})
+    }
+}
+
+def bench(iterations)
+    start = Time.now
+    iterations.times { yield }
+    (Time.now-start)*1000000/iterations
+end
+
+cards = {}
+["no","yes"].each {|simd|
+    r.config("set","hll-simd",simd)
+    # PFCOUNT of a single key returns the cached cardinality, PFMERGE into
+    # another key first to invalidate it.
+    single = bench(iterations) {
+        r.pfmerge("hll-bench:one",keys[0])
+        r.pfcount("hll-bench:one")
+    }
+    multi = bench(iterations) { cards[simd] = r.pfcount(*keys) }
+    merge = bench(iterations) { r.pfmerge("hll-bench:dest",*keys) }
+    puts "hll-simd #{simd}: PFMERGE+PFCOUNT 1 key #{single.round} usec, " \
+         "PFCOUNT #{numkeys} keys #{multi.round} usec, " \
+         "PFMERGE #{numkeys} keys #{merge.round} usec"
+}
+r.config("set","hll-simd","yes")
+r.del(keys+["hll-bench:one","hll-bench:dest"])
+
+if cards["no"] != cards["yes"]
+    puts "Cardinality mismatch: #{cards["no"]} vs #{cards["yes"]}"
+    exit 1
+end
+puts "Cardinality of the union: #{cards["yes"]}"
@@ -38,6 +38,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "migrate.h"
+
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_nodes.h"
+#include "popcorn_grain.h"
+
+// Region ID for popcorn_profile.h
+#define BT_REGION_ADI 1
 #include "header.h"
 #include "timers.h"
 #include "print_results.h"
@@ -93,6 +100,7 @@ int main(int argc, char *argv[])
 {
   int i, niter, step;
   double navg, mflops, n3;
+  struct popcorn_grain grain;
 
   double tmax, t, trecs[t_last+1];
   logical verified;
@@ -146,6 +154,9 @@ int main(int argc, char *argv[])
   printf(" Size: %4dx%4dx%4d\n",
       grid_points[0], grid_points[1], grid_points[2]);
   printf(" Iterations: %4d    dt: %10.6f\n", niter, dt);
+  batch_init();
+  popcorn_grain_init(&grain, 1, niter, POPCORN_GRAIN_ITER);
+  popcorn_grain_print(&grain);
   printf("\n");
 
   if ( (grid_points[0] > IMAX) ||
@@ -182,9 +193,11 @@ int main(int argc, char *argv[])
       printf(" Time step %4d\n", step);
     }
 
-	migrate(1, NULL, NULL);
+    if (popcorn_grain_leave(&grain, step))
+      popcorn_migrate_best(BT_REGION_ADI);
     adi();
-	migrate(0, NULL, NULL);
+    if (popcorn_grain_return(&grain, step))
+      popcorn_migrate_home(BT_REGION_ADI);
   }
 
   timer_stop(1);
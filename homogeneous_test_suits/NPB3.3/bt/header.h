@@ -136,6 +136,13 @@ void matmul_sub(double ablock[5][5], double bblock[5][5], double cblock[5][5]);
 void binvcrhs(double lhs[5][5], double c[5][5], double r[5]);
 void binvrhs(double lhs[5][5], double r[5]);
 void z_solve();
+
+//-----------------------------------------------------------------------
+// Batched line solves (solve_batch.h)
+//-----------------------------------------------------------------------
+#define SOLVE_LANES 4
+extern logical solve_batched;
+void batch_init();
 void add();
 void error_norm(double rms[5]);
 void rhs_norm(double rms[5]);
@@ -0,0 +1,20 @@
+/* CLASS = C */
+/*
+   This file is generated automatically by the setparams utility.
+   It sets the number of processors and the class of the NPB
+   in this directory. Do not modify it by hand.   
+*/
+#define PROBLEM_SIZE   162
+#define NITER_DEFAULT  200
+#define DT_DEFAULT     0.0001
+
+#define CONVERTDOUBLE  false
+#define COMPILETIME "03 Nov 2017"
+#define NPBVERSION "3.3.1"
+#define CS1 "gcc"
+#define CS2 "$(CC)"
+#define CS3 "-lm"
+#define CS4 "-I../common"
+#define CS5 "-g -Wall -O3 -mcmodel=medium"
+#define CS6 "-O3 -mcmodel=medium"
+#define CS7 "randdp"
@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <math.h>
 #include "type.h"
+#include "popcorn_nodes.h"
 
+void timer_print_counters(void);
 
 void print_results(char *name, char class, int n1, int n2, int n3, int niter,
     double t, double mops, char *optype, logical verified, char *npbversion,
@@ -10,6 +12,8 @@ void print_results(char *name, char class, int n1, int n2, int n3, int niter,
 {
   char size[16];
   int j;
+  long migrations;
+  double migrate_time;
 
   printf( "\n\n %s Benchmark Completed.\n", name );
   printf( " Class           =             %12c\n", class );
@@ -46,6 +50,13 @@ void print_results(char *name, char class, int n1, int n2, int n3, int niter,
     printf( " Verification    =             %12s\n", "UNSUCCESSFUL" );
   printf( " Version         =             %12s\n", npbversion );
   printf( " Compile date    =             %12s\n", compiletime );
+
+  popcorn_nodes_stats( &migrations, &migrate_time );
+  printf( " Migrations      =             %12ld\n", migrations );
+  printf( " Migration time  =             %12.2lf\n", migrate_time );
+  printf( " Migration share =             %11.1lf%%\n",
+          t > 0.0 ? 100.0 * migrate_time / t : 0.0 );
+  timer_print_counters();
   
   printf( "\n Compile options:\n"
           "    CC           = %s\n", cs1 );
@@ -0,0 +1,66 @@
+//-------------------------------------------------------------------------//
+//                                                                         //
+//  This benchmark is a serial C version of the NPB BT code. This C        //
+//  version is developed by the Center for Manycore Programming at Seoul   //
+//  National University and derived from the serial Fortran versions in    //
+//  "NPB3.3-SER" developed by NAS.                                         //
+//                                                                         //
+//  Permission to use, copy, distribute and modify this software for any   //
+//  purpose with or without fee is hereby granted. This software is        //
+//  provided "as is" without express or implied warranty.                  //
+//                                                                         //
+//  Information on NPB 3.3, including the technical report, the original   //
+//  specifications, source code, results and information on how to submit  //
+//  new results, is available at:                                          //
+//                                                                         //
+//           http://www.nas.nasa.gov/Software/NPB/                         //
+//                                                                         //
+//  Send comments or suggestions for this C version to cmp@aces.snu.ac.kr  //
+//                                                                         //
+//          Center for Manycore Programming                                //
+//          School of Computer Science and Engineering                     //
+//          Seoul National University                                      //
+//          Seoul 151-744, Korea                                           //
+//                                                                         //
+//          E-mail:  cmp@aces.snu.ac.kr                                    //
+//                                                                         //
+//-------------------------------------------------------------------------//
+
+//-------------------------------------------------------------------------//
+// Authors: Sangmin Seo, Jungwon Kim, Jun Lee, Jeongho Nah, Gangwon Jo,    //
+//          and Jaejin Lee                                                 //
+//-------------------------------------------------------------------------//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+#include "solve_batch.h"
+
+/* common /work_batch/ */
+lanes_t fjacb[PROBLEM_SIZE+1][5][5];
+lanes_t njacb[PROBLEM_SIZE+1][5][5];
+lanes_t blhs [PROBLEM_SIZE+1][3][5][5];
+lanes_t brhs [PROBLEM_SIZE+1][5];
+lanes_t ub   [PROBLEM_SIZE+1][5];
+lanes_t rhob [PROBLEM_SIZE+1];
+lanes_t qsb  [PROBLEM_SIZE+1];
+lanes_t sqb  [PROBLEM_SIZE+1];
+
+logical solve_batched = true;
+
+
+//---------------------------------------------------------------------
+// Batched line solves (see solve_batch.h) unless BT_SOLVE=line
+//---------------------------------------------------------------------
+void batch_init()
+{
+  const char *env = getenv("BT_SOLVE");
+
+  solve_batched = env == NULL || strcmp(env, "line") != 0;
+  if (solve_batched) {
+    printf(" Line solves: batched, %d lanes\n", SOLVE_LANES);
+  } else {
+    printf(" Line solves: one line at a time\n");
+  }
+}
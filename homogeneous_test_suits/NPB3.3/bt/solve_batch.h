@@ -0,0 +1,249 @@
+//-------------------------------------------------------------------------//
+//                                                                         //
+//  This benchmark is a serial C version of the NPB BT code. This C        //
+//  version is developed by the Center for Manycore Programming at Seoul   //
+//  National University and derived from the serial Fortran versions in    //
+//  "NPB3.3-SER" developed by NAS.                                         //
+//                                                                         //
+//  Permission to use, copy, distribute and modify this software for any   //
+//  purpose with or without fee is hereby granted. This software is        //
+//  provided "as is" without express or implied warranty.                  //
+//                                                                         //
+//  Information on NPB 3.3, including the technical report, the original   //
+//  specifications, source code, results and information on how to submit  //
+//  new results, is available at:                                          //
+//                                                                         //
+//           http://www.nas.nasa.gov/Software/NPB/                         //
+//                                                                         //
+//  Send comments or suggestions for this C version to cmp@aces.snu.ac.kr  //
+//                                                                         //
+//          Center for Manycore Programming                                //
+//          School of Computer Science and Engineering                     //
+//          Seoul National University                                      //
+//          Seoul 151-744, Korea                                           //
+//                                                                         //
+//          E-mail:  cmp@aces.snu.ac.kr                                    //
+//                                                                         //
+//-------------------------------------------------------------------------//
+
+//-------------------------------------------------------------------------//
+// Authors: Sangmin Seo, Jungwon Kim, Jun Lee, Jeongho Nah, Gangwon Jo,    //
+//          and Jaejin Lee                                                 //
+//-------------------------------------------------------------------------//
+
+
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+// 
+// solve_batch.h
+// 
+// Batched line solves. In batched mode, x_solve(), y_solve() and
+// z_solve() take SOLVE_LANES lines at a time, one line per SIMD lane,
+// through the jacobians, the left hand side and the block tridiagonal
+// solve. Each lane goes through the operations of the line by line
+// code in their order (binvcrhs(), matvec_sub(), matmul_sub() and
+// binvrhs() for the solve), so the results are the same.
+//
+// The working copies are SoA: element [i][b][n][m] of the lhs of all
+// the lines of a batch is one vector. The vectors are GCC vector types,
+// so the same code is SSE2 or NEON at any optimization level, and AVX
+// in the *_avx() copies the solvers use when batch_avx() says the node
+// has it. That is checked for every batch: the thread can land on a
+// node without AVX.
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+
+typedef double lanes_t __attribute__((vector_size(SOLVE_LANES*sizeof(double))));
+
+#define LANES(x)         ((lanes_t){} + (x))
+#define BATCH_INLINE     static inline __attribute__((always_inline))
+
+// Offset of grid point (k, j, i) in the flattened [KMAX][JMAXP+1][IMAXP+1]
+// arrays
+#define BATCH_POINT(k, j, i) \
+  (((long)(k) * (JMAXP+1) + (j)) * (IMAXP+1) + (i))
+
+/* common /work_batch/ */
+extern lanes_t fjacb[PROBLEM_SIZE+1][5][5];
+extern lanes_t njacb[PROBLEM_SIZE+1][5][5];
+extern lanes_t blhs [PROBLEM_SIZE+1][3][5][5];
+extern lanes_t brhs [PROBLEM_SIZE+1][5];
+extern lanes_t ub   [PROBLEM_SIZE+1][5];
+extern lanes_t rhob [PROBLEM_SIZE+1];
+extern lanes_t qsb  [PROBLEM_SIZE+1];
+extern lanes_t sqb  [PROBLEM_SIZE+1];
+
+
+#if defined(__x86_64__)
+static inline int batch_avx()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx");
+}
+#endif
+
+
+//---------------------------------------------------------------------
+// Load the n lines starting at point p0, lstride points apart, with
+// pstride points between the points of a line; lanes past n repeat
+// the last line
+//---------------------------------------------------------------------
+BATCH_INLINE void batch_gather(long p0, long lstride, long pstride,
+                               int n, int size)
+{
+  int i, l, m;
+  long p;
+
+  for (i = 0; i <= size; i++) {
+    for (l = 0; l < SOLVE_LANES; l++) {
+      p = p0 + (l < n ? l : n-1) * lstride + i * pstride;
+      for (m = 0; m < 5; m++) {
+        ub[i][m][l] = (&u[0][0][0][0])[p*5+m];
+        brhs[i][m][l] = (&rhs[0][0][0][0])[p*5+m];
+      }
+      rhob[i][l] = (&rho_i[0][0][0])[p];
+      qsb[i][l] = (&qs[0][0][0])[p];
+      sqb[i][l] = (&square[0][0][0])[p];
+    }
+  }
+}
+
+
+//---------------------------------------------------------------------
+// Store the solutions of the n lines back in rhs
+//---------------------------------------------------------------------
+BATCH_INLINE void batch_scatter(long p0, long lstride, long pstride,
+                                int n, int size)
+{
+  int i, l, m;
+  long p;
+
+  for (i = 0; i <= size; i++) {
+    for (l = 0; l < n; l++) {
+      p = p0 + l * lstride + i * pstride;
+      for (m = 0; m < 5; m++) {
+        (&rhs[0][0][0][0])[p*5+m] = brhs[i][m][l];
+      }
+    }
+  }
+}
+
+
+//---------------------------------------------------------------------
+// lhsinit() on the lines of a batch
+//---------------------------------------------------------------------
+BATCH_INLINE void lhsinit_batch(int size)
+{
+  int i, b, m, n;
+
+  for (i = 0; i <= size; i += size) {
+    for (b = 0; b < 3; b++) {
+      for (n = 0; n < 5; n++) {
+        for (m = 0; m < 5; m++) {
+          blhs[i][b][n][m] = LANES(m == n && b == BB ? 1.0 : 0.0);
+        }
+      }
+    }
+  }
+}
+
+
+BATCH_INLINE void matvec_sub_batch(lanes_t ablock[5][5], lanes_t avec[5],
+                                   lanes_t bvec[5])
+{
+  int m;
+
+  for (m = 0; m < 5; m++) {
+    bvec[m] = bvec[m] - ablock[0][m]*avec[0]
+                      - ablock[1][m]*avec[1]
+                      - ablock[2][m]*avec[2]
+                      - ablock[3][m]*avec[3]
+                      - ablock[4][m]*avec[4];
+  }
+}
+
+
+BATCH_INLINE void matmul_sub_batch(lanes_t ablock[5][5], lanes_t bblock[5][5],
+                                   lanes_t cblock[5][5])
+{
+  int j, i;
+
+  for (j = 0; j < 5; j++) {
+    for (i = 0; i < 5; i++) {
+      cblock[j][i] = cblock[j][i] - ablock[0][i]*bblock[j][0]
+                                  - ablock[1][i]*bblock[j][1]
+                                  - ablock[2][i]*bblock[j][2]
+                                  - ablock[3][i]*bblock[j][3]
+                                  - ablock[4][i]*bblock[j][4];
+    }
+  }
+}
+
+
+//---------------------------------------------------------------------
+// binvcrhs(), or binvrhs() without c, with the pivots as loops
+//---------------------------------------------------------------------
+BATCH_INLINE void binvcrhs_batch(lanes_t lhs[5][5], lanes_t c[5][5],
+                                 lanes_t r[5], int with_c)
+{
+  lanes_t pivot, coeff;
+  int p, row, q;
+
+  for (p = 0; p < 5; p++) {
+    pivot = 1.00/lhs[p][p];
+    for (q = p+1; q < 5; q++) {
+      lhs[q][p] = lhs[q][p]*pivot;
+    }
+    if (with_c) {
+      for (q = 0; q < 5; q++) {
+        c[q][p] = c[q][p]*pivot;
+      }
+    }
+    r[p]   = r[p]  *pivot;
+
+    for (row = 0; row < 5; row++) {
+      if (row == p) continue;
+      coeff = lhs[p][row];
+      for (q = p+1; q < 5; q++) {
+        lhs[q][row]= lhs[q][row] - coeff*lhs[q][p];
+      }
+      if (with_c) {
+        for (q = 0; q < 5; q++) {
+          c[q][row] = c[q][row] - coeff*c[q][p];
+        }
+      }
+      r[row]   = r[row]   - coeff*r[p];
+    }
+  }
+}
+
+
+//---------------------------------------------------------------------
+// The gaussian elimination and back substitution of the lines of a
+// batch
+//---------------------------------------------------------------------
+BATCH_INLINE void batch_solve(int size)
+{
+  int i, m, n;
+
+  binvcrhs_batch( blhs[0][BB], blhs[0][CC], brhs[0], 1 );
+
+  for (i = 1; i <= size-1; i++) {
+    matvec_sub_batch(blhs[i][AA], brhs[i-1], brhs[i]);
+    matmul_sub_batch(blhs[i][AA], blhs[i-1][CC], blhs[i][BB]);
+    binvcrhs_batch( blhs[i][BB], blhs[i][CC], brhs[i], 1 );
+  }
+
+  matvec_sub_batch(blhs[size][AA], brhs[size-1], brhs[size]);
+  matmul_sub_batch(blhs[size][AA], blhs[size-1][CC], blhs[size][BB]);
+  binvcrhs_batch( blhs[size][BB], blhs[size][CC], brhs[size], 0 );
+
+  for (i = size-1; i >=0; i--) {
+    for (m = 0; m < BLOCK_SIZE; m++) {
+      for (n = 0; n < BLOCK_SIZE; n++) {
+        brhs[i][m] = brhs[i][m]
+          - blhs[i][CC][n][m]*brhs[i+1][n];
+      }
+    }
+  }
+}
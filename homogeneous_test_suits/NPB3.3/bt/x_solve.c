@@ -34,6 +34,294 @@
 #include "header.h"
 #include "work_lhs.h"
 #include "timers.h"
+#include "solve_batch.h"
+
+
+//---------------------------------------------------------------------
+// The a (labeled f) and n jacobians of the lines of a batch
+//---------------------------------------------------------------------
+BATCH_INLINE void x_jacobians_batch(int isize)
+{
+  lanes_t tmp1, tmp2, tmp3;
+  int i;
+
+  for (i = 0; i <= isize; i++) {
+    tmp1 = rhob[i];
+    tmp2 = tmp1 * tmp1;
+    tmp3 = tmp1 * tmp2;
+    //-------------------------------------------------------------------
+    // 
+    //-------------------------------------------------------------------
+    fjacb[i][0][0] = LANES(0.0);
+    fjacb[i][1][0] = LANES(1.0);
+    fjacb[i][2][0] = LANES(0.0);
+    fjacb[i][3][0] = LANES(0.0);
+    fjacb[i][4][0] = LANES(0.0);
+
+    fjacb[i][0][1] = -(ub[i][1] * tmp2 * ub[i][1])
+      + c2 * qsb[i];
+    fjacb[i][1][1] = ( 2.0 - c2 ) * ( ub[i][1] / ub[i][0] );
+    fjacb[i][2][1] = - c2 * ( ub[i][2] * tmp1 );
+    fjacb[i][3][1] = - c2 * ( ub[i][3] * tmp1 );
+    fjacb[i][4][1] = LANES(c2);
+
+    fjacb[i][0][2] = - ( ub[i][1]*ub[i][2] ) * tmp2;
+    fjacb[i][1][2] = ub[i][2] * tmp1;
+    fjacb[i][2][2] = ub[i][1] * tmp1;
+    fjacb[i][3][2] = LANES(0.0);
+    fjacb[i][4][2] = LANES(0.0);
+
+    fjacb[i][0][3] = - ( ub[i][1]*ub[i][3] ) * tmp2;
+    fjacb[i][1][3] = ub[i][3] * tmp1;
+    fjacb[i][2][3] = LANES(0.0);
+    fjacb[i][3][3] = ub[i][1] * tmp1;
+    fjacb[i][4][3] = LANES(0.0);
+
+    fjacb[i][0][4] = ( c2 * 2.0 * sqb[i] - c1 * ub[i][4] )
+      * ( ub[i][1] * tmp2 );
+    fjacb[i][1][4] = c1 *  ub[i][4] * tmp1 
+      - c2 * ( ub[i][1]*ub[i][1] * tmp2 + qsb[i] );
+    fjacb[i][2][4] = - c2 * ( ub[i][2]*ub[i][1] ) * tmp2;
+    fjacb[i][3][4] = - c2 * ( ub[i][3]*ub[i][1] ) * tmp2;
+    fjacb[i][4][4] = c1 * ( ub[i][1] * tmp1 );
+
+    njacb[i][0][0] = LANES(0.0);
+    njacb[i][1][0] = LANES(0.0);
+    njacb[i][2][0] = LANES(0.0);
+    njacb[i][3][0] = LANES(0.0);
+    njacb[i][4][0] = LANES(0.0);
+
+    njacb[i][0][1] = - con43 * c3c4 * tmp2 * ub[i][1];
+    njacb[i][1][1] =   con43 * c3c4 * tmp1;
+    njacb[i][2][1] = LANES(0.0);
+    njacb[i][3][1] = LANES(0.0);
+    njacb[i][4][1] = LANES(0.0);
+
+    njacb[i][0][2] = - c3c4 * tmp2 * ub[i][2];
+    njacb[i][1][2] = LANES(0.0);
+    njacb[i][2][2] =   c3c4 * tmp1;
+    njacb[i][3][2] = LANES(0.0);
+    njacb[i][4][2] = LANES(0.0);
+
+    njacb[i][0][3] = - c3c4 * tmp2 * ub[i][3];
+    njacb[i][1][3] = LANES(0.0);
+    njacb[i][2][3] = LANES(0.0);
+    njacb[i][3][3] =   c3c4 * tmp1;
+    njacb[i][4][3] = LANES(0.0);
+
+    njacb[i][0][4] = - ( con43 * c3c4
+        - c1345 ) * tmp3 * (ub[i][1]*ub[i][1])
+      - ( c3c4 - c1345 ) * tmp3 * (ub[i][2]*ub[i][2])
+      - ( c3c4 - c1345 ) * tmp3 * (ub[i][3]*ub[i][3])
+      - c1345 * tmp2 * ub[i][4];
+
+    njacb[i][1][4] = ( con43 * c3c4
+        - c1345 ) * tmp2 * ub[i][1];
+    njacb[i][2][4] = ( c3c4 - c1345 ) * tmp2 * ub[i][2];
+    njacb[i][3][4] = ( c3c4 - c1345 ) * tmp2 * ub[i][3];
+    njacb[i][4][4] = ( c1345 ) * tmp1;
+  }
+}
+
+
+//---------------------------------------------------------------------
+// The left hand side of the lines of a batch in x direction
+//---------------------------------------------------------------------
+BATCH_INLINE void x_lhs_batch(int isize)
+{
+  double tmp1, tmp2;
+  int i;
+
+  lhsinit_batch(isize);
+  for (i = 1; i <= isize-1; i++) {
+    tmp1 = dt * tx1;
+    tmp2 = dt * tx2;
+
+    blhs[i][AA][0][0] = - tmp2 * fjacb[i-1][0][0]
+      - tmp1 * njacb[i-1][0][0]
+      - tmp1 * dx1; 
+    blhs[i][AA][1][0] = - tmp2 * fjacb[i-1][1][0]
+      - tmp1 * njacb[i-1][1][0];
+    blhs[i][AA][2][0] = - tmp2 * fjacb[i-1][2][0]
+      - tmp1 * njacb[i-1][2][0];
+    blhs[i][AA][3][0] = - tmp2 * fjacb[i-1][3][0]
+      - tmp1 * njacb[i-1][3][0];
+    blhs[i][AA][4][0] = - tmp2 * fjacb[i-1][4][0]
+      - tmp1 * njacb[i-1][4][0];
+
+    blhs[i][AA][0][1] = - tmp2 * fjacb[i-1][0][1]
+      - tmp1 * njacb[i-1][0][1];
+    blhs[i][AA][1][1] = - tmp2 * fjacb[i-1][1][1]
+      - tmp1 * njacb[i-1][1][1]
+      - tmp1 * dx2;
+    blhs[i][AA][2][1] = - tmp2 * fjacb[i-1][2][1]
+      - tmp1 * njacb[i-1][2][1];
+    blhs[i][AA][3][1] = - tmp2 * fjacb[i-1][3][1]
+      - tmp1 * njacb[i-1][3][1];
+    blhs[i][AA][4][1] = - tmp2 * fjacb[i-1][4][1]
+      - tmp1 * njacb[i-1][4][1];
+
+    blhs[i][AA][0][2] = - tmp2 * fjacb[i-1][0][2]
+      - tmp1 * njacb[i-1][0][2];
+    blhs[i][AA][1][2] = - tmp2 * fjacb[i-1][1][2]
+      - tmp1 * njacb[i-1][1][2];
+    blhs[i][AA][2][2] = - tmp2 * fjacb[i-1][2][2]
+      - tmp1 * njacb[i-1][2][2]
+      - tmp1 * dx3;
+    blhs[i][AA][3][2] = - tmp2 * fjacb[i-1][3][2]
+      - tmp1 * njacb[i-1][3][2];
+    blhs[i][AA][4][2] = - tmp2 * fjacb[i-1][4][2]
+      - tmp1 * njacb[i-1][4][2];
+
+    blhs[i][AA][0][3] = - tmp2 * fjacb[i-1][0][3]
+      - tmp1 * njacb[i-1][0][3];
+    blhs[i][AA][1][3] = - tmp2 * fjacb[i-1][1][3]
+      - tmp1 * njacb[i-1][1][3];
+    blhs[i][AA][2][3] = - tmp2 * fjacb[i-1][2][3]
+      - tmp1 * njacb[i-1][2][3];
+    blhs[i][AA][3][3] = - tmp2 * fjacb[i-1][3][3]
+      - tmp1 * njacb[i-1][3][3]
+      - tmp1 * dx4;
+    blhs[i][AA][4][3] = - tmp2 * fjacb[i-1][4][3]
+      - tmp1 * njacb[i-1][4][3];
+
+    blhs[i][AA][0][4] = - tmp2 * fjacb[i-1][0][4]
+      - tmp1 * njacb[i-1][0][4];
+    blhs[i][AA][1][4] = - tmp2 * fjacb[i-1][1][4]
+      - tmp1 * njacb[i-1][1][4];
+    blhs[i][AA][2][4] = - tmp2 * fjacb[i-1][2][4]
+      - tmp1 * njacb[i-1][2][4];
+    blhs[i][AA][3][4] = - tmp2 * fjacb[i-1][3][4]
+      - tmp1 * njacb[i-1][3][4];
+    blhs[i][AA][4][4] = - tmp2 * fjacb[i-1][4][4]
+      - tmp1 * njacb[i-1][4][4]
+      - tmp1 * dx5;
+
+    blhs[i][BB][0][0] = 1.0
+      + tmp1 * 2.0 * njacb[i][0][0]
+      + tmp1 * 2.0 * dx1;
+    blhs[i][BB][1][0] = tmp1 * 2.0 * njacb[i][1][0];
+    blhs[i][BB][2][0] = tmp1 * 2.0 * njacb[i][2][0];
+    blhs[i][BB][3][0] = tmp1 * 2.0 * njacb[i][3][0];
+    blhs[i][BB][4][0] = tmp1 * 2.0 * njacb[i][4][0];
+
+    blhs[i][BB][0][1] = tmp1 * 2.0 * njacb[i][0][1];
+    blhs[i][BB][1][1] = 1.0
+      + tmp1 * 2.0 * njacb[i][1][1]
+      + tmp1 * 2.0 * dx2;
+    blhs[i][BB][2][1] = tmp1 * 2.0 * njacb[i][2][1];
+    blhs[i][BB][3][1] = tmp1 * 2.0 * njacb[i][3][1];
+    blhs[i][BB][4][1] = tmp1 * 2.0 * njacb[i][4][1];
+
+    blhs[i][BB][0][2] = tmp1 * 2.0 * njacb[i][0][2];
+    blhs[i][BB][1][2] = tmp1 * 2.0 * njacb[i][1][2];
+    blhs[i][BB][2][2] = 1.0
+      + tmp1 * 2.0 * njacb[i][2][2]
+      + tmp1 * 2.0 * dx3;
+    blhs[i][BB][3][2] = tmp1 * 2.0 * njacb[i][3][2];
+    blhs[i][BB][4][2] = tmp1 * 2.0 * njacb[i][4][2];
+
+    blhs[i][BB][0][3] = tmp1 * 2.0 * njacb[i][0][3];
+    blhs[i][BB][1][3] = tmp1 * 2.0 * njacb[i][1][3];
+    blhs[i][BB][2][3] = tmp1 * 2.0 * njacb[i][2][3];
+    blhs[i][BB][3][3] = 1.0
+      + tmp1 * 2.0 * njacb[i][3][3]
+      + tmp1 * 2.0 * dx4;
+    blhs[i][BB][4][3] = tmp1 * 2.0 * njacb[i][4][3];
+
+    blhs[i][BB][0][4] = tmp1 * 2.0 * njacb[i][0][4];
+    blhs[i][BB][1][4] = tmp1 * 2.0 * njacb[i][1][4];
+    blhs[i][BB][2][4] = tmp1 * 2.0 * njacb[i][2][4];
+    blhs[i][BB][3][4] = tmp1 * 2.0 * njacb[i][3][4];
+    blhs[i][BB][4][4] = 1.0
+      + tmp1 * 2.0 * njacb[i][4][4]
+      + tmp1 * 2.0 * dx5;
+
+    blhs[i][CC][0][0] =  tmp2 * fjacb[i+1][0][0]
+      - tmp1 * njacb[i+1][0][0]
+      - tmp1 * dx1;
+    blhs[i][CC][1][0] =  tmp2 * fjacb[i+1][1][0]
+      - tmp1 * njacb[i+1][1][0];
+    blhs[i][CC][2][0] =  tmp2 * fjacb[i+1][2][0]
+      - tmp1 * njacb[i+1][2][0];
+    blhs[i][CC][3][0] =  tmp2 * fjacb[i+1][3][0]
+      - tmp1 * njacb[i+1][3][0];
+    blhs[i][CC][4][0] =  tmp2 * fjacb[i+1][4][0]
+      - tmp1 * njacb[i+1][4][0];
+
+    blhs[i][CC][0][1] =  tmp2 * fjacb[i+1][0][1]
+      - tmp1 * njacb[i+1][0][1];
+    blhs[i][CC][1][1] =  tmp2 * fjacb[i+1][1][1]
+      - tmp1 * njacb[i+1][1][1]
+      - tmp1 * dx2;
+    blhs[i][CC][2][1] =  tmp2 * fjacb[i+1][2][1]
+      - tmp1 * njacb[i+1][2][1];
+    blhs[i][CC][3][1] =  tmp2 * fjacb[i+1][3][1]
+      - tmp1 * njacb[i+1][3][1];
+    blhs[i][CC][4][1] =  tmp2 * fjacb[i+1][4][1]
+      - tmp1 * njacb[i+1][4][1];
+
+    blhs[i][CC][0][2] =  tmp2 * fjacb[i+1][0][2]
+      - tmp1 * njacb[i+1][0][2];
+    blhs[i][CC][1][2] =  tmp2 * fjacb[i+1][1][2]
+      - tmp1 * njacb[i+1][1][2];
+    blhs[i][CC][2][2] =  tmp2 * fjacb[i+1][2][2]
+      - tmp1 * njacb[i+1][2][2]
+      - tmp1 * dx3;
+    blhs[i][CC][3][2] =  tmp2 * fjacb[i+1][3][2]
+      - tmp1 * njacb[i+1][3][2];
+    blhs[i][CC][4][2] =  tmp2 * fjacb[i+1][4][2]
+      - tmp1 * njacb[i+1][4][2];
+
+    blhs[i][CC][0][3] =  tmp2 * fjacb[i+1][0][3]
+      - tmp1 * njacb[i+1][0][3];
+    blhs[i][CC][1][3] =  tmp2 * fjacb[i+1][1][3]
+      - tmp1 * njacb[i+1][1][3];
+    blhs[i][CC][2][3] =  tmp2 * fjacb[i+1][2][3]
+      - tmp1 * njacb[i+1][2][3];
+    blhs[i][CC][3][3] =  tmp2 * fjacb[i+1][3][3]
+      - tmp1 * njacb[i+1][3][3]
+      - tmp1 * dx4;
+    blhs[i][CC][4][3] =  tmp2 * fjacb[i+1][4][3]
+      - tmp1 * njacb[i+1][4][3];
+
+    blhs[i][CC][0][4] =  tmp2 * fjacb[i+1][0][4]
+      - tmp1 * njacb[i+1][0][4];
+    blhs[i][CC][1][4] =  tmp2 * fjacb[i+1][1][4]
+      - tmp1 * njacb[i+1][1][4];
+    blhs[i][CC][2][4] =  tmp2 * fjacb[i+1][2][4]
+      - tmp1 * njacb[i+1][2][4];
+    blhs[i][CC][3][4] =  tmp2 * fjacb[i+1][3][4]
+      - tmp1 * njacb[i+1][3][4];
+    blhs[i][CC][4][4] =  tmp2 * fjacb[i+1][4][4]
+      - tmp1 * njacb[i+1][4][4]
+      - tmp1 * dx5;
+  }
+}
+
+//---------------------------------------------------------------------
+// x_solve() on the lines j0 to j0+n-1 of plane k, one line
+// per lane
+//---------------------------------------------------------------------
+BATCH_INLINE void x_solve_lanes(int k, int j0, int n, int isize)
+{
+  long p0 = BATCH_POINT(k, j0, 0);
+
+  batch_gather(p0, IMAXP+1, 1, n, isize);
+  x_jacobians_batch(isize);
+  x_lhs_batch(isize);
+  batch_solve(isize);
+  batch_scatter(p0, IMAXP+1, 1, n, isize);
+}
+
+
+#if defined(__x86_64__)
+__attribute__((target("avx")))
+static void x_solve_lanes_avx(int k, int j0, int n, int isize)
+{
+  x_solve_lanes(k, j0, n, isize);
+}
+#endif
 
 //---------------------------------------------------------------------
 // 
@@ -64,6 +352,27 @@ void x_solve()
 
   isize = grid_points[0]-1;
 
+  //---------------------------------------------------------------------
+  // batched mode: SOLVE_LANES lines at a time (see solve_batch.h)
+  //---------------------------------------------------------------------
+  if (solve_batched) {
+    for (k = 1; k <= grid_points[2]-2; k++) {
+      for (j = 1; j <= grid_points[1]-2; j += SOLVE_LANES) {
+        n = grid_points[1]-2 - j + 1;
+        if (n > SOLVE_LANES) n = SOLVE_LANES;
+#if defined(__x86_64__)
+        if (batch_avx()) {
+          x_solve_lanes_avx(k, j, n, isize);
+          continue;
+        }
+#endif
+        x_solve_lanes(k, j, n, isize);
+      }
+    }
+    if (timeron) timer_stop(t_xsolve);
+    return;
+  }
+
   //---------------------------------------------------------------------
   // determine a (labeled f) and n jacobians
   //---------------------------------------------------------------------
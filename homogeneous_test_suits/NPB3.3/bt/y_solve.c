@@ -34,6 +34,292 @@
 #include "header.h"
 #include "work_lhs.h"
 #include "timers.h"
+#include "solve_batch.h"
+
+
+//---------------------------------------------------------------------
+// The b (labeled f) and n jacobians of the lines of a batch
+//---------------------------------------------------------------------
+BATCH_INLINE void y_jacobians_batch(int jsize)
+{
+  lanes_t tmp1, tmp2, tmp3;
+  int j;
+
+  for (j = 0; j <= jsize; j++) {
+    tmp1 = rhob[j];
+    tmp2 = tmp1 * tmp1;
+    tmp3 = tmp1 * tmp2;
+
+    fjacb[j][0][0] = LANES(0.0);
+    fjacb[j][1][0] = LANES(0.0);
+    fjacb[j][2][0] = LANES(1.0);
+    fjacb[j][3][0] = LANES(0.0);
+    fjacb[j][4][0] = LANES(0.0);
+
+    fjacb[j][0][1] = - ( ub[j][1]*ub[j][2] ) * tmp2;
+    fjacb[j][1][1] = ub[j][2] * tmp1;
+    fjacb[j][2][1] = ub[j][1] * tmp1;
+    fjacb[j][3][1] = LANES(0.0);
+    fjacb[j][4][1] = LANES(0.0);
+
+    fjacb[j][0][2] = - ( ub[j][2]*ub[j][2]*tmp2)
+      + c2 * qsb[j];
+    fjacb[j][1][2] = - c2 *  ub[j][1] * tmp1;
+    fjacb[j][2][2] = ( 2.0 - c2 ) *  ub[j][2] * tmp1;
+    fjacb[j][3][2] = - c2 * ub[j][3] * tmp1;
+    fjacb[j][4][2] = LANES(c2);
+
+    fjacb[j][0][3] = - ( ub[j][2]*ub[j][3] ) * tmp2;
+    fjacb[j][1][3] = LANES(0.0);
+    fjacb[j][2][3] = ub[j][3] * tmp1;
+    fjacb[j][3][3] = ub[j][2] * tmp1;
+    fjacb[j][4][3] = LANES(0.0);
+
+    fjacb[j][0][4] = ( c2 * 2.0 * sqb[j] - c1 * ub[j][4] )
+      * ub[j][2] * tmp2;
+    fjacb[j][1][4] = - c2 * ub[j][1]*ub[j][2] * tmp2;
+    fjacb[j][2][4] = c1 * ub[j][4] * tmp1 
+      - c2 * ( qsb[j] + ub[j][2]*ub[j][2] * tmp2 );
+    fjacb[j][3][4] = - c2 * ( ub[j][2]*ub[j][3] ) * tmp2;
+    fjacb[j][4][4] = c1 * ub[j][2] * tmp1;
+
+    njacb[j][0][0] = LANES(0.0);
+    njacb[j][1][0] = LANES(0.0);
+    njacb[j][2][0] = LANES(0.0);
+    njacb[j][3][0] = LANES(0.0);
+    njacb[j][4][0] = LANES(0.0);
+
+    njacb[j][0][1] = - c3c4 * tmp2 * ub[j][1];
+    njacb[j][1][1] =   c3c4 * tmp1;
+    njacb[j][2][1] = LANES(0.0);
+    njacb[j][3][1] = LANES(0.0);
+    njacb[j][4][1] = LANES(0.0);
+
+    njacb[j][0][2] = - con43 * c3c4 * tmp2 * ub[j][2];
+    njacb[j][1][2] = LANES(0.0);
+    njacb[j][2][2] =   con43 * c3c4 * tmp1;
+    njacb[j][3][2] = LANES(0.0);
+    njacb[j][4][2] = LANES(0.0);
+
+    njacb[j][0][3] = - c3c4 * tmp2 * ub[j][3];
+    njacb[j][1][3] = LANES(0.0);
+    njacb[j][2][3] = LANES(0.0);
+    njacb[j][3][3] =   c3c4 * tmp1;
+    njacb[j][4][3] = LANES(0.0);
+
+    njacb[j][0][4] = - (  c3c4
+        - c1345 ) * tmp3 * (ub[j][1]*ub[j][1])
+      - ( con43 * c3c4
+          - c1345 ) * tmp3 * (ub[j][2]*ub[j][2])
+      - ( c3c4 - c1345 ) * tmp3 * (ub[j][3]*ub[j][3])
+      - c1345 * tmp2 * ub[j][4];
+
+    njacb[j][1][4] = (  c3c4 - c1345 ) * tmp2 * ub[j][1];
+    njacb[j][2][4] = ( con43 * c3c4 - c1345 ) * tmp2 * ub[j][2];
+    njacb[j][3][4] = ( c3c4 - c1345 ) * tmp2 * ub[j][3];
+    njacb[j][4][4] = ( c1345 ) * tmp1;
+  }
+}
+
+
+//---------------------------------------------------------------------
+// The left hand side of the lines of a batch in y direction
+//---------------------------------------------------------------------
+BATCH_INLINE void y_lhs_batch(int jsize)
+{
+  double tmp1, tmp2;
+  int j;
+
+  lhsinit_batch(jsize);
+  for (j = 1; j <= jsize-1; j++) {
+    tmp1 = dt * ty1;
+    tmp2 = dt * ty2;
+
+    blhs[j][AA][0][0] = - tmp2 * fjacb[j-1][0][0]
+      - tmp1 * njacb[j-1][0][0]
+      - tmp1 * dy1; 
+    blhs[j][AA][1][0] = - tmp2 * fjacb[j-1][1][0]
+      - tmp1 * njacb[j-1][1][0];
+    blhs[j][AA][2][0] = - tmp2 * fjacb[j-1][2][0]
+      - tmp1 * njacb[j-1][2][0];
+    blhs[j][AA][3][0] = - tmp2 * fjacb[j-1][3][0]
+      - tmp1 * njacb[j-1][3][0];
+    blhs[j][AA][4][0] = - tmp2 * fjacb[j-1][4][0]
+      - tmp1 * njacb[j-1][4][0];
+
+    blhs[j][AA][0][1] = - tmp2 * fjacb[j-1][0][1]
+      - tmp1 * njacb[j-1][0][1];
+    blhs[j][AA][1][1] = - tmp2 * fjacb[j-1][1][1]
+      - tmp1 * njacb[j-1][1][1]
+      - tmp1 * dy2;
+    blhs[j][AA][2][1] = - tmp2 * fjacb[j-1][2][1]
+      - tmp1 * njacb[j-1][2][1];
+    blhs[j][AA][3][1] = - tmp2 * fjacb[j-1][3][1]
+      - tmp1 * njacb[j-1][3][1];
+    blhs[j][AA][4][1] = - tmp2 * fjacb[j-1][4][1]
+      - tmp1 * njacb[j-1][4][1];
+
+    blhs[j][AA][0][2] = - tmp2 * fjacb[j-1][0][2]
+      - tmp1 * njacb[j-1][0][2];
+    blhs[j][AA][1][2] = - tmp2 * fjacb[j-1][1][2]
+      - tmp1 * njacb[j-1][1][2];
+    blhs[j][AA][2][2] = - tmp2 * fjacb[j-1][2][2]
+      - tmp1 * njacb[j-1][2][2]
+      - tmp1 * dy3;
+    blhs[j][AA][3][2] = - tmp2 * fjacb[j-1][3][2]
+      - tmp1 * njacb[j-1][3][2];
+    blhs[j][AA][4][2] = - tmp2 * fjacb[j-1][4][2]
+      - tmp1 * njacb[j-1][4][2];
+
+    blhs[j][AA][0][3] = - tmp2 * fjacb[j-1][0][3]
+      - tmp1 * njacb[j-1][0][3];
+    blhs[j][AA][1][3] = - tmp2 * fjacb[j-1][1][3]
+      - tmp1 * njacb[j-1][1][3];
+    blhs[j][AA][2][3] = - tmp2 * fjacb[j-1][2][3]
+      - tmp1 * njacb[j-1][2][3];
+    blhs[j][AA][3][3] = - tmp2 * fjacb[j-1][3][3]
+      - tmp1 * njacb[j-1][3][3]
+      - tmp1 * dy4;
+    blhs[j][AA][4][3] = - tmp2 * fjacb[j-1][4][3]
+      - tmp1 * njacb[j-1][4][3];
+
+    blhs[j][AA][0][4] = - tmp2 * fjacb[j-1][0][4]
+      - tmp1 * njacb[j-1][0][4];
+    blhs[j][AA][1][4] = - tmp2 * fjacb[j-1][1][4]
+      - tmp1 * njacb[j-1][1][4];
+    blhs[j][AA][2][4] = - tmp2 * fjacb[j-1][2][4]
+      - tmp1 * njacb[j-1][2][4];
+    blhs[j][AA][3][4] = - tmp2 * fjacb[j-1][3][4]
+      - tmp1 * njacb[j-1][3][4];
+    blhs[j][AA][4][4] = - tmp2 * fjacb[j-1][4][4]
+      - tmp1 * njacb[j-1][4][4]
+      - tmp1 * dy5;
+
+    blhs[j][BB][0][0] = 1.0
+      + tmp1 * 2.0 * njacb[j][0][0]
+      + tmp1 * 2.0 * dy1;
+    blhs[j][BB][1][0] = tmp1 * 2.0 * njacb[j][1][0];
+    blhs[j][BB][2][0] = tmp1 * 2.0 * njacb[j][2][0];
+    blhs[j][BB][3][0] = tmp1 * 2.0 * njacb[j][3][0];
+    blhs[j][BB][4][0] = tmp1 * 2.0 * njacb[j][4][0];
+
+    blhs[j][BB][0][1] = tmp1 * 2.0 * njacb[j][0][1];
+    blhs[j][BB][1][1] = 1.0
+      + tmp1 * 2.0 * njacb[j][1][1]
+      + tmp1 * 2.0 * dy2;
+    blhs[j][BB][2][1] = tmp1 * 2.0 * njacb[j][2][1];
+    blhs[j][BB][3][1] = tmp1 * 2.0 * njacb[j][3][1];
+    blhs[j][BB][4][1] = tmp1 * 2.0 * njacb[j][4][1];
+
+    blhs[j][BB][0][2] = tmp1 * 2.0 * njacb[j][0][2];
+    blhs[j][BB][1][2] = tmp1 * 2.0 * njacb[j][1][2];
+    blhs[j][BB][2][2] = 1.0
+      + tmp1 * 2.0 * njacb[j][2][2]
+      + tmp1 * 2.0 * dy3;
+    blhs[j][BB][3][2] = tmp1 * 2.0 * njacb[j][3][2];
+    blhs[j][BB][4][2] = tmp1 * 2.0 * njacb[j][4][2];
+
+    blhs[j][BB][0][3] = tmp1 * 2.0 * njacb[j][0][3];
+    blhs[j][BB][1][3] = tmp1 * 2.0 * njacb[j][1][3];
+    blhs[j][BB][2][3] = tmp1 * 2.0 * njacb[j][2][3];
+    blhs[j][BB][3][3] = 1.0
+      + tmp1 * 2.0 * njacb[j][3][3]
+      + tmp1 * 2.0 * dy4;
+    blhs[j][BB][4][3] = tmp1 * 2.0 * njacb[j][4][3];
+
+    blhs[j][BB][0][4] = tmp1 * 2.0 * njacb[j][0][4];
+    blhs[j][BB][1][4] = tmp1 * 2.0 * njacb[j][1][4];
+    blhs[j][BB][2][4] = tmp1 * 2.0 * njacb[j][2][4];
+    blhs[j][BB][3][4] = tmp1 * 2.0 * njacb[j][3][4];
+    blhs[j][BB][4][4] = 1.0
+      + tmp1 * 2.0 * njacb[j][4][4] 
+      + tmp1 * 2.0 * dy5;
+
+    blhs[j][CC][0][0] =  tmp2 * fjacb[j+1][0][0]
+      - tmp1 * njacb[j+1][0][0]
+      - tmp1 * dy1;
+    blhs[j][CC][1][0] =  tmp2 * fjacb[j+1][1][0]
+      - tmp1 * njacb[j+1][1][0];
+    blhs[j][CC][2][0] =  tmp2 * fjacb[j+1][2][0]
+      - tmp1 * njacb[j+1][2][0];
+    blhs[j][CC][3][0] =  tmp2 * fjacb[j+1][3][0]
+      - tmp1 * njacb[j+1][3][0];
+    blhs[j][CC][4][0] =  tmp2 * fjacb[j+1][4][0]
+      - tmp1 * njacb[j+1][4][0];
+
+    blhs[j][CC][0][1] =  tmp2 * fjacb[j+1][0][1]
+      - tmp1 * njacb[j+1][0][1];
+    blhs[j][CC][1][1] =  tmp2 * fjacb[j+1][1][1]
+      - tmp1 * njacb[j+1][1][1]
+      - tmp1 * dy2;
+    blhs[j][CC][2][1] =  tmp2 * fjacb[j+1][2][1]
+      - tmp1 * njacb[j+1][2][1];
+    blhs[j][CC][3][1] =  tmp2 * fjacb[j+1][3][1]
+      - tmp1 * njacb[j+1][3][1];
+    blhs[j][CC][4][1] =  tmp2 * fjacb[j+1][4][1]
+      - tmp1 * njacb[j+1][4][1];
+
+    blhs[j][CC][0][2] =  tmp2 * fjacb[j+1][0][2]
+      - tmp1 * njacb[j+1][0][2];
+    blhs[j][CC][1][2] =  tmp2 * fjacb[j+1][1][2]
+      - tmp1 * njacb[j+1][1][2];
+    blhs[j][CC][2][2] =  tmp2 * fjacb[j+1][2][2]
+      - tmp1 * njacb[j+1][2][2]
+      - tmp1 * dy3;
+    blhs[j][CC][3][2] =  tmp2 * fjacb[j+1][3][2]
+      - tmp1 * njacb[j+1][3][2];
+    blhs[j][CC][4][2] =  tmp2 * fjacb[j+1][4][2]
+      - tmp1 * njacb[j+1][4][2];
+
+    blhs[j][CC][0][3] =  tmp2 * fjacb[j+1][0][3]
+      - tmp1 * njacb[j+1][0][3];
+    blhs[j][CC][1][3] =  tmp2 * fjacb[j+1][1][3]
+      - tmp1 * njacb[j+1][1][3];
+    blhs[j][CC][2][3] =  tmp2 * fjacb[j+1][2][3]
+      - tmp1 * njacb[j+1][2][3];
+    blhs[j][CC][3][3] =  tmp2 * fjacb[j+1][3][3]
+      - tmp1 * njacb[j+1][3][3]
+      - tmp1 * dy4;
+    blhs[j][CC][4][3] =  tmp2 * fjacb[j+1][4][3]
+      - tmp1 * njacb[j+1][4][3];
+
+    blhs[j][CC][0][4] =  tmp2 * fjacb[j+1][0][4]
+      - tmp1 * njacb[j+1][0][4];
+    blhs[j][CC][1][4] =  tmp2 * fjacb[j+1][1][4]
+      - tmp1 * njacb[j+1][1][4];
+    blhs[j][CC][2][4] =  tmp2 * fjacb[j+1][2][4]
+      - tmp1 * njacb[j+1][2][4];
+    blhs[j][CC][3][4] =  tmp2 * fjacb[j+1][3][4]
+      - tmp1 * njacb[j+1][3][4];
+    blhs[j][CC][4][4] =  tmp2 * fjacb[j+1][4][4]
+      - tmp1 * njacb[j+1][4][4]
+      - tmp1 * dy5;
+  }
+}
+
+//---------------------------------------------------------------------
+// y_solve() on the lines i0 to i0+n-1 of plane k, one line
+// per lane
+//---------------------------------------------------------------------
+BATCH_INLINE void y_solve_lanes(int k, int i0, int n, int jsize)
+{
+  long p0 = BATCH_POINT(k, 0, i0);
+
+  batch_gather(p0, 1, IMAXP+1, n, jsize);
+  y_jacobians_batch(jsize);
+  y_lhs_batch(jsize);
+  batch_solve(jsize);
+  batch_scatter(p0, 1, IMAXP+1, n, jsize);
+}
+
+
+#if defined(__x86_64__)
+__attribute__((target("avx")))
+static void y_solve_lanes_avx(int k, int i0, int n, int jsize)
+{
+  y_solve_lanes(k, i0, n, jsize);
+}
+#endif
 
 //---------------------------------------------------------------------
 // Performs line solves in Y direction by first factoring
@@ -62,6 +348,27 @@ void y_solve()
 
   jsize = grid_points[1]-1;
 
+  //---------------------------------------------------------------------
+  // batched mode: SOLVE_LANES lines at a time (see solve_batch.h)
+  //---------------------------------------------------------------------
+  if (solve_batched) {
+    for (k = 1; k <= grid_points[2]-2; k++) {
+      for (i = 1; i <= grid_points[0]-2; i += SOLVE_LANES) {
+        n = grid_points[0]-2 - i + 1;
+        if (n > SOLVE_LANES) n = SOLVE_LANES;
+#if defined(__x86_64__)
+        if (batch_avx()) {
+          y_solve_lanes_avx(k, i, n, jsize);
+          continue;
+        }
+#endif
+        y_solve_lanes(k, i, n, jsize);
+      }
+    }
+    if (timeron) timer_stop(t_ysolve);
+    return;
+  }
+
   //---------------------------------------------------------------------
   // Compute the indices for storing the tri-diagonal matrix;
   // determine a (labeled f) and n jacobians for cell c
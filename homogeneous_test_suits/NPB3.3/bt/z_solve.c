@@ -34,6 +34,293 @@
 #include "header.h"
 #include "work_lhs.h"
 #include "timers.h"
+#include "solve_batch.h"
+
+
+//---------------------------------------------------------------------
+// The c (labeled f) and n jacobians of the lines of a batch
+//---------------------------------------------------------------------
+BATCH_INLINE void z_jacobians_batch(int ksize)
+{
+  lanes_t tmp1, tmp2, tmp3;
+  int k;
+
+  for (k = 0; k <= ksize; k++) {
+    tmp1 = 1.0 / ub[k][0];
+    tmp2 = tmp1 * tmp1;
+    tmp3 = tmp1 * tmp2;
+
+    fjacb[k][0][0] = LANES(0.0);
+    fjacb[k][1][0] = LANES(0.0);
+    fjacb[k][2][0] = LANES(0.0);
+    fjacb[k][3][0] = LANES(1.0);
+    fjacb[k][4][0] = LANES(0.0);
+
+    fjacb[k][0][1] = - ( ub[k][1]*ub[k][3] ) * tmp2;
+    fjacb[k][1][1] = ub[k][3] * tmp1;
+    fjacb[k][2][1] = LANES(0.0);
+    fjacb[k][3][1] = ub[k][1] * tmp1;
+    fjacb[k][4][1] = LANES(0.0);
+
+    fjacb[k][0][2] = - ( ub[k][2]*ub[k][3] ) * tmp2;
+    fjacb[k][1][2] = LANES(0.0);
+    fjacb[k][2][2] = ub[k][3] * tmp1;
+    fjacb[k][3][2] = ub[k][2] * tmp1;
+    fjacb[k][4][2] = LANES(0.0);
+
+    fjacb[k][0][3] = - (ub[k][3]*ub[k][3] * tmp2 ) 
+      + c2 * qsb[k];
+    fjacb[k][1][3] = - c2 *  ub[k][1] * tmp1;
+    fjacb[k][2][3] = - c2 *  ub[k][2] * tmp1;
+    fjacb[k][3][3] = ( 2.0 - c2 ) *  ub[k][3] * tmp1;
+    fjacb[k][4][3] = LANES(c2);
+
+    fjacb[k][0][4] = ( c2 * 2.0 * sqb[k] - c1 * ub[k][4] )
+      * ub[k][3] * tmp2;
+    fjacb[k][1][4] = - c2 * ( ub[k][1]*ub[k][3] ) * tmp2;
+    fjacb[k][2][4] = - c2 * ( ub[k][2]*ub[k][3] ) * tmp2;
+    fjacb[k][3][4] = c1 * ( ub[k][4] * tmp1 )
+      - c2 * ( qsb[k] + ub[k][3]*ub[k][3] * tmp2 );
+    fjacb[k][4][4] = c1 * ub[k][3] * tmp1;
+
+    njacb[k][0][0] = LANES(0.0);
+    njacb[k][1][0] = LANES(0.0);
+    njacb[k][2][0] = LANES(0.0);
+    njacb[k][3][0] = LANES(0.0);
+    njacb[k][4][0] = LANES(0.0);
+
+    njacb[k][0][1] = - c3c4 * tmp2 * ub[k][1];
+    njacb[k][1][1] =   c3c4 * tmp1;
+    njacb[k][2][1] = LANES(0.0);
+    njacb[k][3][1] = LANES(0.0);
+    njacb[k][4][1] = LANES(0.0);
+
+    njacb[k][0][2] = - c3c4 * tmp2 * ub[k][2];
+    njacb[k][1][2] = LANES(0.0);
+    njacb[k][2][2] =   c3c4 * tmp1;
+    njacb[k][3][2] = LANES(0.0);
+    njacb[k][4][2] = LANES(0.0);
+
+    njacb[k][0][3] = - con43 * c3c4 * tmp2 * ub[k][3];
+    njacb[k][1][3] = LANES(0.0);
+    njacb[k][2][3] = LANES(0.0);
+    njacb[k][3][3] =   con43 * c3 * c4 * tmp1;
+    njacb[k][4][3] = LANES(0.0);
+
+    njacb[k][0][4] = - (  c3c4
+        - c1345 ) * tmp3 * (ub[k][1]*ub[k][1])
+      - ( c3c4 - c1345 ) * tmp3 * (ub[k][2]*ub[k][2])
+      - ( con43 * c3c4
+          - c1345 ) * tmp3 * (ub[k][3]*ub[k][3])
+      - c1345 * tmp2 * ub[k][4];
+
+    njacb[k][1][4] = (  c3c4 - c1345 ) * tmp2 * ub[k][1];
+    njacb[k][2][4] = (  c3c4 - c1345 ) * tmp2 * ub[k][2];
+    njacb[k][3][4] = ( con43 * c3c4
+        - c1345 ) * tmp2 * ub[k][3];
+    njacb[k][4][4] = ( c1345 )* tmp1;
+  }
+}
+
+
+//---------------------------------------------------------------------
+// The left hand side of the lines of a batch in z direction
+//---------------------------------------------------------------------
+BATCH_INLINE void z_lhs_batch(int ksize)
+{
+  double tmp1, tmp2;
+  int k;
+
+  lhsinit_batch(ksize);
+  for (k = 1; k <= ksize-1; k++) {
+    tmp1 = dt * tz1;
+    tmp2 = dt * tz2;
+
+    blhs[k][AA][0][0] = - tmp2 * fjacb[k-1][0][0]
+      - tmp1 * njacb[k-1][0][0]
+      - tmp1 * dz1; 
+    blhs[k][AA][1][0] = - tmp2 * fjacb[k-1][1][0]
+      - tmp1 * njacb[k-1][1][0];
+    blhs[k][AA][2][0] = - tmp2 * fjacb[k-1][2][0]
+      - tmp1 * njacb[k-1][2][0];
+    blhs[k][AA][3][0] = - tmp2 * fjacb[k-1][3][0]
+      - tmp1 * njacb[k-1][3][0];
+    blhs[k][AA][4][0] = - tmp2 * fjacb[k-1][4][0]
+      - tmp1 * njacb[k-1][4][0];
+
+    blhs[k][AA][0][1] = - tmp2 * fjacb[k-1][0][1]
+      - tmp1 * njacb[k-1][0][1];
+    blhs[k][AA][1][1] = - tmp2 * fjacb[k-1][1][1]
+      - tmp1 * njacb[k-1][1][1]
+      - tmp1 * dz2;
+    blhs[k][AA][2][1] = - tmp2 * fjacb[k-1][2][1]
+      - tmp1 * njacb[k-1][2][1];
+    blhs[k][AA][3][1] = - tmp2 * fjacb[k-1][3][1]
+      - tmp1 * njacb[k-1][3][1];
+    blhs[k][AA][4][1] = - tmp2 * fjacb[k-1][4][1]
+      - tmp1 * njacb[k-1][4][1];
+
+    blhs[k][AA][0][2] = - tmp2 * fjacb[k-1][0][2]
+      - tmp1 * njacb[k-1][0][2];
+    blhs[k][AA][1][2] = - tmp2 * fjacb[k-1][1][2]
+      - tmp1 * njacb[k-1][1][2];
+    blhs[k][AA][2][2] = - tmp2 * fjacb[k-1][2][2]
+      - tmp1 * njacb[k-1][2][2]
+      - tmp1 * dz3;
+    blhs[k][AA][3][2] = - tmp2 * fjacb[k-1][3][2]
+      - tmp1 * njacb[k-1][3][2];
+    blhs[k][AA][4][2] = - tmp2 * fjacb[k-1][4][2]
+      - tmp1 * njacb[k-1][4][2];
+
+    blhs[k][AA][0][3] = - tmp2 * fjacb[k-1][0][3]
+      - tmp1 * njacb[k-1][0][3];
+    blhs[k][AA][1][3] = - tmp2 * fjacb[k-1][1][3]
+      - tmp1 * njacb[k-1][1][3];
+    blhs[k][AA][2][3] = - tmp2 * fjacb[k-1][2][3]
+      - tmp1 * njacb[k-1][2][3];
+    blhs[k][AA][3][3] = - tmp2 * fjacb[k-1][3][3]
+      - tmp1 * njacb[k-1][3][3]
+      - tmp1 * dz4;
+    blhs[k][AA][4][3] = - tmp2 * fjacb[k-1][4][3]
+      - tmp1 * njacb[k-1][4][3];
+
+    blhs[k][AA][0][4] = - tmp2 * fjacb[k-1][0][4]
+      - tmp1 * njacb[k-1][0][4];
+    blhs[k][AA][1][4] = - tmp2 * fjacb[k-1][1][4]
+      - tmp1 * njacb[k-1][1][4];
+    blhs[k][AA][2][4] = - tmp2 * fjacb[k-1][2][4]
+      - tmp1 * njacb[k-1][2][4];
+    blhs[k][AA][3][4] = - tmp2 * fjacb[k-1][3][4]
+      - tmp1 * njacb[k-1][3][4];
+    blhs[k][AA][4][4] = - tmp2 * fjacb[k-1][4][4]
+      - tmp1 * njacb[k-1][4][4]
+      - tmp1 * dz5;
+
+    blhs[k][BB][0][0] = 1.0
+      + tmp1 * 2.0 * njacb[k][0][0]
+      + tmp1 * 2.0 * dz1;
+    blhs[k][BB][1][0] = tmp1 * 2.0 * njacb[k][1][0];
+    blhs[k][BB][2][0] = tmp1 * 2.0 * njacb[k][2][0];
+    blhs[k][BB][3][0] = tmp1 * 2.0 * njacb[k][3][0];
+    blhs[k][BB][4][0] = tmp1 * 2.0 * njacb[k][4][0];
+
+    blhs[k][BB][0][1] = tmp1 * 2.0 * njacb[k][0][1];
+    blhs[k][BB][1][1] = 1.0
+      + tmp1 * 2.0 * njacb[k][1][1]
+      + tmp1 * 2.0 * dz2;
+    blhs[k][BB][2][1] = tmp1 * 2.0 * njacb[k][2][1];
+    blhs[k][BB][3][1] = tmp1 * 2.0 * njacb[k][3][1];
+    blhs[k][BB][4][1] = tmp1 * 2.0 * njacb[k][4][1];
+
+    blhs[k][BB][0][2] = tmp1 * 2.0 * njacb[k][0][2];
+    blhs[k][BB][1][2] = tmp1 * 2.0 * njacb[k][1][2];
+    blhs[k][BB][2][2] = 1.0
+      + tmp1 * 2.0 * njacb[k][2][2]
+      + tmp1 * 2.0 * dz3;
+    blhs[k][BB][3][2] = tmp1 * 2.0 * njacb[k][3][2];
+    blhs[k][BB][4][2] = tmp1 * 2.0 * njacb[k][4][2];
+
+    blhs[k][BB][0][3] = tmp1 * 2.0 * njacb[k][0][3];
+    blhs[k][BB][1][3] = tmp1 * 2.0 * njacb[k][1][3];
+    blhs[k][BB][2][3] = tmp1 * 2.0 * njacb[k][2][3];
+    blhs[k][BB][3][3] = 1.0
+      + tmp1 * 2.0 * njacb[k][3][3]
+      + tmp1 * 2.0 * dz4;
+    blhs[k][BB][4][3] = tmp1 * 2.0 * njacb[k][4][3];
+
+    blhs[k][BB][0][4] = tmp1 * 2.0 * njacb[k][0][4];
+    blhs[k][BB][1][4] = tmp1 * 2.0 * njacb[k][1][4];
+    blhs[k][BB][2][4] = tmp1 * 2.0 * njacb[k][2][4];
+    blhs[k][BB][3][4] = tmp1 * 2.0 * njacb[k][3][4];
+    blhs[k][BB][4][4] = 1.0
+      + tmp1 * 2.0 * njacb[k][4][4] 
+      + tmp1 * 2.0 * dz5;
+
+    blhs[k][CC][0][0] =  tmp2 * fjacb[k+1][0][0]
+      - tmp1 * njacb[k+1][0][0]
+      - tmp1 * dz1;
+    blhs[k][CC][1][0] =  tmp2 * fjacb[k+1][1][0]
+      - tmp1 * njacb[k+1][1][0];
+    blhs[k][CC][2][0] =  tmp2 * fjacb[k+1][2][0]
+      - tmp1 * njacb[k+1][2][0];
+    blhs[k][CC][3][0] =  tmp2 * fjacb[k+1][3][0]
+      - tmp1 * njacb[k+1][3][0];
+    blhs[k][CC][4][0] =  tmp2 * fjacb[k+1][4][0]
+      - tmp1 * njacb[k+1][4][0];
+
+    blhs[k][CC][0][1] =  tmp2 * fjacb[k+1][0][1]
+      - tmp1 * njacb[k+1][0][1];
+    blhs[k][CC][1][1] =  tmp2 * fjacb[k+1][1][1]
+      - tmp1 * njacb[k+1][1][1]
+      - tmp1 * dz2;
+    blhs[k][CC][2][1] =  tmp2 * fjacb[k+1][2][1]
+      - tmp1 * njacb[k+1][2][1];
+    blhs[k][CC][3][1] =  tmp2 * fjacb[k+1][3][1]
+      - tmp1 * njacb[k+1][3][1];
+    blhs[k][CC][4][1] =  tmp2 * fjacb[k+1][4][1]
+      - tmp1 * njacb[k+1][4][1];
+
+    blhs[k][CC][0][2] =  tmp2 * fjacb[k+1][0][2]
+      - tmp1 * njacb[k+1][0][2];
+    blhs[k][CC][1][2] =  tmp2 * fjacb[k+1][1][2]
+      - tmp1 * njacb[k+1][1][2];
+    blhs[k][CC][2][2] =  tmp2 * fjacb[k+1][2][2]
+      - tmp1 * njacb[k+1][2][2]
+      - tmp1 * dz3;
+    blhs[k][CC][3][2] =  tmp2 * fjacb[k+1][3][2]
+      - tmp1 * njacb[k+1][3][2];
+    blhs[k][CC][4][2] =  tmp2 * fjacb[k+1][4][2]
+      - tmp1 * njacb[k+1][4][2];
+
+    blhs[k][CC][0][3] =  tmp2 * fjacb[k+1][0][3]
+      - tmp1 * njacb[k+1][0][3];
+    blhs[k][CC][1][3] =  tmp2 * fjacb[k+1][1][3]
+      - tmp1 * njacb[k+1][1][3];
+    blhs[k][CC][2][3] =  tmp2 * fjacb[k+1][2][3]
+      - tmp1 * njacb[k+1][2][3];
+    blhs[k][CC][3][3] =  tmp2 * fjacb[k+1][3][3]
+      - tmp1 * njacb[k+1][3][3]
+      - tmp1 * dz4;
+    blhs[k][CC][4][3] =  tmp2 * fjacb[k+1][4][3]
+      - tmp1 * njacb[k+1][4][3];
+
+    blhs[k][CC][0][4] =  tmp2 * fjacb[k+1][0][4]
+      - tmp1 * njacb[k+1][0][4];
+    blhs[k][CC][1][4] =  tmp2 * fjacb[k+1][1][4]
+      - tmp1 * njacb[k+1][1][4];
+    blhs[k][CC][2][4] =  tmp2 * fjacb[k+1][2][4]
+      - tmp1 * njacb[k+1][2][4];
+    blhs[k][CC][3][4] =  tmp2 * fjacb[k+1][3][4]
+      - tmp1 * njacb[k+1][3][4];
+    blhs[k][CC][4][4] =  tmp2 * fjacb[k+1][4][4]
+      - tmp1 * njacb[k+1][4][4]
+      - tmp1 * dz5;
+  }
+}
+
+//---------------------------------------------------------------------
+// z_solve() on the lines i0 to i0+n-1 of row j, one line
+// per lane
+//---------------------------------------------------------------------
+BATCH_INLINE void z_solve_lanes(int j, int i0, int n, int ksize)
+{
+  long p0 = BATCH_POINT(0, j, i0);
+
+  batch_gather(p0, 1, (JMAXP+1)*(IMAXP+1), n, ksize);
+  z_jacobians_batch(ksize);
+  z_lhs_batch(ksize);
+  batch_solve(ksize);
+  batch_scatter(p0, 1, (JMAXP+1)*(IMAXP+1), n, ksize);
+}
+
+
+#if defined(__x86_64__)
+__attribute__((target("avx")))
+static void z_solve_lanes_avx(int j, int i0, int n, int ksize)
+{
+  z_solve_lanes(j, i0, n, ksize);
+}
+#endif
 
 //---------------------------------------------------------------------
 // Performs line solves in Z direction by first factoring
@@ -62,6 +349,27 @@ void z_solve()
 
   ksize = grid_points[2]-1;
 
+  //---------------------------------------------------------------------
+  // batched mode: SOLVE_LANES lines at a time (see solve_batch.h)
+  //---------------------------------------------------------------------
+  if (solve_batched) {
+    for (j = 1; j <= grid_points[1]-2; j++) {
+      for (i = 1; i <= grid_points[0]-2; i += SOLVE_LANES) {
+        n = grid_points[0]-2 - i + 1;
+        if (n > SOLVE_LANES) n = SOLVE_LANES;
+#if defined(__x86_64__)
+        if (batch_avx()) {
+          z_solve_lanes_avx(j, i, n, ksize);
+          continue;
+        }
+#endif
+        z_solve_lanes(j, i, n, ksize);
+      }
+    }
+    if (timeron) timer_stop(t_zsolve);
+    return;
+  }
+
   //---------------------------------------------------------------------
   // Compute the indices for storing the block-diagonal matrix;
   // determine c (labeled f) and s jacobians
@@ -37,8 +37,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 #include "migrate.h"
+
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_ranges.h"
+#include "popcorn_team.h"
+#include "popcorn_grain.h"
+#include "popcorn_huge.h"
+
+// Region ID for popcorn_profile.h
+#define CG_REGION_CONJ_GRAD 1
 #include "globals.h"
 #include "randdp.h"
 #include "timers.h"
@@ -46,25 +61,27 @@
 
 
 //---------------------------------------------------------------------
+// The working set of conj_grad() starts on a huge page, to go on 2MB
+// pages with $POPCORN_HUGE (see popcorn_huge.h)
 /* common / main_int_mem / */
-static int colidx[NZ];
-static int rowstr[NA+1];
-static int iv[NA];
+static int colidx[NZ] POPCORN_HUGE_ALIGN;
+static NZ_TYPE rowstr[NA+1] POPCORN_HUGE_ALIGN;
+static NZ_TYPE iv[NA];
 static int arow[NA];
 static int acol[NAZ];
 
 /* common / main_flt_mem / */
 static double aelt[NAZ];
-static double a[NZ];
-static double x[NA+2];
-static double z[NA+2];
-static double p[NA+2];
-static double q[NA+2];
-static double r[NA+2];
+static double a[NZ] POPCORN_HUGE_ALIGN;
+static double x[NA+2] POPCORN_HUGE_ALIGN;
+static double z[NA+2] POPCORN_HUGE_ALIGN;
+static double p[NA+2] POPCORN_HUGE_ALIGN;
+static double q[NA+2] POPCORN_HUGE_ALIGN;
+static double r[NA+2] POPCORN_HUGE_ALIGN;
 
 /* common / partit_size / */
 static int naa;
-static int nzz;
+static NZ_TYPE nzz;
 static int firstrow;
 static int lastrow;
 static int firstcol;
@@ -76,12 +93,93 @@ static double tran;
 
 /* common /timers/ */
 static logical timeron;
+
+//---------------------------------------------------------------------
+// The matrix in SELL-C-sigma format, built from the CSR arrays when
+// $CG_SPMV is "sell": rows sorted by length within windows of SELL_SIGMA
+// rows, then cut into chunks of SELL_C rows stored column by column and
+// padded to their longest row, so that one SIMD lane does one row.
+// Each row keeps its entries in CSR order, so a lane adds them up in the
+// same order as the CSR loop does.
+//---------------------------------------------------------------------
+#define SELL_C      8
+#define SELL_SIGMA  256
+
+static struct {
+  int nchunks;
+  int *len;           // entries per row of chunk c, padding included
+  NZ_TYPE *ptr;       // first entry of chunk c in val[] and col[]
+  int *row;           // row of each lane of each chunk, -1 for padding
+  double *val;        // entry k of lane l of chunk c: val[ptr[c]+k*SELL_C+l]
+  int *col;
+} sell;
+
+// Working set of conj_grad(), taken along to the remote node. The SELL
+// arrays replace colidx, rowstr and a once they are built.
+static struct popcorn_range cg_remote_ranges[] = {
+  POPCORN_RANGE_RO(colidx),
+  POPCORN_RANGE_RO(rowstr),
+  POPCORN_RANGE_RO(a),
+  POPCORN_RANGE_RO(x),
+  POPCORN_RANGE_RW(z),
+  POPCORN_RANGE_RW(p),
+  POPCORN_RANGE_RW(q),
+  POPCORN_RANGE_RW(r),
+  { NULL, 0, 0 },     // sell.val, from CG_SELL_RANGES on
+  { NULL, 0, 0 },     // sell.col
+  { NULL, 0, 0 },     // sell.row
+  { NULL, 0, 0 },     // sell.len
+  { NULL, 0, 0 },     // sell.ptr
+  { NULL, 0, 0 },     // mixed.a, from CG_MIXED_RANGES on
+  { NULL, 0, 0 },     // mixed.p
+  { NULL, 0, 0 },     // mixed.q
+  { NULL, 0, 0 },     // mixed.r
+};
+#define CG_SELL_RANGES  8
+#define CG_MIXED_RANGES 13
+
+//---------------------------------------------------------------------
+// Mixed precision, with $CG_PRECISION=mixed: the CG iterations run on a
+// float copy of a and on float p, q and r, with the dot products and z
+// in double. Then the residual x - A.z is formed in double with a, and
+// while it is above MIXED_TOL times ||x||, another round of float
+// iterations solves for its correction (iterative refinement). zeta
+// comes from the double z and is verified as usual.
+//---------------------------------------------------------------------
+#define MIXED_TOL     1.0e-10   // ||x - A.z|| / ||x|| to stop at
+#define MIXED_ROUNDS  4         // of float iterations, at most
+#define MIXED_DROP    1.0e-6    // of the float residual in a round
+
+static struct {
+  float *a;
+  float *p, *q, *r;
+  long solves, rounds, iters;   // for the report
+} mixed;
+
+// Arguments of conj_grad(), for the threads of the team
+struct conj_grad_args {
+  int *colidx;
+  NZ_TYPE *rowstr;
+  double *x;
+  double *z;
+  double *a;
+  double *p;
+  double *q;
+  double *r;
+  double *rnorm;
+};
+
+// What the main loop touches between two calls to conj_grad()
+static struct popcorn_range cg_home_ranges[] = {
+  POPCORN_RANGE_RW(x),
+  POPCORN_RANGE_RO(z),
+};
 //---------------------------------------------------------------------
 
 
 //---------------------------------------------------------------------
 static void conj_grad(int colidx[],
-                      int rowstr[],
+                      NZ_TYPE rowstr[],
                       double x[],
                       double z[],
                       double a[],
@@ -90,10 +188,10 @@ static void conj_grad(int colidx[],
                       double r[],
                       double *rnorm);
 static void makea(int n,
-                  int nz,
+                  NZ_TYPE nz,
                   double a[],
                   int colidx[],
-                  int rowstr[],
+                  NZ_TYPE rowstr[],
                   int firstrow,
                   int lastrow,
                   int firstcol,
@@ -101,30 +199,36 @@ static void makea(int n,
                   int arow[],
                   int acol[][NONZER+1],
                   double aelt[][NONZER+1],
-                  int iv[]);
+                  NZ_TYPE iv[]);
 static void sparse(double a[],
                    int colidx[],
-                   int rowstr[],
+                   NZ_TYPE rowstr[],
                    int n,
-                   int nz,
+                   NZ_TYPE nz,
                    int nozer,
                    int arow[],
                    int acol[][NONZER+1],
                    double aelt[][NONZER+1],
                    int firstrow,
                    int lastrow,
-                   int nzloc[],
+                   NZ_TYPE nzloc[],
                    double rcond,
                    double shift);
 static void sprnvc(int n, int nz, int nn1, double v[], int iv[]);
 static int icnvrt(double x, int ipwr2);
 static void vecset(int n, double v[], int iv[], int *nzv, int i, double val);
+static const char *sell_build(int nrows);
+static const char *mixed_build(int nrows);
+static void sell_spmv(const double v[], double w[], int c0, int c1);
 //---------------------------------------------------------------------
 
 
 int main(int argc, char *argv[])
 {
-  int i, j, k, it;
+  int i, j, it;
+  NZ_TYPE k;
+  const char *spmv, *precision;
+  struct popcorn_grain grain;
 
   double zeta;
   double rnorm;
@@ -137,6 +241,16 @@ int main(int argc, char *argv[])
 
   char *t_names[T_last];
 
+  // Before anything touches them
+  POPCORN_HUGE_STATIC(colidx);
+  POPCORN_HUGE_STATIC(rowstr);
+  POPCORN_HUGE_STATIC(a);
+  POPCORN_HUGE_STATIC(x);
+  POPCORN_HUGE_STATIC(z);
+  POPCORN_HUGE_STATIC(p);
+  POPCORN_HUGE_STATIC(q);
+  POPCORN_HUGE_STATIC(r);
+
   for (i = 0; i < T_last; i++) {
     timer_clear(i);
   }
@@ -187,6 +301,8 @@ int main(int argc, char *argv[])
   printf("\n\n NAS Parallel Benchmarks (NPB3.3-SER-C) - CG Benchmark\n\n");
   printf(" Size: %11d\n", NA);
   printf(" Iterations: %5d\n", NITER);
+  popcorn_grain_init(&grain, 1, NITER, POPCORN_GRAIN_ITER);
+  popcorn_grain_print(&grain);
   printf("\n");
 
   naa = NA;
@@ -223,6 +339,38 @@ int main(int argc, char *argv[])
     }
   }
 
+  //---------------------------------------------------------------------
+  // The sparse format of q = A.p: CSR, or SELL-C-sigma with $CG_SPMV=sell
+  //---------------------------------------------------------------------
+  spmv = getenv("CG_SPMV");
+  if (spmv != NULL && strcmp(spmv, "sell") == 0) {
+    spmv = sell_build(lastrow - firstrow + 1);
+  } else if (spmv == NULL || strcmp(spmv, "csr") == 0) {
+    spmv = "CSR";
+  } else {
+    printf(" CG_SPMV must be csr or sell, not %s\n", spmv);
+    exit(EXIT_FAILURE);
+  }
+  printf(" Sparse format: %s\n", spmv);
+
+  //---------------------------------------------------------------------
+  // Double precision, or $CG_PRECISION=mixed (CSR only)
+  //---------------------------------------------------------------------
+  precision = getenv("CG_PRECISION");
+  if (precision != NULL && strcmp(precision, "mixed") == 0) {
+    if (sell.nchunks > 0) {
+      printf(" CG_PRECISION=mixed needs CG_SPMV=csr\n");
+      exit(EXIT_FAILURE);
+    }
+    precision = mixed_build(lastrow - firstrow + 1);
+  } else if (precision == NULL || strcmp(precision, "double") == 0) {
+    precision = "double";
+  } else {
+    printf(" CG_PRECISION must be double or mixed, not %s\n", precision);
+    exit(EXIT_FAILURE);
+  }
+  printf(" Precision: %s\n\n", precision);
+
   //---------------------------------------------------------------------
   // set starting vector to (1, 1, .... 1)
   //---------------------------------------------------------------------
@@ -236,6 +384,13 @@ int main(int argc, char *argv[])
     p[j] = 0.0;
   }
 
+  //---------------------------------------------------------------------
+  // conj_grad() runs on a team of $POPCORN_THREADS threads spread over
+  // the nodes. A team of one migrates around each call instead, or every
+  // $POPCORN_GRAIN calls (see popcorn_grain.h).
+  //---------------------------------------------------------------------
+  popcorn_team_init(CG_REGION_CONJ_GRAD);
+
   zeta = 0.0;
 
   //---------------------------------------------------------------------
@@ -281,6 +436,7 @@ int main(int argc, char *argv[])
   }
 
   zeta = 0.0;
+  mixed.solves = mixed.rounds = mixed.iters = 0;
 
   timer_stop(T_init);
 
@@ -297,11 +453,17 @@ int main(int argc, char *argv[])
     //---------------------------------------------------------------------
     // The call to the conjugate gradient routine:
     //---------------------------------------------------------------------
-	migrate(1, NULL, NULL);
+    if (popcorn_team_size() == 1 && popcorn_grain_leave(&grain, it))
+      popcorn_migrate_ranges(CG_REGION_CONJ_GRAD, POPCORN_NODE_BEST,
+                             cg_remote_ranges, POPCORN_RANGES(cg_remote_ranges),
+                             POPCORN_RANGE_ALL);
     if (timeron) timer_start(T_conj_grad);
     conj_grad(colidx, rowstr, x, z, a, p, q, r, &rnorm);
     if (timeron) timer_stop(T_conj_grad);
-	migrate(0, NULL, NULL);
+    if (popcorn_team_size() == 1 && popcorn_grain_return(&grain, it))
+      popcorn_migrate_ranges(CG_REGION_CONJ_GRAD, POPCORN_NODE_HOME,
+                             cg_home_ranges, POPCORN_RANGES(cg_home_ranges),
+                             POPCORN_RANGE_ALL);
 
     //---------------------------------------------------------------------
     // zeta = shift + 1/(x.z)
@@ -332,6 +494,7 @@ int main(int argc, char *argv[])
   } // end of main iter inv pow meth
 
   timer_stop(T_bench);
+  popcorn_team_fini();
 
   //---------------------------------------------------------------------
   // End of timed section
@@ -340,6 +503,12 @@ int main(int argc, char *argv[])
   t = timer_read(T_bench);
 
   printf(" Benchmark completed\n");
+  if (mixed.solves > 0) {
+    printf(" Mixed precision: %.2f rounds, %.1f float iterations per solve\n",
+           (double)mixed.rounds / mixed.solves,
+           (double)mixed.iters / mixed.solves);
+  }
+  popcorn_huge_report(stdout);
 
   epsilon = 1.0e-10;
   if (Class != 'U') {
@@ -405,17 +574,15 @@ int main(int argc, char *argv[])
 // Floaging point arrays here are named as in NPB1 spec discussion of 
 // CG algorithm
 //---------------------------------------------------------------------
-static void conj_grad(int colidx[],
-                      int rowstr[],
-                      double x[],
-                      double z[],
-                      double a[],
-                      double p[],
-                      double q[],
-                      double r[],
-                      double *rnorm)
+static void conj_grad_team(int tid, void *arg)
 {
-  int j, k;
+  struct conj_grad_args *cg = (struct conj_grad_args *)arg;
+  int *colidx = cg->colidx;
+  NZ_TYPE *rowstr = cg->rowstr;
+  double *x = cg->x, *z = cg->z, *a = cg->a;
+  double *p = cg->p, *q = cg->q, *r = cg->r;
+  int j, lo, hi, c0, c1;
+  NZ_TYPE k;
   int cgit, cgitmax = 25;
   double d, sum, rho, rho0, alpha, beta;
 
@@ -424,7 +591,13 @@ static void conj_grad(int colidx[],
   //---------------------------------------------------------------------
   // Initialize the CG algorithm:
   //---------------------------------------------------------------------
-  for (j = 0; j < naa+1; j++) {
+  // Each thread keeps the same block of rows and of columns, which are the
+  // same range here. The last block also covers element naa.
+  popcorn_team_split(0, lastcol - firstcol + 1, &lo, &hi);
+  // The SELL chunks hold permuted rows: a thread's chunks write rows of
+  // the others, so it waits for them before reading its own rows of q.
+  popcorn_team_split(0, sell.nchunks, &c0, &c1);
+  for (j = lo; j < (hi == naa ? naa+1 : hi); j++) {
     q[j] = 0.0;
     z[j] = 0.0;
     r[j] = x[j];
@@ -435,9 +608,10 @@ static void conj_grad(int colidx[],
   // rho = r.r
   // Now, obtain the norm of r: First, sum squares of r elements locally...
   //---------------------------------------------------------------------
-  for (j = 0; j < lastcol - firstcol + 1; j++) {
+  for (j = lo; j < hi; j++) {
     rho = rho + r[j]*r[j];
   }
+  rho = popcorn_team_sum(rho);
 
   //---------------------------------------------------------------------
   //---->
@@ -445,6 +619,9 @@ static void conj_grad(int colidx[],
   //---->
   //---------------------------------------------------------------------
   for (cgit = 1; cgit <= cgitmax; cgit++) {
+    // Everyone reads all of p
+    popcorn_team_barrier();
+
     //---------------------------------------------------------------------
     // q = A.p
     // The partition submatrix-vector multiply: use workspace w
@@ -457,12 +634,17 @@ static void conj_grad(int colidx[],
     //       The unrolled-by-8 version below is significantly faster
     //       on the Cray t3d - overall speed of code is 1.5 times faster.
 
-    for (j = 0; j < lastrow - firstrow + 1; j++) {
-      sum = 0.0;
-      for (k = rowstr[j]; k < rowstr[j+1]; k++) {
-        sum = sum + a[k]*p[colidx[k]];
+    if (sell.nchunks > 0) {
+      sell_spmv(p, q, c0, c1);
+      popcorn_team_barrier();
+    } else {
+      for (j = lo; j < hi; j++) {
+        sum = 0.0;
+        for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+          sum = sum + a[k]*p[colidx[k]];
+        }
+        q[j] = sum;
       }
-      q[j] = sum;
     }
 
     /*
@@ -507,9 +689,10 @@ static void conj_grad(int colidx[],
     // Obtain p.q
     //---------------------------------------------------------------------
     d = 0.0;
-    for (j = 0; j < lastcol - firstcol + 1; j++) {
+    for (j = lo; j < hi; j++) {
       d = d + p[j]*q[j];
     }
+    d = popcorn_team_sum(d);
 
     //---------------------------------------------------------------------
     // Obtain alpha = rho / (p.q)
@@ -526,7 +709,7 @@ static void conj_grad(int colidx[],
     // and    r = r - alpha*q
     //---------------------------------------------------------------------
     rho = 0.0;
-    for (j = 0; j < lastcol - firstcol + 1; j++) {
+    for (j = lo; j < hi; j++) {
       z[j] = z[j] + alpha*p[j];
       r[j] = r[j] - alpha*q[j];
     }
@@ -535,9 +718,10 @@ static void conj_grad(int colidx[],
     // rho = r.r
     // Now, obtain the norm of r: First, sum squares of r elements locally...
     //---------------------------------------------------------------------
-    for (j = 0; j < lastcol - firstcol + 1; j++) {
+    for (j = lo; j < hi; j++) {
       rho = rho + r[j]*r[j];
     }
+    rho = popcorn_team_sum(rho);
 
     //---------------------------------------------------------------------
     // Obtain beta:
@@ -547,7 +731,7 @@ static void conj_grad(int colidx[],
     //---------------------------------------------------------------------
     // p = r + beta*p
     //---------------------------------------------------------------------
-    for (j = 0; j < lastcol - firstcol + 1; j++) {
+    for (j = lo; j < hi; j++) {
       p[j] = r[j] + beta*p[j];
     }
   } // end of do cgit=1,cgitmax
@@ -557,24 +741,155 @@ static void conj_grad(int colidx[],
   // First, form A.z
   // The partition submatrix-vector multiply
   //---------------------------------------------------------------------
+  // z is complete: the last sum of rho came after its update
   sum = 0.0;
-  for (j = 0; j < lastrow - firstrow + 1; j++) {
-    d = 0.0;
-    for (k = rowstr[j]; k < rowstr[j+1]; k++) {
-      d = d + a[k]*z[colidx[k]];
+  if (sell.nchunks > 0) {
+    sell_spmv(z, r, c0, c1);
+    popcorn_team_barrier();
+  } else {
+    for (j = lo; j < hi; j++) {
+      d = 0.0;
+      for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+        d = d + a[k]*z[colidx[k]];
+      }
+      r[j] = d;
     }
-    r[j] = d;
   }
 
   //---------------------------------------------------------------------
   // At this point, r contains A.z
   //---------------------------------------------------------------------
-  for (j = 0; j < lastcol-firstcol+1; j++) {
+  for (j = lo; j < hi; j++) {
     d   = x[j] - r[j];
     sum = sum + d*d;
   }
+  sum = popcorn_team_sum(sum);
 
-  *rnorm = sqrt(sum);
+  if (tid == 0) *cg->rnorm = sqrt(sum);
+}
+
+
+//---------------------------------------------------------------------
+// conj_grad_team() in mixed precision (see MIXED_TOL): p and q are the
+// float mixed.p and mixed.q, r is the double residual and mixed.r the
+// float one of the iterations.
+//---------------------------------------------------------------------
+static void conj_grad_mixed_team(int tid, void *arg)
+{
+  struct conj_grad_args *cg = (struct conj_grad_args *)arg;
+  int *colidx = cg->colidx;
+  NZ_TYPE *rowstr = cg->rowstr;
+  double *x = cg->x, *z = cg->z, *a = cg->a, *r = cg->r;
+  float *af = mixed.a, *pf = mixed.p, *qf = mixed.q, *rf = mixed.r;
+  int j, lo, hi, round, cgit, cgitmax = 25;
+  NZ_TYPE k;
+  double d, sum, xnorm, rho, rho0, rho_end, alpha, beta;
+
+  popcorn_team_split(0, lastcol - firstcol + 1, &lo, &hi);
+  xnorm = 0.0;
+  for (j = lo; j < (hi == naa ? naa+1 : hi); j++) {
+    qf[j] = 0.0f;
+    z[j] = 0.0;
+    r[j] = x[j];
+  }
+  for (j = lo; j < hi; j++) {
+    xnorm = xnorm + x[j]*x[j];
+  }
+  xnorm = popcorn_team_sum(xnorm);
+
+  for (round = 1; ; round++) {
+    //---------------------------------------------------------------------
+    // Solve A.d = r in float, adding d into z as it goes
+    //---------------------------------------------------------------------
+    rho = 0.0;
+    for (j = lo; j < hi; j++) {
+      rf[j] = (float)r[j];
+      pf[j] = rf[j];
+      rho = rho + (double)rf[j]*rf[j];
+    }
+    rho = popcorn_team_sum(rho);
+    rho_end = rho * (MIXED_DROP*MIXED_DROP);
+
+    // Every thread has the same rho, so they stop together.
+    for (cgit = 1; cgit <= cgitmax && rho > rho_end; cgit++) {
+      // Everyone reads all of p
+      popcorn_team_barrier();
+
+      for (j = lo; j < hi; j++) {
+        sum = 0.0;
+        for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+          sum = sum + (double)af[k]*pf[colidx[k]];
+        }
+        qf[j] = (float)sum;
+      }
+
+      d = 0.0;
+      for (j = lo; j < hi; j++) {
+        d = d + (double)pf[j]*qf[j];
+      }
+      d = popcorn_team_sum(d);
+
+      alpha = rho / d;
+      rho0 = rho;
+
+      rho = 0.0;
+      for (j = lo; j < hi; j++) {
+        z[j] = z[j] + alpha*pf[j];
+        rf[j] = (float)(rf[j] - alpha*qf[j]);
+        rho = rho + (double)rf[j]*rf[j];
+      }
+      rho = popcorn_team_sum(rho);
+
+      beta = rho / rho0;
+
+      for (j = lo; j < hi; j++) {
+        pf[j] = (float)(rf[j] + beta*pf[j]);
+      }
+    }
+    if (tid == 0) {
+      mixed.rounds++;
+      mixed.iters += cgit - 1;
+    }
+
+    //---------------------------------------------------------------------
+    // r = x - A.z in double. z is complete: the last sum of rho came
+    // after its update.
+    //---------------------------------------------------------------------
+    sum = 0.0;
+    for (j = lo; j < hi; j++) {
+      d = 0.0;
+      for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+        d = d + a[k]*z[colidx[k]];
+      }
+      r[j] = x[j] - d;
+      sum = sum + r[j]*r[j];
+    }
+    sum = popcorn_team_sum(sum);
+
+    if (sum <= (MIXED_TOL*MIXED_TOL) * xnorm || round == MIXED_ROUNDS) break;
+  }
+
+  if (tid == 0) {
+    mixed.solves++;
+    *cg->rnorm = sqrt(sum);
+  }
+}
+
+
+static void conj_grad(int colidx[],
+                      NZ_TYPE rowstr[],
+                      double x[],
+                      double z[],
+                      double a[],
+                      double p[],
+                      double q[],
+                      double r[],
+                      double *rnorm)
+{
+  struct conj_grad_args cg = { colidx, rowstr, x, z, a, p, q, r, rnorm };
+
+  popcorn_team_run(mixed.a != NULL ? conj_grad_mixed_team : conj_grad_team,
+                   &cg);
 }
 
 
@@ -604,10 +919,10 @@ static void conj_grad(int colidx[],
 // aelt           r*8
 //---------------------------------------------------------------------
 static void makea(int n,
-                  int nz,
+                  NZ_TYPE nz,
                   double a[],
                   int colidx[],
-                  int rowstr[],
+                  NZ_TYPE rowstr[],
                   int firstrow,
                   int lastrow,
                   int firstcol,
@@ -615,7 +930,7 @@ static void makea(int n,
                   int arow[],
                   int acol[][NONZER+1],
                   double aelt[][NONZER+1],
-                  int iv[])
+                  NZ_TYPE iv[])
 {
   int iouter, ivelt, nzv, nn1;
   int ivc[NONZER+1];
@@ -664,16 +979,16 @@ static void makea(int n,
 //---------------------------------------------------------------------
 static void sparse(double a[],
                    int colidx[],
-                   int rowstr[],
+                   NZ_TYPE rowstr[],
                    int n,
-                   int nz,
+                   NZ_TYPE nz,
                    int nozer,
                    int arow[],
                    int acol[][NONZER+1],
                    double aelt[][NONZER+1],
                    int firstrow,
                    int lastrow,
-                   int nzloc[],
+                   NZ_TYPE nzloc[],
                    double rcond,
                    double shift)
 {
@@ -683,7 +998,8 @@ static void sparse(double a[],
   // generate a sparse matrix from a list of
   // [col, row, element] tri
   //---------------------------------------------------
-  int i, j, j1, j2, nza, k, kk, nzrow, jcol;
+  int i, j, nzrow, jcol;
+  NZ_TYPE j1, j2, nza, k, kk;
   double size, scale, ratio, va;
   logical cont40;
 
@@ -718,7 +1034,7 @@ static void sparse(double a[],
   //---------------------------------------------------------------------
   if (nza > nz) {
     printf("Space for matrix elements exceeded in sparse\n");
-    printf("nza, nzmax = %d, %d\n", nza, nz);
+    printf("nza, nzmax = " NZ_FMT ", " NZ_FMT "\n", nza, nz);
     exit(EXIT_FAILURE);
   }
 
@@ -899,3 +1215,294 @@ static void vecset(int n, double v[], int iv[], int *nzv, int i, double val)
   }
 }
 
+
+//---------------------------------------------------------------------
+// SELL-C-sigma sparse matrix-vector multiply
+//---------------------------------------------------------------------
+
+// Rows of a sigma window by decreasing length, ties by row
+static int sell_cmp(const void *pa, const void *pb)
+{
+  int ra = *(const int *)pa, rb = *(const int *)pb;
+  NZ_TYPE la = rowstr[ra+1] - rowstr[ra], lb = rowstr[rb+1] - rowstr[rb];
+
+  if (la != lb) return la > lb ? -1 : 1;
+  return ra - rb;
+}
+
+
+//---------------------------------------------------------------------
+// w = A.v, for the rows of chunks c0 to c1-1, one lane per row
+//---------------------------------------------------------------------
+static void sell_spmv_scalar(const double v[], double w[], int c0, int c1)
+{
+  double sum[SELL_C];
+  int c, k, l;
+
+  for (c = c0; c < c1; c++) {
+    const double *val = &sell.val[sell.ptr[c]];
+    const int *col = &sell.col[sell.ptr[c]];
+
+    for (l = 0; l < SELL_C; l++) sum[l] = 0.0;
+    for (k = 0; k < sell.len[c]; k++) {
+      for (l = 0; l < SELL_C; l++) {
+        sum[l] = sum[l] + val[k*SELL_C+l]*v[col[k*SELL_C+l]];
+      }
+    }
+    for (l = 0; l < SELL_C; l++) {
+      if (sell.row[c*SELL_C+l] >= 0) w[sell.row[c*SELL_C+l]] = sum[l];
+    }
+  }
+}
+
+
+#if defined(__x86_64__)
+//---------------------------------------------------------------------
+// sell_spmv_scalar() with AVX2: two vectors of 4 lanes, v gathered. The
+// products are rounded before the sum, as in the scalar loop.
+//---------------------------------------------------------------------
+__attribute__((target("avx2")))
+static void sell_spmv_simd(const double v[], double w[], int c0, int c1)
+{
+  double sum[SELL_C];
+  int c, k, l;
+
+  for (c = c0; c < c1; c++) {
+    const double *val = &sell.val[sell.ptr[c]];
+    const int *col = &sell.col[sell.ptr[c]];
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+
+    for (k = 0; k < sell.len[c]; k++) {
+      __m128i i0 = _mm_loadu_si128((const __m128i *)&col[k*SELL_C]);
+      __m128i i1 = _mm_loadu_si128((const __m128i *)&col[k*SELL_C+4]);
+      __m256d v0 = _mm256_i32gather_pd(v, i0, 8);
+      __m256d v1 = _mm256_i32gather_pd(v, i1, 8);
+
+      s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(&val[k*SELL_C]), v0));
+      s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(&val[k*SELL_C+4]), v1));
+    }
+    _mm256_storeu_pd(&sum[0], s0);
+    _mm256_storeu_pd(&sum[4], s1);
+    for (l = 0; l < SELL_C; l++) {
+      if (sell.row[c*SELL_C+l] >= 0) w[sell.row[c*SELL_C+l]] = sum[l];
+    }
+  }
+}
+
+
+// Checked on every call: a thread can land on a node without AVX2.
+static int sell_simd_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#elif defined(__aarch64__)
+//---------------------------------------------------------------------
+// sell_spmv_scalar() with NEON: four vectors of 2 lanes
+//---------------------------------------------------------------------
+static void sell_spmv_simd(const double v[], double w[], int c0, int c1)
+{
+  double sum[SELL_C];
+  float64x2_t s[SELL_C/2];
+  int c, k, l;
+
+  for (c = c0; c < c1; c++) {
+    const double *val = &sell.val[sell.ptr[c]];
+    const int *col = &sell.col[sell.ptr[c]];
+
+    for (l = 0; l < SELL_C/2; l++) s[l] = vdupq_n_f64(0.0);
+    for (k = 0; k < sell.len[c]; k++) {
+      const int *ck = &col[k*SELL_C];
+
+      for (l = 0; l < SELL_C/2; l++) {
+        float64x2_t vl = vsetq_lane_f64(v[ck[2*l+1]],
+                                        vdupq_n_f64(v[ck[2*l]]), 1);
+
+        s[l] = vaddq_f64(s[l], vmulq_f64(vld1q_f64(&val[k*SELL_C+2*l]), vl));
+      }
+    }
+    for (l = 0; l < SELL_C/2; l++) vst1q_f64(&sum[2*l], s[l]);
+    for (l = 0; l < SELL_C; l++) {
+      if (sell.row[c*SELL_C+l] >= 0) w[sell.row[c*SELL_C+l]] = sum[l];
+    }
+  }
+}
+
+
+static int sell_simd_supported(void)
+{
+  return 1;
+}
+#endif
+
+
+static void sell_spmv(const double v[], double w[], int c0, int c1)
+{
+#if defined(__x86_64__) || defined(__aarch64__)
+  if (sell_simd_supported()) {
+    sell_spmv_simd(v, w, c0, c1);
+    return;
+  }
+#endif
+  sell_spmv_scalar(v, w, c0, c1);
+}
+
+
+//---------------------------------------------------------------------
+// Build the SELL arrays from rowstr, colidx and a, and check them with
+// one product against the CSR one. Returns the name of the format.
+//---------------------------------------------------------------------
+static const char *sell_build(int nrows)
+{
+  static char name[64];
+  int nchunks = (nrows + SELL_C - 1) / SELL_C;
+  int c, l, j, row, *perm;
+  NZ_TYPE k, n, total;
+  const char *isa = "";
+  double *v, *w, sum;
+
+  perm = (int *)malloc(sizeof(int) * nchunks * SELL_C);
+  sell.len = (int *)malloc(sizeof(int) * nchunks);
+  sell.ptr = (NZ_TYPE *)malloc(sizeof(NZ_TYPE) * (nchunks + 1));
+  sell.row = (int *)malloc(sizeof(int) * nchunks * SELL_C);
+  if (perm == NULL || sell.len == NULL || sell.ptr == NULL ||
+      sell.row == NULL) {
+    printf(" Not enough memory for the SELL format\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (j = 0; j < nchunks * SELL_C; j++) {
+    perm[j] = j < nrows ? j : -1;
+  }
+  for (j = 0; j < nrows; j += SELL_SIGMA) {
+    qsort(&perm[j], nrows - j < SELL_SIGMA ? nrows - j : SELL_SIGMA,
+          sizeof(int), sell_cmp);
+  }
+
+  total = 0;
+  for (c = 0; c < nchunks; c++) {
+    n = 0;
+    for (l = 0; l < SELL_C; l++) {
+      row = perm[c*SELL_C+l];
+      if (row >= 0 && rowstr[row+1] - rowstr[row] > n) {
+        n = rowstr[row+1] - rowstr[row];
+      }
+      sell.row[c*SELL_C+l] = row;
+    }
+    sell.len[c] = (int)n;
+    sell.ptr[c] = total;
+    total += n * SELL_C;
+  }
+  sell.ptr[nchunks] = total;
+
+  sell.val = (double *)malloc(sizeof(double) * total);
+  sell.col = (int *)malloc(sizeof(int) * total);
+  if (sell.val == NULL || sell.col == NULL) {
+    printf(" Not enough memory for the SELL format\n");
+    exit(EXIT_FAILURE);
+  }
+  for (c = 0; c < nchunks; c++) {
+    for (l = 0; l < SELL_C; l++) {
+      row = sell.row[c*SELL_C+l];
+      for (k = 0; k < sell.len[c]; k++) {
+        n = sell.ptr[c] + k*SELL_C + l;
+        if (row >= 0 && k < rowstr[row+1] - rowstr[row]) {
+          sell.val[n] = a[rowstr[row] + k];
+          sell.col[n] = colidx[rowstr[row] + k];
+        } else {
+          sell.val[n] = 0.0;
+          sell.col[n] = 0;
+        }
+      }
+    }
+  }
+  free(perm);
+
+  //---------------------------------------------------------------------
+  // A wrong layout must not show up only as a failed verification, or
+  // worse as a different zeta within the tolerance.
+  //---------------------------------------------------------------------
+  v = (double *)malloc(sizeof(double) * 2 * (NA+2));
+  if (v == NULL) {
+    printf(" Not enough memory for the SELL format\n");
+    exit(EXIT_FAILURE);
+  }
+  w = v + NA+2;
+  for (j = 0; j < NA+2; j++) {
+    v[j] = 1.0 + (double)(j % 17) / 16.0;
+    w[j] = 0.0;
+  }
+  sell.nchunks = nchunks;
+  sell_spmv(v, w, 0, nchunks);
+  for (j = 0; j < nrows; j++) {
+    sum = 0.0;
+    for (k = rowstr[j]; k < rowstr[j+1]; k++) {
+      sum = sum + a[k]*v[colidx[k]];
+    }
+    if (fabs(w[j] - sum) > 1.0e-12 * fabs(sum)) {
+      printf(" SELL layout check failed at row %d: %20.13E, CSR %20.13E\n",
+             j, w[j], sum);
+      exit(EXIT_FAILURE);
+    }
+  }
+  free(v);
+
+  cg_remote_ranges[0].len = 0;
+  cg_remote_ranges[1].len = 0;
+  cg_remote_ranges[2].len = 0;
+  cg_remote_ranges[CG_SELL_RANGES+0] = (struct popcorn_range)
+      { sell.val, sizeof(double) * total, 0 };
+  cg_remote_ranges[CG_SELL_RANGES+1] = (struct popcorn_range)
+      { sell.col, sizeof(int) * total, 0 };
+  cg_remote_ranges[CG_SELL_RANGES+2] = (struct popcorn_range)
+      { sell.row, sizeof(int) * nchunks * SELL_C, 0 };
+  cg_remote_ranges[CG_SELL_RANGES+3] = (struct popcorn_range)
+      { sell.len, sizeof(int) * nchunks, 0 };
+  cg_remote_ranges[CG_SELL_RANGES+4] = (struct popcorn_range)
+      { sell.ptr, sizeof(NZ_TYPE) * (nchunks + 1), 0 };
+
+#if defined(__x86_64__)
+  if (sell_simd_supported()) isa = ", AVX2";
+#elif defined(__aarch64__)
+  isa = ", NEON";
+#endif
+  sprintf(name, "SELL-%d-%d, %.1f%% padding%s", SELL_C, SELL_SIGMA,
+          100.0 * (double)(total - rowstr[nrows]) / (double)total, isa);
+  return name;
+}
+
+
+//---------------------------------------------------------------------
+// The float copy of a and the float vectors of mixed precision.
+// Returns the name of the precision.
+//---------------------------------------------------------------------
+static const char *mixed_build(int nrows)
+{
+  NZ_TYPE k, total = rowstr[nrows];
+
+  mixed.a = (float *)malloc(sizeof(float) * total);
+  mixed.p = (float *)malloc(sizeof(float) * 3 * (NA+2));
+  if (mixed.a == NULL || mixed.p == NULL) {
+    printf(" Not enough memory for mixed precision\n");
+    exit(EXIT_FAILURE);
+  }
+  mixed.q = mixed.p + NA+2;
+  mixed.r = mixed.q + NA+2;
+  for (k = 0; k < total; k++) {
+    mixed.a[k] = (float)a[k];
+  }
+
+  // The double p and q are not used
+  cg_remote_ranges[5].len = 0;
+  cg_remote_ranges[6].len = 0;
+  cg_remote_ranges[CG_MIXED_RANGES+0] = (struct popcorn_range)
+      { mixed.a, sizeof(float) * total, 0 };
+  cg_remote_ranges[CG_MIXED_RANGES+1] = (struct popcorn_range)
+      { mixed.p, sizeof(float) * (NA+2), 1 };
+  cg_remote_ranges[CG_MIXED_RANGES+2] = (struct popcorn_range)
+      { mixed.q, sizeof(float) * (NA+2), 1 };
+  cg_remote_ranges[CG_MIXED_RANGES+3] = (struct popcorn_range)
+      { mixed.r, sizeof(float) * (NA+2), 1 };
+
+  return "mixed, float matrix and CG vectors, double residual";
+}
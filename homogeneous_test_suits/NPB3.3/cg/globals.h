@@ -119,6 +119,18 @@
 #define NZ    (NA*(NONZER+1)*(NONZER+1))
 #define NAZ   (NA*(NONZER+1))
 
+//---------------------------------------------------------------------
+//  Positions in a[] and colidx[] (rowstr[] and the loops over it) need
+//  more than an int once NZ does: class E, or a large custom class.
+//---------------------------------------------------------------------
+#if NZ > 2147483647
+typedef long NZ_TYPE;
+#define NZ_FMT "%ld"
+#else
+typedef int  NZ_TYPE;
+#define NZ_FMT "%d"
+#endif
+
 #define T_init        0
 #define T_bench       1
 #define T_conj_grad   2
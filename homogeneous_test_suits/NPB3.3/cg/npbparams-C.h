@@ -0,0 +1,22 @@
+/* CLASS = C */
+/*
+   This file is generated automatically by the setparams utility.
+   It sets the number of processors and the class of the NPB
+   in this directory. Do not modify it by hand.   
+*/
+#define NA      150000
+#define NONZER  15
+#define NITER   75
+#define SHIFT   110.0
+#define RCOND   1.0e-1
+
+#define CONVERTDOUBLE  false
+#define COMPILETIME "03 Nov 2017"
+#define NPBVERSION "3.3.1"
+#define CS1 "gcc"
+#define CS2 "$(CC)"
+#define CS3 "-lm"
+#define CS4 "-I../common"
+#define CS5 "-g -Wall -O3 -mcmodel=medium"
+#define CS6 "-O3 -mcmodel=medium"
+#define CS7 "randdp"
@@ -32,6 +32,7 @@ void initADCpar(ADC_PAR *par){
 }
 int ParseParFile(char* parfname,ADC_PAR *par);
 int GenerateADC(ADC_PAR *par);
+FILE *AdcFileOpen(const char *fileName, const char *mode);
 
 typedef struct Factorization{
   long int *mlt;
@@ -351,7 +352,7 @@ int CalculateVeiwSizes(ADC_PAR *par){
   vszefname0="view.sz";
   vszefname=(char*)calloc(BlockSize,sizeof(char));
   sprintf(vszefname,"%s.%s.%d",adcfname,vszefname0,NDID);
-  if(!(view = fopen(vszefname, "w+")) ) {
+  if(!(view = AdcFileOpen(vszefname, "w+")) ) {
     fprintf(stderr,"CalculateVeiwSizes: Can't open file: %s\n",vszefname);
     return 0;
   }
@@ -584,6 +585,8 @@ int GenerateADC(ADC_PAR *par){
   FILE *adc;
   int i=0,j=0;
   long long int* attr=NULL,*mes=NULL; 
+  int recsize=8*mesnum+4*dcdim;
+  char *rec=NULL,*adcbuf=NULL;
 /*
    if(par->isascii==1){
     sprintf(adcfname,"%s.tpl.%d",par->filename,par->ndid);
@@ -594,13 +597,17 @@ int GenerateADC(ADC_PAR *par){
   }else{
 */
   sprintf(adcfname,"%s.dat.%d",par->filename,par->ndid);
-    if(!(adc = fopen(adcfname, "wb+"))){
+    if(!(adc = AdcFileOpen(adcfname, "wb+"))){
       fprintf(stderr,"GenerateADC: Can't open file: %s\n",adcfname);
        return 0;
     }
 /*  } */
   attr=(long long int *)malloc(dcdim*sizeof(long long int));
   mes=(long long int *)malloc(mesnum*sizeof(long long int));
+  rec=(char *)malloc(recsize);
+  /* whole tuples through a large buffer, not a write per field */
+  adcbuf=(char *)malloc(BlockSize*BlockSize);
+  if(adcbuf) setvbuf(adc,adcbuf,_IOFBF,BlockSize*BlockSize);
 
   fprintf(stdout,"\nGenerateADC: writing %d tuples of %d attributes and %d measures to %s\n",
 		  tplnum,dcdim,mesnum,adcfname);
@@ -616,16 +623,22 @@ int GenerateADC(ADC_PAR *par){
       for(j=0;j<mesnum;j++){ 
     	long long mv =  mes[j];
 	    if(par->inverse_endian==1) swap8(&mv);
-	    fwrite(&mv, 8, 1, adc); 
+	    memcpy(rec+8*j, &mv, 8); 
       }
       for(j=0;j<dcdim;j++){ 
     	int av = attr[j]; 
 	if(par->inverse_endian==1) swap4(&av);
-	fwrite(&av, 4, 1, adc); 
+	memcpy(rec+8*mesnum+4*j, &av, 4); 
+      }
+      if(fwrite(rec, recsize, 1, adc)!=1){
+        fprintf(stderr,"GenerateADC: Can't write file: %s\n",adcfname);
+        return 0;
       }
     }
 /*  } */
   fclose(adc);
+  free(adcbuf);
+  free(rec);
   fprintf(stdout,"Binary ADC file %s ",adcfname);
   fprintf(stdout,"have been generated.\n");
   free(attr);
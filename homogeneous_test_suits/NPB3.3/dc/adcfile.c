@@ -0,0 +1,175 @@
+/* The files of the ADC (ADC.dat, ADC.view.sz and the per task files).
+ *
+ * By default they are files on disk. With DC_FILES=memory they are
+ * buffers in memory, kept by name until deleted, read and written
+ * through stdio streams (fopencookie), so that DC does no file I/O
+ * at all: on Popcorn a task on another node would otherwise send every
+ * read and write of its files back to the origin node.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "adc.h"
+
+#ifdef UNIX
+#include <unistd.h>
+#endif
+
+/* ADC.dat and ADC.view.sz, and 5 files per task */
+#define MAX_NUM_OF_MEM_FILES (2+5*MAX_NUMBER_OF_TASKS)
+
+typedef struct {
+   char    name[MAX_FILE_FULL_PATH_SIZE];
+   char   *buf;
+   size_t  size;
+   size_t  capacity;
+   uint32  used;
+} MEM_FILE;
+
+typedef struct {
+   MEM_FILE *mf;
+   off64_t   pos;
+} MEM_STREAM;
+
+static int32 inMemory = 0;
+static MEM_FILE memFiles[MAX_NUM_OF_MEM_FILES];
+static pthread_mutex_t memFilesLock = PTHREAD_MUTEX_INITIALIZER;
+
+void AdcFilesInit(void){
+   const char *env = getenv("DC_FILES");
+
+   inMemory = env != NULL && strcmp(env, "memory") == 0;
+   fprintf(stdout," ADC files: %s\n", inMemory ? "in memory" : "on disk");
+}
+
+/* The file called fileName, created if 'create' */
+static MEM_FILE *MemFileFind(const char *fileName, uint32 create){
+   MEM_FILE *mf = NULL;
+   uint32 i;
+
+   pthread_mutex_lock(&memFilesLock);
+   for ( i = 0; i < MAX_NUM_OF_MEM_FILES; i++ ) {
+      if (memFiles[i].used && !strcmp(memFiles[i].name, fileName)) {
+         mf = &memFiles[i];
+         break;
+      }
+   }
+   for ( i = 0; !mf && create && i < MAX_NUM_OF_MEM_FILES; i++ ) {
+      if (!memFiles[i].used) {
+         mf = &memFiles[i];
+         strcpy(mf->name, fileName);
+         mf->used = 1;
+      }
+   }
+   pthread_mutex_unlock(&memFilesLock);
+   return mf;
+}
+
+static ssize_t MemFileRead(void *cookie, char *buf, size_t size){
+   MEM_STREAM *ms = (MEM_STREAM*) cookie;
+
+   if (ms->pos >= (off64_t) ms->mf->size) return 0;
+   if (size > ms->mf->size - ms->pos) size = ms->mf->size - ms->pos;
+   memcpy(buf, ms->mf->buf + ms->pos, size);
+   ms->pos += size;
+   return size;
+}
+
+static ssize_t MemFileWrite(void *cookie, const char *buf, size_t size){
+   MEM_STREAM *ms = (MEM_STREAM*) cookie;
+   MEM_FILE *mf = ms->mf;
+   size_t end = ms->pos + size;
+
+   if (end > mf->capacity) {
+      size_t capacity = mf->capacity ? mf->capacity : BUFSIZ;
+      char *nbuf;
+
+      while (capacity < end) capacity *= 2;
+      if (!(nbuf = (char*) realloc(mf->buf, capacity))) {
+         errno = ENOMEM;
+         return 0;
+      }
+      mf->buf = nbuf;
+      mf->capacity = capacity;
+   }
+   if ((size_t) ms->pos > mf->size)
+      memset(mf->buf + mf->size, 0, ms->pos - mf->size);
+   memcpy(mf->buf + ms->pos, buf, size);
+   ms->pos = end;
+   if (end > mf->size) mf->size = end;
+   return size;
+}
+
+static int MemFileSeek(void *cookie, off64_t *offset, int whence){
+   MEM_STREAM *ms = (MEM_STREAM*) cookie;
+   off64_t pos = *offset;
+
+   if (whence == SEEK_CUR) pos += ms->pos;
+   else if (whence == SEEK_END) pos += ms->mf->size;
+   if (pos < 0) {
+      errno = EINVAL;
+      return -1;
+   }
+   *offset = ms->pos = pos;
+   return 0;
+}
+
+static int MemFileClose(void *cookie){
+   free(cookie);
+   return 0;
+}
+
+static FILE *MemFileOpen(const char *fileName, const char *mode){
+   cookie_io_functions_t io =
+      { MemFileRead, MemFileWrite, MemFileSeek, MemFileClose };
+   MEM_STREAM *ms;
+   MEM_FILE *mf;
+   FILE *f;
+
+   if (!(mf = MemFileFind(fileName, mode[0] != 'r'))) {
+      errno = mode[0] == 'r' ? ENOENT : ENFILE;
+      return NULL;
+   }
+   if (!(ms = (MEM_STREAM*) malloc(sizeof(MEM_STREAM)))) return NULL;
+   ms->mf = mf;
+   ms->pos = 0;
+   if (mode[0] == 'w') mf->size = 0;
+   if (mode[0] == 'a') ms->pos = mf->size;
+   if (!(f = fopencookie(ms, mode, io))) free(ms);
+   return f;
+}
+
+FILE * AdcFileOpen(const char *fileName, const char *mode){
+   FILE *fr;
+
+   if (inMemory) fr = MemFileOpen(fileName, mode);
+   else fr = (FILE*) fopen(fileName, mode);
+   if (fr==NULL)
+      fprintf(stderr, "AdcFileOpen: Cannot open the file %s errno = %d\n",
+                       fileName, errno);
+   return fr;
+}
+int32 DeleteOneFile(const char * file_name) {
+   MEM_FILE *mf;
+
+   if (inMemory) {
+      if (!(mf = MemFileFind(file_name, 0))) return -1;
+      free(mf->buf);
+      mf->buf = NULL;
+      mf->size = mf->capacity = 0;
+      pthread_mutex_lock(&memFilesLock);
+      mf->used = 0;
+      pthread_mutex_unlock(&memFilesLock);
+      return 0;
+   }
+#  ifdef WINNT
+      return(remove(file_name));
+#  else
+      return(unlink(file_name));
+#  endif
+}
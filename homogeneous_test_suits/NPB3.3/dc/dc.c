@@ -53,6 +53,12 @@
 #include "macrodef.h"
 #include "npbparams.h"
 
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_team.h"
+
+// Region ID for popcorn_profile.h
+#define DC_REGION_VIEWS 1
+
 #ifdef UNIX
 #include <sys/types.h>
 #include <unistd.h>
@@ -88,6 +94,7 @@ int ParseParFile(char* parfname, ADC_PAR *par);
 int GenerateADC(ADC_PAR *par);
 void ShowADCPar(ADC_PAR *par);
 int32 DC(ADC_VIEW_PARS *adcpp);
+void AdcFilesInit(void);
 int Verify(long long int checksum,ADC_VIEW_PARS *adcpp);
 
 #define BlockSize 1024
@@ -125,6 +132,7 @@ int main ( int argc, char * argv[] )
     exit(1);
   }
   ShowADCPar(parp); 
+  AdcFilesInit();
   if(!GenerateADC(parp)) {
      PutErrMsg("main.GenerateAdc failed")
      exit(1);
@@ -134,7 +142,8 @@ int main ( int argc, char * argv[] )
   adcpp->clss = parp->clss;
   adcpp->nd = parp->dim;
   adcpp->nm = parp->mnum;
-  adcpp->nTasks = 1;
+  /* a task per thread of the team */
+  adcpp->nTasks = popcorn_team_init(DC_REGION_VIEWS);
   if(argc>=2)
     adcpp->memoryLimit = atoi(argv[1]);
   else
@@ -153,6 +162,7 @@ int main ( int argc, char * argv[] )
      fprintf(stderr, "main.ParRun failed: retcode = %d\n", retCode);
      exit(1);
   }
+  popcorn_team_fini();
 
   if(parp)  { free(parp);   parp = 0; }
   if(adcpp) { free(adcpp); adcpp = 0; }
@@ -164,35 +174,40 @@ int32		 PartitionCube(ADC_VIEW_CNTL *avp);
 ADC_VIEW_CNTL *NewAdcViewCntl(ADC_VIEW_PARS *adcpp, uint32 pnum);
 int32		 ComputeGivenGroupbys(ADC_VIEW_CNTL *adccntl);
 
-int32 DC(ADC_VIEW_PARS *adcpp) {
-   int32 itsk=0;
-   double t_total=0.0;
-   int verified;
+typedef struct { 
+   int    verificationFailed;
+   uint32 totalViewTuples;
+   uint64 totalViewSizesInBytes;
+   uint32 totalNumberOfMadeViews;
+   uint64 checksum;
+   double tm_max;
+} PAR_VIEW_ST;
 
-   typedef struct { 
-      int    verificationFailed;
-      uint32 totalViewTuples;
-      uint64 totalViewSizesInBytes;
-      uint32 totalNumberOfMadeViews;
-      uint64 checksum;
-      double tm_max;
-   } PAR_VIEW_ST;
-   
-   PAR_VIEW_ST *pvstp;
+struct dc_args {
+   ADC_VIEW_PARS *adcpp;
+   int32 retCode[POPCORN_TEAM_MAX];
+   PAR_VIEW_ST pvst[POPCORN_TEAM_MAX];
+};
+
+/* Task 'itsk' of the views, on thread itsk of the team */
+static void dc_task(int itsk, void *arg) {
+   struct dc_args *p = (struct dc_args *) arg;
+   PAR_VIEW_ST *pvstp = &p->pvst[itsk];
    ADC_VIEW_CNTL *adccntlp;
 
-   pvstp = (PAR_VIEW_ST*) malloc(sizeof(PAR_VIEW_ST));
    pvstp->verificationFailed = 0;
    pvstp->totalViewTuples = 0;
    pvstp->totalViewSizesInBytes = 0;
    pvstp->totalNumberOfMadeViews = 0;
    pvstp->checksum = 0;
    pvstp->tm_max = 0.0;
+   p->retCode[itsk] = ADC_OK;
    
-   adccntlp = NewAdcViewCntl(adcpp, itsk);
+   adccntlp = NewAdcViewCntl(p->adcpp, itsk);
    if (!adccntlp) { 
       PutErrMsg("ParRun.NewAdcViewCntl: returned NULL")
-      return ADC_INTERNAL_ERROR;
+      p->retCode[itsk] = ADC_INTERNAL_ERROR;
+      return;
    }else{
      if (adccntlp->retCode!=0) {
    	fprintf(stderr, 
@@ -221,6 +236,33 @@ int32 DC(ADC_VIEW_PARS *adcpp) {
      PutErrMsg("ParRun.CloseAdcView: is failed");
      adccntlp->verificationFailed = 1;
    }
+}
+
+int32 DC(ADC_VIEW_PARS *adcpp) {
+   int32 itsk=0;
+   double t_total=0.0;
+   int verified;
+   struct dc_args *p;
+   PAR_VIEW_ST *pvstp;
+
+   p = (struct dc_args*) malloc(sizeof(struct dc_args));
+   p->adcpp = adcpp;
+   /* wtime() takes its origin at its first call: not in the tasks */
+   timer_start(0);
+   popcorn_team_run(dc_task, p);
+
+   pvstp = &p->pvst[0];
+   for (itsk = 0; itsk < adcpp->nTasks; itsk++) {
+     if (p->retCode[itsk]) return p->retCode[itsk];
+     if (itsk == 0) continue;
+     pvstp->verificationFailed += p->pvst[itsk].verificationFailed;
+     pvstp->totalNumberOfMadeViews += p->pvst[itsk].totalNumberOfMadeViews;
+     pvstp->totalViewSizesInBytes += p->pvst[itsk].totalViewSizesInBytes;
+     pvstp->totalViewTuples += p->pvst[itsk].totalViewTuples;
+     pvstp->checksum += p->pvst[itsk].checksum;
+     if (p->pvst[itsk].tm_max > pvstp->tm_max)
+       pvstp->tm_max = p->pvst[itsk].tm_max;
+   }
 
    t_total=pvstp->tm_max; 
 
@@ -260,6 +302,7 @@ int32 DC(ADC_VIEW_PARS *adcpp) {
   		   C_INC,
   		   CFLAGS,
   		   CLINKFLAGS); 
+   free(p);
    return ADC_OK;
 }
 
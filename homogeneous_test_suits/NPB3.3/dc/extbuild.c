@@ -556,13 +556,6 @@ void SelectToView( uint32 * ib, uint32 *ix, uint32 *viewBuf,
    for ( j = 0, i = 0; i < nv; i++ ) viewBuf[2*nm+j++] = ib[2*nm+ix[i]-1];
    memcpy(&viewBuf[0], &ib[0], MSR_FSZ*nm);
 }
-FILE * AdcFileOpen(const char *fileName, const char *mode){
-   FILE *fr;
-   if ((fr = (FILE*) fopen(fileName, mode))==NULL)
-      fprintf(stderr, "AdcFileOpen: Cannot open the file %s errno = %d\n",  
-                       fileName, errno);
-   return fr;
-}
 void AdcFileName(char *adcFileName, const char *adcName, 
 		 const char *fileName, uint32 taskNumber){
   sprintf(adcFileName, "%s.%s.%d",adcName,fileName,taskNumber);
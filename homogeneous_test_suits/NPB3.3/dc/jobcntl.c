@@ -55,22 +55,17 @@ uint32 setLeadingOnes32(uint32 n){
    } 
    return (x);
 }
-int32 DeleteOneFile(const char * file_name) {
-#  ifdef WINNT
-      return(remove(file_name));
-#  else
-      return(unlink(file_name));
-#  endif
-}
 void WriteOne32Tuple(char * t, uint32 s, uint32 l, FILE * logf) {
   uint64 ob = MLB32;
   uint32 i;
+  char bits[32+1];
             
-  fprintf(logf, "\n %s", t);
-  for ( i = 0; i < l; i++ ) {
-    if (s&ob) fprintf(logf, "1"); else fprintf(logf, "0");
+  for ( i = 0; i < l && i < 32; i++ ) {
+    bits[i] = (s&ob) ? '1' : '0';
     ob >>= 1;
   }
+  bits[i] = '\0';
+  fprintf(logf, "\n %s%s", t, bits);
 }
 uint32 NumOfCombsFromNbyK( uint32 n, uint32 k ){
   uint32 l, combsNbyK;
@@ -278,12 +273,14 @@ void JobPoolInit(JOB_POOL *jpp, uint32 n, uint32 nd){
 void WriteOne64Tuple(char * t, uint64 s, uint32 l, FILE * logf){
    uint64 ob = MLB;
    uint32 i;
+   char bits[64+1];
             
-   fprintf(logf, "\n %s", t);
-   for ( i = 0; i < l; i++ ) {
-      if (s&ob) fprintf(logf, "1"); else fprintf(logf, "0");
+   for ( i = 0; i < l && i < 64; i++ ) {
+      bits[i] = (s&ob) ? '1' : '0';
       ob >>= 1;
    }
+   bits[i] = '\0';
+   fprintf(logf, "\n %s%s", t, bits);
 }
 uint32 NumberOfOnes(uint64 s){
    uint64 ob = MLB;
@@ -14,6 +14,8 @@
 
  int32 DeleteOneFile(const char * file_name);
 
+  FILE *AdcFileOpen(const char *fileName, const char *mode);
+
   void WriteOne64Tuple(char * t, uint64 s, uint32 l, FILE * logf);
 
  int32 ViewSizesVerification(ADC_VIEW_CNTL *adccntlp);
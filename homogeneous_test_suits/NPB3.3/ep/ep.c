@@ -47,7 +47,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 #include "migrate.h"
+
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_nodes.h"
+#include "popcorn_team.h"
+
+// Region ID for popcorn_profile.h
+#define EP_REGION_GAUSSIAN_PAIRS 1
 #include "type.h"
 #include "npbparams.h"
 #include "randdp.h"
@@ -68,15 +80,294 @@
 static double x[2*NK];
 static double q[NQ]; 
 
+// Pairs transformed at a time by gaussian_pairs()
+#define NB        64
+
+// Arguments and results of gaussian_pairs(), for the threads of the team
+struct pairs_args {
+  double an;
+  int np;
+  logical timers_enabled;
+  double sx, sy;
+  double q[NQ];
+};
+
+
+//--------------------------------------------------------------------
+//  Move the pairs of x[0..2*nk) that fall in the unit circle, mapped
+//  to (-1, 1), to the front of x in order and return their number.
+//  Pairs before i are done already, and n of them were kept.
+//--------------------------------------------------------------------
+static int accept_scalar(int nk, double x[], int i, int n)
+{
+  double x1, x2;
+
+  for (; i < nk; i++) {
+    x1 = 2.0 * x[2*i] - 1.0;
+    x2 = 2.0 * x[2*i+1] - 1.0;
+    if (x1 * x1 + x2 * x2 <= 1.0) {
+      x[2*n] = x1;
+      x[2*n+1] = x2;
+      n++;
+    }
+  }
+  return n;
+}
+
+
+//--------------------------------------------------------------------
+//  t2 = sqrt(-2.0 * log(t1) / t1) and the deviates x1 * t2, x2 * t2 of
+//  nb pairs, with lg = log(t1)
+//--------------------------------------------------------------------
+static void deviates_scalar(int nb, double x1[], double x2[],
+                            const double t1[], const double lg[])
+{
+  int j;
+  double t2;
+
+  for (j = 0; j < nb; j++) {
+    t2 = sqrt(-2.0 * lg[j] / t1[j]);
+    x1[j] = x1[j] * t2;
+    x2[j] = x2[j] * t2;
+  }
+}
+
+
+#if defined(__x86_64__)
+//--------------------------------------------------------------------
+//  accept_scalar() and deviates_scalar() with AVX, four pairs at a
+//  time. The products, sums, quotients and square roots are those of
+//  the scalar loops, so the results do not change.
+//--------------------------------------------------------------------
+__attribute__((target("avx")))
+static int accept_simd(int nk, double x[])
+{
+  __m256d two = _mm256_set1_pd(2.0), one = _mm256_set1_pd(1.0);
+  double y[8];
+  int i, p, n = 0, mask;
+
+  for (i = 0; i < nk / 4 * 4; i += 4) {
+    __m256d a = _mm256_sub_pd(_mm256_mul_pd(two, _mm256_loadu_pd(&x[2*i])),
+                              one);
+    __m256d b = _mm256_sub_pd(_mm256_mul_pd(two, _mm256_loadu_pd(&x[2*i+4])),
+                              one);
+    // x1 * x1 + x2 * x2 of pairs 0, 2, 1 and 3
+    __m256d t = _mm256_hadd_pd(_mm256_mul_pd(a, a), _mm256_mul_pd(b, b));
+
+    mask = _mm256_movemask_pd(_mm256_cmp_pd(t, one, _CMP_LE_OQ));
+    _mm256_storeu_pd(&y[0], a);
+    _mm256_storeu_pd(&y[4], b);
+    for (p = 0; p < 4; p++) {
+      if (mask & (1 << ((p & 1) * 2 + (p >> 1)))) {
+        x[2*n] = y[2*p];
+        x[2*n+1] = y[2*p+1];
+        n++;
+      }
+    }
+  }
+  return accept_scalar(nk, x, i, n);
+}
+
+
+__attribute__((target("avx")))
+static void deviates_simd(int nb, double x1[], double x2[],
+                          const double t1[], const double lg[])
+{
+  __m256d m2 = _mm256_set1_pd(-2.0);
+  int j;
+
+  for (j = 0; j + 4 <= nb; j += 4) {
+    __m256d t2 = _mm256_sqrt_pd(_mm256_div_pd(
+        _mm256_mul_pd(m2, _mm256_loadu_pd(&lg[j])), _mm256_loadu_pd(&t1[j])));
+    _mm256_storeu_pd(&x1[j], _mm256_mul_pd(_mm256_loadu_pd(&x1[j]), t2));
+    _mm256_storeu_pd(&x2[j], _mm256_mul_pd(_mm256_loadu_pd(&x2[j]), t2));
+  }
+  deviates_scalar(nb - j, &x1[j], &x2[j], &t1[j], &lg[j]);
+}
+
+
+// Checked for every thread: it can land on a node without AVX.
+static int pairs_simd_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx");
+}
+#elif defined(__aarch64__)
+//--------------------------------------------------------------------
+//  accept_scalar() and deviates_scalar() with NEON, two pairs at a time
+//--------------------------------------------------------------------
+static int accept_simd(int nk, double x[])
+{
+  float64x2_t one = vdupq_n_f64(1.0);
+  int i, n = 0;
+
+  for (i = 0; i < nk / 2 * 2; i += 2) {
+    float64x2x2_t v = vld2q_f64(&x[2*i]);
+    float64x2_t x1 = vsubq_f64(vmulq_n_f64(v.val[0], 2.0), one);
+    float64x2_t x2 = vsubq_f64(vmulq_n_f64(v.val[1], 2.0), one);
+    uint64x2_t in = vcleq_f64(vaddq_f64(vmulq_f64(x1, x1),
+                                        vmulq_f64(x2, x2)), one);
+
+    if (vgetq_lane_u64(in, 0)) {
+      x[2*n] = vgetq_lane_f64(x1, 0);
+      x[2*n+1] = vgetq_lane_f64(x2, 0);
+      n++;
+    }
+    if (vgetq_lane_u64(in, 1)) {
+      x[2*n] = vgetq_lane_f64(x1, 1);
+      x[2*n+1] = vgetq_lane_f64(x2, 1);
+      n++;
+    }
+  }
+  return accept_scalar(nk, x, i, n);
+}
+
+
+static void deviates_simd(int nb, double x1[], double x2[],
+                          const double t1[], const double lg[])
+{
+  int j;
+
+  for (j = 0; j + 2 <= nb; j += 2) {
+    float64x2_t t2 = vsqrtq_f64(vdivq_f64(vmulq_n_f64(vld1q_f64(&lg[j]), -2.0),
+                                          vld1q_f64(&t1[j])));
+    vst1q_f64(&x1[j], vmulq_f64(vld1q_f64(&x1[j]), t2));
+    vst1q_f64(&x2[j], vmulq_f64(vld1q_f64(&x2[j]), t2));
+  }
+  deviates_scalar(nb - j, &x1[j], &x2[j], &t1[j], &lg[j]);
+}
+
+
+static int pairs_simd_supported(void)
+{
+  return 1;
+}
+#else
+static int accept_simd(int nk, double x[])
+{
+  return accept_scalar(nk, x, 0, 0);
+}
+
+
+static void deviates_simd(int nb, double x1[], double x2[],
+                          const double t1[], const double lg[])
+{
+  deviates_scalar(nb, x1, x2, t1, lg);
+}
+
+
+static int pairs_simd_supported(void)
+{
+  return 0;
+}
+#endif
+
+
+//--------------------------------------------------------------------
+//  The batches of random pairs of thread tid. Each batch starts from
+//  its own seed, so the team splits them like the MPI version splits
+//  them over the processes, and the sums are reduced in tid order.
+//--------------------------------------------------------------------
+static void gaussian_pairs(int tid, void *arg)
+{
+  struct pairs_args *p = (struct pairs_args *)arg;
+  double *xt = tid == 0 ? x : popcorn_node_malloc(
+      sizeof(double) * 2 * NK, popcorn_team_node(tid));
+  double t1, t2, t3, t4, sx = 0.0, sy = 0.0, qt[NQ];
+  double x1[NB], x2[NB], tb[NB], lg[NB];
+  int simd = pairs_simd_supported();
+  int i, ik, kk, l, k, n, j, nb, lo, hi;
+  int k_offset = -1;
+
+  for (i = 0; i < NQ; i++) {
+    qt[i] = 0.0;
+  }
+
+  //--------------------------------------------------------------------
+  //  Each instance of this loop may be performed independently. We compute
+  //  the k offsets separately to take into account the fact that some nodes
+  //  have more numbers to generate than others
+  //--------------------------------------------------------------------
+  popcorn_team_split(1, p->np + 1, &lo, &hi);
+  for (k = lo; k < hi; k++) {
+    kk = k_offset + k; 
+    t1 = S;
+    t2 = p->an;
+
+    // Find starting seed t1 for this kk.
+
+    for (i = 1; i <= 100; i++) {
+      ik = kk / 2;
+      if ((2 * ik) != kk) t3 = randlc(&t1, t2);
+      if (ik == 0) break;
+      t3 = randlc(&t2, t2);
+      kk = ik;
+    }
+
+    //--------------------------------------------------------------------
+    //  Compute uniform pseudorandom numbers.
+    //--------------------------------------------------------------------
+    if (p->timers_enabled && tid == 0) timer_start(2);
+    vranlc(2 * NK, &t1, A, xt);
+    if (p->timers_enabled && tid == 0) timer_stop(2);
+
+    //--------------------------------------------------------------------
+    //  Compute Gaussian deviates by acceptance-rejection method and 
+    //  tally counts in concentri//square annuli. The accepted pairs
+    //  are packed first, then transformed NB at a time; only log()
+    //  and the tallies stay one pair at a time.
+    //--------------------------------------------------------------------
+    if (p->timers_enabled && tid == 0) timer_start(1);
+
+    n = simd ? accept_simd(NK, xt) : accept_scalar(NK, xt, 0, 0);
+    for (i = 0; i < n; i += NB) {
+      nb = n - i < NB ? n - i : NB;
+      for (j = 0; j < nb; j++) {
+        x1[j] = xt[2*(i+j)];
+        x2[j] = xt[2*(i+j)+1];
+        tb[j] = x1[j] * x1[j] + x2[j] * x2[j];
+        lg[j] = log(tb[j]);
+      }
+      if (simd) deviates_simd(nb, x1, x2, tb, lg);
+      else deviates_scalar(nb, x1, x2, tb, lg);
+      for (j = 0; j < nb; j++) {
+        t3   = x1[j];
+        t4   = x2[j];
+        l    = MAX(fabs(t3), fabs(t4));
+        qt[l] = qt[l] + 1.0;
+        sx   = sx + t3;
+        sy   = sy + t4;
+      }
+    }
+
+    if (p->timers_enabled && tid == 0) timer_stop(1);
+  }
+
+  sx = popcorn_team_sum(sx);
+  sy = popcorn_team_sum(sy);
+  for (i = 0; i < NQ; i++) {
+    qt[i] = popcorn_team_sum(qt[i]);
+  }
+  if (tid == 0) {
+    p->sx = sx;
+    p->sy = sy;
+    for (i = 0; i < NQ; i++) {
+      p->q[i] = qt[i];
+    }
+  } else {
+    popcorn_node_free(xt);
+  }
+}
+
 
 int main() 
 {
-  double Mops, t1, t2, t3, t4, x1, x2;
+  double Mops, t1;
   double sx, sy, tm, an, tt, gc;
   double sx_verify_value, sy_verify_value, sx_err, sy_err;
   int    np;
-  int    i, ik, kk, l, k, nit;
-  int    k_offset, j;
+  int    i, nit;
+  int    j;
   logical verified, timers_enabled;
 
   double dum[3] = {1.0, 1.0, 1.0};
@@ -129,12 +420,19 @@ int main()
   }
   Mops = log(sqrt(fabs(MAX(1.0, 1.0))));   
 
+  //--------------------------------------------------------------------
+  //  The batches are split over a team of $POPCORN_THREADS threads
+  //  spread over the nodes. A team of one migrates instead.
+  //--------------------------------------------------------------------
+  popcorn_team_init(EP_REGION_GAUSSIAN_PAIRS);
+
   timer_clear(0);
   timer_clear(1);
   timer_clear(2);
   timer_start(0);
 
-  migrate(1, NULL, NULL);
+  if (popcorn_team_size() == 1)
+    popcorn_migrate_best(EP_REGION_GAUSSIAN_PAIRS);
 
   t1 = A;
   vranlc(0, &t1, A, x);
@@ -146,82 +444,32 @@ int main()
   t1 = A;
 
   for (i = 0; i < MK + 1; i++) {
-    t2 = randlc(&t1, t1);
+    randlc(&t1, t1);
   }
 
   an = t1;
   tt = S;
   gc = 0.0;
-  sx = 0.0;
-  sy = 0.0;
-
-  for (i = 0; i < NQ; i++) {
-    q[i] = 0.0;
-  }
-
-  //--------------------------------------------------------------------
-  //  Each instance of this loop may be performed independently. We compute
-  //  the k offsets separately to take into account the fact that some nodes
-  //  have more numbers to generate than others
-  //--------------------------------------------------------------------
-
-  k_offset = -1;
-
-  for (k = 1; k <= np; k++) {
-    kk = k_offset + k; 
-    t1 = S;
-    t2 = an;
-
-    // Find starting seed t1 for this kk.
-
-    for (i = 1; i <= 100; i++) {
-      ik = kk / 2;
-      if ((2 * ik) != kk) t3 = randlc(&t1, t2);
-      if (ik == 0) break;
-      t3 = randlc(&t2, t2);
-      kk = ik;
-    }
 
-    //--------------------------------------------------------------------
-    //  Compute uniform pseudorandom numbers.
-    //--------------------------------------------------------------------
-    if (timers_enabled) timer_start(2);
-    vranlc(2 * NK, &t1, A, x);
-    if (timers_enabled) timer_stop(2);
+  struct pairs_args p = { an, np, timers_enabled };
 
-    //--------------------------------------------------------------------
-    //  Compute Gaussian deviates by acceptance-rejection method and 
-    //  tally counts in concentri//square annuli.  This loop is not 
-    //  vectorizable. 
-    //--------------------------------------------------------------------
-    if (timers_enabled) timer_start(1);
-
-    for (i = 0; i < NK; i++) {
-      x1 = 2.0 * x[2*i] - 1.0;
-      x2 = 2.0 * x[2*i+1] - 1.0;
-      t1 = x1 * x1 + x2 * x2;
-      if (t1 <= 1.0) {
-        t2   = sqrt(-2.0 * log(t1) / t1);
-        t3   = (x1 * t2);
-        t4   = (x2 * t2);
-        l    = MAX(fabs(t3), fabs(t4));
-        q[l] = q[l] + 1.0;
-        sx   = sx + t3;
-        sy   = sy + t4;
-      }
-    }
-
-    if (timers_enabled) timer_stop(1);
+  popcorn_team_run(gaussian_pairs, &p);
+  sx = p.sx;
+  sy = p.sy;
+  for (i = 0; i < NQ; i++) {
+    q[i] = p.q[i];
   }
 
   for (i = 0; i < NQ; i++) {
     gc = gc + q[i];
   }
 
-  migrate(0, NULL, NULL);
+  if (popcorn_team_size() == 1)
+    popcorn_migrate_home(EP_REGION_GAUSSIAN_PAIRS);
 
   timer_stop(0);
   tm = timer_read(0);
+  popcorn_team_fini();
 
   nit = 0;
   verified = true;
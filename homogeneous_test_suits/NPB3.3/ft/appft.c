@@ -35,6 +35,14 @@
 #include <stdlib.h>
 #include <math.h>
 #include "migrate.h"
+
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_ranges.h"
+#include "popcorn_team.h"
+#include "popcorn_huge.h"
+
+// Region ID for popcorn_profile.h
+#define FT_REGION_EVOLVE 1
 #include "global.h"
 #include "timers.h"
 
@@ -44,41 +52,47 @@
 static dcomplex sums[NITER_DEFAULT+1];
 
 /* common /mainarrays/ */
-static double twiddle[NZ][NY][NX+1];
-static dcomplex xnt[NZ][NY][NX+1];
-static dcomplex y[NZ][NY][NX+1];
+// On 2MB pages with $POPCORN_HUGE (see popcorn_huge.h)
+static double twiddle[NZ][NY][NX+1] POPCORN_HUGE_ALIGN;
+static dcomplex xnt[NZ][NY][NX+1] POPCORN_HUGE_ALIGN;
+static dcomplex y[NZ][NY][NX+1] POPCORN_HUGE_ALIGN;
+
+// Working set of the timed section, taken along to the remote node
+static struct popcorn_range ft_ranges[] = {
+  POPCORN_RANGE_RW(sums),
+  POPCORN_RANGE_RW(twiddle),
+  POPCORN_RANGE_RW(xnt),
+  POPCORN_RANGE_RW(y),
+};
 //static dcomplex pad1[128], pad2[128];
 
 
-void appft(int niter, double *total_time, logical *verified)
-{
-  int i, j, k, kt, n12, n22, n32, ii, jj, kk, ii2, ik2;
-  double ap;
-
-  dcomplex exp1[NX], exp2[NY], exp3[NZ];
+// Arguments of evolve_team(), for the threads of the team
+struct evolve_args {
+  int niter;
+  dcomplex *exp1, *exp2, *exp3;
+};
 
-  for (i = 1; i <= 15; i++) {
-    timer_clear(i);
-  }         
 
-  timer_start(2);      
-  compute_initial_conditions(NX, NY, NZ, xnt);
-
-  CompExp(NX, exp1);
-  CompExp(NY, exp2);
-  CompExp(NZ, exp3);          
-  fftXYZ(1, NX, NY, NZ, xnt, (dcomplex *)y, exp1, exp2, exp3);
-  timer_stop(2);
+//---------------------------------------------------------------------
+// The timed section, run by every thread of the team
+//---------------------------------------------------------------------
+static void evolve_team(int tid, void *arg)
+{
+  struct evolve_args *e = (struct evolve_args *)arg;
+  dcomplex *exp1 = e->exp1, *exp2 = e->exp2, *exp3 = e->exp3;
+  int i, j, k, kt, n12, n22, n32, ii, jj, kk, ii2, ik2, lo, hi;
+  int timed = timers_enabled && tid == 0;
+  double ap;
 
-  timer_start(1);
-  migrate(1, NULL, NULL);
-  if (timers_enabled) timer_start(13);
+  if (timed) timer_start(13);
 
   n12 = NX / 2;
   n22 = NY / 2;
   n32 = NZ / 2;
   ap = -4.0 * ALPHA * (PI * PI);
-  for (i = 0; i < NZ; i++) {
+  popcorn_team_split(0, NZ, &lo, &hi);
+  for (i = lo; i < hi; i++) {
     ii = i - (i / n32) * NZ;
     ii2 = ii * ii;
     for (k = 0; k < NY; k++) {
@@ -90,33 +104,82 @@ void appft(int niter, double *total_time, logical *verified)
       }
     }
   }
-  if (timers_enabled) timer_stop(13);
+  popcorn_team_barrier();
+  if (timed) timer_stop(13);
 
-  if (timers_enabled) timer_start(12);
+  if (timed) timer_start(12);
   compute_initial_conditions(NX, NY, NZ, xnt);
-  if (timers_enabled) timer_stop(12);
-  if (timers_enabled) timer_start(15);
+  if (timed) timer_stop(12);
+  if (timed) timer_start(15);
   fftXYZ(1, NX, NY, NZ, xnt, (dcomplex *)y, exp1, exp2, exp3);
-  if (timers_enabled) timer_stop(15);
+  if (timed) timer_stop(15);
 
-  for (kt = 1; kt <= niter; kt++) {
-    if (timers_enabled) timer_start(11);
+  for (kt = 1; kt <= e->niter; kt++) {
+    if (timed) timer_start(11);
     evolve(NX, NY, NZ, xnt, y, twiddle);
-    if (timers_enabled) timer_stop(11);
-    if (timers_enabled) timer_start(15);
+    if (timed) timer_stop(11);
+    if (timed) timer_start(15);
     fftXYZ(-1, NX, NY, NZ, xnt, (dcomplex *)xnt, exp1, exp2, exp3);
-    if (timers_enabled) timer_stop(15);
-    if (timers_enabled) timer_start(10);
-    CalculateChecksum(&sums[kt], kt, NX, NY, NZ, xnt);
-    if (timers_enabled) timer_stop(10);
+    if (timed) timer_stop(15);
+    // The checksum reads a few points of every plane; the next evolve()
+    // must not overwrite them before it is done.
+    if (tid == 0) {
+      if (timed) timer_start(10);
+      CalculateChecksum(&sums[kt], kt, NX, NY, NZ, xnt);
+      if (timed) timer_stop(10);
+    }
+    popcorn_team_barrier();
   }
-  migrate(0, NULL, NULL);
+}
+
+
+void appft(int niter, double *total_time, logical *verified)
+{
+  int i;
+
+  dcomplex exp1[NX], exp2[NY], exp3[NZ];
+
+  // Before anything touches them
+  POPCORN_HUGE_STATIC(twiddle);
+  POPCORN_HUGE_STATIC(xnt);
+  POPCORN_HUGE_STATIC(y);
+
+  for (i = 1; i <= 15; i++) {
+    timer_clear(i);
+  }         
+
+  timer_start(2);      
+  compute_initial_conditions(NX, NY, NZ, xnt);
+
+  CompExp(NX, exp1);
+  CompExp(NY, exp2);
+  CompExp(NZ, exp3);          
+  fftXYZ(1, NX, NY, NZ, xnt, (dcomplex *)y, exp1, exp2, exp3);
+  timer_stop(2);
+
+  //---------------------------------------------------------------------
+  // The timed section runs on a team of $POPCORN_THREADS threads spread
+  // over the nodes, each on a block of planes. A team of one migrates for
+  // the whole section instead.
+  //---------------------------------------------------------------------
+  popcorn_team_init(FT_REGION_EVOLVE);
+  struct evolve_args e = { niter, exp1, exp2, exp3 };
+
+  timer_start(1);
+  if (popcorn_team_size() == 1)
+    popcorn_migrate_ranges(FT_REGION_EVOLVE, POPCORN_NODE_BEST, ft_ranges,
+                           POPCORN_RANGES(ft_ranges), POPCORN_RANGE_ALL);
+  popcorn_team_run(evolve_team, &e);
+  if (popcorn_team_size() == 1)
+    popcorn_migrate_home(FT_REGION_EVOLVE);
 
   // Verification test.
   if (timers_enabled) timer_start(14);
   verify(NX, NY, NZ, niter, sums, verified);
   if (timers_enabled) timer_stop(14);
   timer_stop(1);
+  popcorn_team_fini();
+  popcorn_huge_report(stdout);
 
   *total_time = timer_read(1);
   if (!timers_enabled) return;
@@ -36,6 +36,8 @@
 
 #include "global.h"
 #include "randdp.h"
+#include "popcorn_ranges.h"
+#include "popcorn_team.h"
 
 
 //---------------------------------------------------------------------
@@ -126,7 +128,7 @@ void CalculateChecksum(dcomplex *csum, int iterN, int d1, int d2, int d3,
     ki = 5 * i1 % d3;
     csum_temp = dcmplx_add(csum_temp, u[ki][ji][ii]);
   }
-  csum_temp = dcmplx_div2(csum_temp, (double)(d1*d2*d3));
+  csum_temp = dcmplx_div2(csum_temp, ((double)d1*d2*d3));
   /*
   printf(" T =%5d     Checksum =%22.12E%22.12E\n", 
       iterN, csum_temp.real, csum_temp.imag);
@@ -142,7 +144,7 @@ void compute_initial_conditions(int d1, int d2, int d3,
   double x0, start, an, dummy;
   double RanStarts[MAXDIM];
 
-  int i, j, k;
+  int i, j, k, lo, hi;
   const double seed = 314159265.0;
   const double a = 1220703125.0;
 
@@ -162,7 +164,9 @@ void compute_initial_conditions(int d1, int d2, int d3,
     RanStarts[k] = start;
   }
 
-  for (k = 0; k < d3; k++) {
+  // On a team, each thread fills its block of planes.
+  popcorn_team_split(0, d3, &lo, &hi);
+  for (k = lo; k < hi; k++) {
     x0 = RanStarts[k];
     for (j = 0; j < d2; j++) {
       vranlc(2*d1, &x0, a, (double *)tmp);
@@ -171,6 +175,7 @@ void compute_initial_conditions(int d1, int d2, int d3,
       }
     }
   }
+  popcorn_team_barrier();
 }
 
 
@@ -178,8 +183,13 @@ void evolve(int nx, int ny, int nz,
             dcomplex x[nz][ny][nx+1], dcomplex y[nz][ny][nx+1],
             double twiddle[nz][ny][nx+1])
 {
-  int i, j, k;
-  for (i = 0; i < nz; i++) {
+  int i, j, k, lo, hi;
+
+  popcorn_team_split(0, nz, &lo, &hi);
+  // The previous fftXYZ() left x and y in Z lines.
+  transfer_rows(x, nx, ny, lo, hi, 0, ny, 1, POPCORN_RANGE_PREFETCH);
+  transfer_rows(y, nx, ny, lo, hi, 0, ny, 1, POPCORN_RANGE_PREFETCH);
+  for (i = lo; i < hi; i++) {
     for (k = 0; k < ny; k++) {
       for (j = 0; j < nx; j++) {
         y[i][k][j] = dcmplx_mul2(y[i][k][j], twiddle[i][k][j]);
@@ -187,5 +197,6 @@ void evolve(int nx, int ny, int nz,
       }
     }
   }
+  popcorn_team_barrier();
 }
 
@@ -3,6 +3,9 @@
 /*****************************************************************/
 #include <stdlib.h>
 #include <stdio.h>
+#include "popcorn_nodes.h"
+
+void timer_print_counters( void );
 
 void c_print_results( char   *name,
                       char   class,
@@ -23,6 +26,9 @@ void c_print_results( char   *name,
                       char   *cflags,
                       char   *clinkflags )
 {
+    long migrations;
+    double migrate_time;
+
     printf( "\n\n %s Benchmark Completed\n", name ); 
 
     printf( " Class           =                        %c\n", class );
@@ -54,6 +60,14 @@ void c_print_results( char   *name,
 
     printf( " Compile date    =             %12s\n", compiletime );
 
+    popcorn_nodes_stats( &migrations, &migrate_time );
+    printf( " Migrations      =             %12ld\n", migrations );
+    printf( " Migration time  =             %12.2f\n", migrate_time );
+    printf( " Migration share =             %11.1f%%\n",
+            t > 0.0 ? 100.0 * migrate_time / t : 0.0 );
+
+    timer_print_counters();
+
     printf( "\n Compile options:\n" );
 
     printf( "    CC           = %s\n", cc );
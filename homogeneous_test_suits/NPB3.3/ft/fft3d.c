@@ -33,20 +33,140 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #include "global.h"
 #include "timers.h"
+#include "wtime.h"
+#include "popcorn_ranges.h"
+#include "popcorn_team.h"
 
+void wtime(double *t);
 
-/* common /blockinfo/ */
-static int fftblock;
-//static int fftblockpad;
+
+// The work arrays are per thread: every thread of the team transforms its
+// own block of lines with them. fftblock (common /blockinfo/) is local to
+// fftXYZ().
 
 /* common /workarr/ */
-static dcomplex plane[(BLOCKMAX+1)*MAXDIM];
+static __thread dcomplex plane[(BLOCKMAX+1)*MAXDIM];
 //static dcomplex pad[128];
-static dcomplex scr[MAXDIM][BLOCKMAX+1];
+static __thread dcomplex scr[MAXDIM][BLOCKMAX+1];
+
+
+//---------------------------------------------------------------------
+// One radix-2 butterfly on a row of vlen lines:
+// y1 = a + b and y2 = u1 * (a - b)
+//---------------------------------------------------------------------
+static void butterflies_scalar(int vlen, dcomplex u1,
+                               const dcomplex a[], const dcomplex b[],
+                               dcomplex y1[], dcomplex y2[])
+{
+  dcomplex x11, x21;
+  int j;
+
+  for (j = 0; j < vlen; j++) {
+    x11 = a[j];
+    x21 = b[j];
+    y1[j] = dcmplx_add(x11, x21);
+    y2[j] = dcmplx_mul(u1, dcmplx_sub(x11, x21));
+  }
+}
+
+
+#if defined(__x86_64__)
+//---------------------------------------------------------------------
+// butterflies_scalar() with AVX, two lines at a time. The products and
+// sums are those of dcmplx_mul(), so the results do not change.
+//---------------------------------------------------------------------
+__attribute__((target("avx")))
+static void butterflies_simd(int vlen, dcomplex u1,
+                             const dcomplex a[], const dcomplex b[],
+                             dcomplex y1[], dcomplex y2[])
+{
+  __m256d ur = _mm256_set1_pd(u1.real), ui = _mm256_set1_pd(u1.imag);
+  int j;
+
+  for (j = 0; j + 2 <= vlen; j += 2) {
+    __m256d x11 = _mm256_loadu_pd(&a[j].real);
+    __m256d x21 = _mm256_loadu_pd(&b[j].real);
+    __m256d d = _mm256_sub_pd(x11, x21);
+
+    _mm256_storeu_pd(&y1[j].real, _mm256_add_pd(x11, x21));
+    // (re*ur - im*ui, im*ur + re*ui)
+    _mm256_storeu_pd(&y2[j].real,
+        _mm256_addsub_pd(_mm256_mul_pd(d, ur),
+                         _mm256_mul_pd(_mm256_permute_pd(d, 0x5), ui)));
+  }
+  for (; j < vlen; j++) {
+    dcomplex x11 = a[j], x21 = b[j];
+    y1[j] = dcmplx_add(x11, x21);
+    y2[j] = dcmplx_mul(u1, dcmplx_sub(x11, x21));
+  }
+}
+
+
+// Checked on every call: a thread can land on a node without AVX.
+static int fft_simd_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx");
+}
+#elif defined(__aarch64__)
+//---------------------------------------------------------------------
+// butterflies_scalar() with NEON, one line per vector
+//---------------------------------------------------------------------
+static void butterflies_simd(int vlen, dcomplex u1,
+                             const dcomplex a[], const dcomplex b[],
+                             dcomplex y1[], dcomplex y2[])
+{
+  float64x2_t ui = { -u1.imag, u1.imag };
+  int j;
+
+  for (j = 0; j < vlen; j++) {
+    float64x2_t x11 = vld1q_f64(&a[j].real);
+    float64x2_t x21 = vld1q_f64(&b[j].real);
+    float64x2_t d = vsubq_f64(x11, x21);
+
+    vst1q_f64(&y1[j].real, vaddq_f64(x11, x21));
+    // (re*ur - im*ui, im*ur + re*ui)
+    vst1q_f64(&y2[j].real,
+              vaddq_f64(vmulq_n_f64(d, u1.real),
+                        vmulq_f64(vextq_f64(d, d, 1), ui)));
+  }
+}
+
+
+static int fft_simd_supported(void)
+{
+  return 1;
+}
+#else
+static int fft_simd_supported(void)
+{
+  return 0;
+}
+#endif
+
+
+static inline void butterflies(int simd, int vlen, dcomplex u1,
+                               const dcomplex a[], const dcomplex b[],
+                               dcomplex y1[], dcomplex y2[])
+{
+#if defined(__x86_64__) || defined(__aarch64__)
+  if (simd) {
+    butterflies_simd(vlen, u1, a, b, y1, y2);
+    return;
+  }
+#endif
+  butterflies_scalar(vlen, u1, a, b, y1, y2);
+}
 
 
 //---------------------------------------------------------------------
@@ -56,16 +176,16 @@ static dcomplex scr[MAXDIM][BLOCKMAX+1];
 // Swarztrauber to 
 // perform FFTs
 //---------------------------------------------------------------------
-static void Swarztrauber(int is, int m, int vlen, int n, int xd1,
-                         void *ox, dcomplex exponent[n])
+static void fft_lines(int is, int m, int vlen, int n, int xd1,
+                      void *ox, dcomplex exponent[n])
 {
   dcomplex (*x)[xd1] = (dcomplex (*)[xd1])ox;
 
   int i, j, l;
-  dcomplex u1, x11, x21;
+  dcomplex u1;
   int k, n1, li, lj, lk, ku, i11, i12, i21, i22;
+  int simd = fft_simd_supported();
 
-  if (timers_enabled) timer_start(4);
   //---------------------------------------------------------------------
   // Perform one variant of the Stockham FFT.
   //---------------------------------------------------------------------
@@ -90,12 +210,7 @@ static void Swarztrauber(int is, int m, int vlen, int n, int xd1,
         u1 = dconjg(exponent[ku+i]);
       }
       for (k = 0; k <= lk - 1; k++) {
-        for (j = 0; j < vlen; j++) {
-          x11 = x[i11+k][j];
-          x21 = x[i12+k][j];
-          scr[i21+k][j] = dcmplx_add(x11, x21);
-          scr[i22+k][j] = dcmplx_mul(u1, dcmplx_sub(x11, x21));
-        }
+        butterflies(simd, vlen, u1, x[i11+k], x[i12+k], scr[i21+k], scr[i22+k]);
       }
     }
 
@@ -123,40 +238,158 @@ static void Swarztrauber(int is, int m, int vlen, int n, int xd1,
           u1 = dconjg(exponent[ku+i]);
         }
         for (k = 0; k <= lk - 1; k++) {
-          for (j = 0; j < vlen; j++) {
-            x11 = scr[i11+k][j];
-            x21 = scr[i12+k][j];
-            x[i21+k][j] = dcmplx_add(x11, x21);
-            x[i22+k][j] = dcmplx_mul(u1, dcmplx_sub(x11, x21));
-          }
+          butterflies(simd, vlen, u1, scr[i11+k], scr[i12+k],
+                      x[i21+k], x[i22+k]);
+        }
+      }
+    }
+  }
+}
+
+
+static void Swarztrauber(int is, int m, int vlen, int n, int xd1,
+                         void *ox, dcomplex exponent[n])
+{
+  if (timers_enabled && popcorn_team_tid() <= 0) timer_start(4);
+  fft_lines(is, m, vlen, n, xd1, ox, exponent);
+  if (timers_enabled && popcorn_team_tid() <= 0) timer_stop(4);
+}
+
+
+//---------------------------------------------------------------------
+// Number of lines fftXYZ() transforms at a time along a dimension of n
+// points, at most BLOCKMAX and nlines, the number of lines there are:
+// - $FT_FFTBLOCK, if it is a number;
+// - CACHESIZE / n with FT_FFTBLOCK=static, as NPB does;
+// - by default, the fastest on this node of the powers of 2, timed on
+//   TUNE_LINES lines the first time a thread of the node needs it, so
+//   a thread that migrates to another node tunes it again there.
+//---------------------------------------------------------------------
+#define TUNE_LINES  (8*BLOCKMAX)
+#define TUNE_UNSET  (-2)
+#define TUNE_STATIC (-1)
+#define TUNE_AUTO   0
+
+static int fft_tune_mode = TUNE_UNSET;        // or a fixed block
+static int fft_tuned[MAX_POPCORN_NODES][32];  // 0: not tuned yet
+
+static int fft_block(int n, int nlines, dcomplex exponent[n])
+{
+  const char *env;
+  int mode, nid, log, b, best, calls, c;
+  double t0, t1, tbest;
+
+  mode = __atomic_load_n(&fft_tune_mode, __ATOMIC_RELAXED);
+  if (mode == TUNE_UNSET) {
+    env = getenv("FT_FFTBLOCK");
+    if (env == NULL || strcmp(env, "auto") == 0) mode = TUNE_AUTO;
+    else if (strcmp(env, "static") == 0) mode = TUNE_STATIC;
+    else if ((mode = atoi(env)) < 1) mode = TUNE_AUTO;
+    __atomic_store_n(&fft_tune_mode, mode, __ATOMIC_RELAXED);
+  }
+
+  if (mode == TUNE_STATIC) {
+    b = CACHESIZE / n;
+  } else if (mode > 0) {
+    b = mode;
+  } else {
+    nid = popcorn_nodes_current();
+    log = ilog2(n);
+    b = __atomic_load_n(&fft_tuned[nid][log], __ATOMIC_RELAXED);
+    if (b == 0) {
+      for (c = 0; c < n * (BLOCKMAX+1); c++) plane[c] = dcmplx(1.0, 0.0);
+      best = 1;
+      tbest = 0.0;
+      for (b = 1; b <= BLOCKMAX && b <= nlines; b *= 2) {
+        calls = TUNE_LINES / b;
+        wtime(&t0);
+        for (c = 0; c < calls; c++) {
+          fft_lines(1, log, b, n, b+1, plane, exponent);
+        }
+        wtime(&t1);
+        if (b == 1 || t1 - t0 < tbest) {
+          best = b;
+          tbest = t1 - t0;
         }
       }
+      b = best;
+      __atomic_store_n(&fft_tuned[nid][log], b, __ATOMIC_RELAXED);
     }
   }
-  if (timers_enabled) timer_stop(4);
+
+  if (b > BLOCKMAX) b = BLOCKMAX;
+  if (b > nlines) b = nlines;
+  return b < 1 ? 1 : b;
+}
+
+
+//---------------------------------------------------------------------
+// Takes rows r0 to r1 - 1 of planes p0 to p1 - 1 of the [.][n2][n1+1]
+// array a over to the node of the calling thread (POPCORN_RANGE_PREFETCH,
+// writable if write is set) or gives them up (POPCORN_RANGE_RELEASE), in
+// one range per plane, or one for whole planes. Nothing to do with a team
+// on a single node.
+//---------------------------------------------------------------------
+void transfer_rows(void *a, int n1, int n2, int p0, int p1, int r0, int r1,
+                   int write, int flags)
+{
+  long row = (long)(n1+1) * sizeof(dcomplex);
+  long first, rows;
+  struct popcorn_range r;
+  int p, planes;
+
+  if (popcorn_team_nodes() == 1 || p0 >= p1 || r0 >= r1) return;
+
+  first = (long)n2 * p0 + r0;
+  if (r0 == 0 && r1 == n2) {
+    rows = (long)n2 * (p1 - p0);
+    planes = 1;
+  } else {
+    rows = r1 - r0;
+    planes = p1 - p0;
+  }
+  r.len = row * rows;
+  r.write = write;
+  for (p = 0; p < planes; p++) {
+    r.addr = (char *)a + row * (first + (long)n2 * p);
+    if (flags & POPCORN_RANGE_RELEASE) popcorn_release_ranges(&r, 1);
+    if (flags & POPCORN_RANGE_PREFETCH) popcorn_prefetch_ranges(&r, 1);
+  }
 }
 
 
 void fftXYZ(int sign, int n1, int n2, int n3,
-            dcomplex x[n3][n2][n1+1], dcomplex xout[(n1+1)*n2*n3],
+            dcomplex x[n3][n2][n1+1], dcomplex xout[(long)(n1+1)*n2*n3],
             dcomplex exp1[n1], dcomplex exp2[n2], dcomplex exp3[n3])
 {
   int i, j, k, log;
   int bls, ble;
   int len;
   int blkp;
+  int lo, hi;
+  int fftblock;
+  int timed = timers_enabled && popcorn_team_tid() <= 0;
 
-  if (timers_enabled) timer_start(3);
+  //---------------------------------------------------------------------
+  // On a team, each thread transforms the X and Y lines of its block of
+  // planes and, once all planes are done, the Z lines of its block of k.
+  // The planes are in place on the node of their thread; when the team
+  // spans nodes, the switch between planes and Z lines (the transpose) is
+  // one bulk release of a thread's part before the barrier and one bulk
+  // prefetch of its new part after it, rather than a fault per page.
+  //---------------------------------------------------------------------
+  if (timed) timer_start(3);
 
-  fftblock = CACHESIZE / n1;
-  if (fftblock >= BLOCKMAX) fftblock = BLOCKMAX;
+  fftblock = fft_block(n1, n2, exp1);
   blkp = fftblock + 1;
   log = ilog2(n1);
-  if (timers_enabled) timer_start(7);
-  for (k = 0; k < n3; k++) {
+  if (timed) timer_start(7);
+  popcorn_team_split(0, n3, &lo, &hi);
+  transfer_rows(x, n1, n2, lo, hi, 0, n2, 1, POPCORN_RANGE_PREFETCH);
+  for (k = lo; k < hi; k++) {
     for (bls = 0; bls < n2; bls += fftblock) {
       ble = bls + fftblock - 1;
-      if (ble > n2) ble = n2 - 1;
+      if (ble >= n2) ble = n2 - 1;
       len = ble - bls + 1;
       for (j = bls; j <= ble; j++) {
         for (i = 0; i < n1; i++) {
@@ -171,32 +404,37 @@ void fftXYZ(int sign, int n1, int n2, int n3,
       }
     }
   }
-  if (timers_enabled) timer_stop(7);
+  if (timed) timer_stop(7);
 
-  fftblock = CACHESIZE / n2;
-  if (fftblock >= BLOCKMAX) fftblock = BLOCKMAX;
+  fftblock = fft_block(n2, n1, exp2);
   blkp = fftblock + 1;
   log = ilog2(n2);
-  if (timers_enabled) timer_start(8);
-  for (k = 0; k < n3; k++) {
+  if (timed) timer_start(8);
+  for (k = lo; k < hi; k++) {
     for (bls = 0; bls < n1; bls += fftblock) {
       ble = bls + fftblock - 1;
-      if (ble > n1) ble = n1 - 1;
+      if (ble >= n1) ble = n1 - 1;
       len = ble - bls + 1;
       Swarztrauber(sign, log, len, n2, n1+1, &x[k][0][bls], exp2);
     }
   }
-  if (timers_enabled) timer_stop(8);
+  if (timed) timer_stop(8);
+  transfer_rows(x, n1, n2, lo, hi, 0, n2, 1, POPCORN_RANGE_RELEASE);
+  popcorn_team_barrier();
 
-  fftblock = CACHESIZE / n3;
-  if (fftblock >= BLOCKMAX) fftblock = BLOCKMAX;
+  fftblock = fft_block(n3, n1, exp3);
   blkp = fftblock + 1;
   log = ilog2(n3);
-  if (timers_enabled) timer_start(9);
-  for (k = 0; k < n2; k++) {
+  if (timed) timer_start(9);
+  popcorn_team_split(0, n2, &lo, &hi);
+  transfer_rows(x, n1, n2, 0, n3, lo, hi, xout == (dcomplex *)x,
+                POPCORN_RANGE_PREFETCH);
+  if (xout != (dcomplex *)x)
+    transfer_rows(xout, n1, n2, 0, n3, lo, hi, 1, POPCORN_RANGE_PREFETCH);
+  for (k = lo; k < hi; k++) {
     for (bls = 0; bls < n1; bls += fftblock) {
       ble = bls + fftblock - 1;
-      if (ble > n1) ble = n1 - 1;
+      if (ble >= n1) ble = n1 - 1;
       len = ble - bls + 1;
       for (i = 0; i < n3; i++) {
         for (j = bls; j <= ble; j++) {
@@ -206,12 +444,14 @@ void fftXYZ(int sign, int n1, int n2, int n3,
       Swarztrauber(sign, log, len, n3, blkp, plane, exp3);
       for (i = 0; i <= n3-1; i++) {
         for (j = bls; j <= ble; j++) {
-          xout[j+(n1+1)*(k+n2*i)] = plane[j-bls+blkp*i];
+          xout[j+(long)(n1+1)*(k+n2*i)] = plane[j-bls+blkp*i];
         }
       }
     }
   }
-  if (timers_enabled) timer_stop(9);
-  if (timers_enabled) timer_stop(3);
+  if (timed) timer_stop(9);
+  transfer_rows(xout, n1, n2, 0, n3, lo, hi, 1, POPCORN_RANGE_RELEASE);
+  popcorn_team_barrier();
+  if (timed) timer_stop(3);
 }
 
@@ -93,8 +93,10 @@ void compute_initial_conditions(int d1, int d2, int d3,
 void evolve(int nx, int ny, int nz,
             dcomplex x[nz][ny][nx+1], dcomplex y[nz][ny][nx+1],
             double twiddle[nz][ny][nx+1]);
+void transfer_rows(void *a, int n1, int n2, int p0, int p1, int r0, int r1,
+                   int write, int flags);
 void fftXYZ(int sign, int n1, int n2, int n3,
-            dcomplex x[n3][n2][n1+1], dcomplex xout[(n1+1)*n2*n3],
+            dcomplex x[n3][n2][n1+1], dcomplex xout[(long)(n1+1)*n2*n3],
             dcomplex exp1[n1], dcomplex exp2[n2], dcomplex exp3[n3]);
 void verify(int n1, int n2, int n3, int nt, dcomplex cksum[nt+1],
             logical *verified);
@@ -0,0 +1,26 @@
+/* CLASS = C */
+/*
+   This file is generated automatically by the setparams utility.
+   It sets the number of processors and the class of the NPB
+   in this directory. Do not modify it by hand.   
+*/
+#define NX             512
+#define NY             512
+#define NZ             512
+#define MAXDIM         512
+#define NITER_DEFAULT  20
+#define NXP            513
+#define NYP            512
+#define NTOTAL         134217728
+#define NTOTALP        134479872
+
+#define CONVERTDOUBLE  false
+#define COMPILETIME "03 Nov 2017"
+#define NPBVERSION "3.3.1"
+#define CS1 "gcc"
+#define CS2 "$(CC)"
+#define CS3 "-lm"
+#define CS4 "-I../common"
+#define CS5 "-g -Wall -O3 -mcmodel=medium"
+#define CS6 "-O3 -mcmodel=medium"
+#define CS7 "randdp"
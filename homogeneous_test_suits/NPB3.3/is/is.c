@@ -45,6 +45,15 @@
 #include <stdio.h>
 #include "migrate.h"
 
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_ranges.h"
+#include "popcorn_team.h"
+#include "popcorn_grain.h"
+#include "popcorn_huge.h"
+
+/* Region ID for popcorn_profile.h */
+#define IS_REGION_RANK 1
+
 /*****************************************************************/
 /* For serial IS, buckets are not really req'd to solve NPB1 IS  */
 /* spec, but their use on some machines improves performance, on */
@@ -126,7 +135,24 @@
 #endif
 
 
-#if CLASS == 'D'
+/*************/
+/*  CLASS U  */
+/*************/
+/*  A custom class (setclass.sh custom) has its sizes in npbparams.h.
+    The partial verification has no reference ranks for it.        */
+#if CLASS == 'U'
+#if !defined(TOTAL_KEYS_LOG_2) || !defined(MAX_KEY_LOG_2) \
+ || !defined(NUM_BUCKETS_LOG_2)
+#error "custom class needs TOTAL_KEYS_LOG_2, MAX_KEY_LOG_2 and NUM_BUCKETS_LOG_2"
+#endif
+#if MAX_KEY_LOG_2 > 30 || NUM_BUCKETS_LOG_2 > MAX_KEY_LOG_2
+#error "custom class needs NUM_BUCKETS_LOG_2 <= MAX_KEY_LOG_2 <= 30"
+#endif
+#endif
+
+
+/*  Past 2^30 keys, counts and ranks need a long. */
+#if TOTAL_KEYS_LOG_2 > 30
 #define  TOTAL_KEYS          (1L << TOTAL_KEYS_LOG_2)
 #else
 #define  TOTAL_KEYS          (1 << TOTAL_KEYS_LOG_2)
@@ -146,7 +172,7 @@
 /* size of int here by changing the  */
 /* int type to, say, long            */
 /*************************************/
-#if CLASS == 'D'
+#if TOTAL_KEYS_LOG_2 > 30
 typedef  long INT_TYPE;
 #else
 typedef  int  INT_TYPE;
@@ -164,16 +190,23 @@ int      passed_verification;
 
 /************************************/
 /* These are the three main arrays. */
-/* See SIZE_OF_BUFFERS def above    */
+/* See SIZE_OF_BUFFERS def above.   */
+/* On 2MB pages with $POPCORN_HUGE  */
+/* (see popcorn_huge.h)             */
 /************************************/
-INT_TYPE key_array[SIZE_OF_BUFFERS],    
-         key_buff1[MAX_KEY],    
-         key_buff2[SIZE_OF_BUFFERS],
+INT_TYPE key_array[SIZE_OF_BUFFERS] POPCORN_HUGE_ALIGN,
+         key_buff1[MAX_KEY] POPCORN_HUGE_ALIGN,
+         key_buff2[SIZE_OF_BUFFERS] POPCORN_HUGE_ALIGN,
          partial_verify_vals[TEST_ARRAY_SIZE];
 
 #ifdef USE_BUCKETS
 INT_TYPE bucket_size[NUM_BUCKETS],                    
          bucket_ptrs[NUM_BUCKETS];
+
+/*  Per thread of the team, on its node: the keys of its block in  */
+/*  each bucket, then where they go in key_buff2                   */
+INT_TYPE *bucket_size_team[POPCORN_TEAM_MAX],
+         *bucket_ptrs_team[POPCORN_TEAM_MAX];
 #endif
 
 
@@ -214,12 +247,30 @@ INT_TYPE test_index_array[TEST_ARRAY_SIZE],
                              {1,36538729,1978098519,2145192618,2147425337};
 
 
+/************************************************/
+/* Working set of rank(), taken along to the    */
+/* remote node                                  */
+/************************************************/
+static struct popcorn_range is_ranges[] = {
+    POPCORN_RANGE_RO(key_array),
+    POPCORN_RANGE_RW(key_buff1),
+    POPCORN_RANGE_RW(key_buff2),
+#ifdef USE_BUCKETS
+    POPCORN_RANGE_RW(bucket_size),
+    POPCORN_RANGE_RW(bucket_ptrs),
+#endif
+    POPCORN_RANGE_RW(partial_verify_vals),
+};
+
+
 
 /***********************/
 /* function prototypes */
 /***********************/
 double	randlc( double *X, double *A );
 
+double	find_my_seed( long skip, double s, double a );
+
 void full_verify( void );
 
 void c_print_results( char   *name,
@@ -353,14 +404,27 @@ double	randlc( double *X, double *A )
 /*************      C  R  E  A  T  E  _  S  E  Q      ************/
 /*****************************************************************/
 
-void	create_seq( double seed, double a )
+/*  Each thread of the team generates the keys of its block of      */
+/*  rank_team(), from the seed of the block: the keys are the same   */
+/*  for any team, and each block is first written on the node of     */
+/*  the thread that sorts it.                                        */
+
+struct create_seq_args {
+    double seed[POPCORN_TEAM_MAX];
+    double a;
+};
+
+void	create_seq_team( int tid, void *arg )
 {
-	double x;
+	struct create_seq_args *c = (struct create_seq_args *)arg;
+	double x, seed = c->seed[tid], a = c->a;
 	INT_TYPE i, k;
+	long	b1, b2;
 
         k = MAX_KEY/4;
 
-	for (i=0; i<NUM_KEYS; i++)
+	popcorn_team_split_long( 0, NUM_KEYS, &b1, &b2 );
+	for (i=b1; i<b2; i++)
 	{
 	    x = randlc(&seed, &a);
 	    x += randlc(&seed, &a);
@@ -372,6 +436,61 @@ void	create_seq( double seed, double a )
 }
 
 
+void	create_seq( double seed, double a )
+{
+	struct create_seq_args c;
+	long	b1;
+	int	t;
+
+/*  The seeds come from the main thread, which also sets up the   */
+/*  constants of randlc() before the team calls it                */
+	c.a = a;
+	for (t=0; t<popcorn_team_size(); t++)
+	{
+	    /* b1 of popcorn_team_split_long() for thread t */
+	    b1 = (long)NUM_KEYS * t / popcorn_team_size();
+	    c.seed[t] = find_my_seed( 4*b1, seed, a );
+	}
+	popcorn_team_run( create_seq_team, &c );
+}
+
+
+
+
+/*****************************************************************/
+/*************     F I N D _ M Y _ S E E D            ************/
+/*****************************************************************/
+
+/*  Seed that randlc() reaches from 's' after 'skip' numbers,      */
+/*  s * a^skip mod 2^46, in log2(skip) steps                       */
+
+double	find_my_seed( long skip, double s, double a )
+{
+	double	t1 = s, t2 = a;
+	long	kk = skip, ik;
+
+	if (skip == 0) return s;
+
+	while (kk > 1)
+	{
+	    ik = kk / 2;
+	    if (2 * ik == kk)
+	    {
+		(void)randlc( &t2, &t2 );
+		kk = ik;
+	    }
+	    else
+	    {
+		(void)randlc( &t1, &t2 );
+		kk = kk - 1;
+	    }
+	}
+	(void)randlc( &t1, &t2 );
+
+	return t1;
+}
+
+
 
 
 /*****************************************************************/
@@ -430,60 +549,154 @@ void full_verify( void )
 /*****************************************************************/
 
 
-void rank( int iteration )
+#ifdef USE_BUCKETS
+
+/*  Keys per block of the histogram loops of rank_team() */
+#define HIST_KEYS 16
+
+/*****************************************************************/
+/*  The bucket sort and the ranking of rank(), by every thread   */
+/*  of the team: each thread sorts a block of the keys into the  */
+/*  buckets, then ranks the keys of a block of buckets           */
+/*****************************************************************/
+void rank_team( int tid, void *arg )
 {
 
-    INT_TYPE    i, k;
+    INT_TYPE    i, k, k1, k2, m, t;
+    int         lo, hi;
+    long        b1, b2;
 
-    INT_TYPE    *key_buff_ptr, *key_buff_ptr2;
+    INT_TYPE    *key_buff_ptr, *key_buff_ptr2, *size, *ptrs;
+    INT_TYPE    bucket[HIST_KEYS];
 
-#ifdef USE_BUCKETS
     int shift = MAX_KEY_LOG_2 - NUM_BUCKETS_LOG_2;
+    int num_bucket_keys = 1 << shift;
+    int nthreads = popcorn_team_size();
     INT_TYPE    key;
-#endif
-
 
-    key_array[iteration] = iteration;
-    key_array[iteration+MAX_ITERATIONS] = MAX_KEY - iteration;
-
-
-/*  Determine where the partial verify test keys are, load into  */
-/*  top of array bucket_size                                     */
-    for( i=0; i<TEST_ARRAY_SIZE; i++ )
-        partial_verify_vals[i] = key_array[test_index_array[i]];
+    (void)arg;
 
-#ifdef USE_BUCKETS
+    if( bucket_size_team[tid] == NULL )
+    {
+        bucket_size_team[tid] = popcorn_node_malloc(
+            sizeof(INT_TYPE) * 2 * NUM_BUCKETS, popcorn_team_node( tid ) );
+        bucket_ptrs_team[tid] = bucket_size_team[tid] + NUM_BUCKETS;
+    }
+    size = bucket_size_team[tid];
+    ptrs = bucket_ptrs_team[tid];
 
 /*  Initialize */
     for( i=0; i<NUM_BUCKETS; i++ )  
-        bucket_size[i] = 0;
+        size[i] = 0;
 
-/*  Determine the number of keys in each bucket */
-    for( i=0; i<NUM_KEYS; i++ )
-        bucket_size[key_array[i] >> shift]++;
+/*  Determine the number of keys of the block in each bucket.  The */
+/*  bucket numbers of HIST_KEYS keys at a time come from a loop    */
+/*  the compiler vectorizes, and the counts follow                 */
+    popcorn_team_split_long( 0, NUM_KEYS, &b1, &b2 );
+    for( i=b1; i+HIST_KEYS<=b2; i+=HIST_KEYS )
+    {
+        for( t=0; t<HIST_KEYS; t++ )
+            bucket[t] = key_array[i+t] >> shift;
+        for( t=0; t<HIST_KEYS; t++ )
+            size[bucket[t]]++;
+    }
+    for( ; i<b2; i++ )
+        size[key_array[i] >> shift]++;
 
+    popcorn_team_barrier();
 
-/*  Accumulative bucket sizes are the bucket pointers */
-    bucket_ptrs[0] = 0;
-    for( i=1; i< NUM_BUCKETS; i++ )  
-        bucket_ptrs[i] = bucket_ptrs[i-1] + bucket_size[i-1];
+
+/*  Accumulative bucket sizes are the bucket pointers: the keys  */
+/*  of the lesser buckets, then those of the same bucket in the  */
+/*  blocks of the lesser threads.  The totals are kept in        */
+/*  bucket_size and the ends of the buckets in bucket_ptrs, by   */
+/*  the thread that ranks them.                                  */
+    popcorn_team_split( 0, NUM_BUCKETS, &lo, &hi );
+    for( i=0, m=0; i<NUM_BUCKETS; i++ )
+    {
+        for( t=0, k=0; t<nthreads; t++ )
+        {
+            if( t == tid )
+                ptrs[i] = m + k;
+            k += bucket_size_team[t][i];
+        }
+        m += k;
+        if( lo <= i && i < hi )
+        {
+            bucket_size[i] = k;
+            bucket_ptrs[i] = m;
+        }
+    }
 
 
 /*  Sort into appropriate bucket */
-    for( i=0; i<NUM_KEYS; i++ )  
+    for( i=b1; i<b2; i++ )  
     {
         key = key_array[i];
-        key_buff2[bucket_ptrs[key >> shift]++] = key;
+        key_buff2[ptrs[key >> shift]++] = key;
     }
 
+    popcorn_team_barrier();
+
     key_buff_ptr2 = key_buff2;
+    key_buff_ptr = key_buff1;
 
-#else
+/*  Ranking of the keys of the block of buckets: the keys are    */
+/*  their own indexes into key_buff1, counted from the bucket    */
+/*  slices of key_buff2, then the populations are added up,      */
+/*  starting from the total of the lesser keys                   */
+    for( i=lo; i<hi; i++ )
+    {
+        k1 = i * num_bucket_keys;
+        k2 = k1 + num_bucket_keys;
+        for( k=k1; k<k2; k++ )
+            key_buff_ptr[k] = 0;
+
+        m = bucket_ptrs[i] - bucket_size[i];
+        for( k=m; k<bucket_ptrs[i]; k++ )
+            key_buff_ptr[key_buff_ptr2[k]]++;
+
+        key_buff_ptr[k1] += m;
+        for( k=k1+1; k<k2; k++ )
+            key_buff_ptr[k] += key_buff_ptr[k-1];
+    }
 
-    key_buff_ptr2 = key_array;
+}
 
 #endif
 
+
+void rank( int iteration )
+{
+
+    INT_TYPE    i, k;
+
+    INT_TYPE    *key_buff_ptr;
+
+#ifndef USE_BUCKETS
+    INT_TYPE    *key_buff_ptr2;
+#endif
+
+
+    key_array[iteration] = iteration;
+    key_array[iteration+MAX_ITERATIONS] = MAX_KEY - iteration;
+
+
+/*  Determine where the partial verify test keys are, load into  */
+/*  top of array bucket_size                                     */
+    for( i=0; i<TEST_ARRAY_SIZE; i++ )
+        partial_verify_vals[i] = key_array[test_index_array[i]];
+
+#ifdef USE_BUCKETS
+
+    popcorn_team_run( rank_team, NULL );
+
+    key_buff_ptr = key_buff1;
+
+#else
+
+    key_buff_ptr2 = key_array;
+
 /*  Clear the work array */
     for( i=0; i<MAX_KEY; i++ )
         key_buff1[i] = 0;
@@ -508,6 +721,8 @@ void rank( int iteration )
     for( i=0; i<MAX_KEY-1; i++ )   
         key_buff_ptr[i+1] += key_buff_ptr[i];  
 
+#endif
+
 
 /* This is the partial verify test section */
 /* Observe that test_rank_array vals are   */
@@ -652,6 +867,13 @@ int main( int argc, char **argv )
 
     FILE            *fp;
 
+    struct popcorn_grain grain;
+
+
+/*  Before anything touches them  */
+    POPCORN_HUGE_STATIC( key_array );
+    POPCORN_HUGE_STATIC( key_buff1 );
+    POPCORN_HUGE_STATIC( key_buff2 );
 
 /*  Initialize timers  */
     timer_on = 0;            
@@ -706,6 +928,13 @@ int main( int argc, char **argv )
       ( "\n\n NAS Parallel Benchmarks (NPB3.3-SER) - IS Benchmark\n\n" );
     printf( " Size:  %ld  (class %c)\n", (long)TOTAL_KEYS, CLASS );
     printf( " Iterations:   %d\n", MAX_ITERATIONS );
+    popcorn_grain_init( &grain, 1, MAX_ITERATIONS, POPCORN_GRAIN_ITER );
+    popcorn_grain_print( &grain );
+
+/*  rank() runs on a team of $POPCORN_THREADS threads spread over the
+    nodes.  A team of one migrates around each call instead, or every
+    $POPCORN_GRAIN calls (see popcorn_grain.h).                            */
+    popcorn_team_init( IS_REGION_RANK );
 
     if (timer_on) timer_start( 1 );
 
@@ -714,7 +943,6 @@ int main( int argc, char **argv )
                 1220703125.00 );                 /* Random number gen mult */
     if (timer_on) timer_stop( 1 );
 
-
 /*  Do one interation for free (i.e., untimed) to guarantee initialization of  
     all data and code pages and respective tables */
     rank( 1 );  
@@ -732,15 +960,23 @@ int main( int argc, char **argv )
     for( iteration=1; iteration<=MAX_ITERATIONS; iteration++ )
     {
         if( CLASS != 'S' ) printf( "        %d\n", iteration );
-		migrate(1, NULL, NULL);
+        if( popcorn_team_size() == 1 &&
+            popcorn_grain_leave( &grain, iteration ) )
+            popcorn_migrate_ranges( IS_REGION_RANK, POPCORN_NODE_BEST,
+                                    is_ranges, POPCORN_RANGES(is_ranges),
+                                    POPCORN_RANGE_ALL );
         rank( iteration );
-		migrate(0, NULL, NULL);
+        if( popcorn_team_size() == 1 &&
+            popcorn_grain_return( &grain, iteration ) )
+            popcorn_migrate_home(IS_REGION_RANK);
     }
 
 
 /*  End of timing, obtain maximum time of all processors */
     timer_stop( 0 );
     timecounter = timer_read( 0 );
+    popcorn_team_fini();
+    popcorn_huge_report( stdout );
 
 
 /*  This tests that keys are in sequence: sorting of last ranked key seq
@@ -0,0 +1,14 @@
+#define CLASS 'D'
+/*
+   This file is generated automatically by the setparams utility.
+   It sets the number of processors and the class of the NPB
+   in this directory. Do not modify it by hand.   */
+   
+#define COMPILETIME "03 Nov 2017"
+#define NPBVERSION "3.3.1"
+#define CC "gcc"
+#define CFLAGS "-g -Wall -O3 -mcmodel=medium"
+#define CLINK "$(CC)"
+#define CLINKFLAGS "-O3 -mcmodel=medium"
+#define C_LIB "-lm"
+#define C_INC "-I../common"
@@ -34,9 +34,10 @@
 #include "applu.incl"
 
 //---------------------------------------------------------------------
-// compute the lower triangular part of the jacobian matrix
+// compute the lower triangular part of the jacobian matrix for rows
+// j0 to j1 - 1 of plane k
 //---------------------------------------------------------------------
-void jacld(int k)
+void jacld(int k, int j0, int j1)
 {
   //---------------------------------------------------------------------
   // local variables
@@ -51,7 +52,7 @@ void jacld(int k)
   c1345 = C1 * C3 * C4 * C5;
   c34 = C3 * C4;
 
-  for (j = jst; j < jend; j++) {
+  for (j = j0; j < j1; j++) {
     for (i = ist; i < iend; i++) {
       //---------------------------------------------------------------------
       // form the block daigonal
@@ -46,6 +46,13 @@
 #include <stdlib.h>
 #include <math.h>
 #include "migrate.h"
+
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_nodes.h"
+#include "popcorn_team.h"
+
+// Region ID for popcorn_profile.h
+#define LU_REGION_SSOR 1
 #include "applu.incl"
 #include "timers.h"
 #include "print_results.h"
@@ -158,7 +165,13 @@ int main(int argc, char *argv[])
     timeron = false;
   }
 
-  migrate(1, NULL, NULL);
+  //---------------------------------------------------------------------
+  // The SSOR sweeps run on a team of $POPCORN_THREADS threads spread over
+  // the nodes (see ssor.c), the rest of the solver on its first thread. A
+  // team of one migrates for the whole solver instead.
+  //---------------------------------------------------------------------
+  popcorn_team_init(LU_REGION_SSOR);
+  if (popcorn_team_size() == 1) popcorn_migrate_best(LU_REGION_SSOR);
   //---------------------------------------------------------------------
   // read input data
   //---------------------------------------------------------------------
@@ -214,7 +227,8 @@ int main(int argc, char *argv[])
   // compute the surface integral
   //---------------------------------------------------------------------
   pintgr();
-  migrate(0, NULL, NULL);
+  if (popcorn_team_size() == 1) popcorn_migrate_home(LU_REGION_SSOR);
+  popcorn_team_fini();
 
   //---------------------------------------------------------------------
   // verification test
@@ -32,8 +32,115 @@
 //-------------------------------------------------------------------------//
 
 #include <stdio.h>
+#include <sched.h>
 #include "applu.incl"
 #include "timers.h"
+#include "popcorn_team.h"
+
+// Work array of buts()
+static double tv[ISIZ2][ISIZ1/2*2+1][5];
+
+//---------------------------------------------------------------------
+// The triangular sweeps run as a wavefront over the team: each thread
+// takes a block of j rows, in tid order, and goes through the planes.
+// Plane k of a block only needs plane k of the block before it (after
+// it, for the upper sweep), so a thread waits for that neighbour alone,
+// on the count of planes the neighbour finished, instead of a barrier
+// per plane. The team puts consecutive tids on the same node, so each
+// plane crosses a node boundary once.
+//
+// Each count is written by its thread only and lives in a page of its
+// node.
+//---------------------------------------------------------------------
+static long *sweep_done[POPCORN_TEAM_MAX];
+
+static void sweep_setup(int tid, void *arg)
+{
+  sweep_done[tid] = (long *)popcorn_node_calloc(1, sizeof(long),
+                                                popcorn_team_node(tid));
+  popcorn_team_barrier();
+}
+
+
+// Wait for thread 'tid' to have finished 'step' planes
+static void sweep_wait(int tid, long step)
+{
+  int spins = 0;
+
+  while (__atomic_load_n(sweep_done[tid], __ATOMIC_ACQUIRE) < step) {
+    if (++spins == 64) {
+      spins = 0;
+      sched_yield();
+    }
+  }
+}
+
+
+static void sweep_post(int tid, long step)
+{
+  __atomic_store_n(sweep_done[tid], step, __ATOMIC_RELEASE);
+}
+
+
+static void sweeps(int tid, void *arg)
+{
+  int k, j0, j1;
+  int last = popcorn_team_size() - 1;
+  int timed = timeron && tid == 0;
+  long step = *sweep_done[tid];
+
+  popcorn_team_split(jst, jend, &j0, &j1);
+
+  for (k = 1; k < nz -1; k++) {
+    //---------------------------------------------------------------------
+    // form the lower triangular part of the jacobian matrix
+    //---------------------------------------------------------------------
+    if (timed) timer_start(t_jacld);
+    jacld(k, j0, j1);
+    if (timed) timer_stop(t_jacld);
+
+    //---------------------------------------------------------------------
+    // perform the lower triangular solution
+    //---------------------------------------------------------------------
+    if (timed) timer_start(t_blts);
+    step++;
+    if (tid > 0) sweep_wait(tid - 1, step);
+    blts( ISIZ1, ISIZ2, ISIZ3,
+          nx, ny, nz, k,
+          omega,
+          rsd, 
+          a, b, c, d,
+          ist, iend, j0, j1, 
+          nx0, ny0 );
+    sweep_post(tid, step);
+    if (timed) timer_stop(t_blts);
+  }
+
+  for (k = nz - 2; k > 0; k--) {
+    //---------------------------------------------------------------------
+    // form the strictly upper triangular part of the jacobian matrix
+    //---------------------------------------------------------------------
+    if (timed) timer_start(t_jacu);
+    jacu(k, j0, j1);
+    if (timed) timer_stop(t_jacu);
+
+    //---------------------------------------------------------------------
+    // perform the upper triangular solution
+    //---------------------------------------------------------------------
+    if (timed) timer_start(t_buts);
+    step++;
+    if (tid < last) sweep_wait(tid + 1, step);
+    buts( ISIZ1, ISIZ2, ISIZ3,
+          nx, ny, nz, k,
+          omega,
+          rsd, tv,
+          d, a, b, c,
+          ist, iend, j0, j1,
+          nx0, ny0 );
+    sweep_post(tid, step);
+    if (timed) timer_stop(t_buts);
+  }
+}
 
 //---------------------------------------------------------------------
 // to perform pseudo-time stepping SSOR iterations
@@ -46,7 +153,7 @@ void ssor(int niter)
   //---------------------------------------------------------------------
   int i, j, k, m, n;
   int istep;
-  double tmp, tv[ISIZ2][ISIZ1][5];
+  double tmp;
   double delunm[5];
 
   //---------------------------------------------------------------------
@@ -73,6 +180,7 @@ void ssor(int niter)
   for (i = 1; i <= t_last; i++) {
     timer_clear(i);
   }
+  if (sweep_done[0] == NULL) popcorn_team_run(sweep_setup, NULL);
 
   //---------------------------------------------------------------------
   // compute the steady-state residuals
@@ -135,49 +243,7 @@ void ssor(int niter)
     }
     if (timeron) timer_stop(t_rhs);
 
-    for (k = 1; k < nz -1; k++) {
-      //---------------------------------------------------------------------
-      // form the lower triangular part of the jacobian matrix
-      //---------------------------------------------------------------------
-      if (timeron) timer_start(t_jacld);
-      jacld(k);
-      if (timeron) timer_stop(t_jacld);
-
-      //---------------------------------------------------------------------
-      // perform the lower triangular solution
-      //---------------------------------------------------------------------
-      if (timeron) timer_start(t_blts);
-      blts( ISIZ1, ISIZ2, ISIZ3,
-            nx, ny, nz, k,
-            omega,
-            rsd, 
-            a, b, c, d,
-            ist, iend, jst, jend, 
-            nx0, ny0 );
-      if (timeron) timer_stop(t_blts);
-    }
- 
-    for (k = nz - 2; k > 0; k--) {
-      //---------------------------------------------------------------------
-      // form the strictly upper triangular part of the jacobian matrix
-      //---------------------------------------------------------------------
-      if (timeron) timer_start(t_jacu);
-      jacu(k);
-      if (timeron) timer_stop(t_jacu);
-
-      //---------------------------------------------------------------------
-      // perform the upper triangular solution
-      //---------------------------------------------------------------------
-      if (timeron) timer_start(t_buts);
-      buts( ISIZ1, ISIZ2, ISIZ3,
-            nx, ny, nz, k,
-            omega,
-            rsd, tv,
-            d, a, b, c,
-            ist, iend, jst, jend,
-            nx0, ny0 );
-      if (timeron) timer_stop(t_buts);
-    }
+    popcorn_team_run(sweeps, NULL);
 
     //---------------------------------------------------------------------
     // update the variables
@@ -38,7 +38,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 #include "migrate.h"
+
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_ranges.h"
+#include "popcorn_team.h"
+#include "popcorn_huge.h"
+
+// Region ID for popcorn_profile.h
+#define MG_REGION_BENCH 1
 #include "globals.h"
 #include "randdp.h"
 #include "timers.h"
@@ -52,6 +66,8 @@ static void psinv(void *or, void *ou, int n1, int n2, int n3,
                   double c[4], int k);
 static void resid(void *ou, void *ov, void *or, int n1, int n2, int n3,
                   double a[4], int k);
+static void resid_psinv(void *ou, void *ov, void *or, int n1, int n2, int n3,
+                        double a[4], double c[4], int k);
 static void rprj3(void *or, int m1k, int m2k, int m3k,
                   void *os, int m1j, int m2j, int m3j, int k);
 static void interp(void *oz, int mm1, int mm2, int mm3,
@@ -67,6 +83,16 @@ static double power(double a, int n);
 static void bubble(double ten[][2], int j1[][2], int j2[][2], int j3[][2],
                    int m, int ind);
 static void zero3(void *oz, int n1, int n2, int n3);
+static void mixed_build(void);
+static void bench(int tid, void *arg);
+
+// Arguments and results of bench(), for the threads of the team
+struct bench_args {
+  double *a;
+  double *c;
+  int n1, n2, n3, nit;
+  double rnm2, rnmu;
+};
 
 
 //-------------------------------------------------------------------------c
@@ -75,13 +101,40 @@ static void zero3(void *oz, int n1, int n2, int n3);
 // are always passed as subroutine args. 
 //-------------------------------------------------------------------------c
 /* commcon /noautom/ */
-static double u[NR];
-static double v[NR];
-static double r[NR];
+// On 2MB pages with $POPCORN_HUGE (see popcorn_huge.h)
+static double u[NR] POPCORN_HUGE_ALIGN;
+static double v[NR] POPCORN_HUGE_ALIGN;
+static double r[NR] POPCORN_HUGE_ALIGN;
+
+// Working set of the timed section, taken along to the remote node
+static struct popcorn_range mg_ranges[] = {
+  POPCORN_RANGE_RW(u),
+  POPCORN_RANGE_RO(v),
+  POPCORN_RANGE_RW(r),
+  { NULL, 0, 0 },     // mixed.u, from MG_MIXED_RANGES on
+  { NULL, 0, 0 },     // mixed.r
+};
+#define MG_MIXED_RANGES 3
+
+//---------------------------------------------------------------------
+// Mixed precision, with $MG_PRECISION=mixed: the V-cycles keep r and u
+// of the coarse grids, the corrections, in float, with the stencils
+// computed in double. The finest grid, where the solution accumulates
+// and its residual is formed, stays in double: a float residual there
+// moves the final norm by about 1e-8, the verification tolerance.
+//---------------------------------------------------------------------
+static struct {
+  float *u;
+  float *r;
+} mixed;
 
 /* common /grid/ */
 static int is1, is2, is3, ie1, ie2, ie3;
 
+// resid() and psinv() in one sweep (see resid_psinv()), unless
+// MG_SWEEPS=split
+static logical fused_sweeps = true;
+
 
 int main()
 {
@@ -89,7 +142,7 @@ int main()
   // k is the current level. It is passed down through subroutine args
   // and is NOT global. it is the current iteration
   //-------------------------------------------------------------------------c
-  int k, it;
+  int k;
   double t, tinit, mflops;
 
   double a[4], c[4];
@@ -100,9 +153,15 @@ int main()
   logical verified;
 
   int i;
+  const char *env;
   char *t_names[T_last];
   double tmax;
 
+  // Before anything touches them
+  POPCORN_HUGE_STATIC(u);
+  POPCORN_HUGE_STATIC(v);
+  POPCORN_HUGE_STATIC(r);
+
   for (i = T_init; i < T_last; i++) {
     timer_clear(i);
   }
@@ -222,6 +281,19 @@ int main()
 
   printf(" Size: %4dx%4dx%4d  (class %c)\n", nx[lt], ny[lt], nz[lt], Class);
   printf(" Iterations: %3d\n", nit);
+  env = getenv("MG_SWEEPS");
+  fused_sweeps = env == NULL || strcmp(env, "split") != 0;
+  printf(" Sweeps: %s\n", fused_sweeps ? "resid+psinv fused" : "split");
+  env = getenv("MG_PRECISION");
+  if (env != NULL && strcmp(env, "mixed") == 0) {
+    mixed_build();
+    printf(" Precision: mixed, float coarse grids\n");
+  } else if (env == NULL || strcmp(env, "double") == 0) {
+    printf(" Precision: double\n");
+  } else {
+    printf(" MG_PRECISION must be double or mixed, not %s\n", env);
+    exit(EXIT_FAILURE);
+  }
   printf("\n");
 
   resid(u, v, r, n1, n2, n3, a, k);
@@ -247,32 +319,27 @@ int main()
     timer_clear(i);
   }
 
-  timer_start(T_bench);
-  migrate(1, NULL, NULL);
-
-  if (timeron) timer_start(T_resid2);
-  resid(u, v, r, n1, n2, n3, a, k);
-  if (timeron) timer_stop(T_resid2);
-  norm2u3(r, n1, n2, n3, &rnm2, &rnmu, nx[lt], ny[lt], nz[lt]);
-  old2 = rnm2;
-  oldu = rnmu;
+  //---------------------------------------------------------------------
+  // The timed section runs on a team of $POPCORN_THREADS threads spread
+  // over the nodes, each on a block of planes of the grids. A team of one
+  // migrates for the whole section instead.
+  //---------------------------------------------------------------------
+  popcorn_team_init(MG_REGION_BENCH);
+  struct bench_args b = { a, c, n1, n2, n3, nit };
 
-  for (it = 1; it <= nit; it++) {
-    if ((it == 1) || (it == nit) || ((it % 5) == 0)) {
-      printf("  iter %3d\n", it);
-    }
-    if (timeron) timer_start(T_mg3P);
-    mg3P(u, v, r, a, c, n1, n2, n3);
-    if (timeron) timer_stop(T_mg3P);
-    if (timeron) timer_start(T_resid2);
-    resid(u, v, r, n1, n2, n3, a, k);
-    if (timeron) timer_stop(T_resid2);
-  }
+  timer_start(T_bench);
+  if (popcorn_team_size() == 1)
+    popcorn_migrate_ranges(MG_REGION_BENCH, POPCORN_NODE_BEST, mg_ranges,
+                           POPCORN_RANGES(mg_ranges), POPCORN_RANGE_ALL);
 
-  norm2u3(r, n1, n2, n3, &rnm2, &rnmu, nx[lt], ny[lt], nz[lt]);
+  popcorn_team_run(bench, &b);
+  rnm2 = b.rnm2;
+  rnmu = b.rnmu;
 
-  migrate(0, NULL, NULL);
+  if (popcorn_team_size() == 1)
+    popcorn_migrate_home(MG_REGION_BENCH);
   timer_stop(T_bench);
+  popcorn_team_fini();
 
   t = timer_read(T_bench);
 
@@ -280,6 +347,7 @@ int main()
   verify_value = 0.0;
 
   printf("\n Benchmark completed\n");
+  popcorn_huge_report(stdout);
 
   epsilon = 1.0e-8;
   if (Class != 'U') {
@@ -412,6 +480,331 @@ static void setup(int *n1, int *n2, int *n3)
 }
 
 
+//---------------------------------------------------------------------
+// The kernels of mixed precision (see mixed) on the float coarse grids:
+// those of zero3(), comm3(), resid(), psinv() and resid_psinv(), with
+// the sums in double
+//---------------------------------------------------------------------
+static void mixed_zero3(float *oz, int n1, int n2, int n3)
+{
+  float (*z)[n2][n1] = (float (*)[n2][n1])oz;
+
+  int i1, i2, i3, lo, hi;
+
+  popcorn_team_split(0, n3, &lo, &hi);
+  for (i3 = lo; i3 < hi; i3++) {
+    for (i2 = 0; i2 < n2; i2++) {
+      for (i1 = 0; i1 < n1; i1++) {
+        z[i3][i2][i1] = 0.0f;
+      }
+    }
+  }
+  popcorn_team_barrier();
+}
+
+
+static void mixed_comm3(float *ou, int n1, int n2, int n3)
+{
+  float (*u)[n2][n1] = (float (*)[n2][n1])ou;
+
+  int i1, i2, i3, lo, hi;
+
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_comm3);
+  popcorn_team_barrier();
+  popcorn_team_split(1, n3-1, &lo, &hi);
+  for (i3 = lo; i3 < hi; i3++) {
+    for (i2 = 1; i2 < n2-1; i2++) {
+      u[i3][i2][   0] = u[i3][i2][n1-2];
+      u[i3][i2][n1-1] = u[i3][i2][   1];
+    }
+  }
+
+  popcorn_team_barrier();
+  for (i3 = lo; i3 < hi; i3++) {
+    for (i1 = 0; i1 < n1; i1++) {
+      u[i3][   0][i1] = u[i3][n2-2][i1];
+      u[i3][n2-1][i1] = u[i3][   1][i1];
+    }
+  }
+
+  popcorn_team_barrier();
+  popcorn_team_split(0, n2, &lo, &hi);
+  for (i2 = lo; i2 < hi; i2++) {
+    for (i1 = 0; i1 < n1; i1++) {
+      u[   0][i2][i1] = u[n3-2][i2][i1];
+      u[n3-1][i2][i1] = u[   1][i2][i1];
+    }
+  }
+  popcorn_team_barrier();
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_comm3);
+}
+
+
+static void mixed_comm3_plane(float *ou, int n1, int n2, int i3)
+{
+  float (*u)[n2][n1] = (float (*)[n2][n1])ou;
+
+  int i1, i2;
+
+  for (i2 = 1; i2 < n2-1; i2++) {
+    u[i3][i2][   0] = u[i3][i2][n1-2];
+    u[i3][i2][n1-1] = u[i3][i2][   1];
+  }
+  for (i1 = 0; i1 < n1; i1++) {
+    u[i3][   0][i1] = u[i3][n2-2][i1];
+    u[i3][n2-1][i1] = u[i3][   1][i1];
+  }
+}
+
+
+static void mixed_resid_plane(float *ou, float *ov, float *or, int n1,
+                              int n2, int i3, const double a[4])
+{
+  float (*u)[n2][n1] = (float (*)[n2][n1])ou;
+  float (*v)[n2][n1] = (float (*)[n2][n1])ov;
+  float (*r)[n2][n1] = (float (*)[n2][n1])or;
+
+  int i2, i1;
+  double u1[M], u2[M];
+
+  for (i2 = 1; i2 < n2-1; i2++) {
+    for (i1 = 0; i1 < n1; i1++) {
+      u1[i1] = (double)u[i3][i2-1][i1] + u[i3][i2+1][i1]
+             + u[i3-1][i2][i1] + u[i3+1][i2][i1];
+      u2[i1] = (double)u[i3-1][i2-1][i1] + u[i3-1][i2+1][i1]
+             + u[i3+1][i2-1][i1] + u[i3+1][i2+1][i1];
+    }
+    for (i1 = 1; i1 < n1-1; i1++) {
+      r[i3][i2][i1] = (float)(v[i3][i2][i1] - a[0] * u[i3][i2][i1]
+                    - a[2] * ( u2[i1] + u1[i1-1] + u1[i1+1] )
+                    - a[3] * ( u2[i1-1] + u2[i1+1] ));
+    }
+  }
+}
+
+
+static void mixed_psinv_plane(float *or, float *ou, int n1, int n2,
+                              int i3, const double c[4])
+{
+  float (*r)[n2][n1] = (float (*)[n2][n1])or;
+  float (*u)[n2][n1] = (float (*)[n2][n1])ou;
+
+  int i2, i1;
+  double r1[M], r2[M];
+
+  for (i2 = 1; i2 < n2-1; i2++) {
+    for (i1 = 0; i1 < n1; i1++) {
+      r1[i1] = (double)r[i3][i2-1][i1] + r[i3][i2+1][i1]
+             + r[i3-1][i2][i1] + r[i3+1][i2][i1];
+      r2[i1] = (double)r[i3-1][i2-1][i1] + r[i3-1][i2+1][i1]
+             + r[i3+1][i2-1][i1] + r[i3+1][i2+1][i1];
+    }
+    for (i1 = 1; i1 < n1-1; i1++) {
+      u[i3][i2][i1] = (float)(u[i3][i2][i1] + c[0] * r[i3][i2][i1]
+                    + c[1] * ( (double)r[i3][i2][i1-1] + r[i3][i2][i1+1]
+                             + r1[i1] )
+                    + c[2] * ( r2[i1] + r1[i1-1] + r1[i1+1] ));
+    }
+  }
+}
+
+
+static void mixed_resid(float *ou, float *ov, float *or, int n1, int n2,
+                        int n3, double a[4])
+{
+  int i3, lo, hi;
+
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_resid);
+  popcorn_team_split(1, n3-1, &lo, &hi);
+  for (i3 = lo; i3 < hi; i3++) {
+    mixed_resid_plane(ou, ov, or, n1, n2, i3, a);
+  }
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_resid);
+
+  mixed_comm3(or, n1, n2, n3);
+}
+
+
+static void mixed_psinv(float *or, float *ou, int n1, int n2, int n3,
+                        double c[4])
+{
+  int i3, lo, hi;
+
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_psinv);
+  popcorn_team_split(1, n3-1, &lo, &hi);
+  for (i3 = lo; i3 < hi; i3++) {
+    mixed_psinv_plane(or, ou, n1, n2, i3, c);
+  }
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_psinv);
+
+  mixed_comm3(ou, n1, n2, n3);
+}
+
+
+static void mixed_resid_psinv(float *ou, float *ov, float *or, int n1,
+                              int n2, int n3, double a[4], double c[4])
+{
+  float (*r)[n2][n1] = (float (*)[n2][n1])or;
+
+  int i3, i2, i1, lo, hi, lo2, hi2;
+
+  if (!fused_sweeps) {
+    mixed_resid(ou, ov, or, n1, n2, n3, a);
+    mixed_psinv(or, ou, n1, n2, n3, c);
+    return;
+  }
+
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_resid);
+  popcorn_team_split(1, n3-1, &lo, &hi);
+  if (lo < hi) {
+    mixed_resid_plane(ou, ov, or, n1, n2, lo, a);
+    mixed_comm3_plane(or, n1, n2, lo);
+  }
+  if (lo < hi-1) {
+    mixed_resid_plane(ou, ov, or, n1, n2, hi-1, a);
+    mixed_comm3_plane(or, n1, n2, hi-1);
+  }
+  for (i3 = lo+1; i3 < hi-1; i3++) {
+    mixed_resid_plane(ou, ov, or, n1, n2, i3, a);
+    mixed_comm3_plane(or, n1, n2, i3);
+    if (i3-1 > lo) mixed_psinv_plane(or, ou, n1, n2, i3-1, c);
+  }
+  if (hi-2 > lo) mixed_psinv_plane(or, ou, n1, n2, hi-2, c);
+
+  popcorn_team_barrier();
+  popcorn_team_split(0, n2, &lo2, &hi2);
+  for (i2 = lo2; i2 < hi2; i2++) {
+    for (i1 = 0; i1 < n1; i1++) {
+      r[   0][i2][i1] = r[n3-2][i2][i1];
+      r[n3-1][i2][i1] = r[   1][i2][i1];
+    }
+  }
+  popcorn_team_barrier();
+  if (lo < hi) mixed_psinv_plane(or, ou, n1, n2, lo, c);
+  if (lo < hi-1) mixed_psinv_plane(or, ou, n1, n2, hi-1, c);
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_resid);
+
+  mixed_comm3(ou, n1, n2, n3);
+}
+
+
+#define MIXED_T float
+#define MX(kernel) mixed_##kernel##_f
+#include "mg_mixed.h"
+#undef MIXED_T
+#undef MX
+#define MIXED_T double
+#define MX(kernel) mixed_##kernel##_d
+#include "mg_mixed.h"
+#undef MIXED_T
+#undef MX
+
+
+static void mixed_build(void)
+{
+  int k;
+
+  for (k = lb; k <= lt; k++) {
+    if (m1[k] == 3 || m2[k] == 3 || m3[k] == 3) {
+      printf(" MG_PRECISION=mixed needs grids of more than 3 points\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  // At the offsets of u and r; the finest grid is not used
+  mixed.u = (float *)malloc(sizeof(float) * NR);
+  mixed.r = (float *)malloc(sizeof(float) * NR);
+  if (mixed.u == NULL || mixed.r == NULL) {
+    printf(" Not enough memory for mixed precision\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // The double u and r are only used on the finest grid
+  mg_ranges[0].len = sizeof(double) * ir[lt-1];
+  mg_ranges[2].len = sizeof(double) * ir[lt-1];
+  mg_ranges[MG_MIXED_RANGES+0] = (struct popcorn_range)
+      { mixed.u + ir[lt-1], sizeof(float) * (NR - ir[lt-1]), 1 };
+  mg_ranges[MG_MIXED_RANGES+1] = (struct popcorn_range)
+      { mixed.r + ir[lt-1], sizeof(float) * (NR - ir[lt-1]), 1 };
+}
+
+
+//---------------------------------------------------------------------
+// mg3P() with the coarse grids in float
+//---------------------------------------------------------------------
+static void mixed_mg3P(double u[], double v[], double r[],
+                       double a[4], double c[4], int n1, int n2, int n3)
+{
+  float *uf = mixed.u, *rf = mixed.r;
+  int j, k;
+
+  k = lt;
+  j = k - 1;
+  mixed_rprj3_d(r, m1[k], m2[k], m3[k], &rf[ir[j]], m1[j], m2[j], m3[j]);
+  for (k = lt-1; k >= lb+1; k--) {
+    j = k - 1;
+    mixed_rprj3_f(&rf[ir[k]], m1[k], m2[k], m3[k],
+                  &rf[ir[j]], m1[j], m2[j], m3[j]);
+  }
+
+  k = lb;
+  mixed_zero3(&uf[ir[k]], m1[k], m2[k], m3[k]);
+  mixed_psinv(&rf[ir[k]], &uf[ir[k]], m1[k], m2[k], m3[k], c);
+
+  for (k = lb+1; k <= lt-1; k++) {
+    j = k - 1;
+    mixed_zero3(&uf[ir[k]], m1[k], m2[k], m3[k]);
+    mixed_interp_f(&uf[ir[j]], m1[j], m2[j], m3[j],
+                   &uf[ir[k]], m1[k], m2[k], m3[k]);
+    mixed_resid_psinv(&uf[ir[k]], &rf[ir[k]], &rf[ir[k]],
+                      m1[k], m2[k], m3[k], a, c);
+  }
+
+  j = lt - 1;
+  k = lt;
+  mixed_interp_d(&uf[ir[j]], m1[j], m2[j], m3[j], u, n1, n2, n3);
+  resid_psinv(u, v, r, n1, n2, n3, a, c, k);
+}
+
+
+//---------------------------------------------------------------------
+// The timed section, run by every thread of the team
+//---------------------------------------------------------------------
+static void bench(int tid, void *arg)
+{
+  struct bench_args *b = (struct bench_args *)arg;
+  int n1 = b->n1, n2 = b->n2, n3 = b->n3, k = lt, it;
+  double rnm2, rnmu;
+
+
+  if (timeron && tid == 0) timer_start(T_resid2);
+  resid(u, v, r, n1, n2, n3, b->a, k);
+  if (timeron && tid == 0) timer_stop(T_resid2);
+  norm2u3(r, n1, n2, n3, &rnm2, &rnmu, nx[lt], ny[lt], nz[lt]);
+
+  for (it = 1; it <= b->nit; it++) {
+    if (tid == 0 && ((it == 1) || (it == b->nit) || ((it % 5) == 0))) {
+      printf("  iter %3d\n", it);
+    }
+    if (timeron && tid == 0) timer_start(T_mg3P);
+    if (mixed.u != NULL) {
+      mixed_mg3P(u, v, r, b->a, b->c, n1, n2, n3);
+    } else {
+      mg3P(u, v, r, b->a, b->c, n1, n2, n3);
+    }
+    if (timeron && tid == 0) timer_stop(T_mg3P);
+    if (timeron && tid == 0) timer_start(T_resid2);
+    resid(u, v, r, n1, n2, n3, b->a, k);
+    if (timeron && tid == 0) timer_stop(T_resid2);
+  }
+
+  norm2u3(r, n1, n2, n3, &rnm2, &rnmu, nx[lt], ny[lt], nz[lt]);
+  if (tid == 0) {
+    b->rnm2 = rnm2;
+    b->rnmu = rnmu;
+  }
+}
+
+
 //---------------------------------------------------------------------
 // multigrid V-cycle routine
 //---------------------------------------------------------------------
@@ -447,21 +840,370 @@ static void mg3P(double u[], double v[], double r[],
     interp(&u[ir[j]], m1[j], m2[j], m3[j], &u[ir[k]], m1[k], m2[k], m3[k], k);
 
     //---------------------------------------------------------------------
-    // compute residual for level k
+    // compute residual for level k and apply smoother
     //---------------------------------------------------------------------
-    resid(&u[ir[k]], &r[ir[k]], &r[ir[k]], m1[k], m2[k], m3[k], a, k);
-
-    //---------------------------------------------------------------------
-    // apply smoother
-    //---------------------------------------------------------------------
-    psinv(&r[ir[k]], &u[ir[k]], m1[k], m2[k], m3[k], c, k);
+    resid_psinv(&u[ir[k]], &r[ir[k]], &r[ir[k]], m1[k], m2[k], m3[k],
+                a, c, k);
   }
 
   j = lt - 1;
   k = lt;
   interp(&u[ir[j]], m1[j], m2[j], m3[j], u, n1, n2, n3, k);
-  resid(u, v, r, n1, n2, n3, a, k);
-  psinv(r, u, n1, n2, n3, c, k);
+  resid_psinv(u, v, r, n1, n2, n3, a, c, k);
+}
+
+
+//---------------------------------------------------------------------
+// Row kernels of resid() and psinv(). sum4() adds four rows, in order;
+// resid_row() and psinv_row() are the i1 loops of the stencils, with
+// the partial sums of the neighbouring rows in x1 and x2.
+//---------------------------------------------------------------------
+static void sum4_scalar(int n, const double *x0, const double *x1,
+                        const double *x2, const double *x3, double *s)
+{
+  int i1;
+
+  for (i1 = 0; i1 < n; i1++) {
+    s[i1] = x0[i1] + x1[i1] + x2[i1] + x3[i1];
+  }
+}
+
+
+static void resid_row_scalar(int n1, const double *v, const double *u,
+                             const double *u1, const double *u2,
+                             double *r, const double a[4])
+{
+  int i1;
+
+  for (i1 = 1; i1 < n1-1; i1++) {
+    r[i1] = v[i1] - a[0] * u[i1]
+    //-------------------------------------------------------------------
+    //  Assume a[1] = 0      (Enable 2 lines below if a[1] not= 0)
+    //-------------------------------------------------------------------
+    //      - a[1] * ( u[i1-1] + u[i1+1] + u1[i1] )
+    //-------------------------------------------------------------------
+          - a[2] * ( u2[i1] + u1[i1-1] + u1[i1+1] )
+          - a[3] * ( u2[i1-1] + u2[i1+1] );
+  }
+}
+
+
+static void psinv_row_scalar(int n1, const double *r, const double *r1,
+                             const double *r2, double *u, const double c[4])
+{
+  int i1;
+
+  for (i1 = 1; i1 < n1-1; i1++) {
+    u[i1] = u[i1] + c[0] * r[i1]
+          + c[1] * ( r[i1-1] + r[i1+1] + r1[i1] )
+          + c[2] * ( r2[i1] + r1[i1-1] + r1[i1+1] );
+    //-------------------------------------------------------------------
+    // Assume c[3] = 0    (Enable line below if c[3] not= 0)
+    //-------------------------------------------------------------------
+    //      + c[3] * ( r2[i1-1] + r2[i1+1] )
+    //-------------------------------------------------------------------
+  }
+}
+
+
+#if defined(__x86_64__)
+//---------------------------------------------------------------------
+// The row kernels with AVX, four points at a time. The sums and
+// products are those of the scalar loops, in the same order, so the
+// results do not change.
+//---------------------------------------------------------------------
+__attribute__((target("avx")))
+static void sum4_simd(int n, const double *x0, const double *x1,
+                      const double *x2, const double *x3, double *s)
+{
+  int i1;
+
+  for (i1 = 0; i1 + 4 <= n; i1 += 4) {
+    __m256d t = _mm256_add_pd(_mm256_loadu_pd(&x0[i1]),
+                              _mm256_loadu_pd(&x1[i1]));
+    t = _mm256_add_pd(t, _mm256_loadu_pd(&x2[i1]));
+    _mm256_storeu_pd(&s[i1], _mm256_add_pd(t, _mm256_loadu_pd(&x3[i1])));
+  }
+  for (; i1 < n; i1++) {
+    s[i1] = x0[i1] + x1[i1] + x2[i1] + x3[i1];
+  }
+}
+
+
+__attribute__((target("avx")))
+static void resid_row_simd(int n1, const double *v, const double *u,
+                           const double *u1, const double *u2,
+                           double *r, const double a[4])
+{
+  __m256d a0 = _mm256_set1_pd(a[0]), a2 = _mm256_set1_pd(a[2]);
+  __m256d a3 = _mm256_set1_pd(a[3]);
+  int i1;
+
+  for (i1 = 1; i1 + 4 <= n1-1; i1 += 4) {
+    __m256d s2 = _mm256_add_pd(_mm256_add_pd(_mm256_loadu_pd(&u2[i1]),
+                                             _mm256_loadu_pd(&u1[i1-1])),
+                               _mm256_loadu_pd(&u1[i1+1]));
+    __m256d s3 = _mm256_add_pd(_mm256_loadu_pd(&u2[i1-1]),
+                               _mm256_loadu_pd(&u2[i1+1]));
+    __m256d t = _mm256_sub_pd(_mm256_loadu_pd(&v[i1]),
+                              _mm256_mul_pd(a0, _mm256_loadu_pd(&u[i1])));
+    t = _mm256_sub_pd(t, _mm256_mul_pd(a2, s2));
+    _mm256_storeu_pd(&r[i1], _mm256_sub_pd(t, _mm256_mul_pd(a3, s3)));
+  }
+  for (; i1 < n1-1; i1++) {
+    r[i1] = v[i1] - a[0] * u[i1]
+          - a[2] * ( u2[i1] + u1[i1-1] + u1[i1+1] )
+          - a[3] * ( u2[i1-1] + u2[i1+1] );
+  }
+}
+
+
+__attribute__((target("avx")))
+static void psinv_row_simd(int n1, const double *r, const double *r1,
+                           const double *r2, double *u, const double c[4])
+{
+  __m256d c0 = _mm256_set1_pd(c[0]), c1 = _mm256_set1_pd(c[1]);
+  __m256d c2 = _mm256_set1_pd(c[2]);
+  int i1;
+
+  for (i1 = 1; i1 + 4 <= n1-1; i1 += 4) {
+    __m256d s1 = _mm256_add_pd(_mm256_add_pd(_mm256_loadu_pd(&r[i1-1]),
+                                             _mm256_loadu_pd(&r[i1+1])),
+                               _mm256_loadu_pd(&r1[i1]));
+    __m256d s2 = _mm256_add_pd(_mm256_add_pd(_mm256_loadu_pd(&r2[i1]),
+                                             _mm256_loadu_pd(&r1[i1-1])),
+                               _mm256_loadu_pd(&r1[i1+1]));
+    __m256d t = _mm256_add_pd(_mm256_loadu_pd(&u[i1]),
+                              _mm256_mul_pd(c0, _mm256_loadu_pd(&r[i1])));
+    t = _mm256_add_pd(t, _mm256_mul_pd(c1, s1));
+    _mm256_storeu_pd(&u[i1], _mm256_add_pd(t, _mm256_mul_pd(c2, s2)));
+  }
+  for (; i1 < n1-1; i1++) {
+    u[i1] = u[i1] + c[0] * r[i1]
+          + c[1] * ( r[i1-1] + r[i1+1] + r1[i1] )
+          + c[2] * ( r2[i1] + r1[i1-1] + r1[i1+1] );
+  }
+}
+
+
+// Checked on every sweep: a thread can land on a node without AVX.
+static int stencil_simd_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx");
+}
+#elif defined(__aarch64__)
+//---------------------------------------------------------------------
+// The row kernels with NEON, two points at a time
+//---------------------------------------------------------------------
+static void sum4_simd(int n, const double *x0, const double *x1,
+                      const double *x2, const double *x3, double *s)
+{
+  int i1;
+
+  for (i1 = 0; i1 + 2 <= n; i1 += 2) {
+    float64x2_t t = vaddq_f64(vld1q_f64(&x0[i1]), vld1q_f64(&x1[i1]));
+    t = vaddq_f64(t, vld1q_f64(&x2[i1]));
+    vst1q_f64(&s[i1], vaddq_f64(t, vld1q_f64(&x3[i1])));
+  }
+  for (; i1 < n; i1++) {
+    s[i1] = x0[i1] + x1[i1] + x2[i1] + x3[i1];
+  }
+}
+
+
+static void resid_row_simd(int n1, const double *v, const double *u,
+                           const double *u1, const double *u2,
+                           double *r, const double a[4])
+{
+  int i1;
+
+  for (i1 = 1; i1 + 2 <= n1-1; i1 += 2) {
+    float64x2_t s2 = vaddq_f64(vaddq_f64(vld1q_f64(&u2[i1]),
+                                         vld1q_f64(&u1[i1-1])),
+                               vld1q_f64(&u1[i1+1]));
+    float64x2_t s3 = vaddq_f64(vld1q_f64(&u2[i1-1]), vld1q_f64(&u2[i1+1]));
+    float64x2_t t = vsubq_f64(vld1q_f64(&v[i1]),
+                              vmulq_n_f64(vld1q_f64(&u[i1]), a[0]));
+    t = vsubq_f64(t, vmulq_n_f64(s2, a[2]));
+    vst1q_f64(&r[i1], vsubq_f64(t, vmulq_n_f64(s3, a[3])));
+  }
+  for (; i1 < n1-1; i1++) {
+    r[i1] = v[i1] - a[0] * u[i1]
+          - a[2] * ( u2[i1] + u1[i1-1] + u1[i1+1] )
+          - a[3] * ( u2[i1-1] + u2[i1+1] );
+  }
+}
+
+
+static void psinv_row_simd(int n1, const double *r, const double *r1,
+                           const double *r2, double *u, const double c[4])
+{
+  int i1;
+
+  for (i1 = 1; i1 + 2 <= n1-1; i1 += 2) {
+    float64x2_t s1 = vaddq_f64(vaddq_f64(vld1q_f64(&r[i1-1]),
+                                         vld1q_f64(&r[i1+1])),
+                               vld1q_f64(&r1[i1]));
+    float64x2_t s2 = vaddq_f64(vaddq_f64(vld1q_f64(&r2[i1]),
+                                         vld1q_f64(&r1[i1-1])),
+                               vld1q_f64(&r1[i1+1]));
+    float64x2_t t = vaddq_f64(vld1q_f64(&u[i1]),
+                              vmulq_n_f64(vld1q_f64(&r[i1]), c[0]));
+    t = vaddq_f64(t, vmulq_n_f64(s1, c[1]));
+    vst1q_f64(&u[i1], vaddq_f64(t, vmulq_n_f64(s2, c[2])));
+  }
+  for (; i1 < n1-1; i1++) {
+    u[i1] = u[i1] + c[0] * r[i1]
+          + c[1] * ( r[i1-1] + r[i1+1] + r1[i1] )
+          + c[2] * ( r2[i1] + r1[i1-1] + r1[i1+1] );
+  }
+}
+
+
+static int stencil_simd_supported(void)
+{
+  return 1;
+}
+#else
+static int stencil_simd_supported(void)
+{
+  return 0;
+}
+#endif
+
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define STENCIL_ROW(simd, kernel, ...) \
+  ((simd) ? kernel##_simd(__VA_ARGS__) : kernel##_scalar(__VA_ARGS__))
+#else
+#define STENCIL_ROW(simd, kernel, ...) kernel##_scalar(__VA_ARGS__)
+#endif
+
+
+//---------------------------------------------------------------------
+// Plane i3 of resid() and psinv()
+//---------------------------------------------------------------------
+static void resid_plane(void *ou, void *ov, void *or, int n1, int n2,
+                        int i3, const double a[4], int simd)
+{
+  double (*u)[n2][n1] = (double (*)[n2][n1])ou;
+  double (*v)[n2][n1] = (double (*)[n2][n1])ov;
+  double (*r)[n2][n1] = (double (*)[n2][n1])or;
+
+  int i2;
+  double u1[M], u2[M];
+
+  for (i2 = 1; i2 < n2-1; i2++) {
+    STENCIL_ROW(simd, sum4, n1, u[i3][i2-1], u[i3][i2+1],
+                u[i3-1][i2], u[i3+1][i2], u1);
+    STENCIL_ROW(simd, sum4, n1, u[i3-1][i2-1], u[i3-1][i2+1],
+                u[i3+1][i2-1], u[i3+1][i2+1], u2);
+    STENCIL_ROW(simd, resid_row, n1, v[i3][i2], u[i3][i2], u1, u2,
+                r[i3][i2], a);
+  }
+}
+
+
+static void psinv_plane(void *or, void *ou, int n1, int n2,
+                        int i3, const double c[4], int simd)
+{
+  double (*r)[n2][n1] = (double (*)[n2][n1])or;
+  double (*u)[n2][n1] = (double (*)[n2][n1])ou;
+
+  int i2;
+  double r1[M], r2[M];
+
+  for (i2 = 1; i2 < n2-1; i2++) {
+    STENCIL_ROW(simd, sum4, n1, r[i3][i2-1], r[i3][i2+1],
+                r[i3-1][i2], r[i3+1][i2], r1);
+    STENCIL_ROW(simd, sum4, n1, r[i3-1][i2-1], r[i3-1][i2+1],
+                r[i3+1][i2-1], r[i3+1][i2+1], r2);
+    STENCIL_ROW(simd, psinv_row, n1, r[i3][i2], r1, r2, u[i3][i2], c);
+  }
+}
+
+
+//---------------------------------------------------------------------
+// The i1 and i2 borders of comm3() on plane i3 only
+//---------------------------------------------------------------------
+static void comm3_plane(void *ou, int n1, int n2, int i3)
+{
+  double (*u)[n2][n1] = (double (*)[n2][n1])ou;
+
+  int i1, i2;
+
+  for (i2 = 1; i2 < n2-1; i2++) {
+    u[i3][i2][   0] = u[i3][i2][n1-2];
+    u[i3][i2][n1-1] = u[i3][i2][   1];
+  }
+  for (i1 = 0; i1 < n1; i1++) {
+    u[i3][   0][i1] = u[i3][n2-2][i1];
+    u[i3][n2-1][i1] = u[i3][   1][i1];
+  }
+}
+
+
+//---------------------------------------------------------------------
+// resid() followed by psinv() in one sweep over the planes: psinv()
+// smooths plane i3-1 as soon as resid() has computed plane i3, so the
+// residual is still in cache when it is used. Plane i3-1 of u is read
+// by resid() on plane i3 and is only smoothed after it. The first and
+// last planes of each thread's block wait for the neighbours' residual
+// behind a barrier. The results are those of resid(); psinv(). The
+// sweep is timed as resid.
+//---------------------------------------------------------------------
+static void resid_psinv(void *ou, void *ov, void *or, int n1, int n2, int n3,
+                        double a[4], double c[4], int k)
+{
+  double (*r)[n2][n1] = (double (*)[n2][n1])or;
+
+  int i3, i2, i1, lo, hi, lo2, hi2;
+  int simd = stencil_simd_supported();
+
+  // the norms and dumps of debug_vec come between the two
+  if (!fused_sweeps || debug_vec[0] >= 1 || debug_vec[2] >= k ||
+      debug_vec[3] >= k) {
+    resid(ou, ov, or, n1, n2, n3, a, k);
+    psinv(or, ou, n1, n2, n3, c, k);
+    return;
+  }
+
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_resid);
+  popcorn_team_split(1, n3-1, &lo, &hi);
+  if (lo < hi) {
+    resid_plane(ou, ov, or, n1, n2, lo, a, simd);
+    comm3_plane(or, n1, n2, lo);
+  }
+  if (lo < hi-1) {
+    resid_plane(ou, ov, or, n1, n2, hi-1, a, simd);
+    comm3_plane(or, n1, n2, hi-1);
+  }
+  for (i3 = lo+1; i3 < hi-1; i3++) {
+    resid_plane(ou, ov, or, n1, n2, i3, a, simd);
+    comm3_plane(or, n1, n2, i3);
+    if (i3-1 > lo) psinv_plane(or, ou, n1, n2, i3-1, c, simd);
+  }
+  if (hi-2 > lo) psinv_plane(or, ou, n1, n2, hi-2, c, simd);
+
+  //---------------------------------------------------------------------
+  // the i3 border of the residual, then the planes next to the other
+  // blocks
+  //---------------------------------------------------------------------
+  popcorn_team_barrier();
+  popcorn_team_split(0, n2, &lo2, &hi2);
+  for (i2 = lo2; i2 < hi2; i2++) {
+    for (i1 = 0; i1 < n1; i1++) {
+      r[   0][i2][i1] = r[n3-2][i2][i1];
+      r[n3-1][i2][i1] = r[   1][i2][i1];
+    }
+  }
+  popcorn_team_barrier();
+  if (lo < hi) psinv_plane(or, ou, n1, n2, lo, c, simd);
+  if (lo < hi-1) psinv_plane(or, ou, n1, n2, hi-1, c, simd);
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_resid);
+
+  comm3(ou, n1, n2, n3, k);
 }
 
 
@@ -479,37 +1221,17 @@ static void mg3P(double u[], double v[], double r[],
 static void psinv(void *or, void *ou, int n1, int n2, int n3,
                   double c[4], int k)
 {
-  double (*r)[n2][n1] = (double (*)[n2][n1])or;
   double (*u)[n2][n1] = (double (*)[n2][n1])ou;
 
-  int i3, i2, i1;
-
-  double r1[M], r2[M];
+  int i3, lo, hi;
+  int simd = stencil_simd_supported();
 
-  if (timeron) timer_start(T_psinv);
-  for (i3 = 1; i3 < n3-1; i3++) {
-    for (i2 = 1; i2 < n2-1; i2++) {
-      for (i1 = 0; i1 < n1; i1++) {
-        r1[i1] = r[i3][i2-1][i1] + r[i3][i2+1][i1]
-               + r[i3-1][i2][i1] + r[i3+1][i2][i1];
-        r2[i1] = r[i3-1][i2-1][i1] + r[i3-1][i2+1][i1]
-               + r[i3+1][i2-1][i1] + r[i3+1][i2+1][i1];
-      }
-      for (i1 = 1; i1 < n1-1; i1++) {
-        u[i3][i2][i1] = u[i3][i2][i1]
-                      + c[0] * r[i3][i2][i1]
-                      + c[1] * ( r[i3][i2][i1-1] + r[i3][i2][i1+1]
-                               + r1[i1] )
-                      + c[2] * ( r2[i1] + r1[i1-1] + r1[i1+1] );
-        //--------------------------------------------------------------------
-        // Assume c[3] = 0    (Enable line below if c[3] not= 0)
-        //--------------------------------------------------------------------
-        //            + c[3] * ( r2[i1-1] + r2[i1+1] )
-        //--------------------------------------------------------------------
-      }
-    }
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_psinv);
+  popcorn_team_split(1, n3-1, &lo, &hi);
+  for (i3 = lo; i3 < hi; i3++) {
+    psinv_plane(or, ou, n1, n2, i3, c, simd);
   }
-  if (timeron) timer_stop(T_psinv);
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_psinv);
 
   //---------------------------------------------------------------------
   // exchange boundary points
@@ -541,37 +1263,17 @@ static void psinv(void *or, void *ou, int n1, int n2, int n3,
 static void resid(void *ou, void *ov, void *or, int n1, int n2, int n3,
                   double a[4], int k)
 {
-  double (*u)[n2][n1] = (double (*)[n2][n1])ou;
-  double (*v)[n2][n1] = (double (*)[n2][n1])ov;
   double (*r)[n2][n1] = (double (*)[n2][n1])or;
 
-  int i3, i2, i1;
-  double u1[M], u2[M];
+  int i3, lo, hi;
+  int simd = stencil_simd_supported();
 
-  if (timeron) timer_start(T_resid);
-  for (i3 = 1; i3 < n3-1; i3++) {
-    for (i2 = 1; i2 < n2-1; i2++) {
-      for (i1 = 0; i1 < n1; i1++) {
-        u1[i1] = u[i3][i2-1][i1] + u[i3][i2+1][i1]
-               + u[i3-1][i2][i1] + u[i3+1][i2][i1];
-        u2[i1] = u[i3-1][i2-1][i1] + u[i3-1][i2+1][i1]
-               + u[i3+1][i2-1][i1] + u[i3+1][i2+1][i1];
-      }
-      for (i1 = 1; i1 < n1-1; i1++) {
-        r[i3][i2][i1] = v[i3][i2][i1]
-                      - a[0] * u[i3][i2][i1]
-        //-------------------------------------------------------------------
-        //  Assume a[1] = 0      (Enable 2 lines below if a[1] not= 0)
-        //-------------------------------------------------------------------
-        //            - a[1] * ( u[i3][i2][i1-1] + u[i3][i2][i1+1]
-        //                     + u1[i1] )
-        //-------------------------------------------------------------------
-                      - a[2] * ( u2[i1] + u1[i1-1] + u1[i1+1] )
-                      - a[3] * ( u2[i1-1] + u2[i1+1] );
-      }
-    }
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_resid);
+  popcorn_team_split(1, n3-1, &lo, &hi);
+  for (i3 = lo; i3 < hi; i3++) {
+    resid_plane(ou, ov, or, n1, n2, i3, a, simd);
   }
-  if (timeron) timer_stop(T_resid);
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_resid);
 
   //---------------------------------------------------------------------
   // exchange boundary data
@@ -603,11 +1305,11 @@ static void rprj3(void *or, int m1k, int m2k, int m3k,
   double (*r)[m2k][m1k] = (double (*)[m2k][m1k])or;
   double (*s)[m2j][m1j] = (double (*)[m2j][m1j])os;
 
-  int j3, j2, j1, i3, i2, i1, d1, d2, d3, j;
+  int j3, j2, j1, i3, i2, i1, d1, d2, d3, j, lo, hi;
 
   double x1[M], y1[M], x2, y2;
 
-  if (timeron) timer_start(T_rprj3);
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_rprj3);
   if (m1k == 3) {
     d1 = 2;
   } else {
@@ -626,7 +1328,8 @@ static void rprj3(void *or, int m1k, int m2k, int m3k,
     d3 = 1;
   }
 
-  for (j3 = 1; j3 < m3j-1; j3++) {
+  popcorn_team_split(1, m3j-1, &lo, &hi);
+  for (j3 = lo; j3 < hi; j3++) {
     i3 = 2*j3-d3;
     for (j2 = 1; j2 < m2j-1; j2++) {
       i2 = 2*j2-d2;
@@ -653,7 +1356,7 @@ static void rprj3(void *or, int m1k, int m2k, int m3k,
       }
     }
   }
-  if (timeron) timer_stop(T_rprj3);
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_rprj3);
 
   j = k-1;
   comm3(s, m1j, m2j, m3j, j);
@@ -684,7 +1387,7 @@ static void interp(void *oz, int mm1, int mm2, int mm3,
   double (*z)[mm2][mm1] = (double (*)[mm2][mm1])oz;
   double (*u)[n2][n1] = (double (*)[n2][n1])ou;
 
-  int i3, i2, i1, d1, d2, d3, t1, t2, t3;
+  int i3, i2, i1, d1, d2, d3, t1, t2, t3, lo, hi;
 
   // note that m = 1037 in globals.h but for this only need to be
   // 535 to handle up to 1024^3
@@ -692,9 +1395,11 @@ static void interp(void *oz, int mm1, int mm2, int mm3,
   //      parameter( m=535 )
   double z1[M], z2[M], z3[M];
 
-  if (timeron) timer_start(T_interp);
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_interp);
   if (n1 != 3 && n2 != 3 && n3 != 3) {
-    for (i3 = 0; i3 < mm3-1; i3++) {
+    // Plane i3 of z updates the planes 2*i3 and 2*i3+1 of u only
+    popcorn_team_split(0, mm3-1, &lo, &hi);
+    for (i3 = lo; i3 < hi; i3++) {
       for (i2 = 0; i2 < mm2-1; i2++) {
         for (i1 = 0; i1 < mm1; i1++) {
           z1[i1] = z[i3][i2+1][i1] + z[i3][i2][i1];
@@ -728,7 +1433,8 @@ static void interp(void *oz, int mm1, int mm2, int mm3,
         }
       }
     }
-  } else {
+  } else if (popcorn_team_tid() <= 0) {
+    // Only for 3 point grids, too small to split
     if (n1 == 3) {
       d1 = 2;
       t1 = 1;
@@ -814,7 +1520,8 @@ static void interp(void *oz, int mm1, int mm2, int mm3,
     }
 
   }
-  if (timeron) timer_stop(T_interp);
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_interp);
+  popcorn_team_barrier();
 
   if (debug_vec[0] >= 1) {
     rep_nrm(z, mm1, mm2, mm3, "z: inter", k-1);
@@ -841,28 +1548,34 @@ static void norm2u3(void *or, int n1, int n2, int n3,
 {
   double (*r)[n2][n1] = (double (*)[n2][n1])or;
 
-  double s, a;
-  int i3, i2, i1;
+  double s, a, mu;
+  int i3, i2, i1, lo, hi;
 
   double dn;
 
-  if (timeron) timer_start(T_norm2);
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_norm2);
   dn = 1.0*nx*ny*nz;
 
   s = 0.0;
-  *rnmu = 0.0;
-  for (i3 = 1; i3 < n3-1; i3++) {
+  mu = 0.0;
+  popcorn_team_split(1, n3-1, &lo, &hi);
+  for (i3 = lo; i3 < hi; i3++) {
     for (i2 = 1; i2 < n2-1; i2++) {
       for (i1 = 1; i1 < n1-1; i1++) {
         s = s + pow(r[i3][i2][i1], 2.0);
         a = fabs(r[i3][i2][i1]);
-        if (a > *rnmu) *rnmu = a;
+        if (a > mu) mu = a;
       }
     }
   }
+  s = popcorn_team_sum(s);
+  mu = popcorn_team_max(mu);
 
-  *rnm2 = sqrt(s / dn);
-  if (timeron) timer_stop(T_norm2);
+  if (popcorn_team_tid() <= 0) {
+    *rnmu = mu;
+    *rnm2 = sqrt(s / dn);
+  }
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_norm2);
 }
 
 
@@ -885,30 +1598,37 @@ static void comm3(void *ou, int n1, int n2, int n3, int kk)
 {
   double (*u)[n2][n1] = (double (*)[n2][n1])ou;
 
-  int i1, i2, i3;
+  int i1, i2, i3, lo, hi;
 
-  if (timeron) timer_start(T_comm3);
-  for (i3 = 1; i3 < n3-1; i3++) {
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_comm3);
+  // Each border reads the previous ones: a barrier before each
+  popcorn_team_barrier();
+  popcorn_team_split(1, n3-1, &lo, &hi);
+  for (i3 = lo; i3 < hi; i3++) {
     for (i2 = 1; i2 < n2-1; i2++) {
       u[i3][i2][   0] = u[i3][i2][n1-2];
       u[i3][i2][n1-1] = u[i3][i2][   1];
     }
   }
 
-  for (i3 = 1; i3 < n3-1; i3++) {
+  popcorn_team_barrier();
+  for (i3 = lo; i3 < hi; i3++) {
     for (i1 = 0; i1 < n1; i1++) {
       u[i3][   0][i1] = u[i3][n2-2][i1];
       u[i3][n2-1][i1] = u[i3][   1][i1];
     }
   }
 
-  for (i2 = 0; i2 < n2; i2++) {
+  popcorn_team_barrier();
+  popcorn_team_split(0, n2, &lo, &hi);
+  for (i2 = lo; i2 < hi; i2++) {
     for (i1 = 0; i1 < n1; i1++) {
       u[   0][i2][i1] = u[n3-2][i2][i1];
       u[n3-1][i2][i1] = u[   1][i2][i1];
     }
   }
-  if (timeron) timer_stop(T_comm3);
+  popcorn_team_barrier();
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_comm3);
 }
 
 
@@ -1219,14 +1939,16 @@ static void zero3(void *oz, int n1, int n2, int n3)
 {
   double (*z)[n2][n1] = (double (*)[n2][n1])oz;
 
-  int i1, i2, i3;
+  int i1, i2, i3, lo, hi;
 
-  for (i3 = 0; i3 < n3; i3++) {
+  popcorn_team_split(0, n3, &lo, &hi);
+  for (i3 = lo; i3 < hi; i3++) {
     for (i2 = 0; i2 < n2; i2++) {
       for (i1 = 0; i1 < n1; i1++) {
         z[i3][i2][i1] = 0.0;
       }
     }
   }
+  popcorn_team_barrier();
 }
 
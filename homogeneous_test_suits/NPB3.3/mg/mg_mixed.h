@@ -0,0 +1,109 @@
+//---------------------------------------------------------------------
+// rprj3() and interp() of mixed precision (see mixed_mg3P() in mg.c)
+// between a grid of type MIXED_T and a float coarse grid, named
+// MX(kernel). The sums are in double. mg.c includes this file once for
+// the double finest grid and once for the float coarser grids. The
+// loops are those of rprj3() and interp(), the latter for grids of more
+// than 3 points only (see mixed_build()).
+//---------------------------------------------------------------------
+
+// s = Pr, from r of type MIXED_T to the float s
+static void MX(rprj3)(MIXED_T *or, int m1k, int m2k, int m3k,
+                      float *os, int m1j, int m2j, int m3j)
+{
+  MIXED_T (*r)[m2k][m1k] = (MIXED_T (*)[m2k][m1k])or;
+  float (*s)[m2j][m1j] = (float (*)[m2j][m1j])os;
+
+  int j3, j2, j1, i3, i2, i1, d1, d2, d3, lo, hi;
+
+  double x1[M], y1[M], x2, y2;
+
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_rprj3);
+  d1 = m1k == 3 ? 2 : 1;
+  d2 = m2k == 3 ? 2 : 1;
+  d3 = m3k == 3 ? 2 : 1;
+
+  popcorn_team_split(1, m3j-1, &lo, &hi);
+  for (j3 = lo; j3 < hi; j3++) {
+    i3 = 2*j3-d3;
+    for (j2 = 1; j2 < m2j-1; j2++) {
+      i2 = 2*j2-d2;
+
+      for (j1 = 1; j1 < m1j; j1++) {
+        i1 = 2*j1-d1;
+        x1[i1] = (double)r[i3+1][i2  ][i1] + r[i3+1][i2+2][i1]
+               + r[i3  ][i2+1][i1] + r[i3+2][i2+1][i1];
+        y1[i1] = (double)r[i3  ][i2  ][i1] + r[i3+2][i2  ][i1]
+               + r[i3  ][i2+2][i1] + r[i3+2][i2+2][i1];
+      }
+
+      for (j1 = 1; j1 < m1j-1; j1++) {
+        i1 = 2*j1-d1;
+        y2 = (double)r[i3  ][i2  ][i1+1] + r[i3+2][i2  ][i1+1]
+           + r[i3  ][i2+2][i1+1] + r[i3+2][i2+2][i1+1];
+        x2 = (double)r[i3+1][i2  ][i1+1] + r[i3+1][i2+2][i1+1]
+           + r[i3  ][i2+1][i1+1] + r[i3+2][i2+1][i1+1];
+        s[j3][j2][j1] = (float)(
+                0.5 * r[i3+1][i2+1][i1+1]
+              + 0.25 * ((double)r[i3+1][i2+1][i1] + r[i3+1][i2+1][i1+2] + x2)
+              + 0.125 * (x1[i1] + x1[i1+2] + y2)
+              + 0.0625 * (y1[i1] + y1[i1+2]));
+      }
+    }
+  }
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_rprj3);
+
+  mixed_comm3(os, m1j, m2j, m3j);
+}
+
+
+// u = u + Qz, from the float z to u of type MIXED_T
+static void MX(interp)(float *oz, int mm1, int mm2, int mm3,
+                       MIXED_T *ou, int n1, int n2, int n3)
+{
+  float (*z)[mm2][mm1] = (float (*)[mm2][mm1])oz;
+  MIXED_T (*u)[n2][n1] = (MIXED_T (*)[n2][n1])ou;
+
+  int i3, i2, i1, lo, hi;
+  double z1[M], z2[M], z3[M];
+
+  if (timeron && popcorn_team_tid() <= 0) timer_start(T_interp);
+  popcorn_team_split(0, mm3-1, &lo, &hi);
+  for (i3 = lo; i3 < hi; i3++) {
+    for (i2 = 0; i2 < mm2-1; i2++) {
+      for (i1 = 0; i1 < mm1; i1++) {
+        z1[i1] = (double)z[i3][i2+1][i1] + z[i3][i2][i1];
+        z2[i1] = (double)z[i3+1][i2][i1] + z[i3][i2][i1];
+        z3[i1] = (double)z[i3+1][i2+1][i1] + z[i3+1][i2][i1] + z1[i1];
+      }
+
+      for (i1 = 0; i1 < mm1-1; i1++) {
+        u[2*i3][2*i2][2*i1] = (MIXED_T)(u[2*i3][2*i2][2*i1]
+                            + z[i3][i2][i1]);
+        u[2*i3][2*i2][2*i1+1] = (MIXED_T)(u[2*i3][2*i2][2*i1+1]
+                              + 0.5 * ((double)z[i3][i2][i1+1]
+                                       + z[i3][i2][i1]));
+      }
+      for (i1 = 0; i1 < mm1-1; i1++) {
+        u[2*i3][2*i2+1][2*i1] = (MIXED_T)(u[2*i3][2*i2+1][2*i1]
+                              + 0.5 * z1[i1]);
+        u[2*i3][2*i2+1][2*i1+1] = (MIXED_T)(u[2*i3][2*i2+1][2*i1+1]
+                                + 0.25 * (z1[i1] + z1[i1+1]));
+      }
+      for (i1 = 0; i1 < mm1-1; i1++) {
+        u[2*i3+1][2*i2][2*i1] = (MIXED_T)(u[2*i3+1][2*i2][2*i1]
+                              + 0.5 * z2[i1]);
+        u[2*i3+1][2*i2][2*i1+1] = (MIXED_T)(u[2*i3+1][2*i2][2*i1+1]
+                                + 0.25 * (z2[i1] + z2[i1+1]));
+      }
+      for (i1 = 0; i1 < mm1-1; i1++) {
+        u[2*i3+1][2*i2+1][2*i1] = (MIXED_T)(u[2*i3+1][2*i2+1][2*i1]
+                                + 0.25 * z3[i1]);
+        u[2*i3+1][2*i2+1][2*i1+1] = (MIXED_T)(u[2*i3+1][2*i2+1][2*i1+1]
+                                  + 0.125 * (z3[i1] + z3[i1+1]));
+      }
+    }
+  }
+  if (timeron && popcorn_team_tid() <= 0) timer_stop(T_interp);
+  popcorn_team_barrier();
+}
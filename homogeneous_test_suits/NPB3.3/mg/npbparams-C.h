@@ -0,0 +1,28 @@
+/* CLASS = C */
+/*
+   This file is generated automatically by the setparams utility.
+   It sets the number of processors and the class of the NPB
+   in this directory. Do not modify it by hand.   
+*/
+#define NX_DEFAULT     512
+#define NY_DEFAULT     512
+#define NZ_DEFAULT     512
+#define NIT_DEFAULT    20
+#define LM             9
+#define LT_DEFAULT     9
+#define DEBUG_DEFAULT  0
+#define NDIM1          9
+#define NDIM2          9
+#define NDIM3          9
+#define ONE            1
+
+#define CONVERTDOUBLE  false
+#define COMPILETIME "03 Nov 2017"
+#define NPBVERSION "3.3.1"
+#define CS1 "gcc"
+#define CS2 "$(CC)"
+#define CS3 "-lm"
+#define CS4 "-I../common"
+#define CS5 "-g -Wall -O3 -mcmodel=medium"
+#define CS6 "-O3 -mcmodel=medium"
+#define CS7 "randdp"
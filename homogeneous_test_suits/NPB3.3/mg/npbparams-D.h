@@ -0,0 +1,28 @@
+/* CLASS = D */
+/*
+   This file is generated automatically by the setparams utility.
+   It sets the number of processors and the class of the NPB
+   in this directory. Do not modify it by hand.   
+*/
+#define NX_DEFAULT     1024
+#define NY_DEFAULT     1024
+#define NZ_DEFAULT     1024
+#define NIT_DEFAULT    50
+#define LM             10
+#define LT_DEFAULT     10
+#define DEBUG_DEFAULT  0
+#define NDIM1          10
+#define NDIM2          10
+#define NDIM3          10
+#define ONE            1
+
+#define CONVERTDOUBLE  false
+#define COMPILETIME "03 Nov 2017"
+#define NPBVERSION "3.3.1"
+#define CS1 "gcc"
+#define CS2 "$(CC)"
+#define CS3 "-lm"
+#define CS4 "-I../common"
+#define CS5 "-g -Wall -O3 -mcmodel=medium"
+#define CS6 "-O3 -mcmodel=medium"
+#define CS7 "randdp"
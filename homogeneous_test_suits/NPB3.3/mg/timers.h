@@ -6,5 +6,13 @@ void timer_start( int n );
 void timer_stop( int n );
 double timer_read( int n );
 
+/* With NPB_COUNTERS=1 the timers also count, per thread, the events
+   below (perf_event_open), and record on which nodes they ran.       */
+#define TIMER_COUNTERS 5   /* cycles, instructions, LLC misses,
+                              dTLB misses, page faults              */
+int timer_counters( int n, long long c[TIMER_COUNTERS] );
+unsigned timer_nodes( int n );
+void timer_print_counters( void );
+
 #endif
 
@@ -1,18 +1,131 @@
 #!/bin/bash
+#
+# Link npbparams.h of every kernel to the parameters of a problem class.
+#
+# S, A, B, C and D are the NPB classes. DC has no class C or D and is left at
+# B for those. "custom" writes npbparams-custom.h in each kernel from the
+# environment, so that the footprint can be swept between (and past) the
+# classes; unset variables keep their class B value. The kernels report such
+# a build as class U, without verification.
+#
+#	NPB_BT_SIZE NPB_BT_NITER NPB_BT_DT	grid points per side, steps, dt
+#	NPB_SP_SIZE NPB_SP_NITER NPB_SP_DT	(same for SP)
+#	NPB_LU_SIZE NPB_LU_ITMAX NPB_LU_DT	(same for LU)
+#	NPB_CG_NA NPB_CG_NONZER NPB_CG_NITER NPB_CG_SHIFT
+#	NPB_EP_M				log2 of the pairs / 2
+#	NPB_FT_NX NPB_FT_NY NPB_FT_NZ NPB_FT_NITER	powers of 2
+#	NPB_IS_KEYS_LOG2 NPB_IS_MAX_KEY_LOG2 NPB_IS_BUCKETS_LOG2
+#	NPB_MG_SIZE NPB_MG_NIT			power of 2 points per side
+#	NPB_DC_TUPLES NPB_DC_ATTRS
+#
+# UA's mesh sizes follow from its refinement levels and stay at class B.
+#
+#	NPB_CG_NA=300000 ./setclass.sh custom
 
-if [ $# -ne 1 ]; then
-	echo "Usage: $0 {S | A | B}"
+usage() {
+	echo "Usage: $0 {S | A | B | C | D | custom}"
 	exit 1
+}
+
+if [ $# -ne 1 ]; then
+	usage
 fi
 
-if [[ $1 != "S" && $1 != "A" && $1 != "B" ]]; then
-	echo "Usage: $0 {S | A | B}"
-	exit 1
+case $1 in
+S|A|B|C|D|custom) ;;
+*) usage ;;
+esac
+
+# log2 of $1, or an error if it is not a power of 2
+log2() {
+	local n=$1 l=0
+
+	while [ $n -gt 1 ]; do
+		if [ $((n % 2)) -ne 0 ]; then
+			echo "$0: $2=$1 is not a power of 2" >&2
+			exit 1
+		fi
+		n=$((n / 2))
+		l=$((l + 1))
+	done
+	echo $l
+}
+
+# The class B file with the values given as NAME=VALUE substituted
+custom_params() {
+	local kernel=$1 sed_args=() kv
+	shift
+
+	for kv in "$@"; do
+		sed_args+=(-e "s/^\(#define ${kv%%=*}  *\)[^ ]*$/\1${kv#*=}/")
+	done
+	sed -e "s/CLASS = B/CLASS = custom/" \
+	    -e "s/generated automatically by the setparams utility/generated by setclass.sh custom/" \
+	    "${sed_args[@]}" $kernel/npbparams-B.h > $kernel/npbparams-custom.h
+}
+
+write_custom() {
+	local size nx ny nz maxdim lm
+
+	size=${NPB_BT_SIZE:-102}
+	custom_params bt PROBLEM_SIZE=$size NITER_DEFAULT=${NPB_BT_NITER:-200} \
+		DT_DEFAULT=${NPB_BT_DT:-0.0003}
+	size=${NPB_SP_SIZE:-102}
+	custom_params sp PROBLEM_SIZE=$size NITER_DEFAULT=${NPB_SP_NITER:-400} \
+		DT_DEFAULT=${NPB_SP_DT:-0.001}
+	size=${NPB_LU_SIZE:-102}
+	custom_params lu ISIZ1=$size ISIZ2=$size ISIZ3=$size \
+		ITMAX_DEFAULT=${NPB_LU_ITMAX:-250} INORM_DEFAULT=${NPB_LU_ITMAX:-250} \
+		DT_DEFAULT=${NPB_LU_DT:-2.0}
+
+	custom_params cg NA=${NPB_CG_NA:-75000} NONZER=${NPB_CG_NONZER:-13} \
+		NITER=${NPB_CG_NITER:-75} SHIFT=${NPB_CG_SHIFT:-60.0}
+
+	custom_params ep "CLASS='U'" M=${NPB_EP_M:-30}
+
+	nx=${NPB_FT_NX:-512}
+	ny=${NPB_FT_NY:-256}
+	nz=${NPB_FT_NZ:-256}
+	log2 $nx NPB_FT_NX > /dev/null || exit 1
+	log2 $ny NPB_FT_NY > /dev/null || exit 1
+	log2 $nz NPB_FT_NZ > /dev/null || exit 1
+	maxdim=$nx
+	[ $ny -gt $maxdim ] && maxdim=$ny
+	[ $nz -gt $maxdim ] && maxdim=$nz
+	custom_params ft NX=$nx NY=$ny NZ=$nz MAXDIM=$maxdim \
+		NITER_DEFAULT=${NPB_FT_NITER:-20} NXP=$((nx + 1)) NYP=$ny \
+		NTOTAL=$((nx * ny * nz)) NTOTALP=$(((nx + 1) * ny * nz))
+
+	# IS takes its sizes from npbparams.h for class U only
+	custom_params is
+	sed -i "s/^#define CLASS 'B'/#define CLASS 'U'\n#define TOTAL_KEYS_LOG_2   ${NPB_IS_KEYS_LOG2:-25}\n#define MAX_KEY_LOG_2      ${NPB_IS_MAX_KEY_LOG2:-21}\n#define NUM_BUCKETS_LOG_2  ${NPB_IS_BUCKETS_LOG2:-10}/" \
+		is/npbparams-custom.h
+
+	size=${NPB_MG_SIZE:-256}
+	lm=$(log2 $size NPB_MG_SIZE) || exit 1
+	custom_params mg NX_DEFAULT=$size NY_DEFAULT=$size NZ_DEFAULT=$size \
+		NIT_DEFAULT=${NPB_MG_NIT:-20} LM=$lm LT_DEFAULT=$lm \
+		NDIM1=$lm NDIM2=$lm NDIM3=$lm
+
+	sed -e "s/^#define CLASS 'B'/#define CLASS 'U'/" \
+	    -e "s/input_tuples=[0-9]*, attrnum=[0-9]*/input_tuples=${NPB_DC_TUPLES:-10000000}, attrnum=${NPB_DC_ATTRS:-20}/" \
+	    dc/npbparams-B.h > dc/npbparams-custom.h
+
+	cp ua/npbparams-B.h ua/npbparams-custom.h
+}
+
+if [ $1 = custom ]; then
+	write_custom
 fi
 
 for W in bt cg dc ep ft is lu mg sp ua; do
+	CLASS=$1
+	if [ $W = dc ] && [[ $CLASS = C || $CLASS = D ]]; then
+		echo "$0: dc has no class $CLASS, using B"
+		CLASS=B
+	fi
 	cd $W
 	rm -f npbparams.h
-	ln -s npbparams-$1.h npbparams.h
+	ln -s npbparams-$CLASS.h npbparams.h
 	cd ..
 done
@@ -1,9 +1,22 @@
 #include "wtime.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "popcorn_nodes.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 /*  Prototype  */
 void wtime( double * );
 
+/* Counters captured per timer with NPB_COUNTERS=1 (see timers.h) */
+#define TIMER_COUNTERS 5
+#define MAX_TIMERS     64
+
 
 /*****************************************************************/
 /******         E  L  A  P  S  E  D  _  T  I  M  E          ******/
@@ -17,14 +30,105 @@ static double elapsed_time( void )
 }
 
 
-static double start[64], elapsed[64];
+static double start[MAX_TIMERS], elapsed[MAX_TIMERS];
+
+static long long count_start[MAX_TIMERS][TIMER_COUNTERS];
+static long long counts[MAX_TIMERS][TIMER_COUNTERS];
+static unsigned  nodes[MAX_TIMERS];    /* a bit per node the timer ran on */
+
+static int counters_on = -1;
+static int counter_ok[TIMER_COUNTERS];
+static const char *counter_names[TIMER_COUNTERS] =
+    { "Cycles", "Instructions", "LLC misses", "dTLB misses", "Page faults" };
+
+/* The counters of the calling thread, opened at its first timer */
+static __thread int counter_fd[TIMER_COUNTERS];
+static __thread int counters_opened;
+
+
+/*****************************************************************/
+/******        C  O  U  N  T  E  R  S  _  O  P  E  N        ******/
+/*****************************************************************/
+static void counters_open( void )
+{
+#ifdef __linux__
+    static const struct { unsigned type; unsigned long long config; }
+        events[TIMER_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    };
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < TIMER_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counter_fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counter_fd[i] >= 0) counter_ok[i] = 1;
+    }
+#else
+    int i;
+
+    for (i = 0; i < TIMER_COUNTERS; i++) counter_fd[i] = -1;
+#endif
+    counters_opened = 1;
+}
+
+
+/*****************************************************************/
+/******        C  O  U  N  T  E  R  S  _  R  E  A  D        ******/
+/*****************************************************************/
+static void counters_read( long long c[TIMER_COUNTERS] )
+{
+    int i;
+
+    if (!counters_opened) counters_open();
+    for (i = 0; i < TIMER_COUNTERS; i++) {
+        c[i] = 0;
+#ifdef __linux__
+        if (counter_fd[i] >= 0 &&
+            read(counter_fd[i], &c[i], sizeof(c[i])) != sizeof(c[i]))
+            c[i] = 0;
+#endif
+    }
+}
+
+
+static int counters_enabled( void )
+{
+    const char *env;
+
+    if (counters_on < 0) {
+        env = getenv("NPB_COUNTERS");
+        counters_on = env != NULL && env[0] != '\0' && strcmp(env, "0") != 0;
+    }
+    return counters_on;
+}
+
 
 /*****************************************************************/
 /******            T  I  M  E  R  _  C  L  E  A  R          ******/
 /*****************************************************************/
 void timer_clear( int n )
 {
+    int i;
+
     elapsed[n] = 0.0;
+    if (counters_enabled()) {
+        for (i = 0; i < TIMER_COUNTERS; i++) counts[n][i] = 0;
+        nodes[n] = 0;
+    }
 }
 
 
@@ -33,6 +137,10 @@ void timer_clear( int n )
 /*****************************************************************/
 void timer_start( int n )
 {
+    if (counters_enabled()) {
+        nodes[n] |= 1u << popcorn_nodes_current();
+        counters_read(count_start[n]);
+    }
     start[n] = elapsed_time();
 }
 
@@ -43,11 +151,19 @@ void timer_start( int n )
 void timer_stop( int n )
 {
     double t, now;
+    long long c[TIMER_COUNTERS];
+    int i;
 
     now = elapsed_time();
     t = now - start[n];
     elapsed[n] += t;
 
+    if (counters_enabled()) {
+        counters_read(c);
+        for (i = 0; i < TIMER_COUNTERS; i++)
+            counts[n][i] += c[i] - count_start[n][i];
+        nodes[n] |= 1u << popcorn_nodes_current();
+    }
 }
 
 
@@ -59,3 +175,61 @@ double timer_read( int n )
     return( elapsed[n] );
 }
 
+
+/*****************************************************************/
+/******      T  I  M  E  R  _  C  O  U  N  T  E  R  S       ******/
+/*****************************************************************/
+/* Counters of timer n, -1 for those the system does not have.
+   Returns 0, and leaves c alone, without NPB_COUNTERS.          */
+int timer_counters( int n, long long c[TIMER_COUNTERS] )
+{
+    int i;
+
+    if (!counters_enabled()) return 0;
+    for (i = 0; i < TIMER_COUNTERS; i++)
+        c[i] = counter_ok[i] ? counts[n][i] : -1;
+    return 1;
+}
+
+
+/*****************************************************************/
+/******           T  I  M  E  R  _  N  O  D  E  S           ******/
+/*****************************************************************/
+/* Nodes timer n started or stopped on, a bit per node           */
+unsigned timer_nodes( int n )
+{
+    return( nodes[n] );
+}
+
+
+/*****************************************************************/
+/******       T I M E R _ P R I N T _ C O U N T E R S       ******/
+/*****************************************************************/
+/* The counters of every timer that ran, with NPB_COUNTERS       */
+void timer_print_counters( void )
+{
+    long long c[TIMER_COUNTERS];
+    char list[3*32+1];
+    int n, i, len;
+
+    if (!counters_enabled()) return;
+
+    printf( "\n Timer counters:\n" );
+    printf( "  Timer    Time (s)" );
+    for (i = 0; i < TIMER_COUNTERS; i++) printf( " %14s", counter_names[i] );
+    printf( "  Nodes\n" );
+    for (n = 0; n < MAX_TIMERS; n++) {
+        if (nodes[n] == 0) continue;
+        timer_counters(n, c);
+        printf( "  %5d %11.3f", n, elapsed[n] );
+        for (i = 0; i < TIMER_COUNTERS; i++) {
+            if (c[i] < 0) printf( " %14s", "-" );
+            else printf( " %14lld", c[i] );
+        }
+        for (len = 0, i = 0; i < 32; i++) {
+            if (nodes[n] & (1u << i))
+                len += sprintf(list + len, len ? ",%d" : "%d", i);
+        }
+        printf( "  %s\n", list );
+    }
+}
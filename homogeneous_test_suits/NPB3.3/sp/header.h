@@ -139,6 +139,14 @@ void y_solve();
 void pinvr();
 void z_solve();
 void tzetar();
+
+//-----------------------------------------------------------------------
+// Batched line solves (solve_batch.c)
+//-----------------------------------------------------------------------
+#define SOLVE_LANES 4
+extern logical solve_batched;
+void batch_init();
+void batch_lines(int dir, int k, int j, int i, int n);
 void add();
 void txinvr();
 void error_norm(double rms[5]);
@@ -0,0 +1,397 @@
+//-------------------------------------------------------------------------//
+//                                                                         //
+//  This benchmark is a serial C version of the NPB SP code. This C        //
+//  version is developed by the Center for Manycore Programming at Seoul   //
+//  National University and derived from the serial Fortran versions in    //
+//  "NPB3.3-SER" developed by NAS.                                         //
+//                                                                         //
+//  Permission to use, copy, distribute and modify this software for any   //
+//  purpose with or without fee is hereby granted. This software is        //
+//  provided "as is" without express or implied warranty.                  //
+//                                                                         //
+//  Information on NPB 3.3, including the technical report, the original   //
+//  specifications, source code, results and information on how to submit  //
+//  new results, is available at:                                          //
+//                                                                         //
+//           http://www.nas.nasa.gov/Software/NPB/                         //
+//                                                                         //
+//  Send comments or suggestions for this C version to cmp@aces.snu.ac.kr  //
+//                                                                         //
+//          Center for Manycore Programming                                //
+//          School of Computer Science and Engineering                     //
+//          Seoul National University                                      //
+//          Seoul 151-744, Korea                                           //
+//                                                                         //
+//          E-mail:  cmp@aces.snu.ac.kr                                    //
+//                                                                         //
+//-------------------------------------------------------------------------//
+
+//-------------------------------------------------------------------------//
+// Authors: Sangmin Seo, Jungwon Kim, Jun Lee, Jeongho Nah, Gangwon Jo,    //
+//          and Jaejin Lee                                                 //
+//-------------------------------------------------------------------------//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+//---------------------------------------------------------------------
+// Batched line solves. In batched mode, x_solve(), y_solve() and
+// z_solve() hand SOLVE_LANES lines at a time to batch_lines(), which
+// forms their three pentadiagonal systems and runs the Thomas algorithm
+// with one line per SIMD lane. Each lane goes through the operations of
+// the line by line code in their order, so the results are the same.
+//
+// The working copies are SoA: element [i][m] of the lhs of all the
+// lines of a batch is one vector. The vectors are GCC vector types, so
+// the same code is SSE2 or NEON at any optimization level, and AVX in
+// batch_lines_avx() when the node has it. That is checked for every
+// batch: the thread can land on a node without AVX.
+//---------------------------------------------------------------------
+
+typedef double lanes_t __attribute__((vector_size(SOLVE_LANES*sizeof(double))));
+typedef long lanes_mask_t __attribute__((vector_size(SOLVE_LANES*sizeof(long))));
+
+#define LANES(x)         ((lanes_t){} + (x))
+#define BATCH_INLINE     static inline __attribute__((always_inline))
+
+// max() of type.h, lane by lane
+#define LANES_MAX(x, y) ({                                          \
+  lanes_t x_ = (x), y_ = (y);                                       \
+  lanes_mask_t gt_ = x_ > y_;                                       \
+  (lanes_t)(((lanes_mask_t)x_ & gt_) | ((lanes_mask_t)y_ & ~gt_));  \
+})
+
+// Offset of grid point (k, j, i) in the flattened [KMAX][JMAXP+1][IMAXP+1]
+// arrays
+#define BATCH_POINT(k, j, i) \
+  (((long)(k) * (JMAXP+1) + (j)) * (IMAXP+1) + (i))
+
+/* common /work_batch/ */
+static lanes_t blhs [PROBLEM_SIZE][5];
+static lanes_t blhsp[PROBLEM_SIZE][5];
+static lanes_t blhsm[PROBLEM_SIZE][5];
+static lanes_t brhs [PROBLEM_SIZE][5];
+static lanes_t cvb  [PROBLEM_SIZE];
+static lanes_t rhob [PROBLEM_SIZE];
+static lanes_t speedb[PROBLEM_SIZE];
+
+logical solve_batched = true;
+
+
+//---------------------------------------------------------------------
+// Batched line solves unless SP_SOLVE=line
+//---------------------------------------------------------------------
+void batch_init()
+{
+  const char *env = getenv("SP_SOLVE");
+
+  solve_batched = env == NULL || strcmp(env, "line") != 0;
+  if (solve_batched) {
+    printf(" Line solves: batched, %d lanes\n", SOLVE_LANES);
+  } else {
+    printf(" Line solves: one line at a time\n");
+  }
+}
+
+
+//---------------------------------------------------------------------
+// the n lines of direction dir starting at point p0, lstride points
+// apart, with pstride points between the points of a line and size+1
+// points per line; lanes past n repeat the last line
+//---------------------------------------------------------------------
+BATCH_INLINE void lines_solve(int dir, long p0, long lstride, long pstride,
+                              int n, int size)
+{
+  int i, i1, i2, l, m;
+  long p;
+  double dtt1, dtt2, c2dtt1, d1, d2, dmax, d0;
+  double *cv_in;
+  lanes_t ru1, rhon, fac1, rhonm, rhonp;
+
+  switch (dir) {
+  case 0:
+    cv_in = &us[0][0][0];
+    dtt1 = dttx1; dtt2 = dttx2; c2dtt1 = c2dttx1;
+    d1 = dx2; d2 = dx5; dmax = dxmax; d0 = dx1;
+    break;
+  case 1:
+    cv_in = &vs[0][0][0];
+    dtt1 = dtty1; dtt2 = dtty2; c2dtt1 = c2dtty1;
+    d1 = dy3; d2 = dy5; dmax = dymax; d0 = dy1;
+    break;
+  default:
+    cv_in = &ws[0][0][0];
+    dtt1 = dttz1; dtt2 = dttz2; c2dtt1 = c2dttz1;
+    d1 = dz4; d2 = dz5; dmax = dzmax; d0 = dz1;
+    break;
+  }
+
+  for (i = 0; i <= size; i++) {
+    for (l = 0; l < SOLVE_LANES; l++) {
+      p = p0 + (l < n ? l : n-1) * lstride + i * pstride;
+      cvb[i][l] = cv_in[p];
+      rhob[i][l] = (&rho_i[0][0][0])[p];
+      speedb[i][l] = (&speed[0][0][0])[p];
+      for (m = 0; m < 5; m++) {
+        brhs[i][m][l] = (&rhs[0][0][0][0])[p*5+m];
+      }
+    }
+  }
+
+  //---------------------------------------------------------------------
+  // lhsinit()
+  //---------------------------------------------------------------------
+  for (i = 0; i <= size; i += size) {
+    for (m = 0; m < 5; m++) {
+      blhs [i][m] = LANES(0.0);
+      blhsp[i][m] = LANES(0.0);
+      blhsm[i][m] = LANES(0.0);
+    }
+    blhs [i][2] = LANES(1.0);
+    blhsp[i][2] = LANES(1.0);
+    blhsm[i][2] = LANES(1.0);
+  }
+
+  //---------------------------------------------------------------------
+  // first fill the lhs for the u-eigenvalue
+  //---------------------------------------------------------------------
+  for (i = 0; i <= size; i++) {
+    ru1 = c3c4*rhob[i];
+    rhob[i] = LANES_MAX(LANES_MAX(d1+con43*ru1, d2+c1c5*ru1),
+                        LANES_MAX(dmax+ru1, LANES(d0)));
+  }
+
+  for (i = 1; i <= size-1; i++) {
+    rhonm = rhob[i-1];
+    rhon  = rhob[i];
+    rhonp = rhob[i+1];
+    blhs[i][0] = LANES(0.0);
+    blhs[i][1] = -dtt2 * cvb[i-1] - dtt1 * rhonm;
+    blhs[i][2] =  1.0 + c2dtt1 * rhon;
+    blhs[i][3] =  dtt2 * cvb[i+1] - dtt1 * rhonp;
+    blhs[i][4] = LANES(0.0);
+  }
+
+  //---------------------------------------------------------------------
+  // add fourth order dissipation
+  //---------------------------------------------------------------------
+  i = 1;
+  blhs[i][2] = blhs[i][2] + comz5;
+  blhs[i][3] = blhs[i][3] - comz4;
+  blhs[i][4] = blhs[i][4] + comz1;
+
+  blhs[i+1][1] = blhs[i+1][1] - comz4;
+  blhs[i+1][2] = blhs[i+1][2] + comz6;
+  blhs[i+1][3] = blhs[i+1][3] - comz4;
+  blhs[i+1][4] = blhs[i+1][4] + comz1;
+
+  for (i = 3; i <= size-3; i++) {
+    blhs[i][0] = blhs[i][0] + comz1;
+    blhs[i][1] = blhs[i][1] - comz4;
+    blhs[i][2] = blhs[i][2] + comz6;
+    blhs[i][3] = blhs[i][3] - comz4;
+    blhs[i][4] = blhs[i][4] + comz1;
+  }
+
+  i = size-2;
+  blhs[i][0] = blhs[i][0] + comz1;
+  blhs[i][1] = blhs[i][1] - comz4;
+  blhs[i][2] = blhs[i][2] + comz6;
+  blhs[i][3] = blhs[i][3] - comz4;
+
+  blhs[i+1][0] = blhs[i+1][0] + comz1;
+  blhs[i+1][1] = blhs[i+1][1] - comz4;
+  blhs[i+1][2] = blhs[i+1][2] + comz5;
+
+  //---------------------------------------------------------------------
+  // subsequently, fill the other factors (u+c), (u-c) by adding to
+  // the first
+  //---------------------------------------------------------------------
+  for (i = 1; i <= size-1; i++) {
+    blhsp[i][0] = blhs[i][0];
+    blhsp[i][1] = blhs[i][1] - dtt2 * speedb[i-1];
+    blhsp[i][2] = blhs[i][2];
+    blhsp[i][3] = blhs[i][3] + dtt2 * speedb[i+1];
+    blhsp[i][4] = blhs[i][4];
+    blhsm[i][0] = blhs[i][0];
+    blhsm[i][1] = blhs[i][1] + dtt2 * speedb[i-1];
+    blhsm[i][2] = blhs[i][2];
+    blhsm[i][3] = blhs[i][3] - dtt2 * speedb[i+1];
+    blhsm[i][4] = blhs[i][4];
+  }
+
+  //---------------------------------------------------------------------
+  // FORWARD ELIMINATION
+  //---------------------------------------------------------------------
+  for (i = 0; i <= size-2; i++) {
+    i1 = i + 1;
+    i2 = i + 2;
+    fac1 = 1.0/blhs[i][2];
+    blhs[i][3] = fac1*blhs[i][3];
+    blhs[i][4] = fac1*blhs[i][4];
+    for (m = 0; m < 3; m++) {
+      brhs[i][m] = fac1*brhs[i][m];
+    }
+    blhs[i1][2] = blhs[i1][2] - blhs[i1][1]*blhs[i][3];
+    blhs[i1][3] = blhs[i1][3] - blhs[i1][1]*blhs[i][4];
+    for (m = 0; m < 3; m++) {
+      brhs[i1][m] = brhs[i1][m] - blhs[i1][1]*brhs[i][m];
+    }
+    blhs[i2][1] = blhs[i2][1] - blhs[i2][0]*blhs[i][3];
+    blhs[i2][2] = blhs[i2][2] - blhs[i2][0]*blhs[i][4];
+    for (m = 0; m < 3; m++) {
+      brhs[i2][m] = brhs[i2][m] - blhs[i2][0]*brhs[i][m];
+    }
+  }
+
+  i  = size-1;
+  i1 = size;
+  fac1 = 1.0/blhs[i][2];
+  blhs[i][3] = fac1*blhs[i][3];
+  blhs[i][4] = fac1*blhs[i][4];
+  for (m = 0; m < 3; m++) {
+    brhs[i][m] = fac1*brhs[i][m];
+  }
+  blhs[i1][2] = blhs[i1][2] - blhs[i1][1]*blhs[i][3];
+  blhs[i1][3] = blhs[i1][3] - blhs[i1][1]*blhs[i][4];
+  for (m = 0; m < 3; m++) {
+    brhs[i1][m] = brhs[i1][m] - blhs[i1][1]*brhs[i][m];
+  }
+  fac1 = 1.0/blhs[i1][2];
+  for (m = 0; m < 3; m++) {
+    brhs[i1][m] = fac1*brhs[i1][m];
+  }
+
+  //---------------------------------------------------------------------
+  // for the u+c and the u-c factors
+  //---------------------------------------------------------------------
+  for (i = 0; i <= size-2; i++) {
+    i1 = i + 1;
+    i2 = i + 2;
+
+    m = 3;
+    fac1 = 1.0/blhsp[i][2];
+    blhsp[i][3]  = fac1*blhsp[i][3];
+    blhsp[i][4]  = fac1*blhsp[i][4];
+    brhs[i][m]   = fac1*brhs[i][m];
+    blhsp[i1][2] = blhsp[i1][2] - blhsp[i1][1]*blhsp[i][3];
+    blhsp[i1][3] = blhsp[i1][3] - blhsp[i1][1]*blhsp[i][4];
+    brhs[i1][m]  = brhs[i1][m] - blhsp[i1][1]*brhs[i][m];
+    blhsp[i2][1] = blhsp[i2][1] - blhsp[i2][0]*blhsp[i][3];
+    blhsp[i2][2] = blhsp[i2][2] - blhsp[i2][0]*blhsp[i][4];
+    brhs[i2][m]  = brhs[i2][m] - blhsp[i2][0]*brhs[i][m];
+
+    m = 4;
+    fac1 = 1.0/blhsm[i][2];
+    blhsm[i][3]  = fac1*blhsm[i][3];
+    blhsm[i][4]  = fac1*blhsm[i][4];
+    brhs[i][m]   = fac1*brhs[i][m];
+    blhsm[i1][2] = blhsm[i1][2] - blhsm[i1][1]*blhsm[i][3];
+    blhsm[i1][3] = blhsm[i1][3] - blhsm[i1][1]*blhsm[i][4];
+    brhs[i1][m]  = brhs[i1][m] - blhsm[i1][1]*brhs[i][m];
+    blhsm[i2][1] = blhsm[i2][1] - blhsm[i2][0]*blhsm[i][3];
+    blhsm[i2][2] = blhsm[i2][2] - blhsm[i2][0]*blhsm[i][4];
+    brhs[i2][m]  = brhs[i2][m] - blhsm[i2][0]*brhs[i][m];
+  }
+
+  i  = size-1;
+  i1 = size;
+
+  m = 3;
+  fac1 = 1.0/blhsp[i][2];
+  blhsp[i][3]  = fac1*blhsp[i][3];
+  blhsp[i][4]  = fac1*blhsp[i][4];
+  brhs[i][m]   = fac1*brhs[i][m];
+  blhsp[i1][2] = blhsp[i1][2] - blhsp[i1][1]*blhsp[i][3];
+  blhsp[i1][3] = blhsp[i1][3] - blhsp[i1][1]*blhsp[i][4];
+  brhs[i1][m]  = brhs[i1][m] - blhsp[i1][1]*brhs[i][m];
+
+  m = 4;
+  fac1 = 1.0/blhsm[i][2];
+  blhsm[i][3]  = fac1*blhsm[i][3];
+  blhsm[i][4]  = fac1*blhsm[i][4];
+  brhs[i][m]   = fac1*brhs[i][m];
+  blhsm[i1][2] = blhsm[i1][2] - blhsm[i1][1]*blhsm[i][3];
+  blhsm[i1][3] = blhsm[i1][3] - blhsm[i1][1]*blhsm[i][4];
+  brhs[i1][m]  = brhs[i1][m] - blhsm[i1][1]*brhs[i][m];
+
+  brhs[i1][3] = brhs[i1][3]/blhsp[i1][2];
+  brhs[i1][4] = brhs[i1][4]/blhsm[i1][2];
+
+  //---------------------------------------------------------------------
+  // BACKSUBSTITUTION
+  //---------------------------------------------------------------------
+  i  = size-1;
+  i1 = size;
+  for (m = 0; m < 3; m++) {
+    brhs[i][m] = brhs[i][m] - blhs[i][3]*brhs[i1][m];
+  }
+  brhs[i][3] = brhs[i][3] - blhsp[i][3]*brhs[i1][3];
+  brhs[i][4] = brhs[i][4] - blhsm[i][3]*brhs[i1][4];
+
+  for (i = size-2; i >= 0; i--) {
+    i1 = i + 1;
+    i2 = i + 2;
+    for (m = 0; m < 3; m++) {
+      brhs[i][m] = brhs[i][m] -
+                   blhs[i][3]*brhs[i1][m] -
+                   blhs[i][4]*brhs[i2][m];
+    }
+    brhs[i][3] = brhs[i][3] -
+                 blhsp[i][3]*brhs[i1][3] -
+                 blhsp[i][4]*brhs[i2][3];
+    brhs[i][4] = brhs[i][4] -
+                 blhsm[i][3]*brhs[i1][4] -
+                 blhsm[i][4]*brhs[i2][4];
+  }
+
+  for (i = 0; i <= size; i++) {
+    for (l = 0; l < n; l++) {
+      p = p0 + l * lstride + i * pstride;
+      for (m = 0; m < 5; m++) {
+        (&rhs[0][0][0][0])[p*5+m] = brhs[i][m][l];
+      }
+    }
+  }
+}
+
+
+#if defined(__x86_64__)
+__attribute__((target("avx")))
+static void lines_solve_avx(int dir, long p0, long lstride, long pstride,
+                            int n, int size)
+{
+  lines_solve(dir, p0, lstride, pstride, n, size);
+}
+#endif
+
+
+//---------------------------------------------------------------------
+// Solve the n <= SOLVE_LANES lines of direction dir (0 for x, 1 for y,
+// 2 for z) that start at grid point (k, j, i): x-lines follow each
+// other in j, y- and z-lines in i
+//---------------------------------------------------------------------
+void batch_lines(int dir, int k, int j, int i, int n)
+{
+  long p0 = BATCH_POINT(k, j, i);
+  long lstride = dir == 0 ? IMAXP+1 : 1;
+  long pstride;
+  int size = grid_points[dir]-1;
+
+  switch (dir) {
+  case 0:  pstride = 1; break;
+  case 1:  pstride = IMAXP+1; break;
+  default: pstride = (long)(JMAXP+1)*(IMAXP+1); break;
+  }
+
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx")) {
+    lines_solve_avx(dir, p0, lstride, pstride, n, size);
+    return;
+  }
+#endif
+  lines_solve(dir, p0, lstride, pstride, n, size);
+}
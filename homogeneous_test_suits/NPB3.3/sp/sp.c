@@ -38,6 +38,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "migrate.h"
+
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_nodes.h"
+#include "popcorn_grain.h"
+
+// Region ID for popcorn_profile.h
+#define SP_REGION_ADI 1
 #include "header.h"
 #include "print_results.h"
 
@@ -93,6 +100,7 @@ int main(int argc, char *argv[])
 {
   int i, niter, step, n3;
   double mflops, t, tmax, trecs[t_last+1];
+  struct popcorn_grain grain;
   logical verified;
   char Class;
   char *t_names[t_last+1];
@@ -147,6 +155,9 @@ int main(int argc, char *argv[])
   printf(" Size: %4dx%4dx%4d\n", 
       grid_points[0], grid_points[1], grid_points[2]);
   printf(" Iterations: %4d    dt: %10.6f\n", niter, dt);
+  batch_init();
+  popcorn_grain_init(&grain, 1, niter, POPCORN_GRAIN_RUN);
+  popcorn_grain_print(&grain);
   printf("\n");
 
   if ((grid_points[0] > IMAX) ||
@@ -181,15 +192,17 @@ int main(int argc, char *argv[])
   }
   timer_start(1);
 
-  migrate(1, NULL, NULL);
   for (step = 1; step <= niter; step++) {
     if ((step % 20) == 0 || step == 1) {
       printf(" Time step %4d\n", step);
     }
 
+    if (popcorn_grain_leave(&grain, step))
+      popcorn_migrate_best(SP_REGION_ADI);
     adi();
+    if (popcorn_grain_return(&grain, step))
+      popcorn_migrate_home(SP_REGION_ADI);
   }
-  migrate(0, NULL, NULL);
 
   timer_stop(1);
   tmax = timer_read(1);
@@ -41,10 +41,28 @@
 //---------------------------------------------------------------------
 void x_solve()
 {
-  int i, j, k, i1, i2, m;
+  int i, j, k, i1, i2, m, n;
   double ru1, fac1, fac2;
 
   if (timeron) timer_start(t_xsolve);
+
+  //---------------------------------------------------------------------
+  // batched mode: SOLVE_LANES lines at a time (see solve_batch.c)
+  //---------------------------------------------------------------------
+  if (solve_batched) {
+    for (k = 1; k <= nz2; k++) {
+      for (j = 1; j <= ny2; j += SOLVE_LANES) {
+        n = ny2 - j + 1;
+        if (n > SOLVE_LANES) n = SOLVE_LANES;
+        batch_lines(0, k, j, 0, n);
+      }
+    }
+    if (timeron) timer_stop(t_xsolve);
+
+    ninvr();
+    return;
+  }
+
   for (k = 1; k <= nz2; k++) {
     lhsinit(nx2+1, ny2);
 
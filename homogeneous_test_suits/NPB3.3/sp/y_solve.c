@@ -41,10 +41,28 @@
 //---------------------------------------------------------------------
 void y_solve()
 {
-  int i, j, k, j1, j2, m;
+  int i, j, k, j1, j2, m, n;
   double ru1, fac1, fac2;
 
   if (timeron) timer_start(t_ysolve);
+
+  //---------------------------------------------------------------------
+  // batched mode: SOLVE_LANES lines at a time (see solve_batch.c)
+  //---------------------------------------------------------------------
+  if (solve_batched) {
+    for (k = 1; k <= grid_points[2]-2; k++) {
+      for (i = 1; i <= grid_points[0]-2; i += SOLVE_LANES) {
+        n = grid_points[0]-2 - i + 1;
+        if (n > SOLVE_LANES) n = SOLVE_LANES;
+        batch_lines(1, k, 0, i, n);
+      }
+    }
+    if (timeron) timer_stop(t_ysolve);
+
+    pinvr();
+    return;
+  }
+
   for (k = 1; k <= grid_points[2]-2; k++) {
     lhsinitj(ny2+1, nx2);
 
@@ -41,10 +41,28 @@
 //---------------------------------------------------------------------
 void z_solve()
 {
-  int i, j, k, k1, k2, m;
+  int i, j, k, k1, k2, m, n;
   double ru1, fac1, fac2;
 
   if (timeron) timer_start(t_zsolve);
+
+  //---------------------------------------------------------------------
+  // batched mode: SOLVE_LANES lines at a time (see solve_batch.c)
+  //---------------------------------------------------------------------
+  if (solve_batched) {
+    for (j = 1; j <= ny2; j++) {
+      for (i = 1; i <= nx2; i += SOLVE_LANES) {
+        n = nx2 - i + 1;
+        if (n > SOLVE_LANES) n = SOLVE_LANES;
+        batch_lines(2, 0, j, i, n);
+      }
+    }
+    if (timeron) timer_stop(t_zsolve);
+
+    tzetar();
+    return;
+  }
+
   for (j = 1; j <= ny2; j++) {
     lhsinitj(nz2+1, nx2);
 
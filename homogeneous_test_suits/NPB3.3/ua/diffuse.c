@@ -31,28 +31,28 @@
 //          and Jaejin Lee                                                 //
 //-------------------------------------------------------------------------//
 
+#include <stddef.h>
 #include "header.h"
 #include "timers.h"
 
 //---------------------------------------------------------------------
-// advance the diffusion term using CG iterations
+// CG iterations of diffusion() on thread tid of the team: the thread
+// works on its block of elements and of mortar points, transfb() sums
+// into the mortar points one color of elements at a time.
 //---------------------------------------------------------------------
-void diffusion(logical ifmortar)
+static void diffusion_cg(int tid, void *arg)
 {
   double rho_aux, rho1, rho2, beta, cona;
   int iter, ie, im, iside, i, j, k;
+  int lo, hi, mlo, mhi;
 
-  if (timeron) timer_start(t_diffusion);
-  // set up diagonal preconditioner
-  if (ifmortar) {
-    setuppc();
-    setpcmo();
-  }
+  team_split(0, nelt, &lo, &hi);
+  team_split(0, nmor, &mlo, &mhi);
 
   // arrays t and umor are accumlators of (am pm) in the CG algorithm
   // (see the specification)
-  r_init((double *)t, ntot, 0.0);
-  r_init((double *)umor, nmor, 0.0);
+  r_init((double *)t[lo], (hi-lo)*NXYZ, 0.0);
+  r_init(&umor[mlo], mhi-mlo, 0.0);
 
   // calculate initial am (see specification) in CG algorithm
 
@@ -60,7 +60,7 @@ void diffusion(logical ifmortar)
   // pdiff and pmorx are combined to generate q0 in the CG algorithm.
   // rho1 is  (qm,rm) in the CG algorithm.
   rho1 = 0.0;
-  for (ie = 0; ie < nelt; ie++) {
+  for (ie = lo; ie < hi; ie++) {
     for (k = 0; k < LX1; k++) {
       for (j = 0; j < LX1; j++) {
         for (i = 0; i < LX1; i++) {
@@ -72,10 +72,11 @@ void diffusion(logical ifmortar)
     }
   }
 
-  for (im = 0; im < nmor; im++) {
+  for (im = mlo; im < mhi; im++) {
     pmorx[im] = dpcmor[im]*rmor[im];
     rho1      = rho1 + rmor[im]*pmorx[im];
   }
+  rho1 = popcorn_team_sum(rho1);
 
   //.................................................................
   // commence conjugate gradient iteration
@@ -85,7 +86,7 @@ void diffusion(logical ifmortar)
       rho_aux = 0.0;
       // pdiffp and ppmor are combined to generate q_m+1 in the specification
       // rho_aux is (q_m+1,r_m+1)
-      for (ie = 0; ie < nelt; ie++) {
+      for (ie = lo; ie < hi; ie++) {
         for (k = 0; k < LX1; k++) {
           for (j = 0; j < LX1; j++) {
             for (i = 0; i < LX1; i++) {
@@ -97,10 +98,11 @@ void diffusion(logical ifmortar)
         }
       }
 
-      for (im = 0; im < nmor; im++) {
+      for (im = mlo; im < mhi; im++) {
         ppmor[im] = dpcmor[im]*rmor[im];
         rho_aux = rho_aux + rmor[im]*ppmor[im];
       }
+      rho_aux = popcorn_team_sum(rho_aux);
 
       // compute bm (beta) in the specification
       rho2 = rho1;
@@ -108,28 +110,28 @@ void diffusion(logical ifmortar)
       beta = rho1/rho2;
 
       // update p_m+1 in the specification
-      adds1m1((double *)pdiff, (double *)pdiffp, beta, ntot);
-      adds1m1(pmorx, ppmor, beta, nmor);  
+      adds1m1((double *)pdiff[lo], (double *)pdiffp[lo], beta, (hi-lo)*NXYZ);
+      adds1m1(&pmorx[mlo], &ppmor[mlo], beta, mhi-mlo);  
     }
 
     // compute matrix vector product: (theta pm) in the specification
-    if (timeron) timer_start(t_transf);
+    if (timeron && tid == 0) timer_start(t_transf);
     transf(pmorx, (double *)pdiff);
-    if (timeron) timer_stop(t_transf);
+    if (timeron && tid == 0) timer_stop(t_transf);
 
     // compute pdiffp which is (A theta pm) in the specification
-    for (ie = 0; ie < nelt; ie++) {
+    for (ie = lo; ie < hi; ie++) {
       laplacian(pdiffp[ie], pdiff[ie], size_e[ie]);
     }
 
     // compute ppmor which will be used to compute (thetaT A theta pm) 
     // in the specification
-    if (timeron) timer_start(t_transfb);
+    if (timeron && tid == 0) timer_start(t_transfb);
     transfb(ppmor, (double *)pdiffp);
-    if (timeron) timer_stop(t_transfb);
+    if (timeron && tid == 0) timer_stop(t_transfb);
 
     // apply boundary condition
-    for (ie = 0; ie < nelt; ie++) {
+    for (ie = lo; ie < hi; ie++) {
       for (iside = 0; iside < NSIDES; iside++) {
         if(cbc[ie][iside] == 0) {
           facev(pdiffp[ie], iside, 0.0);
@@ -139,7 +141,7 @@ void diffusion(logical ifmortar)
 
     // compute cona which is (pm,theta T A theta pm)
     cona = 0.0;
-    for (ie = 0; ie < nelt; ie++) {
+    for (ie = lo; ie < hi; ie++) {
       for (k = 0; k < LX1; k++) {
         for (j = 0; j < LX1; j++) {
           for (i = 0; i < LX1; i++) {
@@ -150,26 +152,43 @@ void diffusion(logical ifmortar)
       }
     }
 
-    for (im = 0; im < nmor; im++) {
+    for (im = mlo; im < mhi; im++) {
       ppmor[im] = ppmor[im]*tmmor[im];
       cona = cona + pmorx[im]*ppmor[im];
     }
+    cona = popcorn_team_sum(cona);
 
     // compute am
     cona = rho1/cona;
 
     // compute (am pm)
-    adds2m1((double *)t, (double *)pdiff, cona, ntot);
-    adds2m1(umor, pmorx, cona, nmor);
+    adds2m1((double *)t[lo], (double *)pdiff[lo], cona, (hi-lo)*NXYZ);
+    adds2m1(&umor[mlo], &pmorx[mlo], cona, mhi-mlo);
 
     // compute r_m+1
-    adds2m1((double *)trhs, (double *)pdiffp, -cona, ntot);
-    adds2m1(rmor, ppmor,  -cona, nmor);
+    adds2m1((double *)trhs[lo], (double *)pdiffp[lo], -cona, (hi-lo)*NXYZ);
+    adds2m1(&rmor[mlo], &ppmor[mlo],  -cona, mhi-mlo);
   }
 
-  if (timeron) timer_start(t_transf);
+  if (timeron && tid == 0) timer_start(t_transf);
   transf(umor, (double *)t);
-  if (timeron) timer_stop(t_transf);
+  if (timeron && tid == 0) timer_stop(t_transf);
+}
+
+
+//---------------------------------------------------------------------
+// advance the diffusion term using CG iterations
+//---------------------------------------------------------------------
+void diffusion(logical ifmortar)
+{
+  if (timeron) timer_start(t_diffusion);
+  // set up diagonal preconditioner
+  if (ifmortar) {
+    setuppc();
+    setpcmo();
+  }
+
+  popcorn_team_run(diffusion_cg, NULL);
   if (timeron) timer_stop(t_diffusion);
 }
 
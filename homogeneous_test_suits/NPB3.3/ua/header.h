@@ -238,6 +238,16 @@ extern int face_l1[3];
 extern int face_l2[3];
 extern int face_ld[3];
 
+// colors of the elements for transfb(): color c is the list of elements
+// color_elt[color_ptr[c]] ... color_elt[color_ptr[c+1]-1], which share
+// no mortar point, in ascending order. ncolor is 0 if MAX_COLORS do not
+// suffice.
+#define MAX_COLORS 64
+/* common /colors/ */
+extern int ncolor;
+extern int color_ptr[MAX_COLORS+1];
+extern int color_elt[LELT];
+
 // Timer parameters
 /* common /timing/ */
 extern logical timeron;
@@ -292,6 +302,8 @@ void transfb_nc2(double tmor[LX1][LX1], double tx[LX1][LX1]);
 void transfb_nc1(double tmor[LX1][LX1], double tx[LX1][LX1]);
 void transfb_c(double tx[]);
 void transfb_c_2(double tx[]);
+void color_elements();
+int color_first(int c, int ie);
 void verify(char *Class, logical *verified);
 void create_initial_grid();
 void coef();
@@ -300,3 +312,14 @@ void setdef();
 void prepwork();
 void top_constants();
 
+// The thread team of popcorn_team.h, whose <pthread.h> cannot be
+// included next to the 'time' global (see popcorn_rt.c).
+int popcorn_team_init(int region);
+void popcorn_team_fini(void);
+int popcorn_team_size(void);
+int popcorn_team_tid(void);
+void popcorn_team_run(void (*fn)(int tid, void *arg), void *arg);
+void popcorn_team_barrier(void);
+double popcorn_team_sum(double v);
+void team_split(int first, int end, int *lo, int *hi);
+
@@ -1500,6 +1500,9 @@ void mortar()
       }
     }
   }
+
+  // color the elements by the mortar points they share for transfb
+  color_elements();
 }
 
        
@@ -0,0 +1,15 @@
+//---------------------------------------------------------------------
+// Implementation of the Popcorn runtime headers. It needs <time.h>,
+// whose time() clashes with the 'time' global of UA, so it is kept
+// out of ua.c.
+//---------------------------------------------------------------------
+
+#define POPCORN_RT_IMPLEMENTATION
+#include "popcorn_nodes.h"
+#include "popcorn_team.h"
+
+// popcorn_team_split(), which is inline, for the files of UA
+void team_split(int first, int end, int *lo, int *hi)
+{
+  popcorn_team_split(first, end, lo, hi);
+}
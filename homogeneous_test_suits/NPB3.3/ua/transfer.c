@@ -33,215 +33,281 @@
 
 #include "header.h"
 
+// colors of the mortar points, a bit per color of element adding to it
+static unsigned long long mor_colors[LMOR];
+
+
 //------------------------------------------------------------------
-// Map values from mortar(tmor) to element(tx)
+// Color the elements so that no two elements of a color add to the
+// same mortar point in transfb(). Each element in turn takes the first
+// color that none of the elements before it sharing one of its mortar
+// points has. A team of one sums the elements in order, uncolored.
 //------------------------------------------------------------------
-void transf(double tmor[], double tx[])
+void color_elements()
 {
-  double tmp[2][LX1][LX1];
-  int ig1, ig2, ig3, ig4, ie, iface, il1, il2, il3, il4;
-  int nnje, ije1, ije2, col, i, j, ig, il;
+  unsigned long long used;
+  int count[MAX_COLORS];
+  int color[LELT];
+  int ie, n, ig, c;
+  int *ids;
 
-  // zero out tx on element boundaries
-  col2(tx, (double *)tmult, ntot);
+  ncolor = 0;
+  if (popcorn_team_size() == 1) return;
+
+  for (ig = 0; ig < nmor; ig++) mor_colors[ig] = 0;
+  for (c = 0; c < MAX_COLORS; c++) count[c] = 0;
 
   for (ie = 0; ie < nelt; ie++) {
-    for (iface = 0; iface < NSIDES; iface++) {
-      // get the collocation point index of the four local corners on the
-      // face iface of element ie
-      il1 = idel[ie][iface][0][0];
-      il2 = idel[ie][iface][0][LX1-1];
-      il3 = idel[ie][iface][LX1-1][0];
-      il4 = idel[ie][iface][LX1-1][LX1-1];
-
-      // get the mortar indices of the four local corners
-      ig1 = idmo[ie][iface][0][0][0][0];
-      ig2 = idmo[ie][iface][1][0][0][LX1-1];
-      ig3 = idmo[ie][iface][0][1][LX1-1][0];
-      ig4 = idmo[ie][iface][1][1][LX1-1][LX1-1];
-
-      // copy the value from tmor to tx for these four local corners
-      tx[il1] = tmor[ig1];
-      tx[il2] = tmor[ig2];
-      tx[il3] = tmor[ig3];
-      tx[il4] = tmor[ig4];
-
-      // nnje=1 for conforming faces, nnje=2 for nonconforming faces
-      if (cbc[ie][iface] == 3) {
-        nnje = 2;
-      } else {
-        nnje = 1;
-      }
+    // all the mortar points the faces of ie can add to
+    ids = &idmo[ie][0][0][0][0][0];
+    used = 0;
+    for (n = 0; n < NSIDES*LNJE*LNJE*LX1*LX1; n++) {
+      if (ids[n] >= 0 && ids[n] < nmor) used |= mor_colors[ids[n]];
+    }
+    for (c = 0; c < MAX_COLORS && (used >> c) & 1; c++) ;
+    if (c == MAX_COLORS) {
+      ncolor = 0;
+      return;
+    }
+    for (n = 0; n < NSIDES*LNJE*LNJE*LX1*LX1; n++) {
+      if (ids[n] >= 0 && ids[n] < nmor) mor_colors[ids[n]] |= 1ULL << c;
+    }
+    color[ie] = c;
+    count[c]++;
+    if (c >= ncolor) ncolor = c+1;
+  }
 
-      // for nonconforming faces
-      if (nnje == 2) {
-        // nonconforming faces have four pieces of mortar, first map them to
-        // two intermediate mortars, stored in tmp
-        r_init((double *)tmp, LX1*LX1*2, 0.0);
-
-        for (ije1 = 0; ije1 < nnje; ije1++) {
-          for (ije2 = 0; ije2 < nnje; ije2++) {
-            for (col = 0; col < LX1; col++) {
-              // in each row col, when coloumn i=1 or LX1, the value
-              // in tmor is copied to tmp
-              i = v_end[ije2];
-              ig = idmo[ie][iface][ije2][ije1][col][i];
-              tmp[ije1][col][i] = tmor[ig];
-
-              // in each row col, value in the interior three collocation
-              // points is computed by apply mapping matrix qbnew to tmor
-              for (i = 1; i < LX1-1; i++) {
-                il = idel[ie][iface][col][i];
-                for (j = 0; j < LX1; j++) {
-                  ig = idmo[ie][iface][ije2][ije1][col][j];
-                  tmp[ije1][col][i] = tmp[ije1][col][i] +
-                    qbnew[ije2][j][i-1]*tmor[ig];
-                }
-              }
-            }
-          }
-        }
+  color_ptr[0] = 0;
+  for (c = 0; c < ncolor; c++) {
+    color_ptr[c+1] = color_ptr[c]+count[c];
+    count[c] = color_ptr[c];
+  }
+  for (ie = 0; ie < nelt; ie++) {
+    color_elt[count[color[ie]]++] = ie;
+  }
+}
 
-        // mapping from two pieces of intermediate mortar tmp to element
-        // face tx
-        for (ije1 = 0; ije1 < nnje; ije1++) {
-          // the first column, col=0, is an edge of face iface.
-          // the value on the three interior collocation points, tx, is
-          // computed by applying mapping matrices qbnew to tmp.
-          // the mapping result is divided by 2, because there will be
-          // duplicated contribution from another face sharing this edge.
-          col = 0;
-          for (i = 1; i < LX1-1; i++) {
-            il= idel[ie][iface][i][col];
-            for (j = 0; j < LX1; j++) {
-              tx[il] = tx[il] + qbnew[ije1][j][i-1]*
-                tmp[ije1][j][col]*0.5;
-            }
-          }
 
-          // for column 1 ~ lx-2
-          for (col = 1; col < LX1-1; col++) {
-            //when i=0 or LX1-1, the collocation points are also on an edge of
-            // the face, so the mapping result also needs to be divided by 2
-            i = v_end[ije1];
-            il = idel[ie][iface][i][col];
-            tx[il] = tx[il]+tmp[ije1][i][col]*0.5;
+//------------------------------------------------------------------
+// The first element of color c that is ie or after it
+//------------------------------------------------------------------
+int color_first(int c, int ie)
+{
+  int lo = color_ptr[c], hi = color_ptr[c+1], mid;
+
+  while (lo < hi) {
+    mid = (lo+hi)/2;
+    if (color_elt[mid] < ie) lo = mid+1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+
+//------------------------------------------------------------------
+// Map values from mortar(tmor) to element(tx), on element ie
+//------------------------------------------------------------------
+static void transf_elt(double tmor[], double tx[], int ie)
+{
+  double tmp[2][LX1][LX1];
+  int ig1, ig2, ig3, ig4, iface, il1, il2, il3, il4;
+  int nnje, ije1, ije2, col, i, j, ig, il;
 
-            // compute the value at interior collocation points in
-            // columns 1 ~ LX1-1
+  for (iface = 0; iface < NSIDES; iface++) {
+    // get the collocation point index of the four local corners on the
+    // face iface of element ie
+    il1 = idel[ie][iface][0][0];
+    il2 = idel[ie][iface][0][LX1-1];
+    il3 = idel[ie][iface][LX1-1][0];
+    il4 = idel[ie][iface][LX1-1][LX1-1];
+
+    // get the mortar indices of the four local corners
+    ig1 = idmo[ie][iface][0][0][0][0];
+    ig2 = idmo[ie][iface][1][0][0][LX1-1];
+    ig3 = idmo[ie][iface][0][1][LX1-1][0];
+    ig4 = idmo[ie][iface][1][1][LX1-1][LX1-1];
+
+    // copy the value from tmor to tx for these four local corners
+    tx[il1] = tmor[ig1];
+    tx[il2] = tmor[ig2];
+    tx[il3] = tmor[ig3];
+    tx[il4] = tmor[ig4];
+
+    // nnje=1 for conforming faces, nnje=2 for nonconforming faces
+    if (cbc[ie][iface] == 3) {
+      nnje = 2;
+    } else {
+      nnje = 1;
+    }
+
+    // for nonconforming faces
+    if (nnje == 2) {
+      // nonconforming faces have four pieces of mortar, first map them to
+      // two intermediate mortars, stored in tmp
+      r_init((double *)tmp, LX1*LX1*2, 0.0);
+
+      for (ije1 = 0; ije1 < nnje; ije1++) {
+        for (ije2 = 0; ije2 < nnje; ije2++) {
+          for (col = 0; col < LX1; col++) {
+            // in each row col, when coloumn i=1 or LX1, the value
+            // in tmor is copied to tmp
+            i = v_end[ije2];
+            ig = idmo[ie][iface][ije2][ije1][col][i];
+            tmp[ije1][col][i] = tmor[ig];
+
+            // in each row col, value in the interior three collocation
+            // points is computed by apply mapping matrix qbnew to tmor
             for (i = 1; i < LX1-1; i++) {
-              il = idel[ie][iface][i][col];
+              il = idel[ie][iface][col][i];
               for (j = 0; j < LX1; j++) {
-                tx[il] = tx[il] + qbnew[ije1][j][i-1]* tmp[ije1][j][col];
+                ig = idmo[ie][iface][ije2][ije1][col][j];
+                tmp[ije1][col][i] = tmp[ije1][col][i] +
+                  qbnew[ije2][j][i-1]*tmor[ig];
               }
             }
           }
+        }
+      }
 
-          // same as col=0
-          col = LX1-1;
+      // mapping from two pieces of intermediate mortar tmp to element
+      // face tx
+      for (ije1 = 0; ije1 < nnje; ije1++) {
+        // the first column, col=0, is an edge of face iface.
+        // the value on the three interior collocation points, tx, is
+        // computed by applying mapping matrices qbnew to tmp.
+        // the mapping result is divided by 2, because there will be
+        // duplicated contribution from another face sharing this edge.
+        col = 0;
+        for (i = 1; i < LX1-1; i++) {
+          il= idel[ie][iface][i][col];
+          for (j = 0; j < LX1; j++) {
+            tx[il] = tx[il] + qbnew[ije1][j][i-1]*
+              tmp[ije1][j][col]*0.5;
+          }
+        }
+
+        // for column 1 ~ lx-2
+        for (col = 1; col < LX1-1; col++) {
+          //when i=0 or LX1-1, the collocation points are also on an edge of
+          // the face, so the mapping result also needs to be divided by 2
+          i = v_end[ije1];
+          il = idel[ie][iface][i][col];
+          tx[il] = tx[il]+tmp[ije1][i][col]*0.5;
+
+          // compute the value at interior collocation points in
+          // columns 1 ~ LX1-1
           for (i = 1; i < LX1-1; i++) {
             il = idel[ie][iface][i][col];
             for (j = 0; j < LX1; j++) {
-              tx[il] = tx[il] + qbnew[ije1][j][i-1]*
-                tmp[ije1][j][col]*0.5;
+              tx[il] = tx[il] + qbnew[ije1][j][i-1]* tmp[ije1][j][col];
             }
           }
         }
 
-        // for conforming faces
-      } else {
-        // face interior
-        for (col = 1; col < LX1-1; col++) {
-          for (i = 1; i < LX1-1; i++) {
-            il = idel[ie][iface][col][i];
-            ig = idmo[ie][iface][0][0][col][i];
-            tx[il] = tmor[ig];
+        // same as col=0
+        col = LX1-1;
+        for (i = 1; i < LX1-1; i++) {
+          il = idel[ie][iface][i][col];
+          for (j = 0; j < LX1; j++) {
+            tx[il] = tx[il] + qbnew[ije1][j][i-1]*
+              tmp[ije1][j][col]*0.5;
           }
         }
+      }
 
-        // edges of conforming faces
+      // for conforming faces
+    } else {
+      // face interior
+      for (col = 1; col < LX1-1; col++) {
+        for (i = 1; i < LX1-1; i++) {
+          il = idel[ie][iface][col][i];
+          ig = idmo[ie][iface][0][0][col][i];
+          tx[il] = tmor[ig];
+        }
+      }
 
-        // if local edge 0 is a nonconforming edge
-        if (idmo[ie][iface][0][0][0][LX1-1] != -1) {
-          for (i = 1; i < LX1-1; i++) {
-            il = idel[ie][iface][0][i];
-            for (ije1 = 0; ije1 < 2; ije1++) {
-              for (j = 0; j < LX1; j++) {
-                ig = idmo[ie][iface][ije1][0][0][j];
-                tx[il] = tx[il] + qbnew[ije1][j][i-1]*tmor[ig]*0.5;
-              }
+      // edges of conforming faces
+
+      // if local edge 0 is a nonconforming edge
+      if (idmo[ie][iface][0][0][0][LX1-1] != -1) {
+        for (i = 1; i < LX1-1; i++) {
+          il = idel[ie][iface][0][i];
+          for (ije1 = 0; ije1 < 2; ije1++) {
+            for (j = 0; j < LX1; j++) {
+              ig = idmo[ie][iface][ije1][0][0][j];
+              tx[il] = tx[il] + qbnew[ije1][j][i-1]*tmor[ig]*0.5;
             }
           }
+        }
 
-          // if local edge 0 is a conforming edge
-        } else {
-          for (i = 1; i < LX1-1; i++) {
-            il = idel[ie][iface][0][i];
-            ig = idmo[ie][iface][0][0][0][i];
-            tx[il] = tmor[ig];
-          }
+        // if local edge 0 is a conforming edge
+      } else {
+        for (i = 1; i < LX1-1; i++) {
+          il = idel[ie][iface][0][i];
+          ig = idmo[ie][iface][0][0][0][i];
+          tx[il] = tmor[ig];
         }
+      }
 
-        // if local edge 1 is a nonconforming edge
-        if (idmo[ie][iface][1][0][1][LX1-1] != -1) {
-          for (i = 1; i < LX1-1; i++) {
-            il = idel[ie][iface][i][LX1-1];
-            for (ije1 = 0; ije1 < 2; ije1++) {
-              for (j = 0; j < LX1; j++) {
-                ig = idmo[ie][iface][1][ije1][j][LX1-1];
-                tx[il] = tx[il] + qbnew[ije1][j][i-1]*tmor[ig]*0.5;
-              }
+      // if local edge 1 is a nonconforming edge
+      if (idmo[ie][iface][1][0][1][LX1-1] != -1) {
+        for (i = 1; i < LX1-1; i++) {
+          il = idel[ie][iface][i][LX1-1];
+          for (ije1 = 0; ije1 < 2; ije1++) {
+            for (j = 0; j < LX1; j++) {
+              ig = idmo[ie][iface][1][ije1][j][LX1-1];
+              tx[il] = tx[il] + qbnew[ije1][j][i-1]*tmor[ig]*0.5;
             }
           }
+        }
 
-          // if local edge 1 is a conforming edge
-        } else {
-          for (i = 1; i < LX1-1; i++) {
-            il = idel[ie][iface][i][LX1-1];
-            ig = idmo[ie][iface][0][0][i][LX1-1];
-            tx[il] = tmor[ig];
-          }
+        // if local edge 1 is a conforming edge
+      } else {
+        for (i = 1; i < LX1-1; i++) {
+          il = idel[ie][iface][i][LX1-1];
+          ig = idmo[ie][iface][0][0][i][LX1-1];
+          tx[il] = tmor[ig];
         }
+      }
 
-        // if local edge 2 is a nonconforming edge
-        if (idmo[ie][iface][0][1][LX1-1][1] != -1) {
-          for (i = 1; i < LX1-1; i++) {
-            il = idel[ie][iface][LX1-1][i];
-            for (ije1 = 0; ije1 < 2; ije1++) {
-              for (j = 0; j < LX1; j++) {
-                ig = idmo[ie][iface][ije1][1][LX1-1][j];
-                tx[il] = tx[il] + qbnew[ije1][j][i-1]*tmor[ig]*0.5;
-              }
+      // if local edge 2 is a nonconforming edge
+      if (idmo[ie][iface][0][1][LX1-1][1] != -1) {
+        for (i = 1; i < LX1-1; i++) {
+          il = idel[ie][iface][LX1-1][i];
+          for (ije1 = 0; ije1 < 2; ije1++) {
+            for (j = 0; j < LX1; j++) {
+              ig = idmo[ie][iface][ije1][1][LX1-1][j];
+              tx[il] = tx[il] + qbnew[ije1][j][i-1]*tmor[ig]*0.5;
             }
           }
+        }
 
-          // if local edge 2 is a conforming edge
-        } else {
-          for (i = 1; i < LX1-1; i++) {
-            il = idel[ie][iface][LX1-1][i];
-            ig = idmo[ie][iface][0][0][LX1-1][i];
-            tx[il] = tmor[ig];
-          }
+        // if local edge 2 is a conforming edge
+      } else {
+        for (i = 1; i < LX1-1; i++) {
+          il = idel[ie][iface][LX1-1][i];
+          ig = idmo[ie][iface][0][0][LX1-1][i];
+          tx[il] = tmor[ig];
         }
+      }
 
-        // if local edge 3 is a nonconforming edge
-        if (idmo[ie][iface][0][0][LX1-1][0] != -1) {
-          for (i = 1; i < LX1-1; i++) {
-            il = idel[ie][iface][i][0];
-            for (ije1 = 0; ije1 < 2; ije1++) {
-              for (j = 0; j < LX1; j++) {
-                ig = idmo[ie][iface][0][ije1][j][0];
-                tx[il] = tx[il] + qbnew[ije1][j][i-1]*tmor[ig]*0.5;
-              }
+      // if local edge 3 is a nonconforming edge
+      if (idmo[ie][iface][0][0][LX1-1][0] != -1) {
+        for (i = 1; i < LX1-1; i++) {
+          il = idel[ie][iface][i][0];
+          for (ije1 = 0; ije1 < 2; ije1++) {
+            for (j = 0; j < LX1; j++) {
+              ig = idmo[ie][iface][0][ije1][j][0];
+              tx[il] = tx[il] + qbnew[ije1][j][i-1]*tmor[ig]*0.5;
             }
           }
-          // if local edge 3 is a conforming edge
-        } else {
-          for (i = 1; i < LX1-1; i++) {
-            il = idel[ie][iface][i][0];
-            ig = idmo[ie][iface][0][0][i][0];
-            tx[il] = tmor[ig];
-          }
+        }
+        // if local edge 3 is a conforming edge
+      } else {
+        for (i = 1; i < LX1-1; i++) {
+          il = idel[ie][iface][i][0];
+          ig = idmo[ie][iface][0][0][i][0];
+          tx[il] = tmor[ig];
         }
       }
     }
@@ -250,244 +316,296 @@ void transf(double tmor[], double tx[])
 
 
 //------------------------------------------------------------------
-// Map from element(tx) to mortar(tmor).
-// tmor sums contributions from all elements.
+// Map values from mortar(tmor) to element(tx)
+// On the team, every thread maps its block of elements.
 //------------------------------------------------------------------
-void transfb(double tmor[], double tx[])
+void transf(double tmor[], double tx[])
+{
+  int ie, lo, hi;
+
+  // all of tmor has to be ready
+  popcorn_team_barrier();
+  team_split(0, nelt, &lo, &hi);
+
+  // zero out tx on element boundaries
+  col2(&tx[lo*NXYZ], (double *)tmult[lo], (hi-lo)*NXYZ);
+
+  for (ie = lo; ie < hi; ie++) {
+    transf_elt(tmor, tx, ie);
+  }
+}
+
+
+//------------------------------------------------------------------
+// Map from element(tx) to mortar(tmor), for element ie.
+//------------------------------------------------------------------
+static void transfb_elt(double tmor[], double tx[], int ie)
 {
   const double third = 1.0/3.0;
   int shift;
 
   double tmp, tmp1, temp[2][LX1][LX1], top[2][LX1];
-  int il1, il2, il3, il4, ig1, ig2, ig3, ig4, ie, iface, nnje;
+  int il1, il2, il3, il4, ig1, ig2, ig3, ig4, iface, nnje;
   int ije1, ije2, col, i, j, ije, ig, il;
 
-  r_init(tmor, nmor, 0.0);
+  for (iface = 0; iface < NSIDES; iface++) {
+    // nnje=1 for conforming faces, nnje=2 for nonconforming faces
+    if (cbc[ie][iface] == 3) {
+      nnje = 2;
+    } else {
+      nnje = 1;
+    }
 
-  for (ie = 0; ie < nelt; ie++) {
-    for (iface = 0; iface < NSIDES; iface++) {
-      // nnje=1 for conforming faces, nnje=2 for nonconforming faces
-      if (cbc[ie][iface] == 3) {
-        nnje = 2;
-      } else {
-        nnje = 1;
-      }
+    // get collocation point index of four local corners on the face
+    il1 = idel[ie][iface][0][0];
+    il2 = idel[ie][iface][0][LX1-1];
+    il3 = idel[ie][iface][LX1-1][0];
+    il4 = idel[ie][iface][LX1-1][LX1-1];
+
+    // get the mortar indices of the four local corners
+    ig1 = idmo[ie][iface][0][0][0][0];
+    ig2 = idmo[ie][iface][1][0][0][LX1-1];
+    ig3 = idmo[ie][iface][0][1][LX1-1][0];
+    ig4 = idmo[ie][iface][1][1][LX1-1][LX1-1];
+
+    // sum the values from tx to tmor for these four local corners
+    // only 1/3 of the value is summed, since there will be two duplicated
+    // contributions from the other two faces sharing this vertex
+    tmor[ig1] = tmor[ig1]+tx[il1]*third;
+    tmor[ig2] = tmor[ig2]+tx[il2]*third;
+    tmor[ig3] = tmor[ig3]+tx[il3]*third;
+    tmor[ig4] = tmor[ig4]+tx[il4]*third;
+
+    // for nonconforming faces
+    if (nnje == 2) {
+      r_init((double *)temp, LX1*LX1*2, 0.0);
+
+      // nonconforming faces have four pieces of mortar, first map tx to
+      // two intermediate mortars stored in temp
+      for (ije2 = 0; ije2 < nnje; ije2++) {
+        shift = ije2;
+        for (col = 0; col < LX1; col++) {
+          // For mortar points on face edge (top and bottom), copy the
+          // value from tx to temp
+          il = idel[ie][iface][v_end[ije2]][col];
+          temp[ije2][v_end[ije2]][col] = tx[il];
+
+          // For mortar points on face edge (top and bottom), calculate
+          // the interior points' contribution to them, i.e. top()
+          j = v_end[ije2];
+          tmp = 0.0;
+          for (i = 1; i < LX1-1; i++) {
+            il = idel[ie][iface][i][col];
+            tmp = tmp + qbnew[ije2][j][i-1]*tx[il];
+          }
 
-      // get collocation point index of four local corners on the face
-      il1 = idel[ie][iface][0][0];
-      il2 = idel[ie][iface][0][LX1-1];
-      il3 = idel[ie][iface][LX1-1][0];
-      il4 = idel[ie][iface][LX1-1][LX1-1];
-
-      // get the mortar indices of the four local corners
-      ig1 = idmo[ie][iface][0][0][0][0];
-      ig2 = idmo[ie][iface][1][0][0][LX1-1];
-      ig3 = idmo[ie][iface][0][1][LX1-1][0];
-      ig4 = idmo[ie][iface][1][1][LX1-1][LX1-1];
-
-      // sum the values from tx to tmor for these four local corners
-      // only 1/3 of the value is summed, since there will be two duplicated
-      // contributions from the other two faces sharing this vertex
-      tmor[ig1] = tmor[ig1]+tx[il1]*third;
-      tmor[ig2] = tmor[ig2]+tx[il2]*third;
-      tmor[ig3] = tmor[ig3]+tx[il3]*third;
-      tmor[ig4] = tmor[ig4]+tx[il4]*third;
-
-      // for nonconforming faces
-      if (nnje == 2) {
-        r_init((double *)temp, LX1*LX1*2, 0.0);
-
-        // nonconforming faces have four pieces of mortar, first map tx to
-        // two intermediate mortars stored in temp
-        for (ije2 = 0; ije2 < nnje; ije2++) {
-          shift = ije2;
-          for (col = 0; col < LX1; col++) {
-            // For mortar points on face edge (top and bottom), copy the
-            // value from tx to temp
-            il = idel[ie][iface][v_end[ije2]][col];
-            temp[ije2][v_end[ije2]][col] = tx[il];
-
-            // For mortar points on face edge (top and bottom), calculate
-            // the interior points' contribution to them, i.e. top()
-            j = v_end[ije2];
+          top[ije2][col] = tmp;
+
+          // Use mapping matrices qbnew to map the value from tx to temp
+          // for mortar points not on the top bottom face edge.
+          for (j = 2-shift-1; j < LX1-shift; j++) {
             tmp = 0.0;
             for (i = 1; i < LX1-1; i++) {
               il = idel[ie][iface][i][col];
               tmp = tmp + qbnew[ije2][j][i-1]*tx[il];
-            }
-
-            top[ije2][col] = tmp;
-
-            // Use mapping matrices qbnew to map the value from tx to temp
-            // for mortar points not on the top bottom face edge.
-            for (j = 2-shift-1; j < LX1-shift; j++) {
-              tmp = 0.0;
-              for (i = 1; i < LX1-1; i++) {
-                il = idel[ie][iface][i][col];
-                tmp = tmp + qbnew[ije2][j][i-1]*tx[il];
-              };
-              temp[ije2][j][col] = tmp + temp[ije2][j][col];
-            }
+            };
+            temp[ije2][j][col] = tmp + temp[ije2][j][col];
           }
         }
+      }
 
-        // mapping from temp to tmor
-        for (ije1 = 0; ije1 < nnje; ije1++) {
-          shift = ije1;
-          for (ije2 = 0; ije2 < nnje; ije2++) {
-
-            // for each column of collocation points on a piece of mortar
-            for (col = 2-shift-1; col < LX1-shift; col++) {
-
-              // For the end point, which is on an edge (local edge 1,3),
-              // the contribution is halved since there will be duplicated
-              // contribution from another face sharing this edge.
-
-              ig = idmo[ie][iface][ije2][ije1][col][v_end[ije2]];
-              tmor[ig] = tmor[ig]+temp[ije1][col][v_end[ije2]]*0.5;
+      // mapping from temp to tmor
+      for (ije1 = 0; ije1 < nnje; ije1++) {
+        shift = ije1;
+        for (ije2 = 0; ije2 < nnje; ije2++) {
 
-              // In each row of collocation points on a piece of mortar,
-              // sum the contributions from interior collocation points
-              // (i=1,LX1-2)
-              for (j = 0; j < LX1; j++) {
-                tmp = 0.0;
-                for (i = 1; i < LX1-1; i++) {
-                  tmp = tmp + qbnew[ije2][j][i-1] * temp[ije1][col][i];
-                }
-                ig = idmo[ie][iface][ije2][ije1][col][j];
-                tmor[ig] = tmor[ig]+tmp;
-              }
-            }
+          // for each column of collocation points on a piece of mortar
+          for (col = 2-shift-1; col < LX1-shift; col++) {
 
-            // For tmor on local edge 0 and 2, tmp is the contribution from
-            // an edge, so it is halved because of duplicated contribution
-            // from another face sharing this edge. tmp1 is contribution
-            // from face interior.
+            // For the end point, which is on an edge (local edge 1,3),
+            // the contribution is halved since there will be duplicated
+            // contribution from another face sharing this edge.
 
-            col = v_end[ije1];
             ig = idmo[ie][iface][ije2][ije1][col][v_end[ije2]];
-            tmor[ig] = tmor[ig]+top[ije1][v_end[ije2]]*0.5;
+            tmor[ig] = tmor[ig]+temp[ije1][col][v_end[ije2]]*0.5;
+
+            // In each row of collocation points on a piece of mortar,
+            // sum the contributions from interior collocation points
+            // (i=1,LX1-2)
             for (j = 0; j < LX1; j++) {
               tmp = 0.0;
-              tmp1 = 0.0;
               for (i = 1; i < LX1-1; i++) {
-                tmp  = tmp  + qbnew[ije2][j][i-1] * temp[ije1][col][i];
-                tmp1 = tmp1 + qbnew[ije2][j][i-1] * top[ije1][i];
+                tmp = tmp + qbnew[ije2][j][i-1] * temp[ije1][col][i];
               }
               ig = idmo[ie][iface][ije2][ije1][col][j];
-              tmor[ig] = tmor[ig]+tmp*0.5+tmp1;
+              tmor[ig] = tmor[ig]+tmp;
             }
           }
-        }
 
-        // for conforming faces
-      } else {
+          // For tmor on local edge 0 and 2, tmp is the contribution from
+          // an edge, so it is halved because of duplicated contribution
+          // from another face sharing this edge. tmp1 is contribution
+          // from face interior.
 
-        // face interior
-        for (col = 1; col < LX1-1; col++) {
-          for (j = 1; j < LX1-1; j++) {
-            il = idel[ie][iface][col][j];
-            ig = idmo[ie][iface][0][0][col][j];
-            tmor[ig] = tmor[ig]+tx[il];
+          col = v_end[ije1];
+          ig = idmo[ie][iface][ije2][ije1][col][v_end[ije2]];
+          tmor[ig] = tmor[ig]+top[ije1][v_end[ije2]]*0.5;
+          for (j = 0; j < LX1; j++) {
+            tmp = 0.0;
+            tmp1 = 0.0;
+            for (i = 1; i < LX1-1; i++) {
+              tmp  = tmp  + qbnew[ije2][j][i-1] * temp[ije1][col][i];
+              tmp1 = tmp1 + qbnew[ije2][j][i-1] * top[ije1][i];
+            }
+            ig = idmo[ie][iface][ije2][ije1][col][j];
+            tmor[ig] = tmor[ig]+tmp*0.5+tmp1;
           }
         }
+      }
 
-        // edges of conforming faces
+      // for conforming faces
+    } else {
 
-        // if local edge 0 is a nonconforming edge
-        if (idmo[ie][iface][0][0][0][LX1-1] != -1) {
-          for (ije = 0; ije < 2; ije++) {
-            for (j = 0; j < LX1; j++) {
-              tmp = 0.0;
-              for (i = 1; i < LX1-1; i++) {
-                il = idel[ie][iface][0][i];
-                tmp= tmp + qbnew[ije][j][i-1]*tx[il];
-              }
-              ig = idmo[ie][iface][ije][0][0][j];
-              tmor[ig] = tmor[ig]+tmp*0.5;
+      // face interior
+      for (col = 1; col < LX1-1; col++) {
+        for (j = 1; j < LX1-1; j++) {
+          il = idel[ie][iface][col][j];
+          ig = idmo[ie][iface][0][0][col][j];
+          tmor[ig] = tmor[ig]+tx[il];
+        }
+      }
+
+      // edges of conforming faces
+
+      // if local edge 0 is a nonconforming edge
+      if (idmo[ie][iface][0][0][0][LX1-1] != -1) {
+        for (ije = 0; ije < 2; ije++) {
+          for (j = 0; j < LX1; j++) {
+            tmp = 0.0;
+            for (i = 1; i < LX1-1; i++) {
+              il = idel[ie][iface][0][i];
+              tmp= tmp + qbnew[ije][j][i-1]*tx[il];
             }
+            ig = idmo[ie][iface][ije][0][0][j];
+            tmor[ig] = tmor[ig]+tmp*0.5;
           }
+        }
 
-          // if local edge 0 is a conforming edge
-        } else {
-          for (j = 1; j < LX1-1; j++) {
-            il = idel[ie][iface][0][j];
-            ig = idmo[ie][iface][0][0][0][j];
-            tmor[ig] = tmor[ig]+tx[il]*0.5;
-          }
+        // if local edge 0 is a conforming edge
+      } else {
+        for (j = 1; j < LX1-1; j++) {
+          il = idel[ie][iface][0][j];
+          ig = idmo[ie][iface][0][0][0][j];
+          tmor[ig] = tmor[ig]+tx[il]*0.5;
         }
+      }
 
-        // if local edge 1 is a nonconforming edge
-        if (idmo[ie][iface][1][0][1][LX1-1] != -1) {
-          for (ije = 0; ije < 2; ije++) {
-            for (j = 0; j < LX1; j++) {
-              tmp = 0.0;
-              for (i = 1; i < LX1-1; i++) {
-                il = idel[ie][iface][i][LX1-1];
-                tmp = tmp + qbnew[ije][j][i-1]*tx[il];
-              }
-              ig = idmo[ie][iface][1][ije][j][LX1-1];
-              tmor[ig] = tmor[ig]+tmp*0.5;
+      // if local edge 1 is a nonconforming edge
+      if (idmo[ie][iface][1][0][1][LX1-1] != -1) {
+        for (ije = 0; ije < 2; ije++) {
+          for (j = 0; j < LX1; j++) {
+            tmp = 0.0;
+            for (i = 1; i < LX1-1; i++) {
+              il = idel[ie][iface][i][LX1-1];
+              tmp = tmp + qbnew[ije][j][i-1]*tx[il];
             }
+            ig = idmo[ie][iface][1][ije][j][LX1-1];
+            tmor[ig] = tmor[ig]+tmp*0.5;
           }
+        }
 
-          // if local edge 1 is a conforming edge
-        } else {
-          for (j = 1; j < LX1-1; j++) {
-            il = idel[ie][iface][j][LX1-1];
-            ig = idmo[ie][iface][0][0][j][LX1-1];
-            tmor[ig] = tmor[ig]+tx[il]*0.5;
-          }
+        // if local edge 1 is a conforming edge
+      } else {
+        for (j = 1; j < LX1-1; j++) {
+          il = idel[ie][iface][j][LX1-1];
+          ig = idmo[ie][iface][0][0][j][LX1-1];
+          tmor[ig] = tmor[ig]+tx[il]*0.5;
         }
+      }
 
-        // if local edge 2 is a nonconforming edge
-        if (idmo[ie][iface][0][1][LX1-1][1] != -1) {
-          for (ije = 0; ije < 2; ije++) {
-            for (j = 0; j < LX1; j++) {
-              tmp = 0.0;
-              for (i = 1; i < LX1-1; i++) {
-                il = idel[ie][iface][LX1-1][i];
-                tmp = tmp + qbnew[ije][j][i-1]*tx[il];
-              }
-              ig = idmo[ie][iface][ije][1][LX1-1][j];
-              tmor[ig] = tmor[ig]+tmp*0.5;
+      // if local edge 2 is a nonconforming edge
+      if (idmo[ie][iface][0][1][LX1-1][1] != -1) {
+        for (ije = 0; ije < 2; ije++) {
+          for (j = 0; j < LX1; j++) {
+            tmp = 0.0;
+            for (i = 1; i < LX1-1; i++) {
+              il = idel[ie][iface][LX1-1][i];
+              tmp = tmp + qbnew[ije][j][i-1]*tx[il];
             }
+            ig = idmo[ie][iface][ije][1][LX1-1][j];
+            tmor[ig] = tmor[ig]+tmp*0.5;
           }
+        }
 
-          // if local edge 2 is a conforming edge
-        } else {
-          for (j = 1; j < LX1-1; j++) {
-            il = idel[ie][iface][LX1-1][j];
-            ig = idmo[ie][iface][0][0][LX1-1][j];
-            tmor[ig] = tmor[ig]+tx[il]*0.5;
-          }
+        // if local edge 2 is a conforming edge
+      } else {
+        for (j = 1; j < LX1-1; j++) {
+          il = idel[ie][iface][LX1-1][j];
+          ig = idmo[ie][iface][0][0][LX1-1][j];
+          tmor[ig] = tmor[ig]+tx[il]*0.5;
         }
+      }
 
-        // if local edge 3 is a nonconforming edge
-        if (idmo[ie][iface][0][0][LX1-1][0] != -1) {
-          for (ije = 0; ije < 2; ije++) {
-            for (j = 0; j < LX1; j++) {
-              tmp = 0.0;
-              for (i = 1; i < LX1-1; i++) {
-                il = idel[ie][iface][i][0];
-                tmp = tmp + qbnew[ije][j][i-1]*tx[il];
-              }
-              ig = idmo[ie][iface][0][ije][j][0];
-              tmor[ig] = tmor[ig]+tmp*0.5;
+      // if local edge 3 is a nonconforming edge
+      if (idmo[ie][iface][0][0][LX1-1][0] != -1) {
+        for (ije = 0; ije < 2; ije++) {
+          for (j = 0; j < LX1; j++) {
+            tmp = 0.0;
+            for (i = 1; i < LX1-1; i++) {
+              il = idel[ie][iface][i][0];
+              tmp = tmp + qbnew[ije][j][i-1]*tx[il];
             }
+            ig = idmo[ie][iface][0][ije][j][0];
+            tmor[ig] = tmor[ig]+tmp*0.5;
           }
+        }
 
-          // if local edge 3 is a conforming edge
-        } else {
-          for (j = 1; j < LX1-1; j++) {
-            il = idel[ie][iface][j][0];
-            ig = idmo[ie][iface][0][0][j][0];
-            tmor[ig] = tmor[ig]+tx[il]*0.5;
-          }
+        // if local edge 3 is a conforming edge
+      } else {
+        for (j = 1; j < LX1-1; j++) {
+          il = idel[ie][iface][j][0];
+          ig = idmo[ie][iface][0][0][j][0];
+          tmor[ig] = tmor[ig]+tx[il]*0.5;
         }
-      } //nnje=1
+      }
+    } //nnje=1
+  }
+}
+
+
+//------------------------------------------------------------------
+// Map from element(tx) to mortar(tmor).
+// tmor sums contributions from all elements.
+// On the team, every thread sums the elements of its block one color
+// at a time (see color_elements()), so that no two threads add to the
+// same mortar point at once.
+//------------------------------------------------------------------
+void transfb(double tmor[], double tx[])
+{
+  int ie, c, k, lo, hi, mlo, mhi;
+
+  team_split(0, nmor, &mlo, &mhi);
+  r_init(&tmor[mlo], mhi-mlo, 0.0);
+  popcorn_team_barrier();
+
+  if (popcorn_team_tid() < 0 || popcorn_team_size() == 1 || ncolor == 0) {
+    if (popcorn_team_tid() <= 0) {
+      for (ie = 0; ie < nelt; ie++) {
+        transfb_elt(tmor, tx, ie);
+      }
+    }
+  } else {
+    team_split(0, nelt, &lo, &hi);
+    for (c = 0; c < ncolor; c++) {
+      // the elements of color c are in ascending order
+      for (k = color_first(c, lo); k < color_ptr[c+1]; k++) {
+        if (color_elt[k] >= hi) break;
+        transfb_elt(tmor, tx, color_elt[k]);
+      }
+      popcorn_team_barrier();
     }
   }
+  popcorn_team_barrier();
 }
 
 
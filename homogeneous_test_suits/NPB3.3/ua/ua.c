@@ -36,6 +36,11 @@
 #include <stdio.h>
 #include <math.h>
 #include "migrate.h"
+
+#include "popcorn_nodes.h"
+
+// Region ID for popcorn_profile.h
+#define UA_REGION_ADAPT 1
 #include "header.h"
 #include "timers.h"
 #include "print_results.h"
@@ -231,6 +236,11 @@ int face_l1[3];
 int face_l2[3];
 int face_ld[3];
 
+/* common /colors/ */
+int ncolor;
+int color_ptr[MAX_COLORS+1];
+int color_elt[LELT];
+
 // Timer parameters
 /* common /timing/ */
 logical timeron;
@@ -302,6 +312,12 @@ int main(int argc, char *argv[])
 
   top_constants();
 
+  // The CG iterations of diffusion run on a team of $POPCORN_THREADS
+  // threads spread over the nodes, the rest of the time steps on the first
+  // thread. A team of one migrates for the timed loop instead. The team
+  // starts before the mesh, which is colored for it (see color_elements).
+  popcorn_team_init(UA_REGION_ADAPT);
+
   for (i = 1; i <= t_last; i++) {
     timer_clear(i);
   }
@@ -331,7 +347,8 @@ int main(int argc, char *argv[])
   if (timeron) timer_stop(t_init);
 
   timer_clear(1);
-  migrate(1, NULL, NULL);
+  if (popcorn_team_size() == 1)
+    popcorn_migrate_best(UA_REGION_ADAPT);
 
   time = 0.0;
   for (step = 0; step <= niter; step++) {
@@ -407,10 +424,12 @@ int main(int argc, char *argv[])
     }
     nelt_tot = nelt_tot + (double)(nelt);
   }
-  migrate(0, NULL, NULL);
+  if (popcorn_team_size() == 1)
+    popcorn_migrate_home(UA_REGION_ADAPT);
 
   timer_stop(1);
   tmax = timer_read(1);
+  popcorn_team_fini();
 
   verify(&Class, &verified);
 
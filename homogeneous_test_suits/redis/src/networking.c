@@ -29,6 +29,7 @@
 
 #include "server.h"
 #include "atomicvar.h"
+#include "migrate.h"
 #include <sys/socket.h>
 #include <sys/uio.h>
 #include <math.h>
@@ -115,6 +116,8 @@ client *createClient(connection *conn) {
     c->reqtype = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->cmdq = NULL;
+    c->cmdq_pos = c->cmdq_len = c->cmdq_size = 0;
     c->cmd = c->lastcmd = NULL;
     c->user = DefaultUser;
     c->multibulklen = 0;
@@ -961,6 +964,19 @@ static void freeClientArgv(client *c) {
     c->cmd = NULL;
 }
 
+/* Free the commands an I/O thread parsed but the client did not run. */
+static void freeClientQueuedCommands(client *c) {
+    int i, j;
+    for (i = c->cmdq_pos; i < c->cmdq_len; i++) {
+        for (j = 0; j < c->cmdq[i].argc; j++)
+            decrRefCount(c->cmdq[i].argv[j]);
+        zfree(c->cmdq[i].argv);
+    }
+    zfree(c->cmdq);
+    c->cmdq = NULL;
+    c->cmdq_pos = c->cmdq_len = c->cmdq_size = 0;
+}
+
 /* Close all the slaves connections. This is useful in chained replication
  * when we resync with our own master and want to force all our slaves to
  * resync with us as well. */
@@ -1104,6 +1120,7 @@ void freeClient(client *c) {
     /* Free data structures. */
     listRelease(c->reply);
     freeClientArgv(c);
+    freeClientQueuedCommands(c);
 
     /* Unlink the client: this will close the socket, remove the I/O
      * handlers, and remove references of the client from different
@@ -1686,13 +1703,87 @@ int processCommandAndResetClient(client *c) {
     return deadclient ? C_ERR : C_OK;
 }
 
+/* Return 1 if the query buffer of 'c' starts with a whole RESP command that
+ * processMultibulkBuffer() can parse without a protocol error, 0 otherwise.
+ * The checks are those of processMultibulkBuffer(): an I/O thread that
+ * already queued commands for the client only parses such a command, leaving
+ * a partial command or an error (reported after the queued commands run) to
+ * the main thread. */
+static int querybufHasCommand(client *c) {
+    char *p = c->querybuf+c->qb_pos, *end = c->querybuf+sdslen(c->querybuf);
+    char *newline;
+    long long ll, argc;
+
+    if (p == end || *p != '*') return 0;
+    newline = strchr(p,'\r');
+    if (newline == NULL || end-newline < 2) return 0;
+    if (!string2ll(p+1,newline-(p+1),&argc) || argc > 1024*1024) return 0;
+    p = newline+2;
+
+    while(argc-- > 0) {
+        if (p == end || *p != '$') return 0;
+        newline = strchr(p,'\r');
+        if (newline == NULL || end-newline < 2) return 0;
+        if (!string2ll(p+1,newline-(p+1),&ll) ||
+            ll < 0 || ll > server.proto_max_bulk_len) return 0;
+        p = newline+2;
+        if (end-p < ll+2) return 0;
+        p += ll+2;
+    }
+    return 1;
+}
+
+/* Move the command just parsed in c->argv to the queue of commands for the
+ * main thread to run, and get the client ready to parse the next one. This
+ * is how I/O threads hand over whole pipelines of parsed commands. */
+static void queueClientCommand(client *c) {
+    if (c->cmdq_pos == c->cmdq_len) {
+        c->cmdq_pos = c->cmdq_len = 0;
+    } else if (c->cmdq_len == c->cmdq_size) {
+        memmove(c->cmdq,c->cmdq+c->cmdq_pos,
+                sizeof(clientQueuedCommand)*(c->cmdq_len-c->cmdq_pos));
+        c->cmdq_len -= c->cmdq_pos;
+        c->cmdq_pos = 0;
+    }
+    if (c->cmdq_len == c->cmdq_size) {
+        c->cmdq_size = c->cmdq_size ? c->cmdq_size*2 : 4;
+        c->cmdq = zrealloc(c->cmdq,sizeof(clientQueuedCommand)*c->cmdq_size);
+    }
+
+    /* A command of no arguments (an empty multibulk) is queued too, so that
+     * the main thread resets the client for it in order. */
+    c->cmdq[c->cmdq_len].argc = c->argc;
+    c->cmdq[c->cmdq_len].argv = c->argc ? c->argv : NULL;
+    c->cmdq_len++;
+    if (c->argc) c->argv = NULL;
+    c->argc = 0;
+    c->reqtype = 0;
+    c->multibulklen = 0;
+    c->bulklen = -1;
+}
+
+/* Set up the next queued command of 'c' in c->argv, for the main thread to
+ * run. */
+static void popClientCommand(client *c) {
+    clientQueuedCommand *qc = c->cmdq+c->cmdq_pos++;
+
+    serverAssertWithInfo(c,NULL,c->argc == 0 && c->multibulklen == 0);
+    if (qc->argv) {
+        zfree(c->argv);
+        c->argv = qc->argv;
+    }
+    c->argc = qc->argc;
+    server.stat_io_parsed_commands++;
+}
+
 /* This function is called every time, in the client structure 'c', there is
  * more query buffer to process, because we read more data from the socket
  * or because a client was blocked and later reactivated, so there could be
  * pending query buffer, already representing a full command, to process. */
 void processInputBuffer(client *c) {
-    /* Keep processing while there is something in the input buffer */
-    while(c->qb_pos < sdslen(c->querybuf)) {
+    /* Keep processing while there is something in the input buffer, or
+     * commands an I/O thread already parsed out of it. */
+    while(c->cmdq_pos < c->cmdq_len || c->qb_pos < sdslen(c->querybuf)) {
         /* Return if clients are paused. */
         if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
 
@@ -1700,8 +1791,10 @@ void processInputBuffer(client *c) {
         if (c->flags & CLIENT_BLOCKED) break;
 
         /* Don't process more buffers from clients that have already pending
-         * commands to execute in c->argv. */
-        if (c->flags & CLIENT_PENDING_COMMAND) break;
+         * commands to execute in c->cmdq, unless we are the I/O thread
+         * queueing them. */
+        if ((c->flags & (CLIENT_PENDING_COMMAND|CLIENT_PENDING_READ)) ==
+            CLIENT_PENDING_COMMAND) break;
 
         /* Don't process input from the master while there is a busy script
          * condition on the slave. We want just to accumulate the replication
@@ -1716,46 +1809,59 @@ void processInputBuffer(client *c) {
          * The same applies for clients we want to terminate ASAP. */
         if (c->flags & (CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP)) break;
 
-        /* Determine request type when unknown. */
-        if (!c->reqtype) {
-            if (c->querybuf[c->qb_pos] == '*') {
-                c->reqtype = PROTO_REQ_MULTIBULK;
+        if (c->cmdq_pos < c->cmdq_len && !(c->flags & CLIENT_PENDING_READ)) {
+            /* The commands an I/O thread parsed come first. */
+            popClientCommand(c);
+        } else {
+            /* In an I/O thread, past the first command, only parse whole
+             * RESP commands, up to PROTO_QUEUED_CMDS_MAX of them. */
+            if (c->cmdq_pos < c->cmdq_len &&
+                (c->cmdq_len-c->cmdq_pos >= PROTO_QUEUED_CMDS_MAX ||
+                 !querybufHasCommand(c))) break;
+
+            /* Determine request type when unknown. */
+            if (!c->reqtype) {
+                if (c->querybuf[c->qb_pos] == '*') {
+                    c->reqtype = PROTO_REQ_MULTIBULK;
+                } else {
+                    c->reqtype = PROTO_REQ_INLINE;
+                }
+            }
+
+            if (c->reqtype == PROTO_REQ_INLINE) {
+                if (processInlineBuffer(c) != C_OK) break;
+                /* If the Gopher mode and we got zero or one argument, process
+                 * the request in Gopher mode. */
+                if (server.gopher_enabled &&
+                    ((c->argc == 1 && ((char*)(c->argv[0]->ptr))[0] == '/') ||
+                      c->argc == 0))
+                {
+                    processGopherRequest(c);
+                    resetClient(c);
+                    c->flags |= CLIENT_CLOSE_AFTER_REPLY;
+                    break;
+                }
+            } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
+                if (processMultibulkBuffer(c) != C_OK) break;
             } else {
-                c->reqtype = PROTO_REQ_INLINE;
+                serverPanic("Unknown request type");
             }
-        }
 
-        if (c->reqtype == PROTO_REQ_INLINE) {
-            if (processInlineBuffer(c) != C_OK) break;
-            /* If the Gopher mode and we got zero or one argument, process
-             * the request in Gopher mode. */
-            if (server.gopher_enabled &&
-                ((c->argc == 1 && ((char*)(c->argv[0]->ptr))[0] == '/') ||
-                  c->argc == 0))
-            {
-                processGopherRequest(c);
-                resetClient(c);
-                c->flags |= CLIENT_CLOSE_AFTER_REPLY;
-                break;
+            /* If we are in the context of an I/O thread, we can't really
+             * execute the command here. All we can do is to queue it and
+             * flag the client as one that needs to process commands, then
+             * go on parsing the next one. */
+            if (c->flags & CLIENT_PENDING_READ) {
+                queueClientCommand(c);
+                c->flags |= CLIENT_PENDING_COMMAND;
+                continue;
             }
-        } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != C_OK) break;
-        } else {
-            serverPanic("Unknown request type");
         }
 
         /* Multibulk processing could see a <= 0 length. */
         if (c->argc == 0) {
             resetClient(c);
         } else {
-            /* If we are in the context of an I/O thread, we can't really
-             * execute the command here. All we can do is to flag the client
-             * as one that needs to process the command. */
-            if (c->flags & CLIENT_PENDING_READ) {
-                c->flags |= CLIENT_PENDING_COMMAND;
-                break;
-            }
-
             /* We are finally ready to execute the command. */
             if (processCommandAndResetClient(c) == C_ERR) {
                 /* If the client is no longer valid, we avoid exiting this
@@ -2765,57 +2871,103 @@ int tio_debug = 0;
 #define IO_THREADS_MAX_NUM 128
 #define IO_THREADS_OP_READ 0
 #define IO_THREADS_OP_WRITE 1
+#define IO_THREADS_STATE_ALIGN 4096 /* A page, the unit of Popcorn's DSM. */
+#define IO_THREADS_SPIN_MIN 1000    /* Shortest adaptive spin, in polls. */
+
+/* What the main thread hands over to an I/O thread. Each thread has its own
+ * page of it: with the threads on another node (io-threads-node), a thread
+ * spinning on its pending count then only keeps its own page, and does not
+ * take the others' or the main thread's data away at every poll. */
+typedef struct ioThreadState {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;        /* Signaled by the main thread if parked. */
+    _Atomic unsigned long pending;
+    _Atomic int parked;         /* Waiting on cond for pending work? */
+    int op;         /* IO_THREADS_OP_WRITE or IO_THREADS_OP_READ. */
+
+    /* Polls of pending before parking, between IO_THREADS_SPIN_MIN and
+     * io-threads-spin: doubled when work comes while spinning, halved when
+     * the thread had to park. Then the time spent each way, for INFO. */
+    _Atomic int spin_budget;
+    _Atomic long long spin_usec;
+    _Atomic long long parked_usec;
+    _Atomic long long parks;
+
+    /* This is the list of clients the thread will serve when threaded I/O
+     * is used. We spawn io_threads_num-1 threads, since one is the main
+     * thread itself. */
+    list clients;
+} __attribute__((aligned(IO_THREADS_STATE_ALIGN))) ioThreadState;
 
 pthread_t io_threads[IO_THREADS_MAX_NUM];
-pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
-_Atomic unsigned long io_threads_pending[IO_THREADS_MAX_NUM];
+ioThreadState io_threads_state[IO_THREADS_MAX_NUM];
 int io_threads_active;  /* Are the threads currently spinning waiting I/O? */
-int io_threads_op;      /* IO_THREADS_OP_WRITE or IO_THREADS_OP_READ. */
-
-/* This is the list of clients each thread will serve when threaded I/O is
- * used. We spawn io_threads_num-1 threads, since one is the main thread
- * itself. */
-list *io_threads_list[IO_THREADS_MAX_NUM];
 
 void *IOThreadMain(void *myid) {
     /* The ID is the thread number (from 0 to server.iothreads_num-1), and is
      * used by the thread to just manipulate a single sub-array of clients. */
     long id = (unsigned long)myid;
+    ioThreadState *t = &io_threads_state[id];
+    int rc;
+
+    /* Move to the node of the I/O threads, before touching any client. */
+    if (server.io_threads_node != -1) {
+        rc = migrate(server.io_threads_node,NULL,NULL);
+        if (rc != 0 && rc != EBUSY)
+            serverLog(LL_WARNING,"I/O thread %ld can't migrate to node %d "
+                "(error %d), it stays on this node.",
+                id, server.io_threads_node, rc);
+    }
 
+    t->spin_budget = server.io_threads_spin;
     while(1) {
-        /* Wait for start */
-        for (int j = 0; j < 1000000; j++) {
-            if (io_threads_pending[id] != 0) break;
+        /* Wait for start: poll for a while, then park. */
+        long long start = ustime(), budget = t->spin_budget;
+        for (int j = 0; j < budget; j++) {
+            if (t->pending != 0) break;
         }
+        t->spin_usec += ustime()-start;
 
-        /* Give the main thread a chance to stop this thread. */
-        if (io_threads_pending[id] == 0) {
-            pthread_mutex_lock(&io_threads_mutex[id]);
-            pthread_mutex_unlock(&io_threads_mutex[id]);
-            continue;
+        if (t->pending != 0) {
+            budget *= 2;
+        } else {
+            /* The main thread checks 'parked' after setting 'pending', and
+             * holds the mutex while this thread is stopped. */
+            start = ustime();
+            pthread_mutex_lock(&t->mutex);
+            t->parked = 1;
+            while (t->pending == 0) pthread_cond_wait(&t->cond,&t->mutex);
+            t->parked = 0;
+            pthread_mutex_unlock(&t->mutex);
+            t->parked_usec += ustime()-start;
+            t->parks++;
+            budget /= 2;
         }
+        if (budget < IO_THREADS_SPIN_MIN) budget = IO_THREADS_SPIN_MIN;
+        if (budget > server.io_threads_spin) budget = server.io_threads_spin;
+        t->spin_budget = budget;
 
-        serverAssert(io_threads_pending[id] != 0);
+        serverAssert(t->pending != 0);
 
-        if (tio_debug) printf("[%ld] %d to handle\n", id, (int)listLength(io_threads_list[id]));
+        if (tio_debug) printf("[%ld] %d to handle\n", id, (int)listLength(&t->clients));
 
         /* Process: note that the main thread will never touch our list
-         * before we drop the pending count to 0. */
+         * before we drop the pending count to 0. It empties the list then,
+         * freeing the nodes where it allocated them. */
         listIter li;
         listNode *ln;
-        listRewind(io_threads_list[id],&li);
+        listRewind(&t->clients,&li);
         while((ln = listNext(&li))) {
             client *c = listNodeValue(ln);
-            if (io_threads_op == IO_THREADS_OP_WRITE) {
+            if (t->op == IO_THREADS_OP_WRITE) {
                 writeToClient(c,0);
-            } else if (io_threads_op == IO_THREADS_OP_READ) {
+            } else if (t->op == IO_THREADS_OP_READ) {
                 readQueryFromClient(c->conn);
             } else {
-                serverPanic("io_threads_op value is unknown");
+                serverPanic("I/O thread op value is unknown");
             }
         }
-        listEmpty(io_threads_list[id]);
-        io_threads_pending[id] = 0;
+        t->pending = 0;
 
         if (tio_debug) printf("[%ld] Done\n", id);
     }
@@ -2838,20 +2990,53 @@ void initThreadedIO(void) {
     /* Spawn and initialize the I/O threads. */
     for (int i = 0; i < server.io_threads_num; i++) {
         /* Things we do for all the threads including the main thread. */
-        io_threads_list[i] = listCreate();
+        memset(&io_threads_state[i].clients,0,sizeof(list));
         if (i == 0) continue; /* Thread 0 is the main thread. */
 
         /* Things we do only for the additional threads. */
         pthread_t tid;
-        pthread_mutex_init(&io_threads_mutex[i],NULL);
-        io_threads_pending[i] = 0;
-        pthread_mutex_lock(&io_threads_mutex[i]); /* Thread will be stopped. */
+        pthread_mutex_init(&io_threads_state[i].mutex,NULL);
+        pthread_cond_init(&io_threads_state[i].cond,NULL);
+        io_threads_state[i].pending = 0;
+        pthread_mutex_lock(&io_threads_state[i].mutex); /* Thread will be stopped. */
         if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)i) != 0) {
             serverLog(LL_WARNING,"Fatal: Can't initialize IO thread.");
             exit(1);
         }
         io_threads[i] = tid;
     }
+    if (server.io_threads_node != -1)
+        serverLog(LL_NOTICE,"I/O threads migrating to node %d.",
+            server.io_threads_node);
+}
+
+/* Give the I/O thread 't' its pending count, waking it up if it parked. */
+static void setIOThreadPending(ioThreadState *t, int op, unsigned long count) {
+    t->op = op;
+    t->pending = count;
+    if (count && t->parked) {
+        pthread_mutex_lock(&t->mutex);
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&t->mutex);
+    }
+}
+
+/* The "iothreads" section of INFO. The parked time of a thread parked now
+ * is added when it wakes up. */
+sds genIOThreadsInfoString(sds info) {
+    info = sdscatprintf(info,
+        "io_threads_active:%d\r\n"
+        "io_threads_spin:%d\r\n",
+        io_threads_active, server.io_threads_spin);
+    for (int j = 1; j < server.io_threads_num; j++) {
+        ioThreadState *t = &io_threads_state[j];
+        info = sdscatprintf(info,
+            "io_thread_%d:spin_usec=%lld,parked_usec=%lld,parks=%lld,"
+            "spin_budget=%d,parked=%d\r\n",
+            j, (long long)t->spin_usec, (long long)t->parked_usec,
+            (long long)t->parks, (int)t->spin_budget, (int)t->parked);
+    }
+    return info;
 }
 
 void startThreadedIO(void) {
@@ -2859,7 +3044,7 @@ void startThreadedIO(void) {
     if (tio_debug) printf("--- STARTING THREADED IO ---\n");
     serverAssert(io_threads_active == 0);
     for (int j = 1; j < server.io_threads_num; j++)
-        pthread_mutex_unlock(&io_threads_mutex[j]);
+        pthread_mutex_unlock(&io_threads_state[j].mutex);
     io_threads_active = 1;
 }
 
@@ -2873,7 +3058,7 @@ void stopThreadedIO(void) {
         (int) listLength(server.clients_pending_write));
     serverAssert(io_threads_active == 1);
     for (int j = 1; j < server.io_threads_num; j++)
-        pthread_mutex_lock(&io_threads_mutex[j]);
+        pthread_mutex_lock(&io_threads_state[j].mutex);
     io_threads_active = 0;
 }
 
@@ -2924,33 +3109,34 @@ int handleClientsWithPendingWritesUsingThreads(void) {
         client *c = listNodeValue(ln);
         c->flags &= ~CLIENT_PENDING_WRITE;
         int target_id = item_id % server.io_threads_num;
-        listAddNodeTail(io_threads_list[target_id],c);
+        listAddNodeTail(&io_threads_state[target_id].clients,c);
         item_id++;
     }
 
     /* Give the start condition to the waiting threads, by setting the
      * start condition atomic var. */
-    io_threads_op = IO_THREADS_OP_WRITE;
     for (int j = 1; j < server.io_threads_num; j++) {
-        int count = listLength(io_threads_list[j]);
-        io_threads_pending[j] = count;
+        int count = listLength(&io_threads_state[j].clients);
+        setIOThreadPending(&io_threads_state[j],IO_THREADS_OP_WRITE,count);
     }
 
     /* Also use the main thread to process a slice of clients. */
-    listRewind(io_threads_list[0],&li);
+    listRewind(&io_threads_state[0].clients,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
         writeToClient(c,0);
     }
-    listEmpty(io_threads_list[0]);
+    listEmpty(&io_threads_state[0].clients);
 
     /* Wait for all the other threads to end their work. */
     while(1) {
         unsigned long pending = 0;
         for (int j = 1; j < server.io_threads_num; j++)
-            pending += io_threads_pending[j];
+            pending += io_threads_state[j].pending;
         if (pending == 0) break;
     }
+    for (int j = 1; j < server.io_threads_num; j++)
+        listEmpty(&io_threads_state[j].clients);
     if (tio_debug) printf("I/O WRITE All threads finshed\n");
 
     /* Run the list of clients again to install the write handler where
@@ -3010,44 +3196,43 @@ int handleClientsWithPendingReadsUsingThreads(void) {
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
         int target_id = item_id % server.io_threads_num;
-        listAddNodeTail(io_threads_list[target_id],c);
+        listAddNodeTail(&io_threads_state[target_id].clients,c);
         item_id++;
     }
 
     /* Give the start condition to the waiting threads, by setting the
      * start condition atomic var. */
-    io_threads_op = IO_THREADS_OP_READ;
     for (int j = 1; j < server.io_threads_num; j++) {
-        int count = listLength(io_threads_list[j]);
-        io_threads_pending[j] = count;
+        int count = listLength(&io_threads_state[j].clients);
+        setIOThreadPending(&io_threads_state[j],IO_THREADS_OP_READ,count);
     }
 
     /* Also use the main thread to process a slice of clients. */
-    listRewind(io_threads_list[0],&li);
+    listRewind(&io_threads_state[0].clients,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
         readQueryFromClient(c->conn);
     }
-    listEmpty(io_threads_list[0]);
+    listEmpty(&io_threads_state[0].clients);
 
     /* Wait for all the other threads to end their work. */
     while(1) {
         unsigned long pending = 0;
         for (int j = 1; j < server.io_threads_num; j++)
-            pending += io_threads_pending[j];
+            pending += io_threads_state[j].pending;
         if (pending == 0) break;
     }
+    for (int j = 1; j < server.io_threads_num; j++)
+        listEmpty(&io_threads_state[j].clients);
     if (tio_debug) printf("I/O READ All threads finshed\n");
 
     /* Run the list of clients again to process the new buffers. */
     listRewind(server.clients_pending_read,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
-        c->flags &= ~CLIENT_PENDING_READ;
-        if (c->flags & CLIENT_PENDING_COMMAND) {
-            c->flags &= ~ CLIENT_PENDING_COMMAND;
-            processCommandAndResetClient(c);
-        }
+        c->flags &= ~(CLIENT_PENDING_READ|CLIENT_PENDING_COMMAND);
+        /* Run the commands the threads queued, then whatever is left in
+         * the query buffer. */
         processInputBufferAndReplicate(c);
     }
     listEmpty(server.clients_pending_read);
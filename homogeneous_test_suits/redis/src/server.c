@@ -2132,8 +2132,10 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     if (listLength(server.unblocked_clients))
         processUnblockedClients();
 
-    /* Send the invalidation messages to clients participating to the
-     * client side caching protocol in broadcasting (BCAST) mode. */
+    /* Send the invalidation messages queued in this iteration to clients
+     * participating to the client side caching protocol, one message per
+     * client, and then to the clients in broadcasting (BCAST) mode. */
+    trackingHandlePendingInvalidations();
     trackingBroadcastInvalidationMessages();
 
     /* Write the AOF buffer on disk */
@@ -2686,6 +2688,7 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_io_parsed_commands = 0;
     server.aof_delayed_fsync = 0;
 }
 
@@ -4238,7 +4241,8 @@ sds genRedisInfoString(const char *section) {
             "active_defrag_key_hits:%lld\r\n"
             "active_defrag_key_misses:%lld\r\n"
             "tracking_total_keys:%lld\r\n"
-            "tracking_total_items:%lld\r\n",
+            "tracking_total_items:%lld\r\n"
+            "io_threaded_parsed_commands:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -4267,7 +4271,8 @@ sds genRedisInfoString(const char *section) {
             server.stat_active_defrag_key_hits,
             server.stat_active_defrag_key_misses,
             (unsigned long long) trackingGetTotalKeys(),
-            (unsigned long long) trackingGetTotalItems());
+            (unsigned long long) trackingGetTotalItems(),
+            server.stat_io_parsed_commands);
     }
 
     /* Replication */
@@ -4413,6 +4418,13 @@ sds genRedisInfoString(const char *section) {
         (long)c_ru.ru_utime.tv_sec, (long)c_ru.ru_utime.tv_usec);
     }
 
+    /* I/O threads */
+    if (allsections || defsections || !strcasecmp(section,"iothreads")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,"# IOThreads\r\n");
+        info = genIOThreadsInfoString(info);
+    }
+
     /* Modules */
     if (allsections || defsections || !strcasecmp(section,"modules")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -139,6 +139,8 @@ typedef long long ustime_t; /* microsecond time type. */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_QUEUED_CMDS_MAX   64   /* Max commands an I/O thread parses
+                                        ahead for a single client. */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define REDIS_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -243,7 +245,7 @@ typedef long long ustime_t; /* microsecond time type. */
 #define CLIENT_PENDING_COMMAND (1<<30) /* Used in threaded I/O to signal after
                                           we return single threaded that the
                                           client has already pending commands
-                                          to be executed. */
+                                          to be executed in c->cmdq. */
 #define CLIENT_TRACKING (1ULL<<31) /* Client enabled keys tracking in order to
                                    perform client side caching. */
 #define CLIENT_TRACKING_BROKEN_REDIR (1ULL<<32) /* Target client is invalid. */
@@ -756,6 +758,13 @@ typedef struct user {
                                       need more reserved IDs use UINT64_MAX-1,
                                       -2, ... and so forth. */
 
+/* A command parsed by an I/O thread, waiting in the client queue to be
+ * executed by the main thread. */
+typedef struct clientQueuedCommand {
+    int argc;
+    robj **argv;
+} clientQueuedCommand;
+
 typedef struct client {
     uint64_t id;            /* Client incremental unique ID. */
     connection *conn;
@@ -771,6 +780,10 @@ typedef struct client {
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size. */
     int argc;               /* Num of arguments of current command. */
     robj **argv;            /* Arguments of current command. */
+    clientQueuedCommand *cmdq; /* Commands parsed by I/O threads, to run. */
+    int cmdq_pos;           /* Next command to run in cmdq. */
+    int cmdq_len;           /* Commands in cmdq, including the run ones. */
+    int cmdq_size;          /* Allocated entries of cmdq. */
     struct redisCommand *cmd, *lastcmd;  /* Last command executed. */
     user *user;             /* User associated with this connection. If the
                                user is set to NULL the connection can do
@@ -1079,6 +1092,8 @@ struct redisServer {
                                    queries. Will still serve RESP2 queries. */
     int io_threads_num;         /* Number of IO threads to use. */
     int io_threads_do_reads;    /* Read and parse from IO threads? */
+    int io_threads_node;        /* Node the IO threads migrate to, or -1. */
+    int io_threads_spin;        /* Max polls of an idle IO thread, then park. */
 
     /* RDB / AOF loading information */
     int loading;                /* We are loading data from disk if true */
@@ -1121,6 +1136,7 @@ struct redisServer {
     unsigned long slowlog_max_len;     /* SLOWLOG max number of items logged */
     struct malloc_stats cron_malloc_stats; /* sampled in serverCron(). */
     _Atomic long long stat_net_input_bytes; /* Bytes read from network. */
+    long long stat_io_parsed_commands; /* Commands parsed by I/O threads. */
     _Atomic long long stat_net_output_bytes; /* Bytes written to network. */
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
@@ -1644,6 +1660,7 @@ void linkClient(client *c);
 void protectClient(client *c);
 void unprotectClient(client *c);
 void initThreadedIO(void);
+sds genIOThreadsInfoString(sds info);
 client *lookupClientByID(uint64_t id);
 
 #ifdef __GNUC__
@@ -1666,6 +1683,7 @@ void trackingLimitUsedSlots(void);
 uint64_t trackingGetTotalItems(void);
 uint64_t trackingGetTotalKeys(void);
 void trackingBroadcastInvalidationMessages(void);
+void trackingHandlePendingInvalidations(void);
 
 /* List data type */
 void listTypeTryConversion(robj *subject, robj *value);
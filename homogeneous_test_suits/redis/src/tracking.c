@@ -49,6 +49,42 @@ uint64_t TrackingTableTotalItems = 0; /* Total number of IDs stored across
                                          are using server side for CSC. */
 robj *TrackingChannelName;
 
+/* This is the structure that we have as value of the TrackingTable: the set
+ * of the IDs of the clients that may have a given key in their cache.
+ *
+ * While a key is read by a few clients the IDs are kept in a radix tree.
+ * Hot keys can be read by most of the clients, and since client IDs are
+ * given in connection order they are then dense: once TRACKING_BITMAP_MIN_IDS
+ * clients share a key, and the IDs are at most TRACKING_BITMAP_MAX_SPARSITY
+ * bits apart on average, the set moves to a bitmap with one bit per ID
+ * starting at 'base'. A key tracked by 100k clients then takes about 12k
+ * bytes instead of a radix tree node per client. A bitmap that would get
+ * sparser than that while growing goes back to a radix tree. */
+#define TRACKING_BITMAP_MIN_IDS 256
+#define TRACKING_BITMAP_MAX_SPARSITY 64
+
+typedef struct trackingIds {
+    uint64_t count;     /* Number of IDs in the set. */
+    rax *rt;            /* The IDs, or NULL if they are in the bitmap. */
+    uint64_t base;      /* ID of the first bit, a multiple of 64. */
+    uint64_t *bits;     /* Bitmap, 'words' 64 bit words. */
+    size_t words;
+} trackingIds;
+
+/* Invalidation messages for the clients in default (not BCAST) mode are
+ * not sent as soon as a key is modified: the keys are queued per client in
+ * this table, keyed by client ID like the tracking table, and each client
+ * gets all of them in a single push message per event loop iteration, from
+ * trackingHandlePendingInvalidations() in beforeSleep(). A write to a key
+ * cached by many clients then costs an append per client instead of a
+ * reply per client per key. A client freed in the meantime is skipped. */
+rax *TrackingPendingTable = NULL;
+
+typedef struct pendingInvalidation {
+    uint64_t numkeys;   /* Keys queued for the client. */
+    sds proto;          /* The keys, as RESP bulk strings. */
+} pendingInvalidation;
+
 /* This is the structure that we have as value of the PrefixTable, and
  * represents the list of keys modified, and the list of clients that need
  * to be notified, for a given prefix. */
@@ -58,6 +94,119 @@ typedef struct bcastState {
                        prefix. */
 } bcastState;
 
+/* Create an empty set of client IDs. */
+trackingIds *trackingIdsCreate(void) {
+    trackingIds *ti = zcalloc(sizeof(*ti));
+    ti->rt = raxNew();
+    return ti;
+}
+
+void trackingIdsFree(trackingIds *ti) {
+    if (ti->rt) raxFree(ti->rt);
+    zfree(ti->bits);
+    zfree(ti);
+}
+
+/* Callback of raxFreeWithCallback() for the tracking table. */
+void freeTrackingIds(void *ti) {
+    trackingIdsFree(ti);
+}
+
+/* Move the IDs of 'ti' from the radix tree to a bitmap, if they are dense
+ * enough. */
+void trackingIdsToBitmap(trackingIds *ti) {
+    uint64_t min = UINT64_MAX, max = 0, id;
+    raxIterator ri;
+
+    raxStart(&ri,ti->rt);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        memcpy(&id,ri.key,sizeof(id));
+        if (id < min) min = id;
+        if (id > max) max = id;
+    }
+    min &= ~63ULL;
+    if (max - min + 1 > ti->count * TRACKING_BITMAP_MAX_SPARSITY) {
+        raxStop(&ri);
+        return;
+    }
+
+    ti->base = min;
+    ti->words = (max - min) / 64 + 1;
+    ti->bits = zcalloc(ti->words * sizeof(uint64_t));
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        memcpy(&id,ri.key,sizeof(id));
+        id -= ti->base;
+        ti->bits[id / 64] |= 1ULL << (id % 64);
+    }
+    raxStop(&ri);
+    raxFree(ti->rt);
+    ti->rt = NULL;
+}
+
+/* Move the IDs of 'ti' from the bitmap back to a radix tree. */
+void trackingIdsToRax(trackingIds *ti) {
+    ti->rt = raxNew();
+    for (size_t w = 0; w < ti->words; w++) {
+        uint64_t word = ti->bits[w];
+        while (word) {
+            uint64_t id = ti->base + w * 64 + __builtin_ctzll(word);
+            raxInsert(ti->rt,(unsigned char*)&id,sizeof(id),NULL,NULL);
+            word &= word - 1;
+        }
+    }
+    zfree(ti->bits);
+    ti->bits = NULL;
+    ti->words = 0;
+}
+
+/* Add 'id' to the set. Returns 1 if it was added, 0 if it was already
+ * there. */
+int trackingIdsAdd(trackingIds *ti, uint64_t id) {
+    if (ti->bits) {
+        uint64_t end = ti->base + ti->words * 64;
+        if (id < ti->base || id >= end) {
+            /* Grow the bitmap to cover 'id', with some room at the end
+             * since new clients get higher IDs. */
+            uint64_t base = id < ti->base ? id & ~63ULL : ti->base;
+            if (id >= end) {
+                end = (id | 63) + 1;
+                end += (end - base) / 4 & ~63ULL;
+            }
+            if (end - base > (ti->count + 1) * TRACKING_BITMAP_MAX_SPARSITY) {
+                trackingIdsToRax(ti);
+                return trackingIdsAdd(ti,id);
+            }
+            size_t words = (end - base) / 64;
+            uint64_t *bits = zcalloc(words * sizeof(uint64_t));
+            memcpy(bits + (ti->base - base) / 64,ti->bits,
+                   ti->words * sizeof(uint64_t));
+            zfree(ti->bits);
+            ti->bits = bits;
+            ti->words = words;
+            ti->base = base;
+        }
+        id -= ti->base;
+        if (ti->bits[id / 64] & (1ULL << (id % 64))) return 0;
+        ti->bits[id / 64] |= 1ULL << (id % 64);
+        ti->count++;
+        return 1;
+    }
+
+    if (!raxTryInsert(ti->rt,(unsigned char*)&id,sizeof(id),NULL,NULL))
+        return 0;
+    ti->count++;
+    /* Try the bitmap at TRACKING_BITMAP_MIN_IDS, then every time the set
+     * doubles, so that a sparse set does not pay the scan at every ID. */
+    if (ti->count >= TRACKING_BITMAP_MIN_IDS &&
+        (ti->count & (ti->count - 1)) == 0)
+    {
+        trackingIdsToBitmap(ti);
+    }
+    return 1;
+}
+
 /* Remove the tracking state from the client 'c'. Note that there is not much
  * to do for us here, if not to decrement the counter of the clients in
  * tracking mode, because we just store the ID of the client in the tracking
@@ -133,6 +282,7 @@ void enableTracking(client *c, uint64_t redirect_to, uint64_t options, robj **pr
     c->client_tracking_redirection = redirect_to;
     if (TrackingTable == NULL) {
         TrackingTable = raxNew();
+        TrackingPendingTable = raxNew();
         PrefixTable = raxNew();
         TrackingChannelName = createStringObject("__redis__:invalidate",20);
     }
@@ -169,15 +319,15 @@ void trackingRememberKeys(client *c) {
     for(int j = 0; j < numkeys; j++) {
         int idx = keys[j];
         sds sdskey = c->argv[idx]->ptr;
-        rax *ids = raxFind(TrackingTable,(unsigned char*)sdskey,sdslen(sdskey));
+        trackingIds *ids = raxFind(TrackingTable,(unsigned char*)sdskey,
+                                   sdslen(sdskey));
         if (ids == raxNotFound) {
-            ids = raxNew();
+            ids = trackingIdsCreate();
             int inserted = raxTryInsert(TrackingTable,(unsigned char*)sdskey,
                                         sdslen(sdskey),ids, NULL);
             serverAssert(inserted == 1);
         }
-        if (raxTryInsert(ids,(unsigned char*)&c->id,sizeof(c->id),NULL,NULL))
-            TrackingTableTotalItems++;
+        if (trackingIdsAdd(ids,c->id)) TrackingTableTotalItems++;
     }
     getKeysFreeResult(keys);
 }
@@ -259,6 +409,42 @@ void trackingRememberKeyToBroadcast(char *keyname, size_t keylen) {
     raxStop(&ri);
 }
 
+/* Queue an invalidation message about the key for the client with the
+ * given ID, if it is still tracking keys in default mode. */
+void trackingQueueInvalidation(uint64_t id, char *keyname, size_t keylen) {
+    client *c = lookupClientByID(id);
+    /* Note that if the client is in BCAST mode, we don't want to
+     * send invalidation messages that were pending in the case
+     * previously the client was not in BCAST mode. This can happen if
+     * TRACKING is enabled normally, and then the client switches to
+     * BCAST mode. */
+    if (c == NULL ||
+        !(c->flags & CLIENT_TRACKING)||
+        c->flags & CLIENT_TRACKING_BCAST)
+    {
+        return;
+    }
+
+    pendingInvalidation *pi = raxFind(TrackingPendingTable,
+                                      (unsigned char*)&id,sizeof(id));
+    if (pi == raxNotFound) {
+        pi = zmalloc(sizeof(*pi));
+        pi->numkeys = 0;
+        pi->proto = sdsempty();
+        raxInsert(TrackingPendingTable,(unsigned char*)&id,sizeof(id),pi,NULL);
+    }
+
+    char buf[32];
+    size_t len = ll2string(buf,sizeof(buf),keylen);
+    pi->proto = sdsMakeRoomFor(pi->proto,len+keylen+5);
+    pi->proto = sdscatlen(pi->proto,"$",1);
+    pi->proto = sdscatlen(pi->proto,buf,len);
+    pi->proto = sdscatlen(pi->proto,"\r\n",2);
+    pi->proto = sdscatlen(pi->proto,keyname,keylen);
+    pi->proto = sdscatlen(pi->proto,"\r\n",2);
+    pi->numkeys++;
+}
+
 /* This function is called from signalModifiedKey() or other places in Redis
  * when a key changes value. In the context of keys tracking, our task here is
  * to send a notification to every client that may have keys about such caching
@@ -270,35 +456,35 @@ void trackingInvalidateKey(robj *keyobj) {
     if (raxSize(PrefixTable) > 0)
         trackingRememberKeyToBroadcast(sdskey,sdslen(sdskey));
 
-    rax *ids = raxFind(TrackingTable,(unsigned char*)sdskey,sdslen(sdskey));
-    if (ids == raxNotFound) return;;
+    trackingIds *ids = raxFind(TrackingTable,(unsigned char*)sdskey,
+                               sdslen(sdskey));
+    if (ids == raxNotFound) return;
 
-    raxIterator ri;
-    raxStart(&ri,ids);
-    raxSeek(&ri,"^",NULL,0);
-    while(raxNext(&ri)) {
-        uint64_t id;
-        memcpy(&id,ri.key,sizeof(id));
-        client *c = lookupClientByID(id);
-        /* Note that if the client is in BCAST mode, we don't want to
-         * send invalidation messages that were pending in the case
-         * previously the client was not in BCAST mode. This can happen if
-         * TRACKING is enabled normally, and then the client switches to
-         * BCAST mode. */
-        if (c == NULL ||
-            !(c->flags & CLIENT_TRACKING)||
-            c->flags & CLIENT_TRACKING_BCAST)
-        {
-            continue;
+    if (ids->rt) {
+        raxIterator ri;
+        raxStart(&ri,ids->rt);
+        raxSeek(&ri,"^",NULL,0);
+        while(raxNext(&ri)) {
+            uint64_t id;
+            memcpy(&id,ri.key,sizeof(id));
+            trackingQueueInvalidation(id,sdskey,sdslen(sdskey));
+        }
+        raxStop(&ri);
+    } else {
+        for (size_t w = 0; w < ids->words; w++) {
+            uint64_t word = ids->bits[w];
+            while (word) {
+                uint64_t id = ids->base + w * 64 + __builtin_ctzll(word);
+                trackingQueueInvalidation(id,sdskey,sdslen(sdskey));
+                word &= word - 1;
+            }
         }
-        sendTrackingMessage(c,sdskey,sdslen(sdskey),0);
     }
-    raxStop(&ri);
 
     /* Free the tracking table: we'll create the radix tree and populate it
      * again if more keys will be modified in this caching slot. */
-    TrackingTableTotalItems -= raxSize(ids);
-    raxFree(ids);
+    TrackingTableTotalItems -= ids->count;
+    trackingIdsFree(ids);
     raxRemove(TrackingTable,(unsigned char*)sdskey,sdslen(sdskey),NULL);
 }
 
@@ -309,10 +495,6 @@ void trackingInvalidateKey(robj *keyobj) {
  * key "", which means, "all the keys", in order to avoid flooding clients
  * with many invalidation messages for all the keys they may hold.
  */
-void freeTrackingRadixTree(void *rt) {
-    raxFree(rt);
-}
-
 void trackingInvalidateKeysOnFlush(int dbid) {
     if (server.tracking_clients) {
         listNode *ln;
@@ -328,7 +510,7 @@ void trackingInvalidateKeysOnFlush(int dbid) {
 
     /* In case of FLUSHALL, reclaim all the memory used by tracking. */
     if (dbid == -1 && TrackingTable) {
-        raxFreeWithCallback(TrackingTable,freeTrackingRadixTree);
+        raxFreeWithCallback(TrackingTable,freeTrackingIds);
         TrackingTable = raxNew();
         TrackingTableTotalItems = 0;
     }
@@ -366,9 +548,9 @@ void trackingLimitUsedSlots(void) {
         effort--;
         raxSeek(&ri,"^",NULL,0);
         raxRandomWalk(&ri,0);
-        rax *ids = ri.data;
-        TrackingTableTotalItems -= raxSize(ids);
-        raxFree(ids);
+        trackingIds *ids = ri.data;
+        TrackingTableTotalItems -= ids->count;
+        trackingIdsFree(ids);
         raxRemove(TrackingTable,ri.key,ri.key_len,NULL);
         if (raxSize(TrackingTable) <= max_keys) {
             timeout_counter = 0;
@@ -383,6 +565,42 @@ void trackingLimitUsedSlots(void) {
     timeout_counter++;
 }
 
+/* Send every client the invalidation messages queued for it by
+ * trackingInvalidateKey() in this event loop iteration, as a single
+ * array of keys. */
+void trackingHandlePendingInvalidations(void) {
+    if (TrackingPendingTable == NULL || raxSize(TrackingPendingTable) == 0)
+        return;
+
+    raxIterator ri;
+    raxStart(&ri,TrackingPendingTable);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        pendingInvalidation *pi = ri.data;
+        uint64_t id;
+        memcpy(&id,ri.key,sizeof(id));
+        client *c = lookupClientByID(id);
+        if (c && c->flags & CLIENT_TRACKING &&
+            !(c->flags & CLIENT_TRACKING_BCAST))
+        {
+            char buf[32];
+            size_t len = ll2string(buf,sizeof(buf),pi->numkeys);
+            sds proto = sdsMakeRoomFor(sdsempty(),len+3+sdslen(pi->proto));
+            proto = sdscatlen(proto,"*",1);
+            proto = sdscatlen(proto,buf,len);
+            proto = sdscatlen(proto,"\r\n",2);
+            proto = sdscatsds(proto,pi->proto);
+            sendTrackingMessage(c,proto,sdslen(proto),1);
+            sdsfree(proto);
+        }
+        sdsfree(pi->proto);
+        zfree(pi);
+    }
+    raxStop(&ri);
+    raxFree(TrackingPendingTable);
+    TrackingPendingTable = raxNew();
+}
+
 /* This function will run the prefixes of clients in BCAST mode and
  * keys that were modified about each prefix, and will send the
  * notifications to each client in each prefix. */
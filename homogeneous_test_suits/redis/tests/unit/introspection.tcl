@@ -79,6 +79,7 @@ start_server {tags {"introspection"}} {
             databases
             port
             io-threads
+            io-threads-node
             tls-port
             tls-prefer-server-ciphers
             tls-cert-file
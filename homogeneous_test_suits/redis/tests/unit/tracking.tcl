@@ -21,6 +21,47 @@ start_server {tags {"tracking"}} {
         assert {[lindex $keys 0] eq {a}}
     }
 
+    test {Invalidations of the same iteration are sent in one message} {
+        r MGET x y z
+        r MULTI
+        r INCR x
+        r INCR y
+        r INCR z
+        r EXEC
+        set keys [lsort [lindex [$rd1 read] 2]]
+        assert {$keys eq {x y z}}
+    }
+
+    test {Keys read by many clients are invalidated for each of them} {
+        set clients {}
+        for {set j 0} {$j < 600} {incr j} {
+            set rd [redis_deferring_client]
+            $rd CLIENT TRACKING on REDIRECT $redir
+            $rd GET hot
+            $rd read
+            $rd read
+            lappend clients $rd
+        }
+        # One more client after a gap of IDs, and one that goes away.
+        for {set j 0} {$j < 100} {incr j} {
+            [redis_deferring_client] close
+        }
+        set rd [redis_deferring_client]
+        $rd CLIENT TRACKING on REDIRECT $redir
+        $rd GET hot
+        $rd read
+        $rd read
+        lappend clients $rd
+        [lindex $clients 0] close
+        set clients [lrange $clients 1 end]
+        assert {[s tracking_total_items] >= 601}
+        r INCR hot
+        for {set j 0} {$j < 600} {incr j} {
+            assert {[lindex [$rd1 read] 2] eq {hot}}
+        }
+        foreach rd $clients {$rd close}
+    }
+
     test {The client is now able to disable tracking} {
         # Make sure to add a few more keys in the tracking list
         # so that we can check for leaks, as a side effect.
@@ -0,0 +1,230 @@
+/*
+ * popcorn_arena.h - page aligned, node partitioned allocations.
+ *
+ * On Popcorn memory is kept coherent page by page, so two threads running
+ * on different nodes and writing to the same page bounce it between the
+ * nodes even if they never touch the same bytes. The allocator below keeps
+ * one arena per node: every chunk it hands out is page aligned and rounded
+ * to whole pages, and belongs to the arena of the node that is expected to
+ * write it. Chunks of different nodes never share a page.
+ *
+ *     sum = popcorn_node_malloc(sizeof(int) * dim, targ->nid);
+ *
+ * Allocate (and first touch) a chunk while running on its node: pages are
+ * only mapped in at the first access, on the node doing it.
+ *
+ * The arenas only grow. popcorn_node_free() returns nothing to the system,
+ * it just keeps the statistics; the benchmarks allocate their data once at
+ * startup. Large arrays that several nodes write to, each to its own slice,
+ * can be split with popcorn_partition() so that the slices of different
+ * nodes start on page boundaries.
+ *
+ * With $POPCORN_HUGE set (see popcorn_huge.h), the arenas reserve whole,
+ * aligned 2MB pages; chunks are still 4KB aligned, and the pages of an
+ * arena are still those of a single node.
+ *
+ * Exactly one translation unit of the program has to define
+ * POPCORN_RT_IMPLEMENTATION before including this file.
+ */
+
+#ifndef _POPCORN_ARENA_H_
+#define _POPCORN_ARENA_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <migrate.h>
+#include "popcorn_huge.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Granularity used by the arenas to reserve memory from the system. */
+#ifndef POPCORN_ARENA_RESERVE
+#define POPCORN_ARENA_RESERVE (4 * 1024 * 1024)
+#endif
+
+struct popcorn_arena_stats {
+    int nid;
+    unsigned long long allocs;          /* Chunks handed out. */
+    unsigned long long frees;           /* Chunks given back. */
+    unsigned long long bytes;           /* Bytes requested. */
+    unsigned long long pages;           /* Pages handed out. */
+    unsigned long long reserved;        /* Bytes mapped from the system. */
+    unsigned long long remote_allocs;   /* Allocated from another node. */
+};
+
+void *popcorn_node_malloc(size_t size, int nid);
+void *popcorn_node_calloc(size_t nmemb, size_t size, int nid);
+void popcorn_node_free(void *ptr);
+int popcorn_arena_stats(int nid, struct popcorn_arena_stats *stats);
+void popcorn_arena_dump(FILE *fp);
+
+/* Split 'n' elements of 'size' bytes in 'parts' consecutive slices and
+ * return in '*start' and '*count' the slice 'idx'. Slices start on a page
+ * boundary whenever the array (assumed page aligned) is large enough to give
+ * at least one page to each slice, otherwise the split is just even. */
+static inline void popcorn_partition(size_t n, size_t size, int parts, int idx,
+                                     size_t *start, size_t *count) {
+    size_t per_page = size < PAGE_SIZE ? PAGE_SIZE / size : 1;
+    size_t nparts = (size_t)parts, i = (size_t)idx;
+    size_t units, base, extra, first, last;
+
+    if (per_page > 1 && n >= per_page * nparts) {
+        /* Distribute whole pages and give the tail to the last slice. */
+        units = n / per_page;
+        base = units / nparts;
+        extra = units % nparts;
+        first = (base * i + (i < extra ? i : extra)) * per_page;
+        last = first + (base + (i < extra)) * per_page;
+        if (i == nparts - 1) last = n;
+    } else {
+        base = n / nparts;
+        extra = n % nparts;
+        first = base * i + (i < extra ? i : extra);
+        last = first + base + (i < extra);
+    }
+    *start = first;
+    *count = last - first;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POPCORN_ARENA_H_ */
+
+
+#if defined(POPCORN_RT_IMPLEMENTATION) && !defined(_POPCORN_ARENA_IMPLEMENTED_)
+#define _POPCORN_ARENA_IMPLEMENTED_
+
+#include <stdint.h>
+#include <string.h>
+
+/* A reservation is carved from the bottom; its header lives on its own
+ * page at the start so that chunks never share a page with it. */
+struct popcorn_arena_block {
+    struct popcorn_arena_block *next;
+    size_t size;
+    char *cur;
+    char *end;
+};
+
+struct popcorn_arena {
+    int lock;
+    struct popcorn_arena_block *blocks;
+    struct popcorn_arena_stats stats;
+};
+
+static struct popcorn_arena popcorn_arenas[MAX_POPCORN_NODES];
+
+static void popcorn_arena_lock(struct popcorn_arena *a) {
+    while (__atomic_exchange_n(&a->lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&a->lock, __ATOMIC_RELAXED));
+}
+
+static void popcorn_arena_unlock(struct popcorn_arena *a) {
+    __atomic_store_n(&a->lock, 0, __ATOMIC_RELEASE);
+}
+
+static struct popcorn_arena_block *popcorn_arena_reserve(
+        struct popcorn_arena *a, size_t pages) {
+    struct popcorn_arena_block *b;
+    size_t size = (pages + 1) * PAGE_SIZE;
+
+    if (size < POPCORN_ARENA_RESERVE) size = POPCORN_ARENA_RESERVE;
+    if (popcorn_huge_mode() != POPCORN_HUGE_OFF)
+        size = (size + POPCORN_HUGE_SIZE - 1) & ~(POPCORN_HUGE_SIZE - 1);
+    b = popcorn_huge_map(size);
+    if (b == NULL) return NULL;
+
+    b->size = size;
+    b->cur = (char *)b + PAGE_SIZE;
+    b->end = (char *)b + size;
+    b->next = a->blocks;
+    a->blocks = b;
+    a->stats.reserved += size;
+    return b;
+}
+
+void *popcorn_node_malloc(size_t size, int nid) {
+    struct popcorn_arena *a;
+    struct popcorn_arena_block *b;
+    size_t pages;
+    int cur;
+    char *p = NULL;
+
+    if (nid < 0 || nid >= MAX_POPCORN_NODES) return NULL;
+    if (size == 0) size = 1;
+    pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    a = &popcorn_arenas[nid];
+    cur = popcorn_current_nid();
+
+    popcorn_arena_lock(a);
+    for (b = a->blocks; b; b = b->next)
+        if ((size_t)(b->end - b->cur) >= pages * PAGE_SIZE) break;
+    if (b == NULL) b = popcorn_arena_reserve(a, pages);
+    if (b) {
+        p = b->cur;
+        b->cur += pages * PAGE_SIZE;
+        a->stats.allocs++;
+        a->stats.bytes += size;
+        a->stats.pages += pages;
+        if (cur >= 0 && cur != nid) a->stats.remote_allocs++;
+    }
+    popcorn_arena_unlock(a);
+    return p;
+}
+
+void *popcorn_node_calloc(size_t nmemb, size_t size, int nid) {
+    void *p;
+
+    if (size && nmemb > SIZE_MAX / size) return NULL;
+    p = popcorn_node_malloc(nmemb * size, nid);
+    if (p) memset(p, 0, nmemb * size);
+    return p;
+}
+
+void popcorn_node_free(void *ptr) {
+    struct popcorn_arena_block *b;
+    int i;
+
+    if (ptr == NULL) return;
+    for (i = 0; i < MAX_POPCORN_NODES; i++) {
+        popcorn_arena_lock(&popcorn_arenas[i]);
+        for (b = popcorn_arenas[i].blocks; b; b = b->next) {
+            if ((char *)ptr >= (char *)b && (char *)ptr < b->end) {
+                popcorn_arenas[i].stats.frees++;
+                popcorn_arena_unlock(&popcorn_arenas[i]);
+                return;
+            }
+        }
+        popcorn_arena_unlock(&popcorn_arenas[i]);
+    }
+}
+
+int popcorn_arena_stats(int nid, struct popcorn_arena_stats *stats) {
+    if (nid < 0 || nid >= MAX_POPCORN_NODES) return -1;
+    popcorn_arena_lock(&popcorn_arenas[nid]);
+    *stats = popcorn_arenas[nid].stats;
+    popcorn_arena_unlock(&popcorn_arenas[nid]);
+    stats->nid = nid;
+    return 0;
+}
+
+void popcorn_arena_dump(FILE *fp) {
+    struct popcorn_arena_stats st;
+    int i;
+
+    fprintf(fp, "node\tallocs\tfrees\tbytes\tpages\treserved\t"
+                "remote_allocs\n");
+    for (i = 0; i < MAX_POPCORN_NODES; i++) {
+        popcorn_arena_stats(i, &st);
+        if (st.allocs == 0 && st.reserved == 0) continue;
+        fprintf(fp, "%d\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n", st.nid,
+                st.allocs, st.frees, st.bytes, st.pages, st.reserved,
+                st.remote_allocs);
+    }
+}
+
+#endif /* POPCORN_RT_IMPLEMENTATION */
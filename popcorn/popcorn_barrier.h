@@ -0,0 +1,106 @@
+/*
+ * popcorn_barrier.h - barrier that synchronizes a node before crossing nodes.
+ *
+ * A pthread_barrier_t shared by threads on several nodes is one page that
+ * every arriving thread writes, so each wait bounces it between the nodes
+ * once per thread. popcorn_barrier keeps one pthread barrier per node, in
+ * that node's arena, and a top barrier that only one thread per node (the
+ * last to arrive there) waits on:
+ *
+ *     int threads[MAX_POPCORN_NODES] = { 0 };
+ *
+ *     for (i = 0; i < num_procs; i++) threads[arg[i].nid]++;
+ *     threads[0]++;
+ *     popcorn_barrier_init(&barr, threads);
+ *     ...
+ *     popcorn_barrier_wait(&barr, targ->nid);
+ *
+ * Here the main thread waits on node 0 too. A thread always waits in the
+ * group of the node it was counted on, even after it migrated elsewhere. As
+ * with pthread_barrier_wait(), one of the threads gets
+ * PTHREAD_BARRIER_SERIAL_THREAD back and the others 0.
+ */
+
+#ifndef _POPCORN_BARRIER_H_
+#define _POPCORN_BARRIER_H_
+
+#include <errno.h>
+#include <pthread.h>
+#include <migrate.h>
+#include "popcorn_arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct popcorn_barrier {
+    pthread_barrier_t *node[MAX_POPCORN_NODES]; /* NULL without threads. */
+    pthread_barrier_t top;
+    int nodes;                                  /* Nodes with threads. */
+};
+
+static inline void popcorn_barrier_destroy(struct popcorn_barrier *b) {
+    int i;
+
+    for (i = 0; i < MAX_POPCORN_NODES; i++) {
+        if (b->node[i] == NULL) continue;
+        pthread_barrier_destroy(b->node[i]);
+        popcorn_node_free(b->node[i]);
+        b->node[i] = NULL;
+    }
+    if (b->nodes > 1) pthread_barrier_destroy(&b->top);
+    b->nodes = 0;
+}
+
+/* 'threads' has the number of threads waiting in the group of each node.
+ * Returns 0, or an errno value. */
+static inline int popcorn_barrier_init(struct popcorn_barrier *b,
+                                       const int *threads) {
+    int i, rc;
+
+    b->nodes = 0;
+    for (i = 0; i < MAX_POPCORN_NODES; i++) {
+        b->node[i] = NULL;
+        if (threads[i] > 0) b->nodes++;
+    }
+    if (b->nodes == 0) return EINVAL;
+    if (b->nodes > 1 && (rc = pthread_barrier_init(&b->top, NULL, b->nodes))) {
+        b->nodes = 0;
+        return rc;
+    }
+
+    for (i = 0; i < MAX_POPCORN_NODES; i++) {
+        if (threads[i] <= 0) continue;
+        b->node[i] = (pthread_barrier_t *)popcorn_node_malloc(
+                sizeof(pthread_barrier_t), i);
+        rc = b->node[i] ? pthread_barrier_init(b->node[i], NULL, threads[i])
+                        : ENOMEM;
+        if (rc) {
+            popcorn_node_free(b->node[i]);
+            b->node[i] = NULL;
+            popcorn_barrier_destroy(b);
+            return rc;
+        }
+    }
+    return 0;
+}
+
+static inline int popcorn_barrier_wait(struct popcorn_barrier *b, int nid) {
+    pthread_barrier_t *local = b->node[nid];
+    int serial = 0;
+
+    if (b->nodes == 1) return pthread_barrier_wait(local);
+
+    /* The last thread of the node waits for the other nodes, the others for
+     * it to come back. */
+    if (pthread_barrier_wait(local) == PTHREAD_BARRIER_SERIAL_THREAD)
+        serial = pthread_barrier_wait(&b->top);
+    pthread_barrier_wait(local);
+    return serial;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POPCORN_BARRIER_H_ */
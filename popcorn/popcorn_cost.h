@@ -0,0 +1,164 @@
+/*
+ * popcorn_cost.h - measured cost of the Popcorn primitives.
+ *
+ * bench/popcornmicro measures migrate(), the page transfers of the DSM and
+ * barriers spanning nodes, and writes a cost model as tab separated lines:
+ *
+ *     # popcornmicro home=<nid> nodes=<nid>,...
+ *     primitive nid bytes threads n mean_ns p50_ns p99_ns
+ *
+ * with one line per primitive, remote node, working set and thread count:
+ *
+ *   migrate       a round trip from the home node to nid and back
+ *   fault_read    a page written at home, first read on nid
+ *   fault_write   a page written at home, first written on nid
+ *   fault_back    a page written on nid, written again at home
+ *   pingpong      a word written in turn at home and on nid, a round trip
+ *   false_share   a write at home while a thread on nid writes the word
+ *                 'bytes' away (on the same page below PAGE_SIZE)
+ *   barrier       a pthread_barrier_wait() of 'threads' threads, half of
+ *                 them on nid
+ *   barrier_node  a popcorn_barrier_wait() of the same threads
+ *
+ * The fault lines are per page, of a working set of 'bytes'. The migration
+ * policies read the model back with popcorn_cost_load(), from the file
+ * named by $POPCORN_COST when given no path, and look the primitives up
+ * with popcorn_cost(): the line of the node (of any node for
+ * POPCORN_COST_ANY, or when the node has none), with the closest thread
+ * count, and the mean interpolated between the two nearest working sets.
+ *
+ *     popcorn_cost_load(NULL);
+ *     usec = popcorn_cost("migrate", POPCORN_COST_ANY, 0, 1) / 2000;
+ *
+ * Exactly one translation unit of the program has to define
+ * POPCORN_RT_IMPLEMENTATION before including this file.
+ */
+
+#ifndef _POPCORN_COST_H_
+#define _POPCORN_COST_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Environment variable with the path of the model. */
+#define POPCORN_COST_ENV "POPCORN_COST"
+
+/* popcorn_cost() argument: a line of any node. */
+#define POPCORN_COST_ANY (-1)
+
+#define POPCORN_COST_MAX_NAME 32
+
+struct popcorn_cost_line {
+    char primitive[POPCORN_COST_MAX_NAME];
+    int nid;
+    unsigned long long bytes;
+    int threads;
+    unsigned long long n;
+    double mean_ns;
+    double p50_ns;
+    double p99_ns;
+};
+
+int popcorn_cost_load(const char *path);
+double popcorn_cost(const char *primitive, int nid, size_t bytes,
+                    int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POPCORN_COST_H_ */
+
+
+#if defined(POPCORN_RT_IMPLEMENTATION) && !defined(_POPCORN_COST_IMPLEMENTED_)
+#define _POPCORN_COST_IMPLEMENTED_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct popcorn_cost_line *popcorn_cost_lines;
+static int popcorn_cost_n;
+
+/* Read the model in 'path', or $POPCORN_COST, replacing the one loaded.
+ * Returns the number of lines read, or -1 without a readable model. */
+int popcorn_cost_load(const char *path) {
+    struct popcorn_cost_line line, *lines = NULL, *grown;
+    char buf[256];
+    int n = 0, cap = 0;
+    FILE *fp;
+
+    if (path == NULL) path = getenv(POPCORN_COST_ENV);
+    if (path == NULL || (fp = fopen(path, "r")) == NULL) return -1;
+
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        if (buf[0] == '#') continue;
+        if (sscanf(buf, "%31s %d %llu %d %llu %lf %lf %lf", line.primitive,
+                   &line.nid, &line.bytes, &line.threads, &line.n,
+                   &line.mean_ns, &line.p50_ns, &line.p99_ns) != 8)
+            continue;   /* The column names, or a broken line. */
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            grown = (struct popcorn_cost_line *)realloc(lines,
+                    cap * sizeof(*lines));
+            if (grown == NULL) break;
+            lines = grown;
+        }
+        lines[n++] = line;
+    }
+    fclose(fp);
+
+    free(popcorn_cost_lines);
+    popcorn_cost_lines = lines;
+    popcorn_cost_n = n;
+    return n;
+}
+
+static int popcorn_cost_match(const struct popcorn_cost_line *l,
+                              const char *primitive, int nid) {
+    return strcmp(l->primitive, primitive) == 0 &&
+           (nid == POPCORN_COST_ANY || l->nid == nid);
+}
+
+/* Mean cost of 'primitive' in nanoseconds, -1 if the model has none. */
+double popcorn_cost(const char *primitive, int nid, size_t bytes,
+                    int threads) {
+    const struct popcorn_cost_line *l, *lo = NULL, *hi = NULL;
+    int i, found = 0, best = -1, d;
+
+    for (i = 0; i < popcorn_cost_n; i++)
+        if (popcorn_cost_match(&popcorn_cost_lines[i], primitive, nid))
+            found = 1;
+    if (!found) {
+        if (nid == POPCORN_COST_ANY) return -1;
+        nid = POPCORN_COST_ANY;
+    }
+
+    /* The closest thread count... */
+    for (i = 0; i < popcorn_cost_n; i++) {
+        l = &popcorn_cost_lines[i];
+        if (!popcorn_cost_match(l, primitive, nid)) continue;
+        d = abs(l->threads - threads);
+        if (best < 0 || d < best) best = d;
+    }
+    if (best < 0) return -1;
+
+    /* ...and the working sets around 'bytes'. */
+    for (i = 0; i < popcorn_cost_n; i++) {
+        l = &popcorn_cost_lines[i];
+        if (!popcorn_cost_match(l, primitive, nid) ||
+            abs(l->threads - threads) != best)
+            continue;
+        if (l->bytes <= bytes && (lo == NULL || l->bytes > lo->bytes)) lo = l;
+        if (l->bytes >= bytes && (hi == NULL || l->bytes < hi->bytes)) hi = l;
+    }
+    if (lo == NULL) return hi->mean_ns;
+    if (hi == NULL || hi->bytes == lo->bytes) return lo->mean_ns;
+    return lo->mean_ns + (hi->mean_ns - lo->mean_ns) *
+           (double)(bytes - lo->bytes) / (double)(hi->bytes - lo->bytes);
+}
+
+#endif /* POPCORN_RT_IMPLEMENTATION */
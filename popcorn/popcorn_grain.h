@@ -0,0 +1,97 @@
+/*
+ * popcorn_grain.h - how often a solver loop migrates.
+ *
+ * A kernel that offloads its iterations can leave before every one and come
+ * back after it, or leave once before the loop and come back once after it.
+ * The first pays two migrations per iteration, the second keeps the steps
+ * between iterations (norms, printouts) away from home. popcorn_grain picks
+ * between them, and everything in between, at run time:
+ *
+ *     struct popcorn_grain grain;
+ *
+ *     popcorn_grain_init(&grain, 1, niter, POPCORN_GRAIN_ITER);
+ *     for (step = 1; step <= niter; step++) {
+ *         if (popcorn_grain_leave(&grain, step))
+ *             popcorn_migrate_best(BT_REGION_ADI);
+ *         adi();
+ *         if (popcorn_grain_return(&grain, step))
+ *             popcorn_migrate_home(BT_REGION_ADI);
+ *     }
+ *
+ * The loop runs iterations first to last and migrates every 'every' of them,
+ * POPCORN_GRAIN_RUN (0) being once for the whole loop. $POPCORN_GRAIN
+ * ("run", "iter" or a number of iterations) overrides the default the kernel
+ * passes, and so does building with -DPOPCORN_GRAIN=N, the environment
+ * still having the last word.
+ */
+
+#ifndef _POPCORN_GRAIN_H_
+#define _POPCORN_GRAIN_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Environment variable with the granularity. */
+#define POPCORN_GRAIN_ENV "POPCORN_GRAIN"
+
+#define POPCORN_GRAIN_RUN   0   /* Once around the whole loop. */
+#define POPCORN_GRAIN_ITER  1   /* Around every iteration. */
+
+struct popcorn_grain {
+    int every;
+    int first;
+    int last;
+};
+
+/* Granularity of a loop over iterations first..last, 'every' unless the
+ * build or the environment says otherwise. */
+static inline void popcorn_grain_init(struct popcorn_grain *g, int first,
+                                      int last, int every) {
+    const char *env = getenv(POPCORN_GRAIN_ENV);
+
+#ifdef POPCORN_GRAIN
+    every = POPCORN_GRAIN;
+#endif
+    if (env != NULL && strcmp(env, "run") == 0) every = POPCORN_GRAIN_RUN;
+    else if (env != NULL && strcmp(env, "iter") == 0) every = POPCORN_GRAIN_ITER;
+    else if (env != NULL && atoi(env) > 0) every = atoi(env);
+    if (every < 0) every = POPCORN_GRAIN_RUN;
+
+    g->every = every;
+    g->first = first;
+    g->last = last;
+}
+
+/* Does iteration 'it' start by leaving home? */
+static inline int popcorn_grain_leave(const struct popcorn_grain *g, int it) {
+    if (g->every == POPCORN_GRAIN_RUN) return it == g->first;
+    return (it - g->first) % g->every == 0;
+}
+
+/* Does iteration 'it' end by going back home? */
+static inline int popcorn_grain_return(const struct popcorn_grain *g, int it) {
+    if (it == g->last) return 1;
+    return g->every != POPCORN_GRAIN_RUN &&
+           (it - g->first + 1) % g->every == 0;
+}
+
+/* The startup line of the kernels. */
+static inline void popcorn_grain_print(const struct popcorn_grain *g) {
+    if (g->every == POPCORN_GRAIN_RUN)
+        printf(" Migration grain: whole run\n");
+    else if (g->every == POPCORN_GRAIN_ITER)
+        printf(" Migration grain: every iteration\n");
+    else
+        printf(" Migration grain: every %d iterations\n", g->every);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POPCORN_GRAIN_H_ */
@@ -0,0 +1,213 @@
+/*
+ * popcorn_huge.h - back large arrays with 2MB pages.
+ *
+ * The NPB kernels keep their working arrays in static globals, in the BSS
+ * and on 4KB pages: a class B array takes tens of thousands of TLB entries,
+ * and on Popcorn every one of its pages moves between nodes on its own.
+ * popcorn_huge_static() puts such an array on 2MB pages instead, at startup
+ * and at the same address, so that the code and the static initializers
+ * that take its address (the popcorn_range lists) do not change:
+ *
+ *     static double a[NZ] POPCORN_HUGE_ALIGN;
+ *
+ *     int main() {
+ *         POPCORN_HUGE_STATIC(a);
+ *
+ * The array must still be zero and untouched: its whole 2MB pages are
+ * mapped again, the last partial page stays as it was. $POPCORN_HUGE says
+ * how:
+ *
+ *  - "off" (the default) does nothing;
+ *  - "thp" asks for transparent huge pages with madvise(MADV_HUGEPAGE);
+ *  - "hugetlb" maps pages of the hugetlbfs pool (vm.nr_hugepages), falling
+ *    back to "thp" for an array the pool is too small for.
+ *
+ * popcorn_huge_map() maps a new region the same way; the node arenas of
+ * popcorn_arena.h take their reservations from it. popcorn_huge_report()
+ * prints a line with what was placed and the huge pages the process
+ * actually has (HugetlbPages and AnonHugePages in /proc).
+ *
+ * Exactly one translation unit of the program has to define
+ * POPCORN_RT_IMPLEMENTATION before including this file.
+ */
+
+#ifndef _POPCORN_HUGE_H_
+#define _POPCORN_HUGE_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Environment variable with the mode. */
+#define POPCORN_HUGE_ENV "POPCORN_HUGE"
+
+#define POPCORN_HUGE_OFF        0
+#define POPCORN_HUGE_THP        1
+#define POPCORN_HUGE_HUGETLB    2
+
+#define POPCORN_HUGE_SIZE (2UL * 1024 * 1024)
+
+/* Starts a static array on a huge page boundary. */
+#define POPCORN_HUGE_ALIGN __attribute__((aligned(2 * 1024 * 1024)))
+
+#define POPCORN_HUGE_STATIC(var) popcorn_huge_static((void *)(var), sizeof(var))
+
+struct popcorn_huge_stats {
+    int mode;
+    unsigned long long arrays;      /* Arrays and regions placed. */
+    unsigned long long bytes;       /* Their size. */
+    unsigned long long hugetlb;     /* Bytes on hugetlbfs pages. */
+    unsigned long long thp;         /* Bytes advised MADV_HUGEPAGE. */
+};
+
+int popcorn_huge_mode(void);
+size_t popcorn_huge_static(void *addr, size_t size);
+void *popcorn_huge_map(size_t size);
+void popcorn_huge_stats(struct popcorn_huge_stats *stats);
+void popcorn_huge_report(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POPCORN_HUGE_H_ */
+
+
+#if defined(POPCORN_RT_IMPLEMENTATION) && !defined(_POPCORN_HUGE_IMPLEMENTED_)
+#define _POPCORN_HUGE_IMPLEMENTED_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static int popcorn_huge_mode_env = -1;
+static struct popcorn_huge_stats popcorn_huge_totals;
+
+int popcorn_huge_mode(void) {
+    const char *env;
+
+    if (popcorn_huge_mode_env < 0) {
+        env = getenv(POPCORN_HUGE_ENV);
+        if (env != NULL && strcmp(env, "hugetlb") == 0)
+            popcorn_huge_mode_env = POPCORN_HUGE_HUGETLB;
+        else if (env != NULL && strcmp(env, "thp") == 0)
+            popcorn_huge_mode_env = POPCORN_HUGE_THP;
+        else
+            popcorn_huge_mode_env = POPCORN_HUGE_OFF;
+    }
+    return popcorn_huge_mode_env;
+}
+
+/* Map [addr, addr + len), 2MB aligned, on huge pages. A failed MAP_FIXED
+ * may have unmapped the range already, so it is mapped again with plain
+ * zero pages, which is what an untouched array has. */
+static size_t popcorn_huge_place(char *addr, size_t len) {
+#ifdef MAP_HUGETLB
+    void *p;
+
+    if (popcorn_huge_mode() == POPCORN_HUGE_HUGETLB) {
+        p = mmap(addr, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            popcorn_huge_totals.hugetlb += len;
+            return len;
+        }
+        p = mmap(addr, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if (p == MAP_FAILED) abort();
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    if (madvise(addr, len, MADV_HUGEPAGE) == 0) {
+        popcorn_huge_totals.thp += len;
+        return len;
+    }
+#endif
+    return 0;
+}
+
+size_t popcorn_huge_static(void *addr, size_t size) {
+    uintptr_t start, end;
+
+    if (popcorn_huge_mode() == POPCORN_HUGE_OFF) return 0;
+    start = ((uintptr_t)addr + POPCORN_HUGE_SIZE - 1) & ~(POPCORN_HUGE_SIZE - 1);
+    end = ((uintptr_t)addr + size) & ~(POPCORN_HUGE_SIZE - 1);
+    popcorn_huge_totals.arrays++;
+    popcorn_huge_totals.bytes += size;
+    if (end <= start) return 0;
+    return popcorn_huge_place((char *)start, end - start);
+}
+
+void *popcorn_huge_map(size_t size) {
+    size_t len = (size + POPCORN_HUGE_SIZE - 1) & ~(POPCORN_HUGE_SIZE - 1);
+    uintptr_t start;
+    char *p;
+
+    if (popcorn_huge_mode() == POPCORN_HUGE_OFF) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return p == MAP_FAILED ? NULL : p;
+    }
+
+    /* Over-map by a huge page and trim to a 2MB aligned region. */
+    p = mmap(NULL, len + POPCORN_HUGE_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    start = ((uintptr_t)p + POPCORN_HUGE_SIZE - 1) & ~(POPCORN_HUGE_SIZE - 1);
+    if (start > (uintptr_t)p) munmap(p, start - (uintptr_t)p);
+    munmap((char *)start + len, (uintptr_t)p + POPCORN_HUGE_SIZE - start);
+
+    popcorn_huge_totals.arrays++;
+    popcorn_huge_totals.bytes += len;
+    popcorn_huge_place((char *)start, len);
+    return (void *)start;
+}
+
+void popcorn_huge_stats(struct popcorn_huge_stats *stats) {
+    *stats = popcorn_huge_totals;
+    stats->mode = popcorn_huge_mode();
+}
+
+/* Sum of the "<field>: N kB" lines of a /proc file, -1 without any. */
+static long long popcorn_huge_proc_kb(const char *path, const char *field) {
+    char line[256];
+    size_t n = strlen(field);
+    long long kb = -1;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) return -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, field, n) == 0 && line[n] == ':')
+            kb = (kb < 0 ? 0 : kb) + atoll(line + n + 1);
+    }
+    fclose(fp);
+    return kb;
+}
+
+void popcorn_huge_report(FILE *fp) {
+    static const char *modes[] = { "off", "thp", "hugetlb" };
+    struct popcorn_huge_stats st;
+    long long anon, tlb;
+
+    popcorn_huge_stats(&st);
+    if (st.mode == POPCORN_HUGE_OFF) return;
+    anon = popcorn_huge_proc_kb("/proc/self/smaps_rollup", "AnonHugePages");
+    if (anon < 0) anon = popcorn_huge_proc_kb("/proc/self/smaps", "AnonHugePages");
+    tlb = popcorn_huge_proc_kb("/proc/self/status", "HugetlbPages");
+
+    fprintf(fp, " Huge pages: %s, %.1f of %.1f MB placed (%.1f MB hugetlb), "
+            "%.1f MB in use\n", modes[st.mode],
+            (st.hugetlb + st.thp) / 1048576.0, st.bytes / 1048576.0,
+            st.hugetlb / 1048576.0,
+            ((tlb < 0 ? 0 : tlb) + (anon < 0 ? 0 : anon)) / 1024.0);
+}
+
+#endif /* POPCORN_RT_IMPLEMENTATION */
@@ -0,0 +1,371 @@
+/*
+ * popcorn_nodes.h - pick the node to migrate to.
+ *
+ * Instead of a literal node ID, a migration point can ask for the best node
+ * to offload to:
+ *
+ *     popcorn_migrate_best(EP_REGION_GAUSSIAN_PAIRS);
+ *     ...
+ *     popcorn_migrate_home(EP_REGION_GAUSSIAN_PAIRS);
+ *
+ * The node table comes from popcorn_get_node_info(), queried on first use
+ * and again every POPCORN_NODES_REFRESH_SEC seconds. The best node is an
+ * online node other than the one the program started on (the home node),
+ * of the preferred architecture if there is one online, and among those the
+ * one with the fewest threads of this program on it, then the closest one.
+ * The kernel does not report the load of the nodes, so the load counted is
+ * the one of the program itself. A thread already away from home stays on
+ * its node as long as that node is still a candidate.
+ *
+ * If migrate() fails with EAGAIN the node is taken as offline until the next
+ * refresh and the next best node is tried. When there is no candidate left
+ * the thread stays where it is and EAGAIN is returned.
+ *
+ * The preferred architecture is set with popcorn_nodes_prefer() or with the
+ * POPCORN_PREFER_ARCH environment variable ("aarch64", "x86", "ppc64" or
+ * "any"); by default it is any architecture other than the home node's.
+ * With POPCORN_MIGRATE=off in the environment the threads never leave the
+ * home node: migrations elsewhere return EAGAIN, which gives the local
+ * baseline of a benchmark without rebuilding it.
+ *
+ * A request for the best node first looks up the region in the schedule
+ * (see popcorn_schedule.h; $POPCORN_SCHEDULE is loaded if nothing was), on
+ * its "<region> * <node>" lines: a region scheduled on the node the thread
+ * is already on stays there and EBUSY is returned, one scheduled on an
+ * online node goes there. This is how the placement computed by
+ * bench/popcorn-advise.sh is applied to the hand-placed migration points.
+ * A region kept home is still profiled, see POPCORN_PROFILE_ENTER().
+ *
+ * popcorn_nodes_migrate() accepts, besides real node IDs, POPCORN_NODE_BEST
+ * and POPCORN_NODE_HOME; use it (or the helpers above) for every migration of
+ * a thread that goes through this file, so that the load stays accurate.
+ * The migrations go through POPCORN_PROFILE_MIGRATE(). Exactly one
+ * translation unit of the program has to define POPCORN_RT_IMPLEMENTATION
+ * before including this file; the implementation uses clock_gettime(), so
+ * that unit must be compiled with the POSIX feature macros enabled.
+ *
+ * popcorn_nodes_stats() tells how many migrations the program made so far
+ * and how long its threads spent in them, summed over the threads.
+ */
+
+#ifndef _POPCORN_NODES_H_
+#define _POPCORN_NODES_H_
+
+#include <migrate.h>
+#include "popcorn_profile.h"
+#include "popcorn_schedule.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef POPCORN_NODES_REFRESH_SEC
+#define POPCORN_NODES_REFRESH_SEC 1
+#endif
+
+/* Pseudo node IDs accepted by popcorn_nodes_migrate(). */
+#define POPCORN_NODE_BEST   (-2)
+#define POPCORN_NODE_HOME   (-3)
+
+/* popcorn_nodes_prefer() argument: no preferred architecture. */
+#define POPCORN_NODE_ANY_ARCH   (-2)
+
+void popcorn_nodes_refresh(void);
+void popcorn_nodes_prefer(int arch);
+int popcorn_nodes_home(void);
+int popcorn_nodes_current(void);
+int popcorn_nodes_online(int nid);
+int popcorn_nodes_arch(int nid);
+int popcorn_nodes_pick(void);
+int popcorn_nodes_migrate_cb(int region, int nid, void (*callback)(void *),
+                             void *callback_param);
+void popcorn_nodes_stats(long *migrations, double *seconds);
+
+static inline int popcorn_nodes_migrate(int region, int nid) {
+    return popcorn_nodes_migrate_cb(region, nid, NULL, NULL);
+}
+
+static inline int popcorn_migrate_best(int region) {
+    return popcorn_nodes_migrate(region, POPCORN_NODE_BEST);
+}
+
+static inline int popcorn_migrate_home(int region) {
+    return popcorn_nodes_migrate(region, POPCORN_NODE_HOME);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POPCORN_NODES_H_ */
+
+
+#if defined(POPCORN_RT_IMPLEMENTATION) && !defined(_POPCORN_NODES_IMPLEMENTED_)
+#define _POPCORN_NODES_IMPLEMENTED_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static struct {
+    int lock;
+    int ready;
+    int home;
+    int prefer;
+    int prefer_set;
+    int disabled;   /* POPCORN_MIGRATE=off: stay on the home node. */
+    long updated;   /* CLOCK_MONOTONIC seconds of the last query. */
+    struct popcorn_node_info info[MAX_POPCORN_NODES];
+    int threads[MAX_POPCORN_NODES];     /* Our threads on each node. */
+    long migrations;                    /* To another node. */
+    double migrate_sec;                 /* In migrate(), all threads. */
+} popcorn_nodes;
+
+/* Node the calling thread runs on, -1 until it migrates through here. */
+static __thread int popcorn_nodes_cur = -1;
+
+/* Not time(): some benchmarks (NPB UA) have a global called 'time'. */
+static long popcorn_nodes_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec;
+}
+
+static double popcorn_nodes_sec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void popcorn_nodes_lock(void) {
+    while (__atomic_exchange_n(&popcorn_nodes.lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&popcorn_nodes.lock, __ATOMIC_RELAXED));
+}
+
+static void popcorn_nodes_unlock(void) {
+    __atomic_store_n(&popcorn_nodes.lock, 0, __ATOMIC_RELEASE);
+}
+
+static int popcorn_nodes_env_disabled(void) {
+    const char *migrate = getenv("POPCORN_MIGRATE");
+
+    return migrate != NULL &&
+           (strcmp(migrate, "off") == 0 || strcmp(migrate, "0") == 0);
+}
+
+static int popcorn_nodes_env_arch(void) {
+    const char *arch = getenv("POPCORN_PREFER_ARCH");
+
+    if (arch == NULL) return POPCORN_NODE_UNKNOWN;
+    if (strcmp(arch, "aarch64") == 0) return POPCORN_NODE_AARCH64;
+    if (strcmp(arch, "x86") == 0 || strcmp(arch, "x86_64") == 0)
+        return POPCORN_NODE_X86;
+    if (strcmp(arch, "ppc64") == 0) return POPCORN_NODE_PPC64;
+    if (strcmp(arch, "any") == 0) return POPCORN_NODE_ANY_ARCH;
+    return POPCORN_NODE_UNKNOWN;
+}
+
+/* Query the node table. Called with the lock held. */
+static void popcorn_nodes_query(void) {
+    int cur, i;
+
+    if (popcorn_get_node_info(&cur, popcorn_nodes.info) != 0) {
+        /* No node information: assume the historical two node setup. */
+        memset(popcorn_nodes.info, 0, sizeof(popcorn_nodes.info));
+        for (i = 0; i < 2; i++) {
+            popcorn_nodes.info[i].status = POPCORN_NODE_ONLINE;
+            popcorn_nodes.info[i].arch = POPCORN_NODE_UNKNOWN;
+            popcorn_nodes.info[i].distance = i;
+        }
+        cur = 0;
+    }
+    if (!popcorn_nodes.ready) {
+        popcorn_nodes.home = cur >= 0 && cur < MAX_POPCORN_NODES ? cur : 0;
+        if (!popcorn_nodes.prefer_set)
+            popcorn_nodes.prefer = popcorn_nodes_env_arch();
+        popcorn_nodes.disabled = popcorn_nodes_env_disabled();
+        if (popcorn_schedule_size() == 0) popcorn_schedule_load(NULL, NULL);
+        popcorn_nodes.ready = 1;
+    }
+    popcorn_nodes.updated = popcorn_nodes_now();
+}
+
+static void popcorn_nodes_update(void) {
+    if (!popcorn_nodes.ready ||
+        popcorn_nodes_now() - popcorn_nodes.updated >=
+        POPCORN_NODES_REFRESH_SEC)
+        popcorn_nodes_query();
+}
+
+void popcorn_nodes_refresh(void) {
+    popcorn_nodes_lock();
+    popcorn_nodes_query();
+    popcorn_nodes_unlock();
+}
+
+/* Prefer nodes of architecture 'arch' (a popcorn_arch_types value),
+ * POPCORN_NODE_ANY_ARCH for none, or POPCORN_NODE_UNKNOWN for the default
+ * of any architecture other than the home node's. */
+void popcorn_nodes_prefer(int arch) {
+    popcorn_nodes_lock();
+    popcorn_nodes_update();
+    popcorn_nodes.prefer = arch;
+    popcorn_nodes.prefer_set = 1;
+    popcorn_nodes_unlock();
+}
+
+int popcorn_nodes_home(void) {
+    int home;
+
+    popcorn_nodes_lock();
+    popcorn_nodes_update();
+    home = popcorn_nodes.home;
+    popcorn_nodes_unlock();
+    return home;
+}
+
+int popcorn_nodes_current(void) {
+    return popcorn_nodes_cur >= 0 ? popcorn_nodes_cur : popcorn_nodes_home();
+}
+
+int popcorn_nodes_online(int nid) {
+    int online;
+
+    if (nid < 0 || nid >= MAX_POPCORN_NODES) return 0;
+    popcorn_nodes_lock();
+    popcorn_nodes_update();
+    online = popcorn_nodes.info[nid].status == POPCORN_NODE_ONLINE;
+    popcorn_nodes_unlock();
+    return online;
+}
+
+int popcorn_nodes_arch(int nid) {
+    int arch;
+
+    if (nid < 0 || nid >= MAX_POPCORN_NODES) return POPCORN_NODE_UNKNOWN;
+    popcorn_nodes_lock();
+    popcorn_nodes_update();
+    arch = popcorn_nodes.info[nid].arch;
+    popcorn_nodes_unlock();
+    return arch;
+}
+
+/* Does 'nid' have the preferred architecture? Called with the lock held. */
+static int popcorn_nodes_preferred(int nid) {
+    int arch = popcorn_nodes.info[nid].arch;
+    int home_arch = popcorn_nodes.info[popcorn_nodes.home].arch;
+
+    if (popcorn_nodes.prefer == POPCORN_NODE_ANY_ARCH) return 1;
+    if (popcorn_nodes.prefer == POPCORN_NODE_UNKNOWN)
+        return home_arch == POPCORN_NODE_UNKNOWN || arch != home_arch;
+    return arch == popcorn_nodes.prefer;
+}
+
+/* Best candidate, -1 if none. Called with the lock held. */
+static int popcorn_nodes_best(int cur) {
+    int i, best = -1, best_pref = 0, pref;
+    struct popcorn_node_info *n;
+
+    for (i = 0; i < MAX_POPCORN_NODES; i++) {
+        n = &popcorn_nodes.info[i];
+        if (i == popcorn_nodes.home || n->status != POPCORN_NODE_ONLINE)
+            continue;
+        pref = popcorn_nodes_preferred(i);
+        if (i == cur && pref) return i;
+        if (best != -1) {
+            if (pref != best_pref) {
+                if (!pref) continue;
+            } else if (popcorn_nodes.threads[i] !=
+                       popcorn_nodes.threads[best]) {
+                if (popcorn_nodes.threads[i] > popcorn_nodes.threads[best])
+                    continue;
+            } else if (n->distance >= popcorn_nodes.info[best].distance) {
+                continue;
+            }
+        }
+        best = i;
+        best_pref = pref;
+    }
+    return best;
+}
+
+/* Node the schedule gives 'region', if it is online, or the best node.
+ * Called with the lock held. */
+static int popcorn_nodes_scheduled(int region, int cur) {
+    int nid = popcorn_schedule_node(region, POPCORN_SCHEDULE_ANY, -1);
+
+    if (nid >= 0 && nid < MAX_POPCORN_NODES &&
+        (nid == popcorn_nodes.home ||
+         popcorn_nodes.info[nid].status == POPCORN_NODE_ONLINE))
+        return nid;
+    return popcorn_nodes_best(cur);
+}
+
+int popcorn_nodes_pick(void) {
+    int nid;
+
+    popcorn_nodes_lock();
+    popcorn_nodes_update();
+    nid = popcorn_nodes_best(popcorn_nodes_cur);
+    popcorn_nodes_unlock();
+    return nid;
+}
+
+/* Migrate the calling thread to 'nid', which may be POPCORN_NODE_BEST or
+ * POPCORN_NODE_HOME, on behalf of 'region', and run 'callback' there on
+ * arrival. Returns what migrate() returns, EBUSY if the schedule keeps the
+ * region where it is, or EAGAIN if no node is available. */
+int popcorn_nodes_migrate_cb(int region, int nid, void (*callback)(void *),
+                             void *callback_param) {
+    int best = nid == POPCORN_NODE_BEST;
+    int from, rc, tries;
+    double t;
+
+    for (tries = 0; tries < MAX_POPCORN_NODES; tries++) {
+        popcorn_nodes_lock();
+        popcorn_nodes_update();
+        from = popcorn_nodes_cur >= 0 ? popcorn_nodes_cur : popcorn_nodes.home;
+        if (best) nid = popcorn_nodes_scheduled(region, from);
+        else if (nid == POPCORN_NODE_HOME) nid = popcorn_nodes.home;
+        if (popcorn_nodes.disabled && nid != popcorn_nodes.home) nid = -1;
+        popcorn_nodes_unlock();
+        if (nid < 0 || (best && nid == from)) {
+            /* The region runs here: profile it all the same. */
+            POPCORN_PROFILE_ENTER(region);
+            return nid < 0 ? EAGAIN : EBUSY;
+        }
+
+        t = popcorn_nodes_sec();
+        rc = POPCORN_PROFILE_MIGRATE_CB(region, nid, callback,
+                                        callback_param);
+        t = popcorn_nodes_sec() - t;
+
+        popcorn_nodes_lock();
+        popcorn_nodes.migrate_sec += t;
+        if (rc == 0 && nid != from) popcorn_nodes.migrations++;
+        if (rc == 0 || rc == EBUSY) {
+            /* Only the threads away from home are counted. */
+            if (from != popcorn_nodes.home) popcorn_nodes.threads[from]--;
+            if (nid != popcorn_nodes.home) popcorn_nodes.threads[nid]++;
+            popcorn_nodes_cur = nid;
+        } else if (rc == EAGAIN && nid >= 0 && nid < MAX_POPCORN_NODES) {
+            popcorn_nodes.info[nid].status = POPCORN_NODE_OFFLINE;
+        }
+        popcorn_nodes_unlock();
+
+        if (rc != EAGAIN || !best) return rc;
+    }
+    return EAGAIN;
+}
+
+void popcorn_nodes_stats(long *migrations, double *seconds) {
+    popcorn_nodes_lock();
+    *migrations = popcorn_nodes.migrations;
+    *seconds = popcorn_nodes.migrate_sec;
+    popcorn_nodes_unlock();
+}
+
+#endif /* POPCORN_RT_IMPLEMENTATION */
@@ -0,0 +1,275 @@
+/*
+ * popcorn_profile.h - per region migration profiler.
+ *
+ * Wraps the migrate() calls of a benchmark and accounts, for every region
+ * ID, the number and latency of the migrations, the time spent on each node
+ * and the page faults taken there (on Popcorn remote pages are pulled in
+ * through the fault path, so the fault count of a thread on a remote node
+ * is the number of pages it had to bring over).
+ *
+ * A region is delimited by two migrations tagged with the same ID:
+ *
+ *     POPCORN_PROFILE_MIGRATE(CG_REGION_CONJ_GRAD, 1);
+ *     conj_grad(...);
+ *     POPCORN_PROFILE_MIGRATE(CG_REGION_CONJ_GRAD, 0);
+ *
+ * Migrating back to the home node closes the region. Time spent outside of
+ * any region is accounted to region 0. POPCORN_PROFILE_MIGRATE_CB() passes
+ * a callback to migrate(), to be run on arrival; its time is part of the
+ * migration latency. POPCORN_PROFILE_ENTER(region) opens a region on the
+ * node the thread is on, for a region that runs at home (its migration was
+ * declined or its schedule keeps it there), so that a local run measures
+ * the same regions as an offloaded one; the next migration closes it.
+ *
+ * The profiler is compiled in only when POPCORN_PROFILE is defined,
+ * otherwise POPCORN_PROFILE_MIGRATE() is a plain migrate() call and no
+ * code or data is emitted. Exactly one translation unit of the program has
+ * to define POPCORN_RT_IMPLEMENTATION before including this file; the
+ * implementation uses clock_gettime() and getrusage(RUSAGE_THREAD), so that
+ * unit must be compiled with the GNU/POSIX feature macros enabled.
+ *
+ * At exit the table is written to the file named by the POPCORN_PROFILE_OUT
+ * environment variable (appended, so several processes can share it) or to
+ * stderr, as tab separated lines:
+ *
+ *     # popcorn-profile pid=<pid>
+ *     region node migrations failed migrate_ns migrate_max_ns time_ns faults
+ *
+ * with one line per region and node the region ran on. The migration
+ * columns refer to the migrations into that node.
+ */
+
+#ifndef _POPCORN_PROFILE_H_
+#define _POPCORN_PROFILE_H_
+
+#include <migrate.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef POPCORN_PROFILE_MAX_REGIONS
+#define POPCORN_PROFILE_MAX_REGIONS 64
+#endif
+
+#ifndef POPCORN_PROFILE_MAX_NODES
+#define POPCORN_PROFILE_MAX_NODES 4
+#endif
+
+#define POPCORN_PROFILE_HOME_NODE 0
+
+#ifdef POPCORN_PROFILE
+
+int popcorn_profile_migrate(int region, int nid);
+int popcorn_profile_migrate_cb(int region, int nid, void (*callback)(void *),
+                               void *callback_param);
+void popcorn_profile_enter(int region);
+void popcorn_profile_account(void);
+void popcorn_profile_dump(void);
+
+#define POPCORN_PROFILE_MIGRATE(region, nid) \
+    popcorn_profile_migrate((region), (nid))
+#define POPCORN_PROFILE_MIGRATE_CB(region, nid, callback, param) \
+    popcorn_profile_migrate_cb((region), (nid), (callback), (param))
+#define POPCORN_PROFILE_ENTER(region) popcorn_profile_enter(region)
+
+#else
+
+#define POPCORN_PROFILE_MIGRATE(region, nid) \
+    migrate((nid), NULL, NULL)
+#define POPCORN_PROFILE_MIGRATE_CB(region, nid, callback, param) \
+    migrate((nid), (callback), (param))
+#define POPCORN_PROFILE_ENTER(region) do { } while (0)
+
+#endif /* POPCORN_PROFILE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POPCORN_PROFILE_H_ */
+
+
+#if defined(POPCORN_RT_IMPLEMENTATION) && defined(POPCORN_PROFILE) && \
+    !defined(_POPCORN_PROFILE_IMPLEMENTED_)
+#define _POPCORN_PROFILE_IMPLEMENTED_
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#ifndef RUSAGE_THREAD
+#define RUSAGE_THREAD 1
+#endif
+
+struct popcorn_profile_node {
+    unsigned long long migrations;
+    unsigned long long failed;
+    unsigned long long migrate_ns;
+    unsigned long long migrate_max_ns;
+    unsigned long long time_ns;
+    unsigned long long faults;
+};
+
+struct popcorn_profile_region {
+    struct popcorn_profile_node node[POPCORN_PROFILE_MAX_NODES];
+};
+
+static struct popcorn_profile_region
+    popcorn_profile_regions[POPCORN_PROFILE_MAX_REGIONS];
+static int popcorn_profile_registered;
+
+/* Segment of execution being accounted by the calling thread. */
+static __thread int popcorn_profile_ready;
+static __thread int popcorn_profile_region_id;
+static __thread int popcorn_profile_nid;
+static __thread unsigned long long popcorn_profile_since;
+static __thread unsigned long long popcorn_profile_faults;
+
+static unsigned long long popcorn_profile_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long popcorn_profile_thread_faults(void) {
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_THREAD, &ru) == -1) return 0;
+    return (unsigned long long)ru.ru_minflt + ru.ru_majflt;
+}
+
+static struct popcorn_profile_node *popcorn_profile_slot(int region, int nid) {
+    if (region < 0 || region >= POPCORN_PROFILE_MAX_REGIONS)
+        region = POPCORN_PROFILE_MAX_REGIONS - 1;
+    if (nid < 0 || nid >= POPCORN_PROFILE_MAX_NODES)
+        nid = POPCORN_PROFILE_MAX_NODES - 1;
+    return &popcorn_profile_regions[region].node[nid];
+}
+
+static void popcorn_profile_max(unsigned long long *max,
+                                unsigned long long val) {
+    unsigned long long old = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+    while (val > old &&
+           !__atomic_compare_exchange_n(max, &old, val, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void popcorn_profile_init(void) {
+    if (!__atomic_exchange_n(&popcorn_profile_registered, 1, __ATOMIC_ACQ_REL))
+        atexit(popcorn_profile_dump);
+
+    popcorn_profile_region_id = 0;
+    popcorn_profile_nid = POPCORN_PROFILE_HOME_NODE;
+    popcorn_profile_since = popcorn_profile_ns();
+    popcorn_profile_faults = popcorn_profile_thread_faults();
+    popcorn_profile_ready = 1;
+}
+
+/* Close the current segment of the calling thread, charging its duration
+ * and faults to the current region and node. */
+void popcorn_profile_account(void) {
+    struct popcorn_profile_node *n;
+    unsigned long long now, faults;
+
+    if (!popcorn_profile_ready) {
+        popcorn_profile_init();
+        return;
+    }
+
+    now = popcorn_profile_ns();
+    faults = popcorn_profile_thread_faults();
+    n = popcorn_profile_slot(popcorn_profile_region_id, popcorn_profile_nid);
+    __atomic_fetch_add(&n->time_ns, now - popcorn_profile_since,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&n->faults, faults - popcorn_profile_faults,
+                       __ATOMIC_RELAXED);
+    popcorn_profile_since = now;
+    popcorn_profile_faults = faults;
+}
+
+/* Migrate to 'nid' on behalf of 'region', running 'callback' on arrival.
+ * Returns what migrate() returns. */
+int popcorn_profile_migrate_cb(int region, int nid, void (*callback)(void *),
+                               void *callback_param) {
+    struct popcorn_profile_node *n;
+    unsigned long long start, elapsed;
+    int rc;
+
+    popcorn_profile_account();
+
+    start = popcorn_profile_ns();
+    rc = migrate(nid, callback, callback_param);
+    elapsed = popcorn_profile_ns() - start;
+
+    n = popcorn_profile_slot(region, nid);
+    if (rc == 0) {
+        __atomic_fetch_add(&n->migrations, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&n->migrate_ns, elapsed, __ATOMIC_RELAXED);
+        popcorn_profile_max(&n->migrate_max_ns, elapsed);
+    } else if (rc != EBUSY) {
+        __atomic_fetch_add(&n->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    if (rc == 0 || rc == EBUSY) popcorn_profile_nid = nid;
+    popcorn_profile_region_id =
+        popcorn_profile_nid == POPCORN_PROFILE_HOME_NODE ? 0 : region;
+    popcorn_region_id(popcorn_profile_region_id);
+
+    /* The migration itself is not part of the time spent on the node. */
+    popcorn_profile_since = popcorn_profile_ns();
+    popcorn_profile_faults = popcorn_profile_thread_faults();
+    return rc;
+}
+
+int popcorn_profile_migrate(int region, int nid) {
+    return popcorn_profile_migrate_cb(region, nid, NULL, NULL);
+}
+
+/* Charge what the calling thread runs from now on to 'region', on the node
+ * it is on. */
+void popcorn_profile_enter(int region) {
+    popcorn_profile_account();
+    if (region == popcorn_profile_region_id) return;
+    popcorn_profile_region_id = region;
+    popcorn_region_id(region);
+}
+
+void popcorn_profile_dump(void) {
+    struct popcorn_profile_node *n;
+    const char *path;
+    FILE *fp = stderr;
+    int r, i;
+
+    if (popcorn_profile_ready) popcorn_profile_account();
+
+    path = getenv("POPCORN_PROFILE_OUT");
+    if (path && *path) {
+        fp = fopen(path, "a");
+        if (fp == NULL) fp = stderr;
+    }
+
+    fprintf(fp, "# popcorn-profile pid=%ld\n", (long)getpid());
+    fprintf(fp, "region\tnode\tmigrations\tfailed\tmigrate_ns\t"
+                "migrate_max_ns\ttime_ns\tfaults\n");
+    for (r = 0; r < POPCORN_PROFILE_MAX_REGIONS; r++) {
+        for (i = 0; i < POPCORN_PROFILE_MAX_NODES; i++) {
+            n = &popcorn_profile_regions[r].node[i];
+            if (n->migrations == 0 && n->failed == 0 && n->time_ns == 0)
+                continue;
+            fprintf(fp, "%d\t%d\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+                    r, i, n->migrations, n->failed, n->migrate_ns,
+                    n->migrate_max_ns, n->time_ns, n->faults);
+        }
+    }
+
+    if (fp != stderr) fclose(fp);
+    else fflush(fp);
+}
+
+#endif /* POPCORN_RT_IMPLEMENTATION && POPCORN_PROFILE */
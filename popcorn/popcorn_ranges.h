@@ -0,0 +1,131 @@
+/*
+ * popcorn_ranges.h - migrate a thread together with its working set.
+ *
+ * A plain migrate() leaves all the data behind: the destination then pulls
+ * every page of the working arrays on its first access, one fault at a time
+ * and in the middle of the computation. popcorn_migrate_ranges() takes the
+ * list of (address, length) ranges the region is about to work on and
+ *
+ *  - with POPCORN_RANGE_RELEASE, gives up the ownership of those pages on
+ *    the source node before leaving, so the destination does not have to
+ *    invalidate them one by one;
+ *  - with POPCORN_RANGE_PREFETCH, brings them over on the destination right
+ *    after the migration, with a read (or, for ranges marked writable, a
+ *    write) of every page, so the region starts with its working set.
+ *
+ *     static struct popcorn_range cg_ranges[] = {
+ *         POPCORN_RANGE_RO(colidx),
+ *         POPCORN_RANGE_RW(p),
+ *     };
+ *
+ *     popcorn_migrate_ranges(CG_REGION_CONJ_GRAD, POPCORN_NODE_BEST,
+ *                            cg_ranges, POPCORN_RANGES(cg_ranges),
+ *                            POPCORN_RANGE_ALL);
+ *
+ * Writable ranges are prefetched by rewriting one byte per page, so they
+ * must not be written concurrently by other threads.
+ *
+ * migrate.h #undefs _POPCORN_RELEASE_OWNERSHIP, which turns
+ * popcorn_release_ownership() into a stub; build with
+ * POPCORN_RELEASE_OWNERSHIP defined to issue the release madvise() directly.
+ * The migration goes through popcorn_nodes_migrate(), so the node may be
+ * POPCORN_NODE_BEST or POPCORN_NODE_HOME, and it shows up in the region
+ * profile when that is enabled.
+ */
+
+#ifndef _POPCORN_RANGES_H_
+#define _POPCORN_RANGES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <migrate.h>
+#include "popcorn_nodes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct popcorn_range {
+    void *addr;
+    size_t len;
+    int write;      /* The region writes the range: prefetch it writable. */
+};
+
+#define POPCORN_RANGE_RO(var) { (void *)(var), sizeof(var), 0 }
+#define POPCORN_RANGE_RW(var) { (void *)(var), sizeof(var), 1 }
+#define POPCORN_RANGES(array) ((int)(sizeof(array) / sizeof((array)[0])))
+
+#define POPCORN_RANGE_RELEASE   0x1
+#define POPCORN_RANGE_PREFETCH  0x2
+#define POPCORN_RANGE_ALL       (POPCORN_RANGE_RELEASE | POPCORN_RANGE_PREFETCH)
+
+#ifndef MADVISE_RELEASE
+#define MADVISE_RELEASE 18
+#endif
+
+/* Page aligned bounds of a range. */
+static inline void popcorn_range_bounds(const struct popcorn_range *r,
+                                        uintptr_t *start, uintptr_t *end) {
+    *start = (uintptr_t)r->addr & PAGE_MASK;
+    *end = ((uintptr_t)r->addr + r->len + PAGE_SIZE - 1) & PAGE_MASK;
+}
+
+static inline void popcorn_release_ranges(const struct popcorn_range *ranges,
+                                          int n) {
+    uintptr_t start, end;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (ranges[i].len == 0) continue;
+        popcorn_range_bounds(&ranges[i], &start, &end);
+#ifdef POPCORN_RELEASE_OWNERSHIP
+        madvise((void *)start, end - start, MADVISE_RELEASE);
+#else
+        popcorn_release_ownership((void *)start, end - start);
+#endif
+    }
+}
+
+static inline void popcorn_prefetch_ranges(const struct popcorn_range *ranges,
+                                           int n) {
+    uintptr_t start, end, p, last;
+    volatile char *c;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (ranges[i].len == 0) continue;
+        popcorn_range_bounds(&ranges[i], &start, &end);
+        madvise((void *)start, end - start, MADV_WILLNEED);
+
+        /* Touch one byte of each page, never outside of the range. */
+        last = (uintptr_t)ranges[i].addr + ranges[i].len;
+        for (p = (uintptr_t)ranges[i].addr; p < last;
+             p = (p & PAGE_MASK) + PAGE_SIZE) {
+            c = (volatile char *)p;
+            if (ranges[i].write) *c = *c;
+            else (void)*c;
+        }
+    }
+}
+
+/* Migrate to 'nid' (see popcorn_nodes_migrate()) on behalf of 'region',
+ * taking 'ranges' along according to 'flags'. Returns what migrate()
+ * returns. */
+static inline int popcorn_migrate_ranges(int region, int nid,
+                                         const struct popcorn_range *ranges,
+                                         int n, int flags) {
+    int rc;
+
+    if (flags & POPCORN_RANGE_RELEASE) popcorn_release_ranges(ranges, n);
+    rc = popcorn_nodes_migrate(region, nid);
+    if (rc == 0 && (flags & POPCORN_RANGE_PREFETCH))
+        popcorn_prefetch_ranges(ranges, n);
+    return rc;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POPCORN_RANGES_H_ */
@@ -0,0 +1,262 @@
+/*
+ * popcorn_schedule.h - thread schedules loaded from a file.
+ *
+ * migrate.h has migrate_schedule() for this, but it is compiled out
+ * (_POPCORN_MIGRATE_SCHEDULE is #undef'd) and takes the schedule from the
+ * compiler. This is the same idea with the placement read at run time, so
+ * different placements can be tried without rebuilding. A schedule is a text
+ * file with one "<region> <thread> <node>" mapping per line:
+ *
+ *     # kmeans, 6 threads on x86 (node 0) and 2 on ARM (node 1)
+ *     1 * 0
+ *     1 6 1
+ *     1 7 1
+ *
+ * '*' as thread (or region) matches any thread (or region) without a more
+ * specific line. Blank lines and '#' comments are ignored. Region and thread
+ * IDs are defined by each program; the thread ID is its own numbering of
+ * the threads taking part in the region (kmeans thread index, redis IO
+ * thread id, ...).
+ *
+ * At their migration points the threads ask for their node:
+ *
+ *     nid = popcorn_schedule_node(KMEANS_REGION_THREAD_LOOP, tid, default);
+ *
+ * and get 'default' when there is no schedule or it has no line for them.
+ * popcorn_schedule_load() replaces the schedule atomically and keeps the old
+ * one if the new file does not parse. popcorn_schedule_signal() arranges for
+ * a signal to reload the last file loaded; the reload is done by the next
+ * thread looking up a node, not by the signal handler.
+ *
+ * Exactly one translation unit of the program has to define
+ * POPCORN_RT_IMPLEMENTATION before including this file.
+ */
+
+#ifndef _POPCORN_SCHEDULE_H_
+#define _POPCORN_SCHEDULE_H_
+
+#include <migrate.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POPCORN_SCHEDULE_ANY    (-1)    /* '*' in the schedule file. */
+
+/* Environment variable naming the schedule loaded by a NULL path. */
+#define POPCORN_SCHEDULE_ENV    "POPCORN_SCHEDULE"
+
+int popcorn_schedule_load(const char *path, int *errline);
+int popcorn_schedule_reload(void);
+void popcorn_schedule_clear(void);
+void popcorn_schedule_signal(int sig);
+int popcorn_schedule_node(int region, int tid, int dflt);
+int popcorn_schedule_size(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POPCORN_SCHEDULE_H_ */
+
+
+#if defined(POPCORN_RT_IMPLEMENTATION) && \
+    !defined(_POPCORN_SCHEDULE_IMPLEMENTED_)
+#define _POPCORN_SCHEDULE_IMPLEMENTED_
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct popcorn_schedule_entry {
+    int region;
+    int tid;
+    int nid;
+};
+
+static pthread_rwlock_t popcorn_schedule_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct popcorn_schedule_entry *popcorn_schedule_entries;
+static int popcorn_schedule_len;
+static char *popcorn_schedule_file;
+static volatile sig_atomic_t popcorn_schedule_pending;
+
+/* Parse a region or thread field: a non negative number or '*'. */
+static int popcorn_schedule_id(const char *s, int *id) {
+    char *end;
+    long v;
+
+    if (strcmp(s, "*") == 0) {
+        *id = POPCORN_SCHEDULE_ANY;
+        return 0;
+    }
+    errno = 0;
+    v = strtol(s, &end, 10);
+    if (errno || *end || end == s || v < 0 || v > INT_MAX) return -1;
+    *id = (int)v;
+    return 0;
+}
+
+/* Load the schedule in 'path' (or $POPCORN_SCHEDULE if NULL). Returns 0 on
+ * success, or -1 with errno set and, for syntax errors (EINVAL), the line
+ * number in '*errline'. On error the current schedule is left in place. */
+int popcorn_schedule_load(const char *path, int *errline) {
+    struct popcorn_schedule_entry *entries = NULL, *e, *old;
+    char buf[256], f[3][64], extra[2], *file, *oldfile;
+    int len = 0, cap = 0, line = 0, nid;
+    FILE *fp;
+
+    if (errline) *errline = 0;
+    if (path == NULL) path = getenv(POPCORN_SCHEDULE_ENV);
+    if (path == NULL || *path == '\0') {
+        errno = ENOENT;
+        return -1;
+    }
+    if ((fp = fopen(path, "r")) == NULL) return -1;
+
+    while (fgets(buf, sizeof(buf), fp)) {
+        char *hash = strchr(buf, '#');
+        int n;
+
+        line++;
+        if (hash) *hash = '\0';
+        n = sscanf(buf, "%63s %63s %63s %1s", f[0], f[1], f[2], extra);
+        if (n <= 0) continue;
+        if (len == cap) {
+            cap = cap ? cap * 2 : 16;
+            e = realloc(entries, sizeof(*entries) * cap);
+            if (e == NULL) goto err;
+            entries = e;
+        }
+        e = &entries[len];
+        if (n != 3 ||
+            popcorn_schedule_id(f[0], &e->region) == -1 ||
+            popcorn_schedule_id(f[1], &e->tid) == -1 ||
+            popcorn_schedule_id(f[2], &nid) == -1 ||
+            nid == POPCORN_SCHEDULE_ANY || nid >= MAX_POPCORN_NODES) {
+            if (errline) *errline = line;
+            errno = EINVAL;
+            goto err;
+        }
+        e->nid = nid;
+        len++;
+    }
+    if (ferror(fp)) goto err;
+    fclose(fp);
+
+    if ((file = strdup(path)) == NULL) {
+        free(entries);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&popcorn_schedule_lock);
+    old = popcorn_schedule_entries;
+    oldfile = popcorn_schedule_file;
+    popcorn_schedule_entries = entries;
+    popcorn_schedule_len = len;
+    popcorn_schedule_file = file;
+    pthread_rwlock_unlock(&popcorn_schedule_lock);
+
+    free(old);
+    free(oldfile);
+    return 0;
+
+err:
+    {
+        int saved = errno;
+
+        fclose(fp);
+        free(entries);
+        errno = saved;
+    }
+    return -1;
+}
+
+/* Load again the last schedule file loaded. */
+int popcorn_schedule_reload(void) {
+    char *path = NULL;
+    int rc;
+
+    pthread_rwlock_rdlock(&popcorn_schedule_lock);
+    if (popcorn_schedule_file) path = strdup(popcorn_schedule_file);
+    pthread_rwlock_unlock(&popcorn_schedule_lock);
+
+    rc = popcorn_schedule_load(path, NULL);
+    free(path);
+    return rc;
+}
+
+/* Drop the current schedule: every thread gets its default node. */
+void popcorn_schedule_clear(void) {
+    struct popcorn_schedule_entry *old;
+    char *oldfile;
+
+    pthread_rwlock_wrlock(&popcorn_schedule_lock);
+    old = popcorn_schedule_entries;
+    oldfile = popcorn_schedule_file;
+    popcorn_schedule_entries = NULL;
+    popcorn_schedule_len = 0;
+    popcorn_schedule_file = NULL;
+    pthread_rwlock_unlock(&popcorn_schedule_lock);
+
+    free(old);
+    free(oldfile);
+}
+
+static void popcorn_schedule_handler(int sig) {
+    (void)sig;
+    popcorn_schedule_pending = 1;
+}
+
+/* Reload the schedule when 'sig' is received. */
+void popcorn_schedule_signal(int sig) {
+    struct sigaction act;
+
+    memset(&act, 0, sizeof(act));
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART;
+    act.sa_handler = popcorn_schedule_handler;
+    sigaction(sig, &act, NULL);
+}
+
+/* Node the thread 'tid' has to run 'region' on, or 'dflt'. */
+int popcorn_schedule_node(int region, int tid, int dflt) {
+    int i, best = -1, score, best_score = -1;
+
+    if (popcorn_schedule_pending &&
+        __atomic_exchange_n(&popcorn_schedule_pending, 0, __ATOMIC_ACQ_REL))
+        popcorn_schedule_reload();
+
+    pthread_rwlock_rdlock(&popcorn_schedule_lock);
+    for (i = 0; i < popcorn_schedule_len; i++) {
+        struct popcorn_schedule_entry *e = &popcorn_schedule_entries[i];
+
+        if (e->region != region && e->region != POPCORN_SCHEDULE_ANY) continue;
+        if (e->tid != tid && e->tid != POPCORN_SCHEDULE_ANY) continue;
+
+        /* An exact thread beats an exact region, which beats wildcards. */
+        score = (e->tid == tid) * 2 + (e->region == region);
+        if (score > best_score) {
+            best_score = score;
+            best = e->nid;
+        }
+    }
+    pthread_rwlock_unlock(&popcorn_schedule_lock);
+
+    return best_score >= 0 ? best : dflt;
+}
+
+/* Number of mappings in the current schedule. */
+int popcorn_schedule_size(void) {
+    int len;
+
+    pthread_rwlock_rdlock(&popcorn_schedule_lock);
+    len = popcorn_schedule_len;
+    pthread_rwlock_unlock(&popcorn_schedule_lock);
+    return len;
+}
+
+#endif /* POPCORN_RT_IMPLEMENTATION */
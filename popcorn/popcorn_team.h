@@ -0,0 +1,290 @@
+/*
+ * popcorn_team.h - a fork/join thread team spread over the nodes.
+ *
+ * The OpenMP macros at the bottom of migrate.h (POPCORN_OMP_MIGRATE_START)
+ * move each thread of a parallel region to node tid / cores per node and
+ * back home at the end of the region. This is the same idea for programs
+ * built without OpenMP, with the threads kept on their node between
+ * regions: a parallel region only costs two barriers, not two migrations.
+ *
+ *     popcorn_team_init(CG_REGION_CONJ_GRAD);
+ *     ...
+ *     popcorn_team_run(conj_grad_team, &args);
+ *     ...
+ *     popcorn_team_fini();
+ *
+ * popcorn_team_run() runs 'fn(tid, arg)' on every thread of the team, the
+ * calling thread being tid 0, and returns once they all returned. Inside,
+ * popcorn_team_split() gives a thread its block of a loop,
+ * popcorn_team_barrier() waits for the others and popcorn_team_sum() and
+ * popcorn_team_max() reduce one value per thread, in tid order, so the
+ * result does not depend on the timing. Called outside of a run, from a
+ * single thread, the split is the whole loop, the barrier does nothing and
+ * the reductions return their argument: the same kernels serve the serial
+ * setup code and the team.
+ *
+ * The team has $POPCORN_THREADS threads, 1 by default, in which case
+ * popcorn_team_run() is a plain call. Thread tid runs on the node the
+ * schedule (see popcorn_schedule.h; $POPCORN_SCHEDULE is loaded if nothing
+ * was) gives it for the region, and by default the first half of the team
+ * on the home node and the second half on the best node (see
+ * popcorn_nodes.h), so POPCORN_MIGRATE=off keeps the whole team home. The
+ * threads synchronize with a popcorn_barrier, grouped by the node they
+ * ended up on.
+ *
+ * Exactly one translation unit of the program has to define
+ * POPCORN_RT_IMPLEMENTATION before including this file.
+ */
+
+#ifndef _POPCORN_TEAM_H_
+#define _POPCORN_TEAM_H_
+
+#include <migrate.h>
+#include "popcorn_barrier.h"
+#include "popcorn_nodes.h"
+#include "popcorn_schedule.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef POPCORN_TEAM_MAX
+#define POPCORN_TEAM_MAX 64
+#endif
+
+/* Environment variable with the number of threads of the team. */
+#define POPCORN_TEAM_ENV "POPCORN_THREADS"
+
+int popcorn_team_init(int region);
+void popcorn_team_fini(void);
+int popcorn_team_size(void);
+int popcorn_team_tid(void);
+int popcorn_team_node(int tid);
+int popcorn_team_nodes(void);
+void popcorn_team_run(void (*fn)(int tid, void *arg), void *arg);
+void popcorn_team_barrier(void);
+double popcorn_team_sum(double v);
+double popcorn_team_max(double v);
+
+/* Block of the calling thread when the iterations first to end - 1 are
+ * split over the team: [*lo, *hi). */
+static inline void popcorn_team_split(int first, int end, int *lo, int *hi) {
+    int tid = popcorn_team_tid(), size = popcorn_team_size();
+    long long n = end > first ? end - first : 0;
+
+    if (tid < 0) {
+        *lo = first;
+        *hi = end;
+        return;
+    }
+    *lo = first + (int)(n * tid / size);
+    *hi = first + (int)(n * (tid + 1) / size);
+}
+
+/* popcorn_team_split() for loops longer than an int. */
+static inline void popcorn_team_split_long(long first, long end, long *lo,
+                                           long *hi) {
+    int tid = popcorn_team_tid(), size = popcorn_team_size();
+    long n = end > first ? end - first : 0;
+
+    if (tid < 0) {
+        *lo = first;
+        *hi = end;
+        return;
+    }
+    *lo = first + n / size * tid + (n % size) * tid / size;
+    *hi = first + n / size * (tid + 1) + (n % size) * (tid + 1) / size;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POPCORN_TEAM_H_ */
+
+
+#if defined(POPCORN_RT_IMPLEMENTATION) && !defined(_POPCORN_TEAM_IMPLEMENTED_)
+#define _POPCORN_TEAM_IMPLEMENTED_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static struct {
+    int size;
+    int region;
+    int nid[POPCORN_TEAM_MAX];          /* Node each thread ended up on. */
+    double *sums[POPCORN_TEAM_MAX];     /* A page per thread, on its node. */
+    pthread_t threads[POPCORN_TEAM_MAX];
+    pthread_barrier_t started;
+    struct popcorn_barrier barrier;
+    void (*fn)(int tid, void *arg);
+    void *arg;
+} popcorn_team = { 1 };
+
+/* Thread of the team during popcorn_team_run(), -1 otherwise. */
+static __thread int popcorn_team_cur = -1;
+
+/* Migrate thread 'tid' to its node and record where it ended up. */
+static void popcorn_team_place(int tid) {
+    int nid = tid < (popcorn_team.size + 1) / 2 ? POPCORN_NODE_HOME
+                                                : POPCORN_NODE_BEST;
+
+    nid = popcorn_schedule_node(popcorn_team.region, tid, nid);
+    if (nid != POPCORN_NODE_HOME) popcorn_nodes_migrate(popcorn_team.region, nid);
+    popcorn_team.nid[tid] = popcorn_nodes_current();
+    popcorn_team.sums[tid] = (double *)popcorn_node_calloc(
+            1, sizeof(double), popcorn_team.nid[tid]);
+}
+
+static void *popcorn_team_worker(void *arg) {
+    int tid = (int)(intptr_t)arg;
+
+    popcorn_team_place(tid);
+
+    /* Wait for main to set up the barrier. */
+    pthread_barrier_wait(&popcorn_team.started);
+    pthread_barrier_wait(&popcorn_team.started);
+
+    for (;;) {
+        popcorn_barrier_wait(&popcorn_team.barrier, popcorn_team.nid[tid]);
+        if (popcorn_team.fn == NULL) break;
+        popcorn_team_cur = tid;
+        popcorn_team.fn(tid, popcorn_team.arg);
+        popcorn_team_cur = -1;
+        popcorn_barrier_wait(&popcorn_team.barrier, popcorn_team.nid[tid]);
+    }
+
+    popcorn_node_free(popcorn_team.sums[tid]);
+    popcorn_nodes_migrate(popcorn_team.region, POPCORN_NODE_HOME);
+    return NULL;
+}
+
+/* Start the team for 'region'. Returns its size; a team that cannot be
+ * started is left with the calling thread only. */
+int popcorn_team_init(int region) {
+    const char *env = getenv(POPCORN_TEAM_ENV);
+    int threads[MAX_POPCORN_NODES] = { 0 };
+    int size = env != NULL ? atoi(env) : 1;
+    int i, line;
+
+    if (size < 1) size = 1;
+    if (size > POPCORN_TEAM_MAX) size = POPCORN_TEAM_MAX;
+    popcorn_team.size = size;
+    popcorn_team.region = region;
+    if (size == 1) return 1;
+
+    if (popcorn_schedule_size() == 0) popcorn_schedule_load(NULL, &line);
+    if (pthread_barrier_init(&popcorn_team.started, NULL, size) != 0) {
+        popcorn_team.size = 1;
+        return 1;
+    }
+    popcorn_team_place(0);
+    for (i = 1; i < size; i++) {
+        if (pthread_create(&popcorn_team.threads[i], NULL, popcorn_team_worker,
+                           (void *)(intptr_t)i) != 0) {
+            perror("popcorn_team_init: pthread_create");
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&popcorn_team.started);
+    for (i = 0; i < size; i++) threads[popcorn_team.nid[i]]++;
+    if ((i = popcorn_barrier_init(&popcorn_team.barrier, threads)) != 0) {
+        errno = i;
+        perror("popcorn_team_init: popcorn_barrier_init");
+        exit(1);
+    }
+    pthread_barrier_wait(&popcorn_team.started);
+    return size;
+}
+
+void popcorn_team_fini(void) {
+    int i;
+
+    if (popcorn_team.size == 1) return;
+
+    popcorn_team.fn = NULL;
+    popcorn_barrier_wait(&popcorn_team.barrier, popcorn_team.nid[0]);
+    for (i = 1; i < popcorn_team.size; i++)
+        pthread_join(popcorn_team.threads[i], NULL);
+
+    popcorn_barrier_destroy(&popcorn_team.barrier);
+    pthread_barrier_destroy(&popcorn_team.started);
+    popcorn_node_free(popcorn_team.sums[0]);
+    popcorn_nodes_migrate(popcorn_team.region, POPCORN_NODE_HOME);
+    popcorn_team.size = 1;
+}
+
+int popcorn_team_size(void) {
+    return popcorn_team.size;
+}
+
+int popcorn_team_tid(void) {
+    return popcorn_team_cur;
+}
+
+/* Node thread 'tid' runs on. */
+int popcorn_team_node(int tid) {
+    return popcorn_team.size == 1 ? popcorn_nodes_current()
+                                  : popcorn_team.nid[tid];
+}
+
+/* Number of nodes the team runs on. */
+int popcorn_team_nodes(void) {
+    return popcorn_team.size == 1 ? 1 : popcorn_team.barrier.nodes;
+}
+
+void popcorn_team_run(void (*fn)(int tid, void *arg), void *arg) {
+    popcorn_team_cur = 0;
+    if (popcorn_team.size == 1) {
+        fn(0, arg);
+        popcorn_team_cur = -1;
+        return;
+    }
+
+    popcorn_team.fn = fn;
+    popcorn_team.arg = arg;
+    popcorn_barrier_wait(&popcorn_team.barrier, popcorn_team.nid[0]);
+    fn(0, arg);
+    popcorn_barrier_wait(&popcorn_team.barrier, popcorn_team.nid[0]);
+    popcorn_team_cur = -1;
+}
+
+void popcorn_team_barrier(void) {
+    int tid = popcorn_team_cur;
+
+    if (tid >= 0 && popcorn_team.size > 1)
+        popcorn_barrier_wait(&popcorn_team.barrier, popcorn_team.nid[tid]);
+}
+
+/* Sum (or, with 'max', the largest) of 'v' over the team, returned to
+ * every thread. */
+static double popcorn_team_reduce(double v, int max) {
+    int tid = popcorn_team_cur;
+    double r = 0.0;
+    int i;
+
+    if (tid < 0 || popcorn_team.size == 1) return v;
+
+    *popcorn_team.sums[tid] = v;
+    popcorn_barrier_wait(&popcorn_team.barrier, popcorn_team.nid[tid]);
+    for (i = 0; i < popcorn_team.size; i++) {
+        v = *popcorn_team.sums[i];
+        if (!max) r += v;
+        else if (i == 0 || v > r) r = v;
+    }
+    /* Nobody writes the next value before everyone has read this one. */
+    popcorn_barrier_wait(&popcorn_team.barrier, popcorn_team.nid[tid]);
+    return r;
+}
+
+double popcorn_team_sum(double v) {
+    return popcorn_team_reduce(v, 0);
+}
+
+double popcorn_team_max(double v) {
+    return popcorn_team_reduce(v, 1);
+}
+
+#endif /* POPCORN_RT_IMPLEMENTATION */